@@ -183,6 +183,18 @@ macro(COLMAP_ADD_TARGET_HELPER TARGET_NAME)
     endif()
 endmacro(COLMAP_ADD_TARGET_HELPER)
 
+# Compile the given source files for an instruction set of the runtime
+# dispatch, e.g. COLMAP_SET_SIMD_SOURCE_FLAGS(AVX2 foo_avx2.cc). The sources
+# must guard their code with the definition SIMD_<ISA>_ENABLED, since they are
+# compiled with the default flags if the compiler lacks the instruction set
+# or SIMD_DISPATCH_ENABLED is off. See src/util/simd.h.
+macro(COLMAP_SET_SIMD_SOURCE_FLAGS ISA)
+    if(SIMD_${ISA}_ENABLED)
+        set_source_files_properties(${ARGN} PROPERTIES
+            COMPILE_FLAGS "${SIMD_${ISA}_FLAGS}")
+    endif()
+endmacro(COLMAP_SET_SIMD_SOURCE_FLAGS)
+
 # Replacement for the normal add_library() command. The syntax remains the same
 # in that the first argument is the target name, and the following arguments
 # are the source files to use when building the target.
@@ -245,3 +257,15 @@ macro(COLMAP_CUDA_ADD_TEST TARGET_NAME)
         endif()
     endif()
 endmacro(COLMAP_CUDA_ADD_TEST)
+
+# Wrapper for benchmark executables
+macro(COLMAP_ADD_BENCHMARK TARGET_NAME)
+    if(BENCHMARKS_ENABLED)
+        # ${ARGN} will store the list of source files passed to this function.
+        add_executable(${TARGET_NAME} ${ARGN})
+        target_link_libraries(${TARGET_NAME}
+                              ${COLMAP_LIBRARIES}
+                              benchmark::benchmark)
+        COLMAP_ADD_TARGET_HELPER(${TARGET_NAME})
+    endif()
+endmacro(COLMAP_ADD_BENCHMARK)
@@ -0,0 +1,70 @@
+include(CheckCXXSourceCompiles)
+
+# Check which instruction sets the compiler can generate for the kernels with
+# runtime dispatch, see src/util/simd.h. In contrast to CheckSSEExtensions,
+# the checks only compile and do not run the code, since the CPU of the build
+# host is irrelevant for the nodes that run the binary. For every supported
+# instruction set, SIMD_<ISA>_ENABLED is defined and SIMD_<ISA>_FLAGS holds the
+# flags of its translation units, see COLMAP_SET_SIMD_SOURCE_FLAGS.
+
+set(SIMD_AVX2_ENABLED FALSE)
+set(SIMD_AVX512_ENABLED FALSE)
+
+if(CMAKE_SYSTEM_PROCESSOR MATCHES "^(x86_64|AMD64|amd64|x64)$")
+    if(IS_MSVC)
+        set(SIMD_AVX2_FLAGS "/arch:AVX2")
+        set(SIMD_AVX512_FLAGS "/arch:AVX512")
+    elseif(IS_GNU OR IS_CLANG)
+        set(SIMD_AVX2_FLAGS "-mavx2 -mfma")
+        set(SIMD_AVX512_FLAGS
+            "-mavx2 -mfma -mavx512f -mavx512bw -mavx512dq -mavx512vl")
+    endif()
+
+    ############################################################################
+    # AVX2 and FMA
+    ############################################################################
+
+    set(CMAKE_REQUIRED_FLAGS "${SIMD_AVX2_FLAGS}")
+
+    CHECK_CXX_SOURCE_COMPILES("
+            #include <immintrin.h>
+            int main() {
+              __m256d a = _mm256_set1_pd(2.0);
+              __m256d b = _mm256_fmadd_pd(a, a, a);
+              __m256i c = _mm256_madd_epi16(_mm256_set1_epi16(2),
+                                            _mm256_set1_epi16(3));
+              return static_cast<int>(_mm256_cvtsd_f64(b)) +
+                     _mm256_extract_epi32(c, 0);
+            }"
+            COMPILER_SUPPORTS_SIMD_AVX2)
+
+    ############################################################################
+    # AVX-512
+    ############################################################################
+
+    set(CMAKE_REQUIRED_FLAGS "${SIMD_AVX512_FLAGS}")
+
+    CHECK_CXX_SOURCE_COMPILES("
+            #include <immintrin.h>
+            int main() {
+              __m512d a = _mm512_set1_pd(2.0);
+              __m512i b = _mm512_madd_epi16(_mm512_set1_epi16(2),
+                                            _mm512_set1_epi16(3));
+              __mmask8 mask = _mm512_cmp_pd_mask(a, a, _CMP_EQ_OQ);
+              return static_cast<int>(_mm512_reduce_add_pd(a)) +
+                     _mm512_reduce_add_epi32(b) + mask;
+            }"
+            COMPILER_SUPPORTS_SIMD_AVX512)
+
+    set(CMAKE_REQUIRED_FLAGS)
+
+    if(COMPILER_SUPPORTS_SIMD_AVX2)
+        set(SIMD_AVX2_ENABLED TRUE)
+        add_definitions("-DSIMD_AVX2_ENABLED")
+    endif()
+
+    if(COMPILER_SUPPORTS_SIMD_AVX512)
+        set(SIMD_AVX512_ENABLED TRUE)
+        add_definitions("-DSIMD_AVX512_ENABLED")
+    endif()
+endif()
@@ -129,6 +129,24 @@ CHECK_CXX_SOURCE_RUNS("
         }"
         HAS_AVX_EXTENSION)
 
+################################################################################
+# AVX 2
+################################################################################
+
+if(IS_GNU OR IS_CLANG)
+    set(CMAKE_REQUIRED_FLAGS "-mavx2")
+endif()
+
+CHECK_CXX_SOURCE_RUNS("
+        #include <immintrin.h>
+        int main() {
+          __m256i a = _mm256_set1_epi16(2);
+          __m256i b = _mm256_set1_epi16(3);
+          __m256i c = _mm256_madd_epi16(a, b);
+          return _mm256_extract_epi32(c, 0) == 12 ? 0 : 1;
+        }"
+        HAS_AVX2_EXTENSION)
+
 ################################################################################
 # Setup the compile flags
 ################################################################################
@@ -0,0 +1,279 @@
+# COLMAP - Structure-from-Motion and Multi-View Stereo.
+# Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# This script replays the mapper and the postprocessor on two-body datasets,
+# e.g. the published TBSfM datasets and the ETH3D motion_1 to motion_4
+# sequences, each a folder with the database db.db and the takes.txt. Every
+# dataset is reconstructed by the two_body_regression driver with a fixed
+# random seed. The wall time, the peak resident set size and the quality of
+# the models are compared to the baseline of a previous build and regressions
+# beyond the tolerances are reported, with a non-zero exit code.
+#
+# Record a baseline with --update_baseline, e.g.:
+#
+#    python two_body_regression.py \
+#        --driver_path build/src/tools/two_body_regression \
+#        --colmap_path build/src/exe/colmap --data_path /data/two_body \
+#        --output_path /tmp/regression --baseline_path baseline.json \
+#        --update_baseline
+#
+# and compare later builds by running the same command without it.
+
+import os
+import sys
+import json
+import argparse
+import subprocess
+
+
+COMMANDS = ["mapper", "postprocessor"]
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--driver_path", required=True,
+                        help="The two_body_regression executable")
+    parser.add_argument("--colmap_path", required=True,
+                        help="The colmap executable of the tested build")
+    parser.add_argument("--data_path", required=True,
+                        help="The folder with one folder per dataset")
+    parser.add_argument("--datasets", nargs="+", default=[],
+                        help="The datasets to replay, by default all folders "
+                             "of data_path with db.db and takes.txt")
+    parser.add_argument("--output_path", required=True)
+    parser.add_argument("--baseline_path", required=True)
+    parser.add_argument("--update_baseline", action="store_true",
+                        help="Write the results as the new baseline instead "
+                             "of comparing them")
+    parser.add_argument("--random_seed", type=int, default=0)
+    parser.add_argument("--num_threads", type=int, default=-1)
+    parser.add_argument("--num_repetitions", type=int, default=1,
+                        help="The wall time and peak memory of a dataset are "
+                             "the medians of this many runs")
+    parser.add_argument("--max_wall_time_increase", type=float, default=0.1,
+                        help="Relative to the baseline")
+    parser.add_argument("--max_peak_rss_increase", type=float, default=0.1,
+                        help="Relative to the baseline")
+    parser.add_argument("--max_reg_images_decrease", type=int, default=0)
+    parser.add_argument("--max_points_decrease", type=float, default=0.02,
+                        help="Relative to the baseline")
+    parser.add_argument("--max_reproj_error_increase", type=float,
+                        default=0.05, help="Relative to the baseline")
+    parser.add_argument("--min_stage_seconds", type=float, default=1.0,
+                        help="Stages that took less time in the baseline are "
+                             "not listed as the causes of a slowdown")
+    args = parser.parse_args()
+    return args
+
+
+def find_datasets(data_path):
+    datasets = []
+    for name in sorted(os.listdir(data_path)):
+        path = os.path.join(data_path, name)
+        if os.path.isfile(os.path.join(path, "db.db")) and \
+                os.path.isfile(os.path.join(path, "takes.txt")):
+            datasets.append(name)
+    return datasets
+
+
+def median(values):
+    values = sorted(values)
+    num_values = len(values)
+    if num_values % 2 == 1:
+        return values[num_values // 2]
+    return 0.5 * (values[num_values // 2 - 1] + values[num_values // 2])
+
+
+def run_dataset(args, dataset):
+    reports = []
+    for repetition in range(args.num_repetitions):
+        run_path = os.path.join(args.output_path, dataset,
+                                "run{}".format(repetition))
+        report_path = os.path.join(args.output_path, dataset,
+                                   "run{}.json".format(repetition))
+        return_code = subprocess.call([
+            args.driver_path,
+            "--colmap_path", args.colmap_path,
+            "--dataset_path", os.path.join(args.data_path, dataset),
+            "--output_path", run_path,
+            "--report_path", report_path,
+            "--random_seed", str(args.random_seed),
+            "--num_threads", str(args.num_threads)])
+        if return_code != 0 or not os.path.isfile(report_path):
+            print("ERROR: Reconstruction of {} failed.".format(dataset))
+            return None
+        with open(report_path, "r") as fid:
+            reports.append(json.load(fid))
+
+    # The quality does not depend on the repetition for a fixed seed, up to
+    # the scheduling of the threads, so it is taken from the first run.
+    result = {}
+    for command in COMMANDS:
+        first = reports[0][command]
+        stages = {}
+        if first["resources"] is not None:
+            for stage in first["resources"]["stages"]:
+                stages[stage["name"]] = median(
+                    [find_stage_seconds(report[command], stage["name"])
+                     for report in reports])
+        result[command] = {
+            "wall_seconds": median([report[command]["wall_seconds"]
+                                    for report in reports]),
+            "peak_rss_bytes": median([report[command]["peak_rss_bytes"]
+                                      for report in reports]),
+            "num_reg_images": first["num_reg_images"],
+            "num_points3D": first["num_points3D"],
+            "mean_reprojection_error": first["mean_reprojection_error"],
+            "stages": stages,
+        }
+    return result
+
+
+def find_stage_seconds(command_report, name):
+    if command_report["resources"] is None:
+        return 0
+    for stage in command_report["resources"]["stages"]:
+        if stage["name"] == name:
+            return stage["wall_seconds"]
+    return 0
+
+
+def relative_change(value, baseline_value):
+    if baseline_value == 0:
+        return 0 if value == 0 else float("inf")
+    return float(value - baseline_value) / baseline_value
+
+
+def compare_command(args, dataset, command, result, baseline):
+    regressions = []
+
+    def check(name, failed, message):
+        status = "REGRESSION" if failed else "ok"
+        print("  {:<14} {:<24} {:<52} {}".format(
+            command, name, message, status))
+        if failed:
+            regressions.append("{}/{}/{}".format(dataset, command, name))
+
+    change = relative_change(result["wall_seconds"], baseline["wall_seconds"])
+    check("wall_seconds", change > args.max_wall_time_increase,
+          "{:.2f}s vs. {:.2f}s ({:+.1%})".format(
+              result["wall_seconds"], baseline["wall_seconds"], change))
+    if change > args.max_wall_time_increase:
+        print_stage_slowdowns(args, result["stages"], baseline["stages"])
+
+    change = relative_change(result["peak_rss_bytes"],
+                             baseline["peak_rss_bytes"])
+    check("peak_rss_bytes", change > args.max_peak_rss_increase,
+          "{:.1f}MB vs. {:.1f}MB ({:+.1%})".format(
+              result["peak_rss_bytes"] / 1024.0 ** 2,
+              baseline["peak_rss_bytes"] / 1024.0 ** 2, change))
+
+    decrease = baseline["num_reg_images"] - result["num_reg_images"]
+    check("num_reg_images", decrease > args.max_reg_images_decrease,
+          "{} vs. {}".format(result["num_reg_images"],
+                             baseline["num_reg_images"]))
+
+    change = relative_change(result["num_points3D"], baseline["num_points3D"])
+    check("num_points3D", -change > args.max_points_decrease,
+          "{} vs. {} ({:+.1%})".format(result["num_points3D"],
+                                       baseline["num_points3D"], change))
+
+    change = relative_change(result["mean_reprojection_error"],
+                             baseline["mean_reprojection_error"])
+    check("mean_reproj_error", change > args.max_reproj_error_increase,
+          "{:.4f}px vs. {:.4f}px ({:+.1%})".format(
+              result["mean_reprojection_error"],
+              baseline["mean_reprojection_error"], change))
+
+    return regressions
+
+
+def print_stage_slowdowns(args, stages, baseline_stages):
+    slowdowns = []
+    for name, baseline_seconds in baseline_stages.items():
+        if baseline_seconds < args.min_stage_seconds or name not in stages:
+            continue
+        change = relative_change(stages[name], baseline_seconds)
+        if change > args.max_wall_time_increase:
+            slowdowns.append((stages[name] - baseline_seconds, name, change))
+    for delta, name, change in sorted(slowdowns, reverse=True):
+        print("      stage {}: {:+.2f}s ({:+.1%})".format(name, delta, change))
+
+
+def main():
+    args = parse_args()
+
+    args.driver_path = os.path.abspath(args.driver_path)
+    args.colmap_path = os.path.abspath(args.colmap_path)
+    args.data_path = os.path.abspath(args.data_path)
+    if not os.path.exists(args.output_path):
+        os.makedirs(args.output_path)
+
+    datasets = args.datasets or find_datasets(args.data_path)
+    if not datasets:
+        print("ERROR: No datasets found in {}.".format(args.data_path))
+        return 1
+
+    results = {}
+    failed_datasets = []
+    for dataset in datasets:
+        result = run_dataset(args, dataset)
+        if result is None:
+            failed_datasets.append(dataset)
+        else:
+            results[dataset] = result
+
+    with open(os.path.join(args.output_path, "results.json"), "w") as fid:
+        json.dump(results, fid, indent=2, sort_keys=True)
+
+    if args.update_baseline:
+        if failed_datasets:
+            print("ERROR: Not updating the baseline, the reconstruction of {} "
+                  "failed.".format(", ".join(failed_datasets)))
+            return 1
+        with open(args.baseline_path, "w") as fid:
+            json.dump(results, fid, indent=2, sort_keys=True)
+        print("Wrote baseline of {} datasets to {}.".format(
+            len(results), args.baseline_path))
+        return 0
+
+    if not os.path.isfile(args.baseline_path):
+        print("ERROR: Baseline {} does not exist, record it with "
+              "--update_baseline.".format(args.baseline_path))
+        return 1
+    with open(args.baseline_path, "r") as fid:
+        baselines = json.load(fid)
+
+    regressions = ["{}/failed".format(dataset) for dataset in failed_datasets]
+    for dataset in sorted(results.keys()):
+        print(dataset)
+        if dataset not in baselines:
+            print("  no baseline")
+            continue
+        for command in COMMANDS:
+            regressions += compare_command(args, dataset, command,
+                                           results[dataset][command],
+                                           baselines[dataset][command])
+
+    if regressions:
+        print("Regressions: {}".format(", ".join(regressions)))
+        return 1
+    print("No regressions.")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
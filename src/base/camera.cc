@@ -20,6 +20,7 @@
 
 #include "util/logging.h"
 #include "util/misc.h"
+#include "util/scratch.h"
 
 namespace colmap {
 
@@ -204,6 +205,52 @@ Eigen::Vector2d Camera::WorldToImage(const Eigen::Vector2d& world_point) const {
   return image_point;
 }
 
+namespace {
+
+// Converts the points to structure-of-arrays layout, applies the batch
+// transform of the camera model, and converts the result back.
+template <typename Transform>
+void TransformPoints(const std::vector<Eigen::Vector2d>& points,
+                     std::vector<Eigen::Vector2d>* transformed_points,
+                     Transform transform) {
+  const size_t num_points = points.size();
+  ScratchVector<double> coords_buffer(2 * num_points);
+  std::vector<double>& coords = *coords_buffer;
+  double* xs = coords.data();
+  double* ys = coords.data() + num_points;
+  for (size_t i = 0; i < num_points; ++i) {
+    xs[i] = points[i](0);
+    ys[i] = points[i](1);
+  }
+
+  transform(num_points, xs, ys);
+
+  transformed_points->resize(num_points);
+  for (size_t i = 0; i < num_points; ++i) {
+    (*transformed_points)[i] = Eigen::Vector2d(xs[i], ys[i]);
+  }
+}
+
+}  // namespace
+
+void Camera::ImageToWorld(const std::vector<Eigen::Vector2d>& image_points,
+                          std::vector<Eigen::Vector2d>* world_points) const {
+  TransformPoints(image_points, world_points,
+                  [this](const size_t num_points, double* xs, double* ys) {
+                    CameraModelImageToWorld(model_id_, params_, num_points, xs,
+                                            ys, xs, ys);
+                  });
+}
+
+void Camera::WorldToImage(const std::vector<Eigen::Vector2d>& world_points,
+                          std::vector<Eigen::Vector2d>* image_points) const {
+  TransformPoints(world_points, image_points,
+                  [this](const size_t num_points, double* us, double* vs) {
+                    CameraModelWorldToImage(model_id_, params_, num_points, us,
+                                            vs, us, vs);
+                  });
+}
+
 void Camera::Rescale(const double scale) {
   CHECK_GT(scale, 0.0);
   const double scale_x =
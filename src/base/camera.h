@@ -122,6 +122,13 @@ class Camera {
   // Project point from world / infinity to image plane.
   Eigen::Vector2d WorldToImage(const Eigen::Vector2d& world_point) const;
 
+  // Batch variants of `ImageToWorld` and `WorldToImage`, which dispatch on
+  // the camera model once for all points. The output may alias the input.
+  void ImageToWorld(const std::vector<Eigen::Vector2d>& image_points,
+                    std::vector<Eigen::Vector2d>* world_points) const;
+  void WorldToImage(const std::vector<Eigen::Vector2d>& world_points,
+                    std::vector<Eigen::Vector2d>* image_points) const;
+
   // Rescale camera dimensions and accordingly the focal length and
   // and the principal point.
   void Rescale(const double scale);
@@ -17,6 +17,7 @@
 #ifndef COLMAP_SRC_BASE_CAMERA_MODELS_H_
 #define COLMAP_SRC_BASE_CAMERA_MODELS_H_
 
+#include <algorithm>
 #include <cfloat>
 #include <string>
 #include <vector>
@@ -158,6 +159,18 @@ struct BaseCameraModel {
 
   template <typename T>
   static inline void IterativeUndistortion(const T* params, T* u, T* v);
+
+  // Batch variants of `WorldToImage` and `ImageToWorld` over coordinates in
+  // structure-of-arrays layout. The parameters are copied to the stack, so
+  // that the compiler can prove they do not alias the output and vectorize
+  // the loop for the models without iterative undistortion. The input and
+  // output arrays may be identical.
+  template <typename T>
+  static inline void BatchWorldToImage(const T* params, const size_t num_points,
+                                       const T* u, const T* v, T* x, T* y);
+  template <typename T>
+  static inline void BatchImageToWorld(const T* params, const size_t num_points,
+                                       const T* x, const T* y, T* u, T* v);
 };
 
 // Simple Pinhole camera model.
@@ -434,6 +447,24 @@ inline void CameraModelImageToWorld(const int model_id,
                                     const double x, const double y, double* u,
                                     double* v);
 
+// Batch variants of `CameraModelWorldToImage` and `CameraModelImageToWorld`,
+// which dispatch on the camera model once for all points instead of once per
+// point.
+//
+// @param model_id      Unique identifier of camera model.
+// @param params        Array of camera parameters.
+// @param num_points    Number of points in each coordinate array.
+// @param u, v          Arrays of coordinates in camera system as (u, v, 1).
+// @param x, y          Arrays of image coordinates in pixels.
+inline void CameraModelWorldToImage(const int model_id,
+                                    const std::vector<double>& params,
+                                    const size_t num_points, const double* u,
+                                    const double* v, double* x, double* y);
+inline void CameraModelImageToWorld(const int model_id,
+                                    const std::vector<double>& params,
+                                    const size_t num_points, const double* x,
+                                    const double* y, double* u, double* v);
+
 // Convert pixel threshold in image plane to world space by dividing
 // the threshold through the mean focal length.
 //
@@ -572,6 +603,32 @@ void BaseCameraModel<CameraModel>::IterativeUndistortion(const T* params, T* u,
   *v = x(1);
 }
 
+template <typename CameraModel>
+template <typename T>
+void BaseCameraModel<CameraModel>::BatchWorldToImage(const T* params,
+                                                     const size_t num_points,
+                                                     const T* u, const T* v,
+                                                     T* x, T* y) {
+  T model_params[CameraModel::kNumParams];
+  std::copy(params, params + CameraModel::kNumParams, model_params);
+  for (size_t i = 0; i < num_points; ++i) {
+    CameraModel::WorldToImage(model_params, u[i], v[i], &x[i], &y[i]);
+  }
+}
+
+template <typename CameraModel>
+template <typename T>
+void BaseCameraModel<CameraModel>::BatchImageToWorld(const T* params,
+                                                     const size_t num_points,
+                                                     const T* x, const T* y,
+                                                     T* u, T* v) {
+  T model_params[CameraModel::kNumParams];
+  std::copy(params, params + CameraModel::kNumParams, model_params);
+  for (size_t i = 0; i < num_points; ++i) {
+    CameraModel::ImageToWorld(model_params, x[i], y[i], &u[i], &v[i]);
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // SimplePinholeCameraModel
 
@@ -1497,6 +1554,38 @@ void CameraModelImageToWorld(const int model_id,
   }
 }
 
+void CameraModelWorldToImage(const int model_id,
+                             const std::vector<double>& params,
+                             const size_t num_points, const double* u,
+                             const double* v, double* x, double* y) {
+  switch (model_id) {
+#define CAMERA_MODEL_CASE(CameraModel)                                     \
+  case CameraModel::kModelId:                                              \
+    CameraModel::BatchWorldToImage(params.data(), num_points, u, v, x, y); \
+    break;
+
+    CAMERA_MODEL_SWITCH_CASES
+
+#undef CAMERA_MODEL_CASE
+  }
+}
+
+void CameraModelImageToWorld(const int model_id,
+                             const std::vector<double>& params,
+                             const size_t num_points, const double* x,
+                             const double* y, double* u, double* v) {
+  switch (model_id) {
+#define CAMERA_MODEL_CASE(CameraModel)                                     \
+  case CameraModel::kModelId:                                              \
+    CameraModel::BatchImageToWorld(params.data(), num_points, x, y, u, v); \
+    break;
+
+    CAMERA_MODEL_SWITCH_CASES
+
+#undef CAMERA_MODEL_CASE
+  }
+}
+
 double CameraModelImageToWorldThreshold(const int model_id,
                                         const std::vector<double>& params,
                                         const double threshold) {
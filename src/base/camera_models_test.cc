@@ -47,6 +47,36 @@ void TestImageToWorldToImage(const std::vector<double> params, const double x0,
   BOOST_CHECK_LT(std::abs(y - y0), 1e-6);
 }
 
+template <typename CameraModel>
+void TestBatchWorldToImageToWorld(const std::vector<double>& params) {
+  std::vector<double> us, vs;
+  for (double u = -0.5; u <= 0.5; u += 0.1) {
+    for (double v = -0.5; v <= 0.5; v += 0.1) {
+      us.push_back(u);
+      vs.push_back(v);
+    }
+  }
+
+  const size_t num_points = us.size();
+  std::vector<double> xs(num_points), ys(num_points);
+  CameraModelWorldToImage(CameraModel::model_id, params, num_points, us.data(),
+                          vs.data(), xs.data(), ys.data());
+  std::vector<double> uus(xs), vvs(ys);
+  CameraModelImageToWorld(CameraModel::model_id, params, num_points,
+                          uus.data(), vvs.data(), uus.data(), vvs.data());
+  for (size_t i = 0; i < num_points; ++i) {
+    double x, y, u, v;
+    CameraModel::WorldToImage(params.data(), us[i], vs[i], &x, &y);
+    BOOST_CHECK_LT(std::abs(xs[i] - x), 1e-9);
+    BOOST_CHECK_LT(std::abs(ys[i] - y), 1e-9);
+    CameraModel::ImageToWorld(params.data(), xs[i], ys[i], &u, &v);
+    BOOST_CHECK_LT(std::abs(uus[i] - u), 1e-9);
+    BOOST_CHECK_LT(std::abs(vvs[i] - v), 1e-9);
+    BOOST_CHECK_LT(std::abs(uus[i] - us[i]), 1e-6);
+    BOOST_CHECK_LT(std::abs(vvs[i] - vs[i]), 1e-6);
+  }
+}
+
 template <typename CameraModel>
 void TestModel(const std::vector<double>& params) {
   BOOST_CHECK(CameraModelVerifyParams(CameraModel::model_id, params));
@@ -110,6 +140,8 @@ void TestModel(const std::vector<double>& params) {
     }
   }
 
+  TestBatchWorldToImageToWorld<CameraModel>(params);
+
   const auto pp_idxs = CameraModel::principal_point_idxs;
   TestImageToWorldToImage<CameraModel>(params, params[pp_idxs.at(0)],
                                        params[pp_idxs.at(1)]);
@@ -289,6 +289,35 @@ BOOST_AUTO_TEST_CASE(TestWorldToImage) {
   BOOST_CHECK_EQUAL(camera.WorldToImage(Eigen::Vector2d(-0.5, -0.5))(1), 0.0);
 }
 
+BOOST_AUTO_TEST_CASE(TestBatchImageToWorldToImage) {
+  Camera camera;
+  camera.InitializeWithName("SIMPLE_RADIAL", 100.0, 200, 100);
+  camera.Params(3) = 0.1;
+  std::vector<Eigen::Vector2d> image_points;
+  for (double x = 0; x <= 200; x += 25) {
+    for (double y = 0; y <= 100; y += 25) {
+      image_points.emplace_back(x, y);
+    }
+  }
+
+  std::vector<Eigen::Vector2d> world_points;
+  camera.ImageToWorld(image_points, &world_points);
+  BOOST_CHECK_EQUAL(world_points.size(), image_points.size());
+  for (size_t i = 0; i < image_points.size(); ++i) {
+    BOOST_CHECK_LT(
+        (world_points[i] - camera.ImageToWorld(image_points[i])).norm(), 1e-9);
+  }
+
+  std::vector<Eigen::Vector2d> points = world_points;
+  camera.WorldToImage(points, &points);
+  for (size_t i = 0; i < image_points.size(); ++i) {
+    BOOST_CHECK_LT((points[i] - image_points[i]).norm(), 1e-6);
+  }
+
+  camera.ImageToWorld(std::vector<Eigen::Vector2d>(), &points);
+  BOOST_CHECK(points.empty());
+}
+
 BOOST_AUTO_TEST_CASE(TestRescale) {
   Camera camera;
   camera.InitializeWithName("SIMPLE_PINHOLE", 1.0, 1, 1);
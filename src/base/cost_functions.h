@@ -17,6 +17,9 @@
 #ifndef COLMAP_SRC_BASE_COST_FUNCTIONS_H_
 #define COLMAP_SRC_BASE_COST_FUNCTIONS_H_
 
+#include <cmath>
+#include <limits>
+
 #include <Eigen/Core>
 
 #include <ceres/ceres.h>
@@ -198,6 +201,192 @@ class RigBundleAdjustmentCostFunction {
   const double y_;
 };
 
+// Rotate a point by an angle-axis rotation as ceres::AngleAxisRotatePoint and
+// return the rotation matrix and, if not null, the Jacobian of the rotated
+// point with respect to the angle-axis rotation.
+inline Eigen::Vector3d AngleAxisRotatePointWithJacobian(
+    const double* angle_axis, const double* point, Eigen::Matrix3d* R,
+    Eigen::Matrix3d* J_angle_axis) {
+  const Eigen::Map<const Eigen::Vector3d> w(angle_axis);
+  const Eigen::Map<const Eigen::Vector3d> X(point);
+
+  Eigen::Matrix3d w_x;
+  w_x << 0, -w(2), w(1), w(2), 0, -w(0), -w(1), w(0), 0;
+  Eigen::Matrix3d X_x;
+  X_x << 0, -X(2), X(1), X(2), 0, -X(0), -X(1), X(0), 0;
+
+  const double theta2 = w.squaredNorm();
+  if (theta2 > std::numeric_limits<double>::epsilon()) {
+    const double theta = std::sqrt(theta2);
+    const double cos_theta = std::cos(theta);
+    const double sin_theta = std::sin(theta);
+    // Rodrigues' formula and the right Jacobian of the exponential map, i.e.
+    // d(R * X) / dw = -R * [X]_x * J_r(w).
+    *R = Eigen::Matrix3d::Identity() + sin_theta / theta * w_x +
+         (1 - cos_theta) / theta2 * w_x * w_x;
+    if (J_angle_axis) {
+      const Eigen::Matrix3d J_r = Eigen::Matrix3d::Identity() -
+                                  (1 - cos_theta) / theta2 * w_x +
+                                  (theta - sin_theta) / (theta2 * theta) *
+                                      w_x * w_x;
+      *J_angle_axis = -*R * X_x * J_r;
+    }
+  } else {
+    // First order approximation near the identity, as in Ceres.
+    *R = Eigen::Matrix3d::Identity() + w_x;
+    if (J_angle_axis) {
+      *J_angle_axis = -X_x;
+    }
+  }
+
+  return *R * X;
+}
+
+// Two-body bundle adjustment cost function for variable camera and point
+// parameters. The camera is parameterized by its angle-axis rotation, its
+// translation and its focal length and the observation is relative to the
+// principal point. The Jacobians are analytic.
+class TwoBodyCostFunction : public ceres::SizedCostFunction<2, 7, 3> {
+ public:
+  explicit TwoBodyCostFunction(const Eigen::Vector2d& point2D)
+      : x_(point2D(0)), y_(point2D(1)) {}
+
+  static ceres::CostFunction* Create(const Eigen::Vector2d& point2D) {
+    return new TwoBodyCostFunction(point2D);
+  }
+
+  bool Evaluate(double const* const* parameters, double* residuals,
+                double** jacobians) const override {
+    const double* camera = parameters[0];
+    const double* point3D = parameters[1];
+
+    const bool compute_jacobians = jacobians != nullptr;
+    Eigen::Matrix3d R;
+    Eigen::Matrix3d J_angle_axis;
+    const Eigen::Vector3d projection =
+        AngleAxisRotatePointWithJacobian(
+            camera, point3D, &R,
+            compute_jacobians && jacobians[0] ? &J_angle_axis : nullptr) +
+        Eigen::Map<const Eigen::Vector3d>(camera + 3);
+
+    Eigen::Matrix<double, 2, 3> J_projection;
+    Project(projection, camera[6], x_, y_, residuals,
+            compute_jacobians ? &J_projection : nullptr);
+    if (!compute_jacobians) {
+      return true;
+    }
+
+    if (jacobians[0]) {
+      Eigen::Map<Eigen::Matrix<double, 2, 7, Eigen::RowMajor>> J(jacobians[0]);
+      J.leftCols<3>() = J_projection * J_angle_axis;
+      J.middleCols<3>(3) = J_projection;
+      J.col(6) << projection(0) / projection(2), projection(1) / projection(2);
+    }
+
+    if (jacobians[1]) {
+      Eigen::Map<Eigen::Matrix<double, 2, 3, Eigen::RowMajor>> J(jacobians[1]);
+      J = J_projection * R;
+    }
+
+    return true;
+  }
+
+  // Re-projection error of the point in the camera frame with the focal length
+  // and, if not null, its Jacobian with respect to the point.
+  static void Project(const Eigen::Vector3d& projection, const double focal,
+                      const double x, const double y, double* residuals,
+                      Eigen::Matrix<double, 2, 3>* J_projection) {
+    const double inv_z = 1 / projection(2);
+    const double xp = projection(0) * inv_z;
+    const double yp = projection(1) * inv_z;
+    residuals[0] = focal * xp - x;
+    residuals[1] = focal * yp - y;
+    if (J_projection) {
+      const double focal_inv_z = focal * inv_z;
+      *J_projection << focal_inv_z, 0, -focal_inv_z * xp, 0, focal_inv_z,
+          -focal_inv_z * yp;
+    }
+  }
+
+ private:
+  const double x_;
+  const double y_;
+};
+
+// Two-body bundle adjustment cost function for the object points, which are
+// observed in a take with a different object motion than the one of the
+// reference take, in which the points are given. The point is first moved by
+// the angle-axis rotation and the translation of the object motion of the take
+// and then projected into the camera as in `TwoBodyCostFunction`. The
+// Jacobians are analytic.
+class TwoBodyObjectCostFunction : public ceres::SizedCostFunction<2, 7, 3, 6> {
+ public:
+  explicit TwoBodyObjectCostFunction(const Eigen::Vector2d& point2D)
+      : x_(point2D(0)), y_(point2D(1)) {}
+
+  static ceres::CostFunction* Create(const Eigen::Vector2d& point2D) {
+    return new TwoBodyObjectCostFunction(point2D);
+  }
+
+  bool Evaluate(double const* const* parameters, double* residuals,
+                double** jacobians) const override {
+    const double* camera = parameters[0];
+    const double* point3D = parameters[1];
+    const double* motion = parameters[2];
+
+    const bool compute_jacobians = jacobians != nullptr;
+    Eigen::Matrix3d R_motion;
+    Eigen::Matrix3d J_motion_angle_axis;
+    const Eigen::Vector3d moved_point3D =
+        AngleAxisRotatePointWithJacobian(
+            motion, point3D, &R_motion,
+            compute_jacobians && jacobians[2] ? &J_motion_angle_axis
+                                              : nullptr) +
+        Eigen::Map<const Eigen::Vector3d>(motion + 3);
+
+    Eigen::Matrix3d R;
+    Eigen::Matrix3d J_angle_axis;
+    const Eigen::Vector3d projection =
+        AngleAxisRotatePointWithJacobian(
+            camera, moved_point3D.data(), &R,
+            compute_jacobians && jacobians[0] ? &J_angle_axis : nullptr) +
+        Eigen::Map<const Eigen::Vector3d>(camera + 3);
+
+    Eigen::Matrix<double, 2, 3> J_projection;
+    TwoBodyCostFunction::Project(projection, camera[6], x_, y_, residuals,
+                                 compute_jacobians ? &J_projection : nullptr);
+    if (!compute_jacobians) {
+      return true;
+    }
+
+    if (jacobians[0]) {
+      Eigen::Map<Eigen::Matrix<double, 2, 7, Eigen::RowMajor>> J(jacobians[0]);
+      J.leftCols<3>() = J_projection * J_angle_axis;
+      J.middleCols<3>(3) = J_projection;
+      J.col(6) << projection(0) / projection(2), projection(1) / projection(2);
+    }
+
+    const Eigen::Matrix<double, 2, 3> J_moved_point3D = J_projection * R;
+
+    if (jacobians[1]) {
+      Eigen::Map<Eigen::Matrix<double, 2, 3, Eigen::RowMajor>> J(jacobians[1]);
+      J = J_moved_point3D * R_motion;
+    }
+
+    if (jacobians[2]) {
+      Eigen::Map<Eigen::Matrix<double, 2, 6, Eigen::RowMajor>> J(jacobians[2]);
+      J.leftCols<3>() = J_moved_point3D * J_motion_angle_axis;
+      J.rightCols<3>() = J_moved_point3D;
+    }
+
+    return true;
+  }
+
+ private:
+  const double x_;
+  const double y_;
+};
+
 // Cost function for refining two-view geometry based on the Sampson-Error.
 //
 // First pose is assumed to be located at the origin with 0 rotation. Second
@@ -135,3 +135,102 @@ BOOST_AUTO_TEST_CASE(TestRelativePoseCostFunction) {
   BOOST_CHECK(cost_function->Evaluate(parameters, residuals, nullptr));
   BOOST_CHECK_EQUAL(residuals[0], 0.5);
 }
+
+// Compare the analytic Jacobians of the cost function with central
+// differences of its residuals.
+void CheckTwoBodyJacobians(const ceres::CostFunction& cost_function,
+                           const std::vector<std::vector<double>>& blocks) {
+  std::vector<std::vector<double>> params = blocks;
+  std::vector<const double*> parameters;
+  std::vector<std::vector<double>> jacobians;
+  std::vector<double*> jacobian_ptrs;
+  for (const auto& block : params) {
+    parameters.push_back(block.data());
+    jacobians.emplace_back(2 * block.size());
+  }
+  for (auto& jacobian : jacobians) {
+    jacobian_ptrs.push_back(jacobian.data());
+  }
+
+  double residuals[2];
+  BOOST_CHECK(cost_function.Evaluate(parameters.data(), residuals,
+                                     jacobian_ptrs.data()));
+
+  const double kEps = 1e-6;
+  for (size_t i = 0; i < params.size(); ++i) {
+    for (size_t j = 0; j < params[i].size(); ++j) {
+      double residuals1[2];
+      double residuals2[2];
+      const double value = params[i][j];
+      params[i][j] = value + kEps;
+      cost_function.Evaluate(parameters.data(), residuals1, nullptr);
+      params[i][j] = value - kEps;
+      cost_function.Evaluate(parameters.data(), residuals2, nullptr);
+      params[i][j] = value;
+      for (size_t k = 0; k < 2; ++k) {
+        const double numeric = (residuals1[k] - residuals2[k]) / (2 * kEps);
+        BOOST_CHECK_SMALL(jacobians[i][k * params[i].size() + j] - numeric,
+                          1e-5);
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestTwoBodyCostFunction) {
+  std::unique_ptr<ceres::CostFunction> cost_function(
+      TwoBodyCostFunction::Create(Eigen::Vector2d::Zero()));
+  double camera[7] = {0, 0, 0, 0, 0, 0, 1};
+  double point3D[3] = {0, 0, 1};
+  double residuals[2];
+  const double* parameters[2] = {camera, point3D};
+  BOOST_CHECK(cost_function->Evaluate(parameters, residuals, nullptr));
+  BOOST_CHECK_EQUAL(residuals[0], 0);
+  BOOST_CHECK_EQUAL(residuals[1], 0);
+
+  point3D[1] = 1;
+  camera[6] = 2;
+  BOOST_CHECK(cost_function->Evaluate(parameters, residuals, nullptr));
+  BOOST_CHECK_EQUAL(residuals[0], 0);
+  BOOST_CHECK_EQUAL(residuals[1], 2);
+
+  // Rotation by 90 degrees around the z-axis.
+  camera[2] = M_PI / 2;
+  BOOST_CHECK(cost_function->Evaluate(parameters, residuals, nullptr));
+  BOOST_CHECK_CLOSE(residuals[0], -2, 1e-6);
+  BOOST_CHECK_SMALL(residuals[1], 1e-6);
+
+  cost_function.reset(TwoBodyCostFunction::Create(Eigen::Vector2d(3, -4)));
+  CheckTwoBodyJacobians(*cost_function, {{0.1, -0.2, 0.3, 0.5, -0.1, 4, 800},
+                                         {0.4, 1.1, 2}});
+  CheckTwoBodyJacobians(*cost_function,
+                        {{0, 0, 0, 0.5, -0.1, 4, 800}, {0.4, 1.1, 2}});
+}
+
+BOOST_AUTO_TEST_CASE(TestTwoBodyObjectCostFunction) {
+  std::unique_ptr<ceres::CostFunction> cost_function(
+      TwoBodyObjectCostFunction::Create(Eigen::Vector2d::Zero()));
+  double camera[7] = {0, 0, 0, 0, 0, 0, 1};
+  double point3D[3] = {0, 0, 1};
+  double motion[6] = {0, 0, 0, 0, 0, 0};
+  double residuals[2];
+  const double* parameters[3] = {camera, point3D, motion};
+  BOOST_CHECK(cost_function->Evaluate(parameters, residuals, nullptr));
+  BOOST_CHECK_EQUAL(residuals[0], 0);
+  BOOST_CHECK_EQUAL(residuals[1], 0);
+
+  motion[4] = 1;
+  camera[6] = 2;
+  BOOST_CHECK(cost_function->Evaluate(parameters, residuals, nullptr));
+  BOOST_CHECK_EQUAL(residuals[0], 0);
+  BOOST_CHECK_EQUAL(residuals[1], 2);
+
+  cost_function.reset(
+      TwoBodyObjectCostFunction::Create(Eigen::Vector2d(3, -4)));
+  CheckTwoBodyJacobians(*cost_function,
+                        {{0.1, -0.2, 0.3, 0.5, -0.1, 4, 800},
+                         {0.4, 1.1, 2},
+                         {-0.3, 0.2, 0.1, 0.2, 0.3, -1}});
+  CheckTwoBodyJacobians(*cost_function, {{0, 0, 0, 0.5, -0.1, 4, 800},
+                                         {0.4, 1.1, 2},
+                                         {0, 0, 0, 0.2, 0.3, -1}});
+}
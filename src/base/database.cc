@@ -154,6 +154,63 @@ MatrixType ReadDynamicMatrixBlob(sqlite3_stmt* sql_stmt, const int rc,
   return matrix;
 }
 
+// Map the blob of a row without copying it, which is only valid until the
+// statement is stepped or reset.
+template <typename MatrixType>
+Eigen::Map<const MatrixType> MapDynamicMatrixBlob(sqlite3_stmt* sql_stmt,
+                                                  const int rc,
+                                                  const int col) {
+  CHECK_GE(col, 0);
+
+  typename MatrixType::Index rows =
+      (MatrixType::RowsAtCompileTime == Eigen::Dynamic)
+          ? 0
+          : MatrixType::RowsAtCompileTime;
+  typename MatrixType::Index cols =
+      (MatrixType::ColsAtCompileTime == Eigen::Dynamic)
+          ? 0
+          : MatrixType::ColsAtCompileTime;
+  const typename MatrixType::Scalar* data = nullptr;
+
+  if (rc == SQLITE_ROW) {
+    rows = static_cast<typename MatrixType::Index>(
+        sqlite3_column_int64(sql_stmt, col + 0));
+    cols = static_cast<typename MatrixType::Index>(
+        sqlite3_column_int64(sql_stmt, col + 1));
+
+    CHECK_GE(rows, 0);
+    CHECK_GE(cols, 0);
+
+    data = static_cast<const typename MatrixType::Scalar*>(
+        sqlite3_column_blob(sql_stmt, col + 2));
+    const size_t num_bytes =
+        static_cast<size_t>(sqlite3_column_bytes(sql_stmt, col + 2));
+    CHECK_EQ(rows * cols * sizeof(typename MatrixType::Scalar), num_bytes);
+  }
+
+  return Eigen::Map<const MatrixType>(data, rows, cols);
+}
+
+std::vector<int> ReadLabelsBlob(sqlite3_stmt* sql_stmt, const int rc,
+                                const int col) {
+  CHECK_GE(col, 0);
+
+  std::vector<int> labels;
+
+  if (rc == SQLITE_ROW) {
+    const size_t num_bytes =
+        static_cast<size_t>(sqlite3_column_bytes(sql_stmt, col));
+    CHECK_EQ(num_bytes % sizeof(int), 0);
+    labels.resize(num_bytes / sizeof(int));
+    if (num_bytes > 0) {
+      memcpy(reinterpret_cast<char*>(labels.data()),
+             sqlite3_column_blob(sql_stmt, col), num_bytes);
+    }
+  }
+
+  return labels;
+}
+
 template <typename MatrixType>
 void WriteStaticMatrixBlob(sqlite3_stmt* sql_stmt, const MatrixType& matrix,
                            const int col) {
@@ -228,8 +285,36 @@ Image ReadImageRow(sqlite3_stmt* sql_stmt) {
 const size_t Database::kMaxNumImages =
     static_cast<size_t>(std::numeric_limits<int32_t>::max());
 
+const int64_t Database::kDefaultReadMmapSize = 1024 * 1024 * 1024;
+
 std::mutex Database::update_schema_mutex_;
 
+class Database::ReadConnectionGuard {
+ public:
+  explicit ReadConnectionGuard(const Database* database)
+      : database_(database),
+        connection_(database->AcquireReadConnection()) {}
+
+  ~ReadConnectionGuard() {
+    if (connection_ != nullptr) {
+      database_->ReleaseReadConnection(connection_);
+    }
+  }
+
+  // Select the statement of the pooled connection, or the given statement of
+  // the main connection if the pool is disabled.
+  sqlite3_stmt* Statement(sqlite3_stmt* ReadConnection::*pooled_sql_stmt,
+                          sqlite3_stmt* sql_stmt) const {
+    return connection_ == nullptr ? sql_stmt : connection_->*pooled_sql_stmt;
+  }
+
+ private:
+  NON_COPYABLE(ReadConnectionGuard)
+  NON_MOVABLE(ReadConnectionGuard)
+  const Database* database_;
+  ReadConnection* connection_;
+};
+
 Database::Database() : database_(nullptr) {}
 
 Database::Database(const std::string& path) : Database() { Open(path); }
@@ -263,14 +348,40 @@ void Database::Open(const std::string& path) {
   CreateTables();
   UpdateSchema();
   PrepareSQLStatements();
+
+  path_ = path;
 }
 
 void Database::Close() {
+  CloseReadConnections();
+  read_connection_pool_enabled_ = false;
   if (database_ != nullptr) {
     FinalizeSQLStatements();
     sqlite3_close_v2(database_);
     database_ = nullptr;
   }
+  path_.clear();
+}
+
+bool Database::EnableReadConnectionPool(const int64_t mmap_size) {
+  CHECK_NOTNULL(database_);
+  CHECK_GE(mmap_size, 0);
+  if (path_.empty() || path_ == ":memory:") {
+    return false;
+  }
+  std::unique_lock<std::mutex> lock(read_connections_mutex_);
+  read_connection_pool_enabled_ = true;
+  read_mmap_size_ = mmap_size;
+  return true;
+}
+
+bool Database::IsReadConnectionPoolEnabled() const {
+  return read_connection_pool_enabled_;
+}
+
+size_t Database::NumReadConnections() const {
+  std::unique_lock<std::mutex> lock(read_connections_mutex_);
+  return read_connections_.size();
 }
 
 bool Database::ExistsCamera(const camera_t camera_id) const {
@@ -290,7 +401,23 @@ bool Database::ExistsKeypoints(const image_t image_id) const {
 }
 
 bool Database::ExistsDescriptors(const image_t image_id) const {
-  return ExistsRowId(sql_stmt_exists_descriptors_, image_id);
+  ReadConnectionGuard connection(this);
+  return ExistsRowId(
+      connection.Statement(&ReadConnection::sql_stmt_exists_descriptors,
+                           sql_stmt_exists_descriptors_),
+      image_id);
+}
+
+bool Database::ExistsDescriptorCodes(const image_t image_id) const {
+  ReadConnectionGuard connection(this);
+  return ExistsRowId(
+      connection.Statement(&ReadConnection::sql_stmt_exists_descriptor_codes,
+                           sql_stmt_exists_descriptor_codes_),
+      image_id);
+}
+
+bool Database::ExistsDescriptorCodebook() const {
+  return CountRows("descriptor_codebook") > 0;
 }
 
 bool Database::ExistsMatches(const image_t image_id1,
@@ -331,6 +458,14 @@ size_t Database::NumDescriptorsForImage(const image_t image_id) const {
   return CountRowsForEntry(sql_stmt_num_descriptors_, image_id);
 }
 
+size_t Database::NumDescriptorCodes() const {
+  return SumColumn("rows", "descriptor_codes");
+}
+
+size_t Database::MaxNumDescriptorCodes() const {
+  return MaxColumn("rows", "descriptor_codes");
+}
+
 size_t Database::NumMatches() const { return SumColumn("rows", "matches"); }
 
 size_t Database::NumInlierMatches() const {
@@ -415,30 +550,99 @@ std::vector<Image> Database::ReadAllImages() const {
 }
 
 FeatureKeypoints Database::ReadKeypoints(const image_t image_id) const {
-  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_read_keypoints_, 1, image_id));
+  ReadConnectionGuard connection(this);
+  sqlite3_stmt* sql_stmt = connection.Statement(
+      &ReadConnection::sql_stmt_read_keypoints, sql_stmt_read_keypoints_);
 
-  const int rc = SQLITE3_CALL(sqlite3_step(sql_stmt_read_keypoints_));
-  const FeatureKeypointsBlob blob = ReadDynamicMatrixBlob<FeatureKeypointsBlob>(
-      sql_stmt_read_keypoints_, rc, 0);
+  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, 1, image_id));
 
-  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_keypoints_));
+  const int rc = SQLITE3_CALL(sqlite3_step(sql_stmt));
+  const FeatureKeypointsBlob blob =
+      ReadDynamicMatrixBlob<FeatureKeypointsBlob>(sql_stmt, rc, 0);
+
+  SQLITE3_CALL(sqlite3_reset(sql_stmt));
 
   return FeatureKeypointsFromBlob(blob);
 }
 
 FeatureDescriptors Database::ReadDescriptors(const image_t image_id) const {
-  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt_read_descriptors_, 1, image_id));
+  ReadConnectionGuard connection(this);
+  sqlite3_stmt* sql_stmt = connection.Statement(
+      &ReadConnection::sql_stmt_read_descriptors, sql_stmt_read_descriptors_);
+
+  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, 1, image_id));
 
-  const int rc = SQLITE3_CALL(sqlite3_step(sql_stmt_read_descriptors_));
+  const int rc = SQLITE3_CALL(sqlite3_step(sql_stmt));
   const FeatureDescriptors descriptors =
-      ReadDynamicMatrixBlob<FeatureDescriptors>(sql_stmt_read_descriptors_, rc,
-                                                0);
+      ReadDynamicMatrixBlob<FeatureDescriptors>(sql_stmt, rc, 0);
 
-  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_descriptors_));
+  SQLITE3_CALL(sqlite3_reset(sql_stmt));
 
   return descriptors;
 }
 
+void Database::ReadDescriptors(
+    const image_t image_id,
+    const std::function<void(const Eigen::Map<const FeatureDescriptors>&)>&
+        func) const {
+  ReadConnectionGuard connection(this);
+  sqlite3_stmt* sql_stmt = connection.Statement(
+      &ReadConnection::sql_stmt_read_descriptors, sql_stmt_read_descriptors_);
+
+  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, 1, image_id));
+
+  const int rc = SQLITE3_CALL(sqlite3_step(sql_stmt));
+  func(MapDynamicMatrixBlob<FeatureDescriptors>(sql_stmt, rc, 0));
+
+  SQLITE3_CALL(sqlite3_reset(sql_stmt));
+}
+
+void Database::ReadAllDescriptors(
+    const std::function<void(const image_t,
+                             const Eigen::Map<const FeatureDescriptors>&)>&
+        func) const {
+  int rc;
+  while ((rc = SQLITE3_CALL(sqlite3_step(sql_stmt_read_descriptors_all_))) ==
+         SQLITE_ROW) {
+    const image_t image_id = static_cast<image_t>(
+        sqlite3_column_int64(sql_stmt_read_descriptors_all_, 0));
+    func(image_id, MapDynamicMatrixBlob<FeatureDescriptors>(
+                       sql_stmt_read_descriptors_all_, rc, 1));
+  }
+
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_descriptors_all_));
+}
+
+FeatureDescriptorCodes Database::ReadDescriptorCodes(
+    const image_t image_id) const {
+  ReadConnectionGuard connection(this);
+  sqlite3_stmt* sql_stmt =
+      connection.Statement(&ReadConnection::sql_stmt_read_descriptor_codes,
+                           sql_stmt_read_descriptor_codes_);
+
+  SQLITE3_CALL(sqlite3_bind_int64(sql_stmt, 1, image_id));
+
+  const int rc = SQLITE3_CALL(sqlite3_step(sql_stmt));
+  const FeatureDescriptorCodes codes =
+      ReadDynamicMatrixBlob<FeatureDescriptorCodes>(sql_stmt, rc, 0);
+
+  SQLITE3_CALL(sqlite3_reset(sql_stmt));
+
+  return codes;
+}
+
+FeatureDescriptorCodebook Database::ReadDescriptorCodebook() const {
+  const int rc =
+      SQLITE3_CALL(sqlite3_step(sql_stmt_read_descriptor_codebook_));
+  const FeatureDescriptorCodebook codebook =
+      ReadDynamicMatrixBlob<FeatureDescriptorCodebook>(
+          sql_stmt_read_descriptor_codebook_, rc, 0);
+
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_read_descriptor_codebook_));
+
+  return codebook;
+}
+
 FeatureMatches Database::ReadMatches(image_t image_id1,
                                      image_t image_id2) const {
   const image_pair_t pair_id = ImagePairToPairId(image_id1, image_id2);
@@ -497,6 +701,8 @@ TwoViewGeometry Database::ReadInlierMatches(const image_t image_id1,
       sql_stmt_read_inlier_matches_, rc, 5);
   two_view_geometry.H = ReadStaticMatrixBlob<Eigen::Matrix3d>(
       sql_stmt_read_inlier_matches_, rc, 6);
+  two_view_geometry.inlier_labels =
+      ReadLabelsBlob(sql_stmt_read_inlier_matches_, rc, 7);
 
   SQLITE3_CALL(sqlite3_reset(sql_stmt_read_inlier_matches_));
 
@@ -515,20 +721,30 @@ TwoViewGeometry Database::ReadInlierMatches(const image_t image_id1,
 void Database::ReadAllInlierMatches(
     std::vector<image_pair_t>* image_pair_ids,
     std::vector<TwoViewGeometry>* two_view_geometries) const {
+  ReadAllInlierMatches([image_pair_ids, two_view_geometries](
+      const image_pair_t pair_id, const TwoViewGeometry& two_view_geometry) {
+    image_pair_ids->push_back(pair_id);
+    two_view_geometries->push_back(two_view_geometry);
+  });
+}
+
+void Database::ReadAllInlierMatches(
+    const std::function<void(const image_pair_t, const TwoViewGeometry&)>&
+        func) const {
+  TwoViewGeometry two_view_geometry;
   int rc;
   while ((rc = SQLITE3_CALL(sqlite3_step(sql_stmt_read_inlier_matches_all_))) ==
          SQLITE_ROW) {
     const image_pair_t pair_id = static_cast<image_pair_t>(
         sqlite3_column_int64(sql_stmt_read_inlier_matches_all_, 0));
-    image_pair_ids->push_back(pair_id);
-
-    TwoViewGeometry two_view_geometry;
     const FeatureMatchesBlob blob = ReadDynamicMatrixBlob<FeatureMatchesBlob>(
         sql_stmt_read_inlier_matches_all_, rc, 1);
     two_view_geometry.config = static_cast<int>(
         sqlite3_column_int64(sql_stmt_read_inlier_matches_all_, 4));
     two_view_geometry.inlier_matches = FeatureMatchesFromBlob(blob);
-    two_view_geometries->push_back(two_view_geometry);
+    two_view_geometry.inlier_labels =
+        ReadLabelsBlob(sql_stmt_read_inlier_matches_all_, rc, 8);
+    func(pair_id, two_view_geometry);
   }
 
   SQLITE3_CALL(sqlite3_reset(sql_stmt_read_inlier_matches_all_));
@@ -640,6 +856,24 @@ void Database::WriteDescriptors(const image_t image_id,
   SQLITE3_CALL(sqlite3_reset(sql_stmt_write_descriptors_));
 }
 
+void Database::WriteDescriptorCodes(const image_t image_id,
+                                    const FeatureDescriptorCodes& codes) const {
+  SQLITE3_CALL(
+      sqlite3_bind_int64(sql_stmt_write_descriptor_codes_, 1, image_id));
+  WriteDynamicMatrixBlob(sql_stmt_write_descriptor_codes_, codes, 2);
+
+  SQLITE3_CALL(sqlite3_step(sql_stmt_write_descriptor_codes_));
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_write_descriptor_codes_));
+}
+
+void Database::WriteDescriptorCodebook(
+    const FeatureDescriptorCodebook& codebook) const {
+  WriteDynamicMatrixBlob(sql_stmt_write_descriptor_codebook_, codebook, 1);
+
+  SQLITE3_CALL(sqlite3_step(sql_stmt_write_descriptor_codebook_));
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_write_descriptor_codebook_));
+}
+
 void Database::WriteMatches(const image_t image_id1, const image_t image_id2,
                             const FeatureMatches& matches) const {
   const image_pair_t pair_id = ImagePairToPairId(image_id1, image_id2);
@@ -693,6 +927,18 @@ void Database::WriteInlierMatches(
                           8);
   }
 
+  if (two_view_geometry.inlier_labels.empty()) {
+    SQLITE3_CALL(sqlite3_bind_null(sql_stmt_write_inlier_matches_, 9));
+  } else {
+    CHECK_EQ(two_view_geometry.inlier_labels.size(),
+             two_view_geometry.inlier_matches.size());
+    SQLITE3_CALL(sqlite3_bind_blob(
+        sql_stmt_write_inlier_matches_, 9,
+        reinterpret_cast<const char*>(two_view_geometry.inlier_labels.data()),
+        static_cast<int>(two_view_geometry.inlier_labels.size() * sizeof(int)),
+        SQLITE_STATIC));
+  }
+
   SQLITE3_CALL(sqlite3_step(sql_stmt_write_inlier_matches_));
   SQLITE3_CALL(sqlite3_reset(sql_stmt_write_inlier_matches_));
 }
@@ -774,6 +1020,20 @@ void Database::ClearInlierMatches() const {
   SQLITE3_CALL(sqlite3_reset(sql_stmt_clear_inlier_matches_));
 }
 
+void Database::ClearDescriptors() const {
+  SQLITE3_CALL(sqlite3_step(sql_stmt_clear_descriptors_));
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_clear_descriptors_));
+}
+
+void Database::ClearDescriptorCodes() const {
+  SQLITE3_CALL(sqlite3_step(sql_stmt_clear_descriptor_codes_));
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_clear_descriptor_codes_));
+  SQLITE3_CALL(sqlite3_step(sql_stmt_clear_descriptor_codebook_));
+  SQLITE3_CALL(sqlite3_reset(sql_stmt_clear_descriptor_codebook_));
+}
+
+void Database::Vacuum() const { SQLITE3_EXEC(database_, "VACUUM;", nullptr); }
+
 void Database::BeginTransaction() const {
   SQLITE3_EXEC(database_, "BEGIN TRANSACTION", nullptr);
 }
@@ -828,6 +1088,11 @@ void Database::PrepareSQLStatements() {
                                   &sql_stmt_exists_descriptors_, 0));
   sql_stmts_.push_back(sql_stmt_exists_descriptors_);
 
+  sql = "SELECT 1 FROM descriptor_codes WHERE image_id = ?;";
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_exists_descriptor_codes_, 0));
+  sql_stmts_.push_back(sql_stmt_exists_descriptor_codes_);
+
   sql = "SELECT 1 FROM matches WHERE pair_id = ?;";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_exists_matches_, 0));
@@ -912,6 +1177,21 @@ void Database::PrepareSQLStatements() {
                                   &sql_stmt_read_descriptors_, 0));
   sql_stmts_.push_back(sql_stmt_read_descriptors_);
 
+  sql = "SELECT image_id, rows, cols, data FROM descriptors;";
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_read_descriptors_all_, 0));
+  sql_stmts_.push_back(sql_stmt_read_descriptors_all_);
+
+  sql = "SELECT rows, cols, data FROM descriptor_codes WHERE image_id = ?;";
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_read_descriptor_codes_, 0));
+  sql_stmts_.push_back(sql_stmt_read_descriptor_codes_);
+
+  sql = "SELECT rows, cols, data FROM descriptor_codebook;";
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_read_descriptor_codebook_, 0));
+  sql_stmts_.push_back(sql_stmt_read_descriptor_codebook_);
+
   sql = "SELECT rows, cols, data FROM matches WHERE pair_id = ?;";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_read_matches_, 0));
@@ -923,7 +1203,7 @@ void Database::PrepareSQLStatements() {
   sql_stmts_.push_back(sql_stmt_read_matches_all_);
 
   sql =
-      "SELECT rows, cols, data, config, F, E, H FROM inlier_matches "
+      "SELECT rows, cols, data, config, F, E, H, labels FROM inlier_matches "
       "WHERE pair_id = ?;";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_read_inlier_matches_, 0));
@@ -953,14 +1233,28 @@ void Database::PrepareSQLStatements() {
                                   &sql_stmt_write_descriptors_, 0));
   sql_stmts_.push_back(sql_stmt_write_descriptors_);
 
+  sql =
+      "INSERT INTO descriptor_codes(image_id, rows, cols, data) "
+      "VALUES(?, ?, ?, ?);";
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_write_descriptor_codes_, 0));
+  sql_stmts_.push_back(sql_stmt_write_descriptor_codes_);
+
+  sql =
+      "INSERT OR REPLACE INTO descriptor_codebook(codebook_id, rows, cols, "
+      "data) VALUES(1, ?, ?, ?);";
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_write_descriptor_codebook_, 0));
+  sql_stmts_.push_back(sql_stmt_write_descriptor_codebook_);
+
   sql = "INSERT INTO matches(pair_id, rows, cols, data) VALUES(?, ?, ?, ?);";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_write_matches_, 0));
   sql_stmts_.push_back(sql_stmt_write_matches_);
 
   sql =
-      "INSERT INTO inlier_matches(pair_id, rows, cols, data, config, F, E, H) "
-      "VALUES(?, ?, ?, ?, ?, ?, ?, ?);";
+      "INSERT INTO inlier_matches(pair_id, rows, cols, data, config, F, E, H, "
+      "labels) VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?);";
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_write_inlier_matches_, 0));
   sql_stmts_.push_back(sql_stmt_write_inlier_matches_);
@@ -990,6 +1284,21 @@ void Database::PrepareSQLStatements() {
   SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
                                   &sql_stmt_clear_inlier_matches_, 0));
   sql_stmts_.push_back(sql_stmt_clear_inlier_matches_);
+
+  sql = "DELETE FROM descriptors;";
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_clear_descriptors_, 0));
+  sql_stmts_.push_back(sql_stmt_clear_descriptors_);
+
+  sql = "DELETE FROM descriptor_codes;";
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_clear_descriptor_codes_, 0));
+  sql_stmts_.push_back(sql_stmt_clear_descriptor_codes_);
+
+  sql = "DELETE FROM descriptor_codebook;";
+  SQLITE3_CALL(sqlite3_prepare_v2(database_, sql.c_str(), -1,
+                                  &sql_stmt_clear_descriptor_codebook_, 0));
+  sql_stmts_.push_back(sql_stmt_clear_descriptor_codebook_);
 }
 
 void Database::FinalizeSQLStatements() {
@@ -998,11 +1307,87 @@ void Database::FinalizeSQLStatements() {
   }
 }
 
+Database::ReadConnection* Database::AcquireReadConnection() const {
+  if (!read_connection_pool_enabled_) {
+    return nullptr;
+  }
+
+  std::unique_lock<std::mutex> lock(read_connections_mutex_);
+  if (!free_read_connections_.empty()) {
+    ReadConnection* connection = free_read_connections_.back();
+    free_read_connections_.pop_back();
+    return connection;
+  }
+
+  // Open a new connection outside the lock, since all others are in use.
+  lock.unlock();
+
+  std::unique_ptr<ReadConnection> connection(new ReadConnection);
+  SQLITE3_CALL(sqlite3_open_v2(path_.c_str(), &connection->database,
+                               SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+                               nullptr));
+
+  // Blobs are read directly from the mapped file instead of being copied
+  // through the page cache of each connection.
+  SQLITE3_EXEC(
+      connection->database,
+      StringPrintf("PRAGMA mmap_size=%lld",
+                   static_cast<long long>(read_mmap_size_)).c_str(),
+      nullptr);
+
+  // Wait for a checkpoint of the writing connection instead of failing.
+  SQLITE3_CALL(sqlite3_busy_timeout(connection->database, 60000));
+
+  const auto prepare = [&connection](const std::string& sql,
+                                     sqlite3_stmt** sql_stmt) {
+    SQLITE3_CALL(sqlite3_prepare_v2(connection->database, sql.c_str(), -1,
+                                    sql_stmt, 0));
+  };
+  prepare("SELECT 1 FROM descriptors WHERE image_id = ?;",
+          &connection->sql_stmt_exists_descriptors);
+  prepare("SELECT 1 FROM descriptor_codes WHERE image_id = ?;",
+          &connection->sql_stmt_exists_descriptor_codes);
+  prepare("SELECT rows, cols, data FROM keypoints WHERE image_id = ?;",
+          &connection->sql_stmt_read_keypoints);
+  prepare("SELECT rows, cols, data FROM descriptors WHERE image_id = ?;",
+          &connection->sql_stmt_read_descriptors);
+  prepare("SELECT rows, cols, data FROM descriptor_codes WHERE image_id = ?;",
+          &connection->sql_stmt_read_descriptor_codes);
+
+  lock.lock();
+  read_connections_.push_back(std::move(connection));
+  return read_connections_.back().get();
+}
+
+void Database::ReleaseReadConnection(ReadConnection* connection) const {
+  std::unique_lock<std::mutex> lock(read_connections_mutex_);
+  free_read_connections_.push_back(connection);
+}
+
+void Database::CloseReadConnections() {
+  std::unique_lock<std::mutex> lock(read_connections_mutex_);
+  CHECK_EQ(free_read_connections_.size(), read_connections_.size())
+      << "Read connections are still in use";
+  for (auto& connection : read_connections_) {
+    SQLITE3_CALL(sqlite3_finalize(connection->sql_stmt_exists_descriptors));
+    SQLITE3_CALL(
+        sqlite3_finalize(connection->sql_stmt_exists_descriptor_codes));
+    SQLITE3_CALL(sqlite3_finalize(connection->sql_stmt_read_keypoints));
+    SQLITE3_CALL(sqlite3_finalize(connection->sql_stmt_read_descriptors));
+    SQLITE3_CALL(sqlite3_finalize(connection->sql_stmt_read_descriptor_codes));
+    sqlite3_close_v2(connection->database);
+  }
+  read_connections_.clear();
+  free_read_connections_.clear();
+}
+
 void Database::CreateTables() const {
   CreateCameraTable();
   CreateImageTable();
   CreateKeypointsTable();
   CreateDescriptorsTable();
+  CreateDescriptorCodesTable();
+  CreateDescriptorCodebookTable();
   CreateMatchesTable();
   CreateInlierMatchesTable();
 }
@@ -1065,6 +1450,29 @@ void Database::CreateDescriptorsTable() const {
   SQLITE3_EXEC(database_, sql.c_str(), nullptr);
 }
 
+void Database::CreateDescriptorCodesTable() const {
+  const std::string sql =
+      "CREATE TABLE IF NOT EXISTS descriptor_codes"
+      "   (image_id  INTEGER  PRIMARY KEY  NOT NULL,"
+      "    rows      INTEGER               NOT NULL,"
+      "    cols      INTEGER               NOT NULL,"
+      "    data      BLOB,"
+      "FOREIGN KEY(image_id) REFERENCES images(image_id) ON DELETE CASCADE);";
+
+  SQLITE3_EXEC(database_, sql.c_str(), nullptr);
+}
+
+void Database::CreateDescriptorCodebookTable() const {
+  const std::string sql =
+      "CREATE TABLE IF NOT EXISTS descriptor_codebook"
+      "   (codebook_id  INTEGER  PRIMARY KEY  NOT NULL,"
+      "    rows         INTEGER               NOT NULL,"
+      "    cols         INTEGER               NOT NULL,"
+      "    data         BLOB);";
+
+  SQLITE3_EXEC(database_, sql.c_str(), nullptr);
+}
+
 void Database::CreateMatchesTable() const {
   const std::string sql =
       "CREATE TABLE IF NOT EXISTS matches"
@@ -1086,7 +1494,8 @@ void Database::CreateInlierMatchesTable() const {
       "    config   INTEGER               NOT NULL,"
       "    F        BLOB,"
       "    E        BLOB,"
-      "    H        BLOB);";
+      "    H        BLOB,"
+      "    labels   BLOB);";
 
   SQLITE3_EXEC(database_, sql.c_str(), nullptr);
 }
@@ -1107,6 +1516,11 @@ void Database::UpdateSchema() const {
                  nullptr);
   }
 
+  if (!ExistsColumn("inlier_matches", "labels")) {
+    SQLITE3_EXEC(database_,
+                 "ALTER TABLE inlier_matches ADD COLUMN labels BLOB;", nullptr);
+  }
+
   // Update user version number.
   std::unique_lock<std::mutex> lock(update_schema_mutex_);
   const std::string update_user_version_sql =
@@ -17,6 +17,8 @@
 #ifndef COLMAP_SRC_BASE_DATABASE_H_
 #define COLMAP_SRC_BASE_DATABASE_H_
 
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 #include <vector>
@@ -34,7 +36,8 @@ namespace colmap {
 
 // Database class to read and write images, features, cameras, matches, etc.
 // from a SQLite database. The class is not thread-safe and must not be accessed
-// concurrently. The class is optimized for single-thread speed and for optimal
+// concurrently, except for the feature reads once the read connection pool is
+// enabled. The class is optimized for single-thread speed and for optimal
 // performance, wrap multiple method calls inside a leading `BeginTransaction`
 // and trailing `EndTransaction`.
 class Database {
@@ -51,11 +54,29 @@ class Database {
   explicit Database(const std::string& path);
   ~Database();
 
+  // The default maximum number of bytes of the database file that each pooled
+  // read connection memory-maps.
+  const static int64_t kDefaultReadMmapSize;
+
   // Open and close database. The same database should not be opened
   // concurrently in multiple threads or processes.
   void Open(const std::string& path);
   void Close();
 
+  // Serve `ReadKeypoints`, `ReadDescriptors`, `ReadDescriptorCodes`,
+  // `ExistsDescriptors`, and `ExistsDescriptorCodes` from a pool of read-only
+  // connections with their own prepared statements. Each reading thread checks
+  // out a connection for the duration of a read, and new connections are
+  // opened whenever all existing ones are in use. These reads are then
+  // thread-safe and run in parallel with each other and with one thread that
+  // uses all other methods through the main connection. Since the database is
+  // in WAL mode, the pooled reads see the last committed state and not the
+  // changes of a transaction that is still open. Returns false for in-memory
+  // databases, whose contents cannot be shared between connections.
+  bool EnableReadConnectionPool(const int64_t mmap_size = kDefaultReadMmapSize);
+  bool IsReadConnectionPoolEnabled() const;
+  size_t NumReadConnections() const;
+
   // Check if entry already exists in database. For image pairs, the order of
   // `image_id1` and `image_id2` does not matter.
   bool ExistsCamera(const camera_t camera_id) const;
@@ -63,6 +84,8 @@ class Database {
   bool ExistsImageWithName(std::string name) const;
   bool ExistsKeypoints(const image_t image_id) const;
   bool ExistsDescriptors(const image_t image_id) const;
+  bool ExistsDescriptorCodes(const image_t image_id) const;
+  bool ExistsDescriptorCodebook() const;
   bool ExistsMatches(const image_t image_id1, const image_t image_id2) const;
   bool ExistsInlierMatches(const image_t image_id1,
                            const image_t image_id2) const;
@@ -92,6 +115,13 @@ class Database {
   // Number of descriptors for specific image.
   size_t NumDescriptorsForImage(const image_t image_id) const;
 
+  // Sum of `rows` column in `descriptor_codes` table,
+  // i.e. number of total descriptor codes.
+  size_t NumDescriptorCodes() const;
+
+  // The number of descriptor codes for the image with most features.
+  size_t MaxNumDescriptorCodes() const;
+
   // Sum of `rows` column in `matches` table, i.e. number of total matches.
   size_t NumMatches() const;
 
@@ -134,6 +164,24 @@ class Database {
   FeatureKeypoints ReadKeypoints(const image_t image_id) const;
   FeatureDescriptors ReadDescriptors(const image_t image_id) const;
 
+  // Pass the descriptors of an image to the given function as a view of the
+  // blob in SQLite, which avoids copying them. The view is empty if the image
+  // has no descriptors and it is only valid during the call, so the function
+  // must copy what it keeps and it must not access the database.
+  void ReadDescriptors(
+      const image_t image_id,
+      const std::function<void(const Eigen::Map<const FeatureDescriptors>&)>&
+          func) const;
+
+  // Pass the descriptors of all images to the given function one by one in a
+  // single scan of the table, with the same restrictions as above.
+  void ReadAllDescriptors(
+      const std::function<void(const image_t,
+                               const Eigen::Map<const FeatureDescriptors>&)>&
+          func) const;
+  FeatureDescriptorCodes ReadDescriptorCodes(const image_t image_id) const;
+  FeatureDescriptorCodebook ReadDescriptorCodebook() const;
+
   FeatureMatches ReadMatches(const image_t image_id1,
                              const image_t image_id2) const;
   std::vector<std::pair<image_pair_t, FeatureMatches>> ReadAllMatches() const;
@@ -144,6 +192,13 @@ class Database {
       std::vector<image_pair_t>* image_pair_ids,
       std::vector<TwoViewGeometry>* two_view_geometries) const;
 
+  // Read the inlier matches of all image pairs one by one and pass them to the
+  // given function, so that they need not all be held in memory at once. The
+  // function must not access the database.
+  void ReadAllInlierMatches(
+      const std::function<void(const image_pair_t,
+                               const TwoViewGeometry&)>& func) const;
+
   // Read all image pairs that have an entry in the `inlier_matches` table with
   // at least one inlier match and their corresponding number of inlier matches.
   void ReadInlierMatchesGraph(
@@ -166,11 +221,17 @@ class Database {
                       const FeatureKeypoints& keypoints) const;
   void WriteDescriptors(const image_t image_id,
                         const FeatureDescriptors& descriptors) const;
+  void WriteDescriptorCodes(const image_t image_id,
+                            const FeatureDescriptorCodes& codes) const;
   void WriteMatches(const image_t image_id1, const image_t image_id2,
                     const FeatureMatches& matches) const;
   void WriteInlierMatches(const image_t image_id1, const image_t image_id2,
                           const TwoViewGeometry& two_view_geometry) const;
 
+  // Write the codebook of the descriptor codes, which replaces any existing
+  // codebook, since all codes of a database share the same codebook.
+  void WriteDescriptorCodebook(const FeatureDescriptorCodebook& codebook) const;
+
   // Update an existing camera in the database. The user is responsible for
   // making sure that the entry already exists.
   void UpdateCamera(const Camera& camera) const;
@@ -192,9 +253,38 @@ class Database {
   // Clear the entire inlier matches table.
   void ClearInlierMatches() const;
 
+  // Clear the entire descriptors table, e.g. once all descriptors are stored
+  // as descriptor codes.
+  void ClearDescriptors() const;
+
+  // Clear the entire descriptor codes table and the codebook.
+  void ClearDescriptorCodes() const;
+
+  // Rebuild the database file, which releases the pages of deleted entries.
+  // Must not be called inside a transaction.
+  void Vacuum() const;
+
  private:
   friend class DatabaseTransaction;
 
+  // A read-only connection of the pool with its prepared statements.
+  struct ReadConnection {
+    sqlite3* database = nullptr;
+    sqlite3_stmt* sql_stmt_exists_descriptors = nullptr;
+    sqlite3_stmt* sql_stmt_exists_descriptor_codes = nullptr;
+    sqlite3_stmt* sql_stmt_read_keypoints = nullptr;
+    sqlite3_stmt* sql_stmt_read_descriptors = nullptr;
+    sqlite3_stmt* sql_stmt_read_descriptor_codes = nullptr;
+  };
+
+  // Checks out a pooled read connection for its lifetime, if the pool is
+  // enabled, and otherwise provides the statements of the main connection.
+  class ReadConnectionGuard;
+
+  ReadConnection* AcquireReadConnection() const;
+  void ReleaseReadConnection(ReadConnection* connection) const;
+  void CloseReadConnections();
+
   // Combine multiple queries into one transaction by wrapping a code section
   // into a `BeginTransaction` and `EndTransaction`. You can create a scoped
   // transaction with `DatabaseTransaction` that ends when the transaction
@@ -214,6 +304,8 @@ class Database {
   void CreateImageTable() const;
   void CreateKeypointsTable() const;
   void CreateDescriptorsTable() const;
+  void CreateDescriptorCodesTable() const;
+  void CreateDescriptorCodebookTable() const;
   void CreateMatchesTable() const;
   void CreateInlierMatchesTable() const;
 
@@ -234,6 +326,17 @@ class Database {
 
   sqlite3* database_ = nullptr;
 
+  // The path of the open database, used to open the pooled read connections.
+  std::string path_;
+
+  // The pool of read-only connections, where `free_read_connections_` are the
+  // ones that are not checked out by any thread.
+  bool read_connection_pool_enabled_ = false;
+  int64_t read_mmap_size_ = 0;
+  mutable std::mutex read_connections_mutex_;
+  mutable std::vector<std::unique_ptr<ReadConnection>> read_connections_;
+  mutable std::vector<ReadConnection*> free_read_connections_;
+
   // Ensure that only one database object at a time updates the schema of a
   // database. Since the schema is updated every time a database is opened, this
   // is to ensure that there are no race conditions ("database locked" error
@@ -257,6 +360,7 @@ class Database {
   sqlite3_stmt* sql_stmt_exists_image_name_ = nullptr;
   sqlite3_stmt* sql_stmt_exists_keypoints_ = nullptr;
   sqlite3_stmt* sql_stmt_exists_descriptors_ = nullptr;
+  sqlite3_stmt* sql_stmt_exists_descriptor_codes_ = nullptr;
   sqlite3_stmt* sql_stmt_exists_matches_ = nullptr;
   sqlite3_stmt* sql_stmt_exists_inlier_matches_ = nullptr;
 
@@ -276,6 +380,9 @@ class Database {
   sqlite3_stmt* sql_stmt_read_images_ = nullptr;
   sqlite3_stmt* sql_stmt_read_keypoints_ = nullptr;
   sqlite3_stmt* sql_stmt_read_descriptors_ = nullptr;
+  sqlite3_stmt* sql_stmt_read_descriptors_all_ = nullptr;
+  sqlite3_stmt* sql_stmt_read_descriptor_codes_ = nullptr;
+  sqlite3_stmt* sql_stmt_read_descriptor_codebook_ = nullptr;
   sqlite3_stmt* sql_stmt_read_matches_ = nullptr;
   sqlite3_stmt* sql_stmt_read_matches_all_ = nullptr;
   sqlite3_stmt* sql_stmt_read_inlier_matches_ = nullptr;
@@ -285,6 +392,8 @@ class Database {
   // write_*
   sqlite3_stmt* sql_stmt_write_keypoints_ = nullptr;
   sqlite3_stmt* sql_stmt_write_descriptors_ = nullptr;
+  sqlite3_stmt* sql_stmt_write_descriptor_codes_ = nullptr;
+  sqlite3_stmt* sql_stmt_write_descriptor_codebook_ = nullptr;
   sqlite3_stmt* sql_stmt_write_matches_ = nullptr;
   sqlite3_stmt* sql_stmt_write_inlier_matches_ = nullptr;
 
@@ -295,6 +404,9 @@ class Database {
   // clear_*
   sqlite3_stmt* sql_stmt_clear_matches_ = nullptr;
   sqlite3_stmt* sql_stmt_clear_inlier_matches_ = nullptr;
+  sqlite3_stmt* sql_stmt_clear_descriptors_ = nullptr;
+  sqlite3_stmt* sql_stmt_clear_descriptor_codes_ = nullptr;
+  sqlite3_stmt* sql_stmt_clear_descriptor_codebook_ = nullptr;
 };
 
 // This class automatically manages the scope of a database transaction by
@@ -16,11 +16,14 @@
 
 #include "base/database_cache.h"
 
+#include <memory>
 #include <unordered_set>
 
 #include "feature/utils.h"
 #include "util/string.h"
+#include "util/threading.h"
 #include "util/timer.h"
+#include "util/trace.h"
 
 namespace colmap {
 
@@ -40,6 +43,7 @@ void DatabaseCache::AddImage(const class Image& image) {
 void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
                          const bool ignore_watermarks,
                          const std::set<std::string>& image_names) {
+  TRACE_SCOPE("DatabaseCache::Load");
   //////////////////////////////////////////////////////////////////////////////
   // Load cameras
   //////////////////////////////////////////////////////////////////////////////
@@ -62,20 +66,37 @@ void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
             << std::endl;
 
   //////////////////////////////////////////////////////////////////////////////
-  // Load matches
+  // Load images
   //////////////////////////////////////////////////////////////////////////////
 
   timer.Restart();
-  std::cout << "Loading matches..." << std::flush;
+  std::cout << "Loading images..." << std::flush;
 
-  std::vector<image_pair_t> image_pair_ids;
-  std::vector<TwoViewGeometry> two_view_geometries;
-  database.ReadAllInlierMatches(&image_pair_ids, &two_view_geometries);
+  std::vector<class Image> images = database.ReadAllImages();
+
+  // Determines for which images data should be loaded. The image points are
+  // only loaded for the images that are connected in the scene graph, which
+  // only needs their number for now.
+  std::unordered_set<image_t> image_ids;
+  for (const auto& image : images) {
+    if (image_names.empty() || image_names.count(image.Name()) > 0) {
+      image_ids.insert(image.ImageId());
+      scene_graph_.AddImage(image.ImageId(),
+                            database.NumKeypointsForImage(image.ImageId()));
+    }
+  }
 
-  std::cout << StringPrintf(" %d in %.3fs", image_pair_ids.size(),
+  std::cout << StringPrintf(" %d in %.3fs", images.size(),
                             timer.ElapsedSeconds())
             << std::endl;
 
+  //////////////////////////////////////////////////////////////////////////////
+  // Load matches
+  //////////////////////////////////////////////////////////////////////////////
+
+  timer.Restart();
+  std::cout << "Loading matches..." << std::flush;
+
   auto UseInlierMatchesCheck = [min_num_matches, ignore_watermarks](
                                    const TwoViewGeometry& two_view_geometry) {
     return static_cast<size_t>(two_view_geometry.inlier_matches.size()) >=
@@ -84,97 +105,73 @@ void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
             two_view_geometry.config != TwoViewGeometry::WATERMARK);
   };
 
+  // The matches are added to the scene graph while they are read, so that the
+  // matches of all image pairs are not held in memory twice.
+  size_t num_image_pairs = 0;
+  size_t num_ignored_image_pairs = 0;
+  database.ReadAllInlierMatches([&](const image_pair_t pair_id,
+                                    const TwoViewGeometry& two_view_geometry) {
+    num_image_pairs += 1;
+    image_t image_id1;
+    image_t image_id2;
+    Database::PairIdToImagePair(pair_id, &image_id1, &image_id2);
+    if (UseInlierMatchesCheck(two_view_geometry) &&
+        image_ids.count(image_id1) > 0 && image_ids.count(image_id2) > 0) {
+      scene_graph_.AddCorrespondences(image_id1, image_id2,
+                                      two_view_geometry.inlier_matches);
+    } else {
+      num_ignored_image_pairs += 1;
+    }
+  });
+
+  std::cout << StringPrintf(" %d in %.3fs (ignored %d)", num_image_pairs,
+                            timer.ElapsedSeconds(), num_ignored_image_pairs)
+            << std::endl;
+
   //////////////////////////////////////////////////////////////////////////////
-  // Load images
+  // Build scene graph
   //////////////////////////////////////////////////////////////////////////////
 
   timer.Restart();
-  std::cout << "Loading images..." << std::flush;
-
-  std::unordered_set<image_t> image_ids;
-
-  {
-    const std::vector<class Image> images = database.ReadAllImages();
-
-    // Determines for which images data should be loaded.
-    if (image_names.empty()) {
-      for (const auto& image : images) {
-        image_ids.insert(image.ImageId());
-      }
-    } else {
-      for (const auto& image : images) {
-        if (image_names.count(image.Name()) > 0) {
-          image_ids.insert(image.ImageId());
-        }
-      }
-    }
-
-    // Collect all images that are connected in the scene graph.
-    std::unordered_set<image_t> connected_image_ids;
-    connected_image_ids.reserve(image_ids.size());
-    for (size_t i = 0; i < image_pair_ids.size(); ++i) {
-      if (UseInlierMatchesCheck(two_view_geometries[i])) {
-        image_t image_id1;
-        image_t image_id2;
-        Database::PairIdToImagePair(image_pair_ids[i], &image_id1, &image_id2);
-        if (image_ids.count(image_id1) > 0 && image_ids.count(image_id2) > 0) {
-          connected_image_ids.insert(image_id1);
-          connected_image_ids.insert(image_id2);
-        }
-      }
-    }
+  std::cout << "Building scene graph..." << std::flush;
 
-    // Load images with correspondences and discard images without
-    // correspondences, as those images are useless for SfM.
-    images_.reserve(connected_image_ids.size());
-    for (const auto& image : images) {
-      if (image_ids.count(image.ImageId()) > 0 &&
-          connected_image_ids.count(image.ImageId()) > 0) {
-        images_.emplace(image.ImageId(), image);
-        const FeatureKeypoints keypoints =
-            database.ReadKeypoints(image.ImageId());
-        const std::vector<Eigen::Vector2d> points =
-            FeatureKeypointsToPointsVector(keypoints);
-        images_[image.ImageId()].SetPoints2D(points);
-      }
-    }
+  // Discards the images without correspondences, as those are useless for SfM.
+  scene_graph_.Finalize();
 
-    std::cout << StringPrintf(" %d in %.3fs (connected %d)", images.size(),
-                              timer.ElapsedSeconds(),
-                              connected_image_ids.size())
-              << std::endl;
-  }
+  std::cout << StringPrintf(" in %.3fs (connected %d)", timer.ElapsedSeconds(),
+                            scene_graph_.NumImages())
+            << std::endl;
 
   //////////////////////////////////////////////////////////////////////////////
-  // Build scene graph
+  // Load image points
   //////////////////////////////////////////////////////////////////////////////
 
   timer.Restart();
-  std::cout << "Building scene graph..." << std::flush;
+  std::cout << "Loading image points..." << std::flush;
 
-  for (const auto& image : images_) {
-    scene_graph_.AddImage(image.first, image.second.NumPoints2D());
+  images_.reserve(scene_graph_.NumImages());
+  for (auto& image : images) {
+    if (scene_graph_.ExistsImage(image.ImageId())) {
+      images_.emplace(image.ImageId(), std::move(image));
+    }
   }
+  images.clear();
 
-  size_t num_ignored_image_pairs = 0;
-  for (size_t i = 0; i < image_pair_ids.size(); ++i) {
-    if (UseInlierMatchesCheck(two_view_geometries[i])) {
-      image_t image_id1;
-      image_t image_id2;
-      Database::PairIdToImagePair(image_pair_ids[i], &image_id1, &image_id2);
-      if (image_ids.count(image_id1) > 0 && image_ids.count(image_id2) > 0) {
-        scene_graph_.AddCorrespondences(image_id1, image_id2,
-                                        two_view_geometries[i].inlier_matches);
-      } else {
-        num_ignored_image_pairs += 1;
-      }
-    } else {
-      num_ignored_image_pairs += 1;
+  // The keypoints are read on this thread, as the database must not be
+  // accessed concurrently, and converted to image points in parallel.
+  {
+    ThreadPool thread_pool;
+    for (auto& image : images_) {
+      const auto keypoints = std::make_shared<FeatureKeypoints>(
+          database.ReadKeypoints(image.first));
+      class Image* image_ptr = &image.second;
+      thread_pool.AddTask([image_ptr, keypoints]() {
+        image_ptr->SetPoints2D(FeatureKeypointsToPointsVector(*keypoints));
+      });
     }
+    thread_pool.Wait();
   }
 
-  scene_graph_.Finalize();
-
   // Set number of observations and correspondences per image.
   for (auto& image : images_) {
     image.second.SetNumObservations(
@@ -183,9 +180,38 @@ void DatabaseCache::Load(const Database& database, const size_t min_num_matches,
         scene_graph_.NumCorrespondencesForImage(image.first));
   }
 
-  std::cout << StringPrintf(" in %.3fs (ignored %d)", timer.ElapsedSeconds(),
-                            num_ignored_image_pairs)
+  std::cout << StringPrintf(" %d in %.3fs", images_.size(),
+                            timer.ElapsedSeconds())
             << std::endl;
 }
 
+void DatabaseCache::SpillPoints2D(const std::string& path) {
+  CHECK(!HasSpilledPoints2D());
+
+  Timer timer;
+  timer.Start();
+  std::cout << "Spilling image points..." << std::flush;
+
+  std::shared_ptr<Points2DStore> points2D_store =
+      std::make_shared<Points2DStore>();
+  points2D_store->Create(path, images_);
+  points2D_store_ = points2D_store;
+  for (auto& image : images_) {
+    image.second.ReleasePoints2D(Camera(image.second.CameraId()));
+  }
+
+  std::cout << StringPrintf(" %d in %.3fs", images_.size(),
+                            timer.ElapsedSeconds())
+            << std::endl;
+}
+
+std::vector<class Point2D> DatabaseCache::Points2D(
+    const image_t image_id) const {
+  const class Image& image = Image(image_id);
+  if (image.HasReleasedPoints2D()) {
+    return points2D_store_->Read(image_id);
+  }
+  return image.Points2D();
+}
+
 }  // namespace colmap
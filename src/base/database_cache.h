@@ -17,6 +17,7 @@
 #ifndef COLMAP_SRC_BASE_DATABASE_CACHE_H_
 #define COLMAP_SRC_BASE_DATABASE_CACHE_H_
 
+#include <memory>
 #include <set>
 #include <string>
 #include <unordered_map>
@@ -28,6 +29,7 @@
 #include "base/camera_models.h"
 #include "base/database.h"
 #include "base/image.h"
+#include "base/points2d_store.h"
 #include "base/scene_graph.h"
 #include "util/alignment.h"
 #include "util/types.h"
@@ -61,8 +63,6 @@ class DatabaseCache {
   // Get reference to scene graph.
   inline const class SceneGraph& SceneGraph() const;
 
-  inline class SceneGraph& SG();
-
   // Manually add data to cache.
   void AddCamera(const class Camera& camera);
   void AddImage(const class Image& image);
@@ -79,11 +79,24 @@ class DatabaseCache {
             const bool ignore_watermarks,
             const std::set<std::string>& image_names);
 
+  // Spill the image points of all images to an out-of-core store in a new file
+  // at the given path, which is removed with the cache, and release them. The
+  // points of an image are then read from the store with `Points2D`.
+  void SpillPoints2D(const std::string& path);
+  inline bool HasSpilledPoints2D() const;
+
+  // The points of an image, which are read from the store if they are spilled.
+  std::vector<class Point2D> Points2D(const image_t image_id) const;
+
  private:
   class SceneGraph scene_graph_;
 
   EIGEN_STL_UMAP(camera_t, class Camera) cameras_;
   EIGEN_STL_UMAP(image_t, class Image) images_;
+
+  // The store of the spilled image points, which is shared by copies of the
+  // cache and removed with the last of them.
+  std::shared_ptr<const Points2DStore> points2D_store_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -113,6 +126,10 @@ const EIGEN_STL_UMAP(camera_t, class Camera) & DatabaseCache::Cameras() const {
   return cameras_;
 }
 
+bool DatabaseCache::HasSpilledPoints2D() const {
+  return points2D_store_ != nullptr;
+}
+
 const EIGEN_STL_UMAP(image_t, class Image) & DatabaseCache::Images() const {
   return images_;
 }
@@ -129,10 +146,6 @@ inline const class SceneGraph& DatabaseCache::SceneGraph() const {
   return scene_graph_;
 }
 
-inline class SceneGraph& DatabaseCache::SG() {
-  return scene_graph_;
-}
-
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_BASE_DATABASE_CACHE_H_
@@ -17,6 +17,8 @@
 #define TEST_NAME "base/database_cache"
 #include "util/testing.h"
 
+#include <boost/filesystem.hpp>
+
 #include "base/database_cache.h"
 
 using namespace colmap;
@@ -68,3 +70,44 @@ BOOST_AUTO_TEST_CASE(TestAddImage) {
   BOOST_CHECK_EQUAL(cache.SceneGraph().NumObservationsForImage(image.ImageId()),
                     0);
 }
+
+BOOST_AUTO_TEST_CASE(TestSpillPoints2D) {
+  DatabaseCache cache;
+  Camera camera;
+  camera.SetCameraId(1);
+  camera.InitializeWithId(SimplePinholeCameraModel::model_id, 1, 10, 10);
+  cache.AddCamera(camera);
+  Image image;
+  image.SetImageId(1);
+  image.SetCameraId(camera.CameraId());
+  std::vector<Eigen::Vector2d> points(10);
+  for (size_t i = 0; i < points.size(); ++i) {
+    points[i] = Eigen::Vector2d(i, 0.5 * i);
+  }
+  image.SetPoints2D(points);
+  cache.AddImage(image);
+  BOOST_CHECK(!cache.HasSpilledPoints2D());
+
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("database_cache_test_%%%%%%%%.bin"))
+          .string();
+  {
+    DatabaseCache spilled_cache = cache;
+    spilled_cache.SpillPoints2D(path);
+    BOOST_CHECK(spilled_cache.HasSpilledPoints2D());
+    BOOST_CHECK(boost::filesystem::exists(path));
+    BOOST_CHECK(spilled_cache.Image(1).HasReleasedPoints2D());
+    BOOST_CHECK_EQUAL(spilled_cache.Image(1).NumPoints2D(), 10);
+    const std::vector<class Point2D> points2D = spilled_cache.Points2D(1);
+    BOOST_CHECK_EQUAL(points2D.size(), 10);
+    for (size_t i = 0; i < points2D.size(); ++i) {
+      BOOST_CHECK_EQUAL(points2D[i].XY(), points[i]);
+      BOOST_CHECK(!points2D[i].HasPoint3D());
+    }
+  }
+  BOOST_CHECK(!boost::filesystem::exists(path));
+
+  BOOST_CHECK_EQUAL(cache.Points2D(1).size(), 10);
+  BOOST_CHECK(!cache.Image(1).HasReleasedPoints2D());
+}
@@ -17,8 +17,11 @@
 #define TEST_NAME "base/database"
 #include "util/testing.h"
 
+#include <atomic>
 #include <thread>
 
+#include <boost/filesystem.hpp>
+
 #include "base/database.h"
 
 using namespace colmap;
@@ -264,6 +267,186 @@ BOOST_AUTO_TEST_CASE(TestDescriptors) {
   BOOST_CHECK_EQUAL(database.NumDescriptorsForImage(image.ImageId()), 20);
 }
 
+BOOST_AUTO_TEST_CASE(TestDescriptorsView) {
+  Database database(kMemoryDatabasePath);
+  Camera camera;
+  camera.SetCameraId(database.WriteCamera(camera));
+  Image image;
+  image.SetCameraId(camera.CameraId());
+  std::vector<image_t> image_ids;
+  std::vector<FeatureDescriptors> descriptors;
+  for (int i = 0; i < 3; ++i) {
+    image.SetName("test" + std::to_string(i));
+    image_ids.push_back(database.WriteImage(image));
+    descriptors.push_back(FeatureDescriptors::Random(10 * i, 128));
+    database.WriteDescriptors(image_ids.back(), descriptors.back());
+  }
+  image.SetName("test_without_descriptors");
+  const image_t image_id_without_descriptors = database.WriteImage(image);
+
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    bool called = false;
+    database.ReadDescriptors(
+        image_ids[i],
+        [&](const Eigen::Map<const FeatureDescriptors>& descriptors_view) {
+          BOOST_CHECK(descriptors_view == descriptors[i]);
+          called = true;
+        });
+    BOOST_CHECK(called);
+  }
+
+  database.ReadDescriptors(
+      image_id_without_descriptors,
+      [](const Eigen::Map<const FeatureDescriptors>& descriptors_view) {
+        BOOST_CHECK_EQUAL(descriptors_view.rows(), 0);
+      });
+
+  size_t num_images = 0;
+  database.ReadAllDescriptors(
+      [&](const image_t image_id,
+          const Eigen::Map<const FeatureDescriptors>& descriptors_view) {
+        const size_t idx = image_id - image_ids[0];
+        BOOST_REQUIRE_LT(idx, image_ids.size());
+        BOOST_CHECK(descriptors_view == descriptors[idx]);
+        num_images += 1;
+      });
+  BOOST_CHECK_EQUAL(num_images, image_ids.size());
+}
+
+BOOST_AUTO_TEST_CASE(TestDescriptorCodes) {
+  Database database(kMemoryDatabasePath);
+  Camera camera;
+  camera.SetCameraId(database.WriteCamera(camera));
+  Image image;
+  image.SetName("test");
+  image.SetCameraId(camera.CameraId());
+  image.SetImageId(database.WriteImage(image));
+  BOOST_CHECK(!database.ExistsDescriptorCodes(image.ImageId()));
+  BOOST_CHECK(!database.ExistsDescriptorCodebook());
+  BOOST_CHECK_EQUAL(database.NumDescriptorCodes(), 0);
+  const FeatureDescriptorCodes codes = FeatureDescriptorCodes::Random(10, 16);
+  database.WriteDescriptorCodes(image.ImageId(), codes);
+  BOOST_CHECK(database.ExistsDescriptorCodes(image.ImageId()));
+  BOOST_CHECK(database.ReadDescriptorCodes(image.ImageId()) == codes);
+  BOOST_CHECK_EQUAL(database.NumDescriptorCodes(), 10);
+  BOOST_CHECK_EQUAL(database.MaxNumDescriptorCodes(), 10);
+  const FeatureDescriptorCodebook codebook =
+      FeatureDescriptorCodebook::Random(16 * 256, 8);
+  database.WriteDescriptorCodebook(codebook);
+  BOOST_CHECK(database.ExistsDescriptorCodebook());
+  BOOST_CHECK(database.ReadDescriptorCodebook() == codebook);
+  const FeatureDescriptorCodebook codebook2 =
+      FeatureDescriptorCodebook::Random(8 * 256, 16);
+  database.WriteDescriptorCodebook(codebook2);
+  BOOST_CHECK(database.ReadDescriptorCodebook() == codebook2);
+  database.ClearDescriptorCodes();
+  BOOST_CHECK(!database.ExistsDescriptorCodes(image.ImageId()));
+  BOOST_CHECK(!database.ExistsDescriptorCodebook());
+  BOOST_CHECK_EQUAL(database.ReadDescriptorCodes(image.ImageId()).rows(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestClearDescriptors) {
+  Database database(kMemoryDatabasePath);
+  Camera camera;
+  camera.SetCameraId(database.WriteCamera(camera));
+  Image image;
+  image.SetName("test");
+  image.SetCameraId(camera.CameraId());
+  image.SetImageId(database.WriteImage(image));
+  database.WriteDescriptors(image.ImageId(),
+                            FeatureDescriptors::Random(10, 128));
+  BOOST_CHECK_EQUAL(database.NumDescriptors(), 10);
+  database.ClearDescriptors();
+  BOOST_CHECK(!database.ExistsDescriptors(image.ImageId()));
+  BOOST_CHECK_EQUAL(database.NumDescriptors(), 0);
+  database.Vacuum();
+  BOOST_CHECK(database.ExistsImage(image.ImageId()));
+}
+
+BOOST_AUTO_TEST_CASE(TestReadConnectionPool) {
+  Database memory_database(kMemoryDatabasePath);
+  BOOST_CHECK(!memory_database.EnableReadConnectionPool());
+  BOOST_CHECK(!memory_database.IsReadConnectionPoolEnabled());
+
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("database_test_%%%%%%%%.db"))
+          .string();
+
+  {
+    Database database(path);
+    Camera camera;
+    camera.SetCameraId(database.WriteCamera(camera));
+    std::vector<image_t> image_ids;
+    for (int i = 0; i < 10; ++i) {
+      Image image;
+      image.SetName(std::to_string(i));
+      image.SetCameraId(camera.CameraId());
+      image_ids.push_back(database.WriteImage(image));
+      database.WriteKeypoints(image_ids.back(), FeatureKeypoints(i + 1));
+      database.WriteDescriptors(image_ids.back(),
+                                FeatureDescriptors::Constant(i + 1, 128, i));
+    }
+
+    BOOST_CHECK(database.EnableReadConnectionPool());
+    BOOST_CHECK(database.IsReadConnectionPoolEnabled());
+    BOOST_CHECK_EQUAL(database.NumReadConnections(), 0);
+
+    // Boost.Test assertions are not thread-safe.
+    std::atomic<int> num_errors(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&database, &image_ids, &num_errors]() {
+        for (int k = 0; k < 100; ++k) {
+          for (size_t i = 0; i < image_ids.size(); ++i) {
+            const FeatureDescriptors descriptors =
+                database.ReadDescriptors(image_ids[i]);
+            if (database.ReadKeypoints(image_ids[i]).size() != i + 1 ||
+                descriptors.rows() != static_cast<int>(i + 1) ||
+                descriptors(0, 0) != i ||
+                !database.ExistsDescriptors(image_ids[i]) ||
+                database.ExistsDescriptorCodes(image_ids[i])) {
+              num_errors += 1;
+            }
+          }
+        }
+      });
+    }
+
+    // Writes of the main connection are concurrent to the pooled reads.
+    for (int i = 0; i < 10; ++i) {
+      Image image;
+      image.SetName("concurrent" + std::to_string(i));
+      image.SetCameraId(camera.CameraId());
+      database.WriteKeypoints(database.WriteImage(image), FeatureKeypoints(5));
+    }
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    BOOST_CHECK_EQUAL(num_errors, 0);
+    BOOST_CHECK_GE(database.NumReadConnections(), 1);
+    BOOST_CHECK_LE(database.NumReadConnections(), 4);
+
+    // Committed writes are visible to the pooled reads.
+    Image image;
+    image.SetName("committed");
+    image.SetCameraId(camera.CameraId());
+    image.SetImageId(database.WriteImage(image));
+    database.WriteKeypoints(image.ImageId(), FeatureKeypoints(7));
+    BOOST_CHECK_EQUAL(database.ReadKeypoints(image.ImageId()).size(), 7);
+
+    database.Close();
+    BOOST_CHECK(!database.IsReadConnectionPoolEnabled());
+    BOOST_CHECK_EQUAL(database.NumReadConnections(), 0);
+  }
+
+  boost::filesystem::remove(path);
+  boost::filesystem::remove(path + "-wal");
+  boost::filesystem::remove(path + "-shm");
+}
+
 BOOST_AUTO_TEST_CASE(TestMatches) {
   Database database(kMemoryDatabasePath);
   const image_t image_id1 = 1;
@@ -338,3 +521,30 @@ BOOST_AUTO_TEST_CASE(TestInlierMatches) {
   database.ClearInlierMatches();
   BOOST_CHECK_EQUAL(database.NumInlierMatches(), 0);
 }
+
+BOOST_AUTO_TEST_CASE(TestInlierMatchesLabels) {
+  Database database(kMemoryDatabasePath);
+  const image_t image_id1 = 1;
+  const image_t image_id2 = 2;
+  TwoViewGeometry two_view_geometry;
+  two_view_geometry.inlier_matches = FeatureMatches(10);
+  two_view_geometry.config = TwoViewGeometry::ConfigurationType::MULTIPLE;
+  database.WriteInlierMatches(image_id1, image_id2, two_view_geometry);
+  BOOST_CHECK(
+      database.ReadInlierMatches(image_id1, image_id2).inlier_labels.empty());
+  database.DeleteInlierMatches(image_id1, image_id2);
+  for (size_t i = 0; i < two_view_geometry.inlier_matches.size(); ++i) {
+    two_view_geometry.inlier_labels.push_back(i < 6 ? 0 : 1);
+  }
+  database.WriteInlierMatches(image_id1, image_id2, two_view_geometry);
+  BOOST_CHECK(database.ReadInlierMatches(image_id1, image_id2).inlier_labels ==
+              two_view_geometry.inlier_labels);
+  BOOST_CHECK(database.ReadInlierMatches(image_id2, image_id1).inlier_labels ==
+              two_view_geometry.inlier_labels);
+  std::vector<image_pair_t> image_pair_ids;
+  std::vector<TwoViewGeometry> two_view_geometries;
+  database.ReadAllInlierMatches(&image_pair_ids, &two_view_geometries);
+  BOOST_CHECK_EQUAL(two_view_geometries.size(), 1);
+  BOOST_CHECK(two_view_geometries[0].inlier_labels ==
+              two_view_geometry.inlier_labels);
+}
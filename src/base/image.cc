@@ -47,6 +47,7 @@ void Image::SetUp(const class Camera& camera) {
   CHECK_EQ(camera_id_, camera.CameraId());
   point3D_visibility_pyramid_ = VisibilityPyramid(
       kNumPoint3DVisibilityPyramidLevels, camera.Width(), camera.Height());
+  ComputePoint2DCells(camera);
 }
 
 void Image::TearDown() {
@@ -57,6 +58,7 @@ void Image::SetPoints2D(const std::vector<Eigen::Vector2d>& points) {
   CHECK(points2D_.empty());
   points2D_.resize(points.size());
   num_correspondences_have_point3D_.resize(points.size(), 0);
+  correspondence_point3D_versions_.resize(points.size(), 0);
   for (point2D_t point2D_idx = 0; point2D_idx < points.size(); ++point2D_idx) {
     points2D_[point2D_idx].SetXY(points[point2D_idx]);
   }
@@ -66,6 +68,41 @@ void Image::SetPoints2D(const std::vector<class Point2D>& points) {
   CHECK(points2D_.empty());
   points2D_ = points;
   num_correspondences_have_point3D_.resize(points.size(), 0);
+  correspondence_point3D_versions_.resize(points.size(), 0);
+}
+
+void Image::ReleasePoints2D(const class Camera& camera) {
+  CHECK_EQ(camera_id_, camera.CameraId());
+  CHECK_EQ(num_points3D_, 0);
+  if (points2D_.empty()) {
+    return;
+  }
+  ComputePoint2DCells(camera);
+  std::vector<class Point2D>().swap(points2D_);
+}
+
+void Image::ComputePoint2DCells(const class Camera& camera) {
+  // The cells must fit into a byte per dimension.
+  CHECK_LE(kNumPoint3DVisibilityPyramidLevels, 8);
+  if (!point2D_cells_.empty() || points2D_.empty()) {
+    return;
+  }
+  point2D_cells_.resize(points2D_.size());
+  for (point2D_t point2D_idx = 0; point2D_idx < points2D_.size();
+       ++point2D_idx) {
+    size_t cx = 0;
+    size_t cy = 0;
+    VisibilityPyramid::CellForPoint(
+        kNumPoint3DVisibilityPyramidLevels, camera.Width(), camera.Height(),
+        points2D_[point2D_idx].X(), points2D_[point2D_idx].Y(), &cx, &cy);
+    point2D_cells_[point2D_idx] = static_cast<uint16_t>(cx | (cy << 8));
+  }
+}
+
+void Image::RestorePoints2D(const std::vector<class Point2D>& points) {
+  CHECK(HasReleasedPoints2D());
+  CHECK_EQ(points.size(), point2D_cells_.size());
+  points2D_ = points;
 }
 
 void Image::SetPoint3DForPoint2D(const point2D_t point2D_idx,
@@ -94,31 +131,49 @@ bool Image::HasPoint3D(const point3D_t point3D_id) const {
 }
 
 void Image::IncrementCorrespondenceHasPoint3D(const point2D_t point2D_idx) {
-  const class Point2D& point2D = points2D_.at(point2D_idx);
+  num_correspondences_have_point3D_.at(point2D_idx) += 1;
+  correspondence_point3D_versions_[point2D_idx] += 1;
 
-  num_correspondences_have_point3D_[point2D_idx] += 1;
+  // The pyramid only depends on which points are visible, so that it only
+  // changes with the first correspondence of a point.
   if (num_correspondences_have_point3D_[point2D_idx] == 1) {
     num_visible_points3D_ += 1;
+    SetPoint2DVisibility(point2D_idx, true);
   }
 
-  point3D_visibility_pyramid_.SetPoint(point2D.X(), point2D.Y());
-
   assert(num_visible_points3D_ <= num_observations_);
 }
 
 void Image::DecrementCorrespondenceHasPoint3D(const point2D_t point2D_idx) {
-  const class Point2D& point2D = points2D_.at(point2D_idx);
-
-  num_correspondences_have_point3D_[point2D_idx] -= 1;
+  num_correspondences_have_point3D_.at(point2D_idx) -= 1;
+  correspondence_point3D_versions_[point2D_idx] += 1;
   if (num_correspondences_have_point3D_[point2D_idx] == 0) {
     num_visible_points3D_ -= 1;
+    SetPoint2DVisibility(point2D_idx, false);
   }
 
-  point3D_visibility_pyramid_.ResetPoint(point2D.X(), point2D.Y());
-
   assert(num_visible_points3D_ <= num_observations_);
 }
 
+void Image::SetPoint2DVisibility(const point2D_t point2D_idx,
+                                 const bool visible) {
+  if (point2D_cells_.empty()) {
+    const class Point2D& point2D = points2D_.at(point2D_idx);
+    if (visible) {
+      point3D_visibility_pyramid_.SetPoint(point2D.X(), point2D.Y());
+    } else {
+      point3D_visibility_pyramid_.ResetPoint(point2D.X(), point2D.Y());
+    }
+  } else {
+    const uint16_t cell = point2D_cells_[point2D_idx];
+    if (visible) {
+      point3D_visibility_pyramid_.SetCell(cell & 0xFF, cell >> 8);
+    } else {
+      point3D_visibility_pyramid_.ResetCell(cell & 0xFF, cell >> 8);
+    }
+  }
+}
+
 void Image::NormalizeQvec() { qvec_ = NormalizeQuaternion(qvec_); }
 
 Eigen::Matrix3x4d Image::ProjectionMatrix() const {
@@ -32,6 +32,31 @@
 
 namespace colmap {
 
+// Body label of an image point, which is not an inlier of any pose.
+const uint8_t kInvalidBody = 255;
+
+// Tentative poses of an image found by the sequential PnP, one per rigidly
+// moving body, each with the 2D-3D correspondences that are its inliers.
+struct ImagePoseHypotheses {
+  std::vector<Eigen::Vector4d> qvecs;
+  std::vector<Eigen::Vector3d> tvecs;
+  std::vector<int> num_inliers;
+  std::vector<std::vector<std::pair<point2D_t, point3D_t>>> inlier_corrs;
+
+  // Per image point, the index of the first pose whose inliers contain it, or
+  // `kInvalidBody` if it is not an inlier of any pose. The labels remain after
+  // the inlier correspondences are released.
+  std::vector<uint8_t> point2D_bodies;
+
+  inline size_t Size() const { return qvecs.size(); }
+
+  // The body of an image point, or `kInvalidBody`.
+  inline uint8_t Body(const point2D_t point2D_idx) const {
+    return point2D_idx < point2D_bodies.size() ? point2D_bodies[point2D_idx]
+                                               : kInvalidBody;
+  }
+};
+
 // Class that holds information about an image. An image is the product of one
 // camera shot at a certain location (parameterized as the pose). An image may
 // share a camera with multiple other images, if its intrinsics are the same.
@@ -144,14 +169,15 @@ class Image {
   inline bool HasTvecPrior() const;
   inline void SetTvecPrior(const Eigen::Vector3d& tvec);
 
-  // Access tentative poses
-  // add new pose
-  inline void AddPose(const Eigen::Vector4d qvec, const Eigen::Vector3d tvec);
-  inline std::vector<Eigen::Vector4d> Qvecs();
-  inline std::vector<Eigen::Vector3d> Tvecs();
-
-  inline void AddInlierCorrs(const std::vector<std::pair<point2D_t, point3D_t>> ic);
-  inline std::vector<std::vector<std::pair<point2D_t, point3D_t>>> InlierCorrs();
+  // Access the tentative poses. The inlier correspondences are moved into
+  // the image, so that they are not copied again when the poses are used.
+  inline void AddPose(const Eigen::Vector4d& qvec, const Eigen::Vector3d& tvec,
+                      const int num_inliers,
+                      std::vector<std::pair<point2D_t, point3D_t>> inlier_corrs);
+  inline const ImagePoseHypotheses& PoseHypotheses() const;
+  // Release the inlier correspondences of the poses once the image and its
+  // phantom images are registered, but keep the poses and the body labels.
+  inline void ReleasePoseInlierCorrs();
 
   // Access the coordinates of image points.
   inline const class Point2D& Point2D(const point2D_t point2D_idx) const;
@@ -162,6 +188,15 @@ class Image {
 
   inline void ChangePoint2D(point2D_t id ,Eigen::Vector2d point);
 
+  // Release the image points, e.g. when they are kept in an out-of-core store,
+  // and restore them. While the points are released, only their number and
+  // their cells in the visibility pyramid are kept, which are computed with
+  // the camera of the image, so that the visibility score is still updated.
+  // The points can only be released if none of them is triangulated.
+  void ReleasePoints2D(const Camera& camera);
+  void RestorePoints2D(const std::vector<class Point2D>& points);
+  inline bool HasReleasedPoints2D() const;
+
   // Set the point as triangulated, i.e. it is part of a 3D point track.
   void SetPoint3DForPoint2D(const point2D_t point2D_idx,
                             const point3D_t point3D_id);
@@ -173,6 +208,11 @@ class Image {
   // another image that has a 3D point.
   inline bool IsPoint3DVisible(const point2D_t point2D_idx) const;
 
+  // Number of times that a correspondence of the image point gained or lost a
+  // 3D point. Used to detect stale 2D-3D correspondence searches.
+  inline uint32_t CorrespondencePoint3DVersion(
+      const point2D_t point2D_idx) const;
+
   // Check whether one of the image points is part of the 3D point track.
   bool HasPoint3D(const point3D_t point3D_id) const;
 
@@ -209,9 +249,15 @@ class Image {
   // The number of levels in the 3D point multi-resolution visibility pyramid.
   static const int kNumPoint3DVisibilityPyramidLevels;
 
-  std::vector<int> seq_inliers;
 
  private:
+  // Compute the cells of the image points in the visibility pyramid, unless
+  // they are already known.
+  void ComputePoint2DCells(const class Camera& camera);
+
+  // Add or remove an image point to or from the visibility pyramid.
+  void SetPoint2DVisibility(const point2D_t point2D_idx, const bool visible);
+
   // Identifier of the image, if not specified `kInvalidImageId`.
   image_t image_id_;
 
@@ -255,11 +301,7 @@ class Image {
   Eigen::Vector3d tvec_;
 
   // Tentative poses computed from sequential pnp
-  std::vector<Eigen::Vector4d> qvecs;
-  std::vector<Eigen::Vector3d> tvecs;
-
-  // Inliers of the tentative poses
-  std::vector<std::vector<std::pair<point2D_t, point3D_t>>> inlier_corrs;
+  ImagePoseHypotheses pose_hypotheses_;
 
   // The pose prior of the image, e.g. extracted from EXIF tags.
   Eigen::Vector4d qvec_prior_;
@@ -268,9 +310,17 @@ class Image {
   // All image points, including points that are not part of a 3D point track.
   std::vector<class Point2D> points2D_;
 
+  // Per image point, its cell in the finest level of the visibility pyramid,
+  // with the column in the low and the row in the high byte. Computed when
+  // the image is set up or its points are released.
+  std::vector<uint16_t> point2D_cells_;
+
   // Per image point, the number of correspondences that have a 3D point.
   std::vector<image_t> num_correspondences_have_point3D_;
 
+  // Per image point, the number of changes of the above counter.
+  std::vector<uint32_t> correspondence_point3D_versions_;
+
   // Data structure to compute the distribution of triangulated correspondences
   // in the image. Note that this structure is only usable after `SetUp`.
   VisibilityPyramid point3D_visibility_pyramid_;
@@ -308,6 +358,9 @@ bool Image::IsSeqRegistered() const { return seq_registered; }
 void Image::SetSeqRegistered(const bool seq_reg) { seq_registered = seq_reg; }
 
 point2D_t Image::NumPoints2D() const {
+  if (HasReleasedPoints2D()) {
+    return static_cast<point2D_t>(point2D_cells_.size());
+  }
   return static_cast<point2D_t>(points2D_.size());
 }
 
@@ -379,17 +432,32 @@ inline bool Image::HasTvecPrior() const { return !IsNaN(tvec_prior_.sum()); }
 
 void Image::SetTvecPrior(const Eigen::Vector3d& tvec) { tvec_prior_ = tvec; }
 
-inline void Image::AddPose(const Eigen::Vector4d qvec, const Eigen::Vector3d tvec)
+inline void Image::AddPose(const Eigen::Vector4d& qvec, const Eigen::Vector3d& tvec,
+                           const int num_inliers,
+                           std::vector<std::pair<point2D_t, point3D_t>> inlier_corrs)
 {
-	qvecs.push_back(qvec);
-	tvecs.push_back(tvec);
+	pose_hypotheses_.qvecs.push_back(qvec);
+	pose_hypotheses_.tvecs.push_back(tvec);
+	pose_hypotheses_.num_inliers.push_back(num_inliers);
+	//label the points which are not yet claimed by a previous pose
+	const size_t body = pose_hypotheses_.qvecs.size() - 1;
+	CHECK_LT(body, kInvalidBody);
+	for(const auto& corr : inlier_corrs)
+	{
+		if(corr.first >= pose_hypotheses_.point2D_bodies.size())
+			pose_hypotheses_.point2D_bodies.resize(corr.first + 1, kInvalidBody);
+		if(pose_hypotheses_.point2D_bodies[corr.first] == kInvalidBody)
+			pose_hypotheses_.point2D_bodies[corr.first] = static_cast<uint8_t>(body);
+	}
+	pose_hypotheses_.inlier_corrs.push_back(std::move(inlier_corrs));
 }
 
-inline std::vector<Eigen::Vector4d> Image::Qvecs() {return qvecs;}
-inline std::vector<Eigen::Vector3d> Image::Tvecs() {return tvecs;}
+inline const ImagePoseHypotheses& Image::PoseHypotheses() const {return pose_hypotheses_;}
 
-inline void Image::AddInlierCorrs(const std::vector<std::pair<point2D_t, point3D_t>> ic) {inlier_corrs.push_back(ic);}
-inline std::vector<std::vector<std::pair<point2D_t, point3D_t>>> Image::InlierCorrs() {return inlier_corrs;}
+inline void Image::ReleasePoseInlierCorrs()
+{
+	std::vector<std::vector<std::pair<point2D_t, point3D_t>>>().swap(pose_hypotheses_.inlier_corrs);
+}
 
 const class Point2D& Image::Point2D(const point2D_t point2D_idx) const {
   return points2D_.at(point2D_idx);
@@ -406,10 +474,19 @@ void Image::ChangePoint2D(point2D_t id ,Eigen::Vector2d point)
 	points2D_.at(id).SetXY(point);
 }
 
+bool Image::HasReleasedPoints2D() const {
+  return points2D_.empty() && !point2D_cells_.empty();
+}
+
 bool Image::IsPoint3DVisible(const point2D_t point2D_idx) const {
   return num_correspondences_have_point3D_.at(point2D_idx) > 0;
 }
 
+uint32_t Image::CorrespondencePoint3DVersion(
+    const point2D_t point2D_idx) const {
+  return correspondence_point3D_versions_.at(point2D_idx);
+}
+
 inline void Image::SetGroup(int g) { group = g;}
 inline int Image::Group() {return group;}
 //inline void Image::SetGroup(int g) const { group = g;}
@@ -22,6 +22,12 @@ namespace colmap {
 
 bool ImageReaderOptions::Check() const {
   CHECK_OPTION_GT(default_focal_length_factor, 0.0);
+  CHECK_OPTION_GE(num_decode_threads, -1);
+  CHECK_OPTION_GT(max_num_prefetched_images, 0);
+  CHECK_OPTION_GT(prefetch_cache_size, 0);
+  CHECK_OPTION_NE(max_image_size, 0);
+  CHECK_OPTION(!IsRemoteImagePath(image_path) || !image_list.empty());
+  CHECK_OPTION(image_source.Check());
   CHECK_OPTION(ExistsCameraModelWithName(camera_model));
   const int model_id = CameraModelNameToId(camera_model);
   if (!camera_params.empty()) {
@@ -32,7 +38,13 @@ bool ImageReaderOptions::Check() const {
 }
 
 ImageReader::ImageReader(const ImageReaderOptions& options, Database* database)
-    : options_(options), database_(database), image_index_(0) {
+    : options_(options),
+      database_(database),
+      image_index_(0),
+      prefetch_index_(0),
+      prefetched_num_bytes_(0),
+      bitmap_num_bytes_(0),
+      fetch_index_(0) {
   CHECK(options_.Check());
 
   // Ensure trailing slash, so that we can build the correct image name.
@@ -55,6 +67,12 @@ ImageReader::ImageReader(const ImageReaderOptions& options, Database* database)
   if (!options_.camera_params.empty()) {
     prev_camera_.SetParamsFromString(options_.camera_params);
   }
+
+  if (options_.num_decode_threads != 0) {
+    decode_thread_pool_.reset(new ThreadPool(options_.num_decode_threads));
+  }
+
+  image_source_ = CreateImageSource(options_.image_path, options_.image_source);
 }
 
 ImageReader::Status ImageReader::Next(Camera* camera, Image* image,
@@ -74,11 +92,7 @@ ImageReader::Status ImageReader::Next(Camera* camera, Image* image,
   // Set the image name.
   //////////////////////////////////////////////////////////////////////////////
 
-  image->SetName(image_path);
-  image->SetName(StringReplace(image->Name(), "\\", "/"));
-  image->SetName(
-      image->Name().substr(options_.image_path.size(),
-                           image->Name().size() - options_.image_path.size()));
+  image->SetName(ImageName(image_path));
 
   //////////////////////////////////////////////////////////////////////////////
   // Check if image already read.
@@ -89,8 +103,10 @@ ImageReader::Status ImageReader::Next(Camera* camera, Image* image,
   if (exists_image) {
     *image = database_->ReadImageWithName(image->Name());
     const bool exists_keypoints = database_->ExistsKeypoints(image->ImageId());
+    // The descriptors may have been replaced by their codes.
     const bool exists_descriptors =
-        database_->ExistsDescriptors(image->ImageId());
+        database_->ExistsDescriptors(image->ImageId()) ||
+        database_->ExistsDescriptorCodes(image->ImageId());
 
     if (exists_keypoints && exists_descriptors) {
       return Status::IMAGE_EXISTS;
@@ -101,7 +117,11 @@ ImageReader::Status ImageReader::Next(Camera* camera, Image* image,
   // Read image.
   //////////////////////////////////////////////////////////////////////////////
 
-  if (!bitmap->Read(image_path, false)) {
+  // The dimensions of the full image, which may have been decoded at a reduced
+  // resolution.
+  int width = 0;
+  int height = 0;
+  if (!ReadBitmap(image_path, bitmap, &width, &height)) {
     return Status::BITMAP_ERROR;
   }
 
@@ -118,8 +138,8 @@ ImageReader::Status ImageReader::Next(Camera* camera, Image* image,
       return Status::CAMERA_SINGLE_ERROR;
     }
 
-    if (static_cast<size_t>(bitmap->Width()) != camera.Width() ||
-        static_cast<size_t>(bitmap->Height()) != camera.Height()) {
+    if (static_cast<size_t>(width) != camera.Width() ||
+        static_cast<size_t>(height) != camera.Height()) {
       return Status::CAMERA_DIM_ERROR;
     }
   }
@@ -129,13 +149,13 @@ ImageReader::Status ImageReader::Next(Camera* camera, Image* image,
   //////////////////////////////////////////////////////////////////////////////
 
   if (options_.single_camera && prev_camera_.CameraId() != kInvalidCameraId &&
-      (prev_camera_.Width() != static_cast<size_t>(bitmap->Width()) ||
-       prev_camera_.Height() != static_cast<size_t>(bitmap->Height()))) {
+      (prev_camera_.Width() != static_cast<size_t>(width) ||
+       prev_camera_.Height() != static_cast<size_t>(height))) {
     return Status::CAMERA_SINGLE_ERROR;
   }
 
-  prev_camera_.SetWidth(static_cast<size_t>(bitmap->Width()));
-  prev_camera_.SetHeight(static_cast<size_t>(bitmap->Height()));
+  prev_camera_.SetWidth(static_cast<size_t>(width));
+  prev_camera_.SetHeight(static_cast<size_t>(height));
 
   //////////////////////////////////////////////////////////////////////////////
   // Extract camera model and focal length
@@ -146,10 +166,13 @@ ImageReader::Status ImageReader::Next(Camera* camera, Image* image,
       // Extract focal length.
       double focal_length = 0.0;
       if (bitmap->ExifFocalLength(&focal_length)) {
+        // The focal length is in pixels of the decoded image.
+        focal_length *= static_cast<double>(std::max(width, height)) /
+                        std::max(bitmap->Width(), bitmap->Height());
         prev_camera_.SetPriorFocalLength(true);
       } else {
         focal_length = options_.default_focal_length_factor *
-                       std::max(bitmap->Width(), bitmap->Height());
+                       std::max(width, height);
         prev_camera_.SetPriorFocalLength(false);
       }
 
@@ -184,6 +207,149 @@ ImageReader::Status ImageReader::Next(Camera* camera, Image* image,
   return Status::SUCCESS;
 }
 
+void ImageReader::SetHeaderOnlyPredicate(
+    const HeaderOnlyPredicate& predicate) {
+  CHECK_EQ(image_index_, 0);
+  header_only_predicate_ = predicate;
+}
+
+std::string ImageReader::ImageName(const std::string& image_path) const {
+  const std::string image_name = StringReplace(image_path, "\\", "/");
+  return image_name.substr(options_.image_path.size(),
+                           image_name.size() - options_.image_path.size());
+}
+
+bool ImageReader::ExistsImageFeatures(const std::string& image_name) const {
+  if (!database_->ExistsImageWithName(image_name)) {
+    return false;
+  }
+  const image_t image_id = database_->ReadImageWithName(image_name).ImageId();
+  return database_->ExistsKeypoints(image_id) &&
+         (database_->ExistsDescriptors(image_id) ||
+          database_->ExistsDescriptorCodes(image_id));
+}
+
+void ImageReader::PrefetchBitmaps() {
+  const size_t max_num_bytes =
+      static_cast<size_t>(1024.0 * 1024.0 * 1024.0 *
+                          options_.prefetch_cache_size);
+
+  prefetch_index_ = std::max(prefetch_index_, image_index_ - 1);
+  while (prefetch_index_ < options_.image_list.size() &&
+         prefetched_bitmaps_.size() <
+             static_cast<size_t>(options_.max_num_prefetched_images) &&
+         (prefetched_bitmaps_.empty() ||
+          prefetched_num_bytes_ + bitmap_num_bytes_ <= max_num_bytes)) {
+    const size_t index = prefetch_index_;
+    prefetch_index_ += 1;
+
+    // Images with features are skipped by `Next` without being read.
+    const std::string& image_path = options_.image_list[index];
+    if (ExistsImageFeatures(ImageName(image_path))) {
+      continue;
+    }
+
+    PrefetchedBitmap prefetched_bitmap;
+    prefetched_bitmap.index = index;
+    prefetched_bitmap.num_bytes = bitmap_num_bytes_;
+    prefetched_bitmap.decoded_bitmap.reset(new DecodedBitmap());
+    DecodedBitmap* decoded_bitmap = prefetched_bitmap.decoded_bitmap.get();
+    prefetched_bitmap.success = decode_thread_pool_->AddTask(
+        [this, decoded_bitmap, image_path]() {
+          return ReadImage(image_path, &decoded_bitmap->bitmap,
+                           &decoded_bitmap->width, &decoded_bitmap->height);
+        });
+
+    prefetched_num_bytes_ += prefetched_bitmap.num_bytes;
+    prefetched_bitmaps_.push_back(std::move(prefetched_bitmap));
+  }
+}
+
+void ImageReader::PrefetchImageFiles() {
+  const size_t max_num_prefetched_images =
+      static_cast<size_t>(options_.image_source.max_num_prefetched_images);
+  std::vector<std::string> image_names;
+  fetch_index_ = std::max(fetch_index_, image_index_ - 1);
+  while (fetch_index_ < options_.image_list.size() &&
+         fetch_index_ < image_index_ - 1 + max_num_prefetched_images) {
+    const std::string image_name =
+        ImageName(options_.image_list[fetch_index_]);
+    fetch_index_ += 1;
+    if (!ExistsImageFeatures(image_name)) {
+      image_names.push_back(image_name);
+    }
+  }
+  image_source_->Prefetch(image_names);
+}
+
+bool ImageReader::ReadImage(const std::string& image_path, Bitmap* bitmap,
+                            int* width, int* height) {
+  const std::string image_name = ImageName(image_path);
+  std::string path;
+  if (!image_source_->Acquire(image_name, &path)) {
+    return false;
+  }
+
+  bool success = false;
+  if (header_only_predicate_ && header_only_predicate_(image_name, path)) {
+    success = bitmap->ReadHeader(path);
+    *width = bitmap->Width();
+    *height = bitmap->Height();
+  } else {
+    success = bitmap->Read(path, false, options_.max_image_size);
+    *width = bitmap->Width();
+    *height = bitmap->Height();
+    if (success && options_.max_image_size > 0) {
+      success = Bitmap::ReadDimensions(path, width, height);
+    }
+  }
+
+  image_source_->Release(image_name);
+  return success;
+}
+
+bool ImageReader::ReadBitmap(const std::string& image_path, Bitmap* bitmap,
+                             int* width, int* height) {
+  if (IsRemoteImagePath(options_.image_path)) {
+    PrefetchImageFiles();
+  }
+
+  if (!decode_thread_pool_) {
+    return ReadImage(image_path, bitmap, width, height);
+  }
+
+  const size_t index = image_index_ - 1;
+
+  // Release the images that were skipped since they were prefetched.
+  while (!prefetched_bitmaps_.empty() &&
+         prefetched_bitmaps_.front().index < index) {
+    prefetched_bitmaps_.front().success.wait();
+    prefetched_num_bytes_ -= prefetched_bitmaps_.front().num_bytes;
+    prefetched_bitmaps_.pop_front();
+  }
+
+  PrefetchBitmaps();
+
+  if (prefetched_bitmaps_.empty() ||
+      prefetched_bitmaps_.front().index != index) {
+    return ReadImage(image_path, bitmap, width, height);
+  }
+
+  PrefetchedBitmap& prefetched_bitmap = prefetched_bitmaps_.front();
+  const bool success = prefetched_bitmap.success.get();
+  *bitmap = std::move(prefetched_bitmap.decoded_bitmap->bitmap);
+  *width = prefetched_bitmap.decoded_bitmap->width;
+  *height = prefetched_bitmap.decoded_bitmap->height;
+  bitmap_num_bytes_ = std::max(bitmap_num_bytes_, bitmap->NumBytes());
+  prefetched_num_bytes_ -= prefetched_bitmap.num_bytes;
+  prefetched_bitmaps_.pop_front();
+
+  // Replace the consumed image with the next one.
+  PrefetchBitmaps();
+
+  return success;
+}
+
 size_t ImageReader::NextIndex() const { return image_index_; }
 
 size_t ImageReader::NumImages() const { return options_.image_list.size(); }
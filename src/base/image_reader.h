@@ -17,8 +17,14 @@
 #ifndef COLMAP_SRC_BASE_IMAGE_READER_H_
 #define COLMAP_SRC_BASE_IMAGE_READER_H_
 
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+
 #include "base/database.h"
 #include "util/bitmap.h"
+#include "util/image_source.h"
 #include "util/threading.h"
 
 namespace colmap {
@@ -27,13 +33,18 @@ struct ImageReaderOptions {
   // Path to database in which to store the extracted data.
   std::string database_path = "";
 
-  // Root path to folder which contains the image.
+  // Root path to folder which contains the image, or the URL of a remote
+  // folder, e.g. "s3://bucket/images", whose images are fetched as configured
+  // by `image_source` ahead of their decoding.
   std::string image_path = "";
 
   // Optional list of images to read. The list must contain the relative path
-  // of the images with respect to the image_path.
+  // of the images with respect to the image_path. Required for remote images.
   std::vector<std::string> image_list;
 
+  // Fetching of remote images.
+  ImageSourceOptions image_source;
+
   // Name of the camera model.
   std::string camera_model = "SIMPLE_RADIAL";
 
@@ -49,6 +60,20 @@ struct ImageReaderOptions {
   // value `default_focal_length_factor * max(width, height)`.
   double default_focal_length_factor = 1.2;
 
+  // Number of threads that decode the images ahead of `Next`, where -1 uses
+  // all cores and 0 decodes every image in `Next`. At most
+  // `max_num_prefetched_images` images and, as estimated from the largest
+  // image so far, `prefetch_cache_size` gigabytes are decoded in advance.
+  int num_decode_threads = -1;
+  int max_num_prefetched_images = 16;
+  double prefetch_cache_size = 2.0;
+
+  // If positive, JPEG images are decoded at a reduced resolution whose larger
+  // dimension is at least this size, see `Bitmap::Read`, while the cameras
+  // keep the dimensions of the full images. For readers whose images are
+  // downsized to this size anyway, e.g. for feature extraction.
+  int max_image_size = -1;
+
   bool Check() const;
 };
 
@@ -70,10 +95,54 @@ class ImageReader {
   explicit ImageReader(const ImageReaderOptions& options, Database* database);
 
   Status Next(Camera* camera, Image* image, Bitmap* bitmap);
+
+  // Set a predicate, which is called with the name and the local file of every
+  // image before it is decoded, possibly by the decode threads concurrently.
+  // If it returns true, only the header and the metadata of the image are read
+  // and `Next` returns a bitmap without pixels, e.g. for images whose features
+  // are taken from a cache. Must be set before the first call to `Next`.
+  typedef std::function<bool(const std::string& image_name,
+                             const std::string& path)>
+      HeaderOnlyPredicate;
+  void SetHeaderOnlyPredicate(const HeaderOnlyPredicate& predicate);
   size_t NextIndex() const;
   size_t NumImages() const;
 
  private:
+  // An image, which is decoded by the decode threads, and the dimensions of
+  // the full image.
+  struct DecodedBitmap {
+    Bitmap bitmap;
+    int width = 0;
+    int height = 0;
+  };
+  struct PrefetchedBitmap {
+    size_t index;
+    size_t num_bytes;
+    std::unique_ptr<DecodedBitmap> decoded_bitmap;
+    std::future<bool> success;
+  };
+
+  std::string ImageName(const std::string& image_path) const;
+  bool ExistsImageFeatures(const std::string& image_name) const;
+
+  // Start decoding the next images, as long as the prefetch limits permit.
+  void PrefetchBitmaps();
+
+  // Start fetching the files of the next images of a remote source, which
+  // runs further ahead than the decoding.
+  void PrefetchImageFiles();
+
+  // Read the bitmap of an image, and its full dimensions if it is decoded at
+  // a reduced resolution.
+  bool ReadImage(const std::string& image_path, Bitmap* bitmap, int* width,
+                 int* height);
+
+  // Read the bitmap of the current image, from the prefetched images if it
+  // was prefetched.
+  bool ReadBitmap(const std::string& image_path, Bitmap* bitmap, int* width,
+                  int* height);
+
   // Image reader options.
   ImageReaderOptions options_;
   Database* database_;
@@ -81,6 +150,20 @@ class ImageReader {
   size_t image_index_;
   // Previously processed camera.
   Camera prev_camera_;
+
+  // The images being decoded in the order of their index, the index of the
+  // next image to prefetch, and the reserved and estimated bytes per image.
+  std::deque<PrefetchedBitmap> prefetched_bitmaps_;
+  size_t prefetch_index_;
+  size_t prefetched_num_bytes_;
+  size_t bitmap_num_bytes_;
+  std::unique_ptr<ThreadPool> decode_thread_pool_;
+
+  // The source of the image files and the index of the next image to fetch.
+  std::unique_ptr<ImageSource> image_source_;
+  size_t fetch_index_;
+
+  HeaderOnlyPredicate header_only_predicate_;
 };
 
 }  // namespace colmap
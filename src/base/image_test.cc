@@ -137,6 +137,8 @@ BOOST_AUTO_TEST_CASE(TestNumVisiblePoints3D) {
   BOOST_CHECK_EQUAL(image.NumVisiblePoints3D(), 1);
   image.DecrementCorrespondenceHasPoint3D(1);
   BOOST_CHECK_EQUAL(image.NumVisiblePoints3D(), 0);
+  BOOST_CHECK_EQUAL(image.CorrespondencePoint3DVersion(0), 4);
+  BOOST_CHECK_EQUAL(image.CorrespondencePoint3DVersion(1), 2);
 }
 
 BOOST_AUTO_TEST_CASE(TestPoint3DVisibilityScore) {
@@ -352,3 +354,97 @@ BOOST_AUTO_TEST_CASE(TestViewingDirection) {
   Image image;
   BOOST_CHECK(image.ViewingDirection().isApprox(Eigen::Vector3d(0, 0, 1)));
 }
+
+BOOST_AUTO_TEST_CASE(TestPoseHypotheses) {
+  Image image;
+  BOOST_CHECK_EQUAL(image.PoseHypotheses().Size(), 0);
+  std::vector<std::pair<point2D_t, point3D_t>> inlier_corrs;
+  inlier_corrs.emplace_back(0, 1);
+  inlier_corrs.emplace_back(2, 3);
+  image.AddPose(Eigen::Vector4d(1, 0, 0, 0), Eigen::Vector3d(1, 2, 3), 2,
+                inlier_corrs);
+  image.AddPose(Eigen::Vector4d(0, 1, 0, 0), Eigen::Vector3d(4, 5, 6), 0,
+                std::vector<std::pair<point2D_t, point3D_t>>());
+  const ImagePoseHypotheses& poses = image.PoseHypotheses();
+  BOOST_CHECK_EQUAL(poses.Size(), 2);
+  BOOST_CHECK_EQUAL(poses.qvecs[1], Eigen::Vector4d(0, 1, 0, 0));
+  BOOST_CHECK_EQUAL(poses.tvecs[0], Eigen::Vector3d(1, 2, 3));
+  BOOST_CHECK_EQUAL(poses.num_inliers[0], 2);
+  BOOST_CHECK_EQUAL(poses.num_inliers[1], 0);
+  BOOST_CHECK_EQUAL(poses.inlier_corrs[0].size(), 2);
+  BOOST_CHECK_EQUAL(poses.inlier_corrs[0][1].second, 3);
+  BOOST_CHECK_EQUAL(poses.inlier_corrs[1].size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestPoseHypothesesBodies) {
+  Image image;
+  std::vector<std::pair<point2D_t, point3D_t>> inlier_corrs1;
+  inlier_corrs1.emplace_back(1, 1);
+  inlier_corrs1.emplace_back(3, 2);
+  std::vector<std::pair<point2D_t, point3D_t>> inlier_corrs2;
+  inlier_corrs2.emplace_back(3, 2);
+  inlier_corrs2.emplace_back(5, 4);
+  image.AddPose(Eigen::Vector4d(1, 0, 0, 0), Eigen::Vector3d(1, 2, 3), 2,
+                inlier_corrs1);
+  image.AddPose(Eigen::Vector4d(0, 1, 0, 0), Eigen::Vector3d(4, 5, 6), 2,
+                inlier_corrs2);
+  const ImagePoseHypotheses& poses = image.PoseHypotheses();
+  BOOST_CHECK_EQUAL(poses.Body(0), kInvalidBody);
+  BOOST_CHECK_EQUAL(poses.Body(1), 0);
+  BOOST_CHECK_EQUAL(poses.Body(2), kInvalidBody);
+  BOOST_CHECK_EQUAL(poses.Body(3), 0);
+  BOOST_CHECK_EQUAL(poses.Body(5), 1);
+  BOOST_CHECK_EQUAL(poses.Body(6), kInvalidBody);
+  image.ReleasePoseInlierCorrs();
+  BOOST_CHECK_EQUAL(poses.Size(), 2);
+  BOOST_CHECK(poses.inlier_corrs.empty());
+  BOOST_CHECK_EQUAL(poses.Body(5), 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestReleasePoints2D) {
+  Camera camera;
+  camera.SetCameraId(1);
+  camera.SetWidth(10);
+  camera.SetHeight(10);
+  std::vector<Eigen::Vector2d> points(10);
+  for (size_t i = 0; i < points.size(); ++i) {
+    points[i] = Eigen::Vector2d(i, 9 - i);
+  }
+
+  Image image;
+  image.SetCameraId(camera.CameraId());
+  image.SetPoints2D(points);
+  image.SetNumObservations(10);
+  image.SetUp(camera);
+  BOOST_CHECK(!image.HasReleasedPoints2D());
+
+  // The visibility score of released points must match the one of the points.
+  Image released_image = image;
+  const std::vector<class Point2D> points2D = image.Points2D();
+  released_image.ReleasePoints2D(camera);
+  BOOST_CHECK(released_image.HasReleasedPoints2D());
+  BOOST_CHECK_EQUAL(released_image.NumPoints2D(), 10);
+  BOOST_CHECK(released_image.Points2D().empty());
+  for (point2D_t point2D_idx = 0; point2D_idx < 10; point2D_idx += 3) {
+    image.IncrementCorrespondenceHasPoint3D(point2D_idx);
+    released_image.IncrementCorrespondenceHasPoint3D(point2D_idx);
+  }
+  BOOST_CHECK_EQUAL(released_image.NumVisiblePoints3D(),
+                    image.NumVisiblePoints3D());
+  BOOST_CHECK_EQUAL(released_image.Point3DVisibilityScore(),
+                    image.Point3DVisibilityScore());
+
+  released_image.RestorePoints2D(points2D);
+  BOOST_CHECK(!released_image.HasReleasedPoints2D());
+  BOOST_CHECK_EQUAL(released_image.NumPoints2D(), 10);
+  BOOST_CHECK_EQUAL(released_image.Point2D(3).XY(), points[3]);
+  released_image.DecrementCorrespondenceHasPoint3D(3);
+  image.DecrementCorrespondenceHasPoint3D(3);
+  BOOST_CHECK_EQUAL(released_image.Point3DVisibilityScore(),
+                    image.Point3DVisibilityScore());
+
+  // Points that were restored are released again without recomputing cells.
+  released_image.ReleasePoints2D(camera);
+  BOOST_CHECK(released_image.HasReleasedPoints2D());
+  BOOST_CHECK_EQUAL(released_image.NumPoints2D(), 10);
+}
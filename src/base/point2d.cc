@@ -19,6 +19,6 @@
 namespace colmap {
 
 Point2D::Point2D()
-    : xy_(Eigen::Vector2d::Zero()), point3D_id_(kInvalidPoint3DId) {}
+    : xy_(0, 0), point3D_id_(kInvalidPoint3DId) {}
 
 }  // namespace colmap
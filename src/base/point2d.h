@@ -32,9 +32,10 @@ class Point2D {
 
   Point2D();
 
-  // The coordinate in image space in pixels.
-  inline const Eigen::Vector2d& XY() const;
-  inline Eigen::Vector2d& XY();
+  // The coordinate in image space in pixels. It is stored in single precision
+  // if `FLOAT_POINTS2D_ENABLED` is defined and always returned in double
+  // precision, e.g. for the bundle adjustment.
+  inline Eigen::Vector2d XY() const;
   inline double X() const;
   inline double Y() const;
   inline void SetXY(const Eigen::Vector2d& xy);
@@ -47,7 +48,13 @@ class Point2D {
 
  private:
   // The image coordinates in pixels, starting at upper left corner with 0.
+  // Single precision is far below the noise of the feature detection and
+  // shrinks the point from 24 to 16 bytes.
+#ifdef FLOAT_POINTS2D_ENABLED
+  Eigen::Vector2f xy_;
+#else
   Eigen::Vector2d xy_;
+#endif
 
   // The identifier of the 3D point. If the 2D point is not part of a 3D point
   // track the identifier is `kInvalidPoint3DId` and `HasPoint3D() = false`.
@@ -58,15 +65,15 @@ class Point2D {
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
 
-const Eigen::Vector2d& Point2D::XY() const { return xy_; }
-
-Eigen::Vector2d& Point2D::XY() { return xy_; }
+Eigen::Vector2d Point2D::XY() const { return xy_.cast<double>(); }
 
 double Point2D::X() const { return xy_.x(); }
 
 double Point2D::Y() const { return xy_.y(); }
 
-void Point2D::SetXY(const Eigen::Vector2d& xy) { xy_ = xy; }
+void Point2D::SetXY(const Eigen::Vector2d& xy) {
+  xy_ = xy.cast<decltype(xy_)::Scalar>();
+}
 
 point3D_t Point2D::Point3DId() const { return point3D_id_; }
 
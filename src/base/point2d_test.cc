@@ -37,11 +37,25 @@ BOOST_AUTO_TEST_CASE(TestXY) {
   BOOST_CHECK_EQUAL(point2D.Y(), 0);
   BOOST_CHECK_EQUAL(point2D.XY()[0], point2D.X());
   BOOST_CHECK_EQUAL(point2D.XY()[1], point2D.Y());
+  point2D.SetXY(Eigen::Vector2d(0.5, 0.25));
+  BOOST_CHECK_EQUAL(point2D.X(), 0.5);
+  BOOST_CHECK_EQUAL(point2D.Y(), 0.25);
+  BOOST_CHECK_EQUAL(point2D.XY()[0], point2D.X());
+  BOOST_CHECK_EQUAL(point2D.XY()[1], point2D.Y());
+}
+
+BOOST_AUTO_TEST_CASE(TestXYPrecision) {
+  Point2D point2D;
   point2D.SetXY(Eigen::Vector2d(0.1, 0.2));
+#ifdef FLOAT_POINTS2D_ENABLED
+  BOOST_CHECK_EQUAL(point2D.X(), static_cast<double>(0.1f));
+  BOOST_CHECK_EQUAL(point2D.Y(), static_cast<double>(0.2f));
+  BOOST_CHECK_EQUAL(sizeof(Point2D), 16);
+#else
   BOOST_CHECK_EQUAL(point2D.X(), 0.1);
   BOOST_CHECK_EQUAL(point2D.Y(), 0.2);
-  BOOST_CHECK_EQUAL(point2D.XY()[0], point2D.X());
-  BOOST_CHECK_EQUAL(point2D.XY()[1], point2D.Y());
+#endif
+  BOOST_CHECK_EQUAL(point2D.XY(), Eigen::Vector2d(point2D.X(), point2D.Y()));
 }
 
 BOOST_AUTO_TEST_CASE(TestPoint3DId) {
@@ -0,0 +1,133 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "base/points2d_store.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include "util/endian.h"
+#include "util/logging.h"
+
+namespace colmap {
+namespace {
+
+const char kPoints2DStoreMagic[8] = {'T', 'B', 'S', 'F', 'M', 'P', '2', '\0'};
+
+// Size of the header of every image, i.e. its identifier and number of points.
+const size_t kImageHeaderSize = sizeof(image_t) + sizeof(uint64_t);
+
+}  // namespace
+
+Points2DStore::Points2DStore() : owns_file_(false) {}
+
+Points2DStore::~Points2DStore() { Close(); }
+
+void Points2DStore::Create(const std::string& path,
+                           const EIGEN_STL_UMAP(image_t, class Image) &
+                               images) {
+  Close();
+
+  {
+    std::ofstream file(path, std::ios::trunc | std::ios::binary);
+    CHECK(file.is_open()) << path;
+    file.write(kPoints2DStoreMagic, sizeof(kPoints2DStoreMagic));
+    WriteBinaryLittleEndian<uint64_t>(&file, images.size());
+    for (const auto& image : images) {
+      WriteBinaryLittleEndian<image_t>(&file, image.first);
+      WriteBinaryLittleEndian<uint64_t>(&file, image.second.Points2D().size());
+      for (const auto& point2D : image.second.Points2D()) {
+        WriteBinaryLittleEndian<double>(&file, point2D.X());
+        WriteBinaryLittleEndian<double>(&file, point2D.Y());
+      }
+    }
+    CHECK(file.good()) << "Could not write " << path;
+  }
+
+  CHECK(Open(path)) << path;
+  owns_file_ = true;
+}
+
+bool Points2DStore::Open(const std::string& path) {
+  Close();
+
+  if (!file_.Open(path, /* sequential */ false)) {
+    return false;
+  }
+
+  MappedFileReader reader(file_);
+  char magic[sizeof(kPoints2DStoreMagic)];
+  for (size_t i = 0; i < sizeof(magic); ++i) {
+    magic[i] = reader.Read<char>();
+  }
+  if (!reader.Good() ||
+      !std::equal(magic, magic + sizeof(magic), kPoints2DStoreMagic)) {
+    Close();
+    return false;
+  }
+
+  // Only the headers of the images are read to build the index, the
+  // coordinates are skipped without touching their pages.
+  const size_t num_images = reader.ReadCount(kImageHeaderSize);
+  if (!reader.Good()) {
+    Close();
+    return false;
+  }
+  index_.reserve(num_images);
+  size_t offset = reader.Position();
+  for (size_t i = 0; i < num_images; ++i) {
+    MappedFileReader header(file_.Data() + offset, file_.Size() - offset);
+    const image_t image_id = header.Read<image_t>();
+    const size_t num_points2D = header.ReadCount(2 * sizeof(double));
+    if (!header.Good()) {
+      Close();
+      return false;
+    }
+    offset += kImageHeaderSize;
+    index_.emplace(image_id, std::make_pair(offset, num_points2D));
+    offset += num_points2D * 2 * sizeof(double);
+  }
+
+  path_ = path;
+  return true;
+}
+
+void Points2DStore::Close() {
+  file_.Close();
+  index_.clear();
+  if (owns_file_) {
+    std::remove(path_.c_str());
+    owns_file_ = false;
+  }
+  path_.clear();
+}
+
+std::vector<class Point2D> Points2DStore::Read(const image_t image_id) const {
+  const auto& entry = index_.at(image_id);
+  MappedFileReader reader(file_.Data() + entry.first,
+                          entry.second * 2 * sizeof(double));
+  std::vector<double> coords;
+  reader.Read(&coords, 2 * entry.second);
+  CHECK(reader.Good());
+  std::vector<class Point2D> points2D(entry.second);
+  for (size_t i = 0; i < entry.second; ++i) {
+    points2D[i].SetXY(Eigen::Vector2d(coords[2 * i], coords[2 * i + 1]));
+  }
+  return points2D;
+}
+
+}  // namespace colmap
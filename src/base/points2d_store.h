@@ -0,0 +1,81 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_BASE_POINTS2D_STORE_H_
+#define COLMAP_SRC_BASE_POINTS2D_STORE_H_
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base/image.h"
+#include "base/point2d.h"
+#include "util/alignment.h"
+#include "util/mapped_file.h"
+#include "util/types.h"
+
+namespace colmap {
+
+// Out-of-core store of the image points of many images in a binary file. The
+// file is memory-mapped, so that the points of an image are only paged in from
+// disk when they are read and the OS can page them out again under memory
+// pressure. Only the coordinates of the points are stored.
+class Points2DStore {
+ public:
+  Points2DStore();
+  ~Points2DStore();
+
+  Points2DStore(const Points2DStore&) = delete;
+  Points2DStore& operator=(const Points2DStore&) = delete;
+
+  // Write the points of the images to a new file and open it. The store owns
+  // the file, which is removed when the store is closed.
+  void Create(const std::string& path,
+              const EIGEN_STL_UMAP(image_t, class Image) & images);
+
+  // Open an existing file. Returns false if it cannot be opened or is
+  // truncated.
+  bool Open(const std::string& path);
+  void Close();
+
+  inline size_t NumImages() const;
+  inline bool HasImage(const image_t image_id) const;
+
+  // Read the points of an image, whose identifiers of 3D points are invalid.
+  std::vector<class Point2D> Read(const image_t image_id) const;
+
+ private:
+  std::string path_;
+  bool owns_file_;
+  MappedFile file_;
+  // Offset of the coordinates of every image in the file and their number.
+  std::unordered_map<image_t, std::pair<size_t, size_t>> index_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+size_t Points2DStore::NumImages() const { return index_.size(); }
+
+bool Points2DStore::HasImage(const image_t image_id) const {
+  return index_.count(image_id) > 0;
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_BASE_POINTS2D_STORE_H_
@@ -0,0 +1,116 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "base/points2d_store"
+#include "util/testing.h"
+
+#include <fstream>
+#include <iterator>
+
+#include <boost/filesystem.hpp>
+
+#include "base/points2d_store.h"
+
+using namespace colmap;
+
+namespace {
+
+std::string TempStorePath() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("points2d_store_test_%%%%%%%%.bin"))
+      .string();
+}
+
+EIGEN_STL_UMAP(image_t, Image) CreateImages() {
+  EIGEN_STL_UMAP(image_t, Image) images;
+  for (image_t image_id = 1; image_id <= 3; ++image_id) {
+    std::vector<Eigen::Vector2d> points(image_id * 5);
+    for (size_t i = 0; i < points.size(); ++i) {
+      points[i] = Eigen::Vector2d(image_id + i, image_id - 0.5 * i);
+    }
+    Image image;
+    image.SetImageId(image_id);
+    image.SetPoints2D(points);
+    images.emplace(image_id, image);
+  }
+  // An image without points.
+  Image image;
+  image.SetImageId(4);
+  images.emplace(4, image);
+  return images;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestCreateRead) {
+  const std::string path = TempStorePath();
+  const EIGEN_STL_UMAP(image_t, Image) images = CreateImages();
+  {
+    Points2DStore store;
+    store.Create(path, images);
+    BOOST_CHECK(boost::filesystem::exists(path));
+    BOOST_CHECK_EQUAL(store.NumImages(), images.size());
+    BOOST_CHECK(!store.HasImage(5));
+    for (const auto& image : images) {
+      BOOST_CHECK(store.HasImage(image.first));
+      const std::vector<Point2D> points2D = store.Read(image.first);
+      BOOST_CHECK_EQUAL(points2D.size(), image.second.NumPoints2D());
+      for (size_t i = 0; i < points2D.size(); ++i) {
+        BOOST_CHECK_EQUAL(points2D[i].XY(), image.second.Point2D(i).XY());
+        BOOST_CHECK(!points2D[i].HasPoint3D());
+      }
+    }
+
+    // A second reader of the same file does not own it.
+    Points2DStore reader;
+    BOOST_CHECK(reader.Open(path));
+    BOOST_CHECK_EQUAL(reader.NumImages(), images.size());
+    BOOST_CHECK_EQUAL(reader.Read(3).size(), 15);
+    reader.Close();
+    BOOST_CHECK(boost::filesystem::exists(path));
+  }
+  // The file of a created store is removed with it.
+  BOOST_CHECK(!boost::filesystem::exists(path));
+}
+
+BOOST_AUTO_TEST_CASE(TestOpenInvalid) {
+  Points2DStore store;
+  BOOST_CHECK(!store.Open("/nonexistent/points2d_store_test.bin"));
+
+  const std::string path = TempStorePath();
+  {
+    std::ofstream file(path, std::ios::trunc | std::ios::binary);
+    file << "not a store";
+  }
+  BOOST_CHECK(!store.Open(path));
+  BOOST_CHECK_EQUAL(store.NumImages(), 0);
+
+  // A truncated store is rejected.
+  std::string data;
+  {
+    Points2DStore created_store;
+    created_store.Create(path, CreateImages());
+    std::ifstream file(path, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>());
+  }
+  {
+    std::ofstream file(path, std::ios::trunc | std::ios::binary);
+    file.write(data.data(), data.size() - sizeof(double));
+  }
+  BOOST_CHECK(!store.Open(path));
+  boost::filesystem::remove(path);
+}
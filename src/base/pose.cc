@@ -22,6 +22,39 @@
 #include "base/triangulation.h"
 
 namespace colmap {
+namespace {
+
+// Below this rotation angle, the trigonometric ratios of the conversions are
+// replaced by their series expansions, which avoids the division by zero.
+const double kSmallAngle = 1e-4;
+
+// Below this cosine of the rotation angle, i.e. for angles in the vicinity of
+// 180 degrees, the sine of the angle is too inaccurate to recover the axis
+// from the skew-symmetric part of the rotation matrix.
+const double kLargeAngleCosine = -0.99;
+
+// Angle-axis vector of a rotation close to 180 degrees, computed from the
+// symmetric part of the rotation matrix `0.5 (R + R^T) = c I + (1 - c) a a^T`.
+Eigen::Vector3d LargeAngleRotationMatrixToAngleAxis(const Eigen::Matrix3d& R,
+                                                    const double cos_angle,
+                                                    const double angle,
+                                                    const Eigen::Vector3d& v) {
+  Eigen::Matrix3d B = 0.5 * (R + R.transpose());
+  B.diagonal().array() -= cos_angle;
+  int col;
+  B.diagonal().maxCoeff(&col);
+  Eigen::Vector3d axis =
+      B.col(col) /
+      std::sqrt(std::max(B(col, col), 0.0) * (1 - cos_angle) + 1e-300);
+  axis.normalize();
+  // The symmetric part determines the axis only up to its sign.
+  if (axis.dot(v) < 0) {
+    axis = -axis;
+  }
+  return angle * axis;
+}
+
+}  // namespace
 
 Eigen::Matrix3d CrossProductMatrix(const Eigen::Vector3d& vector) {
   Eigen::Matrix3d matrix;
@@ -64,6 +97,120 @@ Eigen::Matrix3d QuaternionToRotationMatrix(const Eigen::Vector4d& qvec) {
   return quat.toRotationMatrix();
 }
 
+Eigen::Vector3d RotationMatrixToAngleAxis(const Eigen::Matrix3d& R) {
+  // The skew-symmetric part of R is sin(angle) times the cross product matrix
+  // of the axis, its trace is 1 + 2 cos(angle).
+  const Eigen::Vector3d v(0.5 * (R(2, 1) - R(1, 2)), 0.5 * (R(0, 2) - R(2, 0)),
+                          0.5 * (R(1, 0) - R(0, 1)));
+  const double sin_angle = v.norm();
+  const double cos_angle = 0.5 * (R.trace() - 1);
+  const double angle = std::atan2(sin_angle, cos_angle);
+  if (cos_angle < kLargeAngleCosine) {
+    return LargeAngleRotationMatrixToAngleAxis(R, cos_angle, angle, v);
+  }
+  if (angle < kSmallAngle) {
+    return (1 + angle * angle / 6) * v;
+  }
+  return (angle / sin_angle) * v;
+}
+
+Eigen::Matrix3d AngleAxisToRotationMatrix(const Eigen::Vector3d& angle_axis) {
+  AngleAxisArray angle_axes(1, 3);
+  angle_axes.row(0) = angle_axis.transpose();
+  RotationMatrixArray R;
+  AngleAxesToRotationMatrices(angle_axes, &R);
+  Eigen::Matrix3d rot_mat;
+  for (int i = 0; i < 9; ++i) {
+    rot_mat(i / 3, i % 3) = R(0, i);
+  }
+  return rot_mat;
+}
+
+void RotationMatricesToAngleAxes(const RotationMatrixArray& R,
+                                 AngleAxisArray* angle_axes) {
+  const Eigen::ArrayXd vx = 0.5 * (R.col(7) - R.col(5)).array();
+  const Eigen::ArrayXd vy = 0.5 * (R.col(2) - R.col(6)).array();
+  const Eigen::ArrayXd vz = 0.5 * (R.col(3) - R.col(1)).array();
+  const Eigen::ArrayXd sin_angles = (vx.square() + vy.square() + vz.square()).sqrt();
+  const Eigen::ArrayXd cos_angles =
+      0.5 * (R.col(0) + R.col(4) + R.col(8)).array() - 0.5;
+
+  Eigen::ArrayXd angles(R.rows());
+  for (int i = 0; i < R.rows(); ++i) {
+    angles(i) = std::atan2(sin_angles(i), cos_angles(i));
+  }
+  const Eigen::ArrayXd scales =
+      (angles < kSmallAngle)
+          .select(1 + angles.square() / 6, angles / sin_angles);
+
+  angle_axes->resize(R.rows(), 3);
+  angle_axes->col(0) = (scales * vx).matrix();
+  angle_axes->col(1) = (scales * vy).matrix();
+  angle_axes->col(2) = (scales * vz).matrix();
+
+  // The rare rotations close to 180 degrees take the scalar path.
+  for (int i = 0; i < R.rows(); ++i) {
+    if (cos_angles(i) < kLargeAngleCosine) {
+      Eigen::Matrix3d rot_mat;
+      for (int j = 0; j < 9; ++j) {
+        rot_mat(j / 3, j % 3) = R(i, j);
+      }
+      angle_axes->row(i) =
+          LargeAngleRotationMatrixToAngleAxis(
+              rot_mat, cos_angles(i), angles(i),
+              Eigen::Vector3d(vx(i), vy(i), vz(i)))
+              .transpose();
+    }
+  }
+}
+
+void AngleAxesToRotationMatrices(const AngleAxisArray& angle_axes,
+                                 RotationMatrixArray* R) {
+  const Eigen::ArrayXd x = angle_axes.col(0).array();
+  const Eigen::ArrayXd y = angle_axes.col(1).array();
+  const Eigen::ArrayXd z = angle_axes.col(2).array();
+  const Eigen::ArrayXd squared_angles = x.square() + y.square() + z.square();
+  const Eigen::ArrayXd angles = squared_angles.sqrt();
+
+  // Rodrigues' formula R = I + a K + b K^2 with K the cross product matrix of
+  // the angle-axis vector, a = sin(angle) / angle and
+  // b = (1 - cos(angle)) / angle^2.
+  const Eigen::ArrayXd a = (angles < kSmallAngle)
+                               .select(1 - squared_angles / 6,
+                                       angles.sin() / angles);
+  const Eigen::ArrayXd b =
+      (angles < kSmallAngle)
+          .select(0.5 - squared_angles / 24,
+                  (1 - angles.cos()) / squared_angles);
+  const Eigen::ArrayXd diagonal = 1 - b * squared_angles;
+
+  R->resize(angle_axes.rows(), 9);
+  R->col(0) = (diagonal + b * x * x).matrix();
+  R->col(1) = (b * x * y - a * z).matrix();
+  R->col(2) = (b * x * z + a * y).matrix();
+  R->col(3) = (b * x * y + a * z).matrix();
+  R->col(4) = (diagonal + b * y * y).matrix();
+  R->col(5) = (b * y * z - a * x).matrix();
+  R->col(6) = (b * x * z - a * y).matrix();
+  R->col(7) = (b * y * z + a * x).matrix();
+  R->col(8) = (diagonal + b * z * z).matrix();
+}
+
+void RotationMatrixAngles(const RotationMatrixArray& R,
+                          Eigen::VectorXd* angles) {
+  const Eigen::ArrayXd vx = (R.col(7) - R.col(5)).array();
+  const Eigen::ArrayXd vy = (R.col(2) - R.col(6)).array();
+  const Eigen::ArrayXd vz = (R.col(3) - R.col(1)).array();
+  // Twice the sine and cosine of the angles.
+  const Eigen::ArrayXd sin_angles =
+      (vx.square() + vy.square() + vz.square()).sqrt();
+  const Eigen::ArrayXd cos_angles = (R.col(0) + R.col(4) + R.col(8)).array() - 1;
+  angles->resize(R.rows());
+  for (int i = 0; i < R.rows(); ++i) {
+    (*angles)(i) = std::atan2(sin_angles(i), cos_angles(i));
+  }
+}
+
 Eigen::Vector4d NormalizeQuaternion(const Eigen::Vector4d& qvec) {
   const double norm = qvec.norm();
   if (norm == 0) {
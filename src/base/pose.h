@@ -64,6 +64,41 @@ Eigen::Vector4d RotationMatrixToQuaternion(const Eigen::Matrix3d& rot_mat);
 // @return               3x3 rotation matrix.
 Eigen::Matrix3d QuaternionToRotationMatrix(const Eigen::Vector4d& qvec);
 
+// Convert 3D rotation matrix to angle-axis representation, i.e. the logarithm
+// map of the rotation. The conversion is accurate for all rotation angles,
+// including rotations close to the identity and close to 180 degrees.
+//
+// @param R              3x3 rotation matrix.
+//
+// @return               Rotation axis scaled by the rotation angle in radians.
+Eigen::Vector3d RotationMatrixToAngleAxis(const Eigen::Matrix3d& R);
+
+// Convert angle-axis representation to 3D rotation matrix.
+//
+// @param angle_axis     Rotation axis scaled by the rotation angle in radians.
+//
+// @return               3x3 rotation matrix.
+Eigen::Matrix3d AngleAxisToRotationMatrix(const Eigen::Vector3d& angle_axis);
+
+// Arrays of rotation matrices and angle-axis vectors with one rotation per
+// row. Column `3 * r + c` holds the element (r, c) of all rotation matrices,
+// so that the batch conversions below run over contiguous columns and
+// vectorize.
+typedef Eigen::Matrix<double, Eigen::Dynamic, 9> RotationMatrixArray;
+typedef Eigen::Matrix<double, Eigen::Dynamic, 3> AngleAxisArray;
+
+// Batch versions of `RotationMatrixToAngleAxis` and
+// `AngleAxisToRotationMatrix`.
+void RotationMatricesToAngleAxes(const RotationMatrixArray& R,
+                                 AngleAxisArray* angle_axes);
+void AngleAxesToRotationMatrices(const AngleAxisArray& angle_axes,
+                                 RotationMatrixArray* R);
+
+// Compute only the rotation angles in radians of the rotation matrices, which
+// is cheaper than the full angle-axis conversion.
+void RotationMatrixAngles(const RotationMatrixArray& R,
+                          Eigen::VectorXd* angles);
+
 // Compose the Quaternion vector corresponding to a  identity transformation.
 inline Eigen::Vector4d ComposeIdentityQuaternion();
 
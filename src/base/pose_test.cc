@@ -85,6 +85,71 @@ BOOST_AUTO_TEST_CASE(TestQuaternionToRotationMatrix) {
   BOOST_CHECK(rot_mat0.isApprox(rot_mat1));
 }
 
+BOOST_AUTO_TEST_CASE(TestRotationMatrixToAngleAxis) {
+  BOOST_CHECK_EQUAL(RotationMatrixToAngleAxis(Eigen::Matrix3d::Identity()),
+                    Eigen::Vector3d::Zero());
+  const std::vector<double> angles = {1e-9, 1e-5, 0.3, 2, M_PI - 1e-3,
+                                      M_PI - 1e-8, M_PI};
+  const Eigen::Vector3d axis = Eigen::Vector3d(0.2, -0.5, 1).normalized();
+  for (const double angle : angles) {
+    const Eigen::Matrix3d rot_mat =
+        Eigen::AngleAxisd(angle, axis).toRotationMatrix();
+    const Eigen::Vector3d angle_axis = RotationMatrixToAngleAxis(rot_mat);
+    BOOST_CHECK_CLOSE(angle_axis.norm(), angle, 1e-6);
+    if (angle < M_PI) {
+      BOOST_CHECK(angle_axis.normalized().isApprox(axis, 1e-6));
+    } else {
+      BOOST_CHECK_CLOSE(std::abs(angle_axis.normalized().dot(axis)), 1, 1e-6);
+    }
+    BOOST_CHECK(AngleAxisToRotationMatrix(angle_axis).isApprox(rot_mat, 1e-9));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestAngleAxisToRotationMatrix) {
+  BOOST_CHECK_EQUAL(AngleAxisToRotationMatrix(Eigen::Vector3d::Zero()),
+                    Eigen::Matrix3d::Identity());
+  const Eigen::Vector3d axis = Eigen::Vector3d(-1, 0.4, 0.3).normalized();
+  for (const double angle : {1e-9, 1e-5, 0.7, 3.0}) {
+    BOOST_CHECK(AngleAxisToRotationMatrix(angle * axis)
+                    .isApprox(Eigen::AngleAxisd(angle, axis).toRotationMatrix(),
+                              1e-12));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestBatchAngleAxisConversions) {
+  const int kNumRotations = 50;
+  AngleAxisArray angle_axes(kNumRotations, 3);
+  for (int i = 0; i < kNumRotations; ++i) {
+    const double angle = M_PI * i / (kNumRotations - 1);
+    angle_axes.row(i) =
+        angle * Eigen::Vector3d(std::sin(i), std::cos(3 * i), 0.5)
+                    .normalized()
+                    .transpose();
+  }
+
+  RotationMatrixArray R;
+  AngleAxesToRotationMatrices(angle_axes, &R);
+  BOOST_CHECK_EQUAL(R.rows(), kNumRotations);
+  AngleAxisArray angle_axes2;
+  RotationMatricesToAngleAxes(R, &angle_axes2);
+  Eigen::VectorXd angles;
+  RotationMatrixAngles(R, &angles);
+
+  for (int i = 0; i < kNumRotations; ++i) {
+    const Eigen::Vector3d angle_axis = angle_axes.row(i).transpose();
+    const Eigen::Matrix3d rot_mat = AngleAxisToRotationMatrix(angle_axis);
+    for (int j = 0; j < 9; ++j) {
+      BOOST_CHECK_SMALL(R(i, j) - rot_mat(j / 3, j % 3), 1e-12);
+    }
+    const Eigen::Vector3d angle_axis2 = angle_axes2.row(i).transpose();
+    BOOST_CHECK(angle_axis2.isApprox(RotationMatrixToAngleAxis(rot_mat)));
+    BOOST_CHECK_SMALL(angles(i) - angle_axis.norm(), 1e-9);
+    if (i + 1 < kNumRotations) {
+      BOOST_CHECK_SMALL((angle_axis2 - angle_axis).norm(), 1e-9);
+    }
+  }
+}
+
 BOOST_AUTO_TEST_CASE(TestComposeIdentityQuaternion) {
   BOOST_CHECK_EQUAL(ComposeIdentityQuaternion(), Eigen::Vector4d(1, 0, 0, 0));
 }
@@ -26,12 +26,95 @@
 #include "optim/loransac.h"
 #include "util/bitmap.h"
 #include "util/misc.h"
+#include "util/output_buffer.h"
 #include "util/ply.h"
+#include "util/threading.h"
 
 namespace colmap {
+namespace {
+
+// The models are formatted in parallel in chunks of images and 3D points.
+const size_t kNumImagesPerWriteChunk = 16;
+const size_t kNumPoints3DPerWriteChunk = 10000;
+
+// The elements of a map in the order of its iteration, in which they are
+// written to the model files.
+template <typename Map>
+std::vector<const typename Map::value_type*> MapElements(const Map& map) {
+  std::vector<const typename Map::value_type*> elements;
+  elements.reserve(map.size());
+  for (const auto& element : map) {
+    elements.push_back(&element);
+  }
+  return elements;
+}
+
+// The images are transformed in parallel in chunks of images and the 3D points
+// in blocks of consecutive points, which are gathered by coordinate into one
+// buffer, so that the transformation vectorizes over the points of a block.
+const int kNumImagesPerTransformChunk = 64;
+const int kNumPoints3DPerTransformBlock = 4096;
+
+// The tracks of a merged reconstruction are matched in parallel in chunks.
+const int kNumPoints3DPerMergeChunk = 1024;
+
+// Transform the coordinates `src[i]` into `dst[i]`, which may be the same.
+void TransformPoints3D(const SimilarityTransform3& tform,
+                       const std::vector<const Eigen::Vector3d*>& src,
+                       const std::vector<Eigen::Vector3d*>& dst) {
+  CHECK_EQ(src.size(), dst.size());
+  const int num_points3D = static_cast<int>(src.size());
+  const int num_blocks =
+      (num_points3D + kNumPoints3DPerTransformBlock - 1) /
+      kNumPoints3DPerTransformBlock;
+  ParallelFor(0, num_blocks, [&](const int block_idx) {
+    const int begin = block_idx * kNumPoints3DPerTransformBlock;
+    const int end =
+        std::min(num_points3D, begin + kNumPoints3DPerTransformBlock);
+    Eigen::Matrix<double, Eigen::Dynamic, 3> xyzs(end - begin, 3);
+    for (int i = begin; i < end; ++i) {
+      xyzs.row(i - begin) = src[i]->transpose();
+    }
+    tform.TransformPoints(xyzs);
+    for (int i = begin; i < end; ++i) {
+      *dst[i] = xyzs.row(i - begin).transpose();
+    }
+  });
+}
+
+// Find the projection centers of the registered images with the given names
+// and their given locations, where unknown, unregistered and duplicate images
+// are ignored. The names are looked up in a hash map, which is built once.
+void FindCommonImageLocations(const Reconstruction& reconstruction,
+                              const std::vector<std::string>& image_names,
+                              const std::vector<Eigen::Vector3d>& locations,
+                              std::vector<Eigen::Vector3d>* src,
+                              std::vector<Eigen::Vector3d>* dst) {
+  CHECK_EQ(image_names.size(), locations.size());
+
+  std::unordered_map<std::string, const Image*> images_by_name;
+  images_by_name.reserve(reconstruction.NumImages());
+  for (const auto& image : reconstruction.Images()) {
+    images_by_name.emplace(image.second.Name(), &image.second);
+  }
+
+  std::unordered_set<image_t> common_image_ids;
+  for (size_t i = 0; i < image_names.size(); ++i) {
+    const auto image = images_by_name.find(image_names[i]);
+    if (image == images_by_name.end() ||
+        !reconstruction.IsImageRegistered(image->second->ImageId()) ||
+        !common_image_ids.insert(image->second->ImageId()).second) {
+      continue;
+    }
+    src->push_back(image->second->ProjectionCenter());
+    dst->push_back(locations[i]);
+  }
+}
+
+}  // namespace
 
 Reconstruction::Reconstruction()
-    : scene_graph_(nullptr), num_added_points3D_(0) {}
+    : scene_graph_(nullptr), record_changes_(false), num_added_points3D_(0) {}
 
 std::unordered_set<point3D_t> Reconstruction::Point3DIds() const {
   std::unordered_set<point3D_t> point3D_ids;
@@ -44,6 +127,36 @@ std::unordered_set<point3D_t> Reconstruction::Point3DIds() const {
   return point3D_ids;
 }
 
+void Reconstruction::EnableChangeRecording() {
+  record_changes_ = true;
+  changes_ = Changes();
+}
+
+Reconstruction::Changes Reconstruction::TakeChanges() {
+  Changes changes;
+  std::swap(changes, changes_);
+  return changes;
+}
+
+const std::vector<std::pair<point3D_t, size_t>>&
+Reconstruction::MergeCandidates(const point3D_t point3D_id) const {
+  static const std::vector<std::pair<point3D_t, size_t>> kNoMergeCandidates;
+  const auto it = merge_candidates_.find(point3D_id);
+  if (it == merge_candidates_.end()) {
+    return kNoMergeCandidates;
+  }
+  return it->second;
+}
+
+std::vector<point3D_t> Reconstruction::MergeCandidatePoint3DIds() const {
+  std::vector<point3D_t> point3D_ids;
+  point3D_ids.reserve(merge_candidates_.size());
+  for (const auto& merge_candidates : merge_candidates_) {
+    point3D_ids.push_back(merge_candidates.first);
+  }
+  return point3D_ids;
+}
+
 void Reconstruction::Load(const DatabaseCache& database_cache) {
   scene_graph_ = nullptr;
 
@@ -64,7 +177,8 @@ void Reconstruction::Load(const DatabaseCache& database_cache) {
       class Image& existing_image = Image(image.second.ImageId());
       CHECK_EQ(existing_image.Name(), image.second.Name());
       if (existing_image.NumPoints2D() == 0) {
-        existing_image.SetPoints2D(image.second.Points2D());
+        existing_image.SetPoints2D(
+            database_cache.Points2D(image.second.ImageId()));
       } else {
         CHECK_EQ(image.second.NumPoints2D(), existing_image.NumPoints2D());
       }
@@ -88,6 +202,7 @@ void Reconstruction::SetUp(const SceneGraph* scene_graph) {
     image.second.SetUp(Camera(image.second.CameraId()));
   }
   scene_graph_ = scene_graph;
+  merge_candidates_.clear();
 
   // If an existing model was loaded from disk and there were already images
   // registered previously, we need to set observations as triangulated.
@@ -102,10 +217,20 @@ void Reconstruction::SetUp(const SceneGraph* scene_graph) {
       }
     }
   }
+
+  // All observations were already triangulated, so the correspondences
+  // between different 3D points were counted from both of their sides.
+  for (auto& merge_candidates : merge_candidates_) {
+    for (auto& merge_candidate : merge_candidates.second) {
+      merge_candidate.second /= 2;
+    }
+  }
 }
 
 void Reconstruction::TearDown() {
   scene_graph_ = nullptr;
+  visibility_changed_image_ids_.clear();
+  merge_candidates_.clear();
 
   // Remove all not yet registered images.
   std::unordered_set<camera_t> keep_camera_ids;
@@ -132,6 +257,8 @@ void Reconstruction::TearDown() {
   for (auto& point3D : points3D_) {
     point3D.second.Track().Compress();
   }
+
+  RecordAllChanges();
 }
 
 void Reconstruction::AddCamera(const class Camera& camera) {
@@ -147,46 +274,6 @@ void Reconstruction::AddImage(const class Image& image) {
   images_[image.ImageId()] = image;
 }
 
-
-void Reconstruction::InitNewImage(const image_t image_id, const image_t original, std::vector<image_pair_t> * old_pairs, std::vector<image_pair_t> * new_pairs)
-{
-	//CHECK(ExistsImage(image_id));
-	unsigned int maxId = 0;
-	std::vector<std::pair<size_t, size_t>> interesting;
-	for(std::pair<image_pair_t, std::pair<size_t, size_t>> p : image_pairs_)
-	{
-		if(p.first > maxId)
-			maxId = p.first;
-		if(p.second.first == original)
-		{
-			interesting.push_back(std::make_pair(image_id, p.second.second));
-			old_pairs->push_back(p.first);
-		}
-		if(p.second.second == original)
-		{
-			interesting.push_back(std::make_pair(p.second.first, image_id));
-			old_pairs->push_back(p.first);
-		}
-	}
-	for(unsigned int i=0;i<interesting.size();i++)
-	{
-		image_pairs_.insert({maxId+1+i, interesting[i]});
-		new_pairs->push_back(maxId+1+i);
-	}
-
-	//HERE
-	//SceneGraph* sg = scene_graph_;
-	//scene_graph_->AddImage(image_id, Image(image_id).NumPoints2D());
-
-	/*SceneGraph sg = *scene_graph_;
-	sg.AddImage(image_id, Image(image_id).NumPoints2D());
-	bool thrawn = scene_graph_->ExistsImage(image_id);
-	if(thrawn)
-		std::cout << "THRAWN JE MOCNY\n";
-	else
-		std::cout << "ISIS\n";*/
-}
-
 point3D_t Reconstruction::AddPoint3D(const Eigen::Vector3d& xyz,
                                      const Track& track) {
   const point3D_t point3D_id = ++num_added_points3D_;
@@ -196,12 +283,14 @@ point3D_t Reconstruction::AddPoint3D(const Eigen::Vector3d& xyz,
 
   point3D.SetXYZ(xyz);
   point3D.SetTrack(track);
+  RecordPoint3DChange(point3D_id);
 
   for (const auto& track_el : track.Elements()) {
     class Image& image = Image(track_el.image_id);
     CHECK(!image.Point2D(track_el.point2D_idx).HasPoint3D());
     image.SetPoint3DForPoint2D(track_el.point2D_idx, point3D_id);
     CHECK_LE(image.NumPoints3D(), image.NumPoints2D());
+    RecordImageChange(track_el.image_id);
   }
 
   const bool kIsContinuedPoint3D = false;
@@ -225,6 +314,8 @@ void Reconstruction::AddObservation(const point3D_t point3D_id,
   class Point3D& point3D = Point3D(point3D_id);
   point3D.Track().AddElement(track_el);
   //std::cout << "CHECK\n";
+  RecordPoint3DChange(point3D_id);
+  RecordImageChange(track_el.image_id);
 
   const bool kIsContinuedPoint3D = true;
   SetObservationAsTriangulated(track_el.image_id, track_el.point2D_idx,
@@ -276,9 +367,11 @@ void Reconstruction::DeletePoint3D(const point3D_t point3D_id) {
   for (const auto& track_el : track.Elements()) {
     class Image& image = Image(track_el.image_id);
     image.ResetPoint3DForPoint2D(track_el.point2D_idx);
+    RecordImageChange(track_el.image_id);
   }
 
   points3D_.erase(point3D_id);
+  RecordPoint3DChange(point3D_id);
 }
 
 void Reconstruction::DeleteObservation(const image_t image_id,
@@ -301,6 +394,9 @@ void Reconstruction::DeleteObservation(const image_t image_id,
   ResetTriObservations(image_id, point2D_idx, kIsDeletedPoint3D);
 
   image.ResetPoint3DForPoint2D(point2D_idx);
+
+  RecordPoint3DChange(point3D_id);
+  RecordImageChange(image_id);
 }
 
 void Reconstruction::RegisterImage(const image_t image_id) {
@@ -309,6 +405,7 @@ void Reconstruction::RegisterImage(const image_t image_id) {
     image.SetRegistered(true);
     reg_image_ids_.push_back(image_id);
   }
+  RecordImageChange(image_id);
 }
 
 void Reconstruction::DeRegisterImage(const image_t image_id) {
@@ -326,6 +423,8 @@ void Reconstruction::DeRegisterImage(const image_t image_id) {
   reg_image_ids_.erase(
       std::remove(reg_image_ids_.begin(), reg_image_ids_.end(), image_id),
       reg_image_ids_.end());
+
+  RecordImageChange(image_id);
 }
 
 void Reconstruction::Normalize(const double extent, const double p0,
@@ -422,35 +521,42 @@ void Reconstruction::Normalize(const double extent, const double p0,
     point3D.second.XYZ() -= translation;
     point3D.second.XYZ() *= scale;
   }
+
+  RecordAllChanges();
 }
 
 void Reconstruction::Transform(const double scale, const Eigen::Vector4d& qvec,
                                const Eigen::Vector3d& tvec) {
   CHECK_GT(scale, 0);
-  const SimilarityTransform3 tform(scale, qvec, tvec);
-  for (auto& image : images_) {
-    tform.TransformPose(&image.second.Qvec(), &image.second.Tvec());
-  }
-  for (auto& point3D : points3D_) {
-    tform.TransformPoint(&point3D.second.XYZ());
-  }
+  TransformImagesAndPoints3D(SimilarityTransform3(scale, qvec, tvec));
+  RecordAllChanges();
 }
 
 bool Reconstruction::Merge(const Reconstruction& reconstruction,
                            const int min_common_images) {
   CHECK_GE(min_common_images, 3);
 
-  // Find common and missing images in the two reconstructions.
+  // Find common and missing images in the two reconstructions by joining the
+  // sorted identifiers of their registered images.
 
-  std::set<image_t> common_image_ids;
-  std::set<image_t> missing_image_ids;
-  for (const auto& image_id : reconstruction.RegImageIds()) {
-    if (ExistsImage(image_id)) {
-      CHECK(IsImageRegistered(image_id))
-          << "Make sure to tear down the reconstructions before merging";
-      common_image_ids.insert(image_id);
+  std::vector<image_t> reg_image_ids = reg_image_ids_;
+  std::sort(reg_image_ids.begin(), reg_image_ids.end());
+  std::vector<image_t> other_reg_image_ids = reconstruction.RegImageIds();
+  std::sort(other_reg_image_ids.begin(), other_reg_image_ids.end());
+
+  std::vector<image_t> common_image_ids;
+  std::vector<image_t> missing_image_ids;
+  auto reg_image_id = reg_image_ids.begin();
+  for (const auto image_id : other_reg_image_ids) {
+    while (reg_image_id != reg_image_ids.end() && *reg_image_id < image_id) {
+      ++reg_image_id;
+    }
+    if (reg_image_id != reg_image_ids.end() && *reg_image_id == image_id) {
+      common_image_ids.push_back(image_id);
     } else {
-      missing_image_ids.insert(image_id);
+      CHECK(!ExistsImage(image_id))
+          << "Make sure to tear down the reconstructions before merging";
+      missing_image_ids.push_back(image_id);
     }
   }
 
@@ -472,20 +578,6 @@ bool Reconstruction::Merge(const Reconstruction& reconstruction,
   SimilarityTransform3 tform;
   tform.Estimate(src, dst);
 
-  // Register the missing images in this reconstruction.
-
-  for (const auto image_id : missing_image_ids) {
-    auto reg_image = reconstruction.Image(image_id);
-    reg_image.SetRegistered(false);
-    AddImage(reg_image);
-    RegisterImage(image_id);
-    if (!ExistsCamera(reg_image.CameraId())) {
-      AddCamera(reconstruction.Camera(reg_image.CameraId()));
-    }
-    auto& image = Image(image_id);
-    tform.TransformPose(&image.Qvec(), &image.Tvec());
-  }
-
   // Merge the two point clouds using the following two rules:
   //    - copy points to this reconstruction with non-conflicting tracks,
   //      i.e. points that do not have an already triangulated observation
@@ -493,38 +585,111 @@ bool Reconstruction::Merge(const Reconstruction& reconstruction,
   //    - merge tracks that are unambiguous, i.e. only merge points in the two
   //      reconstructions if they have a one-to-one mapping.
   // Note that in both cases no cheirality or reprojection test is performed.
+  //
+  // An observation belongs to at most one point of the given reconstruction,
+  // so the tracks are matched against this reconstruction before any point is
+  // added, in parallel, and the points are then added in their order. Merging
+  // renames the matched points of this reconstruction, which are therefore
+  // looked up again through one of their observations.
+
+  // Whether the images of the given reconstruction are common (true) or
+  // missing (false) in this reconstruction.
+  std::unordered_map<image_t, bool> is_common_image;
+  is_common_image.reserve(other_reg_image_ids.size());
+  for (const auto image_id : common_image_ids) {
+    is_common_image.emplace(image_id, true);
+  }
+  for (const auto image_id : missing_image_ids) {
+    is_common_image.emplace(image_id, false);
+  }
 
-  for (const auto& point3D : reconstruction.Points3D()) {
+  struct TrackMatch {
     Track new_track;
-    Track old_track;
-    std::set<point3D_t> old_point3D_ids;
-    for (const auto& track_el : point3D.second.Track().Elements()) {
-      if (common_image_ids.count(track_el.image_id) > 0) {
-        const auto& point2D =
-            Image(track_el.image_id).Point2D(track_el.point2D_idx);
-        if (point2D.HasPoint3D()) {
-          old_track.AddElement(track_el);
-          old_point3D_ids.insert(point2D.Point3DId());
-        } else {
-          new_track.AddElement(track_el);
+    size_t old_track_length = 0;
+    // An observation of the point of this reconstruction, if the track maps
+    // to exactly one point.
+    bool has_old_point3D = false;
+    TrackElement old_track_el;
+  };
+
+  std::vector<const class Point3D*> points3D;
+  points3D.reserve(reconstruction.NumPoints3D());
+  for (const auto& point3D : reconstruction.Points3D()) {
+    points3D.push_back(&point3D.second);
+  }
+
+  std::vector<Eigen::Vector3d> xyzs(points3D.size());
+  std::vector<const Eigen::Vector3d*> xyzs_src(points3D.size());
+  std::vector<Eigen::Vector3d*> xyzs_dst(points3D.size());
+  for (size_t i = 0; i < points3D.size(); ++i) {
+    xyzs_src[i] = &points3D[i]->XYZ();
+    xyzs_dst[i] = &xyzs[i];
+  }
+  TransformPoints3D(tform, xyzs_src, xyzs_dst);
+
+  std::vector<TrackMatch> track_matches(points3D.size());
+  ParallelFor(0, static_cast<int>(points3D.size()), [&](const int i) {
+    TrackMatch& track_match = track_matches[i];
+    point3D_t old_point3D_id = kInvalidPoint3DId;
+    bool is_ambiguous = false;
+    for (const auto& track_el : points3D[i]->Track().Elements()) {
+      const auto is_common = is_common_image.find(track_el.image_id);
+      if (is_common == is_common_image.end()) {
+        continue;
+      }
+      if (!is_common->second) {
+        track_match.new_track.AddElement(track_el);
+        continue;
+      }
+      const auto& point2D =
+          Image(track_el.image_id).Point2D(track_el.point2D_idx);
+      if (point2D.HasPoint3D()) {
+        track_match.old_track_length += 1;
+        if (old_point3D_id == kInvalidPoint3DId) {
+          old_point3D_id = point2D.Point3DId();
+          track_match.old_track_el = track_el;
+        } else if (point2D.Point3DId() != old_point3D_id) {
+          is_ambiguous = true;
         }
-      } else if (missing_image_ids.count(track_el.image_id) > 0) {
-        Image(track_el.image_id).ResetPoint3DForPoint2D(track_el.point2D_idx);
-        new_track.AddElement(track_el);
+      } else {
+        track_match.new_track.AddElement(track_el);
       }
     }
+    track_match.has_old_point3D =
+        old_point3D_id != kInvalidPoint3DId && !is_ambiguous;
+  }, kNumPoints3DPerMergeChunk);
+
+  // Register the missing images in this reconstruction.
+
+  for (const auto image_id : missing_image_ids) {
+    auto reg_image = reconstruction.Image(image_id);
+    reg_image.SetRegistered(false);
+    for (point2D_t point2D_idx = 0; point2D_idx < reg_image.NumPoints2D();
+         ++point2D_idx) {
+      reg_image.ResetPoint3DForPoint2D(point2D_idx);
+    }
+    tform.TransformPose(&reg_image.Qvec(), &reg_image.Tvec());
+    AddImage(reg_image);
+    RegisterImage(image_id);
+    if (!ExistsCamera(reg_image.CameraId())) {
+      AddCamera(reconstruction.Camera(reg_image.CameraId()));
+    }
+  }
 
-    const bool create_new_point = new_track.Length() >= 2;
+  for (size_t i = 0; i < points3D.size(); ++i) {
+    const TrackMatch& track_match = track_matches[i];
+    const bool create_new_point = track_match.new_track.Length() >= 2;
     const bool merge_new_and_old_point =
-        (new_track.Length() + old_track.Length()) >= 2 &&
-        old_point3D_ids.size() == 1;
+        (track_match.new_track.Length() + track_match.old_track_length) >= 2 &&
+        track_match.has_old_point3D;
     if (create_new_point || merge_new_and_old_point) {
-      Eigen::Vector3d xyz = point3D.second.XYZ();
-      tform.TransformPoint(&xyz);
-      const auto point3D_id = AddPoint3D(xyz, new_track);
-      Point3D(point3D_id).SetColor(point3D.second.Color());
-      if (old_point3D_ids.size() == 1) {
-        MergePoints3D(point3D_id, *old_point3D_ids.begin());
+      const auto point3D_id = AddPoint3D(xyzs[i], track_match.new_track);
+      Point3D(point3D_id).SetColor(points3D[i]->Color());
+      if (track_match.has_old_point3D) {
+        const auto& old_track_el = track_match.old_track_el;
+        MergePoints3D(point3D_id, Image(old_track_el.image_id)
+                                      .Point2D(old_track_el.point2D_idx)
+                                      .Point3DId());
       }
     }
   }
@@ -540,31 +705,12 @@ bool Reconstruction::Align(const std::vector<std::string>& image_names,
 
   // Find out which images are contained in the reconstruction and get the
   // positions of their camera centers.
-  std::set<image_t> common_image_ids;
   std::vector<Eigen::Vector3d> src;
   std::vector<Eigen::Vector3d> dst;
-  for (size_t i = 0; i < image_names.size(); ++i) {
-    const class Image* image = FindImageWithName(image_names[i]);
-    if (image == nullptr) {
-      continue;
-    }
-
-    if (!IsImageRegistered(image->ImageId())) {
-      continue;
-    }
-
-    // Ignore duplicate images.
-    if (common_image_ids.count(image->ImageId()) > 0) {
-      continue;
-    }
-
-    common_image_ids.insert(image->ImageId());
-    src.push_back(image->ProjectionCenter());
-    dst.push_back(locations[i]);
-  }
+  FindCommonImageLocations(*this, image_names, locations, &src, &dst);
 
   // Only compute the alignment if there are enough correspondences.
-  if (common_image_ids.size() < static_cast<size_t>(min_common_images)) {
+  if (src.size() < static_cast<size_t>(min_common_images)) {
     return false;
   }
 
@@ -573,12 +719,8 @@ bool Reconstruction::Align(const std::vector<std::string>& image_names,
   tform.Estimate(src, dst);
 
   // Update the cameras and points using the estimated transform.
-  for (auto& image : images_) {
-    tform.TransformPose(&image.second.Qvec(), &image.second.Tvec());
-  }
-  for (auto& point3D : points3D_) {
-    tform.TransformPoint(&point3D.second.XYZ());
-  }
+  TransformImagesAndPoints3D(tform);
+  RecordAllChanges();
 
   return true;
 }
@@ -592,31 +734,12 @@ bool Reconstruction::AlignRobust(const std::vector<std::string>& image_names,
 
   // Find out which images are contained in the reconstruction and get the
   // positions of their camera centers.
-  std::set<image_t> common_image_ids;
   std::vector<Eigen::Vector3d> src;
   std::vector<Eigen::Vector3d> dst;
-  for (size_t i = 0; i < image_names.size(); ++i) {
-    const class Image* image = FindImageWithName(image_names[i]);
-    if (image == nullptr) {
-      continue;
-    }
-
-    if (!IsImageRegistered(image->ImageId())) {
-      continue;
-    }
-
-    // Ignore duplicate images.
-    if (common_image_ids.count(image->ImageId()) > 0) {
-      continue;
-    }
-
-    common_image_ids.insert(image->ImageId());
-    src.push_back(image->ProjectionCenter());
-    dst.push_back(locations[i]);
-  }
+  FindCommonImageLocations(*this, image_names, locations, &src, &dst);
 
   // Only compute the alignment if there are enough correspondences.
-  if (common_image_ids.size() < static_cast<size_t>(min_common_images)) {
+  if (src.size() < static_cast<size_t>(min_common_images)) {
     return false;
   }
 
@@ -632,14 +755,34 @@ bool Reconstruction::AlignRobust(const std::vector<std::string>& image_names,
   SimilarityTransform3 tform(report.model);
 
   // Update the cameras and points using the estimated transform.
+  TransformImagesAndPoints3D(tform);
+  RecordAllChanges();
+
+  return true;
+}
+
+void Reconstruction::TransformImagesAndPoints3D(
+    const SimilarityTransform3& tform) {
+  std::vector<class Image*> images;
+  images.reserve(images_.size());
   for (auto& image : images_) {
-    tform.TransformPose(&image.second.Qvec(), &image.second.Tvec());
-  }
+    images.push_back(&image.second);
+  }
+  ParallelFor(0, static_cast<int>(images.size()),
+              [&](const int i) {
+                tform.TransformPose(&images[i]->Qvec(), &images[i]->Tvec());
+              },
+              kNumImagesPerTransformChunk);
+
+  std::vector<const Eigen::Vector3d*> src;
+  src.reserve(points3D_.size());
+  std::vector<Eigen::Vector3d*> dst;
+  dst.reserve(points3D_.size());
   for (auto& point3D : points3D_) {
-    tform.TransformPoint(&point3D.second.XYZ());
+    src.push_back(&point3D.second.XYZ());
+    dst.push_back(&point3D.second.XYZ());
   }
-
-  return true;
+  TransformPoints3D(tform, src, dst);
 }
 
 const class Image* Reconstruction::FindImageWithName(
@@ -715,14 +858,29 @@ size_t Reconstruction::FilterObservationsWithNegativeDepth() {
 std::vector<image_t> Reconstruction::FilterImages(
     const double min_focal_length_ratio, const double max_focal_length_ratio,
     const double max_extra_param) {
+  // The parameters of a camera are only checked once for all its images.
+  std::unordered_map<camera_t, bool> bogus_cameras;
+
   std::vector<image_t> filtered_image_ids;
   for (const image_t image_id : RegImageIds()) {
     const class Image& image = Image(image_id);
-    const class Camera& camera = Camera(image.CameraId());
     if (image.NumPoints3D() == 0) {
       filtered_image_ids.push_back(image_id);
-    } else if (camera.HasBogusParams(min_focal_length_ratio,
-                                     max_focal_length_ratio, max_extra_param)) {
+      continue;
+    }
+
+    auto bogus_camera = bogus_cameras.find(image.CameraId());
+    if (bogus_camera == bogus_cameras.end()) {
+      bogus_camera =
+          bogus_cameras
+              .emplace(image.CameraId(),
+                       Camera(image.CameraId())
+                           .HasBogusParams(min_focal_length_ratio,
+                                           max_focal_length_ratio,
+                                           max_extra_param))
+              .first;
+    }
+    if (bogus_camera->second) {
       filtered_image_ids.push_back(image_id);
     }
   }
@@ -1170,6 +1328,7 @@ bool Reconstruction::ExtractColorsForImage(const image_t image_id,
           const BitmapColor<uint8_t> color_ub = color.Cast<uint8_t>();
           point3D.SetColor(
               Eigen::Vector3ub(color_ub.r, color_ub.g, color_ub.b));
+          RecordPoint3DChange(point2D.Point3DId());
         }
       }
     }
@@ -1179,53 +1338,119 @@ bool Reconstruction::ExtractColorsForImage(const image_t image_id,
 }
 
 void Reconstruction::ExtractColorsForAllImages(const std::string& path) {
-  EIGEN_STL_UMAP(point3D_t, Eigen::Vector3d) color_sums;
-  std::unordered_map<point3D_t, size_t> color_counts;
-
-  for (size_t i = 0; i < reg_image_ids_.size(); ++i) {
-    const class Image& image = Image(reg_image_ids_[i]);
-    const std::string image_path = JoinPaths(path, image.Name());
+  ExtractColorsForAllImages(path, {this});
+}
 
-    Bitmap bitmap;
-    if (!bitmap.Read(image_path)) {
-      std::cout << StringPrintf("Could not read image %s at path %s.",
-                                image.Name().c_str(), image_path.c_str())
-                << std::endl;
-      continue;
+void Reconstruction::ExtractColorsForAllImages(
+    const std::string& path,
+    const std::vector<Reconstruction*>& reconstructions) {
+  // The registered images of all reconstructions by name, so that an image
+  // that is registered in several of them is decoded only once.
+  std::vector<std::string> image_names;
+  std::vector<std::vector<std::pair<size_t, image_t>>> image_refs;
+  std::unordered_map<std::string, size_t> image_idxs;
+  for (size_t i = 0; i < reconstructions.size(); ++i) {
+    for (const image_t image_id : reconstructions[i]->reg_image_ids_) {
+      const std::string& name = reconstructions[i]->Image(image_id).Name();
+      const auto image_idx = image_idxs.emplace(name, image_names.size());
+      if (image_idx.second) {
+        image_names.push_back(name);
+        image_refs.emplace_back();
+      }
+      image_refs[image_idx.first->second].emplace_back(i, image_id);
     }
+  }
 
-    for (const Point2D point2D : image.Points2D()) {
-      if (point2D.HasPoint3D()) {
-        BitmapColor<float> color;
-        // COLMAP assumes that the upper left pixel center is (0.5, 0.5).
-        if (bitmap.InterpolateBilinear(point2D.X() - 0.5, point2D.Y() - 0.5,
-                                       &color)) {
-          if (color_sums.count(point2D.Point3DId())) {
-            Eigen::Vector3d& color_sum = color_sums[point2D.Point3DId()];
-            color_sum(0) += color.r;
-            color_sum(1) += color.g;
-            color_sum(2) += color.b;
-            color_counts[point2D.Point3DId()] += 1;
-          } else {
-            color_sums.emplace(point2D.Point3DId(),
-                               Eigen::Vector3d(color.r, color.g, color.b));
-            color_counts.emplace(point2D.Point3DId(), 1);
+  struct ObservationColor {
+    size_t reconstruction_idx;
+    point3D_t point3D_id;
+    BitmapColor<float> color;
+  };
+
+  std::vector<EIGEN_STL_UMAP(point3D_t, Eigen::Vector3d)> color_sums(
+      reconstructions.size());
+  std::vector<std::unordered_map<point3D_t, size_t>> color_counts(
+      reconstructions.size());
+
+  // The images are decoded in parallel in chunks, which bounds the memory of
+  // the sampled colors, and their colors are accumulated in the order of the
+  // images, so that the result does not depend on the number of threads.
+  const int kChunkSize =
+      4 * static_cast<int>(TaskScheduler::Global().NumThreads()) + 1;
+  std::vector<std::vector<ObservationColor>> chunk_colors(kChunkSize);
+  std::vector<char> chunk_read(kChunkSize);
+  for (size_t chunk_begin = 0; chunk_begin < image_names.size();
+       chunk_begin += kChunkSize) {
+    const int num_chunk_images = static_cast<int>(
+        std::min(image_names.size() - chunk_begin,
+                 static_cast<size_t>(kChunkSize)));
+    ParallelFor(0, num_chunk_images, [&](const int i) {
+      const size_t image_idx = chunk_begin + i;
+      std::vector<ObservationColor>& colors = chunk_colors[i];
+      colors.clear();
+
+      Bitmap bitmap;
+      chunk_read[i] = bitmap.Read(JoinPaths(path, image_names[image_idx]));
+      if (!chunk_read[i]) {
+        return;
+      }
+
+      for (const auto& image_ref : image_refs[image_idx]) {
+        const class Image& image =
+            reconstructions[image_ref.first]->Image(image_ref.second);
+        for (const Point2D& point2D : image.Points2D()) {
+          if (point2D.HasPoint3D()) {
+            ObservationColor observation;
+            // COLMAP assumes that the upper left pixel center is (0.5, 0.5).
+            if (bitmap.InterpolateBilinear(point2D.X() - 0.5,
+                                           point2D.Y() - 0.5,
+                                           &observation.color)) {
+              observation.reconstruction_idx = image_ref.first;
+              observation.point3D_id = point2D.Point3DId();
+              colors.push_back(observation);
+            }
           }
         }
       }
+    });
+
+    for (int i = 0; i < num_chunk_images; ++i) {
+      if (!chunk_read[i]) {
+        const std::string& image_name = image_names[chunk_begin + i];
+        std::cout << StringPrintf("Could not read image %s at path %s.",
+                                  image_name.c_str(),
+                                  JoinPaths(path, image_name).c_str())
+                  << std::endl;
+        continue;
+      }
+      for (const ObservationColor& observation : chunk_colors[i]) {
+        const size_t idx = observation.reconstruction_idx;
+        const BitmapColor<float>& color = observation.color;
+        const auto color_sum = color_sums[idx].emplace(
+            observation.point3D_id, Eigen::Vector3d::Zero());
+        color_sum.first->second(0) += color.r;
+        color_sum.first->second(1) += color.g;
+        color_sum.first->second(2) += color.b;
+        color_counts[idx][observation.point3D_id] += 1;
+      }
     }
   }
 
   const Eigen::Vector3ub kBlackColor(0, 0, 0);
-  for (auto& point3D : points3D_) {
-    if (color_sums.count(point3D.first)) {
-      Eigen::Vector3d color =
-          color_sums[point3D.first] / color_counts[point3D.first];
-      color.unaryExpr(std::ptr_fun<double, double>(std::round));
-      point3D.second.SetColor(color.cast<uint8_t>());
-    } else {
-      point3D.second.SetColor(kBlackColor);
+  for (size_t i = 0; i < reconstructions.size(); ++i) {
+    for (auto& point3D : reconstructions[i]->points3D_) {
+      const auto color_sum = color_sums[i].find(point3D.first);
+      if (color_sum != color_sums[i].end()) {
+        Eigen::Vector3d color =
+            color_sum->second / color_counts[i].at(point3D.first);
+        color.unaryExpr(std::ptr_fun<double, double>(std::round));
+        point3D.second.SetColor(color.cast<uint8_t>());
+      } else {
+        point3D.second.SetColor(kBlackColor);
+      }
     }
+
+    reconstructions[i]->RecordAllChanges();
   }
 }
 
@@ -1318,21 +1543,36 @@ size_t Reconstruction::FilterPoints3DWithLargeReprojectionError(
   // Cache for projection matrices.
   EIGEN_STL_UMAP(image_t, Eigen::Matrix3x4d) proj_matrices;
 
+  // The observations of the points to check, in track order. Observations
+  // behind the camera keep a negative reprojection error.
+  struct Observation {
+    TrackElement track_el;
+    double reproj_error;
+  };
+  std::vector<std::pair<point3D_t, size_t>> point_observations;
+  std::vector<Observation> observations;
+
+  // The normalized projections of the observations, grouped by camera, so
+  // that they are projected to the image plane in one batch per camera.
+  struct CameraBatch {
+    std::vector<size_t> observation_idxs;
+    std::vector<Eigen::Vector2d> points;
+  };
+  std::unordered_map<camera_t, CameraBatch> camera_batches;
+
   for (const auto point3D_id : point3D_ids) {
     if (!ExistsPoint3D(point3D_id)) {
       continue;
     }
 
-    class Point3D& point3D = Point3D(point3D_id);
+    const class Point3D& point3D = Point3D(point3D_id);
 
     if (point3D.Track().Length() < 2) {
       DeletePoint3D(point3D_id);
       continue;
     }
 
-    double reproj_error_sum = 0.0;
-
-    std::vector<TrackElement> track_els_to_delete;
+    point_observations.emplace_back(point3D_id, observations.size());
 
     for (const auto& track_el : point3D.Track().Elements()) {
       const class Image& image = Image(track_el.image_id);
@@ -1346,23 +1586,71 @@ size_t Reconstruction::FilterPoints3DWithLargeReprojectionError(
       }
 
       if (HasPointPositiveDepth(proj_matrix, point3D.XYZ())) {
-        const class Camera& camera = Camera(image.CameraId());
-        const Point2D& point2D = image.Point2D(track_el.point2D_idx);
-        const double reproj_error = CalculateReprojectionError(
-            point2D.XY(), point3D.XYZ(), proj_matrix, camera);
-        if (reproj_error > max_reproj_error) {
-          track_els_to_delete.push_back(track_el);
-        } else {
-          reproj_error_sum += reproj_error;
-        }
+        CameraBatch& batch = camera_batches[image.CameraId()];
+        batch.observation_idxs.push_back(observations.size());
+        batch.points.push_back(
+            (proj_matrix * point3D.XYZ().homogeneous()).hnormalized());
+      }
+
+      observations.push_back({track_el, -1.0});
+    }
+  }
+
+  // The batches are projected and compared in parallel chunks, which only
+  // read the reconstruction.
+  const size_t kChunkSize = 4096;
+  struct BatchChunk {
+    camera_t camera_id;
+    CameraBatch* batch;
+    size_t begin;
+  };
+  std::vector<BatchChunk> chunks;
+  for (auto& camera_batch : camera_batches) {
+    for (size_t begin = 0; begin < camera_batch.second.points.size();
+         begin += kChunkSize) {
+      chunks.push_back({camera_batch.first, &camera_batch.second, begin});
+    }
+  }
+
+  ParallelFor(0, static_cast<int>(chunks.size()), [&](const int chunk_idx) {
+    const BatchChunk& chunk = chunks[chunk_idx];
+    const CameraBatch& batch = *chunk.batch;
+    const size_t end = std::min(chunk.begin + kChunkSize, batch.points.size());
+    std::vector<Eigen::Vector2d> points(batch.points.begin() + chunk.begin,
+                                        batch.points.begin() + end);
+    Camera(chunk.camera_id).WorldToImage(points, &points);
+    for (size_t i = chunk.begin; i < end; ++i) {
+      Observation& observation = observations[batch.observation_idxs[i]];
+      const Point2D& point2D = Image(observation.track_el.image_id)
+                                   .Point2D(observation.track_el.point2D_idx);
+      observation.reproj_error =
+          (points[i - chunk.begin] - point2D.XY()).norm();
+    }
+  });
+
+  for (size_t i = 0; i < point_observations.size(); ++i) {
+    const point3D_t point3D_id = point_observations[i].first;
+    class Point3D& point3D = Point3D(point3D_id);
+    const size_t track_length = point3D.Track().Length();
+    const size_t observations_begin = point_observations[i].second;
+
+    double reproj_error_sum = 0.0;
+
+    std::vector<TrackElement> track_els_to_delete;
+
+    for (size_t j = 0; j < track_length; ++j) {
+      const Observation& observation = observations[observations_begin + j];
+      if (observation.reproj_error < 0 ||
+          observation.reproj_error > max_reproj_error) {
+        track_els_to_delete.push_back(observation.track_el);
       } else {
-        track_els_to_delete.push_back(track_el);
+        reproj_error_sum += observation.reproj_error;
       }
     }
 
-    if (track_els_to_delete.size() == point3D.Track().Length() ||
-        track_els_to_delete.size() == point3D.Track().Length() - 1) {
-      num_filtered += point3D.Track().Length();
+    if (track_els_to_delete.size() == track_length ||
+        track_els_to_delete.size() == track_length - 1) {
+      num_filtered += track_length;
       DeletePoint3D(point3D_id);
     } else {
       num_filtered += track_els_to_delete.size();
@@ -1370,6 +1658,7 @@ size_t Reconstruction::FilterPoints3DWithLargeReprojectionError(
         DeleteObservation(track_el.image_id, track_el.point2D_idx);
       }
       point3D.SetError(reproj_error_sum / point3D.Track().Length());
+      RecordPoint3DChange(point3D_id);
     }
   }
 
@@ -1756,51 +2045,59 @@ void Reconstruction::WriteImagesText(const std::string& path) const {
        << ", mean observations per image: "
        << ComputeMeanObservationsPerRegImage() << std::endl;
 
-  for (const auto& image : images_) {
-    if (!image.second.IsRegistered()) {
-      continue;
-    }
-
-    std::ostringstream line;
-    std::string line_string;
-
-    line << image.first << " ";
-
-    // QVEC (qw, qx, qy, qz)
-    const Eigen::Vector4d normalized_qvec =
-        NormalizeQuaternion(image.second.Qvec());
-    line << normalized_qvec(0) << " ";
-    line << normalized_qvec(1) << " ";
-    line << normalized_qvec(2) << " ";
-    line << normalized_qvec(3) << " ";
-
-    // TVEC
-    line << image.second.Tvec(0) << " ";
-    line << image.second.Tvec(1) << " ";
-    line << image.second.Tvec(2) << " ";
+  const auto images = MapElements(images_);
 
-    line << image.second.CameraId() << " ";
+  WriteParallel(
+      images.size(), kNumImagesPerWriteChunk,
+      [&images](const size_t begin, const size_t end, OutputBuffer* buffer) {
+        for (size_t i = begin; i < end; ++i) {
+          const class Image& image = images[i]->second;
+          if (!image.IsRegistered()) {
+            continue;
+          }
 
-    line << image.second.Name();
+          buffer->AppendUInt(images[i]->first);
+          buffer->Append(' ');
 
-    file << line.str() << std::endl;
+          // QVEC (qw, qx, qy, qz)
+          const Eigen::Vector4d normalized_qvec =
+              NormalizeQuaternion(image.Qvec());
+          for (int j = 0; j < 4; ++j) {
+            buffer->AppendDouble(normalized_qvec(j));
+            buffer->Append(' ');
+          }
 
-    line.str("");
-    line.clear();
+          // TVEC
+          for (int j = 0; j < 3; ++j) {
+            buffer->AppendDouble(image.Tvec(j));
+            buffer->Append(' ');
+          }
 
-    for (const Point2D& point2D : image.second.Points2D()) {
-      line << point2D.X() << " ";
-      line << point2D.Y() << " ";
-      if (point2D.HasPoint3D()) {
-        line << point2D.Point3DId() << " ";
-      } else {
-        line << -1 << " ";
-      }
-    }
-    line_string = line.str();
-    line_string = line_string.substr(0, line_string.size() - 1);
-    file << line_string << std::endl;
-  }
+          buffer->AppendUInt(image.CameraId());
+          buffer->Append(' ');
+
+          buffer->Append(image.Name());
+          buffer->Append('\n');
+
+          for (const Point2D& point2D : image.Points2D()) {
+            buffer->AppendDouble(point2D.X());
+            buffer->Append(' ');
+            buffer->AppendDouble(point2D.Y());
+            buffer->Append(' ');
+            if (point2D.HasPoint3D()) {
+              buffer->AppendUInt(point2D.Point3DId());
+            } else {
+              buffer->AppendInt(-1);
+            }
+            buffer->Append(' ');
+          }
+          if (image.NumPoints2D() > 0) {
+            buffer->PopBack();
+          }
+          buffer->Append('\n');
+        }
+      },
+      &file);
 }
 
 void Reconstruction::WritePoints3DText(const std::string& path) const {
@@ -1814,28 +2111,40 @@ void Reconstruction::WritePoints3DText(const std::string& path) const {
   file << "# Number of points: " << points3D_.size()
        << ", mean track length: " << ComputeMeanTrackLength() << std::endl;
 
-  for (const auto& point3D : points3D_) {
-    file << point3D.first << " ";
-    file << point3D.second.XYZ()(0) << " ";
-    file << point3D.second.XYZ()(1) << " ";
-    file << point3D.second.XYZ()(2) << " ";
-    file << static_cast<int>(point3D.second.Color(0)) << " ";
-    file << static_cast<int>(point3D.second.Color(1)) << " ";
-    file << static_cast<int>(point3D.second.Color(2)) << " ";
-    file << point3D.second.Error() << " ";
-
-    std::ostringstream line;
-
-    for (const auto& track_el : point3D.second.Track().Elements()) {
-      line << track_el.image_id << " ";
-      line << track_el.point2D_idx << " ";
-    }
+  const auto points3D = MapElements(points3D_);
 
-    std::string line_string = line.str();
-    line_string = line_string.substr(0, line_string.size() - 1);
+  WriteParallel(
+      points3D.size(), kNumPoints3DPerWriteChunk,
+      [&points3D](const size_t begin, const size_t end, OutputBuffer* buffer) {
+        for (size_t i = begin; i < end; ++i) {
+          const class Point3D& point3D = points3D[i]->second;
 
-    file << line_string << std::endl;
-  }
+          buffer->AppendUInt(points3D[i]->first);
+          buffer->Append(' ');
+          for (int j = 0; j < 3; ++j) {
+            buffer->AppendDouble(point3D.XYZ()(j));
+            buffer->Append(' ');
+          }
+          for (int j = 0; j < 3; ++j) {
+            buffer->AppendUInt(point3D.Color(j));
+            buffer->Append(' ');
+          }
+          buffer->AppendDouble(point3D.Error());
+          buffer->Append(' ');
+
+          for (const auto& track_el : point3D.Track().Elements()) {
+            buffer->AppendUInt(track_el.image_id);
+            buffer->Append(' ');
+            buffer->AppendUInt(track_el.point2D_idx);
+            buffer->Append(' ');
+          }
+          if (point3D.Track().Length() > 0) {
+            buffer->PopBack();
+          }
+          buffer->Append('\n');
+        }
+      },
+      &file);
 }
 
 void Reconstruction::WriteCamerasBinary(const std::string& path) const {
@@ -1861,36 +2170,43 @@ void Reconstruction::WriteImagesBinary(const std::string& path) const {
 
   WriteBinaryLittleEndian<uint64_t>(&file, reg_image_ids_.size());
 
-  for (const auto& image : images_) {
-    if (!image.second.IsRegistered()) {
-      continue;
-    }
+  const auto images = MapElements(images_);
 
-    WriteBinaryLittleEndian<image_t>(&file, image.first);
+  WriteParallel(
+      images.size(), kNumImagesPerWriteChunk,
+      [&images](const size_t begin, const size_t end, OutputBuffer* buffer) {
+        for (size_t i = begin; i < end; ++i) {
+          const class Image& image = images[i]->second;
+          if (!image.IsRegistered()) {
+            continue;
+          }
 
-    const Eigen::Vector4d normalized_qvec =
-        NormalizeQuaternion(image.second.Qvec());
-    WriteBinaryLittleEndian<double>(&file, normalized_qvec(0));
-    WriteBinaryLittleEndian<double>(&file, normalized_qvec(1));
-    WriteBinaryLittleEndian<double>(&file, normalized_qvec(2));
-    WriteBinaryLittleEndian<double>(&file, normalized_qvec(3));
+          buffer->AppendBinary<image_t>(images[i]->first);
 
-    WriteBinaryLittleEndian<double>(&file, image.second.Tvec(0));
-    WriteBinaryLittleEndian<double>(&file, image.second.Tvec(1));
-    WriteBinaryLittleEndian<double>(&file, image.second.Tvec(2));
+          const Eigen::Vector4d normalized_qvec =
+              NormalizeQuaternion(image.Qvec());
+          for (int j = 0; j < 4; ++j) {
+            buffer->AppendBinary<double>(normalized_qvec(j));
+          }
 
-    WriteBinaryLittleEndian<camera_t>(&file, image.second.CameraId());
+          for (int j = 0; j < 3; ++j) {
+            buffer->AppendBinary<double>(image.Tvec(j));
+          }
 
-    const std::string name = image.second.Name() + '\0';
-    file.write(name.c_str(), name.size());
+          buffer->AppendBinary<camera_t>(image.CameraId());
 
-    WriteBinaryLittleEndian<uint64_t>(&file, image.second.NumPoints2D());
-    for (const Point2D& point2D : image.second.Points2D()) {
-      WriteBinaryLittleEndian<double>(&file, point2D.X());
-      WriteBinaryLittleEndian<double>(&file, point2D.Y());
-      WriteBinaryLittleEndian<point3D_t>(&file, point2D.Point3DId());
-    }
-  }
+          buffer->Append(image.Name());
+          buffer->Append('\0');
+
+          buffer->AppendBinary<uint64_t>(image.NumPoints2D());
+          for (const Point2D& point2D : image.Points2D()) {
+            buffer->AppendBinary<double>(point2D.X());
+            buffer->AppendBinary<double>(point2D.Y());
+            buffer->AppendBinary<point3D_t>(point2D.Point3DId());
+          }
+        }
+      },
+      &file);
 }
 
 void Reconstruction::WritePoints3DBinary(const std::string& path) const {
@@ -1899,22 +2215,31 @@ void Reconstruction::WritePoints3DBinary(const std::string& path) const {
 
   WriteBinaryLittleEndian<uint64_t>(&file, points3D_.size());
 
-  for (const auto& point3D : points3D_) {
-    WriteBinaryLittleEndian<point3D_t>(&file, point3D.first);
-    WriteBinaryLittleEndian<double>(&file, point3D.second.XYZ()(0));
-    WriteBinaryLittleEndian<double>(&file, point3D.second.XYZ()(1));
-    WriteBinaryLittleEndian<double>(&file, point3D.second.XYZ()(2));
-    WriteBinaryLittleEndian<uint8_t>(&file, point3D.second.Color(0));
-    WriteBinaryLittleEndian<uint8_t>(&file, point3D.second.Color(1));
-    WriteBinaryLittleEndian<uint8_t>(&file, point3D.second.Color(2));
-    WriteBinaryLittleEndian<double>(&file, point3D.second.Error());
-
-    WriteBinaryLittleEndian<uint64_t>(&file, point3D.second.Track().Length());
-    for (const auto& track_el : point3D.second.Track().Elements()) {
-      WriteBinaryLittleEndian<image_t>(&file, track_el.image_id);
-      WriteBinaryLittleEndian<point2D_t>(&file, track_el.point2D_idx);
-    }
-  }
+  const auto points3D = MapElements(points3D_);
+
+  WriteParallel(
+      points3D.size(), kNumPoints3DPerWriteChunk,
+      [&points3D](const size_t begin, const size_t end, OutputBuffer* buffer) {
+        for (size_t i = begin; i < end; ++i) {
+          const class Point3D& point3D = points3D[i]->second;
+
+          buffer->AppendBinary<point3D_t>(points3D[i]->first);
+          for (int j = 0; j < 3; ++j) {
+            buffer->AppendBinary<double>(point3D.XYZ()(j));
+          }
+          for (int j = 0; j < 3; ++j) {
+            buffer->AppendBinary<uint8_t>(point3D.Color(j));
+          }
+          buffer->AppendBinary<double>(point3D.Error());
+
+          buffer->AppendBinary<uint64_t>(point3D.Track().Length());
+          for (const auto& track_el : point3D.Track().Elements()) {
+            buffer->AppendBinary<image_t>(track_el.image_id);
+            buffer->AppendBinary<point2D_t>(track_el.point2D_idx);
+          }
+        }
+      },
+      &file);
 }
 
 void Reconstruction::SetObservationAsTriangulated(
@@ -1929,7 +2254,7 @@ void Reconstruction::SetObservationAsTriangulated(
   const class Image& image = Image(image_id);
   const Point2D& point2D = image.Point2D(point2D_idx);
   //std::cout << "THRAWN\n";
-  const std::vector<SceneGraph::Correspondence>& corrs =
+  const CsrRow<SceneGraph::Correspondence> corrs =
       scene_graph_->FindCorrespondences(image_id, point2D_idx);
 
   //std::cout << "A\n";
@@ -1943,6 +2268,7 @@ void Reconstruction::SetObservationAsTriangulated(
     class Image& corr_image = Image(corr.image_id);
     const Point2D& corr_point2D = corr_image.Point2D(corr.point2D_idx);
     corr_image.IncrementCorrespondenceHasPoint3D(corr.point2D_idx);
+    visibility_changed_image_ids_.insert(corr.image_id);
     // Update number of shared 3D points between image pairs and make sure to
     // only count the correspondences once (not twice forward and backward).
     if (point2D.Point3DId() == corr_point2D.Point3DId() &&
@@ -1952,6 +2278,9 @@ void Reconstruction::SetObservationAsTriangulated(
       image_pairs_[pair_id].first += 1;
       CHECK_LE(image_pairs_[pair_id].first, image_pairs_[pair_id].second)
           << "The scene graph graph must not contain duplicate matches";
+    } else if (corr_point2D.HasPoint3D() &&
+               corr_point2D.Point3DId() != point2D.Point3DId()) {
+      AddMergeCandidate(point2D.Point3DId(), corr_point2D.Point3DId());
     }
   }
 }
@@ -1965,7 +2294,7 @@ void Reconstruction::ResetTriObservations(const image_t image_id,
 
   const class Image& image = Image(image_id);
   const Point2D& point2D = image.Point2D(point2D_idx);
-  const std::vector<SceneGraph::Correspondence>& corrs =
+  const CsrRow<SceneGraph::Correspondence> corrs =
       scene_graph_->FindCorrespondences(image_id, point2D_idx);
 
   CHECK(image.IsRegistered());
@@ -1975,6 +2304,7 @@ void Reconstruction::ResetTriObservations(const image_t image_id,
     class Image& corr_image = Image(corr.image_id);
     const Point2D& corr_point2D = corr_image.Point2D(corr.point2D_idx);
     corr_image.DecrementCorrespondenceHasPoint3D(corr.point2D_idx);
+    visibility_changed_image_ids_.insert(corr.image_id);
     // Update number of shared 3D points between image pairs and make sure to
     // only count the correspondences once (not twice forward and backward).
     if (point2D.Point3DId() == corr_point2D.Point3DId() &&
@@ -1984,6 +2314,53 @@ void Reconstruction::ResetTriObservations(const image_t image_id,
       image_pairs_[pair_id].first -= 1;
       CHECK_GE(image_pairs_[pair_id].first, 0)
           << "The scene graph graph must not contain duplicate matches";
+    } else if (corr_point2D.HasPoint3D() &&
+               corr_point2D.Point3DId() != point2D.Point3DId()) {
+      RemoveMergeCandidate(point2D.Point3DId(), corr_point2D.Point3DId());
+    }
+  }
+}
+
+void Reconstruction::AddMergeCandidate(const point3D_t point3D_id1,
+                                       const point3D_t point3D_id2) {
+  for (const auto& point3D_ids : {std::make_pair(point3D_id1, point3D_id2),
+                                  std::make_pair(point3D_id2, point3D_id1)}) {
+    auto& merge_candidates = merge_candidates_[point3D_ids.first];
+    auto it = std::find_if(
+        merge_candidates.begin(), merge_candidates.end(),
+        [&point3D_ids](const std::pair<point3D_t, size_t>& merge_candidate) {
+          return merge_candidate.first == point3D_ids.second;
+        });
+    if (it == merge_candidates.end()) {
+      merge_candidates.emplace_back(point3D_ids.second, 1);
+    } else {
+      it->second += 1;
+    }
+  }
+}
+
+void Reconstruction::RemoveMergeCandidate(const point3D_t point3D_id1,
+                                          const point3D_t point3D_id2) {
+  for (const auto& point3D_ids : {std::make_pair(point3D_id1, point3D_id2),
+                                  std::make_pair(point3D_id2, point3D_id1)}) {
+    const auto merge_candidates = merge_candidates_.find(point3D_ids.first);
+    if (merge_candidates == merge_candidates_.end()) {
+      continue;
+    }
+    auto it = std::find_if(
+        merge_candidates->second.begin(), merge_candidates->second.end(),
+        [&point3D_ids](const std::pair<point3D_t, size_t>& merge_candidate) {
+          return merge_candidate.first == point3D_ids.second;
+        });
+    if (it == merge_candidates->second.end()) {
+      continue;
+    }
+    it->second -= 1;
+    if (it->second == 0) {
+      merge_candidates->second.erase(it);
+      if (merge_candidates->second.empty()) {
+        merge_candidates_.erase(merge_candidates);
+      }
     }
   }
 }
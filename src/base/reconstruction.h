@@ -30,15 +30,24 @@
 #include "base/point3d.h"
 #include "base/track.h"
 #include "util/alignment.h"
+#include "util/dense_id_map.h"
 #include "util/types.h"
 
 namespace colmap {
 
+class SimilarityTransform3;
+
 // Reconstruction class holds all information about a single reconstructed
 // model. It is used by the mapping and bundle adjustment classes and can be
 // written to and read from disk.
 class Reconstruction {
  public:
+  // The images and the 3D points are stored by identifier in pages of
+  // consecutive identifiers, which are iterated in the order of the
+  // identifiers. References to them stay valid until they are deleted.
+  typedef DenseIdMap<image_t, class Image, 256> ImageMap;
+  typedef DenseIdMap<point3D_t, class Point3D> Point3DMap;
+
   Reconstruction();
 
   // Get number of objects.
@@ -67,15 +76,51 @@ class Reconstruction {
 
   // Get reference to all objects.
   inline const EIGEN_STL_UMAP(camera_t, class Camera) & Cameras() const;
-  inline const EIGEN_STL_UMAP(image_t, class Image) & Images() const;
+  inline const ImageMap& Images() const;
   inline const std::vector<image_t>& RegImageIds() const;
-  inline const EIGEN_STL_UMAP(point3D_t, class Point3D) & Points3D() const;
+  inline const Point3DMap& Points3D() const;
   inline const std::unordered_map<image_pair_t, std::pair<size_t, size_t>>&
   ImagePairs() const;
 
   // Identifiers of all 3D points.
   std::unordered_set<point3D_t> Point3DIds() const;
 
+  // Identifiers of images whose number of visible 3D points changed since the
+  // last call to `ClearVisibilityChangedImageIds`. This allows to update image
+  // rankings incrementally.
+  inline const std::unordered_set<image_t>& VisibilityChangedImageIds() const;
+  inline void ClearVisibilityChangedImageIds();
+
+  // The images and 3D points that were added, deleted or changed since the
+  // last call to `TakeChanges`. This allows a viewer of a reconstruction that
+  // is still being built to copy only the changes. Changes are only recorded
+  // after `EnableChangeRecording`, and changes through the mutable object
+  // accessors, e.g. by bundle adjustment, must be recorded by the caller.
+  struct Changes {
+    // Whether everything may have changed, e.g. after normalization.
+    bool all = false;
+    std::unordered_set<image_t> image_ids;
+    std::unordered_set<point3D_t> point3D_ids;
+  };
+  void EnableChangeRecording();
+  inline bool IsRecordingChanges() const;
+  inline void RecordImageChange(const image_t image_id);
+  inline void RecordPoint3DChange(const point3D_t point3D_id);
+  inline void RecordAllChanges();
+  Changes TakeChanges();
+
+  // The other 3D points with observations that correspond to observations of
+  // the given 3D point, with the number of these correspondences. Only these
+  // 3D points can be merged with the given 3D point. The candidates are
+  // updated as observations are triangulated and reset, so that track merging
+  // does not have to search the correspondences of every track element.
+  // They are only maintained while the reconstruction is set up.
+  const std::vector<std::pair<point3D_t, size_t>>& MergeCandidates(
+      const point3D_t point3D_id) const;
+
+  // Identifiers of all 3D points that have merge candidates.
+  std::vector<point3D_t> MergeCandidatePoint3DIds() const;
+
   // Check whether specific object exists.
   inline bool ExistsCamera(const camera_t camera_id) const;
   inline bool ExistsImage(const image_t image_id) const;
@@ -104,8 +149,6 @@ class Reconstruction {
   // Add new image.
   void AddImage(const class Image& image);
 
-  void InitNewImage(const image_t image_id, const image_t original, std::vector<image_pair_t> * old_pairs, std::vector<image_pair_t> * new_pairs);
-
   // Add new 3D object, and return its unique ID.
   point3D_t AddPoint3D(const Eigen::Vector3d& xyz, const Track& track);
 
@@ -157,6 +200,8 @@ class Reconstruction {
   // merging the two clouds and their tracks. The coordinate frames of the two
   // reconstructions are aligned using the projection centers of common
   // registered images. Return true if the two reconstructions could be merged.
+  // The tracks of the given reconstruction are matched in parallel and the
+  // result does not depend on the number of threads.
   bool Merge(const Reconstruction& reconstruction, const int min_common_images);
 
   // Align the given reconstruction with a set of pre-defined camera positions.
@@ -257,6 +302,14 @@ class Reconstruction {
   //                      root path and the name of the image.
   void ExtractColorsForAllImages(const std::string& path);
 
+  // Extract colors for all 3D points of several reconstructions, e.g. the
+  // models of different bodies observed in the same images, in one pass over
+  // the images. The images are read in parallel and every image is read once,
+  // also if it is registered in more than one of the reconstructions.
+  static void ExtractColorsForAllImages(
+      const std::string& path,
+      const std::vector<Reconstruction*>& reconstructions);
+
   // Create all image sub-directories in the given path.
   void CreateImageDirs(const std::string& path) const;
 
@@ -268,6 +321,10 @@ class Reconstruction {
       const double max_reproj_error,
       const std::unordered_set<point3D_t>& point3D_ids);
 
+  // Apply the similarity transformation to all images and 3D points in
+  // parallel, without recording the changes.
+  void TransformImagesAndPoints3D(const SimilarityTransform3& tform);
+
   void ReadCamerasText(const std::string& path);
   void ReadImagesText(const std::string& path);
   void ReadPoints3DText(const std::string& path);
@@ -288,18 +345,36 @@ class Reconstruction {
   void ResetTriObservations(const image_t image_id, const point2D_t point2D_idx,
                             const bool is_deleted_point3D);
 
+  // Count a correspondence between the observations of two different 3D
+  // points in the merge candidates of both 3D points, or remove it.
+  void AddMergeCandidate(const point3D_t point3D_id1,
+                         const point3D_t point3D_id2);
+  void RemoveMergeCandidate(const point3D_t point3D_id1,
+                            const point3D_t point3D_id2);
+
   //HERE
   const SceneGraph* scene_graph_;
   //SceneGraph* scene_graph_;
 
   EIGEN_STL_UMAP(camera_t, class Camera) cameras_;
-  EIGEN_STL_UMAP(image_t, class Image) images_;
-  EIGEN_STL_UMAP(point3D_t, class Point3D) points3D_;
+  ImageMap images_;
+  Point3DMap points3D_;
   std::unordered_map<image_pair_t, std::pair<size_t, size_t>> image_pairs_;
 
   // { image_id, ... } where `images_.at(image_id).registered == true`.
   std::vector<image_t> reg_image_ids_;
 
+  // Images whose correspondences gained or lost a 3D point.
+  std::unordered_set<image_t> visibility_changed_image_ids_;
+
+  // The changes since the last call to `TakeChanges`, if they are recorded.
+  bool record_changes_;
+  Changes changes_;
+
+  // The merge candidates of the 3D points that have any.
+  std::unordered_map<point3D_t, std::vector<std::pair<point3D_t, size_t>>>
+      merge_candidates_;
+
   // Total number of added 3D points, used to generate unique identifiers.
   point3D_t num_added_points3D_;
 };
@@ -368,7 +443,7 @@ const EIGEN_STL_UMAP(camera_t, Camera) & Reconstruction::Cameras() const {
   return cameras_;
 }
 
-const EIGEN_STL_UMAP(image_t, class Image) & Reconstruction::Images() const {
+const Reconstruction::ImageMap& Reconstruction::Images() const {
   return images_;
 }
 
@@ -376,7 +451,7 @@ const std::vector<image_t>& Reconstruction::RegImageIds() const {
   return reg_image_ids_;
 }
 
-const EIGEN_STL_UMAP(point3D_t, Point3D) & Reconstruction::Points3D() const {
+const Reconstruction::Point3DMap& Reconstruction::Points3D() const {
   return points3D_;
 }
 
@@ -385,6 +460,37 @@ Reconstruction::ImagePairs() const {
   return image_pairs_;
 }
 
+const std::unordered_set<image_t>& Reconstruction::VisibilityChangedImageIds()
+    const {
+  return visibility_changed_image_ids_;
+}
+
+void Reconstruction::ClearVisibilityChangedImageIds() {
+  visibility_changed_image_ids_.clear();
+}
+
+bool Reconstruction::IsRecordingChanges() const { return record_changes_; }
+
+void Reconstruction::RecordImageChange(const image_t image_id) {
+  if (record_changes_ && !changes_.all) {
+    changes_.image_ids.insert(image_id);
+  }
+}
+
+void Reconstruction::RecordPoint3DChange(const point3D_t point3D_id) {
+  if (record_changes_ && !changes_.all) {
+    changes_.point3D_ids.insert(point3D_id);
+  }
+}
+
+void Reconstruction::RecordAllChanges() {
+  if (record_changes_) {
+    changes_.all = true;
+    changes_.image_ids.clear();
+    changes_.point3D_ids.clear();
+  }
+}
+
 bool Reconstruction::ExistsCamera(const camera_t camera_id) const {
   return cameras_.find(camera_id) != cameras_.end();
 }
@@ -405,11 +511,6 @@ bool Reconstruction::IsImageRegistered(const image_t image_id) const {
   return Image(image_id).IsRegistered();
 }
 
-/*void Reconstruction::InitNewImage(const image_t image_id, const image_t original)
-{
-	int i = image_id + original;
-}*/
-
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_BASE_RECONSTRUCTION_H_
@@ -17,8 +17,13 @@
 #define TEST_NAME "base/reconstruction"
 #include "util/testing.h"
 
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
 #include "base/pose.h"
 #include "base/reconstruction.h"
+#include "util/misc.h"
 
 using namespace colmap;
 
@@ -126,6 +131,108 @@ BOOST_AUTO_TEST_CASE(TestAddObservation) {
   BOOST_CHECK_EQUAL(reconstruction.Point3D(point3D_id).Track().Length(), 2);
 }
 
+BOOST_AUTO_TEST_CASE(TestVisibilityChangedImageIds) {
+  Reconstruction reconstruction;
+  SceneGraph scene_graph;
+  GenerateReconstruction(3, &reconstruction, &scene_graph);
+  FeatureMatches matches(1);
+  matches[0].point2D_idx1 = 0;
+  matches[0].point2D_idx2 = 1;
+  scene_graph.AddCorrespondences(1, 2, matches);
+  reconstruction.Image(1).SetNumObservations(1);
+  reconstruction.Image(2).SetNumObservations(1);
+  BOOST_CHECK_EQUAL(reconstruction.VisibilityChangedImageIds().size(), 0);
+  Track track;
+  track.AddElement(1, 0);
+  const point3D_t point3D_id =
+      reconstruction.AddPoint3D(Eigen::Vector3d::Random(), track);
+  BOOST_CHECK_EQUAL(reconstruction.VisibilityChangedImageIds().size(), 1);
+  BOOST_CHECK_EQUAL(reconstruction.VisibilityChangedImageIds().count(2), 1);
+  reconstruction.ClearVisibilityChangedImageIds();
+  BOOST_CHECK_EQUAL(reconstruction.VisibilityChangedImageIds().size(), 0);
+  reconstruction.AddObservation(point3D_id, TrackElement(3, 0));
+  BOOST_CHECK_EQUAL(reconstruction.VisibilityChangedImageIds().size(), 0);
+  reconstruction.DeletePoint3D(point3D_id);
+  BOOST_CHECK_EQUAL(reconstruction.VisibilityChangedImageIds().size(), 1);
+  BOOST_CHECK_EQUAL(reconstruction.VisibilityChangedImageIds().count(2), 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestChanges) {
+  Reconstruction reconstruction;
+  SceneGraph scene_graph;
+  GenerateReconstruction(3, &reconstruction, &scene_graph);
+  BOOST_CHECK(!reconstruction.IsRecordingChanges());
+  Track track;
+  track.AddElement(1, 0);
+  reconstruction.AddPoint3D(Eigen::Vector3d::Random(), track);
+  BOOST_CHECK(reconstruction.TakeChanges().point3D_ids.empty());
+
+  reconstruction.EnableChangeRecording();
+  BOOST_CHECK(reconstruction.IsRecordingChanges());
+  const point3D_t point3D_id =
+      reconstruction.AddPoint3D(Eigen::Vector3d::Random(), track);
+  reconstruction.AddObservation(point3D_id, TrackElement(2, 0));
+  Reconstruction::Changes changes = reconstruction.TakeChanges();
+  BOOST_CHECK(!changes.all);
+  BOOST_CHECK_EQUAL(changes.point3D_ids.size(), 1);
+  BOOST_CHECK_EQUAL(changes.point3D_ids.count(point3D_id), 1);
+  BOOST_CHECK_EQUAL(changes.image_ids.size(), 2);
+  BOOST_CHECK(reconstruction.TakeChanges().image_ids.empty());
+
+  reconstruction.DeRegisterImage(3);
+  changes = reconstruction.TakeChanges();
+  BOOST_CHECK_EQUAL(changes.image_ids.size(), 1);
+  BOOST_CHECK_EQUAL(changes.image_ids.count(3), 1);
+  BOOST_CHECK(changes.point3D_ids.empty());
+
+  reconstruction.Transform(2, ComposeIdentityQuaternion(),
+                           Eigen::Vector3d::Zero());
+  changes = reconstruction.TakeChanges();
+  BOOST_CHECK(changes.all);
+  BOOST_CHECK(changes.image_ids.empty());
+  BOOST_CHECK(changes.point3D_ids.empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestMergeCandidates) {
+  Reconstruction reconstruction;
+  SceneGraph scene_graph;
+  GenerateReconstruction(4, &reconstruction, &scene_graph);
+  FeatureMatches matches(1);
+  matches[0].point2D_idx1 = 0;
+  matches[0].point2D_idx2 = 0;
+  scene_graph.AddCorrespondences(1, 2, matches);
+  scene_graph.AddCorrespondences(2, 3, matches);
+  for (image_t image_id = 1; image_id <= 3; ++image_id) {
+    reconstruction.Image(image_id).SetNumObservations(1);
+  }
+  Track track1;
+  track1.AddElement(1, 0);
+  track1.AddElement(4, 0);
+  const point3D_t point3D_id1 =
+      reconstruction.AddPoint3D(Eigen::Vector3d::Random(), track1);
+  BOOST_CHECK(reconstruction.MergeCandidates(point3D_id1).empty());
+  Track track2;
+  track2.AddElement(2, 0);
+  const point3D_t point3D_id2 =
+      reconstruction.AddPoint3D(Eigen::Vector3d::Random(), track2);
+  BOOST_CHECK_EQUAL(reconstruction.MergeCandidates(point3D_id1).size(), 1);
+  BOOST_CHECK_EQUAL(reconstruction.MergeCandidates(point3D_id1)[0].first,
+                    point3D_id2);
+  BOOST_CHECK_EQUAL(reconstruction.MergeCandidates(point3D_id1)[0].second, 1);
+  BOOST_CHECK_EQUAL(reconstruction.MergeCandidates(point3D_id2)[0].first,
+                    point3D_id1);
+  BOOST_CHECK_EQUAL(reconstruction.MergeCandidatePoint3DIds().size(), 2);
+  reconstruction.AddObservation(point3D_id1, TrackElement(3, 0));
+  BOOST_CHECK_EQUAL(reconstruction.MergeCandidates(point3D_id1)[0].second, 2);
+  BOOST_CHECK_EQUAL(reconstruction.MergeCandidates(point3D_id2)[0].second, 2);
+  reconstruction.DeleteObservation(3, 0);
+  BOOST_CHECK_EQUAL(reconstruction.MergeCandidates(point3D_id1)[0].second, 1);
+  BOOST_CHECK_EQUAL(reconstruction.MergeCandidates(point3D_id2)[0].second, 1);
+  reconstruction.DeletePoint3D(point3D_id2);
+  BOOST_CHECK(reconstruction.MergeCandidates(point3D_id1).empty());
+  BOOST_CHECK(reconstruction.MergeCandidatePoint3DIds().empty());
+}
+
 BOOST_AUTO_TEST_CASE(TestMergePoints3D) {
   Reconstruction reconstruction;
   SceneGraph scene_graph;
@@ -283,6 +390,152 @@ BOOST_AUTO_TEST_CASE(TestTransform) {
                     Eigen::Vector3d(2, 3, 4));
 }
 
+void AddRegisteredImage(const image_t image_id, const Eigen::Vector3d& tvec,
+                        Reconstruction* reconstruction) {
+  const size_t kNumPoints2D = 10;
+  Image image;
+  image.SetImageId(image_id);
+  image.SetCameraId(1);
+  image.SetName("image" + std::to_string(image_id));
+  image.SetTvec(tvec);
+  image.SetPoints2D(
+      std::vector<Eigen::Vector2d>(kNumPoints2D, Eigen::Vector2d::Zero()));
+  reconstruction->AddImage(image);
+  reconstruction->RegisterImage(image_id);
+}
+
+BOOST_AUTO_TEST_CASE(TestMerge) {
+  Camera camera;
+  camera.SetCameraId(1);
+  camera.InitializeWithName("PINHOLE", 1, 1, 1);
+
+  Reconstruction reconstruction1;
+  reconstruction1.AddCamera(camera);
+  AddRegisteredImage(1, Eigen::Vector3d(0, 0, 0), &reconstruction1);
+  AddRegisteredImage(2, Eigen::Vector3d(1, 0, 0), &reconstruction1);
+  AddRegisteredImage(3, Eigen::Vector3d(0, 1, 0), &reconstruction1);
+  AddRegisteredImage(4, Eigen::Vector3d(0, 0, 1), &reconstruction1);
+  Track track1;
+  track1.AddElement(1, 0);
+  track1.AddElement(2, 0);
+  reconstruction1.AddPoint3D(Eigen::Vector3d(0, 0, 1), track1);
+  Track track2;
+  track2.AddElement(2, 3);
+  track2.AddElement(3, 0);
+  track2.AddElement(4, 0);
+  reconstruction1.AddPoint3D(Eigen::Vector3d(0, 1, 1), track2);
+
+  Reconstruction reconstruction2;
+  reconstruction2.AddCamera(camera);
+  AddRegisteredImage(1, Eigen::Vector3d(0, 0, 0), &reconstruction2);
+  AddRegisteredImage(2, Eigen::Vector3d(1, 0, 0), &reconstruction2);
+  AddRegisteredImage(3, Eigen::Vector3d(0, 1, 0), &reconstruction2);
+  AddRegisteredImage(5, Eigen::Vector3d(1, 1, 0), &reconstruction2);
+  // Merged with the first point of the first reconstruction.
+  Track track3;
+  track3.AddElement(1, 0);
+  track3.AddElement(2, 1);
+  track3.AddElement(5, 0);
+  reconstruction2.AddPoint3D(Eigen::Vector3d(0, 0, 1), track3);
+  // Merged with the second point of the first reconstruction.
+  Track track4;
+  track4.AddElement(1, 1);
+  track4.AddElement(3, 0);
+  reconstruction2.AddPoint3D(Eigen::Vector3d(0, 1, 1), track4);
+  // Ambiguous, since it maps to both points of the first reconstruction.
+  Track track5;
+  track5.AddElement(2, 0);
+  track5.AddElement(2, 3);
+  track5.AddElement(5, 1);
+  reconstruction2.AddPoint3D(Eigen::Vector3d(1, 1, 1), track5);
+  // Copied to the first reconstruction.
+  Track track6;
+  track6.AddElement(2, 2);
+  track6.AddElement(5, 2);
+  const point3D_t point3D_id6 =
+      reconstruction2.AddPoint3D(Eigen::Vector3d(1, 2, 3), track6);
+  reconstruction2.Point3D(point3D_id6).Color() = Eigen::Vector3ub(1, 2, 3);
+  reconstruction2.Transform(
+      2, NormalizeQuaternion(Eigen::Vector4d(0.1, 0.3, 0.2, 0.4)),
+      Eigen::Vector3d(100, 10, 0.5));
+
+  BOOST_CHECK(!reconstruction1.Merge(reconstruction2, 4));
+  BOOST_CHECK(reconstruction1.Merge(reconstruction2, 3));
+
+  BOOST_CHECK_EQUAL(reconstruction1.NumRegImages(), 5);
+  BOOST_CHECK(reconstruction1.IsImageRegistered(5));
+  BOOST_CHECK_LT((reconstruction1.Image(5).ProjectionCenter() +
+                  Eigen::Vector3d(1, 1, 0))
+                     .norm(),
+                 1e-6);
+
+  BOOST_CHECK_EQUAL(reconstruction1.NumPoints3D(), 3);
+  const point3D_t point3D_id1 =
+      reconstruction1.Image(1).Point2D(0).Point3DId();
+  BOOST_CHECK_EQUAL(reconstruction1.Point3D(point3D_id1).Track().Length(), 4);
+  BOOST_CHECK_EQUAL(reconstruction1.Image(2).Point2D(0).Point3DId(),
+                    point3D_id1);
+  BOOST_CHECK_EQUAL(reconstruction1.Image(2).Point2D(1).Point3DId(),
+                    point3D_id1);
+  BOOST_CHECK_EQUAL(reconstruction1.Image(5).Point2D(0).Point3DId(),
+                    point3D_id1);
+  const point3D_t point3D_id2 =
+      reconstruction1.Image(3).Point2D(0).Point3DId();
+  BOOST_CHECK_EQUAL(reconstruction1.Point3D(point3D_id2).Track().Length(), 4);
+  BOOST_CHECK_EQUAL(reconstruction1.Image(1).Point2D(1).Point3DId(),
+                    point3D_id2);
+  BOOST_CHECK_EQUAL(reconstruction1.Image(2).Point2D(3).Point3DId(),
+                    point3D_id2);
+  BOOST_CHECK(!reconstruction1.Image(5).Point2D(1).HasPoint3D());
+  const point3D_t point3D_id3 =
+      reconstruction1.Image(5).Point2D(2).Point3DId();
+  BOOST_CHECK_EQUAL(reconstruction1.Image(2).Point2D(2).Point3DId(),
+                    point3D_id3);
+  BOOST_CHECK_LT((reconstruction1.Point3D(point3D_id3).XYZ() -
+                  Eigen::Vector3d(1, 2, 3))
+                     .norm(),
+                 1e-6);
+  BOOST_CHECK_EQUAL(reconstruction1.Point3D(point3D_id3).Color(),
+                    Eigen::Vector3ub(1, 2, 3));
+  BOOST_CHECK_EQUAL(reconstruction1.Image(5).NumPoints3D(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(TestAlign) {
+  Reconstruction reconstruction;
+  SceneGraph scene_graph;
+  GenerateReconstruction(4, &reconstruction, &scene_graph);
+  reconstruction.Image(2).SetTvec(Eigen::Vector3d(-1, 0, 0));
+  reconstruction.Image(3).SetTvec(Eigen::Vector3d(0, -1, 0));
+  reconstruction.Image(4).SetTvec(Eigen::Vector3d(0, 0, -1));
+  reconstruction.DeRegisterImage(4);
+  const point3D_t point3D_id =
+      reconstruction.AddPoint3D(Eigen::Vector3d(1, 1, 1), Track());
+
+  // Unknown, unregistered and duplicate images are ignored.
+  const std::vector<std::string> image_names = {
+      "image1", "image2", "image5", "image4", "image3", "image1"};
+  const std::vector<Eigen::Vector3d> locations = {
+      Eigen::Vector3d(0, 1, 2), Eigen::Vector3d(2, 1, 2),
+      Eigen::Vector3d(0, 0, 0), Eigen::Vector3d(0, 0, 0),
+      Eigen::Vector3d(0, 3, 2), Eigen::Vector3d(0, 0, 0)};
+  BOOST_CHECK(!reconstruction.Align(image_names, locations, 4));
+  BOOST_CHECK(reconstruction.Align(image_names, locations, 3));
+
+  BOOST_CHECK_LT(
+      (reconstruction.Image(1).ProjectionCenter() - locations[0]).norm(),
+      1e-6);
+  BOOST_CHECK_LT(
+      (reconstruction.Image(2).ProjectionCenter() - locations[1]).norm(),
+      1e-6);
+  BOOST_CHECK_LT(
+      (reconstruction.Image(3).ProjectionCenter() - locations[4]).norm(),
+      1e-6);
+  BOOST_CHECK_LT((reconstruction.Point3D(point3D_id).XYZ() -
+                  Eigen::Vector3d(2, 3, 4))
+                     .norm(),
+                 1e-6);
+}
+
 BOOST_AUTO_TEST_CASE(TestFindImageWithName) {
   Reconstruction reconstruction;
   SceneGraph scene_graph;
@@ -514,3 +767,72 @@ BOOST_AUTO_TEST_CASE(TestComputeMeanReprojectionError) {
   reconstruction.Point3D(point3D_id1).SetError(2.0);
   BOOST_CHECK_EQUAL(reconstruction.ComputeMeanReprojectionError(), 2.0);
 }
+
+namespace {
+
+void CheckWriteRead(const bool binary) {
+  Reconstruction reconstruction;
+  SceneGraph scene_graph;
+  GenerateReconstruction(3, &reconstruction, &scene_graph);
+  // An image without observations and a point without a track.
+  Image image;
+  image.SetImageId(4);
+  image.SetCameraId(1);
+  image.SetName("image4");
+  reconstruction.AddImage(image);
+  reconstruction.RegisterImage(4);
+  reconstruction.AddPoint3D(Eigen::Vector3d(0.5, -1e-7, 123456789), Track());
+  for (point2D_t point2D_idx = 0; point2D_idx < 10; point2D_idx += 2) {
+    Track track;
+    track.AddElement(1, point2D_idx);
+    track.AddElement(3, point2D_idx + 1);
+    const point3D_t point3D_id =
+        reconstruction.AddPoint3D(Eigen::Vector3d::Random(), track);
+    reconstruction.Point3D(point3D_id).SetError(0.25 * point2D_idx);
+    reconstruction.Point3D(point3D_id).SetColor(Eigen::Vector3ub(1, 2, 255));
+  }
+
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("reconstruction_test_%%%%%%%%"))
+          .string();
+  CreateDirIfNotExists(path);
+  if (binary) {
+    reconstruction.WriteBinary(path);
+  } else {
+    reconstruction.WriteText(path);
+  }
+
+  Reconstruction read_reconstruction;
+  read_reconstruction.Read(path);
+  boost::filesystem::remove_all(path);
+
+  BOOST_CHECK_EQUAL(read_reconstruction.NumRegImages(), 4);
+  BOOST_CHECK_EQUAL(read_reconstruction.NumPoints3D(), 6);
+  for (const auto& image : reconstruction.Images()) {
+    const class Image& read_image = read_reconstruction.Image(image.first);
+    BOOST_CHECK_EQUAL(read_image.Name(), image.second.Name());
+    BOOST_REQUIRE_EQUAL(read_image.NumPoints2D(), image.second.NumPoints2D());
+    for (point2D_t point2D_idx = 0; point2D_idx < read_image.NumPoints2D();
+         ++point2D_idx) {
+      BOOST_CHECK_EQUAL(read_image.Point2D(point2D_idx).Point3DId(),
+                        image.second.Point2D(point2D_idx).Point3DId());
+    }
+  }
+  for (const auto& point3D : reconstruction.Points3D()) {
+    const class Point3D& read_point3D =
+        read_reconstruction.Point3D(point3D.first);
+    BOOST_CHECK_LT((read_point3D.XYZ() - point3D.second.XYZ()).norm(),
+                   binary ? 1e-12 : 1e-4 * point3D.second.XYZ().norm());
+    BOOST_CHECK_EQUAL(read_point3D.Error(), point3D.second.Error());
+    BOOST_CHECK(read_point3D.Color() == point3D.second.Color());
+    BOOST_CHECK_EQUAL(read_point3D.Track().Length(),
+                      point3D.second.Track().Length());
+  }
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestWriteReadText) { CheckWriteRead(false); }
+
+BOOST_AUTO_TEST_CASE(TestWriteReadBinary) { CheckWriteRead(true); }
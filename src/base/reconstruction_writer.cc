@@ -0,0 +1,108 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "base/reconstruction_writer.h"
+
+#include <iostream>
+
+namespace colmap {
+
+AsyncReconstructionWriter::AsyncReconstructionWriter()
+    : writing_(false), stop_(false), num_coalesced_(0) {
+  thread_ = std::thread(&AsyncReconstructionWriter::Run, this);
+}
+
+AsyncReconstructionWriter::~AsyncReconstructionWriter() {
+  Wait();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  job_condition_.notify_all();
+  thread_.join();
+}
+
+void AsyncReconstructionWriter::Write(const std::string& key,
+                                      const Reconstruction& reconstruction,
+                                      const WriteFunc& write_func) {
+  // The copy is much cheaper than the output and is taken outside of the lock,
+  // so that the background thread is not blocked meanwhile.
+  std::unique_ptr<Reconstruction> copy(new Reconstruction(reconstruction));
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (auto& job : jobs_) {
+      if (job.key == key) {
+        job.reconstruction = std::move(copy);
+        job.write_func = write_func;
+        num_coalesced_ += 1;
+        return;
+      }
+    }
+
+    Job job;
+    job.key = key;
+    job.reconstruction = std::move(copy);
+    job.write_func = write_func;
+    jobs_.push_back(std::move(job));
+  }
+
+  job_condition_.notify_one();
+}
+
+void AsyncReconstructionWriter::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_condition_.wait(lock, [this]() { return jobs_.empty() && !writing_; });
+}
+
+size_t AsyncReconstructionWriter::NumCoalesced() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return num_coalesced_;
+}
+
+void AsyncReconstructionWriter::Run() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      job_condition_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+      if (jobs_.empty()) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+      writing_ = true;
+    }
+
+    try {
+      job.write_func(*job.reconstruction);
+    } catch (const std::exception& e) {
+      std::cout << "ERROR: Could not write reconstruction: " << e.what()
+                << std::endl;
+    }
+
+    // Release the copy before the waiting threads continue.
+    job.reconstruction.reset();
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      writing_ = false;
+    }
+    done_condition_.notify_all();
+  }
+}
+
+}  // namespace colmap
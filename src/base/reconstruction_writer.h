@@ -0,0 +1,88 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_BASE_RECONSTRUCTION_WRITER_H_
+#define COLMAP_SRC_BASE_RECONSTRUCTION_WRITER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "base/reconstruction.h"
+#include "util/types.h"
+
+namespace colmap {
+
+// Writes copies of reconstructions on a background thread, so that the caller,
+// e.g. the mapper, does not block on the output. Every write has a key and a
+// pending write is replaced by a newer write with the same key, so that the
+// writer only writes the latest state if it falls behind.
+//
+//    AsyncReconstructionWriter writer;
+//    writer.Write("snapshot", reconstruction,
+//                 [](const Reconstruction& copy) { copy.Write(path); });
+//    ... // Continue to modify the reconstruction.
+//    writer.Wait();
+//
+class AsyncReconstructionWriter {
+ public:
+  typedef std::function<void(const Reconstruction&)> WriteFunc;
+
+  AsyncReconstructionWriter();
+
+  // Waits for the pending writes.
+  ~AsyncReconstructionWriter();
+
+  // Copy the reconstruction and call the write function with the copy on the
+  // background thread. A pending write with the same key is replaced, keeping
+  // its position in the order of the writes.
+  void Write(const std::string& key, const Reconstruction& reconstruction,
+             const WriteFunc& write_func);
+
+  // Wait until all writes finished.
+  void Wait();
+
+  // The number of writes that were replaced before they were written.
+  size_t NumCoalesced() const;
+
+ private:
+  NON_COPYABLE(AsyncReconstructionWriter)
+
+  struct Job {
+    std::string key;
+    std::unique_ptr<Reconstruction> reconstruction;
+    WriteFunc write_func;
+  };
+
+  void Run();
+
+  mutable std::mutex mutex_;
+  std::condition_variable job_condition_;
+  std::condition_variable done_condition_;
+  std::deque<Job> jobs_;
+  bool writing_;
+  bool stop_;
+  size_t num_coalesced_;
+  std::thread thread_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_BASE_RECONSTRUCTION_WRITER_H_
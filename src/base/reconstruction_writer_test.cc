@@ -0,0 +1,107 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "base/reconstruction_writer"
+#include "util/testing.h"
+
+#include <future>
+
+#include "base/reconstruction_writer.h"
+
+using namespace colmap;
+
+namespace {
+
+void AddCamera(const camera_t camera_id, Reconstruction* reconstruction) {
+  Camera camera;
+  camera.InitializeWithName("SIMPLE_PINHOLE", 1, 1, 1);
+  camera.SetCameraId(camera_id);
+  reconstruction->AddCamera(camera);
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestWriteCopy) {
+  Reconstruction reconstruction;
+  AddCamera(1, &reconstruction);
+
+  std::promise<void> release;
+  std::shared_future<void> released(release.get_future());
+  size_t num_written_cameras = 0;
+  AsyncReconstructionWriter writer;
+  writer.Write("model", reconstruction, [&](const Reconstruction& copy) {
+    released.wait();
+    num_written_cameras = copy.NumCameras();
+  });
+
+  // The writer works on a copy of the state at the time of the write.
+  AddCamera(2, &reconstruction);
+  release.set_value();
+  writer.Wait();
+  BOOST_CHECK_EQUAL(num_written_cameras, 1);
+  BOOST_CHECK_EQUAL(writer.NumCoalesced(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestCoalesce) {
+  Reconstruction reconstruction;
+
+  std::promise<void> started;
+  std::promise<void> release;
+  std::shared_future<void> released(release.get_future());
+  std::vector<std::string> written;
+  AsyncReconstructionWriter writer;
+  writer.Write("first", reconstruction, [&](const Reconstruction&) {
+    started.set_value();
+    released.wait();
+    written.push_back("first");
+  });
+  started.get_future().wait();
+
+  // While the first write blocks the writer, only the latest pending write of
+  // every key is kept at the position of the first pending write of the key.
+  for (int i = 0; i < 3; ++i) {
+    AddCamera(i + 1, &reconstruction);
+    writer.Write("snapshot", reconstruction,
+                 [&written](const Reconstruction& copy) {
+                   written.push_back("snapshot" +
+                                     std::to_string(copy.NumCameras()));
+                 });
+    if (i == 0) {
+      writer.Write("model", reconstruction, [&written](const Reconstruction&) {
+        written.push_back("model");
+      });
+    }
+  }
+
+  release.set_value();
+  writer.Wait();
+  BOOST_CHECK_EQUAL(writer.NumCoalesced(), 2);
+  BOOST_REQUIRE_EQUAL(written.size(), 3);
+  BOOST_CHECK_EQUAL(written[0], "first");
+  BOOST_CHECK_EQUAL(written[1], "snapshot3");
+  BOOST_CHECK_EQUAL(written[2], "model");
+}
+
+BOOST_AUTO_TEST_CASE(TestDestructorWaits) {
+  Reconstruction reconstruction;
+  bool written = false;
+  {
+    AsyncReconstructionWriter writer;
+    writer.Write("model", reconstruction,
+                 [&written](const Reconstruction&) { written = true; });
+  }
+  BOOST_CHECK(written);
+}
@@ -21,6 +21,7 @@
 #include "base/database.h"
 #include "base/graph_cut.h"
 #include "util/random.h"
+#include "util/threading.h"
 
 namespace colmap {
 
@@ -97,10 +98,19 @@ void SceneClustering::PartitionCluster(
     }
   }
 
-  // Recursively partition all the child clusters.
-  for (int i = 0; i < options_.branching; ++i) {
+  // Recursively partition all the child clusters, whose subtrees are
+  // independent of each other.
+  const auto PartitionChildCluster = [&](const int i) {
     PartitionCluster(child_edges[i], child_weights[i],
                      &cluster->child_clusters[i]);
+  };
+
+  if (GetEffectiveNumThreads(options_.num_threads) == 1) {
+    for (int i = 0; i < options_.branching; ++i) {
+      PartitionChildCluster(i);
+    }
+  } else {
+    ParallelFor(0, options_.branching, PartitionChildCluster);
   }
 
   if (options_.image_overlap > 0) {
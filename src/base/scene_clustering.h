@@ -42,6 +42,9 @@ class SceneClustering {
     // overlap` images to satisfy the overlap constraint.
     int leaf_max_num_images = 500;
 
+    // The number of threads to partition the child clusters concurrently.
+    int num_threads = -1;
+
     bool Check() const;
   };
 
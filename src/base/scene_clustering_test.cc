@@ -199,3 +199,40 @@ BOOST_AUTO_TEST_CASE(TestTwoOverlap) {
   BOOST_CHECK(image_ids1.count(2));
   BOOST_CHECK(image_ids1.count(3));
 }
+
+BOOST_AUTO_TEST_CASE(TestParallel) {
+  // A ring of images with some random shortcuts.
+  const image_t kNumImages = 400;
+  std::vector<std::pair<image_t, image_t>> image_pairs;
+  std::vector<int> num_inliers;
+  for (image_t image_id = 0; image_id < kNumImages; ++image_id) {
+    image_pairs.emplace_back(image_id, (image_id + 1) % kNumImages);
+    num_inliers.push_back(100 + image_id % 7);
+    image_pairs.emplace_back(image_id, (image_id * 37 + 11) % kNumImages);
+    num_inliers.push_back(20 + image_id % 5);
+  }
+
+  SceneClustering::Options options;
+  options.branching = 2;
+  options.image_overlap = 5;
+  options.leaf_max_num_images = 20;
+
+  options.num_threads = 1;
+  SceneClustering serial_scene_clustering(options);
+  serial_scene_clustering.Partition(image_pairs, num_inliers);
+
+  options.num_threads = 4;
+  SceneClustering parallel_scene_clustering(options);
+  parallel_scene_clustering.Partition(image_pairs, num_inliers);
+
+  const auto serial_leaf_clusters = serial_scene_clustering.GetLeafClusters();
+  const auto parallel_leaf_clusters =
+      parallel_scene_clustering.GetLeafClusters();
+  BOOST_CHECK_GT(serial_leaf_clusters.size(), 2);
+  BOOST_REQUIRE_EQUAL(serial_leaf_clusters.size(),
+                      parallel_leaf_clusters.size());
+  for (size_t i = 0; i < serial_leaf_clusters.size(); ++i) {
+    BOOST_CHECK(serial_leaf_clusters[i]->image_ids ==
+                parallel_leaf_clusters[i]->image_ids);
+  }
+}
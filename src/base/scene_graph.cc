@@ -16,34 +16,109 @@
 
 #include "base/scene_graph.h"
 
-#include <unordered_set>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <numeric>
 
 #include "util/string.h"
+#include "util/threading.h"
 
 namespace colmap {
 
-SceneGraph::SceneGraph() {}
+namespace {
 
-void SceneGraph::Finalize() {
+const uint64_t kEmptySlot = std::numeric_limits<uint64_t>::max();
+
+}  // namespace
+
+void SceneGraph::TransitiveScratch::Clear() {
+  for (const size_t slot : used_slots_) {
+    slots_[slot] = kEmptySlot;
+  }
+  used_slots_.clear();
+}
+
+bool SceneGraph::TransitiveScratch::Insert(const image_t image_id,
+                                           const point2D_t point2D_idx) {
+  if (2 * (used_slots_.size() + 1) > slots_.size()) {
+    Grow();
+  }
+
+  const uint64_t key = (static_cast<uint64_t>(image_id) << 32) | point2D_idx;
+  const size_t mask = slots_.size() - 1;
+  size_t slot = static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+  while (slots_[slot] != kEmptySlot) {
+    if (slots_[slot] == key) {
+      return false;
+    }
+    slot = (slot + 1) & mask;
+  }
+
+  slots_[slot] = key;
+  used_slots_.push_back(slot);
+  return true;
+}
+
+void SceneGraph::TransitiveScratch::Grow() {
+  std::vector<uint64_t> keys;
+  keys.reserve(used_slots_.size());
+  for (const size_t slot : used_slots_) {
+    keys.push_back(slots_[slot]);
+  }
+
+  slots_.assign(std::max<size_t>(64, 2 * slots_.size()), kEmptySlot);
+  used_slots_.clear();
+  for (const uint64_t key : keys) {
+    Insert(static_cast<image_t>(key >> 32),
+           static_cast<point2D_t>(key & 0xFFFFFFFF));
+  }
+}
+
+SceneGraph::SceneGraph() : base_(nullptr) {}
+
+SceneGraph::SceneGraph(const SceneGraph* base) : base_(base) {}
+
+void SceneGraph::Finalize(const int num_threads) {
+  CompactCorrespondences(num_threads);
+  UpdateImagePairs();
+
+  bool deleted_images = false;
+  const std::vector<size_t>& offsets = corrs_.Offsets();
   for (auto it = images_.begin(); it != images_.end();) {
     it->second.num_observations = 0;
-    for (auto& corr : it->second.corrs) {
-      corr.shrink_to_fit();
-      if (corr.size() > 0) {
+    const size_t end_row = it->second.first_row + it->second.num_points2D;
+    for (size_t row = it->second.first_row; row < end_row; ++row) {
+      if (offsets[row + 1] > offsets[row]) {
         it->second.num_observations += 1;
       }
     }
     if (it->second.num_observations == 0) {
       images_.erase(it++);
+      deleted_images = true;
     } else {
       ++it;
     }
   }
+
+  if (deleted_images) {
+    CompactCorrespondences(num_threads);
+  }
+
+  pending_matches_.shrink_to_fit();
+  std::unordered_map<image_pair_t, point2D_t>().swap(pending_image_pairs_);
 }
 
 void SceneGraph::AddImage(const image_t image_id, const size_t num_points) {
   CHECK(!ExistsImage(image_id));
-  images_[image_id].corrs.resize(num_points);
+  struct Image& image = images_[image_id];
+  image.num_points2D = static_cast<point2D_t>(num_points);
+  image.first_row = corrs_.NumRows();
+  const Correspondence* no_corrs = nullptr;
+  for (size_t i = 0; i < num_points; ++i) {
+    corrs_.AppendRow(no_corrs, no_corrs);
+  }
 }
 
 void SceneGraph::AddCorrespondences(const image_t image_id1,
@@ -66,10 +141,47 @@ void SceneGraph::AddCorrespondences(const image_t image_id1,
 
   const image_pair_t pair_id =
       Database::ImagePairToPairId(image_id1, image_id2);
-  point2D_t& num_correspondences = image_pairs_[pair_id];
+
+  // Correspondences of earlier matches of the same pair can only be found in
+  // the compacted correspondence array.
+  const auto image_pair = std::lower_bound(
+      image_pairs_.begin(), image_pairs_.end(),
+      std::make_pair(pair_id, static_cast<point2D_t>(0)));
+  const bool existing_pair =
+      pending_image_pairs_.count(pair_id) > 0 ||
+      (image_pair != image_pairs_.end() && image_pair->first == pair_id);
+  if (existing_pair) {
+    CompactCorrespondences(1);
+  }
+
+  point2D_t& num_correspondences = pending_image_pairs_[pair_id];
   num_correspondences += static_cast<point2D_t>(matches.size());
 
-  // Store all matches in correspondence graph data structure. This data-
+  const auto HasCorrespondenceToImage = [this, existing_pair](
+      const image_t image_id, const point2D_t point2D_idx,
+      const image_t other_image_id) {
+    if (!existing_pair) {
+      return false;
+    }
+    const CsrRow<Correspondence> corrs =
+        FindCorrespondences(image_id, point2D_idx);
+    return std::find_if(corrs.begin(), corrs.end(),
+                        [other_image_id](const Correspondence& corr) {
+                          return corr.image_id == other_image_id;
+                        }) != corrs.end();
+  };
+
+  // Image points that already have a correspondence in the given matches.
+  std::vector<bool> matched1(image1.num_points2D, false);
+  std::vector<bool> matched2(image2.num_points2D, false);
+
+  PendingMatches pending;
+  pending.image_id1 = image_id1;
+  pending.image_id2 = image_id2;
+  pending.matches.reserve(matches.size());
+
+  // The matches are stored as they are and only compacted into the
+  // correspondence graph data structure when it is queried. This data-
   // structure uses more memory than storing the raw match matrices, but is
   // significantly more efficient when updating the correspondences in case an
   // observation is triangulated.
@@ -77,23 +189,16 @@ void SceneGraph::AddCorrespondences(const image_t image_id1,
     const point2D_t point2D_idx1 = matches[i].point2D_idx1;
     const point2D_t point2D_idx2 = matches[i].point2D_idx2;
 
-    const bool valid_idx1 = point2D_idx1 < image1.corrs.size();
-    const bool valid_idx2 = point2D_idx2 < image2.corrs.size();
+    const bool valid_idx1 = point2D_idx1 < image1.num_points2D;
+    const bool valid_idx2 = point2D_idx2 < image2.num_points2D;
 
     if (valid_idx1 && valid_idx2) {
-      auto& corrs1 = image1.corrs[point2D_idx1];
-      auto& corrs2 = image2.corrs[point2D_idx2];
-
       const bool duplicate1 =
-          std::find_if(corrs1.begin(), corrs1.end(),
-                       [image_id2](const Correspondence& corr) {
-                         return corr.image_id == image_id2;
-                       }) != corrs1.end();
+          matched1[point2D_idx1] ||
+          HasCorrespondenceToImage(image_id1, point2D_idx1, image_id2);
       const bool duplicate2 =
-          std::find_if(corrs2.begin(), corrs2.end(),
-                       [image_id1](const Correspondence& corr) {
-                         return corr.image_id == image_id1;
-                       }) != corrs2.end();
+          matched2[point2D_idx2] ||
+          HasCorrespondenceToImage(image_id2, point2D_idx2, image_id1);
 
       if (duplicate1 || duplicate2) {
         image1.num_correspondences -= 1;
@@ -106,8 +211,9 @@ void SceneGraph::AddCorrespondences(const image_t image_id1,
                          point2D_idx1, image_id1, point2D_idx2, image_id2)
                   << std::endl;
       } else {
-        corrs1.emplace_back(image_id2, point2D_idx2);
-        corrs2.emplace_back(image_id1, point2D_idx1);
+        matched1[point2D_idx1] = true;
+        matched2[point2D_idx2] = true;
+        pending.matches.push_back(matches[i]);
       }
     } else {
       image1.num_correspondences -= 1;
@@ -129,53 +235,68 @@ void SceneGraph::AddCorrespondences(const image_t image_id1,
       }
     }
   }
+
+  if (!pending.matches.empty()) {
+    pending_matches_.push_back(std::move(pending));
+  }
 }
 
 std::vector<SceneGraph::Correspondence>
 SceneGraph::FindTransitiveCorrespondences(const image_t image_id,
                                           const point2D_t point2D_idx,
                                           const size_t transitivity) const {
-  
+  TransitiveScratch scratch;
+  std::vector<Correspondence> found_corrs;
+  FindTransitiveCorrespondences(image_id, point2D_idx, transitivity, &scratch,
+                                &found_corrs);
+  return found_corrs;
+}
+
+void SceneGraph::FindTransitiveCorrespondences(
+    const image_t image_id, const point2D_t point2D_idx,
+    const size_t transitivity, TransitiveScratch* scratch,
+    std::vector<Correspondence>* found_corrs) const {
+  found_corrs->clear();
+
   if (transitivity == 1) {
-    return FindCorrespondences(image_id, point2D_idx);
+    const CsrRow<Correspondence> corrs =
+        FindCorrespondences(image_id, point2D_idx);
+    found_corrs->assign(corrs.begin(), corrs.end());
+    return;
   }
 
-  std::vector<Correspondence> found_corrs;
   if (!HasCorrespondences(image_id, point2D_idx)) {
-    return found_corrs;
+    return;
   }
 
-  found_corrs.emplace_back(image_id, point2D_idx);
+  found_corrs->emplace_back(image_id, point2D_idx);
 
-  std::unordered_map<image_t, std::unordered_set<point2D_t>> image_corrs;
-  image_corrs[image_id].insert(point2D_idx);
+  scratch->Clear();
+  scratch->Insert(image_id, point2D_idx);
 
   size_t corr_queue_begin = 0;
-  size_t corr_queue_end = found_corrs.size();
+  size_t corr_queue_end = found_corrs->size();
 
   for (size_t t = 0; t < transitivity; ++t) {
     // Collect correspondences at transitive level t to all
     // correspondences that were collected at transitive level t - 1.
     for (size_t i = corr_queue_begin; i < corr_queue_end; ++i) {
-      const Correspondence ref_corr = found_corrs[i];
+      const Correspondence ref_corr = (*found_corrs)[i];
 
-      const Image& image = images_.at(ref_corr.image_id);
-      const std::vector<Correspondence>& ref_corrs =
-          image.corrs[ref_corr.point2D_idx];
+      const CsrRow<Correspondence> ref_corrs =
+          FindCorrespondences(ref_corr.image_id, ref_corr.point2D_idx);
 
       for (const Correspondence corr : ref_corrs) {
         // Check if correspondence already collected, otherwise collect.
-        auto& corr_image_corrs = image_corrs[corr.image_id];
-        if (corr_image_corrs.count(corr.point2D_idx) == 0) {
-          corr_image_corrs.insert(corr.point2D_idx);
-          found_corrs.emplace_back(corr.image_id, corr.point2D_idx);
+        if (scratch->Insert(corr.image_id, corr.point2D_idx)) {
+          found_corrs->emplace_back(corr.image_id, corr.point2D_idx);
         }
       }
     }
 
     // Move on to the next block of correspondences at next transitive level.
     corr_queue_begin = corr_queue_end;
-    corr_queue_end = found_corrs.size();
+    corr_queue_end = found_corrs->size();
 
     // No new correspondences collected in last transitivity level.
     if (corr_queue_begin == corr_queue_end) {
@@ -185,22 +306,21 @@ SceneGraph::FindTransitiveCorrespondences(const image_t image_id,
 
   // Remove first element, which is the given observation by swapping it
   // with the last collected correspondence.
-  if (found_corrs.size() > 1) {
-    found_corrs.front() = found_corrs.back();
+  if (found_corrs->size() > 1) {
+    found_corrs->front() = found_corrs->back();
   }
-  found_corrs.pop_back();
-
-  return found_corrs;
+  found_corrs->pop_back();
 }
 
 std::vector<std::pair<point2D_t, point2D_t>>
 SceneGraph::FindCorrespondencesBetweenImages(const image_t image_id1,
                                              const image_t image_id2) const {
   std::vector<std::pair<point2D_t, point2D_t>> found_corrs;
-  const struct Image& image1 = images_.at(image_id1);
-  for (point2D_t point2D_idx1 = 0; point2D_idx1 < image1.corrs.size();
+  const point2D_t num_points2D1 = NumPoints2DForImage(image_id1);
+  for (point2D_t point2D_idx1 = 0; point2D_idx1 < num_points2D1;
        ++point2D_idx1) {
-    for (const Correspondence& corr1 : image1.corrs[point2D_idx1]) {
+    for (const Correspondence& corr1 :
+         FindCorrespondences(image_id1, point2D_idx1)) {
       if (corr1.image_id == image_id2) {
         found_corrs.emplace_back(point2D_idx1, corr1.point2D_idx);
       }
@@ -211,27 +331,174 @@ SceneGraph::FindCorrespondencesBetweenImages(const image_t image_id1,
 
 bool SceneGraph::IsTwoViewObservation(const image_t image_id,
                                       const point2D_t point2D_idx) const {
-  const struct Image& image = images_.at(image_id);
-  const std::vector<Correspondence>& corrs = image.corrs.at(point2D_idx);
+  const CsrRow<Correspondence> corrs =
+      FindCorrespondences(image_id, point2D_idx);
   if (corrs.size() != 1) {
     return false;
   }
-  const struct Image& other_image = images_.at(corrs[0].image_id);
-  const std::vector<Correspondence>& other_corrs =
-      other_image.corrs.at(corrs[0].point2D_idx);
+  const CsrRow<Correspondence> other_corrs =
+      FindCorrespondences(corrs[0].image_id, corrs[0].point2D_idx);
   return other_corrs.size() == 1;
 }
 
-void SceneGraph::CopyCorrespondences(const image_t orig, const image_t dest, std::vector<image_pair_t> old_pairs, std::vector<image_pair_t> new_pairs)
-{
-	//add correspondences from the image and to the image
-	struct Image& image1 = images_.at(orig);
-	struct Image& image2 = images_.at(dest);
-	image2.num_correspondences = image1.num_correspondences;
-	for(point2D_t i1;i1<image1.corrs.size();i1++)
-	{
-		image2.corrs.push_back(image1.corrs[i1]);
-	}
+void SceneGraph::AddPhantomImage(const image_t image_id,
+                                 const image_t original) {
+  CHECK(!ExistsImage(image_id));
+  const struct Image& original_image = GetImage(original);
+  struct Image& image = images_[image_id];
+  image.num_correspondences = original_image.num_correspondences;
+  image.num_phantom_points2D =
+      std::max(original_image.num_phantom_points2D,
+               original_image.num_points2D);
+}
+
+void SceneGraph::CompactCorrespondences(const int num_threads) const {
+  // The pending matches of every image, as the index of the matches and
+  // whether the image is the second image of the pair.
+  std::unordered_map<image_t, std::vector<std::pair<size_t, bool>>>
+      image_matches;
+  for (size_t i = 0; i < pending_matches_.size(); ++i) {
+    image_matches[pending_matches_[i].image_id1].emplace_back(i, false);
+    image_matches[pending_matches_[i].image_id2].emplace_back(i, true);
+  }
+
+  // The images with image points in the order of their identifiers, their
+  // first rows in the compacted array and their pending matches.
+  std::vector<std::pair<image_t, Image*>> images;
+  images.reserve(images_.size());
+  for (auto& image : images_) {
+    if (image.second.num_points2D > 0) {
+      images.emplace_back(image.first, &image.second);
+    }
+  }
+  std::sort(images.begin(), images.end(),
+            [](const std::pair<image_t, Image*>& image1,
+               const std::pair<image_t, Image*>& image2) {
+              return image1.first < image2.first;
+            });
+
+  std::vector<size_t> first_rows(images.size() + 1, 0);
+  std::vector<const std::vector<std::pair<size_t, bool>>*> matches_refs(
+      images.size(), nullptr);
+  for (size_t i = 0; i < images.size(); ++i) {
+    first_rows[i + 1] = first_rows[i] + images[i].second->num_points2D;
+    const auto it = image_matches.find(images[i].first);
+    if (it != image_matches.end()) {
+      matches_refs[i] = &it->second;
+    }
+  }
+
+  std::vector<size_t> offsets(first_rows.back() + 1, 0);
+  std::vector<Correspondence> corrs;
+
+  // Count the correspondences of the image points of an image.
+  const auto CountImage = [&](const size_t i) {
+    const Image& image = *images[i].second;
+    size_t* counts = offsets.data() + first_rows[i] + 1;
+    for (point2D_t point2D_idx = 0; point2D_idx < image.num_points2D;
+         ++point2D_idx) {
+      counts[point2D_idx] = corrs_.Row(image.first_row + point2D_idx).size();
+    }
+    if (matches_refs[i] == nullptr) {
+      return;
+    }
+    for (const auto& matches_ref : *matches_refs[i]) {
+      for (const auto& match : pending_matches_[matches_ref.first].matches) {
+        counts[matches_ref.second ? match.point2D_idx2
+                                  : match.point2D_idx1] += 1;
+      }
+    }
+  };
+
+  // Copy the existing and the pending correspondences of an image.
+  const auto FillImage = [&](const size_t i) {
+    const Image& image = *images[i].second;
+    std::vector<size_t> corrs_end(
+        offsets.begin() + first_rows[i],
+        offsets.begin() + first_rows[i] + image.num_points2D);
+    for (point2D_t point2D_idx = 0; point2D_idx < image.num_points2D;
+         ++point2D_idx) {
+      for (const Correspondence& corr :
+           corrs_.Row(image.first_row + point2D_idx)) {
+        corrs[corrs_end[point2D_idx]++] = corr;
+      }
+    }
+    if (matches_refs[i] == nullptr) {
+      return;
+    }
+    for (const auto& matches_ref : *matches_refs[i]) {
+      const PendingMatches& pending = pending_matches_[matches_ref.first];
+      for (const auto& match : pending.matches) {
+        if (matches_ref.second) {
+          corrs[corrs_end[match.point2D_idx2]++] =
+              Correspondence(pending.image_id1, match.point2D_idx1);
+        } else {
+          corrs[corrs_end[match.point2D_idx1]++] =
+              Correspondence(pending.image_id2, match.point2D_idx2);
+        }
+      }
+    }
+  };
+
+  // The images are counted and filled independently in disjoint rows, so
+  // that they can be processed in parallel.
+  const int num_eff_threads = std::min(GetEffectiveNumThreads(num_threads),
+                                       static_cast<int>(images.size()));
+  std::unique_ptr<ThreadPool> thread_pool;
+  if (num_eff_threads > 1) {
+    thread_pool.reset(new ThreadPool(num_eff_threads));
+  }
+  const auto ForEachImage = [&](const std::function<void(size_t)>& func) {
+    if (!thread_pool) {
+      for (size_t i = 0; i < images.size(); ++i) {
+        func(i);
+      }
+      return;
+    }
+    for (size_t i = 0; i < images.size(); ++i) {
+      thread_pool->AddTask(func, i);
+    }
+    thread_pool->Wait();
+  };
+
+  ForEachImage(CountImage);
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+  corrs.resize(offsets.back());
+  ForEachImage(FillImage);
+
+  for (size_t i = 0; i < images.size(); ++i) {
+    images[i].second->first_row = first_rows[i];
+  }
+  corrs_ = CsrArray<Correspondence>(std::move(corrs), std::move(offsets));
+
+  pending_matches_.clear();
+  pending_matches_.shrink_to_fit();
+}
+
+void SceneGraph::UpdateImagePairs() const {
+  std::vector<std::pair<image_pair_t, point2D_t>> pending_image_pairs(
+      pending_image_pairs_.begin(), pending_image_pairs_.end());
+  std::sort(pending_image_pairs.begin(), pending_image_pairs.end());
+
+  std::vector<std::pair<image_pair_t, point2D_t>> image_pairs;
+  image_pairs.reserve(image_pairs_.size() + pending_image_pairs.size());
+  auto it = image_pairs_.begin();
+  for (const auto& pending_image_pair : pending_image_pairs) {
+    while (it != image_pairs_.end() && it->first < pending_image_pair.first) {
+      image_pairs.push_back(*it++);
+    }
+    if (it != image_pairs_.end() && it->first == pending_image_pair.first) {
+      image_pairs.emplace_back(it->first,
+                               it->second + pending_image_pair.second);
+      ++it;
+    } else {
+      image_pairs.push_back(pending_image_pair);
+    }
+  }
+  image_pairs.insert(image_pairs.end(), it, image_pairs_.end());
+
+  image_pairs_.swap(image_pairs);
+  pending_image_pairs_.clear();
 }
 
 }  // namespace colmap
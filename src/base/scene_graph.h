@@ -17,16 +17,28 @@
 #ifndef COLMAP_SRC_BASE_SCENE_GRAPH_H_
 #define COLMAP_SRC_BASE_SCENE_GRAPH_H_
 
+#include <algorithm>
+#include <stdexcept>
 #include <unordered_map>
 #include <vector>
 
 #include "base/database.h"
+#include "util/csr_array.h"
 #include "util/types.h"
 
 namespace colmap {
 
 // Scene graph represents the graph of image to image and feature to feature
 // correspondences of a dataset. It should be accessed from the DatabaseCache.
+//
+// The correspondences of all images are stored in one compressed sparse row
+// array over the image points of all images, in which every image owns a range
+// of consecutive rows. Added matches are kept as they are until they are
+// compacted into this array, which happens in Finalize or, before that, in the
+// first query of the correspondences. Likewise, the numbers of correspondences
+// between image pairs are kept in a table sorted by the pair identifiers, into
+// which added pairs are merged on the first query. The graph must therefore
+// not be queried concurrently with adding correspondences.
 class SceneGraph {
  public:
   struct Correspondence {
@@ -42,8 +54,33 @@ class SceneGraph {
     point2D_t point2D_idx;
   };
 
+  // Reusable scratch space of FindTransitiveCorrespondences, which holds the
+  // set of the already collected observations. Once it has grown to the size
+  // of the largest search, the search no longer allocates memory. A scratch
+  // must not be shared by concurrent searches.
+  class TransitiveScratch {
+   public:
+    // Clear the set, which only touches the used slots.
+    void Clear();
+
+    // Insert the observation and return whether it was not yet in the set.
+    bool Insert(const image_t image_id, const point2D_t point2D_idx);
+
+   private:
+    void Grow();
+
+    // Open addressing hash set of the observations and its used slots.
+    std::vector<uint64_t> slots_;
+    std::vector<size_t> used_slots_;
+  };
+
   SceneGraph();
 
+  // Create an overlay on top of a read-only base scene graph. Queries fall
+  // through to the base graph for images that were not added to the overlay,
+  // so that images can be added without copying or modifying the base graph.
+  explicit SceneGraph(const SceneGraph* base);
+
   // Number of added images.
   inline size_t NumImages() const;
 
@@ -54,6 +91,10 @@ class SceneGraph {
   // point that has at least one correspondence.
   inline point2D_t NumObservationsForImage(const image_t image_id) const;
 
+  // Get the number of image points with correspondence storage in an image,
+  // which is zero for phantom images.
+  inline point2D_t NumPoints2DForImage(const image_t image_id) const;
+
   // Get the number of correspondences per image.
   inline point2D_t NumCorrespondencesForImage(const image_t image_id) const;
 
@@ -61,17 +102,21 @@ class SceneGraph {
   inline point2D_t NumCorrespondencesBetweenImages(
       const image_t image_id1, const image_t image_id2) const;
 
-  // Get the number of correspondences between all images.
-  inline const std::unordered_map<image_pair_t, point2D_t>&
+  // Get the number of correspondences between all images, sorted by the
+  // identifiers of the image pairs.
+  inline const std::vector<std::pair<image_pair_t, point2D_t>>&
   NumCorrespondencesBetweenImages() const;
 
   // Finalize the database manager.
   //
+  // - Compacts the added matches into the correspondence array, in parallel
+  //   over the images with the given number of threads.
   // - Calculates the number of observations per image by counting the number
   //   of image points that have at least one correspondence.
-  // - Deletes images without observations, as they are useless for SfM.
-  // - Shrinks the correspondence vectors to their size to save memory.
-  void Finalize();
+  // - Deletes images without observations, as they are useless for SfM, and
+  //   drops their rows from the correspondence array.
+  // - Releases the memory of the added matches and image pairs.
+  void Finalize(const int num_threads = -1);
 
   // Add new image to the scene graph.
   void AddImage(const image_t image_id, const size_t num_points2D);
@@ -83,10 +128,13 @@ class SceneGraph {
   void AddCorrespondences(const image_t image_id1, const image_t image_id2,
                           const FeatureMatches& matches);
 
-  void CopyCorrespondences(const image_t orig, const image_t dest, std::vector<image_pair_t> old_pairs, std::vector<image_pair_t> new_pairs);
+  // Add a phantom image that shares the image points of an existing image,
+  // e.g. the second rigid body pose of an image. Phantom images have no
+  // correspondences of their own, so that no per-point storage is allocated.
+  void AddPhantomImage(const image_t image_id, const image_t original);
 
   // Find the correspondence of an image point to any other image.
-  inline const std::vector<Correspondence>& FindCorrespondences(
+  inline CsrRow<Correspondence> FindCorrespondences(
       const image_t image_id, const point2D_t point2D_idx) const;
 
   // Find correspondences to the given observation.
@@ -101,6 +149,13 @@ class SceneGraph {
       const image_t image_id, const point2D_t point2D_idx,
       const size_t transitivity) const;
 
+  // Same as above, but write the correspondences to the given vector and
+  // reuse the given scratch, so that repeated searches do not allocate.
+  void FindTransitiveCorrespondences(
+      const image_t image_id, const point2D_t point2D_idx,
+      const size_t transitivity, TransitiveScratch* scratch,
+      std::vector<Correspondence>* found_corrs) const;
+
   // Find all correspondences between two images.
   std::vector<std::pair<point2D_t, point2D_t>> FindCorrespondencesBetweenImages(
       const image_t image_id1, const image_t image_id2) const;
@@ -115,10 +170,6 @@ class SceneGraph {
   bool IsTwoViewObservation(const image_t image_id,
                             const point2D_t point2D_idx) const;
 
-    inline void ClearCorrs(image_t image_id);
-    inline void AddCorrs(image_t image_id, point2D_t pnt_id, std::vector<SceneGraph::Correspondence> track);
-    inline void AddNewImage(image_t image_id, size_t num_points2D, image_t orig );
-
  private:
   struct Image {
     // Number of 2D points with at least one correspondence to another image.
@@ -128,94 +179,148 @@ class SceneGraph {
     // to find a good initial pair, that is connected to many images.
     point2D_t num_correspondences = 0;
 
-    // Correspondences to other images per image point.
-    std::vector<std::vector<Correspondence>> corrs;
+    // Number of image points, which is zero for phantom images.
+    point2D_t num_points2D = 0;
+
+    // The row of the first image point in the correspondence array.
+    size_t first_row = 0;
+
+    // Number of image points of a phantom image, which has empty `corrs`.
+    point2D_t num_phantom_points2D = 0;
+  };
+
+  // Matches between a pair of images that are not yet compacted into the
+  // correspondence arrays of the two images.
+  struct PendingMatches {
+    image_t image_id1;
+    image_t image_id2;
+    FeatureMatches matches;
   };
 
+  // Find the image in the overlay or the base graph.
+  inline const Image& GetImage(const image_t image_id) const;
+
+  // Merge the pending matches into the correspondence array, which keeps the
+  // order in which the correspondences were added. The rows of the images are
+  // laid out in the order of the image identifiers and the rows of deleted
+  // images are dropped.
+  void CompactCorrespondences(const int num_threads) const;
+
+  // Merge the pending numbers of correspondences into the sorted table.
+  void UpdateImagePairs() const;
+
+  // The base graph of an overlay, or null.
+  const SceneGraph* base_;
+
   // The nodes of the scene graph are images.
-  EIGEN_STL_UMAP(image_t, Image) images_;
+  mutable EIGEN_STL_UMAP(image_t, Image) images_;
 
-  // The number of correspondences between pairs of images.
-  std::unordered_map<image_pair_t, point2D_t> image_pairs_;
+  // The correspondences of the image points of all images, which are
+  // compacted lazily by the const queries.
+  mutable CsrArray<Correspondence> corrs_;
+
+  // The added matches in the order in which they were added.
+  mutable std::vector<PendingMatches> pending_matches_;
+
+  // The number of correspondences between pairs of images, sorted by the
+  // identifiers of the pairs, and the numbers added since the last update.
+  mutable std::vector<std::pair<image_pair_t, point2D_t>> image_pairs_;
+  mutable std::unordered_map<image_pair_t, point2D_t> pending_image_pairs_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
 
-size_t SceneGraph::NumImages() const { return images_.size(); }
+size_t SceneGraph::NumImages() const {
+  return images_.size() + (base_ == nullptr ? 0 : base_->NumImages());
+}
 
 bool SceneGraph::ExistsImage(const image_t image_id) const {
-  return images_.find(image_id) != images_.end();
+  return images_.find(image_id) != images_.end() ||
+         (base_ != nullptr && base_->ExistsImage(image_id));
 }
 
 point2D_t SceneGraph::NumObservationsForImage(const image_t image_id) const {
-  return images_.at(image_id).num_observations;
+  return GetImage(image_id).num_observations;
+}
+
+point2D_t SceneGraph::NumPoints2DForImage(const image_t image_id) const {
+  return GetImage(image_id).num_points2D;
 }
 
 point2D_t SceneGraph::NumCorrespondencesForImage(const image_t image_id) const {
-  return images_.at(image_id).num_correspondences;
+  return GetImage(image_id).num_correspondences;
 }
 
 point2D_t SceneGraph::NumCorrespondencesBetweenImages(
     const image_t image_id1, const image_t image_id2) const {
+  // Image pairs are only added through matches, which overlays never receive.
+  if (base_ != nullptr) {
+    return base_->NumCorrespondencesBetweenImages(image_id1, image_id2);
+  }
+  if (!pending_image_pairs_.empty()) {
+    UpdateImagePairs();
+  }
   const image_pair_t pair_id =
       Database::ImagePairToPairId(image_id1, image_id2);
-  const auto it = image_pairs_.find(pair_id);
-  if (it == image_pairs_.end()) {
+  const auto it = std::lower_bound(
+      image_pairs_.begin(), image_pairs_.end(),
+      std::make_pair(pair_id, static_cast<point2D_t>(0)));
+  if (it == image_pairs_.end() || it->first != pair_id) {
     return 0;
   } else {
-    return static_cast<point2D_t>(it->second);
+    return it->second;
   }
 }
 
-inline const std::unordered_map<image_pair_t, point2D_t>&
+inline const std::vector<std::pair<image_pair_t, point2D_t>>&
 SceneGraph::NumCorrespondencesBetweenImages() const {
+  if (base_ != nullptr) {
+    return base_->NumCorrespondencesBetweenImages();
+  }
+  if (!pending_image_pairs_.empty()) {
+    UpdateImagePairs();
+  }
   return image_pairs_;
 }
 
-const std::vector<SceneGraph::Correspondence>& SceneGraph::FindCorrespondences(
+CsrRow<SceneGraph::Correspondence> SceneGraph::FindCorrespondences(
     const image_t image_id, const point2D_t point2D_idx) const {
-  return images_.at(image_id).corrs.at(point2D_idx);
+  if (!pending_matches_.empty()) {
+    CompactCorrespondences(1);
+  }
+  const auto it = images_.find(image_id);
+  if (it == images_.end()) {
+    if (base_ != nullptr) {
+      return base_->FindCorrespondences(image_id, point2D_idx);
+    }
+    throw std::out_of_range("image_id");
+  }
+  const Image& image = it->second;
+  if (point2D_idx < image.num_phantom_points2D) {
+    return CsrRow<Correspondence>();
+  }
+  if (point2D_idx >= image.num_points2D) {
+    throw std::out_of_range("point2D_idx");
+  }
+  return corrs_.Row(image.first_row + point2D_idx);
 }
 
 bool SceneGraph::HasCorrespondences(const image_t image_id,
                                     const point2D_t point2D_idx) const {
-  return !images_.at(image_id).corrs.at(point2D_idx).empty();
-}
-
-void SceneGraph::ClearCorrs(image_t image_id)
-{
-	images_.at(image_id).num_correspondences = 0;
-	images_.at(image_id).num_observations = 0;
-	std::vector<std::vector<Correspondence>> vec = images_.at(image_id).corrs;
-	//std::cout << vec.size() << "\n";
-	for(unsigned int i=0;i<vec.size();i++)
-	{
-		vec.at(i) = std::vector<Correspondence>();
-	}
+  return !FindCorrespondences(image_id, point2D_idx).empty();
 }
 
-void SceneGraph::AddCorrs(image_t image_id, point2D_t pnt_id, std::vector<SceneGraph::Correspondence> track)
-{
-	images_.at(image_id).corrs.at(pnt_id) = track;
-	images_.at(image_id).num_correspondences += (track.size()-1);
-	images_.at(image_id).num_observations += 1;
-}
-
-void SceneGraph::AddNewImage(image_t image_id, size_t num_points2D, image_t orig )
-{
-	Image ni;
-	ni.num_observations = 0;
-	ni.num_correspondences = 0;
-	//ni.corrs = std::vector<std::vector<Correspondence>>(num_points2D);
-	images_[image_id] = ni;
-	//images_[image_id].corrs.resize(num_points2D);
-	for(unsigned int i=0;i<num_points2D;i++)
-	{
-		std::vector<Correspondence> c = images_.at(orig).corrs.at(i);
-		images_[image_id].corrs.push_back(c);
-	}
+const SceneGraph::Image& SceneGraph::GetImage(const image_t image_id) const {
+  if (!pending_matches_.empty()) {
+    CompactCorrespondences(1);
+  }
+  const auto it = images_.find(image_id);
+  if (it == images_.end() && base_ != nullptr) {
+    return base_->GetImage(image_id);
+  }
+  return images_.at(image_id);
 }
 
 }  // namespace colmap
@@ -35,6 +35,8 @@ BOOST_AUTO_TEST_CASE(TestTwoView) {
   BOOST_CHECK_EQUAL(scene_graph.ExistsImage(1), true);
   BOOST_CHECK_EQUAL(scene_graph.ExistsImage(2), false);
   BOOST_CHECK_EQUAL(scene_graph.NumImages(), 2);
+  BOOST_CHECK_EQUAL(scene_graph.NumPoints2DForImage(0), 10);
+  BOOST_CHECK_EQUAL(scene_graph.NumPoints2DForImage(1), 10);
   BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages().size(), 0);
   BOOST_CHECK_EQUAL(scene_graph.NumObservationsForImage(0), 0);
   BOOST_CHECK_EQUAL(scene_graph.NumObservationsForImage(1), 0);
@@ -63,7 +65,9 @@ BOOST_AUTO_TEST_CASE(TestTwoView) {
   BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesForImage(1), 4);
   const image_pair_t pair_id = Database::ImagePairToPairId(0, 1);
   BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages().size(), 1);
-  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages().at(pair_id),
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages()[0].first,
+                    pair_id);
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages()[0].second,
                     4);
   BOOST_CHECK_EQUAL(scene_graph.FindCorrespondences(0, 0).size(), 1);
   BOOST_CHECK(scene_graph.HasCorrespondences(0, 0));
@@ -198,11 +202,18 @@ BOOST_AUTO_TEST_CASE(TestThreeView) {
   const image_pair_t pair_id02 = Database::ImagePairToPairId(0, 2);
   const image_pair_t pair_id12 = Database::ImagePairToPairId(1, 2);
   BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages().size(), 3);
-  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages().at(pair_id01),
+  // The image pairs are sorted by their identifiers.
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages()[0].first,
+                    pair_id01);
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages()[0].second,
                     1);
-  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages().at(pair_id02),
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages()[1].first,
+                    pair_id02);
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages()[1].second,
                     1);
-  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages().at(pair_id12),
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages()[2].first,
+                    pair_id12);
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages()[2].second,
                     2);
   BOOST_CHECK_EQUAL(scene_graph.FindCorrespondences(0, 0).size(), 2);
   BOOST_CHECK_EQUAL(scene_graph.FindCorrespondences(0, 0).at(0).image_id, 1);
@@ -290,7 +301,9 @@ BOOST_AUTO_TEST_CASE(TestOutOfBounds) {
   BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesForImage(0), 1);
   BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesForImage(1), 1);
   const image_pair_t pair_id = Database::ImagePairToPairId(0, 1);
-  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages().at(pair_id),
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages()[0].first,
+                    pair_id);
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages()[0].second,
                     1);
 }
 
@@ -313,6 +326,172 @@ BOOST_AUTO_TEST_CASE(TestDuplicate) {
   BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesForImage(0), 3);
   BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesForImage(1), 3);
   const image_pair_t pair_id = Database::ImagePairToPairId(0, 1);
-  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages().at(pair_id),
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages()[0].first,
+                    pair_id);
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages()[0].second,
                     3);
 }
+
+BOOST_AUTO_TEST_CASE(TestOverlay) {
+  SceneGraph scene_graph;
+  scene_graph.AddImage(0, 10);
+  scene_graph.AddImage(1, 10);
+  FeatureMatches matches(2);
+  matches[0].point2D_idx1 = 0;
+  matches[0].point2D_idx2 = 0;
+  matches[1].point2D_idx1 = 1;
+  matches[1].point2D_idx2 = 2;
+  scene_graph.AddCorrespondences(0, 1, matches);
+
+  SceneGraph overlay(&scene_graph);
+  BOOST_CHECK_EQUAL(overlay.NumImages(), 2);
+  BOOST_CHECK(overlay.ExistsImage(0));
+  BOOST_CHECK(overlay.ExistsImage(1));
+  BOOST_CHECK(!overlay.ExistsImage(2));
+  BOOST_CHECK_EQUAL(overlay.NumCorrespondencesForImage(0), 2);
+  BOOST_CHECK_EQUAL(overlay.NumCorrespondencesBetweenImages(0, 1), 2);
+  BOOST_CHECK_EQUAL(overlay.NumCorrespondencesBetweenImages().size(), 1);
+  BOOST_CHECK_EQUAL(overlay.FindCorrespondences(0, 1).at(0).point2D_idx, 2);
+  BOOST_CHECK(overlay.IsTwoViewObservation(1, 2));
+
+  overlay.AddImage(2, 10);
+  BOOST_CHECK_EQUAL(overlay.NumImages(), 3);
+  BOOST_CHECK(overlay.ExistsImage(2));
+  BOOST_CHECK(!overlay.HasCorrespondences(2, 0));
+  BOOST_CHECK_EQUAL(scene_graph.NumImages(), 2);
+  BOOST_CHECK(!scene_graph.ExistsImage(2));
+}
+
+BOOST_AUTO_TEST_CASE(TestPhantomImage) {
+  SceneGraph scene_graph;
+  scene_graph.AddImage(0, 10);
+  scene_graph.AddImage(1, 10);
+  FeatureMatches matches(1);
+  matches[0].point2D_idx1 = 0;
+  matches[0].point2D_idx2 = 1;
+  scene_graph.AddCorrespondences(0, 1, matches);
+
+  SceneGraph overlay(&scene_graph);
+  overlay.AddPhantomImage(2, 0);
+  BOOST_CHECK(overlay.ExistsImage(2));
+  BOOST_CHECK_EQUAL(overlay.NumCorrespondencesForImage(2), 1);
+  BOOST_CHECK_EQUAL(overlay.NumPoints2DForImage(2), 0);
+  for (point2D_t point2D_idx = 0; point2D_idx < 10; ++point2D_idx) {
+    BOOST_CHECK(!overlay.HasCorrespondences(2, point2D_idx));
+    BOOST_CHECK(!overlay.IsTwoViewObservation(2, point2D_idx));
+    BOOST_CHECK_EQUAL(
+        overlay.FindTransitiveCorrespondences(2, point2D_idx, 2).size(), 0);
+  }
+  BOOST_CHECK_THROW(overlay.FindCorrespondences(2, 10), std::out_of_range);
+  BOOST_CHECK_EQUAL(overlay.FindCorrespondencesBetweenImages(2, 1).size(), 0);
+  BOOST_CHECK_EQUAL(overlay.FindCorrespondences(0, 0).size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestCompaction) {
+  SceneGraph scene_graph;
+  scene_graph.AddImage(0, 4);
+  scene_graph.AddImage(1, 4);
+  scene_graph.AddImage(2, 4);
+  scene_graph.AddImage(3, 4);
+  FeatureMatches matches(2);
+  matches[0].point2D_idx1 = 0;
+  matches[0].point2D_idx2 = 1;
+  matches[1].point2D_idx1 = 2;
+  matches[1].point2D_idx2 = 3;
+  scene_graph.AddCorrespondences(0, 1, matches);
+  BOOST_CHECK_EQUAL(scene_graph.FindCorrespondences(0, 0).size(), 1);
+  scene_graph.AddCorrespondences(2, 0, matches);
+  // Duplicate of a match that was already compacted.
+  FeatureMatches duplicate_matches(1);
+  duplicate_matches[0].point2D_idx1 = 1;
+  duplicate_matches[0].point2D_idx2 = 0;
+  scene_graph.AddCorrespondences(1, 0, duplicate_matches);
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages(0, 1), 2);
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesForImage(0), 4);
+  scene_graph.Finalize(2);
+  BOOST_CHECK_EQUAL(scene_graph.NumImages(), 3);
+  BOOST_CHECK(!scene_graph.ExistsImage(3));
+  BOOST_CHECK_EQUAL(scene_graph.NumObservationsForImage(0), 4);
+  BOOST_CHECK_EQUAL(scene_graph.NumObservationsForImage(1), 2);
+  BOOST_CHECK_EQUAL(scene_graph.NumObservationsForImage(2), 2);
+  const CsrRow<SceneGraph::Correspondence> corrs =
+      scene_graph.FindCorrespondences(0, 1);
+  BOOST_CHECK_EQUAL(corrs.size(), 1);
+  BOOST_CHECK_EQUAL(corrs.at(0).image_id, 2);
+  BOOST_CHECK_EQUAL(corrs.at(0).point2D_idx, 0);
+  BOOST_CHECK_EQUAL(scene_graph.FindCorrespondences(0, 0).at(0).image_id, 1);
+  BOOST_CHECK_EQUAL(scene_graph.FindCorrespondences(0, 2).size(), 1);
+  BOOST_CHECK_EQUAL(scene_graph.FindCorrespondences(0, 3).size(), 1);
+  BOOST_CHECK_EQUAL(scene_graph.FindCorrespondencesBetweenImages(0, 2).size(),
+                    2);
+}
+
+BOOST_AUTO_TEST_CASE(TestFinalizeLayout) {
+  SceneGraph scene_graph;
+  scene_graph.AddImage(2, 3);
+  scene_graph.AddImage(0, 3);
+  scene_graph.AddImage(3, 3);
+  scene_graph.AddImage(1, 3);
+  FeatureMatches matches(1);
+  matches[0].point2D_idx1 = 2;
+  matches[0].point2D_idx2 = 0;
+  scene_graph.AddCorrespondences(0, 1, matches);
+  scene_graph.AddCorrespondences(2, 1, matches);
+  matches[0].point2D_idx1 = 1;
+  matches[0].point2D_idx2 = 1;
+  scene_graph.AddCorrespondences(0, 1, matches);
+  scene_graph.Finalize();
+  BOOST_CHECK_EQUAL(scene_graph.NumImages(), 3);
+  BOOST_CHECK(!scene_graph.ExistsImage(3));
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages().size(), 2);
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages(0, 1), 2);
+  BOOST_CHECK_EQUAL(scene_graph.NumCorrespondencesBetweenImages(1, 2), 1);
+  BOOST_CHECK_EQUAL(scene_graph.FindCorrespondences(1, 0).size(), 2);
+  BOOST_CHECK_EQUAL(scene_graph.FindCorrespondences(1, 1).size(), 1);
+  // The rows of all images are stored back to back in the order of the image
+  // identifiers.
+  const SceneGraph::Correspondence* row_end =
+      scene_graph.FindCorrespondences(0, 0).begin();
+  for (image_t image_id = 0; image_id < 3; ++image_id) {
+    for (point2D_t point2D_idx = 0; point2D_idx < 3; ++point2D_idx) {
+      const CsrRow<SceneGraph::Correspondence> corrs =
+          scene_graph.FindCorrespondences(image_id, point2D_idx);
+      BOOST_CHECK_EQUAL(corrs.begin(), row_end);
+      row_end = corrs.end();
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestTransitiveScratch) {
+  const image_t kNumImages = 100;
+  SceneGraph scene_graph;
+  for (image_t image_id = 0; image_id < kNumImages; ++image_id) {
+    scene_graph.AddImage(image_id, 1);
+  }
+  FeatureMatches matches(1);
+  matches[0].point2D_idx1 = 0;
+  matches[0].point2D_idx2 = 0;
+  for (image_t image_id = 0; image_id + 1 < kNumImages; ++image_id) {
+    scene_graph.AddCorrespondences(image_id, image_id + 1, matches);
+  }
+  scene_graph.Finalize();
+
+  SceneGraph::TransitiveScratch scratch;
+  std::vector<SceneGraph::Correspondence> corrs;
+  scene_graph.FindTransitiveCorrespondences(0, 0, kNumImages, &scratch, &corrs);
+  BOOST_CHECK_EQUAL(corrs.size(), kNumImages - 1);
+  std::vector<bool> found(kNumImages, false);
+  for (const auto& corr : corrs) {
+    BOOST_CHECK_EQUAL(corr.point2D_idx, 0);
+    found.at(corr.image_id) = true;
+  }
+  BOOST_CHECK(!found[0]);
+  BOOST_CHECK(std::count(found.begin(), found.end(), true) == kNumImages - 1);
+
+  scene_graph.FindTransitiveCorrespondences(50, 0, 3, &scratch, &corrs);
+  BOOST_CHECK_EQUAL(corrs.size(), 6);
+  scene_graph.FindTransitiveCorrespondences(50, 0, 1, &scratch, &corrs);
+  BOOST_CHECK_EQUAL(corrs.size(), 2);
+  BOOST_CHECK_EQUAL(
+      scene_graph.FindTransitiveCorrespondences(50, 0, 3).size(), 6);
+}
@@ -58,6 +58,13 @@ void SimilarityTransform3::TransformPoint(Eigen::Vector3d* xyz) const {
   *xyz = transform_ * *xyz;
 }
 
+void SimilarityTransform3::TransformPoints(
+    Eigen::Ref<Eigen::Matrix<double, Eigen::Dynamic, 3>> xyzs) const {
+  const Eigen::Matrix3d linear = transform_.linear();
+  xyzs = (xyzs * linear.transpose()).rowwise() +
+         transform_.translation().transpose();
+}
+
 void SimilarityTransform3::TransformPose(Eigen::Vector4d* qvec,
                                          Eigen::Vector3d* tvec) const {
   // Projection matrix P1 projects 3D object points to image plane and thus to
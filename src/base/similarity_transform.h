@@ -48,6 +48,10 @@ class SimilarityTransform3 {
   SimilarityTransform3 Inverse() const;
 
   void TransformPoint(Eigen::Vector3d* xyz) const;
+  // Transform the points stored by coordinate in the rows of the matrix, for
+  // which the transformation vectorizes over the points.
+  void TransformPoints(
+      Eigen::Ref<Eigen::Matrix<double, Eigen::Dynamic, 3>> xyzs) const;
   void TransformPose(Eigen::Vector4d* qvec, Eigen::Vector3d* tvec) const;
 
   Eigen::Matrix4d Matrix() const;
@@ -65,3 +65,25 @@ BOOST_AUTO_TEST_CASE(TestEstimation) {
   TestEstimationWithNumCoords(3);
   TestEstimationWithNumCoords(100);
 }
+
+BOOST_AUTO_TEST_CASE(TestTransformPoints) {
+  const SimilarityTransform3 tform(
+      2, NormalizeQuaternion(Eigen::Vector4d(0.1, 0.3, 0.2, 0.4)),
+      Eigen::Vector3d(100, 10, 0.5));
+
+  Eigen::Matrix<double, Eigen::Dynamic, 3> xyzs(10, 3);
+  for (int i = 0; i < xyzs.rows(); ++i) {
+    xyzs.row(i) << i, i + 2, i * i;
+  }
+
+  Eigen::Matrix<double, Eigen::Dynamic, 3> tform_xyzs = xyzs;
+  tform.TransformPoints(tform_xyzs.middleRows(2, 5));
+
+  for (int i = 0; i < xyzs.rows(); ++i) {
+    Eigen::Vector3d xyz = xyzs.row(i).transpose();
+    if (i >= 2 && i < 7) {
+      tform.TransformPoint(&xyz);
+    }
+    BOOST_CHECK_LT((tform_xyzs.row(i).transpose() - xyz).norm(), 1e-10);
+  }
+}
@@ -0,0 +1,427 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "base/take_bundle.h"
+
+#include <algorithm>
+#include <fstream>
+#include <unordered_set>
+
+#include "util/endian.h"
+#include "util/mapped_file.h"
+#include "util/misc.h"
+
+namespace colmap {
+namespace {
+
+const char kTakeBundleMagic[8] = {'T', 'B', 'S', 'F', 'M', 'T', 'K', '\0'};
+
+const char kTakeCameraLogMagic[8] = {'T', 'B', 'S', 'F', 'M', 'C', 'L', '\0'};
+
+void WriteVector4d(std::ostream* stream, const Eigen::Vector4d& vec) {
+  for (int i = 0; i < 4; ++i) {
+    WriteBinaryLittleEndian<double>(stream, vec(i));
+  }
+}
+
+void WriteVector3d(std::ostream* stream, const Eigen::Vector3d& vec) {
+  for (int i = 0; i < 3; ++i) {
+    WriteBinaryLittleEndian<double>(stream, vec(i));
+  }
+}
+
+Eigen::Vector4d ReadVector4d(MappedFileReader* reader) {
+  Eigen::Vector4d vec;
+  for (int i = 0; i < 4; ++i) {
+    vec(i) = reader->Read<double>();
+  }
+  return vec;
+}
+
+Eigen::Vector3d ReadVector3d(MappedFileReader* reader) {
+  Eigen::Vector3d vec;
+  for (int i = 0; i < 3; ++i) {
+    vec(i) = reader->Read<double>();
+  }
+  return vec;
+}
+
+void WriteTakeCamera(std::ostream* stream, const TakeCamera& camera) {
+  WriteBinaryLittleEndian<image_t>(stream, camera.image_id);
+  WriteBinaryLittleEndian<int32_t>(stream, camera.take);
+  WriteBinaryLittleEndian<int32_t>(stream, camera.anchor);
+  WriteVector4d(stream, camera.qvec);
+  WriteVector3d(stream, camera.tvec);
+  WriteBinaryLittleEndian<double>(stream, camera.width);
+  WriteBinaryLittleEndian<double>(stream, camera.height);
+  WriteBinaryLittleEndian<double>(stream, camera.focal_length);
+  WriteBinaryLittleEndian<double>(stream, camera.principal_point_x);
+  WriteBinaryLittleEndian<double>(stream, camera.principal_point_y);
+  WriteBinaryLittleEndian<int32_t>(stream, camera.num_inliers);
+  WriteBinaryLittleEndian<image_t>(stream, camera.pose_image_id);
+}
+
+void ReadTakeCamera(MappedFileReader* reader, TakeCamera* camera) {
+  camera->image_id = reader->Read<image_t>();
+  camera->take = reader->Read<int32_t>();
+  camera->anchor = reader->Read<int32_t>();
+  camera->qvec = ReadVector4d(reader);
+  camera->tvec = ReadVector3d(reader);
+  camera->width = reader->Read<double>();
+  camera->height = reader->Read<double>();
+  camera->focal_length = reader->Read<double>();
+  camera->principal_point_x = reader->Read<double>();
+  camera->principal_point_y = reader->Read<double>();
+  camera->num_inliers = reader->Read<int32_t>();
+  camera->pose_image_id = reader->Read<image_t>();
+}
+
+void ExtractTakeImage(const Reconstruction& reconstruction,
+                      const Image& image,
+                      const std::unordered_map<std::string, int>& take_map,
+                      TakeImage* take_image) {
+  take_image->image_id = image.ImageId();
+  take_image->camera_id = image.CameraId();
+  const auto take = take_map.find(image.Name());
+  take_image->take = take == take_map.end() ? 0 : take->second;
+  take_image->name = image.Name();
+  take_image->qvec = image.Qvec();
+  take_image->tvec = image.Tvec();
+  take_image->points2D.reserve(image.NumPoints2D());
+  take_image->point3D_ids.reserve(image.NumPoints2D());
+  Eigen::Vector3d center_sum = Eigen::Vector3d::Zero();
+  double num_observed = 0;
+  for (const Point2D& point2D : image.Points2D()) {
+    take_image->points2D.push_back(point2D.XY());
+    take_image->point3D_ids.push_back(point2D.Point3DId());
+    if (point2D.HasPoint3D()) {
+      center_sum += reconstruction.Point3D(point2D.Point3DId()).XYZ();
+      num_observed += 1;
+    }
+  }
+  take_image->center = center_sum / num_observed;
+}
+
+void ExtractTakePoint3D(const point3D_t point3D_id, const Point3D& point3D,
+                        TakePoint3D* take_point3D) {
+  take_point3D->point3D_id = point3D_id;
+  take_point3D->xyz = point3D.XYZ();
+  take_point3D->color = point3D.Color();
+  take_point3D->error = point3D.Error();
+  take_point3D->track = point3D.Track().Elements();
+}
+
+}  // namespace
+
+std::unordered_map<std::string, int> ReadTakeMap(const std::string& path) {
+  std::unordered_map<std::string, int> take_map;
+  std::ifstream file(path);
+  std::string name;
+  int take;
+  while (file >> name >> take) {
+    take_map.emplace(name, take);
+  }
+  return take_map;
+}
+
+void ExtractTakeBundle(const Reconstruction& reconstruction,
+                       const std::unordered_map<std::string, int>& take_map,
+                       TakeBundle* bundle) {
+  bundle->images.clear();
+  bundle->images.reserve(reconstruction.NumRegImages());
+  for (const auto& image : reconstruction.Images()) {
+    if (!image.second.IsRegistered()) {
+      continue;
+    }
+    bundle->images.emplace_back();
+    ExtractTakeImage(reconstruction, image.second, take_map,
+                     &bundle->images.back());
+  }
+
+  bundle->points3D.clear();
+  bundle->points3D.reserve(reconstruction.NumPoints3D());
+  for (const auto& point3D : reconstruction.Points3D()) {
+    bundle->points3D.emplace_back();
+    ExtractTakePoint3D(point3D.first, point3D.second,
+                       &bundle->points3D.back());
+  }
+}
+
+void ExtendTakeBundle(const Reconstruction& reconstruction,
+                      const std::unordered_map<std::string, int>& take_map,
+                      const int take, TakeBundle* bundle) {
+  point3D_t max_point3D_id = 0;
+  for (const TakePoint3D& point3D : bundle->points3D) {
+    max_point3D_id = std::max(max_point3D_id, point3D.point3D_id);
+  }
+
+  // The new images, including the phantom images with their names.
+  std::unordered_set<image_t> image_ids;
+  const size_t num_prev_images = bundle->images.size();
+  for (const auto& image : reconstruction.Images()) {
+    const auto image_take = take_map.find(image.second.Name());
+    if (!image.second.IsRegistered() || image_take == take_map.end() ||
+        image_take->second != take) {
+      continue;
+    }
+    image_ids.insert(image.first);
+    bundle->images.emplace_back();
+    ExtractTakeImage(reconstruction, image.second, take_map,
+                     &bundle->images.back());
+  }
+
+  // The observed points get new identifiers and only keep the observations in
+  // the new images, whose 2D points are the only ones that refer to them.
+  std::unordered_map<point3D_t, point3D_t> point3D_id_map;
+  for (size_t i = num_prev_images; i < bundle->images.size(); ++i) {
+    for (point3D_t& point3D_id : bundle->images[i].point3D_ids) {
+      if (point3D_id == kInvalidPoint3DId) {
+        continue;
+      }
+      const auto new_point3D_id = point3D_id_map.find(point3D_id);
+      if (new_point3D_id != point3D_id_map.end()) {
+        point3D_id = new_point3D_id->second;
+        continue;
+      }
+
+      bundle->points3D.emplace_back();
+      TakePoint3D& take_point3D = bundle->points3D.back();
+      ExtractTakePoint3D(point3D_id, reconstruction.Point3D(point3D_id),
+                         &take_point3D);
+      take_point3D.point3D_id = max_point3D_id + point3D_id_map.size() + 1;
+      take_point3D.track.erase(
+          std::remove_if(take_point3D.track.begin(), take_point3D.track.end(),
+                         [&](const TrackElement& track_el) {
+                           return image_ids.count(track_el.image_id) == 0;
+                         }),
+          take_point3D.track.end());
+      point3D_id_map.emplace(point3D_id, take_point3D.point3D_id);
+      point3D_id = take_point3D.point3D_id;
+    }
+  }
+}
+
+void WriteTakeBundle(const std::string& path, const TakeBundle& bundle) {
+  std::ofstream file(path, std::ios::trunc | std::ios::binary);
+  CHECK(file.is_open()) << path;
+
+  file.write(kTakeBundleMagic, sizeof(kTakeBundleMagic));
+  WriteBinaryLittleEndian<uint32_t>(&file, kTakeBundleVersion);
+  WriteBinaryLittleEndian<int32_t>(&file, bundle.anchor);
+
+  WriteBinaryLittleEndian<uint64_t>(&file, bundle.cameras.size());
+  for (const auto& camera : bundle.cameras) {
+    WriteTakeCamera(&file, camera);
+  }
+
+  WriteBinaryLittleEndian<uint64_t>(&file, bundle.images.size());
+  for (const auto& image : bundle.images) {
+    CHECK_EQ(image.points2D.size(), image.point3D_ids.size());
+    WriteBinaryLittleEndian<image_t>(&file, image.image_id);
+    WriteBinaryLittleEndian<camera_t>(&file, image.camera_id);
+    WriteBinaryLittleEndian<int32_t>(&file, image.take);
+    const std::string name = image.name + '\0';
+    file.write(name.c_str(), name.size());
+    WriteVector4d(&file, image.qvec);
+    WriteVector3d(&file, image.tvec);
+    // The 2D points and their 3D point identifiers are stored as two
+    // contiguous arrays, so that the reader can copy them in bulk.
+    WriteBinaryLittleEndian<uint64_t>(&file, image.points2D.size());
+    for (const auto& point2D : image.points2D) {
+      WriteBinaryLittleEndian<double>(&file, point2D(0));
+      WriteBinaryLittleEndian<double>(&file, point2D(1));
+    }
+    WriteBinaryLittleEndian<point3D_t>(&file, image.point3D_ids);
+    WriteVector3d(&file, image.center);
+  }
+
+  WriteBinaryLittleEndian<uint64_t>(&file, bundle.points3D.size());
+  for (const auto& point3D : bundle.points3D) {
+    WriteBinaryLittleEndian<point3D_t>(&file, point3D.point3D_id);
+    WriteVector3d(&file, point3D.xyz);
+    WriteBinaryLittleEndian<uint8_t>(&file, point3D.color(0));
+    WriteBinaryLittleEndian<uint8_t>(&file, point3D.color(1));
+    WriteBinaryLittleEndian<uint8_t>(&file, point3D.color(2));
+    WriteBinaryLittleEndian<double>(&file, point3D.error);
+    WriteBinaryLittleEndian<uint64_t>(&file, point3D.track.size());
+    for (const auto& track_el : point3D.track) {
+      WriteBinaryLittleEndian<image_t>(&file, track_el.image_id);
+      WriteBinaryLittleEndian<point2D_t>(&file, track_el.point2D_idx);
+    }
+  }
+}
+
+bool ReadTakeBundle(const std::string& path, TakeBundle* bundle) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    return false;
+  }
+
+  MappedFileReader reader(file);
+
+  std::vector<char> magic;
+  reader.Read(&magic, sizeof(kTakeBundleMagic));
+  if (!reader.Good() ||
+      !std::equal(magic.begin(), magic.end(), kTakeBundleMagic)) {
+    std::cout << "WARNING: " << path << " is not a take bundle." << std::endl;
+    return false;
+  }
+
+  const uint32_t version = reader.Read<uint32_t>();
+  if (version != kTakeBundleVersion) {
+    std::cout << StringPrintf("WARNING: Take bundle %s has version %d, "
+                              "expected %d.",
+                              path.c_str(), version, kTakeBundleVersion)
+              << std::endl;
+    return false;
+  }
+
+  bundle->anchor = reader.Read<int32_t>();
+
+  bundle->cameras.clear();
+  bundle->cameras.resize(reader.ReadCount(sizeof(int32_t)));
+  for (auto& camera : bundle->cameras) {
+    ReadTakeCamera(&reader, &camera);
+    if (!reader.Good()) {
+      break;
+    }
+  }
+
+  bundle->images.clear();
+  bundle->images.resize(reader.ReadCount(sizeof(int32_t)));
+  std::vector<double> coords;
+  for (auto& image : bundle->images) {
+    image.image_id = reader.Read<image_t>();
+    image.camera_id = reader.Read<camera_t>();
+    image.take = reader.Read<int32_t>();
+    image.name = reader.ReadString();
+    image.qvec = ReadVector4d(&reader);
+    image.tvec = ReadVector3d(&reader);
+    const size_t num_points2D = reader.ReadCount(2 * sizeof(double));
+    reader.Read(&coords, 2 * num_points2D);
+    reader.Read(&image.point3D_ids, num_points2D);
+    image.center = ReadVector3d(&reader);
+    if (!reader.Good()) {
+      break;
+    }
+    image.points2D.resize(num_points2D);
+    for (size_t i = 0; i < num_points2D; ++i) {
+      image.points2D[i] = Eigen::Vector2d(coords[2 * i], coords[2 * i + 1]);
+    }
+  }
+
+  bundle->points3D.clear();
+  bundle->points3D.resize(reader.ReadCount(sizeof(point3D_t)));
+  for (auto& point3D : bundle->points3D) {
+    point3D.point3D_id = reader.Read<point3D_t>();
+    point3D.xyz = ReadVector3d(&reader);
+    point3D.color(0) = reader.Read<uint8_t>();
+    point3D.color(1) = reader.Read<uint8_t>();
+    point3D.color(2) = reader.Read<uint8_t>();
+    point3D.error = reader.Read<double>();
+    point3D.track.resize(
+        reader.ReadCount(sizeof(image_t) + sizeof(point2D_t)));
+    for (auto& track_el : point3D.track) {
+      track_el.image_id = reader.Read<image_t>();
+      track_el.point2D_idx = reader.Read<point2D_t>();
+    }
+  }
+
+  if (!reader.Good()) {
+    std::cout << "WARNING: Take bundle " << path << " is truncated."
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+TakeCameraLogWriter::TakeCameraLogWriter(const std::string& path,
+                                         const bool append)
+    : file_(path, (append ? std::ios::app : std::ios::trunc) |
+                      std::ios::binary) {
+  if (!file_.is_open()) {
+    std::cout << "WARNING: Could not open camera log " << path << "."
+              << std::endl;
+    return;
+  }
+  if (append && std::ifstream(path, std::ios::ate).tellg() > 0) {
+    return;
+  }
+  file_.write(kTakeCameraLogMagic, sizeof(kTakeCameraLogMagic));
+  WriteBinaryLittleEndian<uint32_t>(&file_, kTakeCameraLogVersion);
+}
+
+TakeCameraLogWriter::~TakeCameraLogWriter() { Flush(); }
+
+void TakeCameraLogWriter::Write(const TakeCamera& camera) {
+  if (file_.is_open()) {
+    WriteTakeCamera(&buffer_, camera);
+  }
+}
+
+void TakeCameraLogWriter::Flush() {
+  if (!file_.is_open()) {
+    return;
+  }
+  const std::string data = buffer_.str();
+  file_.write(data.data(), data.size());
+  file_.flush();
+  buffer_.str("");
+}
+
+bool ReadTakeCameraLog(const std::string& path,
+                       std::vector<TakeCamera>* cameras) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    return false;
+  }
+
+  MappedFileReader reader(file);
+
+  std::vector<char> magic;
+  reader.Read(&magic, sizeof(kTakeCameraLogMagic));
+  if (!reader.Good() ||
+      !std::equal(magic.begin(), magic.end(), kTakeCameraLogMagic)) {
+    std::cout << "WARNING: " << path << " is not a camera log." << std::endl;
+    return false;
+  }
+
+  const uint32_t version = reader.Read<uint32_t>();
+  if (version != kTakeCameraLogVersion) {
+    std::cout << StringPrintf("WARNING: Camera log %s has version %d, "
+                              "expected %d.",
+                              path.c_str(), version, kTakeCameraLogVersion)
+              << std::endl;
+    return false;
+  }
+
+  cameras->clear();
+  while (reader.Good() && reader.Remaining() > 0) {
+    cameras->emplace_back();
+    ReadTakeCamera(&reader, &cameras->back());
+  }
+
+  if (!reader.Good()) {
+    std::cout << "WARNING: Camera log " << path << " is truncated."
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace colmap
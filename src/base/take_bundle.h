@@ -0,0 +1,172 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_BASE_TAKE_BUNDLE_H_
+#define COLMAP_SRC_BASE_TAKE_BUNDLE_H_
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "base/reconstruction.h"
+#include "base/track.h"
+#include "util/alignment.h"
+#include "util/types.h"
+
+namespace colmap {
+
+// Version of the binary take bundle layout. Bundles with a different version
+// are rejected by `ReadTakeBundle`, so that the callers fall back to the text
+// files written next to them.
+const uint32_t kTakeBundleVersion = 2;
+
+// Default file name of the bundle inside the per-take export folder.
+const std::string kTakeBundleFileName = "take.bin";
+
+const uint32_t kTakeCameraLogVersion = 1;
+
+const std::string kTakeCameraLogFileName = "cams.bin";
+
+// Folder of the model of only the anchor take inside the per-take folder, which
+// new takes are registered against without reconstructing the take again.
+const std::string kTakeAnchorModelDirName = "anchor";
+
+// One entry of the camera log of a take, i.e. one (tentative) pose of an image
+// registered in the reconstruction anchored in `anchor`. Images of the second
+// body have one entry per pose found by the sequential registration.
+struct TakeCamera {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  image_t image_id = kInvalidImageId;
+  // The take of the image and the anchor take of the reconstruction.
+  int take = 0;
+  int anchor = 0;
+  Eigen::Vector4d qvec = Eigen::Vector4d(1, 0, 0, 0);
+  Eigen::Vector3d tvec = Eigen::Vector3d::Zero();
+  double width = 0;
+  double height = 0;
+  double focal_length = 0;
+  double principal_point_x = 0;
+  double principal_point_y = 0;
+  // Number of PnP inliers of this pose or -1 for images of the anchor take.
+  int num_inliers = -1;
+  // Identifier of the (phantom) image, which holds this pose.
+  image_t pose_image_id = kInvalidImageId;
+};
+
+// Registered image of a take together with all its 2D points.
+struct TakeImage {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  image_t image_id = kInvalidImageId;
+  camera_t camera_id = kInvalidCameraId;
+  int take = 0;
+  std::string name;
+  Eigen::Vector4d qvec = Eigen::Vector4d(1, 0, 0, 0);
+  Eigen::Vector3d tvec = Eigen::Vector3d::Zero();
+  std::vector<Eigen::Vector2d> points2D;
+  // Per 2D point, the observed 3D point or `kInvalidPoint3DId`.
+  std::vector<point3D_t> point3D_ids;
+  // Mean of the observed 3D points, NaN if the image observes none.
+  Eigen::Vector3d center = Eigen::Vector3d::Zero();
+};
+
+struct TakePoint3D {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  point3D_t point3D_id = kInvalidPoint3DId;
+  Eigen::Vector3d xyz = Eigen::Vector3d::Zero();
+  Eigen::Vector3ub color = Eigen::Vector3ub::Zero();
+  double error = -1;
+  std::vector<TrackElement> track;
+};
+
+}  // namespace colmap
+
+EIGEN_DEFINE_STL_VECTOR_SPECIALIZATION_CUSTOM(colmap::TakeCamera)
+EIGEN_DEFINE_STL_VECTOR_SPECIALIZATION_CUSTOM(colmap::TakeImage)
+EIGEN_DEFINE_STL_VECTOR_SPECIALIZATION_CUSTOM(colmap::TakePoint3D)
+
+namespace colmap {
+
+// All data of one take reconstruction that is needed by the two-body
+// postprocessor: the camera log, take membership, per-image observations,
+// the 3D points and their tracks.
+struct TakeBundle {
+  int anchor = 0;
+  std::vector<TakeCamera> cameras;
+  std::vector<TakeImage> images;
+  std::vector<TakePoint3D> points3D;
+};
+
+// Read the take of every image name from a text file with one `NAME TAKE` pair
+// per line, such as takes.txt. Returns an empty map if the file cannot be read.
+std::unordered_map<std::string, int> ReadTakeMap(const std::string& path);
+
+// Fill the images and points of the bundle from the registered images of the
+// reconstruction. The take of an image is looked up by name in `take_map`.
+void ExtractTakeBundle(const Reconstruction& reconstruction,
+                       const std::unordered_map<std::string, int>& take_map,
+                       TakeBundle* bundle);
+
+// Append the registered images of `take` in the reconstruction, which extends
+// the reconstruction of the bundle, e.g. a new take registered against the
+// model of the anchor take. The 3D points observed by the new images are
+// appended with identifiers after those of the bundle and only keep their
+// observations in the new images.
+void ExtendTakeBundle(const Reconstruction& reconstruction,
+                      const std::unordered_map<std::string, int>& take_map,
+                      const int take, TakeBundle* bundle);
+
+// Write the bundle in the versioned little-endian binary layout.
+void WriteTakeBundle(const std::string& path, const TakeBundle& bundle);
+
+// Read a bundle through a memory mapping of the file. Returns false if the
+// file does not exist, has a different version, or is truncated.
+bool ReadTakeBundle(const std::string& path, TakeBundle* bundle);
+
+// Binary log of the cameras of a take, which are appended while the other
+// takes are registered. The records are buffered in memory and only written to
+// the file by `Flush`, e.g. after every round of registrations, and when the
+// writer is destroyed. If the file cannot be opened, the records are dropped
+// with a warning, as the log is only a fallback for the take bundle. With
+// `append`, the records are appended to an existing log.
+class TakeCameraLogWriter {
+ public:
+  explicit TakeCameraLogWriter(const std::string& path,
+                               const bool append = false);
+  ~TakeCameraLogWriter();
+
+  void Write(const TakeCamera& camera);
+  void Flush();
+
+ private:
+  std::ofstream file_;
+  std::ostringstream buffer_;
+};
+
+// Read all cameras of a log. Returns false if the file is not a camera log or
+// its last record is truncated.
+bool ReadTakeCameraLog(const std::string& path,
+                       std::vector<TakeCamera>* cameras);
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_BASE_TAKE_BUNDLE_H_
@@ -0,0 +1,305 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "base/take_bundle"
+#include "util/testing.h"
+
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+#include "base/take_bundle.h"
+
+using namespace colmap;
+
+namespace {
+
+std::string TemporaryPath() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("take_bundle_test_%%%%%%%%.bin"))
+      .string();
+}
+
+TakeBundle CreateBundle() {
+  TakeBundle bundle;
+  bundle.anchor = 2;
+
+  TakeCamera camera;
+  camera.image_id = 1;
+  camera.take = 1;
+  camera.anchor = 2;
+  camera.qvec = Eigen::Vector4d(0, 1, 0, 0);
+  camera.tvec = Eigen::Vector3d(1, 2, 3);
+  camera.width = 640;
+  camera.height = 480;
+  camera.focal_length = 500;
+  camera.principal_point_x = 320;
+  camera.principal_point_y = 240;
+  camera.num_inliers = 57;
+  camera.pose_image_id = 5;
+  bundle.cameras.push_back(camera);
+  camera.pose_image_id = 1;
+  bundle.cameras.push_back(camera);
+
+  TakeImage image;
+  image.image_id = 1;
+  image.camera_id = 3;
+  image.take = 1;
+  image.name = "1/image1.png";
+  image.points2D.emplace_back(1.5, 2.5);
+  image.points2D.emplace_back(3.5, 4.5);
+  image.point3D_ids.push_back(7);
+  image.point3D_ids.push_back(kInvalidPoint3DId);
+  image.center = Eigen::Vector3d(0.1, 0.2, 0.3);
+  bundle.images.push_back(image);
+
+  TakePoint3D point3D;
+  point3D.point3D_id = 7;
+  point3D.xyz = Eigen::Vector3d(0.1, 0.2, 0.3);
+  point3D.color = Eigen::Vector3ub(10, 20, 30);
+  point3D.error = 0.5;
+  point3D.track.emplace_back(1, 0);
+  point3D.track.emplace_back(2, 4);
+  bundle.points3D.push_back(point3D);
+
+  return bundle;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestReadWrite) {
+  const std::string path = TemporaryPath();
+  const TakeBundle bundle = CreateBundle();
+  WriteTakeBundle(path, bundle);
+
+  TakeBundle read_bundle;
+  BOOST_CHECK(ReadTakeBundle(path, &read_bundle));
+  BOOST_CHECK_EQUAL(read_bundle.anchor, 2);
+
+  BOOST_CHECK_EQUAL(read_bundle.cameras.size(), 2);
+  BOOST_CHECK_EQUAL(read_bundle.cameras[0].image_id, 1);
+  BOOST_CHECK_EQUAL(read_bundle.cameras[0].take, 1);
+  BOOST_CHECK_EQUAL(read_bundle.cameras[0].anchor, 2);
+  BOOST_CHECK_EQUAL(read_bundle.cameras[0].qvec, bundle.cameras[0].qvec);
+  BOOST_CHECK_EQUAL(read_bundle.cameras[0].tvec, bundle.cameras[0].tvec);
+  BOOST_CHECK_EQUAL(read_bundle.cameras[0].width, 640);
+  BOOST_CHECK_EQUAL(read_bundle.cameras[0].height, 480);
+  BOOST_CHECK_EQUAL(read_bundle.cameras[0].focal_length, 500);
+  BOOST_CHECK_EQUAL(read_bundle.cameras[0].principal_point_x, 320);
+  BOOST_CHECK_EQUAL(read_bundle.cameras[0].principal_point_y, 240);
+  BOOST_CHECK_EQUAL(read_bundle.cameras[0].num_inliers, 57);
+  BOOST_CHECK_EQUAL(read_bundle.cameras[0].pose_image_id, 5);
+  BOOST_CHECK_EQUAL(read_bundle.cameras[1].pose_image_id, 1);
+
+  BOOST_CHECK_EQUAL(read_bundle.images.size(), 1);
+  BOOST_CHECK_EQUAL(read_bundle.images[0].image_id, 1);
+  BOOST_CHECK_EQUAL(read_bundle.images[0].camera_id, 3);
+  BOOST_CHECK_EQUAL(read_bundle.images[0].take, 1);
+  BOOST_CHECK_EQUAL(read_bundle.images[0].name, "1/image1.png");
+  BOOST_CHECK_EQUAL(read_bundle.images[0].points2D.size(), 2);
+  BOOST_CHECK_EQUAL(read_bundle.images[0].points2D[0],
+                    Eigen::Vector2d(1.5, 2.5));
+  BOOST_CHECK_EQUAL(read_bundle.images[0].points2D[1],
+                    Eigen::Vector2d(3.5, 4.5));
+  BOOST_CHECK_EQUAL(read_bundle.images[0].point3D_ids[0], 7);
+  BOOST_CHECK_EQUAL(read_bundle.images[0].point3D_ids[1], kInvalidPoint3DId);
+  BOOST_CHECK_EQUAL(read_bundle.images[0].center, bundle.images[0].center);
+
+  BOOST_CHECK_EQUAL(read_bundle.points3D.size(), 1);
+  BOOST_CHECK_EQUAL(read_bundle.points3D[0].point3D_id, 7);
+  BOOST_CHECK_EQUAL(read_bundle.points3D[0].xyz, bundle.points3D[0].xyz);
+  BOOST_CHECK_EQUAL(read_bundle.points3D[0].color, bundle.points3D[0].color);
+  BOOST_CHECK_EQUAL(read_bundle.points3D[0].error, 0.5);
+  BOOST_CHECK_EQUAL(read_bundle.points3D[0].track.size(), 2);
+  BOOST_CHECK_EQUAL(read_bundle.points3D[0].track[1].image_id, 2);
+  BOOST_CHECK_EQUAL(read_bundle.points3D[0].track[1].point2D_idx, 4);
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadInvalid) {
+  TakeBundle bundle;
+  BOOST_CHECK(!ReadTakeBundle("/nonexistent/take.bin", &bundle));
+
+  const std::string path = TemporaryPath();
+  {
+    std::ofstream file(path, std::ios::trunc | std::ios::binary);
+    file << "not a bundle";
+  }
+  BOOST_CHECK(!ReadTakeBundle(path, &bundle));
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadTruncated) {
+  const std::string path = TemporaryPath();
+  WriteTakeBundle(path, CreateBundle());
+  boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 4);
+  TakeBundle bundle;
+  BOOST_CHECK(!ReadTakeBundle(path, &bundle));
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestCameraLog) {
+  const std::string path = TemporaryPath();
+  const TakeBundle bundle = CreateBundle();
+  {
+    TakeCameraLogWriter writer(path);
+    writer.Write(bundle.cameras[0]);
+    writer.Flush();
+    writer.Write(bundle.cameras[1]);
+    writer.Write(bundle.cameras[0]);
+  }
+
+  std::vector<TakeCamera> cameras;
+  BOOST_CHECK(ReadTakeCameraLog(path, &cameras));
+  BOOST_CHECK_EQUAL(cameras.size(), 3);
+  for (size_t i = 0; i < cameras.size(); ++i) {
+    const TakeCamera& camera = bundle.cameras[i == 1 ? 1 : 0];
+    BOOST_CHECK_EQUAL(cameras[i].image_id, camera.image_id);
+    BOOST_CHECK_EQUAL(cameras[i].take, camera.take);
+    BOOST_CHECK_EQUAL(cameras[i].anchor, camera.anchor);
+    BOOST_CHECK_EQUAL(cameras[i].qvec, camera.qvec);
+    BOOST_CHECK_EQUAL(cameras[i].tvec, camera.tvec);
+    BOOST_CHECK_EQUAL(cameras[i].focal_length, camera.focal_length);
+    BOOST_CHECK_EQUAL(cameras[i].num_inliers, camera.num_inliers);
+    BOOST_CHECK_EQUAL(cameras[i].pose_image_id, camera.pose_image_id);
+  }
+
+  boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 4);
+  BOOST_CHECK(!ReadTakeCameraLog(path, &cameras));
+  BOOST_CHECK(!ReadTakeCameraLog("/nonexistent/cams.bin", &cameras));
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestEmptyCameraLog) {
+  const std::string path = TemporaryPath();
+  { TakeCameraLogWriter writer(path); }
+  std::vector<TakeCamera> cameras(1);
+  BOOST_CHECK(ReadTakeCameraLog(path, &cameras));
+  BOOST_CHECK(cameras.empty());
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestAppendCameraLog) {
+  const std::string path = TemporaryPath();
+  const TakeBundle bundle = CreateBundle();
+  {
+    TakeCameraLogWriter writer(path, true);
+    writer.Write(bundle.cameras[0]);
+  }
+  {
+    TakeCameraLogWriter writer(path, true);
+    writer.Write(bundle.cameras[1]);
+  }
+
+  std::vector<TakeCamera> cameras;
+  BOOST_CHECK(ReadTakeCameraLog(path, &cameras));
+  BOOST_CHECK_EQUAL(cameras.size(), 2);
+  BOOST_CHECK_EQUAL(cameras[0].pose_image_id, bundle.cameras[0].pose_image_id);
+  BOOST_CHECK_EQUAL(cameras[1].pose_image_id, bundle.cameras[1].pose_image_id);
+
+  { TakeCameraLogWriter writer(path); }
+  BOOST_CHECK(ReadTakeCameraLog(path, &cameras));
+  BOOST_CHECK(cameras.empty());
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestExtendTakeBundle) {
+  Reconstruction reconstruction;
+  SceneGraph scene_graph;
+  Camera camera;
+  camera.SetCameraId(1);
+  camera.InitializeWithName("PINHOLE", 1, 1, 1);
+  reconstruction.AddCamera(camera);
+  for (image_t image_id = 1; image_id <= 3; ++image_id) {
+    Image image;
+    image.SetImageId(image_id);
+    image.SetCameraId(1);
+    image.SetName("image" + std::to_string(image_id));
+    image.SetPoints2D(std::vector<Eigen::Vector2d>(2, Eigen::Vector2d::Zero()));
+    reconstruction.AddImage(image);
+    reconstruction.RegisterImage(image_id);
+    scene_graph.AddImage(image_id, 2);
+  }
+  reconstruction.SetUp(&scene_graph);
+
+  Track track1;
+  track1.AddElement(1, 0);
+  track1.AddElement(2, 0);
+  reconstruction.AddPoint3D(Eigen::Vector3d(1, 0, 0), track1);
+  Track track2;
+  track2.AddElement(2, 1);
+  track2.AddElement(3, 1);
+  reconstruction.AddPoint3D(Eigen::Vector3d(2, 0, 0), track2);
+  Track track3;
+  track3.AddElement(1, 1);
+  reconstruction.AddPoint3D(Eigen::Vector3d(3, 0, 0), track3);
+
+  const std::unordered_map<std::string, int> take_map = {
+      {"image1", 1}, {"image2", 2}, {"image3", 2}};
+  TakeBundle bundle = CreateBundle();
+  ExtendTakeBundle(reconstruction, take_map, 2, &bundle);
+
+  BOOST_CHECK_EQUAL(bundle.cameras.size(), 2);
+  BOOST_CHECK_EQUAL(bundle.images.size(), 3);
+  BOOST_CHECK_EQUAL(bundle.images[0].image_id, 1);
+  BOOST_CHECK_EQUAL(bundle.images[0].point3D_ids[0], 7);
+  BOOST_CHECK_EQUAL(bundle.points3D.size(), 3);
+  BOOST_CHECK_EQUAL(bundle.points3D[0].point3D_id, 7);
+  BOOST_CHECK_EQUAL(bundle.points3D[0].track.size(), 2);
+
+  std::unordered_map<point3D_t, const TakePoint3D*> points3D;
+  for (const TakePoint3D& point3D : bundle.points3D) {
+    points3D.emplace(point3D.point3D_id, &point3D);
+  }
+  BOOST_CHECK_EQUAL(points3D.size(), 3);
+  for (size_t i = 1; i < bundle.images.size(); ++i) {
+    const TakeImage& image = bundle.images[i];
+    BOOST_CHECK_EQUAL(image.take, 2);
+    BOOST_CHECK(image.image_id == 2 || image.image_id == 3);
+    for (point2D_t point2D_idx = 0; point2D_idx < 2; ++point2D_idx) {
+      const point3D_t point3D_id = image.point3D_ids[point2D_idx];
+      if (image.image_id == 3 && point2D_idx == 0) {
+        BOOST_CHECK_EQUAL(point3D_id, kInvalidPoint3DId);
+        continue;
+      }
+      BOOST_CHECK(point3D_id == 8 || point3D_id == 9);
+      const TakePoint3D& point3D = *points3D.at(point3D_id);
+      BOOST_CHECK_EQUAL(point3D.xyz(0), point2D_idx + 1.0);
+      for (const TrackElement& track_el : point3D.track) {
+        BOOST_CHECK(track_el.image_id == 2 || track_el.image_id == 3);
+        BOOST_CHECK_EQUAL(track_el.point2D_idx, point2D_idx);
+      }
+      BOOST_CHECK_EQUAL(point3D.track.size(), point2D_idx + 1);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestReadTakeMap) {
+  BOOST_CHECK(ReadTakeMap("/nonexistent/takes.txt").empty());
+
+  const std::string path = TemporaryPath();
+  {
+    std::ofstream file(path, std::ios::trunc);
+    file << "image1.jpg 1\nimage2.jpg 2\n image3.jpg  2\n";
+  }
+  const auto take_map = ReadTakeMap(path);
+  BOOST_CHECK_EQUAL(take_map.size(), 3);
+  BOOST_CHECK_EQUAL(take_map.at("image1.jpg"), 1);
+  BOOST_CHECK_EQUAL(take_map.at("image2.jpg"), 2);
+  BOOST_CHECK_EQUAL(take_map.at("image3.jpg"), 2);
+  boost::filesystem::remove(path);
+}
@@ -25,6 +25,30 @@
 namespace colmap {
 namespace {
 
+// The names of the registered images, in the order in which they are
+// undistorted.
+std::vector<std::string> RegImageNames(const Reconstruction& reconstruction) {
+  std::vector<std::string> image_names;
+  image_names.reserve(reconstruction.NumRegImages());
+  for (const image_t image_id : reconstruction.RegImageIds()) {
+    image_names.push_back(reconstruction.Image(image_id).Name());
+  }
+  return image_names;
+}
+
+// Read a distorted image from the local or remote image source.
+bool ReadDistortedBitmap(ImageSource* image_source,
+                         const std::string& image_name, const bool as_rgb,
+                         const int max_image_size, Bitmap* bitmap) {
+  std::string path;
+  if (!image_source->Acquire(image_name, &path)) {
+    return false;
+  }
+  const bool success = bitmap->Read(path, as_rgb, max_image_size);
+  image_source->Release(image_name);
+  return success;
+}
+
 template <typename Derived>
 void WriteMatrix(const Eigen::MatrixBase<Derived>& matrix,
                  std::ofstream* file) {
@@ -117,16 +141,109 @@ void WriteCOLMAPCommands(const bool geometric,
         << JoinPaths(workspace_path, output_prefix + "meshed.ply") << std::endl;
 }
 
+// The camera of an image that was decoded at a reduced resolution, where the
+// JPEG decoder scaled the image by the inverse of an integer denominator and
+// rounded the dimensions up.
+Camera ScaleDecodedCamera(const Camera& camera, const size_t width,
+                          const size_t height) {
+  if (camera.Width() == width && camera.Height() == height) {
+    return camera;
+  }
+
+  const double scale =
+      1.0 / std::round(static_cast<double>(camera.Width()) / width);
+  Camera scaled_camera = camera;
+  scaled_camera.SetWidth(width);
+  scaled_camera.SetHeight(height);
+  for (const size_t idx : camera.FocalLengthIdxs()) {
+    scaled_camera.Params(idx) *= scale;
+  }
+  for (const size_t idx : camera.PrincipalPointIdxs()) {
+    scaled_camera.Params(idx) *= scale;
+  }
+  return scaled_camera;
+}
+
 }  // namespace
 
-COLMAPUndistorter::COLMAPUndistorter(const UndistortCameraOptions& options,
-                                     const Reconstruction& reconstruction,
-                                     const std::string& image_path,
-                                     const std::string& output_path)
+UndistortionMapCache::UndistortionMapCache(
+    const UndistortCameraOptions& options, const Reconstruction& reconstruction)
+    : options_(options), reconstruction_(reconstruction) {
+  for (const image_t image_id : reconstruction_.RegImageIds()) {
+    const camera_t camera_id = reconstruction_.Image(image_id).CameraId();
+    std::unique_ptr<CameraMap>& camera_map = camera_maps_[camera_id];
+    if (!camera_map) {
+      camera_map.reset(new CameraMap());
+    }
+    camera_map->num_remaining_images += 1;
+  }
+}
+
+int UndistortionMapCache::DecodeImageSize(const Image& image) {
+  if (options_.max_image_size <= 0) {
+    return 0;
+  }
+
+  const Camera& camera = reconstruction_.Camera(image.CameraId());
+  CameraMap& camera_map = *camera_maps_.at(image.CameraId());
+  std::unique_lock<std::mutex> lock(camera_map.mutex);
+  if (!camera_map.has_undistorted_camera) {
+    camera_map.undistorted_camera = UndistortCamera(options_, camera);
+    camera_map.has_undistorted_camera = true;
+  }
+
+  const double scale = std::max(
+      static_cast<double>(camera_map.undistorted_camera.Width()) /
+          camera.Width(),
+      static_cast<double>(camera_map.undistorted_camera.Height()) /
+          camera.Height());
+  return static_cast<int>(
+      std::ceil(scale * std::max(camera.Width(), camera.Height())));
+}
+
+void UndistortionMapCache::UndistortImage(const Image& image,
+                                          const Bitmap& distorted_bitmap,
+                                          Bitmap* undistorted_bitmap,
+                                          Camera* undistorted_camera) {
+  CameraMap& camera_map = *camera_maps_.at(image.CameraId());
+
+  std::shared_ptr<const CameraWarpMap> warp_map;
+  {
+    std::unique_lock<std::mutex> lock(camera_map.mutex);
+    const Camera& camera = reconstruction_.Camera(image.CameraId());
+    if (!camera_map.has_undistorted_camera) {
+      camera_map.undistorted_camera = UndistortCamera(options_, camera);
+      camera_map.has_undistorted_camera = true;
+    }
+    // All images of a camera are usually decoded with the same dimensions.
+    if (!camera_map.warp_map ||
+        camera_map.warp_map->SourceWidth() != distorted_bitmap.Width() ||
+        camera_map.warp_map->SourceHeight() != distorted_bitmap.Height()) {
+      camera_map.warp_map = std::make_shared<const CameraWarpMap>(
+          ScaleDecodedCamera(camera, distorted_bitmap.Width(),
+                             distorted_bitmap.Height()),
+          camera_map.undistorted_camera);
+    }
+    warp_map = camera_map.warp_map;
+    *undistorted_camera = camera_map.undistorted_camera;
+    camera_map.num_remaining_images -= 1;
+    if (camera_map.num_remaining_images == 0) {
+      camera_map.warp_map.reset();
+    }
+  }
+
+  colmap::UndistortImage(*warp_map, distorted_bitmap, undistorted_bitmap);
+}
+
+COLMAPUndistorter::COLMAPUndistorter(
+    const UndistortCameraOptions& options, const Reconstruction& reconstruction,
+    const std::string& image_path, const std::string& output_path,
+    const ImageSourceOptions& image_source_options)
     : options_(options),
       image_path_(image_path),
       output_path_(output_path),
-      reconstruction_(reconstruction) {}
+      reconstruction_(reconstruction),
+      image_source_options_(image_source_options) {}
 
 void COLMAPUndistorter::Run() {
   PrintHeading1("Image undistortion");
@@ -144,12 +261,20 @@ void COLMAPUndistorter::Run() {
   reconstruction_.CreateImageDirs(
       JoinPaths(output_path_, "stereo/consistency_graphs"));
 
+  UndistortionMapCache map_cache(options_, reconstruction_);
+
+  // The images are fetched ahead of the undistortion, if they are remote.
+  image_source_ = CreateImageSource(image_path_, image_source_options_);
+  ImagePrefetcher image_prefetcher(
+      image_source_.get(), RegImageNames(reconstruction_),
+      image_source_options_.max_num_prefetched_images);
+
   ThreadPool thread_pool;
   std::vector<std::future<void>> futures;
   futures.reserve(reconstruction_.NumRegImages());
   for (size_t i = 0; i < reconstruction_.NumRegImages(); ++i) {
-    futures.push_back(
-        thread_pool.AddTask(&COLMAPUndistorter::Undistort, this, i));
+    futures.push_back(thread_pool.AddTask(&COLMAPUndistorter::Undistort, this,
+                                          i, &map_cache));
   }
 
   for (size_t i = 0; i < futures.size(); ++i) {
@@ -161,6 +286,7 @@ void COLMAPUndistorter::Run() {
                               futures.size())
               << std::endl;
 
+    image_prefetcher.Advance(i);
     futures[i].get();
   }
 
@@ -180,17 +306,19 @@ void COLMAPUndistorter::Run() {
   GetTimer().PrintMinutes();
 }
 
-void COLMAPUndistorter::Undistort(const size_t reg_image_idx) const {
+void COLMAPUndistorter::Undistort(const size_t reg_image_idx,
+                                 UndistortionMapCache* map_cache) const {
   const image_t image_id = reconstruction_.RegImageIds().at(reg_image_idx);
   const Image& image = reconstruction_.Image(image_id);
-  const Camera& camera = reconstruction_.Camera(image.CameraId());
 
   const std::string output_image_path =
       JoinPaths(output_path_, "images", image.Name());
 
   Bitmap distorted_bitmap;
   const std::string input_image_path = JoinPaths(image_path_, image.Name());
-  if (!distorted_bitmap.Read(input_image_path)) {
+  if (!ReadDistortedBitmap(image_source_.get(), image.Name(), true,
+                           map_cache->DecodeImageSize(image),
+                           &distorted_bitmap)) {
     std::cerr << "ERROR: Cannot read image at path " << input_image_path
               << std::endl;
     return;
@@ -198,8 +326,8 @@ void COLMAPUndistorter::Undistort(const size_t reg_image_idx) const {
 
   Bitmap undistorted_bitmap;
   Camera undistorted_camera;
-  UndistortImage(options_, distorted_bitmap, camera, &undistorted_bitmap,
-                 &undistorted_camera);
+  map_cache->UndistortImage(image, distorted_bitmap, &undistorted_bitmap,
+                            &undistorted_camera);
 
   undistorted_bitmap.Write(output_image_path);
 }
@@ -237,14 +365,15 @@ void COLMAPUndistorter::WriteScript(const bool geometric) const {
   WriteCOLMAPCommands(geometric, ".", "COLMAP", "option-all", "", "", &file);
 }
 
-PMVSUndistorter::PMVSUndistorter(const UndistortCameraOptions& options,
-                                 const Reconstruction& reconstruction,
-                                 const std::string& image_path,
-                                 const std::string& output_path)
+PMVSUndistorter::PMVSUndistorter(
+    const UndistortCameraOptions& options, const Reconstruction& reconstruction,
+    const std::string& image_path, const std::string& output_path,
+    const ImageSourceOptions& image_source_options)
     : options_(options),
       image_path_(image_path),
       output_path_(output_path),
-      reconstruction_(reconstruction) {}
+      reconstruction_(reconstruction),
+      image_source_options_(image_source_options) {}
 
 void PMVSUndistorter::Run() {
   PrintHeading1("Image undistortion (CMVS/PMVS)");
@@ -254,12 +383,20 @@ void PMVSUndistorter::Run() {
   CreateDirIfNotExists(JoinPaths(output_path_, "pmvs/visualize"));
   CreateDirIfNotExists(JoinPaths(output_path_, "pmvs/models"));
 
+  UndistortionMapCache map_cache(options_, reconstruction_);
+
+  // The images are fetched ahead of the undistortion, if they are remote.
+  image_source_ = CreateImageSource(image_path_, image_source_options_);
+  ImagePrefetcher image_prefetcher(
+      image_source_.get(), RegImageNames(reconstruction_),
+      image_source_options_.max_num_prefetched_images);
+
   ThreadPool thread_pool;
   std::vector<std::future<void>> futures;
   futures.reserve(reconstruction_.NumRegImages());
   for (size_t i = 0; i < reconstruction_.NumRegImages(); ++i) {
-    futures.push_back(
-        thread_pool.AddTask(&PMVSUndistorter::Undistort, this, i));
+    futures.push_back(thread_pool.AddTask(&PMVSUndistorter::Undistort, this, i,
+                                          &map_cache));
   }
 
   for (size_t i = 0; i < futures.size(); ++i) {
@@ -276,6 +413,7 @@ void PMVSUndistorter::Run() {
                               futures.size())
               << std::endl;
 
+    image_prefetcher.Advance(i);
     futures[i].get();
   }
 
@@ -303,7 +441,8 @@ void PMVSUndistorter::Run() {
   GetTimer().PrintMinutes();
 }
 
-void PMVSUndistorter::Undistort(const size_t reg_image_idx) const {
+void PMVSUndistorter::Undistort(const size_t reg_image_idx,
+                               UndistortionMapCache* map_cache) const {
   const std::string output_image_path = JoinPaths(
       output_path_, StringPrintf("pmvs/visualize/%08d.jpg", reg_image_idx));
   const std::string proj_matrix_path =
@@ -311,11 +450,12 @@ void PMVSUndistorter::Undistort(const size_t reg_image_idx) const {
 
   const image_t image_id = reconstruction_.RegImageIds().at(reg_image_idx);
   const Image& image = reconstruction_.Image(image_id);
-  const Camera& camera = reconstruction_.Camera(image.CameraId());
 
   Bitmap distorted_bitmap;
   const std::string input_image_path = JoinPaths(image_path_, image.Name());
-  if (!distorted_bitmap.Read(input_image_path)) {
+  if (!ReadDistortedBitmap(image_source_.get(), image.Name(), true,
+                           map_cache->DecodeImageSize(image),
+                           &distorted_bitmap)) {
     std::cerr << StringPrintf("ERROR: Cannot read image at path %s",
                               input_image_path.c_str())
               << std::endl;
@@ -324,8 +464,8 @@ void PMVSUndistorter::Undistort(const size_t reg_image_idx) const {
 
   Bitmap undistorted_bitmap;
   Camera undistorted_camera;
-  UndistortImage(options_, distorted_bitmap, camera, &undistorted_bitmap,
-                 &undistorted_camera);
+  map_cache->UndistortImage(image, distorted_bitmap, &undistorted_bitmap,
+                            &undistorted_camera);
 
   undistorted_bitmap.Write(output_image_path);
   WriteProjectionMatrix(proj_matrix_path, undistorted_camera, image, "CONTOUR");
@@ -469,24 +609,33 @@ void PMVSUndistorter::WriteOptionFile() const {
   file << "oimages 0" << std::endl;
 }
 
-CMPMVSUndistorter::CMPMVSUndistorter(const UndistortCameraOptions& options,
-                                     const Reconstruction& reconstruction,
-                                     const std::string& image_path,
-                                     const std::string& output_path)
+CMPMVSUndistorter::CMPMVSUndistorter(
+    const UndistortCameraOptions& options, const Reconstruction& reconstruction,
+    const std::string& image_path, const std::string& output_path,
+    const ImageSourceOptions& image_source_options)
     : options_(options),
       image_path_(image_path),
       output_path_(output_path),
-      reconstruction_(reconstruction) {}
+      reconstruction_(reconstruction),
+      image_source_options_(image_source_options) {}
 
 void CMPMVSUndistorter::Run() {
   PrintHeading1("Image undistortion (CMP-MVS)");
 
+  UndistortionMapCache map_cache(options_, reconstruction_);
+
+  // The images are fetched ahead of the undistortion, if they are remote.
+  image_source_ = CreateImageSource(image_path_, image_source_options_);
+  ImagePrefetcher image_prefetcher(
+      image_source_.get(), RegImageNames(reconstruction_),
+      image_source_options_.max_num_prefetched_images);
+
   ThreadPool thread_pool;
   std::vector<std::future<void>> futures;
   futures.reserve(reconstruction_.NumRegImages());
   for (size_t i = 0; i < reconstruction_.NumRegImages(); ++i) {
-    futures.push_back(
-        thread_pool.AddTask(&CMPMVSUndistorter::Undistort, this, i));
+    futures.push_back(thread_pool.AddTask(&CMPMVSUndistorter::Undistort, this,
+                                          i, &map_cache));
   }
 
   for (size_t i = 0; i < futures.size(); ++i) {
@@ -498,13 +647,15 @@ void CMPMVSUndistorter::Run() {
                               futures.size())
               << std::endl;
 
+    image_prefetcher.Advance(i);
     futures[i].get();
   }
 
   GetTimer().PrintMinutes();
 }
 
-void CMPMVSUndistorter::Undistort(const size_t reg_image_idx) const {
+void CMPMVSUndistorter::Undistort(const size_t reg_image_idx,
+                                 UndistortionMapCache* map_cache) const {
   const std::string output_image_path =
       JoinPaths(output_path_, StringPrintf("%05d.jpg", reg_image_idx + 1));
   const std::string proj_matrix_path =
@@ -512,11 +663,12 @@ void CMPMVSUndistorter::Undistort(const size_t reg_image_idx) const {
 
   const image_t image_id = reconstruction_.RegImageIds().at(reg_image_idx);
   const Image& image = reconstruction_.Image(image_id);
-  const Camera& camera = reconstruction_.Camera(image.CameraId());
 
   Bitmap distorted_bitmap;
   const std::string input_image_path = JoinPaths(image_path_, image.Name());
-  if (!distorted_bitmap.Read(input_image_path)) {
+  if (!ReadDistortedBitmap(image_source_.get(), image.Name(), true,
+                           map_cache->DecodeImageSize(image),
+                           &distorted_bitmap)) {
     std::cerr << "ERROR: Cannot read image at path " << input_image_path
               << std::endl;
     return;
@@ -524,8 +676,8 @@ void CMPMVSUndistorter::Undistort(const size_t reg_image_idx) const {
 
   Bitmap undistorted_bitmap;
   Camera undistorted_camera;
-  UndistortImage(options_, distorted_bitmap, camera, &undistorted_bitmap,
-                 &undistorted_camera);
+  map_cache->UndistortImage(image, distorted_bitmap, &undistorted_bitmap,
+                            &undistorted_camera);
 
   undistorted_bitmap.Write(output_image_path);
   WriteProjectionMatrix(proj_matrix_path, undistorted_camera, image, "CONTOUR");
@@ -534,16 +686,31 @@ void CMPMVSUndistorter::Undistort(const size_t reg_image_idx) const {
 StereoImageRectifier::StereoImageRectifier(
     const UndistortCameraOptions& options, const Reconstruction& reconstruction,
     const std::string& image_path, const std::string& output_path,
-    const std::vector<std::pair<image_t, image_t>>& stereo_pairs)
+    const std::vector<std::pair<image_t, image_t>>& stereo_pairs,
+    const ImageSourceOptions& image_source_options)
     : options_(options),
       image_path_(image_path),
       output_path_(output_path),
       stereo_pairs_(stereo_pairs),
-      reconstruction_(reconstruction) {}
+      reconstruction_(reconstruction),
+      image_source_options_(image_source_options) {}
 
 void StereoImageRectifier::Run() {
   PrintHeading1("Stereo rectification");
 
+  // The images of the pairs are fetched ahead of the rectification, if they
+  // are remote.
+  image_source_ = CreateImageSource(image_path_, image_source_options_);
+  std::vector<std::string> image_names;
+  image_names.reserve(2 * stereo_pairs_.size());
+  for (const auto& stereo_pair : stereo_pairs_) {
+    image_names.push_back(reconstruction_.Image(stereo_pair.first).Name());
+    image_names.push_back(reconstruction_.Image(stereo_pair.second).Name());
+  }
+  ImagePrefetcher image_prefetcher(
+      image_source_.get(), image_names,
+      image_source_options_.max_num_prefetched_images);
+
   ThreadPool thread_pool;
   std::vector<std::future<void>> futures;
   futures.reserve(stereo_pairs_.size());
@@ -562,6 +729,7 @@ void StereoImageRectifier::Run() {
                               futures.size())
               << std::endl;
 
+    image_prefetcher.Advance(2 * i);
     futures[i].get();
   }
 
@@ -590,7 +758,8 @@ void StereoImageRectifier::Rectify(const image_t image_id1,
 
   Bitmap distorted_bitmap1;
   const std::string input_image1_path = JoinPaths(image_path_, image1.Name());
-  if (!distorted_bitmap1.Read(input_image1_path)) {
+  if (!ReadDistortedBitmap(image_source_.get(), image1.Name(), true, 0,
+                           &distorted_bitmap1)) {
     std::cerr << "ERROR: Cannot read image at path " << input_image1_path
               << std::endl;
     return;
@@ -598,7 +767,8 @@ void StereoImageRectifier::Rectify(const image_t image_id1,
 
   Bitmap distorted_bitmap2;
   const std::string input_image2_path = JoinPaths(image_path_, image2.Name());
-  if (!distorted_bitmap2.Read(input_image2_path)) {
+  if (!ReadDistortedBitmap(image_source_.get(), image2.Name(), true, 0,
+                           &distorted_bitmap2)) {
     std::cerr << "ERROR: Cannot read image at path " << input_image2_path
               << std::endl;
     return;
@@ -786,6 +956,16 @@ void UndistortImage(const UndistortCameraOptions& options,
                           distorted_bitmap, undistorted_bitmap);
 }
 
+void UndistortImage(const CameraWarpMap& warp_map,
+                    const Bitmap& distorted_bitmap,
+                    Bitmap* undistorted_bitmap) {
+  CHECK_EQ(warp_map.SourceWidth(), distorted_bitmap.Width());
+  CHECK_EQ(warp_map.SourceHeight(), distorted_bitmap.Height());
+
+  warp_map.Warp(distorted_bitmap, undistorted_bitmap);
+  distorted_bitmap.CloneMetadata(undistorted_bitmap);
+}
+
 void UndistortReconstruction(const UndistortCameraOptions& options,
                              Reconstruction* reconstruction) {
   const auto distorted_cameras = reconstruction->Cameras();
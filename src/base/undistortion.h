@@ -17,9 +17,15 @@
 #ifndef COLMAP_SRC_BASE_UNDISTORTION_H_
 #define COLMAP_SRC_BASE_UNDISTORTION_H_
 
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
 #include "base/reconstruction.h"
+#include "base/warp.h"
 #include "util/alignment.h"
 #include "util/bitmap.h"
+#include "util/image_source.h"
 #include "util/threading.h"
 
 namespace colmap {
@@ -37,6 +43,40 @@ struct UndistortCameraOptions {
   int max_image_size = -1;
 };
 
+// Thread-safe cache of the undistortion of every camera in a reconstruction.
+// The undistorted camera and the warp map of a camera are computed by its
+// first undistorted image, shared by all its other images, and released after
+// its last registered image.
+class UndistortionMapCache {
+ public:
+  UndistortionMapCache(const UndistortCameraOptions& options,
+                       const Reconstruction& reconstruction);
+
+  // The maximum image size with which the distorted image of a registered
+  // image can be decoded, see `Bitmap::Read`, such that it is still at least
+  // as large as the undistorted image. Zero if the undistorted images are not
+  // downsized.
+  int DecodeImageSize(const Image& image);
+
+  // Undistort a registered image of the reconstruction. See `UndistortImage`.
+  // The distorted image may have been decoded at a reduced resolution.
+  void UndistortImage(const Image& image, const Bitmap& distorted_bitmap,
+                      Bitmap* undistorted_bitmap, Camera* undistorted_camera);
+
+ private:
+  struct CameraMap {
+    std::mutex mutex;
+    size_t num_remaining_images = 0;
+    bool has_undistorted_camera = false;
+    Camera undistorted_camera;
+    std::shared_ptr<const CameraWarpMap> warp_map;
+  };
+
+  const UndistortCameraOptions options_;
+  const Reconstruction& reconstruction_;
+  std::unordered_map<camera_t, std::unique_ptr<CameraMap>> camera_maps_;
+};
+
 // Undistort images and export undistorted cameras, as required by the
 // mvs::PatchMatchController class.
 class COLMAPUndistorter : public Thread {
@@ -44,12 +84,15 @@ class COLMAPUndistorter : public Thread {
   COLMAPUndistorter(const UndistortCameraOptions& options,
                     const Reconstruction& reconstruction,
                     const std::string& image_path,
-                    const std::string& output_path);
+                    const std::string& output_path,
+                    const ImageSourceOptions& image_source_options =
+                        ImageSourceOptions());
 
  private:
   void Run();
 
-  void Undistort(const size_t reg_image_idx) const;
+  void Undistort(const size_t reg_image_idx,
+                 UndistortionMapCache* map_cache) const;
   void WritePatchMatchConfig() const;
   void WriteFusionConfig() const;
   void WriteScript(const bool geometric) const;
@@ -58,6 +101,8 @@ class COLMAPUndistorter : public Thread {
   std::string image_path_;
   std::string output_path_;
   const Reconstruction& reconstruction_;
+  ImageSourceOptions image_source_options_;
+  std::unique_ptr<ImageSource> image_source_;
 };
 
 // Undistort images and prepare data for CMVS/PMVS.
@@ -66,12 +111,15 @@ class PMVSUndistorter : public Thread {
   PMVSUndistorter(const UndistortCameraOptions& options,
                   const Reconstruction& reconstruction,
                   const std::string& image_path,
-                  const std::string& output_path);
+                  const std::string& output_path,
+                  const ImageSourceOptions& image_source_options =
+                      ImageSourceOptions());
 
  private:
   void Run();
 
-  void Undistort(const size_t reg_image_idx) const;
+  void Undistort(const size_t reg_image_idx,
+                 UndistortionMapCache* map_cache) const;
   void WriteVisibilityData() const;
   void WriteOptionFile() const;
   void WritePMVSScript() const;
@@ -83,6 +131,8 @@ class PMVSUndistorter : public Thread {
   std::string image_path_;
   std::string output_path_;
   const Reconstruction& reconstruction_;
+  ImageSourceOptions image_source_options_;
+  std::unique_ptr<ImageSource> image_source_;
 };
 
 // Undistort images and prepare data for CMP-MVS.
@@ -91,17 +141,22 @@ class CMPMVSUndistorter : public Thread {
   CMPMVSUndistorter(const UndistortCameraOptions& options,
                     const Reconstruction& reconstruction,
                     const std::string& image_path,
-                    const std::string& output_path);
+                    const std::string& output_path,
+                    const ImageSourceOptions& image_source_options =
+                        ImageSourceOptions());
 
  private:
   void Run();
 
-  void Undistort(const size_t reg_image_idx) const;
+  void Undistort(const size_t reg_image_idx,
+                 UndistortionMapCache* map_cache) const;
 
   UndistortCameraOptions options_;
   std::string image_path_;
   std::string output_path_;
   const Reconstruction& reconstruction_;
+  ImageSourceOptions image_source_options_;
+  std::unique_ptr<ImageSource> image_source_;
 };
 
 // Rectify stereo image pairs.
@@ -111,7 +166,8 @@ class StereoImageRectifier : public Thread {
       const UndistortCameraOptions& options,
       const Reconstruction& reconstruction, const std::string& image_path,
       const std::string& output_path,
-      const std::vector<std::pair<image_t, image_t>>& stereo_pairs);
+      const std::vector<std::pair<image_t, image_t>>& stereo_pairs,
+      const ImageSourceOptions& image_source_options = ImageSourceOptions());
 
  private:
   void Run();
@@ -123,6 +179,8 @@ class StereoImageRectifier : public Thread {
   std::string output_path_;
   const std::vector<std::pair<image_t, image_t>>& stereo_pairs_;
   const Reconstruction& reconstruction_;
+  ImageSourceOptions image_source_options_;
+  std::unique_ptr<ImageSource> image_source_;
 };
 
 // Undistort camera by resizing the image and shifting the principal point.
@@ -153,6 +211,11 @@ void UndistortImage(const UndistortCameraOptions& options,
                     const Camera& distorted_camera, Bitmap* undistorted_image,
                     Camera* undistorted_camera);
 
+// Undistort image with the precomputed warp map from the distorted to the
+// undistorted camera, as created by `UndistortCamera`.
+void UndistortImage(const CameraWarpMap& warp_map,
+                    const Bitmap& distorted_image, Bitmap* undistorted_image);
+
 // Undistort all cameras in the reconstruction and accordingly all
 // observations in their corresponding images.
 void UndistortReconstruction(const UndistortCameraOptions& options,
@@ -15,77 +15,122 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "base/visibility_pyramid.h"
+
+#include <limits>
+
 #include "util/logging.h"
 #include "util/math.h"
 
 namespace colmap {
 
+namespace {
+
+// Spread the 8 bits of the value to the even bits of the result.
+inline size_t SpreadBits(size_t value) {
+  value = (value | (value << 4)) & 0x0F0F;
+  value = (value | (value << 2)) & 0x3333;
+  value = (value | (value << 1)) & 0x5555;
+  return value;
+}
+
+}  // namespace
+
 VisibilityPyramid::VisibilityPyramid() : VisibilityPyramid(0, 0, 0) {}
 
 VisibilityPyramid::VisibilityPyramid(const size_t num_levels,
                                      const size_t width, const size_t height)
-    : width_(width), height_(height), score_(0), max_score_(0) {
-  pyramid_.resize(num_levels);
+    : width_(width),
+      height_(height),
+      num_levels_(num_levels),
+      score_(0),
+      max_score_(0) {
+  CHECK_LE(num_levels, 8);
+  size_t num_cells = 0;
   for (size_t level = 0; level < num_levels; ++level) {
-    const size_t level_plus_one = level + 1;
-    const int dim = 1 << level_plus_one;
-    pyramid_[level].setZero(dim, dim);
-    max_score_ += dim * dim * dim * dim;
+    const size_t level_size = size_t(4) << (2 * level);
+    num_cells += level_size;
+    max_score_ += level_size * level_size;
   }
+  cells_.resize(num_cells, 0);
 }
 
 void VisibilityPyramid::SetPoint(const double x, const double y) {
-  CHECK_GT(pyramid_.size(), 0);
+  size_t cx = 0;
+  size_t cy = 0;
+  CellForPoint(num_levels_, width_, height_, x, y, &cx, &cy);
+  SetCell(cx, cy);
+}
 
+void VisibilityPyramid::ResetPoint(const double x, const double y) {
   size_t cx = 0;
   size_t cy = 0;
-  CellForPoint(x, y, &cx, &cy);
+  CellForPoint(num_levels_, width_, height_, x, y, &cx, &cy);
+  ResetCell(cx, cy);
+}
+
+void VisibilityPyramid::SetCell(const size_t cx, const size_t cy) {
+  CHECK_GT(num_levels_, 0);
 
-  for (int i = static_cast<int>(pyramid_.size() - 1); i >= 0; --i) {
-    auto& level = pyramid_[i];
+  size_t level_size = size_t(4) << (2 * (num_levels_ - 1));
+  size_t level_offset = cells_.size() - level_size;
+  size_t cell_idx = SpreadBits(cx) | (SpreadBits(cy) << 1);
 
-    level(cy, cx) += 1;
-    if (level(cy, cx) == 1) {
-      score_ += level.size();
+  CHECK_LT(cells_[level_offset + cell_idx],
+           std::numeric_limits<uint16_t>::max());
+
+  for (size_t level = 0; level < num_levels_; ++level) {
+    uint16_t& cell = cells_[level_offset + cell_idx];
+    cell += 1;
+    if (cell != 1) {
+      break;
     }
 
-    cx = cx >> 1;
-    cy = cy >> 1;
+    score_ += level_size;
+
+    level_size >>= 2;
+    level_offset -= level_size;
+    cell_idx >>= 2;
   }
 
   CHECK_LE(score_, max_score_);
 }
 
-void VisibilityPyramid::ResetPoint(const double x, const double y) {
-  CHECK_GT(pyramid_.size(), 0);
+void VisibilityPyramid::ResetCell(const size_t cx, const size_t cy) {
+  CHECK_GT(num_levels_, 0);
 
-  size_t cx = 0;
-  size_t cy = 0;
-  CellForPoint(x, y, &cx, &cy);
+  size_t level_size = size_t(4) << (2 * (num_levels_ - 1));
+  size_t level_offset = cells_.size() - level_size;
+  size_t cell_idx = SpreadBits(cx) | (SpreadBits(cy) << 1);
 
-  for (int i = static_cast<int>(pyramid_.size() - 1); i >= 0; --i) {
-    auto& level = pyramid_[i];
+  CHECK_GT(cells_[level_offset + cell_idx], 0);
 
-    level(cy, cx) -= 1;
-    if (level(cy, cx) == 0) {
-      score_ -= level.size();
+  for (size_t level = 0; level < num_levels_; ++level) {
+    uint16_t& cell = cells_[level_offset + cell_idx];
+    cell -= 1;
+    if (cell != 0) {
+      break;
     }
 
-    cx = cx >> 1;
-    cy = cy >> 1;
+    score_ -= level_size;
+
+    level_size >>= 2;
+    level_offset -= level_size;
+    cell_idx >>= 2;
   }
 
   CHECK_LE(score_, max_score_);
 }
 
-void VisibilityPyramid::CellForPoint(const double x, const double y, size_t* cx,
-                                     size_t* cy) const {
-  CHECK_GT(width_, 0);
-  CHECK_GT(height_, 0);
-  const int max_dim = 1 << pyramid_.size();
-  *cx = Clip<size_t>(static_cast<size_t>(max_dim * x / width_), 0,
+void VisibilityPyramid::CellForPoint(const size_t num_levels,
+                                     const size_t width, const size_t height,
+                                     const double x, const double y,
+                                     size_t* cx, size_t* cy) {
+  CHECK_GT(width, 0);
+  CHECK_GT(height, 0);
+  const int max_dim = 1 << num_levels;
+  *cx = Clip<size_t>(static_cast<size_t>(max_dim * x / width), 0,
                      static_cast<size_t>(max_dim - 1));
-  *cy = Clip<size_t>(static_cast<size_t>(max_dim * y / height_), 0,
+  *cy = Clip<size_t>(static_cast<size_t>(max_dim * y / height), 0,
                      static_cast<size_t>(max_dim - 1));
 }
 
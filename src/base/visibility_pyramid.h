@@ -17,6 +17,7 @@
 #ifndef COLMAP_SRC_BASE_VISIBILITY_PYRAMID_H_
 #define COLMAP_SRC_BASE_VISIBILITY_PYRAMID_H_
 
+#include <cstdint>
 #include <vector>
 
 #include <Eigen/Core>
@@ -36,6 +37,13 @@ namespace colmap {
 // populated by at least one point and the contributed score is according
 // to its resolution in the pyramid. A cell in a higher resolution level
 // contributes a higher score to the overall score.
+//
+// The cells of all levels are stored in a single array of 16-bit counters,
+// level by level from the coarsest one and in Z-order within a level, such
+// that the parent of a cell is found by shifting its index. A cell of the
+// finest level counts its points and a cell of a coarser level counts its
+// populated children, so that an update stops at the first level, whose
+// cell does not change between empty and populated.
 class VisibilityPyramid {
  public:
   VisibilityPyramid();
@@ -45,6 +53,18 @@ class VisibilityPyramid {
   void SetPoint(const double x, const double y);
   void ResetPoint(const double x, const double y);
 
+  // Set or reset a point by its cell in the finest level, which can be kept
+  // instead of the point itself, see `CellForPoint`. At most 8 levels are
+  // supported.
+  void SetCell(const size_t cx, const size_t cy);
+  void ResetCell(const size_t cx, const size_t cy);
+
+  // The cell of a point in the finest level of a pyramid with the given number
+  // of levels and range of the input points.
+  static void CellForPoint(const size_t num_levels, const size_t width,
+                           const size_t height, const double x, const double y,
+                           size_t* cx, size_t* cy);
+
   inline size_t NumLevels() const;
   inline size_t Width() const;
   inline size_t Height() const;
@@ -53,28 +73,27 @@ class VisibilityPyramid {
   inline size_t MaxScore() const;
 
  private:
-  void CellForPoint(const double x, const double y, size_t* cx,
-                    size_t* cy) const;
-
   // Range of the input points.
   size_t width_;
   size_t height_;
 
+  size_t num_levels_;
+
   // The overall visibility score.
   size_t score_;
 
   // The maximum score when all cells are populated.
   size_t max_score_;
 
-  // The visibilty pyramid with multiple levels.
-  std::vector<Eigen::MatrixXi> pyramid_;
+  // The counters of the cells of all levels.
+  std::vector<uint16_t> cells_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
 
-size_t VisibilityPyramid::NumLevels() const { return pyramid_.size(); }
+size_t VisibilityPyramid::NumLevels() const { return num_levels_; }
 
 size_t VisibilityPyramid::Width() const { return width_; }
 
@@ -17,6 +17,9 @@
 #define TEST_NAME "base/visibility_pyramid"
 #include "util/testing.h"
 
+#include <algorithm>
+#include <random>
+
 #include "base/visibility_pyramid.h"
 
 using namespace colmap;
@@ -74,3 +77,67 @@ BOOST_AUTO_TEST_CASE(TestScore) {
         2 * scores.sum() + 2 * scores.tail(scores.size() - 1).sum());
   }
 }
+
+BOOST_AUTO_TEST_CASE(TestSetCell) {
+  VisibilityPyramid pyramid(3, 16, 8);
+  VisibilityPyramid cell_pyramid(3, 16, 8);
+  const std::vector<Eigen::Vector2d> points = {
+      {0, 0}, {15, 7}, {7.9, 3.9}, {8, 4}, {20, -1}};
+  for (const auto& point : points) {
+    size_t cx = 0;
+    size_t cy = 0;
+    VisibilityPyramid::CellForPoint(3, 16, 8, point.x(), point.y(), &cx, &cy);
+    BOOST_CHECK_LT(cx, 8);
+    BOOST_CHECK_LT(cy, 8);
+    pyramid.SetPoint(point.x(), point.y());
+    cell_pyramid.SetCell(cx, cy);
+    BOOST_CHECK_EQUAL(pyramid.Score(), cell_pyramid.Score());
+  }
+  for (const auto& point : points) {
+    size_t cx = 0;
+    size_t cy = 0;
+    VisibilityPyramid::CellForPoint(3, 16, 8, point.x(), point.y(), &cx, &cy);
+    pyramid.ResetPoint(point.x(), point.y());
+    cell_pyramid.ResetCell(cx, cy);
+    BOOST_CHECK_EQUAL(pyramid.Score(), cell_pyramid.Score());
+  }
+  BOOST_CHECK_EQUAL(cell_pyramid.Score(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestRandomCells) {
+  // Compare against the score of the populated cells of every level.
+  const size_t kNumLevels = 5;
+  const size_t kMaxDim = 1 << kNumLevels;
+  VisibilityPyramid pyramid(kNumLevels, kMaxDim, kMaxDim);
+  std::vector<int> counts(kMaxDim * kMaxDim, 0);
+  std::mt19937 prng(0);
+  std::uniform_int_distribution<size_t> cell_distribution(0, kMaxDim - 1);
+  for (int i = 0; i < 2000; ++i) {
+    const size_t cx = cell_distribution(prng);
+    const size_t cy = cell_distribution(prng);
+    if (counts[cy * kMaxDim + cx] > 0 && prng() % 2 == 0) {
+      pyramid.ResetCell(cx, cy);
+      counts[cy * kMaxDim + cx] -= 1;
+    } else {
+      pyramid.SetCell(cx, cy);
+      counts[cy * kMaxDim + cx] += 1;
+    }
+
+    size_t score = 0;
+    for (size_t level = 1; level <= kNumLevels; ++level) {
+      const size_t dim = size_t(1) << level;
+      const size_t shift = kNumLevels - level;
+      std::vector<bool> populated(dim * dim, false);
+      for (size_t y = 0; y < kMaxDim; ++y) {
+        for (size_t x = 0; x < kMaxDim; ++x) {
+          if (counts[y * kMaxDim + x] > 0) {
+            populated[(y >> shift) * dim + (x >> shift)] = true;
+          }
+        }
+      }
+      score += dim * dim *
+               std::count(populated.begin(), populated.end(), true);
+    }
+    BOOST_CHECK_EQUAL(pyramid.Score(), score);
+  }
+}
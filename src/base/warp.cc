@@ -16,6 +16,8 @@
 
 #include "base/warp.h"
 
+#include <cmath>
+
 #include "ext/VLFeat/imopv.h"
 #include "util/logging.h"
 
@@ -67,6 +69,114 @@ void WarpImageBetweenCameras(const Camera& source_camera,
   }
 }
 
+CameraWarpMap::CameraWarpMap()
+    : source_width_(0),
+      source_height_(0),
+      target_width_(0),
+      target_height_(0) {}
+
+CameraWarpMap::CameraWarpMap(const Camera& source_camera,
+                             const Camera& target_camera)
+    : source_width_(static_cast<int>(source_camera.Width())),
+      source_height_(static_cast<int>(source_camera.Height())),
+      target_width_(static_cast<int>(target_camera.Width())),
+      target_height_(static_cast<int>(target_camera.Height())) {
+  const size_t num_pixels =
+      static_cast<size_t>(target_width_) * static_cast<size_t>(target_height_);
+  source_cols_.resize(num_pixels, -1);
+  source_rows_.resize(num_pixels, -1);
+  col_weights_.resize(num_pixels, 0);
+  row_weights_.resize(num_pixels, 0);
+
+  const double kWeightScale = 1 << kWeightBits;
+
+  // Project the pixels of the target image row by row in one batch.
+  std::vector<Eigen::Vector2d> points(target_width_);
+  for (int y = 0; y < target_height_; ++y) {
+    // Camera models assume that the upper left pixel center is (0.5, 0.5).
+    for (int x = 0; x < target_width_; ++x) {
+      points[x] = Eigen::Vector2d(x + 0.5, y + 0.5);
+    }
+    target_camera.ImageToWorld(points, &points);
+    source_camera.WorldToImage(points, &points);
+
+    for (int x = 0; x < target_width_; ++x) {
+      const double source_x = points[x].x() - 0.5;
+      const double source_y = points[x].y() - 0.5;
+      if (!std::isfinite(source_x) || !std::isfinite(source_y)) {
+        continue;
+      }
+
+      // Select the same source pixels as `Bitmap::InterpolateBilinear`,
+      // which interpolates between scanlines counted from the bottom.
+      const double inv_source_y = source_height_ - 1 - source_y;
+      const double col0 = std::floor(source_x);
+      const double line0 = std::floor(inv_source_y);
+      if (col0 < 0 || col0 + 1 >= source_width_ || line0 < 0 ||
+          line0 + 1 >= source_height_) {
+        continue;
+      }
+
+      const size_t idx = static_cast<size_t>(y) * target_width_ + x;
+      source_cols_[idx] = static_cast<int>(col0);
+      source_rows_[idx] = source_height_ - 2 - static_cast<int>(line0);
+      col_weights_[idx] =
+          static_cast<uint16_t>(std::round((source_x - col0) * kWeightScale));
+      row_weights_[idx] = static_cast<uint16_t>(
+          std::round((1 - (inv_source_y - line0)) * kWeightScale));
+    }
+  }
+}
+
+void CameraWarpMap::Warp(const Bitmap& source_image,
+                         Bitmap* target_image) const {
+  CHECK_EQ(source_width_, source_image.Width());
+  CHECK_EQ(source_height_, source_image.Height());
+  CHECK_NOTNULL(target_image);
+
+  target_image->Allocate(target_width_, target_height_, source_image.IsRGB());
+
+  const int num_channels = source_image.IsRGB() ? 3 : 1;
+  const uint32_t kWeightScale = 1 << kWeightBits;
+  const uint32_t kRoundingOffset = 1 << (2 * kWeightBits - 1);
+
+  std::vector<const uint8_t*> source_lines(source_height_);
+  for (int y = 0; y < source_height_; ++y) {
+    source_lines[y] = source_image.GetScanline(y);
+  }
+
+  for (int y = 0; y < target_height_; ++y) {
+    uint8_t* target_line = target_image->GetScanline(y);
+    const size_t row_offset = static_cast<size_t>(y) * target_width_;
+    for (int x = 0; x < target_width_; ++x) {
+      const size_t idx = row_offset + x;
+      uint8_t* target_pixel = target_line + num_channels * x;
+      const int col = source_cols_[idx];
+      if (col < 0) {
+        for (int c = 0; c < num_channels; ++c) {
+          target_pixel[c] = 0;
+        }
+        continue;
+      }
+
+      const int row = source_rows_[idx];
+      const uint32_t wx = col_weights_[idx];
+      const uint32_t wy = row_weights_[idx];
+      const uint32_t wx_1 = kWeightScale - wx;
+      const uint32_t wy_1 = kWeightScale - wy;
+      const uint8_t* p00 = source_lines[row] + num_channels * col;
+      const uint8_t* p10 = source_lines[row + 1] + num_channels * col;
+      for (int c = 0; c < num_channels; ++c) {
+        const uint32_t v0 = wx_1 * p00[c] + wx * p00[c + num_channels];
+        const uint32_t v1 = wx_1 * p10[c] + wx * p10[c + num_channels];
+        target_pixel[c] =
+            static_cast<uint8_t>((wy_1 * v0 + wy * v1 + kRoundingOffset) >>
+                                 (2 * kWeightBits));
+      }
+    }
+  }
+}
+
 void WarpImageWithHomography(const Eigen::Matrix3d& H,
                              const Bitmap& source_image, Bitmap* target_image) {
   CHECK_NOTNULL(target_image);
@@ -17,6 +17,8 @@
 #ifndef COLMAP_SRC_BASE_WARP_H_
 #define COLMAP_SRC_BASE_WARP_H_
 
+#include <vector>
+
 #include "base/camera.h"
 #include "util/alignment.h"
 #include "util/bitmap.h"
@@ -30,6 +32,43 @@ void WarpImageBetweenCameras(const Camera& source_camera,
                              const Camera& target_camera,
                              const Bitmap& source_image, Bitmap* target_image);
 
+// Precomputed inverse mapping of `WarpImageBetweenCameras`. The mapping only
+// depends on the two cameras, so it can be computed once and then applied to
+// all images of the source camera. The bilinear interpolation weights are
+// stored in fixed-point, such that the warped intensities may differ by one
+// from the result of `WarpImageBetweenCameras`.
+class CameraWarpMap {
+ public:
+  CameraWarpMap();
+  CameraWarpMap(const Camera& source_camera, const Camera& target_camera);
+
+  inline int SourceWidth() const;
+  inline int SourceHeight() const;
+  inline int TargetWidth() const;
+  inline int TargetHeight() const;
+
+  // Warp source image to target image. The function allocates the target
+  // image, whose pixels without source are set to zero.
+  void Warp(const Bitmap& source_image, Bitmap* target_image) const;
+
+ private:
+  // Number of fractional bits of the interpolation weights.
+  static const int kWeightBits = 11;
+
+  int source_width_;
+  int source_height_;
+  int target_width_;
+  int target_height_;
+
+  // For every target pixel in row-major order, the column and row of the
+  // upper left source pixel, which are -1 for pixels without source, and the
+  // fixed-point weights of the right and lower source pixels.
+  std::vector<int> source_cols_;
+  std::vector<int> source_rows_;
+  std::vector<uint16_t> col_weights_;
+  std::vector<uint16_t> row_weights_;
+};
+
 // Warp an image with the given homography, where H defines the pixel mapping
 // from the target to source image. Note that the pixel centers are assumed to
 // have coordinates (0.5, 0.5).
@@ -60,6 +99,18 @@ void DownsampleImage(const float* data, const int rows, const int cols,
                      const int new_rows, const int new_cols,
                      float* downsampled);
 
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+int CameraWarpMap::SourceWidth() const { return source_width_; }
+
+int CameraWarpMap::SourceHeight() const { return source_height_; }
+
+int CameraWarpMap::TargetWidth() const { return target_width_; }
+
+int CameraWarpMap::TargetHeight() const { return target_height_; }
+
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_BASE_WARP_H_
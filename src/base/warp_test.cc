@@ -252,3 +252,49 @@ BOOST_AUTO_TEST_CASE(TestDownsampleImage) {
   BOOST_CHECK_CLOSE(downsampled[2], 10.3391361, 1e-3);
   BOOST_CHECK_CLOSE(downsampled[3], 12.2318935, 1e-3);
 }
+
+BOOST_AUTO_TEST_CASE(TestCameraWarpMap) {
+  Camera source_camera;
+  source_camera.InitializeWithName("SIMPLE_RADIAL", 80, 100, 80);
+  source_camera.Params(3) = 0.2;
+  Camera target_camera;
+  target_camera.InitializeWithName("PINHOLE", 70, 90, 70);
+
+  const CameraWarpMap warp_map(source_camera, target_camera);
+  BOOST_CHECK_EQUAL(warp_map.SourceWidth(), 100);
+  BOOST_CHECK_EQUAL(warp_map.SourceHeight(), 80);
+  BOOST_CHECK_EQUAL(warp_map.TargetWidth(), 90);
+  BOOST_CHECK_EQUAL(warp_map.TargetHeight(), 70);
+
+  for (const bool as_rgb : {false, true}) {
+    Bitmap source_image;
+    GenerateRandomBitmap(100, 80, as_rgb, &source_image);
+    Bitmap target_image;
+    WarpImageBetweenCameras(source_camera, target_camera, source_image,
+                            &target_image);
+    Bitmap mapped_target_image;
+    warp_map.Warp(source_image, &mapped_target_image);
+    BOOST_REQUIRE_EQUAL(mapped_target_image.IsRGB(), as_rgb);
+    BOOST_REQUIRE_EQUAL(mapped_target_image.Width(), 90);
+    BOOST_REQUIRE_EQUAL(mapped_target_image.Height(), 70);
+    for (int x = 0; x < target_image.Width(); ++x) {
+      for (int y = 0; y < target_image.Height(); ++y) {
+        BitmapColor<uint8_t> color;
+        BitmapColor<uint8_t> mapped_color;
+        BOOST_CHECK(target_image.GetPixel(x, y, &color));
+        BOOST_CHECK(mapped_target_image.GetPixel(x, y, &mapped_color));
+        BOOST_CHECK_LE(std::abs(color.r - mapped_color.r), 1);
+        BOOST_CHECK_LE(std::abs(color.g - mapped_color.g), 1);
+        BOOST_CHECK_LE(std::abs(color.b - mapped_color.b), 1);
+      }
+    }
+  }
+
+  Camera identical_camera = source_camera;
+  Bitmap source_image;
+  GenerateRandomBitmap(100, 80, true, &source_image);
+  Bitmap target_image;
+  CameraWarpMap(source_camera, identical_camera)
+      .Warp(source_image, &target_image);
+  CheckBitmapsEqual(source_image, target_image);
+}
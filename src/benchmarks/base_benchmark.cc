@@ -0,0 +1,90 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <benchmark/benchmark.h>
+
+#include "base/database_cache.h"
+#include "benchmarks/synthetic.h"
+
+namespace colmap {
+namespace {
+
+// Loading of a two-body scene with the number of images per take given as the
+// argument, where every image is matched with its 10 successors.
+void BM_DatabaseCacheLoad(benchmark::State& state) {
+  const SyntheticScene scene = GenerateSyntheticScene(
+      ScaledSyntheticSceneOptions(static_cast<int>(state.range(0))));
+  const SyntheticDatabase synthetic_database(scene);
+  Database database(synthetic_database.Path());
+
+  for (auto _ : state) {
+    DatabaseCache database_cache;
+    database_cache.Load(database, 15, false, {});
+    benchmark::DoNotOptimize(database_cache.NumImages());
+  }
+
+  state.counters["num_images"] = scene.images.size();
+}
+
+BENCHMARK(BM_DatabaseCacheLoad)
+    ->Arg(10)
+    ->Arg(25)
+    ->Arg(50)
+    ->Unit(benchmark::kMillisecond);
+
+// Transitive correspondences of all observations of the first image, with the
+// transitivity given as the argument.
+void BM_FindTransitiveCorrespondences(benchmark::State& state) {
+  const size_t transitivity = static_cast<size_t>(state.range(0));
+
+  const SyntheticScene scene =
+      GenerateSyntheticScene(ScaledSyntheticSceneOptions(20));
+  const SyntheticDatabase synthetic_database(scene);
+  DatabaseCache database_cache;
+  {
+    Database database(synthetic_database.Path());
+    database_cache.Load(database, 15, false, {});
+  }
+
+  const SceneGraph& scene_graph = database_cache.SceneGraph();
+  const image_t image_id = 1;
+  const point2D_t num_points2D = database_cache.Image(image_id).NumPoints2D();
+
+  SceneGraph::TransitiveScratch scratch;
+  std::vector<SceneGraph::Correspondence> corrs;
+  size_t num_corrs = 0;
+  for (auto _ : state) {
+    num_corrs = 0;
+    for (point2D_t point2D_idx = 0; point2D_idx < num_points2D;
+         ++point2D_idx) {
+      scene_graph.FindTransitiveCorrespondences(
+          image_id, point2D_idx, transitivity, &scratch, &corrs);
+      num_corrs += corrs.size();
+    }
+    benchmark::DoNotOptimize(num_corrs);
+  }
+
+  state.counters["num_corrs"] = num_corrs;
+}
+
+BENCHMARK(BM_FindTransitiveCorrespondences)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+}  // namespace colmap
@@ -0,0 +1,138 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <benchmark/benchmark.h>
+
+#include "benchmarks/synthetic.h"
+#include "estimators/essential_matrix.h"
+#include "estimators/pose.h"
+#include "estimators/utils.h"
+#include "util/random.h"
+#include "util/simd.h"
+
+namespace colmap {
+namespace {
+
+// Absolute pose estimation of 1000 correspondences, whose inlier ratio in
+// percent is the argument. The number of RANSAC trials grows with the inverse
+// cube of the inlier ratio.
+void BM_EstimateAbsolutePose(benchmark::State& state) {
+  const double inlier_ratio = state.range(0) / 100.0;
+
+  Camera camera;
+  Eigen::Vector4d qvec;
+  Eigen::Vector3d tvec;
+  std::vector<Eigen::Vector2d> points2D;
+  std::vector<Eigen::Vector3d> points3D;
+  GenerateSyntheticCorrespondences2D3D(1000, inlier_ratio, 0, &camera, &qvec,
+                                       &tvec, &points2D, &points3D);
+
+  AbsolutePoseEstimationOptions options;
+  options.ransac_options.max_error = 4.0;
+  options.ransac_options.min_inlier_ratio = 0.05;
+  options.ransac_options.confidence = 0.9999;
+
+  size_t num_inliers = 0;
+  for (auto _ : state) {
+    SetPRNGSeed(0);
+    Eigen::Vector4d estimated_qvec;
+    Eigen::Vector3d estimated_tvec;
+    std::vector<char> inlier_mask;
+    EstimateAbsolutePose(options, points2D, points3D, &estimated_qvec,
+                         &estimated_tvec, &camera, &num_inliers, &inlier_mask);
+    benchmark::DoNotOptimize(estimated_qvec);
+  }
+
+  state.counters["num_inliers"] = num_inliers;
+}
+
+BENCHMARK(BM_EstimateAbsolutePose)
+    ->Arg(10)
+    ->Arg(25)
+    ->Arg(50)
+    ->Unit(benchmark::kMillisecond);
+
+// Five-point essential matrix estimation from minimal samples, where the
+// fixed-size solver of `Estimate` is compared with the dynamically sized
+// solver of `EstimateNonMinimal`.
+void BM_EssentialMatrixFivePoint(benchmark::State& state) {
+  std::vector<std::vector<Eigen::Vector2d>> samples1;
+  std::vector<std::vector<Eigen::Vector2d>> samples2;
+  GenerateSyntheticFivePointSamples(1000, 0, &samples1, &samples2);
+
+  size_t num_models = 0;
+  size_t sample_idx = 0;
+  for (auto _ : state) {
+    const auto models = EssentialMatrixFivePointEstimator::Estimate(
+        samples1[sample_idx], samples2[sample_idx]);
+    num_models += models.size();
+    sample_idx = (sample_idx + 1) % samples1.size();
+    benchmark::DoNotOptimize(models.data());
+  }
+
+  state.counters["models_per_sample"] =
+      static_cast<double>(num_models) / state.iterations();
+}
+
+BENCHMARK(BM_EssentialMatrixFivePoint);
+
+void BM_EssentialMatrixFivePointNonMinimal(benchmark::State& state) {
+  std::vector<std::vector<Eigen::Vector2d>> samples1;
+  std::vector<std::vector<Eigen::Vector2d>> samples2;
+  GenerateSyntheticFivePointSamples(1000, 0, &samples1, &samples2);
+
+  size_t num_models = 0;
+  size_t sample_idx = 0;
+  for (auto _ : state) {
+    const auto models = EssentialMatrixFivePointEstimator::EstimateNonMinimal(
+        samples1[sample_idx], samples2[sample_idx]);
+    num_models += models.size();
+    sample_idx = (sample_idx + 1) % samples1.size();
+    benchmark::DoNotOptimize(models.data());
+  }
+
+  state.counters["models_per_sample"] =
+      static_cast<double>(num_models) / state.iterations();
+}
+
+BENCHMARK(BM_EssentialMatrixFivePointNonMinimal);
+
+// Sampson residuals of 4096 correspondences with the kernel selected by the
+// runtime dispatch, which can be lowered with COLMAP_SIMD_LEVEL.
+void BM_ComputeSquaredSampsonError(benchmark::State& state) {
+  SetPRNGSeed(0);
+  std::vector<Eigen::Vector2d> points1(4096);
+  std::vector<Eigen::Vector2d> points2(4096);
+  for (size_t i = 0; i < points1.size(); ++i) {
+    points1[i] = Eigen::Vector2d(RandomReal(-1.0, 1.0), RandomReal(-1.0, 1.0));
+    points2[i] = Eigen::Vector2d(RandomReal(-1.0, 1.0), RandomReal(-1.0, 1.0));
+  }
+  const Eigen::Matrix3d E = Eigen::Matrix3d::Random();
+
+  std::vector<double> residuals;
+  for (auto _ : state) {
+    ComputeSquaredSampsonError(points1, points2, E, &residuals);
+    benchmark::DoNotOptimize(residuals.data());
+  }
+
+  state.SetItemsProcessed(state.iterations() * points1.size());
+  state.SetLabel(SIMDLevelToString(GetSIMDLevel()));
+}
+
+BENCHMARK(BM_ComputeSquaredSampsonError);
+
+}  // namespace
+}  // namespace colmap
@@ -0,0 +1,54 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <benchmark/benchmark.h>
+
+#include "benchmarks/synthetic.h"
+#include "feature/sift.h"
+
+namespace colmap {
+namespace {
+
+// Exhaustive matching of two images with the number of features given as the
+// argument, of which half have a correspondence.
+void BM_MatchSiftFeaturesCPU(benchmark::State& state) {
+  const size_t num_features = static_cast<size_t>(state.range(0));
+
+  FeatureDescriptors descriptors1;
+  FeatureDescriptors descriptors2;
+  GenerateSyntheticSiftDescriptors(num_features, num_features,
+                                   num_features / 2, 0, &descriptors1,
+                                   &descriptors2);
+
+  SiftMatchingOptions options;
+
+  FeatureMatches matches;
+  for (auto _ : state) {
+    MatchSiftFeaturesCPU(options, descriptors1, descriptors2, &matches);
+    benchmark::DoNotOptimize(matches.data());
+  }
+
+  state.counters["num_matches"] = matches.size();
+}
+
+BENCHMARK(BM_MatchSiftFeaturesCPU)
+    ->Arg(1000)
+    ->Arg(4000)
+    ->Arg(8000)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace colmap
@@ -0,0 +1,182 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <random>
+
+#include <benchmark/benchmark.h>
+
+#include "base/database_cache.h"
+#include "base/reconstruction.h"
+#include "benchmarks/synthetic.h"
+#include "sfm/incremental_mapper.h"
+#include "util/kmeans.h"
+#include "util/symmetric_eigen.h"
+
+namespace colmap {
+namespace {
+
+// Registration of the first image of the second take, whose object has moved,
+// after the initial pair of the last images of the first take. The number of
+// images per take is the argument, so that the number of points grows with it.
+void BM_SeqRegisterImage(benchmark::State& state) {
+  const int num_images_per_take = static_cast<int>(state.range(0));
+  SyntheticSceneOptions scene_options =
+      ScaledSyntheticSceneOptions(num_images_per_take);
+  scene_options.num_overlapping_images = 5;
+  const SyntheticScene scene = GenerateSyntheticScene(scene_options);
+  const SyntheticDatabase synthetic_database(scene);
+  DatabaseCache database_cache;
+  {
+    Database database(synthetic_database.Path());
+    database_cache.Load(database, 15, false, {});
+  }
+
+  const image_t image_id1 = num_images_per_take - 3;
+  const image_t image_id2 = num_images_per_take;
+  const image_t image_id = num_images_per_take + 1;
+
+  IncrementalMapper::Options options;
+  IncrementalTriangulator::Options tri_options;
+
+  int num_poses = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    Reconstruction reconstruction;
+    IncrementalMapper mapper(&database_cache);
+    mapper.BeginReconstruction(&reconstruction);
+    if (!mapper.RegisterInitialImagePair(options, image_id1, image_id2)) {
+      state.SkipWithError("Initial image pair could not be registered");
+      break;
+    }
+    mapper.TriangulateImage(tri_options, image_id1);
+    mapper.TriangulateImage(tri_options, image_id2);
+    state.ResumeTiming();
+
+    num_poses = mapper.SeqRegisterImage(options, image_id);
+
+    state.PauseTiming();
+    mapper.EndReconstruction(true);
+    state.ResumeTiming();
+  }
+
+  state.counters["num_poses"] = num_poses;
+}
+
+BENCHMARK(BM_SeqRegisterImage)
+    ->Arg(10)
+    ->Arg(20)
+    ->Arg(40)
+    ->Unit(benchmark::kMillisecond);
+
+// Merging of the reconstructions of the takes, with the number of takes given
+// as the argument.
+void BM_MergeReconstructions(benchmark::State& state) {
+  SyntheticSceneOptions scene_options = ScaledSyntheticSceneOptions(10);
+  scene_options.num_takes = static_cast<int>(state.range(0));
+  const SyntheticScene scene = GenerateSyntheticScene(scene_options);
+  const SyntheticTakes takes = GenerateSyntheticTakes(scene, 0);
+
+  for (auto _ : state) {
+    const auto merged = merge_reconstructions(takes.points, takes.tracks,
+                                              takes.body_tracks, takes.order);
+    benchmark::DoNotOptimize(merged.first.first.points.data());
+  }
+}
+
+BENCHMARK(BM_MergeReconstructions)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->Unit(benchmark::kMillisecond);
+
+// Two-body bundle adjustment of the scene after perturbing its points and
+// cameras, with the number of images per take given as the argument.
+void BM_PerformBA(benchmark::State& state) {
+  const SyntheticScene scene = GenerateSyntheticScene(
+      ScaledSyntheticSceneOptions(static_cast<int>(state.range(0))));
+
+  std::mt19937 rng(0);
+  std::normal_distribution<double> noise_distribution(0, 0.01);
+  const auto Perturb = [&](Eigen::Vector3d* vector) {
+    *vector += Eigen::Vector3d(noise_distribution(rng), noise_distribution(rng),
+                               noise_distribution(rng));
+  };
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::pair<pnts_s, pnts_s> points = SyntheticScenePoints(scene);
+    std::vector<img_s> images = scene.images;
+    std::vector<trans_s> motions = scene.motions;
+    for (auto& point : points.first.points) {
+      Perturb(&point);
+    }
+    for (auto& point : points.second.points) {
+      Perturb(&point);
+    }
+    for (auto& image : images) {
+      Perturb(&image.c);
+    }
+    state.ResumeTiming();
+
+    perform_BA(points, images, motions, 1, 0);
+  }
+}
+
+BENCHMARK(BM_PerformBA)
+    ->Arg(10)
+    ->Arg(20)
+    ->Arg(40)
+    ->Unit(benchmark::kMillisecond);
+
+// Spectral clustering as in the grouping of the motions, i.e. the normalized
+// Laplacian of the pairwise distances, its smallest eigenvectors and k-means,
+// with the number of points given as the argument.
+void BM_SpectralClustering(benchmark::State& state) {
+  const int num_points = static_cast<int>(state.range(0));
+  const int num_clusters = 4;
+  const Eigen::MatrixXd points =
+      GenerateSyntheticClusters(num_points, 6, num_clusters, 0);
+
+  Eigen::MatrixXd distances(num_points, num_points);
+  for (int i = 0; i < num_points; ++i) {
+    for (int j = 0; j < num_points; ++j) {
+      distances(i, j) = (points.row(i) - points.row(j)).norm();
+    }
+  }
+
+  KMeansOptions kmeans_options;
+  kmeans_options.num_clusters = num_clusters;
+
+  for (auto _ : state) {
+    const Eigen::MatrixXd laplacian = dist2laplace(distances, num_points);
+    Eigen::VectorXd eigenvalues;
+    Eigen::MatrixXd eigenvectors;
+    SmallestSymmetricEigenvectors(laplacian, num_clusters, &eigenvalues,
+                                  &eigenvectors);
+    const KMeansPointsd embedding = eigenvectors;
+    const std::vector<int> labels = KMeans(kmeans_options, embedding);
+    benchmark::DoNotOptimize(labels.data());
+  }
+}
+
+BENCHMARK(BM_SpectralClustering)
+    ->Arg(100)
+    ->Arg(400)
+    ->Arg(1600)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace colmap
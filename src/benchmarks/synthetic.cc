@@ -0,0 +1,198 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "benchmarks/synthetic.h"
+
+#include <algorithm>
+#include <random>
+
+#include <boost/filesystem.hpp>
+#include <Eigen/Geometry>
+
+#include "base/pose.h"
+#include "util/logging.h"
+#include "util/math.h"
+
+namespace colmap {
+namespace {
+
+Eigen::Matrix3d RandomRotation(const double max_angle, std::mt19937* rng) {
+  std::uniform_real_distribution<double> angle_distribution(-max_angle,
+                                                            max_angle);
+  std::normal_distribution<double> axis_distribution;
+  Eigen::Vector3d axis(axis_distribution(*rng), axis_distribution(*rng),
+                       axis_distribution(*rng));
+  return Eigen::AngleAxisd(angle_distribution(*rng), axis.normalized())
+      .toRotationMatrix();
+}
+
+}  // namespace
+
+void GenerateSyntheticCorrespondences2D3D(
+    const size_t num_correspondences, const double inlier_ratio,
+    const unsigned int seed, Camera* camera, Eigen::Vector4d* qvec,
+    Eigen::Vector3d* tvec, std::vector<Eigen::Vector2d>* points2D,
+    std::vector<Eigen::Vector3d>* points3D) {
+  CHECK_GE(inlier_ratio, 0);
+  CHECK_LE(inlier_ratio, 1);
+
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> x_distribution(0, 1024);
+  std::uniform_real_distribution<double> y_distribution(0, 768);
+  std::uniform_real_distribution<double> depth_distribution(2, 10);
+  std::normal_distribution<double> noise_distribution(0, 0.5);
+
+  camera->InitializeWithName("SIMPLE_PINHOLE", 1000, 1024, 768);
+  const Eigen::Matrix3d R = RandomRotation(M_PI, &rng);
+  *qvec = RotationMatrixToQuaternion(R);
+  *tvec = Eigen::Vector3d(1, -2, 3);
+
+  points2D->clear();
+  points3D->clear();
+  const size_t num_inliers =
+      static_cast<size_t>(inlier_ratio * num_correspondences);
+  for (size_t i = 0; i < num_correspondences; ++i) {
+    const Eigen::Vector2d point2D(x_distribution(rng), y_distribution(rng));
+    const Eigen::Vector3d point_camera =
+        camera->ImageToWorld(point2D).homogeneous() * depth_distribution(rng);
+    points3D->push_back(R.transpose() * (point_camera - *tvec));
+    if (i < num_inliers) {
+      points2D->emplace_back(point2D.x() + noise_distribution(rng),
+                             point2D.y() + noise_distribution(rng));
+    } else {
+      points2D->emplace_back(x_distribution(rng), y_distribution(rng));
+    }
+  }
+
+  // Mix the inliers and outliers, as RANSAC may sample the first points first.
+  std::vector<size_t> order(num_correspondences);
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), rng);
+  std::vector<Eigen::Vector2d> shuffled_points2D(num_correspondences);
+  std::vector<Eigen::Vector3d> shuffled_points3D(num_correspondences);
+  for (size_t i = 0; i < order.size(); ++i) {
+    shuffled_points2D[i] = (*points2D)[order[i]];
+    shuffled_points3D[i] = (*points3D)[order[i]];
+  }
+  *points2D = std::move(shuffled_points2D);
+  *points3D = std::move(shuffled_points3D);
+}
+
+void GenerateSyntheticFivePointSamples(
+    const size_t num_samples, const unsigned int seed,
+    std::vector<std::vector<Eigen::Vector2d>>* samples1,
+    std::vector<std::vector<Eigen::Vector2d>>* samples2) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> xy_distribution(-1, 1);
+  std::uniform_real_distribution<double> depth_distribution(4, 8);
+  std::normal_distribution<double> tvec_distribution;
+
+  samples1->resize(num_samples);
+  samples2->resize(num_samples);
+  for (size_t i = 0; i < num_samples; ++i) {
+    const Eigen::Matrix3d R = RandomRotation(0.5, &rng);
+    const Eigen::Vector3d t =
+        Eigen::Vector3d(tvec_distribution(rng), tvec_distribution(rng),
+                        tvec_distribution(rng))
+            .normalized();
+    (*samples1)[i].resize(5);
+    (*samples2)[i].resize(5);
+    for (size_t j = 0; j < 5; ++j) {
+      const double depth = depth_distribution(rng);
+      const Eigen::Vector3d point3D(xy_distribution(rng) * depth,
+                                    xy_distribution(rng) * depth, depth);
+      (*samples1)[i][j] = point3D.hnormalized();
+      (*samples2)[i][j] = (R * point3D + t).hnormalized();
+    }
+  }
+}
+
+void GenerateSyntheticSiftDescriptors(const size_t num_descriptors1,
+                                      const size_t num_descriptors2,
+                                      const size_t num_matches,
+                                      const unsigned int seed,
+                                      FeatureDescriptors* descriptors1,
+                                      FeatureDescriptors* descriptors2) {
+  CHECK_LE(num_matches, num_descriptors1);
+  CHECK_LE(num_matches, num_descriptors2);
+
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> value_distribution(0, 1);
+  std::normal_distribution<float> noise_distribution(0, 0.02f);
+
+  Eigen::MatrixXf float_descriptors1(num_descriptors1, 128);
+  for (Eigen::MatrixXf::Index i = 0; i < float_descriptors1.size(); ++i) {
+    float_descriptors1(i) = value_distribution(rng);
+  }
+  Eigen::MatrixXf float_descriptors2(num_descriptors2, 128);
+  for (Eigen::MatrixXf::Index i = 0; i < float_descriptors2.rows(); ++i) {
+    for (Eigen::MatrixXf::Index j = 0; j < 128; ++j) {
+      if (static_cast<size_t>(i) < num_matches) {
+        float_descriptors2(i, j) = std::max(
+            0.0f, float_descriptors1(i, j) + noise_distribution(rng));
+      } else {
+        float_descriptors2(i, j) = value_distribution(rng);
+      }
+    }
+  }
+
+  *descriptors1 = FeatureDescriptorsToUnsignedByte(
+      L2NormalizeFeatureDescriptors(float_descriptors1));
+  *descriptors2 = FeatureDescriptorsToUnsignedByte(
+      L2NormalizeFeatureDescriptors(float_descriptors2));
+}
+
+Eigen::MatrixXd GenerateSyntheticClusters(const int num_points,
+                                          const int num_dims,
+                                          const int num_clusters,
+                                          const unsigned int seed) {
+  CHECK_GT(num_clusters, 0);
+
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> center_distribution(-10, 10);
+  std::normal_distribution<double> point_distribution;
+
+  Eigen::MatrixXd centers(num_clusters, num_dims);
+  for (Eigen::MatrixXd::Index i = 0; i < centers.size(); ++i) {
+    centers(i) = center_distribution(rng);
+  }
+
+  Eigen::MatrixXd points(num_points, num_dims);
+  for (int i = 0; i < num_points; ++i) {
+    for (int j = 0; j < num_dims; ++j) {
+      points(i, j) = centers(i % num_clusters, j) + point_distribution(rng);
+    }
+  }
+
+  return points;
+}
+
+SyntheticDatabase::SyntheticDatabase(const SyntheticScene& scene)
+    : path_((boost::filesystem::temp_directory_path() /
+             boost::filesystem::unique_path(
+                 "colmap_benchmark_%%%%%%%%.db"))
+                .string()) {
+  Database database(path_);
+  WriteSyntheticDatabase(scene, &database);
+}
+
+SyntheticDatabase::~SyntheticDatabase() { boost::filesystem::remove(path_); }
+
+const std::string& SyntheticDatabase::Path() const { return path_; }
+
+}  // namespace colmap
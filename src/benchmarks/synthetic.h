@@ -0,0 +1,80 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_BENCHMARKS_SYNTHETIC_H_
+#define COLMAP_SRC_BENCHMARKS_SYNTHETIC_H_
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "base/camera.h"
+#include "feature/types.h"
+#include "sfm/synthetic_scene.h"
+
+namespace colmap {
+
+// Deterministic synthetic data for the benchmarks besides the two-body scenes
+// of sfm/synthetic_scene.h. Every generator is seeded explicitly.
+
+// 2D-3D correspondences of a camera with the given fraction of inliers, whose
+// image points have Gaussian noise. The outliers are uniformly distributed in
+// the image.
+void GenerateSyntheticCorrespondences2D3D(
+    const size_t num_correspondences, const double inlier_ratio,
+    const unsigned int seed, Camera* camera, Eigen::Vector4d* qvec,
+    Eigen::Vector3d* tvec, std::vector<Eigen::Vector2d>* points2D,
+    std::vector<Eigen::Vector3d>* points3D);
+
+// Minimal samples of 5 noise-free normalized correspondences of two views of
+// a general scene, where every sample has a random relative pose.
+void GenerateSyntheticFivePointSamples(
+    const size_t num_samples, const unsigned int seed,
+    std::vector<std::vector<Eigen::Vector2d>>* samples1,
+    std::vector<std::vector<Eigen::Vector2d>>* samples2);
+
+// SIFT descriptors of two images, where the first `num_matches` descriptors of
+// the second image are noisy copies of descriptors of the first image.
+void GenerateSyntheticSiftDescriptors(const size_t num_descriptors1,
+                                      const size_t num_descriptors2,
+                                      const size_t num_matches,
+                                      const unsigned int seed,
+                                      FeatureDescriptors* descriptors1,
+                                      FeatureDescriptors* descriptors2);
+
+// Points drawn from `num_clusters` isotropic Gaussians with unit standard
+// deviation, whose centers are uniformly distributed in a cube.
+Eigen::MatrixXd GenerateSyntheticClusters(const int num_points,
+                                          const int num_dims,
+                                          const int num_clusters,
+                                          const unsigned int seed);
+
+// Temporary database of a synthetic scene, which is removed on destruction.
+class SyntheticDatabase {
+ public:
+  explicit SyntheticDatabase(const SyntheticScene& scene);
+  ~SyntheticDatabase();
+
+  const std::string& Path() const;
+
+ private:
+  std::string path_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_BENCHMARKS_SYNTHETIC_H_
@@ -0,0 +1,47 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <benchmark/benchmark.h>
+
+#include "benchmarks/synthetic.h"
+#include "util/kmeans.h"
+
+namespace colmap {
+namespace {
+
+// Clustering of 3D points into 8 clusters, with the number of points given as
+// the argument.
+void BM_KMeans(benchmark::State& state) {
+  const KMeansPointsd points =
+      GenerateSyntheticClusters(static_cast<int>(state.range(0)), 3, 8, 0);
+
+  KMeansOptions options;
+  options.num_clusters = 8;
+
+  for (auto _ : state) {
+    const std::vector<int> labels = KMeans(options, points);
+    benchmark::DoNotOptimize(labels.data());
+  }
+}
+
+BENCHMARK(BM_KMeans)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Arg(100000)
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace colmap
@@ -16,6 +16,11 @@
 
 #include "controllers/automatic_reconstruction.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
 #include "base/undistortion.h"
 #include "controllers/incremental_mapper.h"
 #include "feature/extraction.h"
@@ -30,9 +35,7 @@ namespace colmap {
 
 AutomaticReconstructionController::AutomaticReconstructionController(
     const Options& options, ReconstructionManager* reconstruction_manager)
-    : options_(options),
-      reconstruction_manager_(reconstruction_manager),
-      active_thread_(nullptr) {
+    : options_(options), reconstruction_manager_(reconstruction_manager) {
   CHECK(ExistsDir(options_.workspace_path));
   CHECK(ExistsDir(options_.image_path));
   CHECK_NOTNULL(reconstruction_manager_);
@@ -110,24 +113,52 @@ AutomaticReconstructionController::AutomaticReconstructionController(
 }
 
 void AutomaticReconstructionController::Stop() {
-  if (active_thread_ != nullptr) {
-    active_thread_->Stop();
+  {
+    std::unique_lock<std::mutex> lock(active_threads_mutex_);
+    for (auto thread : active_threads_) {
+      thread->Stop();
+    }
   }
   Thread::Stop();
 }
 
-void AutomaticReconstructionController::Run() {
+void AutomaticReconstructionController::RunActiveThread(Thread* thread) {
+  {
+    std::unique_lock<std::mutex> lock(active_threads_mutex_);
+    active_threads_.push_back(thread);
+  }
+
+  thread->Start();
   if (IsStopped()) {
-    return;
+    thread->Stop();
   }
+  thread->Wait();
 
-  RunFeatureExtraction();
+  std::unique_lock<std::mutex> lock(active_threads_mutex_);
+  active_threads_.erase(
+      std::find(active_threads_.begin(), active_threads_.end(), thread));
+}
 
+void AutomaticReconstructionController::Run() {
   if (IsStopped()) {
     return;
   }
 
-  RunFeatureMatching();
+  // All pairs of a subset of the images are also matched by the exhaustive
+  // matching of all images, so that it can already start during the
+  // extraction without changing the matched pairs.
+  if (options_.pipelined && options_.data_type != DataType::VIDEO &&
+      options_.vocab_tree_path.empty()) {
+    RunPipelinedFeatureExtractionAndMatching();
+  } else {
+    RunFeatureExtraction();
+
+    if (IsStopped()) {
+      return;
+    }
+
+    RunFeatureMatching();
+  }
 
   if (IsStopped()) {
     return;
@@ -148,11 +179,48 @@ void AutomaticReconstructionController::Run() {
 
 void AutomaticReconstructionController::RunFeatureExtraction() {
   CHECK(feature_extractor_);
-  active_thread_ = feature_extractor_.get();
-  feature_extractor_->Start();
-  feature_extractor_->Wait();
+  RunActiveThread(feature_extractor_.get());
+  feature_extractor_.reset();
+}
+
+void AutomaticReconstructionController::
+    RunPipelinedFeatureExtractionAndMatching() {
+  CHECK(feature_extractor_);
+
+  std::thread extraction_thread(
+      [this]() { RunActiveThread(feature_extractor_.get()); });
+
+  // The images are written to the database together with their features, and
+  // the exhaustive matcher skips the pairs that were matched in earlier rounds.
+  const size_t block_size =
+      static_cast<size_t>(option_manager_.exhaustive_matching->block_size);
+  Database database(*option_manager_.database_path);
+  size_t num_matched_images = 0;
+  while (!IsStopped()) {
+    const bool extraction_finished = feature_extractor_->IsFinished();
+    const size_t num_images = database.NumImages();
+    if (num_images >= num_matched_images + block_size ||
+        (extraction_finished && num_images > num_matched_images)) {
+      std::cout << StringPrintf("Matching %d extracted images", num_images)
+                << std::endl;
+      ExhaustiveFeatureMatcher matcher(*option_manager_.exhaustive_matching,
+                                       *option_manager_.sift_matching,
+                                       *option_manager_.database_path);
+      RunActiveThread(&matcher);
+      num_matched_images = num_images;
+    } else if (extraction_finished) {
+      break;
+    } else {
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+  }
+
+  extraction_thread.join();
+
   feature_extractor_.reset();
-  active_thread_ = nullptr;
+  exhaustive_matcher_.reset();
+  sequential_matcher_.reset();
+  vocab_tree_matcher_.reset();
 }
 
 void AutomaticReconstructionController::RunFeatureMatching() {
@@ -171,13 +239,10 @@ void AutomaticReconstructionController::RunFeatureMatching() {
   }
 
   CHECK(matcher);
-  active_thread_ = matcher;
-  matcher->Start();
-  matcher->Wait();
+  RunActiveThread(matcher);
   exhaustive_matcher_.reset();
   sequential_matcher_.reset();
   vocab_tree_matcher_.reset();
-  active_thread_ = nullptr;
 }
 
 void AutomaticReconstructionController::RunSparseMapper() {
@@ -200,10 +265,7 @@ void AutomaticReconstructionController::RunSparseMapper() {
   IncrementalMapperController mapper(
       option_manager_.mapper.get(), *option_manager_.image_path,
       *option_manager_.database_path, reconstruction_manager_);
-  active_thread_ = &mapper;
-  mapper.Start();
-  mapper.Wait();
-  active_thread_ = nullptr;
+  RunActiveThread(&mapper);
 
   CreateDirIfNotExists(sparse_path);
   reconstruction_manager_->Write(sparse_path, &option_manager_);
@@ -220,17 +282,22 @@ void AutomaticReconstructionController::RunDenseMapper() {
 
   CreateDirIfNotExists(JoinPaths(options_.workspace_path, "dense"));
 
+  // The fusion and meshing run on the CPU, while the stereo of the next model
+  // mainly runs on the GPU, so that they overlap in the pipelined mode.
+  std::unique_ptr<ThreadPool> postprocessing_thread_pool;
+  if (options_.pipelined) {
+    postprocessing_thread_pool.reset(new ThreadPool(1));
+  }
+
   for (size_t i = 0; i < reconstruction_manager_->Size(); ++i) {
     if (IsStopped()) {
-      return;
+      break;
     }
 
     const std::string dense_path =
         JoinPaths(options_.workspace_path, "dense", std::to_string(i));
-    const std::string fused_path = JoinPaths(dense_path, "fused.ply");
-    const std::string meshed_path = JoinPaths(dense_path, "meshed.ply");
-
-    if (ExistsFile(fused_path) && ExistsFile(meshed_path)) {
+    if (ExistsFile(JoinPaths(dense_path, "fused.ply")) &&
+        ExistsFile(JoinPaths(dense_path, "meshed.ply"))) {
       continue;
     }
 
@@ -245,14 +312,11 @@ void AutomaticReconstructionController::RunDenseMapper() {
       COLMAPUndistorter undistorter(undistortion_options,
                                     reconstruction_manager_->Get(i),
                                     *option_manager_.image_path, dense_path);
-      active_thread_ = &undistorter;
-      undistorter.Start();
-      undistorter.Wait();
-      active_thread_ = nullptr;
+      RunActiveThread(&undistorter);
     }
 
     if (IsStopped()) {
-      return;
+      break;
     }
 
     // Dense stereo
@@ -260,45 +324,70 @@ void AutomaticReconstructionController::RunDenseMapper() {
     {
       mvs::PatchMatchController patch_match_controller(
           *option_manager_.dense_stereo, dense_path, "COLMAP", "");
-      active_thread_ = &patch_match_controller;
-      patch_match_controller.Start();
-      patch_match_controller.Wait();
-      active_thread_ = nullptr;
+      RunActiveThread(&patch_match_controller);
     }
 
     if (IsStopped()) {
-      return;
+      break;
     }
 
-    // Dense fusion
-
-    if (!ExistsFile(fused_path)) {
-      auto fusion_options = *option_manager_.dense_fusion;
-      const int num_reg_images = reconstruction_manager_->Get(i).NumRegImages();
-      fusion_options.min_num_pixels =
-          std::min(num_reg_images + 1, fusion_options.min_num_pixels);
-      mvs::StereoFusion fuser(
-          fusion_options, dense_path, "COLMAP", "",
-          options_.quality == Quality::HIGH ? "geometric" : "photometric");
-      active_thread_ = &fuser;
-      fuser.Start();
-      fuser.Wait();
-      active_thread_ = nullptr;
-
-      std::cout << "Writing output: " << fused_path << std::endl;
-      WriteBinaryPly(fused_path, fuser.GetFusedPoints());
+    if (postprocessing_thread_pool) {
+      postprocessing_thread_pool->AddTask(
+          &AutomaticReconstructionController::RunDenseFusionAndMeshing, this,
+          i, dense_path);
+    } else {
+      RunDenseFusionAndMeshing(i, dense_path);
     }
+  }
+
+  if (postprocessing_thread_pool) {
+    postprocessing_thread_pool->Wait();
+  }
+}
+
+void AutomaticReconstructionController::RunDenseFusionAndMeshing(
+    const size_t reconstruction_idx, const std::string& dense_path) {
+  const std::string fused_path = JoinPaths(dense_path, "fused.ply");
+  const std::string meshed_path = JoinPaths(dense_path, "meshed.ply");
+
+  if (IsStopped()) {
+    return;
+  }
+
+  // Dense fusion
+
+  if (!ExistsFile(fused_path)) {
+    auto fusion_options = *option_manager_.dense_fusion;
+    const int num_reg_images =
+        reconstruction_manager_->Get(reconstruction_idx).NumRegImages();
+    fusion_options.min_num_pixels =
+        std::min(num_reg_images + 1, fusion_options.min_num_pixels);
+    // The points are streamed to a temporary file, so that an interrupted
+    // fusion is not mistaken for a finished one.
+    const std::string fused_tmp_path = fused_path + ".tmp";
+    mvs::StereoFusion fuser(
+        fusion_options, dense_path, "COLMAP", "",
+        options_.quality == Quality::HIGH ? "geometric" : "photometric",
+        fused_tmp_path);
+    RunActiveThread(&fuser);
 
     if (IsStopped()) {
       return;
     }
 
-    // Dense meshing
+    CHECK_EQ(std::rename(fused_tmp_path.c_str(), fused_path.c_str()), 0)
+        << fused_path;
+  }
 
-    if (!ExistsFile(meshed_path)) {
-      mvs::PoissonReconstruction(*option_manager_.dense_meshing, fused_path,
-                                 meshed_path);
-    }
+  if (IsStopped()) {
+    return;
+  }
+
+  // Dense meshing
+
+  if (!ExistsFile(meshed_path)) {
+    mvs::PoissonReconstruction(*option_manager_.dense_meshing, fused_path,
+                               meshed_path);
   }
 }
 
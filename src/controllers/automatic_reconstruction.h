@@ -17,7 +17,9 @@
 #ifndef COLMAP_SRC_CONTROLLERS_AUTOMATIC_RECONSTRUCTION_H_
 #define COLMAP_SRC_CONTROLLERS_AUTOMATIC_RECONSTRUCTION_H_
 
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "base/reconstruction_manager.h"
 #include "util/option_manager.h"
@@ -72,6 +74,12 @@ class AutomaticReconstructionController : public Thread {
     // you should separate multiple GPU indices by comma, e.g., "0,1,2,3".
     // By default, all GPUs will be used in all stages.
     std::string gpu_index = "-1";
+
+    // Whether to overlap consecutive stages. The exhaustive matching of the
+    // extracted images then starts whenever the features of another block of
+    // images exist, and the fusion and meshing of a dense model run while the
+    // next model is undistorted and densely matched.
+    bool pipelined = false;
   };
 
   AutomaticReconstructionController(
@@ -82,14 +90,21 @@ class AutomaticReconstructionController : public Thread {
  private:
   void Run() override;
   void RunFeatureExtraction();
+  void RunPipelinedFeatureExtractionAndMatching();
   void RunFeatureMatching();
   void RunSparseMapper();
   void RunDenseMapper();
+  void RunDenseFusionAndMeshing(const size_t reconstruction_idx,
+                                const std::string& dense_path);
+
+  // Run the thread until it finishes, while it is stopped with the controller.
+  void RunActiveThread(Thread* thread);
 
   const Options options_;
   OptionManager option_manager_;
   ReconstructionManager* reconstruction_manager_;
-  Thread* active_thread_;
+  std::mutex active_threads_mutex_;
+  std::vector<Thread*> active_threads_;
   std::unique_ptr<Thread> feature_extractor_;
   std::unique_ptr<Thread> exhaustive_matcher_;
   std::unique_ptr<Thread> sequential_matcher_;
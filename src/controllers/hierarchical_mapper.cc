@@ -17,6 +17,7 @@
 #include "controllers/hierarchical_mapper.h"
 
 #include "base/scene_clustering.h"
+#include "base/take_bundle.h"
 #include "util/misc.h"
 
 namespace colmap {
@@ -98,6 +99,10 @@ HierarchicalMapperController::HierarchicalMapperController(
   CHECK_EQ(clustering_options_.branching, 2);
 }
 
+const TakeBundle& HierarchicalMapperController::GetTakeBundle() const {
+  return take_bundle_;
+}
+
 void HierarchicalMapperController::Run() {
   PrintHeading1("Partitioning the scene");
 
@@ -112,16 +117,42 @@ void HierarchicalMapperController::Run() {
   {
     Database database(options_.database_path);
 
+    // Only the images of the anchor take are partitioned.
+    const std::unordered_map<std::string, int> take_map =
+        ReadTakeMap("takes.txt");
+
     std::cout << "Reading images..." << std::endl;
     const auto images = database.ReadAllImages();
     for (const auto& image : images) {
-      image_id_to_name.emplace(image.ImageId(), image.Name());
+      const auto take = take_map.find(image.Name());
+      if (take != take_map.end() &&
+          take->second == mapper_options_.anchor_take &&
+          (mapper_options_.image_names.empty() ||
+           mapper_options_.image_names.count(image.Name()) > 0)) {
+        image_id_to_name.emplace(image.ImageId(), image.Name());
+      }
     }
 
+    std::cout << StringPrintf("  Anchor take %d with %d images",
+                              mapper_options_.anchor_take,
+                              image_id_to_name.size())
+              << std::endl;
+
     std::cout << "Reading scene graph..." << std::endl;
     std::vector<std::pair<image_t, image_t>> image_pairs;
     std::vector<int> num_inliers;
-    database.ReadInlierMatchesGraph(&image_pairs, &num_inliers);
+    {
+      std::vector<std::pair<image_t, image_t>> all_image_pairs;
+      std::vector<int> all_num_inliers;
+      database.ReadInlierMatchesGraph(&all_image_pairs, &all_num_inliers);
+      for (size_t i = 0; i < all_image_pairs.size(); ++i) {
+        if (image_id_to_name.count(all_image_pairs[i].first) > 0 &&
+            image_id_to_name.count(all_image_pairs[i].second) > 0) {
+          image_pairs.push_back(all_image_pairs[i]);
+          num_inliers.push_back(all_num_inliers[i]);
+        }
+      }
+    }
 
     std::cout << "Partitioning scene graph..." << std::endl;
     scene_clustering.Partition(image_pairs, num_inliers);
@@ -170,6 +201,7 @@ void HierarchicalMapperController::Run() {
     custom_options.max_model_overlap = 3;
     custom_options.init_num_trials = options_.init_num_trials;
     custom_options.num_threads = num_threads_per_worker;
+    custom_options.register_other_takes = false;
 
     for (const auto image_id : cluster.image_ids) {
       custom_options.image_names.insert(image_id_to_name.at(image_id));
@@ -211,7 +243,50 @@ void HierarchicalMapperController::Run() {
   MergeClusters(*scene_clustering.GetRootCluster(), &reconstruction_managers);
 
   CHECK_EQ(reconstruction_managers.size(), 1);
-  *reconstruction_manager_ = std::move(reconstruction_managers.begin()->second);
+  ReconstructionManager& merged_reconstruction_manager =
+      reconstruction_managers.begin()->second;
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Register other takes
+  //////////////////////////////////////////////////////////////////////////////
+
+  if (merged_reconstruction_manager.Size() == 0) {
+    *reconstruction_manager_ = std::move(merged_reconstruction_manager);
+    std::cout << std::endl;
+    GetTimer().PrintMinutes();
+    return;
+  }
+
+  PrintHeading1("Registering other takes");
+
+  // The other takes are registered against the largest merged reconstruction,
+  // the remaining ones are kept as they are.
+  size_t largest_idx = 0;
+  for (size_t i = 1; i < merged_reconstruction_manager.Size(); ++i) {
+    if (merged_reconstruction_manager.Get(i).NumRegImages() >
+        merged_reconstruction_manager.Get(largest_idx).NumRegImages()) {
+      largest_idx = i;
+    }
+  }
+
+  ReconstructionManager take_reconstruction_manager;
+  take_reconstruction_manager.Get(take_reconstruction_manager.Add()) =
+      merged_reconstruction_manager.Get(largest_idx);
+
+  IncrementalMapperController mapper(&mapper_options_, options_.image_path,
+                                     options_.database_path,
+                                     &take_reconstruction_manager);
+  mapper.Start();
+  mapper.Wait();
+  take_bundle_ = mapper.GetTakeBundle();
+
+  *reconstruction_manager_ = std::move(take_reconstruction_manager);
+  for (size_t i = 0; i < merged_reconstruction_manager.Size(); ++i) {
+    if (i != largest_idx) {
+      reconstruction_manager_->Get(reconstruction_manager_->Add()) =
+          merged_reconstruction_manager.Get(i);
+    }
+  }
 
   std::cout << std::endl;
   GetTimer().PrintMinutes();
@@ -29,6 +29,14 @@ namespace colmap {
 // mapping, and finally merges them all into a globally consistent
 // reconstruction. This is especially useful for larger-scale scenes, since
 // incremental mapping becomes slow with an increasing number of images.
+//
+// Only the images of the anchor take are partitioned, since the static
+// background must be reconstructed before the other takes can be registered.
+// The clusters are reconstructed without registering the other takes and,
+// after merging, the images of the other takes are sequentially registered
+// against the largest merged reconstruction, with their phantom images and
+// the camera log and take bundle of the anchor take as in
+// IncrementalMapperController.
 class HierarchicalMapperController : public Thread {
  public:
   struct Options {
@@ -53,6 +61,10 @@ class HierarchicalMapperController : public Thread {
       const IncrementalMapperOptions& mapper_options,
       ReconstructionManager* reconstruction_manager);
 
+  // Cameras, observations and points of the reconstructed take, which are
+  // available after the controller finished.
+  const TakeBundle& GetTakeBundle() const;
+
  private:
   void Run() override;
 
@@ -60,6 +72,7 @@ class HierarchicalMapperController : public Thread {
   const SceneClustering::Options clustering_options_;
   const IncrementalMapperOptions mapper_options_;
   ReconstructionManager* reconstruction_manager_;
+  TakeBundle take_bundle_;
 };
 
 }  // namespace colmap
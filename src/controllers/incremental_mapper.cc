@@ -16,8 +16,18 @@
 
 #include "controllers/incremental_mapper.h"
 
+#include <boost/filesystem.hpp>
+
+#include "base/reconstruction_writer.h"
+#include "base/take_bundle.h"
+#include "sfm/track_builder.h"
+#include "util/logging.h"
+#include "util/metrics.h"
 #include "util/misc.h"
+#include "util/resource_accounting.h"
+#include "util/trace.h"
 #include <fstream>
+#include <map>
 #include <unordered_set>
 #include <unordered_map>
 #include <utility>
@@ -28,6 +38,12 @@
 namespace colmap {
 namespace {
 
+// Name of a resource accounting stage of the take that is reconstructed.
+std::string TakeStageName(const IncrementalMapperOptions& options,
+                          const std::string& phase) {
+  return StringPrintf("take%d/%s", options.anchor_take, phase.c_str());
+}
+
 size_t TriangulateImage(const IncrementalMapperOptions& options,
                         const Image& image, IncrementalMapper* mapper) {
   std::cout << "  => Continued observations: " << image.NumPoints3D()
@@ -39,7 +55,9 @@ size_t TriangulateImage(const IncrementalMapperOptions& options,
 }
 
 void AdjustGlobalBundle(const IncrementalMapperOptions& options,
-                        IncrementalMapper* mapper) {
+                        IncrementalMapper* mapper, const bool full = false,
+                        const bool reuse_problem = false) {
+  ResourceScope resource_scope(TakeStageName(options, "bundle_adjustment"));
   BundleAdjustmentOptions custom_options = options.GlobalBundleAdjustment();
 
   const size_t num_reg_images = mapper->GetReconstruction().NumRegImages();
@@ -60,18 +78,28 @@ void AdjustGlobalBundle(const IncrementalMapperOptions& options,
                                           mapper->GetReconstruction())) {
     mapper->AdjustParallelGlobalBundle(
         custom_options, options.ParallelGlobalBundleAdjustment());
+  } else if (options.ba_global_subsample_points && !full &&
+             num_reg_images >= kMinNumRegImages) {
+    mapper->AdjustSubsampledGlobalBundle(custom_options,
+                                         options.ba_global_subsample_grid_size);
+  } else if (options.ba_global_incremental || reuse_problem) {
+    mapper->AdjustIncrementalGlobalBundle(custom_options);
   } else {
     mapper->AdjustGlobalBundle(custom_options);
   }
 }
 
 void IterativeLocalRefinement(const IncrementalMapperOptions& options,
-                              const image_t image_id,
+                              const std::vector<image_t>& image_ids,
                               IncrementalMapper* mapper) {
+  TRACE_SCOPE("IterativeLocalRefinement");
+  ResourceScope resource_scope(TakeStageName(options, "bundle_adjustment"));
   auto ba_options = options.LocalBundleAdjustment();
+  auto mapper_options = options.Mapper();
+  mapper_options.local_ba_reuse_problem = options.ba_refinement_reuse_problem;
   for (int i = 0; i < options.ba_local_max_refinements; ++i) {
-    const auto report = mapper->AdjustLocalBundle(
-        options.Mapper(), ba_options, options.Triangulation(), image_id,
+    const auto report = mapper->AdjustLocalBundles(
+        mapper_options, ba_options, options.Triangulation(), image_ids,
         mapper->GetModifiedPoints3D());
     std::cout << "  => Merged observations: " << report.num_merged_observations
               << std::endl;
@@ -92,11 +120,15 @@ void IterativeLocalRefinement(const IncrementalMapperOptions& options,
     ba_options.loss_function_type =
         BundleAdjustmentOptions::LossFunctionType::TRIVIAL;
   }
+  mapper->ResetLocalBundleAdjusters();
   mapper->ClearModifiedPoints3D();
 }
 
 void IterativeGlobalRefinement(const IncrementalMapperOptions& options,
-                               IncrementalMapper* mapper) {
+                               IncrementalMapper* mapper,
+                               const bool full = false) {
+  TRACE_SCOPE("IterativeGlobalRefinement");
+  ResourceScope resource_scope(TakeStageName(options, "bundle_adjustment"));
   PrintHeading1("Retriangulation");
   CompleteAndMergeTracks(options, mapper);
   std::cout << "  => Retriangulated observations: "
@@ -106,9 +138,13 @@ void IterativeGlobalRefinement(const IncrementalMapperOptions& options,
     const size_t num_observations =
         mapper->GetReconstruction().ComputeNumObservations();
     size_t num_changed_observations = 0;
-    AdjustGlobalBundle(options, mapper);
+    AdjustGlobalBundle(options, mapper, full,
+                       options.ba_refinement_reuse_problem);
     num_changed_observations += CompleteAndMergeTracks(options, mapper);
-    num_changed_observations += FilterPoints(options, mapper);
+    // After the first iteration, the points were filtered before the bundle
+    // adjustment, so that only the changed ones are filtered again.
+    num_changed_observations += i == 0 ? FilterPoints(options, mapper)
+                                       : FilterChangedPoints(options, mapper);
     const double changed =
         static_cast<double>(num_changed_observations) / num_observations;
     std::cout << StringPrintf("  => Changed observations: %.6f", changed)
@@ -118,11 +154,17 @@ void IterativeGlobalRefinement(const IncrementalMapperOptions& options,
     }
   }
 
+  // The problem is only kept beyond the refinement in the incremental mode.
+  if (options.ba_refinement_reuse_problem && !options.ba_global_incremental) {
+    mapper->ResetIncrementalGlobalBundle();
+  }
+
   FilterImages(options, mapper);
 }
 
 void ExtractColors(const std::string& image_path, const image_t image_id,
                    Reconstruction* reconstruction) {
+  TRACE_SCOPE("ExtractColors");
   if (!reconstruction->ExtractColorsForImage(image_id, image_path)) {
     std::cout << StringPrintf("WARNING: Could not read image %s at path %s.",
                               reconstruction->Image(image_id).Name().c_str(),
@@ -131,8 +173,13 @@ void ExtractColors(const std::string& image_path, const image_t image_id,
   }
 }
 
+// Queue a copy of the reconstruction to be written to a new snapshot folder
+// in the background. A snapshot that is still pending when the next one is
+// created is replaced by it.
 void WriteSnapshot(const Reconstruction& reconstruction,
-                   const std::string& snapshot_path) {
+                   const std::string& snapshot_path,
+                   AsyncReconstructionWriter* snapshot_writer) {
+  TRACE_SCOPE("WriteSnapshot");
   PrintHeading1("Creating snapshot");
   // Get the current timestamp in milliseconds.
   const size_t timestamp =
@@ -142,9 +189,33 @@ void WriteSnapshot(const Reconstruction& reconstruction,
   // Write reconstruction to unique path with current timestamp.
   const std::string path =
       JoinPaths(snapshot_path, StringPrintf("%010d", timestamp));
-  CreateDirIfNotExists(path);
   std::cout << "  => Writing to " << path << std::endl;
-  reconstruction.Write(path);
+  snapshot_writer->Write("snapshot", reconstruction,
+                         [path](const Reconstruction& snapshot) {
+                           CreateDirIfNotExists(path);
+                           snapshot.Write(path);
+                         });
+}
+
+TakeCamera CreateTakeCamera(const image_t image_id, const int take,
+                            const int anchor, const Eigen::Vector4d& qvec,
+                            const Eigen::Vector3d& tvec, const Camera& camera,
+                            const int num_inliers,
+                            const image_t pose_image_id) {
+  TakeCamera take_camera;
+  take_camera.image_id = image_id;
+  take_camera.take = take;
+  take_camera.anchor = anchor;
+  take_camera.qvec = qvec;
+  take_camera.tvec = tvec;
+  take_camera.width = camera.Width();
+  take_camera.height = camera.Height();
+  take_camera.focal_length = camera.FocalLength();
+  take_camera.principal_point_x = camera.PrincipalPointX();
+  take_camera.principal_point_y = camera.PrincipalPointY();
+  take_camera.num_inliers = num_inliers;
+  take_camera.pose_image_id = pose_image_id;
+  return take_camera;
 }
 
 }  // namespace
@@ -158,6 +229,15 @@ size_t FilterPoints(const IncrementalMapperOptions& options,
   return num_filtered_observations;
 }
 
+size_t FilterChangedPoints(const IncrementalMapperOptions& options,
+                           IncrementalMapper* mapper) {
+  const size_t num_filtered_observations =
+      mapper->FilterChangedPoints(options.Mapper());
+  std::cout << "  => Filtered observations: " << num_filtered_observations
+            << std::endl;
+  return num_filtered_observations;
+}
+
 size_t FilterImages(const IncrementalMapperOptions& options,
                     IncrementalMapper* mapper) {
   const size_t num_filtered_images = mapper->FilterImages(options.Mapper());
@@ -167,6 +247,7 @@ size_t FilterImages(const IncrementalMapperOptions& options,
 
 size_t CompleteAndMergeTracks(const IncrementalMapperOptions& options,
                               IncrementalMapper* mapper) {
+  TRACE_SCOPE("CompleteAndMergeTracks");
   const size_t num_completed_observations =
       mapper->CompleteTracks(options.Triangulation());
   std::cout << "  => Merged observations: " << num_completed_observations
@@ -195,6 +276,7 @@ IncrementalTriangulator::Options IncrementalMapperOptions::Triangulation()
   options.min_focal_length_ratio = min_focal_length_ratio;
   options.max_focal_length_ratio = max_focal_length_ratio;
   options.max_extra_param = max_extra_param;
+  options.num_threads = num_threads;
   return options;
 }
 
@@ -213,6 +295,7 @@ BundleAdjustmentOptions IncrementalMapperOptions::LocalBundleAdjustment()
   options.refine_focal_length = ba_refine_focal_length;
   options.refine_principal_point = ba_refine_principal_point;
   options.refine_extra_params = ba_refine_extra_params;
+  options.use_mixed_precision_solver = ba_mixed_precision;
   options.loss_function_scale = 1.0;
   options.loss_function_type =
       BundleAdjustmentOptions::LossFunctionType::CAUCHY;
@@ -234,6 +317,7 @@ BundleAdjustmentOptions IncrementalMapperOptions::GlobalBundleAdjustment()
   options.refine_focal_length = ba_refine_focal_length;
   options.refine_principal_point = ba_refine_principal_point;
   options.refine_extra_params = ba_refine_extra_params;
+  options.use_mixed_precision_solver = ba_mixed_precision;
   options.loss_function_type =
       BundleAdjustmentOptions::LossFunctionType::TRIVIAL;
   return options;
@@ -249,6 +333,17 @@ IncrementalMapperOptions::ParallelGlobalBundleAdjustment() const {
   return options;
 }
 
+TentativeMotionFilter::Options IncrementalMapperOptions::TentativeMotions()
+    const {
+  TentativeMotionFilter::Options options;
+  options.identity_thr1 = tentative_motion_identity_thr1;
+  options.identity_thr2 = tentative_motion_identity_thr2;
+  options.num_estimates = tentative_motion_num_estimates;
+  options.max_rotation_error = tentative_motion_max_rotation_error;
+  options.max_translation_error = tentative_motion_max_translation_error;
+  return options;
+}
+
 bool IncrementalMapperOptions::Check() const {
   CHECK_OPTION_GT(min_num_matches, 0);
   CHECK_OPTION_GT(max_num_models, 0);
@@ -260,6 +355,7 @@ bool IncrementalMapperOptions::Check() const {
   CHECK_OPTION_GE(max_extra_param, 0);
   CHECK_OPTION_GE(ba_local_num_images, 2);
   CHECK_OPTION_GE(ba_local_max_num_iterations, 0);
+  CHECK_OPTION_GT(ba_global_subsample_grid_size, 0);
   CHECK_OPTION_GT(ba_global_images_ratio, 1.0);
   CHECK_OPTION_GT(ba_global_points_ratio, 1.0);
   CHECK_OPTION_GT(ba_global_images_freq, 0);
@@ -270,8 +366,12 @@ bool IncrementalMapperOptions::Check() const {
   CHECK_OPTION_GT(ba_global_max_refinements, 0);
   CHECK_OPTION_GE(ba_global_max_refinement_change, 0);
   CHECK_OPTION_GE(snapshot_images_freq, 0);
+  CHECK_OPTION_GT(anchor_take, 0);
+  CHECK_OPTION_GE(new_take, 0);
+  CHECK_OPTION_NE(new_take, anchor_take);
   CHECK_OPTION(Mapper().Check());
   CHECK_OPTION(Triangulation().Check());
+  CHECK_OPTION(TentativeMotions().Check());
   return true;
 }
 
@@ -282,18 +382,94 @@ IncrementalMapperController::IncrementalMapperController(
     : options_(options),
       image_path_(image_path),
       database_path_(database_path),
-      reconstruction_manager_(reconstruction_manager) {
+      reconstruction_manager_(reconstruction_manager),
+      database_cache_(nullptr),
+      init_pair_cache_(&owned_init_pair_cache_) {
+  CHECK(options_->Check());
+  RegisterCallback(INITIAL_IMAGE_PAIR_REG_CALLBACK);
+  RegisterCallback(NEXT_IMAGE_REG_CALLBACK);
+  RegisterCallback(LAST_IMAGE_REG_CALLBACK);
+}
+
+IncrementalMapperController::IncrementalMapperController(
+    const IncrementalMapperOptions* options, const std::string& image_path,
+    const DatabaseCache* database_cache,
+    ReconstructionManager* reconstruction_manager)
+    : options_(options),
+      image_path_(image_path),
+      reconstruction_manager_(reconstruction_manager),
+      database_cache_(CHECK_NOTNULL(database_cache)),
+      init_pair_cache_(&owned_init_pair_cache_) {
   CHECK(options_->Check());
   RegisterCallback(INITIAL_IMAGE_PAIR_REG_CALLBACK);
   RegisterCallback(NEXT_IMAGE_REG_CALLBACK);
   RegisterCallback(LAST_IMAGE_REG_CALLBACK);
 }
 
+bool IncrementalMapperController::LoadDatabaseCache(
+    const IncrementalMapperOptions& options, const std::string& database_path,
+    DatabaseCache* database_cache) {
+  TRACE_SCOPE("IncrementalMapperController::LoadDatabaseCache");
+  ResourceScope resource_scope("load_database");
+  PrintHeading1("Loading database");
+
+  Database database(database_path);
+  Timer timer;
+  timer.Start();
+  const size_t min_num_matches = static_cast<size_t>(options.min_num_matches);
+  database_cache->Load(database, min_num_matches, options.ignore_watermarks,
+                       options.image_names);
+  // Every cache spills to its own file, also when several processes share
+  // the out-of-core folder.
+  if (!options.out_of_core_path.empty() && database_cache->NumImages() > 0) {
+    CreateDirIfNotExists(options.out_of_core_path);
+    database_cache->SpillPoints2D(JoinPaths(
+        options.out_of_core_path,
+        boost::filesystem::unique_path("points2D_%%%%%%%%%%%%.bin").string()));
+  }
+  std::cout << std::endl;
+  timer.PrintMinutes();
+
+  std::cout << std::endl;
+
+  if (database_cache->NumImages() == 0) {
+    std::cout << "WARNING: No images with matches found in the database."
+              << std::endl
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+const TakeBundle& IncrementalMapperController::GetTakeBundle() const {
+  return take_bundle_;
+}
+
+void IncrementalMapperController::SetInitialPairCache(
+    InitialPairCache* init_pair_cache) {
+  init_pair_cache_ = CHECK_NOTNULL(init_pair_cache);
+}
+
 void IncrementalMapperController::Run() {
-  if (!LoadDatabase()) {
+  if (database_cache_ == nullptr) {
+    if (!LoadDatabase()) {
+      return;
+    }
+  } else if (database_cache_->NumImages() == 0) {
+    std::cout << "WARNING: No images with matches found in the database."
+              << std::endl
+              << std::endl;
     return;
   }
 
+  // The relaxation rounds below reuse the geometries of the first round, only
+  // the thresholds that are applied to them change.
+  const bool owns_init_pair_cache = init_pair_cache_ == &owned_init_pair_cache_;
+  if (owns_init_pair_cache && !options_->init_pair_cache_path.empty()) {
+    owned_init_pair_cache_.Read(options_->init_pair_cache_path);
+  }
+
   IncrementalMapper::Options init_mapper_options = options_->Mapper();
   Reconstruct(init_mapper_options);
 
@@ -316,43 +492,39 @@ void IncrementalMapperController::Run() {
     Reconstruct(init_mapper_options);
   }
 
+  if (owns_init_pair_cache && !options_->init_pair_cache_path.empty()) {
+    owned_init_pair_cache_.Write(options_->init_pair_cache_path);
+  }
+
   std::cout << std::endl;
   GetTimer().PrintMinutes();
 }
 
 bool IncrementalMapperController::LoadDatabase() {
-  PrintHeading1("Loading database");
-
-  Database database(database_path_);
-  Timer timer;
-  timer.Start();
-  const size_t min_num_matches = static_cast<size_t>(options_->min_num_matches);
-  database_cache_.Load(database, min_num_matches, options_->ignore_watermarks,
-                       options_->image_names);
-  std::cout << std::endl;
-  timer.PrintMinutes();
-
-  std::cout << std::endl;
-
-  if (database_cache_.NumImages() == 0) {
-    std::cout << "WARNING: No images with matches found in the database."
-              << std::endl
-              << std::endl;
+  if (!LoadDatabaseCache(*options_, database_path_, &owned_database_cache_)) {
     return false;
   }
-
+  database_cache_ = &owned_database_cache_;
   return true;
 }
 
 void IncrementalMapperController::Reconstruct(
     const IncrementalMapper::Options& init_mapper_options) {
+  TRACE_SCOPE("IncrementalMapperController::Reconstruct");
+  // The bundle adjustment and the export of the take bundle are accounted in
+  // their own stages, everything else of the take counts as registration.
+  ResourceScope resource_scope(TakeStageName(*options_, "registration"));
   const bool kDiscardReconstruction = true;
 
   //////////////////////////////////////////////////////////////////////////////
   // Main loop
   //////////////////////////////////////////////////////////////////////////////
 
-  IncrementalMapper mapper(&database_cache_);
+  IncrementalMapper mapper(database_cache_);
+  mapper.SetInitialPairCache(init_pair_cache_);
+
+  // Written in the background, the pending snapshots are finished on return.
+  AsyncReconstructionWriter snapshot_writer;
 
   // Is there a sub-model before we start the reconstruction? I.e. the user
   // has imported an existing reconstruction.
@@ -381,93 +553,46 @@ void IncrementalMapperController::Reconstruct(
     mapper.BeginReconstruction(&reconstruction);
 
     //find out which set to reconstruct
-	int recon_set = 1;
-	std::ifstream pivot;
-	pivot.open("pivot.txt");
-	pivot >> recon_set;
-	pivot.close();
+	const int recon_set = options_->anchor_take;
 	std::cout << "ANCHOR TAKE " << recon_set << "\n";
 	std::unordered_set<image_t> main_set;
 	std::unordered_set<image_t> rest_images;
 
     size_t imgs = reconstruction.NumImages();
-    std::cerr << imgs << "\n";
-    //scene graph saved in reconstruction or in database
-    //HERE
-    const SceneGraph scene_graph = database_cache_.SceneGraph();
-    //SceneGraph scene_graph = database_cache_.SG();
-    /*std::cout << "finding tracks\n";
-    std::vector<std::unordered_set<point2D_t>> hash(imgs);
-    std::vector<std::vector<SceneGraph::Correspondence>> tracks;
-    for(size_t i=1;i<imgs;i++)
-    {
-    	//std::cerr << i << "\n";
-    	Image cur_img = reconstruction.Image(i);
-    	point2D_t points = cur_img.NumPoints2D();
-		//std::cerr << i << " " << points << "\n";
-		for(point2D_t j=0;j<points;j++)
-		{
-			if(hash[i-1].count(j)) continue;
-			//std::vector<SceneGraph::Correspondence> track = scene_graph.FindTransitiveCorrespondences(i, j, imgs);
-			std::vector<SceneGraph::Correspondence> track = scene_graph.FindTransitiveCorrespondences(i, j, 1);
-			if(!track.size()) continue;
-			track.emplace_back(i, j);
-			for(SceneGraph::Correspondence corr:track)
-			{
-				hash[corr.image_id-1].insert(corr.point2D_idx);
-				//std::cerr << corr.image_id << " " << corr.point2D_idx << " ";
-			}
-			tracks.push_back(track);
-		}
-    }
-    //write out total number of created tracks
-    std::ofstream file;
-    file.open(JoinPaths(std::to_string(recon_set),"tracks.txt"));
-    file << imgs << "\n";
-    file << tracks.size() << "\n";
-    for(std::vector<SceneGraph::Correspondence> track : tracks)
-    {
-    	for(SceneGraph::Correspondence corr : track)
-    	{
-    		Point2D p = reconstruction.Image(corr.image_id).Point2D(corr.point2D_idx);
-    		//file << corr.image_id << " " << corr.point2D_idx << " ";
-    		file << corr.image_id << " " << p.X() << " " << p.Y() << " ";
-    	}
-    	file << "-1\n";
-    }
-    file.close();
-    //return;
-
-    std::cout << "tracks found\n";*/
-
-    //get ids of images which belong to the first set according to the included file
-	std::unordered_set<std::string> fs;
-	std::ifstream fset;
-	fset.open("takes.txt");
-	std::string name;
-	int cur_id;
-	std::unordered_map<std::string,int> take_map;
-	//std::
-	while(fset >> name)
+    VLOG(3) << imgs;
+	//write the feature tracks of all images, which are built from the scene
+	//graph of the database and do not change between the trials
+	if(options_->write_tracks && num_trials == 0)
 	{
-		fset >> cur_id;
-		//fs.insert(name);
-		//std::cout << "NAME " << name << " " << cur_id << "\n";
-		//take_map.insert(std::make_pair<std::string,int>(name,cur_id));
-		take_map.insert({name, cur_id});
+		ResourceScope tracks_scope(TakeStageName(*options_, "write_tracks"));
+		std::vector<image_t> image_ids;
+		image_ids.reserve(database_cache_->NumImages());
+		for(const auto& image : database_cache_->Images())
+			image_ids.push_back(image.first);
+		const std::vector<Track> tracks = BuildTracks(database_cache_->SceneGraph(), image_ids, options_->num_threads);
+		std::cout << "TRACKS " << tracks.size() << "\n";
+		WriteTracksBinary(JoinPaths(std::to_string(recon_set), kTracksFileName), tracks);
 	}
-	fset.close();
 
+    //get ids of images which belong to the first set according to the included file
+	std::unordered_map<std::string, int> take_map = ReadTakeMap("takes.txt");
+
+	//the images that are not sequentially registered, i.e. the anchor take and,
+	//if only a new take is registered, all other takes
+	std::unordered_set<image_t> seq_skip_set;
 	for (const auto& image : reconstruction.Images())
 	{
 		//std::cout << "ID " << image.first << " " << image.second.Name() << " " << (take_map[image.second.Name()]==recon_set) << "\n";
 		if((take_map[image.second.Name()]==recon_set))
 		{
 			main_set.insert(image.first);
+			seq_skip_set.insert(image.first);
 		}
 		else
 		{
 			rest_images.insert(image.first);
+			if(options_->new_take > 0 && take_map[image.second.Name()] != options_->new_take)
+				seq_skip_set.insert(image.first);
 		}
 	}
 	//return;
@@ -490,7 +615,7 @@ void IncrementalMapperController::Reconstruct(
 		}f
 	}*/
 
-	std::cout << "init pair registration\n";
+	VLOG(3) << "init pair registration";
 	
 
 	
@@ -574,7 +699,8 @@ void IncrementalMapperController::Reconstruct(
     size_t ba_prev_num_reg_images = reconstruction.NumRegImages();
     size_t ba_prev_num_points = reconstruction.NumPoints3D();
 
-    bool reg_next_success = true;
+    //the imported anchor take is kept as it is when a new take is registered
+    bool reg_next_success = options_->new_take == 0;
     bool prev_reg_next_success = true;
 
     //incremental mapping loop
@@ -613,7 +739,7 @@ void IncrementalMapperController::Reconstruct(
         if (reg_next_success) {
           //next_image.SetGroup(0);
           TriangulateImage(*options_, next_image, &mapper);
-          IterativeLocalRefinement(*options_, next_image_id, &mapper);
+          IterativeLocalRefinement(*options_, {next_image_id}, &mapper);
 
           if (reconstruction.NumRegImages() >=
                   options_->ba_global_images_ratio * ba_prev_num_reg_images ||
@@ -637,10 +763,13 @@ void IncrementalMapperController::Reconstruct(
                   options_->snapshot_images_freq +
                       snapshot_prev_num_reg_images) {
             snapshot_prev_num_reg_images = reconstruction.NumRegImages();
-            WriteSnapshot(reconstruction, options_->snapshot_path);
+            WriteSnapshot(reconstruction, options_->snapshot_path,
+                          &snapshot_writer);
           }
 
           Callback(NEXT_IMAGE_REG_CALLBACK);
+          SetMetricGauge(TakeStageName(*options_, "num_reg_images"),
+                         reconstruction.NumRegImages());
 
           break;
         } else {
@@ -687,194 +816,298 @@ void IncrementalMapperController::Reconstruct(
     if (reconstruction.NumRegImages() >= 2 &&
         reconstruction.NumRegImages() != ba_prev_num_reg_images &&
         reconstruction.NumPoints3D() != ba_prev_num_points) {
-      IterativeGlobalRefinement(*options_, &mapper);
+      // The final refinement always adjusts all points.
+      const bool kFullGlobalBundle = true;
+      IterativeGlobalRefinement(*options_, &mapper, kFullGlobalBundle);
     }
 
-    std::ofstream ph_out;
-    ph_out.open(JoinPaths(std::to_string(recon_set/*num_trials*/),"phantom.txt"));
-    std::ofstream real_out;
-    real_out.open(JoinPaths(std::to_string(recon_set/*num_trials*/),"real.txt"));
-    std::ofstream camera_log;
-    camera_log.open(JoinPaths(std::to_string(recon_set/*num_trials*/),"cams.txt"));
-
-	Camera mc = Camera();
-	camera_t mc_id = reconstruction.NumCameras()+1;
-	mc.SetCameraId(mc_id);
-	std::vector<double> flengths;
-    //print out the first set of cameras
-    bool cam_found = false;
-    for(const auto& image : reconstruction.Images())
-	{
-		//check whether i-th image is in the second set
-		int i = image.first;
-		Image cur_img = reconstruction.Image(i);
-		if(!cur_img.IsRegistered()) continue;
-		Camera cam = reconstruction.Camera(cur_img.CameraId());
-		Eigen::Vector4d q = cur_img.Qvec();
-		Eigen::Vector3d t = cur_img.Tvec();
-		camera_log << i << " " << recon_set << " " << recon_set /**//* << " " << num_trials /**/ << " " << q(0) << " " << q(1) << " " << q(2) << " " << q(3) << " "
-				<< t(0) << " " << t(1) << " " << t(2) << " " << cam.Width() << " " << cam.Height() << " " << cam.FocalLength() << " "
-				<< cam.PrincipalPointX() << " " << cam.PrincipalPointY() << " -1 " << i << "\n";
-		flengths.push_back(cam.FocalLength());
-		if(!cam_found)
+    // The clusters of the hierarchical mapper only reconstruct the anchor take,
+    // the other takes are registered once against their merged reconstruction.
+    if (options_->register_other_takes)
+    {
+      const std::string take_path = std::to_string(recon_set/*num_trials*/);
+      //a new take is registered against this model later on
+      const bool extend_take = options_->new_take > 0;
+      if(options_->write_anchor_model && !extend_take)
+      {
+        ResourceScope anchor_scope(TakeStageName(*options_, "write_anchor_model"));
+        const std::string anchor_path = JoinPaths(take_path, kTakeAnchorModelDirName);
+        CreateDirIfNotExists(take_path);
+        CreateDirIfNotExists(anchor_path);
+        reconstruction.WriteBinary(anchor_path);
+      }
+
+      //the cameras and images of the other takes that were registered before,
+      //the phantom images of the new take get identifiers after theirs
+      TakeBundle prev_bundle;
+      bool has_prev_bundle = false;
+      image_t next_phantom_id = reconstruction.NumImages()+1;
+      //the object motion of every body in every take, shared by its phantom images in bundle adjustment
+      std::map<std::pair<int, size_t>, int> motion_idxs;
+      if(extend_take)
+      {
+        has_prev_bundle = ReadTakeBundle(JoinPaths(take_path, kTakeBundleFileName), &prev_bundle);
+        if(!has_prev_bundle)
+        {
+          prev_bundle = TakeBundle();
+          ReadTakeCameraLog(JoinPaths(take_path, kTakeCameraLogFileName), &prev_bundle.cameras);
+        }
+        for(const TakeImage& image : prev_bundle.images)
+          next_phantom_id = std::max(next_phantom_id, image.image_id+1);
+        for(const TakeCamera& camera : prev_bundle.cameras)
+          next_phantom_id = std::max(next_phantom_id, camera.pose_image_id+1);
+      }
+
+      //the camera log is buffered in binary and flushed after every round of
+      //registrations, the text files are only written for debugging
+      TakeCameraLogWriter camera_log(JoinPaths(take_path, kTakeCameraLogFileName), extend_take);
+      std::ofstream ph_out;
+      std::ofstream real_out;
+      std::ofstream camera_log_text;
+      if(options_->write_camera_log_text)
+      {
+        const std::ios::openmode mode = extend_take ? std::ios::app : std::ios::trunc;
+        ph_out.open(JoinPaths(take_path, "phantom.txt"), mode);
+        real_out.open(JoinPaths(take_path, "real.txt"), mode);
+        camera_log_text.open(JoinPaths(take_path, "cams.txt"), mode);
+      }
+      //the same camera log is also stored in the binary take bundle
+      std::vector<TakeCamera> take_cameras;
+      auto log_camera = [&](const TakeCamera& c)
+      {
+        take_cameras.push_back(c);
+        camera_log.Write(c);
+        if(options_->write_camera_log_text)
+        {
+          camera_log_text << c.image_id << " " << c.take << " " << c.anchor << " " << c.qvec(0) << " " << c.qvec(1) << " " << c.qvec(2) << " " << c.qvec(3) << " "
+            << c.tvec(0) << " " << c.tvec(1) << " " << c.tvec(2) << " " << c.width << " " << c.height << " " << c.focal_length << " "
+            << c.principal_point_x << " " << c.principal_point_y << " " << c.num_inliers << " " << c.pose_image_id << "\n";
+        }
+      };
+
+		Camera mc = Camera();
+		camera_t mc_id = reconstruction.NumCameras()+1;
+		mc.SetCameraId(mc_id);
+		std::vector<double> flengths;
+      //print out the first set of cameras
+      bool cam_found = false;
+      for(const auto& image : reconstruction.Images())
 		{
-			cam_found = true;
-			int m = cam.ModelId();
-			std::cout << m << "\n";
-			mc.SetModelId(cam.ModelId());
-			mc.SetWidth(cam.Width());
-			mc.SetHeight(cam.Height());
-			mc.SetPrincipalPointX(cam.PrincipalPointX());
-			mc.SetPrincipalPointY(cam.PrincipalPointY());
+			//check whether i-th image is in the second set
+			int i = image.first;
+			Image cur_img = reconstruction.Image(i);
+			if(!cur_img.IsRegistered()) continue;
+			Camera cam = reconstruction.Camera(cur_img.CameraId());
+			Eigen::Vector4d q = cur_img.Qvec();
+			Eigen::Vector3d t = cur_img.Tvec();
+			//the cameras of the anchor take are already in the log of an extended take
+			if(!extend_take)
+				log_camera(CreateTakeCamera(i, recon_set, recon_set, q, t, cam, -1, i));
+			flengths.push_back(cam.FocalLength());
+			if(!cam_found)
+			{
+				cam_found = true;
+				int m = cam.ModelId();
+				VLOG(3) << m;
+				mc.SetModelId(cam.ModelId());
+				mc.SetWidth(cam.Width());
+				mc.SetHeight(cam.Height());
+				mc.SetPrincipalPointX(cam.PrincipalPointX());
+				mc.SetPrincipalPointY(cam.PrincipalPointY());
+			}
 		}
-	}
-	std::sort(flengths.begin(), flengths.end());
-	mc.SetFocalLength(flengths[flengths.size()/2]);
-	reconstruction.AddCamera(mc);
-	std::cout << "Median camera created\n";
-
-    //here the first set is reconstructed and bundle adjusted
-    //we can start to find poses of the second set cameras
-    EPNPEstimator residualCheck;
-	reg_next_success = true;
-	while(reg_next_success)
-	{
-		std::cout << "Sequential registration\n";
-		//find possible next images, omit those which have already been reconstructed although they have not been trully reconstructed, only their two possible poses have been found
-		//next images will have to be from the original images, not from the newly added ones (maybe they will be added after this procedure)
-		reg_next_success = false;
-		const std::vector<image_t> next_images = mapper.FindNextImagesSecondSet(options_->Mapper(), main_set);
-		std::cout << next_images.size() << " images" << "\n";
-		std::vector<image_t> good_images;
-		std::vector<std::vector<image_t>> images_1;
-		std::vector<std::vector<image_t>> images_2;
-		for(size_t i=0;i<next_images.size();++i)
+		std::sort(flengths.begin(), flengths.end());
+		mc.SetFocalLength(flengths[flengths.size()/2]);
+		reconstruction.AddCamera(mc);
+		VLOG(3) << "Median camera created";
+
+      //here the first set is reconstructed and bundle adjusted
+      //we can start to find poses of the second set cameras
+      EPNPEstimator residualCheck;
+      //the motions of the additional poses are filtered before their phantom
+      //images are created, most of the rejected ones would be removed by the
+      //postprocessor anyway
+      std::unique_ptr<TentativeMotionFilter> motion_filter;
+      if(options_->filter_tentative_motions)
+        motion_filter.reset(new TentativeMotionFilter(options_->TentativeMotions(), ComputeSceneScale(reconstruction)));
+		reg_next_success = true;
+		while(reg_next_success)
 		{
-			//here will be the whole registration process
-			const image_t next_image_id = next_images[i];
-			//const Image& next_image = reconstruction.Image(next_image_id);
-
-			PrintHeading1(StringPrintf("Sequentially registering image #%d (%d)", next_image_id, reconstruction.NumRegImages() + 1));
-			std::cout << mc_id << "\n";
-			//int found_poses = mapper.SeqRegisterImage2(options_->Mapper(), next_image_id,mc_id);
-			int found_poses = 0;
+			VLOG(3) << "Sequential registration";
+			//find possible next images, omit those which have already been reconstructed although they have not been trully reconstructed, only their two possible poses have been found
+			//next images will have to be from the original images, not from the newly added ones (maybe they will be added after this procedure)
+			reg_next_success = false;
+			const std::vector<image_t> next_images = mapper.FindNextImagesSecondSet(options_->Mapper(), seq_skip_set);
+			VLOG(3) << next_images.size() << " images";
+			std::vector<image_t> good_images;
+			std::vector<image_t> batch_image_ids;
+			std::vector<std::vector<image_t>> images_1;
+			std::vector<std::vector<image_t>> images_2;
+			//the candidates do not depend on each other until their poses are
+			//committed, so they are estimated together
+			PrintHeading1(StringPrintf("Sequentially registering %d images (%d)", next_images.size(), reconstruction.NumRegImages()));
+			std::vector<int> found_poses(next_images.size(), 0);
 			try
 			{
-				found_poses = mapper.SeqRegisterImage(options_->Mapper(), next_image_id);
-				//throw 20;
+				found_poses = mapper.SeqRegisterImages(options_->Mapper(), next_images);
 			}
 			catch(const int e)
 			{
 				std::cout << "ERROR\n";
-				//throw 20;
 			}
-			catch(std::bad_function_call& e)
+			for(size_t i=0;i<next_images.size();++i)
 			{
-				std::cout << "ERROR 2\n";
+				VLOG(3) << "SEQ REG RESULT " << next_images[i] << ": " << found_poses[i];
+				//TODO
+				//this is experimental
+				if(found_poses[i] >= 2)
+					good_images.push_back(next_images[i]);
 			}
-			std::cout << "SEQ REG RESULT: " << found_poses << "\n";
-			//TODO
-			//this is experimental
-			if(found_poses >= 2)
-				good_images.push_back(next_image_id);
-			
-		}
+			std::cout << StringPrintf("  => Images with multiple poses: %d / %d", good_images.size(), next_images.size()) << "\n";
 		
-		for(image_t img : good_images)
-		{
-			//prepare for adding new images
-			Image& next_image = reconstruction.Image(img);
-			std::vector<class Point2D> points_orig = next_image.Points2D();
-			//copy vector of 2D points and add the copy to the phantom image (if there are more phantoms, make more copies)
-			std::vector<class Point2D> points_copy;
-			for(Point2D pnt : points_orig)
+			for(image_t img : good_images)
 			{
-				points_copy.push_back(pnt);
-			}
-			Camera cam = reconstruction.Camera(next_image.CameraId());
+				//prepare for adding new images, the points of the image may have been
+				//released since it was prepared
+				mapper.PageInImage(options_->Mapper(), img);
+				Image& next_image = reconstruction.Image(img);
+				//2D points of the image before it gets its 3D points, the phantom images are created from them
+				const std::vector<class Point2D> points_orig = next_image.Points2D();
+				Camera cam = reconstruction.Camera(next_image.CameraId());
 			
-			std::vector<Eigen::Vector4d> qvecs = reconstruction.Image(img).Qvecs();
-			std::vector<Eigen::Vector3d> tvecs = reconstruction.Image(img).Tvecs();
-			//inlier corrs are already in the image but we don't know which of them use, so it will be safer to give them as argument (they won't be in the second image)
-			std::vector<std::vector<std::pair<point2D_t, point3D_t>>> tri_corrs = next_image.InlierCorrs();
-			//set found pose as the official pose of the image
-			next_image.SetQvec(qvecs[0]);
-			next_image.SetTvec(tvecs[0]);
-			next_image.SetGroup(1);
-			//finish registration of the first image
-			//triangulate and do bundle adjustment (but both later), do the same with the phantom image
-			mapper.FinishRegistration(options_->Mapper(), img, tri_corrs[0]);
-			//add a camera to the camera list
-			std::string name = next_image.Name();
-			int take = take_map[name];
-			//set = takes_map
-			/*if(first_set.count(img))
-				set = 1;
-			else if(second_set.count(img))
-				set = 2;
-			else
-				set = 3;*/
-			std::cout << "CAMS\n";
-			camera_log << img << " " << take << " " << recon_set << " " << qvecs[0](0) << " " << qvecs[0](1) << " " << qvecs[0](2) << " " << qvecs[0](3) << " "
-				<< tvecs[0](0) << " " << tvecs[0](1) << " " << tvecs[0](2) << " " << cam.Width() << " " << cam.Height() << " " << cam.FocalLength() << " "
-				<< cam.PrincipalPointX() << " " << cam.PrincipalPointY() << " " << next_image.seq_inliers[0] << " " << img << "\n";
+				//the poses stay owned by the image, phantom images are added to the reconstruction but do not touch them
+				const ImagePoseHypotheses& poses = next_image.PoseHypotheses();
+				const std::vector<Eigen::Vector4d>& qvecs = poses.qvecs;
+				const std::vector<Eigen::Vector3d>& tvecs = poses.tvecs;
+				//inlier corrs are already in the image but we don't know which of them use, so it will be safer to give them as argument (they won't be in the second image)
+				const std::vector<std::vector<std::pair<point2D_t, point3D_t>>>& tri_corrs = poses.inlier_corrs;
+				//set found pose as the official pose of the image
+				next_image.SetQvec(qvecs[0]);
+				next_image.SetTvec(tvecs[0]);
+				next_image.SetGroup(1);
+				//finish registration of the first image
+				//triangulate and do bundle adjustment (but both later), do the same with the phantom image
+				if(mapper.FinishRegistration(options_->Mapper(), img, tri_corrs[0]))
+					batch_image_ids.push_back(img);
+				//add a camera to the camera list
+				std::string name = next_image.Name();
+				int take = take_map[name];
+				//set = takes_map
+				/*if(first_set.count(img))
+					set = 1;
+				else if(second_set.count(img))
+					set = 2;
+				else
+					set = 3;*/
+				VLOG(3) << "CAMS";
+				log_camera(CreateTakeCamera(img, take, recon_set, qvecs[0], tvecs[0], cam, poses.num_inliers[0], img));
 			
-			for(size_t i=1;i<qvecs.size();i++)
-			{
-				//create second 'phantom' image and register it (it will have the same camera (not just params but also id) and the same image name)
-				image_t id_p = reconstruction.NumImages()+1;
-				next_image.SetCorr(id_p);
-				Image phantom;
-				phantom.SetImageId(id_p);
-				phantom.SetCameraId(next_image.CameraId());
-				phantom.SetUp(cam);
-				phantom.SetName(next_image.Name());
-				phantom.SetQvec(qvecs[i]);
-				phantom.SetTvec(tvecs[i]);
-				phantom.SetGroup(i+1);
-				phantom.SetCorr(img);
-				phantom.SetPoints2D(points_orig);
-				std::cout << id_p << " " << next_image.Points2D().size() << "\n";
-				reconstruction.AddImage(phantom);
-				std::vector<image_pair_t> old_pairs; 
-				std::vector<image_pair_t> new_pairs;
-				reconstruction.InitNewImage(id_p, img, &old_pairs, &new_pairs);
-				//HERE
-				//scene_graph.AddNewImage(id_p, reconstruction.Image(id_p).NumPoints2D(),img);
-				//scene_graph.CopyCorrespondences(id_p, img, old_pairs, new_pairs);
-				mapper.InitImage(id_p, img, old_pairs, new_pairs);
-				mapper.FinishRegistration(options_->Mapper(), id_p, tri_corrs[i]);
-				//also triangulate both images
-				if(i==1)
+				for(size_t i=1;i<qvecs.size();i++)
 				{
-					for(std::pair<point2D_t, point3D_t> corr : tri_corrs[1])
+					if(motion_filter && !motion_filter->Filter(take, ComputeObjectMotion(qvecs[0], tvecs[0], qvecs[i], tvecs[i])))
+					{
+						VLOG(3) << "Rejected pose " << i << " of image " << img;
+						continue;
+					}
+					//create second 'phantom' image and register it (it will have the same camera (not just params but also id) and the same image name)
+					image_t id_p = next_phantom_id++;
+					next_image.SetCorr(id_p);
+					Image phantom;
+					phantom.SetImageId(id_p);
+					phantom.SetCameraId(next_image.CameraId());
+					phantom.SetUp(cam);
+					phantom.SetName(next_image.Name());
+					phantom.SetQvec(qvecs[i]);
+					phantom.SetTvec(tvecs[i]);
+					phantom.SetGroup(i+1);
+					phantom.SetCorr(img);
+					phantom.SetPoints2D(points_orig);
+					VLOG(4) << id_p << " " << next_image.Points2D().size();
+					//the phantom has no correspondences of its own, so it gets no image pairs
+					reconstruction.AddImage(phantom);
+					mapper.InitImage(id_p, img);
+					if(options_->ba_rigid_object_motion)
+					{
+						const int motion_idx = motion_idxs.emplace(std::make_pair(take, i), static_cast<int>(motion_idxs.size())).first->second;
+						mapper.SetRigidMotion(id_p, img, motion_idx);
+					}
+					if(mapper.FinishRegistration(options_->Mapper(), id_p, tri_corrs[i]))
+						batch_image_ids.push_back(id_p);
+					//also triangulate both images
+					if(i==1 && options_->write_camera_log_text)
 					{
-						ph_out << corr.second << "\n";
+						for(std::pair<point2D_t, point3D_t> corr : tri_corrs[1])
+						{
+							ph_out << corr.second << "\n";
+						}
 					}
+					log_camera(CreateTakeCamera(img, take, recon_set, qvecs[i], tvecs[i], cam, poses.num_inliers[i], id_p));
 				}
-				camera_log << img << " " << take << " " << recon_set << " " << qvecs[i](0) << " " << qvecs[i](1) << " " << qvecs[i](2) << " " << qvecs[i](3) << " "
-					<< tvecs[i](0) << " " << tvecs[i](1) << " " << tvecs[i](2) << " " << cam.Width() << " " << cam.Height() << " " << cam.FocalLength() << " "
-					<< cam.PrincipalPointX() << " " << cam.PrincipalPointY() << " " << next_image.seq_inliers[i] << " " << id_p << "\n";
+				if(options_->write_camera_log_text)
+				{
+					for(std::pair<point2D_t, point3D_t> corr : tri_corrs[0])
+					{
+						real_out << corr.second << "\n";
+					}
+				}
+				//all poses are registered, only the body labels of the points are kept
+				next_image.ReleasePoseInlierCorrs();
 			}
-			for(std::pair<point2D_t, point3D_t> corr : tri_corrs[0])
+			if(motion_filter)
 			{
-				real_out << corr.second << "\n";
+				std::cout << StringPrintf("  => Accepted motions: %d (rejected: %d identity, %d inconsistent)", motion_filter->NumAccepted(),
+					motion_filter->NumRejectedIdentity(), motion_filter->NumRejectedInconsistent()) << "\n";
 			}
+			camera_log.Flush();
+			SetMetricGauge(TakeStageName(*options_, "num_reg_images"), reconstruction.NumRegImages());
+			//the images of the batch and their phantoms are refined together, the
+			//disjoint local bundles are solved concurrently
+			if(options_->ba_local_batch && !batch_image_ids.empty())
+				IterativeLocalRefinement(*options_, batch_image_ids, &mapper);
+			//maybe will also be something under the loop
+			//bundle adjustment
+			//IterativeGlobalRefinement(*options_, &mapper);
+			//AdjustGlobalBundle(*options_, &mapper);
 		}
-		//maybe will also be something under the loop
-		//bundle adjustment
-		//IterativeGlobalRefinement(*options_, &mapper);
-		//AdjustGlobalBundle(*options_, &mapper);
-	}
 
-	ph_out.close();
-	real_out.close();
-	camera_log.close();
+		ph_out.close();
+		real_out.close();
+		camera_log_text.close();
+		camera_log.Flush();
+
+		//write cameras, observations and points of the take at once, the
+		//postprocessor maps this file instead of parsing the text files
+		if(extend_take)
+		{
+			take_bundle_ = prev_bundle;
+			take_bundle_.anchor = recon_set;
+			take_bundle_.cameras.insert(take_bundle_.cameras.end(), take_cameras.begin(), take_cameras.end());
+			ExtendTakeBundle(reconstruction, take_map, options_->new_take, &take_bundle_);
+		}
+		else
+		{
+			take_bundle_ = TakeBundle();
+			take_bundle_.anchor = recon_set;
+			take_bundle_.cameras = take_cameras;
+			ExtractTakeBundle(reconstruction, take_map, &take_bundle_);
+		}
+		//without a previous bundle, the postprocessor reads the model of the
+		//take and the camera log, which a partial bundle would replace
+		if(extend_take && !has_prev_bundle)
+		{
+			std::cout << "WARNING: No take bundle of take " << recon_set << ", only the camera log is extended." << std::endl;
+		}
+		else if(options_->write_take_bundle)
+		{
+			ResourceScope write_scope(TakeStageName(*options_, "write_take_bundle"));
+			WriteTakeBundle(JoinPaths(std::to_string(recon_set), kTakeBundleFileName), take_bundle_);
+		}
+    }
 
     // If the total number of images is small then do not enforce the minimum
     // model size so that we can reconstruct small image collections.
     const size_t min_model_size =
-        std::min(database_cache_.NumImages(),
+        std::min(database_cache_->NumImages(),
                  static_cast<size_t>(options_->min_model_size));
     if ((options_->multiple_models &&
          reconstruction.NumRegImages() < min_model_size) ||
@@ -891,7 +1124,7 @@ void IncrementalMapperController::Reconstruct(
     const size_t max_num_models = static_cast<size_t>(options_->max_num_models);
     if (initial_reconstruction_given || !options_->multiple_models ||
         reconstruction_manager_->Size() >= max_num_models ||
-        mapper.NumTotalRegImages() >= database_cache_.NumImages() - 1) {
+        mapper.NumTotalRegImages() >= database_cache_->NumImages() - 1) {
       break;
     }
   }
@@ -18,7 +18,9 @@
 #define COLMAP_SRC_CONTROLLERS_INCREMENTAL_MAPPER_H_
 
 #include "base/reconstruction_manager.h"
+#include "base/take_bundle.h"
 #include "sfm/incremental_mapper.h"
+#include "sfm/motion_filter.h"
 #include "util/threading.h"
 
 namespace colmap {
@@ -71,12 +73,28 @@ struct IncrementalMapperOptions {
   bool ba_refine_principal_point = false;
   bool ba_refine_extra_params = true;
 
+  // Whether to use the mixed-precision Schur solver instead of Ceres-Solver in
+  // local and global bundle adjustment. Not used if PBA is used.
+  bool ba_mixed_precision = false;
+
+  // Whether to tie the poses of the phantom images of a moving body to the
+  // poses of their original images through one rigid object motion per body
+  // and take in bundle adjustment, instead of refining independent phantom
+  // poses. The global bundle adjustment then never uses PBA or a persistent
+  // problem.
+  bool ba_rigid_object_motion = false;
+
   // The number of images to optimize in local bundle adjustment.
   int ba_local_num_images = 6;
 
   // The maximum number of local bundle adjustment iterations.
   int ba_local_max_num_iterations = 25;
 
+  // Whether to locally refine the images that are sequentially registered
+  // together in the second set. The local bundles of the batch are merged into
+  // independent groups, which are solved concurrently.
+  bool ba_local_batch = false;
+
   // Whether to use PBA in global bundle adjustment.
   bool ba_global_use_pba = true;
 
@@ -92,6 +110,24 @@ struct IncrementalMapperOptions {
   // The maximum number of global bundle adjustment iterations.
   int ba_global_max_num_iterations = 50;
 
+  // Whether to keep the problem of the global bundle adjustment between calls
+  // and only update the residuals of the changed observations, instead of
+  // building it from scratch. Not used if PBA is used.
+  bool ba_global_incremental = false;
+
+  // Whether to adjust the images in the global bundle adjustment on a
+  // spatially uniform subset of the points, which is selected in a grid with
+  // the given number of cells per dimension in every image, and to refine the
+  // other points afterwards. The final global bundle adjustment of the first
+  // set always adjusts all points. Not used if PBA is used.
+  bool ba_global_subsample_points = false;
+  int ba_global_subsample_grid_size = 16;
+
+  // Whether to keep the bundle adjustment problems between the iterations of
+  // the local and global refinements and only update the residuals of the
+  // merged, completed and filtered observations. Not used if PBA is used.
+  bool ba_refinement_reuse_problem = false;
+
   // The thresholds for iterative bundle adjustment refinements.
   int ba_local_max_refinements = 2;
   double ba_local_max_refinement_change = 0.001;
@@ -104,6 +140,65 @@ struct IncrementalMapperOptions {
   std::string snapshot_path = "";
   int snapshot_images_freq = 0;
 
+  // The take that is reconstructed as the anchor of the camera log. The other
+  // takes are sequentially registered against it and the camera log and take
+  // bundle are written to the folder of this take.
+  int anchor_take = 1;
+
+  // If positive, the imported model of the anchor take is only extended by the
+  // images of this take, e.g. one that was captured after the takes had been
+  // reconstructed. Their cameras are appended to the camera log of the anchor
+  // take and their images and points to its take bundle.
+  int new_take = 0;
+
+  // Whether to write the model of only the anchor take to its `anchor` folder
+  // before the other takes are registered, which new takes are registered
+  // against, see `new_take`.
+  bool write_anchor_model = true;
+
+  // Whether to write the binary bundle of the reconstructed take to the take
+  // folder. The bundle is always kept in memory, see `GetTakeBundle`.
+  bool write_take_bundle = true;
+
+  // Whether to also write the camera log as text to cams.txt and the 3D points
+  // of the first two poses of every registered image to real.txt and
+  // phantom.txt, for debugging. The binary camera log is always written.
+  bool write_camera_log_text = false;
+
+  // Whether to write the feature tracks of all images, i.e. the image points
+  // that are transitively connected by correspondences, to the take folder.
+  bool write_tracks = false;
+
+  // Whether to sequentially register the other takes after the anchor take,
+  // with a phantom image per additional pose, and to write the camera log and
+  // the take bundle. Otherwise, only the anchor take is reconstructed, e.g. in
+  // the clusters of the hierarchical mapper.
+  bool register_other_takes = true;
+
+  // Whether to only create phantom images for the additional poses of the
+  // sequentially registered images whose object motion passes the online
+  // filter of tentative motions, i.e. is no identity motion and is consistent
+  // with the motions already accepted in the take. See
+  // `TentativeMotionFilter` for the thresholds.
+  bool filter_tentative_motions = false;
+  double tentative_motion_identity_thr1 = 2.5;
+  double tentative_motion_identity_thr2 = 3;
+  int tentative_motion_num_estimates = 5;
+  double tentative_motion_max_rotation_error = 5;
+  double tentative_motion_max_translation_error = 0.1;
+
+  // If not empty, the two-view geometries of the candidate initial image
+  // pairs are read from this file before the reconstruction and written back
+  // after it, so that later runs on the same database reuse them.
+  std::string init_pair_cache_path = "";
+
+  // If not empty, the database cache spills the image points of all images
+  // to an out-of-core store in this folder and the mapper only pages in the
+  // points of the unregistered images it tries to register, up to
+  // `Mapper.out_of_core_cache_size` gigabytes. For takes whose image points
+  // do not fit into memory.
+  std::string out_of_core_path = "";
+
   // Which images to reconstruct. If no images are specified, all images will
   // be reconstructed by default.
   std::set<std::string> image_names;
@@ -113,6 +208,7 @@ struct IncrementalMapperOptions {
   BundleAdjustmentOptions LocalBundleAdjustment() const;
   BundleAdjustmentOptions GlobalBundleAdjustment() const;
   ParallelBundleAdjuster::Options ParallelGlobalBundleAdjustment() const;
+  TentativeMotionFilter::Options TentativeMotions() const;
 
   bool Check() const;
 
@@ -144,6 +240,30 @@ class IncrementalMapperController : public Thread {
                               const std::string& database_path,
                               ReconstructionManager* reconstruction_manager);
 
+  // Create the controller on an already loaded database cache, which is only
+  // read and can be shared by multiple controllers, e.g. one per take. The
+  // cache must live for the entire life-time of the controller.
+  IncrementalMapperController(const IncrementalMapperOptions* options,
+                              const std::string& image_path,
+                              const DatabaseCache* database_cache,
+                              ReconstructionManager* reconstruction_manager);
+
+  // Load the database into the cache using the filtering options of the
+  // mapper. Returns false if no images with matches were found.
+  static bool LoadDatabaseCache(const IncrementalMapperOptions& options,
+                                const std::string& database_path,
+                                DatabaseCache* database_cache);
+
+  // Cameras, observations and points of the last reconstructed take, which
+  // are available after the controller finished.
+  const TakeBundle& GetTakeBundle() const;
+
+  // Use the given cache of the two-view geometries of candidate initial image
+  // pairs instead of an own one, e.g. to share it between the controllers of
+  // all takes. The caller then reads and writes `init_pair_cache_path`. The
+  // cache must live for the entire life-time of the controller.
+  void SetInitialPairCache(InitialPairCache* init_pair_cache);
+
  private:
   void Run();
   bool LoadDatabase();
@@ -153,7 +273,13 @@ class IncrementalMapperController : public Thread {
   const std::string image_path_;
   const std::string database_path_;
   ReconstructionManager* reconstruction_manager_;
-  DatabaseCache database_cache_;
+  // Either points to the owned cache or to the shared cache of the caller.
+  const DatabaseCache* database_cache_;
+  DatabaseCache owned_database_cache_;
+  // Either points to the owned cache or to the shared cache of the caller.
+  InitialPairCache* init_pair_cache_;
+  InitialPairCache owned_init_pair_cache_;
+  TakeBundle take_bundle_;
 };
 
 // Globally filter points and images in mapper.
@@ -162,6 +288,11 @@ size_t FilterPoints(const IncrementalMapperOptions& options,
 size_t FilterImages(const IncrementalMapperOptions& options,
                     IncrementalMapper* mapper);
 
+// Filter the points changed by the last global bundle adjustment, see
+// `IncrementalMapper::FilterChangedPoints`.
+size_t FilterChangedPoints(const IncrementalMapperOptions& options,
+                           IncrementalMapper* mapper);
+
 // Globally complete and merge tracks in mapper.
 size_t CompleteAndMergeTracks(
     const IncrementalMapperOptions& options,
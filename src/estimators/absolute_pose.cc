@@ -16,6 +16,8 @@
 
 #include "estimators/absolute_pose.h"
 
+#include <limits>
+
 #include "base/polynomial.h"
 #include "estimators/utils.h"
 #include "util/logging.h"
@@ -27,6 +29,40 @@ Eigen::Vector3d LiftImagePoint(const Eigen::Vector2d& point) {
   return point.homogeneous() / std::sqrt(point.squaredNorm() + 1);
 }
 
+// Gather the normalized 2D points of a focal length sample.
+void GatherFocalLengthSample(const FocalLengthSamples& samples,
+                             const size_t focal_length_idx,
+                             const std::vector<size_t>& point2D_idxs,
+                             std::vector<Eigen::Vector2d>* points2D) {
+  const std::vector<Eigen::Vector2d>& sample_points2D =
+      samples.points2D[focal_length_idx];
+  points2D->resize(point2D_idxs.size());
+  for (size_t i = 0; i < point2D_idxs.size(); ++i) {
+    (*points2D)[i] = sample_points2D[point2D_idxs[i]];
+  }
+}
+
+// The squared reprojection errors of a focal length sample, scaled to the
+// normalized image coordinates of a focal length factor of 1.
+void ComputeFocalLengthSampleResiduals(
+    const FocalLengthSamples& samples, const std::vector<size_t>& point2D_idxs,
+    const std::vector<Eigen::Vector3d>& points3D,
+    const P3PFocalLengthSampleEstimator::M_t& model,
+    std::vector<Eigen::Vector2d>* points2D, std::vector<double>* residuals) {
+  GatherFocalLengthSample(samples, model.focal_length_idx, point2D_idxs,
+                          points2D);
+  ComputeSquaredReprojectionError(*points2D, points3D, model.proj_matrix,
+                                  residuals);
+  const double focal_length_factor =
+      samples.focal_length_factors[model.focal_length_idx];
+  const double scale = focal_length_factor * focal_length_factor;
+  for (double& residual : *residuals) {
+    if (residual != std::numeric_limits<double>::max()) {
+      residual *= scale;
+    }
+  }
+}
+
 }  // namespace
 
 std::vector<P3PEstimator::M_t> P3PEstimator::Estimate(
@@ -593,4 +629,108 @@ double EPNPEstimator::ComputeTotalReprojectionError(const Eigen::Matrix3d& R,
   return reproj_error;
 }
 
+std::vector<P3PFocalLengthSampleEstimator::M_t>
+P3PFocalLengthSampleEstimator::Estimate(
+    const std::vector<X_t>& point2D_idxs,
+    const std::vector<Y_t>& points3D) const {
+  CHECK_NOTNULL(samples);
+  CHECK_EQ(point2D_idxs.size(), 4);
+  CHECK_EQ(points3D.size(), 4);
+
+  const std::vector<Y_t> minimal_points3D(points3D.begin(),
+                                          points3D.begin() + 3);
+  const std::vector<Y_t> check_points3D(1, points3D[3]);
+  std::vector<Eigen::Vector2d> minimal_points2D(3);
+  std::vector<Eigen::Vector2d> check_points2D(1);
+  std::vector<double> residuals;
+
+  M_t best_model;
+  double best_residual = std::numeric_limits<double>::max();
+  for (size_t k = 0; k < samples->focal_length_factors.size(); ++k) {
+    const std::vector<Eigen::Vector2d>& sample_points2D = samples->points2D[k];
+    for (size_t i = 0; i < 3; ++i) {
+      minimal_points2D[i] = sample_points2D[point2D_idxs[i]];
+    }
+    check_points2D[0] = sample_points2D[point2D_idxs[3]];
+
+    const double focal_length_factor = samples->focal_length_factors[k];
+    for (const auto& proj_matrix :
+         P3PEstimator::Estimate(minimal_points2D, minimal_points3D)) {
+      ComputeSquaredReprojectionError(check_points2D, check_points3D,
+                                      proj_matrix, &residuals);
+      if (residuals[0] == std::numeric_limits<double>::max()) {
+        continue;
+      }
+      const double residual =
+          focal_length_factor * focal_length_factor * residuals[0];
+      if (residual < best_residual) {
+        best_residual = residual;
+        best_model.proj_matrix = proj_matrix;
+        best_model.focal_length_idx = k;
+      }
+    }
+  }
+
+  if (best_residual == std::numeric_limits<double>::max()) {
+    return std::vector<M_t>({});
+  }
+
+  return std::vector<M_t>({best_model});
+}
+
+void P3PFocalLengthSampleEstimator::Residuals(
+    const std::vector<X_t>& point2D_idxs, const std::vector<Y_t>& points3D,
+    const M_t& model, std::vector<double>* residuals) const {
+  CHECK_NOTNULL(samples);
+  ComputeFocalLengthSampleResiduals(*samples, point2D_idxs, points3D, model,
+                                    &points2D_, residuals);
+}
+
+std::vector<EPNPFocalLengthSampleEstimator::M_t>
+EPNPFocalLengthSampleEstimator::Estimate(
+    const std::vector<X_t>& point2D_idxs,
+    const std::vector<Y_t>& points3D) const {
+  CHECK_NOTNULL(samples);
+  CHECK_GE(point2D_idxs.size(), 4);
+  CHECK_EQ(point2D_idxs.size(), points3D.size());
+
+  std::vector<double> residuals;
+
+  M_t best_model;
+  double best_residual_sum = std::numeric_limits<double>::max();
+  for (size_t k = 0; k < samples->focal_length_factors.size(); ++k) {
+    GatherFocalLengthSample(*samples, k, point2D_idxs, &points2D_);
+    for (const auto& proj_matrix :
+         EPNPEstimator::Estimate(points2D_, points3D)) {
+      M_t model;
+      model.proj_matrix = proj_matrix;
+      model.focal_length_idx = k;
+      ComputeFocalLengthSampleResiduals(*samples, point2D_idxs, points3D,
+                                        model, &points2D_, &residuals);
+      double residual_sum = 0;
+      for (const double residual : residuals) {
+        residual_sum += residual;
+      }
+      if (residual_sum < best_residual_sum) {
+        best_residual_sum = residual_sum;
+        best_model = model;
+      }
+    }
+  }
+
+  if (best_residual_sum == std::numeric_limits<double>::max()) {
+    return std::vector<M_t>({});
+  }
+
+  return std::vector<M_t>({best_model});
+}
+
+void EPNPFocalLengthSampleEstimator::Residuals(
+    const std::vector<X_t>& point2D_idxs, const std::vector<Y_t>& points3D,
+    const M_t& model, std::vector<double>* residuals) const {
+  CHECK_NOTNULL(samples);
+  ComputeFocalLengthSampleResiduals(*samples, point2D_idxs, points3D, model,
+                                    &points2D_, residuals);
+}
+
 }  // namespace colmap
@@ -162,6 +162,83 @@ class EPNPEstimator {
   std::array<Eigen::Vector3d, 4> ccs_;
 };
 
+// The 2D image points of a camera, normalized for each of a discrete set of
+// focal lengths, which are given as factors of the focal length of the camera.
+struct FocalLengthSamples {
+  std::vector<double> focal_length_factors;
+  // The normalized 2D image points for each focal length factor.
+  std::vector<std::vector<Eigen::Vector2d>> points2D;
+};
+
+// Minimal solver for the absolute pose and the focal length of a camera from
+// four 2D-3D correspondences, where the focal length is one of the focal
+// length samples. For every sample, the P3P solution of the first three
+// correspondences is computed and the one that best reprojects the fourth
+// correspondence is returned.
+//
+// The 2D points are referenced by their index into the focal length samples,
+// which must be set before the estimator is used, and the residuals are the
+// squared reprojection errors in the normalized image coordinates of the
+// camera with a focal length factor of 1, such that they can be compared
+// between the samples.
+class P3PFocalLengthSampleEstimator {
+ public:
+  // The index of the 2D image feature observation in the samples.
+  typedef size_t X_t;
+  // The observed 3D features in the world frame.
+  typedef Eigen::Vector3d Y_t;
+  // The transformation from the world to the camera frame and the index of
+  // the focal length sample.
+  struct M_t {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    Eigen::Matrix3x4d proj_matrix;
+    size_t focal_length_idx = 0;
+  };
+
+  // The minimum number of samples needed to estimate a model.
+  static const int kMinNumSamples = 4;
+
+  std::vector<M_t> Estimate(const std::vector<X_t>& point2D_idxs,
+                            const std::vector<Y_t>& points3D) const;
+
+  void Residuals(const std::vector<X_t>& point2D_idxs,
+                 const std::vector<Y_t>& points3D, const M_t& model,
+                 std::vector<double>* residuals) const;
+
+  const FocalLengthSamples* samples = nullptr;
+
+ private:
+  mutable std::vector<Eigen::Vector2d> points2D_;
+};
+
+// Non-minimal solver for the same problem, which computes the EPNP solution
+// for every focal length sample and returns the one with the smallest sum of
+// residuals.
+class EPNPFocalLengthSampleEstimator {
+ public:
+  typedef P3PFocalLengthSampleEstimator::X_t X_t;
+  typedef P3PFocalLengthSampleEstimator::Y_t Y_t;
+  typedef P3PFocalLengthSampleEstimator::M_t M_t;
+
+  // The minimum number of samples needed to estimate a model.
+  static const int kMinNumSamples = 4;
+
+  std::vector<M_t> Estimate(const std::vector<X_t>& point2D_idxs,
+                            const std::vector<Y_t>& points3D) const;
+
+  void Residuals(const std::vector<X_t>& point2D_idxs,
+                 const std::vector<Y_t>& points3D, const M_t& model,
+                 std::vector<double>* residuals) const;
+
+  const FocalLengthSamples* samples = nullptr;
+
+ private:
+  mutable std::vector<Eigen::Vector2d> points2D_;
+};
+
 }  // namespace colmap
 
+EIGEN_DEFINE_STL_VECTOR_SPECIALIZATION_CUSTOM(
+    colmap::P3PFocalLengthSampleEstimator::M_t)
+
 #endif  // COLMAP_SRC_ESTIMATORS_ABSOLUTE_POSE_H_
@@ -23,6 +23,7 @@
 #include "base/similarity_transform.h"
 #include "estimators/absolute_pose.h"
 #include "estimators/essential_matrix.h"
+#include "optim/loransac.h"
 #include "optim/ransac.h"
 #include "util/random.h"
 
@@ -147,3 +148,58 @@ BOOST_AUTO_TEST_CASE(TestEPNP) {
     }
   }
 }
+
+BOOST_AUTO_TEST_CASE(TestFocalLengthSamples) {
+  SetPRNGSeed(0);
+
+  std::vector<Eigen::Vector3d> points3D;
+  for (size_t i = 0; i < 50; ++i) {
+    points3D.emplace_back(RandomReal(-1.0, 1.0), RandomReal(-1.0, 1.0),
+                          RandomReal(3.0, 5.0));
+  }
+
+  const SimilarityTransform3 orig_tform(1, Eigen::Vector4d(1, 0.1, 0, 0),
+                                        Eigen::Vector3d(0.1, 0, 0));
+
+  // The points are observed with a focal length factor of 1.5, for which the
+  // normalized points of a focal length factor f are scaled by 1.5 / f.
+  FocalLengthSamples samples;
+  samples.focal_length_factors = {0.5, 1, 1.5, 2};
+  samples.points2D.resize(samples.focal_length_factors.size());
+  std::vector<size_t> point2D_idxs;
+  for (size_t i = 0; i < points3D.size(); ++i) {
+    Eigen::Vector3d point3D_camera = points3D[i];
+    orig_tform.TransformPoint(&point3D_camera);
+    for (size_t k = 0; k < samples.focal_length_factors.size(); ++k) {
+      samples.points2D[k].push_back(point3D_camera.hnormalized() * 1.5 /
+                                    samples.focal_length_factors[k]);
+    }
+    point2D_idxs.push_back(i);
+  }
+
+  RANSACOptions options;
+  options.max_error = 1e-5;
+  LORANSAC<P3PFocalLengthSampleEstimator, EPNPFocalLengthSampleEstimator>
+      ransac(options);
+  ransac.estimator.samples = &samples;
+  ransac.local_estimator.samples = &samples;
+  const auto report = ransac.Estimate(point2D_idxs, points3D);
+
+  BOOST_CHECK_EQUAL(report.success, true);
+  BOOST_CHECK_EQUAL(report.support.num_inliers, points3D.size());
+  BOOST_CHECK_EQUAL(report.model.focal_length_idx, 2);
+  BOOST_CHECK_LT(
+      (orig_tform.Matrix().topLeftCorner<3, 4>() - report.model.proj_matrix)
+          .norm(),
+      1e-3);
+
+  // The residuals of the wrong focal lengths are large.
+  P3PFocalLengthSampleEstimator::M_t model = report.model;
+  model.focal_length_idx = 1;
+  std::vector<double> residuals;
+  ransac.estimator.Residuals(point2D_idxs, points3D, model, &residuals);
+  BOOST_CHECK_EQUAL(residuals.size(), points3D.size());
+  for (const double residual : residuals) {
+    BOOST_CHECK_GT(residual, 1e-10);
+  }
+}
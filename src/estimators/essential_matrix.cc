@@ -20,6 +20,7 @@
 
 #include <Eigen/Geometry>
 #include <Eigen/LU>
+#include <Eigen/QR>
 #include <Eigen/SVD>
 
 #include "base/polynomial.h"
@@ -28,36 +29,31 @@
 #include "util/math.h"
 
 namespace colmap {
+namespace {
+
+// The epipolar constraint of a correspondence as a row of the matrix, whose
+// nullspace contains the row-major essential matrices.
+template <typename Derived>
+void FillEpipolarConstraint(const Eigen::Vector2d& x1,
+                            const Eigen::Vector2d& x2,
+                            Eigen::MatrixBase<Derived>* row) {
+  (*row)(0) = x1(0) * x2(0);
+  (*row)(1) = x1(1) * x2(0);
+  (*row)(2) = x2(0);
+  (*row)(3) = x1(0) * x2(1);
+  (*row)(4) = x1(1) * x2(1);
+  (*row)(5) = x2(1);
+  (*row)(6) = x1(0);
+  (*row)(7) = x1(1);
+  (*row)(8) = 1;
+}
 
-std::vector<EssentialMatrixFivePointEstimator::M_t>
-EssentialMatrixFivePointEstimator::Estimate(const std::vector<X_t>& points1,
-                                            const std::vector<Y_t>& points2) {
-  CHECK_EQ(points1.size(), points2.size());
-
-  // Step 1: Extraction of the nullspace x, y, z, w.
-
-  Eigen::Matrix<double, Eigen::Dynamic, 9> Q(points1.size(), 9);
-  for (size_t i = 0; i < points1.size(); ++i) {
-    const double x1_0 = points1[i](0);
-    const double x1_1 = points1[i](1);
-    const double x2_0 = points2[i](0);
-    const double x2_1 = points2[i](1);
-    Q(i, 0) = x1_0 * x2_0;
-    Q(i, 1) = x1_1 * x2_0;
-    Q(i, 2) = x2_0;
-    Q(i, 3) = x1_0 * x2_1;
-    Q(i, 4) = x1_1 * x2_1;
-    Q(i, 5) = x2_1;
-    Q(i, 6) = x1_0;
-    Q(i, 7) = x1_1;
-    Q(i, 8) = 1;
-  }
-
-  // Extract the 4 Eigen vectors corresponding to the smallest singular values.
-  const Eigen::JacobiSVD<Eigen::Matrix<double, Eigen::Dynamic, 9>> svd(
-      Q, Eigen::ComputeFullV);
-  const Eigen::Matrix<double, 9, 4> E = svd.matrixV().block<9, 4>(0, 5);
-
+// Step 3 and 4 of the five-point algorithm: Gauss-Jordan elimination of the
+// cubic constraints of the nullspace basis E and expansion of the determinant
+// of the 3x3 polynomial matrix B to the tenth degree polynomial.
+void ComputeFivePointPolynomial(const Eigen::Matrix<double, 9, 4>& E,
+                                Eigen::Matrix<double, 13, 3>* B_ptr,
+                                Eigen::Matrix<double, 11, 1>* coeffs_ptr) {
   // Step 3: Gauss-Jordan elimination with partial pivoting on A.
 
   Eigen::Matrix<double, 10, 20> A;
@@ -68,7 +64,7 @@ EssentialMatrixFivePointEstimator::Estimate(const std::vector<X_t>& points1,
   // Step 4: Expansion of the determinant polynomial of the 3x3 polynomial
   //         matrix B to obtain the tenth degree polynomial.
 
-  Eigen::Matrix<double, 13, 3> B;
+  Eigen::Matrix<double, 13, 3>& B = *B_ptr;
   for (size_t i = 0; i < 3; ++i) {
     B(0, i) = 0;
     B(4, i) = 0;
@@ -81,9 +77,382 @@ EssentialMatrixFivePointEstimator::Estimate(const std::vector<X_t>& points1,
     B.block<4, 1>(8, i) -= AA.block<1, 4>(i * 2 + 5, 6);
   }
 
-  // Step 5: Extraction of roots from the degree 10 polynomial.
-  Eigen::Matrix<double, 11, 1> coeffs;
+  Eigen::Matrix<double, 11, 1>& coeffs = *coeffs_ptr;
 #include "estimators/essential_matrix_coeffs.h"
+}
+
+// Step 6 of the five-point algorithm: Recover the essential matrix of the root
+// z1 of the tenth degree polynomial, if it is well-defined.
+bool RecoverFivePointEssentialMatrix(const Eigen::Matrix<double, 9, 4>& E,
+                                     const Eigen::Matrix<double, 13, 3>& B,
+                                     const double z1,
+                                     Eigen::Matrix3d* essential_matrix) {
+  const double z2 = z1 * z1;
+  const double z3 = z2 * z1;
+  const double z4 = z3 * z1;
+
+  Eigen::Matrix3d Bz;
+  for (size_t j = 0; j < 3; ++j) {
+    Bz(j, 0) = B(0, j) * z3 + B(1, j) * z2 + B(2, j) * z1 + B(3, j);
+    Bz(j, 1) = B(4, j) * z3 + B(5, j) * z2 + B(6, j) * z1 + B(7, j);
+    Bz(j, 2) = B(8, j) * z4 + B(9, j) * z3 + B(10, j) * z2 + B(11, j) * z1 +
+               B(12, j);
+  }
+
+  // The nullspace of the rank 2 matrix is the largest cross product of two of
+  // its rows.
+  const Eigen::Vector3d X01 = Bz.row(0).cross(Bz.row(1));
+  const Eigen::Vector3d X02 = Bz.row(0).cross(Bz.row(2));
+  const Eigen::Vector3d X12 = Bz.row(1).cross(Bz.row(2));
+  const double norm01 = X01.squaredNorm();
+  const double norm02 = X02.squaredNorm();
+  const double norm12 = X12.squaredNorm();
+  const Eigen::Vector3d& X_max = norm01 >= norm02
+                                     ? (norm01 >= norm12 ? X01 : X12)
+                                     : (norm02 >= norm12 ? X02 : X12);
+  if (X_max.squaredNorm() == 0) {
+    return false;
+  }
+  const Eigen::Vector3d X = X_max.normalized();
+
+  const double kMaxX3 = 1e-10;
+  if (std::abs(X(2)) < kMaxX3) {
+    return false;
+  }
+
+  Eigen::Matrix<double, 9, 1> essential_vec =
+      E.col(0) * (X(0) / X(2)) + E.col(1) * (X(1) / X(2)) + E.col(2) * z1 +
+      E.col(3);
+  essential_vec /= essential_vec.norm();
+
+  *essential_matrix = Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(
+      essential_vec.data());
+  return true;
+}
+
+// Sturm sequence of a polynomial of at most tenth degree, whose polynomials
+// are stored with increasing powers and scaled to a maximum absolute
+// coefficient of one, which does not change their signs.
+class SturmSequence {
+ public:
+  static const int kMaxDegree = 10;
+
+  // Set up the sequence of the polynomial with the coefficients of
+  // decreasing powers as in base/polynomial.h. Return false if the polynomial
+  // is constant.
+  bool Initialize(const Eigen::Matrix<double, kMaxDegree + 1, 1>& coeffs) {
+    int leading_idx = 0;
+    while (leading_idx < kMaxDegree && coeffs(leading_idx) == 0) {
+      leading_idx += 1;
+    }
+    degrees_[0] = kMaxDegree - leading_idx;
+    if (degrees_[0] == 0) {
+      return false;
+    }
+
+    for (int k = 0; k <= degrees_[0]; ++k) {
+      polys_[0][k] = coeffs(kMaxDegree - k);
+    }
+    Normalize(0);
+
+    degrees_[1] = degrees_[0] - 1;
+    for (int k = 0; k <= degrees_[1]; ++k) {
+      polys_[1][k] = (k + 1) * polys_[0][k + 1];
+    }
+    Normalize(1);
+
+    // The negated remainders of the polynomial division of the predecessors,
+    // until the remainder vanishes or is constant.
+    num_polys_ = 2;
+    while (degrees_[num_polys_ - 1] > 0) {
+      const double* a = polys_[num_polys_ - 2];
+      const double* b = polys_[num_polys_ - 1];
+      const int a_degree = degrees_[num_polys_ - 2];
+      const int b_degree = degrees_[num_polys_ - 1];
+
+      double r[kMaxDegree + 1];
+      for (int k = 0; k <= a_degree; ++k) {
+        r[k] = a[k];
+      }
+      for (int k = a_degree; k >= b_degree; --k) {
+        const double q = r[k] / b[b_degree];
+        for (int j = 0; j <= b_degree; ++j) {
+          r[k - b_degree + j] -= q * b[j];
+        }
+      }
+
+      // Drop the leading coefficients, which vanish up to rounding errors.
+      const double kEps = 1e-14;
+      int r_degree = b_degree - 1;
+      while (r_degree >= 0 && std::abs(r[r_degree]) <= kEps) {
+        r_degree -= 1;
+      }
+      if (r_degree < 0) {
+        break;
+      }
+
+      degrees_[num_polys_] = r_degree;
+      for (int k = 0; k <= r_degree; ++k) {
+        polys_[num_polys_][k] = -r[k];
+      }
+      Normalize(num_polys_);
+      num_polys_ += 1;
+    }
+
+    return true;
+  }
+
+  int Degree() const { return degrees_[0]; }
+
+  // An upper bound of the absolute values of the roots by Cauchy.
+  double RootBound() const {
+    const int degree = degrees_[0];
+    double max_coeff = 0;
+    for (int k = 0; k < degree; ++k) {
+      max_coeff = std::max(max_coeff, std::abs(polys_[0][k]));
+    }
+    return 1 + max_coeff / std::abs(polys_[0][degree]);
+  }
+
+  // The number of sign changes of the sequence at x.
+  int NumSignChanges(const double x) const {
+    int num_sign_changes = 0;
+    double prev_value = 0;
+    for (int i = 0; i < num_polys_; ++i) {
+      const double value = Evaluate(i, x);
+      if (value != 0) {
+        if ((prev_value < 0 && value > 0) || (prev_value > 0 && value < 0)) {
+          num_sign_changes += 1;
+        }
+        prev_value = value;
+      }
+    }
+    return num_sign_changes;
+  }
+
+  // The number of sign changes at negative or positive infinity.
+  int NumSignChangesAtInfinity(const bool positive) const {
+    int num_sign_changes = 0;
+    int prev_sign = 0;
+    for (int i = 0; i < num_polys_; ++i) {
+      int sign = polys_[i][degrees_[i]] > 0 ? 1 : -1;
+      if (!positive && degrees_[i] % 2 == 1) {
+        sign = -sign;
+      }
+      if (prev_sign != 0 && sign != prev_sign) {
+        num_sign_changes += 1;
+      }
+      prev_sign = sign;
+    }
+    return num_sign_changes;
+  }
+
+  // Evaluate the polynomial and its derivative at x.
+  double Evaluate(const double x, double* derivative) const {
+    double value = polys_[0][degrees_[0]];
+    *derivative = 0;
+    for (int k = degrees_[0] - 1; k >= 0; --k) {
+      *derivative = *derivative * x + value;
+      value = value * x + polys_[0][k];
+    }
+    return value;
+  }
+
+ private:
+  double Evaluate(const int i, const double x) const {
+    double value = polys_[i][degrees_[i]];
+    for (int k = degrees_[i] - 1; k >= 0; --k) {
+      value = value * x + polys_[i][k];
+    }
+    return value;
+  }
+
+  void Normalize(const int i) {
+    double max_coeff = 0;
+    for (int k = 0; k <= degrees_[i]; ++k) {
+      max_coeff = std::max(max_coeff, std::abs(polys_[i][k]));
+    }
+    if (max_coeff > 0) {
+      for (int k = 0; k <= degrees_[i]; ++k) {
+        polys_[i][k] /= max_coeff;
+      }
+    }
+  }
+
+  int num_polys_ = 0;
+  int degrees_[kMaxDegree + 1];
+  double polys_[kMaxDegree + 1][kMaxDegree + 1];
+};
+
+// Refine the root of the polynomial in the interval (lo, hi], which contains
+// exactly one distinct root, by Newton steps that fall back to bisection
+// if they leave the bracket.
+double RefinePolynomialRoot(const SturmSequence& sequence, double lo,
+                            double hi) {
+  double derivative;
+  double lo_value = sequence.Evaluate(lo, &derivative);
+  const double hi_value = sequence.Evaluate(hi, &derivative);
+  if (hi_value == 0) {
+    return hi;
+  }
+
+  // A root of even multiplicity does not change the sign, such that only
+  // the unsafeguarded Newton steps remain.
+  const bool bracketed = (lo_value < 0) != (hi_value < 0);
+
+  const int kMaxNumIterations = 100;
+  const double kEps = 1e-14;
+  double x = 0.5 * (lo + hi);
+  for (int iter = 0; iter < kMaxNumIterations; ++iter) {
+    const double value = sequence.Evaluate(x, &derivative);
+    if (value == 0) {
+      return x;
+    }
+
+    if (bracketed) {
+      if ((value < 0) == (lo_value < 0)) {
+        lo = x;
+        lo_value = value;
+      } else {
+        hi = x;
+      }
+    }
+
+    double next_x = x - value / derivative;
+    if (bracketed && !(next_x > lo && next_x < hi)) {
+      next_x = 0.5 * (lo + hi);
+    }
+
+    if (std::abs(next_x - x) <= kEps * (1 + std::abs(x))) {
+      return next_x;
+    }
+    x = next_x;
+  }
+
+  return x;
+}
+
+// Isolate the distinct real roots in the interval (lo, hi] by bisection,
+// where the numbers of sign changes of the Sturm sequence at the bounds are
+// given, and append them to the roots.
+void IsolatePolynomialRoots(const SturmSequence& sequence, const double lo,
+                            const double hi, const int lo_num_sign_changes,
+                            const int hi_num_sign_changes, const int depth,
+                            double* roots, int* num_roots) {
+  const int num_interval_roots = lo_num_sign_changes - hi_num_sign_changes;
+  if (num_interval_roots <= 0) {
+    return;
+  }
+
+  // Roots that are still not separated after many bisections are numerically
+  // identical and only reported once.
+  const int kMaxDepth = 64;
+  if (num_interval_roots == 1 || depth >= kMaxDepth) {
+    roots[*num_roots] = RefinePolynomialRoot(sequence, lo, hi);
+    *num_roots += 1;
+    return;
+  }
+
+  const double mid = 0.5 * (lo + hi);
+  const int mid_num_sign_changes = sequence.NumSignChanges(mid);
+  IsolatePolynomialRoots(sequence, lo, mid, lo_num_sign_changes,
+                         mid_num_sign_changes, depth + 1, roots, num_roots);
+  IsolatePolynomialRoots(sequence, mid, hi, mid_num_sign_changes,
+                         hi_num_sign_changes, depth + 1, roots, num_roots);
+}
+
+// Find the distinct real roots of the polynomial with the coefficients of
+// decreasing powers and return their number.
+int FindRealPolynomialRootsSturm(const Eigen::Matrix<double, 11, 1>& coeffs,
+                                 double roots[SturmSequence::kMaxDegree]) {
+  SturmSequence sequence;
+  if (!sequence.Initialize(coeffs)) {
+    return 0;
+  }
+
+  const double bound = sequence.RootBound();
+  int num_roots = 0;
+  IsolatePolynomialRoots(sequence, -bound, bound,
+                         sequence.NumSignChangesAtInfinity(false),
+                         sequence.NumSignChangesAtInfinity(true), 0, roots,
+                         &num_roots);
+  return num_roots;
+}
+
+}  // namespace
+
+std::vector<EssentialMatrixFivePointEstimator::M_t>
+EssentialMatrixFivePointEstimator::Estimate(const std::vector<X_t>& points1,
+                                            const std::vector<Y_t>& points2) {
+  CHECK_EQ(points1.size(), points2.size());
+
+  if (points1.size() != kMinNumSamples) {
+    return EstimateNonMinimal(points1, points2);
+  }
+
+  // Step 1: Extraction of the nullspace x, y, z, w, which is spanned by the
+  //         last 4 columns of the orthogonal factor of the QR decomposition of
+  //         the transposed constraint matrix.
+
+  Eigen::Matrix<double, 9, kMinNumSamples> Qt;
+  for (int i = 0; i < kMinNumSamples; ++i) {
+    auto col = Qt.col(i);
+    FillEpipolarConstraint(points1[i], points2[i], &col);
+  }
+
+  const Eigen::HouseholderQR<Eigen::Matrix<double, 9, kMinNumSamples>> qr(Qt);
+  const Eigen::Matrix<double, 9, 9> Q = qr.householderQ();
+  const Eigen::Matrix<double, 9, 4> E = Q.rightCols<4>();
+
+  // Step 3 and 4.
+
+  Eigen::Matrix<double, 13, 3> B;
+  Eigen::Matrix<double, 11, 1> coeffs;
+  ComputeFivePointPolynomial(E, &B, &coeffs);
+
+  // Step 5: Extraction of the real roots from the degree 10 polynomial.
+
+  double roots[SturmSequence::kMaxDegree];
+  const int num_roots = FindRealPolynomialRootsSturm(coeffs, roots);
+
+  std::vector<M_t> models;
+  models.reserve(num_roots);
+
+  for (int i = 0; i < num_roots; ++i) {
+    M_t essential_matrix;
+    if (RecoverFivePointEssentialMatrix(E, B, roots[i], &essential_matrix)) {
+      models.push_back(essential_matrix);
+    }
+  }
+
+  return models;
+}
+
+std::vector<EssentialMatrixFivePointEstimator::M_t>
+EssentialMatrixFivePointEstimator::EstimateNonMinimal(
+    const std::vector<X_t>& points1, const std::vector<Y_t>& points2) {
+  CHECK_EQ(points1.size(), points2.size());
+
+  // Step 1: Extraction of the nullspace x, y, z, w.
+
+  Eigen::Matrix<double, Eigen::Dynamic, 9> Q(points1.size(), 9);
+  for (size_t i = 0; i < points1.size(); ++i) {
+    auto row = Q.row(i);
+    FillEpipolarConstraint(points1[i], points2[i], &row);
+  }
+
+  // Extract the 4 Eigen vectors corresponding to the smallest singular values.
+  const Eigen::JacobiSVD<Eigen::Matrix<double, Eigen::Dynamic, 9>> svd(
+      Q, Eigen::ComputeFullV);
+  const Eigen::Matrix<double, 9, 4> E = svd.matrixV().block<9, 4>(0, 5);
+
+  // Step 3 and 4.
+
+  Eigen::Matrix<double, 13, 3> B;
+  Eigen::Matrix<double, 11, 1> coeffs;
+  ComputeFivePointPolynomial(E, &B, &coeffs);
+
+  // Step 5: Extraction of roots from the degree 10 polynomial.
 
   Eigen::VectorXd roots_real;
   Eigen::VectorXd roots_imag;
@@ -100,36 +469,11 @@ EssentialMatrixFivePointEstimator::Estimate(const std::vector<X_t>& points1,
       continue;
     }
 
-    const double z1 = roots_real(i);
-    const double z2 = z1 * z1;
-    const double z3 = z2 * z1;
-    const double z4 = z3 * z1;
-
-    Eigen::Matrix3d Bz;
-    for (size_t j = 0; j < 3; ++j) {
-      Bz(j, 0) = B(0, j) * z3 + B(1, j) * z2 + B(2, j) * z1 + B(3, j);
-      Bz(j, 1) = B(4, j) * z3 + B(5, j) * z2 + B(6, j) * z1 + B(7, j);
-      Bz(j, 2) = B(8, j) * z4 + B(9, j) * z3 + B(10, j) * z2 + B(11, j) * z1 +
-                 B(12, j);
-    }
-
-    const Eigen::JacobiSVD<Eigen::Matrix3d> svd(Bz, Eigen::ComputeFullV);
-    const Eigen::Vector3d X = svd.matrixV().block<3, 1>(0, 2);
-
-    const double kMaxX3 = 1e-10;
-    if (std::abs(X(2)) < kMaxX3) {
-      continue;
+    M_t essential_matrix;
+    if (RecoverFivePointEssentialMatrix(E, B, roots_real(i),
+                                        &essential_matrix)) {
+      models.push_back(essential_matrix);
     }
-
-    Eigen::MatrixXd essential_vec = E.col(0) * (X(0) / X(2)) +
-                                    E.col(1) * (X(1) / X(2)) + E.col(2) * z1 +
-                                    E.col(3);
-    essential_vec /= essential_vec.norm();
-
-    const Eigen::Matrix3d essential_matrix =
-        Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(
-            essential_vec.data());
-    models.push_back(essential_matrix);
   }
 
   return models;
@@ -53,9 +53,21 @@ class EssentialMatrixFivePointEstimator {
   // @param points2  Second set of corresponding points.
   //
   // @return         Up to 10 solutions as a vector of 3x3 essential matrices.
+  //
+  // For exactly 5 points, the solutions are computed with fixed-size matrices
+  // and a Sturm sequence for the real roots of the tenth degree polynomial,
+  // such that only the returned vector is allocated. Otherwise, this is the
+  // same as `EstimateNonMinimal`.
   static std::vector<M_t> Estimate(const std::vector<X_t>& points1,
                                    const std::vector<Y_t>& points2);
 
+  // Estimate up to 10 possible essential matrix solutions from the nullspace
+  // of the least-squares epipolar constraints of at least 5 corresponding
+  // points, computed with a dynamically sized SVD, and the roots of the tenth
+  // degree polynomial from the eigenvalues of its companion matrix.
+  static std::vector<M_t> EstimateNonMinimal(const std::vector<X_t>& points1,
+                                             const std::vector<Y_t>& points2);
+
   // Calculate the residuals of a set of corresponding points and a given
   // essential matrix.
   //
@@ -18,6 +18,7 @@
 #include "util/testing.h"
 
 #include <Eigen/Core>
+#include <Eigen/Geometry>
 
 #include "base/camera_models.h"
 #include "base/essential_matrix.h"
@@ -73,6 +74,71 @@ BOOST_AUTO_TEST_CASE(TestFivePoint) {
   BOOST_CHECK(!report.inlier_mask[11]);
 }
 
+BOOST_AUTO_TEST_CASE(TestFivePointMinimal) {
+  SetPRNGSeed(0);
+
+  const size_t kNumProblems = 100;
+  size_t num_found = 0;
+  size_t num_found_non_minimal = 0;
+  for (size_t problem_idx = 0; problem_idx < kNumProblems; ++problem_idx) {
+    const Eigen::Vector3d rvec(RandomReal(-0.5, 0.5), RandomReal(-0.5, 0.5),
+                               RandomReal(-0.5, 0.5));
+    const Eigen::Matrix3d R =
+        Eigen::AngleAxisd(rvec.norm(), rvec.normalized()).toRotationMatrix();
+    const Eigen::Vector3d t = Eigen::Vector3d(RandomReal(-1.0, 1.0),
+                                              RandomReal(-1.0, 1.0),
+                                              RandomReal(-1.0, 1.0))
+                                  .normalized();
+
+    std::vector<Eigen::Vector2d> points1(5);
+    std::vector<Eigen::Vector2d> points2(5);
+    for (size_t i = 0; i < 5; ++i) {
+      const Eigen::Vector3d point3D(RandomReal(-1.0, 1.0),
+                                    RandomReal(-1.0, 1.0),
+                                    RandomReal(4.0, 8.0));
+      points1[i] = point3D.hnormalized();
+      points2[i] = (R * point3D + t).hnormalized();
+    }
+
+    Eigen::Matrix3d t_x;
+    t_x << 0, -t(2), t(1), t(2), 0, -t(0), -t(1), t(0), 0;
+    const Eigen::Matrix3d E = (t_x * R).normalized();
+
+    // The true essential matrix is one of the solutions up to the sign.
+    const auto ContainsEssentialMatrix =
+        [&E](const std::vector<Eigen::Matrix3d>& models) {
+          for (const auto& model : models) {
+            if (std::min((model - E).norm(), (model + E).norm()) < 1e-6) {
+              return true;
+            }
+          }
+          return false;
+        };
+
+    const auto models =
+        EssentialMatrixFivePointEstimator::Estimate(points1, points2);
+    const auto non_minimal_models =
+        EssentialMatrixFivePointEstimator::EstimateNonMinimal(points1,
+                                                              points2);
+    BOOST_CHECK_LE(models.size(), 10);
+
+    std::vector<double> residuals;
+    for (const auto& model : models) {
+      EssentialMatrixFivePointEstimator::Residuals(points1, points2, model,
+                                                   &residuals);
+      for (const double residual : residuals) {
+        BOOST_CHECK_LT(residual, 1e-10);
+      }
+    }
+
+    num_found += ContainsEssentialMatrix(models);
+    num_found_non_minimal += ContainsEssentialMatrix(non_minimal_models);
+  }
+
+  BOOST_CHECK_GE(num_found, num_found_non_minimal);
+  BOOST_CHECK_GE(num_found, kNumProblems - 2);
+}
+
 BOOST_AUTO_TEST_CASE(TestEightPoint) {
   const double points1_raw[] = {1.839035, 1.924743, 0.543582,  0.375221,
                                 0.473240, 0.142522, 0.964910,  0.598376,
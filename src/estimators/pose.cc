@@ -16,22 +16,50 @@
 
 #include "estimators/pose.h"
 
+#include <functional>
+#include <memory>
+#include <numeric>
+
 #include "base/camera_models.h"
 #include "base/cost_functions.h"
 #include "base/essential_matrix.h"
 #include "base/pose.h"
+#include "base/projection.h"
 #include "estimators/absolute_pose.h"
 #include "estimators/essential_matrix.h"
+#include "estimators/generalized_absolute_pose.h"
 #include "optim/bundle_adjustment.h"
+#include "optim/progressive_sampler.h"
 #include "util/matrix.h"
 #include "util/misc.h"
+#include "util/scratch.h"
 #include "util/threading.h"
 
 namespace colmap {
 namespace {
 
 typedef LORANSAC<P3PEstimator, EPNPEstimator> AbsolutePoseRANSAC;
-
+typedef SequentialRANSAC<P3PEstimator, EPNPEstimator> AbsolutePosesRANSAC;
+// There is no non-minimal GP3P solver, so that the hypotheses are not locally
+// optimized and the poses are refined afterwards.
+typedef SequentialRANSAC<GP3PEstimator, GP3PEstimator>
+    GeneralizedAbsolutePosesRANSAC;
+
+// The estimators with a custom sampler, whose reports are moved into the ones
+// of the default sampler, so that the callers do not depend on the sampler.
+template <typename Sampler>
+using AbsolutePoseRANSACWithSampler =
+    LORANSAC<P3PEstimator, EPNPEstimator, InlierSupportMeasurer, Sampler>;
+template <typename Sampler>
+using AbsolutePosesRANSACWithSampler =
+    SequentialRANSAC<P3PEstimator, EPNPEstimator, InlierSupportMeasurer,
+                     Sampler>;
+template <typename Sampler>
+using JointAbsolutePoseRANSACWithSampler =
+    LORANSAC<P3PFocalLengthSampleEstimator, EPNPFocalLengthSampleEstimator,
+             InlierSupportMeasurer, Sampler>;
+
+template <typename Sampler>
 void EstimateAbsolutePoseKernel(const Camera& camera,
                                 const double focal_length_factor,
                                 const std::vector<Eigen::Vector2d>& points2D,
@@ -46,17 +74,134 @@ void EstimateAbsolutePoseKernel(const Camera& camera,
   }
 
   // Normalize image coordinates with current camera hypothesis.
-  std::vector<Eigen::Vector2d> points2D_N(points2D.size());
-  for (size_t i = 0; i < points2D.size(); ++i) {
-    points2D_N[i] = scaled_camera.ImageToWorld(points2D[i]);
-  }
+  ScratchVector<Eigen::Vector2d> points2D_N_buffer;
+  std::vector<Eigen::Vector2d>& points2D_N = *points2D_N_buffer;
+  scaled_camera.ImageToWorld(points2D, &points2D_N);
 
   // Estimate pose for given focal length.
   auto custom_options = options;
   custom_options.max_error =
       scaled_camera.ImageToWorldThreshold(options.max_error);
-  AbsolutePoseRANSAC ransac(custom_options);
-  *report = ransac.Estimate(points2D_N, points3D);
+  AbsolutePoseRANSACWithSampler<Sampler> ransac(custom_options);
+  auto sampler_report = ransac.Estimate(points2D_N, points3D);
+  report->success = sampler_report.success;
+  report->num_trials = sampler_report.num_trials;
+  report->support = sampler_report.support;
+  report->inlier_mask = std::move(sampler_report.inlier_mask);
+  report->model = sampler_report.model;
+}
+
+// Estimate the pose and the focal length factor in one RANSAC, whose
+// hypotheses select the focal length factor that best fits a fourth
+// correspondence, instead of one RANSAC for every focal length factor.
+template <typename Sampler>
+void EstimateAbsolutePoseJointKernel(
+    const Camera& camera, const std::vector<double>& focal_length_factors,
+    const std::vector<Eigen::Vector2d>& points2D,
+    const std::vector<Eigen::Vector3d>& points3D, const RANSACOptions& options,
+    AbsolutePoseRANSAC::Report* report, size_t* focal_length_idx) {
+  // Normalize image coordinates once for every focal length hypothesis.
+  FocalLengthSamples samples;
+  samples.focal_length_factors = focal_length_factors;
+  samples.points2D.resize(focal_length_factors.size());
+  const std::vector<size_t>& focal_length_idxs = camera.FocalLengthIdxs();
+  for (size_t k = 0; k < focal_length_factors.size(); ++k) {
+    Camera scaled_camera = camera;
+    for (const size_t idx : focal_length_idxs) {
+      scaled_camera.Params(idx) *= focal_length_factors[k];
+    }
+    scaled_camera.ImageToWorld(points2D, &samples.points2D[k]);
+  }
+
+  ScratchVector<size_t> point2D_idxs_buffer(points2D.size());
+  std::vector<size_t>& point2D_idxs = *point2D_idxs_buffer;
+  std::iota(point2D_idxs.begin(), point2D_idxs.end(), 0);
+
+  // The residuals are scaled to the unscaled camera.
+  auto custom_options = options;
+  custom_options.max_error = camera.ImageToWorldThreshold(options.max_error);
+  JointAbsolutePoseRANSACWithSampler<Sampler> ransac(custom_options);
+  ransac.estimator.samples = &samples;
+  ransac.local_estimator.samples = &samples;
+  auto sampler_report = ransac.Estimate(point2D_idxs, points3D);
+  report->success = sampler_report.success;
+  report->num_trials = sampler_report.num_trials;
+  report->support = sampler_report.support;
+  report->inlier_mask = std::move(sampler_report.inlier_mask);
+  report->model = sampler_report.model.proj_matrix;
+  *focal_length_idx = sampler_report.model.focal_length_idx;
+}
+
+template <typename Sampler>
+void EstimateAbsolutePosesKernel(const Camera& camera,
+                                 const double focal_length_factor,
+                                 const std::vector<Eigen::Vector2d>& points2D,
+                                 const std::vector<Eigen::Vector3d>& points3D,
+                                 const RANSACOptions& options,
+                                 const size_t max_num_poses,
+                                 const size_t min_num_inliers,
+                                 const std::vector<Eigen::Matrix3x4d>& priors,
+                                 AbsolutePosesRANSAC::Report* report) {
+  // Scale the focal length by the given factor.
+  Camera scaled_camera = camera;
+  const std::vector<size_t>& focal_length_idxs = camera.FocalLengthIdxs();
+  for (const size_t idx : focal_length_idxs) {
+    scaled_camera.Params(idx) *= focal_length_factor;
+  }
+
+  // Normalize image coordinates with current camera hypothesis.
+  ScratchVector<Eigen::Vector2d> points2D_N_buffer;
+  std::vector<Eigen::Vector2d>& points2D_N = *points2D_N_buffer;
+  scaled_camera.ImageToWorld(points2D, &points2D_N);
+
+  // Estimate poses for given focal length.
+  auto custom_options = options;
+  custom_options.max_error =
+      scaled_camera.ImageToWorldThreshold(options.max_error);
+  AbsolutePosesRANSACWithSampler<Sampler> ransac(
+      custom_options, max_num_poses, min_num_inliers);
+  ransac.prior_models.assign(priors.begin(), priors.end());
+  auto sampler_report = ransac.Estimate(points2D_N, points3D);
+  report->success = sampler_report.success;
+  report->num_trials = sampler_report.num_trials;
+  report->models = std::move(sampler_report.models);
+  report->supports = std::move(sampler_report.supports);
+  report->labels = std::move(sampler_report.labels);
+}
+
+// Run the estimation for all focal length samples and wait for it. The samples
+// run on the pool of the options, on a pool that is started for this call or,
+// if there is only one sample or thread, on the calling thread.
+void RunFocalLengthSamples(const AbsolutePoseEstimationOptions& options,
+                           const size_t num_samples,
+                           const std::function<void(const size_t)>& func) {
+  ThreadPool* thread_pool = options.thread_pool;
+  std::unique_ptr<ThreadPool> call_thread_pool;
+  if (thread_pool == nullptr) {
+    const int num_threads =
+        std::min(GetEffectiveNumThreads(options.num_threads),
+                 static_cast<int>(num_samples));
+    if (num_threads > 1) {
+      call_thread_pool.reset(new ThreadPool(num_threads));
+      thread_pool = call_thread_pool.get();
+    }
+  }
+
+  if (thread_pool == nullptr || num_samples == 1) {
+    for (size_t i = 0; i < num_samples; ++i) {
+      func(i);
+    }
+    return;
+  }
+
+  std::vector<std::future<void>> futures;
+  futures.reserve(num_samples);
+  for (size_t i = 0; i < num_samples; ++i) {
+    futures.push_back(thread_pool->AddTask(func, i));
+  }
+  for (auto& future : futures) {
+    future.get();
+  }
 }
 
 }  // namespace
@@ -88,22 +233,39 @@ bool EstimateAbsolutePose(const AbsolutePoseEstimationOptions& options,
     focal_length_factors.push_back(1);
   }
 
-  std::vector<std::future<void>> futures;
-  futures.resize(focal_length_factors.size());
   std::vector<typename AbsolutePoseRANSAC::Report,
               Eigen::aligned_allocator<typename AbsolutePoseRANSAC::Report>>
       reports;
-  reports.resize(focal_length_factors.size());
-
-  ThreadPool thread_pool(std::min(
-      options.num_threads, static_cast<int>(focal_length_factors.size())));
 
   std::cout << "E2\n";
 
-  for (size_t i = 0; i < focal_length_factors.size(); ++i) {
-    futures[i] = thread_pool.AddTask(
-        EstimateAbsolutePoseKernel, *camera, focal_length_factors[i], points2D,
-        points3D, options.ransac_options, &reports[i]);
+  if (options.estimate_focal_length && options.joint_focal_length_estimation) {
+    reports.resize(1);
+    size_t focal_length_idx = 0;
+    if (options.progressive_sampling) {
+      EstimateAbsolutePoseJointKernel<ProgressiveSampler>(
+          *camera, focal_length_factors, points2D, points3D,
+          options.ransac_options, &reports[0], &focal_length_idx);
+    } else {
+      EstimateAbsolutePoseJointKernel<RandomSampler>(
+          *camera, focal_length_factors, points2D, points3D,
+          options.ransac_options, &reports[0], &focal_length_idx);
+    }
+    focal_length_factors = {focal_length_factors[focal_length_idx]};
+  } else {
+    reports.resize(focal_length_factors.size());
+    RunFocalLengthSamples(
+        options, focal_length_factors.size(), [&](const size_t i) {
+          if (options.progressive_sampling) {
+            EstimateAbsolutePoseKernel<ProgressiveSampler>(
+                *camera, focal_length_factors[i], points2D, points3D,
+                options.ransac_options, &reports[i]);
+          } else {
+            EstimateAbsolutePoseKernel<RandomSampler>(
+                *camera, focal_length_factors[i], points2D, points3D,
+                options.ransac_options, &reports[i]);
+          }
+        });
   }
 
   std::cout << "E3\n";
@@ -115,8 +277,7 @@ bool EstimateAbsolutePose(const AbsolutePoseEstimationOptions& options,
 
   // Find best model among all focal lengths.
   for (size_t i = 0; i < focal_length_factors.size(); ++i) {
-    futures[i].get();
-    const auto report = reports[i];
+    const auto& report = reports[i];
     if (report.success && report.support.num_inliers > *num_inliers) {
       *num_inliers = report.support.num_inliers;
       proj_matrix = report.model;
@@ -150,6 +311,198 @@ bool EstimateAbsolutePose(const AbsolutePoseEstimationOptions& options,
   return true;
 }
 
+size_t EstimateAbsolutePoses(const AbsolutePoseEstimationOptions& options,
+                             const size_t max_num_poses,
+                             const size_t min_num_inliers,
+                             const std::vector<Eigen::Vector2d>& points2D,
+                             const std::vector<Eigen::Vector3d>& points3D,
+                             std::vector<Eigen::Vector4d>* qvecs,
+                             std::vector<Eigen::Vector3d>* tvecs,
+                             Camera* camera, std::vector<size_t>* num_inliers,
+                             std::vector<std::vector<char>>* inlier_masks) {
+  options.Check();
+
+  qvecs->clear();
+  tvecs->clear();
+  num_inliers->clear();
+  inlier_masks->clear();
+
+  std::vector<double> focal_length_factors;
+  if (options.estimate_focal_length) {
+    // Generate focal length factors using a quadratic function,
+    // such that more samples are drawn for small focal lengths
+    focal_length_factors.reserve(options.num_focal_length_samples + 1);
+    const double fstep = 1.0 / options.num_focal_length_samples;
+    const double fscale =
+        options.max_focal_length_ratio - options.min_focal_length_ratio;
+    for (double f = 0; f <= 1.0; f += fstep) {
+      focal_length_factors.push_back(options.min_focal_length_ratio +
+                                     fscale * f * f);
+    }
+  } else {
+    focal_length_factors.reserve(1);
+    focal_length_factors.push_back(1);
+  }
+
+  // The joint estimation only selects the focal length factor, with which
+  // the poses are then estimated.
+  if (options.estimate_focal_length && options.joint_focal_length_estimation) {
+    AbsolutePoseRANSAC::Report joint_report;
+    size_t focal_length_idx = 0;
+    if (options.progressive_sampling) {
+      EstimateAbsolutePoseJointKernel<ProgressiveSampler>(
+          *camera, focal_length_factors, points2D, points3D,
+          options.ransac_options, &joint_report, &focal_length_idx);
+    } else {
+      EstimateAbsolutePoseJointKernel<RandomSampler>(
+          *camera, focal_length_factors, points2D, points3D,
+          options.ransac_options, &joint_report, &focal_length_idx);
+    }
+    if (!joint_report.success) {
+      return 0;
+    }
+    focal_length_factors = {focal_length_factors[focal_length_idx]};
+  }
+
+  std::vector<typename AbsolutePosesRANSAC::Report,
+              Eigen::aligned_allocator<typename AbsolutePosesRANSAC::Report>>
+      reports;
+  reports.resize(focal_length_factors.size());
+
+  RunFocalLengthSamples(options, focal_length_factors.size(),
+                        [&](const size_t i) {
+                          if (options.progressive_sampling) {
+                            EstimateAbsolutePosesKernel<ProgressiveSampler>(
+                                *camera, focal_length_factors[i], points2D,
+                                points3D, options.ransac_options,
+                                max_num_poses, min_num_inliers,
+                                options.prior_poses, &reports[i]);
+                          } else {
+                            EstimateAbsolutePosesKernel<RandomSampler>(
+                                *camera, focal_length_factors[i], points2D,
+                                points3D, options.ransac_options,
+                                max_num_poses, min_num_inliers,
+                                options.prior_poses, &reports[i]);
+                          }
+                        });
+
+  // Find best models among all focal lengths.
+  size_t best_num_inliers = 0;
+  size_t best_idx = 0;
+  for (size_t i = 0; i < focal_length_factors.size(); ++i) {
+    const auto& report = reports[i];
+    size_t total_num_inliers = 0;
+    for (const auto& support : report.supports) {
+      total_num_inliers += support.num_inliers;
+    }
+    if (report.success && total_num_inliers > best_num_inliers) {
+      best_num_inliers = total_num_inliers;
+      best_idx = i;
+    }
+  }
+
+  if (best_num_inliers == 0) {
+    return 0;
+  }
+
+  // Scale output camera with best estimated focal length.
+  if (options.estimate_focal_length) {
+    const std::vector<size_t>& focal_length_idxs = camera->FocalLengthIdxs();
+    for (const size_t idx : focal_length_idxs) {
+      camera->Params(idx) *= focal_length_factors[best_idx];
+    }
+  }
+
+  // Extract pose parameters.
+  const auto& report = reports[best_idx];
+  for (size_t i = 0; i < report.models.size(); ++i) {
+    const Eigen::Vector4d qvec =
+        RotationMatrixToQuaternion(report.models[i].leftCols<3>());
+    const Eigen::Vector3d tvec = report.models[i].rightCols<1>();
+    if (IsNaN(qvec) || IsNaN(tvec)) {
+      break;
+    }
+    qvecs->push_back(qvec);
+    tvecs->push_back(tvec);
+    num_inliers->push_back(report.supports[i].num_inliers);
+    inlier_masks->push_back(report.InlierMask(i));
+  }
+
+  return qvecs->size();
+}
+
+size_t EstimateGeneralizedAbsolutePoses(
+    const RANSACOptions& options, const size_t max_num_poses,
+    const size_t min_num_inliers, const std::vector<Eigen::Vector2d>& points2D,
+    const std::vector<Eigen::Vector3d>& points3D,
+    const std::vector<size_t>& camera_idxs,
+    const std::vector<Eigen::Vector4d>& rel_qvecs,
+    const std::vector<Eigen::Vector3d>& rel_tvecs,
+    const std::vector<Camera>& cameras, std::vector<Eigen::Vector4d>* qvecs,
+    std::vector<Eigen::Vector3d>* tvecs, std::vector<size_t>* num_inliers,
+    std::vector<std::vector<char>>* inlier_masks) {
+  CHECK_EQ(points2D.size(), points3D.size());
+  CHECK_EQ(points2D.size(), camera_idxs.size());
+  CHECK_EQ(rel_qvecs.size(), cameras.size());
+  CHECK_EQ(rel_tvecs.size(), cameras.size());
+  options.Check();
+
+  qvecs->clear();
+  tvecs->clear();
+  num_inliers->clear();
+  inlier_masks->clear();
+
+  if (points2D.empty()) {
+    return 0;
+  }
+
+  std::vector<Eigen::Matrix3x4d, Eigen::aligned_allocator<Eigen::Matrix3x4d>>
+      rel_tforms(cameras.size());
+  for (size_t i = 0; i < cameras.size(); ++i) {
+    rel_tforms[i] = ComposeProjectionMatrix(rel_qvecs[i], rel_tvecs[i]);
+  }
+
+  // Normalize the image coordinates and convert the maximum error in pixels
+  // to an angle, whose cosine distance is the residual of GP3P.
+  std::vector<GP3PEstimator::X_t> points2D_N(points2D.size());
+  double max_angular_error = 0;
+  for (size_t i = 0; i < points2D.size(); ++i) {
+    const Camera& camera = cameras[camera_idxs[i]];
+    points2D_N[i].rel_tform = rel_tforms[camera_idxs[i]];
+    points2D_N[i].xy = camera.ImageToWorld(points2D[i]);
+    max_angular_error +=
+        std::atan(camera.ImageToWorldThreshold(options.max_error));
+  }
+  max_angular_error /= points2D.size();
+
+  // The squared maximum error is compared to the residuals.
+  RANSACOptions custom_options = options;
+  custom_options.max_error = std::sqrt(1 - std::cos(max_angular_error));
+
+  GeneralizedAbsolutePosesRANSAC ransac(custom_options, max_num_poses,
+                                        min_num_inliers);
+  const auto report = ransac.Estimate(points2D_N, points3D);
+
+  if (!report.success) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < report.models.size(); ++i) {
+    const Eigen::Vector4d qvec =
+        RotationMatrixToQuaternion(report.models[i].leftCols<3>());
+    const Eigen::Vector3d tvec = report.models[i].rightCols<1>();
+    if (IsNaN(qvec) || IsNaN(tvec)) {
+      break;
+    }
+    qvecs->push_back(qvec);
+    tvecs->push_back(tvec);
+    num_inliers->push_back(report.supports[i].num_inliers);
+    inlier_masks->push_back(report.InlierMask(i));
+  }
+
+  return qvecs->size();
+}
+
 size_t EstimateRelativePose(const RANSACOptions& ransac_options,
                             const std::vector<Eigen::Vector2d>& points1,
                             const std::vector<Eigen::Vector2d>& points2,
@@ -305,6 +658,99 @@ bool RefineAbsolutePose(const AbsolutePoseRefinementOptions& options,
   return summary.IsSolutionUsable();
 }
 
+bool RefineGeneralizedAbsolutePose(
+    const AbsolutePoseRefinementOptions& options,
+    const std::vector<char>& inlier_mask,
+    const std::vector<Eigen::Vector2d>& points2D,
+    const std::vector<Eigen::Vector3d>& points3D,
+    const std::vector<size_t>& camera_idxs,
+    const std::vector<Eigen::Vector4d>& rel_qvecs,
+    const std::vector<Eigen::Vector3d>& rel_tvecs,
+    const std::vector<Camera>& cameras, Eigen::Vector4d* qvec,
+    Eigen::Vector3d* tvec) {
+  CHECK_EQ(inlier_mask.size(), points2D.size());
+  CHECK_EQ(points2D.size(), points3D.size());
+  CHECK_EQ(points2D.size(), camera_idxs.size());
+  CHECK_EQ(rel_qvecs.size(), cameras.size());
+  CHECK_EQ(rel_tvecs.size(), cameras.size());
+  options.Check();
+
+  ceres::LossFunction* loss_function =
+      new ceres::CauchyLoss(options.loss_function_scale);
+
+  double* qvec_data = qvec->data();
+  double* tvec_data = tvec->data();
+
+  // The constant parameter blocks are copied, since ceres requires mutable
+  // pointers to them.
+  std::vector<Eigen::Vector3d> points3D_copy = points3D;
+  std::vector<Eigen::Vector4d> rel_qvecs_copy = rel_qvecs;
+  std::vector<Eigen::Vector3d> rel_tvecs_copy = rel_tvecs;
+  std::vector<Camera> cameras_copy = cameras;
+
+  ceres::Problem problem;
+
+  for (size_t i = 0; i < points2D.size(); ++i) {
+    // Skip outlier observations
+    if (!inlier_mask[i]) {
+      continue;
+    }
+
+    const size_t camera_idx = camera_idxs[i];
+    Camera& camera = cameras_copy[camera_idx];
+
+    ceres::CostFunction* cost_function = nullptr;
+
+    switch (camera.ModelId()) {
+#define CAMERA_MODEL_CASE(CameraModel)                                     \
+  case CameraModel::kModelId:                                              \
+    cost_function =                                                        \
+        RigBundleAdjustmentCostFunction<CameraModel>::Create(points2D[i]); \
+    break;
+
+      CAMERA_MODEL_SWITCH_CASES
+
+#undef CAMERA_MODEL_CASE
+    }
+
+    problem.AddResidualBlock(cost_function, loss_function, qvec_data, tvec_data,
+                             rel_qvecs_copy[camera_idx].data(),
+                             rel_tvecs_copy[camera_idx].data(),
+                             points3D_copy[i].data(), camera.ParamsData());
+    problem.SetParameterBlockConstant(rel_qvecs_copy[camera_idx].data());
+    problem.SetParameterBlockConstant(rel_tvecs_copy[camera_idx].data());
+    problem.SetParameterBlockConstant(points3D_copy[i].data());
+    problem.SetParameterBlockConstant(camera.ParamsData());
+  }
+
+  if (problem.NumResiduals() > 0) {
+    // Quaternion parameterization.
+    *qvec = NormalizeQuaternion(*qvec);
+    ceres::LocalParameterization* quaternion_parameterization =
+        new ceres::QuaternionParameterization;
+    problem.SetParameterization(qvec_data, quaternion_parameterization);
+  }
+
+  ceres::Solver::Options solver_options;
+  solver_options.gradient_tolerance = options.gradient_tolerance;
+  solver_options.max_num_iterations = options.max_num_iterations;
+  solver_options.linear_solver_type = ceres::DENSE_QR;
+
+  // The overhead of creating threads is too large.
+  solver_options.num_threads = 1;
+  solver_options.num_linear_solver_threads = 1;
+
+  ceres::Solver::Summary summary;
+  ceres::Solve(solver_options, &problem, &summary);
+
+  if (options.print_summary) {
+    PrintHeading2("Generalized pose refinement report");
+    PrintSolverSummary(summary);
+  }
+
+  return summary.IsSolutionUsable();
+}
+
 bool RefineRelativePose(const ceres::Solver::Options& options,
                         const std::vector<Eigen::Vector2d>& points1,
                         const std::vector<Eigen::Vector2d>& points2,
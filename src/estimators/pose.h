@@ -26,6 +26,7 @@
 #include "base/camera.h"
 #include "base/camera_models.h"
 #include "optim/loransac.h"
+#include "optim/sequential_ransac.h"
 #include "util/alignment.h"
 #include "util/logging.h"
 #include "util/threading.h"
@@ -48,12 +49,33 @@ struct AbsolutePoseEstimationOptions {
   // around focal length of given camera.
   double max_focal_length_ratio = 5;
 
+  // Whether to estimate the focal length jointly with the pose in a single
+  // RANSAC, whose hypotheses select the focal length sample that best fits a
+  // fourth correspondence, instead of one RANSAC per focal length sample.
+  bool joint_focal_length_estimation = false;
+
   // Number of threads for parallel estimation of focal length.
   int num_threads = ThreadPool::kMaxNumThreads;
 
+  // If not null, the focal length samples are estimated on this long-lived
+  // pool instead of a pool that is started for every call, and `num_threads`
+  // is ignored. The estimation waits for its tasks, so it must not itself run
+  // on this pool.
+  ThreadPool* thread_pool = nullptr;
+
+  // Whether the 2D-3D correspondences are ordered by decreasing quality, in
+  // which case they are sampled progressively with PROSAC instead of
+  // uniformly at random.
+  bool progressive_sampling = false;
+
   // Options used for P3P RANSAC.
   RANSACOptions ransac_options;
 
+  // Predicted projection matrices [R | t], e.g. extrapolated from the poses of
+  // neighboring images, with which the sequential RANSAC of
+  // `EstimateAbsolutePoses` is seeded. Ignored by `EstimateAbsolutePose`.
+  std::vector<Eigen::Matrix3x4d> prior_poses;
+
   void Check() const {
     CHECK_GT(num_focal_length_samples, 0);
     CHECK_GT(min_focal_length_ratio, 0);
@@ -114,6 +136,76 @@ bool EstimateAbsolutePose(const AbsolutePoseEstimationOptions& options,
                           Camera* camera, size_t* num_inliers,
                           std::vector<char>* inlier_mask);
 
+// Estimate multiple absolute poses from the same 2D-3D correspondences, e.g.
+// of independently moving bodies, using sequential RANSAC.
+//
+// Every correspondence is an inlier of at most one pose and the poses are
+// ordered by extraction, i.e. the pose with the largest support comes first.
+// Focal length estimation is performed as in `EstimateAbsolutePose`, where the
+// focal length with the maximal number of inliers over all poses is assigned
+// to the given camera.
+//
+// @param options              Absolute pose estimation options.
+// @param max_num_poses        Maximum number of poses to estimate.
+// @param min_num_inliers      Minimum number of inliers of a pose.
+// @param points2D             Corresponding 2D points.
+// @param points3D             Corresponding 3D points.
+// @param qvecs                Estimated rotation components.
+// @param tvecs                Estimated translation components.
+// @param camera               Camera for which to estimate the poses. Modified
+//                             in-place to store the estimated focal length.
+// @param num_inliers          Number of inliers of each pose.
+// @param inlier_masks         Inlier mask of each pose.
+//
+// @return                     The number of estimated poses.
+size_t EstimateAbsolutePoses(const AbsolutePoseEstimationOptions& options,
+                             const size_t max_num_poses,
+                             const size_t min_num_inliers,
+                             const std::vector<Eigen::Vector2d>& points2D,
+                             const std::vector<Eigen::Vector3d>& points3D,
+                             std::vector<Eigen::Vector4d>* qvecs,
+                             std::vector<Eigen::Vector3d>* tvecs,
+                             Camera* camera, std::vector<size_t>* num_inliers,
+                             std::vector<std::vector<char>>* inlier_masks);
+
+// Estimate multiple absolute poses of a generalized camera, e.g. of a camera
+// rig, from the 2D-3D correspondences of all its cameras, using sequential
+// GP3P RANSAC.
+//
+// The poses are ordered and assigned to the correspondences as in
+// `EstimateAbsolutePoses`. The cameras must be calibrated and are not changed.
+//
+// @param options              RANSAC options, where the maximum error is given
+//                             in pixels.
+// @param max_num_poses        Maximum number of poses to estimate.
+// @param min_num_inliers      Minimum number of inliers of a pose.
+// @param points2D             Corresponding 2D points in pixels.
+// @param points3D             Corresponding 3D points.
+// @param camera_idxs          Index of the camera of each 2D point.
+// @param rel_qvecs            Rotation from the generalized camera frame to
+//                             the frame of each camera.
+// @param rel_tvecs            Translation from the generalized camera frame to
+//                             the frame of each camera.
+// @param cameras              The cameras of the generalized camera.
+// @param qvecs                Estimated rotation components from the world to
+//                             the generalized camera frame.
+// @param tvecs                Estimated translation components from the world
+//                             to the generalized camera frame.
+// @param num_inliers          Number of inliers of each pose.
+// @param inlier_masks         Inlier mask of each pose.
+//
+// @return                     The number of estimated poses.
+size_t EstimateGeneralizedAbsolutePoses(
+    const RANSACOptions& options, const size_t max_num_poses,
+    const size_t min_num_inliers, const std::vector<Eigen::Vector2d>& points2D,
+    const std::vector<Eigen::Vector3d>& points3D,
+    const std::vector<size_t>& camera_idxs,
+    const std::vector<Eigen::Vector4d>& rel_qvecs,
+    const std::vector<Eigen::Vector3d>& rel_tvecs,
+    const std::vector<Camera>& cameras, std::vector<Eigen::Vector4d>* qvecs,
+    std::vector<Eigen::Vector3d>* tvecs, std::vector<size_t>* num_inliers,
+    std::vector<std::vector<char>>* inlier_masks);
+
 // Estimate relative from 2D-2D correspondences.
 //
 // Pose of first camera is assumed to be at the origin without rotation. Pose
@@ -153,6 +245,35 @@ bool RefineAbsolutePose(const AbsolutePoseRefinementOptions& options,
                         Eigen::Vector4d* qvec, Eigen::Vector3d* tvec,
                         Camera* camera);
 
+// Refine the absolute pose of a generalized camera from the 2D-3D
+// correspondences of all its cameras. The cameras and their relative poses are
+// kept fixed, i.e. the focal length options are ignored.
+//
+// @param options              Refinement options.
+// @param inlier_mask          Inlier mask for 2D-3D correspondences.
+// @param points2D             Corresponding 2D points in pixels.
+// @param points3D             Corresponding 3D points.
+// @param camera_idxs          Index of the camera of each 2D point.
+// @param rel_qvecs            Relative rotation of each camera.
+// @param rel_tvecs            Relative translation of each camera.
+// @param cameras              The cameras of the generalized camera.
+// @param qvec                 Estimated rotation component of the generalized
+//                             camera as unit Quaternion coefficients.
+// @param tvec                 Estimated translation component of the
+//                             generalized camera.
+//
+// @return                     Whether the solution is usable.
+bool RefineGeneralizedAbsolutePose(
+    const AbsolutePoseRefinementOptions& options,
+    const std::vector<char>& inlier_mask,
+    const std::vector<Eigen::Vector2d>& points2D,
+    const std::vector<Eigen::Vector3d>& points3D,
+    const std::vector<size_t>& camera_idxs,
+    const std::vector<Eigen::Vector4d>& rel_qvecs,
+    const std::vector<Eigen::Vector3d>& rel_tvecs,
+    const std::vector<Camera>& cameras, Eigen::Vector4d* qvec,
+    Eigen::Vector3d* tvec);
+
 // Refine relative pose of two cameras.
 //
 // Minimizes the Sampson error between corresponding normalized points using
@@ -27,6 +27,188 @@
 #include "util/math.h"
 
 namespace colmap {
+namespace {
+
+typedef TriangulationEstimator::PointData PointData;
+typedef TriangulationEstimator::PoseData PoseData;
+
+// Squared residual of a single observation as in `Residuals`.
+double ComputeResidual(const TriangulationEstimator::ResidualType residual_type,
+                       const PointData& point, const PoseData& pose,
+                       const Eigen::Vector3d& xyz) {
+  if (!HasPointPositiveDepth(pose.proj_matrix, xyz)) {
+    return std::numeric_limits<double>::max();
+  }
+  if (residual_type ==
+      TriangulationEstimator::ResidualType::REPROJECTION_ERROR) {
+    return CalculateReprojectionError(point.point, xyz, pose.proj_matrix,
+                                      *pose.camera);
+  }
+  return CalculateAngularError(point.point_normalized, xyz, pose.proj_matrix);
+}
+
+// Two-view triangulation as in `Estimate`.
+bool EstimateTwoViewPoint(const double min_tri_angle, const PointData& point1,
+                          const PoseData& pose1, const PointData& point2,
+                          const PoseData& pose2, Eigen::Vector3d* xyz) {
+  *xyz = TriangulatePoint(pose1.proj_matrix, pose2.proj_matrix,
+                          point1.point_normalized, point2.point_normalized);
+  return HasPointPositiveDepth(pose1.proj_matrix, *xyz) &&
+         HasPointPositiveDepth(pose2.proj_matrix, *xyz) &&
+         CalculateTriangulationAngle(pose1.proj_center, pose2.proj_center,
+                                     *xyz) >= min_tri_angle;
+}
+
+// Three-view triangulation as in `Estimate`, which accumulates the same
+// normal equations as `TriangulateMultiViewPoint` without the copies.
+bool EstimateThreeViewPoint(const double min_tri_angle,
+                            const std::vector<PointData>& point_data,
+                            const std::vector<PoseData>& pose_data,
+                            Eigen::Vector3d* xyz) {
+  Eigen::Matrix4d A = Eigen::Matrix4d::Zero();
+  for (size_t i = 0; i < 3; ++i) {
+    const Eigen::Vector3d point =
+        point_data[i].point_normalized.homogeneous().normalized();
+    const Eigen::Matrix3x4d term =
+        pose_data[i].proj_matrix -
+        point * point.transpose() * pose_data[i].proj_matrix;
+    A += term.transpose() * term;
+  }
+
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> eigen_solver(A);
+  *xyz = eigen_solver.eigenvectors().col(0).hnormalized();
+
+  for (size_t i = 0; i < 3; ++i) {
+    if (!HasPointPositiveDepth(pose_data[i].proj_matrix, *xyz)) {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < 3; ++i) {
+    for (size_t j = 0; j < i; ++j) {
+      if (CalculateTriangulationAngle(pose_data[i].proj_center,
+                                      pose_data[j].proj_center,
+                                      *xyz) >= min_tri_angle) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+// Estimate a two- or three-view track with the same trials, in the same
+// order, as LORANSAC with the combination sampler, but without its buffers.
+// The two-view samples are all pairs and the local optimization of a sample
+// with three inliers is the three-view triangulation.
+bool EstimateShortTriangulation(const EstimateTriangulationOptions& options,
+                                const std::vector<PointData>& point_data,
+                                const std::vector<PoseData>& pose_data,
+                                std::vector<char>* inlier_mask,
+                                Eigen::Vector3d* xyz) {
+  typedef RANSAC<TriangulationEstimator> Ransac;
+
+  const size_t num_views = point_data.size();
+  const RANSACOptions& ransac_options = options.ransac_options;
+  const double max_residual = ransac_options.max_error * ransac_options.max_error;
+
+  const size_t kNumSamples = 100000;
+  const size_t max_num_trials = std::min<size_t>(
+      std::min<size_t>(ransac_options.max_num_trials,
+                       Ransac::ComputeNumTrials(
+                           static_cast<size_t>(ransac_options.min_inlier_ratio *
+                                               kNumSamples),
+                           kNumSamples, ransac_options.confidence)),
+      num_views * (num_views - 1) / 2);
+
+  const size_t kSampleIdxs[3][2] = {{0, 1}, {0, 2}, {1, 2}};
+
+  size_t best_num_inliers = 0;
+  double best_residual_sum = std::numeric_limits<double>::max();
+  double best_residuals[3];
+  size_t dyn_max_num_trials = max_num_trials;
+
+  const auto Evaluate = [&](const Eigen::Vector3d& model, double* residuals,
+                            size_t* num_inliers, double* residual_sum) {
+    *num_inliers = 0;
+    *residual_sum = 0;
+    for (size_t i = 0; i < num_views; ++i) {
+      residuals[i] = ComputeResidual(options.residual_type, point_data[i],
+                                     pose_data[i], model);
+      if (residuals[i] <= max_residual) {
+        *num_inliers += 1;
+        *residual_sum += residuals[i];
+      }
+    }
+  };
+
+  for (size_t trial = 0; trial < max_num_trials; ++trial) {
+    const size_t idx1 = kSampleIdxs[trial][0];
+    const size_t idx2 = kSampleIdxs[trial][1];
+
+    Eigen::Vector3d sample_xyz;
+    if (!EstimateTwoViewPoint(options.min_tri_angle, point_data[idx1],
+                              pose_data[idx1], point_data[idx2],
+                              pose_data[idx2], &sample_xyz)) {
+      continue;
+    }
+
+    double residuals[3];
+    size_t num_inliers;
+    double residual_sum;
+    Evaluate(sample_xyz, residuals, &num_inliers, &residual_sum);
+
+    if (num_inliers > best_num_inliers ||
+        (num_inliers == best_num_inliers && residual_sum < best_residual_sum)) {
+      best_num_inliers = num_inliers;
+      best_residual_sum = residual_sum;
+      std::copy(residuals, residuals + num_views, best_residuals);
+      *xyz = sample_xyz;
+
+      // Locally optimize from all three views, which are all inliers.
+      Eigen::Vector3d local_xyz;
+      if (num_inliers == 3 &&
+          EstimateThreeViewPoint(options.min_tri_angle, point_data, pose_data,
+                                 &local_xyz)) {
+        double local_residuals[3];
+        size_t local_num_inliers;
+        double local_residual_sum;
+        Evaluate(local_xyz, local_residuals, &local_num_inliers,
+                 &local_residual_sum);
+        if (local_num_inliers > num_inliers ||
+            (local_num_inliers == num_inliers &&
+             local_residual_sum < residual_sum)) {
+          best_num_inliers = local_num_inliers;
+          best_residual_sum = local_residual_sum;
+          std::copy(local_residuals, local_residuals + num_views,
+                    best_residuals);
+          *xyz = local_xyz;
+        }
+      }
+
+      dyn_max_num_trials = Ransac::ComputeNumTrials(
+          best_num_inliers, num_views, ransac_options.confidence);
+    }
+
+    if (trial >= dyn_max_num_trials &&
+        trial >= ransac_options.min_num_trials) {
+      break;
+    }
+  }
+
+  if (best_num_inliers < TriangulationEstimator::kMinNumSamples) {
+    return false;
+  }
+
+  inlier_mask->resize(num_views);
+  for (size_t i = 0; i < num_views; ++i) {
+    (*inlier_mask)[i] = best_residuals[i] <= max_residual;
+  }
+
+  return true;
+}
+
+}  // namespace
 
 void TriangulationEstimator::SetMinTriAngle(const double min_tri_angle) {
   CHECK_GE(min_tri_angle, 0);
@@ -46,15 +228,9 @@ std::vector<TriangulationEstimator::M_t> TriangulationEstimator::Estimate(
   if (point_data.size() == 2) {
     // Two-view triangulation.
 
-    const M_t xyz = TriangulatePoint(
-        pose_data[0].proj_matrix, pose_data[1].proj_matrix,
-        point_data[0].point_normalized, point_data[1].point_normalized);
-
-    if (HasPointPositiveDepth(pose_data[0].proj_matrix, xyz) &&
-        HasPointPositiveDepth(pose_data[1].proj_matrix, xyz) &&
-        CalculateTriangulationAngle(pose_data[0].proj_center,
-                                    pose_data[1].proj_center,
-                                    xyz) >= min_tri_angle_) {
+    M_t xyz;
+    if (EstimateTwoViewPoint(min_tri_angle_, point_data[0], pose_data[0],
+                             point_data[1], pose_data[1], &xyz)) {
       return std::vector<M_t>{xyz};
     }
   } else {
@@ -102,18 +278,8 @@ void TriangulationEstimator::Residuals(const std::vector<X_t>& point_data,
   residuals->resize(point_data.size());
 
   for (size_t i = 0; i < point_data.size(); ++i) {
-    if (HasPointPositiveDepth(pose_data[i].proj_matrix, xyz)) {
-      if (residual_type_ == ResidualType::REPROJECTION_ERROR) {
-        (*residuals)[i] = CalculateReprojectionError(point_data[i].point, xyz,
-                                                     pose_data[i].proj_matrix,
-                                                     *pose_data[i].camera);
-      } else if (residual_type_ == ResidualType::ANGULAR_ERROR) {
-        (*residuals)[i] = CalculateAngularError(point_data[i].point_normalized,
-                                                xyz, pose_data[i].proj_matrix);
-      }
-    } else {
-      (*residuals)[i] = std::numeric_limits<double>::max();
-    }
+    (*residuals)[i] =
+        ComputeResidual(residual_type_, point_data[i], pose_data[i], xyz);
   }
 }
 
@@ -128,6 +294,13 @@ bool EstimateTriangulation(
   CHECK_EQ(point_data.size(), pose_data.size());
   options.Check();
 
+  // Short tracks, which are the most common, have at most three samples, which
+  // are estimated directly. The trials of the SPRT depend on its random blocks.
+  if (point_data.size() <= 3 && !options.ransac_options.use_sprt) {
+    return EstimateShortTriangulation(options, point_data, pose_data,
+                                      inlier_mask, xyz);
+  }
+
   // Robustly estimate track using LORANSAC.
   LORANSAC<TriangulationEstimator, TriangulationEstimator,
            InlierSupportMeasurer, CombinationSampler>
@@ -0,0 +1,144 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "estimators/triangulation"
+#include "util/testing.h"
+
+#include <Eigen/Geometry>
+
+#include "base/pose.h"
+#include "base/projection.h"
+#include "estimators/triangulation.h"
+#include "optim/combination_sampler.h"
+#include "optim/loransac.h"
+#include "util/random.h"
+
+using namespace colmap;
+
+namespace {
+
+// Observe a random point from random poses, of which the given number of
+// observations are displaced outliers.
+void GenerateTrack(const Camera& camera, const size_t num_views,
+                   const size_t num_outliers,
+                   std::vector<TriangulationEstimator::PointData>* point_data,
+                   std::vector<TriangulationEstimator::PoseData>* pose_data) {
+  const Eigen::Vector3d xyz(RandomReal(-1.0, 1.0), RandomReal(-1.0, 1.0),
+                            RandomReal(4.0, 8.0));
+  point_data->clear();
+  pose_data->clear();
+  for (size_t i = 0; i < num_views; ++i) {
+    const Eigen::Vector4d qvec =
+        RotationMatrixToQuaternion(Eigen::AngleAxisd(
+                                       RandomReal(-0.2, 0.2),
+                                       Eigen::Vector3d(RandomReal(-1.0, 1.0),
+                                                       1, RandomReal(-1.0, 1.0))
+                                           .normalized())
+                                       .toRotationMatrix());
+    const Eigen::Vector3d tvec(RandomReal(-2.0, 2.0), RandomReal(-0.5, 0.5),
+                               RandomReal(-0.5, 0.5));
+    const Eigen::Matrix3x4d proj_matrix = ComposeProjectionMatrix(qvec, tvec);
+    Eigen::Vector2d point_normalized =
+        (proj_matrix * xyz.homogeneous()).hnormalized();
+    if (i < num_outliers) {
+      point_normalized += Eigen::Vector2d(RandomReal(-0.2, 0.2), 0.1);
+    }
+    point_data->emplace_back(camera.WorldToImage(point_normalized),
+                             point_normalized);
+    pose_data->emplace_back(proj_matrix, ProjectionCenterFromParameters(qvec, tvec),
+                            &camera);
+  }
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestShortTracksAsLORANSAC) {
+  SetPRNGSeed(0);
+
+  Camera camera;
+  camera.InitializeWithName("SIMPLE_PINHOLE", 500, 640, 480);
+
+  for (const auto residual_type :
+       {TriangulationEstimator::ResidualType::ANGULAR_ERROR,
+        TriangulationEstimator::ResidualType::REPROJECTION_ERROR}) {
+    EstimateTriangulationOptions options;
+    options.min_tri_angle = DegToRad(1.0);
+    options.residual_type = residual_type;
+    options.ransac_options.max_error =
+        residual_type == TriangulationEstimator::ResidualType::ANGULAR_ERROR
+            ? DegToRad(2.0)
+            : 4.0;
+    options.ransac_options.confidence = 0.9999;
+    options.ransac_options.min_inlier_ratio = 0.02;
+
+    for (size_t num_views = 2; num_views <= 3; ++num_views) {
+      for (size_t num_outliers = 0; num_outliers < num_views; ++num_outliers) {
+        for (int i = 0; i < 50; ++i) {
+          std::vector<TriangulationEstimator::PointData> point_data;
+          std::vector<TriangulationEstimator::PoseData> pose_data;
+          GenerateTrack(camera, num_views, num_outliers, &point_data,
+                        &pose_data);
+
+          std::vector<char> inlier_mask;
+          Eigen::Vector3d xyz;
+          const bool success = EstimateTriangulation(
+              options, point_data, pose_data, &inlier_mask, &xyz);
+
+          // The short tracks are estimated without LORANSAC.
+          LORANSAC<TriangulationEstimator, TriangulationEstimator,
+                   InlierSupportMeasurer, CombinationSampler>
+              ransac(options.ransac_options);
+          ransac.estimator.SetMinTriAngle(options.min_tri_angle);
+          ransac.estimator.SetResidualType(options.residual_type);
+          ransac.local_estimator.SetMinTriAngle(options.min_tri_angle);
+          ransac.local_estimator.SetResidualType(options.residual_type);
+          const auto report = ransac.Estimate(point_data, pose_data);
+
+          BOOST_CHECK_EQUAL(success, report.success);
+          if (success && report.success) {
+            BOOST_CHECK(inlier_mask == report.inlier_mask);
+            BOOST_CHECK_EQUAL(xyz, report.model);
+          }
+        }
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestShortTrackDegenerate) {
+  Camera camera;
+  camera.InitializeWithName("SIMPLE_PINHOLE", 500, 640, 480);
+
+  std::vector<TriangulationEstimator::PointData> point_data(2);
+  std::vector<TriangulationEstimator::PoseData> pose_data(2);
+  for (size_t i = 0; i < 2; ++i) {
+    point_data[i].point_normalized = Eigen::Vector2d(0.1, 0.2);
+    point_data[i].point = camera.WorldToImage(point_data[i].point_normalized);
+    pose_data[i].proj_matrix = Eigen::Matrix3x4d::Identity();
+    pose_data[i].proj_center = Eigen::Vector3d::Zero();
+    pose_data[i].camera = &camera;
+  }
+
+  EstimateTriangulationOptions options;
+  options.min_tri_angle = DegToRad(1.0);
+  options.ransac_options.max_error = DegToRad(2.0);
+
+  // Both views share the projection center without a triangulation angle.
+  std::vector<char> inlier_mask;
+  Eigen::Vector3d xyz;
+  BOOST_CHECK(!EstimateTriangulation(options, point_data, pose_data,
+                                     &inlier_mask, &xyz));
+}
@@ -26,8 +26,11 @@
 #include "estimators/fundamental_matrix.h"
 #include "estimators/homography_matrix.h"
 #include "estimators/translation_transform.h"
+#include "estimators/utils.h"
 #include "optim/loransac.h"
+#include "optim/random_sampler.h"
 #include "optim/ransac.h"
+#include "optim/sequential_ransac.h"
 #include "util/random.h"
 
 namespace colmap {
@@ -61,6 +64,16 @@ FeatureMatches ExtractOutlierMatches(const FeatureMatches& matches,
   return outlier_matches;
 }
 
+template <typename Report>
+TwoViewGeometry::ModelEstimate ToModelEstimate(Report* report) {
+  TwoViewGeometry::ModelEstimate estimate;
+  estimate.success = report->success;
+  estimate.num_inliers = report->support.num_inliers;
+  estimate.inlier_mask = std::move(report->inlier_mask);
+  estimate.model = report->model;
+  return estimate;
+}
+
 inline bool IsImagePointInBoundingBox(const Eigen::Vector2d& point,
                                       const double minx, const double maxx,
                                       const double miny, const double maxy) {
@@ -68,6 +81,318 @@ inline bool IsImagePointInBoundingBox(const Eigen::Vector2d& point,
          point(1) <= maxy;
 }
 
+inline double SquaredSampsonError(const Eigen::Vector2d& point1,
+                                  const Eigen::Vector2d& point2,
+                                  const Eigen::Matrix3d& E) {
+  const Eigen::Vector3d Ex1 = E * point1.homogeneous();
+  const Eigen::Vector3d Etx2 = E.transpose() * point2.homogeneous();
+  const double x2tEx1 = point2.homogeneous().dot(Ex1);
+  return x2tEx1 * x2tEx1 / (Ex1.head<2>().squaredNorm() +
+                            Etx2.head<2>().squaredNorm());
+}
+
+inline double SquaredTransferError(const Eigen::Vector2d& point1,
+                                   const Eigen::Vector2d& point2,
+                                   const Eigen::Matrix3d& H) {
+  return (point2 - (H * point1.homogeneous()).hnormalized()).squaredNorm();
+}
+
+// One model of the joint estimation of the two-view models, which is updated
+// with the hypotheses of the shared random samples as in `LORANSAC`.
+class JointModelEstimation {
+ public:
+  JointModelEstimation(const RANSACOptions& options, const bool sampson,
+                       const size_t min_num_samples,
+                       const std::vector<Eigen::Vector2d>& points1,
+                       const std::vector<Eigen::Vector2d>& points2)
+      : sampson_(sampson),
+        min_num_samples_(min_num_samples),
+        points1_(points1),
+        points2_(points2),
+        confidence_(options.confidence),
+        min_num_trials_(options.min_num_trials),
+        max_residual_(options.max_error * options.max_error),
+        num_trials_(0),
+        best_model_(Eigen::Matrix3d::Zero()) {
+    // Determine the maximum number of trials as in `RANSAC`.
+    const size_t kNumSamples = 100000;
+    max_num_trials_ = std::min<size_t>(
+        options.max_num_trials,
+        ComputeNumTrials(
+            static_cast<size_t>(options.min_inlier_ratio * kNumSamples),
+            kNumSamples));
+    dyn_max_num_trials_ = max_num_trials_;
+  }
+
+  virtual ~JointModelEstimation() = default;
+
+  bool IsFinished() const {
+    return num_trials_ >= max_num_trials_ ||
+           (num_trials_ >= dyn_max_num_trials_ &&
+            num_trials_ >= min_num_trials_);
+  }
+
+  bool ReachedMinNumTrials() const { return num_trials_ >= min_num_trials_; }
+
+  // The number of inliers of the best model so far, which is a lower bound
+  // of the number of inliers of the final model.
+  size_t MinNumInliers() const { return best_support_.num_inliers; }
+
+  // An upper bound of the number of inliers of the final model, which holds
+  // with the confidence, since a model with more inliers would have been
+  // sampled in the trials so far otherwise.
+  size_t MaxNumInliers() const {
+    if (num_trials_ == 0 || confidence_ >= 1) {
+      return points1_.size();
+    }
+    const double max_inlier_ratio =
+        std::pow(1 - std::pow(1 - confidence_, 1.0 / num_trials_),
+                 1.0 / min_num_samples_);
+    return std::max(best_support_.num_inliers,
+                    static_cast<size_t>(
+                        std::ceil(max_inlier_ratio * points1_.size())));
+  }
+
+  // Estimate the hypotheses from the leading matches of the sample.
+  void EstimateHypotheses(const std::vector<size_t>& sample_idxs) {
+    X_rand_.resize(min_num_samples_);
+    Y_rand_.resize(min_num_samples_);
+    for (size_t i = 0; i < min_num_samples_; ++i) {
+      X_rand_[i] = points1_[sample_idxs[i]];
+      Y_rand_[i] = points2_[sample_idxs[i]];
+    }
+    hypotheses = Estimate(X_rand_, Y_rand_);
+    supports.assign(hypotheses.size(), InlierSupportMeasurer::Support());
+    for (auto& support : supports) {
+      support.residual_sum = 0;
+    }
+  }
+
+  // Accumulate the residuals of the match under all hypotheses.
+  void ScoreMatch(const size_t idx) {
+    const Eigen::Vector2d& point1 = points1_[idx];
+    const Eigen::Vector2d& point2 = points2_[idx];
+    for (size_t i = 0; i < hypotheses.size(); ++i) {
+      const double residual =
+          sampson_ ? SquaredSampsonError(point1, point2, hypotheses[i])
+                   : SquaredTransferError(point1, point2, hypotheses[i]);
+      if (residual <= max_residual_) {
+        supports[i].num_inliers += 1;
+        supports[i].residual_sum += residual;
+      }
+    }
+  }
+
+  // Update the best model with the scored hypotheses of the trial.
+  void Update() {
+    num_trials_ += 1;
+
+    for (size_t i = 0; i < hypotheses.size(); ++i) {
+      if (!support_measurer_.Compare(supports[i], best_support_)) {
+        continue;
+      }
+
+      const auto support = supports[i];
+      best_support_ = support;
+      best_model_ = hypotheses[i];
+
+      // Estimate locally optimized model from inliers.
+      if (support.num_inliers > min_num_samples_) {
+        ComputeResiduals(hypotheses[i]);
+        std::vector<Eigen::Vector2d> X_inlier;
+        std::vector<Eigen::Vector2d> Y_inlier;
+        X_inlier.reserve(support.num_inliers);
+        Y_inlier.reserve(support.num_inliers);
+        for (size_t j = 0; j < residuals_.size(); ++j) {
+          if (residuals_[j] <= max_residual_) {
+            X_inlier.push_back(points1_[j]);
+            Y_inlier.push_back(points2_[j]);
+          }
+        }
+
+        for (const auto& local_model : LocalEstimate(X_inlier, Y_inlier)) {
+          ComputeResiduals(local_model);
+          const auto local_support =
+              support_measurer_.Evaluate(residuals_, max_residual_);
+          if (support_measurer_.Compare(local_support, best_support_)) {
+            best_support_ = local_support;
+            best_model_ = local_model;
+          }
+        }
+      }
+
+      dyn_max_num_trials_ =
+          ComputeNumTrials(best_support_.num_inliers, points1_.size());
+    }
+  }
+
+  // Return the best model and its inlier mask.
+  TwoViewGeometry::ModelEstimate Finish() {
+    TwoViewGeometry::ModelEstimate estimate;
+    estimate.num_inliers = best_support_.num_inliers;
+
+    // No valid model was found
+    if (best_support_.num_inliers < min_num_samples_) {
+      return estimate;
+    }
+
+    estimate.success = true;
+    estimate.model = best_model_;
+
+    ComputeResiduals(best_model_);
+    estimate.inlier_mask.resize(residuals_.size());
+    for (size_t i = 0; i < residuals_.size(); ++i) {
+      estimate.inlier_mask[i] = residuals_[i] <= max_residual_;
+    }
+
+    return estimate;
+  }
+
+  // The hypotheses of the current trial and their supports.
+  std::vector<Eigen::Matrix3d> hypotheses;
+  std::vector<InlierSupportMeasurer::Support> supports;
+
+ protected:
+  virtual std::vector<Eigen::Matrix3d> Estimate(
+      const std::vector<Eigen::Vector2d>& points1,
+      const std::vector<Eigen::Vector2d>& points2) = 0;
+  virtual std::vector<Eigen::Matrix3d> LocalEstimate(
+      const std::vector<Eigen::Vector2d>& points1,
+      const std::vector<Eigen::Vector2d>& points2) = 0;
+
+ private:
+  // Same as `RANSAC::ComputeNumTrials` for the minimal sample size of the
+  // model.
+  size_t ComputeNumTrials(const size_t num_inliers,
+                          const size_t num_samples) const {
+    const double inlier_ratio = num_inliers / static_cast<double>(num_samples);
+    const double nom = 1 - confidence_;
+    if (nom <= 0) {
+      return std::numeric_limits<size_t>::max();
+    }
+    const double denom = 1 - std::pow(inlier_ratio, min_num_samples_);
+    if (denom <= 0) {
+      return 1;
+    }
+    return static_cast<size_t>(std::ceil(std::log(nom) / std::log(denom)));
+  }
+
+  void ComputeResiduals(const Eigen::Matrix3d& model) {
+    if (sampson_) {
+      ComputeSquaredSampsonError(points1_, points2_, model, &residuals_);
+    } else {
+      ComputeSquaredTransferError(points1_, points2_, model, &residuals_);
+    }
+  }
+
+  const bool sampson_;
+  const size_t min_num_samples_;
+  const std::vector<Eigen::Vector2d>& points1_;
+  const std::vector<Eigen::Vector2d>& points2_;
+  const double confidence_;
+  const size_t min_num_trials_;
+  const double max_residual_;
+
+  InlierSupportMeasurer support_measurer_;
+  size_t max_num_trials_;
+  size_t dyn_max_num_trials_;
+  size_t num_trials_;
+  InlierSupportMeasurer::Support best_support_;
+  Eigen::Matrix3d best_model_;
+
+  std::vector<Eigen::Vector2d> X_rand_;
+  std::vector<Eigen::Vector2d> Y_rand_;
+  std::vector<double> residuals_;
+};
+
+template <typename Estimator, typename LocalEstimator>
+class JointModelEstimationImpl : public JointModelEstimation {
+ public:
+  JointModelEstimationImpl(const RANSACOptions& options, const bool sampson,
+                           const std::vector<Eigen::Vector2d>& points1,
+                           const std::vector<Eigen::Vector2d>& points2)
+      : JointModelEstimation(options, sampson, Estimator::kMinNumSamples,
+                             points1, points2) {}
+
+ protected:
+  std::vector<Eigen::Matrix3d> Estimate(
+      const std::vector<Eigen::Vector2d>& points1,
+      const std::vector<Eigen::Vector2d>& points2) override {
+    return estimator_.Estimate(points1, points2);
+  }
+
+  std::vector<Eigen::Matrix3d> LocalEstimate(
+      const std::vector<Eigen::Vector2d>& points1,
+      const std::vector<Eigen::Vector2d>& points2) override {
+    if (points1.size() < LocalEstimator::kMinNumSamples) {
+      return {};
+    }
+    return local_estimator_.Estimate(points1, points2);
+  }
+
+ private:
+  Estimator estimator_;
+  LocalEstimator local_estimator_;
+};
+
+// Whether the test `num_inliers1 > min_ratio * num_inliers2` has the same
+// outcome for all numbers of inliers within the bounds of the estimations.
+bool IsInlierRatioTestDecided(const JointModelEstimation& estimation1,
+                              const JointModelEstimation& estimation2,
+                              const double min_ratio) {
+  return estimation1.MinNumInliers() >
+             min_ratio * estimation2.MaxNumInliers() ||
+         estimation1.MaxNumInliers() <=
+             min_ratio * estimation2.MinNumInliers();
+}
+
+// Estimate the models jointly from shared random samples of the matches, of
+// which every model uses the leading matches of its minimal sample size. All
+// hypotheses of a sample are scored in one pass over the matches. The
+// estimation stops once all models are finished or `IsDecided` returns true
+// after the minimum number of trials.
+template <typename IsDecided>
+void EstimateJointModels(
+    const std::vector<JointModelEstimation*>& estimations,
+    const size_t num_matches, const size_t max_min_num_samples,
+    const IsDecided& is_decided) {
+  RandomSampler sampler(max_min_num_samples);
+  sampler.Initialize(num_matches);
+
+  std::vector<JointModelEstimation*> active_estimations;
+  active_estimations.reserve(estimations.size());
+  while (true) {
+    active_estimations.clear();
+    bool reached_min_num_trials = true;
+    for (auto estimation : estimations) {
+      if (!estimation->IsFinished()) {
+        active_estimations.push_back(estimation);
+      }
+      reached_min_num_trials &= estimation->ReachedMinNumTrials();
+    }
+
+    if (active_estimations.empty() ||
+        (reached_min_num_trials && is_decided())) {
+      break;
+    }
+
+    const std::vector<size_t> sample_idxs = sampler.Sample();
+    for (auto estimation : active_estimations) {
+      estimation->EstimateHypotheses(sample_idxs);
+    }
+
+    for (size_t i = 0; i < num_matches; ++i) {
+      for (auto estimation : active_estimations) {
+        estimation->ScoreMatch(i);
+      }
+    }
+
+    for (auto estimation : active_estimations) {
+      estimation->Update();
+    }
+  }
+}
+
 }  // namespace
 
 void TwoViewGeometry::Estimate(const Camera& camera1,
@@ -136,6 +461,64 @@ void TwoViewGeometry::EstimateMultiple(
   }
 }
 
+void TwoViewGeometry::EstimateMultipleMotions(
+    const Camera& camera1, const std::vector<Eigen::Vector2d>& points1,
+    const Camera& camera2, const std::vector<Eigen::Vector2d>& points2,
+    const FeatureMatches& matches, const Options& options) {
+  options.Check();
+
+  inlier_labels.clear();
+
+  if (matches.size() < options.min_num_inliers) {
+    config = ConfigurationType::DEGENERATE;
+    return;
+  }
+
+  // Extract corresponding points.
+  std::vector<Eigen::Vector2d> matched_points1(matches.size());
+  std::vector<Eigen::Vector2d> matched_points2(matches.size());
+  for (size_t i = 0; i < matches.size(); ++i) {
+    matched_points1[i] = points1[matches[i].point2D_idx1];
+    matched_points2[i] = points2[matches[i].point2D_idx2];
+  }
+
+  // Estimate the epipolar models of all motions.
+
+  SequentialRANSAC<FundamentalMatrixSevenPointEstimator,
+                   FundamentalMatrixEightPointEstimator>
+      F_ransac(options.ransac_options, options.max_num_models,
+               options.min_num_inliers);
+  const auto F_report = F_ransac.Estimate(matched_points1, matched_points2);
+
+  // A single motion is verified as usual, such that planar, panoramic and
+  // watermark configurations are detected.
+  if (F_report.models.size() < 2) {
+    Estimate(camera1, points1, camera2, points2, matches, options);
+    return;
+  }
+
+  config = ConfigurationType::MULTIPLE;
+  F = F_report.models[0];
+  F_num_inliers = F_report.supports[0].num_inliers;
+
+  // Group the inlier matches by their motion.
+  inlier_matches.clear();
+  for (size_t model_idx = 0; model_idx < F_report.models.size();
+       ++model_idx) {
+    for (size_t i = 0; i < matches.size(); ++i) {
+      if (F_report.labels[i] == static_cast<int>(model_idx)) {
+        inlier_matches.push_back(matches[i]);
+        inlier_labels.push_back(static_cast<int>(model_idx));
+      }
+    }
+  }
+
+  inlier_mask.resize(matches.size());
+  for (size_t i = 0; i < matches.size(); ++i) {
+    inlier_mask[i] = F_report.labels[i] != -1;
+  }
+}
+
 void TwoViewGeometry::EstimateWithRelativePose(
     const Camera& camera1, const std::vector<Eigen::Vector2d>& points1,
     const Camera& camera2, const std::vector<Eigen::Vector2d>& points2,
@@ -234,28 +617,85 @@ void TwoViewGeometry::EstimateCalibrated(
        camera2.ImageToWorldThreshold(options.ransac_options.max_error)) /
       2;
 
+  if (options.joint_estimation &&
+      matches.size() >= FundamentalMatrixSevenPointEstimator::kMinNumSamples) {
+    JointModelEstimationImpl<EssentialMatrixFivePointEstimator,
+                             EssentialMatrixFivePointEstimator>
+        E_estimation(E_ransac_options, true, matched_points1_N,
+                     matched_points2_N);
+    JointModelEstimationImpl<FundamentalMatrixSevenPointEstimator,
+                             FundamentalMatrixEightPointEstimator>
+        F_estimation(options.ransac_options, true, matched_points1,
+                     matched_points2);
+    JointModelEstimationImpl<HomographyMatrixEstimator,
+                             HomographyMatrixEstimator>
+        H_estimation(options.ransac_options, false, matched_points1,
+                     matched_points2);
+
+    // The configuration is decided if the outcomes of the inlier ratio tests
+    // of `DetermineCalibratedConfiguration` are certain.
+    const auto IsDecided = [&]() {
+      if (E_estimation.MinNumInliers() >
+          options.min_E_F_inlier_ratio * F_estimation.MaxNumInliers()) {
+        return E_estimation.MinNumInliers() >= options.min_num_inliers &&
+               IsInlierRatioTestDecided(H_estimation, E_estimation,
+                                        options.max_H_inlier_ratio);
+      } else if (E_estimation.MaxNumInliers() <=
+                 options.min_E_F_inlier_ratio * F_estimation.MinNumInliers()) {
+        return F_estimation.MinNumInliers() >= options.min_num_inliers &&
+               IsInlierRatioTestDecided(H_estimation, F_estimation,
+                                        options.max_H_inlier_ratio);
+      }
+      return false;
+    };
+
+    EstimateJointModels({&E_estimation, &F_estimation, &H_estimation},
+                        matches.size(),
+                        FundamentalMatrixSevenPointEstimator::kMinNumSamples,
+                        IsDecided);
+
+    DetermineCalibratedConfiguration(
+        camera1, matched_points1, camera2, matched_points2, matches,
+        E_estimation.Finish(), F_estimation.Finish(), H_estimation.Finish(),
+        options);
+    return;
+  }
+
   LORANSAC<EssentialMatrixFivePointEstimator, EssentialMatrixFivePointEstimator>
       E_ransac(E_ransac_options);
-  const auto E_report = E_ransac.Estimate(matched_points1_N, matched_points2_N);
-  E = E_report.model;
-  E_num_inliers = E_report.support.num_inliers;
+  auto E_report = E_ransac.Estimate(matched_points1_N, matched_points2_N);
 
   LORANSAC<FundamentalMatrixSevenPointEstimator,
            FundamentalMatrixEightPointEstimator>
       F_ransac(options.ransac_options);
-  const auto F_report = F_ransac.Estimate(matched_points1, matched_points2);
-  F = F_report.model;
-  F_num_inliers = F_report.support.num_inliers;
+  auto F_report = F_ransac.Estimate(matched_points1, matched_points2);
 
   // Estimate planar or panoramic model.
 
   LORANSAC<HomographyMatrixEstimator, HomographyMatrixEstimator> H_ransac(
       options.ransac_options);
-  const auto H_report = H_ransac.Estimate(matched_points1, matched_points2);
-  H = H_report.model;
-  H_num_inliers = H_report.support.num_inliers;
+  auto H_report = H_ransac.Estimate(matched_points1, matched_points2);
+
+  DetermineCalibratedConfiguration(
+      camera1, matched_points1, camera2, matched_points2, matches,
+      ToModelEstimate(&E_report), ToModelEstimate(&F_report),
+      ToModelEstimate(&H_report), options);
+}
 
-  if ((!E_report.success && !F_report.success && !H_report.success) ||
+void TwoViewGeometry::DetermineCalibratedConfiguration(
+    const Camera& camera1, const std::vector<Eigen::Vector2d>& matched_points1,
+    const Camera& camera2, const std::vector<Eigen::Vector2d>& matched_points2,
+    const FeatureMatches& matches, const ModelEstimate& E_estimate,
+    const ModelEstimate& F_estimate, const ModelEstimate& H_estimate,
+    const Options& options) {
+  E = E_estimate.model;
+  E_num_inliers = E_estimate.num_inliers;
+  F = F_estimate.model;
+  F_num_inliers = F_estimate.num_inliers;
+  H = H_estimate.model;
+  H_num_inliers = H_estimate.num_inliers;
+
+  if ((!E_estimate.success && !F_estimate.success && !H_estimate.success) ||
       (E_num_inliers < options.min_num_inliers &&
        F_num_inliers < options.min_num_inliers &&
        H_num_inliers < options.min_num_inliers)) {
@@ -275,46 +715,46 @@ void TwoViewGeometry::EstimateCalibrated(
   const std::vector<char>* best_inlier_mask = nullptr;
   size_t num_inliers = 0;
 
-  if (E_report.success && E_F_inlier_ratio > options.min_E_F_inlier_ratio &&
+  if (E_estimate.success && E_F_inlier_ratio > options.min_E_F_inlier_ratio &&
       E_num_inliers >= options.min_num_inliers) {
     // Calibrated configuration.
 
     // Always use the model with maximum matches.
     if (E_num_inliers >= F_num_inliers) {
       num_inliers = E_num_inliers;
-      best_inlier_mask = &E_report.inlier_mask;
+      best_inlier_mask = &E_estimate.inlier_mask;
     } else {
       num_inliers = F_num_inliers;
-      best_inlier_mask = &F_report.inlier_mask;
+      best_inlier_mask = &F_estimate.inlier_mask;
     }
 
     if (H_E_inlier_ratio > options.max_H_inlier_ratio) {
       config = PLANAR_OR_PANORAMIC;
       if (H_num_inliers > num_inliers) {
         num_inliers = H_num_inliers;
-        best_inlier_mask = &H_report.inlier_mask;
+        best_inlier_mask = &H_estimate.inlier_mask;
       }
     } else {
       config = ConfigurationType::CALIBRATED;
     }
-  } else if (F_report.success && F_num_inliers >= options.min_num_inliers) {
+  } else if (F_estimate.success && F_num_inliers >= options.min_num_inliers) {
     // Uncalibrated configuration.
 
     num_inliers = F_num_inliers;
-    best_inlier_mask = &F_report.inlier_mask;
+    best_inlier_mask = &F_estimate.inlier_mask;
 
     if (H_F_inlier_ratio > options.max_H_inlier_ratio) {
       config = ConfigurationType::PLANAR_OR_PANORAMIC;
       if (H_num_inliers > num_inliers) {
         num_inliers = H_num_inliers;
-        best_inlier_mask = &H_report.inlier_mask;
+        best_inlier_mask = &H_estimate.inlier_mask;
       }
     } else {
       config = ConfigurationType::UNCALIBRATED;
     }
-  } else if (H_report.success && H_num_inliers >= options.min_num_inliers) {
+  } else if (H_estimate.success && H_num_inliers >= options.min_num_inliers) {
     num_inliers = H_num_inliers;
-    best_inlier_mask = &H_report.inlier_mask;
+    best_inlier_mask = &H_estimate.inlier_mask;
     config = ConfigurationType::PLANAR_OR_PANORAMIC;
   } else {
     config = ConfigurationType::DEGENERATE;
@@ -353,24 +793,62 @@ void TwoViewGeometry::EstimateUncalibrated(
     matched_points2[i] = points2[matches[i].point2D_idx2];
   }
 
+  if (options.joint_estimation &&
+      matches.size() >= FundamentalMatrixSevenPointEstimator::kMinNumSamples) {
+    JointModelEstimationImpl<FundamentalMatrixSevenPointEstimator,
+                             FundamentalMatrixEightPointEstimator>
+        F_estimation(options.ransac_options, true, matched_points1,
+                     matched_points2);
+    JointModelEstimationImpl<HomographyMatrixEstimator,
+                             HomographyMatrixEstimator>
+        H_estimation(options.ransac_options, false, matched_points1,
+                     matched_points2);
+
+    const auto IsDecided = [&]() {
+      return F_estimation.MinNumInliers() >= options.min_num_inliers &&
+             IsInlierRatioTestDecided(H_estimation, F_estimation,
+                                      options.max_H_inlier_ratio);
+    };
+
+    EstimateJointModels({&F_estimation, &H_estimation}, matches.size(),
+                        FundamentalMatrixSevenPointEstimator::kMinNumSamples,
+                        IsDecided);
+
+    DetermineUncalibratedConfiguration(
+        camera1, matched_points1, camera2, matched_points2, matches,
+        F_estimation.Finish(), H_estimation.Finish(), options);
+    return;
+  }
+
   // Estimate epipolar model.
 
   LORANSAC<FundamentalMatrixSevenPointEstimator,
            FundamentalMatrixEightPointEstimator>
       F_ransac(options.ransac_options);
-  const auto F_report = F_ransac.Estimate(matched_points1, matched_points2);
-  F = F_report.model;
-  F_num_inliers = F_report.support.num_inliers;
+  auto F_report = F_ransac.Estimate(matched_points1, matched_points2);
 
   // Estimate planar or panoramic model.
 
   LORANSAC<HomographyMatrixEstimator, HomographyMatrixEstimator> H_ransac(
       options.ransac_options);
-  const auto H_report = H_ransac.Estimate(matched_points1, matched_points2);
-  H = H_report.model;
-  H_num_inliers = H_report.support.num_inliers;
+  auto H_report = H_ransac.Estimate(matched_points1, matched_points2);
+
+  DetermineUncalibratedConfiguration(
+      camera1, matched_points1, camera2, matched_points2, matches,
+      ToModelEstimate(&F_report), ToModelEstimate(&H_report), options);
+}
 
-  if ((!F_report.success && !H_report.success) ||
+void TwoViewGeometry::DetermineUncalibratedConfiguration(
+    const Camera& camera1, const std::vector<Eigen::Vector2d>& matched_points1,
+    const Camera& camera2, const std::vector<Eigen::Vector2d>& matched_points2,
+    const FeatureMatches& matches, const ModelEstimate& F_estimate,
+    const ModelEstimate& H_estimate, const Options& options) {
+  F = F_estimate.model;
+  F_num_inliers = F_estimate.num_inliers;
+  H = H_estimate.model;
+  H_num_inliers = H_estimate.num_inliers;
+
+  if ((!F_estimate.success && !H_estimate.success) ||
       (F_num_inliers < options.min_num_inliers &&
        H_num_inliers < options.min_num_inliers)) {
     config = ConfigurationType::DEGENERATE;
@@ -389,12 +867,12 @@ void TwoViewGeometry::EstimateUncalibrated(
   }
 
   inlier_matches =
-      ExtractInlierMatches(matches, F_num_inliers, F_report.inlier_mask);
-  inlier_mask = F_report.inlier_mask;
+      ExtractInlierMatches(matches, F_num_inliers, F_estimate.inlier_mask);
+  inlier_mask = F_estimate.inlier_mask;
 
   if (options.detect_watermark &&
       DetectWatermark(camera1, matched_points1, camera2, matched_points2,
-                      F_num_inliers, F_report.inlier_mask, options)) {
+                      F_num_inliers, F_estimate.inlier_mask, options)) {
     config = ConfigurationType::WATERMARK;
   }
 }
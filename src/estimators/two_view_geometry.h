@@ -89,6 +89,17 @@ struct TwoViewGeometry {
     // Whether to ignore watermark models in multiple model estimation.
     bool multiple_ignore_watermark = true;
 
+    // The maximum number of motion models in `EstimateMultipleMotions`.
+    size_t max_num_models = 2;
+
+    // Whether to estimate the essential matrix, fundamental matrix and
+    // homography jointly instead of in separate RANSAC runs. The hypotheses of
+    // all models are estimated from shared random samples and scored in one
+    // pass over the matches, and the sampling stops as soon as the inlier
+    // ratio tests above are decided with the RANSAC confidence. The sequential
+    // probability ratio test and multiple threads are not used in this mode.
+    bool joint_estimation = false;
+
     // Options used to robustly estimate the geometry.
     RANSACOptions ransac_options;
 
@@ -102,10 +113,27 @@ struct TwoViewGeometry {
       CHECK_LE(watermark_min_inlier_ratio, 1);
       CHECK_GE(watermark_border_size, 0);
       CHECK_LE(watermark_border_size, 1);
+      CHECK_GT(max_num_models, 0);
       ransac_options.Check();
     }
   };
 
+  // A robustly estimated essential matrix, fundamental matrix or homography
+  // of an image pair.
+  struct ModelEstimate {
+    // Whether the estimation was successful.
+    bool success = false;
+
+    // The number of inliers of the model.
+    size_t num_inliers = 0;
+
+    // Boolean mask which is true if a match is an inlier.
+    std::vector<char> inlier_mask;
+
+    // The estimated model.
+    Eigen::Matrix3d model = Eigen::Matrix3d::Zero();
+  };
+
   TwoViewGeometry()
       : config(ConfigurationType::UNDEFINED),
         E(Eigen::Matrix3d::Zero()),
@@ -155,6 +183,27 @@ struct TwoViewGeometry {
                         const std::vector<Eigen::Vector2d>& points2,
                         const FeatureMatches& matches, const Options& options);
 
+  // Estimate up to `max_num_models` fundamental matrices of independent
+  // motions, e.g. of the background and of a moving object, from one pool of
+  // RANSAC hypotheses. Every match is an inlier of at most one motion and the
+  // configuration is `MULTIPLE` if at least two motions are found, in which
+  // case `F` is the matrix of the dominant motion and `inlier_labels` holds the
+  // motion of every inlier match. Otherwise, the two-view geometry is
+  // estimated as in `Estimate`.
+  //
+  // @param camera1         Camera of first image.
+  // @param points1         Feature points in first image.
+  // @param camera2         Camera of second image.
+  // @param points2         Feature points in second image.
+  // @param matches         Feature matches between first and second image.
+  // @param options         Two-view geometry estimation options.
+  void EstimateMultipleMotions(const Camera& camera1,
+                               const std::vector<Eigen::Vector2d>& points1,
+                               const Camera& camera2,
+                               const std::vector<Eigen::Vector2d>& points2,
+                               const FeatureMatches& matches,
+                               const Options& options);
+
   // Estimate two-view geometry and its relative pose from a calibrated or an
   // uncalibrated image pair.
   //
@@ -201,6 +250,44 @@ struct TwoViewGeometry {
                             const FeatureMatches& matches,
                             const Options& options);
 
+  // Determine the configuration and the inlier matches of a calibrated image
+  // pair from its robustly estimated models, as in `EstimateCalibrated`. This
+  // allows to estimate the models elsewhere, e.g. for batches of image pairs.
+  //
+  // @param camera1          Camera of first image.
+  // @param matched_points1  Matched feature points in first image.
+  // @param camera2          Camera of second image.
+  // @param matched_points2  Matched feature points in second image.
+  // @param matches          Feature matches between first and second image.
+  // @param E_estimate       Essential matrix of the normalized points.
+  // @param F_estimate       Fundamental matrix of the matched points.
+  // @param H_estimate       Homography of the matched points.
+  // @param options          Two-view geometry estimation options.
+  void DetermineCalibratedConfiguration(
+      const Camera& camera1, const std::vector<Eigen::Vector2d>& matched_points1,
+      const Camera& camera2, const std::vector<Eigen::Vector2d>& matched_points2,
+      const FeatureMatches& matches, const ModelEstimate& E_estimate,
+      const ModelEstimate& F_estimate, const ModelEstimate& H_estimate,
+      const Options& options);
+
+  // Determine the configuration and the inlier matches of an uncalibrated
+  // image pair from its robustly estimated models, as in
+  // `EstimateUncalibrated`.
+  //
+  // @param camera1          Camera of first image.
+  // @param matched_points1  Matched feature points in first image.
+  // @param camera2          Camera of second image.
+  // @param matched_points2  Matched feature points in second image.
+  // @param matches          Feature matches between first and second image.
+  // @param F_estimate       Fundamental matrix of the matched points.
+  // @param H_estimate       Homography of the matched points.
+  // @param options          Two-view geometry estimation options.
+  void DetermineUncalibratedConfiguration(
+      const Camera& camera1, const std::vector<Eigen::Vector2d>& matched_points1,
+      const Camera& camera2, const std::vector<Eigen::Vector2d>& matched_points2,
+      const FeatureMatches& matches, const ModelEstimate& F_estimate,
+      const ModelEstimate& H_estimate, const Options& options);
+
   // Detect if inlier matches are caused by a watermark.
   // A watermark causes a pure translation in the border are of the image.
   static bool DetectWatermark(const Camera& camera1,
@@ -229,6 +316,10 @@ struct TwoViewGeometry {
   FeatureMatches inlier_matches;
   std::vector<char> inlier_mask;
 
+  // The index of the motion of every inlier match, if the inliers of several
+  // motions were estimated by `EstimateMultipleMotions`, and empty otherwise.
+  std::vector<int> inlier_labels;
+
   // Median triangulation angle.
   double tri_angle;
 
@@ -0,0 +1,408 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "estimators/two_view_geometry_batch.h"
+
+#include <memory>
+
+#include "estimators/essential_matrix.h"
+#include "estimators/fundamental_matrix.h"
+#include "estimators/homography_matrix.h"
+#include "estimators/utils.h"
+#include "optim/random_sampler.h"
+#include "optim/ransac.h"
+#include "util/logging.h"
+
+namespace colmap {
+namespace {
+
+// The maximum number of trials of an estimation in one round. The hypotheses
+// of a round are scored together, such that a smaller number reduces the
+// trials beyond the adaptive number of trials and a larger number reduces the
+// number of rounds.
+const size_t kMaxNumTrialsPerRound = 64;
+
+// One LO-RANSAC estimation of a batch, which draws the hypotheses of a round
+// and is then updated with the best of them.
+class BatchEstimation {
+ public:
+  virtual ~BatchEstimation() = default;
+
+  // Whether the estimation reached its number of trials.
+  virtual bool IsFinished() const = 0;
+
+  // Draw the samples of the next round and set up the problem of their
+  // hypotheses.
+  virtual void DrawHypotheses(TwoViewHypothesisScorer::Problem* problem) = 0;
+
+  // Update the best model with the scored hypotheses of the round.
+  virtual void Update(const TwoViewHypothesisScorer::Problem& problem,
+                      const TwoViewHypothesisScorer::Result& result) = 0;
+
+  // Return the best model and its inlier mask.
+  virtual TwoViewGeometry::ModelEstimate Finish() = 0;
+};
+
+template <typename Estimator, typename LocalEstimator>
+class LORANSACBatchEstimation : public BatchEstimation {
+ public:
+  LORANSACBatchEstimation(
+      const RANSACOptions& options,
+      const TwoViewHypothesisScorer::ResidualType residual_type,
+      const std::vector<Eigen::Vector2d>& points1,
+      const std::vector<Eigen::Vector2d>& points2)
+      : options_(options),
+        residual_type_(residual_type),
+        points1_(points1),
+        points2_(points2),
+        sampler_(Estimator::kMinNumSamples),
+        num_trials_(0),
+        num_round_trials_(0),
+        best_model_(Eigen::Matrix3d::Zero()),
+        best_model_is_local_(false) {
+    options_.Check();
+    CHECK_EQ(points1_.size(), points2_.size());
+
+    // Determine the maximum number of trials as in `RANSAC`.
+    const size_t kNumSamples = 100000;
+    max_num_trials_ = std::min<size_t>(
+        options_.max_num_trials,
+        RANSAC<Estimator>::ComputeNumTrials(
+            static_cast<size_t>(options_.min_inlier_ratio * kNumSamples),
+            kNumSamples, options_.confidence));
+
+    if (points1_.size() < Estimator::kMinNumSamples) {
+      max_num_trials_ = 0;
+    } else {
+      sampler_.Initialize(points1_.size());
+      max_num_trials_ =
+          std::min<size_t>(max_num_trials_, sampler_.MaxNumSamples());
+    }
+
+    dyn_max_num_trials_ = max_num_trials_;
+  }
+
+  bool IsFinished() const override {
+    return num_trials_ >= max_num_trials_ ||
+           (num_trials_ >= dyn_max_num_trials_ &&
+            num_trials_ >= options_.min_num_trials);
+  }
+
+  void DrawHypotheses(TwoViewHypothesisScorer::Problem* problem) override {
+    const size_t num_required_trials = std::min(
+        max_num_trials_,
+        std::max<size_t>(dyn_max_num_trials_, options_.min_num_trials));
+    num_round_trials_ =
+        std::min(kMaxNumTrialsPerRound, num_required_trials - num_trials_);
+
+    problem->residual_type = residual_type_;
+    problem->points1 = &points1_;
+    problem->points2 = &points2_;
+    problem->max_residual = options_.max_error * options_.max_error;
+    problem->models.clear();
+
+    std::vector<Eigen::Vector2d> X_rand(Estimator::kMinNumSamples);
+    std::vector<Eigen::Vector2d> Y_rand(Estimator::kMinNumSamples);
+    for (size_t i = 0; i < num_round_trials_; ++i) {
+      sampler_.SampleXY(points1_, points2_, &X_rand, &Y_rand);
+      for (const auto& model : estimator_.Estimate(X_rand, Y_rand)) {
+        problem->models.push_back(model);
+      }
+    }
+  }
+
+  void Update(const TwoViewHypothesisScorer::Problem& problem,
+              const TwoViewHypothesisScorer::Result& result) override {
+    num_trials_ += num_round_trials_;
+
+    if (problem.models.empty() ||
+        !support_measurer_.Compare(result.support, best_support_)) {
+      return;
+    }
+
+    const auto& support = result.support;
+    best_support_ = support;
+    best_model_ = problem.models[result.best_model_idx];
+    best_model_is_local_ = false;
+
+    // Estimate locally optimized model from inliers.
+    if (support.num_inliers > Estimator::kMinNumSamples &&
+        support.num_inliers >= LocalEstimator::kMinNumSamples) {
+      std::vector<Eigen::Vector2d> X_inlier;
+      std::vector<Eigen::Vector2d> Y_inlier;
+      X_inlier.reserve(support.num_inliers);
+      Y_inlier.reserve(support.num_inliers);
+      for (size_t i = 0; i < result.inlier_mask.size(); ++i) {
+        if (result.inlier_mask[i]) {
+          X_inlier.push_back(points1_[i]);
+          Y_inlier.push_back(points2_[i]);
+        }
+      }
+
+      std::vector<double> residuals;
+      for (const auto& local_model :
+           local_estimator_.Estimate(X_inlier, Y_inlier)) {
+        local_estimator_.Residuals(points1_, points2_, local_model,
+                                   &residuals);
+        const auto local_support =
+            support_measurer_.Evaluate(residuals, problem.max_residual);
+
+        // Check if non-locally optimized model is better.
+        if (support_measurer_.Compare(local_support, support)) {
+          best_support_ = local_support;
+          best_model_ = local_model;
+          best_model_is_local_ = true;
+        }
+      }
+    }
+
+    dyn_max_num_trials_ = RANSAC<Estimator>::ComputeNumTrials(
+        best_support_.num_inliers, points1_.size(), options_.confidence);
+  }
+
+  TwoViewGeometry::ModelEstimate Finish() override {
+    TwoViewGeometry::ModelEstimate estimate;
+    estimate.num_inliers = best_support_.num_inliers;
+
+    // No valid model was found
+    if (best_support_.num_inliers < Estimator::kMinNumSamples) {
+      return estimate;
+    }
+
+    estimate.success = true;
+    estimate.model = best_model_;
+
+    std::vector<double> residuals;
+    if (best_model_is_local_) {
+      local_estimator_.Residuals(points1_, points2_, best_model_, &residuals);
+    } else {
+      estimator_.Residuals(points1_, points2_, best_model_, &residuals);
+    }
+
+    const double max_residual = options_.max_error * options_.max_error;
+    estimate.inlier_mask.resize(residuals.size());
+    for (size_t i = 0; i < residuals.size(); ++i) {
+      estimate.inlier_mask[i] = residuals[i] <= max_residual;
+    }
+
+    return estimate;
+  }
+
+ private:
+  RANSACOptions options_;
+  const TwoViewHypothesisScorer::ResidualType residual_type_;
+  const std::vector<Eigen::Vector2d>& points1_;
+  const std::vector<Eigen::Vector2d>& points2_;
+
+  Estimator estimator_;
+  LocalEstimator local_estimator_;
+  RandomSampler sampler_;
+  InlierSupportMeasurer support_measurer_;
+
+  size_t max_num_trials_;
+  size_t dyn_max_num_trials_;
+  size_t num_trials_;
+  size_t num_round_trials_;
+
+  InlierSupportMeasurer::Support best_support_;
+  Eigen::Matrix3d best_model_;
+  bool best_model_is_local_;
+};
+
+// The matched points and the model estimations of an image pair.
+struct BatchPair {
+  bool calibrated = false;
+  std::vector<Eigen::Vector2d> matched_points1;
+  std::vector<Eigen::Vector2d> matched_points2;
+  std::vector<Eigen::Vector2d> matched_points1_N;
+  std::vector<Eigen::Vector2d> matched_points2_N;
+  std::vector<std::unique_ptr<BatchEstimation>> estimations;
+};
+
+}  // namespace
+
+void CPUTwoViewHypothesisScorer::Score(const std::vector<Problem>& problems,
+                                       std::vector<Result>* results) {
+  CHECK_NOTNULL(results);
+  results->clear();
+  results->resize(problems.size());
+
+  InlierSupportMeasurer support_measurer;
+  std::vector<double> residuals;
+
+  const auto ComputeResiduals = [&residuals](const Problem& problem,
+                                             const Eigen::Matrix3d& model) {
+    if (problem.residual_type == ResidualType::SAMPSON) {
+      ComputeSquaredSampsonError(*problem.points1, *problem.points2, model,
+                                 &residuals);
+    } else {
+      ComputeSquaredTransferError(*problem.points1, *problem.points2, model,
+                                  &residuals);
+    }
+  };
+
+  for (size_t i = 0; i < problems.size(); ++i) {
+    const Problem& problem = problems[i];
+    Result& result = (*results)[i];
+    if (problem.models.empty()) {
+      continue;
+    }
+
+    for (size_t j = 0; j < problem.models.size(); ++j) {
+      ComputeResiduals(problem, problem.models[j]);
+      const auto support =
+          support_measurer.Evaluate(residuals, problem.max_residual);
+      if (j == 0 || support_measurer.Compare(support, result.support)) {
+        result.best_model_idx = j;
+        result.support = support;
+      }
+    }
+
+    ComputeResiduals(problem, problem.models[result.best_model_idx]);
+    result.inlier_mask.resize(residuals.size());
+    for (size_t k = 0; k < residuals.size(); ++k) {
+      result.inlier_mask[k] = residuals[k] <= problem.max_residual;
+    }
+  }
+}
+
+void EstimateTwoViewGeometries(
+    const std::vector<TwoViewGeometryBatchItem>& items,
+    const TwoViewGeometry::Options& options, TwoViewHypothesisScorer* scorer,
+    std::vector<TwoViewGeometry>* geometries) {
+  options.Check();
+  CHECK_NOTNULL(scorer);
+  CHECK_NOTNULL(geometries);
+
+  geometries->clear();
+  geometries->resize(items.size());
+
+  typedef TwoViewHypothesisScorer::ResidualType ResidualType;
+
+  // Set up the estimations of the essential matrix, the fundamental matrix and
+  // the homography as in `TwoViewGeometry::EstimateCalibrated` and
+  // `TwoViewGeometry::EstimateUncalibrated`.
+  std::vector<BatchPair> pairs(items.size());
+  for (size_t i = 0; i < items.size(); ++i) {
+    const TwoViewGeometryBatchItem& item = items[i];
+    const Camera& camera1 = *item.camera1;
+    const Camera& camera2 = *item.camera2;
+    const FeatureMatches& matches = *item.matches;
+    BatchPair& pair = pairs[i];
+
+    if (matches.size() < options.min_num_inliers) {
+      (*geometries)[i].config = TwoViewGeometry::ConfigurationType::DEGENERATE;
+      continue;
+    }
+
+    pair.calibrated =
+        camera1.HasPriorFocalLength() && camera2.HasPriorFocalLength();
+
+    pair.matched_points1.resize(matches.size());
+    pair.matched_points2.resize(matches.size());
+    for (size_t j = 0; j < matches.size(); ++j) {
+      pair.matched_points1[j] = (*item.points1)[matches[j].point2D_idx1];
+      pair.matched_points2[j] = (*item.points2)[matches[j].point2D_idx2];
+    }
+
+    if (pair.calibrated) {
+      pair.matched_points1_N.resize(matches.size());
+      pair.matched_points2_N.resize(matches.size());
+      for (size_t j = 0; j < matches.size(); ++j) {
+        pair.matched_points1_N[j] =
+            camera1.ImageToWorld(pair.matched_points1[j]);
+        pair.matched_points2_N[j] =
+            camera2.ImageToWorld(pair.matched_points2[j]);
+      }
+
+      auto E_ransac_options = options.ransac_options;
+      E_ransac_options.max_error =
+          (camera1.ImageToWorldThreshold(options.ransac_options.max_error) +
+           camera2.ImageToWorldThreshold(options.ransac_options.max_error)) /
+          2;
+
+      pair.estimations.emplace_back(
+          new LORANSACBatchEstimation<EssentialMatrixFivePointEstimator,
+                                      EssentialMatrixFivePointEstimator>(
+              E_ransac_options, ResidualType::SAMPSON, pair.matched_points1_N,
+              pair.matched_points2_N));
+    }
+
+    pair.estimations.emplace_back(
+        new LORANSACBatchEstimation<FundamentalMatrixSevenPointEstimator,
+                                    FundamentalMatrixEightPointEstimator>(
+            options.ransac_options, ResidualType::SAMPSON,
+            pair.matched_points1, pair.matched_points2));
+    pair.estimations.emplace_back(
+        new LORANSACBatchEstimation<HomographyMatrixEstimator,
+                                    HomographyMatrixEstimator>(
+            options.ransac_options, ResidualType::TRANSFER,
+            pair.matched_points1, pair.matched_points2));
+  }
+
+  // Run the rounds of trials until all estimations are finished.
+  std::vector<TwoViewHypothesisScorer::Problem> problems;
+  std::vector<TwoViewHypothesisScorer::Result> results;
+  std::vector<BatchEstimation*> round_estimations;
+  while (true) {
+    problems.clear();
+    round_estimations.clear();
+    for (auto& pair : pairs) {
+      for (auto& estimation : pair.estimations) {
+        if (!estimation->IsFinished()) {
+          problems.emplace_back();
+          estimation->DrawHypotheses(&problems.back());
+          round_estimations.push_back(estimation.get());
+        }
+      }
+    }
+
+    if (problems.empty()) {
+      break;
+    }
+
+    scorer->Score(problems, &results);
+    CHECK_EQ(results.size(), problems.size());
+
+    for (size_t i = 0; i < problems.size(); ++i) {
+      round_estimations[i]->Update(problems[i], results[i]);
+    }
+  }
+
+  for (size_t i = 0; i < items.size(); ++i) {
+    BatchPair& pair = pairs[i];
+    if (pair.estimations.empty()) {
+      continue;
+    }
+
+    const TwoViewGeometryBatchItem& item = items[i];
+    TwoViewGeometry& geometry = (*geometries)[i];
+    if (pair.calibrated) {
+      geometry.DetermineCalibratedConfiguration(
+          *item.camera1, pair.matched_points1, *item.camera2,
+          pair.matched_points2, *item.matches, pair.estimations[0]->Finish(),
+          pair.estimations[1]->Finish(), pair.estimations[2]->Finish(),
+          options);
+    } else {
+      geometry.DetermineUncalibratedConfiguration(
+          *item.camera1, pair.matched_points1, *item.camera2,
+          pair.matched_points2, *item.matches, pair.estimations[0]->Finish(),
+          pair.estimations[1]->Finish(), options);
+    }
+  }
+}
+
+}  // namespace colmap
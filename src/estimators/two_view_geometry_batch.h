@@ -0,0 +1,119 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_ESTIMATORS_TWO_VIEW_GEOMETRY_BATCH_H_
+#define COLMAP_SRC_ESTIMATORS_TWO_VIEW_GEOMETRY_BATCH_H_
+
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "base/camera.h"
+#include "estimators/two_view_geometry.h"
+#include "feature/types.h"
+#include "optim/support_measurement.h"
+
+namespace colmap {
+
+// Scorer of the RANSAC hypotheses of the two-view models of many image pairs
+// at once. Every problem holds the matched points of one model estimation and
+// a set of hypotheses, of which the scorer determines the one with the best
+// inlier support and its inlier mask.
+class TwoViewHypothesisScorer {
+ public:
+  enum class ResidualType {
+    // Squared Sampson error of an essential or fundamental matrix.
+    SAMPSON,
+    // Squared transfer error of a homography.
+    TRANSFER,
+  };
+
+  struct Problem {
+    ResidualType residual_type = ResidualType::SAMPSON;
+
+    // The matched points, which must outlive the scoring.
+    const std::vector<Eigen::Vector2d>* points1 = nullptr;
+    const std::vector<Eigen::Vector2d>* points2 = nullptr;
+
+    // The maximum residual of an inlier.
+    double max_residual = 0.0;
+
+    // The hypotheses to be scored.
+    std::vector<Eigen::Matrix3d> models;
+  };
+
+  struct Result {
+    // The index of the best hypothesis, which has the most inliers and the
+    // smallest sum of inlier residuals among them. Ties are broken by the
+    // lower index.
+    size_t best_model_idx = 0;
+
+    // The support of the best hypothesis.
+    InlierSupportMeasurer::Support support;
+
+    // Boolean mask which is true if a match is an inlier of the best
+    // hypothesis.
+    std::vector<char> inlier_mask;
+  };
+
+  virtual ~TwoViewHypothesisScorer() = default;
+
+  // Score the hypotheses of all problems, where problems without hypotheses
+  // are skipped and have a default result.
+  virtual void Score(const std::vector<Problem>& problems,
+                     std::vector<Result>* results) = 0;
+};
+
+// Reference implementation of the scorer, which evaluates the residuals with
+// the estimators on the calling thread.
+class CPUTwoViewHypothesisScorer : public TwoViewHypothesisScorer {
+ public:
+  void Score(const std::vector<Problem>& problems,
+             std::vector<Result>* results) override;
+};
+
+// An image pair, whose two-view geometry is estimated in a batch. The pointers
+// must outlive the estimation.
+struct TwoViewGeometryBatchItem {
+  const Camera* camera1 = nullptr;
+  const std::vector<Eigen::Vector2d>* points1 = nullptr;
+  const Camera* camera2 = nullptr;
+  const std::vector<Eigen::Vector2d>* points2 = nullptr;
+  const FeatureMatches* matches = nullptr;
+};
+
+// Estimate the two-view geometries of a batch of image pairs as in
+// `TwoViewGeometry::Estimate`, where the LO-RANSAC estimations of all pairs
+// proceed together in rounds of trials. In every round, the minimal samples
+// of all unfinished estimations are drawn and solved on the calling thread
+// and all hypotheses of the round are scored at once by the scorer, which can
+// run on the GPU. The local optimization of new best models, the adaptive
+// number of trials and the final inlier masks are computed on the calling
+// thread. The sequential probability ratio test is not used, since all
+// hypotheses of a round are scored on all matches anyway.
+//
+// @param items           The image pairs of the batch.
+// @param options         Two-view geometry estimation options.
+// @param scorer          The scorer of the hypotheses.
+// @param geometries      The estimated two-view geometry of every pair.
+void EstimateTwoViewGeometries(
+    const std::vector<TwoViewGeometryBatchItem>& items,
+    const TwoViewGeometry::Options& options, TwoViewHypothesisScorer* scorer,
+    std::vector<TwoViewGeometry>* geometries);
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_ESTIMATORS_TWO_VIEW_GEOMETRY_BATCH_H_
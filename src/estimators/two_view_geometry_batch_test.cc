@@ -0,0 +1,183 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "estimators/two_view_geometry_batch"
+#include "util/testing.h"
+
+#include <Eigen/Geometry>
+
+#include "estimators/two_view_geometry_batch.h"
+#include "util/random.h"
+
+using namespace colmap;
+
+namespace {
+
+const size_t kNumInliers = 200;
+const size_t kNumOutliers = 100;
+
+struct SyntheticPair {
+  Camera camera1;
+  Camera camera2;
+  std::vector<Eigen::Vector2d> points1;
+  std::vector<Eigen::Vector2d> points2;
+  FeatureMatches matches;
+};
+
+// Project random points of a general or a planar scene into two images and
+// append random outliers to the second image.
+SyntheticPair GenerateSyntheticPair(const bool calibrated, const bool planar) {
+  SyntheticPair pair;
+  pair.camera1.InitializeWithName("SIMPLE_PINHOLE", 500, 640, 480);
+  pair.camera1.SetPriorFocalLength(calibrated);
+  pair.camera2 = pair.camera1;
+
+  const Eigen::Matrix3d R =
+      Eigen::AngleAxisd(0.1, Eigen::Vector3d(0.2, 1, 0.1).normalized())
+          .toRotationMatrix();
+  const Eigen::Vector3d t(-1, 0.1, 0.2);
+
+  for (size_t i = 0; i < kNumInliers + kNumOutliers; ++i) {
+    const Eigen::Vector3d point3D(
+        RandomReal(-2.0, 2.0), RandomReal(-1.5, 1.5),
+        planar ? 6.0 : RandomReal(4.0, 8.0));
+    pair.points1.push_back(
+        pair.camera1.WorldToImage(point3D.hnormalized()));
+    if (i < kNumInliers) {
+      pair.points2.push_back(
+          pair.camera2.WorldToImage((R * point3D + t).hnormalized()));
+    } else {
+      pair.points2.emplace_back(RandomReal(0.0, 640.0),
+                                RandomReal(0.0, 480.0));
+    }
+    FeatureMatch match;
+    match.point2D_idx1 = i;
+    match.point2D_idx2 = i;
+    pair.matches.push_back(match);
+  }
+
+  return pair;
+}
+
+TwoViewGeometry::Options CreateOptions() {
+  TwoViewGeometry::Options options;
+  options.ransac_options.max_error = 2;
+  options.ransac_options.confidence = 0.999;
+  options.ransac_options.min_inlier_ratio = 0.25;
+  return options;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestCPUScorer) {
+  SetPRNGSeed(0);
+
+  const SyntheticPair pair = GenerateSyntheticPair(false, true);
+
+  const Eigen::Matrix3d K = pair.camera1.CalibrationMatrix();
+  const Eigen::Matrix3d R =
+      Eigen::AngleAxisd(0.1, Eigen::Vector3d(0.2, 1, 0.1).normalized())
+          .toRotationMatrix();
+  const Eigen::Vector3d t(-1, 0.1, 0.2);
+  const Eigen::Vector3d n(0, 0, 1);
+  const Eigen::Matrix3d H = K * (R + t * n.transpose() / 6.0) * K.inverse();
+
+  TwoViewHypothesisScorer::Problem problem;
+  problem.residual_type = TwoViewHypothesisScorer::ResidualType::TRANSFER;
+  problem.points1 = &pair.points1;
+  problem.points2 = &pair.points2;
+  problem.max_residual = 1;
+  problem.models = {Eigen::Matrix3d::Identity(), H, 2 * H};
+
+  std::vector<TwoViewHypothesisScorer::Problem> problems(2);
+  problems[1] = problem;
+
+  CPUTwoViewHypothesisScorer scorer;
+  std::vector<TwoViewHypothesisScorer::Result> results;
+  scorer.Score(problems, &results);
+
+  BOOST_REQUIRE_EQUAL(results.size(), 2);
+  BOOST_CHECK(results[0].inlier_mask.empty());
+
+  // The homography is scale invariant, but the first of equal hypotheses wins.
+  BOOST_CHECK_EQUAL(results[1].best_model_idx, 1);
+  BOOST_CHECK_GE(results[1].support.num_inliers, kNumInliers);
+  BOOST_CHECK_LT(results[1].support.num_inliers, kNumInliers + 5);
+  BOOST_REQUIRE_EQUAL(results[1].inlier_mask.size(), pair.points1.size());
+  for (size_t i = 0; i < kNumInliers; ++i) {
+    BOOST_CHECK(results[1].inlier_mask[i]);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestEstimateTwoViewGeometries) {
+  SetPRNGSeed(0);
+
+  std::vector<SyntheticPair> pairs;
+  pairs.push_back(GenerateSyntheticPair(false, false));
+  pairs.push_back(GenerateSyntheticPair(true, false));
+  pairs.push_back(GenerateSyntheticPair(true, true));
+  pairs.push_back(GenerateSyntheticPair(false, false));
+  pairs.back().matches.resize(10);
+
+  std::vector<TwoViewGeometryBatchItem> items(pairs.size());
+  for (size_t i = 0; i < pairs.size(); ++i) {
+    items[i].camera1 = &pairs[i].camera1;
+    items[i].points1 = &pairs[i].points1;
+    items[i].camera2 = &pairs[i].camera2;
+    items[i].points2 = &pairs[i].points2;
+    items[i].matches = &pairs[i].matches;
+  }
+
+  const TwoViewGeometry::Options options = CreateOptions();
+
+  CPUTwoViewHypothesisScorer scorer;
+  std::vector<TwoViewGeometry> geometries;
+  EstimateTwoViewGeometries(items, options, &scorer, &geometries);
+  BOOST_REQUIRE_EQUAL(geometries.size(), pairs.size());
+
+  BOOST_CHECK_EQUAL(geometries[0].config,
+                    TwoViewGeometry::ConfigurationType::UNCALIBRATED);
+  BOOST_CHECK_EQUAL(geometries[1].config,
+                    TwoViewGeometry::ConfigurationType::CALIBRATED);
+  BOOST_CHECK_EQUAL(geometries[2].config,
+                    TwoViewGeometry::ConfigurationType::PLANAR_OR_PANORAMIC);
+  BOOST_CHECK_EQUAL(geometries[3].config,
+                    TwoViewGeometry::ConfigurationType::DEGENERATE);
+
+  for (size_t i = 0; i < 3; ++i) {
+    BOOST_CHECK_GE(geometries[i].inlier_matches.size(), kNumInliers);
+    BOOST_CHECK_LE(geometries[i].inlier_matches.size(),
+                   kNumInliers + kNumOutliers / 10);
+    BOOST_CHECK_EQUAL(geometries[i].inlier_mask.size(),
+                      pairs[i].matches.size());
+
+    // The same configuration as the estimation of a single image pair.
+    TwoViewGeometry geometry;
+    geometry.Estimate(pairs[i].camera1, pairs[i].points1, pairs[i].camera2,
+                      pairs[i].points2, pairs[i].matches, options);
+    BOOST_CHECK_EQUAL(geometries[i].config, geometry.config);
+    BOOST_CHECK_LE(std::abs(static_cast<int>(geometries[i].F_num_inliers) -
+                            static_cast<int>(geometry.F_num_inliers)),
+                   5);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestEmptyBatch) {
+  CPUTwoViewHypothesisScorer scorer;
+  std::vector<TwoViewGeometry> geometries(1);
+  EstimateTwoViewGeometries({}, CreateOptions(), &scorer, &geometries);
+  BOOST_CHECK(geometries.empty());
+}
@@ -0,0 +1,317 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "estimators/two_view_geometry_cuda.h"
+
+#include <unordered_map>
+
+#include <cuda_runtime.h>
+
+#include "optim/support_measurement.h"
+#include "util/cuda.h"
+#include "util/cudacc.h"
+#include "util/logging.h"
+
+namespace colmap {
+namespace {
+
+// The number of threads that evaluate the residuals of one hypothesis.
+const int kBlockSize = 256;
+
+struct Correspondence {
+  double x1;
+  double y1;
+  double x2;
+  double y2;
+};
+
+// A hypothesis together with the layout of the correspondences of its problem.
+struct DeviceModel {
+  // The row-major model matrix.
+  double M[9];
+  double max_residual;
+  int residual_type;
+  int points_offset;
+  int num_points;
+  // The offset of the inlier mask of the problem, only used for the best
+  // hypotheses.
+  int mask_offset;
+};
+
+struct DeviceSupport {
+  int num_inliers;
+  double residual_sum;
+};
+
+// The same residuals as `ComputeSquaredSampsonError` and
+// `ComputeSquaredTransferError`.
+__device__ double ComputeResidual(const DeviceModel& model,
+                                  const Correspondence& corr) {
+  const double* M = model.M;
+  if (model.residual_type ==
+      static_cast<int>(TwoViewHypothesisScorer::ResidualType::SAMPSON)) {
+    const double Ex1_0 = M[0] * corr.x1 + M[1] * corr.y1 + M[2];
+    const double Ex1_1 = M[3] * corr.x1 + M[4] * corr.y1 + M[5];
+    const double Ex1_2 = M[6] * corr.x1 + M[7] * corr.y1 + M[8];
+    const double Etx2_0 = M[0] * corr.x2 + M[3] * corr.y2 + M[6];
+    const double Etx2_1 = M[1] * corr.x2 + M[4] * corr.y2 + M[7];
+    const double x2tEx1 = corr.x2 * Ex1_0 + corr.y2 * Ex1_1 + Ex1_2;
+    return x2tEx1 * x2tEx1 / (Ex1_0 * Ex1_0 + Ex1_1 * Ex1_1 +
+                              Etx2_0 * Etx2_0 + Etx2_1 * Etx2_1);
+  } else {
+    const double pd_0 = M[0] * corr.x1 + M[1] * corr.y1 + M[2];
+    const double pd_1 = M[3] * corr.x1 + M[4] * corr.y1 + M[5];
+    const double pd_2 = M[6] * corr.x1 + M[7] * corr.y1 + M[8];
+    const double inv_pd_2 = 1.0 / pd_2;
+    const double dd_0 = corr.x2 - pd_0 * inv_pd_2;
+    const double dd_1 = corr.y2 - pd_1 * inv_pd_2;
+    return dd_0 * dd_0 + dd_1 * dd_1;
+  }
+}
+
+__global__ void ScoreModelsKernel(const Correspondence* points,
+                                  const DeviceModel* models,
+                                  DeviceSupport* supports) {
+  __shared__ int shared_num_inliers[kBlockSize];
+  __shared__ double shared_residual_sum[kBlockSize];
+
+  const DeviceModel model = models[blockIdx.x];
+  const Correspondence* model_points = points + model.points_offset;
+
+  int num_inliers = 0;
+  double residual_sum = 0;
+  for (int i = threadIdx.x; i < model.num_points; i += blockDim.x) {
+    const double residual = ComputeResidual(model, model_points[i]);
+    if (residual <= model.max_residual) {
+      num_inliers += 1;
+      residual_sum += residual;
+    }
+  }
+
+  shared_num_inliers[threadIdx.x] = num_inliers;
+  shared_residual_sum[threadIdx.x] = residual_sum;
+  __syncthreads();
+
+  for (unsigned int stride = blockDim.x / 2; stride > 0; stride /= 2) {
+    if (threadIdx.x < stride) {
+      shared_num_inliers[threadIdx.x] +=
+          shared_num_inliers[threadIdx.x + stride];
+      shared_residual_sum[threadIdx.x] +=
+          shared_residual_sum[threadIdx.x + stride];
+    }
+    __syncthreads();
+  }
+
+  if (threadIdx.x == 0) {
+    supports[blockIdx.x].num_inliers = shared_num_inliers[0];
+    supports[blockIdx.x].residual_sum = shared_residual_sum[0];
+  }
+}
+
+__global__ void ComputeInlierMasksKernel(const Correspondence* points,
+                                         const DeviceModel* models,
+                                         char* masks) {
+  const DeviceModel model = models[blockIdx.x];
+  const Correspondence* model_points = points + model.points_offset;
+  char* mask = masks + model.mask_offset;
+  for (int i = threadIdx.x; i < model.num_points; i += blockDim.x) {
+    mask[i] = ComputeResidual(model, model_points[i]) <= model.max_residual;
+  }
+}
+
+DeviceModel MakeDeviceModel(const TwoViewHypothesisScorer::Problem& problem,
+                            const Eigen::Matrix3d& model,
+                            const size_t points_offset) {
+  DeviceModel device_model;
+  for (int row = 0; row < 3; ++row) {
+    for (int col = 0; col < 3; ++col) {
+      device_model.M[3 * row + col] = model(row, col);
+    }
+  }
+  device_model.max_residual = problem.max_residual;
+  device_model.residual_type = static_cast<int>(problem.residual_type);
+  device_model.points_offset = static_cast<int>(points_offset);
+  device_model.num_points = static_cast<int>(problem.points1->size());
+  device_model.mask_offset = 0;
+  return device_model;
+}
+
+}  // namespace
+
+CUDATwoViewHypothesisScorer::CUDATwoViewHypothesisScorer(const int gpu_index)
+    : points_buffer_(nullptr),
+      points_capacity_(0),
+      models_buffer_(nullptr),
+      models_capacity_(0),
+      supports_buffer_(nullptr),
+      supports_capacity_(0),
+      masks_buffer_(nullptr),
+      masks_capacity_(0) {
+  SetBestCudaDevice(gpu_index);
+}
+
+CUDATwoViewHypothesisScorer::~CUDATwoViewHypothesisScorer() {
+  for (void* buffer :
+       {points_buffer_, models_buffer_, supports_buffer_, masks_buffer_}) {
+    if (buffer != nullptr) {
+      CUDA_SAFE_CALL(cudaFree(buffer));
+    }
+  }
+}
+
+void CUDATwoViewHypothesisScorer::Reserve(const size_t num_bytes,
+                                          void** buffer, size_t* capacity) {
+  if (num_bytes <= *capacity) {
+    return;
+  }
+  if (*buffer != nullptr) {
+    CUDA_SAFE_CALL(cudaFree(*buffer));
+  }
+  // Over-allocate, such that slowly growing batches do not reallocate often.
+  *capacity = num_bytes + num_bytes / 2;
+  CUDA_SAFE_CALL(cudaMalloc(buffer, *capacity));
+}
+
+void CUDATwoViewHypothesisScorer::Score(const std::vector<Problem>& problems,
+                                        std::vector<Result>* results) {
+  CHECK_NOTNULL(results);
+  results->clear();
+  results->resize(problems.size());
+
+  // Upload the correspondences of every set of matched points once, since the
+  // fundamental matrix and the homography of an image pair share them.
+  std::vector<Correspondence> points;
+  std::unordered_map<const std::vector<Eigen::Vector2d>*, size_t>
+      points_offsets;
+  std::vector<DeviceModel> models;
+  std::vector<size_t> problem_model_offsets(problems.size() + 1, 0);
+  for (size_t i = 0; i < problems.size(); ++i) {
+    const Problem& problem = problems[i];
+    problem_model_offsets[i + 1] = problem_model_offsets[i];
+    if (problem.models.empty()) {
+      continue;
+    }
+
+    CHECK_EQ(problem.points1->size(), problem.points2->size());
+    const auto points_offset =
+        points_offsets.emplace(problem.points1, points.size());
+    if (points_offset.second) {
+      for (size_t j = 0; j < problem.points1->size(); ++j) {
+        const Eigen::Vector2d& point1 = (*problem.points1)[j];
+        const Eigen::Vector2d& point2 = (*problem.points2)[j];
+        points.push_back({point1(0), point1(1), point2(0), point2(1)});
+      }
+    }
+
+    for (const auto& model : problem.models) {
+      models.push_back(
+          MakeDeviceModel(problem, model, points_offset.first->second));
+    }
+    problem_model_offsets[i + 1] += problem.models.size();
+  }
+
+  if (models.empty()) {
+    return;
+  }
+
+  const size_t num_models = models.size();
+
+  // The best models are stored after the scored models.
+  Reserve(points.size() * sizeof(Correspondence), &points_buffer_,
+          &points_capacity_);
+  Reserve((num_models + problems.size()) * sizeof(DeviceModel),
+          &models_buffer_, &models_capacity_);
+  Reserve(num_models * sizeof(DeviceSupport), &supports_buffer_,
+          &supports_capacity_);
+
+  Correspondence* points_device = static_cast<Correspondence*>(points_buffer_);
+  DeviceModel* models_device = static_cast<DeviceModel*>(models_buffer_);
+  DeviceSupport* supports_device = static_cast<DeviceSupport*>(supports_buffer_);
+
+  CUDA_SAFE_CALL(cudaMemcpy(points_device, points.data(),
+                            points.size() * sizeof(Correspondence),
+                            cudaMemcpyHostToDevice));
+  CUDA_SAFE_CALL(cudaMemcpy(models_device, models.data(),
+                            num_models * sizeof(DeviceModel),
+                            cudaMemcpyHostToDevice));
+
+  ScoreModelsKernel<<<num_models, kBlockSize>>>(points_device, models_device,
+                                                 supports_device);
+  CUDA_SYNC_AND_CHECK();
+
+  std::vector<DeviceSupport> supports(num_models);
+  CUDA_SAFE_CALL(cudaMemcpy(supports.data(), supports_device,
+                            num_models * sizeof(DeviceSupport),
+                            cudaMemcpyDeviceToHost));
+
+  // Select the best hypothesis of every problem.
+  InlierSupportMeasurer support_measurer;
+  std::vector<DeviceModel> best_models;
+  std::vector<size_t> mask_offsets;
+  size_t num_mask_bytes = 0;
+  for (size_t i = 0; i < problems.size(); ++i) {
+    const size_t begin = problem_model_offsets[i];
+    const size_t end = problem_model_offsets[i + 1];
+    if (begin == end) {
+      continue;
+    }
+
+    Result& result = (*results)[i];
+    for (size_t j = begin; j < end; ++j) {
+      InlierSupportMeasurer::Support support;
+      support.num_inliers = static_cast<size_t>(supports[j].num_inliers);
+      support.residual_sum = supports[j].residual_sum;
+      if (j == begin || support_measurer.Compare(support, result.support)) {
+        result.best_model_idx = j - begin;
+        result.support = support;
+      }
+    }
+
+    DeviceModel best_model = models[begin + result.best_model_idx];
+    best_model.mask_offset = static_cast<int>(num_mask_bytes);
+    best_models.push_back(best_model);
+    mask_offsets.push_back(num_mask_bytes);
+    num_mask_bytes += best_model.num_points;
+  }
+
+  Reserve(num_mask_bytes, &masks_buffer_, &masks_capacity_);
+  char* masks_device = static_cast<char*>(masks_buffer_);
+
+  CUDA_SAFE_CALL(cudaMemcpy(models_device + num_models, best_models.data(),
+                            best_models.size() * sizeof(DeviceModel),
+                            cudaMemcpyHostToDevice));
+
+  ComputeInlierMasksKernel<<<best_models.size(), kBlockSize>>>(
+      points_device, models_device + num_models, masks_device);
+  CUDA_SYNC_AND_CHECK();
+
+  std::vector<char> masks(num_mask_bytes);
+  CUDA_SAFE_CALL(cudaMemcpy(masks.data(), masks_device, num_mask_bytes,
+                            cudaMemcpyDeviceToHost));
+
+  size_t best_model_idx = 0;
+  for (size_t i = 0; i < problems.size(); ++i) {
+    if (problem_model_offsets[i] == problem_model_offsets[i + 1]) {
+      continue;
+    }
+    const auto mask_begin = masks.begin() + mask_offsets[best_model_idx];
+    (*results)[i].inlier_mask.assign(
+        mask_begin, mask_begin + best_models[best_model_idx].num_points);
+    best_model_idx += 1;
+  }
+}
+
+}  // namespace colmap
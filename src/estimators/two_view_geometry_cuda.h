@@ -0,0 +1,58 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_ESTIMATORS_TWO_VIEW_GEOMETRY_CUDA_H_
+#define COLMAP_SRC_ESTIMATORS_TWO_VIEW_GEOMETRY_CUDA_H_
+
+#include <vector>
+
+#include "estimators/two_view_geometry_batch.h"
+
+namespace colmap {
+
+// Scorer of the two-view hypotheses on a CUDA device. The matched points of
+// all problems and all hypotheses of a batch are uploaded at once, one thread
+// block evaluates the residuals of one hypothesis on all matches of its
+// problem, and the inlier masks of the best hypotheses are computed on the
+// device as well. The residuals are evaluated in double precision, so that
+// the inliers are the same as on the CPU. The device buffers grow with the
+// largest batch and are reused between batches.
+class CUDATwoViewHypothesisScorer : public TwoViewHypothesisScorer {
+ public:
+  // The scorer must be used on the thread that created it.
+  explicit CUDATwoViewHypothesisScorer(const int gpu_index);
+  ~CUDATwoViewHypothesisScorer();
+
+  void Score(const std::vector<Problem>& problems,
+             std::vector<Result>* results) override;
+
+ private:
+  // Grow the device buffer to hold at least `num_bytes`.
+  void Reserve(const size_t num_bytes, void** buffer, size_t* capacity);
+
+  void* points_buffer_;
+  size_t points_capacity_;
+  void* models_buffer_;
+  size_t models_capacity_;
+  void* supports_buffer_;
+  size_t supports_capacity_;
+  void* masks_buffer_;
+  size_t masks_capacity_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_ESTIMATORS_TWO_VIEW_GEOMETRY_CUDA_H_
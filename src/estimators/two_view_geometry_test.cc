@@ -0,0 +1,151 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "estimators/two_view_geometry"
+#include "util/testing.h"
+
+#include <Eigen/Geometry>
+
+#include "estimators/two_view_geometry.h"
+#include "util/random.h"
+
+using namespace colmap;
+
+namespace {
+
+const size_t kNumInliers = 200;
+const size_t kNumOutliers = 100;
+
+struct SyntheticPair {
+  Camera camera1;
+  Camera camera2;
+  std::vector<Eigen::Vector2d> points1;
+  std::vector<Eigen::Vector2d> points2;
+  FeatureMatches matches;
+};
+
+// Project random points of a general or a planar scene into two images and
+// append random outliers to the second image.
+SyntheticPair GenerateSyntheticPair(const bool calibrated, const bool planar) {
+  SyntheticPair pair;
+  pair.camera1.InitializeWithName("SIMPLE_PINHOLE", 500, 640, 480);
+  pair.camera1.SetPriorFocalLength(calibrated);
+  pair.camera2 = pair.camera1;
+
+  const Eigen::Matrix3d R =
+      Eigen::AngleAxisd(0.1, Eigen::Vector3d(0.2, 1, 0.1).normalized())
+          .toRotationMatrix();
+  const Eigen::Vector3d t(-1, 0.1, 0.2);
+
+  for (size_t i = 0; i < kNumInliers + kNumOutliers; ++i) {
+    const Eigen::Vector3d point3D(RandomReal(-2.0, 2.0), RandomReal(-1.5, 1.5),
+                                  planar ? 6.0 : RandomReal(4.0, 8.0));
+    pair.points1.push_back(pair.camera1.WorldToImage(point3D.hnormalized()));
+    if (i < kNumInliers) {
+      pair.points2.push_back(
+          pair.camera2.WorldToImage((R * point3D + t).hnormalized()));
+    } else {
+      pair.points2.emplace_back(RandomReal(0.0, 640.0),
+                                RandomReal(0.0, 480.0));
+    }
+    FeatureMatch match;
+    match.point2D_idx1 = i;
+    match.point2D_idx2 = i;
+    pair.matches.push_back(match);
+  }
+
+  return pair;
+}
+
+TwoViewGeometry::Options CreateOptions() {
+  TwoViewGeometry::Options options;
+  options.ransac_options.max_error = 2;
+  options.ransac_options.confidence = 0.999;
+  options.ransac_options.min_inlier_ratio = 0.25;
+  return options;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestJointEstimation) {
+  SetPRNGSeed(0);
+
+  std::vector<SyntheticPair> pairs;
+  pairs.push_back(GenerateSyntheticPair(false, false));
+  pairs.push_back(GenerateSyntheticPair(true, false));
+  pairs.push_back(GenerateSyntheticPair(false, true));
+  pairs.push_back(GenerateSyntheticPair(true, true));
+
+  TwoViewGeometry::Options options = CreateOptions();
+  TwoViewGeometry::Options joint_options = CreateOptions();
+  joint_options.joint_estimation = true;
+
+  const int kConfigs[] = {
+      TwoViewGeometry::ConfigurationType::UNCALIBRATED,
+      TwoViewGeometry::ConfigurationType::CALIBRATED,
+      TwoViewGeometry::ConfigurationType::PLANAR_OR_PANORAMIC,
+      TwoViewGeometry::ConfigurationType::PLANAR_OR_PANORAMIC};
+
+  for (size_t i = 0; i < pairs.size(); ++i) {
+    const SyntheticPair& pair = pairs[i];
+
+    TwoViewGeometry geometry;
+    geometry.Estimate(pair.camera1, pair.points1, pair.camera2, pair.points2,
+                      pair.matches, options);
+
+    TwoViewGeometry joint_geometry;
+    joint_geometry.Estimate(pair.camera1, pair.points1, pair.camera2,
+                            pair.points2, pair.matches, joint_options);
+
+    BOOST_CHECK_EQUAL(geometry.config, kConfigs[i]);
+    BOOST_CHECK_EQUAL(joint_geometry.config, geometry.config);
+    BOOST_CHECK_GE(joint_geometry.inlier_matches.size(), kNumInliers);
+    BOOST_CHECK_LE(joint_geometry.inlier_matches.size(),
+                   kNumInliers + kNumOutliers / 10);
+    BOOST_CHECK_EQUAL(joint_geometry.inlier_mask.size(), pair.matches.size());
+    for (size_t j = 0; j < kNumInliers; ++j) {
+      BOOST_CHECK(joint_geometry.inlier_mask[j]);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestJointEstimationDegenerate) {
+  SetPRNGSeed(0);
+
+  SyntheticPair pair = GenerateSyntheticPair(true, false);
+  for (size_t i = 0; i < pair.points2.size(); ++i) {
+    pair.points2[i] =
+        Eigen::Vector2d(RandomReal(0.0, 640.0), RandomReal(0.0, 480.0));
+  }
+
+  TwoViewGeometry::Options options = CreateOptions();
+  options.joint_estimation = true;
+  options.min_num_inliers = 50;
+
+  TwoViewGeometry geometry;
+  geometry.Estimate(pair.camera1, pair.points1, pair.camera2, pair.points2,
+                    pair.matches, options);
+  BOOST_CHECK_EQUAL(geometry.config,
+                    TwoViewGeometry::ConfigurationType::DEGENERATE);
+
+  // Too few matches for the shared samples fall back to separate estimation.
+  pair.matches.resize(6);
+  options.min_num_inliers = 4;
+  geometry.Estimate(pair.camera1, pair.points1, pair.camera2, pair.points2,
+                    pair.matches, options);
+  BOOST_CHECK_NE(geometry.config,
+                 TwoViewGeometry::ConfigurationType::UNDEFINED);
+}
@@ -16,9 +16,95 @@
 
 #include "estimators/utils.h"
 
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#endif
+
+#include "estimators/utils_kernels.h"
 #include "util/logging.h"
+#include "util/simd.h"
 
 namespace colmap {
+namespace {
+
+// The baseline batches use SSE2 on x86-64 and NEON on AArch64. The wider
+// instruction sets are selected at runtime, see utils_avx2.cc and
+// utils_avx512.cc.
+
+#if defined(__SSE2__)
+
+struct SimdBatch {
+  static const size_t kSize = 2;
+  SimdBatch(const __m128d value) : value(value) {}
+  SimdBatch(const double value) : value(_mm_set1_pd(value)) {}
+  static SimdBatch Load(const double* ptr) { return _mm_loadu_pd(ptr); }
+  void Store(double* ptr) const { _mm_storeu_pd(ptr, value); }
+  __m128d value;
+};
+
+inline SimdBatch operator+(const SimdBatch a, const SimdBatch b) {
+  return _mm_add_pd(a.value, b.value);
+}
+inline SimdBatch operator-(const SimdBatch a, const SimdBatch b) {
+  return _mm_sub_pd(a.value, b.value);
+}
+inline SimdBatch operator*(const SimdBatch a, const SimdBatch b) {
+  return _mm_mul_pd(a.value, b.value);
+}
+inline SimdBatch operator/(const SimdBatch a, const SimdBatch b) {
+  return _mm_div_pd(a.value, b.value);
+}
+inline SimdBatch SelectGreater(const SimdBatch x, const SimdBatch y,
+                               const SimdBatch a, const SimdBatch b) {
+  const __m128d mask = _mm_cmpgt_pd(x.value, y.value);
+  return _mm_or_pd(_mm_and_pd(mask, a.value), _mm_andnot_pd(mask, b.value));
+}
+
+#elif defined(__aarch64__) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+
+// Only AArch64 has NEON instructions for doubles.
+struct SimdBatch {
+  static const size_t kSize = 2;
+  SimdBatch(const float64x2_t value) : value(value) {}
+  SimdBatch(const double value) : value(vdupq_n_f64(value)) {}
+  static SimdBatch Load(const double* ptr) { return vld1q_f64(ptr); }
+  void Store(double* ptr) const { vst1q_f64(ptr, value); }
+  float64x2_t value;
+};
+
+inline SimdBatch operator+(const SimdBatch a, const SimdBatch b) {
+  return vaddq_f64(a.value, b.value);
+}
+inline SimdBatch operator-(const SimdBatch a, const SimdBatch b) {
+  return vsubq_f64(a.value, b.value);
+}
+inline SimdBatch operator*(const SimdBatch a, const SimdBatch b) {
+  return vmulq_f64(a.value, b.value);
+}
+inline SimdBatch operator/(const SimdBatch a, const SimdBatch b) {
+  return vdivq_f64(a.value, b.value);
+}
+inline SimdBatch SelectGreater(const SimdBatch x, const SimdBatch y,
+                               const SimdBatch a, const SimdBatch b) {
+  return vbslq_f64(vcgtq_f64(x.value, y.value), a.value, b.value);
+}
+
+#else
+
+typedef ScalarBatch SimdBatch;
+
+#endif
+
+static_assert(sizeof(Eigen::Vector2d) == 2 * sizeof(double),
+              "Points must be stored as consecutive coordinates");
+static_assert(sizeof(Eigen::Vector3d) == 3 * sizeof(double),
+              "Points must be stored as consecutive coordinates");
+
+}  // namespace
 
 void CenterAndNormalizeImagePoints(const std::vector<Eigen::Vector2d>& points,
                                    std::vector<Eigen::Vector2d>* normed_points,
@@ -76,43 +162,39 @@ void ComputeSquaredSampsonError(const std::vector<Eigen::Vector2d>& points1,
   CHECK_EQ(points1.size(), points2.size());
 
   residuals->resize(points1.size());
+  if (points1.empty()) {
+    return;
+  }
 
-  // Note that this code might not be as nice as Eigen expressions,
-  // but it is significantly faster in various tests
-
-  const double E_00 = E(0, 0);
-  const double E_01 = E(0, 1);
-  const double E_02 = E(0, 2);
-  const double E_10 = E(1, 0);
-  const double E_11 = E(1, 1);
-  const double E_12 = E(1, 2);
-  const double E_20 = E(2, 0);
-  const double E_21 = E(2, 1);
-  const double E_22 = E(2, 2);
-
-  for (size_t i = 0; i < points1.size(); ++i) {
-    const double x1_0 = points1[i](0);
-    const double x1_1 = points1[i](1);
-    const double x2_0 = points2[i](0);
-    const double x2_1 = points2[i](1);
-
-    // Ex1 = E * points1[i].homogeneous();
-    const double Ex1_0 = E_00 * x1_0 + E_01 * x1_1 + E_02;
-    const double Ex1_1 = E_10 * x1_0 + E_11 * x1_1 + E_12;
-    const double Ex1_2 = E_20 * x1_0 + E_21 * x1_1 + E_22;
-
-    // Etx2 = E.transpose() * points2[i].homogeneous();
-    const double Etx2_0 = E_00 * x2_0 + E_10 * x2_1 + E_20;
-    const double Etx2_1 = E_01 * x2_0 + E_11 * x2_1 + E_21;
-
-    // x2tEx1 = points2[i].homogeneous().transpose() * Ex1;
-    const double x2tEx1 = x2_0 * Ex1_0 + x2_1 * Ex1_1 + Ex1_2;
-
-    // Sampson distance
-    (*residuals)[i] =
-        x2tEx1 * x2tEx1 /
-        (Ex1_0 * Ex1_0 + Ex1_1 * Ex1_1 + Etx2_0 * Etx2_0 + Etx2_1 * Etx2_1);
+  static const internal::ResidualFunc func =
+      SelectSIMDFunction<internal::ResidualFunc>(
+          &ComputeSquaredSampsonErrorImpl<SimdBatch>,
+          COLMAP_SIMD_AVX2_FUNC(&internal::ComputeSquaredSampsonErrorAVX2),
+          COLMAP_SIMD_AVX512_FUNC(
+              &internal::ComputeSquaredSampsonErrorAVX512));
+  func(points1[0].data(), points2[0].data(), points1.size(), E.data(),
+       residuals->data());
+}
+
+void ComputeSquaredTransferError(const std::vector<Eigen::Vector2d>& points1,
+                                 const std::vector<Eigen::Vector2d>& points2,
+                                 const Eigen::Matrix3d& H,
+                                 std::vector<double>* residuals) {
+  CHECK_EQ(points1.size(), points2.size());
+
+  residuals->resize(points1.size());
+  if (points1.empty()) {
+    return;
   }
+
+  static const internal::ResidualFunc func =
+      SelectSIMDFunction<internal::ResidualFunc>(
+          &ComputeSquaredTransferErrorImpl<SimdBatch>,
+          COLMAP_SIMD_AVX2_FUNC(&internal::ComputeSquaredTransferErrorAVX2),
+          COLMAP_SIMD_AVX512_FUNC(
+              &internal::ComputeSquaredTransferErrorAVX512));
+  func(points1[0].data(), points2[0].data(), points1.size(), H.data(),
+       residuals->data());
 }
 
 void ComputeSquaredReprojectionError(
@@ -122,48 +204,19 @@ void ComputeSquaredReprojectionError(
   CHECK_EQ(points2D.size(), points3D.size());
 
   residuals->resize(points2D.size());
-
-  // Note that this code might not be as nice as Eigen expressions,
-  // but it is significantly faster in various tests.
-
-  const double P_00 = proj_matrix(0, 0);
-  const double P_01 = proj_matrix(0, 1);
-  const double P_02 = proj_matrix(0, 2);
-  const double P_03 = proj_matrix(0, 3);
-  const double P_10 = proj_matrix(1, 0);
-  const double P_11 = proj_matrix(1, 1);
-  const double P_12 = proj_matrix(1, 2);
-  const double P_13 = proj_matrix(1, 3);
-  const double P_20 = proj_matrix(2, 0);
-  const double P_21 = proj_matrix(2, 1);
-  const double P_22 = proj_matrix(2, 2);
-  const double P_23 = proj_matrix(2, 3);
-
-  for (size_t i = 0; i < points2D.size(); ++i) {
-    const double X_0 = points3D[i](0);
-    const double X_1 = points3D[i](1);
-    const double X_2 = points3D[i](2);
-
-    // Project 3D point from world to camera.
-    const double px_2 = P_20 * X_0 + P_21 * X_1 + P_22 * X_2 + P_23;
-
-    // Check if 3D point is in front of camera.
-    if (px_2 > std::numeric_limits<double>::epsilon()) {
-      const double px_0 = P_00 * X_0 + P_01 * X_1 + P_02 * X_2 + P_03;
-      const double px_1 = P_10 * X_0 + P_11 * X_1 + P_12 * X_2 + P_13;
-
-      const double x_0 = points2D[i](0);
-      const double x_1 = points2D[i](1);
-
-      const double inv_px_2 = 1.0 / px_2;
-      const double dx_0 = x_0 - px_0 * inv_px_2;
-      const double dx_1 = x_1 - px_1 * inv_px_2;
-
-      (*residuals)[i] = dx_0 * dx_0 + dx_1 * dx_1;
-    } else {
-      (*residuals)[i] = std::numeric_limits<double>::max();
-    }
+  if (points2D.empty()) {
+    return;
   }
+
+  static const internal::ResidualFunc func =
+      SelectSIMDFunction<internal::ResidualFunc>(
+          &ComputeSquaredReprojectionErrorImpl<SimdBatch>,
+          COLMAP_SIMD_AVX2_FUNC(
+              &internal::ComputeSquaredReprojectionErrorAVX2),
+          COLMAP_SIMD_AVX512_FUNC(
+              &internal::ComputeSquaredReprojectionErrorAVX512));
+  func(points2D[0].data(), points3D[0].data(), points2D.size(),
+       proj_matrix.data(), residuals->data());
 }
 
 }  // namespace colmap
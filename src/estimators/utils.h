@@ -59,6 +59,21 @@ void ComputeSquaredSampsonError(const std::vector<Eigen::Vector2d>& points1,
                                 const Eigen::Matrix3d& E,
                                 std::vector<double>* residuals);
 
+// Calculate the residuals of a set of corresponding points and a given
+// homography matrix.
+//
+// Residuals are defined as the squared transfer error from the first to the
+// second set of points.
+//
+// @param points1     First set of corresponding points as Nx2 matrix.
+// @param points2     Second set of corresponding points as Nx2 matrix.
+// @param H           3x3 homography matrix.
+// @param residuals   Output vector of residuals.
+void ComputeSquaredTransferError(const std::vector<Eigen::Vector2d>& points1,
+                                 const std::vector<Eigen::Vector2d>& points2,
+                                 const Eigen::Matrix3d& H,
+                                 std::vector<double>* residuals);
+
 // Calculate the squared reprojection error given a set of 2D-3D point
 // correspondences and a projection matrix. Returns DBL_MAX if a 3D point is
 // behind the given camera.
@@ -0,0 +1,84 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifdef SIMD_AVX2_ENABLED
+
+#include <immintrin.h>
+
+#include "estimators/utils_kernels.h"
+
+namespace colmap {
+namespace {
+
+struct SimdBatch {
+  static const size_t kSize = 4;
+  SimdBatch(const __m256d value) : value(value) {}
+  SimdBatch(const double value) : value(_mm256_set1_pd(value)) {}
+  static SimdBatch Load(const double* ptr) { return _mm256_loadu_pd(ptr); }
+  void Store(double* ptr) const { _mm256_storeu_pd(ptr, value); }
+  __m256d value;
+};
+
+inline SimdBatch operator+(const SimdBatch a, const SimdBatch b) {
+  return _mm256_add_pd(a.value, b.value);
+}
+inline SimdBatch operator-(const SimdBatch a, const SimdBatch b) {
+  return _mm256_sub_pd(a.value, b.value);
+}
+inline SimdBatch operator*(const SimdBatch a, const SimdBatch b) {
+  return _mm256_mul_pd(a.value, b.value);
+}
+inline SimdBatch operator/(const SimdBatch a, const SimdBatch b) {
+  return _mm256_div_pd(a.value, b.value);
+}
+inline SimdBatch SelectGreater(const SimdBatch x, const SimdBatch y,
+                               const SimdBatch a, const SimdBatch b) {
+  return _mm256_blendv_pd(b.value, a.value,
+                          _mm256_cmp_pd(x.value, y.value, _CMP_GT_OQ));
+}
+
+}  // namespace
+
+namespace internal {
+
+void ComputeSquaredSampsonErrorAVX2(const double* points1,
+                                    const double* points2,
+                                    const size_t num_points, const double* E,
+                                    double* residuals) {
+  ComputeSquaredSampsonErrorImpl<SimdBatch>(points1, points2, num_points, E,
+                                            residuals);
+}
+
+void ComputeSquaredTransferErrorAVX2(const double* points1,
+                                     const double* points2,
+                                     const size_t num_points, const double* H,
+                                     double* residuals) {
+  ComputeSquaredTransferErrorImpl<SimdBatch>(points1, points2, num_points, H,
+                                             residuals);
+}
+
+void ComputeSquaredReprojectionErrorAVX2(const double* points2D,
+                                         const double* points3D,
+                                         const size_t num_points,
+                                         const double* P, double* residuals) {
+  ComputeSquaredReprojectionErrorImpl<SimdBatch>(points2D, points3D,
+                                                 num_points, P, residuals);
+}
+
+}  // namespace internal
+}  // namespace colmap
+
+#endif  // SIMD_AVX2_ENABLED
@@ -0,0 +1,305 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_ESTIMATORS_UTILS_KERNELS_H_
+#define COLMAP_SRC_ESTIMATORS_UTILS_KERNELS_H_
+
+#include <cstddef>
+#include <limits>
+
+// The residual kernels of estimators/utils.cc, which are compiled once for
+// every instruction set of the runtime dispatch, see util/simd.h. Only include
+// this header in estimators/utils*.cc.
+
+namespace colmap {
+namespace internal {
+
+// The residual functions on the coordinates of the points and the entries of
+// the matrix in the memory layout of Eigen, i.e., the points are consecutive
+// pairs or triples and the matrix is column-major.
+typedef void (*ResidualFunc)(const double* points1, const double* points2,
+                             const size_t num_points, const double* matrix,
+                             double* residuals);
+
+// Defined in estimators/utils_avx2.cc.
+void ComputeSquaredSampsonErrorAVX2(const double* points1,
+                                    const double* points2,
+                                    const size_t num_points, const double* E,
+                                    double* residuals);
+void ComputeSquaredTransferErrorAVX2(const double* points1,
+                                     const double* points2,
+                                     const size_t num_points, const double* H,
+                                     double* residuals);
+void ComputeSquaredReprojectionErrorAVX2(const double* points2D,
+                                         const double* points3D,
+                                         const size_t num_points,
+                                         const double* P, double* residuals);
+
+// Defined in estimators/utils_avx512.cc.
+void ComputeSquaredSampsonErrorAVX512(const double* points1,
+                                      const double* points2,
+                                      const size_t num_points,
+                                      const double* E, double* residuals);
+void ComputeSquaredTransferErrorAVX512(const double* points1,
+                                       const double* points2,
+                                       const size_t num_points,
+                                       const double* H, double* residuals);
+void ComputeSquaredReprojectionErrorAVX512(const double* points2D,
+                                           const double* points3D,
+                                           const size_t num_points,
+                                           const double* P, double* residuals);
+
+}  // namespace internal
+
+namespace {
+
+// The residuals are evaluated on blocks of points, which are transposed from
+// the array-of-structures layout of the inputs into structure-of-arrays
+// buffers that stay in the L1 cache, so that the kernels evaluate a full SIMD
+// register of points at a time. The kernels are written once for the batch
+// types, which have the same interface as a single double. Every instruction
+// set defines its own `SimdBatch` type.
+
+struct ScalarBatch {
+  static const size_t kSize = 1;
+  ScalarBatch(const double value) : value(value) {}
+  static ScalarBatch Load(const double* ptr) { return *ptr; }
+  void Store(double* ptr) const { *ptr = value; }
+  double value;
+};
+
+inline ScalarBatch operator+(const ScalarBatch a, const ScalarBatch b) {
+  return a.value + b.value;
+}
+inline ScalarBatch operator-(const ScalarBatch a, const ScalarBatch b) {
+  return a.value - b.value;
+}
+inline ScalarBatch operator*(const ScalarBatch a, const ScalarBatch b) {
+  return a.value * b.value;
+}
+inline ScalarBatch operator/(const ScalarBatch a, const ScalarBatch b) {
+  return a.value / b.value;
+}
+// The elements of `a` where `x > y` and the ones of `b` otherwise.
+inline ScalarBatch SelectGreater(const ScalarBatch x, const ScalarBatch y,
+                                 const ScalarBatch a, const ScalarBatch b) {
+  return x.value > y.value ? a.value : b.value;
+}
+
+// Column-major matrix with three rows.
+template <int kNumCols>
+struct Matrix3xN {
+  explicit Matrix3xN(const double* data) {
+    for (int i = 0; i < 3 * kNumCols; ++i) {
+      values[i] = data[i];
+    }
+  }
+  double operator()(const int row, const int col) const {
+    return values[row + 3 * col];
+  }
+  double values[3 * kNumCols];
+};
+
+const size_t kBlockSize = 128;
+
+// Evaluate the residuals of a block of `num` points with the SIMD batches and
+// the remaining points one at a time.
+template <typename SimdBatch, typename Kernel>
+void EvaluateBlock(const Kernel& kernel, const double* const* soa,
+                   const size_t num, double* residuals) {
+  size_t i = 0;
+  for (; i + SimdBatch::kSize <= num; i += SimdBatch::kSize) {
+    kernel.template Evaluate<SimdBatch>(soa, i, residuals);
+  }
+  for (; i < num; ++i) {
+    kernel.template Evaluate<ScalarBatch>(soa, i, residuals);
+  }
+}
+
+// Squared Sampson error of the points x1 = (soa[0], soa[1]) and
+// x2 = (soa[2], soa[3]).
+struct SampsonErrorKernel {
+  explicit SampsonErrorKernel(const double* E) : E(E) {}
+
+  template <typename Batch>
+  void Evaluate(const double* const* soa, const size_t i,
+                double* residuals) const {
+    const Batch x1_0 = Batch::Load(soa[0] + i);
+    const Batch x1_1 = Batch::Load(soa[1] + i);
+    const Batch x2_0 = Batch::Load(soa[2] + i);
+    const Batch x2_1 = Batch::Load(soa[3] + i);
+
+    const Batch E_00(E(0, 0));
+    const Batch E_01(E(0, 1));
+    const Batch E_02(E(0, 2));
+    const Batch E_10(E(1, 0));
+    const Batch E_11(E(1, 1));
+    const Batch E_12(E(1, 2));
+    const Batch E_20(E(2, 0));
+    const Batch E_21(E(2, 1));
+    const Batch E_22(E(2, 2));
+
+    // Ex1 = E * points1[i].homogeneous();
+    const Batch Ex1_0 = E_00 * x1_0 + E_01 * x1_1 + E_02;
+    const Batch Ex1_1 = E_10 * x1_0 + E_11 * x1_1 + E_12;
+    const Batch Ex1_2 = E_20 * x1_0 + E_21 * x1_1 + E_22;
+
+    // Etx2 = E.transpose() * points2[i].homogeneous();
+    const Batch Etx2_0 = E_00 * x2_0 + E_10 * x2_1 + E_20;
+    const Batch Etx2_1 = E_01 * x2_0 + E_11 * x2_1 + E_21;
+
+    // x2tEx1 = points2[i].homogeneous().transpose() * Ex1;
+    const Batch x2tEx1 = x2_0 * Ex1_0 + x2_1 * Ex1_1 + Ex1_2;
+
+    // Sampson distance
+    const Batch residual =
+        x2tEx1 * x2tEx1 /
+        (Ex1_0 * Ex1_0 + Ex1_1 * Ex1_1 + Etx2_0 * Etx2_0 + Etx2_1 * Etx2_1);
+    residual.Store(residuals + i);
+  }
+
+  const Matrix3xN<3> E;
+};
+
+// Squared transfer error of the points x1 = (soa[0], soa[1]) to the points
+// x2 = (soa[2], soa[3]) through a homography.
+struct TransferErrorKernel {
+  explicit TransferErrorKernel(const double* H) : H(H) {}
+
+  template <typename Batch>
+  void Evaluate(const double* const* soa, const size_t i,
+                double* residuals) const {
+    const Batch s_0 = Batch::Load(soa[0] + i);
+    const Batch s_1 = Batch::Load(soa[1] + i);
+    const Batch d_0 = Batch::Load(soa[2] + i);
+    const Batch d_1 = Batch::Load(soa[3] + i);
+
+    const Batch pd_0 = Batch(H(0, 0)) * s_0 + Batch(H(0, 1)) * s_1 + H(0, 2);
+    const Batch pd_1 = Batch(H(1, 0)) * s_0 + Batch(H(1, 1)) * s_1 + H(1, 2);
+    const Batch pd_2 = Batch(H(2, 0)) * s_0 + Batch(H(2, 1)) * s_1 + H(2, 2);
+
+    const Batch inv_pd_2 = Batch(1.0) / pd_2;
+    const Batch dd_0 = d_0 - pd_0 * inv_pd_2;
+    const Batch dd_1 = d_1 - pd_1 * inv_pd_2;
+
+    const Batch residual = dd_0 * dd_0 + dd_1 * dd_1;
+    residual.Store(residuals + i);
+  }
+
+  const Matrix3xN<3> H;
+};
+
+// Squared reprojection error of the 2D points (soa[0], soa[1]) and the 3D
+// points (soa[2], soa[3], soa[4]).
+struct ReprojectionErrorKernel {
+  explicit ReprojectionErrorKernel(const double* P) : P(P) {}
+
+  template <typename Batch>
+  void Evaluate(const double* const* soa, const size_t i,
+                double* residuals) const {
+    const Batch x_0 = Batch::Load(soa[0] + i);
+    const Batch x_1 = Batch::Load(soa[1] + i);
+    const Batch X_0 = Batch::Load(soa[2] + i);
+    const Batch X_1 = Batch::Load(soa[3] + i);
+    const Batch X_2 = Batch::Load(soa[4] + i);
+
+    // Project 3D point from world to camera.
+    const Batch px_0 = Batch(P(0, 0)) * X_0 + Batch(P(0, 1)) * X_1 +
+                       Batch(P(0, 2)) * X_2 + P(0, 3);
+    const Batch px_1 = Batch(P(1, 0)) * X_0 + Batch(P(1, 1)) * X_1 +
+                       Batch(P(1, 2)) * X_2 + P(1, 3);
+    const Batch px_2 = Batch(P(2, 0)) * X_0 + Batch(P(2, 1)) * X_1 +
+                       Batch(P(2, 2)) * X_2 + P(2, 3);
+
+    const Batch inv_px_2 = Batch(1.0) / px_2;
+    const Batch dx_0 = x_0 - px_0 * inv_px_2;
+    const Batch dx_1 = x_1 - px_1 * inv_px_2;
+
+    // Check if 3D point is in front of camera.
+    const Batch residual =
+        SelectGreater(px_2, std::numeric_limits<double>::epsilon(),
+                      dx_0 * dx_0 + dx_1 * dx_1,
+                      std::numeric_limits<double>::max());
+    residual.Store(residuals + i);
+  }
+
+  const Matrix3xN<4> P;
+};
+
+// Evaluate a kernel of two sets of 2D points.
+template <typename SimdBatch, typename Kernel>
+void EvaluateTwoViewKernel(const Kernel& kernel, const double* points1,
+                           const double* points2, const size_t num_points,
+                           double* residuals) {
+  double soa[4][kBlockSize];
+  const double* soa_ptrs[4] = {soa[0], soa[1], soa[2], soa[3]};
+  for (size_t begin = 0; begin < num_points; begin += kBlockSize) {
+    const size_t num =
+        begin + kBlockSize < num_points ? kBlockSize : num_points - begin;
+    for (size_t i = 0; i < num; ++i) {
+      soa[0][i] = points1[2 * (begin + i)];
+      soa[1][i] = points1[2 * (begin + i) + 1];
+      soa[2][i] = points2[2 * (begin + i)];
+      soa[3][i] = points2[2 * (begin + i) + 1];
+    }
+    EvaluateBlock<SimdBatch>(kernel, soa_ptrs, num, residuals + begin);
+  }
+}
+
+template <typename SimdBatch>
+void ComputeSquaredSampsonErrorImpl(const double* points1,
+                                    const double* points2,
+                                    const size_t num_points, const double* E,
+                                    double* residuals) {
+  EvaluateTwoViewKernel<SimdBatch>(SampsonErrorKernel(E), points1, points2,
+                                   num_points, residuals);
+}
+
+template <typename SimdBatch>
+void ComputeSquaredTransferErrorImpl(const double* points1,
+                                     const double* points2,
+                                     const size_t num_points, const double* H,
+                                     double* residuals) {
+  EvaluateTwoViewKernel<SimdBatch>(TransferErrorKernel(H), points1, points2,
+                                   num_points, residuals);
+}
+
+template <typename SimdBatch>
+void ComputeSquaredReprojectionErrorImpl(const double* points2D,
+                                         const double* points3D,
+                                         const size_t num_points,
+                                         const double* P, double* residuals) {
+  const ReprojectionErrorKernel kernel(P);
+  double soa[5][kBlockSize];
+  const double* soa_ptrs[5] = {soa[0], soa[1], soa[2], soa[3], soa[4]};
+  for (size_t begin = 0; begin < num_points; begin += kBlockSize) {
+    const size_t num =
+        begin + kBlockSize < num_points ? kBlockSize : num_points - begin;
+    for (size_t i = 0; i < num; ++i) {
+      soa[0][i] = points2D[2 * (begin + i)];
+      soa[1][i] = points2D[2 * (begin + i) + 1];
+      soa[2][i] = points3D[3 * (begin + i)];
+      soa[3][i] = points3D[3 * (begin + i) + 1];
+      soa[4][i] = points3D[3 * (begin + i) + 2];
+    }
+    EvaluateBlock<SimdBatch>(kernel, soa_ptrs, num, residuals + begin);
+  }
+}
+
+}  // namespace
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_ESTIMATORS_UTILS_KERNELS_H_
@@ -17,8 +17,13 @@
 #define TEST_NAME "estimators/utils"
 #include "util/testing.h"
 
+#include <array>
+
 #include "base/essential_matrix.h"
 #include "estimators/utils.h"
+#include "estimators/utils_kernels.h"
+#include "util/random.h"
+#include "util/simd.h"
 
 using namespace colmap;
 
@@ -66,3 +71,142 @@ BOOST_AUTO_TEST_CASE(TestComputeSquaredSampsonError) {
   BOOST_CHECK_EQUAL(residuals[1], 0.5);
   BOOST_CHECK_EQUAL(residuals[2], 2);
 }
+
+BOOST_AUTO_TEST_CASE(TestComputeSquaredSampsonErrorBlocks) {
+  const Eigen::Matrix3d E = EssentialMatrixFromPose(
+      Eigen::Matrix3d::Identity(), Eigen::Vector3d(1, 0.5, 0.2));
+
+  // Cover the SIMD batches, the remaining points and several blocks.
+  for (const size_t num_points : {0, 1, 3, 4, 7, 17, 128, 131, 300}) {
+    std::vector<Eigen::Vector2d> points1;
+    std::vector<Eigen::Vector2d> points2;
+    for (size_t i = 0; i < num_points; ++i) {
+      points1.push_back(Eigen::Vector2d::Random());
+      points2.push_back(Eigen::Vector2d::Random());
+    }
+
+    std::vector<double> residuals;
+    ComputeSquaredSampsonError(points1, points2, E, &residuals);
+    BOOST_CHECK_EQUAL(residuals.size(), num_points);
+
+    for (size_t i = 0; i < num_points; ++i) {
+      const Eigen::Vector3d Ex1 = E * points1[i].homogeneous();
+      const Eigen::Vector3d Etx2 = E.transpose() * points2[i].homogeneous();
+      const double x2tEx1 = points2[i].homogeneous().dot(Ex1);
+      const double residual = x2tEx1 * x2tEx1 / (Ex1.head<2>().squaredNorm() +
+                                                 Etx2.head<2>().squaredNorm());
+      BOOST_CHECK_CLOSE(residuals[i], residual, 1e-6);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestComputeSquaredTransferError) {
+  Eigen::Matrix3d H;
+  H << 1.1, 0.1, 0.3, -0.2, 0.9, 0.1, 0.01, 0.02, 1;
+
+  for (const size_t num_points : {0, 1, 3, 4, 7, 17, 128, 131, 300}) {
+    std::vector<Eigen::Vector2d> points1;
+    std::vector<Eigen::Vector2d> points2;
+    for (size_t i = 0; i < num_points; ++i) {
+      points1.push_back(Eigen::Vector2d::Random());
+      points2.push_back(Eigen::Vector2d::Random());
+    }
+
+    std::vector<double> residuals;
+    ComputeSquaredTransferError(points1, points2, H, &residuals);
+    BOOST_CHECK_EQUAL(residuals.size(), num_points);
+
+    for (size_t i = 0; i < num_points; ++i) {
+      const Eigen::Vector2d point2 = (H * points1[i].homogeneous()).hnormalized();
+      BOOST_CHECK_CLOSE(residuals[i], (points2[i] - point2).squaredNorm(),
+                        1e-6);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestComputeSquaredReprojectionError) {
+  Eigen::Matrix3x4d proj_matrix = Eigen::Matrix3x4d::Identity();
+  proj_matrix(0, 3) = 0.1;
+
+  for (const size_t num_points : {0, 1, 3, 4, 7, 17, 128, 131, 300}) {
+    std::vector<Eigen::Vector2d> points2D;
+    std::vector<Eigen::Vector3d> points3D;
+    for (size_t i = 0; i < num_points; ++i) {
+      points2D.push_back(Eigen::Vector2d::Random());
+      points3D.push_back(Eigen::Vector3d::Random());
+      // Every third point is behind the camera.
+      points3D.back()(2) = (i % 3 == 0 ? -1 : 2) + points3D.back()(2) / 2;
+    }
+
+    std::vector<double> residuals;
+    ComputeSquaredReprojectionError(points2D, points3D, proj_matrix,
+                                    &residuals);
+    BOOST_CHECK_EQUAL(residuals.size(), num_points);
+
+    for (size_t i = 0; i < num_points; ++i) {
+      if (i % 3 == 0) {
+        BOOST_CHECK_EQUAL(residuals[i], std::numeric_limits<double>::max());
+      } else {
+        const Eigen::Vector2d point2D =
+            (proj_matrix * points3D[i].homogeneous()).hnormalized();
+        BOOST_CHECK_CLOSE(residuals[i], (points2D[i] - point2D).squaredNorm(),
+                          1e-6);
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestResidualsSIMDLevels) {
+  // Compare every implementation that is compiled and supported by the CPU,
+  // not only the one selected by the dispatch, with the scalar kernels.
+  std::vector<std::array<internal::ResidualFunc, 3>> funcs;
+  const SIMDLevel level = GetSupportedSIMDLevel(GetCPUFeatures());
+#ifdef SIMD_AVX2_ENABLED
+  if (level >= SIMDLevel::AVX2) {
+    funcs.push_back({{&internal::ComputeSquaredSampsonErrorAVX2,
+                      &internal::ComputeSquaredTransferErrorAVX2,
+                      &internal::ComputeSquaredReprojectionErrorAVX2}});
+  }
+#endif
+#ifdef SIMD_AVX512_ENABLED
+  if (level >= SIMDLevel::AVX512) {
+    funcs.push_back({{&internal::ComputeSquaredSampsonErrorAVX512,
+                      &internal::ComputeSquaredTransferErrorAVX512,
+                      &internal::ComputeSquaredReprojectionErrorAVX512}});
+  }
+#endif
+  BOOST_TEST_MESSAGE("Testing " << funcs.size() << " SIMD implementations up to "
+                                << SIMDLevelToString(level));
+
+  const std::array<internal::ResidualFunc, 3> ref_funcs = {
+      {&ComputeSquaredSampsonErrorImpl<ScalarBatch>,
+       &ComputeSquaredTransferErrorImpl<ScalarBatch>,
+       &ComputeSquaredReprojectionErrorImpl<ScalarBatch>}};
+
+  Eigen::Matrix3x4d matrix = Eigen::Matrix3x4d::Random();
+  matrix(2, 2) = 2;
+  for (const size_t num_points : {1, 7, 8, 17, 131, 300}) {
+    std::vector<double> points1(2 * num_points);
+    std::vector<double> points2(3 * num_points);
+    for (double& value : points1) {
+      value = RandomReal(-1.0, 1.0);
+    }
+    for (double& value : points2) {
+      value = RandomReal(-1.0, 1.0);
+    }
+
+    for (size_t i = 0; i < ref_funcs.size(); ++i) {
+      std::vector<double> ref_residuals(num_points);
+      ref_funcs[i](points1.data(), points2.data(), num_points, matrix.data(),
+                   ref_residuals.data());
+      for (const auto& level_funcs : funcs) {
+        std::vector<double> residuals(num_points);
+        level_funcs[i](points1.data(), points2.data(), num_points,
+                       matrix.data(), residuals.data());
+        for (size_t j = 0; j < num_points; ++j) {
+          BOOST_CHECK_CLOSE(residuals[j], ref_residuals[j], 1e-6);
+        }
+      }
+    }
+  }
+}
@@ -17,21 +17,38 @@
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 
+#include "base/reconstruction_writer.h"
 #include "controllers/automatic_reconstruction.h"
 #include "controllers/bundle_adjustment.h"
+#include "controllers/hierarchical_mapper.h"
 #include "estimators/coordinate_frame.h"
 #include "feature/extraction.h"
 #include "feature/matching.h"
+#include "feature/quantization.h"
 #include "feature/utils.h"
 #include "mvs/meshing.h"
 #include "mvs/patch_match.h"
 #include "retrieval/visual_index.h"
 #include "ui/main_window.h"
+#include "util/job_manifest.h"
+#include "util/memory_governor.h"
+#include "util/metrics.h"
 #include "util/misc.h"
 #include "util/opengl_utils.h"
+#include "util/perf_counters.h"
+#include "util/random.h"
+#include "util/resource_accounting.h"
+#include "util/trace.h"
 #include "util/version.h"
 #include "sfm/incremental_mapper.h"
-
+#include "sfm/two_body_checkpoint.h"
+#include "sfm/two_body_postprocessor.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <memory>
 #include <vector>
 
 
@@ -88,6 +105,7 @@ int RunAutomaticReconstructor(int argc, char** argv) {
   options.AddDefaultOption("num_threads", &reconstruction_options.num_threads);
   options.AddDefaultOption("use_gpu", &reconstruction_options.use_gpu);
   options.AddDefaultOption("gpu_index", &reconstruction_options.gpu_index);
+  options.AddDefaultOption("pipelined", &reconstruction_options.pipelined);
   options.Parse(argc, argv);
 
   StringToLower(&data_type);
@@ -201,8 +219,11 @@ int RunDenseFuser(int argc, char** argv) {
                            "{photometric, geometric}");
   options.AddRequiredOption("output_path", &output_path);
   options.AddDenseFusionOptions();
+  options.AddImageSourceOptions();
   options.Parse(argc, argv);
 
+  options.dense_fusion->image_source = *options.image_source;
+
   StringToLower(&workspace_format);
   if (workspace_format != "colmap" && workspace_format != "pmvs") {
     std::cout << "ERROR: Invalid `workspace_format` - supported values are "
@@ -220,14 +241,12 @@ int RunDenseFuser(int argc, char** argv) {
   }
 
   mvs::StereoFusion fuser(*options.dense_fusion, workspace_path,
-                          workspace_format, pmvs_option_name, input_type);
+                          workspace_format, pmvs_option_name, input_type,
+                          output_path);
 
   fuser.Start();
   fuser.Wait();
 
-  std::cout << "Writing output: " << output_path << std::endl;
-  WriteBinaryPly(output_path, fuser.GetFusedPoints());
-
   return EXIT_SUCCESS;
 }
 
@@ -257,15 +276,20 @@ int RunDenseStereo(int argc, char** argv) {
   std::string workspace_path;
   std::string workspace_format = "COLMAP";
   std::string pmvs_option_name = "option-all";
+  std::string object_sparse_path;
 
   OptionManager options;
   options.AddRequiredOption("workspace_path", &workspace_path);
   options.AddDefaultOption("workspace_format", &workspace_format,
                            "{COLMAP, PMVS}");
   options.AddDefaultOption("pmvs_option_name", &pmvs_option_name);
+  options.AddDefaultOption("object_sparse_path", &object_sparse_path);
   options.AddDenseStereoOptions();
+  options.AddImageSourceOptions();
   options.Parse(argc, argv);
 
+  options.dense_stereo->image_source = *options.image_source;
+
   StringToLower(&workspace_format);
   if (workspace_format != "colmap" && workspace_format != "pmvs") {
     std::cout << "ERROR: Invalid `workspace_format` - supported values are "
@@ -275,7 +299,8 @@ int RunDenseStereo(int argc, char** argv) {
   }
 
   mvs::PatchMatchController controller(*options.dense_stereo, workspace_path,
-                                       workspace_format, pmvs_option_name);
+                                       workspace_format, pmvs_option_name,
+                                       object_sparse_path);
 
   controller.Start();
   controller.Wait();
@@ -284,6 +309,117 @@ int RunDenseStereo(int argc, char** argv) {
 #endif  // CUDA_ENABLED
 }
 
+// Encode the descriptors of the database as product-quantized codes, which
+// are matched with `SiftMatching.use_descriptor_codes`. The codebook is
+// trained on the descriptors of random images, unless the database already
+// has a codebook, in which case only the images without codes are encoded.
+int RunDescriptorQuantizer(int argc, char** argv) {
+  ProductQuantizerOptions quantizer_options;
+  bool clear_descriptors = false;
+
+  OptionManager options;
+  options.AddDatabaseOptions();
+  options.AddDefaultOption("num_subspaces", &quantizer_options.num_subspaces);
+  options.AddDefaultOption("num_iterations", &quantizer_options.num_iterations);
+  options.AddDefaultOption("max_num_training_descriptors",
+                           &quantizer_options.max_num_training_descriptors);
+  options.AddDefaultOption("num_threads", &quantizer_options.num_threads);
+  options.AddDefaultOption("clear_descriptors", &clear_descriptors);
+  options.Parse(argc, argv);
+
+  Database database(*options.database_path);
+
+  const std::vector<Image> images = database.ReadAllImages();
+
+  ProductQuantizer quantizer;
+  if (database.ExistsDescriptorCodebook()) {
+    std::cout << "Loading codebook..." << std::endl;
+    quantizer = ProductQuantizer(database.ReadDescriptorCodebook());
+  } else {
+    std::cout << "Loading descriptors..." << std::endl;
+
+    std::vector<size_t> image_idxs(images.size());
+    std::iota(image_idxs.begin(), image_idxs.end(), 0);
+    Shuffle(static_cast<uint32_t>(image_idxs.size()), &image_idxs);
+
+    const size_t max_num_descriptors =
+        static_cast<size_t>(quantizer_options.max_num_training_descriptors);
+    std::vector<image_t> training_image_ids;
+    size_t num_descriptors = 0;
+    for (const auto image_idx : image_idxs) {
+      if (num_descriptors >= max_num_descriptors) {
+        break;
+      }
+      const image_t image_id = images[image_idx].ImageId();
+      const size_t num_image_descriptors =
+          database.NumDescriptorsForImage(image_id);
+      if (num_image_descriptors > 0) {
+        training_image_ids.push_back(image_id);
+        num_descriptors += num_image_descriptors;
+      }
+    }
+
+    if (num_descriptors == 0) {
+      std::cerr << "ERROR: No descriptors in database" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    // Copy the descriptors straight from the database into the training set.
+    FeatureDescriptors descriptors(num_descriptors, 128);
+    size_t descriptor_row = 0;
+    for (const auto image_id : training_image_ids) {
+      database.ReadDescriptors(
+          image_id, [&](const Eigen::Map<const FeatureDescriptors>&
+                            image_descriptors) {
+            descriptors.middleRows(descriptor_row, image_descriptors.rows()) =
+                image_descriptors;
+            descriptor_row += image_descriptors.rows();
+          });
+    }
+    CHECK_EQ(descriptor_row, num_descriptors);
+
+    std::cout << StringPrintf("Training codebook on %d descriptors...",
+                              num_descriptors)
+              << std::endl;
+    quantizer.Train(quantizer_options, descriptors);
+  }
+
+  std::cout << "Encoding descriptors..." << std::endl;
+
+  {
+    DatabaseTransaction database_transaction(&database);
+
+    if (!database.ExistsDescriptorCodebook()) {
+      database.WriteDescriptorCodebook(quantizer.Codebook());
+    }
+
+    for (const auto& image : images) {
+      if (database.ExistsDescriptors(image.ImageId()) &&
+          !database.ExistsDescriptorCodes(image.ImageId())) {
+        database.WriteDescriptorCodes(
+            image.ImageId(),
+            quantizer.Encode(database.ReadDescriptors(image.ImageId())));
+      }
+    }
+
+    std::cout << StringPrintf("  => Encoded %d descriptors in %d bytes each",
+                              database.NumDescriptorCodes(),
+                              quantizer.NumSubspaces())
+              << std::endl;
+
+    if (clear_descriptors) {
+      database.ClearDescriptors();
+    }
+  }
+
+  if (clear_descriptors) {
+    std::cout << "Compacting database..." << std::endl;
+    database.Vacuum();
+  }
+
+  return EXIT_SUCCESS;
+}
+
 int RunExhaustiveMatcher(int argc, char** argv) {
   OptionManager options;
   options.AddDatabaseOptions();
@@ -317,11 +453,13 @@ int RunFeatureExtractor(int argc, char** argv) {
   options.AddImageOptions();
   options.AddDefaultOption("image_list_path", &image_list_path);
   options.AddExtractionOptions();
+  options.AddImageSourceOptions();
   options.Parse(argc, argv);
 
   ImageReaderOptions reader_options = *options.image_reader;
   reader_options.database_path = *options.database_path;
   reader_options.image_path = *options.image_path;
+  reader_options.image_source = *options.image_source;
 
   if (!image_list_path.empty()) {
     reader_options.image_list = ReadTextFileLines(image_list_path);
@@ -373,11 +511,13 @@ int RunFeatureImporter(int argc, char** argv) {
   options.AddRequiredOption("import_path", &import_path);
   options.AddDefaultOption("image_list_path", &image_list_path);
   options.AddExtractionOptions();
+  options.AddImageSourceOptions();
   options.Parse(argc, argv);
 
   ImageReaderOptions reader_options = *options.image_reader;
   reader_options.database_path = *options.database_path;
   reader_options.image_path = *options.image_path;
+  reader_options.image_source = *options.image_source;
 
   if (!image_list_path.empty()) {
     reader_options.image_list = ReadTextFileLines(image_list_path);
@@ -397,7 +537,8 @@ int RunFeatureImporter(int argc, char** argv) {
     return EXIT_FAILURE;
   }
 
-  FeatureImporter feature_importer(reader_options, import_path);
+  FeatureImporter feature_importer(reader_options, import_path,
+                                   options.sift_extraction->num_threads);
   feature_importer.Start();
   feature_importer.Wait();
 
@@ -435,6 +576,50 @@ std::vector<std::pair<image_t, image_t>> ReadStereoImagePairs(
   return stereo_pairs;
 }
 
+// Reconstruct the anchor take `Mapper.anchor_take` in partitions, after which
+// the other takes are registered against the merged reconstruction.
+int RunHierarchicalMapper(int argc, char** argv) {
+  HierarchicalMapperController::Options hierarchical_options;
+  SceneClustering::Options clustering_options;
+  std::string export_path;
+
+  OptionManager options;
+  options.AddDatabaseOptions();
+  options.AddImageOptions();
+  options.AddRequiredOption("export_path", &export_path);
+  options.AddDefaultOption("num_workers", &hierarchical_options.num_workers);
+  options.AddDefaultOption("image_overlap", &clustering_options.image_overlap);
+  options.AddDefaultOption("leaf_max_num_images",
+                           &clustering_options.leaf_max_num_images);
+  options.AddMapperOptions();
+  options.Parse(argc, argv);
+
+  if (!ExistsDir(export_path)) {
+    std::cerr << "ERROR: `export_path` is not a directory." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  hierarchical_options.database_path = *options.database_path;
+  hierarchical_options.image_path = *options.image_path;
+  clustering_options.num_threads = options.mapper->num_threads;
+
+  ReconstructionManager reconstruction_manager;
+  HierarchicalMapperController hierarchical_mapper(
+      hierarchical_options, clustering_options, *options.mapper,
+      &reconstruction_manager);
+  hierarchical_mapper.Start();
+  hierarchical_mapper.Wait();
+
+  if (reconstruction_manager.Size() == 0) {
+    std::cerr << "ERROR: failed to create sparse model" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  reconstruction_manager.Write(export_path, &options);
+
+  return EXIT_SUCCESS;
+}
+
 int RunImageRectifier(int argc, char** argv) {
   std::string input_path;
   std::string output_path;
@@ -447,6 +632,7 @@ int RunImageRectifier(int argc, char** argv) {
   options.AddRequiredOption("input_path", &input_path);
   options.AddRequiredOption("output_path", &output_path);
   options.AddRequiredOption("stereo_pairs_list", &stereo_pairs_list);
+  options.AddImageSourceOptions();
   options.AddDefaultOption("blank_pixels",
                            &undistort_camera_options.blank_pixels);
   options.AddDefaultOption("min_scale", &undistort_camera_options.min_scale);
@@ -463,21 +649,93 @@ int RunImageRectifier(int argc, char** argv) {
 
   StereoImageRectifier rectifier(undistort_camera_options, reconstruction,
                                  *options.image_path, output_path,
-                                 stereo_pairs);
+                                 stereo_pairs, *options.image_source);
   rectifier.Start();
   rectifier.Wait();
 
   return EXIT_SUCCESS;
 }
 
+// Register the images of `new_take` against the anchor model of every other
+// take in `import_path`/N/anchor, which appends their cameras to the camera
+// logs and take bundles of these takes, and reconstruct the new take with
+// itself as the anchor take into `export_path`/`new_take`. The takes that were
+// reconstructed before are not reconstructed again.
+int RegisterNewTake(OptionManager& options, const std::string& import_path,
+                    const std::string& export_path, const int new_take)
+{
+	const std::unordered_map<std::string, int> take_map = ReadTakeMap("takes.txt");
+	std::set<int> takes;
+	for(const auto& image : take_map)
+		takes.insert(image.second);
+	if(takes.count(new_take) == 0)
+	{
+		std::cerr << "ERROR: Take " << new_take << " is not in takes.txt." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	DatabaseCache database_cache;
+	if (!IncrementalMapperController::LoadDatabaseCache(*options.mapper, *options.database_path, &database_cache))
+	{
+		return EXIT_FAILURE;
+	}
+
+	//the take is registered as the only other take against the anchor takes
+	for(const int take : takes)
+	{
+		if(take == new_take)
+			continue;
+		const std::string anchor_path = JoinPaths(import_path, std::to_string(take), kTakeAnchorModelDirName);
+		if(!ExistsDir(anchor_path))
+		{
+			std::cout << "WARNING: No anchor model of take " << take << ", skipping." << std::endl;
+			continue;
+		}
+
+		PrintHeading1(StringPrintf("Registering take %d against take %d", new_take, take));
+		IncrementalMapperOptions take_options = *options.mapper;
+		take_options.anchor_take = take;
+		take_options.new_take = new_take;
+		ReconstructionManager reconstruction_manager;
+		reconstruction_manager.Read(anchor_path);
+		IncrementalMapperController mapper(&take_options, *options.image_path,
+		                                   &database_cache,
+		                                   &reconstruction_manager);
+		mapper.Start();
+		mapper.Wait();
+	}
+
+	//the images are only read to extract the colors of the points
+	PrintHeading1(StringPrintf("Reconstructing take %d", new_take));
+	IncrementalMapperOptions take_options = *options.mapper;
+	take_options.anchor_take = new_take;
+	take_options.extract_colors = take_options.extract_colors && !options.image_path->empty();
+	ReconstructionManager reconstruction_manager;
+	IncrementalMapperController mapper(&take_options, *options.image_path,
+	                                   &database_cache,
+	                                   &reconstruction_manager);
+	mapper.Start();
+	mapper.Wait();
+	if (reconstruction_manager.Size() > 0)
+	{
+		const std::string path = JoinPaths(export_path, std::to_string(new_take));
+		CreateDirIfNotExists(path);
+		reconstruction_manager.Get(0).WriteBinary(path);
+	}
+
+	return EXIT_SUCCESS;
+}
+
 int RunImageRegistrator(int argc, char** argv) {
   std::string import_path;
   std::string export_path;
+  int new_take = 0;
 
   OptionManager options;
   options.AddDatabaseOptions();
   options.AddRequiredOption("import_path", &import_path);
   options.AddRequiredOption("export_path", &export_path);
+  options.AddDefaultOption("new_take", &new_take);
   options.AddMapperOptions();
   options.Parse(argc, argv);
 
@@ -491,6 +749,10 @@ int RunImageRegistrator(int argc, char** argv) {
     return EXIT_FAILURE;
   }
 
+  if (new_take > 0) {
+    return RegisterNewTake(options, import_path, export_path, new_take);
+  }
+
   PrintHeading1("Loading database");
 
   DatabaseCache database_cache;
@@ -550,6 +812,7 @@ int RunImageUndistorter(int argc, char** argv) {
 
   OptionManager options;
   options.AddImageOptions();
+  options.AddImageSourceOptions();
   options.AddRequiredOption("input_path", &input_path);
   options.AddRequiredOption("output_path", &output_path);
   options.AddDefaultOption("output_type", &output_type);
@@ -568,17 +831,17 @@ int RunImageUndistorter(int argc, char** argv) {
 
   std::unique_ptr<Thread> undistorter;
   if (output_type == "COLMAP") {
-    undistorter.reset(new COLMAPUndistorter(undistort_camera_options,
-                                            reconstruction, *options.image_path,
-                                            output_path));
+    undistorter.reset(new COLMAPUndistorter(
+        undistort_camera_options, reconstruction, *options.image_path,
+        output_path, *options.image_source));
   } else if (output_type == "PMVS") {
-    undistorter.reset(new PMVSUndistorter(undistort_camera_options,
-                                          reconstruction, *options.image_path,
-                                          output_path));
+    undistorter.reset(new PMVSUndistorter(
+        undistort_camera_options, reconstruction, *options.image_path,
+        output_path, *options.image_source));
   } else if (output_type == "CMP-MVS") {
-    undistorter.reset(new CMPMVSUndistorter(undistort_camera_options,
-                                            reconstruction, *options.image_path,
-                                            output_path));
+    undistorter.reset(new CMPMVSUndistorter(
+        undistort_camera_options, reconstruction, *options.image_path,
+        output_path, *options.image_source));
   } else {
     std::cerr << "ERROR: Invalid `output_type` - supported values are "
                  "{'COLMAP', 'PMVS', 'CMP-MVS'}."
@@ -592,34 +855,56 @@ int RunImageUndistorter(int argc, char** argv) {
   return EXIT_SUCCESS;
 }
 
-int RunMapper(int argc, char** argv)
+// Write the resources of the stages of the command to `resources.json` in the
+// directory of its outputs.
+void WriteCommandResourceReport(const std::string& output_path)
 {
-	std::string import_path;
-	std::string export_path;
-	std::string image_list_path;
-
-	OptionManager options;
-	options.AddDatabaseOptions();
-	options.AddImageOptions();
-	options.AddDefaultOption("import_path", &import_path);
-	options.AddRequiredOption("export_path", &export_path);
-	options.AddDefaultOption("image_list_path", &image_list_path);
-	options.AddMapperOptions();
-	options.Parse(argc, argv);
+	const std::string report_path = JoinPaths(output_path, "resources.json");
+	if (!WriteResourceReport(report_path))
+		std::cerr << "ERROR: Could not write resource report to `" << report_path << "`." << std::endl;
+}
 
-	if (!ExistsDir(export_path))
+// Format of the written models, either 'BIN' or 'TXT' as in the model_converter.
+bool ParseModelOutputType(std::string output_type, bool* binary_models)
+{
+	StringToLower(&output_type);
+	if (output_type != "bin" && output_type != "txt")
 	{
-		std::cerr << "ERROR: `export_path` is not a directory." << std::endl;
-		return EXIT_FAILURE;
+		std::cerr << "ERROR: Invalid `output_type` - supported values are {'BIN', 'TXT'}." << std::endl;
+		return false;
 	}
+	*binary_models = output_type == "bin";
+	return true;
+}
 
-	if (!image_list_path.empty())
-	{
-		const auto image_names = ReadTextFileLines(image_list_path);
-		options.mapper->image_names =
-		    std::set<std::string>(image_names.begin(), image_names.end());
-	}
+void WriteModel(const Reconstruction& reconstruction, const std::string& path, const bool binary_models)
+{
+	if (binary_models)
+		reconstruction.WriteBinary(path);
+	else
+		reconstruction.WriteText(path);
+}
 
+// Reconstruct every take listed in takes.txt with itself as the anchor take.
+// The models are written to `export_path`/N unless `export_path` is empty and
+// the bundles of the takes are appended to `bundles` if it is given. The models
+// are written in the binary format if `binary_models` is set. Up to
+// `num_parallel_takes` takes are reconstructed at once, which share the thread
+// budget of `Mapper.num_threads`.
+//
+// If `job_path` is given, the takes are jobs of the manifest in this folder and
+// only the takes that this process claims as `job_worker` are reconstructed,
+// so that mapper processes on several nodes with a shared filesystem split the
+// takes among them. Without a worker name, a unique one is chosen, otherwise
+// the takes that a previous run of the same worker left running are redone.
+int ReconstructTakes(OptionManager& options, const std::string& import_path,
+                     const std::string& export_path,
+                     const int num_parallel_takes,
+                     std::vector<TakeBundle>* bundles,
+                     const bool binary_models,
+                     const std::string& job_path = "",
+                     const std::string& job_worker = "")
+{
 	//find number of takes
 	int takes_count = 0;
 	std::ifstream fset;
@@ -634,43 +919,96 @@ int RunMapper(int argc, char** argv)
 	}
 	fset.close();
 
-	//for each take run the reconstruction and save the result to the right folder
-	for(int i=1;i<=takes_count;i++)
+	if (import_path != "" && !ExistsDir(import_path))
+	{
+		std::cerr << "ERROR: `import_path` is not a directory." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	//the database is the same for all takes, so it is only loaded once and
+	//every take adds its phantom images to its own overlay of the scene graph
+	DatabaseCache database_cache;
+	if (!IncrementalMapperController::LoadDatabaseCache(*options.mapper, *options.database_path, &database_cache))
+	{
+		return EXIT_FAILURE;
+	}
+
+	//the takes share the geometries of the candidate initial pairs, which are
+	//persisted for later runs if Mapper.init_pair_cache_path is given
+	InitialPairCache init_pair_cache;
+	if (!options.mapper->init_pair_cache_path.empty())
+	{
+		init_pair_cache.Read(options.mapper->init_pair_cache_path);
+	}
+
+	//divide the threads between the takes that run at the same time
+	const int num_workers = std::max(1, std::min(num_parallel_takes, takes_count));
+	const int num_threads = std::max(1, GetEffectiveNumThreads(options.mapper->num_threads) / num_workers);
+
+	std::vector<TakeBundle> take_bundles(takes_count);
+
+	//every process adds all takes, the manifest keeps only the first of them
+	std::unique_ptr<JobManifest> jobs;
+	std::string worker = job_worker;
+	if (job_path != "")
+	{
+		jobs.reset(new JobManifest(job_path));
+		if (worker == "")
+		{
+			worker = JobManifest::UniqueWorkerName();
+		}
+		else if (const size_t num_requeued = jobs->Requeue(worker))
+		{
+			std::cout << "Requeued " << num_requeued << " takes of worker " << worker << "\n";
+		}
+		for(int i=1;i<=takes_count;i++)
+		{
+			jobs->Add(std::to_string(i));
+		}
+	}
+
+	//reconstruct take i and save the result to the right folder, returns
+	//whether the take was reconstructed
+	auto reconstruct_take = [&](const int i)
 	{
 		std::cout << "RECONSTRUCTION OF TAKE " << i << "\n";
-  		//improve the pivot file so it contains the take id
-  		std::ofstream pivot;
-		pivot.open("pivot.txt");
-		pivot << i << "\n";
-		pivot.close();
+		SetMetricsStage(StringPrintf("take%d", i));
+		IncrementalMapperOptions take_options = *options.mapper;
+		take_options.anchor_take = i;
+		if (num_workers > 1)
+		{
+			take_options.num_threads = num_threads;
+		}
 
 		//create the new output path
 		std::string path;
-		path.append(export_path);
-		path.append("/");
-		path.append(std::to_string(i));
+		if (export_path != "")
+		{
+			path = JoinPaths(export_path, std::to_string(i));
+		}
 
 		//create new reconstruction manager and mapper
 		ReconstructionManager reconstruction_manager;
 		if (import_path != "")
 		{
-		  if (!ExistsDir(import_path))
-		  {
-		    std::cerr << "ERROR: `import_path` is not a directory." << std::endl;
-		    return EXIT_FAILURE;
-		  }
-		  reconstruction_manager.Read(import_path);
+			reconstruction_manager.Read(import_path);
 		}
 
-		IncrementalMapperController mapper(options.mapper.get(), *options.image_path,
-		                                   *options.database_path,
+		//writes the sub-models in the background
+		AsyncReconstructionWriter model_writer;
+
+		IncrementalMapperController mapper(&take_options, *options.image_path,
+		                                   &database_cache,
 		                                   &reconstruction_manager);
+		mapper.SetInitialPairCache(&init_pair_cache);
 
 		// In case a new reconstruction is started, write results of individual sub-
 		// models to as their reconstruction finishes instead of writing all results
-		// after all reconstructions finished.
+		// after all reconstructions finished. The sub-model folders are shared by
+		// all takes, so this is only done when the takes run one after another.
+		// The sub-models are written in the background while the mapper goes on.
 		size_t prev_num_reconstructions = 0;
-		if (import_path == "")
+		if (import_path == "" && export_path != "" && num_workers == 1 && !jobs)
 		{
 			mapper.AddCallback(
 		      IncrementalMapperController::LAST_IMAGE_REG_CALLBACK, [&]() {
@@ -682,42 +1020,144 @@ int RunMapper(int argc, char** argv)
 		          const auto& reconstruction =
 		              reconstruction_manager.Get(prev_num_reconstructions);
 		          CreateDirIfNotExists(reconstruction_path);
-		          reconstruction.Write(reconstruction_path);
+		          model_writer.Write(reconstruction_path, reconstruction,
+		              [reconstruction_path, binary_models](const Reconstruction& model) {
+		                WriteModel(model, reconstruction_path, binary_models);
+		              });
 		          options.Write(JoinPaths(reconstruction_path, "project.ini"));
 		          prev_num_reconstructions = reconstruction_manager.Size();
 		        }
 		      });
 		}
-		CreateDirIfNotExists(path);
+		if (path != "")
+		{
+			CreateDirIfNotExists(path);
+		}
 		
 		//run the mapper
 		mapper.Start();
 		mapper.Wait();
+		model_writer.Wait();
 
 		//save the result to the new folder
 		if (path != "" && reconstruction_manager.Size() > 0)
 		{
-	    	reconstruction_manager.Get(0).Write(path);
-	    	
+			ResourceScope resource_scope(StringPrintf("take%d/write_model", i));
+	    	WriteModel(reconstruction_manager.Get(0), path, binary_models);
+	    	std::cout << JoinPaths(path, binary_models ? "cameras.bin" : "cameras.txt");
 		}
-  		std::cout << JoinPaths(path, "cameras.txt");
-  		//delete &mapper;
-  		reconstruction_manager.Clear();
 
-		//break;
-		
+		//hand the take over to the postprocessor
+		if (bundles != nullptr)
+		{
+			take_bundles[i-1] = mapper.GetTakeBundle();
+		}
+
+		return reconstruction_manager.Size() > 0;
+	};
+
+	//claim and reconstruct takes until no pending take is left
+	auto run_jobs = [&]()
+	{
+		std::string job;
+		while (jobs->Claim(worker, &job))
+		{
+			std::cout << "Worker " << worker << " claimed take " << job << "\n";
+			jobs->Finish(worker, job, reconstruct_take(std::stoi(job)));
+		}
+	};
+
+	if (num_workers == 1)
+	{
+		if (jobs)
+		{
+			run_jobs();
+		}
+		else
+		{
+			for(int i=1;i<=takes_count;i++)
+			{
+				reconstruct_take(i);
+			}
+		}
+	}
+	else
+	{
+		ThreadPool thread_pool(num_workers);
+		if (jobs)
+		{
+			for(int i=0;i<num_workers;i++)
+			{
+				thread_pool.AddTask(run_jobs);
+			}
+		}
+		else
+		{
+			for(int i=1;i<=takes_count;i++)
+			{
+				thread_pool.AddTask(reconstruct_take, i);
+			}
+		}
+		thread_pool.Wait();
 	}
 
-  /*mapper.Start();
-  mapper.Wait();
+	if (!options.mapper->init_pair_cache_path.empty())
+	{
+		init_pair_cache.Write(options.mapper->init_pair_cache_path);
+	}
 
-  // In case the reconstruction is continued from an existing reconstruction, do
-  // not create sub-folders but directly write the results.
-  if (import_path != "" && reconstruction_manager.Size() > 0) {
-    reconstruction_manager.Get(0).Write(export_path);
-  }*/
+	if (bundles != nullptr)
+	{
+		bundles->insert(bundles->end(), take_bundles.begin(), take_bundles.end());
+	}
 
-  return EXIT_SUCCESS;
+	return EXIT_SUCCESS;
+}
+
+int RunMapper(int argc, char** argv)
+{
+	std::string import_path;
+	std::string export_path;
+	std::string image_list_path;
+	int num_parallel_takes = 1;
+	std::string job_path;
+	std::string job_worker;
+	std::string output_type = "BIN";
+
+	OptionManager options;
+	options.AddDatabaseOptions();
+	options.AddImageOptions();
+	options.AddDefaultOption("import_path", &import_path);
+	options.AddRequiredOption("export_path", &export_path);
+	options.AddDefaultOption("image_list_path", &image_list_path);
+	options.AddDefaultOption("num_parallel_takes", &num_parallel_takes);
+	options.AddDefaultOption("job_path", &job_path);
+	options.AddDefaultOption("job_worker", &job_worker);
+	options.AddDefaultOption("output_type", &output_type, "{'BIN', 'TXT'}");
+	options.AddMapperOptions();
+	options.Parse(argc, argv);
+
+	bool binary_models;
+	if (!ParseModelOutputType(output_type, &binary_models))
+		return EXIT_FAILURE;
+
+	if (!ExistsDir(export_path))
+	{
+		std::cerr << "ERROR: `export_path` is not a directory." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (!image_list_path.empty())
+	{
+		const auto image_names = ReadTextFileLines(image_list_path);
+		options.mapper->image_names =
+		    std::set<std::string>(image_names.begin(), image_names.end());
+	}
+
+	EnableResourceAccounting();
+	const int return_code = ReconstructTakes(options, import_path, export_path, num_parallel_takes, nullptr, binary_models, job_path, job_worker);
+	WriteCommandResourceReport(export_path);
+	return return_code;
 }
 
 int RunMatchesImporter(int argc, char** argv) {
@@ -823,13 +1263,20 @@ int RunModelAligner(int argc, char** argv) {
     std::cout << " => Alignment succeeded" << std::endl;
     reconstruction.Write(output_path);
 
+    std::unordered_map<std::string, const Image*> images_by_name;
+    images_by_name.reserve(reconstruction.NumImages());
+    for (const auto& image : reconstruction.Images()) {
+      images_by_name.emplace(image.second.Name(), &image.second);
+    }
+
     std::vector<double> errors;
     errors.reserve(ref_image_names.size());
 
     for (size_t i = 0; i < ref_image_names.size(); ++i) {
-      const Image* image = reconstruction.FindImageWithName(ref_image_names[i]);
-      if (image != nullptr) {
-        errors.push_back((image->ProjectionCenter() - ref_locations[i]).norm());
+      const auto image = images_by_name.find(ref_image_names[i]);
+      if (image != images_by_name.end()) {
+        errors.push_back(
+            (image->second->ProjectionCenter() - ref_locations[i]).norm());
       }
     }
 
@@ -1113,22 +1560,20 @@ int RunPointTriangulator(int argc, char** argv) {
 
   const auto tri_options = mapper_options.Triangulation();
 
-  for (const image_t image_id : reconstruction.RegImageIds()) {
-    const auto& image = reconstruction.Image(image_id);
-
-    PrintHeading1("Triangulating image #" + std::to_string(image_id));
+  PrintHeading1("Triangulating images");
 
-    const size_t num_existing_points3D = image.NumPoints3D();
+  const size_t num_existing_points3D = reconstruction.NumPoints3D();
 
-    std::cout << "  => Image has " << num_existing_points3D << " / "
-              << image.NumObservations() << " points" << std::endl;
+  std::cout << "  => Model has " << num_existing_points3D << " points in "
+            << reconstruction.NumRegImages() << " images" << std::endl;
 
-    mapper.TriangulateImage(tri_options, image_id);
+  // The poses are fixed, so that all images are triangulated at once, which
+  // runs concurrently across the independent correspondences.
+  mapper.TriangulateImages(tri_options, reconstruction.RegImageIds());
 
-    std::cout << "  => Triangulated "
-              << (image.NumPoints3D() - num_existing_points3D) << " points"
-              << std::endl;
-  }
+  std::cout << "  => Triangulated "
+            << (reconstruction.NumPoints3D() - num_existing_points3D)
+            << " points" << std::endl;
 
   //////////////////////////////////////////////////////////////////////////////
   // Bundle adjustment
@@ -1303,11 +1748,15 @@ int RunRigBundleAdjuster(int argc, char** argv) {
   std::string input_path;
   std::string output_path;
   std::string rig_config_path;
+  RigBundleAdjuster::Options rig_ba_options;
 
   OptionManager options;
   options.AddRequiredOption("input_path", &input_path);
   options.AddRequiredOption("output_path", &output_path);
   options.AddRequiredOption("rig_config_path", &rig_config_path);
+  options.AddDefaultOption("use_iterative_solver",
+                           &rig_ba_options.use_iterative_solver);
+  options.AddDefaultOption("num_threads", &rig_ba_options.num_threads);
   options.AddBundleAdjustmentOptions();
   options.Parse(argc, argv);
 
@@ -1337,7 +1786,6 @@ int RunRigBundleAdjuster(int argc, char** argv) {
 
   BundleAdjustmentOptions ba_options = *options.bundle_adjustment;
   ba_options.solver_options.minimizer_progress_to_stdout = true;
-  RigBundleAdjuster::Options rig_ba_options;
   RigBundleAdjuster bundle_adjuster(ba_options, rig_ba_options, config);
   CHECK(bundle_adjuster.Solve(&reconstruction, &camera_rigs));
 
@@ -1398,9 +1846,12 @@ int RunTransitiveMatcher(int argc, char** argv) {
 
 // Loads descriptors for training from the database. Loads all descriptors from
 // the database if max_num_images < 0, otherwise the descriptors of a random
-// subset of images are selected.
+// subset of images are selected. If max_num_descriptors > 0, a uniform random
+// sample of at most this many descriptors is drawn while the descriptors are
+// streamed from the database, so that the others are never held in memory.
 FeatureDescriptors LoadRandomDatabaseDescriptors(
-    const std::string& database_path, const int max_num_images) {
+    const std::string& database_path, const int max_num_images,
+    const int max_num_descriptors) {
   Database database(database_path);
   DatabaseTransaction database_transaction(&database);
 
@@ -1412,8 +1863,6 @@ FeatureDescriptors LoadRandomDatabaseDescriptors(
   size_t num_descriptors = 0;
   if (max_num_images < 0) {
     // All images in the database.
-    image_ids.resize(images.size());
-    std::iota(image_ids.begin(), image_ids.end(), 0);
     num_descriptors = database.NumDescriptors();
   } else {
     // Random subset of images in the database.
@@ -1427,19 +1876,46 @@ FeatureDescriptors LoadRandomDatabaseDescriptors(
     }
   }
 
-  descriptors.resize(num_descriptors, 128);
+  size_t num_sampled_descriptors = num_descriptors;
+  if (max_num_descriptors > 0) {
+    num_sampled_descriptors = std::min(
+        num_descriptors, static_cast<size_t>(max_num_descriptors));
+  }
 
-  size_t descriptor_row = 0;
-  for (const auto image_id : image_ids) {
-    const auto& image = images.at(image_id);
-    const FeatureDescriptors image_descriptors =
-        database.ReadDescriptors(image.ImageId());
-    descriptors.block(descriptor_row, 0, image_descriptors.rows(), 128) =
-        image_descriptors;
-    descriptor_row += image_descriptors.rows();
+  descriptors.resize(num_sampled_descriptors, 128);
+
+  // Copy the descriptors straight from the database without an intermediate
+  // matrix per image. Once the sample is full, every further descriptor
+  // replaces a random sampled descriptor with the probability of the sample
+  // size over the number of descriptors so far (reservoir sampling).
+  size_t descriptor_idx = 0;
+  const auto CopyDescriptors =
+      [&](const Eigen::Map<const FeatureDescriptors>& image_descriptors) {
+        for (FeatureDescriptors::Index i = 0; i < image_descriptors.rows();
+             ++i) {
+          size_t descriptor_row = descriptor_idx;
+          if (descriptor_idx >= num_sampled_descriptors) {
+            descriptor_row = RandomInteger<size_t>(0, descriptor_idx);
+          }
+          if (descriptor_row < num_sampled_descriptors) {
+            descriptors.row(descriptor_row) = image_descriptors.row(i);
+          }
+          descriptor_idx += 1;
+        }
+      };
+  if (max_num_images < 0) {
+    database.ReadAllDescriptors(
+        [&](const image_t,
+            const Eigen::Map<const FeatureDescriptors>& image_descriptors) {
+          CopyDescriptors(image_descriptors);
+        });
+  } else {
+    for (const auto image_id : image_ids) {
+      database.ReadDescriptors(images.at(image_id).ImageId(), CopyDescriptors);
+    }
   }
 
-  CHECK_EQ(descriptor_row, num_descriptors);
+  CHECK_EQ(descriptor_idx, num_descriptors);
 
   return descriptors;
 }
@@ -1448,6 +1924,7 @@ int RunVocabTreeBuilder(int argc, char** argv) {
   std::string vocab_tree_path;
   retrieval::VisualIndex<>::BuildOptions build_options;
   int max_num_images = -1;
+  int max_num_descriptors = -1;
 
   OptionManager options;
   options.AddDatabaseOptions();
@@ -1456,14 +1933,19 @@ int RunVocabTreeBuilder(int argc, char** argv) {
   options.AddDefaultOption("num_checks", &build_options.num_checks);
   options.AddDefaultOption("branching", &build_options.branching);
   options.AddDefaultOption("num_iterations", &build_options.num_iterations);
+  options.AddDefaultOption("num_mini_batch_iterations",
+                           &build_options.num_mini_batch_iterations);
+  options.AddDefaultOption("num_threads", &build_options.num_threads);
   options.AddDefaultOption("max_num_images", &max_num_images);
+  options.AddDefaultOption("max_num_descriptors", &max_num_descriptors);
   options.Parse(argc, argv);
 
   retrieval::VisualIndex<> visual_index;
 
   std::cout << "Loading descriptors..." << std::endl;
   const auto descriptors =
-      LoadRandomDatabaseDescriptors(*options.database_path, max_num_images);
+      LoadRandomDatabaseDescriptors(*options.database_path, max_num_images,
+                                    max_num_descriptors);
   std::cout << "  => Loaded a total of " << descriptors.rows() << " descriptors"
             << std::endl;
 
@@ -1642,87 +2124,217 @@ int RunVocabTreeRetriever(int argc, char** argv) {
   return EXIT_SUCCESS;
 }
 
+// Print the wall time of every postprocessor stage when it has finished.
+void AddStageTimingCallback(TwoBodyPostprocessor* postprocessor)
+{
+	postprocessor->AddCallback(TwoBodyPostprocessor::STAGE_FINISHED_CALLBACK,
+		[](const std::string& stage, const double elapsed_seconds) {
+			std::cout << StringPrintf("Stage %s finished in %.3fs", stage.c_str(), elapsed_seconds) << std::endl;
+		});
+}
+
+// Account the resources of every postprocessor stage as "postprocessor/<stage>".
+void AddResourceAccountingCallback(TwoBodyPostprocessor* postprocessor)
+{
+	//the scope of the running stage, stages run one after another on the
+	//thread of `Run`
+	auto scope = std::make_shared<std::unique_ptr<ResourceScope>>();
+	postprocessor->AddCallback(TwoBodyPostprocessor::STAGE_STARTED_CALLBACK,
+		[scope](const std::string& stage, const double) {
+			scope->reset();
+			scope->reset(new ResourceScope("postprocessor/" + stage));
+		});
+	postprocessor->AddCallback(TwoBodyPostprocessor::STAGE_FINISHED_CALLBACK,
+		[scope](const std::string&, const double) { scope->reset(); });
+}
+
+// Report the running postprocessor stage as "postprocessor/<stage>" in the
+// live metrics.
+void AddMetricsStageCallback(TwoBodyPostprocessor* postprocessor)
+{
+	postprocessor->AddCallback(TwoBodyPostprocessor::STAGE_STARTED_CALLBACK,
+		[](const std::string& stage, const double) {
+			SetMetricsStage("postprocessor/" + stage);
+		});
+}
+
+// Wait until the mapper workers that share the job manifest in `job_path` have
+// finished all takes of takes.txt. The takes are added to the manifest, in case
+// the postprocessor starts before the workers. Returns false if a take failed.
+bool WaitForTakeJobs(const std::string& job_path, const double poll_seconds)
+{
+	int takes_count = 0;
+	for (const auto& take : ReadTakeMap("takes.txt"))
+		takes_count = std::max(takes_count, take.second);
+
+	JobManifest jobs(job_path);
+	for(int i=1;i<=takes_count;i++)
+		jobs.Add(std::to_string(i));
+
+	std::cout << "Waiting for the takes of the workers in " << job_path << "\n";
+	jobs.Wait(poll_seconds);
+	const std::vector<std::string> failed_jobs = jobs.Jobs(JobManifest::State::FAILED);
+	if (!failed_jobs.empty())
+	{
+		std::cerr << "ERROR: The reconstruction of takes";
+		for (const auto& job : failed_jobs)
+			std::cerr << " " << job;
+		std::cerr << " failed." << std::endl;
+		return false;
+	}
+	return true;
+}
+
 int RunPostprocessor(int argc, char** argv)
 {
 	//RUN THE POSTPROCESSING STEP
 	//parts 3.3 to 3.7 of the paper
-	std::cout << "RUNNING POSTPROCESSOR\n";
-	step1();
-	std::vector<cam_s> C = load_cams();
-	std::cout << C.size() << "\n";
-	std::vector<basis_t> B = find_bases(C);
-	std::cout << B.size() << "\n";
-	int takes = count_takes(C);
-	std::cout << takes << "\n";
-	std::vector<std::vector<std::vector<basis_t>>> CL = divide_bases(B,C,1);
-	std::vector<std::vector<clust_b>> M = meanclust(CL, C);	
-	std::vector<cycle_3> CY = find3cycles(M);
-	std::vector<double> bzs(CY.size());
-	std::vector<int> CL2 = cluster_cycles(CY, 0.03, C, CL, &bzs);
-	std::pair<std::pair<Eigen::MatrixXi, Eigen::MatrixXi>, Eigen::MatrixXd> st = select_bases(M, CY, CL2, takes, bzs, 0.03, 0.98);
-	int reference = find_reference(st.second, takes);
-	double pd = princ_dist(C, reference+1);
-	std::cout << reference << "\n";
-	std::vector<std::vector<trans_s>> transform = find_transformations(st.first, reference, M, takes);
-	std::vector<motion_t> U = find_motion(C);
-	std::vector<motion_t> U2 = transform_motion(U, transform);
-	std::vector<motion_t> U3 = remove_id(U2, pd, 2.5, 3);
-	std::cout << pd << "\n";
-	std::vector<cam_s> C2 = change_basis_cams(C, transform);
-	std::vector<std::vector<std::vector<motion_t>>> CL_mot = divide_motions(U3, C2, 1, pd, 1);
-	std::vector<std::vector<clust_m>> MM = meanclust_motions(CL_mot);
-	std::pair<std::vector<std::vector<std::vector<motion_t>>>, std::vector<std::vector<clust_m>>> MM2 = remove_identity(MM, CL_mot, pd, 1, 1);
-	
-	std::vector<imgs_s> I = load_imgs(takes);
-	std::vector<pnts_s> P = load_pnts(takes);
-	
-	std::pair<std::vector<std::vector<std::pair<int, int>>>, std::vector<std::unordered_map<int, int>>> T = load_tracks(P, takes);
-	std::vector<std::vector<int>> O = observed_tracks(C, I, P, T.second);
-	std::vector<std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>> O2 = observed_tracks_2(C, I, P, T.second);
-	std::vector<std::vector<std::pair<std::vector<int>, std::vector<int>>>> CLO = observed_by_cluster(MM2.first, O);
-	std::vector<std::vector<std::pair<int, int>>> CLCL = chordal_completion(MM2.second, CLO, 1, 1, pd);
-	//std::vector<std::vector<std::pair<int, int>>> CLCL = split_cams(CLO);
-	//return 0;
-	int group = select_group(CLCL, MM2.second);
-	//int group = select_group_o(CLCL, CLO);
-	std::pair<std::vector<int>, std::vector<int>> Q = group_cams(CLCL[group], MM2.first);
-	std::pair<std::pair<std::vector<int>, std::vector<int>>, std::vector<int>> D = split_tracks(Q, O, T.first.size());
-	std::vector<int> order = order_fold(T.first, D.first, takes);
-	std::pair<std::pair<pnts_s, pnts_s>, std::vector<std::pair<trans_s,trans_s>>> R = merge_reconstructions(P, T.first, D.first, order);
-	std::pair<std::vector<img_s>, std::vector<trans_s>> MC = merge_cameras(C, R.second, order[0], O2, Q, D.first);
-	for(int i=0;i<3;i++)
+	std::string checkpoint_path;
+	std::string resume_from = PostprocessorStageName(PostprocessorStage::INPUT);
+	std::string output_type = "TXT";
+	std::string job_path;
+	double job_poll_seconds = 10;
+
+	OptionManager options;
+	options.AddDefaultOption("checkpoint_path", &checkpoint_path);
+	options.AddDefaultOption("resume_from", &resume_from);
+	options.AddDefaultOption("output_type", &output_type, "{'BIN', 'TXT'}");
+	options.AddDefaultOption("job_path", &job_path);
+	options.AddDefaultOption("job_poll_seconds", &job_poll_seconds);
+	options.AddPostprocessorOptions();
+	options.Parse(argc, argv);
+
+	bool binary_models;
+	if (!ParseModelOutputType(output_type, &binary_models))
+		return EXIT_FAILURE;
+
+	PostprocessorStage resume_stage;
+	if (!ParsePostprocessorStage(resume_from, &resume_stage))
 	{
-		std::pair<std::vector<int>, std::vector<int>> D2 = split_tracks3(D.first, 5, T.first.size(), P, T.second);
-		std::pair<std::vector<int>, std::vector<int>> D3 = filter_points2(D2, D.first, MC.first, P, 3, T.first);
-		add_points2(D3, T.first, P, R.first, R.second, order[0]);
-		std::cout << "ADDED: " << D3.first.size() << " " << D3.second.size() << "\n";
-		for(unsigned int j=0;j<D3.first.size();j++)
-		{
-			D.first.first.push_back(D3.first[j]);
-		}
-		for(unsigned int j=0;j<D3.second.size();j++)
-		{
-			D.first.second.push_back(D3.second[j]);
-		}
+		std::cerr << "ERROR: Invalid `resume_from` stage, must be one of input, clustering, merging or points." << std::endl;
+		return EXIT_FAILURE;
 	}
+	if (!checkpoint_path.empty())
+		CreateDirIfNotExists(checkpoint_path);
 
-	std::pair<std::pair<pnts_s, pnts_s>, std::vector<std::pair<trans_s,trans_s>>> RB = R;
-	std::pair<std::vector<img_s>, std::vector<trans_s>> MCB = MC;
-	
-	
-	perform_BA(R.first, MC.first, MC.second, 1, order[0]);
-	CreateDirIfNotExists("model0");
-	CreateDirIfNotExists("model1");
-	CreateDirIfNotExists("model2");
-	CreateDirIfNotExists("model3");
-	save_model(R.first, MC.first, MC.second, 0, order[0]);
-	save_model(R.first, MC.first, MC.second, 1, order[0]);
-	save_model(R.first, MC.first, MC.second, 2, order[0]);
-	save_model(R.first, MC.first, MC.second, 3, order[0]);
+	TwoBodyPostprocessorOptions postprocessor_options = *options.postprocessor;
+	postprocessor_options.checkpoint_path = checkpoint_path;
+	postprocessor_options.resume_from = resume_stage;
+	const int num_threads = postprocessor_options.num_threads;
+
+	//gather the takes of the mapper workers, which write their take bundles to
+	//the shared take folders
+	if (!job_path.empty() && !WaitForTakeJobs(job_path, job_poll_seconds))
+		return EXIT_FAILURE;
+
+	EnableResourceAccounting();
+	std::cout << "RUNNING POSTPROCESSOR\n";
+	std::vector<cam_s> C;
+	{
+		ResourceScope resource_scope("postprocessor/step1");
+		step1();
+	}
+	{
+		ResourceScope resource_scope("postprocessor/load_cams");
+		C = load_cams();
+	}
+	const int takes = count_takes(C);
+	//the take bundles are read once and shared by the images and the points
+	//loaders, they are released with the loaders
+	std::shared_future<std::shared_ptr<const std::vector<TakeBundle>>> bundles = std::async(std::launch::async, [takes]() {
+		ResourceScope resource_scope("postprocessor/load_takes");
+		return std::make_shared<const std::vector<TakeBundle>>(load_takes(takes));
+	}).share();
+	PostprocessorLoaders loaders;
+	loaders.images = [bundles]() { return load_imgs(*bundles.get()); };
+	loaders.points = [bundles]() { return load_pnts(*bundles.get()); };
+	loaders.tracks = [takes, num_threads](const std::vector<pnts_s>& P) { return load_tracks(P, takes, num_threads); };
+	bundles = std::shared_future<std::shared_ptr<const std::vector<TakeBundle>>>();
+	TwoBodyPostprocessor postprocessor(postprocessor_options);
+	AddStageTimingCallback(&postprocessor);
+	AddResourceAccountingCallback(&postprocessor);
+	AddMetricsStageCallback(&postprocessor);
+	const auto models = postprocessor.Run(C, std::move(loaders));
+	{
+		ResourceScope resource_scope("postprocessor/write_models");
+		postprocessor.WriteModels(models, ".", binary_models);
+	}
+	WriteCommandResourceReport(".");
 	
 	return 0;
 }
 
+int RunTwoBodyReconstructor(int argc, char** argv)
+{
+	//mapper and postprocessor in one process, the takes are handed over in
+	//memory and only written to disk with --export_takes 1
+	std::string export_path = ".";
+	std::string image_list_path;
+	bool export_takes = false;
+	int num_parallel_takes = 1;
+	std::string output_type = "TXT";
+
+	OptionManager options;
+	options.AddDatabaseOptions();
+	options.AddImageOptions();
+	options.AddDefaultOption("export_path", &export_path);
+	options.AddDefaultOption("export_takes", &export_takes);
+	options.AddDefaultOption("num_parallel_takes", &num_parallel_takes);
+	options.AddDefaultOption("image_list_path", &image_list_path);
+	options.AddDefaultOption("output_type", &output_type, "{'BIN', 'TXT'}");
+	options.AddMapperOptions();
+	options.AddPostprocessorOptions();
+	options.Parse(argc, argv);
+
+	bool binary_models;
+	if (!ParseModelOutputType(output_type, &binary_models))
+		return EXIT_FAILURE;
+
+	if (export_takes && !ExistsDir(export_path))
+	{
+		std::cerr << "ERROR: `export_path` is not a directory." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (!image_list_path.empty())
+	{
+		const auto image_names = ReadTextFileLines(image_list_path);
+		options.mapper->image_names =
+		    std::set<std::string>(image_names.begin(), image_names.end());
+	}
+
+	options.mapper->write_take_bundle = export_takes;
+
+	EnableResourceAccounting();
+	std::vector<TakeBundle> bundles;
+	if (ReconstructTakes(options, "", export_takes ? export_path : "", num_parallel_takes, &bundles, true) != EXIT_SUCCESS)
+	{
+		return EXIT_FAILURE;
+	}
+
+	std::cout << "RUNNING POSTPROCESSOR\n";
+	std::vector<cam_s> C;
+	{
+		ResourceScope resource_scope("postprocessor/load_cams");
+		C = load_cams(bundles);
+	}
+	//the bundles are shared by the loaders and released with them
+	PostprocessorLoaders loaders = TakeBundleLoaders(std::make_shared<const std::vector<TakeBundle>>(std::move(bundles)), options.postprocessor->num_threads);
+	bundles.clear();
+	TwoBodyPostprocessor postprocessor(*options.postprocessor);
+	AddStageTimingCallback(&postprocessor);
+	AddResourceAccountingCallback(&postprocessor);
+	AddMetricsStageCallback(&postprocessor);
+	const auto models = postprocessor.Run(C, std::move(loaders));
+	{
+		ResourceScope resource_scope("postprocessor/write_models");
+		postprocessor.WriteModels(models, ".", binary_models);
+	}
+	WriteCommandResourceReport(".");
+
+	return EXIT_SUCCESS;
+}
+
 int RunPreprocessor(int argc, char** argv)
 {
 	//we expect the images to be in the images folder in subfolders folders 1..k
@@ -1774,7 +2386,16 @@ int ShowHelp(
             << std::endl;
 
   std::cout << "Usage:" << std::endl;
-  std::cout << "  colmap [command] [options]" << std::endl << std::endl;
+  std::cout << "  colmap [command] [options]" << std::endl;
+  std::cout << "  colmap [command] [options] --trace_path TRACE.json"
+            << std::endl;
+  std::cout << "  colmap [command] [options] --max_memory_gb GB" << std::endl;
+  std::cout << "  colmap [command] [options] --perf_counters 1" << std::endl;
+  std::cout << "  colmap [command] [options] --random_seed SEED" << std::endl;
+  std::cout << "  colmap [command] [options] --metrics_path METRICS.json "
+               "[--metrics_interval SECONDS]"
+            << std::endl
+            << std::endl;
 
   std::cout << "Documentation:" << std::endl;
   std::cout << "  https://colmap.github.io/" << std::endl << std::endl;
@@ -1819,9 +2440,11 @@ int main(int argc, char** argv) {
   commands.emplace_back("dense_fuser", &RunDenseFuser);
   commands.emplace_back("dense_mesher", &RunDenseMesher);
   commands.emplace_back("dense_stereo", &RunDenseStereo);
+  commands.emplace_back("descriptor_quantizer", &RunDescriptorQuantizer);
   commands.emplace_back("exhaustive_matcher", &RunExhaustiveMatcher);
   commands.emplace_back("feature_extractor", &RunFeatureExtractor);
   commands.emplace_back("feature_importer", &RunFeatureImporter);
+  commands.emplace_back("hierarchical_mapper", &RunHierarchicalMapper);
   commands.emplace_back("image_rectifier", &RunImageRectifier);
   commands.emplace_back("image_registrator", &RunImageRegistrator);
   commands.emplace_back("image_undistorter", &RunImageUndistorter);
@@ -1840,6 +2463,7 @@ int main(int argc, char** argv) {
   commands.emplace_back("sequential_matcher", &RunSequentialMatcher);
   commands.emplace_back("spatial_matcher", &RunSpatialMatcher);
   commands.emplace_back("transitive_matcher", &RunTransitiveMatcher);
+  commands.emplace_back("two_body_reconstructor", &RunTwoBodyReconstructor);
   commands.emplace_back("vocab_tree_builder", &RunVocabTreeBuilder);
   commands.emplace_back("vocab_tree_matcher", &RunVocabTreeMatcher);
   commands.emplace_back("vocab_tree_retriever", &RunVocabTreeRetriever);
@@ -1870,7 +2494,146 @@ int main(int argc, char** argv) {
       int command_argc = argc - 1;
       char** command_argv = &argv[1];
       command_argv[0] = argv[0];
-      return matched_command_func(command_argc, command_argv);
+
+      // The global `--trace_path` option is handled here, so that the trace
+      // covers the entire command irrespective of its own options.
+      std::string trace_path;
+      for (int i = 1; i < command_argc; ++i) {
+        if (std::string(command_argv[i]) == "--trace_path" &&
+            i + 1 < command_argc) {
+          trace_path = command_argv[i + 1];
+          std::copy(command_argv + i + 2, command_argv + command_argc,
+                    command_argv + i);
+          command_argc -= 2;
+          break;
+        }
+      }
+
+      // So is the global `--max_memory_gb` option, which sets the budget of
+      // the resident memory that the caches of all components adapt to.
+      for (int i = 1; i < command_argc; ++i) {
+        if (std::string(command_argv[i]) == "--max_memory_gb" &&
+            i + 1 < command_argc) {
+          const double max_memory_gb = std::atof(command_argv[i + 1]);
+          if (max_memory_gb < 0) {
+            std::cerr << "ERROR: `max_memory_gb` must not be negative."
+                      << std::endl;
+            return EXIT_FAILURE;
+          }
+          SetMemoryBudget(
+              static_cast<size_t>(1024.0 * 1024.0 * 1024.0 * max_memory_gb));
+          std::copy(command_argv + i + 2, command_argv + command_argc,
+                    command_argv + i);
+          command_argc -= 2;
+          break;
+        }
+      }
+
+      // And the global `--metrics_path` and `--metrics_interval` options, which
+      // periodically rewrite a JSON file with the live metrics of the command.
+      std::string metrics_path;
+      double metrics_interval = 10.0;
+      for (int i = 1; i < command_argc;) {
+        const std::string arg = command_argv[i];
+        if ((arg == "--metrics_path" || arg == "--metrics_interval") &&
+            i + 1 < command_argc) {
+          if (arg == "--metrics_path") {
+            metrics_path = command_argv[i + 1];
+          } else {
+            metrics_interval = std::atof(command_argv[i + 1]);
+            if (metrics_interval <= 0) {
+              std::cerr << "ERROR: `metrics_interval` must be positive."
+                        << std::endl;
+              return EXIT_FAILURE;
+            }
+          }
+          std::copy(command_argv + i + 2, command_argv + command_argc,
+                    command_argv + i);
+          command_argc -= 2;
+        } else {
+          i += 1;
+        }
+      }
+
+      // And the global `--perf_counters` option, which counts the hardware
+      // performance counters of the trace scopes.
+      bool perf_counters = false;
+      for (int i = 1; i < command_argc; ++i) {
+        if (std::string(command_argv[i]) == "--perf_counters" &&
+            i + 1 < command_argc) {
+          perf_counters = std::atoi(command_argv[i + 1]) != 0;
+          std::copy(command_argv + i + 2, command_argv + command_argc,
+                    command_argv + i);
+          command_argc -= 2;
+          break;
+        }
+      }
+
+      // And the global `--random_seed` option, which seeds the random number
+      // generators of all threads for reproducible runs.
+      for (int i = 1; i < command_argc; ++i) {
+        if (std::string(command_argv[i]) == "--random_seed" &&
+            i + 1 < command_argc) {
+          const int random_seed = std::atoi(command_argv[i + 1]);
+          if (random_seed < 0) {
+            std::cerr << "ERROR: `random_seed` must not be negative."
+                      << std::endl;
+            return EXIT_FAILURE;
+          }
+          SetDefaultPRNGSeed(static_cast<unsigned>(random_seed));
+          std::copy(command_argv + i + 2, command_argv + command_argc,
+                    command_argv + i);
+          command_argc -= 2;
+          break;
+        }
+      }
+
+      if (!metrics_path.empty()) {
+        StartMetricsWriter(metrics_path, metrics_interval);
+      }
+
+      if (perf_counters && !EnablePerfCounters()) {
+        std::cerr << "WARNING: Hardware performance counters are not "
+                     "available, see /proc/sys/kernel/perf_event_paranoid."
+                  << std::endl;
+        perf_counters = false;
+      }
+
+      if (!trace_path.empty()) {
+        EnableTracing();
+      }
+
+      const int return_code = matched_command_func(command_argc, command_argv);
+
+      if (!trace_path.empty()) {
+        DisableTracing();
+        if (!WriteChromeTrace(trace_path)) {
+          std::cerr << StringPrintf("ERROR: Could not write trace to `%s`.",
+                                    trace_path.c_str())
+                    << std::endl;
+        }
+      }
+
+      if (perf_counters) {
+        DisablePerfCounters();
+        std::cout << std::endl << "Hardware performance counters:" << std::endl;
+        for (const auto& stats : GetPerfCounterStats()) {
+          std::cout << StringPrintf(
+                           "  %s: %d calls, IPC %.2f, LLC misses %.2f, branch "
+                           "misses %.2f per 1000 instructions",
+                           stats.name.c_str(),
+                           static_cast<int>(stats.num_calls), stats.IPC(),
+                           stats.LLCMissesPerKiloInstruction(),
+                           stats.BranchMissesPerKiloInstruction())
+                    << std::endl;
+        }
+      }
+
+      if (!metrics_path.empty()) {
+        StopMetricsWriter();
+      }
+
+      return return_code;
     }
   }
 
@@ -16,8 +16,18 @@
 /*************************************************************************
 * The following macro returns a random number in the specified range
 **************************************************************************/
-#define RandomInRange(u) ((rand()>>3)%(u))
-#define RandomInRangeFast(u) ((rand()>>3)%(u))
+#define RandomInRange(u) ((RandomNumber()>>3)%(u))
+#define RandomInRangeFast(u) ((RandomNumber()>>3)%(u))
+
+/*************************************************************************
+* The random number generator has a state per thread, such that concurrent
+* partitionings are independent of each other
+**************************************************************************/
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
 
 
 
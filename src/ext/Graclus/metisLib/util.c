@@ -585,7 +585,7 @@ void RandomPermute(int n, idxtype *p, int flag)
 
   for(i = 1; i < n; i++)
   {
-    j = rand() % (i+1);
+    j = RandomNumber() % (i+1);
     tmp = p[i];
     p[i] = p[j];
     p[j] = tmp;
@@ -645,18 +645,62 @@ int ispow2(int a)
 
 
 /*************************************************************************
-* This function initializes the random number generator
+* The random number generator is the additive feedback generator of rand()
+* in glibc with a state per thread, which is r[i-34], ..., r[i-1] in a ring
 **************************************************************************/
+static THREAD_LOCAL int random_ring[34];
+static THREAD_LOCAL int random_pos = -1;
+
+static void SeedRandomNumber(int seed)
+{
+  int i, hi, lo, word;
+
+  random_ring[0] = (seed == 0 ? 1 : seed);
+  for (i=1; i<31; i++) {
+    hi = random_ring[i-1] / 127773;
+    lo = random_ring[i-1] % 127773;
+    word = 16807 * lo - 2836 * hi;
+    if (word < 0)
+      word += 2147483647;
+    random_ring[i] = word;
+  }
+  for (i=31; i<34; i++)
+    random_ring[i] = random_ring[i-31];
+
+  /* The first 310 numbers are discarded */
+  random_pos = 0;
+  for (i=0; i<310; i++)
+    RandomNumber();
+}
+
 void InitRandom(int seed)
 {
   if (seed == -1) {
-    srand(4321);
+    SeedRandomNumber(4321);
   }
   else {
-    srand(seed);
+    SeedRandomNumber(seed);
   }
 }
 
+/*************************************************************************
+* This function returns the next random number of the calling thread, which
+* is the one of rand() after the same seed
+**************************************************************************/
+int RandomNumber(void)
+{
+  unsigned int value;
+
+  if (random_pos == -1)
+    SeedRandomNumber(1);
+
+  value = (unsigned int)random_ring[(random_pos+3)%34] +
+          (unsigned int)random_ring[(random_pos+31)%34];
+  random_ring[random_pos] = (int)value;
+  random_pos = (random_pos+1)%34;
+  return (int)(value >> 1);
+}
+
 /*************************************************************************
 * This function returns the log2(x)
 **************************************************************************/
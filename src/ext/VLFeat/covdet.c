@@ -1473,6 +1473,8 @@ struct _VlCovDet
   float * patch ;
   vl_size patchBufferSize ;
 
+  vl_bool sharedScaleSpace ; /**< whether @c gss is owned by another object. */
+
   vl_bool transposed ;
   VlCovDetFeatureOrientation orientations [VL_COVDET_MAX_NUM_ORIENTATIONS] ;
   VlCovDetFeatureLaplacianScale scales [VL_COVDET_MAX_NUM_LAPLACIAN_SCALES] ;
@@ -1599,6 +1601,37 @@ vl_covdet_new (VlCovDetMethod method)
   return self ;
 }
 
+/** @brief Create an object sharing the scale space of another one
+ ** @param self object with a detected image.
+ ** @return new covariant detector.
+ **
+ ** The new object has the parameters and the Gaussian scale space of
+ ** @a self, but no features and its own scratch buffers. Thus, the
+ ** per-frame functions, such as ::vl_covdet_extract_affine_shape_for_frame,
+ ** ::vl_covdet_extract_orientations_for_frame, and
+ ** ::vl_covdet_extract_patch_for_frame, can be called concurrently on
+ ** several such objects. @a self must outlive the new object and
+ ** must not process another image in the meantime.
+ **/
+
+VlCovDet *
+vl_covdet_new_shared (VlCovDet const * self)
+{
+  VlCovDet * shared ;
+  assert(self) ;
+  shared = vl_malloc(sizeof(VlCovDet)) ;
+  if (shared == NULL) return NULL ;
+  *shared = *self ;
+  shared->css = NULL ;
+  shared->features = NULL ;
+  shared->numFeatures = 0 ;
+  shared->numFeatureBufferSize = 0 ;
+  shared->patch = NULL ;
+  shared->patchBufferSize = 0 ;
+  shared->sharedScaleSpace = (self->gss != NULL) ;
+  return shared ;
+}
+
 /** @brief Reset object
  ** @param self object.
  **
@@ -1618,9 +1651,10 @@ vl_covdet_reset (VlCovDet * self)
     self->css = NULL ;
   }
   if (self->gss) {
-    vl_scalespace_delete(self->gss) ;
+    if (! self->sharedScaleSpace) vl_scalespace_delete(self->gss) ;
     self->gss = NULL ;
   }
+  self->sharedScaleSpace = VL_FALSE ;
 }
 
 /** @brief Delete object instance
@@ -1717,6 +1751,11 @@ vl_covdet_put_image (VlCovDet * self,
   geom.octaveFirstSubdivision = octaveFirstSubdivision ;
   geom.octaveLastSubdivision = octaveLastSubdivision ;
 
+  if (self->sharedScaleSpace) {
+    self->gss = NULL ;
+    self->sharedScaleSpace = VL_FALSE ;
+  }
+
   if (self->gss == NULL ||
       ! vl_scalespacegeometry_is_equal (geom,
                                         vl_scalespace_get_geometry(self->gss)))
@@ -187,6 +187,7 @@ typedef struct _VlCovDet VlCovDet ;
 /** @name Create and destroy
  ** @{ */
 VL_EXPORT VlCovDet * vl_covdet_new (VlCovDetMethod method) ;
+VL_EXPORT VlCovDet * vl_covdet_new_shared (VlCovDet const * self) ;
 VL_EXPORT void vl_covdet_delete (VlCovDet * self) ;
 VL_EXPORT void vl_covdet_reset (VlCovDet * self) ;
 /** @} */
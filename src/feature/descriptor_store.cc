@@ -0,0 +1,198 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "feature/descriptor_store.h"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+
+#include <boost/filesystem.hpp>
+
+#include "util/endian.h"
+#include "util/misc.h"
+
+namespace colmap {
+namespace {
+
+const char kFeatureDescriptorStoreMagic[8] = {'T', 'B', 'S', 'F',
+                                              'M', 'D', 'S', '\0'};
+
+// The descriptors of every image start at a multiple of the cache line size.
+const uint64_t kDescriptorsAlignment = 64;
+
+const size_t kHeaderNumBytes = sizeof(kFeatureDescriptorStoreMagic) +
+                               sizeof(uint32_t) + 3 * sizeof(uint64_t);
+const size_t kEntryNumBytes = sizeof(image_t) + 3 * sizeof(uint64_t);
+
+uint64_t AlignDescriptorsOffset(const uint64_t offset) {
+  return (offset + kDescriptorsAlignment - 1) / kDescriptorsAlignment *
+         kDescriptorsAlignment;
+}
+
+}  // namespace
+
+void FeatureDescriptorStore::Write(const Database& database,
+                                   const std::string& path) {
+  const std::vector<Image> images = database.ReadAllImages();
+  const uint64_t num_images = database.NumImages();
+  const uint64_t num_descriptors = database.NumDescriptors();
+
+  const std::string temp_path =
+      path + ".tmp" + std::to_string(std::random_device()());
+
+  {
+    std::ofstream file(temp_path, std::ios::trunc | std::ios::binary);
+    CHECK(file.is_open()) << temp_path;
+
+    // Write the descriptors first, since the offsets of the images are only
+    // known afterwards, and then the header in front of them.
+    std::vector<std::pair<image_t, Entry>> entries;
+    entries.reserve(images.size());
+    uint64_t offset = AlignDescriptorsOffset(kHeaderNumBytes +
+                                             images.size() * kEntryNumBytes);
+    for (const auto& image : images) {
+      const FeatureDescriptors descriptors =
+          database.ReadDescriptors(image.ImageId());
+
+      Entry entry;
+      entry.num_rows = static_cast<uint64_t>(descriptors.rows());
+      entry.num_cols = static_cast<uint64_t>(descriptors.cols());
+      entry.offset = offset;
+      entries.emplace_back(image.ImageId(), entry);
+
+      file.seekp(offset);
+      file.write(reinterpret_cast<const char*>(descriptors.data()),
+                 descriptors.size());
+      offset = AlignDescriptorsOffset(offset + descriptors.size());
+    }
+
+    file.seekp(0);
+    file.write(kFeatureDescriptorStoreMagic,
+               sizeof(kFeatureDescriptorStoreMagic));
+    WriteBinaryLittleEndian<uint32_t>(&file, kFeatureDescriptorStoreVersion);
+    WriteBinaryLittleEndian<uint64_t>(&file, num_images);
+    WriteBinaryLittleEndian<uint64_t>(&file, num_descriptors);
+    WriteBinaryLittleEndian<uint64_t>(&file, entries.size());
+    for (const auto& entry : entries) {
+      WriteBinaryLittleEndian<image_t>(&file, entry.first);
+      WriteBinaryLittleEndian<uint64_t>(&file, entry.second.num_rows);
+      WriteBinaryLittleEndian<uint64_t>(&file, entry.second.num_cols);
+      WriteBinaryLittleEndian<uint64_t>(&file, entry.second.offset);
+    }
+
+    CHECK(file.good()) << temp_path;
+  }
+
+  boost::filesystem::rename(temp_path, path);
+}
+
+bool FeatureDescriptorStore::Open(const std::string& path,
+                                  const Database& database) {
+  Close();
+
+  // The descriptors are accessed in the order of the matched images.
+  if (!file_.Open(path, /* sequential = */ false)) {
+    return false;
+  }
+
+  MappedFileReader reader(file_);
+
+  std::vector<char> magic;
+  reader.Read(&magic, sizeof(kFeatureDescriptorStoreMagic));
+  if (!reader.Good() || !std::equal(magic.begin(), magic.end(),
+                                    kFeatureDescriptorStoreMagic)) {
+    std::cout << "WARNING: " << path << " is not a descriptor store."
+              << std::endl;
+    Close();
+    return false;
+  }
+
+  const uint32_t version = reader.Read<uint32_t>();
+  if (version != kFeatureDescriptorStoreVersion) {
+    std::cout << StringPrintf("WARNING: Descriptor store %s has version %d, "
+                              "expected %d.",
+                              path.c_str(), version,
+                              kFeatureDescriptorStoreVersion)
+              << std::endl;
+    Close();
+    return false;
+  }
+
+  const uint64_t num_images = reader.Read<uint64_t>();
+  const uint64_t num_descriptors = reader.Read<uint64_t>();
+  if (!reader.Good() || num_images != database.NumImages() ||
+      num_descriptors != database.NumDescriptors()) {
+    std::cout << "WARNING: Descriptor store " << path
+              << " does not match the database." << std::endl;
+    Close();
+    return false;
+  }
+
+  const size_t num_entries = reader.ReadCount(kEntryNumBytes);
+  entries_.reserve(num_entries);
+  bool valid = true;
+  for (size_t i = 0; i < num_entries; ++i) {
+    const image_t image_id = reader.Read<image_t>();
+    Entry entry;
+    entry.num_rows = reader.Read<uint64_t>();
+    entry.num_cols = reader.Read<uint64_t>();
+    entry.offset = reader.Read<uint64_t>();
+    if (entry.offset > file_.Size() || (entry.num_cols > 0 &&
+        entry.num_rows > (file_.Size() - entry.offset) / entry.num_cols)) {
+      valid = false;
+      break;
+    }
+    entries_.emplace(image_id, entry);
+  }
+
+  if (!reader.Good() || !valid) {
+    std::cout << "WARNING: Descriptor store " << path << " is truncated."
+              << std::endl;
+    Close();
+    return false;
+  }
+
+  return true;
+}
+
+bool FeatureDescriptorStore::OpenOrWrite(const std::string& path,
+                                         const Database& database) {
+  if (Open(path, database)) {
+    return true;
+  }
+
+  std::cout << "Writing descriptor store " << path << std::endl;
+  Write(database, path);
+
+  return Open(path, database);
+}
+
+void FeatureDescriptorStore::Close() {
+  file_.Close();
+  entries_.clear();
+}
+
+FeatureDescriptorStore::DescriptorsMap FeatureDescriptorStore::Descriptors(
+    const image_t image_id) const {
+  const Entry& entry = entries_.at(image_id);
+  return DescriptorsMap(
+      reinterpret_cast<const uint8_t*>(file_.Data() + entry.offset),
+      static_cast<Eigen::Index>(entry.num_rows),
+      static_cast<Eigen::Index>(entry.num_cols));
+}
+
+}  // namespace colmap
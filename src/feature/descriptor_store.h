@@ -0,0 +1,94 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_FEATURE_DESCRIPTOR_STORE_H_
+#define COLMAP_SRC_FEATURE_DESCRIPTOR_STORE_H_
+
+#include <string>
+#include <unordered_map>
+
+#include <Eigen/Core>
+
+#include "base/database.h"
+#include "feature/types.h"
+#include "util/mapped_file.h"
+#include "util/types.h"
+
+namespace colmap {
+
+const uint32_t kFeatureDescriptorStoreVersion = 1;
+
+// Read-only store of the descriptors of all images of a database in a single
+// memory-mapped file. The store is built once per database and all threads
+// and processes that open it share its pages through the page cache, so that
+// the descriptors are read without querying SQLite and without copying.
+//
+// The file starts with a header, which holds the number of images and
+// descriptors of the database and the location of the descriptors of every
+// image, followed by the descriptors of the images, each aligned to 64 bytes.
+class FeatureDescriptorStore {
+ public:
+  typedef Eigen::Map<const FeatureDescriptors> DescriptorsMap;
+
+  // Write the store of all images in the database. The store is written to a
+  // temporary file, which is then renamed, such that concurrent readers never
+  // open a partially written store.
+  static void Write(const Database& database, const std::string& path);
+
+  // Open the store at the given path. Returns false if it does not exist or
+  // if it was built from a database with a different number of images or
+  // descriptors than the given one.
+  bool Open(const std::string& path, const Database& database);
+
+  // Open the store and build it first, if it is missing or stale.
+  bool OpenOrWrite(const std::string& path, const Database& database);
+
+  void Close();
+
+  inline bool IsOpen() const;
+  inline size_t NumImages() const;
+  inline bool ExistsImage(const image_t image_id) const;
+
+  // The descriptors of the given image, which are valid until the store is
+  // closed.
+  DescriptorsMap Descriptors(const image_t image_id) const;
+
+ private:
+  struct Entry {
+    uint64_t num_rows = 0;
+    uint64_t num_cols = 0;
+    uint64_t offset = 0;
+  };
+
+  MappedFile file_;
+  std::unordered_map<image_t, Entry> entries_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+bool FeatureDescriptorStore::IsOpen() const { return file_.IsOpen(); }
+
+size_t FeatureDescriptorStore::NumImages() const { return entries_.size(); }
+
+bool FeatureDescriptorStore::ExistsImage(const image_t image_id) const {
+  return entries_.count(image_id) > 0;
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_FEATURE_DESCRIPTOR_STORE_H_
@@ -0,0 +1,135 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "feature/descriptor_store"
+#include "util/testing.h"
+
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+#include "feature/descriptor_store.h"
+
+using namespace colmap;
+
+namespace {
+
+const static std::string kMemoryDatabasePath = ":memory:";
+
+std::string TemporaryPath() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("descriptor_store_test_%%%%%%%%.bin"))
+      .string();
+}
+
+image_t WriteImage(const std::string& name, const int num_descriptors,
+                   Database* database) {
+  Camera camera;
+  camera.SetCameraId(database->WriteCamera(camera));
+  Image image;
+  image.SetName(name);
+  image.SetCameraId(camera.CameraId());
+  const image_t image_id = database->WriteImage(image);
+  if (num_descriptors > 0) {
+    database->WriteDescriptors(
+        image_id, FeatureDescriptors::Random(num_descriptors, 128));
+  }
+  return image_id;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestWriteOpen) {
+  Database database(kMemoryDatabasePath);
+  const image_t image_id1 = WriteImage("image1", 10, &database);
+  const image_t image_id2 = WriteImage("image2", 0, &database);
+  const image_t image_id3 = WriteImage("image3", 33, &database);
+
+  const std::string path = TemporaryPath();
+  FeatureDescriptorStore::Write(database, path);
+
+  FeatureDescriptorStore store;
+  BOOST_CHECK(!store.IsOpen());
+  BOOST_CHECK(store.Open(path, database));
+  BOOST_CHECK(store.IsOpen());
+  BOOST_CHECK_EQUAL(store.NumImages(), 3);
+  BOOST_CHECK(store.ExistsImage(image_id1));
+  BOOST_CHECK(store.ExistsImage(image_id2));
+  BOOST_CHECK(store.ExistsImage(image_id3));
+  BOOST_CHECK(!store.ExistsImage(image_id3 + 1));
+
+  for (const image_t image_id : {image_id1, image_id2, image_id3}) {
+    const FeatureDescriptors descriptors = database.ReadDescriptors(image_id);
+    const FeatureDescriptorStore::DescriptorsMap descriptors_map =
+        store.Descriptors(image_id);
+    BOOST_CHECK_EQUAL(descriptors_map.rows(), descriptors.rows());
+    if (descriptors.rows() > 0) {
+      BOOST_CHECK_EQUAL(descriptors_map.cols(), descriptors.cols());
+      BOOST_CHECK_EQUAL(
+          reinterpret_cast<uintptr_t>(descriptors_map.data()) % 64, 0);
+    }
+    BOOST_CHECK(descriptors_map == descriptors);
+  }
+
+  store.Close();
+  BOOST_CHECK(!store.IsOpen());
+  BOOST_CHECK_EQUAL(store.NumImages(), 0);
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestStale) {
+  Database database(kMemoryDatabasePath);
+  WriteImage("image1", 10, &database);
+
+  const std::string path = TemporaryPath();
+  FeatureDescriptorStore store;
+  BOOST_CHECK(!store.Open(path, database));
+  BOOST_CHECK(store.OpenOrWrite(path, database));
+  BOOST_CHECK_EQUAL(store.NumImages(), 1);
+
+  const image_t image_id2 = WriteImage("image2", 5, &database);
+  BOOST_CHECK(!store.Open(path, database));
+  BOOST_CHECK(!store.IsOpen());
+  BOOST_CHECK(store.OpenOrWrite(path, database));
+  BOOST_CHECK_EQUAL(store.NumImages(), 2);
+  BOOST_CHECK(store.Descriptors(image_id2) ==
+              database.ReadDescriptors(image_id2));
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestCorrupt) {
+  Database database(kMemoryDatabasePath);
+  WriteImage("image1", 10, &database);
+
+  const std::string path = TemporaryPath();
+  {
+    std::ofstream file(path, std::ios::trunc | std::ios::binary);
+    file << "not a descriptor store";
+  }
+
+  FeatureDescriptorStore store;
+  BOOST_CHECK(!store.Open(path, database));
+
+  FeatureDescriptorStore::Write(database, path);
+  const size_t file_size = boost::filesystem::file_size(path);
+  boost::filesystem::resize_file(path, file_size / 2);
+  BOOST_CHECK(!store.Open(path, database));
+  BOOST_CHECK(!store.IsOpen());
+
+  boost::filesystem::remove(path);
+}
@@ -20,6 +20,7 @@
 #include "feature/sift.h"
 #include "util/cuda.h"
 #include "util/misc.h"
+#include "util/timer.h"
 
 namespace colmap {
 namespace {
@@ -36,6 +37,16 @@ void ScaleKeypoints(const Bitmap& bitmap, const Camera& camera,
   }
 }
 
+// The images are downsized to the maximum image size of the extraction, so
+// that JPEG images can be decoded at a reduced resolution.
+ImageReaderOptions CreateDecodeOptions(
+    const ImageReaderOptions& reader_options,
+    const SiftExtractionOptions& sift_options) {
+  ImageReaderOptions options = reader_options;
+  options.max_image_size = sift_options.max_image_size;
+  return options;
+}
+
 }  // namespace
 
 SiftFeatureExtractor::SiftFeatureExtractor(
@@ -44,31 +55,19 @@ SiftFeatureExtractor::SiftFeatureExtractor(
     : reader_options_(reader_options),
       sift_options_(sift_options),
       database_(reader_options_.database_path),
-      image_reader_(reader_options_, &database_) {
+      image_reader_(CreateDecodeOptions(reader_options_, sift_options_),
+                    &database_) {
   CHECK(reader_options_.Check());
   CHECK(sift_options_.Check());
 
   const int num_threads = GetEffectiveNumThreads(sift_options_.num_threads);
   CHECK_GT(num_threads, 0);
 
-  // Make sure that we only have limited number of objects in the queue to avoid
-  // excess in memory usage since images and features take lots of memory.
-  const int kQueueSize = 1;
-  resizer_queue_.reset(new JobQueue<internal::ImageData>(kQueueSize));
-  extractor_queue_.reset(new JobQueue<internal::ImageData>(kQueueSize));
-  writer_queue_.reset(new JobQueue<internal::ImageData>(kQueueSize));
-
-  if (sift_options_.max_image_size > 0) {
-    for (int i = 0; i < num_threads; ++i) {
-      resizers_.emplace_back(new internal::ImageResizerThread(
-          sift_options_.max_image_size, resizer_queue_.get(),
-          extractor_queue_.get()));
-    }
-  }
-
+  std::vector<int> gpu_indices;
   if (!sift_options_.domain_size_pooling &&
-      !sift_options_.estimate_affine_shape && sift_options_.use_gpu) {
-    std::vector<int> gpu_indices = CSVToVector<int>(sift_options_.gpu_index);
+      !sift_options_.estimate_affine_shape && sift_options_.use_gpu &&
+      sift_options_.tile_size <= 0) {
+    gpu_indices = CSVToVector<int>(sift_options_.gpu_index);
     CHECK_GT(gpu_indices.size(), 0);
 
 #ifdef CUDA_ENABLED
@@ -79,24 +78,62 @@ SiftFeatureExtractor::SiftFeatureExtractor(
       std::iota(gpu_indices.begin(), gpu_indices.end(), 0);
     }
 #endif  // CUDA_ENABLED
+  }
+
+  // Make sure that we only have limited number of objects in the queue to avoid
+  // excess in memory usage since images and features take lots of memory. Every
+  // GPU has a queue of two images, such that the next image is staged while
+  // the current one is extracted.
+  const int kQueueSize = 1;
+  const int kGPUQueueSize = 2;
+  resizer_queue_.reset(new RingJobQueue<internal::ImageData>(kQueueSize));
+  if (gpu_indices.empty()) {
+    extractor_queues_.reset(new internal::ExtractorInputQueues(1, kQueueSize));
+  } else {
+    staging_buffer_pool_.reset(new internal::StagingBufferPool());
+    extractor_queues_.reset(new internal::ExtractorInputQueues(
+        gpu_indices.size(), kGPUQueueSize));
+  }
+  writer_queue_.reset(new RingJobQueue<internal::ImageData>(kQueueSize));
+
+  if (sift_options_.max_image_size > 0) {
+    for (int i = 0; i < num_threads; ++i) {
+      resizers_.emplace_back(new internal::ImageResizerThread(
+          sift_options_.max_image_size, resizer_queue_.get(),
+          extractor_queues_.get(), &resizer_counter_,
+          staging_buffer_pool_.get()));
+    }
+  }
 
+  if (!gpu_indices.empty()) {
     auto sift_gpu_options = sift_options_;
-    for (const auto& gpu_index : gpu_indices) {
-      sift_gpu_options.gpu_index = std::to_string(gpu_index);
+    for (size_t i = 0; i < gpu_indices.size(); ++i) {
+      sift_gpu_options.gpu_index = std::to_string(gpu_indices[i]);
       extractors_.emplace_back(new internal::SiftFeatureExtractorThread(
-          sift_gpu_options, extractor_queue_.get(), writer_queue_.get()));
+          sift_gpu_options, extractor_queues_.get(), i, writer_queue_.get(),
+          &extractor_counter_));
     }
   } else {
     auto custom_sift_options = sift_options_;
     custom_sift_options.use_gpu = false;
     for (int i = 0; i < num_threads; ++i) {
       extractors_.emplace_back(new internal::SiftFeatureExtractorThread(
-          custom_sift_options, extractor_queue_.get(), writer_queue_.get()));
+          custom_sift_options, extractor_queues_.get(), 0, writer_queue_.get(),
+          &extractor_counter_));
     }
   }
 
+  if (!sift_options_.feature_cache_path.empty()) {
+    feature_cache_.reset(new FeatureCache(sift_options_.feature_cache_path));
+    image_reader_.SetHeaderOnlyPredicate(
+        [this](const std::string& image_name, const std::string& path) {
+          return ReadCachedFeatures(image_name, path);
+        });
+  }
+
   writer_.reset(new internal::FeatureWriterThread(
-      image_reader_.NumImages(), &database_, writer_queue_.get()));
+      image_reader_.NumImages(), &database_, writer_queue_.get(),
+      &writer_counter_, feature_cache_.get()));
 }
 
 void SiftFeatureExtractor::Run() {
@@ -121,24 +158,48 @@ void SiftFeatureExtractor::Run() {
   while (image_reader_.NextIndex() < image_reader_.NumImages()) {
     if (IsStopped()) {
       resizer_queue_->Stop();
-      extractor_queue_->Stop();
+      extractor_queues_->Stop();
       resizer_queue_->Clear();
-      extractor_queue_->Clear();
+      extractor_queues_->Clear();
       break;
     }
 
+    Timer timer;
+    timer.Start();
     internal::ImageData image_data;
     image_data.status = image_reader_.Next(
         &image_data.camera, &image_data.image, &image_data.bitmap);
+    reader_counter_.Add(timer.ElapsedSeconds());
+
+    if (feature_cache_) {
+      std::unique_lock<std::mutex> lock(cached_features_mutex_);
+      const auto it = cached_features_.find(image_data.image.Name());
+      if (it != cached_features_.end()) {
+        image_data.is_cached = it->second.is_cached;
+        if (image_data.is_cached) {
+          image_data.keypoints = std::move(it->second.keypoints);
+          image_data.descriptors = std::move(it->second.descriptors);
+        } else {
+          image_data.feature_cache_key = it->second.key;
+        }
+        cached_features_.erase(it);
+      }
+    }
 
     if (image_data.status != ImageReader::Status::SUCCESS) {
       image_data.bitmap.Deallocate();
     }
 
-    if (sift_options_.max_image_size > 0) {
-      CHECK(resizer_queue_->Push(image_data));
+    // The images are moved through the queues, since copying a bitmap copies
+    // all of its pixels.
+    if (image_data.is_cached) {
+      // Only the header of the image was read, and its features are final.
+      image_data.bitmap.Deallocate();
+      CHECK(writer_queue_->Push(std::move(image_data)));
+    } else if (sift_options_.max_image_size > 0) {
+      CHECK(resizer_queue_->Push(std::move(image_data)));
     } else {
-      CHECK(extractor_queue_->Push(image_data));
+      CHECK(extractor_queues_->Push(std::move(image_data)));
     }
   }
 
@@ -148,8 +209,8 @@ void SiftFeatureExtractor::Run() {
     resizer->Wait();
   }
 
-  extractor_queue_->Wait();
-  extractor_queue_->Stop();
+  extractor_queues_->Wait();
+  extractor_queues_->Stop();
   for (auto& extractor : extractors_) {
     extractor->Wait();
   }
@@ -158,12 +219,42 @@ void SiftFeatureExtractor::Run() {
   writer_queue_->Stop();
   writer_->Wait();
 
+  std::cout << std::endl << "Throughput:" << std::endl;
+  reader_counter_.Print("Read");
+  if (!resizers_.empty()) {
+    resizer_counter_.Print("Resize");
+  }
+  extractor_counter_.Print("Extract");
+  writer_counter_.Print("Write");
+
   GetTimer().PrintMinutes();
 }
 
+bool SiftFeatureExtractor::ReadCachedFeatures(const std::string& image_name,
+                                              const std::string& path) {
+  internal::CachedImageFeatures cached_features;
+  cached_features.key = FeatureCache::ImageFeaturesKey(path, sift_options_);
+  if (cached_features.key.empty()) {
+    return false;
+  }
+
+  cached_features.is_cached = feature_cache_->ReadFeatures(
+      cached_features.key, &cached_features.keypoints,
+      &cached_features.descriptors);
+  const bool is_cached = cached_features.is_cached;
+
+  std::unique_lock<std::mutex> lock(cached_features_mutex_);
+  cached_features_[image_name] = std::move(cached_features);
+
+  return is_cached;
+}
+
 FeatureImporter::FeatureImporter(const ImageReaderOptions& reader_options,
-                                 const std::string& import_path)
-    : reader_options_(reader_options), import_path_(import_path) {}
+                                 const std::string& import_path,
+                                 const int num_threads)
+    : reader_options_(reader_options),
+      import_path_(import_path),
+      num_threads_(num_threads) {}
 
 void FeatureImporter::Run() {
   PrintHeading1("Feature import");
@@ -175,50 +266,90 @@ void FeatureImporter::Run() {
 
   Database database(reader_options_.database_path);
   ImageReader image_reader(reader_options_, &database);
+  ThreadPool thread_pool(num_threads_);
+
+  struct ImportData {
+    Image image;
+    FeatureKeypoints keypoints;
+    FeatureDescriptors descriptors;
+  };
+
+  std::vector<ImportData> batch;
+  batch.reserve(kBatchSize);
 
   while (image_reader.NextIndex() < image_reader.NumImages()) {
-    if (IsStopped()) {
-      break;
-    }
+    // Read the images of the batch, whose feature files are parsed in the
+    // meantime. The image reader writes their cameras in its own transactions.
+    batch.clear();
+    while (batch.size() < kBatchSize &&
+           image_reader.NextIndex() < image_reader.NumImages()) {
+      if (IsStopped()) {
+        break;
+      }
 
-    std::cout << StringPrintf("Processing file [%d/%d]",
-                              image_reader.NextIndex() + 1,
-                              image_reader.NumImages())
-              << std::endl;
+      std::cout << StringPrintf("Processing file [%d/%d]",
+                                image_reader.NextIndex() + 1,
+                                image_reader.NumImages())
+                << std::endl;
 
-    // Load image data and possibly save camera to database.
-    Camera camera;
-    Image image;
-    Bitmap bitmap;
-    if (image_reader.Next(&camera, &image, &bitmap) !=
-        ImageReader::Status::SUCCESS) {
-      continue;
-    }
+      // Load image data and possibly save camera to database.
+      Camera camera;
+      Image image;
+      Bitmap bitmap;
+      if (image_reader.Next(&camera, &image, &bitmap) !=
+          ImageReader::Status::SUCCESS) {
+        continue;
+      }
 
-    const std::string path = JoinPaths(import_path_, image.Name() + ".txt");
+      const std::string binary_path =
+          JoinPaths(import_path_, image.Name() + ".bin");
+      const std::string text_path =
+          JoinPaths(import_path_, image.Name() + ".txt");
+      const bool is_binary = ExistsFile(binary_path);
+      if (!is_binary && !ExistsFile(text_path)) {
+        std::cout << "  SKIP: No features found at " << text_path << std::endl;
+        continue;
+      }
 
-    if (ExistsFile(path)) {
-      FeatureKeypoints keypoints;
-      FeatureDescriptors descriptors;
-      LoadSiftFeaturesFromTextFile(path, &keypoints, &descriptors);
+      // The batch does not grow beyond its reserved size, so that the
+      // references of the running tasks stay valid.
+      batch.emplace_back();
+      batch.back().image = image;
+      ImportData* data = &batch.back();
+      thread_pool.AddTask([data, is_binary, binary_path, text_path]() {
+        if (is_binary) {
+          LoadSiftFeaturesFromBinaryFile(binary_path, &data->keypoints,
+                                         &data->descriptors);
+        } else {
+          LoadSiftFeaturesFromTextFile(text_path, &data->keypoints,
+                                       &data->descriptors);
+        }
+      });
+    }
 
-      std::cout << "  Features:       " << keypoints.size() << std::endl;
+    thread_pool.Wait();
 
-      DatabaseTransaction database_transaction(&database);
+    DatabaseTransaction database_transaction(&database);
+    for (ImportData& data : batch) {
+      std::cout << StringPrintf("  %s: %d features", data.image.Name().c_str(),
+                                data.keypoints.size())
+                << std::endl;
 
-      if (image.ImageId() == kInvalidImageId) {
-        image.SetImageId(database.WriteImage(image));
+      if (data.image.ImageId() == kInvalidImageId) {
+        data.image.SetImageId(database.WriteImage(data.image));
       }
 
-      if (!database.ExistsKeypoints(image.ImageId())) {
-        database.WriteKeypoints(image.ImageId(), keypoints);
+      if (!database.ExistsKeypoints(data.image.ImageId())) {
+        database.WriteKeypoints(data.image.ImageId(), data.keypoints);
       }
 
-      if (!database.ExistsDescriptors(image.ImageId())) {
-        database.WriteDescriptors(image.ImageId(), descriptors);
+      if (!database.ExistsDescriptors(data.image.ImageId())) {
+        database.WriteDescriptors(data.image.ImageId(), data.descriptors);
       }
-    } else {
-      std::cout << "  SKIP: No features found at " << path << std::endl;
+    }
+
+    if (IsStopped()) {
+      break;
     }
   }
 
@@ -227,12 +358,153 @@ void FeatureImporter::Run() {
 
 namespace internal {
 
+StagingBufferPool::~StagingBufferPool() {
+  for (const auto& buffer : free_buffers_) {
+    Free(buffer);
+  }
+}
+
+std::shared_ptr<uint8_t> StagingBufferPool::Acquire(const size_t num_bytes) {
+  Buffer buffer;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Take the smallest sufficient buffer, or replace a too small buffer, so
+    // that the number of buffers is bounded by the images in flight.
+    auto best_it = free_buffers_.end();
+    for (auto it = free_buffers_.begin(); it != free_buffers_.end(); ++it) {
+      if (it->num_bytes >= num_bytes &&
+          (best_it == free_buffers_.end() ||
+           it->num_bytes < best_it->num_bytes)) {
+        best_it = it;
+      }
+    }
+    if (best_it == free_buffers_.end() && !free_buffers_.empty()) {
+      best_it = free_buffers_.end() - 1;
+    }
+    if (best_it != free_buffers_.end()) {
+      buffer = *best_it;
+      free_buffers_.erase(best_it);
+    }
+  }
+
+  if (buffer.num_bytes < num_bytes) {
+    if (buffer.data != nullptr) {
+      Free(buffer);
+    }
+    buffer = Allocate(num_bytes);
+  }
+
+  return std::shared_ptr<uint8_t>(buffer.data, [this, buffer](uint8_t*) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    free_buffers_.push_back(buffer);
+  });
+}
+
+StagingBufferPool::Buffer StagingBufferPool::Allocate(const size_t num_bytes) {
+  Buffer buffer;
+  buffer.num_bytes = num_bytes;
+#ifdef CUDA_ENABLED
+  buffer.data = static_cast<uint8_t*>(AllocatePinnedHostMemory(num_bytes));
+  buffer.is_pinned = buffer.data != nullptr;
+#endif
+  if (buffer.data == nullptr) {
+    buffer.data = new uint8_t[num_bytes];
+  }
+  return buffer;
+}
+
+void StagingBufferPool::Free(const Buffer& buffer) {
+  if (buffer.is_pinned) {
+#ifdef CUDA_ENABLED
+    FreePinnedHostMemory(buffer.data);
+#endif
+  } else {
+    delete[] buffer.data;
+  }
+}
+
+ExtractorInputQueues::ExtractorInputQueues(const size_t num_queues,
+                                           const size_t queue_size)
+    : num_pending_pixels_(num_queues, 0) {
+  CHECK_GT(num_queues, 0);
+  for (size_t i = 0; i < num_queues; ++i) {
+    queues_.emplace_back(new RingJobQueue<ImageData>(queue_size));
+  }
+}
+
+RingJobQueue<ImageData>* ExtractorInputQueues::Queue(const size_t queue_idx) {
+  return queues_.at(queue_idx).get();
+}
+
+bool ExtractorInputQueues::Push(ImageData image_data) {
+  const size_t num_pixels =
+      static_cast<size_t>(image_data.bitmap.Width()) * image_data.bitmap.Height();
+  size_t queue_idx = 0;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (size_t i = 1; i < queues_.size(); ++i) {
+      if (num_pending_pixels_[i] < num_pending_pixels_[queue_idx]) {
+        queue_idx = i;
+      }
+    }
+    num_pending_pixels_[queue_idx] += num_pixels;
+  }
+  return queues_[queue_idx]->Push(std::move(image_data));
+}
+
+void ExtractorInputQueues::Release(const size_t queue_idx,
+                                   const size_t num_pixels) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  CHECK_GE(num_pending_pixels_.at(queue_idx), num_pixels);
+  num_pending_pixels_[queue_idx] -= num_pixels;
+}
+
+void ExtractorInputQueues::Wait() {
+  for (auto& queue : queues_) {
+    queue->Wait();
+  }
+}
+
+void ExtractorInputQueues::Stop() {
+  for (auto& queue : queues_) {
+    queue->Stop();
+  }
+}
+
+void ExtractorInputQueues::Clear() {
+  for (auto& queue : queues_) {
+    queue->Clear();
+  }
+}
+
+PipelineStageCounter::PipelineStageCounter()
+    : num_images_(0), num_seconds_(0) {}
+
+void PipelineStageCounter::Add(const double seconds) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  num_images_ += 1;
+  num_seconds_ += seconds;
+}
+
+void PipelineStageCounter::Print(const std::string& name) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  const double seconds_per_image =
+      num_images_ > 0 ? num_seconds_ / num_images_ : 0;
+  std::cout << StringPrintf("  %-8s %d images, %.3fs per image", name.c_str(),
+                            num_images_, seconds_per_image)
+            << std::endl;
+}
+
 ImageResizerThread::ImageResizerThread(const int max_image_size,
-                                       JobQueue<ImageData>* input_queue,
-                                       JobQueue<ImageData>* output_queue)
+                                       RingJobQueue<ImageData>* input_queue,
+                                       ExtractorInputQueues* output_queues,
+                                       PipelineStageCounter* counter,
+                                       StagingBufferPool* staging_buffer_pool)
     : max_image_size_(max_image_size),
       input_queue_(input_queue),
-      output_queue_(output_queue) {}
+      output_queues_(output_queues),
+      counter_(counter),
+      staging_buffer_pool_(staging_buffer_pool) {}
 
 void ImageResizerThread::Run() {
   while (true) {
@@ -240,9 +512,12 @@ void ImageResizerThread::Run() {
       break;
     }
 
-    const auto input_job = input_queue_->Pop();
+    auto input_job = input_queue_->Pop();
     if (input_job.IsValid()) {
-      auto image_data = input_job.Data();
+      auto image_data = std::move(input_job.Data());
+
+      Timer timer;
+      timer.Start();
 
       if (image_data.status == ImageReader::Status::SUCCESS) {
         if (static_cast<int>(image_data.bitmap.Width()) > max_image_size_ ||
@@ -258,9 +533,17 @@ void ImageResizerThread::Run() {
 
           image_data.bitmap.Rescale(new_width, new_height);
         }
+
+        if (staging_buffer_pool_ != nullptr) {
+          image_data.raw_bits =
+              staging_buffer_pool_->Acquire(image_data.bitmap.NumBytes());
+          image_data.bitmap.ConvertToRawBits(image_data.raw_bits.get());
+        }
       }
 
-      output_queue_->Push(image_data);
+      counter_->Add(timer.ElapsedSeconds());
+
+      output_queues_->Push(std::move(image_data));
     } else {
       break;
     }
@@ -268,11 +551,14 @@ void ImageResizerThread::Run() {
 }
 
 SiftFeatureExtractorThread::SiftFeatureExtractorThread(
-    const SiftExtractionOptions& sift_options, JobQueue<ImageData>* input_queue,
-    JobQueue<ImageData>* output_queue)
+    const SiftExtractionOptions& sift_options,
+    ExtractorInputQueues* input_queues, const size_t input_queue_idx,
+    RingJobQueue<ImageData>* output_queue, PipelineStageCounter* counter)
     : sift_options_(sift_options),
-      input_queue_(input_queue),
-      output_queue_(output_queue) {
+      input_queues_(input_queues),
+      input_queue_idx_(input_queue_idx),
+      output_queue_(output_queue),
+      counter_(counter) {
   CHECK(sift_options_.Check());
 
 #ifndef CUDA_ENABLED
@@ -305,9 +591,14 @@ void SiftFeatureExtractorThread::Run() {
       break;
     }
 
-    const auto input_job = input_queue_->Pop();
+    auto input_job = input_queues_->Queue(input_queue_idx_)->Pop();
     if (input_job.IsValid()) {
-      auto image_data = input_job.Data();
+      auto image_data = std::move(input_job.Data());
+      const size_t num_pixels = static_cast<size_t>(image_data.bitmap.Width()) *
+                                image_data.bitmap.Height();
+
+      Timer timer;
+      timer.Start();
 
       if (image_data.status == ImageReader::Status::SUCCESS) {
         bool success = false;
@@ -316,6 +607,11 @@ void SiftFeatureExtractorThread::Run() {
           success = ExtractCovariantSiftFeaturesCPU(
               sift_options_, image_data.bitmap, &image_data.keypoints,
               &image_data.descriptors);
+        } else if (sift_options_.use_gpu && image_data.raw_bits) {
+          success = ExtractSiftFeaturesGPU(
+              sift_options_, image_data.bitmap.ScanWidth(),
+              image_data.bitmap.Height(), image_data.raw_bits.get(),
+              sift_gpu.get(), &image_data.keypoints, &image_data.descriptors);
         } else if (sift_options_.use_gpu) {
           success = ExtractSiftFeaturesGPU(
               sift_options_, image_data.bitmap, sift_gpu.get(),
@@ -334,8 +630,12 @@ void SiftFeatureExtractorThread::Run() {
       }
 
       image_data.bitmap.Deallocate();
+      image_data.raw_bits.reset();
+      input_queues_->Release(input_queue_idx_, num_pixels);
+
+      counter_->Add(timer.ElapsedSeconds());
 
-      output_queue_->Push(image_data);
+      output_queue_->Push(std::move(image_data));
     } else {
       break;
     }
@@ -344,8 +644,14 @@ void SiftFeatureExtractorThread::Run() {
 
 FeatureWriterThread::FeatureWriterThread(const size_t num_images,
                                          Database* database,
-                                         JobQueue<ImageData>* input_queue)
-    : num_images_(num_images), database_(database), input_queue_(input_queue) {}
+                                         RingJobQueue<ImageData>* input_queue,
+                                         PipelineStageCounter* counter,
+                                         const FeatureCache* feature_cache)
+    : num_images_(num_images),
+      database_(database),
+      feature_cache_(feature_cache),
+      input_queue_(input_queue),
+      counter_(counter) {}
 
 void FeatureWriterThread::Run() {
   size_t image_index = 0;
@@ -414,25 +720,39 @@ void FeatureWriterThread::Run() {
                    image_data.image.TvecPrior(2))
             << std::endl;
       }
-      std::cout << StringPrintf("  Features:        %d",
-                                image_data.keypoints.size())
+      std::cout << StringPrintf("  Features:        %d%s",
+                                image_data.keypoints.size(),
+                                image_data.is_cached ? " (cached)" : "")
                 << std::endl;
 
-      DatabaseTransaction database_transaction(database_);
+      Timer timer;
+      timer.Start();
 
-      if (image_data.image.ImageId() == kInvalidImageId) {
-        image_data.image.SetImageId(database_->WriteImage(image_data.image));
-      }
+      {
+        DatabaseTransaction database_transaction(database_);
+
+        if (image_data.image.ImageId() == kInvalidImageId) {
+          image_data.image.SetImageId(database_->WriteImage(image_data.image));
+        }
 
-      if (!database_->ExistsKeypoints(image_data.image.ImageId())) {
-        database_->WriteKeypoints(image_data.image.ImageId(),
-                                  image_data.keypoints);
+        if (!database_->ExistsKeypoints(image_data.image.ImageId())) {
+          database_->WriteKeypoints(image_data.image.ImageId(),
+                                    image_data.keypoints);
+        }
+
+        if (!database_->ExistsDescriptors(image_data.image.ImageId())) {
+          database_->WriteDescriptors(image_data.image.ImageId(),
+                                      image_data.descriptors);
+        }
       }
 
-      if (!database_->ExistsDescriptors(image_data.image.ImageId())) {
-        database_->WriteDescriptors(image_data.image.ImageId(),
-                                    image_data.descriptors);
+      if (feature_cache_ && !image_data.feature_cache_key.empty()) {
+        feature_cache_->WriteFeatures(image_data.feature_cache_key,
+                                      image_data.keypoints,
+                                      image_data.descriptors);
       }
+
+      counter_->Add(timer.ElapsedSeconds());
     } else {
       break;
     }
@@ -17,8 +17,14 @@
 #ifndef COLMAP_SRC_FEATURE_EXTRACTION_H_
 #define COLMAP_SRC_FEATURE_EXTRACTION_H_
 
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
 #include "base/database.h"
 #include "base/image_reader.h"
+#include "feature/feature_cache.h"
 #include "feature/sift.h"
 #include "util/opengl_utils.h"
 #include "util/threading.h"
@@ -29,9 +35,91 @@ namespace internal {
 
 struct ImageData;
 
+// The feature cache key of an image and its features, if they are cached.
+struct CachedImageFeatures {
+  std::string key;
+  bool is_cached = false;
+  FeatureKeypoints keypoints;
+  FeatureDescriptors descriptors;
+};
+
+// Pool of the host buffers, into which the resizer threads stage the images
+// for the upload to the GPU. With CUDA, the buffers are page-locked, such that
+// SiftGPU uploads them at the full bandwidth of the bus, and they are reused,
+// since page-locking memory is expensive.
+class StagingBufferPool {
+ public:
+  ~StagingBufferPool();
+
+  // A buffer of at least the given size, which returns to the pool when its
+  // last reference is released. The pool must outlive its buffers.
+  std::shared_ptr<uint8_t> Acquire(const size_t num_bytes);
+
+ private:
+  struct Buffer {
+    uint8_t* data = nullptr;
+    size_t num_bytes = 0;
+    bool is_pinned = false;
+  };
+
+  static Buffer Allocate(const size_t num_bytes);
+  static void Free(const Buffer& buffer);
+
+  std::mutex mutex_;
+  std::vector<Buffer> free_buffers_;
+};
+
+// Input queues of the feature extractor threads. Every GPU has its own queue
+// and an image is pushed to the GPU with the fewest pixels queued or being
+// extracted, so that images of different sizes keep all GPUs equally busy,
+// rather than being taken by whichever thread pops first. The CPU extractor
+// threads share a single queue.
+class ExtractorInputQueues {
+ public:
+  ExtractorInputQueues(const size_t num_queues, const size_t queue_size);
+
+  RingJobQueue<ImageData>* Queue(const size_t queue_idx);
+
+  // Push an image to the queue with the fewest pending pixels.
+  bool Push(ImageData image_data);
+
+  // Release the pixels of an image of the queue, once it was extracted.
+  void Release(const size_t queue_idx, const size_t num_pixels);
+
+  void Wait();
+  void Stop();
+  void Clear();
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<RingJobQueue<ImageData>>> queues_;
+  std::vector<size_t> num_pending_pixels_;
+};
+
+// Throughput counter of a stage of the extraction pipeline, which accumulates
+// the images processed by all threads of the stage and the time spent on them.
+class PipelineStageCounter {
+ public:
+  PipelineStageCounter();
+
+  void Add(const double seconds);
+  void Print(const std::string& name) const;
+
+ private:
+  mutable std::mutex mutex_;
+  size_t num_images_;
+  double num_seconds_;
+};
+
 }  // namespace internal
 
 // Feature extraction class to extract features for all images in a directory.
+// With a feature cache, the image files are hashed by the decode threads of
+// the image reader, which read the features of cached images from the cache
+// instead of decoding the images, and the extracted features of the other
+// images are added to the cache. With GPUs, the resizer threads also stage the
+// images for the upload, such that every GPU thread only uploads an image and
+// extracts its features, while the next image waits in its queue.
 class SiftFeatureExtractor : public Thread {
  public:
   SiftFeatureExtractor(const ImageReaderOptions& reader_options,
@@ -40,33 +128,62 @@ class SiftFeatureExtractor : public Thread {
  private:
   void Run();
 
+  // Look up the features of an image file in the cache and return whether
+  // they are cached, see `ImageReader::SetHeaderOnlyPredicate`.
+  bool ReadCachedFeatures(const std::string& image_name,
+                          const std::string& path);
+
   const ImageReaderOptions reader_options_;
   const SiftExtractionOptions sift_options_;
 
   Database database_;
   ImageReader image_reader_;
 
+  // The feature cache and the cache lookups of the images that were read
+  // ahead of `ImageReader::Next` by their name.
+  std::unique_ptr<FeatureCache> feature_cache_;
+  std::mutex cached_features_mutex_;
+  std::unordered_map<std::string, internal::CachedImageFeatures>
+      cached_features_;
+
+  // Declared before the queues, whose images may hold its buffers.
+  std::unique_ptr<internal::StagingBufferPool> staging_buffer_pool_;
+
   std::vector<std::unique_ptr<Thread>> resizers_;
   std::vector<std::unique_ptr<Thread>> extractors_;
   std::unique_ptr<Thread> writer_;
 
-  std::unique_ptr<JobQueue<internal::ImageData>> resizer_queue_;
-  std::unique_ptr<JobQueue<internal::ImageData>> extractor_queue_;
-  std::unique_ptr<JobQueue<internal::ImageData>> writer_queue_;
+  std::unique_ptr<RingJobQueue<internal::ImageData>> resizer_queue_;
+  std::unique_ptr<internal::ExtractorInputQueues> extractor_queues_;
+  std::unique_ptr<RingJobQueue<internal::ImageData>> writer_queue_;
+
+  internal::PipelineStageCounter reader_counter_;
+  internal::PipelineStageCounter resizer_counter_;
+  internal::PipelineStageCounter extractor_counter_;
+  internal::PipelineStageCounter writer_counter_;
 };
 
 // Import features from text files. Each image must have a corresponding text
 // file with the same name and an additional ".txt" suffix.
+// Import the features of every image from NAME.bin in the binary or from
+// NAME.txt in the text format of `LoadSiftFeaturesFromBinaryFile` and
+// `LoadSiftFeaturesFromTextFile`. The feature files are parsed by `num_threads`
+// threads while the next images are read, and the features of a batch of
+// images are written to the database in a single transaction.
 class FeatureImporter : public Thread {
  public:
   FeatureImporter(const ImageReaderOptions& reader_options,
-                  const std::string& import_path);
+                  const std::string& import_path, const int num_threads = -1);
 
  private:
+  // The number of images whose features are written in one transaction.
+  const static size_t kBatchSize = 100;
+
   void Run();
 
   const ImageReaderOptions reader_options_;
   const std::string import_path_;
+  const int num_threads_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -82,29 +199,47 @@ struct ImageData {
   Image image;
   Bitmap bitmap;
 
+  // The raw bits of the bitmap, see `Bitmap::ConvertToRawBits`, which are
+  // staged by the resizer threads for the upload to the GPU.
+  std::shared_ptr<uint8_t> raw_bits;
+
   FeatureKeypoints keypoints;
   FeatureDescriptors descriptors;
+
+  // Whether the features were read from the feature cache, and otherwise the
+  // key under which the extracted features are added to the cache.
+  bool is_cached = false;
+  std::string feature_cache_key;
 };
 
+// Resize the images to the maximum image size and, if a staging buffer pool
+// is given, stage their raw bits for the upload to the GPU.
 class ImageResizerThread : public Thread {
  public:
-  ImageResizerThread(const int max_image_size, JobQueue<ImageData>* input_queue,
-                     JobQueue<ImageData>* output_queue);
+  ImageResizerThread(const int max_image_size,
+                     RingJobQueue<ImageData>* input_queue,
+                     ExtractorInputQueues* output_queues,
+                     PipelineStageCounter* counter,
+                     StagingBufferPool* staging_buffer_pool = nullptr);
 
  private:
   void Run();
 
   const int max_image_size_;
 
-  JobQueue<ImageData>* input_queue_;
-  JobQueue<ImageData>* output_queue_;
+  RingJobQueue<ImageData>* input_queue_;
+  ExtractorInputQueues* output_queues_;
+  PipelineStageCounter* counter_;
+  StagingBufferPool* staging_buffer_pool_;
 };
 
 class SiftFeatureExtractorThread : public Thread {
  public:
   SiftFeatureExtractorThread(const SiftExtractionOptions& sift_options,
-                             JobQueue<ImageData>* input_queue,
-                             JobQueue<ImageData>* output_queue);
+                             ExtractorInputQueues* input_queues,
+                             const size_t input_queue_idx,
+                             RingJobQueue<ImageData>* output_queue,
+                             PipelineStageCounter* counter);
 
  private:
   void Run();
@@ -113,21 +248,27 @@ class SiftFeatureExtractorThread : public Thread {
 
   std::unique_ptr<OpenGLContextManager> opengl_context_;
 
-  JobQueue<ImageData>* input_queue_;
-  JobQueue<ImageData>* output_queue_;
+  ExtractorInputQueues* input_queues_;
+  const size_t input_queue_idx_;
+  RingJobQueue<ImageData>* output_queue_;
+  PipelineStageCounter* counter_;
 };
 
 class FeatureWriterThread : public Thread {
  public:
   FeatureWriterThread(const size_t num_images, Database* database,
-                      JobQueue<ImageData>* input_queue);
+                      RingJobQueue<ImageData>* input_queue,
+                      PipelineStageCounter* counter,
+                      const FeatureCache* feature_cache = nullptr);
 
  private:
   void Run();
 
   const size_t num_images_;
   Database* database_;
-  JobQueue<ImageData>* input_queue_;
+  const FeatureCache* feature_cache_;
+  RingJobQueue<ImageData>* input_queue_;
+  PipelineStageCounter* counter_;
 };
 
 }  // namespace internal
@@ -0,0 +1,351 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "feature/feature_cache.h"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <random>
+
+#include <boost/filesystem.hpp>
+
+#include "util/endian.h"
+#include "util/hash.h"
+#include "util/mapped_file.h"
+#include "util/metrics.h"
+#include "util/misc.h"
+
+namespace colmap {
+namespace {
+
+const char kFeaturesMagic[8] = {'T', 'B', 'S', 'F', 'M', 'F', 'C', '\0'};
+const char kMatchesMagic[8] = {'T', 'B', 'S', 'F', 'M', 'M', 'C', '\0'};
+
+const size_t kKeypointNumBytes = 6 * sizeof(float);
+const size_t kMatchNumBytes = 2 * sizeof(point2D_t);
+
+// The extraction backend, since the CPU, CUDA and OpenGL implementations
+// produce slightly different features, see `SiftFeatureExtractor`.
+std::string ExtractionBackend(const SiftExtractionOptions& options) {
+  if (!options.use_gpu || options.estimate_affine_shape ||
+      options.domain_size_pooling || options.tile_size > 0) {
+    return "cpu";
+  }
+#ifdef CUDA_ENABLED
+  return "cuda";
+#else
+  return "opengl";
+#endif
+}
+
+void AddMatrix(const Eigen::Matrix3d& matrix, ContentHasher* hasher) {
+  for (int i = 0; i < 9; ++i) {
+    hasher->AddValue(matrix(i));
+  }
+}
+
+void WriteMatrix(const Eigen::Matrix3d& matrix, std::ostream* stream) {
+  for (int i = 0; i < 9; ++i) {
+    WriteBinaryLittleEndian<double>(stream, matrix(i));
+  }
+}
+
+void ReadMatrix(MappedFileReader* reader, Eigen::Matrix3d* matrix) {
+  for (int i = 0; i < 9; ++i) {
+    (*matrix)(i) = reader->Read<double>();
+  }
+}
+
+// Read the header of an entry and check its magic and version.
+bool ReadEntryHeader(MappedFileReader* reader, const char* magic) {
+  std::vector<char> entry_magic;
+  reader->Read(&entry_magic, 8);
+  return reader->Good() &&
+         std::equal(entry_magic.begin(), entry_magic.end(), magic) &&
+         reader->Read<uint32_t>() == kFeatureCacheVersion && reader->Good();
+}
+
+// Write an entry through a temporary file, which is renamed at once, so that
+// concurrent readers never see a partially written entry.
+void WriteEntry(const std::string& path, const char* magic,
+                const std::function<void(std::ostream*)>& write_func) {
+  boost::system::error_code error;
+  boost::filesystem::create_directories(GetParentDir(path), error);
+
+  const std::string temp_path =
+      path + ".tmp" + std::to_string(std::random_device()());
+
+  bool success = false;
+  {
+    std::ofstream file(temp_path, std::ios::trunc | std::ios::binary);
+    if (file.is_open()) {
+      file.write(magic, 8);
+      WriteBinaryLittleEndian<uint32_t>(&file, kFeatureCacheVersion);
+      write_func(&file);
+      success = file.good();
+    }
+  }
+
+  if (success) {
+    boost::filesystem::rename(temp_path, path, error);
+    success = !error;
+  }
+
+  if (!success) {
+    boost::filesystem::remove(temp_path, error);
+    std::cout << "WARNING: Failed to write feature cache entry " << path
+              << std::endl;
+  }
+}
+
+}  // namespace
+
+FeatureCache::FeatureCache(const std::string& path) : path_(path) {
+  boost::filesystem::create_directories(path_);
+}
+
+std::string FeatureCache::ImageFeaturesKey(
+    const std::string& image_path, const SiftExtractionOptions& options) {
+  const std::string image_hash = HashFileContent(image_path);
+  if (image_hash.empty()) {
+    return "";
+  }
+
+  ContentHasher hasher;
+  hasher.AddValue(kFeatureCacheVersion);
+  hasher.AddString(image_hash);
+  hasher.AddString(ExtractionBackend(options));
+  hasher.AddValue(options.max_image_size);
+  hasher.AddValue(options.max_num_features);
+  hasher.AddValue(options.tile_size);
+  hasher.AddValue(options.tile_size > 0 ? options.tile_overlap : 0);
+  hasher.AddValue(options.first_octave);
+  hasher.AddValue(options.num_octaves);
+  hasher.AddValue(options.octave_resolution);
+  hasher.AddValue(options.peak_threshold);
+  hasher.AddValue(options.edge_threshold);
+  hasher.AddValue(options.estimate_affine_shape);
+  hasher.AddValue(options.max_num_orientations);
+  hasher.AddValue(options.upright);
+  hasher.AddValue(options.darkness_adaptivity);
+  hasher.AddValue(options.domain_size_pooling);
+  hasher.AddValue(options.dsp_min_scale);
+  hasher.AddValue(options.dsp_max_scale);
+  hasher.AddValue(options.dsp_num_scales);
+  hasher.AddValue(static_cast<int>(options.normalization));
+  return hasher.HexDigest();
+}
+
+std::string FeatureCache::MatchingInputKey(
+    const Camera& camera, const FeatureKeypoints& keypoints,
+    const FeatureDescriptors& descriptors) {
+  ContentHasher hasher;
+  hasher.AddValue(kFeatureCacheVersion);
+  hasher.AddValue(camera.ModelId());
+  hasher.AddValue<uint64_t>(camera.Width());
+  hasher.AddValue<uint64_t>(camera.Height());
+  hasher.AddVector(camera.Params());
+  hasher.AddVector(keypoints);
+  hasher.AddValue<uint64_t>(descriptors.rows());
+  hasher.AddValue<uint64_t>(descriptors.cols());
+  hasher.Add(descriptors.data(), descriptors.size());
+  return hasher.HexDigest();
+}
+
+std::string FeatureCache::ImagePairKey(const std::string& matching_input_key1,
+                                       const std::string& matching_input_key2,
+                                       const SiftMatchingOptions& options) {
+  ContentHasher hasher;
+  hasher.AddValue(kFeatureCacheVersion);
+  hasher.AddString(matching_input_key1);
+  hasher.AddString(matching_input_key2);
+  // The GPU and CPU matchers may break ties between equally distant
+  // descriptors differently.
+  hasher.AddValue(options.use_gpu);
+  hasher.AddValue(options.max_ratio);
+  hasher.AddValue(options.max_distance);
+  hasher.AddValue(options.cross_check);
+  hasher.AddValue(options.max_num_matches);
+  hasher.AddValue(options.max_error);
+  hasher.AddValue(options.confidence);
+  hasher.AddValue(options.min_num_trials);
+  hasher.AddValue(options.max_num_trials);
+  hasher.AddValue(options.min_inlier_ratio);
+  hasher.AddValue(options.use_sprt);
+  hasher.AddValue(options.min_num_inliers);
+  hasher.AddValue(options.joint_verification);
+  hasher.AddValue(options.gpu_verification);
+  hasher.AddValue(options.multiple_models);
+  hasher.AddValue(options.max_num_models);
+  hasher.AddValue(options.guided_matching);
+  return hasher.HexDigest();
+}
+
+bool FeatureCache::ReadFeatures(const std::string& key,
+                                FeatureKeypoints* keypoints,
+                                FeatureDescriptors* descriptors) const {
+  CHECK_NOTNULL(keypoints);
+  CHECK_NOTNULL(descriptors);
+
+  MappedFile file;
+  if (!file.Open(EntryPath("features", key))) {
+    METRIC_COUNTER_ADD("feature_cache/feature_misses", 1);
+    return false;
+  }
+
+  MappedFileReader reader(file);
+  if (!ReadEntryHeader(&reader, kFeaturesMagic)) {
+    METRIC_COUNTER_ADD("feature_cache/feature_misses", 1);
+    return false;
+  }
+
+  const size_t num_features = reader.ReadCount(kKeypointNumBytes);
+  const size_t dim = static_cast<size_t>(reader.Read<uint64_t>());
+  keypoints->resize(num_features);
+  for (auto& keypoint : *keypoints) {
+    keypoint.x = reader.Read<float>();
+    keypoint.y = reader.Read<float>();
+    keypoint.a11 = reader.Read<float>();
+    keypoint.a12 = reader.Read<float>();
+    keypoint.a21 = reader.Read<float>();
+    keypoint.a22 = reader.Read<float>();
+  }
+
+  if (!reader.Good() || (dim > 0 && num_features > reader.Remaining() / dim)) {
+    METRIC_COUNTER_ADD("feature_cache/feature_misses", 1);
+    return false;
+  }
+
+  std::vector<uint8_t> descriptors_data;
+  reader.Read(&descriptors_data, num_features * dim);
+  if (!reader.Good()) {
+    METRIC_COUNTER_ADD("feature_cache/feature_misses", 1);
+    return false;
+  }
+
+  *descriptors = Eigen::Map<const FeatureDescriptors>(descriptors_data.data(),
+                                                      num_features, dim);
+
+  METRIC_COUNTER_ADD("feature_cache/feature_hits", 1);
+  return true;
+}
+
+bool FeatureCache::ReadMatches(const std::string& key, FeatureMatches* matches,
+                               TwoViewGeometry* two_view_geometry) const {
+  CHECK_NOTNULL(matches);
+  CHECK_NOTNULL(two_view_geometry);
+
+  MappedFile file;
+  if (!file.Open(EntryPath("matches", key))) {
+    METRIC_COUNTER_ADD("feature_cache/match_misses", 1);
+    return false;
+  }
+
+  MappedFileReader reader(file);
+  if (!ReadEntryHeader(&reader, kMatchesMagic)) {
+    METRIC_COUNTER_ADD("feature_cache/match_misses", 1);
+    return false;
+  }
+
+  matches->resize(reader.ReadCount(kMatchNumBytes));
+  for (auto& match : *matches) {
+    match.point2D_idx1 = reader.Read<point2D_t>();
+    match.point2D_idx2 = reader.Read<point2D_t>();
+  }
+
+  *two_view_geometry = TwoViewGeometry();
+  two_view_geometry->config = reader.Read<int>();
+  ReadMatrix(&reader, &two_view_geometry->E);
+  ReadMatrix(&reader, &two_view_geometry->F);
+  ReadMatrix(&reader, &two_view_geometry->H);
+
+  auto& inlier_matches = two_view_geometry->inlier_matches;
+  inlier_matches.resize(reader.ReadCount(kMatchNumBytes));
+  for (auto& match : inlier_matches) {
+    match.point2D_idx1 = reader.Read<point2D_t>();
+    match.point2D_idx2 = reader.Read<point2D_t>();
+  }
+
+  reader.Read(&two_view_geometry->inlier_labels,
+              reader.ReadCount(sizeof(int)));
+
+  if (!reader.Good()) {
+    METRIC_COUNTER_ADD("feature_cache/match_misses", 1);
+    return false;
+  }
+
+  METRIC_COUNTER_ADD("feature_cache/match_hits", 1);
+  return true;
+}
+
+void FeatureCache::WriteFeatures(const std::string& key,
+                                 const FeatureKeypoints& keypoints,
+                                 const FeatureDescriptors& descriptors) const {
+  CHECK_EQ(keypoints.size(), descriptors.rows());
+  WriteEntry(EntryPath("features", key), kFeaturesMagic,
+             [&](std::ostream* stream) {
+               WriteBinaryLittleEndian<uint64_t>(stream, keypoints.size());
+               WriteBinaryLittleEndian<uint64_t>(stream, descriptors.cols());
+               for (const auto& keypoint : keypoints) {
+                 WriteBinaryLittleEndian<float>(stream, keypoint.x);
+                 WriteBinaryLittleEndian<float>(stream, keypoint.y);
+                 WriteBinaryLittleEndian<float>(stream, keypoint.a11);
+                 WriteBinaryLittleEndian<float>(stream, keypoint.a12);
+                 WriteBinaryLittleEndian<float>(stream, keypoint.a21);
+                 WriteBinaryLittleEndian<float>(stream, keypoint.a22);
+               }
+               stream->write(reinterpret_cast<const char*>(descriptors.data()),
+                             descriptors.size());
+             });
+}
+
+void FeatureCache::WriteMatches(const std::string& key,
+                                const FeatureMatches& matches,
+                                const TwoViewGeometry& two_view_geometry) const {
+  WriteEntry(
+      EntryPath("matches", key), kMatchesMagic, [&](std::ostream* stream) {
+        WriteBinaryLittleEndian<uint64_t>(stream, matches.size());
+        for (const auto& match : matches) {
+          WriteBinaryLittleEndian<point2D_t>(stream, match.point2D_idx1);
+          WriteBinaryLittleEndian<point2D_t>(stream, match.point2D_idx2);
+        }
+
+        WriteBinaryLittleEndian<int>(stream, two_view_geometry.config);
+        WriteMatrix(two_view_geometry.E, stream);
+        WriteMatrix(two_view_geometry.F, stream);
+        WriteMatrix(two_view_geometry.H, stream);
+
+        const auto& inlier_matches = two_view_geometry.inlier_matches;
+        WriteBinaryLittleEndian<uint64_t>(stream, inlier_matches.size());
+        for (const auto& match : inlier_matches) {
+          WriteBinaryLittleEndian<point2D_t>(stream, match.point2D_idx1);
+          WriteBinaryLittleEndian<point2D_t>(stream, match.point2D_idx2);
+        }
+
+        WriteBinaryLittleEndian<uint64_t>(
+            stream, two_view_geometry.inlier_labels.size());
+        WriteBinaryLittleEndian(stream, two_view_geometry.inlier_labels);
+      });
+}
+
+std::string FeatureCache::EntryPath(const std::string& kind,
+                                    const std::string& key) const {
+  CHECK_GE(key.size(), 2);
+  return JoinPaths(path_, kind, key.substr(0, 2), key + ".bin");
+}
+
+}  // namespace colmap
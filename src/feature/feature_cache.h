@@ -0,0 +1,88 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_FEATURE_FEATURE_CACHE_H_
+#define COLMAP_SRC_FEATURE_FEATURE_CACHE_H_
+
+#include <string>
+
+#include "base/camera.h"
+#include "estimators/two_view_geometry.h"
+#include "feature/sift.h"
+#include "feature/types.h"
+
+namespace colmap {
+
+const uint32_t kFeatureCacheVersion = 1;
+
+// Content-addressed cache of extracted features and matching results in a
+// directory, which is shared by all databases and runs on the same images,
+// e.g. when overlapping subsets of a collection are reconstructed repeatedly.
+//
+// The features of an image are addressed by the content hash of the image
+// file and the extraction options, so that renamed or copied images hit the
+// cache and changed files or options miss it. The matches and the two-view
+// geometry of an image pair are addressed by the hashes of the features and
+// cameras of both images and the matching options, which are all inputs of
+// the matching, such that they stay valid when the features of an image are
+// extracted again with the same result.
+//
+// Every entry is a file below the cache directory, which is written to a
+// temporary file and then renamed, so that concurrent processes can share the
+// cache. Entries are never evicted, i.e. the directory may be pruned by age.
+class FeatureCache {
+ public:
+  explicit FeatureCache(const std::string& path);
+
+  // The key of the features of an image file, which are extracted with the
+  // given options, or an empty string, if the file cannot be read.
+  static std::string ImageFeaturesKey(const std::string& image_path,
+                                      const SiftExtractionOptions& options);
+
+  // The key of the features of an image and its camera as the input of the
+  // matching, and the key of the results of an ordered image pair.
+  static std::string MatchingInputKey(const Camera& camera,
+                                      const FeatureKeypoints& keypoints,
+                                      const FeatureDescriptors& descriptors);
+  static std::string ImagePairKey(const std::string& matching_input_key1,
+                                  const std::string& matching_input_key2,
+                                  const SiftMatchingOptions& options);
+
+  // Read the entry of the given key. Returns false if the entry does not exist
+  // or cannot be read, e.g. because it was written by another version.
+  bool ReadFeatures(const std::string& key, FeatureKeypoints* keypoints,
+                    FeatureDescriptors* descriptors) const;
+  bool ReadMatches(const std::string& key, FeatureMatches* matches,
+                   TwoViewGeometry* two_view_geometry) const;
+
+  // Write the entry of the given key. A failed write only prints a warning,
+  // since the cache is an optimization.
+  void WriteFeatures(const std::string& key, const FeatureKeypoints& keypoints,
+                     const FeatureDescriptors& descriptors) const;
+  void WriteMatches(const std::string& key, const FeatureMatches& matches,
+                    const TwoViewGeometry& two_view_geometry) const;
+
+ private:
+  // The path of an entry, whose files are spread over subdirectories by the
+  // first two digits of the key, so that no directory grows too large.
+  std::string EntryPath(const std::string& kind, const std::string& key) const;
+
+  const std::string path_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_FEATURE_FEATURE_CACHE_H_
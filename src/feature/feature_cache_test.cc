@@ -0,0 +1,177 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "feature/feature_cache"
+#include "util/testing.h"
+
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+#include "feature/feature_cache.h"
+#include "util/misc.h"
+
+using namespace colmap;
+
+namespace {
+
+std::string TemporaryPath() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("feature_cache_test_%%%%%%%%"))
+      .string();
+}
+
+void WriteFile(const std::string& path, const std::string& content) {
+  std::ofstream file(path, std::ios::trunc | std::ios::binary);
+  file << content;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestImageFeaturesKey) {
+  const std::string path = TemporaryPath();
+  SiftExtractionOptions options;
+  BOOST_CHECK_EQUAL(FeatureCache::ImageFeaturesKey(path, options), "");
+
+  WriteFile(path, "image1");
+  const std::string key = FeatureCache::ImageFeaturesKey(path, options);
+  BOOST_CHECK_EQUAL(key.size(), 32);
+  BOOST_CHECK_EQUAL(FeatureCache::ImageFeaturesKey(path, options), key);
+
+  // The key does not depend on the number of threads, but on the options that
+  // change the features.
+  SiftExtractionOptions changed_options = options;
+  changed_options.num_threads = 3;
+  BOOST_CHECK_EQUAL(FeatureCache::ImageFeaturesKey(path, changed_options),
+                    key);
+  changed_options.max_num_features += 1;
+  BOOST_CHECK_NE(FeatureCache::ImageFeaturesKey(path, changed_options), key);
+
+  WriteFile(path, "image2");
+  BOOST_CHECK_NE(FeatureCache::ImageFeaturesKey(path, options), key);
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestImagePairKey) {
+  Camera camera;
+  camera.InitializeWithName("SIMPLE_RADIAL", 100, 200, 100);
+  FeatureKeypoints keypoints = {FeatureKeypoint(1, 2), FeatureKeypoint(3, 4)};
+  FeatureDescriptors descriptors = FeatureDescriptors::Random(2, 128);
+
+  const std::string key1 =
+      FeatureCache::MatchingInputKey(camera, keypoints, descriptors);
+  keypoints[1].x += 1;
+  const std::string key2 =
+      FeatureCache::MatchingInputKey(camera, keypoints, descriptors);
+  BOOST_CHECK_NE(key1, key2);
+  camera.SetFocalLength(101);
+  BOOST_CHECK_NE(FeatureCache::MatchingInputKey(camera, keypoints, descriptors),
+                 key2);
+
+  SiftMatchingOptions options;
+  const std::string pair_key = FeatureCache::ImagePairKey(key1, key2, options);
+  BOOST_CHECK_NE(FeatureCache::ImagePairKey(key2, key1, options), pair_key);
+  options.num_threads = 3;
+  BOOST_CHECK_EQUAL(FeatureCache::ImagePairKey(key1, key2, options), pair_key);
+  options.max_ratio = 0.7;
+  BOOST_CHECK_NE(FeatureCache::ImagePairKey(key1, key2, options), pair_key);
+}
+
+BOOST_AUTO_TEST_CASE(TestFeatures) {
+  const std::string path = TemporaryPath();
+  FeatureCache cache(path);
+
+  const std::string key = "0123456789abcdef0123456789abcdef";
+  FeatureKeypoints keypoints;
+  FeatureDescriptors descriptors;
+  BOOST_CHECK(!cache.ReadFeatures(key, &keypoints, &descriptors));
+
+  const FeatureKeypoints written_keypoints = {
+      FeatureKeypoint(1, 2, 3, 4, 5, 6), FeatureKeypoint(7, 8, 1.5, 0.5)};
+  const FeatureDescriptors written_descriptors =
+      FeatureDescriptors::Random(2, 128);
+  cache.WriteFeatures(key, written_keypoints, written_descriptors);
+
+  BOOST_CHECK(cache.ReadFeatures(key, &keypoints, &descriptors));
+  BOOST_REQUIRE_EQUAL(keypoints.size(), written_keypoints.size());
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    BOOST_CHECK_EQUAL(keypoints[i].x, written_keypoints[i].x);
+    BOOST_CHECK_EQUAL(keypoints[i].y, written_keypoints[i].y);
+    BOOST_CHECK_EQUAL(keypoints[i].a11, written_keypoints[i].a11);
+    BOOST_CHECK_EQUAL(keypoints[i].a12, written_keypoints[i].a12);
+    BOOST_CHECK_EQUAL(keypoints[i].a21, written_keypoints[i].a21);
+    BOOST_CHECK_EQUAL(keypoints[i].a22, written_keypoints[i].a22);
+  }
+  BOOST_CHECK(descriptors == written_descriptors);
+
+  // A second cache on the same directory, e.g. of another process.
+  FeatureCache other_cache(path);
+  BOOST_CHECK(other_cache.ReadFeatures(key, &keypoints, &descriptors));
+  BOOST_CHECK(descriptors == written_descriptors);
+
+  // Truncated entries are rejected.
+  const std::string entry_path =
+      JoinPaths(path, "features", key.substr(0, 2), key + ".bin");
+  BOOST_CHECK(boost::filesystem::exists(entry_path));
+  boost::filesystem::resize_file(entry_path,
+                                 boost::filesystem::file_size(entry_path) - 1);
+  BOOST_CHECK(!cache.ReadFeatures(key, &keypoints, &descriptors));
+
+  boost::filesystem::remove_all(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestMatches) {
+  const std::string path = TemporaryPath();
+  FeatureCache cache(path);
+
+  const std::string key = "fedcba9876543210fedcba9876543210";
+  FeatureMatches matches;
+  TwoViewGeometry two_view_geometry;
+  BOOST_CHECK(!cache.ReadMatches(key, &matches, &two_view_geometry));
+
+  FeatureMatches written_matches(3);
+  for (size_t i = 0; i < written_matches.size(); ++i) {
+    written_matches[i].point2D_idx1 = i;
+    written_matches[i].point2D_idx2 = 2 * i + 1;
+  }
+  TwoViewGeometry written_two_view_geometry;
+  written_two_view_geometry.config = TwoViewGeometry::MULTIPLE;
+  written_two_view_geometry.E = Eigen::Matrix3d::Random();
+  written_two_view_geometry.F = Eigen::Matrix3d::Random();
+  written_two_view_geometry.H = Eigen::Matrix3d::Random();
+  written_two_view_geometry.inlier_matches = {written_matches[0],
+                                              written_matches[2]};
+  written_two_view_geometry.inlier_labels = {0, 1};
+  cache.WriteMatches(key, written_matches, written_two_view_geometry);
+
+  BOOST_CHECK(cache.ReadMatches(key, &matches, &two_view_geometry));
+  BOOST_REQUIRE_EQUAL(matches.size(), written_matches.size());
+  for (size_t i = 0; i < matches.size(); ++i) {
+    BOOST_CHECK_EQUAL(matches[i].point2D_idx1, written_matches[i].point2D_idx1);
+    BOOST_CHECK_EQUAL(matches[i].point2D_idx2, written_matches[i].point2D_idx2);
+  }
+  BOOST_CHECK_EQUAL(two_view_geometry.config, TwoViewGeometry::MULTIPLE);
+  BOOST_CHECK_EQUAL(two_view_geometry.E, written_two_view_geometry.E);
+  BOOST_CHECK_EQUAL(two_view_geometry.F, written_two_view_geometry.F);
+  BOOST_CHECK_EQUAL(two_view_geometry.H, written_two_view_geometry.H);
+  BOOST_REQUIRE_EQUAL(two_view_geometry.inlier_matches.size(), 2);
+  BOOST_CHECK_EQUAL(two_view_geometry.inlier_matches[1].point2D_idx2, 5);
+  BOOST_CHECK(two_view_geometry.inlier_labels ==
+              written_two_view_geometry.inlier_labels);
+
+  boost::filesystem::remove_all(path);
+}
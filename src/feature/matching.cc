@@ -16,14 +16,21 @@
 
 #include "feature/matching.h"
 
+#include <algorithm>
 #include <fstream>
+#include <map>
 #include <numeric>
 
 #include "base/gps.h"
+#ifdef CUDA_ENABLED
+#include "estimators/two_view_geometry_cuda.h"
+#endif  // CUDA_ENABLED
 #include "ext/SiftGPU/SiftGPU.h"
 #include "feature/utils.h"
 #include "retrieval/visual_index.h"
 #include "util/cuda.h"
+#include "util/endian.h"
+#include "util/metrics.h"
 #include "util/misc.h"
 
 namespace colmap {
@@ -33,6 +40,80 @@ void PrintElapsedTime(const Timer& timer) {
   std::cout << StringPrintf(" in %.3fs", timer.ElapsedSeconds()) << std::endl;
 }
 
+// The cells of a square grid with num_cells rows and columns in the order
+// of a Hilbert curve, in which consecutive cells share a row or a column, and
+// nearby cells mostly follow each other at all scales.
+std::vector<std::pair<size_t, size_t>> OrderGridCellsAlongHilbertCurve(
+    const size_t num_cells) {
+  size_t curve_size = 1;
+  while (curve_size < num_cells) {
+    curve_size *= 2;
+  }
+
+  std::vector<std::pair<size_t, size_t>> cells;
+  cells.reserve(num_cells * num_cells);
+  for (size_t d = 0; d < curve_size * curve_size; ++d) {
+    size_t x = 0;
+    size_t y = 0;
+    size_t t = d;
+    for (size_t s = 1; s < curve_size; s *= 2) {
+      const size_t rx = 1 & (t / 2);
+      const size_t ry = 1 & (t ^ rx);
+      if (ry == 0) {
+        if (rx == 1) {
+          x = s - 1 - x;
+          y = s - 1 - y;
+        }
+        std::swap(x, y);
+      }
+      x += s * rx;
+      y += s * ry;
+      t /= 4;
+    }
+    // The curve covers the next power of two, whose excess cells are skipped.
+    if (x < num_cells && y < num_cells) {
+      cells.emplace_back(y, x);
+    }
+  }
+
+  return cells;
+}
+
+// The order of the locations along a Z-order curve in their bounding box, in
+// which consecutive locations are mostly close to each other.
+std::vector<size_t> OrderLocationsSpatially(
+    const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor>&
+        locations) {
+  const Eigen::RowVector3f min_location = locations.colwise().minCoeff();
+  const Eigen::RowVector3f extent =
+      locations.colwise().maxCoeff() - min_location;
+  const float max_extent = std::max(extent.maxCoeff(), 1e-6f);
+
+  // The locations are quantized to 21 bits per axis, whose bits are
+  // interleaved into a 63-bit code.
+  const uint32_t kMaxCoord = (1u << 21) - 1;
+  std::vector<std::pair<uint64_t, size_t>> codes(locations.rows());
+  for (Eigen::Index i = 0; i < locations.rows(); ++i) {
+    uint64_t code = 0;
+    for (int d = 0; d < 3; ++d) {
+      const uint32_t coord = static_cast<uint32_t>(
+          (locations(i, d) - min_location(d)) / max_extent * kMaxCoord);
+      for (int bit = 0; bit < 21; ++bit) {
+        code |= static_cast<uint64_t>((coord >> bit) & 1) << (3 * bit + d);
+      }
+    }
+    codes[i] = std::make_pair(code, static_cast<size_t>(i));
+  }
+
+  std::sort(codes.begin(), codes.end());
+
+  std::vector<size_t> order(codes.size());
+  for (size_t i = 0; i < codes.size(); ++i) {
+    order[i] = codes[i].second;
+  }
+  return order;
+}
+
 void IndexImagesInVisualIndex(const int num_threads, const int num_checks,
                               const int max_num_features,
                               const std::vector<image_t>& image_ids,
@@ -42,7 +123,15 @@ void IndexImagesInVisualIndex(const int num_threads, const int num_checks,
   index_options.num_threads = num_threads;
   index_options.num_checks = num_checks;
 
-  for (size_t i = 0; i < image_ids.size(); ++i) {
+  // The images are indexed in batches, which are quantized concurrently. The
+  // batch size bounds the memory of the descriptors held at the same time.
+  const size_t batch_size = 4 * GetEffectiveNumThreads(num_threads);
+
+  std::vector<int> batch_image_ids;
+  std::vector<FeatureKeypoints> batch_keypoints;
+  std::vector<retrieval::VisualIndex<>::DescType> batch_descriptors;
+
+  for (size_t begin = 0; begin < image_ids.size(); begin += batch_size) {
     if (thread->IsStopped()) {
       return;
     }
@@ -50,22 +139,34 @@ void IndexImagesInVisualIndex(const int num_threads, const int num_checks,
     Timer timer;
     timer.Start();
 
-    std::cout << StringPrintf("Indexing image [%d/%d]", i + 1, image_ids.size())
+    const size_t end = std::min(begin + batch_size, image_ids.size());
+
+    std::cout << StringPrintf("Indexing images [%d-%d/%d]", begin + 1, end,
+                              image_ids.size())
               << std::flush;
 
-    auto keypoints = cache->GetKeypoints(image_ids[i]);
-    auto descriptors = cache->GetDescriptors(image_ids[i]);
-    if (max_num_features > 0 && descriptors.rows() > max_num_features) {
-      ExtractTopScaleFeatures(&keypoints, &descriptors, max_num_features);
+    batch_image_ids.clear();
+    batch_keypoints.clear();
+    batch_descriptors.clear();
+    for (size_t i = begin; i < end; ++i) {
+      auto keypoints = cache->GetKeypoints(image_ids[i]);
+      auto descriptors = cache->GetDescriptors(image_ids[i]);
+      if (max_num_features > 0 && descriptors.rows() > max_num_features) {
+        ExtractTopScaleFeatures(&keypoints, &descriptors, max_num_features);
+      }
+      batch_image_ids.push_back(image_ids[i]);
+      batch_keypoints.push_back(std::move(keypoints));
+      batch_descriptors.push_back(std::move(descriptors));
     }
 
-    visual_index->Add(index_options, image_ids[i], keypoints, descriptors);
+    visual_index->Add(index_options, batch_image_ids, batch_keypoints,
+                      batch_descriptors);
 
     PrintElapsedTime(timer);
   }
 
   // Compute the TF-IDF weights, etc.
-  visual_index->Prepare();
+  visual_index->Prepare(num_threads);
 }
 
 void MatchNearestNeighborsInVisualIndex(
@@ -91,6 +192,8 @@ void MatchNearestNeighborsInVisualIndex(
   query_options.num_neighbors = num_neighbors;
   query_options.num_checks = num_checks;
   query_options.num_images_after_verification = num_images_after_verification;
+  // Every query runs on a single thread of the retrieval thread pool.
+  query_options.num_threads = 1;
   auto QueryFunc = [&](const image_t image_id) {
     auto keypoints = cache->GetKeypoints(image_id);
     auto descriptors = cache->GetDescriptors(image_id);
@@ -155,15 +258,311 @@ void MatchNearestNeighborsInVisualIndex(
   }
 }
 
+// Read the takes file of the preprocessor, where every line holds the name of
+// an image and the identifier of its take, and return the images of every
+// take in the order of their names. Images that are not listed are assigned
+// to take 0, as in the mapper.
+std::vector<std::vector<image_t>> ReadImageTakes(
+    const std::string& path, const FeatureMatcherCache& cache) {
+  const std::vector<image_t> image_ids = cache.GetImageIds();
+
+  std::unordered_map<std::string, image_t> image_name_to_image_id;
+  image_name_to_image_id.reserve(image_ids.size());
+  for (const auto image_id : image_ids) {
+    image_name_to_image_id.emplace(cache.GetImage(image_id).Name(), image_id);
+  }
+
+  std::ifstream file(path);
+  CHECK(file.is_open()) << path;
+
+  std::map<int, std::vector<image_t>> takes;
+  std::unordered_set<image_t> listed_image_ids;
+  std::string image_name;
+  int take_id;
+  while (file >> image_name >> take_id) {
+    const auto it = image_name_to_image_id.find(image_name);
+    if (it == image_name_to_image_id.end()) {
+      std::cerr << "WARNING: Image " << image_name << " does not exist."
+                << std::endl;
+    } else if (listed_image_ids.insert(it->second).second) {
+      takes[take_id].push_back(it->second);
+    }
+  }
+
+  size_t num_unlisted_images = 0;
+  for (const auto image_id : image_ids) {
+    if (listed_image_ids.count(image_id) == 0) {
+      takes[0].push_back(image_id);
+      num_unlisted_images += 1;
+    }
+  }
+
+  if (num_unlisted_images > 0) {
+    std::cout << StringPrintf("WARNING: %d images are not listed in %s",
+                              num_unlisted_images, path.c_str())
+              << std::endl;
+  }
+
+  std::vector<std::vector<image_t>> ordered_takes;
+  ordered_takes.reserve(takes.size());
+  for (auto& take : takes) {
+    std::sort(take.second.begin(), take.second.end(),
+              [&cache](const image_t image_id1, const image_t image_id2) {
+                return cache.GetImage(image_id1).Name() <
+                       cache.GetImage(image_id2).Name();
+              });
+    ordered_takes.push_back(std::move(take.second));
+  }
+
+  return ordered_takes;
+}
+
+// Pair every image with the `num_images` images of the other takes that are
+// closest to it in relative time within their take, i.e. it is assumed that
+// the takes capture similar motions at a similar pace.
+std::vector<std::pair<image_t, image_t>> FindTemporalCrossTakePairs(
+    const std::vector<std::vector<image_t>>& takes, const int num_images) {
+  struct TakeImage {
+    image_t image_id;
+    size_t take_idx;
+    double time;
+  };
+
+  std::vector<TakeImage> take_images;
+  for (size_t take_idx = 0; take_idx < takes.size(); ++take_idx) {
+    const auto& take = takes[take_idx];
+    for (size_t i = 0; i < take.size(); ++i) {
+      TakeImage take_image;
+      take_image.image_id = take[i];
+      take_image.take_idx = take_idx;
+      take_image.time =
+          take.size() > 1 ? static_cast<double>(i) / (take.size() - 1) : 0.0;
+      take_images.push_back(take_image);
+    }
+  }
+
+  std::vector<std::pair<image_t, image_t>> image_pairs;
+  std::vector<std::pair<double, size_t>> candidates;
+  for (const auto& take_image : take_images) {
+    candidates.clear();
+    for (size_t i = 0; i < take_images.size(); ++i) {
+      if (take_images[i].take_idx != take_image.take_idx) {
+        candidates.emplace_back(std::abs(take_images[i].time - take_image.time),
+                                i);
+      }
+    }
+
+    if (num_images >= 0 && candidates.size() > static_cast<size_t>(num_images)) {
+      std::nth_element(candidates.begin(), candidates.begin() + num_images,
+                       candidates.end());
+      candidates.resize(num_images);
+    }
+
+    for (const auto& candidate : candidates) {
+      image_pairs.emplace_back(take_image.image_id,
+                               take_images[candidate.second].image_id);
+    }
+  }
+
+  return image_pairs;
+}
+
+// Select the pairs of every image with `num_images` images of the other
+// takes, which are the most similar ones according to the vocabulary tree at
+// `vocab_tree_path` if given and otherwise the ones at the closest relative
+// time within their take. With -1, all images of the other takes are paired.
+std::vector<std::pair<image_t, image_t>> FindCrossTakePairs(
+    const std::vector<std::vector<image_t>>& takes, const int num_images,
+    const std::string& vocab_tree_path, const int num_threads, Thread* thread,
+    FeatureMatcherCache* cache) {
+  if (vocab_tree_path.empty() || num_images < 0) {
+    return FindTemporalCrossTakePairs(takes, num_images);
+  }
+
+  std::vector<image_t> image_ids;
+  std::unordered_map<image_t, size_t> image_id_to_take_idx;
+  size_t max_take_size = 0;
+  for (size_t take_idx = 0; take_idx < takes.size(); ++take_idx) {
+    for (const auto image_id : takes[take_idx]) {
+      image_ids.push_back(image_id);
+      image_id_to_take_idx.emplace(image_id, take_idx);
+    }
+    max_take_size = std::max(max_take_size, takes[take_idx].size());
+  }
+
+  // Read the pre-trained vocabulary tree from disk.
+  retrieval::VisualIndex<> visual_index;
+  visual_index.Read(vocab_tree_path);
+
+  // Index all images in the visual index.
+  const retrieval::VisualIndex<>::QueryOptions default_query_options;
+  IndexImagesInVisualIndex(num_threads, default_query_options.num_checks, -1,
+                           image_ids, thread, cache, &visual_index);
+
+  // Retrieve enough images, such that the requested number of images of the
+  // other takes remains after removing the images of the same take.
+  retrieval::VisualIndex<>::QueryOptions query_options;
+  query_options.max_num_images = num_images + static_cast<int>(max_take_size);
+  query_options.num_threads = 1;
+
+  std::vector<std::vector<std::pair<image_t, image_t>>> image_pairs(
+      image_ids.size());
+
+  auto QueryFunc = [&](const size_t image_idx) {
+    const image_t image_id = image_ids[image_idx];
+    const size_t take_idx = image_id_to_take_idx.at(image_id);
+    const auto keypoints = cache->GetKeypoints(image_id);
+    const auto descriptors = cache->GetDescriptors(image_id);
+
+    std::vector<retrieval::ImageScore> image_scores;
+    visual_index.Query(query_options, keypoints, descriptors, &image_scores);
+
+    for (const auto& image_score : image_scores) {
+      if (image_pairs[image_idx].size() == static_cast<size_t>(num_images)) {
+        break;
+      }
+      if (image_id_to_take_idx.at(image_score.image_id) != take_idx) {
+        image_pairs[image_idx].emplace_back(image_id, image_score.image_id);
+      }
+    }
+  };
+
+  ThreadPool thread_pool(num_threads);
+  for (size_t image_idx = 0; image_idx < image_ids.size(); ++image_idx) {
+    if (thread->IsStopped()) {
+      break;
+    }
+    thread_pool.AddTask(QueryFunc, image_idx);
+  }
+  thread_pool.Wait();
+
+  std::vector<std::pair<image_t, image_t>> cross_take_pairs;
+  for (const auto& image_pairs_of_image : image_pairs) {
+    cross_take_pairs.insert(cross_take_pairs.end(),
+                            image_pairs_of_image.begin(),
+                            image_pairs_of_image.end());
+  }
+
+  return cross_take_pairs;
+}
+
+// Match the pairs between the takes without duplicates in batches of
+// `batch_size` pairs, which are ordered by the first image, such that
+// consecutive batches share their images.
+void MatchCrossTakePairs(
+    std::vector<std::pair<image_t, image_t>> cross_take_pairs,
+    const size_t batch_size, Thread* thread, SiftFeatureMatcher* matcher) {
+  for (auto& image_pair : cross_take_pairs) {
+    if (image_pair.first > image_pair.second) {
+      std::swap(image_pair.first, image_pair.second);
+    }
+  }
+  std::sort(cross_take_pairs.begin(), cross_take_pairs.end());
+  cross_take_pairs.erase(
+      std::unique(cross_take_pairs.begin(), cross_take_pairs.end()),
+      cross_take_pairs.end());
+
+  const size_t num_batches = static_cast<size_t>(
+      std::ceil(static_cast<double>(cross_take_pairs.size()) / batch_size));
+
+  std::vector<std::pair<image_t, image_t>> image_pairs;
+  image_pairs.reserve(batch_size);
+
+  for (size_t batch_idx = 0; batch_idx < num_batches; ++batch_idx) {
+    if (thread->IsStopped()) {
+      return;
+    }
+
+    Timer timer;
+    timer.Start();
+
+    std::cout << StringPrintf("Matching cross-take batch [%d/%d]",
+                              batch_idx + 1, num_batches)
+              << std::flush;
+
+    const auto begin = cross_take_pairs.begin() + batch_idx * batch_size;
+    const auto end =
+        cross_take_pairs.begin() +
+        std::min(cross_take_pairs.size(), (batch_idx + 1) * batch_size);
+    image_pairs.assign(begin, end);
+
+    matcher->Match(image_pairs);
+
+    PrintElapsedTime(timer);
+  }
+}
+
+// Read the next image pair and its matches from a match list in the text
+// format of `FeaturePairsFeatureMatcher`. Returns false at the end of the list.
+bool ReadNextTextMatches(std::istream* file, std::string* image_name1,
+                         std::string* image_name2, FeatureMatches* matches) {
+  matches->clear();
+
+  std::string line;
+  do {
+    if (!std::getline(*file, line)) {
+      return false;
+    }
+    StringTrim(&line);
+  } while (line.empty());
+
+  std::istringstream line_stream(line);
+  line_stream >> *image_name1 >> *image_name2;
+
+  while (std::getline(*file, line)) {
+    StringTrim(&line);
+    if (line.empty()) {
+      break;
+    }
+
+    std::istringstream line_stream(line);
+    FeatureMatch match;
+    line_stream >> match.point2D_idx1 >> match.point2D_idx2;
+    matches->push_back(match);
+  }
+
+  return true;
+}
+
+// Read the next image pair and its matches from a match list in the binary
+// format of `FeaturePairsFeatureMatcher`. Returns false at the end of the list.
+bool ReadNextBinaryMatches(std::istream* file, std::string* image_name1,
+                           std::string* image_name2, FeatureMatches* matches) {
+  for (std::string* image_name : {image_name1, image_name2}) {
+    const uint32_t name_length = ReadBinaryLittleEndian<uint32_t>(file);
+    if (!file->good()) {
+      return false;
+    }
+    image_name->resize(name_length);
+    file->read(&(*image_name)[0], name_length);
+  }
+
+  const size_t num_matches = ReadBinaryLittleEndian<uint64_t>(file);
+  std::vector<uint32_t> match_data(2 * num_matches);
+  file->read(reinterpret_cast<char*>(match_data.data()),
+             match_data.size() * sizeof(uint32_t));
+  CHECK(file->good()) << "Truncated match list";
+
+  matches->resize(num_matches);
+  for (size_t i = 0; i < num_matches; ++i) {
+    (*matches)[i].point2D_idx1 = LittleEndianToNative(match_data[2 * i]);
+    (*matches)[i].point2D_idx2 = LittleEndianToNative(match_data[2 * i + 1]);
+  }
+
+  return true;
+}
+
 }  // namespace
 
 bool ExhaustiveMatchingOptions::Check() const {
   CHECK_OPTION_GT(block_size, 1);
+  CHECK_OPTION_GE(num_cross_take_images, -1);
   return true;
 }
 
 bool SequentialMatchingOptions::Check() const {
   CHECK_OPTION_GT(overlap, 0);
+  CHECK_OPTION_GE(num_cross_take_images, -1);
   CHECK_OPTION_GT(loop_detection_period, 0);
   CHECK_OPTION_GT(loop_detection_num_images, 0);
   CHECK_OPTION_GT(loop_detection_num_nearest_neighbors, 0);
@@ -197,10 +596,16 @@ bool ImagePairsMatchingOptions::Check() const {
 
 bool FeaturePairsMatchingOptions::Check() const { return true; }
 
-FeatureMatcherCache::FeatureMatcherCache(const size_t cache_size,
-                                         const Database* database)
-    : cache_size_(cache_size), database_(database) {
+FeatureMatcherCache::FeatureMatcherCache(
+    const size_t cache_size, const Database* database,
+    const double descriptor_cache_size,
+    const std::string& descriptor_store_path)
+    : cache_size_(cache_size),
+      descriptor_cache_size_(descriptor_cache_size),
+      descriptor_store_path_(descriptor_store_path),
+      database_(database) {
   CHECK_NOTNULL(database_);
+  CHECK_GE(descriptor_cache_size_, 0);
 }
 
 void FeatureMatcherCache::Setup() {
@@ -216,15 +621,60 @@ void FeatureMatcherCache::Setup() {
     images_cache_.emplace(image.ImageId(), image);
   }
 
-  keypoints_cache_.reset(new LRUCache<image_t, FeatureKeypoints>(
-      cache_size_, [this](const image_t image_id) {
-        return database_->ReadKeypoints(image_id);
-      }));
+  // The caches are only locked per shard, while the getters serialize the
+  // accesses to the database, unless they go through the read connection pool.
+  keypoints_cache_.reset(
+      ShardedLRUCache<image_t, FeatureKeypoints>::Create<
+          LRUCache<image_t, FeatureKeypoints>>(
+          cache_size_, [this](const image_t image_id) {
+            METRIC_COUNTER_ADD("matcher/keypoints_cache_misses", 1);
+            const auto lock = LockDatabaseForReading();
+            return database_->ReadKeypoints(image_id);
+          }));
+
+  if (!descriptor_store_path_.empty()) {
+    descriptor_store_.OpenOrWrite(descriptor_store_path_, *database_);
+  }
+
+  if (database_->ExistsDescriptorCodebook()) {
+    descriptor_quantizer_ =
+        ProductQuantizer(database_->ReadDescriptorCodebook());
+  }
+
+  // The codes are 8 times smaller than the descriptors with the default
+  // number of subspaces, so that more images are cached for the same memory.
+  descriptor_codes_cache_.reset(
+      ShardedLRUCache<image_t, FeatureDescriptorCodes>::Create<
+          LRUCache<image_t, FeatureDescriptorCodes>>(
+          8 * cache_size_, [this](const image_t image_id) {
+            const auto lock = LockDatabaseForReading();
+            return database_->ReadDescriptorCodes(image_id);
+          }));
+
+  const auto descriptors_getter = [this](const image_t image_id) {
+    METRIC_COUNTER_ADD("matcher/descriptors_cache_misses", 1);
+    return ReadDescriptors(image_id);
+  };
 
-  descriptors_cache_.reset(new LRUCache<image_t, FeatureDescriptors>(
-      cache_size_, [this](const image_t image_id) {
-        return database_->ReadDescriptors(image_id);
-      }));
+  typedef ShardedLRUCache<image_t, CachedDescriptors> DescriptorsCache;
+  if (descriptor_cache_size_ > 0 || GetMemoryBudget() > 0) {
+    const size_t max_num_bytes =
+        descriptor_cache_size_ > 0
+            ? static_cast<size_t>(1024.0 * 1024.0 * 1024.0 *
+                                  descriptor_cache_size_)
+            : GetMemoryBudget();
+    descriptors_cache_.reset(
+        DescriptorsCache::Create<
+            MemoryConstrainedLRUCache<image_t, CachedDescriptors>>(
+            max_num_bytes, descriptors_getter));
+    descriptors_memory_consumer_.reset(new MemoryConsumer(
+        "matcher_descriptors", kMatcherCacheMemoryPriority));
+    descriptors_cache_->SetMemoryConsumer(descriptors_memory_consumer_.get());
+  } else {
+    descriptors_cache_.reset(
+        DescriptorsCache::Create<LRUCache<image_t, CachedDescriptors>>(
+            cache_size_, descriptors_getter));
+  }
 }
 
 const Camera& FeatureMatcherCache::GetCamera(const camera_t camera_id) const {
@@ -235,16 +685,69 @@ const Image& FeatureMatcherCache::GetImage(const image_t image_id) const {
   return images_cache_.at(image_id);
 }
 
-const FeatureKeypoints& FeatureMatcherCache::GetKeypoints(
-    const image_t image_id) {
-  std::unique_lock<std::mutex> lock(database_mutex_);
+FeatureKeypoints FeatureMatcherCache::GetKeypoints(const image_t image_id) {
+  METRIC_COUNTER_ADD("matcher/keypoints_cache_accesses", 1);
   return keypoints_cache_->Get(image_id);
 }
 
-const FeatureDescriptors& FeatureMatcherCache::GetDescriptors(
+FeatureDescriptors FeatureMatcherCache::GetDescriptors(const image_t image_id) {
+  METRIC_COUNTER_ADD("matcher/descriptors_cache_accesses", 1);
+  return descriptors_cache_->Get(image_id).descriptors;
+}
+
+FeatureDescriptorCodes FeatureMatcherCache::GetDescriptorCodes(
     const image_t image_id) {
-  std::unique_lock<std::mutex> lock(database_mutex_);
-  return descriptors_cache_->Get(image_id);
+  return descriptor_codes_cache_->Get(image_id);
+}
+
+void FeatureMatcherCache::Prefetch(const std::vector<image_t>& image_ids) {
+  METRIC_COUNTER_ADD("matcher/keypoints_cache_accesses", image_ids.size());
+  METRIC_COUNTER_ADD("matcher/descriptors_cache_accesses", image_ids.size());
+  for (const auto image_id : image_ids) {
+    keypoints_cache_->Load(image_id);
+    descriptors_cache_->Load(image_id);
+  }
+}
+
+const ProductQuantizer& FeatureMatcherCache::GetDescriptorQuantizer() const {
+  return descriptor_quantizer_;
+}
+
+size_t FeatureMatcherCache::CachedDescriptors::NumBytes() const {
+  return static_cast<size_t>(descriptors.size()) * sizeof(uint8_t);
+}
+
+FeatureMatcherCache::CachedDescriptors FeatureMatcherCache::ReadDescriptors(
+    const image_t image_id) {
+  CachedDescriptors cached;
+  // The memory-mapped store is read without locking the database.
+  if (descriptor_store_.IsOpen() && descriptor_store_.ExistsImage(image_id)) {
+    cached.descriptors = descriptor_store_.Descriptors(image_id);
+    return cached;
+  }
+
+  auto lock = LockDatabaseForReading();
+  if (descriptor_quantizer_.IsTrained() &&
+      !database_->ExistsDescriptors(image_id) &&
+      database_->ExistsDescriptorCodes(image_id)) {
+    const FeatureDescriptorCodes codes =
+        database_->ReadDescriptorCodes(image_id);
+    if (lock.owns_lock()) {
+      lock.unlock();
+    }
+    cached.descriptors = descriptor_quantizer_.Decode(codes);
+  } else {
+    cached.descriptors = database_->ReadDescriptors(image_id);
+  }
+  return cached;
+}
+
+std::unique_lock<std::mutex> FeatureMatcherCache::LockDatabaseForReading() {
+  std::unique_lock<std::mutex> lock(database_mutex_, std::defer_lock);
+  if (!database_->IsReadConnectionPoolEnabled()) {
+    lock.lock();
+  }
+  return lock;
 }
 
 FeatureMatches FeatureMatcherCache::GetMatches(const image_t image_id1,
@@ -288,6 +791,17 @@ void FeatureMatcherCache::WriteInlierMatches(
   database_->WriteInlierMatches(image_id1, image_id2, two_view_geometry);
 }
 
+void FeatureMatcherCache::WriteMatchesAndInlierMatches(
+    const std::vector<internal::FeatureMatcherData>& data) {
+  std::unique_lock<std::mutex> lock(database_mutex_);
+  for (const auto& pair_data : data) {
+    database_->WriteMatches(pair_data.image_id1, pair_data.image_id2,
+                            pair_data.matches);
+    database_->WriteInlierMatches(pair_data.image_id1, pair_data.image_id2,
+                                  pair_data.two_view_geometry);
+  }
+}
+
 void FeatureMatcherCache::DeleteMatches(const image_t image_id1,
                                         const image_t image_id2) {
   std::unique_lock<std::mutex> lock(database_mutex_);
@@ -310,8 +824,8 @@ void FeatureMatcherThread::SetMaxNumMatches(const int max_num_matches) {
 
 SiftCPUFeatureMatcher::SiftCPUFeatureMatcher(const SiftMatchingOptions& options,
                                              FeatureMatcherCache* cache,
-                                             JobQueue<Input>* input_queue,
-                                             JobQueue<Output>* output_queue)
+                                             RingJobQueue<Input>* input_queue,
+                                             RingJobQueue<Output>* output_queue)
     : FeatureMatcherThread(options, cache),
       input_queue_(input_queue),
       output_queue_(output_queue) {
@@ -319,6 +833,13 @@ SiftCPUFeatureMatcher::SiftCPUFeatureMatcher(const SiftMatchingOptions& options,
 }
 
 void SiftCPUFeatureMatcher::Run() {
+  if (options_.use_descriptor_codes &&
+      !cache_->GetDescriptorQuantizer().IsTrained()) {
+    std::cout << "ERROR: Database has no descriptor codebook" << std::endl;
+    SignalInvalidSetup();
+    return;
+  }
+
   SignalValidSetup();
 
   while (true) {
@@ -326,25 +847,38 @@ void SiftCPUFeatureMatcher::Run() {
       break;
     }
 
-    const auto input_job = input_queue_->Pop();
+    auto input_job = input_queue_->Pop();
     if (input_job.IsValid()) {
-      auto data = input_job.Data();
+      auto& group = input_job.Data();
+      CHECK(!group.empty());
 
       const FeatureDescriptors descriptors1 =
-          cache_->GetDescriptors(data.image_id1);
-      const FeatureDescriptors descriptors2 =
-          cache_->GetDescriptors(data.image_id2);
-      MatchSiftFeaturesCPU(options_, descriptors1, descriptors2, &data.matches);
+          cache_->GetDescriptors(group.front().image_id1);
+      for (auto& data : group) {
+        CHECK_EQ(data.image_id1, group.front().image_id1);
+        if (options_.use_descriptor_codes) {
+          const FeatureDescriptorCodes codes2 =
+              cache_->GetDescriptorCodes(data.image_id2);
+          MatchQuantizedSiftFeaturesCPU(options_,
+                                        cache_->GetDescriptorQuantizer(),
+                                        descriptors1, codes2, &data.matches);
+        } else {
+          const FeatureDescriptors descriptors2 =
+              cache_->GetDescriptors(data.image_id2);
+          MatchSiftFeaturesCPU(options_, descriptors1, descriptors2,
+                               &data.matches);
+        }
 
-      CHECK(output_queue_->Push(data));
+        CHECK(output_queue_->Push(data));
+      }
     }
   }
 }
 
 SiftGPUFeatureMatcher::SiftGPUFeatureMatcher(const SiftMatchingOptions& options,
                                              FeatureMatcherCache* cache,
-                                             JobQueue<Input>* input_queue,
-                                             JobQueue<Output>* output_queue)
+                                             RingJobQueue<Input>* input_queue,
+                                             RingJobQueue<Output>* output_queue)
     : FeatureMatcherThread(options, cache),
       input_queue_(input_queue),
       output_queue_(output_queue) {
@@ -378,18 +912,24 @@ void SiftGPUFeatureMatcher::Run() {
       break;
     }
 
-    const auto input_job = input_queue_->Pop();
+    auto input_job = input_queue_->Pop();
     if (input_job.IsValid()) {
-      auto data = input_job.Data();
-
-      const FeatureDescriptors* descriptors1_ptr;
-      GetDescriptorData(0, data.image_id1, &descriptors1_ptr);
-      const FeatureDescriptors* descriptors2_ptr;
-      GetDescriptorData(1, data.image_id2, &descriptors2_ptr);
-      MatchSiftFeaturesGPU(options_, descriptors1_ptr, descriptors2_ptr,
-                           &sift_match_gpu, &data.matches);
+      auto& group = input_job.Data();
+      CHECK(!group.empty());
+
+      // The descriptors of the first image stay on the GPU for all pairs of
+      // the group, and only the ones of the second images are uploaded.
+      for (auto& data : group) {
+        CHECK_EQ(data.image_id1, group.front().image_id1);
+        const FeatureDescriptors* descriptors1_ptr;
+        GetDescriptorData(0, data.image_id1, &descriptors1_ptr);
+        const FeatureDescriptors* descriptors2_ptr;
+        GetDescriptorData(1, data.image_id2, &descriptors2_ptr);
+        MatchSiftFeaturesGPU(options_, descriptors1_ptr, descriptors2_ptr,
+                             &sift_match_gpu, &data.matches);
 
-      CHECK(output_queue_->Push(data));
+        CHECK(output_queue_->Push(data));
+      }
     }
   }
 }
@@ -410,7 +950,7 @@ void SiftGPUFeatureMatcher::GetDescriptorData(
 
 GuidedSiftCPUFeatureMatcher::GuidedSiftCPUFeatureMatcher(
     const SiftMatchingOptions& options, FeatureMatcherCache* cache,
-    JobQueue<Input>* input_queue, JobQueue<Output>* output_queue)
+    RingJobQueue<Input>* input_queue, RingJobQueue<Output>* output_queue)
     : FeatureMatcherThread(options, cache),
       input_queue_(input_queue),
       output_queue_(output_queue) {
@@ -451,7 +991,7 @@ void GuidedSiftCPUFeatureMatcher::Run() {
 
 GuidedSiftGPUFeatureMatcher::GuidedSiftGPUFeatureMatcher(
     const SiftMatchingOptions& options, FeatureMatcherCache* cache,
-    JobQueue<Input>* input_queue, JobQueue<Output>* output_queue)
+    RingJobQueue<Input>* input_queue, RingJobQueue<Output>* output_queue)
     : FeatureMatcherThread(options, cache),
       input_queue_(input_queue),
       output_queue_(output_queue) {
@@ -480,34 +1020,47 @@ void GuidedSiftGPUFeatureMatcher::Run() {
 
   SignalValidSetup();
 
+  std::vector<Input> batch;
+  batch.reserve(kMaxNumPairsPerBatch);
+
   while (true) {
     if (IsStopped()) {
       break;
     }
 
-    const auto input_job = input_queue_->Pop();
-    if (input_job.IsValid()) {
-      auto data = input_job.Data();
-
-      if (data.two_view_geometry.inlier_matches.size() <
-          static_cast<size_t>(options_.min_num_inliers)) {
-        CHECK(output_queue_->Push(data));
-        continue;
-      }
+    batch.clear();
+    if (!input_queue_->PopBatch(kMaxNumPairsPerBatch, &batch)) {
+      continue;
+    }
 
+    // The pairs without enough verified inliers are not matched, and the
+    // other pairs are matched in the order of their images, so that
+    // consecutive pairs share the uploaded features of their first images.
+    const auto guided_end = std::partition(
+        batch.begin(), batch.end(), [this](const Input& data) {
+          return data.two_view_geometry.inlier_matches.size() >=
+                 static_cast<size_t>(options_.min_num_inliers);
+        });
+    std::sort(batch.begin(), guided_end,
+              [](const Input& data1, const Input& data2) {
+                return std::make_pair(data1.image_id1, data1.image_id2) <
+                       std::make_pair(data2.image_id1, data2.image_id2);
+              });
+
+    for (auto data = batch.begin(); data != guided_end; ++data) {
       const FeatureDescriptors* descriptors1_ptr;
       const FeatureKeypoints* keypoints1_ptr;
-      GetFeatureData(0, data.image_id1, &keypoints1_ptr, &descriptors1_ptr);
+      GetFeatureData(0, data->image_id1, &keypoints1_ptr, &descriptors1_ptr);
       const FeatureDescriptors* descriptors2_ptr;
       const FeatureKeypoints* keypoints2_ptr;
-      GetFeatureData(1, data.image_id2, &keypoints2_ptr, &descriptors2_ptr);
+      GetFeatureData(1, data->image_id2, &keypoints2_ptr, &descriptors2_ptr);
 
       MatchGuidedSiftFeaturesGPU(options_, keypoints1_ptr, keypoints2_ptr,
                                  descriptors1_ptr, descriptors2_ptr,
-                                 &sift_match_gpu, &data.two_view_geometry);
-
-      CHECK(output_queue_->Push(data));
+                                 &sift_match_gpu, &data->two_view_geometry);
     }
+
+    CHECK(output_queue_->PushBatch(batch.begin(), batch.end()));
   }
 }
 
@@ -531,7 +1084,7 @@ void GuidedSiftGPUFeatureMatcher::GetFeatureData(
 
 TwoViewGeometryVerifier::TwoViewGeometryVerifier(
     const SiftMatchingOptions& options, FeatureMatcherCache* cache,
-    JobQueue<Input>* input_queue, JobQueue<Output>* output_queue)
+    RingJobQueue<Input>* input_queue, RingJobQueue<Output>* output_queue)
     : options_(options),
       cache_(cache),
       input_queue_(input_queue),
@@ -546,9 +1099,20 @@ TwoViewGeometryVerifier::TwoViewGeometryVerifier(
       static_cast<size_t>(options_.max_num_trials);
   two_view_geometry_options_.ransac_options.min_inlier_ratio =
       options_.min_inlier_ratio;
+  two_view_geometry_options_.ransac_options.use_sprt = options_.use_sprt;
+  two_view_geometry_options_.joint_estimation = options_.joint_verification;
+  two_view_geometry_options_.max_num_models =
+      static_cast<size_t>(options_.max_num_models);
 }
 
 void TwoViewGeometryVerifier::Run() {
+#ifdef CUDA_ENABLED
+  if (options_.gpu_verification && !options_.multiple_models) {
+    CUDATwoViewHypothesisScorer scorer(std::stoi(options_.gpu_index));
+    RunBatched(&scorer);
+    return;
+  }
+#endif  // CUDA_ENABLED
 
   //std::cout << "THRAWN\n";
   /*std::unordered_set<std::string> fs;
@@ -612,31 +1176,198 @@ void TwoViewGeometryVerifier::Run() {
 		//int count1 = fs.count(cache_->GetImage(data.image_id1).Name());
 		//int count2 = fs.count(cache_->GetImage(data.image_id2).Name());
 		
-      	//if (options_.multiple_models)
-      	//if(1)
-      	/*{
-        	//std::cout << "MULTIMODEL VERIFICATION\n";
-        	data.two_view_geometry.EstimateMultiple(camera1, points1, camera2,
-                                                points2, data.matches,
-                                                two_view_geometry_options_);
-      	}*/
-      	//else
-      	{
-        	//std::cout << "SINGLEMODEL VERIFICATION\n";
-        	data.two_view_geometry.Estimate(camera1, points1, camera2, points2,
+      if (options_.multiple_models) {
+        data.two_view_geometry.EstimateMultipleMotions(
+            camera1, points1, camera2, points2, data.matches,
+            two_view_geometry_options_);
+      } else {
+        data.two_view_geometry.Estimate(camera1, points1, camera2, points2,
                                         data.matches,
                                         two_view_geometry_options_);
-      	}
+      }
 
       CHECK(output_queue_->Push(data));
     }
   }
 }
 
+void TwoViewGeometryVerifier::RunBatched(TwoViewHypothesisScorer* scorer) {
+  const size_t min_num_inliers =
+      static_cast<size_t>(options_.min_num_inliers);
+
+  std::vector<Input> batch;
+  std::vector<size_t> batch_idxs;
+  std::vector<std::vector<Eigen::Vector2d>> points1;
+  std::vector<std::vector<Eigen::Vector2d>> points2;
+  std::vector<TwoViewGeometryBatchItem> items;
+  std::vector<TwoViewGeometry> geometries;
+
+  while (true) {
+    if (IsStopped()) {
+      break;
+    }
+
+    batch.clear();
+    if (!input_queue_->PopBatch(
+            static_cast<size_t>(options_.verification_batch_size), &batch)) {
+      continue;
+    }
+
+    // The pairs with too few matches are passed on without verification.
+    batch_idxs.clear();
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (batch[i].matches.size() >= min_num_inliers) {
+        batch_idxs.push_back(i);
+      }
+    }
+
+    points1.resize(batch_idxs.size());
+    points2.resize(batch_idxs.size());
+    items.resize(batch_idxs.size());
+    for (size_t i = 0; i < batch_idxs.size(); ++i) {
+      const auto& data = batch[batch_idxs[i]];
+      points1[i] =
+          FeatureKeypointsToPointsVector(cache_->GetKeypoints(data.image_id1));
+      points2[i] =
+          FeatureKeypointsToPointsVector(cache_->GetKeypoints(data.image_id2));
+      items[i].camera1 =
+          &cache_->GetCamera(cache_->GetImage(data.image_id1).CameraId());
+      items[i].points1 = &points1[i];
+      items[i].camera2 =
+          &cache_->GetCamera(cache_->GetImage(data.image_id2).CameraId());
+      items[i].points2 = &points2[i];
+      items[i].matches = &data.matches;
+    }
+
+    EstimateTwoViewGeometries(items, two_view_geometry_options_, scorer,
+                              &geometries);
+
+    for (size_t i = 0; i < batch_idxs.size(); ++i) {
+      batch[batch_idxs[i]].two_view_geometry = std::move(geometries[i]);
+    }
+
+    CHECK(output_queue_->PushBatch(batch.begin(), batch.end()));
+  }
+}
+
+FeatureMatcherWriter::FeatureMatcherWriter(const SiftMatchingOptions& options,
+                                           Database* database,
+                                           FeatureMatcherCache* cache,
+                                           RingJobQueue<Input>* input_queue,
+                                           const FeatureCache* feature_cache)
+    : options_(options),
+      database_(database),
+      cache_(cache),
+      input_queue_(input_queue),
+      feature_cache_(feature_cache),
+      num_received_(0) {
+  CHECK(options_.Check());
+  CHECK_NOTNULL(database_);
+  CHECK_NOTNULL(cache_);
+}
+
+void FeatureMatcherWriter::AddPendingPair(const image_pair_t pair_id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  pending_pair_ids_.insert(pair_id);
+}
+
+bool FeatureMatcherWriter::IsPendingPair(const image_pair_t pair_id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return pending_pair_ids_.count(pair_id) > 0;
+}
+
+void FeatureMatcherWriter::WaitForNumReceived(const size_t num_received) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  received_condition_.wait(
+      lock, [this, num_received]() { return num_received_ >= num_received; });
+}
+
+void FeatureMatcherWriter::WaitForPendingPairs() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  written_condition_.wait(lock,
+                          [this]() { return pending_pair_ids_.empty(); });
+}
+
+size_t FeatureMatcherWriter::NumReceived() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return num_received_;
+}
+
+void FeatureMatcherWriter::Run() {
+  std::vector<Input> batch;
+  batch.reserve(kBatchSize);
+
+  while (true) {
+    if (IsStopped()) {
+      break;
+    }
+
+    // All results that are available are received at once.
+    const size_t num_batched = batch.size();
+    if (input_queue_->PopBatch(kBatchSize - num_batched, &batch)) {
+      // The batch is complete, if it is full or if the results of all pending
+      // image pairs have been received, i.e. no further result is expected.
+      bool batch_complete = batch.size() >= kBatchSize;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        num_received_ += batch.size() - num_batched;
+        batch_complete |= batch.size() >= pending_pair_ids_.size();
+      }
+      received_condition_.notify_all();
+
+      if (batch_complete) {
+        WriteBatch(&batch);
+      }
+    }
+  }
+}
+
+void FeatureMatcherWriter::WriteBatch(std::vector<Input>* batch) {
+  for (auto& data : *batch) {
+    if (data.matches.size() < static_cast<size_t>(options_.min_num_inliers)) {
+      data.matches = {};
+    }
+
+    if (data.two_view_geometry.inlier_matches.size() <
+        static_cast<size_t>(options_.min_num_inliers)) {
+      data.two_view_geometry = TwoViewGeometry();
+    }
+  }
+
+  {
+    DatabaseTransaction database_transaction(database_);
+    cache_->WriteMatchesAndInlierMatches(*batch);
+  }
+
+  if (feature_cache_) {
+    for (const auto& data : *batch) {
+      if (!data.feature_cache_key.empty()) {
+        feature_cache_->WriteMatches(data.feature_cache_key, data.matches,
+                                     data.two_view_geometry);
+      }
+    }
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (const auto& data : *batch) {
+      pending_pair_ids_.erase(
+          Database::ImagePairToPairId(data.image_id1, data.image_id2));
+    }
+  }
+  written_condition_.notify_all();
+
+  batch->clear();
+}
+
 SiftFeatureMatcher::SiftFeatureMatcher(const SiftMatchingOptions& options,
                                        Database* database,
                                        FeatureMatcherCache* cache)
-    : options_(options), database_(database), cache_(cache), is_setup_(false) {
+    : options_(options),
+      database_(database),
+      cache_(cache),
+      is_setup_(false),
+      output_queue_(4 * FeatureMatcherWriter::kBatchSize) {
   CHECK(options_.Check());
 
   const int num_threads = GetEffectiveNumThreads(options_.num_threads);
@@ -646,15 +1377,23 @@ SiftFeatureMatcher::SiftFeatureMatcher(const SiftMatchingOptions& options,
   CHECK_GT(gpu_indices.size(), 0);
 
 #ifdef CUDA_ENABLED
-  if (options_.use_gpu && gpu_indices.size() == 1 && gpu_indices[0] == -1) {
+  if ((options_.use_gpu || options_.gpu_verification) &&
+      gpu_indices.size() == 1 && gpu_indices[0] == -1) {
     const int num_cuda_devices = GetNumCudaDevices();
     CHECK_GT(num_cuda_devices, 0);
     gpu_indices.resize(num_cuda_devices);
     std::iota(gpu_indices.begin(), gpu_indices.end(), 0);
   }
+#else
+  if (options_.gpu_verification) {
+    std::cout << "WARNING: GPU verification requires CUDA, verifying on the "
+                 "CPU instead."
+              << std::endl;
+  }
 #endif  // CUDA_ENABLED
 
-  if (options_.use_gpu) {
+  // The descriptor codes are only matched on the CPU.
+  if (options_.use_gpu && !options_.use_descriptor_codes) {
     auto gpu_options = options_;
     matchers_.reserve(gpu_indices.size());
     for (const auto& gpu_index : gpu_indices) {
@@ -670,11 +1409,21 @@ SiftFeatureMatcher::SiftFeatureMatcher(const SiftMatchingOptions& options,
     }
   }
 
+  // The verifiers score their hypotheses on the GPUs in turn.
+  std::vector<SiftMatchingOptions> verifier_options(num_threads, options_);
+  if (options_.gpu_verification) {
+    for (int i = 0; i < num_threads; ++i) {
+      verifier_options[i].gpu_index =
+          std::to_string(gpu_indices[i % gpu_indices.size()]);
+    }
+  }
+
   verifiers_.reserve(num_threads);
   if (options_.guided_matching) {
     for (int i = 0; i < num_threads; ++i) {
       verifiers_.emplace_back(new TwoViewGeometryVerifier(
-          options_, cache, &verifier_queue_, &guided_matcher_queue_));
+          verifier_options[i], cache, &verifier_queue_,
+          &guided_matcher_queue_));
     }
 
     if (options_.use_gpu) {
@@ -698,9 +1447,18 @@ SiftFeatureMatcher::SiftFeatureMatcher(const SiftMatchingOptions& options,
     //to, co se tam cpe je TwoViewGeometryVerifier
     for (int i = 0; i < num_threads; ++i) {
       verifiers_.emplace_back(new TwoViewGeometryVerifier(
-          options_, cache, &verifier_queue_, &output_queue_));
+          verifier_options[i], cache, &verifier_queue_, &output_queue_));
     }
   }
+
+  // The descriptor codes are matched with the codebook of the database, which
+  // is not part of the cache key.
+  if (!options_.feature_cache_path.empty() && !options_.use_descriptor_codes) {
+    feature_cache_.reset(new FeatureCache(options_.feature_cache_path));
+  }
+
+  writer_.reset(new FeatureMatcherWriter(options_, database, cache,
+                                         &output_queue_, feature_cache_.get()));
 }
 
 SiftFeatureMatcher::~SiftFeatureMatcher() {
@@ -708,6 +1466,7 @@ SiftFeatureMatcher::~SiftFeatureMatcher() {
   verifier_queue_.Wait();
   guided_matcher_queue_.Wait();
   output_queue_.Wait();
+  writer_->WaitForPendingPairs();
 
   for (auto& matcher : matchers_) {
     matcher->Stop();
@@ -721,6 +1480,8 @@ SiftFeatureMatcher::~SiftFeatureMatcher() {
     guided_matcher->Stop();
   }
 
+  writer_->Stop();
+
   matcher_queue_.Stop();
   verifier_queue_.Stop();
   guided_matcher_queue_.Stop();
@@ -737,10 +1498,18 @@ SiftFeatureMatcher::~SiftFeatureMatcher() {
   for (auto& guided_matcher : guided_matchers_) {
     guided_matcher->Wait();
   }
+
+  writer_->Wait();
 }
 
 bool SiftFeatureMatcher::Setup() {
-  const int max_num_features = CHECK_NOTNULL(database_)->MaxNumDescriptors();
+  // Let the matcher threads load their features in parallel to each other and
+  // to the writer.
+  CHECK_NOTNULL(database_)->EnableReadConnectionPool();
+
+  const int max_num_features =
+      std::max(database_->MaxNumDescriptors(),
+               database_->MaxNumDescriptorCodes());
   options_.max_num_matches =
       std::min(options_.max_num_matches, max_num_features);
 
@@ -758,6 +1527,8 @@ bool SiftFeatureMatcher::Setup() {
     guided_matcher->Start();
   }
 
+  writer_->Start();
+
   for (auto& matcher : matchers_) {
     if (!matcher->CheckValidSetup()) {
       return false;
@@ -785,8 +1556,6 @@ void SiftFeatureMatcher::Match(
     return;
   }
 
-  DatabaseTransaction database_transaction(database_);
-
   //////////////////////////////////////////////////////////////////////////////
   // Match the image pairs
   //////////////////////////////////////////////////////////////////////////////
@@ -794,83 +1563,135 @@ void SiftFeatureMatcher::Match(
   std::unordered_set<image_pair_t> image_pair_ids;
   image_pair_ids.reserve(image_pairs.size());
 
+  const size_t num_received = writer_->NumReceived();
   size_t num_outputs = 0;
-  for (const auto image_pair : image_pairs) {
-    // Avoid self-matches.
-    if (image_pair.first == image_pair.second) {
-      continue;
-    }
 
-    // Avoid duplicate image pairs.
-    const image_pair_t pair_id =
-        Database::ImagePairToPairId(image_pair.first, image_pair.second);
-    if (image_pair_ids.count(pair_id) > 0) {
-      continue;
-    }
+  // The pairs to match, grouped by their first image.
+  const size_t kMaxGroupSize = 32;
+  std::vector<internal::FeatureMatcherDataGroup> groups;
+  std::unordered_map<image_t, size_t> group_idxs;
+
+  {
+    DatabaseTransaction database_transaction(database_);
+
+    for (const auto image_pair : image_pairs) {
+      // Avoid self-matches.
+      if (image_pair.first == image_pair.second) {
+        continue;
+      }
 
-    image_pair_ids.insert(pair_id);
+      // Avoid duplicate image pairs.
+      const image_pair_t pair_id =
+          Database::ImagePairToPairId(image_pair.first, image_pair.second);
+      if (image_pair_ids.count(pair_id) > 0) {
+        continue;
+      }
 
-    const bool exists_matches =
-        cache_->ExistsMatches(image_pair.first, image_pair.second);
-    const bool exists_inlier_matches =
-        cache_->ExistsInlierMatches(image_pair.first, image_pair.second);
+      image_pair_ids.insert(pair_id);
 
-    if (exists_matches && exists_inlier_matches) {
-      continue;
-    }
+      // The result of the pair from a previous batch is not yet written.
+      if (writer_->IsPendingPair(pair_id)) {
+        continue;
+      }
 
-    num_outputs += 1;
-    //THRAWN
-    //here should the matches be created
-    //std::cout << "TRUMP " << image_pair.first << " " << image_pair.second << "\n";
+      const bool exists_matches =
+          cache_->ExistsMatches(image_pair.first, image_pair.second);
+      const bool exists_inlier_matches =
+          cache_->ExistsInlierMatches(image_pair.first, image_pair.second);
 
-    // If only one of the matches or inlier matches exist, we recompute them
-    // from scratch and delete the existing results. This must be done before
-    // pushing the jobs to the queue, otherwise database constraints might fail
-    // when writing an existing result into the database.
+      if (exists_matches && exists_inlier_matches) {
+        continue;
+      }
 
-    if (exists_inlier_matches) {
-      cache_->DeleteInlierMatches(image_pair.first, image_pair.second);
-    }
+      num_outputs += 1;
+      //THRAWN
+      //here should the matches be created
+      //std::cout << "TRUMP " << image_pair.first << " " << image_pair.second << "\n";
 
-    internal::FeatureMatcherData data;
-    data.image_id1 = image_pair.first;
-    data.image_id2 = image_pair.second;
+      // If only one of the matches or inlier matches exist, we recompute them
+      // from scratch and delete the existing results. This must be done
+      // before pushing the jobs to the queue, otherwise database constraints
+      // might fail when writing an existing result into the database.
 
-    if (exists_matches) {
-      data.matches = cache_->GetMatches(image_pair.first, image_pair.second);
-      cache_->DeleteMatches(image_pair.first, image_pair.second);
-      CHECK(verifier_queue_.Push(data));
-    } else {
-      //tady se to cpe do nejake queue, kterou potom obsluhuje jine vlakno
-      CHECK(matcher_queue_.Push(data));
+      if (exists_inlier_matches) {
+        cache_->DeleteInlierMatches(image_pair.first, image_pair.second);
+      }
+
+      internal::FeatureMatcherData data;
+      data.image_id1 = image_pair.first;
+      data.image_id2 = image_pair.second;
+
+      writer_->AddPendingPair(pair_id);
+
+      // Pairs with cached results are passed to the writer directly.
+      if (feature_cache_ && !exists_matches) {
+        data.feature_cache_key =
+            ImagePairCacheKey(image_pair.first, image_pair.second);
+        if (feature_cache_->ReadMatches(data.feature_cache_key, &data.matches,
+                                        &data.two_view_geometry)) {
+          data.feature_cache_key.clear();
+          CHECK(output_queue_.Push(data));
+          continue;
+        }
+      }
+
+      if (exists_matches) {
+        data.matches = cache_->GetMatches(image_pair.first, image_pair.second);
+        cache_->DeleteMatches(image_pair.first, image_pair.second);
+        CHECK(verifier_queue_.Push(data));
+      } else {
+        //tady se to cpe do nejake queue, kterou potom obsluhuje jine vlakno
+        const auto group_idx =
+            group_idxs.emplace(image_pair.first, groups.size());
+        if (group_idx.second) {
+          groups.emplace_back();
+        }
+        groups[group_idx.first->second].push_back(data);
+      }
+    }
+  }
+
+  // Match the pairs with the same first image one-vs-many in the order of
+  // their first occurrence. Large groups are split, such that all matchers
+  // share the work of a batch with few distinct first images.
+  for (const auto& group : groups) {
+    for (size_t begin = 0; begin < group.size(); begin += kMaxGroupSize) {
+      const size_t end = std::min(group.size(), begin + kMaxGroupSize);
+      CHECK(matcher_queue_.Push(internal::FeatureMatcherDataGroup(
+          group.begin() + begin, group.begin() + end)));
     }
   }
 
   //////////////////////////////////////////////////////////////////////////////
-  // Write results to database
+  // Wait for the results
   //////////////////////////////////////////////////////////////////////////////
 
-  for (size_t i = 0; i < num_outputs; ++i) {
-    const auto output_job = output_queue_.Pop();
-    CHECK(output_job.IsValid());
-    auto output = output_job.Data();
+  // The results are written to the database by the writer, which may still
+  // write the last results of this batch, while the next one is prepared.
+  writer_->WaitForNumReceived(num_received + num_outputs);
 
-    if (output.matches.size() < static_cast<size_t>(options_.min_num_inliers)) {
-      output.matches = {};
-    }
+  CHECK_EQ(output_queue_.Size(), 0);
+}
 
-    if (output.two_view_geometry.inlier_matches.size() <
-        static_cast<size_t>(options_.min_num_inliers)) {
-      output.two_view_geometry = TwoViewGeometry();
+std::string SiftFeatureMatcher::ImagePairCacheKey(const image_t image_id1,
+                                                  const image_t image_id2) {
+  std::array<std::string, 2> matching_input_keys;
+  for (int i = 0; i < 2; ++i) {
+    const image_t image_id = i == 0 ? image_id1 : image_id2;
+    auto it = matching_input_keys_.find(image_id);
+    if (it == matching_input_keys_.end()) {
+      const Image& image = cache_->GetImage(image_id);
+      it = matching_input_keys_
+               .emplace(image_id, FeatureCache::MatchingInputKey(
+                                      cache_->GetCamera(image.CameraId()),
+                                      cache_->GetKeypoints(image_id),
+                                      cache_->GetDescriptors(image_id)))
+               .first;
     }
-
-    cache_->WriteMatches(output.image_id1, output.image_id2, output.matches);
-    cache_->WriteInlierMatches(output.image_id1, output.image_id2,
-                               output.two_view_geometry);
+    matching_input_keys[i] = it->second;
   }
-
-  CHECK_EQ(output_queue_.Size(), 0);
+  return FeatureCache::ImagePairKey(matching_input_keys[0],
+                                    matching_input_keys[1], options_);
 }
 
 ExhaustiveFeatureMatcher::ExhaustiveFeatureMatcher(
@@ -879,7 +1700,9 @@ ExhaustiveFeatureMatcher::ExhaustiveFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(5 * options_.block_size, &database_),
+      cache_(5 * options_.block_size, &database_,
+             match_options_.descriptor_cache_size,
+             match_options_.descriptor_store_path),
       matcher_(match_options, &database_, &cache_) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
@@ -887,7 +1710,6 @@ ExhaustiveFeatureMatcher::ExhaustiveFeatureMatcher(
 
 void ExhaustiveFeatureMatcher::Run() {
   PrintHeading1("Exhaustive feature matching");
-  //std::cout << "THRAWN IST MACHTIG\n";
 
   if (!matcher_.Setup()) {
     return;
@@ -895,61 +1717,133 @@ void ExhaustiveFeatureMatcher::Run() {
 
   cache_.Setup();
 
-  const std::vector<image_t> image_ids = cache_.GetImageIds();
+  if (options_.takes_path.empty()) {
+    RunBlockMatching(cache_.GetImageIds());
+  } else {
+    RunTakeMatching();
+  }
+
+  GetTimer().PrintMinutes();
+}
 
+void ExhaustiveFeatureMatcher::RunBlockMatching(
+    const std::vector<image_t>& image_ids) {
   const size_t block_size = static_cast<size_t>(options_.block_size);
   const size_t num_blocks = static_cast<size_t>(
       std::ceil(static_cast<double>(image_ids.size()) / block_size));
   const size_t num_pairs_per_block = block_size * (block_size - 1) / 2;
 
+  // The blocks are visited along a Hilbert curve instead of row by row, so
+  // that consecutive blocks share the images of a row or a column and the
+  // cache of 5 * block_size images mostly still holds the images of nearby
+  // blocks, rather than reloading all columns for every row.
+  const std::vector<std::pair<size_t, size_t>> blocks =
+      OrderGridCellsAlongHilbertCurve(num_blocks);
+
+  const auto GetBlockImageIds = [&](const size_t block_idx) {
+    std::vector<image_t> block_image_ids;
+    block_image_ids.reserve(2 * block_size);
+    for (const size_t block : {blocks[block_idx].first,
+                               blocks[block_idx].second}) {
+      const size_t start_idx = block * block_size;
+      const size_t end_idx =
+          std::min(image_ids.size(), start_idx + block_size);
+      block_image_ids.insert(block_image_ids.end(),
+                             image_ids.begin() + start_idx,
+                             image_ids.begin() + end_idx);
+    }
+    return block_image_ids;
+  };
+
+  // The features of the next block are read in the background, while the
+  // current block is matched. The cache holds the images of both blocks.
+  ThreadPool prefetch_thread_pool(1);
+  std::future<void> prefetch_future;
+
   std::vector<std::pair<image_t, image_t>> image_pairs;
   image_pairs.reserve(num_pairs_per_block);
 
-  for (size_t start_idx1 = 0; start_idx1 < image_ids.size();
-       start_idx1 += block_size) {
+  for (size_t block_idx = 0; block_idx < blocks.size(); ++block_idx) {
+    if (prefetch_future.valid()) {
+      prefetch_future.get();
+    }
+
+    if (IsStopped()) {
+      return;
+    }
+
+    if (block_idx + 1 < blocks.size()) {
+      prefetch_future = prefetch_thread_pool.AddTask(
+          [this](const std::vector<image_t>& next_image_ids) {
+            cache_.Prefetch(next_image_ids);
+          },
+          GetBlockImageIds(block_idx + 1));
+    }
+
+    const size_t start_idx1 = blocks[block_idx].first * block_size;
     const size_t end_idx1 =
         std::min(image_ids.size(), start_idx1 + block_size) - 1;
-    for (size_t start_idx2 = 0; start_idx2 < image_ids.size();
-         start_idx2 += block_size) {
-      const size_t end_idx2 =
-          std::min(image_ids.size(), start_idx2 + block_size) - 1;
-
-      if (IsStopped()) {
-        GetTimer().PrintMinutes();
-        return;
-      }
+    const size_t start_idx2 = blocks[block_idx].second * block_size;
+    const size_t end_idx2 =
+        std::min(image_ids.size(), start_idx2 + block_size) - 1;
 
-      Timer timer;
-      timer.Start();
-
-      std::cout << StringPrintf("Matching block [%d/%d, %d/%d]",
-                                start_idx1 / block_size + 1, num_blocks,
-                                start_idx2 / block_size + 1, num_blocks)
-                << std::flush;
-
-      image_pairs.clear();
-      for (size_t idx1 = start_idx1; idx1 <= end_idx1; ++idx1) {
-        for (size_t idx2 = start_idx2; idx2 <= end_idx2; ++idx2) {
-        	//std::cout << "THRAWN " << idx1 << " " << idx2 << "\n";
-          const size_t block_id1 = idx1 % block_size;
-          const size_t block_id2 = idx2 % block_size;
-          if ((idx1 > idx2 && block_id1 <= block_id2) ||
-              (idx1 < idx2 &&
-               block_id1 < block_id2)) {  // Avoid duplicate pairs
-            image_pairs.emplace_back(image_ids[idx1], image_ids[idx2]);
-          }
+    Timer timer;
+    timer.Start();
+
+    std::cout << StringPrintf("Matching block [%d/%d, %d/%d]",
+                              start_idx1 / block_size + 1, num_blocks,
+                              start_idx2 / block_size + 1, num_blocks)
+              << std::flush;
+
+    image_pairs.clear();
+    for (size_t idx1 = start_idx1; idx1 <= end_idx1; ++idx1) {
+      for (size_t idx2 = start_idx2; idx2 <= end_idx2; ++idx2) {
+        const size_t block_id1 = idx1 % block_size;
+        const size_t block_id2 = idx2 % block_size;
+        if ((idx1 > idx2 && block_id1 <= block_id2) ||
+            (idx1 < idx2 && block_id1 < block_id2)) {  // Avoid duplicate pairs
+          image_pairs.emplace_back(image_ids[idx1], image_ids[idx2]);
         }
       }
+    }
 
-	//THRAWN
-	//everything interesting happens directly here in this function
-      matcher_.Match(image_pairs);
+    matcher_.Match(image_pairs);
 
-      PrintElapsedTime(timer);
+    PrintElapsedTime(timer);
+  }
+
+  if (prefetch_future.valid()) {
+    prefetch_future.get();
+  }
+}
+
+void ExhaustiveFeatureMatcher::RunTakeMatching() {
+  const std::vector<std::vector<image_t>> takes =
+      ReadImageTakes(options_.takes_path, cache_);
+
+  // All pairs within every take.
+  for (size_t take_idx = 0; take_idx < takes.size(); ++take_idx) {
+    std::cout << StringPrintf("Matching take [%d/%d]", take_idx + 1,
+                              takes.size())
+              << std::endl;
+    RunBlockMatching(takes[take_idx]);
+    if (IsStopped()) {
+      return;
     }
   }
 
-  GetTimer().PrintMinutes();
+  const std::vector<std::pair<image_t, image_t>> cross_take_pairs =
+      FindCrossTakePairs(takes, options_.num_cross_take_images,
+                         options_.vocab_tree_path, match_options_.num_threads,
+                         this, &cache_);
+  if (IsStopped()) {
+    return;
+  }
+
+  MatchCrossTakePairs(cross_take_pairs,
+                      static_cast<size_t>(options_.block_size) *
+                          options_.block_size,
+                      this, &matcher_);
 }
 
 SequentialFeatureMatcher::SequentialFeatureMatcher(
@@ -958,9 +1852,11 @@ SequentialFeatureMatcher::SequentialFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(std::max(5 * options_.loop_detection_num_images,
-                      5 * options_.overlap),
-             &database_),
+      cache_(std::max({5 * options_.loop_detection_num_images,
+                       5 * options_.overlap,
+                       5 * options_.num_cross_take_images}),
+             &database_, match_options_.descriptor_cache_size,
+             match_options_.descriptor_store_path),
       matcher_(match_options, &database_, &cache_) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
@@ -977,7 +1873,14 @@ void SequentialFeatureMatcher::Run() {
 
   const std::vector<image_t> ordered_image_ids = GetOrderedImageIds();
 
-  RunSequentialMatching(ordered_image_ids);
+  if (options_.takes_path.empty()) {
+    RunSequentialMatching(ordered_image_ids);
+  } else {
+    RunTakeMatching();
+  }
+  if (IsStopped()) {
+    return;
+  }
   if (options_.loop_detection) {
     RunLoopDetection(ordered_image_ids);
   }
@@ -1050,6 +1953,35 @@ void SequentialFeatureMatcher::RunSequentialMatching(
   }
 }
 
+void SequentialFeatureMatcher::RunTakeMatching() {
+  const std::vector<std::vector<image_t>> takes =
+      ReadImageTakes(options_.takes_path, cache_);
+
+  // The images of a take are a continuous capture, so they are matched
+  // sequentially within their take.
+  for (size_t take_idx = 0; take_idx < takes.size(); ++take_idx) {
+    std::cout << StringPrintf("Matching take [%d/%d]", take_idx + 1,
+                              takes.size())
+              << std::endl;
+    RunSequentialMatching(takes[take_idx]);
+    if (IsStopped()) {
+      return;
+    }
+  }
+
+  const std::vector<std::pair<image_t, image_t>> cross_take_pairs =
+      FindCrossTakePairs(takes, options_.num_cross_take_images,
+                         options_.vocab_tree_path, match_options_.num_threads,
+                         this, &cache_);
+  if (IsStopped()) {
+    return;
+  }
+
+  // The same batch size as for the default blocks of the exhaustive matcher.
+  const size_t kCrossTakeBatchSize = 50 * 50;
+  MatchCrossTakePairs(cross_take_pairs, kCrossTakeBatchSize, this, &matcher_);
+}
+
 void SequentialFeatureMatcher::RunLoopDetection(
     const std::vector<image_t>& image_ids) {
   // Read the pre-trained vocabulary tree from disk.
@@ -1088,7 +2020,9 @@ VocabTreeFeatureMatcher::VocabTreeFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(5 * options_.num_images, &database_),
+      cache_(5 * options_.num_images, &database_,
+             match_options_.descriptor_cache_size,
+             match_options_.descriptor_store_path),
       matcher_(match_options, &database_, &cache_) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
@@ -1165,7 +2099,9 @@ SpatialFeatureMatcher::SpatialFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(5 * options_.max_num_neighbors, &database_),
+      cache_(5 * options_.max_num_neighbors, &database_,
+             match_options_.descriptor_cache_size,
+             match_options_.descriptor_store_path),
       matcher_(match_options, &database_, &cache_) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
@@ -1256,8 +2192,10 @@ void SpatialFeatureMatcher::Run() {
   flann::Matrix<float> locations(location_matrix.data(), num_locations,
                                  location_matrix.cols());
 
-  flann::LinearIndexParams index_params;
-  flann::LinearIndex<flann::L2<float>> search_index(index_params);
+  // The neighbors are exact, as with a linear search, but the tree answers a
+  // query in logarithmic instead of linear time in the number of images.
+  flann::KDTreeSingleIndexParams index_params;
+  flann::KDTreeSingleIndex<flann::L2<float>> search_index(index_params);
   search_index.buildIndex(locations);
 
   PrintElapsedTime(timer);
@@ -1280,15 +2218,9 @@ void SpatialFeatureMatcher::Run() {
       distance_matrix(num_locations, knn);
   flann::Matrix<float> distances(distance_matrix.data(), num_locations, knn);
 
-  flann::SearchParams search_params(flann::FLANN_CHECKS_AUTOTUNED);
-  if (match_options_.num_threads == ThreadPool::kMaxNumThreads) {
-    search_params.cores = std::thread::hardware_concurrency();
-  } else {
-    search_params.cores = match_options_.num_threads;
-  }
-  if (search_params.cores <= 0) {
-    search_params.cores = 1;
-  }
+  // All images are queried in one batch on all threads.
+  flann::SearchParams search_params(flann::FLANN_CHECKS_UNLIMITED);
+  search_params.cores = GetEffectiveNumThreads(match_options_.num_threads);
 
   search_index.knnSearch(locations, indices, distances, knn, search_params);
 
@@ -1301,19 +2233,43 @@ void SpatialFeatureMatcher::Run() {
   const float max_distance =
       static_cast<float>(options_.max_distance * options_.max_distance);
 
+  // The images are visited in the order of a space-filling curve, so that
+  // consecutive images have mostly the same neighbors. Their pairs are matched
+  // in blocks of at most as many images as the cache holds, such that the
+  // features of every image are read once per block and mostly stay cached
+  // for the next block.
+  const std::vector<size_t> location_order =
+      OrderLocationsSpatially(location_matrix.topRows(num_locations));
+
+  const size_t max_num_block_images = 5 * options_.max_num_neighbors;
+
+  std::unordered_set<image_pair_t> image_pair_ids;
+  std::unordered_set<image_t> block_image_ids;
+  std::vector<std::pair<image_t, image_t>> block_image_pairs;
   std::vector<std::pair<image_t, image_t>> image_pairs;
-  image_pairs.reserve(knn);
+  size_t num_block_locations = 0;
 
-  for (size_t i = 0; i < num_locations; ++i) {
+  const auto MatchBlock = [&](const size_t num_matched_locations) {
+    timer.Restart();
+    std::cout << StringPrintf("Matching images [%d/%d] (%d pairs)",
+                              num_matched_locations, num_locations,
+                              block_image_pairs.size())
+              << std::flush;
+    matcher_.Match(block_image_pairs);
+    PrintElapsedTime(timer);
+    block_image_ids.clear();
+    block_image_pairs.clear();
+    num_block_locations = 0;
+  };
+
+  for (size_t k = 0; k < num_locations; ++k) {
     if (IsStopped()) {
       GetTimer().PrintMinutes();
       return;
     }
 
-    timer.Restart();
-
-    std::cout << StringPrintf("Matching image [%d/%d]", i + 1, num_locations)
-              << std::flush;
+    const size_t i = location_order[k];
+    const image_t image_id = image_ids.at(location_idxs[i]);
 
     image_pairs.clear();
 
@@ -1328,16 +2284,38 @@ void SpatialFeatureMatcher::Run() {
         break;
       }
 
-      const size_t idx = location_idxs[i];
-      const image_t image_id = image_ids.at(idx);
       const size_t nn_idx = location_idxs.at(index_matrix(i, j));
       const image_t nn_image_id = image_ids.at(nn_idx);
-      image_pairs.emplace_back(image_id, nn_image_id);
+
+      // Mutual neighbors are only matched once.
+      if (image_pair_ids
+              .insert(Database::ImagePairToPairId(image_id, nn_image_id))
+              .second) {
+        image_pairs.emplace_back(image_id, nn_image_id);
+      }
     }
 
-    matcher_.Match(image_pairs);
+    // Count the images, which this image adds to the block.
+    size_t num_new_images = block_image_ids.count(image_id) == 0 ? 1 : 0;
+    for (const auto& image_pair : image_pairs) {
+      num_new_images += block_image_ids.count(image_pair.second) == 0 ? 1 : 0;
+    }
 
-    PrintElapsedTime(timer);
+    if (num_block_locations > 0 &&
+        block_image_ids.size() + num_new_images > max_num_block_images) {
+      MatchBlock(k);
+    }
+
+    block_image_ids.insert(image_id);
+    for (const auto& image_pair : image_pairs) {
+      block_image_ids.insert(image_pair.second);
+      block_image_pairs.push_back(image_pair);
+    }
+    num_block_locations += 1;
+  }
+
+  if (num_block_locations > 0) {
+    MatchBlock(num_locations);
   }
 
   GetTimer().PrintMinutes();
@@ -1349,7 +2327,9 @@ TransitiveFeatureMatcher::TransitiveFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(options_.batch_size, &database_),
+      cache_(options_.batch_size, &database_,
+             match_options_.descriptor_cache_size,
+             match_options_.descriptor_store_path),
       matcher_(match_options, &database_, &cache_) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
@@ -1445,7 +2425,9 @@ ImagePairsFeatureMatcher::ImagePairsFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(options.block_size, &database_),
+      cache_(options.block_size, &database_,
+             match_options_.descriptor_cache_size,
+             match_options_.descriptor_store_path),
       matcher_(match_options, &database_, &cache_) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
@@ -1552,7 +2534,9 @@ FeaturePairsFeatureMatcher::FeaturePairsFeatureMatcher(
     : options_(options),
       match_options_(match_options),
       database_(database_path),
-      cache_(kCacheSize, &database_) {
+      cache_(kCacheSize, &database_,
+             match_options_.descriptor_cache_size,
+             match_options_.descriptor_store_path) {
   CHECK(options_.Check());
   CHECK(match_options_.Check());
 }
@@ -1569,125 +2553,124 @@ void FeaturePairsFeatureMatcher::Run() {
     image_name_to_image.emplace(image.Name(), &image);
   }
 
-  std::ifstream file(options_.match_list_path);
+  const bool is_binary = HasFileExtension(options_.match_list_path, ".bin");
+  std::ifstream file(options_.match_list_path, std::ios::binary);
   CHECK(file.is_open()) << options_.match_list_path;
 
-  std::string line;
-  while (std::getline(file, line)) {
+  TwoViewGeometry::Options two_view_geometry_options;
+  two_view_geometry_options.min_num_inliers =
+      static_cast<size_t>(match_options_.min_num_inliers);
+  two_view_geometry_options.ransac_options.max_error = match_options_.max_error;
+  two_view_geometry_options.ransac_options.confidence =
+      match_options_.confidence;
+  two_view_geometry_options.ransac_options.max_num_trials =
+      static_cast<size_t>(match_options_.max_num_trials);
+  two_view_geometry_options.ransac_options.min_inlier_ratio =
+      match_options_.min_inlier_ratio;
+  two_view_geometry_options.ransac_options.use_sprt = match_options_.use_sprt;
+  two_view_geometry_options.joint_estimation =
+      match_options_.joint_verification;
+
+  ThreadPool thread_pool(match_options_.num_threads);
+
+  std::vector<internal::FeatureMatcherData> batch;
+  std::unordered_set<image_pair_t> batch_pair_ids;
+  bool end_of_list = false;
+  while (!end_of_list) {
     if (IsStopped()) {
       GetTimer().PrintMinutes();
       return;
     }
 
-    StringTrim(&line);
-    if (line.empty()) {
-      continue;
-    }
-
-    std::istringstream line_stream(line);
-
-    std::string image_name1, image_name2;
-    try {
-      line_stream >> image_name1 >> image_name2;
-    } catch (...) {
-      std::cerr << "ERROR: Could not read image pair." << std::endl;
-      break;
-    }
-
-    std::cout << StringPrintf("%s - %s", image_name1.c_str(),
-                              image_name2.c_str())
-              << std::endl;
+    // Read the pairs of the batch, whose matches are then verified in parallel
+    // and written in a single transaction.
+    batch.clear();
+    batch_pair_ids.clear();
+    while (batch.size() < kBatchSize) {
+      std::string image_name1, image_name2;
+      FeatureMatches matches;
+      if (!(is_binary ? ReadNextBinaryMatches(&file, &image_name1,
+                                              &image_name2, &matches)
+                      : ReadNextTextMatches(&file, &image_name1, &image_name2,
+                                            &matches))) {
+        end_of_list = true;
+        break;
+      }
 
-    if (image_name_to_image.count(image_name1) == 0) {
-      std::cout << StringPrintf("SKIP: Image %s not found in database.",
-                                image_name1.c_str())
-                << std::endl;
-      break;
-    }
-    if (image_name_to_image.count(image_name2) == 0) {
-      std::cout << StringPrintf("SKIP: Image %s not found in database.",
+      std::cout << StringPrintf("%s - %s", image_name1.c_str(),
                                 image_name2.c_str())
                 << std::endl;
-      break;
-    }
-
-    const Image& image1 = *image_name_to_image[image_name1];
-    const Image& image2 = *image_name_to_image[image_name2];
 
-    bool skip_pair = false;
-    if (database_.ExistsInlierMatches(image1.ImageId(), image2.ImageId())) {
-      std::cout << "SKIP: Matches for image pair already exist in database."
-                << std::endl;
-      skip_pair = true;
-    }
-
-    FeatureMatches matches;
-    while (std::getline(file, line)) {
-      StringTrim(&line);
-
-      if (line.empty()) {
+      if (image_name_to_image.count(image_name1) == 0) {
+        std::cout << StringPrintf("SKIP: Image %s not found in database.",
+                                  image_name1.c_str())
+                  << std::endl;
+        end_of_list = true;
         break;
       }
-
-      std::istringstream line_stream(line);
-
-      FeatureMatch match;
-      try {
-        line_stream >> match.point2D_idx1 >> match.point2D_idx2;
-      } catch (...) {
-        std::cerr << "ERROR: Cannot read feature matches." << std::endl;
+      if (image_name_to_image.count(image_name2) == 0) {
+        std::cout << StringPrintf("SKIP: Image %s not found in database.",
+                                  image_name2.c_str())
+                  << std::endl;
+        end_of_list = true;
         break;
       }
 
-      matches.push_back(match);
-    }
+      const Image& image1 = *image_name_to_image[image_name1];
+      const Image& image2 = *image_name_to_image[image_name2];
 
-    if (skip_pair) {
-      continue;
-    }
-
-    const Camera& camera1 = cache_.GetCamera(image1.CameraId());
-    const Camera& camera2 = cache_.GetCamera(image2.CameraId());
-
-    if (options_.verify_matches) {
-      database_.WriteMatches(image1.ImageId(), image2.ImageId(), matches);
-
-      const auto keypoints1 = cache_.GetKeypoints(image1.ImageId());
-      const auto keypoints2 = cache_.GetKeypoints(image2.ImageId());
-
-      TwoViewGeometry two_view_geometry;
-      TwoViewGeometry::Options two_view_geometry_options;
-      two_view_geometry_options.min_num_inliers =
-          static_cast<size_t>(match_options_.min_num_inliers);
-      two_view_geometry_options.ransac_options.max_error =
-          match_options_.max_error;
-      two_view_geometry_options.ransac_options.confidence =
-          match_options_.confidence;
-      two_view_geometry_options.ransac_options.max_num_trials =
-          static_cast<size_t>(match_options_.max_num_trials);
-      two_view_geometry_options.ransac_options.min_inlier_ratio =
-          match_options_.min_inlier_ratio;
-
-      two_view_geometry.Estimate(
-          camera1, FeatureKeypointsToPointsVector(keypoints1), camera2,
-          FeatureKeypointsToPointsVector(keypoints2), matches,
-          two_view_geometry_options);
+      const image_pair_t pair_id =
+          Database::ImagePairToPairId(image1.ImageId(), image2.ImageId());
+      if (batch_pair_ids.count(pair_id) > 0 ||
+          database_.ExistsInlierMatches(image1.ImageId(), image2.ImageId())) {
+        std::cout << "SKIP: Matches for image pair already exist in database."
+                  << std::endl;
+        continue;
+      }
 
-      database_.WriteInlierMatches(image1.ImageId(), image2.ImageId(),
-                                   two_view_geometry);
-    } else {
-      TwoViewGeometry two_view_geometry;
+      batch_pair_ids.insert(pair_id);
+      batch.emplace_back();
+      batch.back().image_id1 = image1.ImageId();
+      batch.back().image_id2 = image2.ImageId();
+      batch.back().matches = std::move(matches);
+    }
 
-      if (camera1.HasPriorFocalLength() && camera2.HasPriorFocalLength()) {
-        two_view_geometry.config = TwoViewGeometry::CALIBRATED;
+    for (auto& data : batch) {
+      const Camera& camera1 =
+          cache_.GetCamera(cache_.GetImage(data.image_id1).CameraId());
+      const Camera& camera2 =
+          cache_.GetCamera(cache_.GetImage(data.image_id2).CameraId());
+
+      if (options_.verify_matches) {
+        internal::FeatureMatcherData* data_ptr = &data;
+        thread_pool.AddTask([this, data_ptr, camera1, camera2,
+                             &two_view_geometry_options]() {
+          const auto keypoints1 = cache_.GetKeypoints(data_ptr->image_id1);
+          const auto keypoints2 = cache_.GetKeypoints(data_ptr->image_id2);
+          data_ptr->two_view_geometry.Estimate(
+              camera1, FeatureKeypointsToPointsVector(keypoints1), camera2,
+              FeatureKeypointsToPointsVector(keypoints2), data_ptr->matches,
+              two_view_geometry_options);
+        });
       } else {
-        two_view_geometry.config = TwoViewGeometry::UNCALIBRATED;
+        if (camera1.HasPriorFocalLength() && camera2.HasPriorFocalLength()) {
+          data.two_view_geometry.config = TwoViewGeometry::CALIBRATED;
+        } else {
+          data.two_view_geometry.config = TwoViewGeometry::UNCALIBRATED;
+        }
+        data.two_view_geometry.inlier_matches = data.matches;
       }
+    }
 
-      two_view_geometry.inlier_matches = matches;
+    thread_pool.Wait();
 
-      database_.WriteInlierMatches(image1.ImageId(), image2.ImageId(),
-                                   two_view_geometry);
+    DatabaseTransaction database_transaction(&database_);
+    for (const auto& data : batch) {
+      if (options_.verify_matches) {
+        database_.WriteMatches(data.image_id1, data.image_id2, data.matches);
+      }
+      database_.WriteInlierMatches(data.image_id1, data.image_id2,
+                                   data.two_view_geometry);
     }
   }
 
@@ -18,13 +18,22 @@
 #define COLMAP_SRC_FEATURE_MATCHING_H_
 
 #include <array>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "base/database.h"
+#include "estimators/two_view_geometry_batch.h"
+#include "feature/descriptor_store.h"
+#include "feature/feature_cache.h"
+#include "feature/quantization.h"
 #include "feature/sift.h"
 #include "util/alignment.h"
 #include "util/cache.h"
+#include "util/memory_governor.h"
 #include "util/opengl_utils.h"
 #include "util/threading.h"
 #include "util/timer.h"
@@ -35,6 +44,22 @@ struct ExhaustiveMatchingOptions {
   // Block size, i.e. number of images to simultaneously load into memory.
   int block_size = 50;
 
+  // Optional path to the file with the take of every image, as written by the
+  // preprocessor. If given, all pairs of images in the same take are matched,
+  // but every image is only matched against `num_cross_take_images` images
+  // of the other takes.
+  std::string takes_path = "";
+
+  // The number of images of other takes to match every image against. These
+  // are the most similar ones according to the vocabulary tree at
+  // `vocab_tree_path` if given and otherwise the ones at the closest relative
+  // time within their take. With -1, all images of the other takes are
+  // matched.
+  int num_cross_take_images = 20;
+
+  // Optional path to the vocabulary tree to select the cross-take pairs.
+  std::string vocab_tree_path = "";
+
   bool Check() const;
 };
 
@@ -69,7 +94,21 @@ struct SequentialMatchingOptions {
   // image has more features, only the largest-scale features will be indexed.
   int loop_detection_max_num_features = -1;
 
-  // Path to the vocabulary tree.
+  // Optional path to the file with the take of every image, as written by the
+  // preprocessor. If given, the images are matched sequentially within their
+  // take, but every image is only matched against `num_cross_take_images`
+  // images of the other takes.
+  std::string takes_path = "";
+
+  // The number of images of other takes to match every image against. These
+  // are the most similar ones according to the vocabulary tree at
+  // `vocab_tree_path` if given and otherwise the ones at the closest relative
+  // time within their take. With -1, all images of the other takes are
+  // matched.
+  int num_cross_take_images = 20;
+
+  // Path to the vocabulary tree, which is used for loop detection and to
+  // select the cross-take pairs.
   std::string vocab_tree_path = "";
 
   bool Check() const;
@@ -157,24 +196,52 @@ struct FeatureMatcherData {
   image_t image_id2 = kInvalidImageId;
   FeatureMatches matches;
   TwoViewGeometry two_view_geometry;
+  // The key under which the results are added to the feature cache, if any.
+  std::string feature_cache_key;
 };
 
+// Image pairs with the same first image, which are matched one-vs-many, such
+// that the descriptors of the first image are fetched and uploaded only once.
+typedef std::vector<FeatureMatcherData> FeatureMatcherDataGroup;
+
 }  // namespace internal
 
 // Cache for feature matching to minimize database access during matching.
+// The descriptors are cached for `cache_size` images or, if
+// `descriptor_cache_size` in gigabytes is positive, for as many images as fit
+// into this budget. If a descriptor store path is given, the descriptors are
+// read from the memory-mapped store instead of the database. If the database
+// has a descriptor codebook, the descriptor codes are cached as well and the
+// descriptors of images without descriptors are decoded from their codes. With
+// a process memory budget, the descriptors are cached by their size up to the
+// budget, unless `descriptor_cache_size` is given, and the cache is shrunk by
+// the memory governor under memory pressure.
 class FeatureMatcherCache {
  public:
-  FeatureMatcherCache(const size_t cache_size, const Database* database);
+  FeatureMatcherCache(const size_t cache_size, const Database* database,
+                      const double descriptor_cache_size = 0.0,
+                      const std::string& descriptor_store_path = "");
 
   void Setup();
 
   const Camera& GetCamera(const camera_t camera_id) const;
   const Image& GetImage(const image_t image_id) const;
-  const FeatureKeypoints& GetKeypoints(const image_t image_id);
-  const FeatureDescriptors& GetDescriptors(const image_t image_id);
+  // The features are returned as copies, since the cache is accessed
+  // concurrently and other threads may evict them at any time.
+  FeatureKeypoints GetKeypoints(const image_t image_id);
+  FeatureDescriptors GetDescriptors(const image_t image_id);
+  FeatureDescriptorCodes GetDescriptorCodes(const image_t image_id);
   FeatureMatches GetMatches(const image_t image_id1, const image_t image_id2);
   std::vector<image_t> GetImageIds() const;
 
+  // Read the keypoints and descriptors of the images into the cache, e.g. in
+  // the background, while the previously loaded images are being matched.
+  void Prefetch(const std::vector<image_t>& image_ids);
+
+  // The quantizer of the descriptor codes, which is only trained if the
+  // database has a codebook.
+  const ProductQuantizer& GetDescriptorQuantizer() const;
+
   bool ExistsMatches(const image_t image_id1, const image_t image_id2);
   bool ExistsInlierMatches(const image_t image_id1, const image_t image_id2);
 
@@ -183,17 +250,42 @@ class FeatureMatcherCache {
   void WriteInlierMatches(const image_t image_id1, const image_t image_id2,
                           const TwoViewGeometry& two_view_geometry);
 
+  // Write the matches and inlier matches of multiple image pairs while
+  // locking the database only once.
+  void WriteMatchesAndInlierMatches(
+      const std::vector<internal::FeatureMatcherData>& data);
+
   void DeleteMatches(const image_t image_id1, const image_t image_id2);
   void DeleteInlierMatches(const image_t image_id1, const image_t image_id2);
 
  private:
+  struct CachedDescriptors {
+    FeatureDescriptors descriptors;
+    size_t NumBytes() const;
+  };
+
+  CachedDescriptors ReadDescriptors(const image_t image_id);
+
+  // Lock the database for a feature read, unless the read is served by the
+  // read connection pool of the database.
+  std::unique_lock<std::mutex> LockDatabaseForReading();
+
   const size_t cache_size_;
+  const double descriptor_cache_size_;
+  const std::string descriptor_store_path_;
   const Database* database_;
   std::mutex database_mutex_;
   EIGEN_STL_UMAP(camera_t, Camera) cameras_cache_;
   EIGEN_STL_UMAP(image_t, Image) images_cache_;
-  std::unique_ptr<LRUCache<image_t, FeatureKeypoints>> keypoints_cache_;
-  std::unique_ptr<LRUCache<image_t, FeatureDescriptors>> descriptors_cache_;
+  FeatureDescriptorStore descriptor_store_;
+  ProductQuantizer descriptor_quantizer_;
+  // Declared before the caches, which report to it until they are destroyed.
+  std::unique_ptr<MemoryConsumer> descriptors_memory_consumer_;
+  std::unique_ptr<ShardedLRUCache<image_t, FeatureKeypoints>> keypoints_cache_;
+  std::unique_ptr<ShardedLRUCache<image_t, CachedDescriptors>>
+      descriptors_cache_;
+  std::unique_ptr<ShardedLRUCache<image_t, FeatureDescriptorCodes>>
+      descriptor_codes_cache_;
 };
 
 class FeatureMatcherThread : public Thread {
@@ -210,30 +302,30 @@ class FeatureMatcherThread : public Thread {
 
 class SiftCPUFeatureMatcher : public FeatureMatcherThread {
  public:
-  typedef internal::FeatureMatcherData Input;
+  typedef internal::FeatureMatcherDataGroup Input;
   typedef internal::FeatureMatcherData Output;
 
   SiftCPUFeatureMatcher(const SiftMatchingOptions& options,
                         FeatureMatcherCache* cache,
-                        JobQueue<Input>* input_queue,
-                        JobQueue<Output>* output_queue);
+                        RingJobQueue<Input>* input_queue,
+                        RingJobQueue<Output>* output_queue);
 
  protected:
   void Run() override;
 
-  JobQueue<Input>* input_queue_;
-  JobQueue<Output>* output_queue_;
+  RingJobQueue<Input>* input_queue_;
+  RingJobQueue<Output>* output_queue_;
 };
 
 class SiftGPUFeatureMatcher : public FeatureMatcherThread {
  public:
-  typedef internal::FeatureMatcherData Input;
+  typedef internal::FeatureMatcherDataGroup Input;
   typedef internal::FeatureMatcherData Output;
 
   SiftGPUFeatureMatcher(const SiftMatchingOptions& options,
                         FeatureMatcherCache* cache,
-                        JobQueue<Input>* input_queue,
-                        JobQueue<Output>* output_queue);
+                        RingJobQueue<Input>* input_queue,
+                        RingJobQueue<Output>* output_queue);
 
  protected:
   void Run() override;
@@ -241,8 +333,8 @@ class SiftGPUFeatureMatcher : public FeatureMatcherThread {
   void GetDescriptorData(const int index, const image_t image_id,
                          const FeatureDescriptors** descriptors_ptr);
 
-  JobQueue<Input>* input_queue_;
-  JobQueue<Output>* output_queue_;
+  RingJobQueue<Input>* input_queue_;
+  RingJobQueue<Output>* output_queue_;
 
   std::unique_ptr<OpenGLContextManager> opengl_context_;
 
@@ -258,25 +350,32 @@ class GuidedSiftCPUFeatureMatcher : public FeatureMatcherThread {
 
   GuidedSiftCPUFeatureMatcher(const SiftMatchingOptions& options,
                               FeatureMatcherCache* cache,
-                              JobQueue<Input>* input_queue,
-                              JobQueue<Output>* output_queue);
+                              RingJobQueue<Input>* input_queue,
+                              RingJobQueue<Output>* output_queue);
 
  private:
   void Run() override;
 
-  JobQueue<Input>* input_queue_;
-  JobQueue<Output>* output_queue_;
+  RingJobQueue<Input>* input_queue_;
+  RingJobQueue<Output>* output_queue_;
 };
 
+// Guided matcher on the GPU, which takes all queued image pairs at once, up to
+// `kMaxNumPairsPerBatch`, and matches them in the order of their images, so
+// that the features of an image are uploaded once for all its pairs in the
+// batch. The matches are guided by the geometry of the verification, which is
+// kept for the guided inlier matches.
 class GuidedSiftGPUFeatureMatcher : public FeatureMatcherThread {
  public:
   typedef internal::FeatureMatcherData Input;
   typedef internal::FeatureMatcherData Output;
 
+  static const size_t kMaxNumPairsPerBatch = 256;
+
   GuidedSiftGPUFeatureMatcher(const SiftMatchingOptions& options,
                               FeatureMatcherCache* cache,
-                              JobQueue<Input>* input_queue,
-                              JobQueue<Output>* output_queue);
+                              RingJobQueue<Input>* input_queue,
+                              RingJobQueue<Output>* output_queue);
 
  private:
   void Run() override;
@@ -285,8 +384,8 @@ class GuidedSiftGPUFeatureMatcher : public FeatureMatcherThread {
                       const FeatureKeypoints** keypoints_ptr,
                       const FeatureDescriptors** descriptors_ptr);
 
-  JobQueue<Input>* input_queue_;
-  JobQueue<Output>* output_queue_;
+  RingJobQueue<Input>* input_queue_;
+  RingJobQueue<Output>* output_queue_;
 
   std::unique_ptr<OpenGLContextManager> opengl_context_;
 
@@ -303,24 +402,82 @@ class TwoViewGeometryVerifier : public Thread {
 
   TwoViewGeometryVerifier(const SiftMatchingOptions& options,
                           FeatureMatcherCache* cache,
-                          JobQueue<Input>* input_queue,
-                          JobQueue<Output>* output_queue);
+                          RingJobQueue<Input>* input_queue,
+                          RingJobQueue<Output>* output_queue);
 
  protected:
   void Run() override;
 
+  // Verify batches of image pairs, whose RANSAC hypotheses are scored together
+  // by the given scorer, see `SiftMatchingOptions::gpu_verification`.
+  void RunBatched(TwoViewHypothesisScorer* scorer);
+
   const SiftMatchingOptions options_;
   TwoViewGeometry::Options two_view_geometry_options_;
   FeatureMatcherCache* cache_;
-  JobQueue<Input>* input_queue_;
-  JobQueue<Output>* output_queue_;
+  RingJobQueue<Input>* input_queue_;
+  RingJobQueue<Output>* output_queue_;
+};
+
+// Writer of the matching results, which collects the results in batches of
+// up to `kBatchSize` image pairs and writes every batch in one transaction, so
+// that the matchers and verifiers do not wait for the database. A batch is
+// written early when no further result is queued. The pairs whose results are
+// not yet written are tracked, such that the next batch of the matcher can be
+// prepared while the previous one is written.
+class FeatureMatcherWriter : public Thread {
+ public:
+  typedef internal::FeatureMatcherData Input;
+
+  static const size_t kBatchSize = 256;
+
+  FeatureMatcherWriter(const SiftMatchingOptions& options, Database* database,
+                       FeatureMatcherCache* cache,
+                       RingJobQueue<Input>* input_queue,
+                       const FeatureCache* feature_cache = nullptr);
+
+  // Register an image pair, whose result will be pushed to the input queue.
+  void AddPendingPair(const image_pair_t pair_id);
+
+  // Whether the result of the image pair is not yet written.
+  bool IsPendingPair(const image_pair_t pair_id);
+
+  // Wait until the given number of results have been taken from the input
+  // queue since the writer was started.
+  void WaitForNumReceived(const size_t num_received);
+
+  // Wait until the results of all registered image pairs have been written.
+  void WaitForPendingPairs();
+
+  size_t NumReceived();
+
+ private:
+  void Run() override;
+
+  void WriteBatch(std::vector<Input>* batch);
+
+  const SiftMatchingOptions options_;
+  Database* database_;
+  FeatureMatcherCache* cache_;
+  RingJobQueue<Input>* input_queue_;
+  const FeatureCache* feature_cache_;
+
+  std::mutex mutex_;
+  std::condition_variable received_condition_;
+  std::condition_variable written_condition_;
+  size_t num_received_;
+  std::unordered_set<image_pair_t> pending_pair_ids_;
 };
 
 // Multi-threaded and multi-GPU SIFT feature matcher, which writes the computed
 // results to the database and skips already matched image pairs. To improve
 // performance of the matching by taking advantage of caching and database
-// transactions, pass multiple images to the `Match` function. Note that the
-// database should be in an active transaction while calling `Match`.
+// transactions, pass multiple images to the `Match` function. The results are
+// written by a separate thread, which may still write the results of a batch
+// when `Match` returns. All results are written when the matcher is destructed.
+// With a feature cache, the results of image pairs are taken from the cache
+// if their features, cameras and matching options were matched before, and
+// the results of the other pairs are added to it.
 class SiftFeatureMatcher {
  public:
   SiftFeatureMatcher(const SiftMatchingOptions& options, Database* database,
@@ -335,21 +492,30 @@ class SiftFeatureMatcher {
   void Match(const std::vector<std::pair<image_t, image_t>>& image_pairs);
 
  private:
+  // The feature cache key of the results of an image pair, where the keys of
+  // the matching inputs of the images are computed once.
+  std::string ImagePairCacheKey(const image_t image_id1,
+                                const image_t image_id2);
+
   SiftMatchingOptions options_;
   Database* database_;
   FeatureMatcherCache* cache_;
 
+  std::unique_ptr<FeatureCache> feature_cache_;
+  std::unordered_map<image_t, std::string> matching_input_keys_;
+
   bool is_setup_;
 
   std::vector<std::unique_ptr<FeatureMatcherThread>> matchers_;
   std::vector<std::unique_ptr<FeatureMatcherThread>> guided_matchers_;
   std::vector<std::unique_ptr<Thread>> verifiers_;
+  std::unique_ptr<FeatureMatcherWriter> writer_;
   std::unique_ptr<ThreadPool> thread_pool_;
 
-  JobQueue<internal::FeatureMatcherData> matcher_queue_;
-  JobQueue<internal::FeatureMatcherData> verifier_queue_;
-  JobQueue<internal::FeatureMatcherData> guided_matcher_queue_;
-  JobQueue<internal::FeatureMatcherData> output_queue_;
+  RingJobQueue<internal::FeatureMatcherDataGroup> matcher_queue_;
+  RingJobQueue<internal::FeatureMatcherData> verifier_queue_;
+  RingJobQueue<internal::FeatureMatcherData> guided_matcher_queue_;
+  RingJobQueue<internal::FeatureMatcherData> output_queue_;
 };
 
 // Exhaustively match images by processing each block in the exhaustive match
@@ -375,6 +541,10 @@ class SiftFeatureMatcher {
 //
 // Pairs will only be matched if 1, to avoid duplicate pairs. Pairs with #
 // are on the main diagonal and denote pairs of the same image.
+//
+// If a takes file is given, the images of every take are matched in blocks as
+// above and the cross-take pairs are matched afterwards in batches of the
+// same size.
 class ExhaustiveFeatureMatcher : public Thread {
  public:
   ExhaustiveFeatureMatcher(const ExhaustiveMatchingOptions& options,
@@ -384,6 +554,9 @@ class ExhaustiveFeatureMatcher : public Thread {
  private:
   void Run() override;
 
+  void RunBlockMatching(const std::vector<image_t>& image_ids);
+  void RunTakeMatching();
+
   const ExhaustiveMatchingOptions options_;
   const SiftMatchingOptions match_options_;
   Database database_;
@@ -405,6 +578,8 @@ class ExhaustiveFeatureMatcher : public Thread {
 //                    image_[i - 2^o, i + 2^o]    (for quadratic overlap)
 //
 // Sequential order is determined based on the image names in ascending order.
+// If a takes file is given, the images are matched sequentially within their
+// take and the pairs between the takes are selected as in exhaustive matching.
 //
 // Invoke loop detection if `(i mod loop_detection_period) == 0`, retrieve
 // most similar `loop_detection_num_images` images from vocabulary tree,
@@ -420,6 +595,7 @@ class SequentialFeatureMatcher : public Thread {
 
   std::vector<image_t> GetOrderedImageIds() const;
   void RunSequentialMatching(const std::vector<image_t>& image_ids);
+  void RunTakeMatching();
   void RunLoopDetection(const std::vector<image_t>& image_ids);
 
   const SequentialMatchingOptions options_;
@@ -524,6 +700,16 @@ class ImagePairsFeatureMatcher : public Thread {
 //      2 3
 //      ...
 //
+// If the file has the extension .bin, it is read in the binary counterpart of
+// this format instead, where every image pair is stored in little-endian byte
+// order as:
+//
+//      NAME_LENGTH1 (uint32) NAME1 NAME_LENGTH2 (uint32) NAME2
+//      NUM_MATCHES (uint64)
+//      POINT2D_IDX1 POINT2D_IDX2 (uint32) of every match
+//
+// The matches of a batch of image pairs are verified in parallel and written
+// to the database in a single transaction.
 class FeaturePairsFeatureMatcher : public Thread {
  public:
   FeaturePairsFeatureMatcher(const FeaturePairsMatchingOptions& options,
@@ -532,6 +718,8 @@ class FeaturePairsFeatureMatcher : public Thread {
 
  private:
   const static size_t kCacheSize = 100;
+  // The number of image pairs that are written in one transaction.
+  const static size_t kBatchSize = 1000;
 
   void Run() override;
 
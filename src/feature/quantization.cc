@@ -0,0 +1,278 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "feature/quantization.h"
+
+#include <numeric>
+
+#include "util/logging.h"
+#include "util/math.h"
+#include "util/random.h"
+#include "util/threading.h"
+
+namespace colmap {
+namespace {
+
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    SubspaceMatrix;
+
+SubspaceMatrix ExtractSubspace(const FeatureDescriptors& descriptors,
+                               const std::vector<int>& idxs, const int begin,
+                               const int dim) {
+  SubspaceMatrix data(idxs.size(), dim);
+  for (size_t i = 0; i < idxs.size(); ++i) {
+    data.row(i) = descriptors.block(idxs[i], begin, 1, dim).cast<float>();
+  }
+  return data;
+}
+
+// Assign every row of the data to its nearest centroid. The squared distances
+// are computed in blocks from the dot products, which uses the matrix
+// product of Eigen instead of one distance computation per pair.
+void AssignToCentroids(const SubspaceMatrix& data,
+                       const SubspaceMatrix& centroids,
+                       std::vector<int>* assignments) {
+  const int kBlockSize = 1024;
+
+  const Eigen::RowVectorXf centroid_norms =
+      centroids.rowwise().squaredNorm().transpose();
+
+  const int num_rows = static_cast<int>(data.rows());
+  assignments->resize(num_rows);
+  for (int begin = 0; begin < num_rows; begin += kBlockSize) {
+    const int block_size = std::min(kBlockSize, num_rows - begin);
+    const Eigen::MatrixXf dot_products =
+        data.middleRows(begin, block_size) * centroids.transpose();
+    for (int i = 0; i < block_size; ++i) {
+      Eigen::RowVectorXf::Index idx;
+      (centroid_norms - 2 * dot_products.row(i)).minCoeff(&idx);
+      (*assignments)[begin + i] = static_cast<int>(idx);
+    }
+  }
+}
+
+SubspaceMatrix TrainSubspace(const SubspaceMatrix& data,
+                             const std::vector<int>& init_idxs,
+                             const int num_iterations) {
+  SubspaceMatrix centroids(init_idxs.size(), data.cols());
+  for (size_t k = 0; k < init_idxs.size(); ++k) {
+    centroids.row(k) = data.row(init_idxs[k]);
+  }
+
+  std::vector<int> assignments;
+  std::vector<int> prev_assignments;
+  for (int iteration = 0; iteration < num_iterations; ++iteration) {
+    AssignToCentroids(data, centroids, &assignments);
+    if (assignments == prev_assignments) {
+      break;
+    }
+
+    // Centroids without any assigned rows keep their previous position.
+    SubspaceMatrix sums = SubspaceMatrix::Zero(centroids.rows(), data.cols());
+    std::vector<int> counts(centroids.rows(), 0);
+    for (size_t i = 0; i < assignments.size(); ++i) {
+      sums.row(assignments[i]) += data.row(i);
+      counts[assignments[i]] += 1;
+    }
+    for (Eigen::Index k = 0; k < centroids.rows(); ++k) {
+      if (counts[k] > 0) {
+        centroids.row(k) = sums.row(k) / counts[k];
+      }
+    }
+
+    prev_assignments.swap(assignments);
+  }
+
+  return centroids;
+}
+
+}  // namespace
+
+bool ProductQuantizerOptions::Check() const {
+  CHECK_OPTION_GT(num_subspaces, 0);
+  CHECK_OPTION_LE(num_subspaces, 128);
+  CHECK_OPTION_EQ(128 % num_subspaces, 0);
+  CHECK_OPTION_GT(num_iterations, 0);
+  CHECK_OPTION_GT(max_num_training_descriptors, 0);
+  return true;
+}
+
+const int ProductQuantizer::kNumCentroids;
+
+ProductQuantizer::ProductQuantizer() {}
+
+ProductQuantizer::ProductQuantizer(const FeatureDescriptorCodebook& codebook)
+    : codebook_(codebook) {
+  CHECK_GT(codebook_.rows(), 0);
+  CHECK_EQ(codebook_.rows() % kNumCentroids, 0);
+  CHECK_EQ(NumSubspaces() * SubspaceDim(), 128);
+}
+
+bool ProductQuantizer::IsTrained() const { return codebook_.size() > 0; }
+
+int ProductQuantizer::NumSubspaces() const {
+  return static_cast<int>(codebook_.rows()) / kNumCentroids;
+}
+
+int ProductQuantizer::SubspaceDim() const {
+  return static_cast<int>(codebook_.cols());
+}
+
+const FeatureDescriptorCodebook& ProductQuantizer::Codebook() const {
+  return codebook_;
+}
+
+void ProductQuantizer::Train(const ProductQuantizerOptions& options,
+                             const FeatureDescriptors& descriptors) {
+  CHECK(options.Check());
+  CHECK_GT(descriptors.rows(), 0);
+  CHECK_EQ(descriptors.cols(), 128);
+
+  const int num_subspaces = options.num_subspaces;
+  const int subspace_dim = 128 / num_subspaces;
+
+  std::vector<int> training_idxs(descriptors.rows());
+  std::iota(training_idxs.begin(), training_idxs.end(), 0);
+  if (training_idxs.size() >
+      static_cast<size_t>(options.max_num_training_descriptors)) {
+    Shuffle(options.max_num_training_descriptors, &training_idxs);
+    training_idxs.resize(options.max_num_training_descriptors);
+  }
+
+  // The initial centroids are distinct training descriptors, if there are
+  // enough. They are sampled on this thread, so that the seed of the PRNG
+  // determines the result independently of the number of threads.
+  const int num_training = static_cast<int>(training_idxs.size());
+  std::vector<std::vector<int>> init_idxs(num_subspaces);
+  for (auto& subspace_init_idxs : init_idxs) {
+    std::vector<int> idxs(num_training);
+    std::iota(idxs.begin(), idxs.end(), 0);
+    Shuffle(std::min(num_training, kNumCentroids), &idxs);
+    subspace_init_idxs.resize(kNumCentroids);
+    for (int k = 0; k < kNumCentroids; ++k) {
+      subspace_init_idxs[k] = idxs[k % num_training];
+    }
+  }
+
+  codebook_.resize(num_subspaces * kNumCentroids, subspace_dim);
+
+  ThreadPool thread_pool(
+      std::min(GetEffectiveNumThreads(options.num_threads), num_subspaces));
+  std::vector<std::future<void>> futures;
+  futures.reserve(num_subspaces);
+  for (int subspace = 0; subspace < num_subspaces; ++subspace) {
+    futures.push_back(thread_pool.AddTask([&, subspace]() {
+      const SubspaceMatrix data =
+          ExtractSubspace(descriptors, training_idxs, subspace * subspace_dim,
+                          subspace_dim);
+      codebook_.middleRows(subspace * kNumCentroids, kNumCentroids) =
+          TrainSubspace(data, init_idxs[subspace], options.num_iterations);
+    }));
+  }
+
+  for (auto& future : futures) {
+    future.get();
+  }
+}
+
+FeatureDescriptorCodes ProductQuantizer::Encode(
+    const FeatureDescriptors& descriptors) const {
+  CHECK(IsTrained());
+
+  const int num_subspaces = NumSubspaces();
+  const int subspace_dim = SubspaceDim();
+
+  FeatureDescriptorCodes codes(descriptors.rows(), num_subspaces);
+  if (descriptors.rows() == 0) {
+    return codes;
+  }
+
+  CHECK_EQ(descriptors.cols(), 128);
+
+  std::vector<int> idxs(descriptors.rows());
+  std::iota(idxs.begin(), idxs.end(), 0);
+
+  std::vector<int> assignments;
+  for (int subspace = 0; subspace < num_subspaces; ++subspace) {
+    const SubspaceMatrix data = ExtractSubspace(
+        descriptors, idxs, subspace * subspace_dim, subspace_dim);
+    AssignToCentroids(
+        data, codebook_.middleRows(subspace * kNumCentroids, kNumCentroids),
+        &assignments);
+    for (size_t i = 0; i < assignments.size(); ++i) {
+      codes(i, subspace) = static_cast<uint8_t>(assignments[i]);
+    }
+  }
+
+  return codes;
+}
+
+FeatureDescriptors ProductQuantizer::Decode(
+    const FeatureDescriptorCodes& codes) const {
+  CHECK(IsTrained());
+
+  const int num_subspaces = NumSubspaces();
+  const int subspace_dim = SubspaceDim();
+
+  FeatureDescriptors descriptors(codes.rows(), 128);
+  if (codes.rows() == 0) {
+    return descriptors;
+  }
+
+  CHECK_EQ(codes.cols(), num_subspaces);
+
+  for (Eigen::Index i = 0; i < codes.rows(); ++i) {
+    for (int subspace = 0; subspace < num_subspaces; ++subspace) {
+      const float* centroid =
+          codebook_.data() +
+          (subspace * kNumCentroids + codes(i, subspace)) * subspace_dim;
+      for (int j = 0; j < subspace_dim; ++j) {
+        descriptors(i, subspace * subspace_dim + j) =
+            TruncateCast<float, uint8_t>(std::round(centroid[j]));
+      }
+    }
+  }
+
+  return descriptors;
+}
+
+void ProductQuantizer::ComputeDotProductTable(const uint8_t* descriptor,
+                                              std::vector<int>* table) const {
+  CHECK(IsTrained());
+
+  const int num_subspaces = NumSubspaces();
+  const int subspace_dim = SubspaceDim();
+
+  table->resize(num_subspaces * kNumCentroids);
+
+  const float* centroid = codebook_.data();
+  int* entry = table->data();
+  for (int subspace = 0; subspace < num_subspaces; ++subspace) {
+    const uint8_t* values = descriptor + subspace * subspace_dim;
+    for (int k = 0; k < kNumCentroids; ++k) {
+      float dot_product = 0;
+      for (int j = 0; j < subspace_dim; ++j) {
+        dot_product += centroid[j] * values[j];
+      }
+      *entry = static_cast<int>(std::round(dot_product));
+      centroid += subspace_dim;
+      entry += 1;
+    }
+  }
+}
+
+}  // namespace colmap
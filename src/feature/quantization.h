@@ -0,0 +1,89 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef COLMAP_SRC_FEATURE_QUANTIZATION_H_
+#define COLMAP_SRC_FEATURE_QUANTIZATION_H_
+
+#include <vector>
+
+#include "feature/types.h"
+#include "util/types.h"
+
+namespace colmap {
+
+struct ProductQuantizerOptions {
+  // The number of subspaces into which the 128 dimensions of a descriptor are
+  // split, which is the number of bytes per code. Must divide 128.
+  int num_subspaces = 16;
+
+  // The number of k-means iterations per subspace.
+  int num_iterations = 25;
+
+  // The maximum number of descriptors used for training, which are randomly
+  // sampled from the given descriptors.
+  int max_num_training_descriptors = 250000;
+
+  // The number of threads used for training.
+  int num_threads = -1;
+
+  bool Check() const;
+};
+
+// Product quantizer for SIFT descriptors. A descriptor is split into
+// subspaces of equal dimension and every subspace is encoded by the index of
+// the nearest of 256 centroids, such that, with the default 16 subspaces, a
+// descriptor is stored in 16 instead of 128 bytes.
+//
+// Codes are compared to an uncompressed query descriptor by the asymmetric
+// distance, for which the dot products of the query with all centroids are
+// computed once and then looked up for every code.
+class ProductQuantizer {
+ public:
+  static const int kNumCentroids = 256;
+
+  ProductQuantizer();
+  explicit ProductQuantizer(const FeatureDescriptorCodebook& codebook);
+
+  bool IsTrained() const;
+  int NumSubspaces() const;
+  int SubspaceDim() const;
+
+  const FeatureDescriptorCodebook& Codebook() const;
+
+  // Learn the centroids of every subspace by k-means.
+  void Train(const ProductQuantizerOptions& options,
+             const FeatureDescriptors& descriptors);
+
+  FeatureDescriptorCodes Encode(const FeatureDescriptors& descriptors) const;
+
+  // Approximate reconstruction of the descriptors from their codes.
+  FeatureDescriptors Decode(const FeatureDescriptorCodes& codes) const;
+
+  // The dot products of the subspaces of a descriptor with all centroids,
+  // where entry `subspace * kNumCentroids + k` holds the dot product with
+  // centroid `k`. The dot product of the descriptor with an encoded
+  // descriptor is the sum of the entries selected by its code.
+  void ComputeDotProductTable(const uint8_t* descriptor,
+                              std::vector<int>* table) const;
+
+ private:
+  FeatureDescriptorCodebook codebook_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_FEATURE_QUANTIZATION_H_
@@ -0,0 +1,163 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#define TEST_NAME "feature/quantization"
+#include "util/testing.h"
+
+#include "feature/quantization.h"
+#include "feature/sift.h"
+#include "util/random.h"
+
+using namespace colmap;
+
+namespace {
+
+// Random descriptors around a few cluster centers, normalized to the length
+// 512 of SIFT descriptors.
+FeatureDescriptors CreateDescriptors(const int num_descriptors,
+                                     const int num_clusters) {
+  std::vector<Eigen::VectorXf> centers(num_clusters);
+  for (auto& center : centers) {
+    center = Eigen::VectorXf::Zero(128);
+    for (int j = 0; j < 128; ++j) {
+      center(j) = RandomReal<float>(0, 1);
+    }
+  }
+
+  FeatureDescriptors descriptors(num_descriptors, 128);
+  for (int i = 0; i < num_descriptors; ++i) {
+    Eigen::VectorXf descriptor = centers[i % num_clusters];
+    for (int j = 0; j < 128; ++j) {
+      descriptor(j) =
+          std::max(0.0f, descriptor(j) + RandomGaussian(0.0f, 0.01f));
+    }
+    descriptor *= 512.0f / descriptor.norm();
+    for (int j = 0; j < 128; ++j) {
+      descriptors(i, j) = static_cast<uint8_t>(std::min(255.0f, descriptor(j)));
+    }
+  }
+
+  return descriptors;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestUntrained) {
+  ProductQuantizer quantizer;
+  BOOST_CHECK(!quantizer.IsTrained());
+  BOOST_CHECK_EQUAL(quantizer.NumSubspaces(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestTrainEncodeDecode) {
+  SetPRNGSeed(0);
+  const FeatureDescriptors descriptors = CreateDescriptors(2000, 20);
+
+  ProductQuantizerOptions options;
+  options.num_subspaces = 16;
+  ProductQuantizer quantizer;
+  quantizer.Train(options, descriptors);
+  BOOST_CHECK(quantizer.IsTrained());
+  BOOST_CHECK_EQUAL(quantizer.NumSubspaces(), 16);
+  BOOST_CHECK_EQUAL(quantizer.SubspaceDim(), 8);
+  BOOST_CHECK_EQUAL(quantizer.Codebook().rows(), 16 * 256);
+
+  const FeatureDescriptorCodes codes = quantizer.Encode(descriptors);
+  BOOST_CHECK_EQUAL(codes.rows(), descriptors.rows());
+  BOOST_CHECK_EQUAL(codes.cols(), 16);
+
+  // The clusters are much tighter than the distance between them, so that
+  // the reconstruction is close to the descriptors.
+  const FeatureDescriptors decoded = quantizer.Decode(codes);
+  BOOST_CHECK_EQUAL(decoded.rows(), descriptors.rows());
+  BOOST_CHECK_EQUAL(decoded.cols(), 128);
+  const double error = (decoded.cast<float>() - descriptors.cast<float>())
+                           .rowwise()
+                           .norm()
+                           .mean();
+  BOOST_CHECK_LT(error, 0.1 * 512);
+
+  const ProductQuantizer quantizer2(quantizer.Codebook());
+  BOOST_CHECK(quantizer2.Encode(descriptors) == codes);
+
+  BOOST_CHECK_EQUAL(quantizer.Encode(FeatureDescriptors(0, 128)).rows(), 0);
+  BOOST_CHECK_EQUAL(quantizer.Decode(FeatureDescriptorCodes(0, 16)).rows(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestDotProductTable) {
+  SetPRNGSeed(0);
+  const FeatureDescriptors descriptors = CreateDescriptors(500, 10);
+
+  ProductQuantizerOptions options;
+  options.num_subspaces = 8;
+  options.num_iterations = 5;
+  ProductQuantizer quantizer;
+  quantizer.Train(options, descriptors);
+
+  const FeatureDescriptorCodes codes = quantizer.Encode(descriptors);
+  std::vector<int> table;
+  quantizer.ComputeDotProductTable(descriptors.data(), &table);
+  BOOST_CHECK_EQUAL(table.size(), 8 * ProductQuantizer::kNumCentroids);
+
+  // The looked up dot product is the one with the centroids of the code.
+  for (int i = 0; i < 10; ++i) {
+    int dot_product = 0;
+    float expected_dot_product = 0;
+    for (int subspace = 0; subspace < 8; ++subspace) {
+      const int k = codes(i, subspace);
+      dot_product += table[subspace * ProductQuantizer::kNumCentroids + k];
+      for (int j = 0; j < 16; ++j) {
+        expected_dot_product +=
+            descriptors(0, subspace * 16 + j) *
+            quantizer.Codebook()(subspace * ProductQuantizer::kNumCentroids + k,
+                                 j);
+      }
+    }
+    BOOST_CHECK_LE(std::abs(dot_product - expected_dot_product), 8);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestMatchQuantizedSiftFeaturesCPU) {
+  SetPRNGSeed(0);
+  const FeatureDescriptors descriptors = CreateDescriptors(1000, 1000);
+
+  ProductQuantizerOptions options;
+  ProductQuantizer quantizer;
+  quantizer.Train(options, descriptors);
+
+  const FeatureDescriptors descriptors1 = descriptors.topRows(100);
+  const FeatureDescriptorCodes codes2 =
+      quantizer.Encode(descriptors.middleRows(50, 100));
+
+  SiftMatchingOptions match_options;
+  FeatureMatches matches;
+  MatchQuantizedSiftFeaturesCPU(match_options, quantizer, descriptors1, codes2,
+                                &matches);
+
+  // Most of the 50 overlapping descriptors are matched correctly.
+  size_t num_correct = 0;
+  for (const auto& match : matches) {
+    if (match.point2D_idx1 == match.point2D_idx2 + 50) {
+      num_correct += 1;
+    }
+  }
+  BOOST_CHECK_GE(num_correct, 45);
+  BOOST_CHECK_LE(matches.size() - num_correct, 5);
+
+  MatchQuantizedSiftFeaturesCPU(match_options, quantizer,
+                                FeatureDescriptors(0, 128), codes2, &matches);
+  BOOST_CHECK_EQUAL(matches.size(), 0);
+}
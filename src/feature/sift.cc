@@ -17,18 +17,31 @@
 #include "feature/sift.h"
 
 #include <array>
+#include <atomic>
 #include <fstream>
+#include <limits>
+#include <map>
 #include <memory>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #include "ext/SiftGPU/SiftGPU.h"
 #include "ext/VLFeat/covdet.h"
 #include "ext/VLFeat/sift.h"
 #include "feature/utils.h"
 #include "util/cuda.h"
+#include "util/endian.h"
 #include "util/logging.h"
 #include "util/math.h"
 #include "util/misc.h"
 #include "util/opengl_utils.h"
+#include "util/simd.h"
+#include "util/threading.h"
+#include "util/trace.h"
 
 namespace colmap {
 namespace {
@@ -38,6 +51,20 @@ namespace {
 static std::map<int, std::unique_ptr<std::mutex>> sift_extraction_mutexes;
 static std::map<int, std::unique_ptr<std::mutex>> sift_matching_mutexes;
 
+// Guards the maps of the mutexes, since the extractor and matcher threads of
+// multiple GPUs are set up and run concurrently.
+static std::mutex sift_gpu_mutexes_mutex;
+
+std::mutex* GetSiftGPUMutex(
+    std::map<int, std::unique_ptr<std::mutex>>* mutexes, const int gpu_index) {
+  std::unique_lock<std::mutex> lock(sift_gpu_mutexes_mutex);
+  std::unique_ptr<std::mutex>& mutex = (*mutexes)[gpu_index];
+  if (!mutex) {
+    mutex.reset(new std::mutex());
+  }
+  return mutex.get();
+}
+
 // VLFeat uses a different convention to store its descriptors. This transforms
 // the VLFeat format into the original SIFT format that is also used by SiftGPU.
 FeatureDescriptors TransformVLFeatToUBCFeatureDescriptors(
@@ -58,11 +85,111 @@ FeatureDescriptors TransformVLFeatToUBCFeatureDescriptors(
   return ubc_descriptors;
 }
 
-Eigen::MatrixXi ComputeSiftDistanceMatrix(
+// Dot product of two SIFT descriptors with 128 uint8 elements. The products
+// and their pairwise sums fit into 16 and 32 bit integers, respectively. The
+// baseline uses SSE2 or NEON, the wider instruction sets are selected at
+// runtime, see ComputeSiftDotProducts.
+inline int ComputeSiftDotProduct(const uint8_t* descriptor1,
+                                 const uint8_t* descriptor2) {
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sum = _mm_setzero_si128();
+  for (int i = 0; i < 128; i += 16) {
+    const __m128i values1 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(descriptor1 + i));
+    const __m128i values2 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(descriptor2 + i));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi8(values1, zero),
+                                            _mm_unpacklo_epi8(values2, zero)));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpackhi_epi8(values1, zero),
+                                            _mm_unpackhi_epi8(values2, zero)));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  uint32x4_t sum = vdupq_n_u32(0);
+  for (int i = 0; i < 128; i += 16) {
+    const uint8x16_t values1 = vld1q_u8(descriptor1 + i);
+    const uint8x16_t values2 = vld1q_u8(descriptor2 + i);
+    sum = vpadalq_u16(sum,
+                      vmull_u8(vget_low_u8(values1), vget_low_u8(values2)));
+    sum = vpadalq_u16(sum,
+                      vmull_u8(vget_high_u8(values1), vget_high_u8(values2)));
+  }
+  const uint64x2_t sum64 = vpaddlq_u32(sum);
+  return static_cast<int>(vgetq_lane_u64(sum64, 0) + vgetq_lane_u64(sum64, 1));
+#else
+  int sum = 0;
+  for (int i = 0; i < 128; ++i) {
+    sum += static_cast<int>(descriptor1[i]) * static_cast<int>(descriptor2[i]);
+  }
+  return sum;
+#endif
+}
+
+typedef void (*SiftDotProductsFunc)(const uint8_t* descriptor1,
+                                    const uint8_t* descriptors2,
+                                    const int num_descriptors2, int* dots);
+
+// Dot products of a descriptor with consecutive descriptors of the other
+// image.
+void ComputeSiftDotProducts(const uint8_t* descriptor1,
+                            const uint8_t* descriptors2,
+                            const int num_descriptors2, int* dots) {
+  for (int i = 0; i < num_descriptors2; ++i) {
+    dots[i] = ComputeSiftDotProduct(descriptor1, descriptors2 + 128 * i);
+  }
+}
+
+}  // namespace
+
+namespace internal {
+
+// Defined in sift_avx2.cc. The dot products are bound by the conversion of
+// the bytes, such that AVX-512 is not faster.
+void ComputeSiftDotProductsAVX2(const uint8_t* descriptor1,
+                                const uint8_t* descriptors2,
+                                const int num_descriptors2, int* dots);
+
+}  // namespace internal
+
+namespace {
+
+// The best and second best dot product of a descriptor with the descriptors
+// of the other image and the index of the best one, updated in the order of
+// the indices of the other image.
+struct SiftMatchCandidates {
+  int best_idx = -1;
+  int best_dist = 0;
+  int second_best_dist = 0;
+
+  inline void Update(const int idx, const int dist) {
+    if (dist > best_dist) {
+      best_idx = idx;
+      second_best_dist = best_dist;
+      best_dist = dist;
+    } else if (dist > second_best_dist) {
+      second_best_dist = dist;
+    }
+  }
+};
+
+// Compute the best matching candidates of all descriptors in both directions.
+// The dot products are computed in blocks of descriptors that fit into the L1
+// cache and only the running candidates are kept, so that the memory is
+// linear instead of quadratic in the number of descriptors. The pairs that are
+// rejected by the guided filter are skipped, which is equivalent to a zero dot
+// product.
+void ComputeSiftMatchCandidates(
     const FeatureKeypoints* keypoints1, const FeatureKeypoints* keypoints2,
     const FeatureDescriptors& descriptors1,
     const FeatureDescriptors& descriptors2,
-    const std::function<bool(float, float, float, float)>& guided_filter) {
+    const std::function<bool(float, float, float, float)>& guided_filter,
+    std::vector<SiftMatchCandidates>* candidates12,
+    std::vector<SiftMatchCandidates>* candidates21) {
+  TRACE_SCOPE("ComputeSiftMatchCandidates");
+
   if (guided_filter != nullptr) {
     CHECK_NOTNULL(keypoints1);
     CHECK_NOTNULL(keypoints2);
@@ -70,60 +197,89 @@ Eigen::MatrixXi ComputeSiftDistanceMatrix(
     CHECK_EQ(keypoints2->size(), descriptors2.rows());
   }
 
-  const Eigen::Matrix<int, Eigen::Dynamic, 128> descriptors1_int =
-      descriptors1.cast<int>();
-  const Eigen::Matrix<int, Eigen::Dynamic, 128> descriptors2_int =
-      descriptors2.cast<int>();
+  const int num_descriptors1 = static_cast<int>(descriptors1.rows());
+  const int num_descriptors2 = static_cast<int>(descriptors2.rows());
 
-  Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> dists(
-      descriptors1.rows(), descriptors2.rows());
+  candidates12->clear();
+  candidates12->resize(num_descriptors1);
+  candidates21->clear();
+  candidates21->resize(num_descriptors2);
 
-  for (FeatureDescriptors::Index i1 = 0; i1 < descriptors1.rows(); ++i1) {
-    for (FeatureDescriptors::Index i2 = 0; i2 < descriptors2.rows(); ++i2) {
-      if (guided_filter != nullptr &&
-          guided_filter((*keypoints1)[i1].x, (*keypoints1)[i1].y,
-                        (*keypoints2)[i2].x, (*keypoints2)[i2].y)) {
-        dists(i1, i2) = 0;
-      } else {
-        dists(i1, i2) = descriptors1_int.row(i1).dot(descriptors2_int.row(i2));
+  if (num_descriptors1 == 0 || num_descriptors2 == 0) {
+    return;
+  }
+
+  CHECK_EQ(descriptors1.cols(), 128);
+  CHECK_EQ(descriptors2.cols(), 128);
+
+  // Two blocks of 128 descriptors occupy 32KB.
+  const int kBlockSize = 128;
+
+  // Without guided filter, the dot products of a descriptor with a block of
+  // the other image are computed at once by the widest supported instruction
+  // set. The guided filter rejects most pairs, which are skipped instead.
+  static const SiftDotProductsFunc compute_dot_products =
+      SelectSIMDFunction<SiftDotProductsFunc>(
+          &ComputeSiftDotProducts,
+          COLMAP_SIMD_AVX2_FUNC(&internal::ComputeSiftDotProductsAVX2),
+          nullptr);
+  std::array<int, kBlockSize> dots;
+
+  // The blocks are visited in increasing order of the indices in both images,
+  // such that the candidates are identical to an exhaustive scan of the rows
+  // and the columns of the full distance matrix.
+  for (int begin1 = 0; begin1 < num_descriptors1; begin1 += kBlockSize) {
+    const int end1 = std::min(begin1 + kBlockSize, num_descriptors1);
+    for (int begin2 = 0; begin2 < num_descriptors2; begin2 += kBlockSize) {
+      const int end2 = std::min(begin2 + kBlockSize, num_descriptors2);
+      for (int i1 = begin1; i1 < end1; ++i1) {
+        const uint8_t* descriptor1 = descriptors1.data() + 128 * i1;
+        SiftMatchCandidates& candidate12 = (*candidates12)[i1];
+        if (guided_filter == nullptr) {
+          compute_dot_products(descriptor1,
+                               descriptors2.data() + 128 * begin2,
+                               end2 - begin2, dots.data());
+          for (int i2 = begin2; i2 < end2; ++i2) {
+            const int dist = dots[i2 - begin2];
+            candidate12.Update(i2, dist);
+            (*candidates21)[i2].Update(i1, dist);
+          }
+        } else {
+          for (int i2 = begin2; i2 < end2; ++i2) {
+            if (guided_filter((*keypoints1)[i1].x, (*keypoints1)[i1].y,
+                              (*keypoints2)[i2].x, (*keypoints2)[i2].y)) {
+              continue;
+            }
+            const int dist = ComputeSiftDotProduct(
+                descriptor1, descriptors2.data() + 128 * i2);
+            candidate12.Update(i2, dist);
+            (*candidates21)[i2].Update(i1, dist);
+          }
+        }
       }
     }
   }
-
-  return dists;
 }
 
-size_t FindBestMatchesOneWay(const Eigen::MatrixXi& dists,
+size_t FindBestMatchesOneWay(const std::vector<SiftMatchCandidates>& candidates,
                              const float max_ratio, const float max_distance,
                              std::vector<int>* matches) {
   // SIFT descriptor vectors are normalized to length 512.
   const float kDistNorm = 1.0f / (512.0f * 512.0f);
 
   size_t num_matches = 0;
-  matches->resize(dists.rows(), -1);
-
-  for (Eigen::MatrixXi::Index i1 = 0; i1 < dists.rows(); ++i1) {
-    int best_i2 = -1;
-    int best_dist = 0;
-    int second_best_dist = 0;
-    for (Eigen::MatrixXi::Index i2 = 0; i2 < dists.cols(); ++i2) {
-      const int dist = dists(i1, i2);
-      if (dist > best_dist) {
-        best_i2 = i2;
-        second_best_dist = best_dist;
-        best_dist = dist;
-      } else if (dist > second_best_dist) {
-        second_best_dist = dist;
-      }
-    }
+  matches->assign(candidates.size(), -1);
+
+  for (size_t i1 = 0; i1 < candidates.size(); ++i1) {
+    const SiftMatchCandidates& candidate = candidates[i1];
 
     // Check if any match found.
-    if (best_i2 == -1) {
+    if (candidate.best_idx == -1) {
       continue;
     }
 
     const float best_dist_normed =
-        std::acos(std::min(kDistNorm * best_dist, 1.0f));
+        std::acos(std::min(kDistNorm * candidate.best_dist, 1.0f));
 
     // Check if match distance passes threshold.
     if (best_dist_normed > max_distance) {
@@ -131,7 +287,7 @@ size_t FindBestMatchesOneWay(const Eigen::MatrixXi& dists,
     }
 
     const float second_best_dist_normed =
-        std::acos(std::min(kDistNorm * second_best_dist, 1.0f));
+        std::acos(std::min(kDistNorm * candidate.second_best_dist, 1.0f));
 
     // Check if match passes ratio test. Keep this comparison >= in order to
     // ensure that the case of best == second_best is detected.
@@ -140,25 +296,74 @@ size_t FindBestMatchesOneWay(const Eigen::MatrixXi& dists,
     }
 
     num_matches += 1;
-    (*matches)[i1] = best_i2;
+    (*matches)[i1] = candidate.best_idx;
   }
 
   return num_matches;
 }
 
-void FindBestMatches(const Eigen::MatrixXi& dists, const float max_ratio,
-                     const float max_distance, const bool cross_check,
-                     FeatureMatches* matches) {
+// Compute the best matching candidates of the descriptors of the first image
+// with the product-quantized descriptors of the second image in both
+// directions. The dot products of every descriptor of the first image are
+// looked up from its table of dot products with the centroids, which are the
+// same for the matches from the second to the first image.
+void ComputeQuantizedSiftMatchCandidates(
+    const ProductQuantizer& quantizer, const FeatureDescriptors& descriptors1,
+    const FeatureDescriptorCodes& codes2,
+    std::vector<SiftMatchCandidates>* candidates12,
+    std::vector<SiftMatchCandidates>* candidates21) {
+  TRACE_SCOPE("ComputeQuantizedSiftMatchCandidates");
+
+  const int num_descriptors1 = static_cast<int>(descriptors1.rows());
+  const int num_descriptors2 = static_cast<int>(codes2.rows());
+
+  candidates12->clear();
+  candidates12->resize(num_descriptors1);
+  candidates21->clear();
+  candidates21->resize(num_descriptors2);
+
+  if (num_descriptors1 == 0 || num_descriptors2 == 0) {
+    return;
+  }
+
+  const int num_subspaces = quantizer.NumSubspaces();
+  CHECK_EQ(descriptors1.cols(), 128);
+  CHECK_EQ(codes2.cols(), num_subspaces);
+
+  std::vector<int> table;
+  for (int i1 = 0; i1 < num_descriptors1; ++i1) {
+    quantizer.ComputeDotProductTable(descriptors1.data() + 128 * i1, &table);
+    SiftMatchCandidates& candidate12 = (*candidates12)[i1];
+    const uint8_t* code2 = codes2.data();
+    for (int i2 = 0; i2 < num_descriptors2; ++i2) {
+      int dist = 0;
+      const int* subspace_table = table.data();
+      for (int subspace = 0; subspace < num_subspaces; ++subspace) {
+        dist += subspace_table[code2[subspace]];
+        subspace_table += ProductQuantizer::kNumCentroids;
+      }
+      candidate12.Update(i2, dist);
+      (*candidates21)[i2].Update(i1, dist);
+      code2 += num_subspaces;
+    }
+  }
+}
+
+void FindBestMatchesFromCandidates(
+    const std::vector<SiftMatchCandidates>& candidates12,
+    const std::vector<SiftMatchCandidates>& candidates21,
+    const float max_ratio, const float max_distance, const bool cross_check,
+    FeatureMatches* matches) {
   matches->clear();
 
   std::vector<int> matches12;
   const size_t num_matches12 =
-      FindBestMatchesOneWay(dists, max_ratio, max_distance, &matches12);
+      FindBestMatchesOneWay(candidates12, max_ratio, max_distance, &matches12);
 
   if (cross_check) {
     std::vector<int> matches21;
     const size_t num_matches21 = FindBestMatchesOneWay(
-        dists.transpose(), max_ratio, max_distance, &matches21);
+        candidates21, max_ratio, max_distance, &matches21);
     matches->reserve(std::min(num_matches12, num_matches21));
     for (size_t i1 = 0; i1 < matches12.size(); ++i1) {
       if (matches12[i1] != -1 && matches21[matches12[i1]] != -1 &&
@@ -182,6 +387,23 @@ void FindBestMatches(const Eigen::MatrixXi& dists, const float max_ratio,
   }
 }
 
+void FindBestMatches(const FeatureKeypoints* keypoints1,
+                     const FeatureKeypoints* keypoints2,
+                     const FeatureDescriptors& descriptors1,
+                     const FeatureDescriptors& descriptors2,
+                     const std::function<bool(float, float, float, float)>&
+                         guided_filter,
+                     const float max_ratio, const float max_distance,
+                     const bool cross_check, FeatureMatches* matches) {
+  std::vector<SiftMatchCandidates> candidates12;
+  std::vector<SiftMatchCandidates> candidates21;
+  ComputeSiftMatchCandidates(keypoints1, keypoints2, descriptors1,
+                             descriptors2, guided_filter, &candidates12,
+                             &candidates21);
+  FindBestMatchesFromCandidates(candidates12, candidates21, max_ratio,
+                                max_distance, cross_check, matches);
+}
+
 void WarnIfMaxNumMatchesReachedGPU(const SiftMatchGPU& sift_match_gpu,
                                    const FeatureDescriptors& descriptors) {
   if (sift_match_gpu.GetMaxSift() < descriptors.rows()) {
@@ -198,57 +420,30 @@ void WarnDarknessAdaptivityNotAvailable() {
             << std::endl;
 }
 
-}  // namespace
-
-bool SiftExtractionOptions::Check() const {
-  if (use_gpu) {
-    CHECK_OPTION_GT(CSVToVector<int>(gpu_index).size(), 0);
-  }
-  CHECK_OPTION_GT(max_image_size, 0);
-  CHECK_OPTION_GT(max_num_features, 0);
-  CHECK_OPTION_GT(octave_resolution, 0);
-  CHECK_OPTION_GT(peak_threshold, 0.0);
-  CHECK_OPTION_GT(edge_threshold, 0.0);
-  CHECK_OPTION_GT(max_num_orientations, 0);
-  if (domain_size_pooling) {
-    CHECK_OPTION_GT(dsp_min_scale, 0);
-    CHECK_OPTION_GE(dsp_max_scale, dsp_min_scale);
-    CHECK_OPTION_GT(dsp_num_scales, 0);
-  }
-  return true;
-}
-
-bool SiftMatchingOptions::Check() const {
-  if (use_gpu) {
-    CHECK_OPTION_GT(CSVToVector<int>(gpu_index).size(), 0);
-  }
-  CHECK_OPTION_GT(max_ratio, 0.0);
-  CHECK_OPTION_GT(max_distance, 0.0);
-  CHECK_OPTION_GT(max_error, 0.0);
-  CHECK_OPTION_GT(max_num_trials, 0);
-  CHECK_OPTION_GE(min_inlier_ratio, 0);
-  CHECK_OPTION_LE(min_inlier_ratio, 1);
-  CHECK_OPTION_GE(min_num_inliers, 0);
-  return true;
-}
-
-bool ExtractSiftFeaturesCPU(const SiftExtractionOptions& options,
-                            const Bitmap& bitmap, FeatureKeypoints* keypoints,
-                            FeatureDescriptors* descriptors) {
-  CHECK(options.Check());
-  CHECK(bitmap.IsGrey());
-  CHECK_NOTNULL(keypoints);
-
-  CHECK(!options.estimate_affine_shape);
-  CHECK(!options.domain_size_pooling);
-
-  if (options.darkness_adaptivity) {
-    WarnDarknessAdaptivityNotAvailable();
-  }
-
+// The features of one DOG level of the VLFeat SIFT pyramid.
+struct SiftLevelFeatures {
+  int octave = 0;
+  int level = 0;
+  // The number of detected keypoints, without multiple orientations.
+  size_t num_features = 0;
+  FeatureKeypoints keypoints;
+  FeatureDescriptors descriptors;
+};
+
+// Extract the features of a row-major image with intensities in [0, 1] by DOG
+// level. The keypoints are shifted by the offset of the image, and only the
+// keypoints inside the region [min_x, max_x) x [min_y, max_y) are kept.
+bool ExtractSiftLevelFeaturesCPU(const SiftExtractionOptions& options,
+                                 const float* data, const int width,
+                                 const int height, const int offset_x,
+                                 const int offset_y, const float min_x,
+                                 const float min_y, const float max_x,
+                                 const float max_y,
+                                 const bool extract_descriptors,
+                                 std::vector<SiftLevelFeatures>* levels) {
   // Setup SIFT extractor.
   std::unique_ptr<VlSiftFilt, void (*)(VlSiftFilt*)> sift(
-      vl_sift_new(bitmap.Width(), bitmap.Height(), options.num_octaves,
+      vl_sift_new(width, height, options.num_octaves,
                   options.octave_resolution, options.first_octave),
       &vl_sift_delete);
   if (!sift) {
@@ -258,19 +453,22 @@ bool ExtractSiftFeaturesCPU(const SiftExtractionOptions& options,
   vl_sift_set_peak_thresh(sift.get(), options.peak_threshold);
   vl_sift_set_edge_thresh(sift.get(), options.edge_threshold);
 
+  // Resize containers of the last DOG level.
+  size_t level_idx = 0;
+  const auto FinishLevel = [&]() {
+    if (!levels->empty()) {
+      levels->back().keypoints.resize(level_idx);
+      if (extract_descriptors) {
+        levels->back().descriptors.conservativeResize(level_idx, 128);
+      }
+    }
+  };
+
   // Iterate through octaves.
-  std::vector<size_t> level_num_features;
-  std::vector<FeatureKeypoints> level_keypoints;
-  std::vector<FeatureDescriptors> level_descriptors;
   bool first_octave = true;
   while (true) {
     if (first_octave) {
-      const std::vector<uint8_t> data_uint8 = bitmap.ConvertToRowMajorArray();
-      std::vector<float> data_float(data_uint8.size());
-      for (size_t i = 0; i < data_uint8.size(); ++i) {
-        data_float[i] = static_cast<float>(data_uint8[i]) / 255.0f;
-      }
-      if (vl_sift_process_first_octave(sift.get(), data_float.data())) {
+      if (vl_sift_process_first_octave(sift.get(), data)) {
         break;
       }
       first_octave = false;
@@ -286,36 +484,36 @@ bool ExtractSiftFeaturesCPU(const SiftExtractionOptions& options,
     // Extract detected keypoints.
     const VlSiftKeypoint* vl_keypoints = vl_sift_get_keypoints(sift.get());
     const int num_keypoints = vl_sift_get_nkeypoints(sift.get());
-    if (num_keypoints == 0) {
-      continue;
-    }
+    const int octave = vl_sift_get_octave_index(sift.get());
 
     // Extract features with different orientations per DOG level.
-    size_t level_idx = 0;
-    int prev_level = -1;
+    bool new_octave = true;
     for (int i = 0; i < num_keypoints; ++i) {
-      if (vl_keypoints[i].is != prev_level) {
-        if (i > 0) {
-          // Resize containers of previous DOG level.
-          level_keypoints.back().resize(level_idx);
-          if (descriptors != nullptr) {
-            level_descriptors.back().conservativeResize(level_idx, 128);
-          }
-        }
+      const float x = vl_keypoints[i].x + 0.5f + offset_x;
+      const float y = vl_keypoints[i].y + 0.5f + offset_y;
+      if (x < min_x || x >= max_x || y < min_y || y >= max_y) {
+        continue;
+      }
+
+      if (new_octave || vl_keypoints[i].is != levels->back().level) {
+        FinishLevel();
 
         // Add containers for new DOG level.
         level_idx = 0;
-        level_num_features.push_back(0);
-        level_keypoints.emplace_back(options.max_num_orientations *
-                                     num_keypoints);
-        if (descriptors != nullptr) {
-          level_descriptors.emplace_back(
+        levels->emplace_back();
+        levels->back().octave = octave;
+        levels->back().level = vl_keypoints[i].is;
+        levels->back().keypoints.resize(options.max_num_orientations *
+                                        num_keypoints);
+        if (extract_descriptors) {
+          levels->back().descriptors.resize(
               options.max_num_orientations * num_keypoints, 128);
         }
+        new_octave = false;
       }
 
-      level_num_features.back() += 1;
-      prev_level = vl_keypoints[i].is;
+      SiftLevelFeatures& level = levels->back();
+      level.num_features += 1;
 
       // Extract feature orientations.
       double angles[4];
@@ -335,10 +533,9 @@ bool ExtractSiftFeaturesCPU(const SiftExtractionOptions& options,
           std::min(num_orientations, options.max_num_orientations);
 
       for (int o = 0; o < num_used_orientations; ++o) {
-        level_keypoints.back()[level_idx] =
-            FeatureKeypoint(vl_keypoints[i].x + 0.5f, vl_keypoints[i].y + 0.5f,
-                            vl_keypoints[i].sigma, angles[o]);
-        if (descriptors != nullptr) {
+        level.keypoints[level_idx] =
+            FeatureKeypoint(x, y, vl_keypoints[i].sigma, angles[o]);
+        if (extract_descriptors) {
           Eigen::MatrixXf desc(1, 128);
           vl_sift_calc_keypoint_descriptor(sift.get(), desc.data(),
                                            &vl_keypoints[i], angles[o]);
@@ -352,7 +549,7 @@ bool ExtractSiftFeaturesCPU(const SiftExtractionOptions& options,
             LOG(FATAL) << "Normalization type not supported";
           }
 
-          level_descriptors.back().row(level_idx) =
+          level.descriptors.row(level_idx) =
               FeatureDescriptorsToUnsignedByte(desc);
         }
 
@@ -361,9 +558,264 @@ bool ExtractSiftFeaturesCPU(const SiftExtractionOptions& options,
     }
 
     // Resize containers for last DOG level in octave.
-    level_keypoints.back().resize(level_idx);
-    if (descriptors != nullptr) {
-      level_descriptors.back().conservativeResize(level_idx, 128);
+    if (!new_octave) {
+      FinishLevel();
+    }
+  }
+
+  return true;
+}
+
+// Extract the features of the overlapping tiles of the image in parallel and
+// merge the DOG levels with the same octave and level of all tiles. Every
+// keypoint is kept only from the tile, in whose interior it is located, so
+// that the features in the overlap of neighboring tiles are not duplicated.
+bool ExtractTiledSiftLevelFeaturesCPU(const SiftExtractionOptions& options,
+                                      const Bitmap& bitmap,
+                                      const bool extract_descriptors,
+                                      std::vector<SiftLevelFeatures>* levels) {
+  const int width = bitmap.Width();
+  const int height = bitmap.Height();
+  const std::vector<uint8_t> data_uint8 = bitmap.ConvertToRowMajorArray();
+
+  std::vector<Eigen::Vector2i> tile_origins;
+  for (int y = 0; y < height; y += options.tile_size) {
+    for (int x = 0; x < width; x += options.tile_size) {
+      tile_origins.emplace_back(x, y);
+    }
+  }
+
+  std::vector<std::vector<SiftLevelFeatures>> tile_levels(tile_origins.size());
+
+  const auto ExtractTile = [&](const size_t tile_idx) {
+    const int min_x = tile_origins[tile_idx].x();
+    const int min_y = tile_origins[tile_idx].y();
+    const int max_x = std::min(width, min_x + options.tile_size);
+    const int max_y = std::min(height, min_y + options.tile_size);
+    const int x0 = std::max(0, min_x - options.tile_overlap);
+    const int y0 = std::max(0, min_y - options.tile_overlap);
+    const int x1 = std::min(width, max_x + options.tile_overlap);
+    const int y1 = std::min(height, max_y + options.tile_overlap);
+
+    std::vector<float> data_float((x1 - x0) * (y1 - y0));
+    for (int y = y0; y < y1; ++y) {
+      for (int x = x0; x < x1; ++x) {
+        data_float[(y - y0) * (x1 - x0) + x - x0] =
+            static_cast<float>(data_uint8[y * width + x]) / 255.0f;
+      }
+    }
+
+    return ExtractSiftLevelFeaturesCPU(
+        options, data_float.data(), x1 - x0, y1 - y0, x0, y0, min_x, min_y,
+        max_x, max_y, extract_descriptors, &tile_levels[tile_idx]);
+  };
+
+  const int num_threads =
+      std::min(GetEffectiveNumThreads(options.num_tile_threads),
+               static_cast<int>(tile_origins.size()));
+  ThreadPool thread_pool(num_threads);
+  std::vector<std::future<bool>> futures;
+  futures.reserve(tile_origins.size());
+  for (size_t tile_idx = 0; tile_idx < tile_origins.size(); ++tile_idx) {
+    futures.push_back(thread_pool.AddTask(ExtractTile, tile_idx));
+  }
+
+  bool success = true;
+  for (auto& future : futures) {
+    success &= future.get();
+  }
+  if (!success) {
+    return false;
+  }
+
+  // Merge the levels of all tiles from fine to coarse scales.
+  std::map<std::pair<int, int>, SiftLevelFeatures> merged_levels;
+  for (const auto& tile : tile_levels) {
+    for (const auto& level : tile) {
+      SiftLevelFeatures& merged_level =
+          merged_levels[std::make_pair(level.octave, level.level)];
+      merged_level.octave = level.octave;
+      merged_level.level = level.level;
+      merged_level.num_features += level.num_features;
+      merged_level.keypoints.insert(merged_level.keypoints.end(),
+                                    level.keypoints.begin(),
+                                    level.keypoints.end());
+    }
+  }
+
+  if (extract_descriptors) {
+    for (auto& merged_level : merged_levels) {
+      merged_level.second.descriptors.resize(
+          merged_level.second.keypoints.size(), 128);
+    }
+    std::map<std::pair<int, int>, size_t> num_merged_rows;
+    for (const auto& tile : tile_levels) {
+      for (const auto& level : tile) {
+        const auto key = std::make_pair(level.octave, level.level);
+        size_t& row = num_merged_rows[key];
+        merged_levels[key].descriptors.middleRows(row,
+                                                  level.descriptors.rows()) =
+            level.descriptors;
+        row += level.descriptors.rows();
+      }
+    }
+  }
+
+  levels->clear();
+  levels->reserve(merged_levels.size());
+  for (auto& merged_level : merged_levels) {
+    levels->push_back(std::move(merged_level.second));
+  }
+
+  return true;
+}
+
+// Calls `func(covdet, begin, end)` on consecutive chunks of the frames
+// [0, num_frames) with the given number of threads. The per-frame functions of
+// VLFeat write to scratch buffers of the detector, so that every thread works
+// on its own detector, which shares the scale space of `covdet`.
+template <typename Func>
+bool ParallelForCovariantFrames(VlCovDet* covdet, const int num_threads,
+                                const size_t num_frames, const Func& func) {
+  const size_t kNumFramesPerChunk = 32;
+  const size_t num_chunks =
+      (num_frames + kNumFramesPerChunk - 1) / kNumFramesPerChunk;
+  const int num_eff_threads =
+      std::min(GetEffectiveNumThreads(num_threads),
+               static_cast<int>(num_chunks));
+  if (num_eff_threads <= 1) {
+    func(covdet, 0, num_frames);
+    return true;
+  }
+
+  std::vector<std::unique_ptr<VlCovDet, void (*)(VlCovDet*)>> thread_covdets;
+  thread_covdets.reserve(num_eff_threads);
+  for (int thread_idx = 0; thread_idx < num_eff_threads; ++thread_idx) {
+    thread_covdets.emplace_back(vl_covdet_new_shared(covdet),
+                                &vl_covdet_delete);
+    if (!thread_covdets.back()) {
+      return false;
+    }
+  }
+
+  // The chunks are claimed dynamically, since the cost of the frames varies
+  // with the number of iterations of the shape adaptation.
+  std::atomic<size_t> next_chunk_idx(0);
+  const auto ProcessChunks = [&](const int thread_idx) {
+    VlCovDet* thread_covdet = thread_covdets[thread_idx].get();
+    for (size_t chunk_idx = next_chunk_idx++; chunk_idx < num_chunks;
+         chunk_idx = next_chunk_idx++) {
+      const size_t begin = chunk_idx * kNumFramesPerChunk;
+      const size_t end = std::min(num_frames, begin + kNumFramesPerChunk);
+      func(thread_covdet, begin, end);
+    }
+  };
+
+  ThreadPool thread_pool(num_eff_threads);
+  std::vector<std::future<void>> futures;
+  futures.reserve(num_eff_threads);
+  for (int thread_idx = 0; thread_idx < num_eff_threads; ++thread_idx) {
+    futures.push_back(thread_pool.AddTask(ProcessChunks, thread_idx));
+  }
+  for (auto& future : futures) {
+    future.get();
+  }
+
+  return true;
+}
+
+// Rotates the frame of the feature by the given angle, as done by
+// vl_covdet_extract_orientations.
+VlCovDetFeature OrientCovariantFeature(
+    const VlCovDetFeature& feature,
+    const VlCovDetFeatureOrientation& orientation) {
+  const double r1 = std::cos(orientation.angle);
+  const double r2 = std::sin(orientation.angle);
+  VlCovDetFeature oriented = feature;
+  oriented.orientationScore = orientation.score;
+  oriented.frame.a11 = feature.frame.a11 * r1 + feature.frame.a12 * r2;
+  oriented.frame.a21 = feature.frame.a21 * r1 + feature.frame.a22 * r2;
+  oriented.frame.a12 = -feature.frame.a11 * r2 + feature.frame.a12 * r1;
+  oriented.frame.a22 = -feature.frame.a21 * r2 + feature.frame.a22 * r1;
+  return oriented;
+}
+
+}  // namespace
+
+bool SiftExtractionOptions::Check() const {
+  if (use_gpu) {
+    CHECK_OPTION_GT(CSVToVector<int>(gpu_index).size(), 0);
+  }
+  CHECK_OPTION_GT(max_image_size, 0);
+  CHECK_OPTION_GT(max_num_features, 0);
+  CHECK_OPTION_GT(octave_resolution, 0);
+  CHECK_OPTION_GT(peak_threshold, 0.0);
+  CHECK_OPTION_GT(edge_threshold, 0.0);
+  CHECK_OPTION_GT(max_num_orientations, 0);
+  CHECK_OPTION_GE(tile_size, 0);
+  CHECK_OPTION_GE(tile_overlap, 0);
+  CHECK_OPTION_NE(num_tile_threads, 0);
+  if (domain_size_pooling) {
+    CHECK_OPTION_GT(dsp_min_scale, 0);
+    CHECK_OPTION_GE(dsp_max_scale, dsp_min_scale);
+    CHECK_OPTION_GT(dsp_num_scales, 0);
+  }
+  return true;
+}
+
+bool SiftMatchingOptions::Check() const {
+  if (use_gpu) {
+    CHECK_OPTION_GT(CSVToVector<int>(gpu_index).size(), 0);
+  }
+  CHECK_OPTION_GT(max_ratio, 0.0);
+  CHECK_OPTION_GT(max_distance, 0.0);
+  CHECK_OPTION_GT(max_error, 0.0);
+  CHECK_OPTION_GT(max_num_trials, 0);
+  CHECK_OPTION_GE(min_inlier_ratio, 0);
+  CHECK_OPTION_LE(min_inlier_ratio, 1);
+  CHECK_OPTION_GE(min_num_inliers, 0);
+  CHECK_OPTION_GT(verification_batch_size, 0);
+  CHECK_OPTION_GT(max_num_models, 0);
+  CHECK_OPTION_GE(descriptor_cache_size, 0);
+  return true;
+}
+
+bool ExtractSiftFeaturesCPU(const SiftExtractionOptions& options,
+                            const Bitmap& bitmap, FeatureKeypoints* keypoints,
+                            FeatureDescriptors* descriptors) {
+  CHECK(options.Check());
+  CHECK(bitmap.IsGrey());
+  CHECK_NOTNULL(keypoints);
+
+  CHECK(!options.estimate_affine_shape);
+  CHECK(!options.domain_size_pooling);
+
+  if (options.darkness_adaptivity) {
+    WarnDarknessAdaptivityNotAvailable();
+  }
+
+  const bool extract_descriptors = descriptors != nullptr;
+
+  std::vector<SiftLevelFeatures> levels;
+  if (options.tile_size > 0 &&
+      (static_cast<int>(bitmap.Width()) > options.tile_size ||
+       static_cast<int>(bitmap.Height()) > options.tile_size)) {
+    if (!ExtractTiledSiftLevelFeaturesCPU(options, bitmap, extract_descriptors,
+                                          &levels)) {
+      return false;
+    }
+  } else {
+    const std::vector<uint8_t> data_uint8 = bitmap.ConvertToRowMajorArray();
+    std::vector<float> data_float(data_uint8.size());
+    for (size_t i = 0; i < data_uint8.size(); ++i) {
+      data_float[i] = static_cast<float>(data_uint8[i]) / 255.0f;
+    }
+    const float kMaxCoord = std::numeric_limits<float>::max();
+    if (!ExtractSiftLevelFeaturesCPU(
+            options, data_float.data(), bitmap.Width(), bitmap.Height(), 0, 0,
+            -kMaxCoord, -kMaxCoord, kMaxCoord, kMaxCoord, extract_descriptors,
+            &levels)) {
+      return false;
     }
   }
 
@@ -371,9 +823,9 @@ bool ExtractSiftFeaturesCPU(const SiftExtractionOptions& options,
   int first_level_to_keep = 0;
   int num_features = 0;
   int num_features_with_orientations = 0;
-  for (int i = level_keypoints.size() - 1; i >= 0; --i) {
-    num_features += level_num_features[i];
-    num_features_with_orientations += level_keypoints[i].size();
+  for (int i = levels.size() - 1; i >= 0; --i) {
+    num_features += levels[i].num_features;
+    num_features_with_orientations += levels[i].keypoints.size();
     if (num_features > options.max_num_features) {
       first_level_to_keep = i;
       break;
@@ -384,9 +836,9 @@ bool ExtractSiftFeaturesCPU(const SiftExtractionOptions& options,
   {
     size_t k = 0;
     keypoints->resize(num_features_with_orientations);
-    for (size_t i = first_level_to_keep; i < level_keypoints.size(); ++i) {
-      for (size_t j = 0; j < level_keypoints[i].size(); ++j) {
-        (*keypoints)[k] = level_keypoints[i][j];
+    for (size_t i = first_level_to_keep; i < levels.size(); ++i) {
+      for (size_t j = 0; j < levels[i].keypoints.size(); ++j) {
+        (*keypoints)[k] = levels[i].keypoints[j];
         k += 1;
       }
     }
@@ -396,9 +848,9 @@ bool ExtractSiftFeaturesCPU(const SiftExtractionOptions& options,
   if (descriptors != nullptr) {
     size_t k = 0;
     descriptors->resize(num_features_with_orientations, 128);
-    for (size_t i = first_level_to_keep; i < level_keypoints.size(); ++i) {
-      for (size_t j = 0; j < level_keypoints[i].size(); ++j) {
-        descriptors->row(k) = level_descriptors[i].row(j);
+    for (size_t i = first_level_to_keep; i < levels.size(); ++i) {
+      for (size_t j = 0; j < levels[i].keypoints.size(); ++j) {
+        descriptors->row(k) = levels[i].descriptors.row(j);
         k += 1;
       }
     }
@@ -447,20 +899,85 @@ bool ExtractCovariantSiftFeaturesCPU(const SiftExtractionOptions& options,
 
   vl_covdet_detect(covdet.get(), options.max_num_features);
 
+  std::vector<VlCovDetFeature> features(
+      vl_covdet_get_features(covdet.get()),
+      vl_covdet_get_features(covdet.get()) +
+          vl_covdet_get_num_features(covdet.get()));
+
+  // Estimate the affine shape or the orientations of the detected frames in
+  // parallel. The features are kept in the same order as by the serial
+  // vl_covdet_extract_affine_shape and vl_covdet_extract_orientations.
   if (!options.upright) {
     if (options.estimate_affine_shape) {
-      vl_covdet_extract_affine_shape(covdet.get());
+      std::vector<char> adapted(features.size(), 0);
+      if (!ParallelForCovariantFrames(
+              covdet.get(), options.num_tile_threads, features.size(),
+              [&](VlCovDet* thread_covdet, const size_t begin,
+                  const size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                  VlFrameOrientedEllipse adapted_frame;
+                  if (vl_covdet_extract_affine_shape_for_frame(
+                          thread_covdet, &adapted_frame, features[i].frame) ==
+                      VL_ERR_OK) {
+                    features[i].frame = adapted_frame;
+                    adapted[i] = 1;
+                  }
+                }
+              })) {
+        return false;
+      }
+
+      // Discard the features, for which the adaptation failed.
+      size_t num_adapted = 0;
+      for (size_t i = 0; i < features.size(); ++i) {
+        if (adapted[i]) {
+          features[num_adapted] = features[i];
+          num_adapted += 1;
+        }
+      }
+      features.resize(num_adapted);
     } else {
-      vl_covdet_extract_orientations(covdet.get());
+      std::vector<std::vector<VlCovDetFeature>> oriented_features(
+          features.size());
+      if (!ParallelForCovariantFrames(
+              covdet.get(), options.num_tile_threads, features.size(),
+              [&](VlCovDet* thread_covdet, const size_t begin,
+                  const size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                  vl_size num_orientations = 0;
+                  const VlCovDetFeatureOrientation* orientations =
+                      vl_covdet_extract_orientations_for_frame(
+                          thread_covdet, &num_orientations, features[i].frame);
+                  for (vl_size j = 0; j < num_orientations; ++j) {
+                    oriented_features[i].push_back(
+                        OrientCovariantFeature(features[i], orientations[j]));
+                  }
+                }
+              })) {
+        return false;
+      }
+
+      // The first orientation replaces the feature and the others are
+      // appended, while features without orientation are kept unchanged.
+      for (size_t i = 0; i < oriented_features.size(); ++i) {
+        if (oriented_features[i].empty()) {
+          continue;
+        }
+        features[i] = oriented_features[i][0];
+      }
+      for (size_t i = 0; i < oriented_features.size(); ++i) {
+        for (size_t j = 1; j < oriented_features[i].size(); ++j) {
+          features.push_back(oriented_features[i][j]);
+        }
+      }
     }
   }
 
-  const int num_features = vl_covdet_get_num_features(covdet.get());
-  VlCovDetFeature* features = vl_covdet_get_features(covdet.get());
+  const int num_features = static_cast<int>(features.size());
 
   // Sort features according to detected octave and scale.
   std::sort(
-      features, features + num_features,
+      features.begin(), features.end(),
       [](const VlCovDetFeature& feature1, const VlCovDetFeature& feature2) {
         if (feature1.o == feature2.o) {
           return feature1.s > feature2.s;
@@ -507,9 +1024,6 @@ bool ExtractCovariantSiftFeaturesCPU(const SiftExtractionOptions& options,
     const double kSigma =
         kPatchRelativeExtent / (3.0 * (4 + 1) / 2) / kPatchStep;
 
-    std::vector<float> patch(kPatchSide * kPatchSide);
-    std::vector<float> patchXY(2 * kPatchSide * kPatchSide);
-
     float dsp_min_scale = 1;
     float dsp_scale_step = 0;
     int dsp_num_scales = 1;
@@ -520,9 +1034,8 @@ bool ExtractCovariantSiftFeaturesCPU(const SiftExtractionOptions& options,
       dsp_num_scales = options.dsp_num_scales;
     }
 
-    Eigen::Matrix<float, Eigen::Dynamic, 128, Eigen::RowMajor>
-        scaled_descriptors(dsp_num_scales, 128);
-
+    // The filter is only read by vl_sift_calc_raw_descriptor and can thus be
+    // shared by all threads.
     std::unique_ptr<VlSiftFilt, void (*)(VlSiftFilt*)> sift(
         vl_sift_new(16, 16, 1, 3, 0), &vl_sift_delete);
     if (!sift) {
@@ -531,47 +1044,65 @@ bool ExtractCovariantSiftFeaturesCPU(const SiftExtractionOptions& options,
 
     vl_sift_set_magnif(sift.get(), 3.0);
 
-    for (size_t i = 0; i < keypoints->size(); ++i) {
-      for (int s = 0; s < dsp_num_scales; ++s) {
-        const double dsp_scale = dsp_min_scale + s * dsp_scale_step;
+    const auto ExtractDescriptors = [&](VlCovDet* thread_covdet,
+                                        const size_t begin, const size_t end) {
+      std::vector<float> patch(kPatchSide * kPatchSide);
+      std::vector<float> patchXY(2 * kPatchSide * kPatchSide);
 
-        VlFrameOrientedEllipse scaled_frame = features[i].frame;
-        scaled_frame.a11 *= dsp_scale;
-        scaled_frame.a12 *= dsp_scale;
-        scaled_frame.a21 *= dsp_scale;
-        scaled_frame.a22 *= dsp_scale;
+      // The raw descriptors of all scales are accumulated in place instead
+      // of being stored and averaged afterwards.
+      Eigen::Matrix<float, 1, 128> scaled_descriptor;
+      Eigen::Matrix<float, 1, 128> descriptor;
 
-        vl_covdet_extract_patch_for_frame(
-            covdet.get(), patch.data(), kPatchResolution, kPatchRelativeExtent,
-            kPatchRelativeSmoothing, scaled_frame);
+      for (size_t i = begin; i < end; ++i) {
+        descriptor.setZero();
 
-        vl_imgradient_polar_f(patchXY.data(), patchXY.data() + 1, 2,
-                              2 * kPatchSide, patch.data(), kPatchSide,
-                              kPatchSide, kPatchSide);
+        for (int s = 0; s < dsp_num_scales; ++s) {
+          const double dsp_scale = dsp_min_scale + s * dsp_scale_step;
 
-        vl_sift_calc_raw_descriptor(sift.get(), patchXY.data(),
-                                    scaled_descriptors.row(s).data(),
-                                    kPatchSide, kPatchSide, kPatchResolution,
-                                    kPatchResolution, kSigma, 0);
-      }
+          VlFrameOrientedEllipse scaled_frame = features[i].frame;
+          scaled_frame.a11 *= dsp_scale;
+          scaled_frame.a12 *= dsp_scale;
+          scaled_frame.a21 *= dsp_scale;
+          scaled_frame.a22 *= dsp_scale;
 
-      Eigen::Matrix<float, 1, 128> descriptor;
-      if (options.domain_size_pooling) {
-        descriptor = scaled_descriptors.colwise().mean();
-      } else {
-        descriptor = scaled_descriptors;
-      }
+          vl_covdet_extract_patch_for_frame(
+              thread_covdet, patch.data(), kPatchResolution,
+              kPatchRelativeExtent, kPatchRelativeSmoothing, scaled_frame);
 
-      if (options.normalization == SiftExtractionOptions::Normalization::L2) {
-        descriptor = L2NormalizeFeatureDescriptors(descriptor);
-      } else if (options.normalization ==
-                 SiftExtractionOptions::Normalization::L1_ROOT) {
-        descriptor = L1RootNormalizeFeatureDescriptors(descriptor);
-      } else {
-        LOG(FATAL) << "Normalization type not supported";
+          vl_imgradient_polar_f(patchXY.data(), patchXY.data() + 1, 2,
+                                2 * kPatchSide, patch.data(), kPatchSide,
+                                kPatchSide, kPatchSide);
+
+          vl_sift_calc_raw_descriptor(sift.get(), patchXY.data(),
+                                      scaled_descriptor.data(), kPatchSide,
+                                      kPatchSide, kPatchResolution,
+                                      kPatchResolution, kSigma, 0);
+
+          descriptor += scaled_descriptor;
+        }
+
+        if (dsp_num_scales > 1) {
+          descriptor /= static_cast<float>(dsp_num_scales);
+        }
+
+        if (options.normalization ==
+            SiftExtractionOptions::Normalization::L2) {
+          descriptor = L2NormalizeFeatureDescriptors(descriptor);
+        } else if (options.normalization ==
+                   SiftExtractionOptions::Normalization::L1_ROOT) {
+          descriptor = L1RootNormalizeFeatureDescriptors(descriptor);
+        } else {
+          LOG(FATAL) << "Normalization type not supported";
+        }
+
+        descriptors->row(i) = FeatureDescriptorsToUnsignedByte(descriptor);
       }
+    };
 
-      descriptors->row(i) = FeatureDescriptorsToUnsignedByte(descriptor);
+    if (!ParallelForCovariantFrames(covdet.get(), options.num_tile_threads,
+                                    keypoints->size(), ExtractDescriptors)) {
+      return false;
     }
 
     *descriptors = TransformVLFeatToUBCFeatureDescriptors(*descriptors);
@@ -667,10 +1198,7 @@ bool CreateSiftGPUExtractor(const SiftExtractionOptions& options,
   sift_gpu->ParseParam(sift_gpu_args_cstr.size(), sift_gpu_args_cstr.data());
 
   sift_gpu->gpu_index = gpu_indices[0];
-  if (sift_extraction_mutexes.count(gpu_indices[0]) == 0) {
-    sift_extraction_mutexes.emplace(
-        gpu_indices[0], std::unique_ptr<std::mutex>(new std::mutex()));
-  }
+  GetSiftGPUMutex(&sift_extraction_mutexes, gpu_indices[0]);
 
   return sift_gpu->VerifyContextGL() == SiftGPU::SIFTGPU_FULL_SUPPORTED;
 }
@@ -679,8 +1207,22 @@ bool ExtractSiftFeaturesGPU(const SiftExtractionOptions& options,
                             const Bitmap& bitmap, SiftGPU* sift_gpu,
                             FeatureKeypoints* keypoints,
                             FeatureDescriptors* descriptors) {
-  CHECK(options.Check());
   CHECK(bitmap.IsGrey());
+  // Note, that this produces slightly different results than using SiftGPU
+  // directly for RGB->GRAY conversion, since it uses different weights.
+  const std::vector<uint8_t> bitmap_raw_bits = bitmap.ConvertToRawBits();
+  return ExtractSiftFeaturesGPU(options, bitmap.ScanWidth(), bitmap.Height(),
+                                bitmap_raw_bits.data(), sift_gpu, keypoints,
+                                descriptors);
+}
+
+bool ExtractSiftFeaturesGPU(const SiftExtractionOptions& options,
+                            const int scan_width, const int height,
+                            const uint8_t* raw_bits, SiftGPU* sift_gpu,
+                            FeatureKeypoints* keypoints,
+                            FeatureDescriptors* descriptors) {
+  CHECK(options.Check());
+  CHECK_NOTNULL(raw_bits);
   CHECK_NOTNULL(keypoints);
   CHECK_NOTNULL(descriptors);
   CHECK_EQ(options.max_image_size, sift_gpu->GetMaxDimension());
@@ -688,34 +1230,38 @@ bool ExtractSiftFeaturesGPU(const SiftExtractionOptions& options,
   CHECK(!options.estimate_affine_shape);
   CHECK(!options.domain_size_pooling);
 
-  std::unique_lock<std::mutex> lock(
-      *sift_extraction_mutexes[sift_gpu->gpu_index]);
+  std::vector<SiftKeypoint> keypoints_data;
 
-  // Note, that this produces slightly different results than using SiftGPU
-  // directly for RGB->GRAY conversion, since it uses different weights.
-  const std::vector<uint8_t> bitmap_raw_bits = bitmap.ConvertToRawBits();
-  const int code =
-      sift_gpu->RunSIFT(bitmap.ScanWidth(), bitmap.Height(),
-                        bitmap_raw_bits.data(), GL_LUMINANCE, GL_UNSIGNED_BYTE);
+  // Eigen's default is ColMajor, but SiftGPU stores result as RowMajor.
+  Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+      descriptors_float;
 
-  const int kSuccessCode = 1;
-  if (code != kSuccessCode) {
-    return false;
-  }
+  // Only the upload, the extraction and the download hold the GPU, while the
+  // conversion of the features below overlaps the next image.
+  {
+    std::unique_lock<std::mutex> lock(
+        *GetSiftGPUMutex(&sift_extraction_mutexes, sift_gpu->gpu_index));
 
-  const size_t num_features = static_cast<size_t>(sift_gpu->GetFeatureNum());
+    const int code = sift_gpu->RunSIFT(scan_width, height, raw_bits,
+                                       GL_LUMINANCE, GL_UNSIGNED_BYTE);
 
-  std::vector<SiftKeypoint> keypoints_data(num_features);
+    const int kSuccessCode = 1;
+    if (code != kSuccessCode) {
+      return false;
+    }
 
-  // Eigen's default is ColMajor, but SiftGPU stores result as RowMajor.
-  Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
-      descriptors_float(num_features, 128);
+    const size_t num_features =
+        static_cast<size_t>(sift_gpu->GetFeatureNum());
+    keypoints_data.resize(num_features);
+    descriptors_float.resize(num_features, 128);
 
-  // Download the extracted keypoints and descriptors.
-  sift_gpu->GetFeatureVector(keypoints_data.data(), descriptors_float.data());
+    // Download the extracted keypoints and descriptors.
+    sift_gpu->GetFeatureVector(keypoints_data.data(),
+                               descriptors_float.data());
+  }
 
-  keypoints->resize(num_features);
-  for (size_t i = 0; i < num_features; ++i) {
+  keypoints->resize(keypoints_data.size());
+  for (size_t i = 0; i < keypoints_data.size(); ++i) {
     (*keypoints)[i] = FeatureKeypoint(keypoints_data[i].x, keypoints_data[i].y,
                                       keypoints_data[i].s, keypoints_data[i].o);
   }
@@ -790,6 +1336,59 @@ void LoadSiftFeaturesFromTextFile(const std::string& path,
   }
 }
 
+void LoadSiftFeaturesFromBinaryFile(const std::string& path,
+                                    FeatureKeypoints* keypoints,
+                                    FeatureDescriptors* descriptors) {
+  CHECK_NOTNULL(keypoints);
+  CHECK_NOTNULL(descriptors);
+
+  std::ifstream file(path, std::ios::binary);
+  CHECK(file.is_open()) << path;
+
+  const size_t num_features = ReadBinaryLittleEndian<uint64_t>(&file);
+  const size_t dim = ReadBinaryLittleEndian<uint64_t>(&file);
+  CHECK(file.good()) << path;
+  CHECK_EQ(dim, 128) << "SIFT features must have 128 dimensions";
+
+  // The keypoints and descriptors are read as blocks, as reading them value by
+  // value dominates the import time of large feature sets.
+  std::vector<float> keypoint_data(4 * num_features);
+  file.read(reinterpret_cast<char*>(keypoint_data.data()),
+            keypoint_data.size() * sizeof(float));
+  descriptors->resize(num_features, dim);
+  file.read(reinterpret_cast<char*>(descriptors->data()), descriptors->size());
+  CHECK(file.good()) << "Truncated feature file " << path;
+
+  keypoints->resize(num_features);
+  for (size_t i = 0; i < num_features; ++i) {
+    (*keypoints)[i] = FeatureKeypoint(
+        LittleEndianToNative(keypoint_data[4 * i]),
+        LittleEndianToNative(keypoint_data[4 * i + 1]),
+        LittleEndianToNative(keypoint_data[4 * i + 2]),
+        LittleEndianToNative(keypoint_data[4 * i + 3]));
+  }
+}
+
+void WriteSiftFeaturesToBinaryFile(const std::string& path,
+                                   const FeatureKeypoints& keypoints,
+                                   const FeatureDescriptors& descriptors) {
+  CHECK_EQ(keypoints.size(), descriptors.rows());
+
+  std::ofstream file(path, std::ios::trunc | std::ios::binary);
+  CHECK(file.is_open()) << path;
+
+  WriteBinaryLittleEndian<uint64_t>(&file, keypoints.size());
+  WriteBinaryLittleEndian<uint64_t>(&file, descriptors.cols());
+  for (const FeatureKeypoint& keypoint : keypoints) {
+    WriteBinaryLittleEndian<float>(&file, keypoint.x);
+    WriteBinaryLittleEndian<float>(&file, keypoint.y);
+    WriteBinaryLittleEndian<float>(&file, keypoint.ComputeScale());
+    WriteBinaryLittleEndian<float>(&file, keypoint.ComputeOrientation());
+  }
+  file.write(reinterpret_cast<const char*>(descriptors.data()),
+             descriptors.size());
+}
+
 void MatchSiftFeaturesCPU(const SiftMatchingOptions& match_options,
                           const FeatureDescriptors& descriptors1,
                           const FeatureDescriptors& descriptors2,
@@ -797,13 +1396,30 @@ void MatchSiftFeaturesCPU(const SiftMatchingOptions& match_options,
   CHECK(match_options.Check());
   CHECK_NOTNULL(matches);
 
-  const Eigen::MatrixXi dists = ComputeSiftDistanceMatrix(
-      nullptr, nullptr, descriptors1, descriptors2, nullptr);
-
-  FindBestMatches(dists, match_options.max_ratio, match_options.max_distance,
+  FindBestMatches(nullptr, nullptr, descriptors1, descriptors2, nullptr,
+                  match_options.max_ratio, match_options.max_distance,
                   match_options.cross_check, matches);
 }
 
+void MatchQuantizedSiftFeaturesCPU(const SiftMatchingOptions& match_options,
+                                   const ProductQuantizer& quantizer,
+                                   const FeatureDescriptors& descriptors1,
+                                   const FeatureDescriptorCodes& codes2,
+                                   FeatureMatches* matches) {
+  CHECK(match_options.Check());
+  CHECK(quantizer.IsTrained());
+  CHECK_NOTNULL(matches);
+
+  std::vector<SiftMatchCandidates> candidates12;
+  std::vector<SiftMatchCandidates> candidates21;
+  ComputeQuantizedSiftMatchCandidates(quantizer, descriptors1, codes2,
+                                      &candidates12, &candidates21);
+  FindBestMatchesFromCandidates(candidates12, candidates21,
+                                match_options.max_ratio,
+                                match_options.max_distance,
+                                match_options.cross_check, matches);
+}
+
 void MatchGuidedSiftFeaturesCPU(const SiftMatchingOptions& match_options,
                                 const FeatureKeypoints& keypoints1,
                                 const FeatureKeypoints& keypoints2,
@@ -849,11 +1465,9 @@ void MatchGuidedSiftFeaturesCPU(const SiftMatchingOptions& match_options,
 
   CHECK(guided_filter);
 
-  const Eigen::MatrixXi dists = ComputeSiftDistanceMatrix(
-      &keypoints1, &keypoints2, descriptors1, descriptors2, guided_filter);
-
-  FindBestMatches(dists, match_options.max_ratio, match_options.max_distance,
-                  match_options.cross_check,
+  FindBestMatches(&keypoints1, &keypoints2, descriptors1, descriptors2,
+                  guided_filter, match_options.max_ratio,
+                  match_options.max_distance, match_options.cross_check,
                   &two_view_geometry->inlier_matches);
 }
 
@@ -913,10 +1527,7 @@ bool CreateSiftGPUMatcher(const SiftMatchingOptions& match_options,
 #endif  // CUDA_ENABLED
 
   sift_match_gpu->gpu_index = gpu_indices[0];
-  if (sift_matching_mutexes.count(gpu_indices[0]) == 0) {
-    sift_matching_mutexes.emplace(
-        gpu_indices[0], std::unique_ptr<std::mutex>(new std::mutex()));
-  }
+  GetSiftGPUMutex(&sift_matching_mutexes, gpu_indices[0]);
 
   return true;
 }
@@ -931,7 +1542,7 @@ void MatchSiftFeaturesGPU(const SiftMatchingOptions& match_options,
   CHECK_NOTNULL(matches);
 
   std::unique_lock<std::mutex> lock(
-      *sift_matching_mutexes[sift_match_gpu->gpu_index]);
+      *GetSiftGPUMutex(&sift_matching_mutexes, sift_match_gpu->gpu_index));
 
   if (descriptors1 != nullptr) {
     CHECK_EQ(descriptors1->cols(), 128);
@@ -986,7 +1597,7 @@ void MatchGuidedSiftFeaturesGPU(const SiftMatchingOptions& match_options,
   CHECK_NOTNULL(two_view_geometry);
 
   std::unique_lock<std::mutex> lock(
-      *sift_matching_mutexes[sift_match_gpu->gpu_index]);
+      *GetSiftGPUMutex(&sift_matching_mutexes, sift_match_gpu->gpu_index));
 
   const size_t kFeatureShapeNumElems = 4;
 
@@ -1036,13 +1647,14 @@ void MatchGuidedSiftFeaturesGPU(const SiftMatchingOptions& match_options,
 
   CHECK(F_ptr != nullptr || H_ptr != nullptr);
 
-  two_view_geometry->inlier_matches.resize(
+  // The guided matches replace the inlier matches of the verification only if
+  // the matching succeeds, while the verified geometry is kept.
+  FeatureMatches guided_matches(
       static_cast<size_t>(match_options.max_num_matches));
 
   const int num_matches = sift_match_gpu->GetGuidedSiftMatch(
       match_options.max_num_matches,
-      reinterpret_cast<uint32_t(*)[2]>(
-          two_view_geometry->inlier_matches.data()),
+      reinterpret_cast<uint32_t(*)[2]>(guided_matches.data()),
       H_ptr, F_ptr, static_cast<float>(match_options.max_distance),
       static_cast<float>(match_options.max_ratio),
       static_cast<float>(match_options.max_error * match_options.max_error),
@@ -1054,10 +1666,10 @@ void MatchGuidedSiftFeaturesGPU(const SiftMatchingOptions& match_options,
                  "insufficient GPU memory. Consider reducing the maximum "
                  "number of features."
               << std::endl;
-    two_view_geometry->inlier_matches.clear();
   } else {
-    CHECK_LE(num_matches, two_view_geometry->inlier_matches.size());
-    two_view_geometry->inlier_matches.resize(num_matches);
+    CHECK_LE(num_matches, guided_matches.size());
+    guided_matches.resize(num_matches);
+    two_view_geometry->inlier_matches = std::move(guided_matches);
   }
 }
 
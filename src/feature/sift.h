@@ -18,6 +18,7 @@
 #define COLMAP_SRC_FEATURE_SIFT_H_
 
 #include "estimators/two_view_geometry.h"
+#include "feature/quantization.h"
 #include "feature/types.h"
 #include "util/bitmap.h"
 
@@ -43,6 +44,22 @@ struct SiftExtractionOptions {
   // Maximum number of features to detect, keeping larger-scale features.
   int max_num_features = 8192;
 
+  // If positive, images larger than this size are split into tiles of this
+  // size, which overlap by `tile_overlap` pixels and are processed by
+  // `num_tile_threads` threads, so that large images can be processed at full
+  // resolution, i.e. with a large `max_image_size`, in less time and memory.
+  // A feature is only kept from the tile that contains it without the
+  // overlap, which should cover the descriptor support of the largest
+  // features. Tiles are only supported by the CPU extraction without affine
+  // shape estimation and domain-size pooling, which is then used instead of
+  // the GPU. The covariant extraction with affine shape estimation or
+  // domain-size pooling uses `num_tile_threads` for the per-frame shape,
+  // orientation and descriptor computation. Note that every extraction thread
+  // uses `num_tile_threads`.
+  int tile_size = 0;
+  int tile_overlap = 128;
+  int num_tile_threads = -1;
+
   // First octave in the pyramid, i.e. -1 upsamples the image by one level.
   int first_octave = -1;
 
@@ -95,6 +112,11 @@ struct SiftExtractionOptions {
   };
   Normalization normalization = Normalization::L1_ROOT;
 
+  // If not empty, the features are looked up in and added to the
+  // content-addressed cache at this path, see `FeatureCache`. The features of
+  // cached images are read from the cache instead of decoding the images.
+  std::string feature_cache_path = "";
+
   bool Check() const;
 };
 
@@ -136,19 +158,64 @@ struct SiftMatchingOptions {
   // number of iterations.
   double min_inlier_ratio = 0.25;
 
+  // Whether to reject bad RANSAC hypotheses early with the sequential
+  // probability ratio test in the geometric verification.
+  bool use_sprt = false;
+
   // Minimum number of inliers for an image pair to be considered as
   // geometrically verified.
   int min_num_inliers = 15;
 
+  // Whether to estimate the epipolar geometry and the homography of an image
+  // pair jointly from shared RANSAC samples in the geometric verification,
+  // see `TwoViewGeometry::Options::joint_estimation`.
+  bool joint_verification = false;
+
+  // Whether to score the RANSAC hypotheses of the geometric verification on
+  // the GPU. The verification threads then verify batches of up to
+  // `verification_batch_size` image pairs, whose hypotheses are scored
+  // together on the GPU, and only draw the samples, refine the best models and
+  // decompose the geometries on the CPU. Requires CUDA and does not apply to
+  // the estimation of multiple models.
+  bool gpu_verification = false;
+  int verification_batch_size = 64;
+
   // Whether to attempt to estimate multiple geometric models per image pair.
+  // If enabled, up to `max_num_models` motions are extracted from one pool of
+  // RANSAC hypotheses and the inliers of all motions are stored together with
+  // the index of their motion.
   bool multiple_models = false;
 
+  // The maximum number of motions per image pair in multiple model estimation.
+  int max_num_models = 2;
+
   // Whether to perform guided matching, if geometric verification succeeds.
   bool guided_matching = false;
 
   // Border between the first and second image sets
   int border = 0;
 
+  // Maximum size in gigabytes of the descriptors cached by the matcher. If
+  // zero, a fixed number of images is cached, which depends on the matcher.
+  double descriptor_cache_size = 0.0;
+
+  // If not empty, the descriptors are read from a memory-mapped store at this
+  // path, which is built from the database if it is missing or stale. The
+  // store is shared by all matcher threads and by concurrent processes on
+  // the same database through the page cache.
+  std::string descriptor_store_path = "";
+
+  // Whether to match the product-quantized descriptor codes of the database
+  // instead of the descriptors, which requires a codebook in the database.
+  // The codes of the second image are compared to the descriptors of the first
+  // image by the asymmetric distance on the CPU, also if `use_gpu` is set.
+  bool use_descriptor_codes = false;
+
+  // If not empty, the matches and two-view geometries of the image pairs are
+  // looked up in and added to the content-addressed cache at this path, see
+  // `FeatureCache`, unless the descriptor codes are matched.
+  std::string feature_cache_path = "";
+
   bool Check() const;
 };
 
@@ -177,6 +244,15 @@ bool ExtractSiftFeaturesGPU(const SiftExtractionOptions& options,
                             FeatureKeypoints* keypoints,
                             FeatureDescriptors* descriptors);
 
+// Extract SIFT features on the GPU from the raw bits of a grey bitmap, see
+// `Bitmap::ConvertToRawBits`, which may be prepared by another thread, e.g. in
+// page-locked memory, while the GPU extracts the features of another image.
+bool ExtractSiftFeaturesGPU(const SiftExtractionOptions& options,
+                            const int scan_width, const int height,
+                            const uint8_t* raw_bits, SiftGPU* sift_gpu,
+                            FeatureKeypoints* keypoints,
+                            FeatureDescriptors* descriptors);
+
 // Load keypoints and descriptors from text file in the following format:
 //
 //    LINE_0:            NUM_FEATURES DIM
@@ -198,6 +274,23 @@ void LoadSiftFeaturesFromTextFile(const std::string& path,
                                   FeatureKeypoints* keypoints,
                                   FeatureDescriptors* descriptors);
 
+// Load and write SIFT features in the binary counterpart of the text format,
+// which is much faster to parse for large feature sets. All values are stored
+// in little-endian byte order:
+//
+//    NUM_FEATURES (uint64) DIM (uint64)
+//    X Y SCALE ORIENTATION (float32) of every feature
+//    D_1 D_2 ... D_DIM (uint8) of every feature
+//
+// The keypoints are written with their scale and orientation, so that their
+// affine shape is lost if it is not a similarity.
+void LoadSiftFeaturesFromBinaryFile(const std::string& path,
+                                    FeatureKeypoints* keypoints,
+                                    FeatureDescriptors* descriptors);
+void WriteSiftFeaturesToBinaryFile(const std::string& path,
+                                   const FeatureKeypoints& keypoints,
+                                   const FeatureDescriptors& descriptors);
+
 // Match the given SIFT features on the CPU.
 void MatchSiftFeaturesCPU(const SiftMatchingOptions& match_options,
                           const FeatureDescriptors& descriptors1,
@@ -210,6 +303,13 @@ void MatchGuidedSiftFeaturesCPU(const SiftMatchingOptions& match_options,
                                 const FeatureDescriptors& descriptors2,
                                 TwoViewGeometry* two_view_geometry);
 
+// Match the given SIFT features to product-quantized SIFT features on the CPU.
+void MatchQuantizedSiftFeaturesCPU(const SiftMatchingOptions& match_options,
+                                   const ProductQuantizer& quantizer,
+                                   const FeatureDescriptors& descriptors1,
+                                   const FeatureDescriptorCodes& codes2,
+                                   FeatureMatches* matches);
+
 // Create a SiftGPU feature matcher. Note that if CUDA is not available or the
 // gpu_index is -1, the OpenGLContextManager must be created in the main thread
 // of the Qt application before calling this function. The same SiftMatchGPU
@@ -0,0 +1,57 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifdef SIMD_AVX2_ENABLED
+
+#include <cstdint>
+
+#include <immintrin.h>
+
+namespace colmap {
+namespace internal {
+
+void ComputeSiftDotProductsAVX2(const uint8_t* descriptor1,
+                                const uint8_t* descriptors2,
+                                const int num_descriptors2, int* dots) {
+  // The products and their pairwise sums fit into 16 and 32 bit integers.
+  __m256i values1[8];
+  for (int k = 0; k < 8; ++k) {
+    values1[k] = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(descriptor1 + 16 * k)));
+  }
+
+  for (int i = 0; i < num_descriptors2; ++i) {
+    const uint8_t* descriptor2 = descriptors2 + 128 * i;
+    __m256i sum = _mm256_setzero_si256();
+    for (int k = 0; k < 8; ++k) {
+      const __m256i values2 = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(descriptor2 + 16 * k)));
+      sum = _mm256_add_epi32(sum, _mm256_madd_epi16(values1[k], values2));
+    }
+    __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                                   _mm256_extracti128_si256(sum, 1));
+    sum128 = _mm_add_epi32(
+        sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum128 = _mm_add_epi32(
+        sum128, _mm_shuffle_epi32(sum128, _MM_SHUFFLE(2, 3, 0, 1)));
+    dots[i] = _mm_cvtsi128_si32(sum128);
+  }
+}
+
+}  // namespace internal
+}  // namespace colmap
+
+#endif  // SIMD_AVX2_ENABLED
@@ -19,6 +19,8 @@
 
 #include <QApplication>
 
+#include <boost/filesystem.hpp>
+
 #include "ext/SiftGPU/SiftGPU.h"
 #include "feature/sift.h"
 #include "feature/utils.h"
@@ -64,6 +66,45 @@ BOOST_AUTO_TEST_CASE(TestExtractSiftFeaturesCPU) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(TestExtractSiftFeaturesCPUTiled) {
+  Bitmap bitmap;
+  CreateImageWithSquare(256, &bitmap);
+
+  SiftExtractionOptions options;
+  FeatureKeypoints keypoints;
+  FeatureDescriptors descriptors;
+  BOOST_CHECK(
+      ExtractSiftFeaturesCPU(options, bitmap, &keypoints, &descriptors));
+
+  // With an overlap that covers the whole image, the tiles see the same image
+  // and every feature is kept from exactly one tile.
+  options.tile_size = 100;
+  options.tile_overlap = 256;
+  options.num_tile_threads = 2;
+  FeatureKeypoints tiled_keypoints;
+  FeatureDescriptors tiled_descriptors;
+  BOOST_CHECK(ExtractSiftFeaturesCPU(options, bitmap, &tiled_keypoints,
+                                     &tiled_descriptors));
+  BOOST_CHECK_EQUAL(tiled_keypoints.size(), keypoints.size());
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    BOOST_CHECK_EQUAL(tiled_keypoints[i].x, keypoints[i].x);
+    BOOST_CHECK_EQUAL(tiled_keypoints[i].y, keypoints[i].y);
+  }
+  BOOST_CHECK(tiled_descriptors == descriptors);
+
+  options.tile_overlap = 16;
+  BOOST_CHECK(ExtractSiftFeaturesCPU(options, bitmap, &tiled_keypoints,
+                                     &tiled_descriptors));
+  BOOST_CHECK_GT(tiled_keypoints.size(), 0);
+  BOOST_CHECK_EQUAL(tiled_descriptors.rows(), tiled_keypoints.size());
+  for (const auto& keypoint : tiled_keypoints) {
+    BOOST_CHECK_GE(keypoint.x, 0);
+    BOOST_CHECK_GE(keypoint.y, 0);
+    BOOST_CHECK_LE(keypoint.x, bitmap.Width());
+    BOOST_CHECK_LE(keypoint.y, bitmap.Height());
+  }
+}
+
 BOOST_AUTO_TEST_CASE(TestExtractCovariantSiftFeaturesCPU) {
   Bitmap bitmap;
   CreateImageWithSquare(256, &bitmap);
@@ -175,6 +216,51 @@ BOOST_AUTO_TEST_CASE(TestExtractCovariantAffineDSPSiftFeaturesCPU) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(TestExtractCovariantSiftFeaturesCPUParallel) {
+  // Many squares, such that the frames are split into several chunks.
+  Bitmap bitmap;
+  bitmap.Allocate(512, 512, false);
+  bitmap.Fill(BitmapColor<uint8_t>(0));
+  for (int i = 0; i < 8; ++i) {
+    for (int j = 0; j < 8; ++j) {
+      const int size = 8 + 2 * ((i + j) % 8);
+      for (int r = 64 * i + 16; r < 64 * i + 16 + size; ++r) {
+        for (int c = 64 * j + 16; c < 64 * j + 16 + size; ++c) {
+          bitmap.SetPixel(c, r, BitmapColor<uint8_t>(64 + 16 * ((i * j) % 12)));
+        }
+      }
+    }
+  }
+
+  for (const bool estimate_affine_shape : {false, true}) {
+    SiftExtractionOptions options;
+    options.estimate_affine_shape = estimate_affine_shape;
+    options.domain_size_pooling = true;
+    options.num_tile_threads = 1;
+    FeatureKeypoints keypoints;
+    FeatureDescriptors descriptors;
+    BOOST_CHECK(ExtractCovariantSiftFeaturesCPU(options, bitmap, &keypoints,
+                                                &descriptors));
+    BOOST_CHECK_GT(keypoints.size(), 64);
+
+    options.num_tile_threads = 4;
+    FeatureKeypoints parallel_keypoints;
+    FeatureDescriptors parallel_descriptors;
+    BOOST_CHECK(ExtractCovariantSiftFeaturesCPU(
+        options, bitmap, &parallel_keypoints, &parallel_descriptors));
+    BOOST_CHECK_EQUAL(parallel_keypoints.size(), keypoints.size());
+    for (size_t i = 0; i < keypoints.size(); ++i) {
+      BOOST_CHECK_EQUAL(parallel_keypoints[i].x, keypoints[i].x);
+      BOOST_CHECK_EQUAL(parallel_keypoints[i].y, keypoints[i].y);
+      BOOST_CHECK_EQUAL(parallel_keypoints[i].a11, keypoints[i].a11);
+      BOOST_CHECK_EQUAL(parallel_keypoints[i].a12, keypoints[i].a12);
+      BOOST_CHECK_EQUAL(parallel_keypoints[i].a21, keypoints[i].a21);
+      BOOST_CHECK_EQUAL(parallel_keypoints[i].a22, keypoints[i].a22);
+    }
+    BOOST_CHECK(parallel_descriptors == descriptors);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(TestExtractSiftFeaturesGPU) {
   char app_name[] = "Test";
   int argc = 1;
@@ -282,6 +368,45 @@ BOOST_AUTO_TEST_CASE(TestCreateSiftGPUMatcherCUDA) {
 #endif
 }
 
+BOOST_AUTO_TEST_CASE(TestReadWriteSiftFeaturesBinary) {
+  FeatureKeypoints keypoints;
+  keypoints.emplace_back(1.5f, 2.5f, 3.0f, 0.5f);
+  keypoints.emplace_back(10.0f, 20.0f, 1.0f, -1.0f);
+  keypoints.emplace_back(0.0f, 0.0f, 2.0f, 0.0f);
+  const FeatureDescriptors descriptors = CreateRandomFeatureDescriptors(3);
+
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("sift_test_%%%%%%%%.bin"))
+          .string();
+  WriteSiftFeaturesToBinaryFile(path, keypoints, descriptors);
+
+  FeatureKeypoints read_keypoints;
+  FeatureDescriptors read_descriptors;
+  LoadSiftFeaturesFromBinaryFile(path, &read_keypoints, &read_descriptors);
+  boost::filesystem::remove(path);
+
+  BOOST_CHECK_EQUAL(read_keypoints.size(), keypoints.size());
+  for (size_t i = 0; i < keypoints.size(); ++i) {
+    BOOST_CHECK_EQUAL(read_keypoints[i].x, keypoints[i].x);
+    BOOST_CHECK_EQUAL(read_keypoints[i].y, keypoints[i].y);
+    BOOST_CHECK_CLOSE(read_keypoints[i].ComputeScale(),
+                      keypoints[i].ComputeScale(), 1e-4);
+    BOOST_CHECK_SMALL(read_keypoints[i].ComputeOrientation() -
+                          keypoints[i].ComputeOrientation(),
+                      1e-5f);
+  }
+  BOOST_CHECK_EQUAL(read_descriptors, descriptors);
+
+  WriteSiftFeaturesToBinaryFile(path, FeatureKeypoints(),
+                                FeatureDescriptors(0, 128));
+  LoadSiftFeaturesFromBinaryFile(path, &read_keypoints, &read_descriptors);
+  boost::filesystem::remove(path);
+  BOOST_CHECK(read_keypoints.empty());
+  BOOST_CHECK_EQUAL(read_descriptors.rows(), 0);
+  BOOST_CHECK_EQUAL(read_descriptors.cols(), 128);
+}
+
 BOOST_AUTO_TEST_CASE(TestMatchSiftFeaturesCPU) {
   const FeatureDescriptors empty_descriptors =
       CreateRandomFeatureDescriptors(0);
@@ -309,6 +434,29 @@ BOOST_AUTO_TEST_CASE(TestMatchSiftFeaturesCPU) {
   BOOST_CHECK_EQUAL(matches.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(TestMatchSiftFeaturesCPUMultipleBlocks) {
+  const FeatureDescriptors descriptors1 = CreateRandomFeatureDescriptors(300);
+  const FeatureDescriptors descriptors2 = descriptors1.colwise().reverse();
+
+  FeatureMatches matches;
+
+  MatchSiftFeaturesCPU(SiftMatchingOptions(), descriptors1, descriptors2,
+                       &matches);
+  BOOST_CHECK_EQUAL(matches.size(), 300);
+  for (size_t i = 0; i < matches.size(); ++i) {
+    BOOST_CHECK_EQUAL(matches[i].point2D_idx1, i);
+    BOOST_CHECK_EQUAL(matches[i].point2D_idx2, 299 - i);
+  }
+
+  MatchSiftFeaturesCPU(SiftMatchingOptions(), descriptors1.topRows(200),
+                       descriptors2, &matches);
+  BOOST_CHECK_EQUAL(matches.size(), 200);
+  for (size_t i = 0; i < matches.size(); ++i) {
+    BOOST_CHECK_EQUAL(matches[i].point2D_idx1, i);
+    BOOST_CHECK_EQUAL(matches[i].point2D_idx2, 299 - i);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(TestMatchGuidedSiftFeaturesCPU) {
   FeatureKeypoints empty_keypoints(0);
   FeatureKeypoints keypoints1(2);
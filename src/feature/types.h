@@ -77,6 +77,15 @@ typedef Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
     FeatureDescriptors;
 typedef std::vector<FeatureMatch> FeatureMatches;
 
+// Product-quantized descriptors, where every column holds the index of the
+// nearest centroid in one subspace of the descriptor, and the centroids of
+// all subspaces, where row `subspace * 256 + k` holds centroid `k` of the
+// subspace.
+typedef Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    FeatureDescriptorCodes;
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    FeatureDescriptorCodebook;
+
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_FEATURE_TYPES_H_
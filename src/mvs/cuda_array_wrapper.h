@@ -41,6 +41,9 @@ class CudaArrayWrapper {
   size_t GetDepth() const;
 
   void CopyToDevice(const T* data);
+  // Copy asynchronously on the stream, where the data must be in pinned host
+  // memory and must not be changed until the stream is synchronized.
+  void CopyToDeviceAsync(const T* data, cudaStream_t stream);
   void CopyToHost(const T* data);
   void CopyFromGpuMat(const GpuMat<T>& array);
 
@@ -111,6 +114,19 @@ void CudaArrayWrapper<T>::CopyToDevice(const T* data) {
   CUDA_SAFE_CALL(cudaMemcpy3D(&params));
 }
 
+template <typename T>
+void CudaArrayWrapper<T>::CopyToDeviceAsync(const T* data,
+                                           cudaStream_t stream) {
+  cudaMemcpy3DParms params = {0};
+  Allocate();
+  params.extent = make_cudaExtent(width_, height_, depth_);
+  params.kind = cudaMemcpyHostToDevice;
+  params.dstArray = array_;
+  params.srcPtr =
+      make_cudaPitchedPtr((void*)data, width_ * sizeof(T), width_, height_);
+  CUDA_SAFE_CALL(cudaMemcpy3DAsync(&params, stream));
+}
+
 template <typename T>
 void CudaArrayWrapper<T>::CopyToHost(const T* data) {
   cudaMemcpy3DParms params = {0};
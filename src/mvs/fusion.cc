@@ -16,6 +16,7 @@
 
 #include "mvs/fusion.h"
 
+#include "mvs/fusion_cuda.h"
 #include "util/misc.h"
 
 namespace colmap {
@@ -77,6 +78,11 @@ void StereoFusionOptions::Print() const {
   PrintOption(max_normal_error);
   PrintOption(check_num_images);
   PrintOption(cache_size);
+  PrintOption(image_path);
+  PrintOption(num_threads);
+  PrintOption(num_cells);
+  PrintOption(use_gpu);
+  PrintOption(gpu_index);
 #undef PrintOption
 }
 
@@ -89,6 +95,13 @@ bool StereoFusionOptions::Check() const {
   CHECK_OPTION_GE(max_normal_error, 0);
   CHECK_OPTION_GT(check_num_images, 0);
   CHECK_OPTION_GT(cache_size, 0);
+  CHECK_OPTION(image_source.Check());
+  CHECK_OPTION_GT(num_cells, 0);
+  if (use_gpu) {
+    const std::vector<int> gpu_indices = CSVToVector<int>(gpu_index);
+    CHECK_OPTION_EQ(gpu_indices.size(), 1);
+    CHECK_OPTION_GE(gpu_indices[0], -1);
+  }
   return true;
 }
 
@@ -96,12 +109,14 @@ StereoFusion::StereoFusion(const StereoFusionOptions& options,
                            const std::string& workspace_path,
                            const std::string& workspace_format,
                            const std::string& pmvs_option_name,
-                           const std::string& input_type)
+                           const std::string& input_type,
+                           const std::string& output_path)
     : options_(options),
       workspace_path_(workspace_path),
       workspace_format_(workspace_format),
       pmvs_option_name_(pmvs_option_name),
       input_type_(input_type),
+      output_path_(output_path),
       max_squared_reproj_error_(options_.max_reproj_error *
                                 options_.max_reproj_error),
       min_cos_normal_error_(std::cos(DegToRad(options_.max_normal_error))) {
@@ -112,12 +127,23 @@ const std::vector<PlyPoint>& StereoFusion::GetFusedPoints() const {
   return fused_points_;
 }
 
+size_t StereoFusion::GetNumFusedPoints() const { return num_fused_points_; }
+
 void StereoFusion::Run() {
   fused_points_.clear();
+  num_fused_points_ = 0;
 
   options_.Print();
   std::cout << std::endl;
 
+#ifndef CUDA_ENABLED
+  if (options_.use_gpu) {
+    std::cout << "WARNING: Checking the consistency on the GPU requires CUDA, "
+                 "falling back to the CPU."
+              << std::endl;
+  }
+#endif
+
   std::cout << "Reading workspace..." << std::endl;
 
   Workspace::Options workspace_options;
@@ -136,6 +162,8 @@ void StereoFusion::Run() {
   workspace_options.workspace_format = workspace_format_;
   workspace_options.workspace_format = workspace_format_;
   workspace_options.input_type = input_type_;
+  workspace_options.image_path = options_.image_path;
+  workspace_options.image_source = options_.image_source;
 
   workspace_.reset(new Workspace(workspace_options));
 
@@ -157,7 +185,6 @@ void StereoFusion::Run() {
   }
 
   used_images_.resize(model.images.size(), false);
-  fused_images_.resize(model.images.size(), false);
   fused_pixel_masks_.resize(model.images.size());
   depth_map_sizes_.resize(model.images.size());
   bitmap_scales_.resize(model.images.size());
@@ -182,20 +209,22 @@ void StereoFusion::Run() {
     }
 
     const auto& image = model.images.at(image_id);
-    const auto& depth_map = workspace_->GetDepthMap(image_id);
+    size_t depth_map_width;
+    size_t depth_map_height;
+    workspace_->GetDepthMapSize(image_id, &depth_map_width, &depth_map_height);
 
     used_images_.at(image_id) = true;
 
     fused_pixel_masks_.at(image_id) =
-        Mat<bool>(depth_map.GetWidth(), depth_map.GetHeight(), 1);
+        Mat<char>(depth_map_width, depth_map_height, 1);
     fused_pixel_masks_.at(image_id).Fill(false);
 
     depth_map_sizes_.at(image_id) =
-        std::make_pair(depth_map.GetWidth(), depth_map.GetHeight());
+        std::make_pair(depth_map_width, depth_map_height);
 
     bitmap_scales_.at(image_id) = std::make_pair(
-        static_cast<float>(depth_map.GetWidth()) / image.GetWidth(),
-        static_cast<float>(depth_map.GetHeight()) / image.GetHeight());
+        static_cast<float>(depth_map_width) / image.GetWidth(),
+        static_cast<float>(depth_map_height) / image.GetHeight());
 
     Eigen::Matrix<float, 3, 3, Eigen::RowMajor> K =
         Eigen::Map<const Eigen::Matrix<float, 3, 3, Eigen::RowMajor>>(
@@ -215,24 +244,190 @@ void StereoFusion::Run() {
             .transpose();
   }
 
+  PartitionCells(model);
+
+  // The last task fuses the remaining pixels, which were not fused by their
+  // cells, after all cells, so that their masks are no longer modified
+  // concurrently.
+  std::vector<FusionTask> tasks(num_cells_ + 1);
+  output_tasks_.clear();
+  for (int cell = 0; cell < num_cells_; ++cell) {
+    tasks[cell].cell = cell;
+  }
+  for (auto& task : tasks) {
+    output_tasks_.push_back(&task);
+  }
+  next_output_task_ = 0;
+
+  if (!output_path_.empty()) {
+    std::cout << "Writing output: " << output_path_ << std::endl;
+    ply_writer_.reset(new BinaryPlyWriter(output_path_));
+  }
+
+  if (num_cells_ > 0) {
+    std::cout << StringPrintf("Fusing %d cells", num_cells_) << std::endl;
+    ThreadPool thread_pool(GetEffectiveNumThreads(options_.num_threads));
+    for (int cell = 0; cell < num_cells_; ++cell) {
+      thread_pool.AddTask(&StereoFusion::FuseCell, this, &tasks[cell]);
+    }
+    thread_pool.Wait();
+  }
+
+  FuseCell(&tasks.back());
+
+  if (ply_writer_) {
+    ply_writer_->Close();
+    ply_writer_.reset();
+  }
+
+  output_tasks_.clear();
+  fused_points_.shrink_to_fit();
+
+  if (num_fused_points_ == 0) {
+    std::cout << "WARNING: Could not fuse any points. This is likely caused by "
+                 "incorrect settings - filtering must be enabled for the last "
+                 "call to patch match stereo."
+              << std::endl;
+  }
+
+  std::cout << "Number of fused points: " << num_fused_points_ << std::endl;
+  GetTimer().PrintMinutes();
+}
+
+void StereoFusion::PartitionCells(const Model& model) {
+  num_cells_ = 0;
+  cell_root_ = -1;
+  cell_nodes_.clear();
+  cell_images_.clear();
+
+  if (options_.num_cells <= 1 || model.points.empty()) {
+    return;
+  }
+
+  std::vector<Eigen::Vector3f> points;
+  points.reserve(model.points.size());
+  for (const auto& point : model.points) {
+    points.emplace_back(point.x, point.y, point.z);
+  }
+
+  cell_root_ = BuildCellTree(&points, 0, points.size(), options_.num_cells);
+
+  cell_images_.resize(num_cells_,
+                      std::vector<char>(model.images.size(), false));
+  for (const auto& point : model.points) {
+    const int cell = FindCell(Eigen::Vector3f(point.x, point.y, point.z));
+    for (const int image_id : point.track) {
+      if (used_images_.at(image_id)) {
+        cell_images_[cell][image_id] = true;
+      }
+    }
+  }
+}
+
+int StereoFusion::BuildCellTree(std::vector<Eigen::Vector3f>* points,
+                                const size_t begin, const size_t end,
+                                const int num_cells) {
+  if (num_cells <= 1 || end - begin < 2) {
+    num_cells_ += 1;
+    return -num_cells_;
+  }
+
+  // Split the points at the median along the axis of their largest extent.
+  Eigen::Vector3f min_bound = (*points)[begin];
+  Eigen::Vector3f max_bound = (*points)[begin];
+  for (size_t i = begin + 1; i < end; ++i) {
+    min_bound = min_bound.cwiseMin((*points)[i]);
+    max_bound = max_bound.cwiseMax((*points)[i]);
+  }
+
+  CellNode node;
+  (max_bound - min_bound).maxCoeff(&node.axis);
+
+  const size_t mid = begin + (end - begin) / 2;
+  const int axis = node.axis;
+  std::nth_element(points->begin() + begin, points->begin() + mid,
+                   points->begin() + end,
+                   [axis](const Eigen::Vector3f& point1,
+                          const Eigen::Vector3f& point2) {
+                     return point1(axis) < point2(axis);
+                   });
+  node.split = (*points)[mid](axis);
+
+  const int node_idx = static_cast<int>(cell_nodes_.size());
+  cell_nodes_.push_back(node);
+  const int left_child = BuildCellTree(points, begin, mid, num_cells / 2);
+  const int right_child =
+      BuildCellTree(points, mid, end, num_cells - num_cells / 2);
+  cell_nodes_[node_idx].children[0] = left_child;
+  cell_nodes_[node_idx].children[1] = right_child;
+
+  return node_idx;
+}
+
+int StereoFusion::FindCell(const Eigen::Vector3f& xyz) const {
+  int node_idx = cell_root_;
+  while (node_idx >= 0) {
+    const auto& node = cell_nodes_[node_idx];
+    node_idx = node.children[xyz(node.axis) < node.split ? 0 : 1];
+  }
+  return -node_idx - 1;
+}
+
+void StereoFusion::FuseCell(FusionTask* task) {
+  task->fused_images.resize(used_images_.size(), false);
+
+  const auto& reference_images =
+      task->cell == -1 ? used_images_ : cell_images_.at(task->cell);
+
+  Timer timer;
+  timer.Start();
+
+  int image_id = -1;
+  if (!reference_images.empty()) {
+    image_id = reference_images[0]
+                   ? 0
+                   : internal::FindNextImage(overlapping_images_,
+                                             reference_images,
+                                             task->fused_images, 0);
+  }
   size_t num_fused_images = 0;
-  for (int image_id = 0; image_id >= 0;
-       image_id = internal::FindNextImage(overlapping_images_, used_images_,
-                                          fused_images_, image_id)) {
+  for (; image_id >= 0;
+       image_id = internal::FindNextImage(overlapping_images_,
+                                          reference_images,
+                                          task->fused_images, image_id)) {
     if (IsStopped()) {
       break;
     }
 
-    Timer timer;
-    timer.Start();
+    if (task->cell == -1) {
+      timer.Restart();
+      std::cout << StringPrintf("Fusing image [%d/%d]", num_fused_images + 1,
+                                used_images_.size())
+                << std::flush;
+    }
 
-    std::cout << StringPrintf("Fusing image [%d/%d]", num_fused_images + 1,
-                              model.images.size())
-              << std::flush;
+    // The traversal of the pixels of the reference image mostly visits its
+    // overlapping images, which are read ahead.
+    std::vector<int> prefetch_image_ids = {image_id};
+    for (const int overlapping_image_id : overlapping_images_.at(image_id)) {
+      if (used_images_.at(overlapping_image_id)) {
+        prefetch_image_ids.push_back(overlapping_image_id);
+      }
+    }
+    {
+      std::unique_lock<std::mutex> lock(workspace_mutex_);
+      workspace_->Prefetch(prefetch_image_ids, /* prefetch_maps */ true);
+    }
+
+    task->has_consistency_masks = false;
+#ifdef CUDA_ENABLED
+    if (options_.use_gpu) {
+      ComputeConsistencyMasks(image_id, task);
+    }
+#endif
 
     const int width = depth_map_sizes_.at(image_id).first;
     const int height = depth_map_sizes_.at(image_id).second;
-    const auto& fused_pixel_mask = fused_pixel_masks_.at(image_id);
 
     FusionData data;
     data.image_id = image_id;
@@ -240,79 +435,173 @@ void StereoFusion::Run() {
 
     for (data.row = 0; data.row < height; ++data.row) {
       for (data.col = 0; data.col < width; ++data.col) {
-        if (fused_pixel_mask.Get(data.row, data.col)) {
-          continue;
-        }
-
-        fusion_queue_.push_back(data);
-
-        Fuse();
+        task->fusion_queue.push_back(data);
+        Fuse(task);
       }
     }
 
     num_fused_images += 1;
-    fused_images_.at(image_id) = true;
+    task->fused_images.at(image_id) = true;
 
-    std::cout << StringPrintf(" in %.3fs (%d points)", timer.ElapsedSeconds(),
-                              fused_points_.size())
-              << std::endl;
+    OutputFusedPoints(task, /* finished */ false);
+
+    if (task->cell == -1) {
+      std::cout << StringPrintf(" in %.3fs (%d points)",
+                                timer.ElapsedSeconds(),
+                                task->num_fused_points)
+                << std::endl;
+    }
   }
 
-  fused_points_.shrink_to_fit();
+  OutputFusedPoints(task, /* finished */ true);
 
-  if (fused_points_.empty()) {
-    std::cout << "WARNING: Could not fuse any points. This is likely caused by "
-                 "incorrect settings - filtering must be enabled for the last "
-                 "call to patch match stereo."
-              << std::endl;
+  if (task->cell != -1) {
+    std::cout << StringPrintf("Fused cell %d with %d images in %.3fs "
+                              "(%d points)\n",
+                              task->cell + 1, num_fused_images,
+                              timer.ElapsedSeconds(), task->num_fused_points)
+              << std::flush;
   }
+}
 
-  std::cout << "Number of fused points: " << fused_points_.size() << std::endl;
-  GetTimer().PrintMinutes();
+#ifdef CUDA_ENABLED
+void StereoFusion::ComputeConsistencyMasks(const int image_id,
+                                           FusionTask* task) {
+  // The source images are the used overlapping images, in the order in which
+  // the reference pixels traverse them.
+  std::vector<int> src_image_ids;
+  for (const int overlapping_image_id : overlapping_images_.at(image_id)) {
+    if (used_images_.at(overlapping_image_id)) {
+      src_image_ids.push_back(overlapping_image_id);
+    }
+  }
+
+  FusionConsistencyCuda consistency(
+      std::stoi(options_.gpu_index), options_.max_depth_error,
+      max_squared_reproj_error_, min_cos_normal_error_);
+
+  // The maps are uploaded while the workspace is locked, such that they are
+  // not evicted by the other tasks, and checked without the lock.
+  {
+    std::unique_lock<std::mutex> lock(workspace_mutex_);
+    consistency.SetRefImage(workspace_->GetDepthMap(image_id),
+                            workspace_->GetNormalMap(image_id),
+                            inv_P_.at(image_id).data(),
+                            inv_R_.at(image_id).data(),
+                            static_cast<int>(src_image_ids.size()));
+  }
+
+  for (size_t i = 0; i < src_image_ids.size(); ++i) {
+    const int src_image_id = src_image_ids[i];
+    {
+      std::unique_lock<std::mutex> lock(workspace_mutex_);
+      consistency.AddSrcImage(workspace_->GetDepthMap(src_image_id),
+                              workspace_->GetNormalMap(src_image_id),
+                              P_.at(src_image_id).data(),
+                              inv_R_.at(src_image_id).data());
+    }
+    if ((i + 1) % FusionConsistencyCuda::kMaxNumSrcImages == 0 ||
+        i + 1 == src_image_ids.size()) {
+      consistency.CheckSrcImages();
+    }
+  }
+
+  task->consistency_masks = consistency.GetConsistencyMasks();
+  task->has_consistency_masks = true;
 }
+#endif
+
+void StereoFusion::OutputFusedPoints(FusionTask* task, const bool finished) {
+  std::unique_lock<std::mutex> lock(output_mutex_);
 
-void StereoFusion::Fuse() {
-  CHECK_EQ(fusion_queue_.size(), 1);
+  task->finished = finished;
+
+  // The points are output in the order of the tasks. The points of an
+  // unfinished task are only output by its own thread, which is the only one
+  // that modifies them, and the points of the following tasks are buffered
+  // until it is finished.
+  while (next_output_task_ < output_tasks_.size()) {
+    FusionTask* next_task = output_tasks_[next_output_task_];
+    if (next_task != task && !next_task->finished) {
+      break;
+    }
+
+    if (ply_writer_) {
+      ply_writer_->Write(next_task->fused_points);
+    } else {
+      fused_points_.insert(fused_points_.end(),
+                           next_task->fused_points.begin(),
+                           next_task->fused_points.end());
+    }
+    num_fused_points_ += next_task->fused_points.size();
+
+    if (!next_task->finished) {
+      next_task->fused_points.clear();
+      break;
+    }
+
+    std::vector<PlyPoint>().swap(next_task->fused_points);
+    next_output_task_ += 1;
+  }
+}
+
+void StereoFusion::Fuse(FusionTask* task) {
+  CHECK_EQ(task->fusion_queue.size(), 1);
 
   Eigen::Vector4f fused_ref_point = Eigen::Vector4f::Zero();
   Eigen::Vector3f fused_ref_normal = Eigen::Vector3f::Zero();
 
-  fused_points_x_.clear();
-  fused_points_y_.clear();
-  fused_points_z_.clear();
-  fused_points_nx_.clear();
-  fused_points_ny_.clear();
-  fused_points_nz_.clear();
-  fused_points_r_.clear();
-  fused_points_g_.clear();
-  fused_points_b_.clear();
-
-  while (!fusion_queue_.empty()) {
-    const auto data = fusion_queue_.back();
+  task->fused_points_x.clear();
+  task->fused_points_y.clear();
+  task->fused_points_z.clear();
+  task->fused_points_nx.clear();
+  task->fused_points_ny.clear();
+  task->fused_points_nz.clear();
+  task->fused_points_r.clear();
+  task->fused_points_g.clear();
+  task->fused_points_b.clear();
+
+  while (!task->fusion_queue.empty()) {
+    const auto data = task->fusion_queue.back();
     const int image_id = data.image_id;
     const int row = data.row;
     const int col = data.col;
     const int traversal_depth = data.traversal_depth;
 
-    fusion_queue_.pop_back();
+    task->fusion_queue.pop_back();
 
-    // Check if pixel already fused.
+    // Check if pixel already fused. The masks of pixels in cells are only
+    // accessed by the task of their cell, which is known once their 3D point
+    // is computed below.
     auto& fused_pixel_mask = fused_pixel_masks_.at(image_id);
-    if (fused_pixel_mask.Get(row, col)) {
+    if (task->cell == -1 && fused_pixel_mask.Get(row, col)) {
       continue;
     }
 
-    const auto& depth_map = workspace_->GetDepthMap(image_id);
-    const float depth = depth_map.Get(row, col);
+    float depth;
+    {
+      std::unique_lock<std::mutex> lock(workspace_mutex_);
+      depth = workspace_->GetDepth(image_id, row, col);
+    }
 
     // Pixels with negative depth are filtered.
     if (depth <= 0.0f) {
       continue;
     }
 
+    // Determine 3D location of current depth value.
+    const Eigen::Vector3f xyz =
+        inv_P_.at(image_id) *
+        Eigen::Vector4f(col * depth, row * depth, depth, 1.0f);
+
+    if (task->cell != -1 &&
+        (FindCell(xyz) != task->cell || fused_pixel_mask.Get(row, col))) {
+      continue;
+    }
+
     // If the traversal depth is greater than zero, the initial reference
     // pixel has already been added and we need to check for consistency.
-    if (traversal_depth > 0) {
+    if (traversal_depth > 0 && !data.is_consistent) {
       // Project reference point into current view.
       const Eigen::Vector3f proj = P_.at(image_id) * fused_ref_point;
 
@@ -333,44 +622,46 @@ void StereoFusion::Fuse() {
     }
 
     // Determine normal direction in global reference frame.
-    const auto& normal_map = workspace_->GetNormalMap(image_id);
+    float normal_values[3];
+    {
+      std::unique_lock<std::mutex> lock(workspace_mutex_);
+      workspace_->GetNormal(image_id, row, col, normal_values);
+    }
     const Eigen::Vector3f normal =
-        inv_R_.at(image_id) * Eigen::Vector3f(normal_map.Get(row, col, 0),
-                                              normal_map.Get(row, col, 1),
-                                              normal_map.Get(row, col, 2));
+        inv_R_.at(image_id) * Eigen::Vector3f(normal_values[0],
+                                              normal_values[1],
+                                              normal_values[2]);
 
     // Check for consistent normal direction with reference normal.
-    if (traversal_depth > 0) {
+    if (traversal_depth > 0 && !data.is_consistent) {
       const float cos_normal_error = fused_ref_normal.dot(normal);
       if (cos_normal_error < min_cos_normal_error_) {
         continue;
       }
     }
 
-    // Determine 3D location of current depth value.
-    const Eigen::Vector3f xyz =
-        inv_P_.at(image_id) *
-        Eigen::Vector4f(col * depth, row * depth, depth, 1.0f);
-
     // Read the color of the pixel.
     BitmapColor<uint8_t> color;
     const auto& bitmap_scale = bitmap_scales_.at(image_id);
-    workspace_->GetBitmap(image_id).InterpolateNearestNeighbor(
-        col / bitmap_scale.first, row / bitmap_scale.second, &color);
+    {
+      std::unique_lock<std::mutex> lock(workspace_mutex_);
+      workspace_->GetBitmap(image_id).InterpolateNearestNeighbor(
+          col / bitmap_scale.first, row / bitmap_scale.second, &color);
+    }
 
     // Set the current pixel as visited.
     fused_pixel_mask.Set(row, col, true);
 
     // Accumulate statistics for fused point.
-    fused_points_x_.push_back(xyz(0));
-    fused_points_y_.push_back(xyz(1));
-    fused_points_z_.push_back(xyz(2));
-    fused_points_nx_.push_back(normal(0));
-    fused_points_ny_.push_back(normal(1));
-    fused_points_nz_.push_back(normal(2));
-    fused_points_r_.push_back(color.r);
-    fused_points_g_.push_back(color.g);
-    fused_points_b_.push_back(color.b);
+    task->fused_points_x.push_back(xyz(0));
+    task->fused_points_y.push_back(xyz(1));
+    task->fused_points_z.push_back(xyz(2));
+    task->fused_points_nx.push_back(normal(0));
+    task->fused_points_ny.push_back(normal(1));
+    task->fused_points_nz.push_back(normal(2));
+    task->fused_points_r.push_back(color.r);
+    task->fused_points_g.push_back(color.g);
+    task->fused_points_b.push_back(color.b);
 
     // Remember the first pixel as the reference.
     if (traversal_depth == 0) {
@@ -378,7 +669,7 @@ void StereoFusion::Fuse() {
       fused_ref_normal = normal;
     }
 
-    if (fused_points_x_.size() >=
+    if (task->fused_points_x.size() >=
         static_cast<size_t>(options_.max_num_pixels)) {
       break;
     }
@@ -390,11 +681,35 @@ void StereoFusion::Fuse() {
       continue;
     }
 
+    // The pixels of the overlapping images of the reference pixel, with
+    // which it is not consistent, are not visited, if the consistency was
+    // checked on the GPU.
+    const bool use_consistency_masks =
+        traversal_depth == 0 && task->has_consistency_masks;
+    next_data.is_consistent = use_consistency_masks;
+
+    int src_image_idx = -1;
     for (const auto next_image_id : overlapping_images_.at(image_id)) {
-      if (!used_images_.at(next_image_id) || fused_images_.at(next_image_id)) {
+      if (!used_images_.at(next_image_id)) {
         continue;
       }
 
+      src_image_idx += 1;
+
+      if (task->fused_images.at(next_image_id)) {
+        continue;
+      }
+
+      if (use_consistency_masks) {
+        const uint32_t consistency_mask = task->consistency_masks.Get(
+            row, col, src_image_idx / FusionConsistencyCuda::kMaxNumSrcImages);
+        if (!(consistency_mask &
+              (1u << (src_image_idx %
+                      FusionConsistencyCuda::kMaxNumSrcImages)))) {
+          continue;
+        }
+      }
+
       next_data.image_id = next_image_id;
 
       const Eigen::Vector3f next_proj =
@@ -409,41 +724,42 @@ void StereoFusion::Fuse() {
         continue;
       }
 
-      fusion_queue_.push_back(next_data);
+      task->fusion_queue.push_back(next_data);
     }
   }
 
-  fusion_queue_.clear();
+  task->fusion_queue.clear();
 
-  const size_t num_pixels = fused_points_x_.size();
+  const size_t num_pixels = task->fused_points_x.size();
   if (num_pixels >= static_cast<size_t>(options_.min_num_pixels)) {
     PlyPoint fused_point;
 
     Eigen::Vector3f fused_normal;
-    fused_normal.x() = internal::Median(&fused_points_nx_);
-    fused_normal.y() = internal::Median(&fused_points_ny_);
-    fused_normal.z() = internal::Median(&fused_points_nz_);
+    fused_normal.x() = internal::Median(&task->fused_points_nx);
+    fused_normal.y() = internal::Median(&task->fused_points_ny);
+    fused_normal.z() = internal::Median(&task->fused_points_nz);
     const float fused_normal_norm = fused_normal.norm();
     if (fused_normal_norm < std::numeric_limits<float>::epsilon()) {
       return;
     }
 
-    fused_point.x = internal::Median(&fused_points_x_);
-    fused_point.y = internal::Median(&fused_points_y_);
-    fused_point.z = internal::Median(&fused_points_z_);
+    fused_point.x = internal::Median(&task->fused_points_x);
+    fused_point.y = internal::Median(&task->fused_points_y);
+    fused_point.z = internal::Median(&task->fused_points_z);
 
     fused_point.nx = fused_normal.x() / fused_normal_norm;
     fused_point.ny = fused_normal.y() / fused_normal_norm;
     fused_point.nz = fused_normal.z() / fused_normal_norm;
 
     fused_point.r = TruncateCast<float, uint8_t>(
-        std::round(internal::Median(&fused_points_r_)));
+        std::round(internal::Median(&task->fused_points_r)));
     fused_point.g = TruncateCast<float, uint8_t>(
-        std::round(internal::Median(&fused_points_g_)));
+        std::round(internal::Median(&task->fused_points_g)));
     fused_point.b = TruncateCast<float, uint8_t>(
-        std::round(internal::Median(&fused_points_b_)));
+        std::round(internal::Median(&task->fused_points_b)));
 
-    fused_points_.push_back(fused_point);
+    task->fused_points.push_back(fused_point);
+    task->num_fused_points += 1;
   }
 }
 
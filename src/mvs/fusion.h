@@ -17,6 +17,7 @@
 #ifndef COLMAP_SRC_MVS_FUSION_H_
 #define COLMAP_SRC_MVS_FUSION_H_
 
+#include <mutex>
 #include <vector>
 
 #include <Eigen/Core>
@@ -68,6 +69,35 @@ struct StereoFusionOptions {
   // consume a lot of memory, if the consistency graph is dense.
   double cache_size = 32.0;
 
+  // Directory or URL of the undistorted images, e.g. "s3://bucket/images", if
+  // they are not in the images folder of the workspace. Remote images are
+  // fetched ahead of the cells that use them.
+  std::string image_path = "";
+  ImageSourceOptions image_source;
+
+  // The number of threads, which fuse the cells of the scene concurrently.
+  int num_threads = -1;
+
+  // The number of cells, into which the scene is partitioned along the sparse
+  // points. Every pixel belongs to the cell of its 3D point and a cell only
+  // fuses its own pixels, so that the cells are fused concurrently and
+  // independently. Points are not fused across cell borders and images
+  // without sparse points in a cell are fused in a final sequential pass, so
+  // the result only depends on the number of cells and not on the number of
+  // threads. With a single cell, all pixels are fused sequentially.
+  int num_cells = 32;
+
+  // Whether to check the consistency of the pixels of each reference image
+  // with its overlapping images on the GPU, in batches of the overlapping
+  // images, before the pixels are fused on the CPU. The fusion then only
+  // visits the consistent pixels of the overlapping images. This reads the
+  // complete maps of the images and requires CUDA, without which the fusion
+  // falls back to the CPU.
+  bool use_gpu = false;
+
+  // Index of the GPU used for fusion, which is selected automatically if -1.
+  std::string gpu_index = "-1";
+
   // Check the options for validity.
   bool Check() const;
 
@@ -83,54 +113,114 @@ class StereoFusion : public Thread {
                const std::string& workspace_path,
                const std::string& workspace_format,
                const std::string& pmvs_option_name,
-               const std::string& input_type);
+               const std::string& input_type,
+               const std::string& output_path = "");
 
+  // The fused points, which are empty if they were written to the output
+  // path while fusing. Then, only the bounded number of points of the cells
+  // that are not yet written are kept in memory.
   const std::vector<PlyPoint>& GetFusedPoints() const;
+  size_t GetNumFusedPoints() const;
 
  private:
+  struct FusionData {
+    int image_id = kInvalidImageId;
+    int row = 0;
+    int col = 0;
+    int traversal_depth = -1;
+    // Whether the consistency of the pixel with the reference pixel was
+    // already checked on the GPU.
+    bool is_consistent = false;
+    bool operator()(const FusionData& data1, const FusionData& data2) {
+      return data1.image_id > data2.image_id;
+    }
+  };
+
+  // The state of a fusion task, which fuses the pixels of a cell or, if the
+  // cell is -1, all remaining pixels.
+  struct FusionTask {
+    int cell = -1;
+    bool finished = false;
+    size_t num_fused_points = 0;
+    std::vector<char> fused_images;
+    std::vector<FusionData> fusion_queue;
+    std::vector<PlyPoint> fused_points;
+    std::vector<float> fused_points_x;
+    std::vector<float> fused_points_y;
+    std::vector<float> fused_points_z;
+    std::vector<float> fused_points_nx;
+    std::vector<float> fused_points_ny;
+    std::vector<float> fused_points_nz;
+    std::vector<uint8_t> fused_points_r;
+    std::vector<uint8_t> fused_points_g;
+    std::vector<uint8_t> fused_points_b;
+    // The masks of the pixels of the current reference image, which are
+    // consistent with its used overlapping images, if they were computed on
+    // the GPU.
+    bool has_consistency_masks = false;
+    Mat<uint32_t> consistency_masks;
+  };
+
+  // Node of the k-d tree that partitions the scene into cells. The children
+  // are either nodes or, if negative, the one-based cell index.
+  struct CellNode {
+    int axis = 0;
+    float split = 0;
+    int children[2] = {0, 0};
+  };
+
   void Run();
-  void Fuse();
+  void PartitionCells(const Model& model);
+  int BuildCellTree(std::vector<Eigen::Vector3f>* points, const size_t begin,
+                    const size_t end, const int num_cells);
+  int FindCell(const Eigen::Vector3f& xyz) const;
+  void FuseCell(FusionTask* task);
+#ifdef CUDA_ENABLED
+  void ComputeConsistencyMasks(const int image_id, FusionTask* task);
+#endif
+  // Output the fused points of the task, which is called periodically and
+  // once the task is finished.
+  void OutputFusedPoints(FusionTask* task, const bool finished);
+  void Fuse(FusionTask* task);
 
   const StereoFusionOptions options_;
   const std::string workspace_path_;
   const std::string workspace_format_;
   const std::string pmvs_option_name_;
   const std::string input_type_;
+  const std::string output_path_;
   const float max_squared_reproj_error_;
   const float min_cos_normal_error_;
 
   std::unique_ptr<Workspace> workspace_;
+  // The workspace cache is shared by the concurrent tasks.
+  std::mutex workspace_mutex_;
   std::vector<char> used_images_;
-  std::vector<char> fused_images_;
   std::vector<std::vector<int>> overlapping_images_;
-  std::vector<Mat<bool>> fused_pixel_masks_;
+  // The masks are not packed, as the pixels of an image are fused by
+  // different tasks.
+  std::vector<Mat<char>> fused_pixel_masks_;
   std::vector<std::pair<int, int>> depth_map_sizes_;
   std::vector<std::pair<float, float>> bitmap_scales_;
   std::vector<Eigen::Matrix<float, 3, 4, Eigen::RowMajor>> P_;
   std::vector<Eigen::Matrix<float, 3, 4, Eigen::RowMajor>> inv_P_;
   std::vector<Eigen::Matrix<float, 3, 3, Eigen::RowMajor>> inv_R_;
 
-  struct FusionData {
-    int image_id = kInvalidImageId;
-    int row = 0;
-    int col = 0;
-    int traversal_depth = -1;
-    bool operator()(const FusionData& data1, const FusionData& data2) {
-      return data1.image_id > data2.image_id;
-    }
-  };
-
-  std::vector<FusionData> fusion_queue_;
+  int num_cells_ = 0;
+  int cell_root_ = -1;
+  std::vector<CellNode> cell_nodes_;
+  // The images with sparse points in each cell, which are the reference
+  // images of the cell.
+  std::vector<std::vector<char>> cell_images_;
+
+  // The points are output in the order of the tasks, independent of the
+  // order in which they are finished.
+  std::mutex output_mutex_;
+  std::vector<FusionTask*> output_tasks_;
+  size_t next_output_task_ = 0;
+  std::unique_ptr<BinaryPlyWriter> ply_writer_;
   std::vector<PlyPoint> fused_points_;
-  std::vector<float> fused_points_x_;
-  std::vector<float> fused_points_y_;
-  std::vector<float> fused_points_z_;
-  std::vector<float> fused_points_nx_;
-  std::vector<float> fused_points_ny_;
-  std::vector<float> fused_points_nz_;
-  std::vector<uint8_t> fused_points_r_;
-  std::vector<uint8_t> fused_points_g_;
-  std::vector<uint8_t> fused_points_b_;
+  size_t num_fused_points_ = 0;
 };
 
 }  // namespace mvs
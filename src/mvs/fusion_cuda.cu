@@ -0,0 +1,274 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mvs/fusion_cuda.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "mvs/gpu_mat.h"
+#include "util/cuda.h"
+#include "util/cudacc.h"
+#include "util/logging.h"
+
+namespace colmap {
+namespace mvs {
+namespace {
+
+const int kBlockDimX = 32;
+const int kBlockDimY = 16;
+
+// The transformations of the reference image, which are passed by value.
+struct RefTransforms {
+  float inv_P[12];
+  float inv_R[9];
+};
+
+__device__ inline float GetMapValue(const float* map, const size_t pitch,
+                                    const int height, const int row,
+                                    const int col, const int slice) {
+  return *((const float*)((const char*)map + pitch * (slice * height + row)) +
+           col);
+}
+
+__device__ inline void RotateNormal(const float inv_R[9], const float normal[3],
+                                    float rotated_normal[3]) {
+  for (int i = 0; i < 3; ++i) {
+    rotated_normal[i] = inv_R[3 * i + 0] * normal[0] +
+                        inv_R[3 * i + 1] * normal[1] +
+                        inv_R[3 * i + 2] * normal[2];
+  }
+}
+
+__global__ void CheckConsistency(
+    const GpuMat<float> ref_depth_map, const GpuMat<float> ref_normal_map,
+    const RefTransforms ref_transforms,
+    const FusionConsistencyCuda::SrcImage* src_images,
+    const int num_src_images, const float max_depth_error,
+    const float max_squared_reproj_error, const float min_cos_normal_error,
+    const int batch_idx, GpuMat<uint32_t> consistency_masks) {
+  const int row = blockDim.y * blockIdx.y + threadIdx.y;
+  const int col = blockDim.x * blockIdx.x + threadIdx.x;
+  if (col >= ref_depth_map.GetWidth() || row >= ref_depth_map.GetHeight()) {
+    return;
+  }
+
+  uint32_t mask = 0;
+
+  // Pixels with negative depth are filtered.
+  const float depth = ref_depth_map.Get(row, col);
+  if (depth > 0.0f) {
+    const float* inv_P = ref_transforms.inv_P;
+    float xyz[3];
+    for (int i = 0; i < 3; ++i) {
+      xyz[i] = inv_P[4 * i + 0] * col * depth +
+               inv_P[4 * i + 1] * row * depth + inv_P[4 * i + 2] * depth +
+               inv_P[4 * i + 3];
+    }
+
+    float normal[3];
+    ref_normal_map.GetSlice(row, col, normal);
+    float ref_normal[3];
+    RotateNormal(ref_transforms.inv_R, normal, ref_normal);
+
+    for (int i = 0; i < num_src_images; ++i) {
+      const FusionConsistencyCuda::SrcImage& src_image = src_images[i];
+
+      // Project the reference point into the source image.
+      float proj[3];
+      for (int j = 0; j < 3; ++j) {
+        proj[j] = src_image.P[4 * j + 0] * xyz[0] +
+                  src_image.P[4 * j + 1] * xyz[1] +
+                  src_image.P[4 * j + 2] * xyz[2] + src_image.P[4 * j + 3];
+      }
+      const int src_col = static_cast<int>(roundf(proj[0] / proj[2]));
+      const int src_row = static_cast<int>(roundf(proj[1] / proj[2]));
+      if (src_col < 0 || src_row < 0 || src_col >= src_image.width ||
+          src_row >= src_image.height) {
+        continue;
+      }
+
+      const float src_depth =
+          GetMapValue(src_image.depth_map, src_image.depth_map_pitch,
+                      src_image.height, src_row, src_col, 0);
+      if (src_depth <= 0.0f) {
+        continue;
+      }
+
+      // Depth error of reference depth with source depth.
+      const float depth_error = fabsf((proj[2] - src_depth) / src_depth);
+      if (depth_error > max_depth_error) {
+        continue;
+      }
+
+      // Reprojection error of the reference point in the source image.
+      const float col_diff = proj[0] / proj[2] - src_col;
+      const float row_diff = proj[1] / proj[2] - src_row;
+      if (col_diff * col_diff + row_diff * row_diff >
+          max_squared_reproj_error) {
+        continue;
+      }
+
+      // Consistent normal direction with the reference normal.
+      for (int slice = 0; slice < 3; ++slice) {
+        normal[slice] =
+            GetMapValue(src_image.normal_map, src_image.normal_map_pitch,
+                        src_image.height, src_row, src_col, slice);
+      }
+      float src_normal[3];
+      RotateNormal(src_image.inv_R, normal, src_normal);
+      const float cos_normal_error = ref_normal[0] * src_normal[0] +
+                                     ref_normal[1] * src_normal[1] +
+                                     ref_normal[2] * src_normal[2];
+      if (cos_normal_error < min_cos_normal_error) {
+        continue;
+      }
+
+      mask |= 1u << i;
+    }
+  }
+
+  consistency_masks.Set(row, col, batch_idx, mask);
+}
+
+}  // namespace
+
+FusionConsistencyCuda::FusionConsistencyCuda(
+    const int gpu_index, const float max_depth_error,
+    const float max_squared_reproj_error, const float min_cos_normal_error)
+    : max_depth_error_(max_depth_error),
+      max_squared_reproj_error_(max_squared_reproj_error),
+      min_cos_normal_error_(min_cos_normal_error),
+      src_images_device_(nullptr),
+      batch_idx_(0) {
+  SetBestCudaDevice(gpu_index);
+  CUDA_SAFE_CALL(cudaMalloc((void**)&src_images_device_,
+                            kMaxNumSrcImages * sizeof(SrcImage)));
+}
+
+FusionConsistencyCuda::~FusionConsistencyCuda() {
+  CUDA_SAFE_CALL(cudaFree(src_images_device_));
+}
+
+void FusionConsistencyCuda::SetRefImage(const DepthMap& depth_map,
+                                        const NormalMap& normal_map,
+                                        const float inv_P[12],
+                                        const float inv_R[9],
+                                        const int num_src_images) {
+  CHECK_EQ(depth_map.GetWidth(), normal_map.GetWidth());
+  CHECK_EQ(depth_map.GetHeight(), normal_map.GetHeight());
+  CHECK_EQ(normal_map.GetDepth(), 3);
+  CHECK_GE(num_src_images, 0);
+
+  ref_depth_map_.reset(
+      new GpuMat<float>(depth_map.GetWidth(), depth_map.GetHeight()));
+  ref_depth_map_->CopyToDevice(depth_map.GetPtr(),
+                               depth_map.GetWidth() * sizeof(float));
+  ref_normal_map_.reset(
+      new GpuMat<float>(normal_map.GetWidth(), normal_map.GetHeight(), 3));
+  ref_normal_map_->CopyToDevice(normal_map.GetPtr(),
+                                normal_map.GetWidth() * sizeof(float));
+
+  std::copy(inv_P, inv_P + 12, ref_inv_P_);
+  std::copy(inv_R, inv_R + 9, ref_inv_R_);
+
+  const int num_batches =
+      std::max(1, (num_src_images - 1) / kMaxNumSrcImages + 1);
+  consistency_masks_.reset(new GpuMat<uint32_t>(
+      depth_map.GetWidth(), depth_map.GetHeight(), num_batches));
+  consistency_masks_->FillWithScalar(0);
+
+  src_depth_maps_.clear();
+  src_normal_maps_.clear();
+  src_images_.clear();
+  batch_idx_ = 0;
+}
+
+void FusionConsistencyCuda::AddSrcImage(const DepthMap& depth_map,
+                                        const NormalMap& normal_map,
+                                        const float P[12],
+                                        const float inv_R[9]) {
+  CHECK(consistency_masks_);
+  CHECK_LT(src_images_.size(), static_cast<size_t>(kMaxNumSrcImages));
+  CHECK_EQ(depth_map.GetWidth(), normal_map.GetWidth());
+  CHECK_EQ(depth_map.GetHeight(), normal_map.GetHeight());
+  CHECK_EQ(normal_map.GetDepth(), 3);
+
+  std::unique_ptr<GpuMat<float>> src_depth_map(
+      new GpuMat<float>(depth_map.GetWidth(), depth_map.GetHeight()));
+  src_depth_map->CopyToDevice(depth_map.GetPtr(),
+                              depth_map.GetWidth() * sizeof(float));
+  std::unique_ptr<GpuMat<float>> src_normal_map(
+      new GpuMat<float>(normal_map.GetWidth(), normal_map.GetHeight(), 3));
+  src_normal_map->CopyToDevice(normal_map.GetPtr(),
+                               normal_map.GetWidth() * sizeof(float));
+
+  SrcImage src_image;
+  src_image.depth_map = src_depth_map->GetPtr();
+  src_image.normal_map = src_normal_map->GetPtr();
+  src_image.depth_map_pitch = src_depth_map->GetPitch();
+  src_image.normal_map_pitch = src_normal_map->GetPitch();
+  src_image.width = static_cast<int>(depth_map.GetWidth());
+  src_image.height = static_cast<int>(depth_map.GetHeight());
+  std::copy(P, P + 12, src_image.P);
+  std::copy(inv_R, inv_R + 9, src_image.inv_R);
+
+  src_depth_maps_.push_back(std::move(src_depth_map));
+  src_normal_maps_.push_back(std::move(src_normal_map));
+  src_images_.push_back(src_image);
+}
+
+void FusionConsistencyCuda::CheckSrcImages() {
+  CHECK(consistency_masks_);
+  if (src_images_.empty()) {
+    return;
+  }
+
+  CHECK_LT(static_cast<size_t>(batch_idx_), consistency_masks_->GetDepth());
+
+  CUDA_SAFE_CALL(cudaMemcpy(src_images_device_, src_images_.data(),
+                            src_images_.size() * sizeof(SrcImage),
+                            cudaMemcpyHostToDevice));
+
+  RefTransforms ref_transforms;
+  std::copy(ref_inv_P_, ref_inv_P_ + 12, ref_transforms.inv_P);
+  std::copy(ref_inv_R_, ref_inv_R_ + 9, ref_transforms.inv_R);
+
+  const dim3 block_size(kBlockDimX, kBlockDimY);
+  const dim3 grid_size(
+      (ref_depth_map_->GetWidth() - 1) / kBlockDimX + 1,
+      (ref_depth_map_->GetHeight() - 1) / kBlockDimY + 1);
+  CheckConsistency<<<grid_size, block_size>>>(
+      *ref_depth_map_, *ref_normal_map_, ref_transforms, src_images_device_,
+      static_cast<int>(src_images_.size()), max_depth_error_,
+      max_squared_reproj_error_, min_cos_normal_error_, batch_idx_,
+      *consistency_masks_);
+  CUDA_SYNC_AND_CHECK();
+
+  // The maps of the batch are released once it is checked.
+  src_depth_maps_.clear();
+  src_normal_maps_.clear();
+  src_images_.clear();
+  batch_idx_ += 1;
+}
+
+Mat<uint32_t> FusionConsistencyCuda::GetConsistencyMasks() const {
+  CHECK(consistency_masks_);
+  return consistency_masks_->CopyToMat();
+}
+
+}  // namespace mvs
+}  // namespace colmap
@@ -0,0 +1,106 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_MVS_FUSION_CUDA_H_
+#define COLMAP_SRC_MVS_FUSION_CUDA_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "mvs/depth_map.h"
+#include "mvs/mat.h"
+#include "mvs/normal_map.h"
+
+namespace colmap {
+namespace mvs {
+
+template <typename T>
+class GpuMat;
+
+// Check the consistency of the pixels of a reference depth map with their
+// projections into the overlapping source images on the GPU. A reference
+// pixel is consistent with a source image, if the pixel, to which its 3D
+// point projects, has a consistent depth, reprojection and normal, i.e. the
+// checks of the first step of the fusion traversal. The source images are
+// checked in batches of at most `kMaxNumSrcImages`, whose results are the bits
+// of a mask per reference pixel and batch.
+class FusionConsistencyCuda {
+ public:
+  static const int kMaxNumSrcImages = 32;
+
+  // The device maps and the transformations of a source image, as read by
+  // the kernel. The pitches are in bytes.
+  struct SrcImage {
+    const float* depth_map;
+    const float* normal_map;
+    size_t depth_map_pitch;
+    size_t normal_map_pitch;
+    int width;
+    int height;
+    float P[12];
+    float inv_R[9];
+  };
+
+  FusionConsistencyCuda(const int gpu_index, const float max_depth_error,
+                        const float max_squared_reproj_error,
+                        const float min_cos_normal_error);
+  ~FusionConsistencyCuda();
+
+  // Set the reference image, whose 3D points are computed with the inverse
+  // projection matrix and whose normals are rotated into the global frame
+  // with the inverse rotation. The masks of the given number of source images
+  // are reset.
+  void SetRefImage(const DepthMap& depth_map, const NormalMap& normal_map,
+                   const float inv_P[12], const float inv_R[9],
+                   const int num_src_images);
+
+  // Upload the next source image of the current batch, whose maps are copied
+  // and may be released afterwards.
+  void AddSrcImage(const DepthMap& depth_map, const NormalMap& normal_map,
+                   const float P[12], const float inv_R[9]);
+
+  // Check the reference pixels against the source images of the current
+  // batch and start the next batch.
+  void CheckSrcImages();
+
+  // The masks of the reference pixels, whose bit i of slice j is set if the
+  // pixel is consistent with source image `j * kMaxNumSrcImages + i`.
+  Mat<uint32_t> GetConsistencyMasks() const;
+
+ private:
+  const float max_depth_error_;
+  const float max_squared_reproj_error_;
+  const float min_cos_normal_error_;
+
+  std::unique_ptr<GpuMat<float>> ref_depth_map_;
+  std::unique_ptr<GpuMat<float>> ref_normal_map_;
+  float ref_inv_P_[12];
+  float ref_inv_R_[9];
+
+  std::vector<std::unique_ptr<GpuMat<float>>> src_depth_maps_;
+  std::vector<std::unique_ptr<GpuMat<float>>> src_normal_maps_;
+  std::vector<SrcImage> src_images_;
+  SrcImage* src_images_device_;
+
+  std::unique_ptr<GpuMat<uint32_t>> consistency_masks_;
+  int batch_idx_;
+};
+
+}  // namespace mvs
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_MVS_FUSION_CUDA_H_
@@ -0,0 +1,89 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "mvs/fusion_cuda_test"
+#include "util/testing.h"
+
+#include "mvs/fusion_cuda.h"
+
+using namespace colmap;
+using namespace colmap::mvs;
+
+BOOST_AUTO_TEST_CASE(TestConsistencyMasks) {
+  const size_t kWidth = 10;
+  const size_t kHeight = 10;
+
+  // All images have the same calibration and pose.
+  const float P[12] = {10, 0, 5, 0, 0, 10, 5, 0, 0, 0, 1, 0};
+  const float inv_P[12] = {0.1f, 0, -0.5f, 0, 0, 0.1f, -0.5f, 0, 0, 0, 1, 0};
+  const float inv_R[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+
+  DepthMap depth_map(kWidth, kHeight, 0, 10);
+  depth_map.Fill(2.0f);
+  depth_map.Set(3, 4, 0.0f);
+  DepthMap far_depth_map(kWidth, kHeight, 0, 10);
+  far_depth_map.Fill(3.0f);
+
+  NormalMap normal_map(kWidth, kHeight);
+  NormalMap flipped_normal_map(kWidth, kHeight);
+  for (size_t row = 0; row < kHeight; ++row) {
+    for (size_t col = 0; col < kWidth; ++col) {
+      normal_map.Set(row, col, 2, -1.0f);
+      flipped_normal_map.Set(row, col, 2, 1.0f);
+    }
+  }
+
+  // The source images are consistent, have an inconsistent depth or an
+  // inconsistent normal, in turns, and are checked in two batches.
+  const int kNumSrcImages = FusionConsistencyCuda::kMaxNumSrcImages + 3;
+  FusionConsistencyCuda consistency(-1, 0.01f, 4.0f, 0.9f);
+  consistency.SetRefImage(depth_map, normal_map, inv_P, inv_R, kNumSrcImages);
+  for (int i = 0; i < kNumSrcImages; ++i) {
+    if (i % 3 == 0) {
+      consistency.AddSrcImage(depth_map, normal_map, P, inv_R);
+    } else if (i % 3 == 1) {
+      consistency.AddSrcImage(far_depth_map, normal_map, P, inv_R);
+    } else {
+      consistency.AddSrcImage(depth_map, flipped_normal_map, P, inv_R);
+    }
+    if (i + 1 == FusionConsistencyCuda::kMaxNumSrcImages ||
+        i + 1 == kNumSrcImages) {
+      consistency.CheckSrcImages();
+    }
+  }
+
+  const Mat<uint32_t> masks = consistency.GetConsistencyMasks();
+  BOOST_CHECK_EQUAL(masks.GetWidth(), kWidth);
+  BOOST_CHECK_EQUAL(masks.GetHeight(), kHeight);
+  BOOST_CHECK_EQUAL(masks.GetDepth(), 2);
+
+  for (size_t row = 0; row < kHeight; ++row) {
+    for (size_t col = 0; col < kWidth; ++col) {
+      for (int i = 0; i < kNumSrcImages; ++i) {
+        const bool is_consistent =
+            (masks.Get(row, col,
+                       i / FusionConsistencyCuda::kMaxNumSrcImages) >>
+             (i % FusionConsistencyCuda::kMaxNumSrcImages)) &
+            1;
+        if (row == 3 && col == 4) {
+          BOOST_CHECK(!is_consistent);
+        } else {
+          BOOST_CHECK_EQUAL(is_consistent, i % 3 == 0);
+        }
+      }
+    }
+  }
+}
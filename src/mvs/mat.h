@@ -17,10 +17,12 @@
 #ifndef COLMAP_SRC_MVS_MAT_H_
 #define COLMAP_SRC_MVS_MAT_H_
 
+#include <algorithm>
 #include <fstream>
 #include <string>
 #include <vector>
 
+#include "mvs/tiled_mat.h"
 #include "util/endian.h"
 #include "util/logging.h"
 
@@ -52,8 +54,11 @@ class Mat {
 
   void Fill(const T value);
 
+  // Read the matrix in the raw or the tiled format, which is detected from
+  // the file, so that the readers do not depend on how it was written.
   void Read(const std::string& path);
   void Write(const std::string& path) const;
+  void Write(const std::string& path, const TiledMatOptions& options) const;
 
  protected:
   size_t width_ = 0;
@@ -140,6 +145,15 @@ void Mat<T>::Fill(const T value) {
 
 template <typename T>
 void Mat<T>::Read(const std::string& path) {
+  if (IsTiledMat(path)) {
+    std::vector<float> data;
+    ReadTiledMat(path, &width_, &height_, &depth_, &data);
+    data_.resize(data.size());
+    std::transform(data.begin(), data.end(), data_.begin(),
+                   [](const float value) { return static_cast<T>(value); });
+    return;
+  }
+
   std::fstream text_file(path, std::ios::in | std::ios::binary);
   CHECK(text_file.is_open()) << path;
 
@@ -175,6 +189,13 @@ void Mat<T>::Write(const std::string& path) const {
   binary_file.close();
 }
 
+template <typename T>
+void Mat<T>::Write(const std::string& path,
+                   const TiledMatOptions& options) const {
+  const std::vector<float> data(data_.begin(), data_.end());
+  WriteTiledMat(path, width_, height_, depth_, data.data(), options);
+}
+
 }  // namespace mvs
 }  // namespace colmap
 
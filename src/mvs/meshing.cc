@@ -21,6 +21,7 @@
 #include "ext/PoissonRecon/PoissonRecon.h"
 #include "ext/PoissonRecon/SurfaceTrimmer.h"
 #include "util/logging.h"
+#include "util/threading.h"
 
 namespace colmap {
 namespace mvs {
@@ -30,6 +31,7 @@ bool PoissonReconstructionOptions::Check() const {
   CHECK_OPTION_GT(depth, 0);
   CHECK_OPTION_GE(color, 0);
   CHECK_OPTION_GE(trim, 0);
+  CHECK_OPTION_GT(samples_per_node, 0);
   CHECK_OPTION_GE(num_threads, -1);
   CHECK_OPTION_NE(num_threads, 0);
   return true;
@@ -56,16 +58,17 @@ bool PoissonReconstruction(const PoissonReconstructionOptions& options,
   args.push_back("--depth");
   args.push_back(std::to_string(options.depth));
 
+  args.push_back("--samplesPerNode");
+  args.push_back(std::to_string(options.samples_per_node));
+
   if (options.color > 0) {
     args.push_back("--color");
     args.push_back(std::to_string(options.color));
   }
 
 #ifdef OPENMP_ENABLED
-  if (options.num_threads > 0) {
-    args.push_back("--threads");
-    args.push_back(std::to_string(options.num_threads));
-  }
+  args.push_back("--threads");
+  args.push_back(std::to_string(GetEffectiveNumThreads(options.num_threads)));
 #endif  // OPENMP_ENABLED
 
   if (options.trim > 0) {
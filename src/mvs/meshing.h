@@ -46,7 +46,15 @@ struct PoissonReconstructionOptions {
   // subset of the mesh with signal value less than the trim value is discarded.
   double trim = 10.0;
 
-  // The number of threads used for the Poisson reconstruction.
+  // The minimum number of point samples that fall into an octree node before
+  // it is refined further. In sparsely sampled regions the octree then stops
+  // at a coarser depth, which bounds the memory of the octree and the linear
+  // system at high depths. Noise-free samples allow values in [1, 5], noisy
+  // samples benefit from values in [15, 20].
+  double samples_per_node = 1.5;
+
+  // The number of threads used to build the octree, set up and solve the
+  // linear system and extract the iso-surface.
   int num_threads = -1;
 
   bool Check() const;
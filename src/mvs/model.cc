@@ -78,6 +78,58 @@ void Model::ReadFromCOLMAP(const std::string& path) {
   }
 }
 
+Model Model::ReadBodyFromCOLMAP(const std::string& path) const {
+  Reconstruction reconstruction;
+  reconstruction.Read(path);
+
+  Model body_model = *this;
+  body_model.points.clear();
+  body_model.pmvs_vis_dat_.clear();
+
+  std::unordered_map<image_t, int> image_id_map;
+  for (const image_t image_id : reconstruction.RegImageIds()) {
+    const auto& image = reconstruction.Image(image_id);
+    const auto name_and_id = image_name_to_id_.find(image.Name());
+    if (name_and_id == image_name_to_id_.end()) {
+      std::cout << StringPrintf(
+                       "WARNING: Ignoring image %s of the body, because it is "
+                       "not in the workspace.",
+                       image.Name().c_str())
+                << std::endl;
+      continue;
+    }
+
+    const int body_image_id = name_and_id->second;
+    const Image& workspace_image = images.at(body_image_id);
+    const Eigen::Matrix<float, 3, 3, Eigen::RowMajor> R =
+        QuaternionToRotationMatrix(image.Qvec()).cast<float>();
+    const Eigen::Vector3f T = image.Tvec().cast<float>();
+    body_model.images[body_image_id] =
+        Image(workspace_image.GetPath(), workspace_image.GetWidth(),
+              workspace_image.GetHeight(), workspace_image.GetK(), R.data(),
+              T.data());
+    image_id_map.emplace(image_id, body_image_id);
+  }
+
+  body_model.points.reserve(reconstruction.NumPoints3D());
+  for (const auto& point3D : reconstruction.Points3D()) {
+    Point point;
+    point.x = point3D.second.X();
+    point.y = point3D.second.Y();
+    point.z = point3D.second.Z();
+    point.track.reserve(point3D.second.Track().Length());
+    for (const auto& track_el : point3D.second.Track().Elements()) {
+      const auto body_image_id = image_id_map.find(track_el.image_id);
+      if (body_image_id != image_id_map.end()) {
+        point.track.push_back(body_image_id->second);
+      }
+    }
+    body_model.points.push_back(point);
+  }
+
+  return body_model;
+}
+
 void Model::ReadFromPMVS(const std::string& path) {
   if (ReadFromBundlerPMVS(path)) {
     return;
@@ -46,6 +46,14 @@ struct Model {
   void ReadFromCOLMAP(const std::string& path);
   void ReadFromPMVS(const std::string& path);
 
+  // Read the model of the object of a two-body reconstruction from the COLMAP
+  // sparse model at the path, e.g. the `model3` of the postprocessor. The
+  // object model has the images, cameras and image identifiers of this model,
+  // whose images are found by name, and only its own poses and points, so that
+  // the images are undistorted once for both bodies. The images that are not
+  // in the object model keep their pose but are in no track.
+  Model ReadBodyFromCOLMAP(const std::string& path) const;
+
   // Get the image identifier for the given image name.
   int GetImageId(const std::string& name) const;
   std::string GetImageName(const int image_id) const;
@@ -16,6 +16,7 @@
 
 #include "mvs/patch_match.h"
 
+#include <algorithm>
 #include <numeric>
 #include <unordered_set>
 
@@ -29,6 +30,29 @@
 
 namespace colmap {
 namespace mvs {
+namespace {
+
+// Nearest neighbor upsampling of a map of a coarser pyramid level.
+Mat<float> UpsampleMap(const Mat<float>& map, const size_t width,
+                       const size_t height) {
+  Mat<float> upsampled_map(width, height, map.GetDepth());
+  const float scale_x = static_cast<float>(map.GetWidth()) / width;
+  const float scale_y = static_cast<float>(map.GetHeight()) / height;
+  for (size_t row = 0; row < height; ++row) {
+    const size_t map_row = std::min(static_cast<size_t>(row * scale_y),
+                                    map.GetHeight() - 1);
+    for (size_t col = 0; col < width; ++col) {
+      const size_t map_col = std::min(static_cast<size_t>(col * scale_x),
+                                      map.GetWidth() - 1);
+      for (size_t slice = 0; slice < map.GetDepth(); ++slice) {
+        upsampled_map.Set(row, col, slice, map.Get(map_row, map_col, slice));
+      }
+    }
+  }
+  return upsampled_map;
+}
+
+}  // namespace
 
 PatchMatch::PatchMatch(const PatchMatchOptions& options, const Problem& problem)
     : options_(options), problem_(problem) {}
@@ -50,6 +74,8 @@ void PatchMatchOptions::Print() const {
   PrintOption(min_triangulation_angle);
   PrintOption(incident_angle_sigma);
   PrintOption(num_iterations);
+  PrintOption(num_pyramid_levels);
+  PrintOption(pyramid_num_iterations);
   PrintOption(geom_consistency);
   PrintOption(geom_consistency_regularizer);
   PrintOption(geom_consistency_max_cost);
@@ -58,7 +84,12 @@ void PatchMatchOptions::Print() const {
   PrintOption(filter_min_triangulation_angle);
   PrintOption(filter_min_num_consistent);
   PrintOption(filter_geom_consistency_max_cost);
+  PrintOption(half_precision_maps);
+  PrintOption(image_path);
   PrintOption(write_consistency_graph);
+  PrintOption(write_tiled_maps);
+  PrintOption(tiled_maps_tile_size);
+  PrintOption(tiled_maps_half_precision);
 }
 
 void PatchMatch::Problem::Print() const {
@@ -136,6 +167,16 @@ void PatchMatch::Check() const {
     CHECK_EQ(ref_image.GetWidth(), ref_normal_map.GetWidth());
     CHECK_EQ(ref_image.GetHeight(), ref_normal_map.GetHeight());
   }
+
+  CHECK_EQ(problem_.init_depth_map == nullptr,
+           problem_.init_normal_map == nullptr);
+  if (problem_.init_depth_map != nullptr) {
+    const Image& ref_image = problem_.images->at(problem_.ref_image_id);
+    CHECK_EQ(ref_image.GetWidth(), problem_.init_depth_map->GetWidth());
+    CHECK_EQ(ref_image.GetHeight(), problem_.init_depth_map->GetHeight());
+    CHECK_EQ(ref_image.GetWidth(), problem_.init_normal_map->GetWidth());
+    CHECK_EQ(ref_image.GetHeight(), problem_.init_normal_map->GetHeight());
+  }
 }
 
 void PatchMatch::Run() {
@@ -143,10 +184,69 @@ void PatchMatch::Run() {
 
   Check();
 
+  // The geometric pass is already initialized with the photometric maps.
+  if (options_.num_pyramid_levels > 1 && !options_.geom_consistency) {
+    RunPyramid();
+    return;
+  }
+
   patch_match_cuda_.reset(new PatchMatchCuda(options_, problem_));
   patch_match_cuda_->Run();
 }
 
+void PatchMatch::RunPyramid() {
+  std::vector<int> used_image_ids = problem_.src_image_ids;
+  used_image_ids.push_back(problem_.ref_image_id);
+
+  DepthMap init_depth_map;
+  NormalMap init_normal_map;
+  for (int level = options_.num_pyramid_levels - 1; level >= 0; --level) {
+    PatchMatchOptions level_options = options_;
+    Problem level_problem = problem_;
+
+    std::vector<Image> level_images;
+    if (level > 0) {
+      const float scale = 1.0f / (1 << level);
+      level_images = *problem_.images;
+      for (const int image_id : used_image_ids) {
+        level_images[image_id].Rescale(scale);
+      }
+      level_problem.images = &level_images;
+      // The coarse maps are not filtered, as they initialize all pixels of
+      // the next level.
+      level_options.filter = false;
+      level_options.write_consistency_graph = false;
+    }
+
+    if (level < options_.num_pyramid_levels - 1) {
+      const Image& ref_image =
+          level_problem.images->at(problem_.ref_image_id);
+      init_depth_map = DepthMap(
+          UpsampleMap(init_depth_map, ref_image.GetWidth(),
+                      ref_image.GetHeight()),
+          init_depth_map.GetDepthMin(), init_depth_map.GetDepthMax());
+      init_normal_map = NormalMap(UpsampleMap(
+          init_normal_map, ref_image.GetWidth(), ref_image.GetHeight()));
+      level_problem.init_depth_map = &init_depth_map;
+      level_problem.init_normal_map = &init_normal_map;
+      level_options.num_iterations = options_.pyramid_num_iterations;
+    }
+
+    std::cout << StringPrintf("Pyramid level %d with %d iterations", level,
+                              level_options.num_iterations)
+              << std::endl;
+
+    patch_match_cuda_.reset(new PatchMatchCuda(level_options, level_problem));
+    patch_match_cuda_->Run();
+
+    if (level > 0) {
+      init_depth_map = patch_match_cuda_->GetDepthMap();
+      init_normal_map = patch_match_cuda_->GetNormalMap();
+      patch_match_cuda_.reset();
+    }
+  }
+}
+
 DepthMap PatchMatch::GetDepthMap() const {
   return patch_match_cuda_->GetDepthMap();
 }
@@ -165,14 +265,15 @@ ConsistencyGraph PatchMatch::GetConsistencyGraph() const {
                           patch_match_cuda_->GetConsistentImageIds());
 }
 
-PatchMatchController::PatchMatchController(const PatchMatchOptions& options,
-                                           const std::string& workspace_path,
-                                           const std::string& workspace_format,
-                                           const std::string& pmvs_option_name)
+PatchMatchController::PatchMatchController(
+    const PatchMatchOptions& options, const std::string& workspace_path,
+    const std::string& workspace_format, const std::string& pmvs_option_name,
+    const std::string& object_sparse_path)
     : options_(options),
       workspace_path_(workspace_path),
       workspace_format_(workspace_format),
-      pmvs_option_name_(pmvs_option_name) {
+      pmvs_option_name_(pmvs_option_name),
+      object_sparse_path_(object_sparse_path) {
   std::vector<int> gpu_indices = CSVToVector<int>(options_.gpu_index);
 }
 
@@ -180,8 +281,11 @@ void PatchMatchController::Run() {
   ReadWorkspace();
   ReadProblems();
   ReadGpuIndices();
+  ScheduleProblems();
 
   thread_pool_.reset(new ThreadPool(gpu_indices_.size()));
+  prefetch_thread_pool_.reset(new ThreadPool(1));
+  output_thread_pool_.reset(new ThreadPool(1));
 
   // If geometric consistency is enabled, then photometric output must be
   // computed first for all images without filtering.
@@ -190,21 +294,27 @@ void PatchMatchController::Run() {
     photometric_options.geom_consistency = false;
     photometric_options.filter = false;
 
-    for (size_t problem_idx = 0; problem_idx < problems_.size();
-         ++problem_idx) {
-      thread_pool_->AddTask(&PatchMatchController::ProcessProblem, this,
-                            photometric_options, problem_idx);
+    for (size_t schedule_idx = 0; schedule_idx < schedule_.size();
+         ++schedule_idx) {
+      thread_pool_->AddTask(&PatchMatchController::ProcessScheduledProblem,
+                            this, photometric_options, schedule_idx);
     }
 
+    // The geometric pass reads the photometric outputs.
     thread_pool_->Wait();
+    prefetch_thread_pool_->Wait();
+    output_thread_pool_->Wait();
   }
 
-  for (size_t problem_idx = 0; problem_idx < problems_.size(); ++problem_idx) {
-    thread_pool_->AddTask(&PatchMatchController::ProcessProblem, this, options_,
-                          problem_idx);
+  for (size_t schedule_idx = 0; schedule_idx < schedule_.size();
+       ++schedule_idx) {
+    thread_pool_->AddTask(&PatchMatchController::ProcessScheduledProblem, this,
+                          options_, schedule_idx);
   }
 
   thread_pool_->Wait();
+  prefetch_thread_pool_->Wait();
+  output_thread_pool_->Wait();
 
   GetTimer().PrintMinutes();
 }
@@ -227,6 +337,13 @@ void PatchMatchController::ReadWorkspace() {
   workspace_options.workspace_path = workspace_path_;
   workspace_options.workspace_format = workspace_format_;
   workspace_options.input_type = options_.geom_consistency ? "photometric" : "";
+  workspace_options.image_path = options_.image_path;
+  workspace_options.image_source = options_.image_source;
+  if (!object_sparse_path_.empty()) {
+    CHECK_EQ(workspace_format_lower_case, "colmap")
+        << "Two-body workspaces must be in the COLMAP format";
+    workspace_options.object_sparse_path = object_sparse_path_;
+  }
 
   workspace_.reset(new Workspace(workspace_options));
 
@@ -237,7 +354,19 @@ void PatchMatchController::ReadWorkspace() {
     ImportPMVSWorkspace(*workspace_, pmvs_option_name_);
   }
 
-  depth_ranges_ = workspace_->GetModel().ComputeDepthRanges();
+  if (!object_sparse_path_.empty()) {
+    const std::string object_stereo_path = JoinPaths(
+        workspace_path_, workspace_->GetOptions().object_stereo_folder);
+    CreateDirIfNotExists(object_stereo_path);
+    CreateDirIfNotExists(JoinPaths(object_stereo_path, "depth_maps"));
+    CreateDirIfNotExists(JoinPaths(object_stereo_path, "normal_maps"));
+    CreateDirIfNotExists(JoinPaths(object_stereo_path, "consistency_graphs"));
+  }
+
+  depth_ranges_.clear();
+  for (int body = 0; body < workspace_->NumBodies(); ++body) {
+    depth_ranges_.push_back(workspace_->GetModel(body).ComputeDepthRanges());
+  }
 }
 
 void PatchMatchController::ReadProblems() {
@@ -251,8 +380,11 @@ void PatchMatchController::ReadProblems() {
       JoinPaths(workspace_path_, workspace_->GetOptions().stereo_folder,
                 "patch-match.cfg"));
 
-  std::vector<std::map<int, int>> shared_num_points;
-  std::vector<std::map<int, float>> triangulation_angles;
+  // The overlap of the images in every body.
+  std::vector<std::vector<std::map<int, int>>> shared_num_points(
+      workspace_->NumBodies());
+  std::vector<std::vector<std::map<int, float>>> triangulation_angles(
+      workspace_->NumBodies());
 
   const float min_triangulation_angle_rad =
       DegToRad(options_.min_triangulation_angle);
@@ -290,77 +422,98 @@ void PatchMatchController::ReadProblems() {
   }
 
   for (const auto& problem_config : problem_configs) {
-    PatchMatch::Problem problem;
-
-    problem.ref_image_id = model.GetImageId(problem_config.ref_image_name);
-
-    if (problem_config.src_image_names.size() == 1 &&
-        problem_config.src_image_names[0] == "__all__") {
-      // Use all images as source images.
-      problem.src_image_ids.clear();
-      problem.src_image_ids.reserve(model.images.size() - 1);
-      for (const int image_id : ref_image_ids) {
-        if (image_id != problem.ref_image_id) {
-          problem.src_image_ids.push_back(image_id);
-        }
-      }
-    } else if (problem_config.src_image_names.size() == 2 &&
-               problem_config.src_image_names[0] == "__auto__") {
-      // Use maximum number of overlapping images as source images. Overlapping
-      // will be sorted based on the number of shared points to the reference
-      // image and the top ranked images are selected. Note that images are only
-      // selected if some points have a sufficient triangulation angle.
-
-      if (shared_num_points.empty()) {
-        shared_num_points = model.ComputeSharedPoints();
-      }
-      if (triangulation_angles.empty()) {
-        const float kTriangulationAnglePercentile = 75;
-        triangulation_angles =
-            model.ComputeTriangulationAngles(kTriangulationAnglePercentile);
+    std::vector<PatchMatch::Problem> problems(workspace_->NumBodies());
+    bool has_src_images = false;
+    for (int body = 0; body < workspace_->NumBodies(); ++body) {
+      // Only the images that see points of the object take part in its
+      // problems, since the other images have no pose relative to it.
+      const auto& body_depth_ranges = depth_ranges_[body];
+      const auto IsBodyImage = [body, &body_depth_ranges](const int image_id) {
+        return body == 0 || body_depth_ranges.at(image_id).first > 0;
+      };
+
+      PatchMatch::Problem& problem = problems[body];
+      problem.ref_image_id = model.GetImageId(problem_config.ref_image_name);
+      if (!IsBodyImage(problem.ref_image_id)) {
+        continue;
       }
 
-      const size_t max_num_src_images =
-          std::stoll(problem_config.src_image_names[1]);
-
-      const auto& overlapping_images =
-          shared_num_points.at(problem.ref_image_id);
-      const auto& overlapping_triangulation_angles =
-          triangulation_angles.at(problem.ref_image_id);
-
-      std::vector<std::pair<int, int>> src_images;
-      src_images.reserve(overlapping_images.size());
-      for (const auto& image : overlapping_images) {
-        if (ref_image_ids.count(image.first) &&
-            overlapping_triangulation_angles.at(image.first) >=
-                min_triangulation_angle_rad) {
-          src_images.emplace_back(image.first, image.second);
+      if (problem_config.src_image_names.size() == 1 &&
+          problem_config.src_image_names[0] == "__all__") {
+        // Use all images as source images.
+        problem.src_image_ids.clear();
+        problem.src_image_ids.reserve(model.images.size() - 1);
+        for (const int image_id : ref_image_ids) {
+          if (image_id != problem.ref_image_id && IsBodyImage(image_id)) {
+            problem.src_image_ids.push_back(image_id);
+          }
+        }
+      } else if (problem_config.src_image_names.size() == 2 &&
+                 problem_config.src_image_names[0] == "__auto__") {
+        // Use maximum number of overlapping images as source images.
+        // Overlapping will be sorted based on the number of shared points to
+        // the reference image and the top ranked images are selected. Note
+        // that images are only selected if some points have a sufficient
+        // triangulation angle. The overlap is computed from the poses and
+        // points of the body.
+        const Model& body_model = workspace_->GetModel(body);
+
+        if (shared_num_points[body].empty()) {
+          shared_num_points[body] = body_model.ComputeSharedPoints();
+        }
+        if (triangulation_angles[body].empty()) {
+          const float kTriangulationAnglePercentile = 75;
+          triangulation_angles[body] = body_model.ComputeTriangulationAngles(
+              kTriangulationAnglePercentile);
         }
-      }
 
-      const size_t eff_max_num_src_images =
-          std::min(src_images.size(), max_num_src_images);
+        const size_t max_num_src_images =
+            std::stoll(problem_config.src_image_names[1]);
+
+        const auto& overlapping_images =
+            shared_num_points[body].at(problem.ref_image_id);
+        const auto& overlapping_triangulation_angles =
+            triangulation_angles[body].at(problem.ref_image_id);
+
+        std::vector<std::pair<int, int>> src_images;
+        src_images.reserve(overlapping_images.size());
+        for (const auto& image : overlapping_images) {
+          if (ref_image_ids.count(image.first) &&
+              overlapping_triangulation_angles.at(image.first) >=
+                  min_triangulation_angle_rad) {
+            src_images.emplace_back(image.first, image.second);
+          }
+        }
 
-      std::partial_sort(src_images.begin(),
-                        src_images.begin() + eff_max_num_src_images,
-                        src_images.end(),
-                        [](const std::pair<int, int>& image1,
-                           const std::pair<int, int>& image2) {
-                          return image1.second > image2.second;
-                        });
+        const size_t eff_max_num_src_images =
+            std::min(src_images.size(), max_num_src_images);
 
-      problem.src_image_ids.reserve(eff_max_num_src_images);
-      for (size_t i = 0; i < eff_max_num_src_images; ++i) {
-        problem.src_image_ids.push_back(src_images[i].first);
-      }
-    } else {
-      problem.src_image_ids.reserve(problem_config.src_image_names.size());
-      for (const auto& src_image_name : problem_config.src_image_names) {
-        problem.src_image_ids.push_back(model.GetImageId(src_image_name));
+        std::partial_sort(src_images.begin(),
+                          src_images.begin() + eff_max_num_src_images,
+                          src_images.end(),
+                          [](const std::pair<int, int>& image1,
+                             const std::pair<int, int>& image2) {
+                            return image1.second > image2.second;
+                          });
+
+        problem.src_image_ids.reserve(eff_max_num_src_images);
+        for (size_t i = 0; i < eff_max_num_src_images; ++i) {
+          problem.src_image_ids.push_back(src_images[i].first);
+        }
+      } else {
+        problem.src_image_ids.reserve(problem_config.src_image_names.size());
+        for (const auto& src_image_name : problem_config.src_image_names) {
+          const int src_image_id = model.GetImageId(src_image_name);
+          if (IsBodyImage(src_image_id)) {
+            problem.src_image_ids.push_back(src_image_id);
+          }
+        }
       }
+
+      has_src_images = has_src_images || !problem.src_image_ids.empty();
     }
 
-    if (problem.src_image_ids.empty()) {
+    if (!has_src_images) {
       std::cout
           << StringPrintf(
                  "WARNING: Ignoring reference image %s, because it has no "
@@ -368,7 +521,7 @@ void PatchMatchController::ReadProblems() {
                  problem_config.ref_image_name.c_str())
           << std::endl;
     } else {
-      problems_.push_back(problem);
+      problems_.push_back(problems);
     }
   }
 
@@ -387,6 +540,95 @@ void PatchMatchController::ReadGpuIndices() {
   }
 }
 
+void PatchMatchController::ScheduleProblems() {
+  // The cost of a problem is estimated by the number of NCC evaluations per
+  // iteration, i.e. the reference pixels times the source images of the
+  // bodies, as the window size is the same for all problems.
+  std::vector<double> costs(problems_.size(), 0);
+  for (size_t problem_idx = 0; problem_idx < problems_.size(); ++problem_idx) {
+    for (int body = 0; body < workspace_->NumBodies(); ++body) {
+      const auto& problem = problems_[problem_idx][body];
+      const auto& ref_image =
+          workspace_->GetModel(body).images.at(problem.ref_image_id);
+      costs[problem_idx] += static_cast<double>(ref_image.GetWidth()) *
+                            ref_image.GetHeight() *
+                            problem.src_image_ids.size();
+    }
+  }
+
+  schedule_.resize(problems_.size());
+  std::iota(schedule_.begin(), schedule_.end(), 0);
+  std::stable_sort(schedule_.begin(), schedule_.end(),
+                   [&costs](const size_t problem_idx1,
+                            const size_t problem_idx2) {
+                     return costs[problem_idx1] > costs[problem_idx2];
+                   });
+}
+
+std::vector<int> PatchMatchController::FindPendingBodies(
+    const PatchMatchOptions& options, const size_t problem_idx) const {
+  std::vector<int> bodies;
+  const auto& problems = problems_.at(problem_idx);
+  for (int body = 0; body < static_cast<int>(problems.size()); ++body) {
+    if (problems[body].src_image_ids.empty()) {
+      continue;
+    }
+    if (!ExistsFile(GetOutputPath(options, problem_idx, body, "depth_maps")) ||
+        !ExistsFile(GetOutputPath(options, problem_idx, body, "normal_maps")) ||
+        (options.write_consistency_graph &&
+         !ExistsFile(GetOutputPath(options, problem_idx, body,
+                                   "consistency_graphs")))) {
+      bodies.push_back(body);
+    }
+  }
+  return bodies;
+}
+
+std::string PatchMatchController::GetOutputPath(
+    const PatchMatchOptions& options, const size_t problem_idx, const int body,
+    const std::string& folder) const {
+  const std::string& stereo_folder =
+      body == 0 ? workspace_->GetOptions().stereo_folder
+                : workspace_->GetOptions().object_stereo_folder;
+  const std::string output_type =
+      options.geom_consistency ? "geometric" : "photometric";
+  const std::string image_name = workspace_->GetModel().GetImageName(
+      problems_.at(problem_idx)[0].ref_image_id);
+  const std::string file_name =
+      StringPrintf("%s.%s.bin", image_name.c_str(), output_type.c_str());
+  return JoinPaths(workspace_path_, stereo_folder, folder, file_name);
+}
+
+void PatchMatchController::ProcessScheduledProblem(
+    const PatchMatchOptions& options, const size_t schedule_idx) {
+  const size_t prefetch_schedule_idx = schedule_idx + gpu_indices_.size();
+  if (prefetch_schedule_idx < schedule_.size()) {
+    prefetch_thread_pool_->AddTask(&PatchMatchController::PrefetchProblem,
+                                   this, options,
+                                   schedule_.at(prefetch_schedule_idx));
+  }
+  ProcessProblem(options, schedule_.at(schedule_idx));
+}
+
+void PatchMatchController::PrefetchProblem(const PatchMatchOptions& options,
+                                           const size_t problem_idx) {
+  if (IsStopped()) {
+    return;
+  }
+
+  const auto& problems = problems_.at(problem_idx);
+  for (const int body : FindPendingBodies(options, problem_idx)) {
+    const auto& problem = problems[body];
+    std::vector<int> used_image_ids = {problem.ref_image_id};
+    used_image_ids.insert(used_image_ids.end(), problem.src_image_ids.begin(),
+                          problem.src_image_ids.end());
+    // The images are read by the prefetch threads of the workspace, so that
+    // the running problems are not blocked while they are read.
+    std::unique_lock<std::mutex> lock(workspace_mutex_);
+    workspace_->Prefetch(used_image_ids, options.geom_consistency, body);
+  }
+}
+
 void PatchMatchController::ProcessProblem(const PatchMatchOptions& options,
                                           const size_t problem_idx) {
   if (IsStopped()) {
@@ -395,102 +637,131 @@ void PatchMatchController::ProcessProblem(const PatchMatchOptions& options,
 
   const auto& model = workspace_->GetModel();
 
-  auto& problem = problems_.at(problem_idx);
+  auto& problems = problems_.at(problem_idx);
   const int gpu_index = gpu_indices_.at(thread_pool_->GetThreadIndex());
   CHECK_GE(gpu_index, -1);
 
-  const std::string& stereo_folder = workspace_->GetOptions().stereo_folder;
   const std::string output_type =
       options.geom_consistency ? "geometric" : "photometric";
-  const std::string image_name = model.GetImageName(problem.ref_image_id);
-  const std::string file_name =
-      StringPrintf("%s.%s.bin", image_name.c_str(), output_type.c_str());
-  const std::string depth_map_path =
-      JoinPaths(workspace_path_, stereo_folder, "depth_maps", file_name);
-  const std::string normal_map_path =
-      JoinPaths(workspace_path_, stereo_folder, "normal_maps", file_name);
-  const std::string consistency_graph_path = JoinPaths(
-      workspace_path_, stereo_folder, "consistency_graphs", file_name);
-
-  if (ExistsFile(depth_map_path) && ExistsFile(normal_map_path) &&
-      (!options.write_consistency_graph ||
-       ExistsFile(consistency_graph_path))) {
+  const std::string image_name = model.GetImageName(problems[0].ref_image_id);
+
+  const std::vector<int> bodies = FindPendingBodies(options, problem_idx);
+  if (bodies.empty()) {
     return;
   }
 
   PrintHeading1(StringPrintf("Processing view %d / %d", problem_idx + 1,
                              problems_.size()));
 
-  auto patch_match_options = options;
-
-  if (patch_match_options.depth_min < 0 || patch_match_options.depth_max < 0) {
-    patch_match_options.depth_min =
-        depth_ranges_.at(problem.ref_image_id).first;
-    patch_match_options.depth_max =
-        depth_ranges_.at(problem.ref_image_id).second;
-    CHECK(patch_match_options.depth_min > 0 &&
-          patch_match_options.depth_max > 0)
-        << " - You must manually set the minimum and maximum depth, since no "
-           "sparse model is provided in the workspace.";
-  }
+  // The images of every body, which share the bitmaps read from the
+  // workspace, so that every image is only read once for all bodies.
+  std::vector<std::vector<Image>> images(problems.size());
+  std::vector<std::vector<DepthMap>> depth_maps(problems.size());
+  std::vector<std::vector<NormalMap>> normal_maps(problems.size());
+  std::vector<PatchMatchOptions> patch_match_options(problems.size(), options);
+  for (const int body : bodies) {
+    auto& problem = problems[body];
+    images[body] = workspace_->GetModel(body).images;
+    if (options.geom_consistency) {
+      depth_maps[body].resize(model.images.size());
+      normal_maps[body].resize(model.images.size());
+    }
 
-  patch_match_options.gpu_index = std::to_string(gpu_index);
+    problem.images = &images[body];
+    problem.depth_maps = &depth_maps[body];
+    problem.normal_maps = &normal_maps[body];
+
+    auto& body_options = patch_match_options[body];
+    if (body_options.depth_min < 0 || body_options.depth_max < 0) {
+      body_options.depth_min =
+          depth_ranges_[body].at(problem.ref_image_id).first;
+      body_options.depth_max =
+          depth_ranges_[body].at(problem.ref_image_id).second;
+      CHECK(body_options.depth_min > 0 && body_options.depth_max > 0)
+          << " - You must manually set the minimum and maximum depth, since no "
+             "sparse model is provided in the workspace.";
+    }
 
-  if (patch_match_options.sigma_spatial <= 0.0f) {
-    patch_match_options.sigma_spatial = patch_match_options.window_radius;
-  }
+    body_options.gpu_index = std::to_string(gpu_index);
 
-  std::vector<Image> images = model.images;
-  std::vector<DepthMap> depth_maps;
-  std::vector<NormalMap> normal_maps;
-  if (options.geom_consistency) {
-    depth_maps.resize(model.images.size());
-    normal_maps.resize(model.images.size());
-  }
+    if (body_options.sigma_spatial <= 0.0f) {
+      body_options.sigma_spatial = body_options.window_radius;
+    }
 
-  problem.images = &images;
-  problem.depth_maps = &depth_maps;
-  problem.normal_maps = &normal_maps;
+    body_options.filter_min_num_consistent =
+        std::min(static_cast<int>(problem.src_image_ids.size()),
+                 body_options.filter_min_num_consistent);
+  }
 
   {
-    // Collect all used images in current problem.
-    std::unordered_set<int> used_image_ids(problem.src_image_ids.begin(),
-                                           problem.src_image_ids.end());
-    used_image_ids.insert(problem.ref_image_id);
-
-    patch_match_options.filter_min_num_consistent =
-        std::min(static_cast<int>(used_image_ids.size()) - 1,
-                 patch_match_options.filter_min_num_consistent);
-
     // Only access workspace from one thread at a time and only spawn resample
     // threads from one master thread at a time.
     std::unique_lock<std::mutex> lock(workspace_mutex_);
 
     std::cout << "Reading inputs..." << std::endl;
-    for (const auto image_id : used_image_ids) {
-      images.at(image_id).SetBitmap(workspace_->GetBitmap(image_id));
-      if (options.geom_consistency) {
-        depth_maps.at(image_id) = workspace_->GetDepthMap(image_id);
-        normal_maps.at(image_id) = workspace_->GetNormalMap(image_id);
+    for (const int body : bodies) {
+      const auto& problem = problems[body];
+      // Collect all used images in current problem.
+      std::unordered_set<int> used_image_ids(problem.src_image_ids.begin(),
+                                             problem.src_image_ids.end());
+      used_image_ids.insert(problem.ref_image_id);
+      for (const auto image_id : used_image_ids) {
+        images[body].at(image_id).SetBitmap(workspace_->GetBitmap(image_id));
+        if (options.geom_consistency) {
+          depth_maps[body].at(image_id) =
+              workspace_->GetDepthMap(image_id, body);
+          normal_maps[body].at(image_id) =
+              workspace_->GetNormalMap(image_id, body);
+        }
       }
     }
   }
 
-  problem.Print();
-  patch_match_options.Print();
+  for (const int body : bodies) {
+    const auto& problem = problems[body];
+    problem.Print();
+    patch_match_options[body].Print();
 
-  PatchMatch patch_match(patch_match_options, problem);
-  patch_match.Run();
+    PatchMatch patch_match(patch_match_options[body], problem);
+    patch_match.Run();
 
-  std::cout << std::endl
-            << StringPrintf("Writing %s output for %s", output_type.c_str(),
-                            image_name.c_str())
-            << std::endl;
+    std::cout << std::endl
+              << StringPrintf("Writing %s output for %s", output_type.c_str(),
+                              image_name.c_str())
+              << std::endl;
 
-  patch_match.GetDepthMap().Write(depth_map_path);
-  patch_match.GetNormalMap().Write(normal_map_path);
-  if (options.write_consistency_graph) {
-    patch_match.GetConsistencyGraph().Write(consistency_graph_path);
+    // The outputs are downloaded here, but written on the output thread, so
+    // that this GPU can already start with its next problem.
+    auto depth_map = std::make_shared<DepthMap>(patch_match.GetDepthMap());
+    auto normal_map = std::make_shared<NormalMap>(patch_match.GetNormalMap());
+    std::shared_ptr<ConsistencyGraph> consistency_graph;
+    if (options.write_consistency_graph) {
+      consistency_graph = std::make_shared<ConsistencyGraph>(
+          patch_match.GetConsistencyGraph());
+    }
+    const bool write_tiled_maps = options.write_tiled_maps;
+    TiledMatOptions tiled_mat_options;
+    tiled_mat_options.tile_size = options.tiled_maps_tile_size;
+    tiled_mat_options.half_precision = options.tiled_maps_half_precision;
+    output_thread_pool_->AddTask(
+        [depth_map, normal_map, consistency_graph, write_tiled_maps,
+         tiled_mat_options](const std::string& depth_map_path,
+                            const std::string& normal_map_path,
+                            const std::string& consistency_graph_path) {
+          if (write_tiled_maps) {
+            depth_map->Write(depth_map_path, tiled_mat_options);
+            normal_map->Write(normal_map_path, tiled_mat_options);
+          } else {
+            depth_map->Write(depth_map_path);
+            normal_map->Write(normal_map_path);
+          }
+          if (consistency_graph) {
+            consistency_graph->Write(consistency_graph_path);
+          }
+        },
+        GetOutputPath(options, problem_idx, body, "depth_maps"),
+        GetOutputPath(options, problem_idx, body, "normal_maps"),
+        GetOutputPath(options, problem_idx, body, "consistency_graphs"));
   }
 }
 
@@ -25,6 +25,7 @@
 #include "mvs/image.h"
 #include "mvs/model.h"
 #include "mvs/normal_map.h"
+#include "util/image_source.h"
 #ifndef __CUDACC__
 #include "util/threading.h"
 #endif
@@ -83,6 +84,14 @@ struct PatchMatchOptions {
   // of four sweeps from left to right, top to bottom, and vice versa.
   int num_iterations = 5;
 
+  // The number of levels of the image pyramid in the photometric pass. With
+  // more than one level, the problem is first solved on images downsampled by
+  // a factor of two per level and every finer level is initialized with the
+  // upsampled depth and normal maps of the coarser level instead of random
+  // hypotheses, so that it only runs `pyramid_num_iterations` iterations.
+  int num_pyramid_levels = 1;
+  int pyramid_num_iterations = 2;
+
   // Whether to add a regularized geometric consistency term to the cost
   // function. If true, the `depth_maps` and `normal_maps` must not be null.
   bool geom_consistency = true;
@@ -112,6 +121,11 @@ struct PatchMatchOptions {
   // to be geometrically consistent.
   double filter_geom_consistency_max_cost = 1.0f;
 
+  // Whether to store the normal and cost maps on the GPU in half precision,
+  // which roughly halves their memory, while the kernels still compute in
+  // single precision. The depth map is always kept in single precision.
+  bool half_precision_maps = false;
+
   // Cache size in gigabytes for patch match, which keeps the bitmaps, depth
   // maps, and normal maps of this number of images in memory. A higher value
   // leads to less disk access and faster computation, while a lower value
@@ -119,9 +133,22 @@ struct PatchMatchOptions {
   // of memory, if the consistency graph is dense.
   double cache_size = 32.0;
 
+  // Directory or URL of the undistorted images, e.g. "s3://bucket/images", if
+  // they are not in the images folder of the workspace. Remote images are
+  // fetched ahead of the problems that use them.
+  std::string image_path = "";
+  ImageSourceOptions image_source;
+
   // Whether to write the consistency graph.
   bool write_consistency_graph = false;
 
+  // Whether to write the depth and normal maps in the tiled format of
+  // `TiledMatOptions`, which is compressed and lets fusion read only the
+  // tiles of the pixels it visits. Half precision halves the size again.
+  bool write_tiled_maps = false;
+  int tiled_maps_tile_size = 128;
+  bool tiled_maps_half_precision = false;
+
   void Print() const;
   bool Check() const {
     if (depth_min != -1.0f || depth_max != -1.0f) {
@@ -140,6 +167,8 @@ struct PatchMatchOptions {
     CHECK_OPTION_LT(min_triangulation_angle, 180.0f);
     CHECK_OPTION_GT(incident_angle_sigma, 0.0f);
     CHECK_OPTION_GT(num_iterations, 0);
+    CHECK_OPTION_GE(num_pyramid_levels, 1);
+    CHECK_OPTION_GT(pyramid_num_iterations, 0);
     CHECK_OPTION_GE(geom_consistency_regularizer, 0.0f);
     CHECK_OPTION_GE(geom_consistency_max_cost, 0.0f);
     CHECK_OPTION_GE(filter_min_ncc, -1.0f);
@@ -149,6 +178,11 @@ struct PatchMatchOptions {
     CHECK_OPTION_GE(filter_min_num_consistent, 0);
     CHECK_OPTION_GE(filter_geom_consistency_max_cost, 0.0f);
     CHECK_OPTION_GT(cache_size, 0);
+    CHECK_OPTION(image_source.Check());
+    if (write_tiled_maps) {
+      CHECK_OPTION_GT(tiled_maps_tile_size, 0);
+      CHECK_OPTION_LE(tiled_maps_tile_size, 4096);
+    }
     return true;
   }
 };
@@ -174,6 +208,11 @@ class PatchMatch {
     // Input normal maps for the geometric consistency term.
     std::vector<NormalMap>* normal_maps = nullptr;
 
+    // Optional initial depth and normal map of the reference image, which
+    // replace the random initialization of the photometric pass.
+    const DepthMap* init_depth_map = nullptr;
+    const NormalMap* init_normal_map = nullptr;
+
     // Print the configuration to stdout.
     void Print() const;
   };
@@ -194,6 +233,9 @@ class PatchMatch {
   Mat<float> GetSelProbMap() const;
 
  private:
+  // Solve the photometric problem coarse-to-fine on the image pyramid.
+  void RunPyramid();
+
   const PatchMatchOptions options_;
   const Problem problem_;
   std::unique_ptr<PatchMatchCuda> patch_match_cuda_;
@@ -227,6 +269,14 @@ class PatchMatch {
 // images, and the third reference image uses the first and second as source
 // images. Note that all specified images must be reconstructed in the COLMAP
 // reconstruction provided in the `sparse` folder.
+//
+// If an object sparse model is given, e.g. the `model3` of the two-body
+// postprocessor next to a workspace undistorted from its `model2`, the
+// workspace has two bodies. Every reference image is then processed once for
+// both bodies, which share the decoded images, and the object depth and normal
+// maps are written to `stereo_object/`. The source images of the object are
+// selected from its own poses and points and only images that see object
+// points take part in its problems.
 
 #ifndef __CUDACC__
 
@@ -235,13 +285,33 @@ class PatchMatchController : public Thread {
   PatchMatchController(const PatchMatchOptions& options,
                        const std::string& workspace_path,
                        const std::string& workspace_format,
-                       const std::string& pmvs_option_name);
+                       const std::string& pmvs_option_name,
+                       const std::string& object_sparse_path = "");
 
  private:
   void Run();
   void ReadWorkspace();
   void ReadProblems();
   void ReadGpuIndices();
+  // Order the problems by decreasing estimated cost, so that the GPUs, which
+  // take the next problem from a shared queue when they are idle, finish the
+  // large problems first and the run does not end with one GPU busy with a
+  // large problem while the others are idle.
+  void ScheduleProblems();
+  // The bodies of a problem whose output is still missing and the path of an
+  // output of a body, where the folder is e.g. "depth_maps".
+  std::vector<int> FindPendingBodies(const PatchMatchOptions& options,
+                                     const size_t problem_idx) const;
+  std::string GetOutputPath(const PatchMatchOptions& options,
+                            const size_t problem_idx, const int body,
+                            const std::string& folder) const;
+  // Process the problem at the position in the schedule. The inputs of the
+  // problem which is started after the ones which are running are read into
+  // the workspace cache in the background, while this problem runs.
+  void ProcessScheduledProblem(const PatchMatchOptions& options,
+                               const size_t schedule_idx);
+  void PrefetchProblem(const PatchMatchOptions& options,
+                       const size_t problem_idx);
   void ProcessProblem(const PatchMatchOptions& options,
                       const size_t problem_idx);
 
@@ -249,13 +319,22 @@ class PatchMatchController : public Thread {
   const std::string workspace_path_;
   const std::string workspace_format_;
   const std::string pmvs_option_name_;
+  const std::string object_sparse_path_;
 
   std::unique_ptr<ThreadPool> thread_pool_;
+  std::unique_ptr<ThreadPool> prefetch_thread_pool_;
+  // Writes the outputs of the problems, while the GPUs continue.
+  std::unique_ptr<ThreadPool> output_thread_pool_;
   std::mutex workspace_mutex_;
   std::unique_ptr<Workspace> workspace_;
-  std::vector<PatchMatch::Problem> problems_;
+  // For every reference image, its problem in every body of the workspace.
+  // The problem of a body without source images is skipped.
+  std::vector<std::vector<PatchMatch::Problem>> problems_;
+  // The indices of the problems in the order in which they are processed.
+  std::vector<size_t> schedule_;
   std::vector<int> gpu_indices_;
-  std::vector<std::pair<float, float>> depth_ranges_;
+  // The depth ranges of the images in every body.
+  std::vector<std::vector<std::pair<float, float>>> depth_ranges_;
 };
 
 #endif
@@ -49,6 +49,41 @@ texture<float, cudaTextureType2DLayered, cudaReadModeElementType>
     src_depth_maps_texture;
 texture<float, cudaTextureType2D, cudaReadModeElementType> poses_texture;
 
+// Pinned host memory of the uploads of a thread, which is reused by its
+// following problems, since pinning memory is expensive. The uploads of a
+// problem finish before its sweeps, so that the next problem of the thread
+// can reuse the memory.
+class PinnedHostBuffer {
+ public:
+  PinnedHostBuffer() : data_(nullptr), num_bytes_(0) {}
+  ~PinnedHostBuffer() {
+    if (data_ != nullptr) {
+      cudaFreeHost(data_);
+    }
+  }
+
+  template <typename T>
+  T* Get(const size_t num_elems) {
+    const size_t num_bytes = num_elems * sizeof(T);
+    if (num_bytes > num_bytes_) {
+      if (data_ != nullptr) {
+        CUDA_SAFE_CALL(cudaFreeHost(data_));
+      }
+      CUDA_SAFE_CALL(
+          cudaHostAlloc(&data_, num_bytes, cudaHostAllocPortable));
+      num_bytes_ = num_bytes;
+    }
+    return static_cast<T*>(data_);
+  }
+
+ private:
+  void* data_;
+  size_t num_bytes_;
+};
+
+thread_local PinnedHostBuffer src_images_host_buffer;
+thread_local PinnedHostBuffer src_depth_maps_host_buffer;
+
 // Calibration of reference image as {fx, cx, fy, cy}.
 __constant__ float ref_K[4];
 // Calibration of reference image as {1/fx, -cx/fx, 1/fy, -cy/fy}.
@@ -577,6 +612,56 @@ __device__ inline void TransformPDFToCDF(float* probs, const int num_probs) {
   }
 }
 
+// The normal and cost maps are stored in single or half precision, while all
+// computations are carried out in single precision.
+__device__ inline float MapValueToFloat(const float value) { return value; }
+
+__device__ inline float MapValueToFloat(const __half value) {
+  return __half2float(value);
+}
+
+template <typename T>
+__device__ inline T FloatToMapValue(const float value);
+
+template <>
+__device__ inline float FloatToMapValue<float>(const float value) {
+  return value;
+}
+
+template <>
+__device__ inline __half FloatToMapValue<__half>(const float value) {
+  return __float2half(value);
+}
+
+template <typename T>
+__device__ inline float GetMapValue(const GpuMat<T>& map, const int row,
+                                    const int col, const int slice) {
+  return MapValueToFloat(map.Get(row, col, slice));
+}
+
+template <typename T>
+__device__ inline void SetMapValue(GpuMat<T>* map, const int row,
+                                   const int col, const int slice,
+                                   const float value) {
+  map->Set(row, col, slice, FloatToMapValue<T>(value));
+}
+
+template <typename T>
+__device__ inline void GetNormal(const GpuMat<T>& normal_map, const int row,
+                                 const int col, float normal[3]) {
+  for (int i = 0; i < 3; ++i) {
+    normal[i] = GetMapValue(normal_map, row, col, i);
+  }
+}
+
+template <typename T>
+__device__ inline void SetNormal(GpuMat<T>* normal_map, const int row,
+                                 const int col, const float normal[3]) {
+  for (int i = 0; i < 3; ++i) {
+    SetMapValue(normal_map, row, col, i, normal[i]);
+  }
+}
+
 class LikelihoodComputer {
  public:
   __device__ LikelihoodComputer(const float ncc_sigma,
@@ -714,7 +799,8 @@ class LikelihoodComputer {
 };
 
 // Rotate normals by 90deg around z-axis in counter-clockwise direction.
-__global__ void InitNormalMap(GpuMat<float> normal_map,
+template <typename MapType>
+__global__ void InitNormalMap(GpuMat<MapType> normal_map,
                               GpuMat<curandState> rand_state_map) {
   const int row = blockDim.y * blockIdx.y + threadIdx.y;
   const int col = blockDim.x * blockIdx.x + threadIdx.x;
@@ -722,30 +808,45 @@ __global__ void InitNormalMap(GpuMat<float> normal_map,
     curandState rand_state = rand_state_map.Get(row, col);
     float normal[3];
     GenerateRandomNormal(row, col, &rand_state, normal);
-    normal_map.SetSlice(row, col, normal);
+    SetNormal(&normal_map, row, col, normal);
     rand_state_map.Set(row, col, rand_state);
   }
 }
 
 // Rotate normals by 90deg around z-axis in counter-clockwise direction.
-__global__ void RotateNormalMap(GpuMat<float> normal_map) {
+template <typename MapType>
+__global__ void RotateNormalMap(GpuMat<MapType> normal_map) {
   const int row = blockDim.y * blockIdx.y + threadIdx.y;
   const int col = blockDim.x * blockIdx.x + threadIdx.x;
   if (col < normal_map.GetWidth() && row < normal_map.GetHeight()) {
     float normal[3];
-    normal_map.GetSlice(row, col, normal);
+    GetNormal(normal_map, row, col, normal);
     float rotated_normal[3];
     rotated_normal[0] = normal[1];
     rotated_normal[1] = -normal[0];
     rotated_normal[2] = normal[2];
-    normal_map.SetSlice(row, col, rotated_normal);
+    SetNormal(&normal_map, row, col, rotated_normal);
   }
 }
 
-template <int kWindowSize, int kWindowStep>
-__global__ void ComputeInitialCost(GpuMat<float> cost_map,
+// Convert the values of a map between single and half precision.
+template <typename InputType, typename OutputType>
+__global__ void ConvertMap(const GpuMat<InputType> input,
+                           GpuMat<OutputType> output) {
+  const int row = blockDim.y * blockIdx.y + threadIdx.y;
+  const int col = blockDim.x * blockIdx.x + threadIdx.x;
+  if (col < input.GetWidth() && row < input.GetHeight()) {
+    for (int slice = 0; slice < input.GetDepth(); ++slice) {
+      SetMapValue(&output, row, col, slice,
+                  GetMapValue(input, row, col, slice));
+    }
+  }
+}
+
+template <int kWindowSize, int kWindowStep, typename MapType>
+__global__ void ComputeInitialCost(GpuMat<MapType> cost_map,
                                    const GpuMat<float> depth_map,
-                                   const GpuMat<float> normal_map,
+                                   const GpuMat<MapType> normal_map,
                                    const GpuMat<float> ref_sum_image,
                                    const GpuMat<float> ref_squared_sum_image,
                                    const float sigma_spatial,
@@ -772,14 +873,14 @@ __global__ void ComputeInitialCost(GpuMat<float> cost_map,
 
     if (col < cost_map.GetWidth()) {
       pcc_computer.depth = depth_map.Get(row, col);
-      normal_map.GetSlice(row, col, normal);
+      GetNormal(normal_map, row, col, normal);
 
       pcc_computer.local_ref_sum = ref_sum_image.Get(row, col);
       pcc_computer.local_ref_squared_sum = ref_squared_sum_image.Get(row, col);
 
       for (int image_id = 0; image_id < cost_map.GetDepth(); ++image_id) {
         pcc_computer.src_image_id = image_id;
-        cost_map.Set(row, col, image_id, pcc_computer.Compute());
+        SetMapValue(&cost_map, row, col, image_id, pcc_computer.Compute());
       }
 
       pcc_computer.row += 1;
@@ -806,12 +907,14 @@ struct SweepOptions {
   float filter_geom_consistency_max_cost = 1.0f;
 };
 
-template <int kWindowSize, int kWindowStep, bool kGeomConsistencyTerm = false,
+template <int kWindowSize, int kWindowStep, typename MapType,
+          bool kGeomConsistencyTerm = false,
           bool kFilterPhotoConsistency = false,
           bool kFilterGeomConsistency = false>
 __global__ void SweepFromTopToBottom(
     GpuMat<float> global_workspace, GpuMat<curandState> rand_state_map,
-    GpuMat<float> cost_map, GpuMat<float> depth_map, GpuMat<float> normal_map,
+    GpuMat<MapType> cost_map, GpuMat<float> depth_map,
+    GpuMat<MapType> normal_map,
     GpuMat<uint8_t> consistency_mask, GpuMat<float> sel_prob_map,
     const GpuMat<float> prev_sel_prob_map, const GpuMat<float> ref_sum_image,
     const GpuMat<float> ref_squared_sum_image, const SweepOptions options) {
@@ -843,7 +946,7 @@ __global__ void SweepFromTopToBottom(
       // Compute backward message.
       float beta = kUniformProb;
       for (int row = cost_map.GetHeight() - 1; row >= 0; --row) {
-        const float cost = cost_map.Get(row, col, image_id);
+        const float cost = GetMapValue(cost_map, row, col, image_id);
         beta = likelihood_computer.ComputeBackwardMessage(cost, beta);
         sel_prob_map.Set(row, col, image_id, beta);
       }
@@ -887,7 +990,7 @@ __global__ void SweepFromTopToBottom(
     rand_state = rand_state_map.Get(0, col);
     // Parameters for first row in column.
     prev_param_state.depth = depth_map.Get(0, col);
-    normal_map.GetSlice(0, col, prev_param_state.normal);
+    GetNormal(normal_map, 0, col, prev_param_state.normal);
   }
 
   for (int row = 0; row < cost_map.GetHeight(); ++row) {
@@ -913,7 +1016,7 @@ __global__ void SweepFromTopToBottom(
 
     // Read parameters for current pixel from previous sweep.
     curr_param_state.depth = depth_map.Get(row, col);
-    normal_map.GetSlice(row, col, curr_param_state.normal);
+    GetNormal(normal_map, row, col, curr_param_state.normal);
 
     // Generate random parameters.
     rand_param_state.depth =
@@ -929,7 +1032,7 @@ __global__ void SweepFromTopToBottom(
     ComputePointAtDepth(row, col, curr_param_state.depth, point);
 
     for (int image_id = 0; image_id < cost_map.GetDepth(); ++image_id) {
-      const float cost = cost_map.Get(row, col, image_id);
+      const float cost = GetMapValue(cost_map, row, col, image_id);
       const float alpha = likelihood_computer.ComputeForwardMessage(
           cost, forward_message[image_id]);
       const float beta = sel_prob_map.Get(row, col, image_id);
@@ -994,7 +1097,8 @@ __global__ void SweepFromTopToBottom(
         continue;
       }
 
-      costs[0] += cost_map.Get(row, col, pcc_computer.src_image_id);
+      costs[0] +=
+          GetMapValue(cost_map, row, col, pcc_computer.src_image_id);
       if (kGeomConsistencyTerm) {
         costs[0] += options.geom_consistency_regularizer *
                     ComputeGeomConsistencyCost(
@@ -1022,7 +1126,7 @@ __global__ void SweepFromTopToBottom(
 
     // Save best new parameters.
     depth_map.Set(row, col, best_depth);
-    normal_map.SetSlice(row, col, best_normal);
+    SetNormal(&normal_map, row, col, best_normal);
 
     // Use the new cost to recompute the updated forward message and
     // the selection probability.
@@ -1032,11 +1136,11 @@ __global__ void SweepFromTopToBottom(
       // Determine the cost for best depth.
       float cost;
       if (min_cost_idx == 0) {
-        cost = cost_map.Get(row, col, image_id);
+        cost = GetMapValue(cost_map, row, col, image_id);
       } else {
         pcc_computer.src_image_id = image_id;
         cost = pcc_computer.Compute();
-        cost_map.Set(row, col, image_id, cost);
+        SetMapValue(&cost_map, row, col, image_id, cost);
       }
 
       const float alpha = likelihood_computer.ComputeForwardMessage(
@@ -1095,10 +1199,10 @@ __global__ void SweepFromTopToBottom(
 
       if (num_consistent < options.filter_min_num_consistent) {
         const float kFilterValue = 0.0f;
+        const float kFilterNormal[3] = {kFilterValue, kFilterValue,
+                                        kFilterValue};
         depth_map.Set(row, col, kFilterValue);
-        normal_map.Set(row, col, 0, kFilterValue);
-        normal_map.Set(row, col, 1, kFilterValue);
-        normal_map.Set(row, col, 2, kFilterValue);
+        SetNormal(&normal_map, row, col, kFilterNormal);
         for (int image_id = 0; image_id < cost_map.GetDepth(); ++image_id) {
           consistency_mask.Set(row, col, image_id, 0);
         }
@@ -1117,6 +1221,16 @@ __global__ void SweepFromTopToBottom(
   }
 }
 
+// Replace the map by its rotation, whose width and height are swapped.
+template <typename T>
+void RotateGpuMat(const size_t width, const size_t height,
+                  std::unique_ptr<GpuMat<T>>* map) {
+  std::unique_ptr<GpuMat<T>> rotated_map(
+      new GpuMat<T>(width, height, (*map)->GetDepth()));
+  (*map)->Rotate(rotated_map.get());
+  map->swap(rotated_map);
+}
+
 PatchMatchCuda::PatchMatchCuda(const PatchMatchOptions& options,
                                const PatchMatch::Problem& problem)
     : options_(options),
@@ -1125,22 +1239,53 @@ PatchMatchCuda::PatchMatchCuda(const PatchMatchOptions& options,
       ref_height_(0),
       rotation_in_half_pi_(0) {
   SetBestCudaDevice(std::stoi(options_.gpu_index));
-  InitRefImage();
+  CUDA_SAFE_CALL(
+      cudaStreamCreateWithFlags(&upload_stream_, cudaStreamNonBlocking));
+  // The source images are uploaded first, so that their transfer overlaps
+  // with the filtering of the reference image and the initialization of the
+  // workspace memory.
   InitSourceImages();
+  InitRefImage();
   InitTransforms();
   InitWorkspaceMemory();
 }
 
 PatchMatchCuda::~PatchMatchCuda() {
+  CUDA_SAFE_CALL(cudaStreamSynchronize(upload_stream_));
+  CUDA_SAFE_CALL(cudaStreamDestroy(upload_stream_));
   for (size_t i = 0; i < 4; ++i) {
     poses_device_[i].reset();
   }
 }
 
+template <>
+GpuMat<float>& PatchMatchCuda::GetDeviceNormalMap<float>() {
+  return *normal_map_;
+}
+
+template <>
+GpuMat<__half>& PatchMatchCuda::GetDeviceNormalMap<__half>() {
+  return *half_normal_map_;
+}
+
+template <>
+GpuMat<float>& PatchMatchCuda::GetDeviceCostMap<float>() {
+  return *cost_map_;
+}
+
+template <>
+GpuMat<__half>& PatchMatchCuda::GetDeviceCostMap<__half>() {
+  return *half_cost_map_;
+}
+
 void PatchMatchCuda::Run() {
-#define CASE_WINDOW_RADIUS(window_radius, window_step)              \
-  case window_radius:                                               \
-    RunWithWindowSizeAndStep<2 * window_radius + 1, window_step>(); \
+#define CASE_WINDOW_RADIUS(window_radius, window_step)                        \
+  case window_radius:                                                         \
+    if (options_.half_precision_maps) {                                       \
+      RunWithWindowSizeAndStep<2 * window_radius + 1, window_step, __half>(); \
+    } else {                                                                  \
+      RunWithWindowSizeAndStep<2 * window_radius + 1, window_step, float>();  \
+    }                                                                         \
     break;
 
 #define CASE_WINDOW_STEP(window_step)                                 \
@@ -1192,6 +1337,14 @@ DepthMap PatchMatchCuda::GetDepthMap() const {
 }
 
 NormalMap PatchMatchCuda::GetNormalMap() const {
+  if (options_.half_precision_maps) {
+    GpuMat<float> normal_map(half_normal_map_->GetWidth(),
+                             half_normal_map_->GetHeight(), 3);
+    ConvertMap<<<elem_wise_grid_size_, elem_wise_block_size_>>>(
+        *half_normal_map_, normal_map);
+    CUDA_SYNC_AND_CHECK();
+    return NormalMap(normal_map.CopyToMat());
+  }
   return NormalMap(normal_map_->CopyToMat());
 }
 
@@ -1225,18 +1378,20 @@ std::vector<int> PatchMatchCuda::GetConsistentImageIds() const {
   return consistent_image_ids;
 }
 
-template <int kWindowSize, int kWindowStep>
+template <int kWindowSize, int kWindowStep, typename MapType>
 void PatchMatchCuda::RunWithWindowSizeAndStep() {
   // Wait for all initializations to finish.
+  CUDA_SAFE_CALL(cudaStreamSynchronize(upload_stream_));
   CUDA_SYNC_AND_CHECK();
 
   CudaTimer total_timer;
   CudaTimer init_timer;
 
   ComputeCudaConfig();
-  ComputeInitialCost<kWindowSize, kWindowStep>
+  ComputeInitialCost<kWindowSize, kWindowStep, MapType>
       <<<sweep_grid_size_, sweep_block_size_>>>(
-          *cost_map_, *depth_map_, *normal_map_, *ref_image_->sum_image,
+          GetDeviceCostMap<MapType>(), *depth_map_,
+          GetDeviceNormalMap<MapType>(), *ref_image_->sum_image,
           *ref_image_->squared_sum_image, options_.sigma_spatial,
           options_.sigma_color);
   CUDA_SYNC_AND_CHECK();
@@ -1280,20 +1435,22 @@ void PatchMatchCuda::RunWithWindowSizeAndStep() {
 
       const bool last_sweep = iter == options_.num_iterations - 1 && sweep == 3;
 
-#define CALL_SWEEP_FUNC                                                  \
-  SweepFromTopToBottom<kWindowSize, kWindowStep, kGeomConsistencyTerm,   \
-                       kFilterPhotoConsistency, kFilterGeomConsistency>  \
-      <<<sweep_grid_size_, sweep_block_size_>>>(                         \
-          *global_workspace_, *rand_state_map_, *cost_map_, *depth_map_, \
-          *normal_map_, *consistency_mask_, *sel_prob_map_,              \
-          *prev_sel_prob_map_, *ref_image_->sum_image,                   \
+#define CALL_SWEEP_FUNC                                                      \
+  SweepFromTopToBottom<kWindowSize, kWindowStep, MapType,                    \
+                       kGeomConsistencyTerm, kFilterPhotoConsistency,        \
+                       kFilterGeomConsistency>                               \
+      <<<sweep_grid_size_, sweep_block_size_>>>(                             \
+          *global_workspace_, *rand_state_map_,                              \
+          GetDeviceCostMap<MapType>(), *depth_map_,                          \
+          GetDeviceNormalMap<MapType>(), *consistency_mask_, *sel_prob_map_, \
+          *prev_sel_prob_map_, *ref_image_->sum_image,                       \
           *ref_image_->squared_sum_image, sweep_options);
 
       if (last_sweep) {
         if (options_.filter) {
-          consistency_mask_.reset(new GpuMat<uint8_t>(cost_map_->GetWidth(),
-                                                      cost_map_->GetHeight(),
-                                                      cost_map_->GetDepth()));
+          consistency_mask_.reset(new GpuMat<uint8_t>(
+              depth_map_->GetWidth(), depth_map_->GetHeight(),
+              problem_.src_image_ids.size()));
           consistency_mask_->FillWithScalar(0);
         }
         if (options_.geom_consistency) {
@@ -1340,8 +1497,9 @@ void PatchMatchCuda::RunWithWindowSizeAndStep() {
       // Rotate selected image map.
       if (last_sweep && options_.filter) {
         std::unique_ptr<GpuMat<uint8_t>> rot_consistency_mask_(
-            new GpuMat<uint8_t>(cost_map_->GetWidth(), cost_map_->GetHeight(),
-                                cost_map_->GetDepth()));
+            new GpuMat<uint8_t>(depth_map_->GetWidth(),
+                                depth_map_->GetHeight(),
+                                problem_.src_image_ids.size()));
         consistency_mask_->Rotate(rot_consistency_mask_.get());
         consistency_mask_.swap(rot_consistency_mask_);
       }
@@ -1416,16 +1574,18 @@ void PatchMatchCuda::InitSourceImages() {
 
   // Upload source images to device.
   {
-    // Copy source images to contiguous memory block.
+    // Copy source images to contiguous block of pinned memory.
     const uint8_t kDefaultValue = 0;
-    std::vector<uint8_t> src_images_host_data(
-        static_cast<size_t>(max_width * max_height *
-                            problem_.src_image_ids.size()),
-        kDefaultValue);
+    const size_t num_elems = static_cast<size_t>(
+        max_width * max_height * problem_.src_image_ids.size());
+    uint8_t* src_images_host_data =
+        src_images_host_buffer.Get<uint8_t>(num_elems);
+    std::fill(src_images_host_data, src_images_host_data + num_elems,
+              kDefaultValue);
     for (size_t i = 0; i < problem_.src_image_ids.size(); ++i) {
       const Image& image = problem_.images->at(problem_.src_image_ids[i]);
       const Bitmap& bitmap = image.GetBitmap();
-      uint8_t* dest = src_images_host_data.data() + max_width * max_height * i;
+      uint8_t* dest = src_images_host_data + max_width * max_height * i;
       for (size_t r = 0; r < image.GetHeight(); ++r) {
         memcpy(dest, bitmap.GetScanline(r), image.GetWidth() * sizeof(uint8_t));
         dest += max_width;
@@ -1435,7 +1595,8 @@ void PatchMatchCuda::InitSourceImages() {
     // Upload to device.
     src_images_device_.reset(new CudaArrayWrapper<uint8_t>(
         max_width, max_height, problem_.src_image_ids.size()));
-    src_images_device_->CopyToDevice(src_images_host_data.data());
+    src_images_device_->CopyToDeviceAsync(src_images_host_data,
+                                          upload_stream_);
 
     // Create source images texture.
     src_images_texture.addressMode[0] = cudaAddressModeBorder;
@@ -1450,15 +1611,16 @@ void PatchMatchCuda::InitSourceImages() {
   // Upload source depth maps to device.
   if (options_.geom_consistency) {
     const float kDefaultValue = 0.0f;
-    std::vector<float> src_depth_maps_host_data(
-        static_cast<size_t>(max_width * max_height *
-                            problem_.src_image_ids.size()),
-        kDefaultValue);
+    const size_t num_elems = static_cast<size_t>(
+        max_width * max_height * problem_.src_image_ids.size());
+    float* src_depth_maps_host_data =
+        src_depth_maps_host_buffer.Get<float>(num_elems);
+    std::fill(src_depth_maps_host_data, src_depth_maps_host_data + num_elems,
+              kDefaultValue);
     for (size_t i = 0; i < problem_.src_image_ids.size(); ++i) {
       const DepthMap& depth_map =
           problem_.depth_maps->at(problem_.src_image_ids[i]);
-      float* dest =
-          src_depth_maps_host_data.data() + max_width * max_height * i;
+      float* dest = src_depth_maps_host_data + max_width * max_height * i;
       for (size_t r = 0; r < depth_map.GetHeight(); ++r) {
         memcpy(dest, depth_map.GetPtr() + r * depth_map.GetWidth(),
                depth_map.GetWidth() * sizeof(float));
@@ -1468,7 +1630,8 @@ void PatchMatchCuda::InitSourceImages() {
 
     src_depth_maps_device_.reset(new CudaArrayWrapper<float>(
         max_width, max_height, problem_.src_image_ids.size()));
-    src_depth_maps_device_->CopyToDevice(src_depth_maps_host_data.data());
+    src_depth_maps_device_->CopyToDeviceAsync(src_depth_maps_host_data,
+                                              upload_stream_);
 
     // Create source depth maps texture.
     src_depth_maps_texture.addressMode[0] = cudaAddressModeBorder;
@@ -1601,12 +1764,20 @@ void PatchMatchCuda::InitWorkspaceMemory() {
         problem_.depth_maps->at(problem_.ref_image_id);
     depth_map_->CopyToDevice(init_depth_map.GetPtr(),
                              init_depth_map.GetWidth() * sizeof(float));
+  } else if (problem_.init_depth_map != nullptr) {
+    depth_map_->CopyToDevice(problem_.init_depth_map->GetPtr(),
+                             problem_.init_depth_map->GetWidth() *
+                                 sizeof(float));
   } else {
     depth_map_->FillWithRandomNumbers(options_.depth_min, options_.depth_max,
                                       *rand_state_map_);
   }
 
-  normal_map_.reset(new GpuMat<float>(ref_width_, ref_height_, 3));
+  if (options_.half_precision_maps) {
+    half_normal_map_.reset(new GpuMat<__half>(ref_width_, ref_height_, 3));
+  } else {
+    normal_map_.reset(new GpuMat<float>(ref_width_, ref_height_, 3));
+  }
 
   // Note that it is not necessary to keep the selection probability map in
   // memory for all pixels. Theoretically, it is possible to incorporate
@@ -1619,8 +1790,13 @@ void PatchMatchCuda::InitWorkspaceMemory() {
                                              problem_.src_image_ids.size()));
   prev_sel_prob_map_->FillWithScalar(0.5f);
 
-  cost_map_.reset(new GpuMat<float>(ref_width_, ref_height_,
-                                    problem_.src_image_ids.size()));
+  if (options_.half_precision_maps) {
+    half_cost_map_.reset(new GpuMat<__half>(ref_width_, ref_height_,
+                                            problem_.src_image_ids.size()));
+  } else {
+    cost_map_.reset(new GpuMat<float>(ref_width_, ref_height_,
+                                      problem_.src_image_ids.size()));
+  }
 
   const int ref_max_dim = std::max(ref_width_, ref_height_);
   global_workspace_.reset(
@@ -1630,14 +1806,29 @@ void PatchMatchCuda::InitWorkspaceMemory() {
 
   ComputeCudaConfig();
 
+  const NormalMap* init_normal_map = problem_.init_normal_map;
   if (options_.geom_consistency) {
-    const NormalMap& init_normal_map =
-        problem_.normal_maps->at(problem_.ref_image_id);
-    normal_map_->CopyToDevice(init_normal_map.GetPtr(),
-                              init_normal_map.GetWidth() * sizeof(float));
+    init_normal_map = &problem_.normal_maps->at(problem_.ref_image_id);
+  }
+
+  if (init_normal_map == nullptr) {
+    if (options_.half_precision_maps) {
+      InitNormalMap<<<elem_wise_grid_size_, elem_wise_block_size_>>>(
+          *half_normal_map_, *rand_state_map_);
+    } else {
+      InitNormalMap<<<elem_wise_grid_size_, elem_wise_block_size_>>>(
+          *normal_map_, *rand_state_map_);
+    }
+  } else if (options_.half_precision_maps) {
+    GpuMat<float> normal_map(ref_width_, ref_height_, 3);
+    normal_map.CopyToDevice(init_normal_map->GetPtr(),
+                            init_normal_map->GetWidth() * sizeof(float));
+    ConvertMap<<<elem_wise_grid_size_, elem_wise_block_size_>>>(
+        normal_map, *half_normal_map_);
+    CUDA_SYNC_AND_CHECK();
   } else {
-    InitNormalMap<<<elem_wise_grid_size_, elem_wise_block_size_>>>(
-        *normal_map_, *rand_state_map_);
+    normal_map_->CopyToDevice(init_normal_map->GetPtr(),
+                              init_normal_map->GetWidth() * sizeof(float));
   }
 }
 
@@ -1671,13 +1862,14 @@ void PatchMatchCuda::Rotate() {
   }
 
   // Rotate normal map.
-  {
+  if (options_.half_precision_maps) {
+    RotateNormalMap<<<elem_wise_grid_size_, elem_wise_block_size_>>>(
+        *half_normal_map_);
+    RotateGpuMat(width, height, &half_normal_map_);
+  } else {
     RotateNormalMap<<<elem_wise_grid_size_, elem_wise_block_size_>>>(
         *normal_map_);
-    std::unique_ptr<GpuMat<float>> rotated_normal_map(
-        new GpuMat<float>(width, height, 3));
-    normal_map_->Rotate(rotated_normal_map.get());
-    normal_map_.swap(rotated_normal_map);
+    RotateGpuMat(width, height, &normal_map_);
   }
 
   // Rotate reference image.
@@ -1706,11 +1898,10 @@ void PatchMatchCuda::Rotate() {
       new GpuMat<float>(width, height, problem_.src_image_ids.size()));
 
   // Rotate cost map.
-  {
-    std::unique_ptr<GpuMat<float>> rotated_cost_map(
-        new GpuMat<float>(width, height, problem_.src_image_ids.size()));
-    cost_map_->Rotate(rotated_cost_map.get());
-    cost_map_.swap(rotated_cost_map);
+  if (options_.half_precision_maps) {
+    RotateGpuMat(width, height, &half_cost_map_);
+  } else {
+    RotateGpuMat(width, height, &cost_map_);
   }
 
   // Rotate transformations.
@@ -21,6 +21,7 @@
 #include <memory>
 #include <vector>
 
+#include <cuda_fp16.h>
 #include <cuda_runtime.h>
 
 #include "mvs/cuda_array_wrapper.h"
@@ -49,9 +50,15 @@ class PatchMatchCuda {
   std::vector<int> GetConsistentImageIds() const;
 
  private:
-  template <int kWindowSize, int kWindowStep>
+  template <int kWindowSize, int kWindowStep, typename MapType>
   void RunWithWindowSizeAndStep();
 
+  // The normal and cost maps of the storage type, i.e. float or half.
+  template <typename MapType>
+  GpuMat<MapType>& GetDeviceNormalMap();
+  template <typename MapType>
+  GpuMat<MapType>& GetDeviceCostMap();
+
   void ComputeCudaConfig();
 
   void InitRefImage();
@@ -65,6 +72,11 @@ class PatchMatchCuda {
   const PatchMatchOptions options_;
   const PatchMatch::Problem problem_;
 
+  // Stream of the uploads of the source images and depth maps, which overlap
+  // with the initialization of the reference image on the default stream and
+  // are synchronized before the first sweep.
+  cudaStream_t upload_stream_;
+
   // Dimensions for sweeping from top to bottom, i.e. one thread per column.
   dim3 sweep_block_size_;
   dim3 sweep_grid_size_;
@@ -112,6 +124,10 @@ class PatchMatchCuda {
   std::unique_ptr<GpuMat<float>> sel_prob_map_;
   std::unique_ptr<GpuMat<float>> prev_sel_prob_map_;
   std::unique_ptr<GpuMat<float>> cost_map_;
+  // The normal and cost maps in half precision, which are allocated instead
+  // of `normal_map_` and `cost_map_` with `half_precision_maps`.
+  std::unique_ptr<GpuMat<__half>> half_normal_map_;
+  std::unique_ptr<GpuMat<__half>> half_cost_map_;
   std::unique_ptr<GpuMatPRNG> rand_state_map_;
   std::unique_ptr<GpuMat<uint8_t>> consistency_mask_;
 
@@ -0,0 +1,380 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "mvs/tiled_mat.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+#include "ext/FLANN/ext/lz4.h"
+#include "util/endian.h"
+#include "util/logging.h"
+
+namespace colmap {
+namespace mvs {
+namespace {
+
+const char kTiledMatMagic[8] = {'T', 'B', 'S', 'F', 'M', 'T', 'M', '\0'};
+
+// Size of the header after the magic, i.e. the dimensions, the tile size, the
+// precision and the number of tiles.
+const size_t kTiledMatHeaderSize = 5 * sizeof(uint64_t) + sizeof(uint8_t);
+
+uint16_t FloatToHalf(const float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+  const uint32_t abs_bits = bits & 0x7FFFFFFF;
+
+  // Infinity and NaN, which keeps a mantissa bit.
+  if (abs_bits >= 0x7F800000) {
+    return sign | 0x7C00 | (abs_bits > 0x7F800000 ? 0x0200 : 0);
+  }
+
+  // Values that round to a magnitude of at least 65520 overflow.
+  if (abs_bits >= 0x477FF000) {
+    return sign | 0x7C00;
+  }
+
+  // Subnormal half floats, rounded to the nearest even value.
+  if (abs_bits < 0x38800000) {
+    if (abs_bits < 0x33000000) {
+      return sign;
+    }
+    const uint32_t exponent = abs_bits >> 23;
+    const uint32_t mantissa = (abs_bits & 0x7FFFFF) | 0x800000;
+    const uint32_t shift = 126 - exponent;
+    uint32_t half_mantissa = mantissa >> shift;
+    const uint32_t remainder = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (remainder > halfway ||
+        (remainder == halfway && (half_mantissa & 1) != 0)) {
+      half_mantissa += 1;
+    }
+    return sign | static_cast<uint16_t>(half_mantissa);
+  }
+
+  // Normal half floats, where a carry of the rounding into the exponent is
+  // the correctly rounded result.
+  uint32_t half_bits = (abs_bits - 0x38000000) >> 13;
+  const uint32_t remainder = abs_bits & 0x1FFF;
+  if (remainder > 0x1000 || (remainder == 0x1000 && (half_bits & 1) != 0)) {
+    half_bits += 1;
+  }
+  return sign | static_cast<uint16_t>(half_bits);
+}
+
+float HalfToFloat(const uint16_t half_bits) {
+  const uint32_t sign = static_cast<uint32_t>(half_bits & 0x8000) << 16;
+  const uint32_t exponent = (half_bits >> 10) & 0x1F;
+  const uint32_t mantissa = half_bits & 0x3FF;
+
+  uint32_t bits;
+  if (exponent == 0) {
+    const float value = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign != 0 ? -value : value;
+  } else if (exponent == 31) {
+    bits = sign | 0x7F800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Shuffle the bytes of the elements into planes of the same byte, which
+// compress much better for floats, whose exponents are similar.
+void ShuffleBytes(const char* data, const size_t num_elems,
+                  const size_t elem_size, char* shuffled) {
+  for (size_t i = 0; i < num_elems; ++i) {
+    for (size_t b = 0; b < elem_size; ++b) {
+      shuffled[b * num_elems + i] = data[i * elem_size + b];
+    }
+  }
+}
+
+void UnshuffleBytes(const char* shuffled, const size_t num_elems,
+                    const size_t elem_size, char* data) {
+  for (size_t i = 0; i < num_elems; ++i) {
+    for (size_t b = 0; b < elem_size; ++b) {
+      data[i * elem_size + b] = shuffled[b * num_elems + i];
+    }
+  }
+}
+
+}  // namespace
+
+bool TiledMatOptions::Check() const {
+  CHECK_OPTION_GT(tile_size, 0);
+  CHECK_OPTION_LE(tile_size, 4096);
+  return true;
+}
+
+bool IsTiledMat(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  char magic[sizeof(kTiledMatMagic)];
+  file.read(magic, sizeof(magic));
+  return file.good() &&
+         std::equal(magic, magic + sizeof(magic), kTiledMatMagic);
+}
+
+void ReadMatSize(const std::string& path, size_t* width, size_t* height,
+                 size_t* depth) {
+  if (IsTiledMat(path)) {
+    TiledMatReader reader;
+    CHECK(reader.Open(path)) << path;
+    *width = reader.GetWidth();
+    *height = reader.GetHeight();
+    *depth = reader.GetDepth();
+    return;
+  }
+
+  std::fstream text_file(path, std::ios::in | std::ios::binary);
+  CHECK(text_file.is_open()) << path;
+  char unused_char;
+  text_file >> *width >> unused_char >> *height >> unused_char >> *depth >>
+      unused_char;
+  CHECK(!text_file.fail()) << path;
+}
+
+void WriteTiledMat(const std::string& path, const size_t width,
+                   const size_t height, const size_t depth, const float* data,
+                   const TiledMatOptions& options) {
+  CHECK(options.Check());
+
+  const size_t tile_size = static_cast<size_t>(options.tile_size);
+  const size_t num_tile_rows = (height + tile_size - 1) / tile_size;
+  const size_t num_tile_cols = (width + tile_size - 1) / tile_size;
+  const size_t elem_size =
+      options.half_precision ? sizeof(uint16_t) : sizeof(float);
+
+  std::vector<std::vector<char>> compressed_tiles;
+  compressed_tiles.reserve(num_tile_rows * num_tile_cols);
+  std::vector<char> raw_tile;
+  std::vector<char> shuffled_tile;
+  for (size_t tile_row = 0; tile_row < num_tile_rows; ++tile_row) {
+    for (size_t tile_col = 0; tile_col < num_tile_cols; ++tile_col) {
+      const size_t row_begin = tile_row * tile_size;
+      const size_t col_begin = tile_col * tile_size;
+      const size_t tile_height = std::min(tile_size, height - row_begin);
+      const size_t tile_width = std::min(tile_size, width - col_begin);
+      const size_t num_elems = tile_width * tile_height * depth;
+
+      raw_tile.resize(num_elems * elem_size);
+      size_t elem_idx = 0;
+      for (size_t slice = 0; slice < depth; ++slice) {
+        for (size_t row = row_begin; row < row_begin + tile_height; ++row) {
+          const float* values =
+              data + slice * width * height + row * width + col_begin;
+          for (size_t col = 0; col < tile_width; ++col, ++elem_idx) {
+            if (options.half_precision) {
+              const uint16_t value =
+                  NativeToLittleEndian(FloatToHalf(values[col]));
+              std::memcpy(raw_tile.data() + elem_idx * elem_size, &value,
+                          elem_size);
+            } else {
+              const float value = NativeToLittleEndian(values[col]);
+              std::memcpy(raw_tile.data() + elem_idx * elem_size, &value,
+                          elem_size);
+            }
+          }
+        }
+      }
+
+      shuffled_tile.resize(raw_tile.size());
+      ShuffleBytes(raw_tile.data(), num_elems, elem_size,
+                   shuffled_tile.data());
+
+      std::vector<char> compressed_tile(
+          LZ4_compressBound(static_cast<int>(shuffled_tile.size())));
+      const int num_compressed_bytes = LZ4_compress_default(
+          shuffled_tile.data(), compressed_tile.data(),
+          static_cast<int>(shuffled_tile.size()),
+          static_cast<int>(compressed_tile.size()));
+      CHECK_GT(num_compressed_bytes, 0);
+      compressed_tile.resize(num_compressed_bytes);
+      compressed_tiles.push_back(std::move(compressed_tile));
+    }
+  }
+
+  std::ofstream file(path, std::ios::trunc | std::ios::binary);
+  CHECK(file.is_open()) << path;
+  file.write(kTiledMatMagic, sizeof(kTiledMatMagic));
+  WriteBinaryLittleEndian<uint64_t>(&file, width);
+  WriteBinaryLittleEndian<uint64_t>(&file, height);
+  WriteBinaryLittleEndian<uint64_t>(&file, depth);
+  WriteBinaryLittleEndian<uint64_t>(&file, tile_size);
+  WriteBinaryLittleEndian<uint8_t>(&file, options.half_precision ? 1 : 0);
+  WriteBinaryLittleEndian<uint64_t>(&file, compressed_tiles.size());
+  size_t offset = sizeof(kTiledMatMagic) + kTiledMatHeaderSize +
+                  2 * sizeof(uint64_t) * compressed_tiles.size();
+  for (const auto& compressed_tile : compressed_tiles) {
+    WriteBinaryLittleEndian<uint64_t>(&file, offset);
+    WriteBinaryLittleEndian<uint64_t>(&file, compressed_tile.size());
+    offset += compressed_tile.size();
+  }
+  for (const auto& compressed_tile : compressed_tiles) {
+    file.write(compressed_tile.data(), compressed_tile.size());
+  }
+  CHECK(file.good()) << "Could not write " << path;
+}
+
+TiledMatReader::TiledMatReader()
+    : width_(0),
+      height_(0),
+      depth_(0),
+      tile_size_(0),
+      num_tile_cols_(0),
+      half_precision_(false),
+      num_decoded_bytes_(0) {}
+
+bool TiledMatReader::Open(const std::string& path) {
+  tiles_.clear();
+  num_decoded_bytes_ = 0;
+
+  if (!file_.Open(path, /* sequential */ false)) {
+    return false;
+  }
+
+  MappedFileReader reader(file_);
+  char magic[sizeof(kTiledMatMagic)];
+  for (size_t i = 0; i < sizeof(magic); ++i) {
+    magic[i] = reader.Read<char>();
+  }
+  width_ = reader.Read<uint64_t>();
+  height_ = reader.Read<uint64_t>();
+  depth_ = reader.Read<uint64_t>();
+  tile_size_ = reader.Read<uint64_t>();
+  half_precision_ = reader.Read<uint8_t>() != 0;
+  if (!reader.Good() ||
+      !std::equal(magic, magic + sizeof(magic), kTiledMatMagic) ||
+      width_ == 0 || height_ == 0 || depth_ == 0 || tile_size_ == 0) {
+    file_.Close();
+    return false;
+  }
+
+  num_tile_cols_ = (width_ + tile_size_ - 1) / tile_size_;
+  const size_t num_tile_rows = (height_ + tile_size_ - 1) / tile_size_;
+  const size_t num_tiles = reader.ReadCount(2 * sizeof(uint64_t));
+  if (!reader.Good() || num_tiles != num_tile_rows * num_tile_cols_) {
+    file_.Close();
+    return false;
+  }
+
+  tiles_.resize(num_tiles);
+  for (auto& tile : tiles_) {
+    tile.offset = reader.Read<uint64_t>();
+    tile.num_bytes = reader.Read<uint64_t>();
+    if (!reader.Good() || tile.offset > file_.Size() ||
+        tile.num_bytes > file_.Size() - tile.offset) {
+      tiles_.clear();
+      file_.Close();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void TiledMatReader::ReadAll(std::vector<float>* data) {
+  data->resize(width_ * height_ * depth_);
+  std::vector<float> tile;
+  const size_t num_tile_rows = tiles_.size() / num_tile_cols_;
+  for (size_t tile_row = 0; tile_row < num_tile_rows; ++tile_row) {
+    for (size_t tile_col = 0; tile_col < num_tile_cols_; ++tile_col) {
+      ReadTile(tile_row, tile_col, &tile);
+      const size_t row_begin = tile_row * tile_size_;
+      const size_t col_begin = tile_col * tile_size_;
+      const size_t tile_height = std::min(tile_size_, height_ - row_begin);
+      const size_t tile_width = std::min(tile_size_, width_ - col_begin);
+      const float* values = tile.data();
+      for (size_t slice = 0; slice < depth_; ++slice) {
+        for (size_t row = row_begin; row < row_begin + tile_height; ++row) {
+          std::copy(values, values + tile_width,
+                    data->data() + slice * width_ * height_ + row * width_ +
+                        col_begin);
+          values += tile_width;
+        }
+      }
+    }
+  }
+}
+
+size_t TiledMatReader::GetNumBytes() const {
+  return num_decoded_bytes_ + tiles_.size() * sizeof(Tile);
+}
+
+void TiledMatReader::ReadTile(const size_t tile_row, const size_t tile_col,
+                              std::vector<float>* data) const {
+  const Tile& tile = tiles_.at(tile_row * num_tile_cols_ + tile_col);
+  const size_t tile_height =
+      std::min(tile_size_, height_ - tile_row * tile_size_);
+  const size_t tile_width =
+      std::min(tile_size_, width_ - tile_col * tile_size_);
+  const size_t num_elems = tile_width * tile_height * depth_;
+  const size_t elem_size = half_precision_ ? sizeof(uint16_t) : sizeof(float);
+
+  std::vector<char> shuffled_tile(num_elems * elem_size);
+  const int num_decompressed_bytes = LZ4_decompress_safe(
+      file_.Data() + tile.offset, shuffled_tile.data(),
+      static_cast<int>(tile.num_bytes), static_cast<int>(shuffled_tile.size()));
+  CHECK_EQ(num_decompressed_bytes, static_cast<int>(shuffled_tile.size()))
+      << "Corrupt tile " << tile_row << ", " << tile_col;
+
+  std::vector<char> raw_tile(shuffled_tile.size());
+  UnshuffleBytes(shuffled_tile.data(), num_elems, elem_size, raw_tile.data());
+
+  data->resize(num_elems);
+  for (size_t i = 0; i < num_elems; ++i) {
+    if (half_precision_) {
+      uint16_t value;
+      std::memcpy(&value, raw_tile.data() + i * elem_size, elem_size);
+      (*data)[i] = HalfToFloat(LittleEndianToNative(value));
+    } else {
+      float value;
+      std::memcpy(&value, raw_tile.data() + i * elem_size, elem_size);
+      (*data)[i] = LittleEndianToNative(value);
+    }
+  }
+}
+
+const std::vector<float>& TiledMatReader::GetTile(const size_t tile_row,
+                                                  const size_t tile_col) {
+  Tile& tile = tiles_.at(tile_row * num_tile_cols_ + tile_col);
+  if (!tile.data) {
+    tile.data.reset(new std::vector<float>());
+    ReadTile(tile_row, tile_col, tile.data.get());
+    num_decoded_bytes_ += tile.data->size() * sizeof(float);
+  }
+  return *tile.data;
+}
+
+void ReadTiledMat(const std::string& path, size_t* width, size_t* height,
+                  size_t* depth, std::vector<float>* data) {
+  TiledMatReader reader;
+  CHECK(reader.Open(path)) << path;
+  *width = reader.GetWidth();
+  *height = reader.GetHeight();
+  *depth = reader.GetDepth();
+  reader.ReadAll(data);
+}
+
+}  // namespace mvs
+}  // namespace colmap
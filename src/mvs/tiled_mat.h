@@ -0,0 +1,142 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_MVS_TILED_MAT_H_
+#define COLMAP_SRC_MVS_TILED_MAT_H_
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "util/mapped_file.h"
+
+namespace colmap {
+namespace mvs {
+
+// Tiled format of the float matrices of depth and normal maps. The matrix is
+// split into square tiles, which hold all slices of their pixels and are
+// compressed independently with LZ4 after their bytes are shuffled into
+// planes, so that single tiles can be read without the rest of the matrix.
+// The values are stored losslessly as floats or, optionally, as half floats.
+struct TiledMatOptions {
+  // Width and height of the tiles in pixels.
+  int tile_size = 128;
+
+  // Whether to store the values as half floats, which have a relative
+  // precision of about 1e-3.
+  bool half_precision = false;
+
+  bool Check() const;
+};
+
+// Whether the file is in the tiled format, as opposed to the raw format of
+// `Mat::Write` with its text header.
+bool IsTiledMat(const std::string& path);
+
+// Read the dimensions of a matrix in either format without its values.
+void ReadMatSize(const std::string& path, size_t* width, size_t* height,
+                 size_t* depth);
+
+// Write a matrix with the given dimensions, whose values are stored as in
+// `Mat`, i.e. slice by slice in row-major order, in the tiled format.
+void WriteTiledMat(const std::string& path, const size_t width,
+                   const size_t height, const size_t depth, const float* data,
+                   const TiledMatOptions& options);
+
+// Random access to the values of a matrix in the tiled format. Only the header
+// and the tile index are read when the file is opened and the tiles are
+// decompressed when one of their values is first accessed.
+class TiledMatReader {
+ public:
+  TiledMatReader();
+
+  TiledMatReader(const TiledMatReader&) = delete;
+  TiledMatReader& operator=(const TiledMatReader&) = delete;
+
+  // Returns false if the file cannot be opened or is not a valid tiled matrix.
+  bool Open(const std::string& path);
+
+  inline size_t GetWidth() const;
+  inline size_t GetHeight() const;
+  inline size_t GetDepth() const;
+
+  // The value of a pixel, whose tile is decompressed if necessary.
+  inline float Get(const size_t row, const size_t col,
+                   const size_t slice = 0);
+
+  // Decompress all tiles into values in the layout of `Mat`.
+  void ReadAll(std::vector<float>* data);
+
+  // The number of bytes of the decompressed tiles and the tile index.
+  size_t GetNumBytes() const;
+
+ private:
+  struct Tile {
+    size_t offset = 0;
+    size_t num_bytes = 0;
+    // The decompressed values, slice by slice in row-major order of the tile.
+    std::unique_ptr<std::vector<float>> data;
+  };
+
+  void ReadTile(const size_t tile_row, const size_t tile_col,
+                std::vector<float>* data) const;
+  const std::vector<float>& GetTile(const size_t tile_row,
+                                    const size_t tile_col);
+
+  MappedFile file_;
+  size_t width_;
+  size_t height_;
+  size_t depth_;
+  size_t tile_size_;
+  size_t num_tile_cols_;
+  bool half_precision_;
+  std::vector<Tile> tiles_;
+  size_t num_decoded_bytes_;
+};
+
+// Read all values of a matrix in the tiled format.
+void ReadTiledMat(const std::string& path, size_t* width, size_t* height,
+                  size_t* depth, std::vector<float>* data);
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+size_t TiledMatReader::GetWidth() const { return width_; }
+
+size_t TiledMatReader::GetHeight() const { return height_; }
+
+size_t TiledMatReader::GetDepth() const { return depth_; }
+
+float TiledMatReader::Get(const size_t row, const size_t col,
+                          const size_t slice) {
+  const size_t tile_row = row / tile_size_;
+  const size_t tile_col = col / tile_size_;
+  const std::vector<float>& tile = GetTile(tile_row, tile_col);
+  const size_t tile_width =
+      std::min(tile_size_, width_ - tile_col * tile_size_);
+  const size_t tile_height =
+      std::min(tile_size_, height_ - tile_row * tile_size_);
+  return tile[slice * tile_width * tile_height +
+              (row - tile_row * tile_size_) * tile_width +
+              (col - tile_col * tile_size_)];
+}
+
+}  // namespace mvs
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_MVS_TILED_MAT_H_
@@ -0,0 +1,148 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "mvs/tiled_mat_test"
+#include "util/testing.h"
+
+#include <cmath>
+
+#include <boost/filesystem.hpp>
+
+#include "mvs/mat.h"
+#include "mvs/tiled_mat.h"
+
+using namespace colmap::mvs;
+
+namespace {
+
+std::string TempMatPath() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("tiled_mat_test_%%%%%%%%.bin"))
+      .string();
+}
+
+// A matrix whose size is not a multiple of the tile size in either dimension.
+Mat<float> CreateMat() {
+  Mat<float> mat(37, 21, 3);
+  for (size_t slice = 0; slice < mat.GetDepth(); ++slice) {
+    for (size_t row = 0; row < mat.GetHeight(); ++row) {
+      for (size_t col = 0; col < mat.GetWidth(); ++col) {
+        mat.Set(row, col, slice, 0.5f * row - 1.25f * col + 100.0f * slice);
+      }
+    }
+  }
+  mat.Set(3, 4, 0, -1.0f);
+  mat.Set(5, 6, 1, 1e-6f);
+  return mat;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestReadWriteFloat) {
+  const Mat<float> mat = CreateMat();
+  const std::string path = TempMatPath();
+  TiledMatOptions options;
+  options.tile_size = 8;
+  mat.Write(path, options);
+
+  BOOST_CHECK(IsTiledMat(path));
+  size_t width, height, depth;
+  ReadMatSize(path, &width, &height, &depth);
+  BOOST_CHECK_EQUAL(width, 37);
+  BOOST_CHECK_EQUAL(height, 21);
+  BOOST_CHECK_EQUAL(depth, 3);
+
+  Mat<float> read_mat;
+  read_mat.Read(path);
+  BOOST_CHECK_EQUAL(read_mat.GetWidth(), mat.GetWidth());
+  BOOST_CHECK_EQUAL(read_mat.GetHeight(), mat.GetHeight());
+  BOOST_CHECK_EQUAL(read_mat.GetDepth(), mat.GetDepth());
+  BOOST_CHECK(read_mat.GetData() == mat.GetData());
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadWriteHalf) {
+  const Mat<float> mat = CreateMat();
+  const std::string path = TempMatPath();
+  TiledMatOptions options;
+  options.tile_size = 16;
+  options.half_precision = true;
+  mat.Write(path, options);
+
+  Mat<float> read_mat;
+  read_mat.Read(path);
+  for (size_t i = 0; i < mat.GetData().size(); ++i) {
+    const float value = mat.GetData()[i];
+    BOOST_CHECK_LE(std::abs(read_mat.GetData()[i] - value),
+                   1e-3f * std::abs(value) + 1e-7f);
+  }
+  BOOST_CHECK_EQUAL(read_mat.Get(3, 4, 0), -1.0f);
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestRandomAccess) {
+  const Mat<float> mat = CreateMat();
+  const std::string path = TempMatPath();
+  TiledMatOptions options;
+  options.tile_size = 8;
+  mat.Write(path, options);
+
+  TiledMatReader reader;
+  BOOST_CHECK(reader.Open(path));
+  BOOST_CHECK_EQUAL(reader.GetWidth(), 37);
+  BOOST_CHECK_EQUAL(reader.GetHeight(), 21);
+  BOOST_CHECK_EQUAL(reader.GetDepth(), 3);
+
+  // Only the tile of the accessed pixel is decompressed.
+  const size_t num_index_bytes = reader.GetNumBytes();
+  BOOST_CHECK_EQUAL(reader.Get(20, 36, 2), mat.Get(20, 36, 2));
+  BOOST_CHECK_EQUAL(reader.GetNumBytes() - num_index_bytes,
+                    5 * 5 * 3 * sizeof(float));
+  BOOST_CHECK_EQUAL(reader.Get(16, 32, 0), mat.Get(16, 32, 0));
+  BOOST_CHECK_EQUAL(reader.GetNumBytes() - num_index_bytes,
+                    5 * 5 * 3 * sizeof(float));
+
+  for (size_t slice = 0; slice < mat.GetDepth(); ++slice) {
+    for (size_t row = 0; row < mat.GetHeight(); ++row) {
+      for (size_t col = 0; col < mat.GetWidth(); ++col) {
+        BOOST_CHECK_EQUAL(reader.Get(row, col, slice),
+                          mat.Get(row, col, slice));
+      }
+    }
+  }
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestRawFormat) {
+  const Mat<float> mat = CreateMat();
+  const std::string path = TempMatPath();
+  mat.Write(path);
+
+  BOOST_CHECK(!IsTiledMat(path));
+  size_t width, height, depth;
+  ReadMatSize(path, &width, &height, &depth);
+  BOOST_CHECK_EQUAL(width, 37);
+  BOOST_CHECK_EQUAL(height, 21);
+  BOOST_CHECK_EQUAL(depth, 3);
+
+  TiledMatReader reader;
+  BOOST_CHECK(!reader.Open(path));
+
+  boost::filesystem::remove(path);
+}
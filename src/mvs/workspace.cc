@@ -16,8 +16,10 @@
 
 #include "mvs/workspace.h"
 
+#include <algorithm>
 #include <numeric>
 
+#include "util/metrics.h"
 #include "util/misc.h"
 
 namespace colmap {
@@ -28,16 +30,26 @@ Workspace::CachedImage::CachedImage() {}
 Workspace::CachedImage::CachedImage(CachedImage&& other) {
   num_bytes = other.num_bytes;
   bitmap = std::move(other.bitmap);
-  depth_map = std::move(other.depth_map);
-  normal_map = std::move(other.normal_map);
+  for (int body = 0; body < 2; ++body) {
+    depth_maps[body] = std::move(other.depth_maps[body]);
+    normal_maps[body] = std::move(other.normal_maps[body]);
+    depth_map_readers[body] = std::move(other.depth_map_readers[body]);
+    normal_map_readers[body] = std::move(other.normal_map_readers[body]);
+  }
+  num_reader_bytes = other.num_reader_bytes;
 }
 
 Workspace::CachedImage& Workspace::CachedImage::operator=(CachedImage&& other) {
   if (this != &other) {
     num_bytes = other.num_bytes;
     bitmap = std::move(other.bitmap);
-    depth_map = std::move(other.depth_map);
-    normal_map = std::move(other.normal_map);
+    for (int body = 0; body < 2; ++body) {
+      depth_maps[body] = std::move(other.depth_maps[body]);
+      normal_maps[body] = std::move(other.normal_maps[body]);
+      depth_map_readers[body] = std::move(other.depth_map_readers[body]);
+      normal_map_readers[body] = std::move(other.normal_map_readers[body]);
+    }
+    num_reader_bytes = other.num_reader_bytes;
   }
   return *this;
 }
@@ -46,103 +58,387 @@ size_t Workspace::CachedImage::NumBytes() const { return num_bytes; }
 
 Workspace::Workspace(const Options& options)
     : options_(options),
+      memory_consumer_("mvs_workspace", kWorkspaceCacheMemoryPriority),
       cache_(1024 * 1024 * 1024 * options_.cache_size,
-             [](const int) { return CachedImage(); }) {
+             [this](const int image_id) {
+               return TakePrefetchedImage(image_id);
+             }) {
+  cache_.SetMemoryConsumer(&memory_consumer_);
   StringToLower(&options_.input_type);
-  model_.Read(options_.workspace_path, options_.workspace_format);
-  if (options_.max_image_size > 0) {
-    for (auto& image : model_.images) {
-      image.Downsize(options_.max_image_size, options_.max_image_size);
+  models_.emplace_back();
+  models_[0].Read(options_.workspace_path, options_.workspace_format);
+  std::vector<std::string> stereo_folders = {options_.stereo_folder};
+
+  // The object model is read before the images are downsized, as it takes
+  // their calibration from the workspace model.
+  if (!options_.object_sparse_path.empty()) {
+    models_.push_back(
+        models_[0].ReadBodyFromCOLMAP(options_.object_sparse_path));
+    stereo_folders.push_back(options_.object_stereo_folder);
+  }
+
+  for (auto& model : models_) {
+    if (options_.max_image_size > 0) {
+      for (auto& image : model.images) {
+        image.Downsize(options_.max_image_size, options_.max_image_size);
+      }
     }
   }
 
-  depth_map_path_ = EnsureTrailingSlash(
-      JoinPaths(options_.workspace_path, options_.stereo_folder, "depth_maps"));
-  normal_map_path_ = EnsureTrailingSlash(JoinPaths(
-      options_.workspace_path, options_.stereo_folder, "normal_maps"));
+  for (const auto& stereo_folder : stereo_folders) {
+    depth_map_paths_.push_back(EnsureTrailingSlash(
+        JoinPaths(options_.workspace_path, stereo_folder, "depth_maps")));
+    normal_map_paths_.push_back(EnsureTrailingSlash(
+        JoinPaths(options_.workspace_path, stereo_folder, "normal_maps")));
+  }
+
+  if (!options_.image_path.empty()) {
+    std::string workspace_format = options_.workspace_format;
+    StringToLower(&workspace_format);
+    CHECK_EQ(workspace_format, "colmap")
+        << "Separate image paths require a workspace in the COLMAP format";
+    image_source_ =
+        CreateImageSource(options_.image_path, options_.image_source);
+  }
+
+  if (options_.num_prefetch_threads > 0) {
+    prefetch_thread_pool_.reset(
+        new ThreadPool(options_.num_prefetch_threads));
+  }
+}
+
+Workspace::~Workspace() {
+  // The prefetch threads access the workspace, so they must be joined first.
+  prefetch_thread_pool_.reset();
+}
+
+void Workspace::ClearCache() {
+  if (prefetch_thread_pool_) {
+    prefetch_thread_pool_->Wait();
+  }
+  prefetched_images_.clear();
+  prefetched_image_ids_.clear();
+  cache_.Clear();
 }
 
-void Workspace::ClearCache() { cache_.Clear(); }
+void Workspace::Prefetch(const std::vector<int>& image_ids,
+                         const bool prefetch_maps, const int body) {
+  CHECK_LT(body, NumBodies());
+
+  // Access the cached images in reverse order, so that the images that are
+  // accessed last are evicted first.
+  for (auto it = image_ids.rbegin(); it != image_ids.rend(); ++it) {
+    if (cache_.Exists(*it)) {
+      cache_.Get(*it);
+    }
+  }
+
+  // Fetch the remote images, which are not cached, in the background.
+  if (image_source_) {
+    std::vector<std::string> image_names;
+    for (const int image_id : image_ids) {
+      if (!cache_.Exists(image_id)) {
+        image_names.push_back(models_[0].GetImageName(image_id));
+      }
+    }
+    image_source_->Prefetch(image_names);
+  }
+
+  if (!prefetch_thread_pool_) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(prefetch_mutex_);
+  for (const int image_id : image_ids) {
+    if (cache_.Exists(image_id) || prefetched_images_.count(image_id) > 0) {
+      continue;
+    }
+
+    // Drop the oldest images that were read ahead but not yet accessed.
+    while (prefetched_images_.size() >=
+           static_cast<size_t>(options_.max_num_prefetched_images)) {
+      auto it = std::find_if(prefetched_image_ids_.begin(),
+                             prefetched_image_ids_.end(), [&](const int id) {
+                               return prefetched_images_.at(id) != nullptr;
+                             });
+      if (it == prefetched_image_ids_.end()) {
+        return;
+      }
+      prefetched_images_.erase(*it);
+      prefetched_image_ids_.erase(it);
+    }
+
+    prefetched_images_.emplace(image_id, nullptr);
+    prefetched_image_ids_.push_back(image_id);
+    prefetch_thread_pool_->AddTask(&Workspace::PrefetchImage, this, image_id,
+                                   prefetch_maps, body);
+  }
+}
 
 const Workspace::Options& Workspace::GetOptions() const { return options_; }
 
-const Model& Workspace::GetModel() const { return model_; }
+int Workspace::NumBodies() const { return static_cast<int>(models_.size()); }
+
+const Model& Workspace::GetModel() const { return models_[0]; }
+
+const Model& Workspace::GetModel(const int body) const {
+  return models_.at(body);
+}
 
 const Bitmap& Workspace::GetBitmap(const int image_id) {
+  METRIC_COUNTER_ADD("mvs_workspace/cache_accesses", 1);
   auto& cached_image = cache_.GetMutable(image_id);
   if (!cached_image.bitmap) {
-    cached_image.bitmap.reset(new Bitmap());
-    cached_image.bitmap->Read(GetBitmapPath(image_id), options_.image_as_rgb);
-    if (options_.max_image_size > 0) {
-      cached_image.bitmap->Rescale(model_.images.at(image_id).GetWidth(),
-                                   model_.images.at(image_id).GetHeight());
-    }
-    cached_image.num_bytes += cached_image.bitmap->NumBytes();
+    METRIC_COUNTER_ADD("mvs_workspace/cache_misses", 1);
+    ReadBitmap(image_id, &cached_image);
     cache_.UpdateNumBytes(image_id);
   }
   return *cached_image.bitmap;
 }
 
-const DepthMap& Workspace::GetDepthMap(const int image_id) {
+const DepthMap& Workspace::GetDepthMap(const int image_id, const int body) {
+  CHECK_LT(body, NumBodies());
+  METRIC_COUNTER_ADD("mvs_workspace/cache_accesses", 1);
   auto& cached_image = cache_.GetMutable(image_id);
-  if (!cached_image.depth_map) {
-    cached_image.depth_map.reset(new DepthMap());
-    cached_image.depth_map->Read(GetDepthMapPath(image_id));
-    if (options_.max_image_size > 0) {
-      cached_image.depth_map->Downsize(model_.images.at(image_id).GetWidth(),
-                                       model_.images.at(image_id).GetHeight());
-    }
-    cached_image.num_bytes += cached_image.depth_map->GetNumBytes();
+  if (!cached_image.depth_maps[body]) {
+    METRIC_COUNTER_ADD("mvs_workspace/cache_misses", 1);
+    ReadDepthMap(image_id, body, &cached_image);
     cache_.UpdateNumBytes(image_id);
   }
-  return *cached_image.depth_map;
+  return *cached_image.depth_maps[body];
 }
 
-const NormalMap& Workspace::GetNormalMap(const int image_id) {
+const NormalMap& Workspace::GetNormalMap(const int image_id, const int body) {
+  CHECK_LT(body, NumBodies());
+  METRIC_COUNTER_ADD("mvs_workspace/cache_accesses", 1);
   auto& cached_image = cache_.GetMutable(image_id);
-  if (!cached_image.normal_map) {
-    cached_image.normal_map.reset(new NormalMap());
-    cached_image.normal_map->Read(GetNormalMapPath(image_id));
-    if (options_.max_image_size > 0) {
-      cached_image.normal_map->Downsize(model_.images.at(image_id).GetWidth(),
-                                        model_.images.at(image_id).GetHeight());
-    }
-    cached_image.num_bytes += cached_image.normal_map->GetNumBytes();
+  if (!cached_image.normal_maps[body]) {
+    METRIC_COUNTER_ADD("mvs_workspace/cache_misses", 1);
+    ReadNormalMap(image_id, body, &cached_image);
     cache_.UpdateNumBytes(image_id);
   }
-  return *cached_image.normal_map;
+  return *cached_image.normal_maps[body];
+}
+
+void Workspace::GetDepthMapSize(const int image_id, size_t* width,
+                                size_t* height, const int body) {
+  if (options_.max_image_size > 0) {
+    const auto& depth_map = GetDepthMap(image_id, body);
+    *width = depth_map.GetWidth();
+    *height = depth_map.GetHeight();
+  } else {
+    size_t depth;
+    ReadMatSize(GetDepthMapPath(image_id, body), width, height, &depth);
+  }
+}
+
+float Workspace::GetDepth(const int image_id, const int row, const int col,
+                          const int body) {
+  CHECK_LT(body, NumBodies());
+  auto& cached_image = cache_.GetMutable(image_id);
+  TiledMatReader* reader = GetTiledMatReader(
+      GetDepthMapPath(image_id, body), !!cached_image.depth_maps[body],
+      &cached_image.depth_map_readers[body]);
+  if (reader == nullptr) {
+    return GetDepthMap(image_id, body).Get(row, col);
+  }
+  const float depth = reader->Get(row, col);
+  UpdateTiledMatNumBytes(image_id, &cached_image);
+  return depth;
+}
+
+void Workspace::GetNormal(const int image_id, const int row, const int col,
+                          float normal[3], const int body) {
+  CHECK_LT(body, NumBodies());
+  auto& cached_image = cache_.GetMutable(image_id);
+  TiledMatReader* reader = GetTiledMatReader(
+      GetNormalMapPath(image_id, body), !!cached_image.normal_maps[body],
+      &cached_image.normal_map_readers[body]);
+  if (reader == nullptr) {
+    GetNormalMap(image_id, body).GetSlice(row, col, normal);
+    return;
+  }
+  for (int slice = 0; slice < 3; ++slice) {
+    normal[slice] = reader->Get(row, col, slice);
+  }
+  UpdateTiledMatNumBytes(image_id, &cached_image);
 }
 
 std::string Workspace::GetBitmapPath(const int image_id) const {
-  return model_.images.at(image_id).GetPath();
+  if (image_source_) {
+    return JoinPaths(options_.image_path, models_[0].GetImageName(image_id));
+  }
+  return models_[0].images.at(image_id).GetPath();
 }
 
-std::string Workspace::GetDepthMapPath(const int image_id) const {
-  return depth_map_path_ + GetFileName(image_id);
+std::string Workspace::GetDepthMapPath(const int image_id,
+                                       const int body) const {
+  return depth_map_paths_.at(body) + GetFileName(image_id);
 }
 
-std::string Workspace::GetNormalMapPath(const int image_id) const {
-  return normal_map_path_ + GetFileName(image_id);
+std::string Workspace::GetNormalMapPath(const int image_id,
+                                        const int body) const {
+  return normal_map_paths_.at(body) + GetFileName(image_id);
 }
 
 bool Workspace::HasBitmap(const int image_id) const {
+  // Remote images are assumed to exist, as checking them would fetch them.
+  if (IsRemoteImagePath(GetBitmapPath(image_id))) {
+    return true;
+  }
   return ExistsFile(GetBitmapPath(image_id));
 }
 
-bool Workspace::HasDepthMap(const int image_id) const {
-  return ExistsFile(GetDepthMapPath(image_id));
+bool Workspace::HasDepthMap(const int image_id, const int body) const {
+  return ExistsFile(GetDepthMapPath(image_id, body));
 }
 
-bool Workspace::HasNormalMap(const int image_id) const {
-  return ExistsFile(GetNormalMapPath(image_id));
+bool Workspace::HasNormalMap(const int image_id, const int body) const {
+  return ExistsFile(GetNormalMapPath(image_id, body));
 }
 
 std::string Workspace::GetFileName(const int image_id) const {
-  const auto& image_name = model_.GetImageName(image_id);
+  const auto& image_name = models_[0].GetImageName(image_id);
   return StringPrintf("%s.%s.bin", image_name.c_str(),
                       options_.input_type.c_str());
 }
 
+void Workspace::ReadBitmap(const int image_id,
+                           CachedImage* cached_image) const {
+  // Remote images are fetched to a local file first.
+  std::string path = GetBitmapPath(image_id);
+  const std::string image_name = models_[0].GetImageName(image_id);
+  const bool acquired =
+      image_source_ && image_source_->Acquire(image_name, &path);
+
+  cached_image->bitmap.reset(new Bitmap());
+  if (options_.max_image_size > 0) {
+    // Decode JPEG images at the smallest resolution that can still be
+    // rescaled to the downsized image.
+    const int width =
+        static_cast<int>(models_[0].images.at(image_id).GetWidth());
+    const int height =
+        static_cast<int>(models_[0].images.at(image_id).GetHeight());
+    cached_image->bitmap->Read(path, options_.image_as_rgb,
+                               std::max(width, height));
+    cached_image->bitmap->Rescale(width, height);
+  } else {
+    cached_image->bitmap->Read(path, options_.image_as_rgb);
+  }
+  cached_image->num_bytes += cached_image->bitmap->NumBytes();
+
+  if (acquired) {
+    image_source_->Release(image_name);
+  }
+}
+
+void Workspace::ReadDepthMap(const int image_id, const int body,
+                             CachedImage* cached_image) const {
+  auto& depth_map = cached_image->depth_maps[body];
+  depth_map.reset(new DepthMap());
+  depth_map->Read(GetDepthMapPath(image_id, body));
+  if (options_.max_image_size > 0) {
+    depth_map->Downsize(models_[0].images.at(image_id).GetWidth(),
+                        models_[0].images.at(image_id).GetHeight());
+  }
+  cached_image->num_bytes += depth_map->GetNumBytes();
+}
+
+void Workspace::ReadNormalMap(const int image_id, const int body,
+                              CachedImage* cached_image) const {
+  auto& normal_map = cached_image->normal_maps[body];
+  normal_map.reset(new NormalMap());
+  normal_map->Read(GetNormalMapPath(image_id, body));
+  if (options_.max_image_size > 0) {
+    normal_map->Downsize(models_[0].images.at(image_id).GetWidth(),
+                         models_[0].images.at(image_id).GetHeight());
+  }
+  cached_image->num_bytes += normal_map->GetNumBytes();
+}
+
+void Workspace::PrefetchImage(const int image_id, const bool prefetch_maps,
+                              const int body) {
+  std::unique_ptr<CachedImage> cached_image(new CachedImage());
+  if (HasBitmap(image_id)) {
+    ReadBitmap(image_id, cached_image.get());
+  }
+
+  if (prefetch_maps) {
+    const std::string depth_map_path = GetDepthMapPath(image_id, body);
+    if (ExistsFile(depth_map_path) &&
+        (options_.max_image_size > 0 || !IsTiledMat(depth_map_path))) {
+      ReadDepthMap(image_id, body, cached_image.get());
+    }
+    const std::string normal_map_path = GetNormalMapPath(image_id, body);
+    if (ExistsFile(normal_map_path) &&
+        (options_.max_image_size > 0 || !IsTiledMat(normal_map_path))) {
+      ReadNormalMap(image_id, body, cached_image.get());
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(prefetch_mutex_);
+  prefetched_images_.at(image_id) = std::move(cached_image);
+  prefetch_condition_.notify_all();
+}
+
+Workspace::CachedImage Workspace::TakePrefetchedImage(const int image_id) {
+  std::unique_lock<std::mutex> lock(prefetch_mutex_);
+  if (prefetched_images_.count(image_id) == 0) {
+    return CachedImage();
+  }
+
+  // Wait for the image, if it is still read.
+  prefetch_condition_.wait(
+      lock, [&]() { return prefetched_images_.at(image_id) != nullptr; });
+
+  CachedImage cached_image = std::move(*prefetched_images_.at(image_id));
+  prefetched_images_.erase(image_id);
+  prefetched_image_ids_.erase(std::find(prefetched_image_ids_.begin(),
+                                        prefetched_image_ids_.end(),
+                                        image_id));
+  return cached_image;
+}
+
+TiledMatReader* Workspace::GetTiledMatReader(
+    const std::string& path, const bool has_full_map,
+    std::unique_ptr<TiledMatReader>* reader) {
+  if (*reader) {
+    return reader->get();
+  }
+
+  // Downsized maps are interpolated from all pixels, so they are read
+  // completely, as are maps in the raw format.
+  if (has_full_map || options_.max_image_size > 0 || !IsTiledMat(path)) {
+    return nullptr;
+  }
+
+  reader->reset(new TiledMatReader());
+  CHECK((*reader)->Open(path)) << path;
+  return reader->get();
+}
+
+void Workspace::UpdateTiledMatNumBytes(const int image_id,
+                                       CachedImage* cached_image) {
+  size_t num_reader_bytes = 0;
+  for (int body = 0; body < 2; ++body) {
+    if (cached_image->depth_map_readers[body]) {
+      num_reader_bytes += cached_image->depth_map_readers[body]->GetNumBytes();
+    }
+    if (cached_image->normal_map_readers[body]) {
+      num_reader_bytes +=
+          cached_image->normal_map_readers[body]->GetNumBytes();
+    }
+  }
+
+  // Only update the cache if a tile was decompressed since the last update.
+  if (num_reader_bytes != cached_image->num_reader_bytes) {
+    cached_image->num_bytes += num_reader_bytes;
+    cached_image->num_bytes -= cached_image->num_reader_bytes;
+    cached_image->num_reader_bytes = num_reader_bytes;
+    cache_.UpdateNumBytes(image_id);
+  }
+}
+
 void ImportPMVSWorkspace(const Workspace& workspace,
                          const std::string& option_name) {
   const std::string& workspace_path = workspace.GetOptions().workspace_path;
@@ -17,12 +17,22 @@
 #ifndef COLMAP_SRC_MVS_WORKSPACE_H_
 #define COLMAP_SRC_MVS_WORKSPACE_H_
 
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
 #include "mvs/consistency_graph.h"
 #include "mvs/depth_map.h"
 #include "mvs/model.h"
 #include "mvs/normal_map.h"
+#include "mvs/tiled_mat.h"
 #include "util/bitmap.h"
 #include "util/cache.h"
+#include "util/image_source.h"
+#include "util/memory_governor.h"
+#include "util/threading.h"
 
 namespace colmap {
 namespace mvs {
@@ -44,28 +54,74 @@ class Workspace {
     std::string workspace_format;
     std::string input_type;
     std::string stereo_folder = "stereo";
+
+    // If not empty, the workspace has a second body, whose model is read with
+    // `Model::ReadBodyFromCOLMAP` from this sparse model and whose depth and
+    // normal maps are in the object stereo folder. Both bodies share the
+    // images of the workspace and their cached bitmaps.
+    std::string object_sparse_path;
+    std::string object_stereo_folder = "stereo_object";
+
+    // The number of threads that read the images hinted with `Prefetch` ahead
+    // of their access, and the maximum number of images that are read ahead.
+    // The images read ahead are not counted against the cache size until they
+    // are accessed. No images are read ahead without threads.
+    int num_prefetch_threads = 2;
+    int max_num_prefetched_images = 16;
+
+    // If not empty, the directory or URL from which the images are read
+    // instead of the images folder of a workspace in the COLMAP format. The
+    // remote images hinted with `Prefetch` are fetched ahead of their access,
+    // as configured by `image_source`.
+    std::string image_path;
+    ImageSourceOptions image_source;
   };
 
   Workspace(const Options& options);
+  ~Workspace();
 
   void ClearCache();
 
+  // Hint that the images are accessed next, in the given order. The cached
+  // images among them are evicted last, with the first image evicted last, and
+  // the bitmaps and, if requested, the depth and normal maps of the given body
+  // of the other images are read ahead in the background. Tiled maps, which
+  // are read on demand, are not read ahead unless they are downsized.
+  void Prefetch(const std::vector<int>& image_ids, const bool prefetch_maps,
+                const int body = 0);
+
   const Options& GetOptions() const;
 
+  // The number of bodies, which is 2 if the workspace has an object model.
+  // The depth and normal maps are per body, where body 0 is the background
+  // of the workspace model and body 1 the object.
+  int NumBodies() const;
+
   const Model& GetModel() const;
+  const Model& GetModel(const int body) const;
   const Bitmap& GetBitmap(const int image_id);
-  const DepthMap& GetDepthMap(const int image_id);
-  const NormalMap& GetNormalMap(const int image_id);
+  const DepthMap& GetDepthMap(const int image_id, const int body = 0);
+  const NormalMap& GetNormalMap(const int image_id, const int body = 0);
+
+  // Per-pixel access to the depth and normal maps. Maps in the tiled format
+  // are not read completely but only the tiles of the accessed pixels, unless
+  // the maps are downsized to the maximum image size.
+  void GetDepthMapSize(const int image_id, size_t* width, size_t* height,
+                       const int body = 0);
+  float GetDepth(const int image_id, const int row, const int col,
+                 const int body = 0);
+  void GetNormal(const int image_id, const int row, const int col,
+                 float normal[3], const int body = 0);
 
   // Get paths to bitmap, depth map, normal map and consistency graph.
   std::string GetBitmapPath(const int image_id) const;
-  std::string GetDepthMapPath(const int image_id) const;
-  std::string GetNormalMapPath(const int image_id) const;
+  std::string GetDepthMapPath(const int image_id, const int body = 0) const;
+  std::string GetNormalMapPath(const int image_id, const int body = 0) const;
 
   // Return whether bitmap, depth map, normal map, and consistency graph exist.
   bool HasBitmap(const int image_id) const;
-  bool HasDepthMap(const int image_id) const;
-  bool HasNormalMap(const int image_id) const;
+  bool HasDepthMap(const int image_id, const int body = 0) const;
+  bool HasNormalMap(const int image_id, const int body = 0) const;
 
  private:
   std::string GetFileName(const int image_id) const;
@@ -78,18 +134,55 @@ class Workspace {
     size_t NumBytes() const;
     size_t num_bytes = 0;
     std::unique_ptr<Bitmap> bitmap;
-    std::unique_ptr<DepthMap> depth_map;
-    std::unique_ptr<NormalMap> normal_map;
+    std::unique_ptr<DepthMap> depth_maps[2];
+    std::unique_ptr<NormalMap> normal_maps[2];
+    std::unique_ptr<TiledMatReader> depth_map_readers[2];
+    std::unique_ptr<TiledMatReader> normal_map_readers[2];
+    size_t num_reader_bytes = 0;
 
    private:
     NON_COPYABLE(CachedImage)
   };
 
+  // Read the data of an image into a cached image, which does not access the
+  // cache and is used by the prefetch threads.
+  void ReadBitmap(const int image_id, CachedImage* cached_image) const;
+  void ReadDepthMap(const int image_id, const int body,
+                    CachedImage* cached_image) const;
+  void ReadNormalMap(const int image_id, const int body,
+                     CachedImage* cached_image) const;
+
+  void PrefetchImage(const int image_id, const bool prefetch_maps,
+                     const int body);
+  // The getter of the cache, which takes the image from the prefetched images
+  // or returns an empty image that is read on demand.
+  CachedImage TakePrefetchedImage(const int image_id);
+
+  // The reader of a tiled map, which is opened on first access, or null if
+  // the map is already read completely or must be read completely.
+  TiledMatReader* GetTiledMatReader(const std::string& path,
+                                    const bool has_full_map,
+                                    std::unique_ptr<TiledMatReader>* reader);
+  void UpdateTiledMatNumBytes(const int image_id, CachedImage* cached_image);
+
   Options options_;
-  Model model_;
+  // The models, depth and normal map folders of the bodies.
+  std::vector<Model> models_;
+  // The cache reports its size to the memory governor, which shrinks it when
+  // the process exceeds its memory budget.
+  MemoryConsumer memory_consumer_;
   MemoryConstrainedLRUCache<int, CachedImage> cache_;
-  std::string depth_map_path_;
-  std::string normal_map_path_;
+  std::vector<std::string> depth_map_paths_;
+  std::vector<std::string> normal_map_paths_;
+  std::unique_ptr<ImageSource> image_source_;
+
+  // The images read ahead, which are null while they are read, in the order
+  // in which they were requested.
+  std::mutex prefetch_mutex_;
+  std::condition_variable prefetch_condition_;
+  std::unordered_map<int, std::unique_ptr<CachedImage>> prefetched_images_;
+  std::deque<int> prefetched_image_ids_;
+  std::unique_ptr<ThreadPool> prefetch_thread_pool_;
 };
 
 // Import a PMVS workspace into the COLMAP workspace format. Only images in the
@@ -24,10 +24,38 @@
 
 #include "base/cost_functions.h"
 #include "base/projection.h"
+#include "optim/schur_solver.h"
+#include "util/metrics.h"
 #include "util/misc.h"
 #include "util/timer.h"
+#include "util/trace.h"
 
 namespace colmap {
+namespace {
+
+// Publish the iterations and the residuals of every solve to the live metrics,
+// with the costs in pixels as in `PrintSolverSummary`.
+void RecordSolverMetrics(const ceres::Solver::Summary& summary) {
+  if (!IsMetricsEnabled()) {
+    return;
+  }
+  METRIC_COUNTER_ADD("bundle_adjustment/num_solves", 1);
+  METRIC_COUNTER_ADD(
+      "bundle_adjustment/num_iterations",
+      summary.num_successful_steps + summary.num_unsuccessful_steps);
+  METRIC_GAUGE_SET("bundle_adjustment/num_residuals",
+                   summary.num_residuals_reduced);
+  if (summary.num_residuals_reduced > 0) {
+    METRIC_GAUGE_SET(
+        "bundle_adjustment/initial_cost",
+        std::sqrt(summary.initial_cost / summary.num_residuals_reduced));
+    METRIC_GAUGE_SET(
+        "bundle_adjustment/final_cost",
+        std::sqrt(summary.final_cost / summary.num_residuals_reduced));
+  }
+}
+
+}  // namespace
 
 ////////////////////////////////////////////////////////////////////////////////
 // BundleAdjustmentOptions
@@ -42,6 +70,9 @@ ceres::LossFunction* BundleAdjustmentOptions::CreateLossFunction() const {
     case LossFunctionType::CAUCHY:
       loss_function = new ceres::CauchyLoss(loss_function_scale);
       break;
+    case LossFunctionType::HUBER:
+      loss_function = new ceres::HuberLoss(loss_function_scale);
+      break;
   }
   return loss_function;
 }
@@ -55,7 +86,7 @@ bool BundleAdjustmentOptions::Check() const {
 // BundleAdjustmentConfig
 ////////////////////////////////////////////////////////////////////////////////
 
-BundleAdjustmentConfig::BundleAdjustmentConfig() {}
+BundleAdjustmentConfig::BundleAdjustmentConfig() : has_point_subset_(false) {}
 
 size_t BundleAdjustmentConfig::NumImages() const { return image_ids_.size(); }
 
@@ -71,6 +102,10 @@ size_t BundleAdjustmentConfig::NumConstantPoses() const {
   return constant_poses_.size();
 }
 
+size_t BundleAdjustmentConfig::NumRigidMotions() const {
+  return rigid_motions_.size();
+}
+
 size_t BundleAdjustmentConfig::NumConstantTvecs() const {
   return constant_tvecs_.size();
 }
@@ -88,7 +123,16 @@ size_t BundleAdjustmentConfig::NumResiduals(
   // Count the number of observations for all added images.
   size_t num_observations = 0;
   for (const image_t image_id : image_ids_) {
-    num_observations += reconstruction.Image(image_id).NumPoints3D();
+    const Image& image = reconstruction.Image(image_id);
+    if (has_point_subset_) {
+      for (const Point2D& point2D : image.Points2D()) {
+        if (point2D.HasPoint3D() && IsInPointSubset(point2D.Point3DId())) {
+          num_observations += 1;
+        }
+      }
+    } else {
+      num_observations += image.NumPoints3D();
+    }
   }
 
   // Count the number of observations for all added 3D points that are not
@@ -224,6 +268,52 @@ void BundleAdjustmentConfig::RemoveConstantPoint(const point3D_t point3D_id) {
   constant_point3D_ids_.erase(point3D_id);
 }
 
+void BundleAdjustmentConfig::SetPointSubset(
+    const std::unordered_set<point3D_t>& point3D_ids) {
+  has_point_subset_ = true;
+  subset_point3D_ids_ = point3D_ids;
+}
+
+void BundleAdjustmentConfig::ClearPointSubset() {
+  has_point_subset_ = false;
+  subset_point3D_ids_.clear();
+}
+
+bool BundleAdjustmentConfig::HasPointSubset() const {
+  return has_point_subset_;
+}
+
+bool BundleAdjustmentConfig::IsInPointSubset(
+    const point3D_t point3D_id) const {
+  return !has_point_subset_ || subset_point3D_ids_.count(point3D_id) > 0;
+}
+
+void BundleAdjustmentConfig::SetRigidMotion(const image_t image_id,
+                                            const image_t base_image_id,
+                                            const int motion_idx) {
+  CHECK(HasImage(image_id));
+  CHECK(HasImage(base_image_id));
+  CHECK_NE(image_id, base_image_id);
+  CHECK(!HasConstantPose(image_id));
+  CHECK(!HasConstantTvec(image_id));
+  CHECK(!HasRigidMotion(base_image_id))
+      << "The base image must not have a rigid motion itself";
+  rigid_motions_[image_id] = std::make_pair(base_image_id, motion_idx);
+}
+
+void BundleAdjustmentConfig::RemoveRigidMotion(const image_t image_id) {
+  rigid_motions_.erase(image_id);
+}
+
+bool BundleAdjustmentConfig::HasRigidMotion(const image_t image_id) const {
+  return rigid_motions_.find(image_id) != rigid_motions_.end();
+}
+
+const std::unordered_map<image_t, std::pair<image_t, int>>&
+BundleAdjustmentConfig::RigidMotions() const {
+  return rigid_motions_;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // BundleAdjuster
 ////////////////////////////////////////////////////////////////////////////////
@@ -235,6 +325,7 @@ BundleAdjuster::BundleAdjuster(const BundleAdjustmentOptions& options,
 }
 
 bool BundleAdjuster::Solve(Reconstruction* reconstruction) {
+  TRACE_SCOPE("BundleAdjuster::Solve");
   CHECK_NOTNULL(reconstruction);
   CHECK(!problem_) << "Cannot use the same BundleAdjuster multiple times";
 
@@ -277,7 +368,19 @@ bool BundleAdjuster::Solve(Reconstruction* reconstruction) {
   std::string solver_error;
   CHECK(solver_options.IsValid(&solver_error)) << solver_error;
 
-  ceres::Solve(solver_options, problem_.get(), &summary_);
+  if (options_.use_mixed_precision_solver) {
+    std::vector<double*> point_blocks;
+    point_blocks.reserve(point3D_num_observations_.size());
+    for (const auto& elem : point3D_num_observations_) {
+      point_blocks.push_back(
+          reconstruction->Point3D(elem.first).XYZ().data());
+    }
+    SolveMixedPrecision(solver_options, point_blocks, problem_.get(),
+                        &summary_);
+  } else {
+    ceres::Solve(solver_options, problem_.get(), &summary_);
+  }
+  RecordSolverMetrics(summary_);
 
   if (solver_options.minimizer_progress_to_stdout) {
     std::cout << std::endl;
@@ -299,6 +402,8 @@ const ceres::Solver::Summary& BundleAdjuster::Summary() const {
 
 void BundleAdjuster::SetUp(Reconstruction* reconstruction,
                            ceres::LossFunction* loss_function) {
+  ComputeRigidMotions(reconstruction);
+
   // Warning: AddPointsToProblem assumes that AddImageToProblem is called first.
   // Do not change order of instructions!
   for (const image_t image_id : config_.Images()) {
@@ -313,10 +418,50 @@ void BundleAdjuster::SetUp(Reconstruction* reconstruction,
 
   ParameterizeCameras(reconstruction);
   ParameterizePoints(reconstruction);
+  ParameterizeRigidMotions(reconstruction);
+}
+
+void BundleAdjuster::TearDown(Reconstruction* reconstruction) {
+  // Compose the poses of the images with a rigid motion from the refined
+  // motions and poses of the base images.
+  for (const auto& rigid_motion : config_.RigidMotions()) {
+    Image& image = reconstruction->Image(rigid_motion.first);
+    const Image& base_image = reconstruction->Image(rigid_motion.second.first);
+    ConcatenatePoses(motion_qvecs_.at(rigid_motion.second.second),
+                     motion_tvecs_.at(rigid_motion.second.second),
+                     base_image.Qvec(), base_image.Tvec(), &image.Qvec(),
+                     &image.Tvec());
+  }
 }
 
-void BundleAdjuster::TearDown(Reconstruction*) {
-  // Nothing to do
+void BundleAdjuster::ComputeRigidMotions(Reconstruction* reconstruction) {
+  std::unordered_map<int, image_t> motion_image_ids;
+  for (const auto& rigid_motion : config_.RigidMotions()) {
+    const auto motion_image_id =
+        motion_image_ids.emplace(rigid_motion.second.second, rigid_motion.first);
+    if (!motion_image_id.second &&
+        rigid_motion.first < motion_image_id.first->second) {
+      motion_image_id.first->second = rigid_motion.first;
+    }
+  }
+
+  for (const auto& motion_image_id : motion_image_ids) {
+    Image& image = reconstruction->Image(motion_image_id.second);
+    Image& base_image = reconstruction->Image(
+        config_.RigidMotions().at(motion_image_id.second).first);
+    image.NormalizeQvec();
+    base_image.NormalizeQvec();
+    // The motion followed by the pose of the base image gives the pose of the
+    // image, i.e. the motion is the pose of the image followed by the inverse
+    // pose of the base image.
+    Eigen::Vector4d inv_base_qvec;
+    Eigen::Vector3d inv_base_tvec;
+    InvertPose(base_image.Qvec(), base_image.Tvec(), &inv_base_qvec,
+               &inv_base_tvec);
+    ConcatenatePoses(image.Qvec(), image.Tvec(), inv_base_qvec, inv_base_tvec,
+                     &motion_qvecs_[motion_image_id.first],
+                     &motion_tvecs_[motion_image_id.first]);
+  }
 }
 
 void BundleAdjuster::AddImageToProblem(const image_t image_id,
@@ -334,10 +479,24 @@ void BundleAdjuster::AddImageToProblem(const image_t image_id,
 
   const bool constant_pose = config_.HasConstantPose(image_id);
 
+  // The pose of an image with a rigid motion is composed of the shared motion
+  // and the pose of its base image, which replace the pose of the image.
+  const bool rigid_motion = config_.HasRigidMotion(image_id);
+  double* motion_qvec_data = nullptr;
+  double* motion_tvec_data = nullptr;
+  if (rigid_motion) {
+    const auto& motion = config_.RigidMotions().at(image_id);
+    Image& base_image = reconstruction->Image(motion.first);
+    qvec_data = base_image.Qvec().data();
+    tvec_data = base_image.Tvec().data();
+    motion_qvec_data = motion_qvecs_.at(motion.second).data();
+    motion_tvec_data = motion_tvecs_.at(motion.second).data();
+  }
+
   // Add residuals to bundle adjustment problem.
   size_t num_observations = 0;
   for (const Point2D& point2D : image.Points2D()) {
-    if (!point2D.HasPoint3D()) {
+    if (!point2D.HasPoint3D() || !config_.IsInPointSubset(point2D.Point3DId())) {
       continue;
     }
 
@@ -349,7 +508,26 @@ void BundleAdjuster::AddImageToProblem(const image_t image_id,
 
     ceres::CostFunction* cost_function = nullptr;
 
-    if (constant_pose) {
+    if (rigid_motion) {
+      // The motion takes the place of the rig pose and the pose of the base
+      // image the place of the relative pose of the camera in the rig.
+      switch (camera.ModelId()) {
+#define CAMERA_MODEL_CASE(CameraModel)                                      \
+  case CameraModel::kModelId:                                               \
+    cost_function =                                                         \
+        RigBundleAdjustmentCostFunction<CameraModel>::Create(point2D.XY()); \
+    break;
+
+        CAMERA_MODEL_SWITCH_CASES
+
+#undef CAMERA_MODEL_CASE
+      }
+
+      problem_->AddResidualBlock(cost_function, loss_function,
+                                 motion_qvec_data, motion_tvec_data, qvec_data,
+                                 tvec_data, point3D.XYZ().data(),
+                                 camera_params_data);
+    } else if (constant_pose) {
       switch (camera.ModelId()) {
 #define CAMERA_MODEL_CASE(CameraModel)                                 \
   case CameraModel::kModelId:                                          \
@@ -387,8 +565,9 @@ void BundleAdjuster::AddImageToProblem(const image_t image_id,
   if (num_observations > 0) {
     camera_ids_.insert(image.CameraId());
 
-    // Set pose parameterization.
-    if (!constant_pose) {
+    // Set pose parameterization. The poses of the base images and the motions
+    // are parameterized once all images are added.
+    if (!constant_pose && !rigid_motion) {
       ceres::LocalParameterization* quaternion_parameterization =
           new ceres::QuaternionParameterization;
       problem_->SetParameterization(qvec_data, quaternion_parameterization);
@@ -508,6 +687,480 @@ void BundleAdjuster::ParameterizePoints(Reconstruction* reconstruction) {
   }
 }
 
+void BundleAdjuster::ParameterizeRigidMotions(Reconstruction* reconstruction) {
+  std::unordered_set<int> motion_idxs;
+  std::unordered_set<image_t> base_image_ids;
+  for (const auto& rigid_motion : config_.RigidMotions()) {
+    const image_t base_image_id = rigid_motion.second.first;
+    const int motion_idx = rigid_motion.second.second;
+
+    double* motion_qvec_data = motion_qvecs_.at(motion_idx).data();
+    if (!problem_->HasParameterBlock(motion_qvec_data)) {
+      continue;
+    }
+    if (motion_idxs.insert(motion_idx).second) {
+      problem_->SetParameterization(motion_qvec_data,
+                                    new ceres::QuaternionParameterization);
+    }
+
+    if (!base_image_ids.insert(base_image_id).second) {
+      continue;
+    }
+    Image& base_image = reconstruction->Image(base_image_id);
+    double* qvec_data = base_image.Qvec().data();
+    double* tvec_data = base_image.Tvec().data();
+    if (!problem_->HasParameterBlock(qvec_data)) {
+      continue;
+    }
+
+    // The base image is already parameterized if it has observations itself.
+    if (config_.HasConstantPose(base_image_id)) {
+      problem_->SetParameterBlockConstant(qvec_data);
+      problem_->SetParameterBlockConstant(tvec_data);
+    } else if (problem_->GetParameterization(qvec_data) == nullptr) {
+      problem_->SetParameterization(qvec_data,
+                                    new ceres::QuaternionParameterization);
+      if (config_.HasConstantTvec(base_image_id)) {
+        problem_->SetParameterization(
+            tvec_data, new ceres::SubsetParameterization(
+                           3, config_.ConstantTvec(base_image_id)));
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// IncrementalBundleAdjuster
+////////////////////////////////////////////////////////////////////////////////
+
+IncrementalBundleAdjuster::IncrementalBundleAdjuster()
+    : reconstruction_(nullptr),
+      num_added_residuals_(0),
+      num_removed_residuals_(0) {}
+
+bool IncrementalBundleAdjuster::Solve(const BundleAdjustmentOptions& options,
+                                      const BundleAdjustmentConfig& config,
+                                      Reconstruction* reconstruction) {
+  TRACE_SCOPE("IncrementalBundleAdjuster::Solve");
+  CHECK_NOTNULL(reconstruction);
+  CHECK(options.Check());
+  CHECK_EQ(config.NumConstantPoints(), 0)
+      << "IncrementalBundleAdjuster does not allow constant 3D points";
+  CHECK_EQ(config.NumRigidMotions(), 0)
+      << "IncrementalBundleAdjuster does not support rigid motions";
+
+  if (NeedsReset(options, config, *reconstruction)) {
+    Reset();
+    for (const image_t image_id : config.Images()) {
+      if (config.HasConstantTvec(image_id)) {
+        constant_tvecs_.emplace(image_id, config.ConstantTvec(image_id));
+      }
+    }
+    reconstruction_ = reconstruction;
+
+    // The loss function is shared by all residuals, of which many are removed
+    // over the lifetime of the problem. Fast removal avoids a linear scan of
+    // all residuals per removal.
+    ceres::Problem::Options problem_options;
+    problem_options.enable_fast_removal = true;
+    problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_.reset(new ceres::Problem(problem_options));
+    loss_function_.reset(new ceres::LossFunctionWrapper(
+        options.CreateLossFunction(), ceres::TAKE_OWNERSHIP));
+  } else if (options.loss_function_type != options_.loss_function_type ||
+             options.loss_function_scale != options_.loss_function_scale) {
+    // E.g. the robust loss of the first refinement iteration is replaced by
+    // the trivial loss, which does not change the structure of the problem.
+    loss_function_->Reset(options.CreateLossFunction(), ceres::TAKE_OWNERSHIP);
+  }
+
+  options_ = options;
+
+  // The images outside of the configuration, whose observations of the
+  // variable points are added with a constant pose.
+  std::unordered_set<image_t> external_image_ids;
+  for (const point3D_t point3D_id : config.VariablePoints()) {
+    for (const TrackElement& track_el :
+         reconstruction->Point3D(point3D_id).Track().Elements()) {
+      if (!config.HasImage(track_el.image_id)) {
+        external_image_ids.insert(track_el.image_id);
+      }
+    }
+  }
+
+  num_added_residuals_ = 0;
+  num_removed_residuals_ = 0;
+
+  // Warning: The residuals must be removed before any are added, since the
+  // memory of deleted 3D points may be reused by new 3D points, which would
+  // otherwise be mistaken for existing parameter blocks.
+  RemoveDeletedResiduals(config, external_image_ids, reconstruction);
+  AddNewResiduals(config, external_image_ids, reconstruction);
+  ParameterizeCameras(config, reconstruction);
+  ParameterizePoints(reconstruction);
+
+  if (problem_->NumResiduals() == 0) {
+    return false;
+  }
+
+  ceres::Solver::Options solver_options = options.solver_options;
+
+  // Empirical choice.
+  const size_t kMaxNumImagesDirectDenseSolver = 50;
+  const size_t kMaxNumImagesDirectSparseSolver = 1000;
+  const size_t num_images = config.NumImages();
+  if (num_images <= kMaxNumImagesDirectDenseSolver) {
+    solver_options.linear_solver_type = ceres::DENSE_SCHUR;
+  } else if (num_images <= kMaxNumImagesDirectSparseSolver) {
+    solver_options.linear_solver_type = ceres::SPARSE_SCHUR;
+  } else {  // Indirect sparse (preconditioned CG) solver.
+    solver_options.linear_solver_type = ceres::ITERATIVE_SCHUR;
+    solver_options.preconditioner_type = ceres::SCHUR_JACOBI;
+  }
+
+#ifdef OPENMP_ENABLED
+  if (solver_options.num_threads <= 0) {
+    solver_options.num_threads = omp_get_max_threads();
+  }
+  if (solver_options.num_linear_solver_threads <= 0) {
+    solver_options.num_linear_solver_threads = omp_get_max_threads();
+  }
+#else
+  solver_options.num_threads = 1;
+  solver_options.num_linear_solver_threads = 1;
+#endif
+
+  std::string solver_error;
+  CHECK(solver_options.IsValid(&solver_error)) << solver_error;
+
+  if (options.use_mixed_precision_solver) {
+    std::vector<double*> point_blocks;
+    point_blocks.reserve(point3D_blocks_.size());
+    for (const auto& point3D_block : point3D_blocks_) {
+      point_blocks.push_back(point3D_block.second.data);
+    }
+    SolveMixedPrecision(solver_options, point_blocks, problem_.get(),
+                        &summary_);
+  } else {
+    ceres::Solve(solver_options, problem_.get(), &summary_);
+  }
+  RecordSolverMetrics(summary_);
+
+  if (solver_options.minimizer_progress_to_stdout) {
+    std::cout << std::endl;
+  }
+
+  if (options.print_summary) {
+    PrintHeading2("Incremental bundle adjustment report");
+    std::cout << std::right << std::setw(16) << "Added residuals : ";
+    std::cout << std::left << num_added_residuals_ << std::endl;
+    std::cout << std::right << std::setw(16) << "Removed residuals : ";
+    std::cout << std::left << num_removed_residuals_ << std::endl;
+    PrintSolverSummary(summary_);
+  }
+
+  return true;
+}
+
+void IncrementalBundleAdjuster::Reset() {
+  problem_.reset();
+  loss_function_.reset();
+  constant_tvecs_.clear();
+  reconstruction_ = nullptr;
+  image_blocks_.clear();
+  camera_blocks_.clear();
+  point3D_blocks_.clear();
+}
+
+const ceres::Solver::Summary& IncrementalBundleAdjuster::Summary() const {
+  return summary_;
+}
+
+size_t IncrementalBundleAdjuster::NumAddedResiduals() const {
+  return num_added_residuals_;
+}
+
+size_t IncrementalBundleAdjuster::NumRemovedResiduals() const {
+  return num_removed_residuals_;
+}
+
+bool IncrementalBundleAdjuster::NeedsReset(
+    const BundleAdjustmentOptions& options,
+    const BundleAdjustmentConfig& config,
+    const Reconstruction& reconstruction) const {
+  if (!problem_ || reconstruction_ != &reconstruction) {
+    return true;
+  }
+
+  // The camera parameterizations are set up once.
+  if (options.refine_focal_length != options_.refine_focal_length ||
+      options.refine_principal_point != options_.refine_principal_point ||
+      options.refine_extra_params != options_.refine_extra_params) {
+    return true;
+  }
+
+  // The tvec parameterizations cannot be changed, as opposed to the constant
+  // poses, which are changed in place.
+  size_t num_constant_tvecs = 0;
+  for (const image_t image_id : config.Images()) {
+    if (config.HasConstantTvec(image_id)) {
+      const auto it = constant_tvecs_.find(image_id);
+      if (it == constant_tvecs_.end() ||
+          it->second != config.ConstantTvec(image_id)) {
+        return true;
+      }
+      num_constant_tvecs += 1;
+    }
+  }
+  if (num_constant_tvecs != constant_tvecs_.size()) {
+    return true;
+  }
+
+  // Changing the camera model reallocates its parameters.
+  for (const auto& camera_block : camera_blocks_) {
+    if (!reconstruction.ExistsCamera(camera_block.first) ||
+        reconstruction.Camera(camera_block.first).ParamsData() !=
+            camera_block.second.data) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void IncrementalBundleAdjuster::RemoveDeletedResiduals(
+    const BundleAdjustmentConfig& config,
+    const std::unordered_set<image_t>& external_image_ids,
+    Reconstruction* reconstruction) {
+  for (auto it = image_blocks_.begin(); it != image_blocks_.end();) {
+    ImageBlock& image_block = it->second;
+    const bool external = external_image_ids.count(it->first) > 0;
+    if ((!config.HasImage(it->first) && !external) ||
+        !reconstruction->ExistsImage(it->first) ||
+        reconstruction->Image(it->first).NumPoints2D() !=
+            image_block.point3D_ids.size()) {
+      for (size_t i = 0; i < image_block.residual_block_ids.size(); ++i) {
+        if (image_block.residual_block_ids[i] != nullptr) {
+          RemoveResidual(&image_block, i);
+        }
+      }
+      problem_->RemoveParameterBlock(image_block.qvec_data);
+      problem_->RemoveParameterBlock(image_block.tvec_data);
+      it = image_blocks_.erase(it);
+      continue;
+    }
+
+    const Image& image = reconstruction->Image(it->first);
+    for (point2D_t point2D_idx = 0; point2D_idx < image.NumPoints2D();
+         ++point2D_idx) {
+      if (image_block.residual_block_ids[point2D_idx] == nullptr) {
+        continue;
+      }
+      const class Point2D& point2D = image.Point2D(point2D_idx);
+      if (!point2D.HasPoint3D() ||
+          point2D.Point3DId() != image_block.point3D_ids[point2D_idx] ||
+          (external && !config.HasVariablePoint(point2D.Point3DId()))) {
+        RemoveResidual(&image_block, point2D_idx);
+      }
+    }
+
+    ++it;
+  }
+}
+
+void IncrementalBundleAdjuster::AddNewResiduals(
+    const BundleAdjustmentConfig& config,
+    const std::unordered_set<image_t>& external_image_ids,
+    Reconstruction* reconstruction) {
+  for (const image_t image_id : config.Images()) {
+    AddImageResiduals(config, image_id, false, reconstruction);
+  }
+  for (const image_t image_id : external_image_ids) {
+    AddImageResiduals(config, image_id, true, reconstruction);
+  }
+}
+
+void IncrementalBundleAdjuster::AddImageResiduals(
+    const BundleAdjustmentConfig& config, const image_t image_id,
+    const bool external, Reconstruction* reconstruction) {
+  Image& image = reconstruction->Image(image_id);
+  Camera& camera = reconstruction->Camera(image.CameraId());
+
+  // CostFunction assumes unit quaternions.
+  image.NormalizeQvec();
+
+  auto image_block_it = image_blocks_.find(image_id);
+  if (image_block_it == image_blocks_.end()) {
+    ImageBlock image_block;
+    image_block.qvec_data = image.Qvec().data();
+    image_block.tvec_data = image.Tvec().data();
+    image_block.camera_id = image.CameraId();
+    image_block.point3D_ids.resize(image.NumPoints2D(), kInvalidPoint3DId);
+    image_block.residual_block_ids.resize(image.NumPoints2D(), nullptr);
+
+    problem_->AddParameterBlock(image_block.qvec_data, 4,
+                                new ceres::QuaternionParameterization);
+    if (config.HasConstantTvec(image_id)) {
+      problem_->AddParameterBlock(
+          image_block.tvec_data, 3,
+          new ceres::SubsetParameterization(3,
+                                            config.ConstantTvec(image_id)));
+    } else {
+      problem_->AddParameterBlock(image_block.tvec_data, 3);
+    }
+
+    image_block_it = image_blocks_.emplace(image_id, image_block).first;
+  }
+
+  ImageBlock& image_block = image_block_it->second;
+
+  for (point2D_t point2D_idx = 0; point2D_idx < image.NumPoints2D();
+       ++point2D_idx) {
+    const class Point2D& point2D = image.Point2D(point2D_idx);
+    if (!point2D.HasPoint3D() ||
+        image_block.residual_block_ids[point2D_idx] != nullptr ||
+        (external && !config.HasVariablePoint(point2D.Point3DId()))) {
+      continue;
+    }
+
+    class Point3D& point3D = reconstruction->Point3D(point2D.Point3DId());
+
+    ceres::CostFunction* cost_function = nullptr;
+
+    switch (camera.ModelId()) {
+#define CAMERA_MODEL_CASE(CameraModel)                                   \
+  case CameraModel::kModelId:                                            \
+    cost_function =                                                      \
+        BundleAdjustmentCostFunction<CameraModel>::Create(point2D.XY()); \
+    break;
+
+      CAMERA_MODEL_SWITCH_CASES
+
+#undef CAMERA_MODEL_CASE
+    }
+
+    const bool new_camera = camera_blocks_.count(image.CameraId()) == 0;
+
+    image_block.residual_block_ids[point2D_idx] = problem_->AddResidualBlock(
+        cost_function, loss_function_.get(), image_block.qvec_data,
+        image_block.tvec_data, point3D.XYZ().data(), camera.ParamsData());
+    image_block.point3D_ids[point2D_idx] = point2D.Point3DId();
+    num_added_residuals_ += 1;
+
+    ParameterBlock& point3D_block = point3D_blocks_[point2D.Point3DId()];
+    point3D_block.data = point3D.XYZ().data();
+    point3D_block.num_residuals += 1;
+
+    ParameterBlock& camera_block = camera_blocks_[image.CameraId()];
+    camera_block.data = camera.ParamsData();
+    camera_block.num_residuals += 1;
+
+    if (new_camera) {
+      SetCameraParameterization(&camera);
+    }
+  }
+
+  if (external || config.HasConstantPose(image_id)) {
+    problem_->SetParameterBlockConstant(image_block.qvec_data);
+    problem_->SetParameterBlockConstant(image_block.tvec_data);
+  } else {
+    problem_->SetParameterBlockVariable(image_block.qvec_data);
+    problem_->SetParameterBlockVariable(image_block.tvec_data);
+  }
+}
+
+void IncrementalBundleAdjuster::RemoveResidual(ImageBlock* image_block,
+                                               const size_t point2D_idx) {
+  problem_->RemoveResidualBlock(image_block->residual_block_ids[point2D_idx]);
+  image_block->residual_block_ids[point2D_idx] = nullptr;
+  num_removed_residuals_ += 1;
+
+  // Parameter blocks without residuals are removed, since their memory may be
+  // freed before the next call to `Solve`.
+  const auto point3D_block_it =
+      point3D_blocks_.find(image_block->point3D_ids[point2D_idx]);
+  point3D_block_it->second.num_residuals -= 1;
+  if (point3D_block_it->second.num_residuals == 0) {
+    problem_->RemoveParameterBlock(point3D_block_it->second.data);
+    point3D_blocks_.erase(point3D_block_it);
+  }
+  image_block->point3D_ids[point2D_idx] = kInvalidPoint3DId;
+
+  const auto camera_block_it = camera_blocks_.find(image_block->camera_id);
+  camera_block_it->second.num_residuals -= 1;
+  if (camera_block_it->second.num_residuals == 0) {
+    problem_->RemoveParameterBlock(camera_block_it->second.data);
+    camera_blocks_.erase(camera_block_it);
+  }
+}
+
+void IncrementalBundleAdjuster::SetCameraParameterization(Camera* camera) {
+  std::vector<int> const_camera_params;
+
+  if (!options_.refine_focal_length) {
+    const std::vector<size_t>& params_idxs = camera->FocalLengthIdxs();
+    const_camera_params.insert(const_camera_params.end(), params_idxs.begin(),
+                               params_idxs.end());
+  }
+  if (!options_.refine_principal_point) {
+    const std::vector<size_t>& params_idxs = camera->PrincipalPointIdxs();
+    const_camera_params.insert(const_camera_params.end(), params_idxs.begin(),
+                               params_idxs.end());
+  }
+  if (!options_.refine_extra_params) {
+    const std::vector<size_t>& params_idxs = camera->ExtraParamsIdxs();
+    const_camera_params.insert(const_camera_params.end(), params_idxs.begin(),
+                               params_idxs.end());
+  }
+
+  // A camera without any refined parameters is set constant instead.
+  if (const_camera_params.size() > 0 &&
+      const_camera_params.size() < camera->NumParams()) {
+    ceres::SubsetParameterization* camera_params_parameterization =
+        new ceres::SubsetParameterization(static_cast<int>(camera->NumParams()),
+                                          const_camera_params);
+    problem_->SetParameterization(camera->ParamsData(),
+                                  camera_params_parameterization);
+  }
+}
+
+void IncrementalBundleAdjuster::ParameterizeCameras(
+    const BundleAdjustmentConfig& config, Reconstruction* reconstruction) {
+  const bool constant_camera = !options_.refine_focal_length &&
+                               !options_.refine_principal_point &&
+                               !options_.refine_extra_params;
+
+  // The cameras that are only observed in the external images are constant.
+  std::unordered_set<camera_t> config_camera_ids;
+  for (const image_t image_id : config.Images()) {
+    config_camera_ids.insert(reconstruction->Image(image_id).CameraId());
+  }
+
+  for (const auto& camera_block : camera_blocks_) {
+    if (constant_camera || config.IsConstantCamera(camera_block.first) ||
+        config_camera_ids.count(camera_block.first) == 0) {
+      problem_->SetParameterBlockConstant(camera_block.second.data);
+    } else {
+      problem_->SetParameterBlockVariable(camera_block.second.data);
+    }
+  }
+}
+
+void IncrementalBundleAdjuster::ParameterizePoints(
+    Reconstruction* reconstruction) {
+  // The observations of a point outside of the configured images are only part
+  // of the problem for the variable points, so that the other points are kept
+  // constant as in BundleAdjuster.
+  for (const auto& point3D_block : point3D_blocks_) {
+    const Point3D& point3D = reconstruction->Point3D(point3D_block.first);
+    if (point3D.Track().Length() > point3D_block.second.num_residuals) {
+      problem_->SetParameterBlockConstant(point3D_block.second.data);
+    } else {
+      problem_->SetParameterBlockVariable(point3D_block.second.data);
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // ParallelBundleAdjuster
 ////////////////////////////////////////////////////////////////////////////////
@@ -537,6 +1190,7 @@ ParallelBundleAdjuster::ParallelBundleAdjuster(
 }
 
 bool ParallelBundleAdjuster::Solve(Reconstruction* reconstruction) {
+  TRACE_SCOPE("ParallelBundleAdjuster::Solve");
   CHECK_NOTNULL(reconstruction);
   CHECK_EQ(num_measurements_, 0)
       << "Cannot use the same ParallelBundleAdjuster multiple times";
@@ -597,6 +1251,7 @@ bool ParallelBundleAdjuster::Solve(Reconstruction* reconstruction) {
   summary_.final_cost =
       pba_config->GetFinalMSE() * summary_.num_residuals_reduced / 4;
   summary_.total_time_in_seconds = timer.ElapsedSeconds();
+  RecordSolverMetrics(summary_);
 
   TearDown(reconstruction);
 
@@ -758,13 +1413,22 @@ void ParallelBundleAdjuster::AddPointsToProblem(
 // RigBundleAdjuster
 ////////////////////////////////////////////////////////////////////////////////
 
+bool RigBundleAdjuster::Options::Check() const {
+  CHECK_OPTION_GE(max_reproj_error, 0);
+  CHECK_OPTION_NE(num_threads, 0);
+  return true;
+}
+
 RigBundleAdjuster::RigBundleAdjuster(const BundleAdjustmentOptions& options,
                                      const Options& rig_options,
                                      const BundleAdjustmentConfig& config)
-    : BundleAdjuster(options, config), rig_options_(rig_options) {}
+    : BundleAdjuster(options, config), rig_options_(rig_options) {
+  CHECK(rig_options_.Check());
+}
 
 bool RigBundleAdjuster::Solve(Reconstruction* reconstruction,
                               std::vector<CameraRig>* camera_rigs) {
+  TRACE_SCOPE("RigBundleAdjuster::Solve");
   CHECK_NOTNULL(reconstruction);
   CHECK_NOTNULL(camera_rigs);
   CHECK(!problem_) << "Cannot use the same BundleAdjuster multiple times";
@@ -803,15 +1467,20 @@ bool RigBundleAdjuster::Solve(Reconstruction* reconstruction,
   const size_t kMaxNumImagesDirectDenseSolver = 50;
   const size_t kMaxNumImagesDirectSparseSolver = 1000;
   const size_t num_images = config_.NumImages();
-  if (num_images <= kMaxNumImagesDirectDenseSolver) {
-    solver_options.linear_solver_type = ceres::DENSE_SCHUR;
-  } else if (num_images <= kMaxNumImagesDirectSparseSolver) {
-    solver_options.linear_solver_type = ceres::SPARSE_SCHUR;
-  } else {  // Indirect sparse (preconditioned CG) solver.
+  if (rig_options_.use_iterative_solver ||
+      num_images > kMaxNumImagesDirectSparseSolver) {
+    // Indirect sparse (preconditioned CG) solver.
     solver_options.linear_solver_type = ceres::ITERATIVE_SCHUR;
     solver_options.preconditioner_type = ceres::SCHUR_JACOBI;
+  } else if (num_images <= kMaxNumImagesDirectDenseSolver) {
+    solver_options.linear_solver_type = ceres::DENSE_SCHUR;
+  } else {
+    solver_options.linear_solver_type = ceres::SPARSE_SCHUR;
   }
 
+  solver_options.linear_solver_ordering.reset(
+      CreateParameterBlockOrdering(reconstruction, *camera_rigs));
+
 #ifdef OPENMP_ENABLED
   if (solver_options.num_threads <= 0) {
     solver_options.num_threads = omp_get_max_threads();
@@ -827,7 +1496,19 @@ bool RigBundleAdjuster::Solve(Reconstruction* reconstruction,
   std::string solver_error;
   CHECK(solver_options.IsValid(&solver_error)) << solver_error;
 
-  ceres::Solve(solver_options, problem_.get(), &summary_);
+  if (options_.use_mixed_precision_solver) {
+    std::vector<double*> point_blocks;
+    point_blocks.reserve(point3D_num_observations_.size());
+    for (const auto& elem : point3D_num_observations_) {
+      point_blocks.push_back(
+          reconstruction->Point3D(elem.first).XYZ().data());
+    }
+    SolveMixedPrecision(solver_options, point_blocks, problem_.get(),
+                        &summary_);
+  } else {
+    ceres::Solve(solver_options, problem_.get(), &summary_);
+  }
+  RecordSolverMetrics(summary_);
 
   if (solver_options.minimizer_progress_to_stdout) {
     std::cout << std::endl;
@@ -848,8 +1529,41 @@ void RigBundleAdjuster::SetUp(Reconstruction* reconstruction,
                               ceres::LossFunction* loss_function) {
   ComputeCameraRigPoses(*reconstruction, *camera_rigs);
 
-  for (const image_t image_id : config_.Images()) {
-    AddImageToProblem(image_id, reconstruction, camera_rigs, loss_function);
+  // Select the observations and create the cost functions of the images in
+  // parallel, while the problem is only modified by this thread. The residuals
+  // are added in the order of the images, as ceres::Problem is not
+  // thread-safe.
+  const std::vector<image_t> image_ids(config_.Images().begin(),
+                                       config_.Images().end());
+  std::vector<ImageResiduals> image_residuals(image_ids.size());
+
+  const int num_threads =
+      std::min(GetEffectiveNumThreads(rig_options_.num_threads),
+               static_cast<int>(image_ids.size()));
+  if (num_threads <= 1) {
+    for (size_t i = 0; i < image_ids.size(); ++i) {
+      CreateImageResiduals(image_ids[i], reconstruction, &image_residuals[i]);
+    }
+  } else {
+    ThreadPool thread_pool(num_threads);
+    std::vector<std::future<void>> futures;
+    futures.reserve(image_ids.size());
+    for (size_t i = 0; i < image_ids.size(); ++i) {
+      futures.push_back(thread_pool.AddTask([&, i]() {
+        CreateImageResiduals(image_ids[i], reconstruction, &image_residuals[i]);
+      }));
+    }
+    for (auto& future : futures) {
+      future.get();
+    }
+  }
+
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    AddImageToProblem(image_ids[i], image_residuals[i], reconstruction,
+                      loss_function);
+    // Release the bookkeeping of the image as soon as the problem owns the
+    // cost functions.
+    image_residuals[i] = ImageResiduals();
   }
   for (const auto point3D_id : config_.VariablePoints()) {
     AddPointToProblem(point3D_id, reconstruction, loss_function);
@@ -877,34 +1591,21 @@ void RigBundleAdjuster::TearDown(Reconstruction* reconstruction,
   }
 }
 
-void RigBundleAdjuster::AddImageToProblem(const image_t image_id,
-                                          Reconstruction* reconstruction,
-                                          std::vector<CameraRig>* camera_rigs,
-                                          ceres::LossFunction* loss_function) {
+void RigBundleAdjuster::CreateImageResiduals(
+    const image_t image_id, Reconstruction* reconstruction,
+    ImageResiduals* residuals) const {
   Image& image = reconstruction->Image(image_id);
-  Camera& camera = reconstruction->Camera(image.CameraId());
+  const Camera& camera = reconstruction->Camera(image.CameraId());
 
   const bool constant_pose = config_.HasConstantPose(image_id);
-  const bool constant_tvec = config_.HasConstantTvec(image_id);
-
-  double* qvec_data = nullptr;
-  double* tvec_data = nullptr;
-  double* rig_qvec_data = nullptr;
-  double* rig_tvec_data = nullptr;
-  double* camera_params_data = camera.ParamsData();
-  CameraRig* camera_rig = nullptr;
+  const auto camera_rig = image_id_to_camera_rig_.find(image_id);
   Eigen::Matrix3x4d rig_proj_matrix = Eigen::Matrix3x4d::Zero();
 
-  if (image_id_to_camera_rig_.count(image_id) > 0) {
+  if (camera_rig != image_id_to_camera_rig_.end()) {
     CHECK(!constant_pose)
         << "Images contained in a camera rig must not have constant pose";
-    CHECK(!constant_tvec)
+    CHECK(!config_.HasConstantTvec(image_id))
         << "Images contained in a camera rig must not have constant tvec";
-    camera_rig = image_id_to_camera_rig_.at(image_id);
-    rig_qvec_data = image_id_to_rig_qvec_.at(image_id)->data();
-    rig_tvec_data = image_id_to_rig_tvec_.at(image_id)->data();
-    qvec_data = camera_rig->RelativeQvec(image.CameraId()).data();
-    tvec_data = camera_rig->RelativeTvec(image.CameraId()).data();
 
     // Concatenate the absolute pose of the rig and the relative pose the camera
     // within the rig to detect outlier observations.
@@ -912,47 +1613,29 @@ void RigBundleAdjuster::AddImageToProblem(const image_t image_id,
     Eigen::Vector3d rig_concat_tvec;
     ConcatenatePoses(*image_id_to_rig_qvec_.at(image_id),
                      *image_id_to_rig_tvec_.at(image_id),
-                     camera_rig->RelativeQvec(image.CameraId()),
-                     camera_rig->RelativeTvec(image.CameraId()),
+                     camera_rig->second->RelativeQvec(image.CameraId()),
+                     camera_rig->second->RelativeTvec(image.CameraId()),
                      &rig_concat_qvec, &rig_concat_tvec);
     rig_proj_matrix = ComposeProjectionMatrix(rig_concat_qvec, rig_concat_tvec);
   } else {
     // CostFunction assumes unit quaternions.
     image.NormalizeQvec();
-    qvec_data = image.Qvec().data();
-    tvec_data = image.Tvec().data();
   }
 
-  // Collect cameras for final parameterization.
-  CHECK(image.HasCamera());
-  camera_ids_.insert(image.CameraId());
+  residuals->point3D_ids.reserve(image.NumPoints3D());
+  residuals->cost_functions.reserve(image.NumPoints3D());
 
-  // The number of added observations for the current image.
-  size_t num_observations = 0;
-
-  // Add residuals to bundle adjustment problem.
   for (const Point2D& point2D : image.Points2D()) {
     if (!point2D.HasPoint3D()) {
       continue;
     }
 
-    Point3D& point3D = reconstruction->Point3D(point2D.Point3DId());
+    const Point3D& point3D = reconstruction->Point3D(point2D.Point3DId());
     assert(point3D.Track().Length() > 1);
 
-    if (camera_rig != nullptr &&
-        (!HasPointPositiveDepth(rig_proj_matrix, point3D.XYZ()) ||
-         CalculateReprojectionError(point2D.XY(), point3D.XYZ(),
-                                    rig_proj_matrix,
-                                    camera) > rig_options_.max_reproj_error)) {
-      continue;
-    }
-
-    num_observations += 1;
-    point3D_num_observations_[point2D.Point3DId()] += 1;
-
     ceres::CostFunction* cost_function = nullptr;
 
-    if (camera_rig == nullptr) {
+    if (camera_rig == image_id_to_camera_rig_.end()) {
       if (constant_pose) {
         switch (camera.ModelId()) {
 #define CAMERA_MODEL_CASE(CameraModel)                                 \
@@ -966,9 +1649,6 @@ void RigBundleAdjuster::AddImageToProblem(const image_t image_id,
 
 #undef CAMERA_MODEL_CASE
         }
-
-        problem_->AddResidualBlock(cost_function, loss_function,
-                                   point3D.XYZ().data(), camera_params_data);
       } else {
         switch (camera.ModelId()) {
 #define CAMERA_MODEL_CASE(CameraModel)                                   \
@@ -981,12 +1661,15 @@ void RigBundleAdjuster::AddImageToProblem(const image_t image_id,
 
 #undef CAMERA_MODEL_CASE
         }
-
-        problem_->AddResidualBlock(cost_function, loss_function, qvec_data,
-                                   tvec_data, point3D.XYZ().data(),
-                                   camera_params_data);
       }
     } else {
+      if (!HasPointPositiveDepth(rig_proj_matrix, point3D.XYZ()) ||
+          CalculateReprojectionError(point2D.XY(), point3D.XYZ(),
+                                     rig_proj_matrix, camera) >
+              rig_options_.max_reproj_error) {
+        continue;
+      }
+
       switch (camera.ModelId()) {
 #define CAMERA_MODEL_CASE(CameraModel)                                      \
   case CameraModel::kModelId:                                               \
@@ -999,13 +1682,66 @@ void RigBundleAdjuster::AddImageToProblem(const image_t image_id,
 
 #undef CAMERA_MODEL_CASE
       }
-      problem_->AddResidualBlock(cost_function, loss_function, rig_qvec_data,
-                                 rig_tvec_data, qvec_data, tvec_data,
-                                 point3D.XYZ().data(), camera_params_data);
     }
+
+    residuals->point3D_ids.push_back(point2D.Point3DId());
+    residuals->cost_functions.push_back(cost_function);
   }
+}
 
-  if (num_observations > 0) {
+void RigBundleAdjuster::AddImageToProblem(const image_t image_id,
+                                          const ImageResiduals& residuals,
+                                          Reconstruction* reconstruction,
+                                          ceres::LossFunction* loss_function) {
+  Image& image = reconstruction->Image(image_id);
+  Camera& camera = reconstruction->Camera(image.CameraId());
+
+  const bool constant_pose = config_.HasConstantPose(image_id);
+  const bool constant_tvec = config_.HasConstantTvec(image_id);
+
+  double* qvec_data = nullptr;
+  double* tvec_data = nullptr;
+  double* rig_qvec_data = nullptr;
+  double* rig_tvec_data = nullptr;
+  double* camera_params_data = camera.ParamsData();
+  CameraRig* camera_rig = nullptr;
+
+  if (image_id_to_camera_rig_.count(image_id) > 0) {
+    camera_rig = image_id_to_camera_rig_.at(image_id);
+    rig_qvec_data = image_id_to_rig_qvec_.at(image_id)->data();
+    rig_tvec_data = image_id_to_rig_tvec_.at(image_id)->data();
+    qvec_data = camera_rig->RelativeQvec(image.CameraId()).data();
+    tvec_data = camera_rig->RelativeTvec(image.CameraId()).data();
+  } else {
+    qvec_data = image.Qvec().data();
+    tvec_data = image.Tvec().data();
+  }
+
+  // Collect cameras for final parameterization.
+  CHECK(image.HasCamera());
+  camera_ids_.insert(image.CameraId());
+
+  // Add residuals to bundle adjustment problem.
+  for (size_t i = 0; i < residuals.cost_functions.size(); ++i) {
+    const point3D_t point3D_id = residuals.point3D_ids[i];
+    double* point3D_data = reconstruction->Point3D(point3D_id).XYZ().data();
+    point3D_num_observations_[point3D_id] += 1;
+
+    if (camera_rig != nullptr) {
+      problem_->AddResidualBlock(residuals.cost_functions[i], loss_function,
+                                 rig_qvec_data, rig_tvec_data, qvec_data,
+                                 tvec_data, point3D_data, camera_params_data);
+    } else if (constant_pose) {
+      problem_->AddResidualBlock(residuals.cost_functions[i], loss_function,
+                                 point3D_data, camera_params_data);
+    } else {
+      problem_->AddResidualBlock(residuals.cost_functions[i], loss_function,
+                                 qvec_data, tvec_data, point3D_data,
+                                 camera_params_data);
+    }
+  }
+
+  if (!residuals.cost_functions.empty()) {
     parameterized_qvec_data_.insert(qvec_data);
 
     if (camera_rig != nullptr) {
@@ -1116,6 +1852,549 @@ void RigBundleAdjuster::ParameterizeCameraRigs(Reconstruction* reconstruction) {
   }
 }
 
+ceres::ParameterBlockOrdering* RigBundleAdjuster::CreateParameterBlockOrdering(
+    Reconstruction* reconstruction,
+    const std::vector<CameraRig>& camera_rigs) const {
+  // The relative poses of the rigs and the camera parameters are shared by the
+  // residuals of many snapshots and thus couple most of the other blocks in
+  // the reduced camera system.
+  std::unordered_set<const double*> shared_blocks;
+  for (const auto& camera_rig : camera_rigs) {
+    for (const auto camera_id : camera_rig.GetCameraIds()) {
+      shared_blocks.insert(camera_rig.RelativeQvec(camera_id).data());
+      shared_blocks.insert(camera_rig.RelativeTvec(camera_id).data());
+    }
+  }
+  for (const camera_t camera_id : camera_ids_) {
+    shared_blocks.insert(reconstruction->Camera(camera_id).ParamsData());
+  }
+
+  std::unordered_set<const double*> point_blocks;
+  point_blocks.reserve(point3D_num_observations_.size());
+  for (const auto& elem : point3D_num_observations_) {
+    point_blocks.insert(reconstruction->Point3D(elem.first).XYZ().data());
+  }
+
+  // Eliminate the points first, as usual. In the reduced camera system, the
+  // absolute poses of the snapshots and the images without rig come before
+  // the shared blocks, which limits the fill-in of the sparse factorization.
+  ceres::ParameterBlockOrdering* ordering = new ceres::ParameterBlockOrdering;
+  std::vector<double*> parameter_blocks;
+  problem_->GetParameterBlocks(&parameter_blocks);
+  for (double* parameter_block : parameter_blocks) {
+    if (point_blocks.count(parameter_block) > 0) {
+      ordering->AddElementToGroup(parameter_block, 0);
+    } else if (shared_blocks.count(parameter_block) > 0) {
+      ordering->AddElementToGroup(parameter_block, 2);
+    } else {
+      ordering->AddElementToGroup(parameter_block, 1);
+    }
+  }
+
+  return ordering;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// TwoBodyBundleAdjuster
+////////////////////////////////////////////////////////////////////////////////
+
+TwoBodyBundleAdjuster::TwoBodyBundleAdjuster(
+    const BundleAdjustmentOptions& options, const Options& two_body_options,
+    const BundleAdjustmentConfig& config)
+    : options_(options), two_body_options_(two_body_options), config_(config) {
+  CHECK(options_.Check());
+}
+
+bool TwoBodyBundleAdjuster::Solve(TwoBodyScene* scene) {
+  TRACE_SCOPE("TwoBodyBundleAdjuster::Solve");
+  CHECK_NOTNULL(scene);
+  CHECK(!problem_)
+      << "Cannot use the same TwoBodyBundleAdjuster multiple times";
+
+  problem_.reset(new ceres::Problem());
+
+  ceres::LossFunction* loss_function = options_.CreateLossFunction();
+  SetUp(scene, loss_function);
+
+  if (problem_->NumResiduals() == 0) {
+    return false;
+  }
+
+  ceres::Solver::Options solver_options = options_.solver_options;
+
+  // Empirical choice, as in BundleAdjuster, where the object motions are part
+  // of the reduced camera system.
+  const size_t kMaxNumImagesDirectDenseSolver = 50;
+  const size_t kMaxNumImagesDirectSparseSolver = 1000;
+  const size_t num_images = variable_image_ids_.size() + motion_idxs_.size();
+  if (num_images <= kMaxNumImagesDirectDenseSolver) {
+    solver_options.linear_solver_type = ceres::DENSE_SCHUR;
+  } else if (num_images <= kMaxNumImagesDirectSparseSolver) {
+    solver_options.linear_solver_type = ceres::SPARSE_SCHUR;
+  } else {  // Indirect sparse (preconditioned CG) solver.
+    solver_options.linear_solver_type = ceres::ITERATIVE_SCHUR;
+    solver_options.preconditioner_type = ceres::SCHUR_JACOBI;
+  }
+
+  // Eliminate the points first, such that the reduced camera system only
+  // contains the cameras and the object motions.
+  ceres::ParameterBlockOrdering* ordering = new ceres::ParameterBlockOrdering;
+  for (const point3D_t point3D_id : point3D_ids_) {
+    ordering->AddElementToGroup(scene->points3D.at(point3D_id).data(), 0);
+  }
+  for (const image_t image_id : variable_image_ids_) {
+    ordering->AddElementToGroup(scene->images.at(image_id).camera.data(), 1);
+  }
+  for (const image_t image_id : constant_image_ids_) {
+    ordering->AddElementToGroup(scene->images.at(image_id).camera.data(), 1);
+  }
+  for (const int motion_idx : motion_idxs_) {
+    ordering->AddElementToGroup(scene->motions.at(motion_idx).data(), 1);
+  }
+  solver_options.linear_solver_ordering.reset(ordering);
+
+#ifdef OPENMP_ENABLED
+  if (solver_options.num_threads <= 0) {
+    solver_options.num_threads = omp_get_max_threads();
+  }
+  if (solver_options.num_linear_solver_threads <= 0) {
+    solver_options.num_linear_solver_threads = omp_get_max_threads();
+  }
+#else
+  solver_options.num_threads = 1;
+  solver_options.num_linear_solver_threads = 1;
+#endif
+
+  std::string solver_error;
+  CHECK(solver_options.IsValid(&solver_error)) << solver_error;
+
+  if (options_.use_mixed_precision_solver) {
+    std::vector<double*> point_blocks;
+    point_blocks.reserve(point3D_ids_.size());
+    for (const point3D_t point3D_id : point3D_ids_) {
+      point_blocks.push_back(scene->points3D.at(point3D_id).data());
+    }
+    SolveMixedPrecision(solver_options, point_blocks, problem_.get(),
+                        &summary_);
+  } else {
+    ceres::Solve(solver_options, problem_.get(), &summary_);
+  }
+  RecordSolverMetrics(summary_);
+
+  if (solver_options.minimizer_progress_to_stdout) {
+    std::cout << std::endl;
+  }
+
+  if (options_.print_summary) {
+    PrintHeading2("Two-body bundle adjustment report");
+    PrintSolverSummary(summary_);
+  }
+
+  return true;
+}
+
+const ceres::Solver::Summary& TwoBodyBundleAdjuster::Summary() const {
+  return summary_;
+}
+
+void TwoBodyBundleAdjuster::SetUp(TwoBodyScene* scene,
+                                  ceres::LossFunction* loss_function) {
+  for (const image_t image_id : config_.Images()) {
+    AddImageToProblem(image_id, scene, false, loss_function);
+  }
+
+  if (config_.NumPoints() > 0) {
+    for (const auto& image : scene->images) {
+      if (!config_.HasImage(image.first)) {
+        AddImageToProblem(image.first, scene, true, loss_function);
+      }
+    }
+  }
+
+  ParameterizeImages(scene);
+  ParameterizePoints(scene);
+}
+
+void TwoBodyBundleAdjuster::AddImageToProblem(
+    const image_t image_id, TwoBodyScene* scene, const bool constant_camera,
+    ceres::LossFunction* loss_function) {
+  TwoBodyScene::Image& image = scene->images.at(image_id);
+  CHECK_EQ(image.points2D.size(), image.point3D_ids.size());
+
+  double* camera_data = image.camera.data();
+  double* motion_data = image.motion_idx >= 0
+                            ? scene->motions.at(image.motion_idx).data()
+                            : nullptr;
+
+  size_t num_observations = 0;
+  for (size_t i = 0; i < image.points2D.size(); ++i) {
+    const point3D_t point3D_id = image.point3D_ids[i];
+    if (constant_camera && !config_.HasPoint(point3D_id)) {
+      continue;
+    }
+
+    double* point3D_data = scene->points3D.at(point3D_id).data();
+
+    if (motion_data != nullptr &&
+        scene->object_point3D_ids.count(point3D_id) > 0) {
+      ceres::CostFunction* cost_function =
+          TwoBodyObjectCostFunction::Create(image.points2D[i]);
+      problem_->AddResidualBlock(cost_function, loss_function, camera_data,
+                                 point3D_data, motion_data);
+      motion_idxs_.insert(image.motion_idx);
+    } else {
+      ceres::CostFunction* cost_function =
+          TwoBodyCostFunction::Create(image.points2D[i]);
+      problem_->AddResidualBlock(cost_function, loss_function, camera_data,
+                                 point3D_data);
+    }
+
+    point3D_ids_.insert(point3D_id);
+    num_observations += 1;
+  }
+
+  if (num_observations > 0) {
+    if (constant_camera) {
+      constant_image_ids_.insert(image_id);
+    } else {
+      variable_image_ids_.insert(image_id);
+    }
+  }
+}
+
+void TwoBodyBundleAdjuster::ParameterizeImages(TwoBodyScene* scene) {
+  const size_t kNumCameraParams = 7;
+  const int kFocalLengthIdx = 6;
+
+  for (const image_t image_id : constant_image_ids_) {
+    problem_->SetParameterBlockConstant(
+        scene->images.at(image_id).camera.data());
+  }
+
+  for (const image_t image_id : variable_image_ids_) {
+    std::vector<int> const_camera_params;
+    if (config_.HasConstantPose(image_id)) {
+      for (int idx = 0; idx < 6; ++idx) {
+        const_camera_params.push_back(idx);
+      }
+    } else if (config_.HasConstantTvec(image_id)) {
+      for (const int idx : config_.ConstantTvec(image_id)) {
+        const_camera_params.push_back(3 + idx);
+      }
+    }
+    if (!options_.refine_focal_length ||
+        config_.IsConstantCamera(static_cast<camera_t>(image_id))) {
+      const_camera_params.push_back(kFocalLengthIdx);
+    }
+
+    double* camera_data = scene->images.at(image_id).camera.data();
+    if (const_camera_params.size() == kNumCameraParams) {
+      problem_->SetParameterBlockConstant(camera_data);
+    } else if (const_camera_params.size() > 0) {
+      ceres::SubsetParameterization* camera_parameterization =
+          new ceres::SubsetParameterization(static_cast<int>(kNumCameraParams),
+                                            const_camera_params);
+      problem_->SetParameterization(camera_data, camera_parameterization);
+    }
+  }
+
+  if (!two_body_options_.refine_motions) {
+    for (const int motion_idx : motion_idxs_) {
+      problem_->SetParameterBlockConstant(scene->motions.at(motion_idx).data());
+    }
+  }
+}
+
+void TwoBodyBundleAdjuster::ParameterizePoints(TwoBodyScene* scene) {
+  for (const point3D_t point3D_id : config_.ConstantPoints()) {
+    if (point3D_ids_.count(point3D_id) > 0) {
+      problem_->SetParameterBlockConstant(
+          scene->points3D.at(point3D_id).data());
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ParallelTwoBodyBundleAdjuster
+////////////////////////////////////////////////////////////////////////////////
+
+ParallelTwoBodyBundleAdjuster::ParallelTwoBodyBundleAdjuster(
+    const ParallelBundleAdjuster::Options& options,
+    const BundleAdjustmentOptions& ba_options,
+    const BundleAdjustmentConfig& config)
+    : options_(options), ba_options_(ba_options), config_(config) {
+  CHECK(options_.Check());
+  CHECK(ba_options_.Check());
+  CHECK_EQ(config_.NumConstantCameras(), 0)
+      << "PBA does not allow to set individual cameras constant";
+  CHECK_EQ(config_.NumConstantPoses(), 0)
+      << "PBA does not allow to set individual translational elements constant";
+  CHECK_EQ(config_.NumConstantTvecs(), 0)
+      << "PBA does not allow to set individual translational elements constant";
+  CHECK(config_.NumVariablePoints() == 0 && config_.NumConstantPoints() == 0)
+      << "PBA does not allow to parameterize individual 3D points";
+}
+
+bool ParallelTwoBodyBundleAdjuster::Solve(TwoBodyScene* scene) {
+  TRACE_SCOPE("ParallelTwoBodyBundleAdjuster::Solve");
+  CHECK_NOTNULL(scene);
+  CHECK(cameras_.empty())
+      << "Cannot use the same ParallelTwoBodyBundleAdjuster multiple times";
+  CHECK(!ba_options_.refine_principal_point);
+
+  SetUp(*scene);
+
+  if (measurements_.empty()) {
+    return false;
+  }
+
+  pba::ParallelBA::DeviceT device;
+  const size_t kMaxNumResidualsFloat = 100 * 1000;
+  if (2 * measurements_.size() > kMaxNumResidualsFloat) {
+    // The threshold for using double precision is empirically chosen and
+    // ensures that the system can be reliable solved.
+    device = pba::ParallelBA::PBA_CPU_DOUBLE;
+  } else {
+    if (options_.gpu_index < 0) {
+      device = pba::ParallelBA::PBA_CUDA_DEVICE_DEFAULT;
+    } else {
+      device = static_cast<pba::ParallelBA::DeviceT>(
+          pba::ParallelBA::PBA_CUDA_DEVICE0 + options_.gpu_index);
+    }
+  }
+
+  pba::ParallelBA pba(device, options_.num_threads);
+
+  pba.SetNextBundleMode(pba::ParallelBA::BUNDLE_FULL);
+  pba.EnableRadialDistortion(pba::ParallelBA::PBA_NO_DISTORTION);
+  pba.SetFixedIntrinsics(!ba_options_.refine_focal_length);
+
+  pba::ConfigBA* pba_config = pba.GetInternalConfig();
+  pba_config->__lm_delta_threshold /= 100.0f;
+  pba_config->__lm_gradient_threshold /= 100.0f;
+  pba_config->__lm_mse_threshold = 0.0f;
+  pba_config->__cg_min_iteration = 10;
+  pba_config->__verbose_level = 2;
+  pba_config->__lm_max_iteration = options_.max_num_iterations;
+
+  pba.SetCameraData(cameras_.size(), cameras_.data());
+  pba.SetPointData(points3D_.size(), points3D_.data());
+  pba.SetProjection(measurements_.size(), measurements_.data(),
+                    point3D_idxs_.data(), camera_idxs_.data());
+
+  Timer timer;
+  timer.Start();
+  pba.RunBundleAdjustment();
+  timer.Pause();
+
+  // Compose Ceres solver summary from PBA options.
+  const int num_camera_params = ba_options_.refine_focal_length ? 7 : 6;
+  summary_.num_residuals_reduced = static_cast<int>(2 * measurements_.size());
+  summary_.num_effective_parameters_reduced = static_cast<int>(
+      num_camera_params * cameras_.size() + 3 * points3D_.size());
+  summary_.num_successful_steps = pba_config->GetIterationsLM() + 1;
+  summary_.termination_type = ceres::TerminationType::USER_SUCCESS;
+  summary_.initial_cost =
+      pba_config->GetInitialMSE() * summary_.num_residuals_reduced / 4;
+  summary_.final_cost =
+      pba_config->GetFinalMSE() * summary_.num_residuals_reduced / 4;
+  summary_.total_time_in_seconds = timer.ElapsedSeconds();
+  RecordSolverMetrics(summary_);
+
+  TearDown(scene);
+
+  if (options_.print_summary) {
+    PrintHeading2("Two-body bundle adjustment report");
+    PrintSolverSummary(summary_);
+  }
+
+  return true;
+}
+
+const ceres::Solver::Summary& ParallelTwoBodyBundleAdjuster::Summary() const {
+  return summary_;
+}
+
+void ParallelTwoBodyBundleAdjuster::SetUp(const TwoBodyScene& scene) {
+  // The observations of every point, with the index of the camera and the
+  // measurement, as PBA requires the tracks to be stored contiguously.
+  std::unordered_map<point3D_t, std::vector<std::pair<int, const double*>>>
+      point3D_observations;
+
+  cameras_.reserve(config_.NumImages());
+  ordered_image_ids_.reserve(config_.NumImages());
+  for (const image_t image_id : config_.Images()) {
+    const TwoBodyScene::Image& image = scene.images.at(image_id);
+    const int camera_idx = static_cast<int>(cameras_.size());
+
+    size_t num_observations = 0;
+    for (size_t i = 0; i < image.point3D_ids.size(); ++i) {
+      const point3D_t point3D_id = image.point3D_ids[i];
+      if (image.motion_idx >= 0 &&
+          scene.object_point3D_ids.count(point3D_id) > 0) {
+        continue;
+      }
+      point3D_observations[point3D_id].emplace_back(camera_idx,
+                                                    image.points2D[i].data());
+      num_observations += 1;
+    }
+
+    if (num_observations == 0) {
+      continue;
+    }
+
+    // Note: Do not use PBA's quaternion methods as they seem to lead to
+    // numerical instability or other issues.
+    const Eigen::Matrix3d rotation_matrix =
+        AngleAxisToRotationMatrix(Eigen::Vector3d(
+            image.camera[0], image.camera[1], image.camera[2]))
+            .transpose();
+
+    pba::CameraT pba_camera;
+    pba_camera.SetFocalLength(image.camera[6]);
+    pba_camera.SetProjectionDistortion(0.0);
+    pba_camera.SetMatrixRotation(rotation_matrix.data());
+    pba_camera.SetTranslation(image.camera.data() + 3);
+    pba_camera.SetVariableCamera();
+
+    cameras_.push_back(pba_camera);
+    ordered_image_ids_.push_back(image_id);
+  }
+
+  points3D_.resize(point3D_observations.size());
+  ordered_point3D_ids_.reserve(point3D_observations.size());
+
+  int point3D_idx = 0;
+  for (const auto& point3D : point3D_observations) {
+    points3D_[point3D_idx].SetPoint(scene.points3D.at(point3D.first).data());
+    ordered_point3D_ids_.push_back(point3D.first);
+    for (const auto& observation : point3D.second) {
+      pba::Point2D measurement;
+      measurement.SetPoint2D(observation.second[0], observation.second[1]);
+      measurements_.push_back(measurement);
+      camera_idxs_.push_back(observation.first);
+      point3D_idxs_.push_back(point3D_idx);
+    }
+    point3D_idx += 1;
+  }
+}
+
+void ParallelTwoBodyBundleAdjuster::TearDown(TwoBodyScene* scene) {
+  for (size_t i = 0; i < cameras_.size(); ++i) {
+    const pba::CameraT& pba_camera = cameras_[i];
+    TwoBodyScene::Image& image = scene->images.at(ordered_image_ids_[i]);
+
+    Eigen::Matrix3d rotation_matrix;
+    pba_camera.GetMatrixRotation(rotation_matrix.data());
+    const Eigen::Vector3d angle_axis =
+        RotationMatrixToAngleAxis(rotation_matrix.transpose());
+    image.camera[0] = angle_axis(0);
+    image.camera[1] = angle_axis(1);
+    image.camera[2] = angle_axis(2);
+    pba_camera.GetTranslation(image.camera.data() + 3);
+    image.camera[6] = pba_camera.GetFocalLength();
+  }
+
+  for (size_t i = 0; i < points3D_.size(); ++i) {
+    points3D_[i].GetPoint(scene->points3D.at(ordered_point3D_ids_[i]).data());
+  }
+}
+
+size_t RefinePoints3D(const BundleAdjustmentOptions& options,
+                      const std::vector<point3D_t>& point3D_ids,
+                      Reconstruction* reconstruction,
+                      ThreadPool* thread_pool) {
+  CHECK_NOTNULL(reconstruction);
+  CHECK(options.Check());
+
+  ceres::Solver::Options solver_options = options.solver_options;
+  solver_options.linear_solver_type = ceres::DENSE_QR;
+  solver_options.minimizer_progress_to_stdout = false;
+  solver_options.logging_type = ceres::SILENT;
+  solver_options.num_threads = 1;
+  solver_options.num_linear_solver_threads = 1;
+
+  const auto RefinePoint3D = [&](const point3D_t point3D_id) {
+    Point3D& point3D = reconstruction->Point3D(point3D_id);
+
+    // The camera parameters are copied, since the cameras are shared by the
+    // points that are refined concurrently.
+    std::vector<std::vector<double>> camera_params;
+    camera_params.reserve(point3D.Track().Length());
+
+    Eigen::Vector3d xyz = point3D.XYZ();
+    ceres::Problem problem;
+    ceres::LossFunction* loss_function = options.CreateLossFunction();
+    for (const TrackElement& track_el : point3D.Track().Elements()) {
+      const Image& image = reconstruction->Image(track_el.image_id);
+      const Camera& camera = reconstruction->Camera(image.CameraId());
+      const Point2D& point2D = image.Point2D(track_el.point2D_idx);
+
+      ceres::CostFunction* cost_function = nullptr;
+
+      switch (camera.ModelId()) {
+#define CAMERA_MODEL_CASE(CameraModel)                                 \
+  case CameraModel::kModelId:                                          \
+    cost_function =                                                    \
+        BundleAdjustmentConstantPoseCostFunction<CameraModel>::Create( \
+            image.Qvec(), image.Tvec(), point2D.XY());                 \
+    break;
+
+        CAMERA_MODEL_SWITCH_CASES
+
+#undef CAMERA_MODEL_CASE
+      }
+
+      camera_params.push_back(camera.Params());
+      problem.AddResidualBlock(cost_function, loss_function, xyz.data(),
+                               camera_params.back().data());
+      problem.SetParameterBlockConstant(camera_params.back().data());
+    }
+
+    if (problem.NumResiduals() == 0) {
+      delete loss_function;
+      return false;
+    }
+
+    ceres::Solver::Summary summary;
+    ceres::Solve(solver_options, &problem, &summary);
+    if (!summary.IsSolutionUsable()) {
+      return false;
+    }
+
+    point3D.XYZ() = xyz;
+    return true;
+  };
+
+  const auto RefineChunk = [&](const size_t begin, const size_t stride) {
+    size_t num_refined = 0;
+    for (size_t i = begin; i < point3D_ids.size(); i += stride) {
+      if (RefinePoint3D(point3D_ids[i])) {
+        num_refined += 1;
+      }
+    }
+    return num_refined;
+  };
+
+  if (thread_pool == nullptr || thread_pool->NumThreads() <= 1) {
+    return RefineChunk(0, 1);
+  }
+
+  const size_t num_chunks = thread_pool->NumThreads();
+  std::vector<std::future<size_t>> futures;
+  futures.reserve(num_chunks);
+  for (size_t i = 0; i < num_chunks; ++i) {
+    futures.push_back(thread_pool->AddTask(RefineChunk, i, num_chunks));
+  }
+
+  size_t num_refined = 0;
+  for (auto& future : futures) {
+    num_refined += future.get();
+  }
+
+  return num_refined;
+}
+
 void PrintSolverSummary(const ceres::Solver::Summary& summary) {
   std::cout << std::right << std::setw(16) << "Residuals : ";
   std::cout << std::left << summary.num_residuals_reduced << std::endl;
@@ -17,8 +17,11 @@
 #ifndef COLMAP_SRC_OPTIM_BUNDLE_ADJUSTMENT_H_
 #define COLMAP_SRC_OPTIM_BUNDLE_ADJUSTMENT_H_
 
+#include <array>
 #include <memory>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <Eigen/Core>
 
@@ -28,12 +31,13 @@
 #include "base/reconstruction.h"
 #include "ext/PBA/pba.h"
 #include "util/alignment.h"
+#include "util/threading.h"
 
 namespace colmap {
 
 struct BundleAdjustmentOptions {
-  // Loss function types: Trivial (non-robust) and Cauchy (robust) loss.
-  enum class LossFunctionType { TRIVIAL, CAUCHY };
+  // Loss function types: Trivial (non-robust), Cauchy and Huber (robust) loss.
+  enum class LossFunctionType { TRIVIAL, CAUCHY, HUBER };
   LossFunctionType loss_function_type = LossFunctionType::TRIVIAL;
 
   // Scaling factor determines residual at which robustification takes place.
@@ -51,6 +55,11 @@ struct BundleAdjustmentOptions {
   // Whether to print a final summary.
   bool print_summary = true;
 
+  // Whether to minimize with `SolveMixedPrecision` instead of Ceres-Solver,
+  // which eliminates the points in single precision and assembles the reduced
+  // camera system in parallel. Only a subset of the solver options is used.
+  bool use_mixed_precision_solver = false;
+
   // Ceres-Solver options.
   ceres::Solver::Options solver_options;
 
@@ -86,6 +95,7 @@ class BundleAdjustmentConfig {
   size_t NumConstantTvecs() const;
   size_t NumVariablePoints() const;
   size_t NumConstantPoints() const;
+  size_t NumRigidMotions() const;
 
   // Determine the number of residuals for the given reconstruction. The number
   // of residuals equals the number of observations times two.
@@ -126,11 +136,35 @@ class BundleAdjustmentConfig {
   void RemoveVariablePoint(const point3D_t point3D_id);
   void RemoveConstantPoint(const point3D_t point3D_id);
 
+  // Restrict the observations of the added images to the given 3D points,
+  // e.g. to adjust the images on a subset of the points. By default, all
+  // observations of the added images are used. Only supported by
+  // `BundleAdjuster`.
+  void SetPointSubset(const std::unordered_set<point3D_t>& point3D_ids);
+  void ClearPointSubset();
+  bool HasPointSubset() const;
+  bool IsInPointSubset(const point3D_t point3D_id) const;
+
+  // Tie the pose of an image, e.g. a phantom image of a moving object, to the
+  // pose of its base image through a rigid motion, which is shared by all
+  // images with the same motion index. The pose of the image is then the
+  // motion followed by the pose of the base image, so that only the motion is
+  // refined instead of an independent pose per image. Both images have to be
+  // added prior to calling these methods and the image must have a variable
+  // pose. Only supported by `BundleAdjuster`.
+  void SetRigidMotion(const image_t image_id, const image_t base_image_id,
+                      const int motion_idx);
+  void RemoveRigidMotion(const image_t image_id);
+  bool HasRigidMotion(const image_t image_id) const;
+
   // Access configuration data.
   const std::unordered_set<image_t>& Images() const;
   const std::unordered_set<point3D_t>& VariablePoints() const;
   const std::unordered_set<point3D_t>& ConstantPoints() const;
   const std::vector<int>& ConstantTvec(const image_t image_id) const;
+  // The base image and the motion index of every image with a rigid motion.
+  const std::unordered_map<image_t, std::pair<image_t, int>>& RigidMotions()
+      const;
 
  private:
   std::unordered_set<camera_t> constant_camera_ids_;
@@ -139,6 +173,9 @@ class BundleAdjustmentConfig {
   std::unordered_set<point3D_t> constant_point3D_ids_;
   std::unordered_set<image_t> constant_poses_;
   std::unordered_map<image_t, std::vector<int>> constant_tvecs_;
+  bool has_point_subset_;
+  std::unordered_set<point3D_t> subset_point3D_ids_;
+  std::unordered_map<image_t, std::pair<image_t, int>> rigid_motions_;
 };
 
 // Bundle adjustment based on Ceres-Solver. Enables most flexible configurations
@@ -165,9 +202,14 @@ class BundleAdjuster {
                          Reconstruction* reconstruction,
                          ceres::LossFunction* loss_function);
 
+  // Initialize every rigid motion from the image with the smallest identifier
+  // among the images that share it.
+  void ComputeRigidMotions(Reconstruction* reconstruction);
+
  protected:
   void ParameterizeCameras(Reconstruction* reconstruction);
   void ParameterizePoints(Reconstruction* reconstruction);
+  void ParameterizeRigidMotions(Reconstruction* reconstruction);
 
   const BundleAdjustmentOptions options_;
   BundleAdjustmentConfig config_;
@@ -175,6 +217,88 @@ class BundleAdjuster {
   ceres::Solver::Summary summary_;
   std::unordered_set<camera_t> camera_ids_;
   std::unordered_map<point3D_t, size_t> point3D_num_observations_;
+
+  // The rotation and translation of the rigid motions by motion index.
+  EIGEN_STL_UMAP(int, Eigen::Vector4d) motion_qvecs_;
+  std::unordered_map<int, Eigen::Vector3d> motion_tvecs_;
+};
+
+// Bundle adjustment based on Ceres-Solver, which keeps its problem between
+// calls to `Solve` for the repeated global adjustment of a growing
+// reconstruction. Every call synchronizes the problem with the configured
+// images, i.e. the residuals of new observations are inserted and those of
+// removed observations are deleted, and the solver is warm-started from the
+// current parameters. The problem is only rebuilt if the camera parameter
+// options or the images with constant tvec elements change, while a changed
+// loss function is swapped in place. Constant points cannot be configured. As
+// in BundleAdjuster, the observations of variable points in other images are
+// added with a constant pose and camera, whereas the other points with
+// observations outside of the configured images are kept constant.
+class IncrementalBundleAdjuster {
+ public:
+  IncrementalBundleAdjuster();
+
+  bool Solve(const BundleAdjustmentOptions& options,
+             const BundleAdjustmentConfig& config,
+             Reconstruction* reconstruction);
+
+  // Drop the problem, so that the next call to `Solve` builds it from scratch.
+  void Reset();
+
+  // Get the Ceres solver summary for the last call to `Solve`.
+  const ceres::Solver::Summary& Summary() const;
+
+  // Number of residual blocks inserted into and removed from the problem in
+  // the last call to `Solve`.
+  size_t NumAddedResiduals() const;
+  size_t NumRemovedResiduals() const;
+
+ private:
+  struct ImageBlock {
+    double* qvec_data = nullptr;
+    double* tvec_data = nullptr;
+    camera_t camera_id = kInvalidCameraId;
+    // The observed 3D point and residual block of every image point.
+    std::vector<point3D_t> point3D_ids;
+    std::vector<ceres::ResidualBlockId> residual_block_ids;
+  };
+
+  struct ParameterBlock {
+    double* data = nullptr;
+    size_t num_residuals = 0;
+  };
+
+  bool NeedsReset(const BundleAdjustmentOptions& options,
+                  const BundleAdjustmentConfig& config,
+                  const Reconstruction& reconstruction) const;
+
+  void RemoveDeletedResiduals(
+      const BundleAdjustmentConfig& config,
+      const std::unordered_set<image_t>& external_image_ids,
+      Reconstruction* reconstruction);
+  void AddNewResiduals(const BundleAdjustmentConfig& config,
+                       const std::unordered_set<image_t>& external_image_ids,
+                       Reconstruction* reconstruction);
+  void AddImageResiduals(const BundleAdjustmentConfig& config,
+                         const image_t image_id, const bool external,
+                         Reconstruction* reconstruction);
+  void RemoveResidual(ImageBlock* image_block, const size_t point2D_idx);
+  void SetCameraParameterization(Camera* camera);
+  void ParameterizeCameras(const BundleAdjustmentConfig& config,
+                           Reconstruction* reconstruction);
+  void ParameterizePoints(Reconstruction* reconstruction);
+
+  BundleAdjustmentOptions options_;
+  std::unordered_map<image_t, std::vector<int>> constant_tvecs_;
+  const Reconstruction* reconstruction_;
+  std::unique_ptr<ceres::Problem> problem_;
+  std::unique_ptr<ceres::LossFunctionWrapper> loss_function_;
+  ceres::Solver::Summary summary_;
+  size_t num_added_residuals_;
+  size_t num_removed_residuals_;
+  std::unordered_map<image_t, ImageBlock> image_blocks_;
+  std::unordered_map<camera_t, ParameterBlock> camera_blocks_;
+  std::unordered_map<point3D_t, ParameterBlock> point3D_blocks_;
 };
 
 // Bundle adjustment using PBA (GPU or CPU). Less flexible and accurate than
@@ -249,6 +373,19 @@ class RigBundleAdjuster : public BundleAdjuster {
     // rig poses, which might be different from the absolute pose of the image
     // in the reconstruction.
     double max_reproj_error = 1000.0;
+
+    // Whether to always solve the reduced camera system iteratively with
+    // preconditioned conjugate gradients, which neither forms nor factorizes
+    // it. Otherwise, the solver is chosen by the number of images as in
+    // `BundleAdjuster`, i.e. only more than 1000 images are solved
+    // iteratively.
+    bool use_iterative_solver = false;
+
+    // The number of threads that select the observations of the images and
+    // create their residuals when setting up the problem.
+    int num_threads = -1;
+
+    bool Check() const;
   };
 
   RigBundleAdjuster(const BundleAdjustmentOptions& options,
@@ -265,8 +402,20 @@ class RigBundleAdjuster : public BundleAdjuster {
   void TearDown(Reconstruction* reconstruction,
                 const std::vector<CameraRig>& camera_rigs);
 
-  void AddImageToProblem(const image_t image_id, Reconstruction* reconstruction,
-                         std::vector<CameraRig>* camera_rigs,
+  // The observations of an image and their cost functions, which are created
+  // concurrently for all images before they are added to the problem.
+  struct ImageResiduals {
+    std::vector<point3D_t> point3D_ids;
+    std::vector<ceres::CostFunction*> cost_functions;
+  };
+
+  void CreateImageResiduals(const image_t image_id,
+                            Reconstruction* reconstruction,
+                            ImageResiduals* residuals) const;
+
+  void AddImageToProblem(const image_t image_id,
+                         const ImageResiduals& residuals,
+                         Reconstruction* reconstruction,
                          ceres::LossFunction* loss_function);
 
   void AddPointToProblem(const point3D_t point3D_id,
@@ -278,6 +427,11 @@ class RigBundleAdjuster : public BundleAdjuster {
 
   void ParameterizeCameraRigs(Reconstruction* reconstruction);
 
+  // Order the parameter blocks for the Schur complement, see `Solve`.
+  ceres::ParameterBlockOrdering* CreateParameterBlockOrdering(
+      Reconstruction* reconstruction,
+      const std::vector<CameraRig>& camera_rigs) const;
+
   const Options rig_options_;
 
   // Mapping from images to camera rigs.
@@ -296,6 +450,125 @@ class RigBundleAdjuster : public BundleAdjuster {
   std::unordered_set<double*> parameterized_qvec_data_;
 };
 
+// Scene of a static background and a rigidly moving object as reconstructed
+// by the two-body postprocessor. Every image has its own camera with the
+// identifier of the image and the object points are given in the frame of the
+// reference take. In the other takes, they are first moved by the object
+// motion of the take.
+struct TwoBodyScene {
+  struct Image {
+    // Angle-axis rotation, translation and focal length of the camera.
+    std::array<double, 7> camera;
+
+    // Index of the object motion of the take of the image or -1 for the
+    // reference take.
+    int motion_idx = -1;
+
+    // Observations relative to the principal point and their 3D points.
+    std::vector<Eigen::Vector2d> points2D;
+    std::vector<point3D_t> point3D_ids;
+  };
+
+  std::unordered_map<image_t, Image> images;
+
+  // Angle-axis rotation and translation of the object motions.
+  std::vector<std::array<double, 6>> motions;
+
+  EIGEN_STL_UMAP(point3D_t, Eigen::Vector3d) points3D;
+  std::unordered_set<point3D_t> object_point3D_ids;
+};
+
+// Bundle adjustment of a two-body scene based on Ceres-Solver, with the
+// analytic `TwoBodyCostFunction` and `TwoBodyObjectCostFunction`. The images,
+// points and constant poses and cameras are configured as for BundleAdjuster,
+// where the camera of an image has the identifier of the image. The
+// observations of the configured points in the other images are added with a
+// constant camera. The points are eliminated first in the Schur complement.
+class TwoBodyBundleAdjuster {
+ public:
+  struct Options {
+    // Whether to optimize the object motions of the takes.
+    bool refine_motions = true;
+  };
+
+  TwoBodyBundleAdjuster(const BundleAdjustmentOptions& options,
+                        const Options& two_body_options,
+                        const BundleAdjustmentConfig& config);
+
+  bool Solve(TwoBodyScene* scene);
+
+  // Get the Ceres solver summary for the last call to `Solve`.
+  const ceres::Solver::Summary& Summary() const;
+
+ private:
+  void SetUp(TwoBodyScene* scene, ceres::LossFunction* loss_function);
+
+  // Add the observations of the image, either all of them or only the ones of
+  // the configured points, in which case the camera is constant.
+  void AddImageToProblem(const image_t image_id, TwoBodyScene* scene,
+                         const bool constant_camera,
+                         ceres::LossFunction* loss_function);
+
+  void ParameterizeImages(TwoBodyScene* scene);
+  void ParameterizePoints(TwoBodyScene* scene);
+
+  const BundleAdjustmentOptions options_;
+  const Options two_body_options_;
+  BundleAdjustmentConfig config_;
+  std::unique_ptr<ceres::Problem> problem_;
+  ceres::Solver::Summary summary_;
+  std::unordered_set<image_t> variable_image_ids_;
+  std::unordered_set<image_t> constant_image_ids_;
+  std::unordered_set<int> motion_idxs_;
+  std::unordered_set<point3D_t> point3D_ids_;
+};
+
+// Bundle adjustment of a two-body scene using PBA (GPU or CPU), restricted to
+// the observations without an object motion, i.e. the background in all
+// images and the object in the reference take. PBA has no parameters that are
+// shared by several cameras, so the object motions are not changed. It brings
+// the bulk of the problem close to its optimum before the joint adjustment
+// with TwoBodyBundleAdjuster. As ParallelBundleAdjuster, it is less flexible
+// than the Ceres-Solver bundle adjustment and has no robust loss function.
+class ParallelTwoBodyBundleAdjuster {
+ public:
+  ParallelTwoBodyBundleAdjuster(const ParallelBundleAdjuster::Options& options,
+                                const BundleAdjustmentOptions& ba_options,
+                                const BundleAdjustmentConfig& config);
+
+  bool Solve(TwoBodyScene* scene);
+
+  // Get the Ceres solver summary for the last call to `Solve`.
+  const ceres::Solver::Summary& Summary() const;
+
+ private:
+  void SetUp(const TwoBodyScene& scene);
+  void TearDown(TwoBodyScene* scene);
+
+  const ParallelBundleAdjuster::Options options_;
+  const BundleAdjustmentOptions ba_options_;
+  BundleAdjustmentConfig config_;
+  ceres::Solver::Summary summary_;
+
+  std::vector<pba::CameraT> cameras_;
+  std::vector<pba::Point3D> points3D_;
+  std::vector<pba::Point2D> measurements_;
+  std::vector<int> camera_idxs_;
+  std::vector<int> point3D_idxs_;
+  std::vector<image_t> ordered_image_ids_;
+  std::vector<point3D_t> ordered_point3D_ids_;
+};
+
+// Refine the given 3D points with the poses and cameras of their observing
+// images fixed, e.g. the points that were left out of a bundle adjustment on a
+// subset of the points. The points are independent of each other and they are
+// distributed over the threads of the thread pool, if one is given. Returns
+// the number of refined points.
+size_t RefinePoints3D(const BundleAdjustmentOptions& options,
+                      const std::vector<point3D_t>& point3D_ids,
+                      Reconstruction* reconstruction,
+                      ThreadPool* thread_pool = nullptr);
+
 void PrintSolverSummary(const ceres::Solver::Summary& summary);
 
 }  // namespace colmap
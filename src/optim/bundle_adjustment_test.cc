@@ -17,6 +17,7 @@
 #define TEST_NAME "optim/bundle_adjustment"
 #include "util/testing.h"
 
+#include "base/cost_functions.h"
 #include "base/projection.h"
 #include "optim/bundle_adjustment.h"
 #include "util/random.h"
@@ -627,6 +628,240 @@ BOOST_AUTO_TEST_CASE(TestConstantExtraParam) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(TestPointSubset) {
+  Reconstruction reconstruction;
+  SceneGraph scene_graph;
+  GenerateReconstruction(2, 100, &reconstruction, &scene_graph);
+  const auto orig_reconstruction = reconstruction;
+
+  std::unordered_set<point3D_t> subset_point3D_ids;
+  std::vector<point3D_t> other_point3D_ids;
+  for (const auto& point3D : reconstruction.Points3D()) {
+    if (subset_point3D_ids.size() < 50) {
+      subset_point3D_ids.insert(point3D.first);
+    } else {
+      other_point3D_ids.push_back(point3D.first);
+    }
+  }
+
+  BundleAdjustmentConfig config;
+  config.AddImage(0);
+  config.AddImage(1);
+  config.SetConstantPose(0);
+  config.SetConstantTvec(1, {0});
+  config.SetPointSubset(subset_point3D_ids);
+  BOOST_CHECK_EQUAL(config.NumResiduals(reconstruction), 200);
+
+  BundleAdjustmentOptions options;
+  BundleAdjuster bundle_adjuster(options, config);
+  BOOST_REQUIRE(bundle_adjuster.Solve(&reconstruction));
+
+  const auto summary = bundle_adjuster.Summary();
+
+  // 50 points, 2 images, 2 residuals per point per image
+  BOOST_CHECK_EQUAL(summary.num_residuals_reduced, 200);
+  // 50 x 3 point parameters
+  // + 5 image parameters (pose of second image)
+  // + 2 x 2 camera parameters
+  BOOST_CHECK_EQUAL(summary.num_effective_parameters_reduced, 159);
+
+  for (const point3D_t point3D_id : subset_point3D_ids) {
+    CheckVariablePoint(reconstruction.Point3D(point3D_id),
+                       orig_reconstruction.Point3D(point3D_id));
+  }
+  for (const point3D_t point3D_id : other_point3D_ids) {
+    CheckConstantPoint(reconstruction.Point3D(point3D_id),
+                       orig_reconstruction.Point3D(point3D_id));
+  }
+
+  ThreadPool thread_pool(2);
+  BOOST_CHECK_EQUAL(RefinePoints3D(options, other_point3D_ids, &reconstruction,
+                                   &thread_pool),
+                    50);
+  for (const point3D_t point3D_id : other_point3D_ids) {
+    CheckVariablePoint(reconstruction.Point3D(point3D_id),
+                       orig_reconstruction.Point3D(point3D_id));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestRigidMotion) {
+  Reconstruction reconstruction;
+  SceneGraph scene_graph;
+  GenerateReconstruction(4, 100, &reconstruction, &scene_graph);
+
+  BundleAdjustmentConfig config;
+  config.AddImage(0);
+  config.AddImage(1);
+  config.AddImage(2);
+  config.AddImage(3);
+  config.SetConstantPose(0);
+  config.SetConstantTvec(1, {0});
+  config.SetRigidMotion(2, 0, 0);
+  config.SetRigidMotion(3, 1, 0);
+  BOOST_CHECK_EQUAL(config.NumRigidMotions(), 2);
+  BOOST_CHECK(config.HasRigidMotion(2));
+  BOOST_CHECK(!config.HasRigidMotion(1));
+
+  BundleAdjustmentOptions options;
+  BundleAdjuster bundle_adjuster(options, config);
+  BOOST_REQUIRE(bundle_adjuster.Solve(&reconstruction));
+
+  const auto summary = bundle_adjuster.Summary();
+
+  // 100 points, 4 images, 2 residuals per point per image
+  BOOST_CHECK_EQUAL(summary.num_residuals_reduced, 800);
+  // 100 x 3 point parameters
+  // + 5 image parameters (pose of second image)
+  // + 6 motion parameters (shared by the third and fourth image)
+  // + 4 x 2 camera parameters
+  BOOST_CHECK_EQUAL(summary.num_effective_parameters_reduced, 319);
+
+  // Both images are related to their base images by the same motion.
+  const auto ComputeMotion = [&reconstruction](const image_t image_id,
+                                               const image_t base_image_id,
+                                               Eigen::Vector4d* qvec,
+                                               Eigen::Vector3d* tvec) {
+    const Image& image = reconstruction.Image(image_id);
+    const Image& base_image = reconstruction.Image(base_image_id);
+    Eigen::Vector4d inv_base_qvec;
+    Eigen::Vector3d inv_base_tvec;
+    InvertPose(base_image.Qvec(), base_image.Tvec(), &inv_base_qvec,
+               &inv_base_tvec);
+    ConcatenatePoses(image.Qvec(), image.Tvec(), inv_base_qvec, inv_base_tvec,
+                     qvec, tvec);
+  };
+  Eigen::Vector4d qvec1;
+  Eigen::Vector3d tvec1;
+  ComputeMotion(2, 0, &qvec1, &tvec1);
+  Eigen::Vector4d qvec2;
+  Eigen::Vector3d tvec2;
+  ComputeMotion(3, 1, &qvec2, &tvec2);
+  BOOST_CHECK(NormalizeQuaternion(qvec1).isApprox(NormalizeQuaternion(qvec2),
+                                                  1e-6));
+  BOOST_CHECK(tvec1.isApprox(tvec2, 1e-6));
+}
+
+BOOST_AUTO_TEST_CASE(TestIncremental) {
+  Reconstruction reconstruction;
+  SceneGraph scene_graph;
+  GenerateReconstruction(3, 100, &reconstruction, &scene_graph);
+
+  BundleAdjustmentConfig config;
+  config.AddImage(0);
+  config.AddImage(1);
+  config.SetConstantPose(0);
+  config.SetConstantTvec(1, {0});
+
+  BundleAdjustmentOptions options;
+  IncrementalBundleAdjuster bundle_adjuster;
+  BOOST_REQUIRE(bundle_adjuster.Solve(options, config, &reconstruction));
+
+  // 100 points, 2 images, 2 residuals per point per image. The points are
+  // constant, since they are also observed by the third image.
+  BOOST_CHECK_EQUAL(bundle_adjuster.NumAddedResiduals(), 200);
+  BOOST_CHECK_EQUAL(bundle_adjuster.NumRemovedResiduals(), 0);
+  BOOST_CHECK_EQUAL(bundle_adjuster.Summary().num_residuals_reduced, 400);
+  // 5 image parameters (pose of second image) + 2 x 2 camera parameters
+  BOOST_CHECK_EQUAL(bundle_adjuster.Summary().num_effective_parameters_reduced,
+                    9);
+
+  const auto orig_reconstruction = reconstruction;
+
+  config.AddImage(2);
+  reconstruction.DeleteObservation(2, 0);
+  BOOST_REQUIRE(bundle_adjuster.Solve(options, config, &reconstruction));
+
+  BOOST_CHECK_EQUAL(bundle_adjuster.NumAddedResiduals(), 99);
+  BOOST_CHECK_EQUAL(bundle_adjuster.NumRemovedResiduals(), 0);
+  BOOST_CHECK_EQUAL(bundle_adjuster.Summary().num_residuals_reduced, 598);
+  // 100 x 3 point parameters
+  // + 5 image parameters (pose of second image)
+  // + 6 image parameters (pose of third image)
+  // + 3 x 2 camera parameters
+  BOOST_CHECK_EQUAL(bundle_adjuster.Summary().num_effective_parameters_reduced,
+                    317);
+
+  CheckConstantImage(reconstruction.Image(0), orig_reconstruction.Image(0));
+  CheckConstantXImage(reconstruction.Image(1), orig_reconstruction.Image(1));
+  CheckVariableImage(reconstruction.Image(2), orig_reconstruction.Image(2));
+  for (const auto& point3D : reconstruction.Points3D()) {
+    CheckVariablePoint(point3D.second,
+                       orig_reconstruction.Point3D(point3D.first));
+  }
+
+  reconstruction.DeleteObservation(0, 1);
+  config.RemoveConstantTvec(1);
+  config.SetConstantPose(1);
+  BOOST_REQUIRE(bundle_adjuster.Solve(options, config, &reconstruction));
+
+  // The changed gauge rebuilds the problem.
+  BOOST_CHECK_EQUAL(bundle_adjuster.NumAddedResiduals(), 298);
+  BOOST_CHECK_EQUAL(bundle_adjuster.NumRemovedResiduals(), 0);
+  BOOST_CHECK_EQUAL(bundle_adjuster.Summary().num_residuals_reduced, 596);
+}
+
+BOOST_AUTO_TEST_CASE(TestIncrementalVariablePoints) {
+  Reconstruction reconstruction;
+  SceneGraph scene_graph;
+  GenerateReconstruction(3, 100, &reconstruction, &scene_graph);
+  const point3D_t variable_point3D_id =
+      reconstruction.Image(2).Point2D(0).Point3DId();
+  const point3D_t add_variable_point3D_id =
+      reconstruction.Image(2).Point2D(1).Point3DId();
+  reconstruction.DeleteObservation(2, 0);
+
+  const auto orig_reconstruction = reconstruction;
+
+  BundleAdjustmentConfig config;
+  config.AddImage(0);
+  config.AddImage(1);
+  config.SetConstantPose(0);
+  config.SetConstantPose(1);
+  config.AddVariablePoint(add_variable_point3D_id);
+
+  BundleAdjustmentOptions options;
+  options.loss_function_type =
+      BundleAdjustmentOptions::LossFunctionType::CAUCHY;
+  IncrementalBundleAdjuster bundle_adjuster;
+  BOOST_REQUIRE(bundle_adjuster.Solve(options, config, &reconstruction));
+
+  // 100 points, 2 images, 2 residuals per point per image
+  // + 2 residuals in 3rd image for added variable 3D point.
+  BOOST_CHECK_EQUAL(bundle_adjuster.NumAddedResiduals(), 201);
+  BOOST_CHECK_EQUAL(bundle_adjuster.Summary().num_residuals_reduced, 402);
+  // 2 x 3 point parameters
+  // 2 x 2 camera parameters
+  BOOST_CHECK_EQUAL(bundle_adjuster.Summary().num_effective_parameters_reduced,
+                    10);
+
+  CheckConstantCamera(reconstruction.Camera(2), orig_reconstruction.Camera(2));
+  CheckConstantImage(reconstruction.Image(2), orig_reconstruction.Image(2));
+  for (const auto& point3D : reconstruction.Points3D()) {
+    if (point3D.first == variable_point3D_id ||
+        point3D.first == add_variable_point3D_id) {
+      CheckVariablePoint(point3D.second,
+                         orig_reconstruction.Point3D(point3D.first));
+    } else {
+      CheckConstantPoint(point3D.second,
+                         orig_reconstruction.Point3D(point3D.first));
+    }
+  }
+
+  // The changed loss function keeps the problem.
+  options.loss_function_type =
+      BundleAdjustmentOptions::LossFunctionType::TRIVIAL;
+  BOOST_REQUIRE(bundle_adjuster.Solve(options, config, &reconstruction));
+  BOOST_CHECK_EQUAL(bundle_adjuster.NumAddedResiduals(), 0);
+  BOOST_CHECK_EQUAL(bundle_adjuster.NumRemovedResiduals(), 0);
+
+  // The observation in the 3rd image is removed with the variable point.
+  config.RemoveVariablePoint(add_variable_point3D_id);
+  BOOST_REQUIRE(bundle_adjuster.Solve(options, config, &reconstruction));
+  BOOST_CHECK_EQUAL(bundle_adjuster.NumAddedResiduals(), 0);
+  BOOST_CHECK_EQUAL(bundle_adjuster.NumRemovedResiduals(), 1);
+  BOOST_CHECK_EQUAL(bundle_adjuster.Summary().num_residuals_reduced, 400);
+}
+
 BOOST_AUTO_TEST_CASE(TestParallelReconstructionSupported) {
   BundleAdjustmentOptions options;
   options.refine_focal_length = true;
@@ -847,6 +1082,60 @@ BOOST_AUTO_TEST_CASE(TestRigFourView) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(TestRigFourViewIterative) {
+  Reconstruction reconstruction;
+  SceneGraph scene_graph;
+  GenerateReconstruction(4, 100, &reconstruction, &scene_graph);
+  reconstruction.Image(2).SetCameraId(0);
+  reconstruction.Image(3).SetCameraId(1);
+  const auto orig_reconstruction = reconstruction;
+
+  BundleAdjustmentConfig config;
+  config.AddImage(0);
+  config.AddImage(1);
+  config.AddImage(2);
+  config.AddImage(3);
+
+  std::vector<CameraRig> camera_rigs;
+  camera_rigs.emplace_back();
+  camera_rigs[0].AddCamera(0, ComposeIdentityQuaternion(),
+                           Eigen::Vector3d(0, 0, 0));
+  camera_rigs[0].AddCamera(1, ComposeIdentityQuaternion(),
+                           Eigen::Vector3d(0, 0, 0));
+  camera_rigs[0].AddSnapshot({0, 1});
+  camera_rigs[0].AddSnapshot({2, 3});
+  camera_rigs[0].SetRefCameraId(0);
+  const auto orig_camera_rigs = camera_rigs;
+
+  BundleAdjustmentOptions options;
+  RigBundleAdjuster::Options rig_options;
+  rig_options.use_iterative_solver = true;
+  rig_options.num_threads = 2;
+  RigBundleAdjuster bundle_adjuster(options, rig_options, config);
+  BOOST_REQUIRE(bundle_adjuster.Solve(&reconstruction, &camera_rigs));
+
+  const auto summary = bundle_adjuster.Summary();
+
+  BOOST_CHECK_EQUAL(summary.linear_solver_type_used, ceres::ITERATIVE_SCHUR);
+  // The same problem as in TestRigFourView.
+  BOOST_CHECK_EQUAL(summary.num_residuals_reduced, 800);
+  BOOST_CHECK_EQUAL(summary.num_effective_parameters_reduced, 322);
+
+  CheckVariableCamera(reconstruction.Camera(0), orig_reconstruction.Camera(0));
+  CheckVariableImage(reconstruction.Image(0), orig_reconstruction.Image(0));
+
+  CheckVariableCamera(reconstruction.Camera(1), orig_reconstruction.Camera(1));
+  CheckVariableImage(reconstruction.Image(1), orig_reconstruction.Image(1));
+
+  CheckVariableCameraRig(camera_rigs[0], orig_camera_rigs[0], 0);
+  CheckVariableCameraRig(camera_rigs[0], orig_camera_rigs[0], 1);
+
+  for (const auto& point3D : reconstruction.Points3D()) {
+    CheckVariablePoint(point3D.second,
+                       orig_reconstruction.Point3D(point3D.first));
+  }
+}
+
 BOOST_AUTO_TEST_CASE(TestConstantRigFourView) {
   Reconstruction reconstruction;
   SceneGraph scene_graph;
@@ -957,3 +1246,121 @@ BOOST_AUTO_TEST_CASE(TestRigFourViewPartial) {
                        orig_reconstruction.Point3D(point3D.first));
   }
 }
+
+// Two images of a background and an object, where the second image is in a
+// take with an object motion and observes the moved object points.
+void GenerateTwoBodyScene(const size_t num_points, TwoBodyScene* scene) {
+  SetPRNGSeed(0);
+
+  scene->motions.push_back({{0.05, -0.02, 0.1, 0.2, -0.1, 0.3}});
+
+  const std::array<double, 7> cameras[2] = {
+      {{0, 0, 0, 0, 0, 0, 100}}, {{0.02, 0.1, -0.05, -1, 0.1, 0.2, 120}}};
+  for (image_t image_id = 0; image_id < 2; ++image_id) {
+    scene->images[image_id].camera = cameras[image_id];
+  }
+  scene->images[1].motion_idx = 0;
+
+  for (point3D_t point3D_id = 0; point3D_id < 2 * num_points; ++point3D_id) {
+    const Eigen::Vector3d xyz(RandomReal(-1.0, 1.0), RandomReal(-1.0, 1.0),
+                              RandomReal(4.0, 6.0));
+    scene->points3D.emplace(point3D_id, xyz);
+    const bool is_object = point3D_id >= num_points;
+    if (is_object) {
+      scene->object_point3D_ids.insert(point3D_id);
+    }
+
+    for (auto& image : scene->images) {
+      const double* point3D_data = xyz.data();
+      double residuals[2];
+      if (is_object && image.second.motion_idx >= 0) {
+        const double* parameters[3] = {
+            image.second.camera.data(), point3D_data,
+            scene->motions[image.second.motion_idx].data()};
+        std::unique_ptr<ceres::CostFunction>(
+            TwoBodyObjectCostFunction::Create(Eigen::Vector2d::Zero()))
+            ->Evaluate(parameters, residuals, nullptr);
+      } else {
+        const double* parameters[2] = {image.second.camera.data(),
+                                       point3D_data};
+        std::unique_ptr<ceres::CostFunction>(
+            TwoBodyCostFunction::Create(Eigen::Vector2d::Zero()))
+            ->Evaluate(parameters, residuals, nullptr);
+      }
+      image.second.points2D.emplace_back(
+          residuals[0] + RandomGaussian(0.0, 0.1),
+          residuals[1] + RandomGaussian(0.0, 0.1));
+      image.second.point3D_ids.push_back(point3D_id);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestTwoBody) {
+  TwoBodyScene scene;
+  GenerateTwoBodyScene(50, &scene);
+  const TwoBodyScene orig_scene = scene;
+
+  BundleAdjustmentConfig config;
+  config.AddImage(0);
+  config.AddImage(1);
+  config.SetConstantPose(0);
+
+  BundleAdjustmentOptions options;
+  TwoBodyBundleAdjuster::Options two_body_options;
+  TwoBodyBundleAdjuster bundle_adjuster(options, two_body_options, config);
+  BOOST_REQUIRE(bundle_adjuster.Solve(&scene));
+
+  const auto summary = bundle_adjuster.Summary();
+
+  // 100 points, 2 images, 2 residuals per point per image
+  BOOST_CHECK_EQUAL(summary.num_residuals_reduced, 400);
+  // 100 x 3 point parameters
+  // + 1 + 7 camera parameters
+  // + 6 motion parameters
+  BOOST_CHECK_EQUAL(summary.num_effective_parameters_reduced, 314);
+  BOOST_CHECK_LT(summary.final_cost, summary.initial_cost);
+
+  for (int idx = 0; idx < 6; ++idx) {
+    BOOST_CHECK_EQUAL(scene.images.at(0).camera[idx],
+                      orig_scene.images.at(0).camera[idx]);
+  }
+  BOOST_CHECK_NE(scene.images.at(0).camera[6],
+                 orig_scene.images.at(0).camera[6]);
+  BOOST_CHECK(scene.images.at(1).camera != orig_scene.images.at(1).camera);
+  BOOST_CHECK(scene.motions[0] != orig_scene.motions[0]);
+}
+
+BOOST_AUTO_TEST_CASE(TestTwoBodyConstantMotions) {
+  TwoBodyScene scene;
+  GenerateTwoBodyScene(50, &scene);
+  const TwoBodyScene orig_scene = scene;
+
+  BundleAdjustmentConfig config;
+  config.AddImage(1);
+  config.SetConstantCamera(1);
+  for (point3D_t point3D_id = 0; point3D_id < 10; ++point3D_id) {
+    config.AddVariablePoint(point3D_id);
+  }
+  config.AddConstantPoint(90);
+
+  BundleAdjustmentOptions options;
+  TwoBodyBundleAdjuster::Options two_body_options;
+  two_body_options.refine_motions = false;
+  TwoBodyBundleAdjuster bundle_adjuster(options, two_body_options, config);
+  BOOST_REQUIRE(bundle_adjuster.Solve(&scene));
+
+  const auto summary = bundle_adjuster.Summary();
+
+  // 100 points in the second image and 11 points in the constant first image,
+  // 2 residuals per point per image
+  BOOST_CHECK_EQUAL(summary.num_residuals_reduced, 222);
+  // 99 x 3 point parameters
+  // + 6 camera parameters
+  BOOST_CHECK_EQUAL(summary.num_effective_parameters_reduced, 303);
+
+  BOOST_CHECK(scene.images.at(0).camera == orig_scene.images.at(0).camera);
+  BOOST_CHECK_EQUAL(scene.images.at(1).camera[6],
+                    orig_scene.images.at(1).camera[6]);
+  BOOST_CHECK(scene.motions[0] == orig_scene.motions[0]);
+  BOOST_CHECK(scene.points3D.at(90) == orig_scene.points3D.at(90));
+}
@@ -17,7 +17,10 @@
 #ifndef COLMAP_SRC_OPTIM_LORANSAC_H_
 #define COLMAP_SRC_OPTIM_LORANSAC_H_
 
+#include <atomic>
 #include <cfloat>
+#include <functional>
+#include <mutex>
 #include <random>
 #include <stdexcept>
 #include <vector>
@@ -27,6 +30,9 @@
 #include "optim/support_measurement.h"
 #include "util/alignment.h"
 #include "util/logging.h"
+#include "util/metrics.h"
+#include "util/scratch.h"
+#include "util/trace.h"
 
 namespace colmap {
 
@@ -58,6 +64,15 @@ class LORANSAC : public RANSAC<Estimator, SupportMeasurer, Sampler> {
   using RANSAC<Estimator, SupportMeasurer, Sampler>::support_measurer;
 
  private:
+  // Run the trials of `Estimate` on multiple threads, see
+  // `RANSACOptions::num_threads`, and return the number of trials.
+  size_t EstimateParallel(const std::vector<typename Estimator::X_t>& X,
+                          const std::vector<typename Estimator::Y_t>& Y,
+                          const int num_threads,
+                          typename SupportMeasurer::Support* best_support,
+                          typename Estimator::M_t* best_model,
+                          bool* best_model_is_local);
+
   using RANSAC<Estimator, SupportMeasurer, Sampler>::options_;
 };
 
@@ -77,6 +92,7 @@ typename LORANSAC<Estimator, LocalEstimator, SupportMeasurer, Sampler>::Report
 LORANSAC<Estimator, LocalEstimator, SupportMeasurer, Sampler>::Estimate(
     const std::vector<typename Estimator::X_t>& X,
     const std::vector<typename Estimator::Y_t>& Y) {
+  TRACE_SCOPE("LORANSAC::Estimate");
   CHECK_EQ(X.size(), Y.size());
 
   const size_t num_samples = X.size();
@@ -97,92 +113,121 @@ LORANSAC<Estimator, LocalEstimator, SupportMeasurer, Sampler>::Estimate(
 
   const double max_residual = options_.max_error * options_.max_error;
 
-  std::vector<double> residuals(num_samples);
+  // The temporaries are recycled between the estimations of a thread.
+  ScratchVector<double> residuals_buffer(num_samples);
+  std::vector<double>& residuals = *residuals_buffer;
 
-  std::vector<typename LocalEstimator::X_t> X_inlier;
-  std::vector<typename LocalEstimator::Y_t> Y_inlier;
+  ScratchVector<typename LocalEstimator::X_t> X_inlier_buffer;
+  ScratchVector<typename LocalEstimator::Y_t> Y_inlier_buffer;
+  std::vector<typename LocalEstimator::X_t>& X_inlier = *X_inlier_buffer;
+  std::vector<typename LocalEstimator::Y_t>& Y_inlier = *Y_inlier_buffer;
 
-  std::vector<typename Estimator::X_t> X_rand(Estimator::kMinNumSamples);
-  std::vector<typename Estimator::Y_t> Y_rand(Estimator::kMinNumSamples);
+  ScratchVector<typename Estimator::X_t> X_rand_buffer(
+      Estimator::kMinNumSamples);
+  ScratchVector<typename Estimator::Y_t> Y_rand_buffer(
+      Estimator::kMinNumSamples);
+  std::vector<typename Estimator::X_t>& X_rand = *X_rand_buffer;
+  std::vector<typename Estimator::Y_t>& Y_rand = *Y_rand_buffer;
 
   sampler.Initialize(num_samples);
 
+  SPRTVerifier<Estimator> sprt_verifier(options_);
+  sprt_verifier.Initialize(X, Y);
+
   size_t max_num_trials = options_.max_num_trials;
   max_num_trials = std::min<size_t>(max_num_trials, sampler.MaxNumSamples());
   size_t dyn_max_num_trials = max_num_trials;
 
-  for (report.num_trials = 0; report.num_trials < max_num_trials;
-       ++report.num_trials) {
-    if (abort) {
-      report.num_trials += 1;
-      break;
-    }
-
-    sampler.SampleXY(X, Y, &X_rand, &Y_rand);
-
-    // Estimate model for current subset.
-    const std::vector<typename Estimator::M_t> sample_models =
-        estimator.Estimate(X_rand, Y_rand);
-
-    // Iterate through all estimated models
-    for (const auto& sample_model : sample_models) {
-      estimator.Residuals(X, Y, sample_model, &residuals);
-      CHECK_EQ(residuals.size(), X.size());
-
-      const auto support = support_measurer.Evaluate(residuals, max_residual);
-
-      // Do local optimization if better than all previous subsets.
-      if (support_measurer.Compare(support, best_support)) {
-        best_support = support;
-        best_model = sample_model;
-        best_model_is_local = false;
-
-        // Estimate locally optimized model from inliers.
-        if (support.num_inliers > Estimator::kMinNumSamples &&
-            support.num_inliers >= LocalEstimator::kMinNumSamples) {
-          X_inlier.clear();
-          Y_inlier.clear();
-          X_inlier.reserve(support.num_inliers);
-          Y_inlier.reserve(support.num_inliers);
-          for (size_t i = 0; i < residuals.size(); ++i) {
-            if (residuals[i] <= max_residual) {
-              X_inlier.push_back(X[i]);
-              Y_inlier.push_back(Y[i]);
-            }
-          }
-
-          const std::vector<typename LocalEstimator::M_t> local_models =
-              local_estimator.Estimate(X_inlier, Y_inlier);
-
-          for (const auto& local_model : local_models) {
-            local_estimator.Residuals(X, Y, local_model, &residuals);
-            CHECK_EQ(residuals.size(), X.size());
+  const int num_threads = NumRANSACThreads<Sampler>(options_);
+  if (num_threads > 1) {
+    report.num_trials = EstimateParallel(X, Y, num_threads, &best_support,
+                                         &best_model, &best_model_is_local);
+  } else {
+    ScopedPRNG trial_prng(RandomSeed(), 0);
+    for (report.num_trials = 0; report.num_trials < max_num_trials;
+         ++report.num_trials) {
+      if (abort) {
+        report.num_trials += 1;
+        break;
+      }
 
-            const auto local_support =
-                support_measurer.Evaluate(residuals, max_residual);
+      if (report.num_trials % kRANSACTrialBlockSize == 0) {
+        trial_prng.SetStream(report.num_trials / kRANSACTrialBlockSize);
+      }
 
-            // Check if non-locally optimized model is better.
-            if (support_measurer.Compare(local_support, support)) {
-              best_support = local_support;
-              best_model = local_model;
-              best_model_is_local = true;
+      sampler.SampleXY(X, Y, &X_rand, &Y_rand);
+
+      // Estimate model for current subset.
+      const std::vector<typename Estimator::M_t> sample_models =
+          estimator.Estimate(X_rand, Y_rand);
+
+      // Iterate through all estimated models
+      for (const auto& sample_model : sample_models) {
+        if (sprt_verifier.Verify(estimator, sample_model)) {
+          estimator.Residuals(X, Y, sample_model, &residuals);
+          CHECK_EQ(residuals.size(), X.size());
+
+          const auto support =
+              support_measurer.Evaluate(residuals, max_residual);
+
+          // Do local optimization if better than all previous subsets.
+          if (support_measurer.Compare(support, best_support)) {
+            best_support = support;
+            best_model = sample_model;
+            best_model_is_local = false;
+
+            // Estimate locally optimized model from inliers.
+            if (support.num_inliers > Estimator::kMinNumSamples &&
+                support.num_inliers >= LocalEstimator::kMinNumSamples) {
+              X_inlier.clear();
+              Y_inlier.clear();
+              X_inlier.reserve(support.num_inliers);
+              Y_inlier.reserve(support.num_inliers);
+              for (size_t i = 0; i < residuals.size(); ++i) {
+                if (residuals[i] <= max_residual) {
+                  X_inlier.push_back(X[i]);
+                  Y_inlier.push_back(Y[i]);
+                }
+              }
+
+              const std::vector<typename LocalEstimator::M_t> local_models =
+                  local_estimator.Estimate(X_inlier, Y_inlier);
+
+              for (const auto& local_model : local_models) {
+                local_estimator.Residuals(X, Y, local_model, &residuals);
+                CHECK_EQ(residuals.size(), X.size());
+
+                const auto local_support =
+                    support_measurer.Evaluate(residuals, max_residual);
+
+                // Check if non-locally optimized model is better.
+                if (support_measurer.Compare(local_support, support)) {
+                  best_support = local_support;
+                  best_model = local_model;
+                  best_model_is_local = true;
+                }
+              }
             }
+
+            dyn_max_num_trials =
+                RANSAC<Estimator, SupportMeasurer, Sampler>::ComputeNumTrials(
+                    best_support.num_inliers, num_samples, options_.confidence);
+            sprt_verifier.UpdateBestInlierRatio(
+                best_support.num_inliers / static_cast<double>(num_samples));
           }
         }
 
-        dyn_max_num_trials =
-            RANSAC<Estimator, SupportMeasurer, Sampler>::ComputeNumTrials(
-                best_support.num_inliers, num_samples, options_.confidence);
-      }
-
-      if (report.num_trials >= dyn_max_num_trials &&
-          report.num_trials >= options_.min_num_trials) {
-        abort = true;
-        break;
+        if (report.num_trials >= dyn_max_num_trials &&
+            report.num_trials >= options_.min_num_trials) {
+          abort = true;
+          break;
+        }
       }
     }
   }
 
+  METRIC_COUNTER_ADD("ransac/num_trials", report.num_trials);
+
   report.support = best_support;
   report.model = best_model;
 
@@ -217,6 +262,133 @@ LORANSAC<Estimator, LocalEstimator, SupportMeasurer, Sampler>::Estimate(
   return report;
 }
 
+template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+          typename Sampler>
+size_t
+LORANSAC<Estimator, LocalEstimator, SupportMeasurer, Sampler>::EstimateParallel(
+    const std::vector<typename Estimator::X_t>& X,
+    const std::vector<typename Estimator::Y_t>& Y, const int num_threads,
+    typename SupportMeasurer::Support* best_support,
+    typename Estimator::M_t* best_model, bool* best_model_is_local) {
+  const size_t num_samples = X.size();
+  const double max_residual = options_.max_error * options_.max_error;
+  const size_t max_num_trials =
+      std::min<size_t>(options_.max_num_trials, sampler.MaxNumSamples());
+
+  std::mutex best_mutex;
+  std::atomic<size_t> dyn_max_num_trials(max_num_trials);
+
+  return RunParallelRANSACTrials(
+      num_threads, options_.min_num_trials, max_num_trials, dyn_max_num_trials,
+      [&](const std::function<bool()>& next_trial) {
+        Estimator thread_estimator = estimator;
+        LocalEstimator thread_local_estimator = local_estimator;
+        Sampler thread_sampler = sampler;
+        SupportMeasurer thread_support_measurer = support_measurer;
+        thread_sampler.Initialize(num_samples);
+
+        SPRTVerifier<Estimator> sprt_verifier(options_);
+        sprt_verifier.Initialize(X, Y);
+
+        ScratchVector<double> residuals_buffer(num_samples);
+        std::vector<double>& residuals = *residuals_buffer;
+        ScratchVector<typename LocalEstimator::X_t> X_inlier_buffer;
+        ScratchVector<typename LocalEstimator::Y_t> Y_inlier_buffer;
+        std::vector<typename LocalEstimator::X_t>& X_inlier = *X_inlier_buffer;
+        std::vector<typename LocalEstimator::Y_t>& Y_inlier = *Y_inlier_buffer;
+        ScratchVector<typename Estimator::X_t> X_rand_buffer(
+            Estimator::kMinNumSamples);
+        ScratchVector<typename Estimator::Y_t> Y_rand_buffer(
+            Estimator::kMinNumSamples);
+        std::vector<typename Estimator::X_t>& X_rand = *X_rand_buffer;
+        std::vector<typename Estimator::Y_t>& Y_rand = *Y_rand_buffer;
+
+        // The best support of all threads when this thread last looked, which
+        // avoids the local optimization and the lock for models that cannot
+        // be the best.
+        typename SupportMeasurer::Support known_best_support;
+
+        while (next_trial()) {
+          thread_sampler.SampleXY(X, Y, &X_rand, &Y_rand);
+
+          const std::vector<typename Estimator::M_t> sample_models =
+              thread_estimator.Estimate(X_rand, Y_rand);
+
+          for (const auto& sample_model : sample_models) {
+            if (!sprt_verifier.Verify(thread_estimator, sample_model)) {
+              continue;
+            }
+
+            thread_estimator.Residuals(X, Y, sample_model, &residuals);
+            CHECK_EQ(residuals.size(), X.size());
+
+            const auto support =
+                thread_support_measurer.Evaluate(residuals, max_residual);
+            if (!thread_support_measurer.Compare(support, known_best_support)) {
+              continue;
+            }
+
+            auto thread_best_support = support;
+            typename Estimator::M_t thread_best_model = sample_model;
+            bool thread_best_model_is_local = false;
+
+            // Estimate locally optimized model from inliers.
+            if (support.num_inliers > Estimator::kMinNumSamples &&
+                support.num_inliers >= LocalEstimator::kMinNumSamples) {
+              X_inlier.clear();
+              Y_inlier.clear();
+              X_inlier.reserve(support.num_inliers);
+              Y_inlier.reserve(support.num_inliers);
+              for (size_t i = 0; i < residuals.size(); ++i) {
+                if (residuals[i] <= max_residual) {
+                  X_inlier.push_back(X[i]);
+                  Y_inlier.push_back(Y[i]);
+                }
+              }
+
+              const std::vector<typename LocalEstimator::M_t> local_models =
+                  thread_local_estimator.Estimate(X_inlier, Y_inlier);
+
+              for (const auto& local_model : local_models) {
+                thread_local_estimator.Residuals(X, Y, local_model,
+                                                 &residuals);
+                CHECK_EQ(residuals.size(), X.size());
+
+                const auto local_support =
+                    thread_support_measurer.Evaluate(residuals, max_residual);
+
+                // Check if non-locally optimized model is better.
+                if (thread_support_measurer.Compare(local_support, support)) {
+                  thread_best_support = local_support;
+                  thread_best_model = local_model;
+                  thread_best_model_is_local = true;
+                }
+              }
+            }
+
+            {
+              std::unique_lock<std::mutex> lock(best_mutex);
+              if (thread_support_measurer.Compare(thread_best_support,
+                                                  *best_support)) {
+                *best_support = thread_best_support;
+                *best_model = thread_best_model;
+                *best_model_is_local = thread_best_model_is_local;
+                dyn_max_num_trials =
+                    RANSAC<Estimator, SupportMeasurer, Sampler>::
+                        ComputeNumTrials(thread_best_support.num_inliers,
+                                         num_samples, options_.confidence);
+              }
+              known_best_support = *best_support;
+            }
+
+            sprt_verifier.UpdateBestInlierRatio(
+                known_best_support.num_inliers /
+                static_cast<double>(num_samples));
+          }
+        }
+      });
+}
+
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_OPTIM_LORANSAC_H_
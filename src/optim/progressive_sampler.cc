@@ -88,9 +88,10 @@ std::vector<size_t> ProgressiveSampler::Sample() {
     }
   }
 
-  // In progressive sampling mode, the last element is mandatory.
+  // In progressive sampling mode, the last element of the first n samples
+  // is mandatory.
   if (T_n_p_ >= t_) {
-    sampled_idxs.push_back(n_);
+    sampled_idxs.push_back(n_ - 1);
   }
 
   return sampled_idxs;
@@ -33,6 +33,9 @@ BOOST_AUTO_TEST_CASE(TestLessSamples) {
     BOOST_CHECK_EQUAL(samples.size(), 2);
     BOOST_CHECK_EQUAL(
         std::unordered_set<size_t>(samples.begin(), samples.end()).size(), 2);
+    for (const auto sample : samples) {
+      BOOST_CHECK_LT(sample, 5);
+    }
   }
 }
 
@@ -46,6 +49,9 @@ BOOST_AUTO_TEST_CASE(TestEqualSamples) {
     BOOST_CHECK_EQUAL(samples.size(), 5);
     BOOST_CHECK_EQUAL(
         std::unordered_set<size_t>(samples.begin(), samples.end()).size(), 5);
+    for (const auto sample : samples) {
+      BOOST_CHECK_LT(sample, 5);
+    }
   }
 }
 
@@ -53,9 +59,10 @@ BOOST_AUTO_TEST_CASE(TestProgressive) {
   const size_t kNumSamples = 5;
   ProgressiveSampler sampler(kNumSamples);
   sampler.Initialize(50);
-  size_t prev_last_sample = 5;
+  size_t prev_last_sample = kNumSamples - 1;
   for (size_t i = 0; i < 100; ++i) {
     const auto samples = sampler.Sample();
+    BOOST_CHECK_LT(samples.back(), 50);
     for (size_t i = 0; i < samples.size() - 1; ++i) {
       BOOST_CHECK_LT(samples[i], samples.back());
       BOOST_CHECK_GE(samples.back(), prev_last_sample);
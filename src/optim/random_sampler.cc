@@ -16,8 +16,6 @@
 
 #include "optim/random_sampler.h"
 
-#include <numeric>
-
 #include "util/random.h"
 
 namespace colmap {
@@ -27,8 +25,7 @@ RandomSampler::RandomSampler(const size_t num_samples)
 
 void RandomSampler::Initialize(const size_t total_num_samples) {
   CHECK_LE(num_samples_, total_num_samples);
-  sample_idxs_.resize(total_num_samples);
-  std::iota(sample_idxs_.begin(), sample_idxs_.end(), 0);
+  is_sampled_.assign(total_num_samples, 0);
 }
 
 size_t RandomSampler::MaxNumSamples() {
@@ -36,11 +33,38 @@ size_t RandomSampler::MaxNumSamples() {
 }
 
 std::vector<size_t> RandomSampler::Sample() {
-  Shuffle(static_cast<uint32_t>(num_samples_), &sample_idxs_);
+  const uint32_t total_num_samples = static_cast<uint32_t>(is_sampled_.size());
+  std::vector<size_t> sampled_idxs;
+  sampled_idxs.reserve(num_samples_);
+
+  if (2 * num_samples_ <= total_num_samples) {
+    // Draw without replacement by rejecting the indices that were already
+    // drawn, which takes less than two draws per index on average.
+    while (sampled_idxs.size() < num_samples_) {
+      const uint32_t idx = RandomInteger<uint32_t>(0, total_num_samples - 1);
+      if (!is_sampled_[idx]) {
+        is_sampled_[idx] = 1;
+        sampled_idxs.push_back(idx);
+      }
+    }
+  } else {
+    // Floyd's algorithm draws a uniformly distributed subset, whose order is
+    // then shuffled, since the estimators of joint estimations only use the
+    // first samples.
+    for (uint32_t j = total_num_samples - static_cast<uint32_t>(num_samples_);
+         j < total_num_samples; ++j) {
+      uint32_t idx = RandomInteger<uint32_t>(0, j);
+      if (is_sampled_[idx]) {
+        idx = j;
+      }
+      is_sampled_[idx] = 1;
+      sampled_idxs.push_back(idx);
+    }
+    Shuffle(static_cast<uint32_t>(sampled_idxs.size()), &sampled_idxs);
+  }
 
-  std::vector<size_t> sampled_idxs(num_samples_);
-  for (size_t i = 0; i < num_samples_; ++i) {
-    sampled_idxs[i] = sample_idxs_[i];
+  for (const size_t idx : sampled_idxs) {
+    is_sampled_[idx] = 0;
   }
 
   return sampled_idxs;
@@ -21,7 +21,10 @@
 
 namespace colmap {
 
-// Random sampler for RANSAC-based methods.
+// Random sampler for RANSAC-based methods. Every sample only depends on the
+// random numbers that it draws and not on the previous samples, so that a
+// trial draws the same sample from the same random stream, whichever sampler
+// and thread run it.
 //
 // Note that a separate sampler should be instantiated per thread.
 class RandomSampler : public Sampler {
@@ -36,7 +39,9 @@ class RandomSampler : public Sampler {
 
  private:
   const size_t num_samples_;
-  std::vector<size_t> sample_idxs_;
+  // Whether the samples are part of the current sample, which is all false
+  // between the calls to `Sample`.
+  std::vector<char> is_sampled_;
 };
 
 }  // namespace colmap
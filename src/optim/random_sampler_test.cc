@@ -20,6 +20,7 @@
 #include <unordered_set>
 
 #include "optim/random_sampler.h"
+#include "util/random.h"
 
 using namespace colmap;
 
@@ -48,3 +49,49 @@ BOOST_AUTO_TEST_CASE(TestEqualSamples) {
         std::unordered_set<size_t>(samples.begin(), samples.end()).size(), 5);
   }
 }
+
+BOOST_AUTO_TEST_CASE(TestUniformOrder) {
+  // Every index is drawn at every position of the sample.
+  RandomSampler sampler(3);
+  sampler.Initialize(5);
+  std::vector<std::vector<int>> counts(3, std::vector<int>(5, 0));
+  for (size_t i = 0; i < 3000; ++i) {
+    const auto samples = sampler.Sample();
+    for (size_t j = 0; j < samples.size(); ++j) {
+      counts[j][samples[j]] += 1;
+    }
+  }
+  for (const auto& position_counts : counts) {
+    for (const int count : position_counts) {
+      BOOST_CHECK_GT(count, 400);
+      BOOST_CHECK_LT(count, 800);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestIndependentOfHistory) {
+  RandomSampler sampler1(4);
+  sampler1.Initialize(100);
+  RandomSampler sampler2(4);
+  sampler2.Initialize(100);
+  {
+    ScopedPRNG scoped_prng(0, 0);
+    for (size_t i = 0; i < 10; ++i) {
+      sampler2.Sample();
+    }
+  }
+  for (uint64_t stream = 0; stream < 10; ++stream) {
+    std::vector<size_t> samples1;
+    {
+      ScopedPRNG scoped_prng(1, stream);
+      samples1 = sampler1.Sample();
+    }
+    std::vector<size_t> samples2;
+    {
+      ScopedPRNG scoped_prng(1, stream);
+      samples2 = sampler2.Sample();
+    }
+    BOOST_CHECK_EQUAL_COLLECTIONS(samples1.begin(), samples1.end(),
+                                  samples2.begin(), samples2.end());
+  }
+}
@@ -17,16 +17,28 @@
 #ifndef COLMAP_SRC_OPTIM_RANSAC_H_
 #define COLMAP_SRC_OPTIM_RANSAC_H_
 
+#include <algorithm>
+#include <atomic>
 #include <cfloat>
+#include <cmath>
+#include <functional>
+#include <mutex>
 #include <random>
 #include <stdexcept>
+#include <type_traits>
 #include <vector>
 #include <iostream>
 
 #include "optim/random_sampler.h"
+#include "optim/sprt.h"
 #include "optim/support_measurement.h"
 #include "util/alignment.h"
 #include "util/logging.h"
+#include "util/metrics.h"
+#include "util/scratch.h"
+#include "util/random.h"
+#include "util/threading.h"
+#include "util/trace.h"
 
 namespace colmap {
 
@@ -47,6 +59,19 @@ struct RANSACOptions {
   size_t min_num_trials = 0;
   size_t max_num_trials = std::numeric_limits<size_t>::max();
 
+  // Whether to reject bad hypotheses early with the sequential probability
+  // ratio test instead of evaluating every hypothesis on all samples. This
+  // mostly pays off at low inlier ratios, where most hypotheses are bad.
+  bool use_sprt = false;
+
+  // Number of threads that draw and score the hypotheses of one estimation
+  // concurrently on the global task scheduler, in blocks of trials. The best
+  // model and the adaptive number of trials are shared, so that all threads
+  // stop once the best model so far reaches the confidence. Only estimators
+  // with the random sampler run in parallel, since the other samplers
+  // enumerate the samples in a fixed order. If -1, all cores are used.
+  int num_threads = 1;
+
   void Check() const {
     if(max_error <= 0)
     {
@@ -60,10 +85,88 @@ struct RANSACOptions {
     CHECK_GE(confidence, 0);
     CHECK_LE(confidence, 1);
     CHECK_LE(min_num_trials, max_num_trials);
+    CHECK_NE(num_threads, 0);
+    CHECK_GE(num_threads, -1);
     //if(max_error)
   }
 };
 
+// Early rejection of RANSAC hypotheses with the sequential probability ratio
+// test (SPRT) of Matas et al. The samples are evaluated in blocks in a random
+// order, which is drawn once per estimation, and the evaluation of a
+// hypothesis stops as soon as the test rejects it. The test adapts to the
+// data: epsilon is the inlier ratio of the best hypothesis so far and delta the
+// inlier ratio of the rejected hypotheses. If `use_sprt` is not set, every
+// hypothesis passes.
+template <typename Estimator>
+class SPRTVerifier {
+ public:
+  explicit SPRTVerifier(const RANSACOptions& options);
+
+  // Draw the order of the samples for a new estimation, optionally only of
+  // the samples with the given indices, and reset the test.
+  void Initialize(const std::vector<typename Estimator::X_t>& X,
+                  const std::vector<typename Estimator::Y_t>& Y,
+                  const std::vector<size_t>* sample_idxs = nullptr);
+
+  // Return whether the hypothesis passed the test, in which case it must be
+  // evaluated on all samples.
+  bool Verify(Estimator& estimator, const typename Estimator::M_t& model);
+
+  // Update the test with the inlier ratio of a new best hypothesis.
+  void UpdateBestInlierRatio(const double inlier_ratio);
+
+  // The number of hypotheses that were rejected since the initialization.
+  size_t NumRejected() const;
+
+ private:
+  static const size_t kBlockSize = 32;
+
+  void UpdateTest();
+
+  const bool enabled_;
+  const double min_inlier_ratio_;
+  const double max_residual_;
+  SPRT::Options sprt_options_;
+  SPRT sprt_;
+  // The test is only meaningful as long as inliers of good models are more
+  // frequent than those of bad models.
+  bool active_;
+  std::vector<std::vector<typename Estimator::X_t>> X_blocks_;
+  std::vector<std::vector<typename Estimator::Y_t>> Y_blocks_;
+  std::vector<double> residuals_;
+  size_t num_rejected_;
+  size_t num_rejected_inliers_;
+  size_t num_rejected_samples_;
+};
+
+// Number of consecutive trials that draw from the same random stream, see
+// `ScopedPRNG`. The streams are keyed by the index of the block and a seed that
+// is drawn from the PRNG of the calling thread, so that a trial draws the same
+// sample, whether the trials run on one or several threads. The parallel
+// estimations hand out the trials to the threads in these blocks.
+const size_t kRANSACTrialBlockSize = 8;
+
+// The number of threads of an estimation with the given sampler, which is one
+// unless the sampler draws independent random samples in every thread.
+template <typename Sampler>
+int NumRANSACThreads(const RANSACOptions& options);
+
+// Run the trials of an estimation on `num_threads` tasks of the global task
+// scheduler. Every task calls `thread_func(next_trial)` once, which sets up its
+// own estimator, sampler and buffers and runs one trial after another as long
+// as `next_trial()` returns true. The trials are handed out in blocks from a
+// shared counter until `dyn_max_num_trials`, which the tasks lower as they find
+// better models, is reached and at least `min_num_trials`, but at most
+// `max_num_trials` trials ran. Every block of trials samples from its own
+// random stream, see `kRANSACTrialBlockSize`. Returns the number of trials
+// that ran.
+size_t RunParallelRANSACTrials(
+    const int num_threads, const size_t min_num_trials,
+    const size_t max_num_trials,
+    const std::atomic<size_t>& dyn_max_num_trials,
+    const std::function<void(const std::function<bool()>&)>& thread_func);
+
 template <typename Estimator, typename SupportMeasurer = InlierSupportMeasurer,
           typename Sampler = RandomSampler>
 class RANSAC {
@@ -112,12 +215,21 @@ class RANSAC {
                   const std::vector<typename Estimator::Y_t>& Y);
 
   // Objects used in RANSAC procedure. Access useful to define custom behavior
-  // through options or e.g. to compute residuals.
+  // through options or e.g. to compute residuals. In the parallel mode, every
+  // thread works on a copy of them.
   Estimator estimator;
   Sampler sampler;
   SupportMeasurer support_measurer;
 
  protected:
+  // Run the trials of `Estimate` on multiple threads, see
+  // `RANSACOptions::num_threads`, and return the number of trials.
+  size_t EstimateParallel(const std::vector<typename Estimator::X_t>& X,
+                          const std::vector<typename Estimator::Y_t>& Y,
+                          const int num_threads,
+                          typename SupportMeasurer::Support* best_support,
+                          typename Estimator::M_t* best_model);
+
   RANSACOptions options_;
 };
 
@@ -125,6 +237,178 @@ class RANSAC {
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
 
+template <typename Sampler>
+int NumRANSACThreads(const RANSACOptions& options) {
+  if (!std::is_same<Sampler, RandomSampler>::value) {
+    return 1;
+  }
+  return GetEffectiveNumThreads(options.num_threads);
+}
+
+inline size_t RunParallelRANSACTrials(
+    const int num_threads, const size_t min_num_trials,
+    const size_t max_num_trials,
+    const std::atomic<size_t>& dyn_max_num_trials,
+    const std::function<void(const std::function<bool()>&)>& thread_func) {
+  // The blocks keep the contention on the counter low while wasting few
+  // trials at the end.
+  const size_t kBlockSize = kRANSACTrialBlockSize;
+
+  std::atomic<size_t> next_block_begin(0);
+  std::atomic<size_t> num_trials(0);
+
+  const auto NumRequiredTrials = [&]() {
+    return std::min(max_num_trials,
+                    std::max(min_num_trials, dyn_max_num_trials.load()));
+  };
+
+  const uint64_t seed = RandomSeed();
+
+  const auto RunThread = [&]() {
+    // The thread-local generator is swapped, so that the tasks of the scheduler
+    // thread that ran before and after this one keep their random sequence.
+    ScopedPRNG trial_prng(seed, 0);
+
+    size_t trial = 0;
+    size_t block_end = 0;
+    thread_func([&]() {
+      if (trial == block_end) {
+        trial = next_block_begin.fetch_add(kBlockSize);
+        block_end = trial + kBlockSize;
+        trial_prng.SetStream(trial / kBlockSize);
+      }
+      if (trial >= NumRequiredTrials()) {
+        block_end = trial;
+        return false;
+      }
+      trial += 1;
+      num_trials += 1;
+      return true;
+    });
+  };
+
+  TaskGroup task_group;
+  for (int thread_idx = 0; thread_idx < num_threads; ++thread_idx) {
+    task_group.Run(RunThread);
+  }
+  task_group.Wait();
+
+  return num_trials;
+}
+
+template <typename Estimator>
+SPRTVerifier<Estimator>::SPRTVerifier(const RANSACOptions& options)
+    : enabled_(options.use_sprt),
+      min_inlier_ratio_(options.min_inlier_ratio),
+      max_residual_(options.max_error * options.max_error),
+      sprt_(SPRT::Options()),
+      active_(false),
+      num_rejected_(0),
+      num_rejected_inliers_(0),
+      num_rejected_samples_(0) {}
+
+template <typename Estimator>
+void SPRTVerifier<Estimator>::Initialize(
+    const std::vector<typename Estimator::X_t>& X,
+    const std::vector<typename Estimator::Y_t>& Y,
+    const std::vector<size_t>* sample_idxs) {
+  if (!enabled_) {
+    return;
+  }
+
+  std::vector<size_t> order;
+  if (sample_idxs == nullptr) {
+    order.resize(X.size());
+    for (size_t i = 0; i < X.size(); ++i) {
+      order[i] = i;
+    }
+  } else {
+    order = *sample_idxs;
+  }
+  Shuffle(static_cast<uint32_t>(order.size()), &order);
+
+  const size_t num_blocks = (order.size() + kBlockSize - 1) / kBlockSize;
+  X_blocks_.resize(num_blocks);
+  Y_blocks_.resize(num_blocks);
+  for (size_t i = 0; i < num_blocks; ++i) {
+    X_blocks_[i].clear();
+    Y_blocks_[i].clear();
+    for (size_t j = i * kBlockSize;
+         j < std::min(order.size(), (i + 1) * kBlockSize); ++j) {
+      X_blocks_[i].push_back(X[order[j]]);
+      Y_blocks_[i].push_back(Y[order[j]]);
+    }
+  }
+
+  sprt_options_ = SPRT::Options();
+  sprt_options_.epsilon = std::max(min_inlier_ratio_, sprt_options_.delta);
+  num_rejected_ = 0;
+  num_rejected_inliers_ = 0;
+  num_rejected_samples_ = 0;
+  UpdateTest();
+}
+
+template <typename Estimator>
+bool SPRTVerifier<Estimator>::Verify(Estimator& estimator,
+                                     const typename Estimator::M_t& model) {
+  if (!enabled_ || !active_) {
+    return true;
+  }
+
+  double likelihood_ratio = 1;
+  size_t num_inliers = 0;
+  size_t num_eval_samples = 0;
+  for (size_t i = 0; i < X_blocks_.size(); ++i) {
+    estimator.Residuals(X_blocks_[i], Y_blocks_[i], model, &residuals_);
+    if (!sprt_.Evaluate(residuals_, max_residual_, &likelihood_ratio,
+                        &num_inliers, &num_eval_samples)) {
+      num_rejected_ += 1;
+      num_rejected_inliers_ += num_inliers;
+      num_rejected_samples_ += num_eval_samples;
+
+      // Re-estimate delta from the rejected hypotheses once it is based on
+      // enough samples and has changed noticeably.
+      const size_t kMinNumDeltaSamples = 100;
+      if (num_rejected_samples_ >= kMinNumDeltaSamples) {
+        const double delta = std::max(
+            1e-4, num_rejected_inliers_ /
+                      static_cast<double>(num_rejected_samples_));
+        if (std::abs(delta - sprt_options_.delta) >
+            0.1 * sprt_options_.delta) {
+          sprt_options_.delta = delta;
+          UpdateTest();
+        }
+      }
+
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template <typename Estimator>
+void SPRTVerifier<Estimator>::UpdateBestInlierRatio(const double inlier_ratio) {
+  if (!enabled_ || inlier_ratio <= sprt_options_.epsilon) {
+    return;
+  }
+  sprt_options_.epsilon = std::min(inlier_ratio, 1 - 1e-4);
+  UpdateTest();
+}
+
+template <typename Estimator>
+size_t SPRTVerifier<Estimator>::NumRejected() const {
+  return num_rejected_;
+}
+
+template <typename Estimator>
+void SPRTVerifier<Estimator>::UpdateTest() {
+  active_ = sprt_options_.delta < sprt_options_.epsilon;
+  if (active_) {
+    sprt_.Update(sprt_options_);
+  }
+}
+
 template <typename Estimator, typename SupportMeasurer, typename Sampler>
 RANSAC<Estimator, SupportMeasurer, Sampler>::RANSAC(
     const RANSACOptions& options)
@@ -164,6 +448,7 @@ typename RANSAC<Estimator, SupportMeasurer, Sampler>::Report
 RANSAC<Estimator, SupportMeasurer, Sampler>::Estimate(
     const std::vector<typename Estimator::X_t>& X,
     const std::vector<typename Estimator::Y_t>& Y) {
+  TRACE_SCOPE("RANSAC::Estimate");
   CHECK_EQ(X.size(), Y.size());
 
   const size_t num_samples = X.size();
@@ -183,54 +468,81 @@ RANSAC<Estimator, SupportMeasurer, Sampler>::Estimate(
 
   const double max_residual = options_.max_error * options_.max_error;
 
-  std::vector<double> residuals(num_samples);
+  // The temporaries are recycled between the estimations of a thread.
+  ScratchVector<double> residuals_buffer(num_samples);
+  std::vector<double>& residuals = *residuals_buffer;
 
-  std::vector<typename Estimator::X_t> X_rand(Estimator::kMinNumSamples);
-  std::vector<typename Estimator::Y_t> Y_rand(Estimator::kMinNumSamples);
+  ScratchVector<typename Estimator::X_t> X_rand_buffer(
+      Estimator::kMinNumSamples);
+  ScratchVector<typename Estimator::Y_t> Y_rand_buffer(
+      Estimator::kMinNumSamples);
+  std::vector<typename Estimator::X_t>& X_rand = *X_rand_buffer;
+  std::vector<typename Estimator::Y_t>& Y_rand = *Y_rand_buffer;
 
   sampler.Initialize(num_samples);
 
+  SPRTVerifier<Estimator> sprt_verifier(options_);
+  sprt_verifier.Initialize(X, Y);
+
   size_t max_num_trials = options_.max_num_trials;
   max_num_trials = std::min<size_t>(max_num_trials, sampler.MaxNumSamples());
   size_t dyn_max_num_trials = max_num_trials;
 
-  for (report.num_trials = 0; report.num_trials < max_num_trials;
-       ++report.num_trials) {
-    if (abort) {
-      report.num_trials += 1;
-      break;
-    }
-
-    sampler.SampleXY(X, Y, &X_rand, &Y_rand);
-
-    // Estimate model for current subset.
-    const std::vector<typename Estimator::M_t> sample_models =
-        estimator.Estimate(X_rand, Y_rand);
-
-    // Iterate through all estimated models.
-    for (const auto& sample_model : sample_models) {
-      estimator.Residuals(X, Y, sample_model, &residuals);
-      CHECK_EQ(residuals.size(), X.size());
-
-      const auto support = support_measurer.Evaluate(residuals, max_residual);
-
-      // Save as best subset if better than all previous subsets.
-      if (support_measurer.Compare(support, best_support)) {
-        best_support = support;
-        best_model = sample_model;
+  const int num_threads = NumRANSACThreads<Sampler>(options_);
+  if (num_threads > 1) {
+    report.num_trials =
+        EstimateParallel(X, Y, num_threads, &best_support, &best_model);
+  } else {
+    ScopedPRNG trial_prng(RandomSeed(), 0);
+    for (report.num_trials = 0; report.num_trials < max_num_trials;
+         ++report.num_trials) {
+      if (abort) {
+        report.num_trials += 1;
+        break;
+      }
 
-        dyn_max_num_trials = ComputeNumTrials(best_support.num_inliers,
-                                              num_samples, options_.confidence);
+      if (report.num_trials % kRANSACTrialBlockSize == 0) {
+        trial_prng.SetStream(report.num_trials / kRANSACTrialBlockSize);
       }
 
-      if (report.num_trials >= dyn_max_num_trials &&
-          report.num_trials >= options_.min_num_trials) {
-        abort = true;
-        break;
+      sampler.SampleXY(X, Y, &X_rand, &Y_rand);
+
+      // Estimate model for current subset.
+      const std::vector<typename Estimator::M_t> sample_models =
+          estimator.Estimate(X_rand, Y_rand);
+
+      // Iterate through all estimated models.
+      for (const auto& sample_model : sample_models) {
+        if (sprt_verifier.Verify(estimator, sample_model)) {
+          estimator.Residuals(X, Y, sample_model, &residuals);
+          CHECK_EQ(residuals.size(), X.size());
+
+          const auto support =
+              support_measurer.Evaluate(residuals, max_residual);
+
+          // Save as best subset if better than all previous subsets.
+          if (support_measurer.Compare(support, best_support)) {
+            best_support = support;
+            best_model = sample_model;
+
+            dyn_max_num_trials = ComputeNumTrials(
+                best_support.num_inliers, num_samples, options_.confidence);
+            sprt_verifier.UpdateBestInlierRatio(
+                best_support.num_inliers / static_cast<double>(num_samples));
+          }
+        }
+
+        if (report.num_trials >= dyn_max_num_trials &&
+            report.num_trials >= options_.min_num_trials) {
+          abort = true;
+          break;
+        }
       }
     }
   }
 
+  METRIC_COUNTER_ADD("ransac/num_trials", report.num_trials);
+
   report.support = best_support;
   report.model = best_model;
 
@@ -260,6 +572,83 @@ RANSAC<Estimator, SupportMeasurer, Sampler>::Estimate(
   return report;
 }
 
+template <typename Estimator, typename SupportMeasurer, typename Sampler>
+size_t RANSAC<Estimator, SupportMeasurer, Sampler>::EstimateParallel(
+    const std::vector<typename Estimator::X_t>& X,
+    const std::vector<typename Estimator::Y_t>& Y, const int num_threads,
+    typename SupportMeasurer::Support* best_support,
+    typename Estimator::M_t* best_model) {
+  const size_t num_samples = X.size();
+  const double max_residual = options_.max_error * options_.max_error;
+  const size_t max_num_trials =
+      std::min<size_t>(options_.max_num_trials, sampler.MaxNumSamples());
+
+  std::mutex best_mutex;
+  std::atomic<size_t> dyn_max_num_trials(max_num_trials);
+
+  return RunParallelRANSACTrials(
+      num_threads, options_.min_num_trials, max_num_trials, dyn_max_num_trials,
+      [&](const std::function<bool()>& next_trial) {
+        Estimator thread_estimator = estimator;
+        Sampler thread_sampler = sampler;
+        SupportMeasurer thread_support_measurer = support_measurer;
+        thread_sampler.Initialize(num_samples);
+
+        SPRTVerifier<Estimator> sprt_verifier(options_);
+        sprt_verifier.Initialize(X, Y);
+
+        ScratchVector<double> residuals_buffer(num_samples);
+        std::vector<double>& residuals = *residuals_buffer;
+        ScratchVector<typename Estimator::X_t> X_rand_buffer(
+            Estimator::kMinNumSamples);
+        ScratchVector<typename Estimator::Y_t> Y_rand_buffer(
+            Estimator::kMinNumSamples);
+        std::vector<typename Estimator::X_t>& X_rand = *X_rand_buffer;
+        std::vector<typename Estimator::Y_t>& Y_rand = *Y_rand_buffer;
+
+        // The best support of all threads when this thread last looked, which
+        // avoids taking the lock for models that cannot be the best.
+        typename SupportMeasurer::Support known_best_support;
+
+        while (next_trial()) {
+          thread_sampler.SampleXY(X, Y, &X_rand, &Y_rand);
+
+          const std::vector<typename Estimator::M_t> sample_models =
+              thread_estimator.Estimate(X_rand, Y_rand);
+
+          for (const auto& sample_model : sample_models) {
+            if (!sprt_verifier.Verify(thread_estimator, sample_model)) {
+              continue;
+            }
+
+            thread_estimator.Residuals(X, Y, sample_model, &residuals);
+            CHECK_EQ(residuals.size(), X.size());
+
+            const auto support =
+                thread_support_measurer.Evaluate(residuals, max_residual);
+            if (!thread_support_measurer.Compare(support, known_best_support)) {
+              continue;
+            }
+
+            {
+              std::unique_lock<std::mutex> lock(best_mutex);
+              if (thread_support_measurer.Compare(support, *best_support)) {
+                *best_support = support;
+                *best_model = sample_model;
+                dyn_max_num_trials = ComputeNumTrials(
+                    support.num_inliers, num_samples, options_.confidence);
+              }
+              known_best_support = *best_support;
+            }
+
+            sprt_verifier.UpdateBestInlierRatio(
+                known_best_support.num_inliers /
+                static_cast<double>(num_samples));
+          }
+        }
+      });
+}
+
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_OPTIM_RANSAC_H_
@@ -35,6 +35,7 @@ BOOST_AUTO_TEST_CASE(TestOptions) {
   BOOST_CHECK_EQUAL(options.confidence, 0.99);
   BOOST_CHECK_EQUAL(options.min_num_trials, 0);
   BOOST_CHECK_EQUAL(options.max_num_trials, std::numeric_limits<size_t>::max());
+  BOOST_CHECK_EQUAL(options.use_sprt, false);
 }
 
 BOOST_AUTO_TEST_CASE(TestReport) {
@@ -118,3 +119,156 @@ BOOST_AUTO_TEST_CASE(TestSimilarityTransform) {
       (orig_tform.Matrix().topLeftCorner<3, 4>() - report.model).norm();
   BOOST_CHECK(std::abs(matrix_diff) < 1e-6);
 }
+
+BOOST_AUTO_TEST_CASE(TestSPRT) {
+  SetPRNGSeed(0);
+
+  const size_t num_samples = 1000;
+  const size_t num_outliers = 800;
+
+  const SimilarityTransform3 orig_tform(2, ComposeIdentityQuaternion(),
+                                        Eigen::Vector3d(100, 10, 10));
+
+  std::vector<Eigen::Vector3d> src;
+  std::vector<Eigen::Vector3d> dst;
+  for (size_t i = 0; i < num_samples; ++i) {
+    src.emplace_back(i, std::sqrt(i) + 2, std::sqrt(2 * i + 2));
+    dst.push_back(src.back());
+    orig_tform.TransformPoint(&dst.back());
+  }
+
+  for (size_t i = 0; i < num_outliers; ++i) {
+    dst[i] = Eigen::Vector3d(RandomReal(-3000.0, -2000.0),
+                             RandomReal(-4000.0, -3000.0),
+                             RandomReal(-5000.0, -4000.0));
+  }
+
+  RANSACOptions options;
+  options.max_error = 10;
+  options.min_inlier_ratio = 0.1;
+  options.use_sprt = true;
+
+  // Bad hypotheses are rejected, good ones pass.
+  SimilarityTransformEstimator<3> estimator;
+  SPRTVerifier<SimilarityTransformEstimator<3>> verifier(options);
+  verifier.Initialize(src, dst);
+  verifier.UpdateBestInlierRatio(0.2);
+  const SimilarityTransform3 bad_tform(1, ComposeIdentityQuaternion(),
+                                       Eigen::Vector3d(0, 0, 0));
+  BOOST_CHECK(!verifier.Verify(estimator,
+                               bad_tform.Matrix().topLeftCorner<3, 4>()));
+  BOOST_CHECK(verifier.Verify(estimator,
+                              orig_tform.Matrix().topLeftCorner<3, 4>()));
+  BOOST_CHECK_EQUAL(verifier.NumRejected(), 1);
+
+  RANSAC<SimilarityTransformEstimator<3>> ransac(options);
+  const auto report = ransac.Estimate(src, dst);
+
+  BOOST_CHECK_EQUAL(report.success, true);
+  BOOST_CHECK_EQUAL(report.support.num_inliers, num_samples - num_outliers);
+  for (size_t i = 0; i < num_samples; ++i) {
+    BOOST_CHECK_EQUAL(report.inlier_mask[i], i >= num_outliers);
+  }
+
+  const double matrix_diff =
+      (orig_tform.Matrix().topLeftCorner<3, 4>() - report.model).norm();
+  BOOST_CHECK(std::abs(matrix_diff) < 1e-6);
+}
+
+BOOST_AUTO_TEST_CASE(TestParallel) {
+  SetPRNGSeed(0);
+
+  const size_t num_samples = 1000;
+  const size_t num_outliers = 900;
+
+  const SimilarityTransform3 orig_tform(2, ComposeIdentityQuaternion(),
+                                        Eigen::Vector3d(100, 10, 10));
+
+  std::vector<Eigen::Vector3d> src;
+  std::vector<Eigen::Vector3d> dst;
+  for (size_t i = 0; i < num_samples; ++i) {
+    src.emplace_back(i, std::sqrt(i) + 2, std::sqrt(2 * i + 2));
+    dst.push_back(src.back());
+    orig_tform.TransformPoint(&dst.back());
+  }
+
+  for (size_t i = 0; i < num_outliers; ++i) {
+    dst[i] = Eigen::Vector3d(RandomReal(-3000.0, -2000.0),
+                             RandomReal(-4000.0, -3000.0),
+                             RandomReal(-5000.0, -4000.0));
+  }
+
+  for (const bool use_sprt : {false, true}) {
+    RANSACOptions options;
+    options.max_error = 10;
+    options.min_inlier_ratio = 0.05;
+    options.use_sprt = use_sprt;
+    options.num_threads = 4;
+    RANSAC<SimilarityTransformEstimator<3>> ransac(options);
+    const auto report = ransac.Estimate(src, dst);
+
+    BOOST_CHECK_EQUAL(report.success, true);
+    BOOST_CHECK_GT(report.num_trials, 0);
+    BOOST_CHECK_LE(report.num_trials, options.max_num_trials);
+    BOOST_CHECK_EQUAL(report.support.num_inliers, num_samples - num_outliers);
+    for (size_t i = 0; i < num_samples; ++i) {
+      BOOST_CHECK_EQUAL(report.inlier_mask[i], i >= num_outliers);
+    }
+
+    const double matrix_diff =
+        (orig_tform.Matrix().topLeftCorner<3, 4>() - report.model).norm();
+    BOOST_CHECK(std::abs(matrix_diff) < 1e-6);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestIndependentOfNumThreads) {
+  SetPRNGSeed(0);
+
+  const size_t num_samples = 1000;
+  const size_t num_outliers = 500;
+
+  const SimilarityTransform3 orig_tform(2, ComposeIdentityQuaternion(),
+                                        Eigen::Vector3d(100, 10, 10));
+
+  // Noisy inliers, so that every sample yields a different model.
+  std::vector<Eigen::Vector3d> src;
+  std::vector<Eigen::Vector3d> dst;
+  for (size_t i = 0; i < num_samples; ++i) {
+    src.emplace_back(i, std::sqrt(i) + 2, std::sqrt(2 * i + 2));
+    dst.push_back(src.back());
+    orig_tform.TransformPoint(&dst.back());
+    dst.back() += Eigen::Vector3d(RandomGaussian(0.0, 0.5),
+                                  RandomGaussian(0.0, 0.5),
+                                  RandomGaussian(0.0, 0.5));
+  }
+
+  for (size_t i = 0; i < num_outliers; ++i) {
+    dst[i] = Eigen::Vector3d(RandomReal(-3000.0, -2000.0),
+                             RandomReal(-4000.0, -3000.0),
+                             RandomReal(-5000.0, -4000.0));
+  }
+
+  // The trials draw the same samples from the streams of their blocks,
+  // whether they run on one or several threads.
+  std::vector<RANSAC<SimilarityTransformEstimator<3>>::Report> reports;
+  for (const int num_threads : {1, 2, 4}) {
+    RANSACOptions options;
+    options.max_error = 10;
+    options.min_num_trials = 100;
+    options.max_num_trials = 100;
+    options.num_threads = num_threads;
+    RANSAC<SimilarityTransformEstimator<3>> ransac(options);
+    SetPRNGSeed(1);
+    reports.push_back(ransac.Estimate(src, dst));
+    BOOST_CHECK(reports.back().success);
+    BOOST_CHECK_EQUAL(reports.back().num_trials, 100);
+  }
+
+  for (size_t i = 1; i < reports.size(); ++i) {
+    BOOST_CHECK_EQUAL(reports[i].support.num_inliers,
+                      reports[0].support.num_inliers);
+    BOOST_CHECK_EQUAL(reports[i].support.residual_sum,
+                      reports[0].support.residual_sum);
+    BOOST_CHECK(reports[i].model == reports[0].model);
+  }
+}
@@ -0,0 +1,542 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "optim/schur_solver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <unordered_set>
+
+#include <Eigen/LU>
+#include <Eigen/SparseCholesky>
+
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/threading.h"
+#include "util/timer.h"
+
+namespace colmap {
+namespace {
+
+// The bounds of the diagonal of J^T J in the damping, as in Ceres.
+const double kMinDiagonal = 1e-6;
+const double kMaxDiagonal = 1e32;
+
+double ClampDiagonal(const double value) {
+  return std::min(std::max(value, kMinDiagonal), kMaxDiagonal);
+}
+
+}  // namespace
+
+SchurSolver::SchurSolver(const size_t num_points,
+                         const std::vector<int>& camera_sizes,
+                         const int num_threads)
+    : num_points_(num_points),
+      num_threads_(GetEffectiveNumThreads(num_threads)),
+      camera_sizes_(camera_sizes),
+      num_camera_cols_(0),
+      jacobian_(nullptr) {
+  camera_cols_.reserve(camera_sizes_.size());
+  for (size_t camera_idx = 0; camera_idx < camera_sizes_.size();
+       ++camera_idx) {
+    CHECK_GT(camera_sizes_[camera_idx], 0);
+    camera_cols_.push_back(num_camera_cols_);
+    num_camera_cols_ += camera_sizes_[camera_idx];
+    col_camera_idxs_.insert(col_camera_idxs_.end(), camera_sizes_[camera_idx],
+                            static_cast<int>(camera_idx));
+  }
+}
+
+void SchurSolver::SetJacobian(const ceres::CRSMatrix* jacobian) {
+  CHECK_NOTNULL(jacobian);
+  CHECK_EQ(jacobian->num_cols,
+           static_cast<int>(3 * num_points_) + num_camera_cols_);
+
+  jacobian_ = jacobian;
+
+  const int num_point_cols = static_cast<int>(3 * num_points_);
+  point_rows_.clear();
+  point_rows_.resize(num_points_ + 1);
+  for (int row = 0; row < jacobian_->num_rows; ++row) {
+    size_t point_idx = num_points_;
+    for (int k = jacobian_->rows[row]; k < jacobian_->rows[row + 1]; ++k) {
+      const int col = jacobian_->cols[k];
+      if (col < num_point_cols) {
+        CHECK(point_idx == num_points_ ||
+              point_idx == static_cast<size_t>(col / 3))
+            << "Rows may depend on at most one point";
+        point_idx = static_cast<size_t>(col / 3);
+      }
+    }
+    point_rows_[point_idx].push_back(row);
+  }
+
+  eliminations_.resize(num_points_);
+}
+
+void SchurSolver::EliminatePoints(const size_t begin, const size_t stride,
+                                  const Eigen::VectorXd& gradient,
+                                  const double lambda,
+                                  ReducedSystem* system) {
+  const int num_point_cols = static_cast<int>(3 * num_points_);
+  const size_t num_cameras = camera_sizes_.size();
+
+  // The position of every camera in the row group, -1 if not contained.
+  std::vector<int> camera_slots(num_cameras, -1);
+
+  for (size_t point_idx = begin; point_idx < point_rows_.size();
+       point_idx += stride) {
+    const std::vector<int>& rows = point_rows_[point_idx];
+    if (rows.empty()) {
+      continue;
+    }
+
+    // Collect the cameras of the row group.
+    std::vector<int> camera_idxs;
+    std::vector<int> local_cols;
+    int num_local_cols = 0;
+    for (const int row : rows) {
+      for (int k = jacobian_->rows[row]; k < jacobian_->rows[row + 1]; ++k) {
+        const int col = jacobian_->cols[k];
+        if (col < num_point_cols) {
+          continue;
+        }
+        const int camera_idx = col_camera_idxs_[col - num_point_cols];
+        if (camera_slots[camera_idx] == -1) {
+          camera_slots[camera_idx] = static_cast<int>(camera_idxs.size());
+          camera_idxs.push_back(camera_idx);
+          local_cols.push_back(num_local_cols);
+          num_local_cols += camera_sizes_[camera_idx];
+        }
+      }
+    }
+
+    // Extract the dense Jacobians of the point and the cameras.
+    Eigen::MatrixXf J_point = Eigen::MatrixXf::Zero(rows.size(), 3);
+    Eigen::MatrixXd J_camera = Eigen::MatrixXd::Zero(rows.size(), num_local_cols);
+    for (size_t i = 0; i < rows.size(); ++i) {
+      const int row = rows[i];
+      for (int k = jacobian_->rows[row]; k < jacobian_->rows[row + 1]; ++k) {
+        const int col = jacobian_->cols[k];
+        if (col < num_point_cols) {
+          J_point(i, col % 3) = static_cast<float>(jacobian_->values[k]);
+        } else {
+          const int camera_col = col - num_point_cols;
+          const int camera_idx = col_camera_idxs_[camera_col];
+          J_camera(i, local_cols[camera_slots[camera_idx]] + camera_col -
+                          camera_cols_[camera_idx]) = jacobian_->values[k];
+        }
+      }
+    }
+
+    for (const int camera_idx : camera_idxs) {
+      camera_slots[camera_idx] = -1;
+    }
+
+    Eigen::MatrixXd S = J_camera.transpose() * J_camera;
+    for (size_t i = 0; i < camera_idxs.size(); ++i) {
+      const int camera_idx = camera_idxs[i];
+      for (int j = 0; j < camera_sizes_[camera_idx]; ++j) {
+        system->diagonal(camera_cols_[camera_idx] + j) +=
+            S(local_cols[i] + j, local_cols[i] + j);
+      }
+    }
+
+    // Eliminate the point in single precision.
+    if (point_idx < num_points_) {
+      Eigen::Matrix3f V = J_point.transpose() * J_point;
+      for (int j = 0; j < 3; ++j) {
+        V(j, j) += static_cast<float>(lambda * ClampDiagonal(V(j, j)));
+      }
+
+      PointElimination& elimination = eliminations_[point_idx];
+      elimination.V_inv = V.inverse();
+      elimination.W = J_point.transpose() * J_camera.cast<float>();
+      elimination.camera_idxs = camera_idxs;
+
+      const Eigen::MatrixXf V_inv_W = elimination.V_inv * elimination.W;
+      S -= (elimination.W.transpose() * V_inv_W).cast<double>();
+
+      const Eigen::Vector3f point_gradient =
+          gradient.segment<3>(3 * point_idx).cast<float>();
+      const Eigen::VectorXd rhs =
+          (V_inv_W.transpose() * point_gradient).cast<double>();
+      for (size_t i = 0; i < camera_idxs.size(); ++i) {
+        const int camera_idx = camera_idxs[i];
+        system->rhs.segment(camera_cols_[camera_idx],
+                            camera_sizes_[camera_idx]) +=
+            rhs.segment(local_cols[i], camera_sizes_[camera_idx]);
+      }
+    }
+
+    // Add the upper triangular blocks to the reduced camera system.
+    for (size_t i = 0; i < camera_idxs.size(); ++i) {
+      for (size_t j = 0; j < camera_idxs.size(); ++j) {
+        const int camera_idx1 = camera_idxs[i];
+        const int camera_idx2 = camera_idxs[j];
+        if (camera_idx1 > camera_idx2) {
+          continue;
+        }
+        const size_t key = camera_idx1 * num_cameras + camera_idx2;
+        auto block_it = system->blocks.find(key);
+        if (block_it == system->blocks.end()) {
+          block_it = system->blocks
+                         .emplace(key, Eigen::MatrixXd::Zero(
+                                           camera_sizes_[camera_idx1],
+                                           camera_sizes_[camera_idx2]))
+                         .first;
+        }
+        block_it->second += S.block(local_cols[i], local_cols[j],
+                                    camera_sizes_[camera_idx1],
+                                    camera_sizes_[camera_idx2]);
+      }
+    }
+  }
+}
+
+bool SchurSolver::Solve(const Eigen::VectorXd& gradient, const double lambda,
+                        Eigen::VectorXd* step) {
+  CHECK_NOTNULL(jacobian_);
+  CHECK_NOTNULL(step);
+  CHECK_EQ(gradient.size(), jacobian_->num_cols);
+
+  const size_t num_cameras = camera_sizes_.size();
+  const int num_point_cols = static_cast<int>(3 * num_points_);
+
+  // Assemble the reduced camera system, where every thread eliminates a
+  // strided subset of the points into its own part of the system.
+  const size_t num_parts = std::max(
+      static_cast<size_t>(1),
+      std::min(static_cast<size_t>(num_threads_), point_rows_.size()));
+  std::vector<ReducedSystem> systems(num_parts);
+  for (auto& system : systems) {
+    system.diagonal = Eigen::VectorXd::Zero(num_camera_cols_);
+    system.rhs = Eigen::VectorXd::Zero(num_camera_cols_);
+  }
+
+  if (num_parts == 1) {
+    EliminatePoints(0, 1, gradient, lambda, &systems[0]);
+  } else {
+    ThreadPool thread_pool(static_cast<int>(num_parts));
+    for (size_t part = 0; part < num_parts; ++part) {
+      thread_pool.AddTask(&SchurSolver::EliminatePoints, this, part,
+                          num_parts, std::cref(gradient), lambda,
+                          &systems[part]);
+    }
+    thread_pool.Wait();
+  }
+
+  ReducedSystem& system = systems[0];
+  for (size_t part = 1; part < num_parts; ++part) {
+    for (auto& block : systems[part].blocks) {
+      auto block_it = system.blocks.find(block.first);
+      if (block_it == system.blocks.end()) {
+        system.blocks.emplace(block.first, std::move(block.second));
+      } else {
+        block_it->second += block.second;
+      }
+    }
+    system.diagonal += systems[part].diagonal;
+    system.rhs += systems[part].rhs;
+  }
+
+  std::vector<Eigen::Triplet<double>> triplets;
+  triplets.reserve(num_camera_cols_);
+  for (const auto& block : system.blocks) {
+    const size_t camera_idx1 = block.first / num_cameras;
+    const size_t camera_idx2 = block.first % num_cameras;
+    for (int r = 0; r < block.second.rows(); ++r) {
+      for (int c = 0; c < block.second.cols(); ++c) {
+        const int row = camera_cols_[camera_idx1] + r;
+        const int col = camera_cols_[camera_idx2] + c;
+        triplets.emplace_back(row, col, block.second(r, c));
+        if (camera_idx1 != camera_idx2) {
+          triplets.emplace_back(col, row, block.second(r, c));
+        }
+      }
+    }
+  }
+  for (int col = 0; col < num_camera_cols_; ++col) {
+    triplets.emplace_back(col, col,
+                          lambda * ClampDiagonal(system.diagonal(col)));
+  }
+
+  step->resize(jacobian_->num_cols);
+
+  Eigen::VectorXd camera_step;
+  if (num_camera_cols_ > 0) {
+    Eigen::SparseMatrix<double> S(num_camera_cols_, num_camera_cols_);
+    S.setFromTriplets(triplets.begin(), triplets.end());
+
+    const Eigen::VectorXd rhs =
+        system.rhs - gradient.tail(num_camera_cols_);
+
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> ldlt(S);
+    if (ldlt.info() != Eigen::Success) {
+      return false;
+    }
+
+    camera_step = ldlt.solve(rhs);
+    if (ldlt.info() != Eigen::Success || !camera_step.allFinite()) {
+      return false;
+    }
+
+    step->tail(num_camera_cols_) = camera_step;
+  }
+
+  // Back-substitute the point steps.
+  for (size_t point_idx = 0; point_idx < num_points_; ++point_idx) {
+    if (point_rows_[point_idx].empty()) {
+      step->segment<3>(3 * point_idx).setZero();
+      continue;
+    }
+
+    const PointElimination& elimination = eliminations_[point_idx];
+    Eigen::VectorXf local_camera_step(elimination.W.cols());
+    int local_col = 0;
+    for (const int camera_idx : elimination.camera_idxs) {
+      local_camera_step.segment(local_col, camera_sizes_[camera_idx]) =
+          camera_step.segment(camera_cols_[camera_idx],
+                              camera_sizes_[camera_idx])
+              .cast<float>();
+      local_col += camera_sizes_[camera_idx];
+    }
+
+    const Eigen::Vector3f point_gradient =
+        gradient.segment<3>(3 * point_idx).cast<float>();
+    step->segment<3>(3 * point_idx) =
+        (elimination.V_inv *
+         (-point_gradient - elimination.W * local_camera_step))
+            .cast<double>();
+  }
+
+  return step->head(num_point_cols).allFinite();
+}
+
+bool SolveMixedPrecision(const ceres::Solver::Options& options,
+                         const std::vector<double*>& point_blocks,
+                         ceres::Problem* problem,
+                         ceres::Solver::Summary* summary) {
+  CHECK_NOTNULL(problem);
+  CHECK_NOTNULL(summary);
+
+  Timer timer;
+  timer.Start();
+
+  *summary = ceres::Solver::Summary();
+  summary->termination_type = ceres::NO_CONVERGENCE;
+
+  // Order the variable parameter blocks with the points first. The constant
+  // blocks are left out of the evaluation, which keeps them constant.
+  std::unordered_set<const double*> point_block_set;
+  std::vector<double*> parameter_blocks;
+  for (double* point_block : point_blocks) {
+    if (problem->HasParameterBlock(point_block) &&
+        !problem->IsParameterBlockConstant(point_block) &&
+        point_block_set.insert(point_block).second) {
+      CHECK_EQ(problem->ParameterBlockLocalSize(point_block), 3);
+      parameter_blocks.push_back(point_block);
+    }
+  }
+
+  const size_t num_points = parameter_blocks.size();
+
+  std::vector<double*> all_parameter_blocks;
+  problem->GetParameterBlocks(&all_parameter_blocks);
+  std::vector<int> camera_sizes;
+  for (double* parameter_block : all_parameter_blocks) {
+    if (point_block_set.count(parameter_block) == 0 &&
+        !problem->IsParameterBlockConstant(parameter_block)) {
+      parameter_blocks.push_back(parameter_block);
+      camera_sizes.push_back(problem->ParameterBlockLocalSize(parameter_block));
+    }
+  }
+
+  // The offsets of the blocks in the state, i.e. the parameters, and in the
+  // steps of their local parameterizations.
+  std::vector<int> state_offsets;
+  std::vector<int> step_offsets;
+  int num_states = 0;
+  int num_steps = 0;
+  for (double* parameter_block : parameter_blocks) {
+    state_offsets.push_back(num_states);
+    step_offsets.push_back(num_steps);
+    num_states += problem->ParameterBlockSize(parameter_block);
+    num_steps += problem->ParameterBlockLocalSize(parameter_block);
+  }
+
+  ceres::Problem::EvaluateOptions evaluate_options;
+  evaluate_options.parameter_blocks = parameter_blocks;
+  evaluate_options.num_threads = options.num_threads;
+
+  double cost = 0;
+  std::vector<double> gradient_data;
+  ceres::CRSMatrix jacobian;
+  if (!problem->Evaluate(evaluate_options, &cost, nullptr, &gradient_data,
+                         &jacobian)) {
+    summary->termination_type = ceres::FAILURE;
+    return false;
+  }
+
+  summary->initial_cost = cost;
+  summary->num_residuals_reduced = jacobian.num_rows;
+  summary->num_effective_parameters_reduced = jacobian.num_cols;
+
+  SchurSolver schur_solver(num_points, camera_sizes, options.num_threads);
+  schur_solver.SetJacobian(&jacobian);
+
+  // Trust region strategy of the Levenberg-Marquardt algorithm in Ceres.
+  const double kMaxRadius = 1e16;
+  const double kMinRadius = 1e-32;
+  const double kMinRelativeDecrease = 1e-3;
+  double radius = options.initial_trust_region_radius;
+  double decrease_factor = 2;
+
+  std::vector<double> prev_state(num_states);
+
+  for (int iteration = 0; iteration < options.max_num_iterations;
+       ++iteration) {
+    const Eigen::Map<const Eigen::VectorXd> gradient(gradient_data.data(),
+                                                     gradient_data.size());
+    if (gradient.lpNorm<Eigen::Infinity>() <= options.gradient_tolerance) {
+      summary->termination_type = ceres::CONVERGENCE;
+      break;
+    }
+
+    Eigen::VectorXd step;
+    bool step_is_successful =
+        schur_solver.Solve(gradient, 1.0 / radius, &step);
+
+    double new_cost = cost;
+    double relative_decrease = 0;
+    if (step_is_successful) {
+      double state_squared_norm = 0;
+      for (size_t i = 0; i < parameter_blocks.size(); ++i) {
+        const int size = problem->ParameterBlockSize(parameter_blocks[i]);
+        std::copy(parameter_blocks[i], parameter_blocks[i] + size,
+                  prev_state.begin() + state_offsets[i]);
+        for (int j = 0; j < size; ++j) {
+          state_squared_norm += parameter_blocks[i][j] * parameter_blocks[i][j];
+        }
+      }
+
+      const double state_norm = std::sqrt(state_squared_norm);
+      if (step.norm() <= options.parameter_tolerance *
+                             (state_norm + options.parameter_tolerance)) {
+        summary->termination_type = ceres::CONVERGENCE;
+        break;
+      }
+
+      for (size_t i = 0; i < parameter_blocks.size(); ++i) {
+        double* parameter_block = parameter_blocks[i];
+        const double* prev_parameter_block =
+            prev_state.data() + state_offsets[i];
+        const double* parameter_step = step.data() + step_offsets[i];
+        const ceres::LocalParameterization* parameterization =
+            problem->GetParameterization(parameter_block);
+        if (parameterization == nullptr) {
+          const int size = problem->ParameterBlockSize(parameter_block);
+          for (int j = 0; j < size; ++j) {
+            parameter_block[j] = prev_parameter_block[j] + parameter_step[j];
+          }
+        } else {
+          parameterization->Plus(prev_parameter_block, parameter_step,
+                                 parameter_block);
+        }
+      }
+
+      // The decrease of the linearized cost, ||r||^2/2 - ||r + J x||^2/2.
+      Eigen::VectorXd jacobian_step = Eigen::VectorXd::Zero(jacobian.num_rows);
+      for (int row = 0; row < jacobian.num_rows; ++row) {
+        for (int k = jacobian.rows[row]; k < jacobian.rows[row + 1]; ++k) {
+          jacobian_step(row) += jacobian.values[k] * step(jacobian.cols[k]);
+        }
+      }
+      const double model_cost_change =
+          -(gradient.dot(step) + 0.5 * jacobian_step.squaredNorm());
+
+      step_is_successful =
+          problem->Evaluate(evaluate_options, &new_cost, nullptr, nullptr,
+                            nullptr) &&
+          std::isfinite(new_cost) && model_cost_change > 0;
+      if (step_is_successful) {
+        relative_decrease = (cost - new_cost) / model_cost_change;
+        step_is_successful = relative_decrease > kMinRelativeDecrease;
+      }
+
+      if (!step_is_successful) {
+        for (size_t i = 0; i < parameter_blocks.size(); ++i) {
+          const int size = problem->ParameterBlockSize(parameter_blocks[i]);
+          std::copy(prev_state.begin() + state_offsets[i],
+                    prev_state.begin() + state_offsets[i] + size,
+                    parameter_blocks[i]);
+        }
+      }
+    }
+
+    if (options.minimizer_progress_to_stdout) {
+      std::cout << StringPrintf(
+                       "% 4d: f:% 8e d:% 3.2e |g|:% 3.2e rho:% 3.2e "
+                       "tr_radius:% 3.2e",
+                       iteration, step_is_successful ? new_cost : cost,
+                       step_is_successful ? cost - new_cost : 0.0,
+                       gradient.lpNorm<Eigen::Infinity>(), relative_decrease,
+                       radius)
+                << std::endl;
+    }
+
+    if (step_is_successful) {
+      summary->num_successful_steps += 1;
+
+      radius = std::min(
+          kMaxRadius,
+          radius / std::max(1.0 / 3.0,
+                            1.0 - std::pow(2.0 * relative_decrease - 1.0, 3)));
+      decrease_factor = 2;
+
+      const double cost_change = cost - new_cost;
+      if (cost_change <= options.function_tolerance * cost) {
+        cost = new_cost;
+        summary->termination_type = ceres::CONVERGENCE;
+        break;
+      }
+
+      if (!problem->Evaluate(evaluate_options, &cost, nullptr, &gradient_data,
+                             &jacobian)) {
+        summary->termination_type = ceres::FAILURE;
+        break;
+      }
+      schur_solver.SetJacobian(&jacobian);
+    } else {
+      summary->num_unsuccessful_steps += 1;
+
+      radius /= decrease_factor;
+      decrease_factor *= 2;
+      if (radius < kMinRadius) {
+        summary->termination_type = ceres::CONVERGENCE;
+        break;
+      }
+    }
+  }
+
+  summary->final_cost = cost;
+  summary->total_time_in_seconds = timer.ElapsedSeconds();
+
+  return summary->IsSolutionUsable();
+}
+
+}  // namespace colmap
@@ -0,0 +1,102 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_OPTIM_SCHUR_SOLVER_H_
+#define COLMAP_SRC_OPTIM_SCHUR_SOLVER_H_
+
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include <ceres/ceres.h>
+
+#include "util/alignment.h"
+
+namespace colmap {
+
+// Solver of the damped normal equations of a bundle adjustment problem:
+//
+//        (J^T J + lambda D) x = -g
+//
+// where D is the clamped diagonal of J^T J, as in the Levenberg-Marquardt
+// strategy of Ceres. The first 3 x `num_points` columns of the Jacobian J
+// belong to the points, which are followed by the blocks of the cameras, i.e.
+// of all other parameters. Every row of the Jacobian may depend on at most one
+// point. The point blocks are eliminated in single precision, since they make
+// up most of the memory traffic, while the reduced camera system is assembled
+// in double precision in parallel and solved with a sparse Cholesky.
+class SchurSolver {
+ public:
+  SchurSolver(const size_t num_points, const std::vector<int>& camera_sizes,
+              const int num_threads);
+
+  // Set the Jacobian, whose structure must not change between calls.
+  void SetJacobian(const ceres::CRSMatrix* jacobian);
+
+  // Solve the normal equations with the given gradient and damping.
+  bool Solve(const Eigen::VectorXd& gradient, const double lambda,
+             Eigen::VectorXd* step);
+
+ private:
+  // The eliminated point block of a row group.
+  struct PointElimination {
+    Eigen::Matrix3f V_inv;
+    Eigen::MatrixXf W;
+    std::vector<int> camera_idxs;
+  };
+
+  // The part of the reduced camera system of a thread, whose blocks are
+  // stored with the camera indices a <= b as key a * num_cameras + b.
+  struct ReducedSystem {
+    std::unordered_map<size_t, Eigen::MatrixXd> blocks;
+    Eigen::VectorXd diagonal;
+    Eigen::VectorXd rhs;
+  };
+
+  // Eliminate the points of every stride-th row group, starting at begin, and
+  // add the result to the reduced camera system.
+  void EliminatePoints(const size_t begin, const size_t stride,
+                       const Eigen::VectorXd& gradient, const double lambda,
+                       ReducedSystem* system);
+
+  const size_t num_points_;
+  const int num_threads_;
+  std::vector<int> camera_sizes_;
+  std::vector<int> camera_cols_;
+  std::vector<int> col_camera_idxs_;
+  int num_camera_cols_;
+
+  const ceres::CRSMatrix* jacobian_;
+  // The rows of every point, with the rows without a point in the last group.
+  std::vector<std::vector<int>> point_rows_;
+  std::vector<PointElimination> eliminations_;
+};
+
+// Minimize the bundle adjustment problem with Levenberg-Marquardt, where the
+// normal equations are solved with `SchurSolver`. The given point blocks are
+// eliminated and every residual block may depend on at most one of them. Of
+// the solver options, the number of iterations and threads, the tolerances,
+// the initial trust region radius and the progress output are used. The
+// summary only contains the fields that are printed by `PrintSolverSummary`.
+bool SolveMixedPrecision(const ceres::Solver::Options& options,
+                         const std::vector<double*>& point_blocks,
+                         ceres::Problem* problem,
+                         ceres::Solver::Summary* summary);
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_OPTIM_SCHUR_SOLVER_H_
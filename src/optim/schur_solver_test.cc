@@ -0,0 +1,140 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "optim/schur_solver"
+#include "util/testing.h"
+
+#include <Eigen/Dense>
+
+#include "optim/schur_solver.h"
+#include "util/random.h"
+
+using namespace colmap;
+
+namespace {
+
+// Generate the Jacobian of a bundle adjustment problem, where every point is
+// observed by three cameras and the last camera has an additional prior.
+ceres::CRSMatrix GenerateJacobian(const int num_points,
+                                  const std::vector<int>& camera_sizes) {
+  std::vector<int> camera_cols;
+  int num_cols = 3 * num_points;
+  for (const int camera_size : camera_sizes) {
+    camera_cols.push_back(num_cols);
+    num_cols += camera_size;
+  }
+
+  const int num_cameras = static_cast<int>(camera_sizes.size());
+
+  ceres::CRSMatrix jacobian;
+  jacobian.num_cols = num_cols;
+  jacobian.rows.push_back(0);
+
+  const auto AddRow = [&](const int point_idx, const int camera_idx) {
+    if (point_idx >= 0) {
+      for (int i = 0; i < 3; ++i) {
+        jacobian.cols.push_back(3 * point_idx + i);
+        jacobian.values.push_back(RandomReal(-1.0, 1.0));
+      }
+    }
+    for (int i = 0; i < camera_sizes[camera_idx]; ++i) {
+      jacobian.cols.push_back(camera_cols[camera_idx] + i);
+      jacobian.values.push_back(RandomReal(-1.0, 1.0));
+    }
+    jacobian.rows.push_back(static_cast<int>(jacobian.cols.size()));
+    jacobian.num_rows += 1;
+  };
+
+  for (int point_idx = 0; point_idx < num_points; ++point_idx) {
+    for (int i = 0; i < 3; ++i) {
+      const int camera_idx = (point_idx + i) % num_cameras;
+      AddRow(point_idx, camera_idx);
+      AddRow(point_idx, camera_idx);
+    }
+  }
+
+  for (int i = 0; i < camera_sizes.back(); ++i) {
+    AddRow(-1, num_cameras - 1);
+  }
+
+  return jacobian;
+}
+
+Eigen::MatrixXd DenseJacobian(const ceres::CRSMatrix& jacobian) {
+  Eigen::MatrixXd J = Eigen::MatrixXd::Zero(jacobian.num_rows,
+                                            jacobian.num_cols);
+  for (int row = 0; row < jacobian.num_rows; ++row) {
+    for (int k = jacobian.rows[row]; k < jacobian.rows[row + 1]; ++k) {
+      J(row, jacobian.cols[k]) = jacobian.values[k];
+    }
+  }
+  return J;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestSolve) {
+  SetPRNGSeed(0);
+
+  const int kNumPoints = 50;
+  const std::vector<int> camera_sizes = {6, 6, 6, 6, 3};
+  const double kLambda = 1e-2;
+
+  const ceres::CRSMatrix jacobian = GenerateJacobian(kNumPoints, camera_sizes);
+  const Eigen::MatrixXd J = DenseJacobian(jacobian);
+
+  Eigen::VectorXd residuals(J.rows());
+  for (int i = 0; i < residuals.size(); ++i) {
+    residuals(i) = RandomReal(-1.0, 1.0);
+  }
+  const Eigen::VectorXd gradient = J.transpose() * residuals;
+
+  Eigen::MatrixXd H = J.transpose() * J;
+  for (int i = 0; i < H.rows(); ++i) {
+    H(i, i) += kLambda * std::min(std::max(H(i, i), 1e-6), 1e32);
+  }
+  const Eigen::VectorXd step_ref = H.ldlt().solve(-gradient);
+
+  for (const int num_threads : {1, 3}) {
+    SchurSolver solver(kNumPoints, camera_sizes, num_threads);
+    solver.SetJacobian(&jacobian);
+
+    Eigen::VectorXd step;
+    BOOST_CHECK(solver.Solve(gradient, kLambda, &step));
+    BOOST_CHECK_EQUAL(step.size(), step_ref.size());
+    BOOST_CHECK_LE((step - step_ref).norm(), 1e-3 * step_ref.norm());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestRepeatedSolve) {
+  SetPRNGSeed(0);
+
+  const ceres::CRSMatrix jacobian = GenerateJacobian(10, {3});
+  const Eigen::MatrixXd J = DenseJacobian(jacobian);
+  const Eigen::VectorXd gradient =
+      J.transpose() * Eigen::VectorXd::Ones(J.rows());
+
+  SchurSolver solver(10, {3}, 1);
+  solver.SetJacobian(&jacobian);
+
+  // Solving twice with the same Jacobian must give the same step.
+  Eigen::VectorXd step1;
+  Eigen::VectorXd step2;
+  BOOST_CHECK(solver.Solve(gradient, 1.0, &step1));
+  BOOST_CHECK(solver.Solve(gradient, 1.0, &step2));
+  BOOST_CHECK_EQUAL(step1, step2);
+  BOOST_CHECK(step1.allFinite());
+}
@@ -0,0 +1,400 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_OPTIM_SEQUENTIAL_RANSAC_H_
+#define COLMAP_SRC_OPTIM_SEQUENTIAL_RANSAC_H_
+
+#include <algorithm>
+#include <cfloat>
+#include <type_traits>
+#include <vector>
+
+#include "optim/random_sampler.h"
+#include "optim/ransac.h"
+#include "optim/support_measurement.h"
+#include "util/alignment.h"
+#include "util/logging.h"
+#include "util/scratch.h"
+#include "util/trace.h"
+
+namespace colmap {
+
+// Multi-model estimation with sequential, locally optimized RANSAC.
+//
+// The models are extracted one after another from a single set of samples.
+// Every sample is assigned to at most one model and the inliers of a found
+// model are masked out for all subsequent models. The hypotheses of previous
+// rounds are kept in a shared pool and are re-scored on the remaining samples
+// at the start of each round, so that a model which was already hypothesized
+// terminates its round early instead of restarting RANSAC from scratch. The
+// pool can be seeded with prior models in the same way.
+//
+// "Detecting planar homographies in an image pair" Etienne Vincent, Robert
+// Laganiere, ISPA 2001, and
+// "Locally Optimized RANSAC" Ondrej Chum, Jiri Matas, Josef Kittler, DAGM 2003.
+template <typename Estimator, typename LocalEstimator,
+          typename SupportMeasurer = InlierSupportMeasurer,
+          typename Sampler = RandomSampler>
+class SequentialRANSAC {
+ public:
+  struct Report {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // Whether at least one model was estimated.
+    bool success = false;
+
+    // The total number of RANSAC trials over all models.
+    size_t num_trials = 0;
+
+    // The estimated models and their support, in the order of extraction.
+    std::vector<typename Estimator::M_t,
+                Eigen::aligned_allocator<typename Estimator::M_t>>
+        models;
+    std::vector<typename SupportMeasurer::Support> supports;
+
+    // The index of the model for each sample or -1 if the sample is an
+    // outlier to all models.
+    std::vector<int> labels;
+
+    // Boolean mask which is true if a sample is an inlier of the given model.
+    std::vector<char> InlierMask(const size_t model_idx) const;
+  };
+
+  // @param options          The options of each RANSAC round.
+  // @param max_num_models   The maximum number of models to extract.
+  // @param min_num_inliers  The minimum number of inliers of a model.
+  SequentialRANSAC(const RANSACOptions& options, const size_t max_num_models,
+                   const size_t min_num_inliers);
+
+  // Robustly estimate multiple models.
+  //
+  // @param X              Independent variables.
+  // @param Y              Dependent variables.
+  //
+  // @return               The report with the results of the estimation.
+  Report Estimate(const std::vector<typename Estimator::X_t>& X,
+                  const std::vector<typename Estimator::Y_t>& Y);
+
+  // The number of hypotheses that are kept for the following rounds.
+  static const size_t kMaxNumPoolModels = 64;
+
+  // Objects used in RANSAC procedure.
+  Estimator estimator;
+  LocalEstimator local_estimator;
+  Sampler sampler;
+  SupportMeasurer support_measurer;
+
+  // Models that are predicted from other data, e.g. from the poses of
+  // neighboring images. They join the hypothesis pool before the first round,
+  // so that a good prediction terminates the rounds early, while a bad one
+  // only costs its evaluation.
+  std::vector<typename Estimator::M_t,
+              Eigen::aligned_allocator<typename Estimator::M_t>>
+      prior_models;
+
+ private:
+  struct Hypothesis {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    typename Estimator::M_t model;
+    bool is_local = false;
+    size_t num_inliers = 0;
+  };
+
+  typedef std::vector<Hypothesis, Eigen::aligned_allocator<Hypothesis>>
+      HypothesisPool;
+
+  // Compute the residuals of a model, where the residuals of samples that
+  // already belong to a model are set to the maximum value.
+  void ComputeResiduals(const std::vector<typename Estimator::X_t>& X,
+                        const std::vector<typename Estimator::Y_t>& Y,
+                        const Hypothesis& hypothesis,
+                        const std::vector<int>& labels,
+                        std::vector<double>* residuals);
+
+  RANSACOptions options_;
+  size_t max_num_models_;
+  size_t min_num_inliers_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+          typename Sampler>
+std::vector<char> SequentialRANSAC<Estimator, LocalEstimator, SupportMeasurer,
+                                   Sampler>::Report::InlierMask(
+    const size_t model_idx) const {
+  std::vector<char> inlier_mask(labels.size());
+  for (size_t i = 0; i < labels.size(); ++i) {
+    inlier_mask[i] = labels[i] == static_cast<int>(model_idx);
+  }
+  return inlier_mask;
+}
+
+template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+          typename Sampler>
+SequentialRANSAC<Estimator, LocalEstimator, SupportMeasurer, Sampler>::
+    SequentialRANSAC(const RANSACOptions& options, const size_t max_num_models,
+                     const size_t min_num_inliers)
+    : sampler(Sampler(Estimator::kMinNumSamples)),
+      options_(options),
+      max_num_models_(max_num_models),
+      min_num_inliers_(std::max<size_t>(min_num_inliers,
+                                        Estimator::kMinNumSamples)) {
+  options.Check();
+  CHECK_GT(max_num_models_, 0);
+
+  // Determine max_num_trials based on assumed `min_inlier_ratio`.
+  const size_t kNumSamples = 100000;
+  const size_t dyn_max_num_trials =
+      RANSAC<Estimator, SupportMeasurer, Sampler>::ComputeNumTrials(
+          static_cast<size_t>(options_.min_inlier_ratio * kNumSamples),
+          kNumSamples, options_.confidence);
+  options_.max_num_trials =
+      std::min<size_t>(options_.max_num_trials, dyn_max_num_trials);
+}
+
+template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+          typename Sampler>
+void SequentialRANSAC<Estimator, LocalEstimator, SupportMeasurer, Sampler>::
+    ComputeResiduals(const std::vector<typename Estimator::X_t>& X,
+                     const std::vector<typename Estimator::Y_t>& Y,
+                     const Hypothesis& hypothesis,
+                     const std::vector<int>& labels,
+                     std::vector<double>* residuals) {
+  if (hypothesis.is_local) {
+    local_estimator.Residuals(X, Y, hypothesis.model, residuals);
+  } else {
+    estimator.Residuals(X, Y, hypothesis.model, residuals);
+  }
+  CHECK_EQ(residuals->size(), X.size());
+  for (size_t i = 0; i < labels.size(); ++i) {
+    if (labels[i] != -1) {
+      (*residuals)[i] = std::numeric_limits<double>::max();
+    }
+  }
+}
+
+template <typename Estimator, typename LocalEstimator, typename SupportMeasurer,
+          typename Sampler>
+typename SequentialRANSAC<Estimator, LocalEstimator, SupportMeasurer,
+                          Sampler>::Report
+SequentialRANSAC<Estimator, LocalEstimator, SupportMeasurer, Sampler>::Estimate(
+    const std::vector<typename Estimator::X_t>& X,
+    const std::vector<typename Estimator::Y_t>& Y) {
+  TRACE_SCOPE("SequentialRANSAC::Estimate");
+  CHECK_EQ(X.size(), Y.size());
+
+  const size_t num_samples = X.size();
+
+  Report report;
+  report.success = false;
+  report.num_trials = 0;
+  report.labels.resize(num_samples, -1);
+
+  const double max_residual = options_.max_error * options_.max_error;
+
+  // The temporaries are recycled between the estimations of a thread.
+  ScratchVector<double> residuals_buffer(num_samples);
+  std::vector<double>& residuals = *residuals_buffer;
+
+  ScratchVector<typename LocalEstimator::X_t> X_inlier_buffer;
+  ScratchVector<typename LocalEstimator::Y_t> Y_inlier_buffer;
+  std::vector<typename LocalEstimator::X_t>& X_inlier = *X_inlier_buffer;
+  std::vector<typename LocalEstimator::Y_t>& Y_inlier = *Y_inlier_buffer;
+
+  ScratchVector<typename Estimator::X_t> X_rand_buffer(
+      Estimator::kMinNumSamples);
+  ScratchVector<typename Estimator::Y_t> Y_rand_buffer(
+      Estimator::kMinNumSamples);
+  std::vector<typename Estimator::X_t>& X_rand = *X_rand_buffer;
+  std::vector<typename Estimator::Y_t>& Y_rand = *Y_rand_buffer;
+
+  // Indices of the samples that do not belong to any model yet.
+  ScratchVector<size_t> remaining_idxs_buffer(num_samples);
+  std::vector<size_t>& remaining_idxs = *remaining_idxs_buffer;
+  for (size_t i = 0; i < num_samples; ++i) {
+    remaining_idxs[i] = i;
+  }
+
+  HypothesisPool pool;
+  for (const auto& prior_model : prior_models) {
+    Hypothesis hypothesis;
+    hypothesis.model = prior_model;
+    pool.push_back(hypothesis);
+  }
+
+  SPRTVerifier<Estimator> sprt_verifier(options_);
+
+  while (report.models.size() < max_num_models_ &&
+         remaining_idxs.size() >= min_num_inliers_) {
+    const size_t num_remaining = remaining_idxs.size();
+
+    typename SupportMeasurer::Support best_support;
+    Hypothesis best_hypothesis;
+    size_t dyn_max_num_trials = 0;
+
+    // Evaluate a hypothesis on the remaining samples and, if it is the best
+    // so far, locally optimize it from its inliers.
+    auto EvaluateHypothesis = [&](const Hypothesis& hypothesis) {
+      ComputeResiduals(X, Y, hypothesis, report.labels, &residuals);
+      const auto support = support_measurer.Evaluate(residuals, max_residual);
+      if (!support_measurer.Compare(support, best_support)) {
+        return support;
+      }
+
+      best_support = support;
+      best_hypothesis = hypothesis;
+
+      // A minimal solver as local estimator disables the local optimization.
+      if (!std::is_same<Estimator, LocalEstimator>::value &&
+          support.num_inliers > Estimator::kMinNumSamples &&
+          support.num_inliers >= LocalEstimator::kMinNumSamples) {
+        X_inlier.clear();
+        Y_inlier.clear();
+        X_inlier.reserve(support.num_inliers);
+        Y_inlier.reserve(support.num_inliers);
+        for (size_t i = 0; i < residuals.size(); ++i) {
+          if (residuals[i] <= max_residual) {
+            X_inlier.push_back(X[i]);
+            Y_inlier.push_back(Y[i]);
+          }
+        }
+
+        const std::vector<typename LocalEstimator::M_t> local_models =
+            local_estimator.Estimate(X_inlier, Y_inlier);
+
+        Hypothesis local_hypothesis;
+        local_hypothesis.is_local = true;
+        for (const auto& local_model : local_models) {
+          local_hypothesis.model = local_model;
+          ComputeResiduals(X, Y, local_hypothesis, report.labels, &residuals);
+          const auto local_support =
+              support_measurer.Evaluate(residuals, max_residual);
+          if (support_measurer.Compare(local_support, best_support)) {
+            best_support = local_support;
+            best_hypothesis = local_hypothesis;
+          }
+        }
+      }
+
+      dyn_max_num_trials =
+          RANSAC<Estimator, SupportMeasurer, Sampler>::ComputeNumTrials(
+              best_support.num_inliers, num_remaining, options_.confidence);
+      sprt_verifier.UpdateBestInlierRatio(
+          best_support.num_inliers / static_cast<double>(num_remaining));
+
+      return support;
+    };
+
+    sampler.Initialize(num_remaining);
+    sprt_verifier.Initialize(X, Y, &remaining_idxs);
+
+    size_t max_num_trials = options_.max_num_trials;
+    max_num_trials = std::min<size_t>(max_num_trials, sampler.MaxNumSamples());
+    dyn_max_num_trials = max_num_trials;
+
+    // Seed the round with the hypotheses of the previous rounds.
+    for (auto& hypothesis : pool) {
+      hypothesis.num_inliers = EvaluateHypothesis(hypothesis).num_inliers;
+    }
+
+    HypothesisPool round_pool;
+
+    size_t num_trials = 0;
+    bool abort = false;
+    for (num_trials = 0; num_trials < max_num_trials; ++num_trials) {
+      if (abort) {
+        num_trials += 1;
+        break;
+      }
+
+      const std::vector<size_t> sample_idxs = sampler.Sample();
+      for (size_t i = 0; i < X_rand.size(); ++i) {
+        X_rand[i] = X[remaining_idxs[sample_idxs[i]]];
+        Y_rand[i] = Y[remaining_idxs[sample_idxs[i]]];
+      }
+
+      const std::vector<typename Estimator::M_t> sample_models =
+          estimator.Estimate(X_rand, Y_rand);
+
+      for (const auto& sample_model : sample_models) {
+        // Hypotheses that are rejected early are not kept in the pool.
+        if (sprt_verifier.Verify(estimator, sample_model)) {
+          Hypothesis hypothesis;
+          hypothesis.model = sample_model;
+          hypothesis.num_inliers = EvaluateHypothesis(hypothesis).num_inliers;
+          if (hypothesis.num_inliers >= min_num_inliers_) {
+            round_pool.push_back(hypothesis);
+          }
+        }
+
+        if (num_trials >= dyn_max_num_trials &&
+            num_trials >= options_.min_num_trials) {
+          abort = true;
+          break;
+        }
+      }
+    }
+
+    report.num_trials += num_trials;
+
+    if (best_support.num_inliers < min_num_inliers_) {
+      break;
+    }
+
+    // Assign the inliers of the best model and remove them from the
+    // remaining samples.
+    const int model_idx = static_cast<int>(report.models.size());
+    ComputeResiduals(X, Y, best_hypothesis, report.labels, &residuals);
+    for (size_t i = 0; i < num_samples; ++i) {
+      if (residuals[i] <= max_residual) {
+        report.labels[i] = model_idx;
+      }
+    }
+
+    remaining_idxs.erase(
+        std::remove_if(remaining_idxs.begin(), remaining_idxs.end(),
+                       [&report](const size_t idx) {
+                         return report.labels[idx] != -1;
+                       }),
+        remaining_idxs.end());
+
+    report.models.push_back(best_hypothesis.model);
+    report.supports.push_back(best_support);
+
+    // Keep the strongest hypotheses for the next round. Their support is
+    // re-evaluated there, as it changes with the removed samples.
+    pool.insert(pool.end(), round_pool.begin(), round_pool.end());
+    if (pool.size() > kMaxNumPoolModels) {
+      std::nth_element(pool.begin(), pool.begin() + kMaxNumPoolModels,
+                       pool.end(),
+                       [](const Hypothesis& h1, const Hypothesis& h2) {
+                         return h1.num_inliers > h2.num_inliers;
+                       });
+      pool.resize(kMaxNumPoolModels);
+    }
+  }
+
+  report.success = !report.models.empty();
+
+  return report;
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_OPTIM_SEQUENTIAL_RANSAC_H_
@@ -0,0 +1,171 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "optim/sequential_ransac"
+#include "util/testing.h"
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "base/pose.h"
+#include "base/similarity_transform.h"
+#include "estimators/similarity_transform.h"
+#include "optim/sequential_ransac.h"
+#include "util/random.h"
+
+using namespace colmap;
+
+typedef SequentialRANSAC<SimilarityTransformEstimator<3>,
+                         SimilarityTransformEstimator<3>>
+    SimilarityTransformSequentialRANSAC;
+
+BOOST_AUTO_TEST_CASE(TestReport) {
+  SimilarityTransformSequentialRANSAC::Report report;
+  BOOST_CHECK_EQUAL(report.success, false);
+  BOOST_CHECK_EQUAL(report.num_trials, 0);
+  BOOST_CHECK_EQUAL(report.models.size(), 0);
+  BOOST_CHECK_EQUAL(report.supports.size(), 0);
+  BOOST_CHECK_EQUAL(report.labels.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestNotEnoughSamples) {
+  RANSACOptions options;
+  options.max_error = 10;
+  SimilarityTransformSequentialRANSAC ransac(options, 2, 10);
+  const std::vector<Eigen::Vector3d> src(5, Eigen::Vector3d::Zero());
+  const auto report = ransac.Estimate(src, src);
+  BOOST_CHECK_EQUAL(report.success, false);
+  BOOST_CHECK_EQUAL(report.models.size(), 0);
+  BOOST_CHECK_EQUAL(report.labels.size(), 5);
+}
+
+BOOST_AUTO_TEST_CASE(TestTwoSimilarityTransforms) {
+  SetPRNGSeed(0);
+
+  const size_t num_samples1 = 600;
+  const size_t num_samples2 = 300;
+  const size_t num_outliers = 100;
+
+  // Create two arbitrary transformations, e.g. of two moving bodies.
+  const SimilarityTransform3 orig_tform1(2, ComposeIdentityQuaternion(),
+                                         Eigen::Vector3d(100, 10, 10));
+  const SimilarityTransform3 orig_tform2(
+      1, Eigen::Vector4d(0.9, 0.1, 0.2, 0.3).normalized(),
+      Eigen::Vector3d(-50, 20, 5));
+
+  std::vector<Eigen::Vector3d> src;
+  std::vector<Eigen::Vector3d> dst;
+  for (size_t i = 0; i < num_samples1 + num_samples2; ++i) {
+    src.emplace_back(i, std::sqrt(i) + 2, std::sqrt(2 * i + 2));
+    dst.push_back(src.back());
+    if (i < num_samples1) {
+      orig_tform1.TransformPoint(&dst.back());
+    } else {
+      orig_tform2.TransformPoint(&dst.back());
+    }
+  }
+
+  for (size_t i = 0; i < num_outliers; ++i) {
+    src.emplace_back(i, 2 * i, 3 * i);
+    dst.emplace_back(RandomReal(-3000.0, -2000.0), RandomReal(-4000.0, -3000.0),
+                     RandomReal(-5000.0, -4000.0));
+  }
+
+  RANSACOptions options;
+  options.max_error = 10;
+  SimilarityTransformSequentialRANSAC ransac(options, 3, 50);
+  const auto report = ransac.Estimate(src, dst);
+
+  BOOST_CHECK_EQUAL(report.success, true);
+  BOOST_CHECK_GT(report.num_trials, 0);
+  BOOST_CHECK_EQUAL(report.models.size(), 2);
+  BOOST_CHECK_EQUAL(report.supports[0].num_inliers, num_samples1);
+  BOOST_CHECK_EQUAL(report.supports[1].num_inliers, num_samples2);
+
+  // Make sure the samples are assigned to the right model.
+  const std::vector<char> inlier_mask1 = report.InlierMask(0);
+  const std::vector<char> inlier_mask2 = report.InlierMask(1);
+  for (size_t i = 0; i < src.size(); ++i) {
+    if (i < num_samples1) {
+      BOOST_CHECK_EQUAL(report.labels[i], 0);
+      BOOST_CHECK(inlier_mask1[i]);
+      BOOST_CHECK(!inlier_mask2[i]);
+    } else if (i < num_samples1 + num_samples2) {
+      BOOST_CHECK_EQUAL(report.labels[i], 1);
+      BOOST_CHECK(!inlier_mask1[i]);
+      BOOST_CHECK(inlier_mask2[i]);
+    } else {
+      BOOST_CHECK_EQUAL(report.labels[i], -1);
+    }
+  }
+
+  const double matrix_diff1 =
+      (orig_tform1.Matrix().topLeftCorner<3, 4>() - report.models[0]).norm();
+  BOOST_CHECK(std::abs(matrix_diff1) < 1e-6);
+  const double matrix_diff2 =
+      (orig_tform2.Matrix().topLeftCorner<3, 4>() - report.models[1]).norm();
+  BOOST_CHECK(std::abs(matrix_diff2) < 1e-6);
+}
+
+BOOST_AUTO_TEST_CASE(TestPriorModels) {
+  SetPRNGSeed(0);
+
+  const size_t num_inliers = 50;
+  const size_t num_outliers = 450;
+
+  const SimilarityTransform3 orig_tform(2, ComposeIdentityQuaternion(),
+                                        Eigen::Vector3d(100, 10, 10));
+
+  std::vector<Eigen::Vector3d> src;
+  std::vector<Eigen::Vector3d> dst;
+  for (size_t i = 0; i < num_inliers; ++i) {
+    src.emplace_back(i, std::sqrt(i) + 2, std::sqrt(2 * i + 2));
+    dst.push_back(src.back());
+    orig_tform.TransformPoint(&dst.back());
+  }
+
+  for (size_t i = 0; i < num_outliers; ++i) {
+    src.emplace_back(i, 2 * i, 3 * i);
+    dst.emplace_back(RandomReal(-3000.0, -2000.0), RandomReal(-4000.0, -3000.0),
+                     RandomReal(-5000.0, -4000.0));
+  }
+
+  // Too few trials to sample the inliers at this inlier ratio.
+  RANSACOptions options;
+  options.max_error = 10;
+  options.max_num_trials = 5;
+
+  SimilarityTransformSequentialRANSAC cold_ransac(options, 1, 20);
+  const auto cold_report = cold_ransac.Estimate(src, dst);
+  BOOST_CHECK_EQUAL(cold_report.success, false);
+
+  // A good prediction is found despite the few trials, a bad one is ignored.
+  SimilarityTransformSequentialRANSAC prior_ransac(options, 1, 20);
+  Eigen::Matrix3x4d prior_model = orig_tform.Matrix().topLeftCorner<3, 4>();
+  prior_model(0, 3) += 1;
+  prior_ransac.prior_models.push_back(Eigen::Matrix3x4d::Zero());
+  prior_ransac.prior_models.push_back(prior_model);
+  const auto prior_report = prior_ransac.Estimate(src, dst);
+
+  BOOST_CHECK_EQUAL(prior_report.success, true);
+  BOOST_CHECK_LE(prior_report.num_trials, options.max_num_trials);
+  BOOST_CHECK_EQUAL(prior_report.models.size(), 1);
+  BOOST_CHECK_EQUAL(prior_report.supports[0].num_inliers, num_inliers);
+  BOOST_CHECK(prior_report.models[0] == prior_model);
+  for (size_t i = 0; i < src.size(); ++i) {
+    BOOST_CHECK_EQUAL(prior_report.labels[i], i < num_inliers ? 0 : -1);
+  }
+}
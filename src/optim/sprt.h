@@ -51,9 +51,21 @@ class SPRT {
 
   void Update(const Options& options);
 
+  const Options& GetOptions() const;
+
+  // Evaluate the residuals of a model in the given order and return whether
+  // the model was accepted, i.e. not rejected before all residuals were
+  // evaluated.
   bool Evaluate(const std::vector<double>& residuals, const double max_residual,
                 size_t* num_inliers, size_t* num_eval_samples);
 
+  // Continue the evaluation of a model with further residuals. The likelihood
+  // ratio and the counts are carried over between the calls for the same
+  // model and must be initialized to one and zero for a new model.
+  bool Evaluate(const std::vector<double>& residuals, const double max_residual,
+                double* likelihood_ratio, size_t* num_inliers,
+                size_t* num_eval_samples) const;
+
  private:
   void UpdateDecisionThreshold();
 
@@ -0,0 +1,448 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_RETRIEVAL_HIERARCHICAL_KMEANS_H_
+#define COLMAP_SRC_RETRIEVAL_HIERARCHICAL_KMEANS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "util/logging.h"
+#include "util/threading.h"
+
+namespace colmap {
+namespace retrieval {
+
+struct HierarchicalKMeansOptions {
+  // The maximum number of leaf clusters. There are fewer leaves only if there
+  // are fewer points than leaves.
+  int num_clusters = 256 * 256;
+
+  // The maximum number of children of a node in the tree.
+  int branching = 256;
+
+  // The number of Lloyd iterations for the nodes with few points.
+  int num_iterations = 11;
+
+  // Nodes with more points than this number per child are clustered with
+  // mini-batch k-means on random batches of this number of points per child,
+  // so that the full set of points is only assigned once to the children.
+  int batch_size_per_cluster = 64;
+
+  // The number of mini-batch iterations per node.
+  int num_mini_batch_iterations = 100;
+
+  // Seed of the random initialization, such that the clustering of the same
+  // points is reproducible irrespective of the number of threads.
+  unsigned int random_seed = 0;
+
+  // The number of threads for the assignment of the points and for the
+  // clustering of different nodes.
+  int num_threads = -1;
+
+  bool Check() const {
+    CHECK_OPTION_GT(num_clusters, 0);
+    CHECK_OPTION_GT(branching, 1);
+    CHECK_OPTION_GE(num_iterations, 1);
+    CHECK_OPTION_GT(batch_size_per_cluster, 0);
+    CHECK_OPTION_GE(num_mini_batch_iterations, 1);
+    return true;
+  }
+};
+
+// The cluster centers, one center per row.
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    HierarchicalKMeansCenters;
+
+// Cluster the rows of a row-major point matrix with hierarchical k-means and
+// return the centers of the leaves in the order of the tree. The points keep
+// their type, e.g. uint8 descriptors, and are converted to float in blocks,
+// such that the distances to all centers of a node are a vectorized matrix
+// product. Large nodes are clustered with mini-batch k-means after k-means++
+// initialization, small nodes with Lloyd's algorithm. The children of a node
+// are clustered in parallel and the leaves are distributed over the children
+// in proportion to their number of points.
+template <typename Points>
+HierarchicalKMeansCenters HierarchicalKMeans(
+    const HierarchicalKMeansOptions& options, const Points& points);
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+namespace internal {
+
+template <typename Points>
+class HierarchicalKMeansClusterer {
+ public:
+  typedef HierarchicalKMeansCenters Matrix;
+
+  HierarchicalKMeansClusterer(const HierarchicalKMeansOptions& options,
+                              const Points& points, TaskScheduler* scheduler)
+      : options_(options), points_(points), scheduler_(scheduler) {}
+
+  // Cluster the points of a node into the given number of leaves.
+  Matrix ClusterNode(const std::vector<int>& point_idxs, const int num_leaves,
+                     const unsigned int seed) const;
+
+ private:
+  // Number of points that are assigned in one block. The block of distances
+  // to all centers stays in the cache and each block is one task.
+  static const int kAssignmentBlockSize = 256;
+
+  Matrix GatherPoints(const std::vector<int>& point_idxs, const size_t begin,
+                      const size_t end) const;
+
+  // Assign the points to their nearest centers in parallel.
+  void Assign(const std::vector<int>& point_idxs, const Matrix& centers,
+              std::vector<int>* labels, std::vector<float>* distances) const;
+
+  // k-means++ initialization on the given points.
+  Matrix InitializeCenters(const std::vector<int>& point_idxs,
+                           const int num_centers,
+                           std::mt19937* generator) const;
+
+  Matrix ClusterLloyd(const std::vector<int>& point_idxs,
+                      const int num_centers, std::mt19937* generator) const;
+  Matrix ClusterMiniBatch(const std::vector<int>& point_idxs,
+                          const int num_centers,
+                          std::mt19937* generator) const;
+
+  const HierarchicalKMeansOptions& options_;
+  const Points& points_;
+  TaskScheduler* scheduler_;
+};
+
+// Distribute the leaves over the children in proportion to their number of
+// points, where every child gets at least one and at most all its points.
+inline std::vector<int> DistributeHierarchicalKMeansLeaves(
+    const std::vector<int>& num_child_points, const int num_leaves) {
+  int64_t num_points = 0;
+  for (const int num_child_point : num_child_points) {
+    num_points += num_child_point;
+  }
+  CHECK_GE(num_points, num_leaves);
+
+  std::vector<int> child_order(num_child_points.size());
+  for (size_t i = 0; i < child_order.size(); ++i) {
+    child_order[i] = static_cast<int>(i);
+  }
+  std::stable_sort(child_order.begin(), child_order.end(),
+                   [&num_child_points](const int i, const int j) {
+                     return num_child_points[i] > num_child_points[j];
+                   });
+
+  std::vector<int> num_child_leaves(num_child_points.size());
+  int num_distributed_leaves = 0;
+  for (size_t i = 0; i < num_child_points.size(); ++i) {
+    const int64_t num_proportional_leaves =
+        static_cast<int64_t>(num_leaves) * num_child_points[i] / num_points;
+    num_child_leaves[i] = std::min(
+        num_child_points[i],
+        std::max(1, static_cast<int>(num_proportional_leaves)));
+    num_distributed_leaves += num_child_leaves[i];
+  }
+
+  // Hand out the remaining leaves to the largest children first.
+  while (num_distributed_leaves < num_leaves) {
+    for (const int i : child_order) {
+      if (num_distributed_leaves < num_leaves &&
+          num_child_leaves[i] < num_child_points[i]) {
+        num_child_leaves[i] += 1;
+        num_distributed_leaves += 1;
+      }
+    }
+  }
+  while (num_distributed_leaves > num_leaves) {
+    for (const int i : child_order) {
+      if (num_distributed_leaves > num_leaves && num_child_leaves[i] > 1) {
+        num_child_leaves[i] -= 1;
+        num_distributed_leaves -= 1;
+      }
+    }
+  }
+
+  return num_child_leaves;
+}
+
+template <typename Points>
+typename HierarchicalKMeansClusterer<Points>::Matrix
+HierarchicalKMeansClusterer<Points>::GatherPoints(
+    const std::vector<int>& point_idxs, const size_t begin,
+    const size_t end) const {
+  Matrix gathered_points(end - begin, points_.cols());
+  for (size_t i = begin; i < end; ++i) {
+    gathered_points.row(i - begin) =
+        points_.row(point_idxs[i]).template cast<float>();
+  }
+  return gathered_points;
+}
+
+template <typename Points>
+void HierarchicalKMeansClusterer<Points>::Assign(
+    const std::vector<int>& point_idxs, const Matrix& centers,
+    std::vector<int>* labels, std::vector<float>* distances) const {
+  const Eigen::VectorXf center_norms = centers.rowwise().squaredNorm();
+  labels->resize(point_idxs.size());
+  distances->resize(point_idxs.size());
+
+  const int num_blocks = static_cast<int>(
+      (point_idxs.size() + kAssignmentBlockSize - 1) / kAssignmentBlockSize);
+  ParallelFor(
+      0, num_blocks,
+      [&](const int block) {
+        // The squared distances are expanded as |x|^2 - 2 x^T c + |c|^2.
+        const size_t begin = static_cast<size_t>(block) * kAssignmentBlockSize;
+        const size_t end =
+            std::min(point_idxs.size(), begin + kAssignmentBlockSize);
+        const Matrix block_points = GatherPoints(point_idxs, begin, end);
+        const Eigen::MatrixXf dots = block_points * centers.transpose();
+        for (size_t i = begin; i < end; ++i) {
+          int best_label = 0;
+          float best_distance = center_norms(0) - 2 * dots(i - begin, 0);
+          for (int j = 1; j < centers.rows(); ++j) {
+            const float distance = center_norms(j) - 2 * dots(i - begin, j);
+            if (distance < best_distance) {
+              best_distance = distance;
+              best_label = j;
+            }
+          }
+          (*labels)[i] = best_label;
+          (*distances)[i] = std::max(
+              0.0f, best_distance + block_points.row(i - begin).squaredNorm());
+        }
+      },
+      1, scheduler_);
+}
+
+template <typename Points>
+typename HierarchicalKMeansClusterer<Points>::Matrix
+HierarchicalKMeansClusterer<Points>::InitializeCenters(
+    const std::vector<int>& point_idxs, const int num_centers,
+    std::mt19937* generator) const {
+  const Matrix sample_points = GatherPoints(point_idxs, 0, point_idxs.size());
+  const int num_points = static_cast<int>(sample_points.rows());
+
+  Matrix centers(num_centers, sample_points.cols());
+  std::uniform_int_distribution<int> point_distribution(0, num_points - 1);
+  centers.row(0) = sample_points.row(point_distribution(*generator));
+  Eigen::VectorXf distances =
+      (sample_points.rowwise() - centers.row(0)).rowwise().squaredNorm();
+  for (int i = 1; i < num_centers; ++i) {
+    const double sum = distances.cast<double>().sum();
+    int next = point_distribution(*generator);
+    if (sum > 0) {
+      std::uniform_real_distribution<double> distribution(0, sum);
+      double threshold = distribution(*generator);
+      for (next = 0; next < num_points - 1; ++next) {
+        threshold -= distances(next);
+        if (threshold <= 0) {
+          break;
+        }
+      }
+    }
+    centers.row(i) = sample_points.row(next);
+    distances = distances.cwiseMin(
+        (sample_points.rowwise() - centers.row(i)).rowwise().squaredNorm());
+  }
+
+  return centers;
+}
+
+template <typename Points>
+typename HierarchicalKMeansClusterer<Points>::Matrix
+HierarchicalKMeansClusterer<Points>::ClusterLloyd(
+    const std::vector<int>& point_idxs, const int num_centers,
+    std::mt19937* generator) const {
+  Matrix centers = InitializeCenters(point_idxs, num_centers, generator);
+
+  std::vector<int> labels;
+  std::vector<int> prev_labels;
+  std::vector<float> distances;
+  std::vector<int> cluster_sizes(num_centers);
+  for (int iteration = 0; iteration < options_.num_iterations; ++iteration) {
+    prev_labels.swap(labels);
+    Assign(point_idxs, centers, &labels, &distances);
+    if (labels == prev_labels) {
+      break;
+    }
+
+    // Move the centers to the means of their points.
+    centers.setZero();
+    std::fill(cluster_sizes.begin(), cluster_sizes.end(), 0);
+    for (size_t i = 0; i < point_idxs.size(); ++i) {
+      centers.row(labels[i]) +=
+          points_.row(point_idxs[i]).template cast<float>();
+      cluster_sizes[labels[i]] += 1;
+    }
+    for (int j = 0; j < num_centers; ++j) {
+      if (cluster_sizes[j] > 0) {
+        centers.row(j) /= static_cast<float>(cluster_sizes[j]);
+        continue;
+      }
+      // Re-seed the empty cluster with the worst represented point, whose
+      // distance is cleared so that other empty clusters pick other points.
+      const size_t farthest =
+          std::max_element(distances.begin(), distances.end()) -
+          distances.begin();
+      centers.row(j) = points_.row(point_idxs[farthest]).template cast<float>();
+      distances[farthest] = 0;
+    }
+  }
+
+  return centers;
+}
+
+template <typename Points>
+typename HierarchicalKMeansClusterer<Points>::Matrix
+HierarchicalKMeansClusterer<Points>::ClusterMiniBatch(
+    const std::vector<int>& point_idxs, const int num_centers,
+    std::mt19937* generator) const {
+  const size_t batch_size =
+      static_cast<size_t>(options_.batch_size_per_cluster) * num_centers;
+  std::uniform_int_distribution<size_t> point_distribution(
+      0, point_idxs.size() - 1);
+  std::vector<int> batch_point_idxs(batch_size);
+  const auto SampleBatch = [&]() {
+    for (auto& point_idx : batch_point_idxs) {
+      point_idx = point_idxs[point_distribution(*generator)];
+    }
+  };
+
+  SampleBatch();
+  Matrix centers = InitializeCenters(batch_point_idxs, num_centers, generator);
+
+  // Every center moves towards its batch points with a decreasing learning
+  // rate, which is the inverse of the number of its points so far:
+  //
+  //    Sculley. "Web-Scale K-Means Clustering". WWW 2010.
+  std::vector<int64_t> num_center_points(num_centers, 0);
+  std::vector<int> labels;
+  std::vector<float> distances;
+  for (int iteration = 0; iteration < options_.num_mini_batch_iterations;
+       ++iteration) {
+    SampleBatch();
+    Assign(batch_point_idxs, centers, &labels, &distances);
+    for (size_t i = 0; i < batch_size; ++i) {
+      const int label = labels[i];
+      num_center_points[label] += 1;
+      const float learning_rate = 1.0f / num_center_points[label];
+      centers.row(label) +=
+          learning_rate *
+          (points_.row(batch_point_idxs[i]).template cast<float>() -
+           centers.row(label));
+    }
+  }
+
+  return centers;
+}
+
+template <typename Points>
+typename HierarchicalKMeansClusterer<Points>::Matrix
+HierarchicalKMeansClusterer<Points>::ClusterNode(
+    const std::vector<int>& point_idxs, const int num_leaves,
+    const unsigned int seed) const {
+  if (point_idxs.size() <= static_cast<size_t>(num_leaves)) {
+    return GatherPoints(point_idxs, 0, point_idxs.size());
+  }
+
+  std::mt19937 generator(seed);
+
+  const int num_centers = std::min(num_leaves, options_.branching);
+  const Matrix centers =
+      point_idxs.size() <=
+              static_cast<size_t>(options_.batch_size_per_cluster) *
+                  num_centers
+          ? ClusterLloyd(point_idxs, num_centers, &generator)
+          : ClusterMiniBatch(point_idxs, num_centers, &generator);
+  if (num_leaves <= options_.branching) {
+    return centers;
+  }
+
+  std::vector<int> labels;
+  std::vector<float> distances;
+  Assign(point_idxs, centers, &labels, &distances);
+
+  std::vector<std::vector<int>> child_point_idxs(num_centers);
+  for (size_t i = 0; i < point_idxs.size(); ++i) {
+    child_point_idxs[labels[i]].push_back(point_idxs[i]);
+  }
+  child_point_idxs.erase(
+      std::remove_if(child_point_idxs.begin(), child_point_idxs.end(),
+                     [](const std::vector<int>& idxs) { return idxs.empty(); }),
+      child_point_idxs.end());
+
+  std::vector<int> num_child_points(child_point_idxs.size());
+  std::vector<unsigned int> child_seeds(child_point_idxs.size());
+  for (size_t i = 0; i < child_point_idxs.size(); ++i) {
+    num_child_points[i] = static_cast<int>(child_point_idxs[i].size());
+    child_seeds[i] = generator();
+  }
+  const std::vector<int> num_child_leaves =
+      DistributeHierarchicalKMeansLeaves(num_child_points, num_leaves);
+
+  std::vector<Matrix> child_centers(child_point_idxs.size());
+  ParallelFor(0, static_cast<int>(child_point_idxs.size()),
+              [&](const int i) {
+                child_centers[i] = ClusterNode(
+                    child_point_idxs[i], num_child_leaves[i], child_seeds[i]);
+              },
+              1, scheduler_);
+
+  Matrix leaf_centers(num_leaves, centers.cols());
+  int num_leaf_centers = 0;
+  for (const Matrix& centers_of_child : child_centers) {
+    leaf_centers.middleRows(num_leaf_centers, centers_of_child.rows()) =
+        centers_of_child;
+    num_leaf_centers += static_cast<int>(centers_of_child.rows());
+  }
+  CHECK_EQ(num_leaf_centers, num_leaves);
+
+  return leaf_centers;
+}
+
+}  // namespace internal
+
+template <typename Points>
+HierarchicalKMeansCenters HierarchicalKMeans(
+    const HierarchicalKMeansOptions& options, const Points& points) {
+  static_assert(Points::IsRowMajor || Points::ColsAtCompileTime == 1,
+                "Points must be row-major.");
+  CHECK(options.Check());
+  CHECK_LE(points.rows(), std::numeric_limits<int>::max());
+
+  std::vector<int> point_idxs(points.rows());
+  for (size_t i = 0; i < point_idxs.size(); ++i) {
+    point_idxs[i] = static_cast<int>(i);
+  }
+
+  TaskScheduler scheduler(GetEffectiveNumThreads(options.num_threads));
+  const internal::HierarchicalKMeansClusterer<Points> clusterer(
+      options, points, &scheduler);
+  return clusterer.ClusterNode(
+      point_idxs, std::min<int>(options.num_clusters, points.rows()),
+      options.random_seed);
+}
+
+}  // namespace retrieval
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_RETRIEVAL_HIERARCHICAL_KMEANS_H_
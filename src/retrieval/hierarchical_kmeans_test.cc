@@ -0,0 +1,121 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "retrieval/hierarchical_kmeans"
+#include "util/testing.h"
+
+#include "retrieval/hierarchical_kmeans.h"
+
+using namespace colmap::retrieval;
+
+namespace {
+
+typedef Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    Descriptors;
+
+// Points around well separated modes, which are the first coordinates of
+// the points.
+Descriptors GenerateModePoints(const int num_modes,
+                               const int num_points_per_mode) {
+  Descriptors points(num_modes * num_points_per_mode, 8);
+  for (int i = 0; i < points.rows(); ++i) {
+    const int mode = i % num_modes;
+    for (int j = 0; j < points.cols(); ++j) {
+      points(i, j) = static_cast<uint8_t>(
+          (j == 0 ? 20 * mode : 100) + (i * 7 + j * 3) % 5);
+    }
+  }
+  return points;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestDistributeLeaves) {
+  const std::vector<int> num_leaves =
+      internal::DistributeHierarchicalKMeansLeaves({10, 1, 100, 3}, 20);
+  BOOST_REQUIRE_EQUAL(num_leaves.size(), 4);
+  BOOST_CHECK_EQUAL(num_leaves[0] + num_leaves[1] + num_leaves[2] +
+                        num_leaves[3],
+                    20);
+  BOOST_CHECK_EQUAL(num_leaves[1], 1);
+  BOOST_CHECK_GE(num_leaves[3], 1);
+  BOOST_CHECK_GT(num_leaves[2], num_leaves[0]);
+
+  const std::vector<int> all_leaves =
+      internal::DistributeHierarchicalKMeansLeaves({2, 3}, 5);
+  BOOST_CHECK_EQUAL(all_leaves[0], 2);
+  BOOST_CHECK_EQUAL(all_leaves[1], 3);
+}
+
+BOOST_AUTO_TEST_CASE(TestSingleLevel) {
+  const Descriptors points = GenerateModePoints(10, 50);
+  HierarchicalKMeansOptions options;
+  options.num_clusters = 10;
+  options.branching = 10;
+  const HierarchicalKMeansCenters centers = HierarchicalKMeans(options, points);
+  BOOST_REQUIRE_EQUAL(centers.rows(), 10);
+  BOOST_REQUIRE_EQUAL(centers.cols(), 8);
+
+  // Every mode is found by exactly one center.
+  std::vector<int> num_mode_centers(10, 0);
+  for (int i = 0; i < centers.rows(); ++i) {
+    const int mode = static_cast<int>(std::round(centers(i, 0) / 20));
+    BOOST_REQUIRE_GE(mode, 0);
+    BOOST_REQUIRE_LT(mode, 10);
+    BOOST_CHECK_LT(std::abs(centers(i, 0) - 20 * mode), 5);
+    num_mode_centers[mode] += 1;
+  }
+  for (const int num_centers : num_mode_centers) {
+    BOOST_CHECK_EQUAL(num_centers, 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestMultiLevel) {
+  const Descriptors points = GenerateModePoints(8, 200);
+  HierarchicalKMeansOptions options;
+  options.num_clusters = 100;
+  options.branching = 8;
+  // Large nodes use mini-batches, small nodes Lloyd's algorithm.
+  options.batch_size_per_cluster = 16;
+  const HierarchicalKMeansCenters centers = HierarchicalKMeans(options, points);
+  BOOST_CHECK_EQUAL(centers.rows(), 100);
+  BOOST_CHECK_GE(centers.minCoeff(), 0);
+  BOOST_CHECK_LE(centers.maxCoeff(), 255);
+}
+
+BOOST_AUTO_TEST_CASE(TestFewPoints) {
+  const Descriptors points = GenerateModePoints(3, 2);
+  HierarchicalKMeansOptions options;
+  options.num_clusters = 100;
+  options.branching = 4;
+  const HierarchicalKMeansCenters centers = HierarchicalKMeans(options, points);
+  BOOST_CHECK_EQUAL(centers.rows(), 6);
+}
+
+BOOST_AUTO_TEST_CASE(TestDeterministic) {
+  const Descriptors points = GenerateModePoints(8, 100);
+  HierarchicalKMeansOptions options;
+  options.num_clusters = 50;
+  options.branching = 4;
+  options.batch_size_per_cluster = 8;
+  options.num_threads = 1;
+  const HierarchicalKMeansCenters centers1 =
+      HierarchicalKMeans(options, points);
+  options.num_threads = 4;
+  const HierarchicalKMeansCenters centers2 =
+      HierarchicalKMeans(options, points);
+  BOOST_CHECK(centers1 == centers2);
+}
@@ -31,8 +31,11 @@
 #include "retrieval/inverted_file_entry.h"
 #include "retrieval/utils.h"
 #include "util/alignment.h"
+#include "util/endian.h"
 #include "util/logging.h"
+#include "util/mapped_file.h"
 #include "util/math.h"
+#include "util/scratch.h"
 
 namespace colmap {
 namespace retrieval {
@@ -55,13 +58,37 @@ class InvertedFile {
     USABLE = 0x03,
   };
 
+  // A contiguous range of the entries of the file.
+  class EntryRange {
+   public:
+    EntryRange(const EntryType* begin, const EntryType* end)
+        : begin_(begin), end_(end) {}
+
+    const EntryType* begin() const { return begin_; }
+    const EntryType* end() const { return end_; }
+    size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+    const EntryType& front() const { return *begin_; }
+    const EntryType& operator[](const size_t idx) const { return begin_[idx]; }
+
+   private:
+    const EntryType* begin_;
+    const EntryType* end_;
+  };
+
   InvertedFile();
 
   // The number of added entries.
   size_t NumEntries() const;
 
   // Return all entries in the file.
-  const std::vector<EntryType>& GetEntries() const;
+  EntryRange GetEntries() const;
+
+  // Use the entries in the packed format of InvertedFileEntry, which are
+  // stored outside of the file, e.g. in a memory-mapped index that must
+  // outlive the file. The entries are only copied into the file before they
+  // are modified or if their memory layout differs from the packed format.
+  void MapEntries(const char* data, const size_t num_entries);
 
   // Whether the Hamming embedding was computed for this file.
   bool HasHammingEmbedding() const;
@@ -125,7 +152,17 @@ class InvertedFile {
   void Read(std::ifstream* ifs);
   void Write(std::ofstream* ofs) const;
 
+  // Read/write the status, the idf-weight and the thresholds of the file
+  // without its entries.
+  void ReadHeader(MappedFileReader* reader);
+  void WriteHeader(std::ofstream* ofs) const;
+
  private:
+  void SetMappedEntries(const EntryType* entries, const size_t num_entries);
+
+  // Copy the mapped entries into the file.
+  void CopyMappedEntries();
+
   // Whether the inverted file is initialized.
   uint8_t status_;
 
@@ -135,6 +172,11 @@ class InvertedFile {
   // The entries of the inverted file system.
   std::vector<EntryType> entries_;
 
+  // The entries stored outside of the file, which are used instead of
+  // entries_, if they are set.
+  const EntryType* mapped_entries_;
+  size_t num_mapped_entries_;
+
   // The thresholds used for Hamming embedding.
   DescType thresholds_;
 
@@ -153,7 +195,10 @@ const HammingDistWeightFunctor<kEmbeddingDim>
 
 template <int kEmbeddingDim>
 InvertedFile<kEmbeddingDim>::InvertedFile()
-    : status_(UNUSABLE), idf_weight_(0.0f) {
+    : status_(UNUSABLE),
+      idf_weight_(0.0f),
+      mapped_entries_(nullptr),
+      num_mapped_entries_(0) {
   static_assert(kEmbeddingDim % 8 == 0,
                 "Dimensionality of projected space needs to"
                 " be a multiple of 8.");
@@ -166,13 +211,50 @@ InvertedFile<kEmbeddingDim>::InvertedFile()
 
 template <int kEmbeddingDim>
 size_t InvertedFile<kEmbeddingDim>::NumEntries() const {
-  return entries_.size();
+  return mapped_entries_ == nullptr ? entries_.size() : num_mapped_entries_;
 }
 
 template <int kEmbeddingDim>
-const std::vector<typename InvertedFile<kEmbeddingDim>::EntryType>&
+typename InvertedFile<kEmbeddingDim>::EntryRange
 InvertedFile<kEmbeddingDim>::GetEntries() const {
-  return entries_;
+  if (mapped_entries_ == nullptr) {
+    return EntryRange(entries_.data(), entries_.data() + entries_.size());
+  } else {
+    return EntryRange(mapped_entries_, mapped_entries_ + num_mapped_entries_);
+  }
+}
+
+template <int kEmbeddingDim>
+void InvertedFile<kEmbeddingDim>::MapEntries(const char* data,
+                                             const size_t num_entries) {
+  static const bool kHasPackedLayout = EntryType::HasPackedLayout();
+  if (kHasPackedLayout) {
+    SetMappedEntries(reinterpret_cast<const EntryType*>(data), num_entries);
+  } else {
+    SetMappedEntries(nullptr, 0);
+    entries_.resize(num_entries);
+    for (size_t i = 0; i < num_entries; ++i) {
+      entries_[i].ReadPacked(data + i * EntryType::kPackedSize);
+    }
+  }
+}
+
+template <int kEmbeddingDim>
+void InvertedFile<kEmbeddingDim>::SetMappedEntries(const EntryType* entries,
+                                                   const size_t num_entries) {
+  entries_.clear();
+  entries_.shrink_to_fit();
+  mapped_entries_ = num_entries > 0 ? entries : nullptr;
+  num_mapped_entries_ = num_entries;
+}
+
+template <int kEmbeddingDim>
+void InvertedFile<kEmbeddingDim>::CopyMappedEntries() {
+  if (mapped_entries_ != nullptr) {
+    entries_.assign(mapped_entries_, mapped_entries_ + num_mapped_entries_);
+    mapped_entries_ = nullptr;
+    num_mapped_entries_ = 0;
+  }
 }
 
 template <int kEmbeddingDim>
@@ -202,12 +284,17 @@ void InvertedFile<kEmbeddingDim>::AddEntry(const int image_id,
   entry.feature_idx = feature_idx;
   entry.geometry = geometry;
   ConvertToBinaryDescriptor(descriptor, &entry.descriptor);
+  CopyMappedEntries();
   entries_.push_back(entry);
   status_ &= ~ENTRIES_SORTED;
 }
 
 template <int kEmbeddingDim>
 void InvertedFile<kEmbeddingDim>::SortEntries() {
+  if (EntriesSorted()) {
+    return;
+  }
+  CopyMappedEntries();
   std::sort(entries_.begin(), entries_.end(),
             [](const EntryType& entry1, const EntryType& entry2) {
               return entry1.image_id < entry2.image_id;
@@ -217,7 +304,7 @@ void InvertedFile<kEmbeddingDim>::SortEntries() {
 
 template <int kEmbeddingDim>
 void InvertedFile<kEmbeddingDim>::ClearEntries() {
-  entries_.clear();
+  SetMappedEntries(nullptr, 0);
   status_ &= ~ENTRIES_SORTED;
 }
 
@@ -225,7 +312,7 @@ template <int kEmbeddingDim>
 void InvertedFile<kEmbeddingDim>::Reset() {
   status_ = UNUSABLE;
   idf_weight_ = 0.0f;
-  entries_.clear();
+  SetMappedEntries(nullptr, 0);
   thresholds_.setZero();
 }
 
@@ -241,7 +328,7 @@ void InvertedFile<kEmbeddingDim>::ConvertToBinaryDescriptor(
 
 template <int kEmbeddingDim>
 void InvertedFile<kEmbeddingDim>::ComputeIDFWeight(const int num_total_images) {
-  if (entries_.empty()) {
+  if (NumEntries() == 0) {
     return;
   }
 
@@ -287,7 +374,8 @@ void InvertedFile<kEmbeddingDim>::ScoreFeature(
     return;
   }
 
-  if (entries_.size() == 0) {
+  const EntryRange entries = GetEntries();
+  if (entries.empty()) {
     return;
   }
 
@@ -296,14 +384,21 @@ void InvertedFile<kEmbeddingDim>::ScoreFeature(
   std::bitset<kEmbeddingDim> bin_descriptor;
   ConvertToBinaryDescriptor(descriptor, &bin_descriptor);
 
+  // The distances to all entries are computed first in a tight loop over the
+  // contiguous entries, which the voting then only looks up.
+  ScratchVector<uint8_t> hamming_dists(entries.size());
+  ComputeHammingDistances(bin_descriptor, entries.begin(), entries.size(),
+                          hamming_dists->data());
+
   ImageScore image_score;
-  image_score.image_id = entries_.front().image_id;
+  image_score.image_id = entries.front().image_id;
   image_score.score = 0.0f;
   int num_image_votes = 0;
 
   // Note that this assumes that the entries are sorted using SortEntries
   // according to their image identifiers.
-  for (const auto& entry : entries_) {
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const EntryType& entry = entries[i];
     if (image_score.image_id < entry.image_id) {
       if (num_image_votes > 0) {
         // Finalizes the voting since we now know how many features from
@@ -324,7 +419,7 @@ void InvertedFile<kEmbeddingDim>::ScoreFeature(
       num_image_votes = 0;
     }
 
-    const size_t hamming_dist = (bin_descriptor ^ entry.descriptor).count();
+    const size_t hamming_dist = (*hamming_dists)[i];
 
     if (hamming_dist <= hamming_dist_weight_functor_.kMaxHammingDistance) {
       image_score.score += hamming_dist_weight_functor_(hamming_dist);
@@ -343,7 +438,7 @@ void InvertedFile<kEmbeddingDim>::ScoreFeature(
 template <int kEmbeddingDim>
 void InvertedFile<kEmbeddingDim>::GetImageIds(
     std::unordered_set<int>* ids) const {
-  for (const EntryType& entry : entries_) {
+  for (const EntryType& entry : GetEntries()) {
     ids->insert(entry.image_id);
   }
 }
@@ -352,7 +447,7 @@ template <int kEmbeddingDim>
 void InvertedFile<kEmbeddingDim>::ComputeImageSelfSimilarities(
     std::unordered_map<int, double>* self_similarities) const {
   const double squared_idf_weight = idf_weight_ * idf_weight_;
-  for (const auto& entry : entries_) {
+  for (const auto& entry : GetEntries()) {
     (*self_similarities)[entry.image_id] += squared_idf_weight;
   }
 }
@@ -370,6 +465,7 @@ void InvertedFile<kEmbeddingDim>::Read(std::ifstream* ifs) {
 
   uint32_t num_entries = 0;
   ifs->read(reinterpret_cast<char*>(&num_entries), sizeof(uint32_t));
+  SetMappedEntries(nullptr, 0);
   entries_.resize(num_entries);
 
   for (uint32_t i = 0; i < num_entries; ++i) {
@@ -388,11 +484,30 @@ void InvertedFile<kEmbeddingDim>::Write(std::ofstream* ofs) const {
     ofs->write(reinterpret_cast<const char*>(&thresholds_[i]), sizeof(float));
   }
 
-  const uint32_t num_entries = static_cast<uint32_t>(entries_.size());
+  const EntryRange entries = GetEntries();
+  const uint32_t num_entries = static_cast<uint32_t>(entries.size());
   ofs->write(reinterpret_cast<const char*>(&num_entries), sizeof(uint32_t));
 
   for (uint32_t i = 0; i < num_entries; ++i) {
-    entries_[i].Write(ofs);
+    entries[i].Write(ofs);
+  }
+}
+
+template <int kEmbeddingDim>
+void InvertedFile<kEmbeddingDim>::ReadHeader(MappedFileReader* reader) {
+  status_ = reader->Read<uint8_t>();
+  idf_weight_ = reader->Read<float>();
+  for (int i = 0; i < kEmbeddingDim; ++i) {
+    thresholds_[i] = reader->Read<float>();
+  }
+}
+
+template <int kEmbeddingDim>
+void InvertedFile<kEmbeddingDim>::WriteHeader(std::ofstream* ofs) const {
+  WriteBinaryLittleEndian<uint8_t>(ofs, status_);
+  WriteBinaryLittleEndian<float>(ofs, idf_weight_);
+  for (int i = 0; i < kEmbeddingDim; ++i) {
+    WriteBinaryLittleEndian<float>(ofs, thresholds_[i]);
   }
 }
 
@@ -18,7 +18,14 @@
 #define COLMAP_SRC_RETRIEVAL_INVERTED_FILE_ENTRY_H_
 
 #include <bitset>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <sstream>
+
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+#include <immintrin.h>
+#endif
 
 #include "retrieval/geometry.h"
 
@@ -30,9 +37,20 @@ namespace retrieval {
 // This class is based on an original implementation by Torsten Sattler.
 template <int N>
 struct InvertedFileEntry {
+  // The number of bytes of an entry in the packed format of Read and Write.
+  static const size_t kPackedSize = 32;
+
   void Read(std::istream* ifs);
   void Write(std::ostream* ofs) const;
 
+  // Read an entry from its packed format in memory.
+  void ReadPacked(const char* data);
+
+  // Whether the memory layout of an entry equals its packed format on this
+  // platform, so that packed entries, e.g. in a memory-mapped index, can be
+  // used in place without decoding them.
+  static bool HasPackedLayout();
+
   // The identifier of the image this entry is associated with.
   int image_id = -1;
 
@@ -46,10 +64,23 @@ struct InvertedFileEntry {
   std::bitset<N> descriptor;
 };
 
+// Compute the Hamming distances between a binary signature and the signatures
+// of contiguous entries as population counts of 64-bit words. If the entries
+// have the packed layout, the signatures of eight entries are compared at a
+// time with AVX-512 VPOPCNTQ, where it is available.
+template <int N>
+void ComputeHammingDistances(
+    const decltype(InvertedFileEntry<N>::descriptor)& descriptor,
+    const InvertedFileEntry<N>* entries, const size_t num_entries,
+    uint8_t* distances);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
 
+template <int N>
+const size_t InvertedFileEntry<N>::kPackedSize;
+
 template <int N>
 void InvertedFileEntry<N>::Read(std::istream* ifs) {
   static_assert(N <= 64, "Dimensionality too large");
@@ -92,6 +123,97 @@ void InvertedFileEntry<N>::Write(std::ostream* ofs) const {
   ofs->write(reinterpret_cast<const char*>(&descriptor_data), sizeof(uint64_t));
 }
 
+template <int N>
+void InvertedFileEntry<N>::ReadPacked(const char* data) {
+  int32_t image_id_data = 0;
+  std::memcpy(&image_id_data, data, sizeof(int32_t));
+  image_id = static_cast<int>(image_id_data);
+
+  int32_t feature_idx_data = 0;
+  std::memcpy(&feature_idx_data, data + 4, sizeof(int32_t));
+  feature_idx = static_cast<int>(feature_idx_data);
+
+  std::memcpy(&geometry, data + 8, sizeof(FeatureGeometry));
+
+  uint64_t descriptor_data = 0;
+  std::memcpy(&descriptor_data, data + 24, sizeof(uint64_t));
+  descriptor = std::bitset<N>(descriptor_data);
+}
+
+template <int N>
+bool InvertedFileEntry<N>::HasPackedLayout() {
+  if (sizeof(InvertedFileEntry<N>) != kPackedSize) {
+    return false;
+  }
+
+  InvertedFileEntry<N> entry;
+  entry.image_id = 0x01020304;
+  entry.feature_idx = 0x05060708;
+  entry.geometry.x = 1.0f;
+  entry.geometry.y = 2.0f;
+  entry.geometry.scale = 3.0f;
+  entry.geometry.orientation = 4.0f;
+  for (int i = 0; i < N; i += 3) {
+    entry.descriptor[i] = true;
+  }
+
+  std::ostringstream stream;
+  entry.Write(&stream);
+  const std::string packed_entry = stream.str();
+  return packed_entry.size() == kPackedSize &&
+         std::memcmp(packed_entry.data(), &entry, kPackedSize) == 0;
+}
+
+inline int PopulationCount64(const uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(value);
+#else
+  return static_cast<int>(std::bitset<64>(value).count());
+#endif
+}
+
+template <int N>
+void ComputeHammingDistances(
+    const decltype(InvertedFileEntry<N>::descriptor)& descriptor,
+    const InvertedFileEntry<N>* entries, const size_t num_entries,
+    uint8_t* distances) {
+  static_assert(N <= 64, "Dimensionality too large");
+
+  const uint64_t query_descriptor =
+      static_cast<uint64_t>(descriptor.to_ullong());
+
+  size_t i = 0;
+
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+  static const bool kHasPackedLayout = InvertedFileEntry<N>::HasPackedLayout();
+  if (kHasPackedLayout) {
+    // The signatures are the last 8 bytes of the entries of 32 bytes, i.e.
+    // every fourth 64-bit word starting at the fourth word.
+    static_assert(InvertedFileEntry<N>::kPackedSize == 32,
+                  "Packed entry size mismatch");
+    const __m512i query_descriptors =
+        _mm512_set1_epi64(static_cast<long long>(query_descriptor));
+    const __m512i word_offsets =
+        _mm512_setr_epi64(3, 7, 11, 15, 19, 23, 27, 31);
+    const long long* words = reinterpret_cast<const long long*>(entries);
+    for (; i + 8 <= num_entries; i += 8) {
+      const __m512i entry_descriptors =
+          _mm512_i64gather_epi64(word_offsets, words + 4 * i, 8);
+      const __m512i counts = _mm512_popcnt_epi64(
+          _mm512_xor_si512(entry_descriptors, query_descriptors));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(distances + i),
+                       _mm512_cvtepi64_epi8(counts));
+    }
+  }
+#endif
+
+  for (; i < num_entries; ++i) {
+    distances[i] = static_cast<uint8_t>(PopulationCount64(
+        query_descriptor ^
+        static_cast<uint64_t>(entries[i].descriptor.to_ullong())));
+  }
+}
+
 }  // namespace retrieval
 }  // namespace colmap
 
@@ -59,3 +59,68 @@ BOOST_AUTO_TEST_CASE(TestReadWrite) {
     BOOST_CHECK_EQUAL(entry.descriptor[i], read_entry.descriptor[i]);
   }
 }
+
+BOOST_AUTO_TEST_CASE(TestReadPacked) {
+  InvertedFileEntry<64> entry;
+  entry.image_id = 99;
+  entry.feature_idx = 100;
+  entry.geometry.x = 0.123;
+  entry.geometry.y = 0.456;
+  entry.geometry.scale = 0.789;
+  entry.geometry.orientation = -0.1;
+  for (size_t i = 0; i < entry.descriptor.size(); ++i) {
+    entry.descriptor[i] = (i % 3) == 0;
+  }
+  std::stringstream file;
+  entry.Write(&file);
+  const std::string packed_entry = file.str();
+  BOOST_CHECK_EQUAL(packed_entry.size(), InvertedFileEntry<64>::kPackedSize);
+
+  InvertedFileEntry<64> read_entry;
+  read_entry.ReadPacked(packed_entry.data());
+  BOOST_CHECK_EQUAL(entry.image_id, read_entry.image_id);
+  BOOST_CHECK_EQUAL(entry.feature_idx, read_entry.feature_idx);
+  BOOST_CHECK_EQUAL(entry.geometry.x, read_entry.geometry.x);
+  BOOST_CHECK_EQUAL(entry.geometry.y, read_entry.geometry.y);
+  BOOST_CHECK_EQUAL(entry.geometry.scale, read_entry.geometry.scale);
+  BOOST_CHECK_EQUAL(entry.geometry.orientation,
+                    read_entry.geometry.orientation);
+  BOOST_CHECK(entry.descriptor == read_entry.descriptor);
+
+  if (InvertedFileEntry<64>::HasPackedLayout()) {
+    BOOST_CHECK_EQUAL(std::memcmp(packed_entry.data(), &entry,
+                                  InvertedFileEntry<64>::kPackedSize),
+                      0);
+  }
+}
+
+template <int N>
+void TestComputeHammingDistancesDim() {
+  // More entries than one block of eight and a remainder.
+  std::vector<InvertedFileEntry<N>> entries(21);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    entries[i].image_id = static_cast<int>(i);
+    for (int j = 0; j < N; ++j) {
+      entries[i].descriptor[j] = ((i + 1) * (j + 3)) % 5 < 2;
+    }
+  }
+
+  std::bitset<N> descriptor;
+  for (int j = 0; j < N; j += 2) {
+    descriptor[j] = true;
+  }
+
+  std::vector<uint8_t> distances(entries.size());
+  ComputeHammingDistances(descriptor, entries.data(), entries.size(),
+                          distances.data());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    BOOST_CHECK_EQUAL(distances[i],
+                      (descriptor ^ entries[i].descriptor).count());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestComputeHammingDistances) {
+  TestComputeHammingDistancesDim<64>();
+  TestComputeHammingDistancesDim<32>();
+  TestComputeHammingDistancesDim<8>();
+}
@@ -21,6 +21,7 @@
 #include <bitset>
 #include <cstdint>
 #include <fstream>
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -30,7 +31,10 @@
 
 #include "retrieval/inverted_file.h"
 #include "util/alignment.h"
+#include "util/endian.h"
+#include "util/mapped_file.h"
 #include "util/random.h"
+#include "util/threading.h"
 
 namespace colmap {
 namespace retrieval {
@@ -58,8 +62,9 @@ class InvertedIndex {
   void Initialize(const int num_words);
 
   // Finalizes the inverted index by sorting each inverted file such that all
-  // entries are in ascending order of image ids.
-  void Finalize();
+  // entries are in ascending order of image ids. The inverted files are
+  // sorted concurrently in contiguous ranges of visual words.
+  void Finalize(const int num_threads = 1);
 
   // Generate projection matrix for Hamming embedding.
   void GenerateHammingEmbeddingProjection();
@@ -74,6 +79,18 @@ class InvertedIndex {
                 typename DescType::Index feature_idx,
                 const DescType& descriptor, const GeomType& geometry);
 
+  // Project the descriptors for the Hamming embedding, where the projected
+  // descriptor of each row of descriptors is a column of the result.
+  Eigen::MatrixXf ProjectDescriptors(const DescType& descriptors) const;
+
+  // Add single entry with a descriptor that was projected with
+  // ProjectDescriptors. Note that entries for different visual words can be
+  // added concurrently.
+  void AddProjectedEntry(const int image_id, const int word_id,
+                         typename DescType::Index feature_idx,
+                         const ProjDescType& proj_desc,
+                         const GeomType& geometry);
+
   // Clear all index entries.
   void ClearEntries();
 
@@ -100,6 +117,17 @@ class InvertedIndex {
   void Read(std::ifstream* ifs);
   void Write(std::ofstream* ofs) const;
 
+  // Read/write the inverted index in the layout of a memory-mapped index, in
+  // which the packed entries of all inverted files follow the headers of the
+  // files. Every inverted file that spans at least a page starts on a page,
+  // so that a query only touches the pages of the entries of its visual
+  // words. The entries are used in place from the mapped file, which is kept
+  // open by the index. The write position of the stream must be its offset
+  // in the file.
+  void ReadMapped(const std::shared_ptr<MappedFile>& file,
+                  const size_t offset);
+  void WriteMapped(std::ofstream* ofs) const;
+
  private:
   void ComputeWeightsAndNormalizationConstants();
 
@@ -114,6 +142,9 @@ class InvertedIndex {
 
   // The projection matrix used to project SIFT descriptors.
   ProjMatrixType proj_matrix_;
+
+  // The memory-mapped index file, whose entries are used by inverted files.
+  std::shared_ptr<MappedFile> mapped_file_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -143,14 +174,31 @@ void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::Initialize(
   for (auto& inverted_file : inverted_files_) {
     inverted_file.Reset();
   }
+  mapped_file_.reset();
 }
 
 template <typename kDescType, int kDescDim, int kEmbeddingDim>
-void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::Finalize() {
+void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::Finalize(
+    const int num_threads) {
   CHECK_GT(NumVisualWords(), 0);
 
-  for (auto& inverted_file : inverted_files_) {
-    inverted_file.SortEntries();
+  auto SortEntries = [this](const int begin_word_id, const int end_word_id) {
+    for (int word_id = begin_word_id; word_id < end_word_id; ++word_id) {
+      inverted_files_[word_id].SortEntries();
+    }
+  };
+
+  const int num_shards =
+      std::min(GetEffectiveNumThreads(num_threads), NumVisualWords());
+  if (num_shards <= 1) {
+    SortEntries(0, NumVisualWords());
+  } else {
+    ThreadPool thread_pool(num_shards);
+    for (int shard = 0; shard < num_shards; ++shard) {
+      thread_pool.AddTask(SortEntries, shard * NumVisualWords() / num_shards,
+                          (shard + 1) * NumVisualWords() / num_shards);
+    }
+    thread_pool.Wait();
   }
 
   ComputeWeightsAndNormalizationConstants();
@@ -213,6 +261,22 @@ void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::AddEntry(
       .AddEntry(image_id, feature_idx, proj_desc, geometry);
 }
 
+template <typename kDescType, int kDescDim, int kEmbeddingDim>
+Eigen::MatrixXf
+InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::ProjectDescriptors(
+    const DescType& descriptors) const {
+  CHECK_EQ(descriptors.cols(), kDescDim);
+  return proj_matrix_ * descriptors.transpose().template cast<float>();
+}
+
+template <typename kDescType, int kDescDim, int kEmbeddingDim>
+void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::AddProjectedEntry(
+    const int image_id, const int word_id, typename DescType::Index feature_idx,
+    const ProjDescType& proj_desc, const GeomType& geometry) {
+  inverted_files_.at(word_id)
+      .AddEntry(image_id, feature_idx, proj_desc, geometry);
+}
+
 template <typename kDescType, int kDescDim, int kEmbeddingDim>
 void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::ClearEntries() {
   for (auto& inverted_file : inverted_files_) {
@@ -398,6 +462,114 @@ void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::Write(
   }
 }
 
+template <typename kDescType, int kDescDim, int kEmbeddingDim>
+void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::ReadMapped(
+    const std::shared_ptr<MappedFile>& file, const size_t offset) {
+  CHECK(file->IsOpen());
+  CHECK_LE(offset, file->Size());
+
+  MappedFileReader reader(file->Data() + offset, file->Size() - offset);
+
+  const int32_t num_words = reader.Read<int32_t>();
+  CHECK_GT(num_words, 0);
+
+  Initialize(num_words);
+
+  const int32_t N_t = reader.Read<int32_t>();
+  CHECK_EQ(N_t, kEmbeddingDim)
+      << "The length of the binary strings should be " << kEmbeddingDim
+      << " but is " << N_t << ". The indices are not compatible!";
+
+  for (int i = 0; i < kEmbeddingDim; ++i) {
+    for (int j = 0; j < kDescDim; ++j) {
+      proj_matrix_(i, j) = reader.Read<float>();
+    }
+  }
+
+  const size_t num_images =
+      reader.ReadCount(sizeof(int32_t) + sizeof(float));
+  normalization_constants_.clear();
+  normalization_constants_.reserve(num_images);
+  for (size_t i = 0; i < num_images; ++i) {
+    const int image_id = reader.Read<int32_t>();
+    normalization_constants_[image_id] = reader.Read<float>();
+  }
+
+  for (auto& inverted_file : inverted_files_) {
+    inverted_file.ReadHeader(&reader);
+    const uint64_t entries_offset = reader.Read<uint64_t>();
+    const uint64_t num_entries = reader.Read<uint64_t>();
+    CHECK(reader.Good()) << "Truncated visual index";
+    CHECK_LE(entries_offset, file->Size());
+    CHECK_LE(num_entries,
+             (file->Size() - entries_offset) / EntryType::kPackedSize);
+    inverted_file.MapEntries(file->Data() + entries_offset, num_entries);
+  }
+
+  mapped_file_ = file;
+}
+
+template <typename kDescType, int kDescDim, int kEmbeddingDim>
+void InvertedIndex<kDescType, kDescDim, kEmbeddingDim>::WriteMapped(
+    std::ofstream* ofs) const {
+  CHECK(ofs->is_open());
+
+  const size_t kPageSize = 4096;
+  auto AlignOffset = [kPageSize](const size_t offset) {
+    return (offset + kPageSize - 1) / kPageSize * kPageSize;
+  };
+
+  WriteBinaryLittleEndian<int32_t>(ofs, NumVisualWords());
+  WriteBinaryLittleEndian<int32_t>(ofs, kEmbeddingDim);
+
+  for (int i = 0; i < kEmbeddingDim; ++i) {
+    for (int j = 0; j < kDescDim; ++j) {
+      WriteBinaryLittleEndian<float>(ofs, proj_matrix_(i, j));
+    }
+  }
+
+  WriteBinaryLittleEndian<uint64_t>(ofs, normalization_constants_.size());
+  for (const auto& constant : normalization_constants_) {
+    WriteBinaryLittleEndian<int32_t>(ofs, constant.first);
+    WriteBinaryLittleEndian<float>(ofs, constant.second);
+  }
+
+  // Determine the offsets of the entries of the inverted files, which follow
+  // the headers of all files.
+  const size_t kHeaderSize = sizeof(uint8_t) +
+                             (kEmbeddingDim + 1) * sizeof(float) +
+                             2 * sizeof(uint64_t);
+  size_t entries_offset = AlignOffset(static_cast<size_t>(ofs->tellp()) +
+                                      NumVisualWords() * kHeaderSize);
+  std::vector<size_t> entries_offsets;
+  entries_offsets.reserve(inverted_files_.size());
+  for (const auto& inverted_file : inverted_files_) {
+    const size_t num_bytes =
+        inverted_file.NumEntries() * EntryType::kPackedSize;
+    if (num_bytes >= kPageSize) {
+      entries_offset = AlignOffset(entries_offset);
+    }
+    entries_offsets.push_back(entries_offset);
+    entries_offset += num_bytes;
+  }
+
+  for (size_t i = 0; i < inverted_files_.size(); ++i) {
+    inverted_files_[i].WriteHeader(ofs);
+    WriteBinaryLittleEndian<uint64_t>(ofs, entries_offsets[i]);
+    WriteBinaryLittleEndian<uint64_t>(ofs, inverted_files_[i].NumEntries());
+  }
+
+  const std::vector<char> padding(kPageSize, 0);
+  for (size_t i = 0; i < inverted_files_.size(); ++i) {
+    const size_t position = static_cast<size_t>(ofs->tellp());
+    CHECK_LE(position, entries_offsets[i]);
+    ofs->write(padding.data(), entries_offsets[i] - position);
+    for (const auto& entry : inverted_files_[i].GetEntries()) {
+      entry.Write(ofs);
+    }
+  }
+}
+
 template <typename kDescType, int kDescDim, int kEmbeddingDim>
 void InvertedIndex<kDescType, kDescDim,
                    kEmbeddingDim>::ComputeWeightsAndNormalizationConstants() {
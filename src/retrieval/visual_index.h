@@ -17,18 +17,24 @@
 #ifndef COLMAP_SRC_RETRIEVAL_VISUAL_INDEX_H_
 #define COLMAP_SRC_RETRIEVAL_VISUAL_INDEX_H_
 
+#include <cstring>
+#include <memory>
+
 #include <boost/heap/fibonacci_heap.hpp>
 #include <Eigen/Core>
 
 #include "ext/FLANN/flann.hpp"
 #include "feature/types.h"
+#include "retrieval/hierarchical_kmeans.h"
 #include "retrieval/inverted_file.h"
 #include "retrieval/inverted_index.h"
 #include "retrieval/vote_and_verify.h"
 #include "util/alignment.h"
 #include "util/endian.h"
 #include "util/logging.h"
+#include "util/mapped_file.h"
 #include "util/math.h"
+#include "util/threading.h"
 
 namespace colmap {
 namespace retrieval {
@@ -89,9 +95,12 @@ class VisualIndex {
     // The branching factor of the hierarchical k-means tree.
     int branching = 256;
 
-    // The number of iterations for the clustering.
+    // The number of Lloyd iterations for the clustering of small nodes.
     int num_iterations = 11;
 
+    // The number of mini-batch iterations for the clustering of large nodes.
+    int num_mini_batch_iterations = 100;
+
     // The target precision of the visual word search index.
     double target_precision = 0.9;
 
@@ -111,6 +120,15 @@ class VisualIndex {
   void Add(const IndexOptions& options, const int image_id,
            const GeomType& geometries, const DescType& descriptors);
 
+  // Add a batch of images to the visual index. The descriptors of the images
+  // are quantized concurrently and the entries are then inserted by threads
+  // that each own a contiguous range of visual words, so that no inverted file
+  // is shared between threads. The entries are the same as for adding the
+  // images one by one.
+  void Add(const IndexOptions& options, const std::vector<int>& image_ids,
+           const std::vector<GeomType>& geometries,
+           const std::vector<DescType>& descriptors);
+
   // Check if an image has been indexed.
   bool ImageIndexed(const int image_id) const;
 
@@ -123,19 +141,33 @@ class VisualIndex {
              const DescType& descriptors,
              std::vector<ImageScore>* image_scores) const;
 
+  // Query a batch of images concurrently, where each image is queried by a
+  // single thread. The geometries are only required for spatial verification.
+  void Query(const QueryOptions& options,
+             const std::vector<GeomType>& geometries,
+             const std::vector<DescType>& descriptors,
+             std::vector<std::vector<ImageScore>>* image_scores) const;
+
   // Prepare the index after adding images and before querying.
-  void Prepare();
+  void Prepare(const int num_threads = kMaxNumThreads);
 
   // Build a visual index from a set of training descriptors by quantizing the
   // descriptor space into visual words and compute their Hamming embedding.
   void Build(const BuildOptions& options, const DescType& descriptors);
 
   // Read and write the visual index. This can be done for an index with and
-  // without indexed images.
+  // without indexed images. The index is written in a format, whose inverted
+  // files are memory-mapped when it is read, so that the index is ready for
+  // queries without reading its entries and the pages of the entries are
+  // shared by all processes that read the same index. Indices in the
+  // previous format, which is read completely into memory, are detected.
   void Read(const std::string& path);
   void Write(const std::string& path);
 
  private:
+  // The magic number at the start of an index in the memory-mapped format.
+  static const char kMappedFormatMagic[8];
+
   // Quantize the descriptor space into visual words.
   void Quantize(const BuildOptions& options, const DescType& descriptors);
 
@@ -171,6 +203,10 @@ class VisualIndex {
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
 
+template <typename kDescType, int kDescDim, int kEmbeddingDim>
+const char VisualIndex<kDescType, kDescDim, kEmbeddingDim>::kMappedFormatMagic
+    [8] = {'T', 'B', 'S', 'F', 'M', 'V', 'I', '\0'};
+
 template <typename kDescType, int kDescDim, int kEmbeddingDim>
 VisualIndex<kDescType, kDescDim, kEmbeddingDim>::VisualIndex()
     : prepared_(false) {}
@@ -226,6 +262,85 @@ void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Add(
   }
 }
 
+template <typename kDescType, int kDescDim, int kEmbeddingDim>
+void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Add(
+    const IndexOptions& options, const std::vector<int>& image_ids,
+    const std::vector<GeomType>& geometries,
+    const std::vector<DescType>& descriptors) {
+  CHECK_EQ(image_ids.size(), geometries.size());
+  CHECK_EQ(image_ids.size(), descriptors.size());
+
+  // The indices of the images in the batch that are not yet indexed.
+  std::vector<size_t> image_idxs;
+  image_idxs.reserve(image_ids.size());
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    if (ImageIndexed(image_ids[i])) {
+      continue;
+    }
+    image_ids_.insert(image_ids[i]);
+    if (descriptors[i].rows() > 0) {
+      image_idxs.push_back(i);
+    }
+  }
+
+  prepared_ = false;
+
+  if (image_idxs.empty()) {
+    return;
+  }
+
+  ThreadPool thread_pool(options.num_threads);
+
+  // Quantize and project the descriptors of every image on a single thread.
+  std::vector<Eigen::MatrixXi> word_ids(image_idxs.size());
+  std::vector<Eigen::MatrixXf> proj_descs(image_idxs.size());
+  for (size_t i = 0; i < image_idxs.size(); ++i) {
+    thread_pool.AddTask([&, i]() {
+      const DescType& image_descriptors = descriptors[image_idxs[i]];
+      word_ids[i] = FindWordIds(image_descriptors, options.num_neighbors,
+                                options.num_checks, 1);
+      proj_descs[i] = inverted_index_.ProjectDescriptors(image_descriptors);
+    });
+  }
+  thread_pool.Wait();
+
+  auto AddEntries = [&](const int begin_word_id, const int end_word_id) {
+    typename InvertedIndexType::ProjDescType proj_desc;
+    for (size_t i = 0; i < image_idxs.size(); ++i) {
+      const int image_id = image_ids[image_idxs[i]];
+      const GeomType& image_geometries = geometries[image_idxs[i]];
+      for (Eigen::MatrixXi::Index j = 0; j < word_ids[i].rows(); ++j) {
+        for (Eigen::MatrixXi::Index n = 0; n < word_ids[i].cols(); ++n) {
+          // Note that invalid word identifiers are outside of all ranges.
+          const int word_id = word_ids[i](j, n);
+          if (word_id < begin_word_id || word_id >= end_word_id) {
+            continue;
+          }
+
+          typename InvertedIndexType::GeomType geometry;
+          geometry.x = image_geometries[j].x;
+          geometry.y = image_geometries[j].y;
+          geometry.scale = image_geometries[j].ComputeScale();
+          geometry.orientation = image_geometries[j].ComputeOrientation();
+
+          proj_desc = proj_descs[i].col(j);
+          inverted_index_.AddProjectedEntry(image_id, word_id, j, proj_desc,
+                                            geometry);
+        }
+      }
+    }
+  };
+
+  const int num_words = static_cast<int>(NumVisualWords());
+  const int num_shards =
+      std::min(static_cast<int>(thread_pool.NumThreads()), num_words);
+  for (int shard = 0; shard < num_shards; ++shard) {
+    thread_pool.AddTask(AddEntries, shard * num_words / num_shards,
+                        (shard + 1) * num_words / num_shards);
+  }
+  thread_pool.Wait();
+}
+
 template <typename kDescType, int kDescDim, int kEmbeddingDim>
 bool VisualIndex<kDescType, kDescDim, kEmbeddingDim>::ImageIndexed(
     const int image_id) const {
@@ -346,16 +461,22 @@ void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Query(
     }
   }
 
-  // Verify top-ranked images using the found matches.
-  for (auto& image_score : *image_scores) {
-    auto& query_matches = query_to_db_matches[image_score.image_id];
-    auto& db_matches = db_to_query_matches[image_score.image_id];
+  // Verify top-ranked images using the found matches. The images are verified
+  // concurrently, as every image only modifies its own lists of matches.
+  const auto VerifyImage = [&](const int image_idx) {
+    ImageScore& image_score = (*image_scores)[image_idx];
 
     // No matches found.
-    if (query_matches.empty()) {
-      continue;
+    const auto query_matches_it =
+        query_to_db_matches.find(image_score.image_id);
+    if (query_matches_it == query_to_db_matches.end() ||
+        query_matches_it->second.empty()) {
+      return;
     }
 
+    auto& query_matches = query_matches_it->second;
+    auto& db_matches = db_to_query_matches.at(image_score.image_id);
+
     // Enforce 1-to-1 matching: Build Fibonacci heaps for the query and database
     // features, ordered by the minimum number of matches per feature. We'll
     // select these matches one at a time. For convenience, we'll also pre-sort
@@ -464,6 +585,14 @@ void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Query(
     // Finally, run verification for the current image.
     VoteAndVerifyOptions vote_and_verify_options;
     image_score.score += VoteAndVerify(vote_and_verify_options, matches);
+  };
+
+  if (options.num_threads == 1) {
+    for (size_t i = 0; i < image_scores->size(); ++i) {
+      VerifyImage(static_cast<int>(i));
+    }
+  } else {
+    ParallelFor(0, static_cast<int>(image_scores->size()), VerifyImage);
   }
 
   // Re-rank the images using the spatial verification scores.
@@ -485,14 +614,52 @@ void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Query(
 }
 
 template <typename kDescType, int kDescDim, int kEmbeddingDim>
-void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Prepare() {
-  inverted_index_.Finalize();
+void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Query(
+    const QueryOptions& options, const std::vector<GeomType>& geometries,
+    const std::vector<DescType>& descriptors,
+    std::vector<std::vector<ImageScore>>* image_scores) const {
+  CHECK(geometries.empty() || geometries.size() == descriptors.size());
+
+  image_scores->clear();
+  image_scores->resize(descriptors.size());
+
+  if (descriptors.empty()) {
+    return;
+  }
+
+  QueryOptions image_options = options;
+  image_options.num_threads = 1;
+
+  const GeomType empty_geometries;
+  ThreadPool thread_pool(
+      std::min<int>(GetEffectiveNumThreads(options.num_threads),
+                    descriptors.size()));
+  for (size_t i = 0; i < descriptors.size(); ++i) {
+    thread_pool.AddTask([&, i]() {
+      Query(image_options, geometries.empty() ? empty_geometries : geometries[i],
+            descriptors[i], &(*image_scores)[i]);
+    });
+  }
+  thread_pool.Wait();
+}
+
+template <typename kDescType, int kDescDim, int kEmbeddingDim>
+void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Prepare(
+    const int num_threads) {
+  // An index, which is read in prepared state and has not been modified, is
+  // not prepared again, which would read all of its entries.
+  if (prepared_) {
+    return;
+  }
+  inverted_index_.Finalize(num_threads);
   prepared_ = true;
 }
 
 template <typename kDescType, int kDescDim, int kEmbeddingDim>
 void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Build(
     const BuildOptions& options, const DescType& descriptors) {
+  prepared_ = false;
+
   // Quantize the descriptor space into visual words.
   Quantize(options, descriptors);
 
@@ -523,7 +690,11 @@ void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Read(
     const std::string& path) {
   long int file_offset = 0;
 
-  // Read the visual words.
+  // Read the header of the mapped format and the visual words.
+
+  bool mapped_format = false;
+  bool prepared = false;
+  std::vector<int> image_ids;
 
   {
     if (visual_words_.ptr() != nullptr) {
@@ -532,6 +703,23 @@ void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Read(
 
     std::ifstream file(path, std::ios::binary);
     CHECK(file.is_open()) << path;
+
+    char magic[sizeof(kMappedFormatMagic)] = {};
+    file.read(magic, sizeof(magic));
+    mapped_format =
+        file && std::memcmp(magic, kMappedFormatMagic, sizeof(magic)) == 0;
+    if (mapped_format) {
+      prepared = ReadBinaryLittleEndian<uint8_t>(&file) != 0;
+      const uint64_t num_image_ids = ReadBinaryLittleEndian<uint64_t>(&file);
+      image_ids.resize(num_image_ids);
+      for (auto& image_id : image_ids) {
+        image_id = ReadBinaryLittleEndian<int32_t>(&file);
+      }
+    } else {
+      file.clear();
+      file.seekg(0, std::ios::beg);
+    }
+
     const uint64_t rows = ReadBinaryLittleEndian<uint64_t>(&file);
     const uint64_t cols = ReadBinaryLittleEndian<uint64_t>(&file);
     kDescType* visual_words_data = new kDescType[rows * cols];
@@ -558,26 +746,42 @@ void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Read(
 
   // Read the inverted index.
 
-  {
+  if (mapped_format) {
+    // Only the pages of the inverted files, which are accessed, are read.
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+    CHECK(file->Open(path, /* sequential */ false)) << path;
+    inverted_index_.ReadMapped(file, file_offset);
+
+    image_ids_.clear();
+    image_ids_.insert(image_ids.begin(), image_ids.end());
+    prepared_ = prepared;
+  } else {
     std::ifstream file(path, std::ios::binary);
     CHECK(file.is_open()) << path;
     file.seekg(file_offset, std::ios::beg);
     inverted_index_.Read(&file);
-  }
 
-  image_ids_.clear();
-  inverted_index_.GetImageIds(&image_ids_);
+    image_ids_.clear();
+    inverted_index_.GetImageIds(&image_ids_);
+    prepared_ = false;
+  }
 }
 
 template <typename kDescType, int kDescDim, int kEmbeddingDim>
 void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Write(
     const std::string& path) {
-  // Write the visual words.
+  // Write the header and the visual words.
 
   {
     CHECK_NOTNULL(visual_words_.ptr());
     std::ofstream file(path, std::ios::binary);
     CHECK(file.is_open()) << path;
+    file.write(kMappedFormatMagic, sizeof(kMappedFormatMagic));
+    WriteBinaryLittleEndian<uint8_t>(&file, prepared_);
+    WriteBinaryLittleEndian<uint64_t>(&file, image_ids_.size());
+    for (const int image_id : image_ids_) {
+      WriteBinaryLittleEndian<int32_t>(&file, image_id);
+    }
     WriteBinaryLittleEndian<uint64_t>(&file, visual_words_.rows);
     WriteBinaryLittleEndian<uint64_t>(&file, visual_words_.cols);
     for (size_t i = 0; i < visual_words_.rows * visual_words_.cols; ++i) {
@@ -594,12 +798,13 @@ void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Write(
     fclose(fout);
   }
 
-  // Write the inverted index.
+  // Write the inverted index, whose layout depends on the write position.
 
   {
-    std::ofstream file(path, std::ios::binary | std::ios::app);
+    std::ofstream file(path, std::ios::binary | std::ios::in | std::ios::out);
     CHECK(file.is_open()) << path;
-    inverted_index_.Write(&file);
+    file.seekp(0, std::ios::end);
+    inverted_index_.WriteMapped(&file);
   }
 }
 
@@ -611,21 +816,15 @@ void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Quantize(
   CHECK_GE(options.num_visual_words, options.branching);
   CHECK_GE(descriptors.rows(), options.num_visual_words);
 
-  const flann::Matrix<kDescType> descriptor_matrix(
-      const_cast<kDescType*>(descriptors.data()), descriptors.rows(),
-      descriptors.cols());
-
-  std::vector<typename flann::L2<kDescType>::ResultType> centers_data(
-      options.num_visual_words * descriptors.cols());
-  flann::Matrix<typename flann::L2<kDescType>::ResultType> centers(
-      centers_data.data(), options.num_visual_words, descriptors.cols());
-
-  flann::KMeansIndexParams index_params;
-  index_params["branching"] = options.branching;
-  index_params["iterations"] = options.num_iterations;
-  index_params["centers_init"] = flann::FLANN_CENTERS_KMEANSPP;
-  const int num_centers = flann::hierarchicalClustering<flann::L2<kDescType>>(
-      descriptor_matrix, centers, index_params);
+  HierarchicalKMeansOptions kmeans_options;
+  kmeans_options.num_clusters = options.num_visual_words;
+  kmeans_options.branching = options.branching;
+  kmeans_options.num_iterations = options.num_iterations;
+  kmeans_options.num_mini_batch_iterations = options.num_mini_batch_iterations;
+  kmeans_options.num_threads = options.num_threads;
+  const HierarchicalKMeansCenters centers =
+      HierarchicalKMeans(kmeans_options, descriptors);
+  const int num_centers = static_cast<int>(centers.rows());
 
   CHECK_LE(num_centers, options.num_visual_words);
 
@@ -633,9 +832,9 @@ void VisualIndex<kDescType, kDescDim, kEmbeddingDim>::Quantize(
   kDescType* visual_words_data = new kDescType[visual_word_data_size];
   for (size_t i = 0; i < visual_word_data_size; ++i) {
     if (std::is_integral<kDescType>::value) {
-      visual_words_data[i] = std::round(centers_data[i]);
+      visual_words_data[i] = std::round(centers.data()[i]);
     } else {
-      visual_words_data[i] = centers_data[i];
+      visual_words_data[i] = centers.data()[i];
     }
   }
 
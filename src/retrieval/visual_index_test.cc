@@ -17,6 +17,8 @@
 #define TEST_NAME "retrieval/visual_index"
 #include "util/testing.h"
 
+#include <boost/filesystem.hpp>
+
 #include "retrieval/visual_index.h"
 
 using namespace colmap::retrieval;
@@ -86,6 +88,205 @@ void TestVocabTreeType() {
   }
 }
 
+BOOST_AUTO_TEST_CASE(TestBatchAddAndQuery) {
+  typedef VisualIndex<uint8_t, 128, 64> VisualIndexType;
+
+  typename VisualIndexType::DescType descriptors =
+      VisualIndexType::DescType::Random(1000, 128);
+  VisualIndexType visual_index1;
+  typename VisualIndexType::BuildOptions build_options;
+  build_options.num_visual_words = 100;
+  build_options.branching = 10;
+  visual_index1.Build(build_options, descriptors);
+
+  const std::string index_path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("visual_index_test_%%%%%%%%.bin"))
+          .string();
+  visual_index1.Write(index_path);
+  VisualIndexType visual_index2;
+  visual_index2.Read(index_path);
+  boost::filesystem::remove(index_path);
+
+  std::vector<int> image_ids;
+  std::vector<typename VisualIndexType::GeomType> keypoints;
+  std::vector<typename VisualIndexType::DescType> image_descriptors;
+  for (int image_id = 1; image_id <= 10; ++image_id) {
+    image_ids.push_back(image_id);
+    keypoints.emplace_back(50 + image_id);
+    image_descriptors.push_back(
+        VisualIndexType::DescType::Random(50 + image_id, 128));
+  }
+
+  typename VisualIndexType::IndexOptions index_options;
+  index_options.num_neighbors = 2;
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    visual_index1.Add(index_options, image_ids[i], keypoints[i],
+                      image_descriptors[i]);
+  }
+  visual_index1.Prepare(1);
+
+  index_options.num_threads = 4;
+  visual_index2.Add(index_options, image_ids, keypoints, image_descriptors);
+  visual_index2.Prepare(4);
+  for (const int image_id : image_ids) {
+    BOOST_CHECK(visual_index2.ImageIndexed(image_id));
+  }
+
+  typename VisualIndexType::QueryOptions query_options;
+  query_options.num_threads = 4;
+  std::vector<std::vector<ImageScore>> batch_image_scores;
+  visual_index2.Query(query_options, {}, image_descriptors,
+                      &batch_image_scores);
+  BOOST_CHECK_EQUAL(batch_image_scores.size(), image_ids.size());
+
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    std::vector<ImageScore> image_scores;
+    visual_index1.Query(query_options, image_descriptors[i], &image_scores);
+    BOOST_CHECK_EQUAL(image_scores[0].image_id, image_ids[i]);
+    BOOST_CHECK_EQUAL(batch_image_scores[i].size(), image_scores.size());
+    for (size_t j = 0; j < image_scores.size(); ++j) {
+      BOOST_CHECK_EQUAL(batch_image_scores[i][j].image_id,
+                        image_scores[j].image_id);
+      BOOST_CHECK_CLOSE(batch_image_scores[i][j].score, image_scores[j].score,
+                        1e-4);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestQueryWithVerification) {
+  typedef VisualIndex<uint8_t, 128, 64> VisualIndexType;
+
+  typename VisualIndexType::DescType descriptors =
+      VisualIndexType::DescType::Random(1000, 128);
+  VisualIndexType visual_index;
+  typename VisualIndexType::BuildOptions build_options;
+  build_options.num_visual_words = 100;
+  build_options.branching = 10;
+  visual_index.Build(build_options, descriptors);
+
+  std::vector<typename VisualIndexType::GeomType> keypoints;
+  std::vector<typename VisualIndexType::DescType> image_descriptors;
+  for (int image_id = 1; image_id <= 8; ++image_id) {
+    keypoints.emplace_back();
+    for (int i = 0; i < 100; ++i) {
+      keypoints.back().emplace_back(i % 10 * 10.0f, i / 10 * 10.0f);
+    }
+    image_descriptors.push_back(VisualIndexType::DescType::Random(100, 128));
+    visual_index.Add(typename VisualIndexType::IndexOptions(), image_id,
+                     keypoints.back(), image_descriptors.back());
+  }
+  visual_index.Prepare();
+
+  // The images are verified concurrently with the same scores.
+  typename VisualIndexType::QueryOptions query_options;
+  query_options.num_images_after_verification = 8;
+  query_options.num_threads = 1;
+  std::vector<ImageScore> image_scores1;
+  visual_index.Query(query_options, keypoints[2], image_descriptors[2],
+                     &image_scores1);
+  query_options.num_threads = 4;
+  std::vector<ImageScore> image_scores2;
+  visual_index.Query(query_options, keypoints[2], image_descriptors[2],
+                     &image_scores2);
+
+  BOOST_REQUIRE_EQUAL(image_scores1.size(), image_scores2.size());
+  BOOST_REQUIRE(!image_scores1.empty());
+  BOOST_CHECK_EQUAL(image_scores1[0].image_id, 3);
+  for (size_t i = 0; i < image_scores1.size(); ++i) {
+    BOOST_CHECK_EQUAL(image_scores1[i].image_id, image_scores2[i].image_id);
+    BOOST_CHECK_EQUAL(image_scores1[i].score, image_scores2[i].score);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestReadWriteMapped) {
+  typedef VisualIndex<uint8_t, 128, 64> VisualIndexType;
+
+  typename VisualIndexType::DescType descriptors =
+      VisualIndexType::DescType::Random(1000, 128);
+  VisualIndexType visual_index;
+  typename VisualIndexType::BuildOptions build_options;
+  build_options.num_visual_words = 20;
+  build_options.branching = 10;
+  visual_index.Build(build_options, descriptors);
+
+  // Enough images for the inverted files to span multiple pages, while every
+  // image only contains some of the visual words.
+  const int kNumImages = 300;
+  typename VisualIndexType::IndexOptions index_options;
+  std::vector<typename VisualIndexType::DescType> image_descriptors;
+  for (int image_id = 1; image_id <= kNumImages; ++image_id) {
+    image_descriptors.push_back(VisualIndexType::DescType::Random(10, 128));
+    visual_index.Add(index_options, image_id,
+                     typename VisualIndexType::GeomType(10),
+                     image_descriptors.back());
+  }
+  visual_index.Add(index_options, kNumImages + 1,
+                   typename VisualIndexType::GeomType(),
+                   typename VisualIndexType::DescType());
+  visual_index.Prepare();
+
+  const std::string index_path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("visual_index_test_%%%%%%%%.bin"))
+          .string();
+  visual_index.Write(index_path);
+
+  VisualIndexType read_visual_index;
+  read_visual_index.Read(index_path);
+  BOOST_CHECK_EQUAL(read_visual_index.NumVisualWords(),
+                    visual_index.NumVisualWords());
+  for (int image_id = 1; image_id <= kNumImages + 1; ++image_id) {
+    BOOST_CHECK(read_visual_index.ImageIndexed(image_id));
+  }
+
+  // The read index is prepared and can be written again.
+  const std::string index_path2 = index_path + ".2";
+  read_visual_index.Write(index_path2);
+  BOOST_CHECK_EQUAL(boost::filesystem::file_size(index_path),
+                    boost::filesystem::file_size(index_path2));
+
+  typename VisualIndexType::QueryOptions query_options;
+  query_options.max_num_images = 10;
+  for (size_t i = 0; i < image_descriptors.size(); i += 10) {
+    std::vector<ImageScore> image_scores;
+    visual_index.Query(query_options, image_descriptors[i], &image_scores);
+    std::vector<ImageScore> read_image_scores;
+    read_visual_index.Query(query_options, image_descriptors[i],
+                            &read_image_scores);
+    BOOST_CHECK_GT(read_image_scores[0].score, 0);
+    BOOST_CHECK_EQUAL(read_image_scores.size(), image_scores.size());
+    for (size_t j = 0; j < image_scores.size(); ++j) {
+      BOOST_CHECK_EQUAL(read_image_scores[j].image_id,
+                        image_scores[j].image_id);
+      BOOST_CHECK_EQUAL(read_image_scores[j].score, image_scores[j].score);
+    }
+  }
+
+  // Adding an image to the mapped index copies the modified inverted files.
+  read_visual_index.Add(index_options, kNumImages + 2,
+                        typename VisualIndexType::GeomType(10),
+                        image_descriptors[0]);
+  read_visual_index.Prepare();
+  query_options.max_num_images = -1;
+  std::vector<ImageScore> image_scores;
+  read_visual_index.Query(query_options, image_descriptors[0], &image_scores);
+  float image_score1 = 0;
+  float image_score2 = 0;
+  for (const auto& image_score : image_scores) {
+    if (image_score.image_id == 1) {
+      image_score1 = image_score.score;
+    } else if (image_score.image_id == kNumImages + 2) {
+      image_score2 = image_score.score;
+    }
+  }
+  BOOST_CHECK_GT(image_score1, 0);
+  BOOST_CHECK_CLOSE(image_score1, image_score2, 1e-4);
+
+  boost::filesystem::remove(index_path);
+  boost::filesystem::remove(index_path2);
+}
+
 BOOST_AUTO_TEST_CASE(TestVocabTree) {
   TestVocabTreeType<uint8_t, 128, 64>();
   TestVocabTreeType<uint8_t, 64, 64>();
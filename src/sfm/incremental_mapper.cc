@@ -17,6 +17,10 @@
 #include "sfm/incremental_mapper.h"
 
 #include <fstream>
+#include <map>
+#include <numeric>
+#include <memory>
+#include <sstream>
 #include <cmath>
 #include <queue>
 #include <stack>
@@ -24,38 +28,41 @@
 #include <time.h>
 #include <unordered_map>
 #include <algorithm>
+#include <atomic>
 #include <unordered_set>
 #include <ceres/ceres.h>
 #include <ceres/rotation.h>
 #include <ceres/loss_function.h>
 
 
+#include "base/camera_models.h"
+#include "base/cost_functions.h"
+#include "base/pose.h"
 #include "base/projection.h"
+#include "base/similarity_transform.h"
 #include "base/triangulation.h"
 #include "estimators/pose.h"
+#include "optim/random_sampler.h"
 #include "util/bitmap.h"
+#include "util/endian.h"
+#include "util/kmeans.h"
+#include "util/logging.h"
+#include "util/math.h"
+#include "util/matrix.h"
+#include "util/metrics.h"
 #include "util/misc.h"
+#include "util/ply.h"
+#include "util/point_index.h"
+#include "util/random.h"
+#include "util/sorted_ids.h"
+#include "util/symmetric_eigen.h"
+#include "util/threading.h"
+#include "util/trace.h"
 using namespace std;
 
 namespace colmap {
 namespace {
 
-void SortAndAppendNextImages(std::vector<std::pair<image_t, float>> image_ranks,
-                             std::vector<image_t>* sorted_images_ids) {
-  std::sort(image_ranks.begin(), image_ranks.end(),
-            [](const std::pair<image_t, float>& image1,
-               const std::pair<image_t, float>& image2) {
-              return image1.second > image2.second;
-            });
-
-  sorted_images_ids->reserve(sorted_images_ids->size() + image_ranks.size());
-  for (const auto& image : image_ranks) {
-    sorted_images_ids->push_back(image.first);
-  }
-
-  image_ranks.clear();
-}
-
 float RankNextImageMaxVisiblePointsNum(const Image& image) {
   return static_cast<float>(image.NumVisiblePoints3D());
 }
@@ -78,6 +85,7 @@ bool IncrementalMapper::Options::Check() const {
   CHECK_OPTION_LE(init_max_forward_motion, 1.0);
   CHECK_OPTION_GE(init_min_tri_angle, 0.0);
   CHECK_OPTION_GE(init_max_reg_trials, 1);
+  CHECK_OPTION_GE(init_num_parallel_pairs, 1);
   CHECK_OPTION_GT(abs_pose_max_error, 0.0);
   CHECK_OPTION_GT(abs_pose_min_num_inliers, 0);
   CHECK_OPTION_GE(abs_pose_min_inlier_ratio, 0.0);
@@ -88,29 +96,41 @@ bool IncrementalMapper::Options::Check() const {
   CHECK_OPTION_GE(max_extra_param, 0.0);
   CHECK_OPTION_GE(filter_max_reproj_error, 0.0);
   CHECK_OPTION_GE(filter_min_tri_angle, 0.0);
+  CHECK_OPTION_GE(filter_min_change, 0.0);
   CHECK_OPTION_GE(max_reg_trials, 1);
+  CHECK_OPTION_GT(out_of_core_cache_size, 0);
+  CHECK_OPTION_NE(ransac_num_threads, 0);
+  CHECK_OPTION_GE(ransac_num_threads, -1);
+  CHECK_OPTION_GT(seq_pose_prediction_num_trials, 0);
   return true;
 }
 
-IncrementalMapper::IncrementalMapper(/*const*/ DatabaseCache* database_cache)
+IncrementalMapper::IncrementalMapper(const DatabaseCache* database_cache)
     : database_cache_(database_cache),
       reconstruction_(nullptr),
       triangulator_(nullptr),
       num_total_reg_images_(0),
       num_shared_reg_images_(0),
-      prev_init_image_pair_id_(kInvalidImagePairId) {}
+      prev_init_image_pair_id_(kInvalidImagePairId),
+      init_pair_cache_(nullptr),
+      next_image_selection_method_(
+          Options::ImageSelectionMethod::MIN_UNCERTAINTY) {}
+
+void IncrementalMapper::SetInitialPairCache(InitialPairCache* init_pair_cache) {
+  init_pair_cache_ = init_pair_cache;
+}
 
 void IncrementalMapper::BeginReconstruction(Reconstruction* reconstruction) {
   CHECK(reconstruction_ == nullptr);
   reconstruction_ = reconstruction;
   reconstruction_->Load(*database_cache_);
-  //HERE
-  reconstruction_->SetUp(&database_cache_->SceneGraph());
-  //reconstruction_->SetUp(&database_cache_->SG());
-  triangulator_.reset(new IncrementalTriangulator(
-      //&database_cache_->SceneGraph(), reconstruction));
-      &database_cache_->SG(), reconstruction));
-  sg = &(database_cache_->SG());
+  scene_graph_.reset(new SceneGraph(&database_cache_->SceneGraph()));
+  reconstruction_->SetUp(scene_graph_.get());
+  triangulator_.reset(new IncrementalTriangulator(scene_graph_.get(),
+                                                  reconstruction));
+  global_bundle_adjuster_.reset();
+  local_bundle_adjusters_.clear();
+  resident_images_.reset();
 
   num_shared_reg_images_ = 0;
   for (const image_t image_id : reconstruction_->RegImageIds()) {
@@ -123,6 +143,11 @@ void IncrementalMapper::BeginReconstruction(Reconstruction* reconstruction) {
   refined_cameras_.clear();
   filtered_images_.clear();
   num_reg_trials_.clear();
+  correspondence_caches_.clear();
+  next_image_ranks_.clear();
+  next_image_ranking_.clear();
+  image_ids_by_name_.clear();
+  image_name_idxs_.clear();
 }
 
 void IncrementalMapper::EndReconstruction(const bool discard) {
@@ -134,9 +159,18 @@ void IncrementalMapper::EndReconstruction(const bool discard) {
     }
   }
 
+  // Release the points of the paged-in images, while the reconstruction is
+  // still set up.
+  resident_images_.reset();
+
   reconstruction_->TearDown();
   reconstruction_ = nullptr;
   triangulator_.reset();
+  scene_graph_.reset();
+  global_bundle_adjuster_.reset();
+  local_bundle_adjusters_.clear();
+  rigid_motions_.clear();
+  correspondence_caches_.clear();
 }
 
 //initial image pair
@@ -223,35 +257,58 @@ bool IncrementalMapper::FindInitFirstSet(const Options& options, image_t* image_
 		image_ids1 = FindFirstInitialImage(options);
   	}
 
+	//the candidate pairs are collected in the serial order and evaluated in
+	//batches of init_num_parallel_pairs, the first passing one wins
+	const size_t num_parallel_pairs = static_cast<size_t>(options.init_num_parallel_pairs);
+	std::vector<std::pair<image_t, image_t>> candidates;
+	std::unordered_set<image_pair_t> candidate_pair_ids;
+	const auto EvaluateCandidates = [&]()
+	{
+		const size_t winner = EstimateInitialTwoViewGeometries(options, candidates);
+		if (winner < candidates.size())
+		{
+			*image_id1 = candidates[winner].first;
+			*image_id2 = candidates[winner].second;
+			return true;
+		}
+		candidates.clear();
+		candidate_pair_ids.clear();
+		return false;
+	};
+
 	// Try to find good initial pair.
 	for (size_t i1 = 0; i1 < image_ids1.size(); ++i1)
 	{
-		std::cout << i1 << " " << image_ids1.size() << "\n";
+		VLOG(4) << i1 << " " << image_ids1.size();
 		if(!first_set.count(image_ids1[i1])) continue;
-		std::cout << "K\n";
 		//std::cout << i1 << " " << image_ids1.size() << "\n";
-    	*image_id1 = image_ids1[i1];
+		const image_t candidate_id1 = image_ids1[i1];
 
-		const std::vector<image_t> image_ids2 = FindSecondInitialImage(options, *image_id1);
+		const std::vector<image_t> image_ids2 = FindSecondInitialImage(options, candidate_id1);
 
 		for (size_t i2 = 0; i2 < image_ids2.size(); ++i2)
 		{
-			std::cout << i1 << " " << image_ids1.size() << " " << i2 << " " << image_ids2.size() << "\n";
+			VLOG(4) << i1 << " " << image_ids1.size() << " " << i2 << " " << image_ids2.size();
 			if(!first_set.count(image_ids2[i2])) continue;
-			*image_id2 = image_ids2[i2];
-			const image_pair_t pair_id = Database::ImagePairToPairId(*image_id1, *image_id2);
+			const image_pair_t pair_id = Database::ImagePairToPairId(candidate_id1, image_ids2[i2]);
 			// Try every pair only once.
-			if (init_image_pairs_.count(pair_id) > 0)
+			if (init_image_pairs_.count(pair_id) > 0 || candidate_pair_ids.count(pair_id) > 0)
 				continue;
-			init_image_pairs_.insert(pair_id);
+			candidate_pair_ids.insert(pair_id);
+			candidates.emplace_back(candidate_id1, image_ids2[i2]);
 
-			if (EstimateInitialTwoViewGeometry(options, *image_id1, *image_id2))
+			if (candidates.size() >= num_parallel_pairs && EvaluateCandidates())
 			{
-        		return true;
-      		}
+				return true;
+			}
 		}
 	}
 
+	if (!candidates.empty() && EvaluateCandidates())
+	{
+		return true;
+	}
+
 	/*for (size_t i1 = 0; i1 < image_ids1.size(); ++i1)
 	{
 		//if(!first_set.count(image_ids1[i1])) continue;
@@ -286,187 +343,50 @@ std::vector<image_t> IncrementalMapper::FindNextImages(const Options& options) {
   CHECK_NOTNULL(reconstruction_);
   CHECK(options.Check());
 
-  std::function<float(const Image&)> rank_image_func;
-  switch (options.image_selection_method) {
-    case Options::ImageSelectionMethod::MAX_VISIBLE_POINTS_NUM:
-      rank_image_func = RankNextImageMaxVisiblePointsNum;
-      break;
-    case Options::ImageSelectionMethod::MAX_VISIBLE_POINTS_RATIO:
-      rank_image_func = RankNextImageMaxVisiblePointsRatio;
-      break;
-    case Options::ImageSelectionMethod::MIN_UNCERTAINTY:
-      rank_image_func = RankNextImageMinUncertainty;
-      break;
-  }
-
-  std::vector<std::pair<image_t, float>> image_ranks;
-  std::vector<std::pair<image_t, float>> other_image_ranks;
-
-  // Append images that have not failed to register before.
-  for (const auto& image : reconstruction_->Images()) {
-    // Skip images that are already registered.
-    if (image.second.IsRegistered()) {
-      continue;
-    }
-
+  return RankNextImages(options, [&options](const Image& image) {
     // Only consider images with a sufficient number of visible points.
-    if (image.second.NumVisiblePoints3D() <
-        static_cast<size_t>(options.abs_pose_min_num_inliers)) {
-      continue;
-    }
-
-    // Only try registration for a certain maximum number of times.
-    const size_t num_reg_trials = num_reg_trials_[image.first];
-    if (num_reg_trials >= static_cast<size_t>(options.max_reg_trials)) {
-      continue;
-    }
-
-    // If image has been filtered or failed to register, place it in the
-    // second bucket and prefer images that have not been tried before.
-    const float rank = rank_image_func(image.second);
-    if (filtered_images_.count(image.first) == 0 && num_reg_trials == 0) {
-      image_ranks.emplace_back(image.first, rank);
-    } else {
-      other_image_ranks.emplace_back(image.first, rank);
-    }
-  }
-
-  std::vector<image_t> ranked_images_ids;
-  SortAndAppendNextImages(image_ranks, &ranked_images_ids);
-  SortAndAppendNextImages(other_image_ranks, &ranked_images_ids);
-
-  return ranked_images_ids;
+    return image.NumVisiblePoints3D() >=
+           static_cast<size_t>(options.abs_pose_min_num_inliers);
+  });
 }
 
-std::vector<image_t> IncrementalMapper::FindNextImagesSecondSet(const Options& options, std::unordered_set<image_t> first_set)
+std::vector<image_t> IncrementalMapper::FindNextImagesSecondSet(const Options& options, const std::unordered_set<image_t>& first_set)
 {
   CHECK_NOTNULL(reconstruction_);
   CHECK(options.Check());
 
-  std::function<float(const Image&)> rank_image_func;
-  switch (options.image_selection_method) {
-    case Options::ImageSelectionMethod::MAX_VISIBLE_POINTS_NUM:
-      rank_image_func = RankNextImageMaxVisiblePointsNum;
-      break;
-    case Options::ImageSelectionMethod::MAX_VISIBLE_POINTS_RATIO:
-      rank_image_func = RankNextImageMaxVisiblePointsRatio;
-      break;
-    case Options::ImageSelectionMethod::MIN_UNCERTAINTY:
-      rank_image_func = RankNextImageMinUncertainty;
-      break;
-  }
-
-  std::vector<std::pair<image_t, float>> image_ranks;
-  std::vector<std::pair<image_t, float>> other_image_ranks;
-
-  // Append images that have not failed to register before.
-  for (const auto& image : reconstruction_->Images()) {
-    // Skip images that are already registered.
-    if (image.second.IsRegistered()) {
-      continue;
-    }
-    if(image.second.IsSeqRegistered()) continue;
-
-	//get name of the image and compare it with legal names
-	
-    if(first_set.count(image.first)) continue;
-
-    std::cout << "Seqreg " << image.first << "\n";
-    std::cout << image.second.NumVisiblePoints3D() << " " << options.abs_pose_min_num_inliers << "\n"; 
-
-    // Only consider images with a sufficient number of visible points.
-    /*if (image.second.NumVisiblePoints3D() <
-        static_cast<size_t>(options.abs_pose_min_num_inliers)) {
-      continue;
-    }*/
-
-    // Only try registration for a certain maximum number of times.
-    const size_t num_reg_trials = num_reg_trials_[image.first];
-    if (num_reg_trials >= static_cast<size_t>(options.max_reg_trials)) {
-      continue;
-    }
+  return RankNextImages(options, [&options, &first_set](const Image& image) {
+    if(image.IsSeqRegistered()) return false;
 
-    // If image has been filtered or failed to register, place it in the
-    // second bucket and prefer images that have not been tried before.
-    const float rank = rank_image_func(image.second);
-    if (filtered_images_.count(image.first) == 0 && num_reg_trials == 0) {
-      image_ranks.emplace_back(image.first, rank);
-    } else {
-      other_image_ranks.emplace_back(image.first, rank);
-    }
-  }
+    //get name of the image and compare it with legal names
+    if(first_set.count(image.ImageId())) return false;
 
-  std::vector<image_t> ranked_images_ids;
-  SortAndAppendNextImages(image_ranks, &ranked_images_ids);
-  SortAndAppendNextImages(other_image_ranks, &ranked_images_ids);
+    VLOG(4) << "Seqreg " << image.ImageId();
+    VLOG(4) << image.NumVisiblePoints3D() << " " << options.abs_pose_min_num_inliers;
 
-  return ranked_images_ids;
+    return true;
+  });
 }
 
-std::vector<image_t> IncrementalMapper::FindNextImagesFirstSet(const Options& options, std::unordered_set<image_t> first_set)
+std::vector<image_t> IncrementalMapper::FindNextImagesFirstSet(const Options& options, const std::unordered_set<image_t>& first_set)
 {
   CHECK_NOTNULL(reconstruction_);
   CHECK(options.Check());
 
-  std::function<float(const Image&)> rank_image_func;
-  switch (options.image_selection_method) {
-    case Options::ImageSelectionMethod::MAX_VISIBLE_POINTS_NUM:
-      rank_image_func = RankNextImageMaxVisiblePointsNum;
-      break;
-    case Options::ImageSelectionMethod::MAX_VISIBLE_POINTS_RATIO:
-      rank_image_func = RankNextImageMaxVisiblePointsRatio;
-      break;
-    case Options::ImageSelectionMethod::MIN_UNCERTAINTY:
-      rank_image_func = RankNextImageMinUncertainty;
-      break;
-  }
-
-  std::vector<std::pair<image_t, float>> image_ranks;
-  std::vector<std::pair<image_t, float>> other_image_ranks;
-
-  // Append images that have not failed to register before.
-  for (const auto& image : reconstruction_->Images()) {
-    // Skip images that are already registered.
-    if (image.second.IsRegistered()) {
-      continue;
-    }
-
-	//get name of the image and compare it with legal names
-	
-    if(!first_set.count(image.first)) continue;
+  return RankNextImages(options, [&options, &first_set](const Image& image) {
+    //get name of the image and compare it with legal names
+    if(!first_set.count(image.ImageId())) return false;
 
     // Only consider images with a sufficient number of visible points.
-    if (image.second.NumVisiblePoints3D() <
-        static_cast<size_t>(options.abs_pose_min_num_inliers)) {
-      continue;
-    }
-
-    // Only try registration for a certain maximum number of times.
-    const size_t num_reg_trials = num_reg_trials_[image.first];
-    if (num_reg_trials >= static_cast<size_t>(options.max_reg_trials)) {
-      continue;
-    }
-
-    // If image has been filtered or failed to register, place it in the
-    // second bucket and prefer images that have not been tried before.
-    const float rank = rank_image_func(image.second);
-    if (filtered_images_.count(image.first) == 0 && num_reg_trials == 0) {
-      image_ranks.emplace_back(image.first, rank);
-    } else {
-      other_image_ranks.emplace_back(image.first, rank);
-    }
-  }
-
-  std::vector<image_t> ranked_images_ids;
-  SortAndAppendNextImages(image_ranks, &ranked_images_ids);
-  SortAndAppendNextImages(other_image_ranks, &ranked_images_ids);
-
-  return ranked_images_ids;
+    return image.NumVisiblePoints3D() >=
+           static_cast<size_t>(options.abs_pose_min_num_inliers);
+  });
 }
 
 bool IncrementalMapper::RegisterInitialImagePair(const Options& options,
                                                  const image_t image_id1,
                                                  const image_t image_id2) {
+  TRACE_SCOPE("IncrementalMapper::RegisterInitialImagePair");
   CHECK_NOTNULL(reconstruction_);
   CHECK_EQ(reconstruction_->NumRegImages(), 0);
 
@@ -477,6 +397,9 @@ bool IncrementalMapper::RegisterInitialImagePair(const Options& options,
   num_reg_trials_[image_id1] += 1;
   num_reg_trials_[image_id2] += 1;
 
+  PageInImage(options, image_id1);
+  PageInImage(options, image_id2);
+
   const image_pair_t pair_id =
       Database::ImagePairToPairId(image_id1, image_id2);
   init_image_pairs_.insert(pair_id);
@@ -514,12 +437,23 @@ bool IncrementalMapper::RegisterInitialImagePair(const Options& options,
   RegisterImageEvent(image_id1);
   RegisterImageEvent(image_id2);
 
-  const SceneGraph& scene_graph = database_cache_->SceneGraph();
+  const SceneGraph& scene_graph = *scene_graph_;
   const std::vector<std::pair<point2D_t, point2D_t>>& corrs =
       scene_graph.FindCorrespondencesBetweenImages(image_id1, image_id2);
 
   const double min_tri_angle_rad = DegToRad(options.init_min_tri_angle);
 
+  // Normalize the corresponding image points of both images in one batch per
+  // camera.
+  std::vector<Eigen::Vector2d> points1_N(corrs.size());
+  std::vector<Eigen::Vector2d> points2_N(corrs.size());
+  for (size_t i = 0; i < corrs.size(); ++i) {
+    points1_N[i] = image1.Point2D(corrs[i].first).XY();
+    points2_N[i] = image2.Point2D(corrs[i].second).XY();
+  }
+  camera1.ImageToWorld(points1_N, &points1_N);
+  camera2.ImageToWorld(points2_N, &points2_N);
+
   // Add 3D point tracks.
   Track track;
   track.Reserve(2);
@@ -530,12 +464,8 @@ bool IncrementalMapper::RegisterInitialImagePair(const Options& options,
   for (size_t i = 0; i < corrs.size(); ++i) {
     const point2D_t point2D_idx1 = corrs[i].first;
     const point2D_t point2D_idx2 = corrs[i].second;
-    const Eigen::Vector2d point1_N =
-        camera1.ImageToWorld(image1.Point2D(point2D_idx1).XY());
-    const Eigen::Vector2d point2_N =
-        camera2.ImageToWorld(image2.Point2D(point2D_idx2).XY());
-    const Eigen::Vector3d& xyz =
-        TriangulatePoint(proj_matrix1, proj_matrix2, point1_N, point2_N);
+    const Eigen::Vector3d& xyz = TriangulatePoint(
+        proj_matrix1, proj_matrix2, points1_N[i], points2_N[i]);
     const double tri_angle =
         CalculateTriangulationAngle(proj_center1, proj_center2, xyz);
     if (tri_angle >= min_tri_angle_rad &&
@@ -552,11 +482,14 @@ bool IncrementalMapper::RegisterInitialImagePair(const Options& options,
 
 bool IncrementalMapper::RegisterNextImage(const Options& options,
                                           const image_t image_id) {
+  TRACE_SCOPE("IncrementalMapper::RegisterNextImage");
   CHECK_NOTNULL(reconstruction_);
   CHECK_GE(reconstruction_->NumRegImages(), 2);
 
   CHECK(options.Check());
 
+  PageInImage(options, image_id);
+
   Image& image = reconstruction_->Image(image_id);
   Camera& camera = reconstruction_->Camera(image.CameraId());
 
@@ -574,57 +507,15 @@ bool IncrementalMapper::RegisterNextImage(const Options& options,
   // Search for 2D-3D correspondences
   //////////////////////////////////////////////////////////////////////////////
 
-  const int kCorrTransitivity = 1;
-
-  std::vector<std::pair<point2D_t, point3D_t>> tri_corrs;
-  std::vector<Eigen::Vector2d> tri_points2D;
-  std::vector<Eigen::Vector3d> tri_points3D;
-
-  for (point2D_t point2D_idx = 0; point2D_idx < image.NumPoints2D();
-       ++point2D_idx) {
-    const Point2D& point2D = image.Point2D(point2D_idx);
-    const SceneGraph& scene_graph = database_cache_->SceneGraph();
-    const std::vector<SceneGraph::Correspondence> corrs =
-        scene_graph.FindTransitiveCorrespondences(image_id, point2D_idx,
-                                                  kCorrTransitivity);
-
-    std::unordered_set<point3D_t> point3D_ids;
-
-    for (const auto corr : corrs) {
-      const Image& corr_image = reconstruction_->Image(corr.image_id);
-      if (!corr_image.IsRegistered()) {
-        continue;
-      }
-
-      const Point2D& corr_point2D = corr_image.Point2D(corr.point2D_idx);
-      if (!corr_point2D.HasPoint3D()) {
-        continue;
-      }
-
-      // Avoid duplicate correspondences.
-      if (point3D_ids.count(corr_point2D.Point3DId()) > 0) {
-        continue;
-      }
-
-      const Camera& corr_camera =
-          reconstruction_->Camera(corr_image.CameraId());
-
-      // Avoid correspondences to images with bogus camera parameters.
-      if (corr_camera.HasBogusParams(options.min_focal_length_ratio,
-                                     options.max_focal_length_ratio,
-                                     options.max_extra_param)) {
-        continue;
-      }
-
-      const Point3D& point3D =
-          reconstruction_->Point3D(corr_point2D.Point3DId());
-
-      tri_corrs.emplace_back(point2D_idx, corr_point2D.Point3DId());
-      point3D_ids.insert(corr_point2D.Point3DId());
-      tri_points2D.push_back(point2D.XY());
-      tri_points3D.push_back(point3D.XYZ());
-    }
-  }
+  // The temporaries of the registration are recycled by the thread.
+  ScratchVector<std::pair<point2D_t, point3D_t>> tri_corrs_buffer;
+  ScratchVector<Eigen::Vector2d> tri_points2D_buffer;
+  ScratchVector<Eigen::Vector3d> tri_points3D_buffer;
+  std::vector<std::pair<point2D_t, point3D_t>>& tri_corrs = *tri_corrs_buffer;
+  std::vector<Eigen::Vector2d>& tri_points2D = *tri_points2D_buffer;
+  std::vector<Eigen::Vector3d>& tri_points3D = *tri_points3D_buffer;
+  FindCorrespondences2D3D(options, image_id, &tri_corrs, &tri_points2D,
+                          &tri_points3D);
 
   // The size of `next_image.num_tri_obs` and `tri_corrs_point2D_idxs.size()`
   // can only differ, when there are images with bogus camera parameters, and
@@ -645,12 +536,17 @@ bool IncrementalMapper::RegisterNextImage(const Options& options,
 
   AbsolutePoseEstimationOptions abs_pose_options;
   abs_pose_options.num_threads = options.num_threads;
+  abs_pose_options.thread_pool = WorkerPool(options.num_threads);
   abs_pose_options.num_focal_length_samples = 30;
   abs_pose_options.min_focal_length_ratio = options.min_focal_length_ratio;
   abs_pose_options.max_focal_length_ratio = options.max_focal_length_ratio;
   abs_pose_options.ransac_options.max_error = options.abs_pose_max_error;
   abs_pose_options.ransac_options.min_inlier_ratio =
       options.abs_pose_min_inlier_ratio;
+  abs_pose_options.ransac_options.use_sprt = options.abs_pose_use_sprt;
+  abs_pose_options.ransac_options.num_threads = options.ransac_num_threads;
+  abs_pose_options.joint_focal_length_estimation =
+      options.abs_pose_joint_focal_length;
   // Use high confidence to avoid preemptive termination of P3P RANSAC
   // - too early termination may lead to bad registration.
   abs_pose_options.ransac_options.min_num_trials = 30;
@@ -690,7 +586,8 @@ bool IncrementalMapper::RegisterNextImage(const Options& options,
   }
 
   size_t num_inliers;
-  std::vector<char> inlier_mask;
+  ScratchVector<char> inlier_mask_buffer;
+  std::vector<char>& inlier_mask = *inlier_mask_buffer;
 
   if (!EstimateAbsolutePose(abs_pose_options, tri_points2D, tri_points3D,
                             &image.Qvec(), &image.Tvec(), &camera, &num_inliers,
@@ -742,103 +639,387 @@ bool IncrementalMapper::RegisterNextImage(const Options& options,
 
 int IncrementalMapper::SeqRegisterImage(const Options& options, const image_t image_id)
 {
-	CHECK_NOTNULL(reconstruction_);
-	CHECK_GE(reconstruction_->NumRegImages(), 2);
-
-	std::cout << "SQ1\n";
+	TRACE_SCOPE("IncrementalMapper::SeqRegisterImage");
+	SeqRegistration registration;
+	if (!PrepareSeqRegistration(options, image_id, &registration))
+		return 0;
+	EstimateSeqPoses(options, &registration);
+	return CommitSeqRegistration(&registration);
+}
 
-	CHECK(options.Check());
+std::vector<int> IncrementalMapper::SeqRegisterImages(const Options& options, const std::vector<image_t>& image_ids)
+{
+	TRACE_SCOPE("IncrementalMapper::SeqRegisterImages");
+	CHECK_NOTNULL(reconstruction_);
 
-	Image& image = reconstruction_->Image(image_id);
-	Camera& camera = reconstruction_->Camera(image.CameraId());
+	std::vector<int> found_poses(image_ids.size(), 0);
+
+	// Images whose camera is refined for the first time change the starting
+	// point of all later images with the same camera, so only the first of them
+	// is estimated in the batch and the others are registered afterwards.
+	std::vector<size_t> batch;
+	std::vector<size_t> deferred;
+	std::unordered_set<camera_t> refined_batch_cameras;
+	for (size_t i = 0; i < image_ids.size(); ++i)
+	{
+		const Image& image = reconstruction_->Image(image_ids[i]);
+		const Camera& camera = reconstruction_->Camera(image.CameraId());
+		const bool refines_camera = refined_cameras_.count(image.CameraId()) == 0 ||
+			camera.HasBogusParams(options.min_focal_length_ratio, options.max_focal_length_ratio, options.max_extra_param);
+		if (refines_camera && !refined_batch_cameras.insert(image.CameraId()).second)
+			deferred.push_back(i);
+		else
+			batch.push_back(i);
+	}
 
-	CHECK(!image.IsSeqRegistered()) << "Image cannot be sequentially registered multiple times";
+	// The preparation may reset bogus cameras, so it runs serially.
+	std::vector<SeqRegistration> registrations(batch.size());
+	std::vector<char> prepared(batch.size(), false);
+	for (size_t j = 0; j < batch.size(); ++j)
+	{
+		prepared[j] = PrepareSeqRegistration(options, image_ids[batch[j]], &registrations[j]);
+		// The candidates already run in parallel on the worker pool, on which
+		// their own estimation must not wait.
+		registrations[j].abs_pose_options.num_threads = 1;
+		registrations[j].abs_pose_options.thread_pool = nullptr;
+	}
 
-	num_reg_trials_[image_id] += 1;
+	// The estimation only reads the reconstruction and works on a copy of the
+	// camera, so that all candidates can be estimated concurrently.
+	ThreadPool* thread_pool = WorkerPool(options.num_threads);
+	std::vector<std::future<void>> futures(batch.size());
+	for (size_t j = 0; j < batch.size(); ++j)
+	{
+		if (!prepared[j])
+			continue;
+		futures[j] = thread_pool->AddTask([this, &options, &registrations, j]() {
+			EstimateSeqPoses(options, &registrations[j]);
+		});
+	}
 
-	// Check if enough 2D-3D correspondences.
-	if (image.NumVisiblePoints3D() < static_cast<size_t>(options.abs_pose_min_num_inliers))
+	// Commit the poses in the given order. Cameras that are shared by several
+	// candidates end up with the parameters of the last committed candidate.
+	for (size_t j = 0; j < batch.size(); ++j)
 	{
-		return 0;
+		if (!prepared[j])
+			continue;
+		try
+		{
+			futures[j].get();
+			found_poses[batch[j]] = CommitSeqRegistration(&registrations[j]);
+		}
+		catch(const std::exception& e)
+		{
+			std::cout << "ERROR: " << e.what() << "\n";
+		}
 	}
 
-	//////////////////////////////////////////////////////////////////////////////
-	// Search for 2D-3D correspondences
-	//////////////////////////////////////////////////////////////////////////////
+	for (const size_t i : deferred)
+	{
+		try
+		{
+			found_poses[i] = SeqRegisterImage(options, image_ids[i]);
+		}
+		catch(const std::exception& e)
+		{
+			std::cout << "ERROR: " << e.what() << "\n";
+		}
+	}
 
-	const int kCorrTransitivity = 1;
+	return found_poses;
+}
 
-	std::vector<std::pair<point2D_t, point3D_t>> tri_corrs;
-	std::vector<Eigen::Vector2d> tri_points2D;
-	std::vector<Eigen::Vector3d> tri_points3D;
+void IncrementalMapper::FindCorrespondences2D3D(
+    const Options& options, const image_t image_id,
+    std::vector<std::pair<point2D_t, point3D_t>>* tri_corrs,
+    std::vector<Eigen::Vector2d>* tri_points2D,
+    std::vector<Eigen::Vector3d>* tri_points3D) {
+  const int kCorrTransitivity = 1;
 
-	for (point2D_t point2D_idx = 0; point2D_idx < image.NumPoints2D(); ++point2D_idx)
-	{
-		const Point2D& point2D = image.Point2D(point2D_idx);
-		const SceneGraph& scene_graph = database_cache_->SceneGraph();
-		const std::vector<SceneGraph::Correspondence> corrs = scene_graph.FindTransitiveCorrespondences(image_id, point2D_idx, kCorrTransitivity);
+  const Image& image = reconstruction_->Image(image_id);
+  CorrespondenceCache& cache = correspondence_caches_[image_id];
 
-		std::unordered_set<point3D_t> point3D_ids;
+  const auto HasBogusParams = [this, &options](const camera_t camera_id) {
+    return reconstruction_->Camera(camera_id).HasBogusParams(
+        options.min_focal_length_ratio, options.max_focal_length_ratio,
+        options.max_extra_param);
+  };
 
-		for (const auto corr : corrs)
-		{
-			const Image& corr_image = reconstruction_->Image(corr.image_id);
-			if (!corr_image.IsRegistered())
-				continue;
+  // Camera parameters change without notice to the image points, so that the
+  // whole search is repeated once a camera changes its bogus state.
+  bool search_all = cache.versions.size() != image.NumPoints2D();
+  for (const auto& bogus_camera : cache.bogus_cameras) {
+    if (HasBogusParams(bogus_camera.first) != bogus_camera.second) {
+      search_all = true;
+      break;
+    }
+  }
 
-			const Point2D& corr_point2D = corr_image.Point2D(corr.point2D_idx);
-			if (!corr_point2D.HasPoint3D())
-				continue;
+  if (search_all) {
+    cache.versions.assign(image.NumPoints2D(), 0);
+    cache.point3D_ids.assign(image.NumPoints2D(), std::vector<point3D_t>());
+    cache.bogus_cameras.clear();
+  }
 
-			// Avoid duplicate correspondences.
-			if (point3D_ids.count(corr_point2D.Point3DId()) > 0)
-				continue;
+  const SceneGraph& scene_graph = *scene_graph_;
 
-			const Camera& corr_camera = reconstruction_->Camera(corr_image.CameraId());
+  SceneGraph::TransitiveScratch scratch;
+  ScratchVector<SceneGraph::Correspondence> corrs_buffer;
+  std::vector<SceneGraph::Correspondence>& corrs = *corrs_buffer;
 
-			// Avoid correspondences to images with bogus camera parameters.
-			if (corr_camera.HasBogusParams(options.min_focal_length_ratio, options.max_focal_length_ratio, options.max_extra_param))
-				continue;
+  for (point2D_t point2D_idx = 0; point2D_idx < image.NumPoints2D();
+       ++point2D_idx) {
+    const uint32_t version = image.CorrespondencePoint3DVersion(point2D_idx);
+    std::vector<point3D_t>& point3D_ids = cache.point3D_ids[point2D_idx];
 
-			const Point3D& point3D = reconstruction_->Point3D(corr_point2D.Point3DId());
+    if (search_all || cache.versions[point2D_idx] != version) {
+      cache.versions[point2D_idx] = version;
+      point3D_ids.clear();
 
-			tri_corrs.emplace_back(point2D_idx, corr_point2D.Point3DId());
-			point3D_ids.insert(corr_point2D.Point3DId());
-			tri_points2D.push_back(point2D.XY());
-			tri_points3D.push_back(point3D.XYZ());
-		}
-	}
+      scene_graph.FindTransitiveCorrespondences(
+          image_id, point2D_idx, kCorrTransitivity, &scratch, &corrs);
 
-	// The size of `next_image.num_tri_obs` and `tri_corrs_point2D_idxs.size()`
-	// can only differ, when there are images with bogus camera parameters, and
-	// hence we skip some of the 2D-3D correspondences.
-	if (tri_points2D.size() < static_cast<size_t>(options.abs_pose_min_num_inliers))
-		return 0;
+      for (const auto corr : corrs) {
+        const Image& corr_image = reconstruction_->Image(corr.image_id);
+        if (!corr_image.IsRegistered()) {
+          continue;
+        }
 
-	//////////////////////////////////////////////////////////////////////////////
-  	// 2D-3D estimation
-  	//////////////////////////////////////////////////////////////////////////////
+        const Point2D& corr_point2D = corr_image.Point2D(corr.point2D_idx);
+        if (!corr_point2D.HasPoint3D()) {
+          continue;
+        }
 
-  //EXTRACT OPTIONS AND SET THEM
-  // Only refine / estimate focal length, if no focal length was specified
-  // (manually or through EXIF) and if it was not already estimated previously
-  // from another image (when multiple images share the same camera
-  // parameters)
+        // Avoid duplicate correspondences.
+        if (std::find(point3D_ids.begin(), point3D_ids.end(),
+                      corr_point2D.Point3DId()) != point3D_ids.end()) {
+          continue;
+        }
 
-  AbsolutePoseEstimationOptions abs_pose_options;
-  abs_pose_options.num_threads = options.num_threads;
-  abs_pose_options.num_focal_length_samples = 30;
-  abs_pose_options.min_focal_length_ratio = options.min_focal_length_ratio;
-  abs_pose_options.max_focal_length_ratio = options.max_focal_length_ratio;
-  abs_pose_options.ransac_options.max_error = options.abs_pose_max_error;
-  abs_pose_options.ransac_options.min_inlier_ratio =
-      options.abs_pose_min_inlier_ratio;
-  // Use high confidence to avoid preemptive termination of P3P RANSAC
-  // - too early termination may lead to bad registration.
-  abs_pose_options.ransac_options.min_num_trials = 30;
-  abs_pose_options.ransac_options.confidence = 0.9999;
+        // Avoid correspondences to images with bogus camera parameters.
+        const camera_t corr_camera_id = corr_image.CameraId();
+        auto bogus_camera = cache.bogus_cameras.find(corr_camera_id);
+        if (bogus_camera == cache.bogus_cameras.end()) {
+          bogus_camera =
+              cache.bogus_cameras
+                  .emplace(corr_camera_id, HasBogusParams(corr_camera_id))
+                  .first;
+        }
+        if (bogus_camera->second) {
+          continue;
+        }
 
-  AbsolutePoseRefinementOptions abs_pose_refinement_options;
+        point3D_ids.push_back(corr_point2D.Point3DId());
+      }
+    }
+
+    const Point2D& point2D = image.Point2D(point2D_idx);
+    for (const point3D_t point3D_id : point3D_ids) {
+      if (!reconstruction_->ExistsPoint3D(point3D_id)) {
+        continue;
+      }
+      tri_corrs->emplace_back(point2D_idx, point3D_id);
+      tri_points2D->push_back(point2D.XY());
+      tri_points3D->push_back(reconstruction_->Point3D(point3D_id).XYZ());
+    }
+  }
+}
+
+void IncrementalMapper::SortCorrespondences2D3D(
+    std::vector<std::pair<point2D_t, point3D_t>>* tri_corrs,
+    std::vector<Eigen::Vector2d>* tri_points2D,
+    std::vector<Eigen::Vector3d>* tri_points3D) const {
+  ScratchVector<size_t> order_buffer(tri_corrs->size());
+  std::vector<size_t>& order = *order_buffer;
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](const size_t idx1,
+                                                   const size_t idx2) {
+    const Point3D& point3D1 =
+        reconstruction_->Point3D((*tri_corrs)[idx1].second);
+    const Point3D& point3D2 =
+        reconstruction_->Point3D((*tri_corrs)[idx2].second);
+    if (point3D1.Track().Length() != point3D2.Track().Length()) {
+      return point3D1.Track().Length() > point3D2.Track().Length();
+    }
+    return point3D1.Error() < point3D2.Error();
+  });
+
+  // The sorted buffers are swapped in, so that both buffers keep their
+  // capacity for the next registration.
+  ScratchVector<std::pair<point2D_t, point3D_t>> sorted_corrs_buffer;
+  ScratchVector<Eigen::Vector2d> sorted_points2D_buffer;
+  ScratchVector<Eigen::Vector3d> sorted_points3D_buffer;
+  std::vector<std::pair<point2D_t, point3D_t>>& sorted_corrs =
+      *sorted_corrs_buffer;
+  std::vector<Eigen::Vector2d>& sorted_points2D = *sorted_points2D_buffer;
+  std::vector<Eigen::Vector3d>& sorted_points3D = *sorted_points3D_buffer;
+  sorted_corrs.reserve(order.size());
+  sorted_points2D.reserve(order.size());
+  sorted_points3D.reserve(order.size());
+  for (const size_t idx : order) {
+    sorted_corrs.push_back((*tri_corrs)[idx]);
+    sorted_points2D.push_back((*tri_points2D)[idx]);
+    sorted_points3D.push_back((*tri_points3D)[idx]);
+  }
+
+  tri_corrs->swap(sorted_corrs);
+  tri_points2D->swap(sorted_points2D);
+  tri_points3D->swap(sorted_points3D);
+}
+
+std::vector<Eigen::Matrix3x4d> IncrementalMapper::PredictSeqPoses(const image_t image_id)
+{
+	if (image_ids_by_name_.empty())
+	{
+		image_ids_by_name_.reserve(reconstruction_->NumImages());
+		for (const auto& image : reconstruction_->Images())
+			image_ids_by_name_.push_back(image.first);
+		std::sort(image_ids_by_name_.begin(), image_ids_by_name_.end(), [this](const image_t image_id1, const image_t image_id2) {
+			return reconstruction_->Image(image_id1).Name() < reconstruction_->Image(image_id2).Name();
+		});
+		for (size_t i = 0; i < image_ids_by_name_.size(); ++i)
+			image_name_idxs_.emplace(image_ids_by_name_[i], i);
+	}
+
+	//the two closest images before and the closest image after the image that
+	//already have poses
+	const size_t name_idx = image_name_idxs_.at(image_id);
+	std::vector<const ImagePoseHypotheses*> neighbor_poses;
+	for (size_t i = name_idx; i > 0 && neighbor_poses.size() < 2; --i)
+	{
+		const ImagePoseHypotheses& poses = reconstruction_->Image(image_ids_by_name_[i - 1]).PoseHypotheses();
+		if (poses.Size() > 0)
+			neighbor_poses.push_back(&poses);
+	}
+	const size_t num_prev_neighbors = neighbor_poses.size();
+	for (size_t i = name_idx + 1; i < image_ids_by_name_.size(); ++i)
+	{
+		const ImagePoseHypotheses& poses = reconstruction_->Image(image_ids_by_name_[i]).PoseHypotheses();
+		if (poses.Size() > 0)
+		{
+			neighbor_poses.push_back(&poses);
+			break;
+		}
+	}
+
+	std::vector<Eigen::Matrix3x4d> predictions;
+
+	//constant velocity: every body of the previous image moves by the same
+	//motion as from the image before, where the same body is the one with the
+	//closest projection center
+	if (num_prev_neighbors == 2)
+	{
+		const ImagePoseHypotheses& poses1 = *neighbor_poses[1];
+		const ImagePoseHypotheses& poses2 = *neighbor_poses[0];
+		for (size_t k = 0; k < poses2.Size(); ++k)
+		{
+			const Eigen::Vector3d center2 = ProjectionCenterFromParameters(poses2.qvecs[k], poses2.tvecs[k]);
+			size_t best_idx = 0;
+			double best_dist = std::numeric_limits<double>::max();
+			for (size_t l = 0; l < poses1.Size(); ++l)
+			{
+				const double dist = (ProjectionCenterFromParameters(poses1.qvecs[l], poses1.tvecs[l]) - center2).squaredNorm();
+				if (dist < best_dist)
+				{
+					best_dist = dist;
+					best_idx = l;
+				}
+			}
+			Eigen::Matrix4d T1 = Eigen::Matrix4d::Identity();
+			Eigen::Matrix4d T2 = Eigen::Matrix4d::Identity();
+			T1.topRows<3>() = ComposeProjectionMatrix(poses1.qvecs[best_idx], poses1.tvecs[best_idx]);
+			T2.topRows<3>() = ComposeProjectionMatrix(poses2.qvecs[k], poses2.tvecs[k]);
+			const Eigen::Matrix4d T = T2 * T1.inverse() * T2;
+			predictions.push_back(T.topRows<3>());
+		}
+	}
+
+	//the poses of the neighbors themselves
+	for (const ImagePoseHypotheses* poses : neighbor_poses)
+	{
+		for (size_t k = 0; k < poses->Size(); ++k)
+			predictions.push_back(ComposeProjectionMatrix(poses->qvecs[k], poses->tvecs[k]));
+	}
+
+	return predictions;
+}
+
+bool IncrementalMapper::PrepareSeqRegistration(const Options& options, const image_t image_id, SeqRegistration* registration)
+{
+	TRACE_SCOPE("IncrementalMapper::PrepareSeqRegistration");
+	CHECK_NOTNULL(reconstruction_);
+	CHECK_GE(reconstruction_->NumRegImages(), 2);
+
+	CHECK(options.Check());
+
+	PageInImage(options, image_id);
+
+	const Image& image = reconstruction_->Image(image_id);
+	Camera& camera = reconstruction_->Camera(image.CameraId());
+
+	CHECK(!image.IsSeqRegistered()) << "Image cannot be sequentially registered multiple times";
+
+	num_reg_trials_[image_id] += 1;
+
+	// Check if enough 2D-3D correspondences.
+	if (image.NumVisiblePoints3D() < static_cast<size_t>(options.abs_pose_min_num_inliers))
+	{
+		return false;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// Search for 2D-3D correspondences
+	//////////////////////////////////////////////////////////////////////////////
+
+	registration->image_id = image_id;
+	std::vector<std::pair<point2D_t, point3D_t>>& tri_corrs = *registration->tri_corrs;
+	std::vector<Eigen::Vector2d>& tri_points2D = *registration->tri_points2D;
+	std::vector<Eigen::Vector3d>& tri_points3D = *registration->tri_points3D;
+	FindCorrespondences2D3D(options, image_id, &tri_corrs, &tri_points2D, &tri_points3D);
+
+	// The size of `next_image.num_tri_obs` and `tri_corrs_point2D_idxs.size()`
+	// can only differ, when there are images with bogus camera parameters, and
+	// hence we skip some of the 2D-3D correspondences.
+	if (tri_points2D.size() < static_cast<size_t>(options.abs_pose_min_num_inliers))
+		return false;
+
+	// The best correspondences are sampled first.
+	SortCorrespondences2D3D(&tri_corrs, &tri_points2D, &tri_points3D);
+
+	//////////////////////////////////////////////////////////////////////////////
+  	// 2D-3D estimation
+  	//////////////////////////////////////////////////////////////////////////////
+
+  //EXTRACT OPTIONS AND SET THEM
+  // Only refine / estimate focal length, if no focal length was specified
+  // (manually or through EXIF) and if it was not already estimated previously
+  // from another image (when multiple images share the same camera
+  // parameters)
+
+  AbsolutePoseEstimationOptions& abs_pose_options = registration->abs_pose_options;
+  abs_pose_options.num_threads = options.num_threads;
+  abs_pose_options.thread_pool = WorkerPool(options.num_threads);
+  abs_pose_options.num_focal_length_samples = 30;
+  abs_pose_options.min_focal_length_ratio = options.min_focal_length_ratio;
+  abs_pose_options.max_focal_length_ratio = options.max_focal_length_ratio;
+  abs_pose_options.ransac_options.max_error = options.abs_pose_max_error;
+  abs_pose_options.ransac_options.min_inlier_ratio =
+      options.abs_pose_min_inlier_ratio;
+  abs_pose_options.ransac_options.use_sprt = options.abs_pose_use_sprt;
+  abs_pose_options.ransac_options.num_threads = options.ransac_num_threads;
+  abs_pose_options.joint_focal_length_estimation =
+      options.abs_pose_joint_focal_length;
+  abs_pose_options.progressive_sampling = true;
+  // Use high confidence to avoid preemptive termination of P3P RANSAC
+  // - too early termination may lead to bad registration.
+  abs_pose_options.ransac_options.min_num_trials = 30;
+  abs_pose_options.ransac_options.confidence = 0.9999;
+
+  if (options.seq_pose_prediction) {
+    abs_pose_options.prior_poses = PredictSeqPoses(image_id);
+  }
+
+  AbsolutePoseRefinementOptions& abs_pose_refinement_options = registration->abs_pose_refinement_options;
   if (refined_cameras_.count(image.CameraId()) > 0) {
     // Camera already refined from another image with the same camera.
     if (camera.HasBogusParams(options.min_focal_length_ratio,
@@ -871,77 +1052,83 @@ int IncrementalMapper::SeqRegisterImage(const Options& options, const image_t im
     abs_pose_refinement_options.refine_extra_params = false;
   }
 
-  std::cout << "SQ2\n";
+  registration->camera = camera;
 
+  return true;
+}
 
+void IncrementalMapper::EstimateSeqPoses(const Options& options, SeqRegistration* registration) const
+{
+	TRACE_SCOPE("IncrementalMapper::EstimateSeqPoses");
 	//SEQUENTIAL PNP IS APPLIED HERE
-	int ret = 0;
-	std::vector<std::pair<point2D_t, point3D_t>> remaining_tri_corrs = tri_corrs;
-	std::vector<Eigen::Vector2d> remaining_tri_points2D = tri_points2D;
-	std::vector<Eigen::Vector3d> remaining_tri_points3D = tri_points3D;
-	//image.seq_
-	while(true)
-	{
-		std::cout << "A\n";
-		size_t num_inliers;
-  		std::vector<char> inlier_mask;
-  		Eigen::Vector4d qvec;
-		Eigen::Vector3d tvec;
-  		if (!EstimateAbsolutePose(abs_pose_options, remaining_tri_points2D, remaining_tri_points3D,
-        		&qvec, &tvec, &camera, &num_inliers, &inlier_mask))
-					break;
-		std::cout << "Pose estimated\n";
-		if (num_inliers < static_cast<size_t>(options.abs_pose_min_num_inliers))
-			break;
-		if (!RefineAbsolutePose(abs_pose_refinement_options, inlier_mask, remaining_tri_points2D,
-				remaining_tri_points3D, &qvec, &tvec, &camera))
+	//all poses are extracted in one pass over the correspondences, the inliers
+	//of a pose are masked out for the following poses
+	ScratchVector<Eigen::Vector4d> qvecs_buffer;
+	ScratchVector<Eigen::Vector3d> tvecs_buffer;
+	ScratchVector<size_t> num_inliers_buffer;
+	std::vector<Eigen::Vector4d>& qvecs = *qvecs_buffer;
+	std::vector<Eigen::Vector3d>& tvecs = *tvecs_buffer;
+	std::vector<size_t>& num_inliers = *num_inliers_buffer;
+	std::vector<std::vector<char>> inlier_masks;
+	const std::vector<Eigen::Vector2d>& tri_points2D = *registration->tri_points2D;
+	const std::vector<Eigen::Vector3d>& tri_points3D = *registration->tri_points3D;
+	size_t num_poses = 0;
+
+	//with predicted poses, a short RANSAC usually finds both bodies already, the
+	//full RANSAC only runs from the original camera if it does not
+	if (!registration->abs_pose_options.prior_poses.empty())
+	{
+		AbsolutePoseEstimationOptions guided_options = registration->abs_pose_options;
+		guided_options.ransac_options.max_num_trials = options.seq_pose_prediction_num_trials;
+		guided_options.ransac_options.min_num_trials = std::min(guided_options.ransac_options.min_num_trials,
+			guided_options.ransac_options.max_num_trials);
+		Camera guided_camera = registration->camera;
+		num_poses = EstimateAbsolutePoses(guided_options, std::numeric_limits<size_t>::max(),
+			options.abs_pose_min_num_inliers, tri_points2D, tri_points3D,
+			&qvecs, &tvecs, &guided_camera, &num_inliers, &inlier_masks);
+		if (num_poses >= 2)
+			registration->camera = guided_camera;
+	}
+
+	if (num_poses < 2)
+		num_poses = EstimateAbsolutePoses(registration->abs_pose_options, std::numeric_limits<size_t>::max(),
+			options.abs_pose_min_num_inliers, tri_points2D, tri_points3D,
+			&qvecs, &tvecs, &registration->camera, &num_inliers, &inlier_masks);
+
+	for (size_t k = 0; k < num_poses; ++k)
+	{
+		if (!RefineAbsolutePose(registration->abs_pose_refinement_options, inlier_masks[k], tri_points2D,
+				tri_points3D, &qvecs[k], &tvecs[k], &registration->camera))
 					break;
 
-		//std::cout << "QV: " << qvec << " TV: " << tvec << "\n";
-		//add tentative pose to the image
-		image.AddPose(qvec, tvec);
-		image.seq_inliers.push_back(num_inliers);
-		std::cout << "Number of inliers: " << num_inliers << "\n";
-		
-		//add inliers to the image
-		//set outliers as remaining corrs
+		//add tentative pose and its inliers to the image
 		std::vector<std::pair<point2D_t, point3D_t>> inlier_tri_corrs;
-		std::vector<std::pair<point2D_t, point3D_t>> next_tri_corrs;
-		std::vector<Eigen::Vector2d> next_tri_points2D;
-		std::vector<Eigen::Vector3d> next_tri_points3D;
-		
-		for (size_t i = 0; i < inlier_mask.size(); ++i)
+		inlier_tri_corrs.reserve(num_inliers[k]);
+		for (size_t i = 0; i < inlier_masks[k].size(); ++i)
 		{
-			if (inlier_mask[i])
-			{
-				inlier_tri_corrs.push_back(remaining_tri_corrs[i]);
-				/*const point2D_t point2D_idx = tri_corrs[i].first;
-      			const Point2D& point2D = image.Point2D(point2D_idx);
-      			if (!point2D.HasPoint3D())
-      			{
-					const point3D_t point3D_id = tri_corrs[i].second;
-					const TrackElement track_el(image_id, point2D_idx);
-					reconstruction_->AddObservation(point3D_id, track_el);
-				}*/
-			}
-			else
-			{
-				next_tri_corrs.push_back(remaining_tri_corrs[i]);
-				next_tri_points2D.push_back(remaining_tri_points2D[i]);
-				next_tri_points3D.push_back(remaining_tri_points3D[i]);
-			}
+			if (inlier_masks[k][i])
+				inlier_tri_corrs.push_back((*registration->tri_corrs)[i]);
 		}
-		remaining_tri_corrs = next_tri_corrs;
-		remaining_tri_points2D = next_tri_points2D;
-		remaining_tri_points3D = next_tri_points3D;
-		image.AddInlierCorrs(inlier_tri_corrs);
-
-		ret++;
-		//if(ret >= 2) break;
-		std::cout << "B\n";
+		registration->qvecs.push_back(qvecs[k]);
+		registration->tvecs.push_back(tvecs[k]);
+		registration->num_inliers.push_back(num_inliers[k]);
+		registration->inlier_corrs.push_back(inlier_tri_corrs);
 	}
+}
 
-	std::cout << "SQ3\n";
+int IncrementalMapper::CommitSeqRegistration(SeqRegistration* registration)
+{
+	TRACE_SCOPE("IncrementalMapper::CommitSeqRegistration");
+	Image& image = reconstruction_->Image(registration->image_id);
+	Camera& camera = reconstruction_->Camera(image.CameraId());
+	camera.SetParams(registration->camera.Params());
+
+	const int ret = registration->qvecs.size();
+	for (int i = 0; i < ret; ++i)
+	{
+		image.AddPose(registration->qvecs[i], registration->tvecs[i], registration->num_inliers[i], std::move(registration->inlier_corrs[i]));
+		VLOG(4) << "Number of inliers: " << registration->num_inliers[i];
+	}
 
 	if(ret==2)
 		image.SetSeqRegistered(true);
@@ -951,9 +1138,137 @@ int IncrementalMapper::SeqRegisterImage(const Options& options, const image_t im
 	return ret;
 }
 
+int IncrementalMapper::SeqRegisterRigFrame(
+    const Options& options, const CameraRig& camera_rig,
+    const std::vector<image_t>& image_ids) {
+  TRACE_SCOPE("IncrementalMapper::SeqRegisterRigFrame");
+  CHECK_NOTNULL(reconstruction_);
+  CHECK_GE(reconstruction_->NumRegImages(), 2);
+  CHECK(options.Check());
+
+  // GP3P needs calibrated cameras, i.e. cameras with a prior focal length or
+  // which were refined from an earlier image.
+  std::vector<Camera> cameras;
+  std::vector<Eigen::Vector4d> rel_qvecs;
+  std::vector<Eigen::Vector3d> rel_tvecs;
+  cameras.reserve(image_ids.size());
+  rel_qvecs.reserve(image_ids.size());
+  rel_tvecs.reserve(image_ids.size());
+  for (const image_t image_id : image_ids) {
+    PageInImage(options, image_id);
+  }
+  for (const image_t image_id : image_ids) {
+    const Image& image = reconstruction_->Image(image_id);
+    CHECK(!image.IsSeqRegistered())
+        << "Image cannot be sequentially registered multiple times";
+    CHECK(camera_rig.HasCamera(image.CameraId()));
+    const Camera& camera = reconstruction_->Camera(image.CameraId());
+    if ((refined_cameras_.count(image.CameraId()) == 0 &&
+         !camera.HasPriorFocalLength()) ||
+        camera.HasBogusParams(options.min_focal_length_ratio,
+                              options.max_focal_length_ratio,
+                              options.max_extra_param)) {
+      return 0;
+    }
+    cameras.push_back(camera);
+    rel_qvecs.push_back(camera_rig.RelativeQvec(image.CameraId()));
+    rel_tvecs.push_back(camera_rig.RelativeTvec(image.CameraId()));
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Search for 2D-3D correspondences
+  //////////////////////////////////////////////////////////////////////////////
+
+  std::vector<std::pair<point2D_t, point3D_t>> tri_corrs;
+  std::vector<Eigen::Vector2d> tri_points2D;
+  std::vector<Eigen::Vector3d> tri_points3D;
+  std::vector<size_t> tri_camera_idxs;
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    num_reg_trials_[image_ids[i]] += 1;
+    FindCorrespondences2D3D(options, image_ids[i], &tri_corrs, &tri_points2D,
+                            &tri_points3D);
+    tri_camera_idxs.resize(tri_corrs.size(), i);
+  }
+
+  if (tri_points2D.size() <
+      static_cast<size_t>(options.abs_pose_min_num_inliers)) {
+    return 0;
+  }
+
+  //////////////////////////////////////////////////////////////////////////////
+  // 2D-3D estimation
+  //////////////////////////////////////////////////////////////////////////////
+
+  RANSACOptions ransac_options;
+  ransac_options.max_error = options.abs_pose_max_error;
+  ransac_options.min_inlier_ratio = options.abs_pose_min_inlier_ratio;
+  ransac_options.use_sprt = options.abs_pose_use_sprt;
+  ransac_options.num_threads = options.ransac_num_threads;
+  // Use high confidence to avoid preemptive termination of P3P RANSAC
+  // - too early termination may lead to bad registration.
+  ransac_options.min_num_trials = 30;
+  ransac_options.confidence = 0.9999;
+
+  std::vector<Eigen::Vector4d> rig_qvecs;
+  std::vector<Eigen::Vector3d> rig_tvecs;
+  std::vector<size_t> num_inliers;
+  std::vector<std::vector<char>> inlier_masks;
+  const size_t num_poses = EstimateGeneralizedAbsolutePoses(
+      ransac_options, std::numeric_limits<size_t>::max(),
+      options.abs_pose_min_num_inliers, tri_points2D, tri_points3D,
+      tri_camera_idxs, rel_qvecs, rel_tvecs, cameras, &rig_qvecs, &rig_tvecs,
+      &num_inliers, &inlier_masks);
+
+  //////////////////////////////////////////////////////////////////////////////
+  // Pose refinement
+  //////////////////////////////////////////////////////////////////////////////
+
+  const AbsolutePoseRefinementOptions abs_pose_refinement_options;
+
+  size_t num_found_poses = 0;
+  for (; num_found_poses < num_poses; ++num_found_poses) {
+    const size_t k = num_found_poses;
+    if (!RefineGeneralizedAbsolutePose(
+            abs_pose_refinement_options, inlier_masks[k], tri_points2D,
+            tri_points3D, tri_camera_idxs, rel_qvecs, rel_tvecs, cameras,
+            &rig_qvecs[k], &rig_tvecs[k])) {
+      break;
+    }
+
+    // Split the inliers of the rig pose among the images, whose poses follow
+    // from the relative poses of their cameras.
+    std::vector<std::vector<std::pair<point2D_t, point3D_t>>> inlier_corrs(
+        image_ids.size());
+    for (size_t i = 0; i < inlier_masks[k].size(); ++i) {
+      if (inlier_masks[k][i]) {
+        inlier_corrs[tri_camera_idxs[i]].push_back(tri_corrs[i]);
+      }
+    }
+
+    for (size_t i = 0; i < image_ids.size(); ++i) {
+      Eigen::Vector4d qvec;
+      Eigen::Vector3d tvec;
+      ConcatenatePoses(rig_qvecs[k], rig_tvecs[k], rel_qvecs[i], rel_tvecs[i],
+                       &qvec, &tvec);
+      const int num_image_inliers = static_cast<int>(inlier_corrs[i].size());
+      reconstruction_->Image(image_ids[i])
+          .AddPose(qvec, tvec, num_image_inliers, std::move(inlier_corrs[i]));
+    }
+  }
+
+  if (num_found_poses == 2) {
+    for (const image_t image_id : image_ids) {
+      reconstruction_->Image(image_id).SetSeqRegistered(true);
+    }
+  }
+
+  return static_cast<int>(num_found_poses);
+}
+
 //uses a determined already used camera instead of a new one
 int IncrementalMapper::SeqRegisterImage2(const Options& options, const image_t image_id, const camera_t cam)
 {
+	TRACE_SCOPE("IncrementalMapper::SeqRegisterImage2");
 	CHECK_NOTNULL(reconstruction_);
 	CHECK_GE(reconstruction_->NumRegImages(), 2);
 
@@ -978,48 +1293,10 @@ int IncrementalMapper::SeqRegisterImage2(const Options& options, const image_t i
 	// Search for 2D-3D correspondences
 	//////////////////////////////////////////////////////////////////////////////
 
-	const int kCorrTransitivity = 1;
-
 	std::vector<std::pair<point2D_t, point3D_t>> tri_corrs;
 	std::vector<Eigen::Vector2d> tri_points2D;
 	std::vector<Eigen::Vector3d> tri_points3D;
-
-	for (point2D_t point2D_idx = 0; point2D_idx < image.NumPoints2D(); ++point2D_idx)
-	{
-		const Point2D& point2D = image.Point2D(point2D_idx);
-		const SceneGraph& scene_graph = database_cache_->SceneGraph();
-		const std::vector<SceneGraph::Correspondence> corrs = scene_graph.FindTransitiveCorrespondences(image_id, point2D_idx, kCorrTransitivity);
-
-		std::unordered_set<point3D_t> point3D_ids;
-
-		for (const auto corr : corrs)
-		{
-			const Image& corr_image = reconstruction_->Image(corr.image_id);
-			if (!corr_image.IsRegistered())
-				continue;
-
-			const Point2D& corr_point2D = corr_image.Point2D(corr.point2D_idx);
-			if (!corr_point2D.HasPoint3D())
-				continue;
-
-			// Avoid duplicate correspondences.
-			if (point3D_ids.count(corr_point2D.Point3DId()) > 0)
-				continue;
-
-			const Camera& corr_camera = reconstruction_->Camera(corr_image.CameraId());
-
-			// Avoid correspondences to images with bogus camera parameters.
-			if (corr_camera.HasBogusParams(options.min_focal_length_ratio, options.max_focal_length_ratio, options.max_extra_param))
-				continue;
-
-			const Point3D& point3D = reconstruction_->Point3D(corr_point2D.Point3DId());
-
-			tri_corrs.emplace_back(point2D_idx, corr_point2D.Point3DId());
-			point3D_ids.insert(corr_point2D.Point3DId());
-			tri_points2D.push_back(point2D.XY());
-			tri_points3D.push_back(point3D.XYZ());
-		}
-	}
+	FindCorrespondences2D3D(options, image_id, &tri_corrs, &tri_points2D, &tri_points3D);
 
 	// The size of `next_image.num_tri_obs` and `tri_corrs_point2D_idxs.size()`
 	// can only differ, when there are images with bogus camera parameters, and
@@ -1038,12 +1315,17 @@ int IncrementalMapper::SeqRegisterImage2(const Options& options, const image_t i
   // parameters)
   AbsolutePoseEstimationOptions abs_pose_options;
   abs_pose_options.num_threads = options.num_threads;
+  abs_pose_options.thread_pool = WorkerPool(options.num_threads);
   abs_pose_options.num_focal_length_samples = 30;
   abs_pose_options.min_focal_length_ratio = options.min_focal_length_ratio;
   abs_pose_options.max_focal_length_ratio = options.max_focal_length_ratio;
   abs_pose_options.ransac_options.max_error = options.abs_pose_max_error;
   abs_pose_options.ransac_options.min_inlier_ratio =
       options.abs_pose_min_inlier_ratio;
+  abs_pose_options.ransac_options.use_sprt = options.abs_pose_use_sprt;
+  abs_pose_options.ransac_options.num_threads = options.ransac_num_threads;
+  abs_pose_options.joint_focal_length_estimation =
+      options.abs_pose_joint_focal_length;
   // Use high confidence to avoid preemptive termination of P3P RANSAC
   // - too early termination may lead to bad registration.
   abs_pose_options.ransac_options.min_num_trials = 30;
@@ -1072,7 +1354,7 @@ int IncrementalMapper::SeqRegisterImage2(const Options& options, const image_t i
   else
   {
     // Camera not refined before.
-    std::cout << image.CameraId() << "\n";
+    VLOG(3) << image.CameraId();
     refined_cameras_.insert(image.CameraId());
     //abs_pose_options.estimate_focal_length = !camera.HasPriorFocalLength();
     abs_pose_options.estimate_focal_length = false;
@@ -1112,10 +1394,7 @@ int IncrementalMapper::SeqRegisterImage2(const Options& options, const image_t i
 					break;
 
 		//std::cout << "QV: " << qvec << " TV: " << tvec << "\n";
-		//add tentative pose to the image
-		image.AddPose(qvec, tvec);
-		image.seq_inliers.push_back(num_inliers);
-		std::cout << "Number of inliers: " << num_inliers << "\n";
+		VLOG(4) << "Number of inliers: " << num_inliers;
 		
 		//add inliers to the image
 		//set outliers as remaining corrs
@@ -1148,7 +1427,8 @@ int IncrementalMapper::SeqRegisterImage2(const Options& options, const image_t i
 		remaining_tri_corrs = next_tri_corrs;
 		remaining_tri_points2D = next_tri_points2D;
 		remaining_tri_points3D = next_tri_points3D;
-		image.AddInlierCorrs(inlier_tri_corrs);
+		//add tentative pose and its inliers to the image
+		image.AddPose(qvec, tvec, num_inliers, std::move(inlier_tri_corrs));
 
 		ret++;
 		//if(ret >= 2) break;
@@ -1164,13 +1444,14 @@ int IncrementalMapper::SeqRegisterImage2(const Options& options, const image_t i
 
 bool IncrementalMapper::FinishRegistration(const Options& options, const image_t image_id, const std::vector<std::pair<point2D_t, point3D_t>> tri_corrs)
 {
-	std::cout << "Finish registration\n";
-	std::cout << image_id << "\n";
+	VLOG(3) << "Finish registration";
+	VLOG(3) << image_id;
 	if(!tri_corrs.size()) return false;
+	PageInImage(options, image_id);
 	reconstruction_->RegisterImage(image_id);
 	RegisterImageEvent(image_id);
 	Image& image = reconstruction_->Image(image_id);
-	std::cout << image.NumPoints2D() << "\n";
+	VLOG(3) << image.NumPoints2D();
 
 	//////////////////////////////////////////////////////////////////////////////
 	// Continue tracks
@@ -1179,11 +1460,10 @@ bool IncrementalMapper::FinishRegistration(const Options& options, const image_t
 	for(size_t i=0;i<tri_corrs.size();++i)
 	{
 		const point2D_t point2D_idx = tri_corrs[i].first;
-		std::cout << point2D_idx << "\n";
+		VLOG(4) << point2D_idx;
 		if(point2D_idx >= image.NumPoints2D())
 			continue;
 		const Point2D& point2D = image.Point2D(point2D_idx);
-		std::cout << "K\n";
 		if (!point2D.HasPoint3D())
 		{
 			const point3D_t point3D_id = tri_corrs[i].second;
@@ -1195,35 +1475,122 @@ bool IncrementalMapper::FinishRegistration(const Options& options, const image_t
 	return true;
 }
 
-void IncrementalMapper::InitImage(const image_t image_id, const image_t original, std::vector<image_pair_t> old_pairs, std::vector<image_pair_t> new_pairs)
+void IncrementalMapper::InitImage(const image_t image_id, const image_t original)
 {
-	sg->AddImage(image_id, reconstruction_->Image(image_id).NumPoints2D());
-	sg->CopyCorrespondences(original, image_id, old_pairs, new_pairs);
+	//the phantom shares the image points of the original and has no correspondences of its own
+	CHECK_EQ(reconstruction_->Image(image_id).NumPoints2D(), reconstruction_->Image(original).NumPoints2D());
+	scene_graph_->AddPhantomImage(image_id, original);
+}
+
+void IncrementalMapper::SetRigidMotion(const image_t image_id,
+                                       const image_t original,
+                                       const int motion_idx) {
+  CHECK_NE(image_id, original);
+  CHECK_EQ(rigid_motions_.count(original), 0);
+  rigid_motions_[image_id] = std::make_pair(original, motion_idx);
+}
+
+void IncrementalMapper::PageInImage(const Options& options,
+                                    const image_t image_id) {
+  CHECK_NOTNULL(reconstruction_);
+  if (!database_cache_->HasSpilledPoints2D() ||
+      !database_cache_->ExistsImage(image_id)) {
+    return;
+  }
+
+  if (!resident_images_) {
+    const size_t max_num_bytes = static_cast<size_t>(
+        options.out_of_core_cache_size * 1024 * 1024 * 1024);
+    resident_images_.reset(
+        new MemoryConstrainedLRUCache<image_t, ResidentPoints2D>(
+            max_num_bytes, [this](const image_t resident_image_id) {
+              METRIC_COUNTER_ADD("mapper/out_of_core_cache_misses", 1);
+              Image& image = reconstruction_->Image(resident_image_id);
+              if (image.HasReleasedPoints2D()) {
+                image.RestorePoints2D(
+                    database_cache_->Points2D(resident_image_id));
+              }
+              return ResidentPoints2D(
+                  &image, &reconstruction_->Camera(image.CameraId()));
+            }));
+    if (!resident_images_memory_consumer_) {
+      resident_images_memory_consumer_.reset(new MemoryConsumer(
+          "mapper_resident_images", kMapperCacheMemoryPriority));
+    }
+    resident_images_->SetMemoryConsumer(resident_images_memory_consumer_.get());
+  }
+
+  // Registered images keep their points. Unregistered images are paged in or
+  // marked as recently used, which also covers images that were resident
+  // before, e.g. because they were registered and filtered again.
+  const Image& image = reconstruction_->Image(image_id);
+  if (!image.IsRegistered() || resident_images_->Exists(image_id)) {
+    METRIC_COUNTER_ADD("mapper/out_of_core_cache_accesses", 1);
+    resident_images_->Get(image_id);
+  }
+}
+
+IncrementalMapper::ResidentPoints2D::ResidentPoints2D(Image* image,
+                                                      const Camera* camera)
+    : image_(image),
+      camera_(camera),
+      num_bytes_(image->NumPoints2D() * sizeof(class Point2D)) {}
+
+IncrementalMapper::ResidentPoints2D::ResidentPoints2D(ResidentPoints2D&& other)
+    : image_(other.image_),
+      camera_(other.camera_),
+      num_bytes_(other.num_bytes_) {
+  other.image_ = nullptr;
+}
+
+IncrementalMapper::ResidentPoints2D::~ResidentPoints2D() {
+  if (image_ != nullptr && !image_->IsRegistered() &&
+      !image_->IsSeqRegistered() && image_->NumPoints3D() == 0) {
+    image_->ReleasePoints2D(*camera_);
+  }
+}
+
+size_t IncrementalMapper::ResidentPoints2D::NumBytes() const {
+  return num_bytes_;
 }
 
 size_t IncrementalMapper::TriangulateImage(
     const IncrementalTriangulator::Options& tri_options,
     const image_t image_id) {
+  TRACE_SCOPE("IncrementalMapper::TriangulateImage");
+  CHECK_NOTNULL(reconstruction_);
+  return triangulator_->TriangulateImage(TriangulatorOptions(tri_options),
+                                          image_id);
+}
+
+size_t IncrementalMapper::TriangulateImages(
+    const IncrementalTriangulator::Options& tri_options,
+    const std::vector<image_t>& image_ids) {
+  TRACE_SCOPE("IncrementalMapper::TriangulateImages");
   CHECK_NOTNULL(reconstruction_);
-  return triangulator_->TriangulateImage(tri_options, image_id);
+  return triangulator_->TriangulateImages(TriangulatorOptions(tri_options),
+                                          image_ids);
 }
 
 size_t IncrementalMapper::Retriangulate(
     const IncrementalTriangulator::Options& tri_options) {
+  TRACE_SCOPE("IncrementalMapper::Retriangulate");
   CHECK_NOTNULL(reconstruction_);
-  return triangulator_->Retriangulate(tri_options);
+  return triangulator_->Retriangulate(TriangulatorOptions(tri_options));
 }
 
 size_t IncrementalMapper::CompleteTracks(
     const IncrementalTriangulator::Options& tri_options) {
+  TRACE_SCOPE("IncrementalMapper::CompleteTracks");
   CHECK_NOTNULL(reconstruction_);
-  return triangulator_->CompleteAllTracks(tri_options);
+  return triangulator_->CompleteAllTracks(TriangulatorOptions(tri_options));
 }
 
 size_t IncrementalMapper::MergeTracks(
     const IncrementalTriangulator::Options& tri_options) {
+  TRACE_SCOPE("IncrementalMapper::MergeTracks");
   CHECK_NOTNULL(reconstruction_);
-  return triangulator_->MergeAllTracks(tri_options);
+  return triangulator_->MergeAllTracks(TriangulatorOptions(tri_options));
 }
 
 IncrementalMapper::LocalBundleAdjustmentReport
@@ -1242,53 +1609,30 @@ IncrementalMapper::AdjustLocalBundle(
   // Do the bundle adjustment only if there is any connected images.
   if (local_bundle.size() > 0) {
     BundleAdjustmentConfig ba_config;
-    ba_config.AddImage(image_id);
-    for (const image_t local_image_id : local_bundle) {
-      ba_config.AddImage(local_image_id);
-    }
+    std::unordered_set<point3D_t> variable_point3D_ids;
+    SetUpLocalBundle(image_id, local_bundle, point3D_ids, &ba_config,
+                     &variable_point3D_ids);
+    SetUpRigidMotions(&ba_config);
 
-    // Fix 7 DOF to avoid scale/rotation/translation drift in bundle adjustment.
-    if (local_bundle.size() == 1) {
-      ba_config.SetConstantPose(local_bundle[0]);
-      ba_config.SetConstantTvec(image_id, {0});
-    } else if (local_bundle.size() > 1) {
-      ba_config.SetConstantPose(local_bundle[local_bundle.size() - 1]);
-      ba_config.SetConstantTvec(local_bundle[local_bundle.size() - 2], {0});
-    }
-
-    // Make sure, we refine all new and short-track 3D points, no matter if
-    // they are fully contained in the local image set or not. Do not include
-    // long track 3D points as they are usually already very stable and adding
-    // to them to bundle adjustment and track merging/completion would slow
-    // down the local bundle adjustment significantly.
-    std::unordered_set<point3D_t> variable_point3D_ids;
-    for (const point3D_t point3D_id : point3D_ids) {
-      const Point3D& point3D = reconstruction_->Point3D(point3D_id);
-      const size_t kMaxTrackLength = 15;
-      if (!point3D.HasError() || point3D.Track().Length() <= kMaxTrackLength) {
-        ba_config.AddVariablePoint(point3D_id);
-        variable_point3D_ids.insert(point3D_id);
-      }
-    }
-
-    // Adjust the local bundle.
-    BundleAdjuster bundle_adjuster(ba_options, ba_config);
-    bundle_adjuster.Solve(reconstruction_);
-
-    report.num_adjusted_observations =
-        bundle_adjuster.Summary().num_residuals / 2;
+    // Adjust the local bundle.
+    report.num_adjusted_observations = SolveLocalBundle(
+        ba_options, ba_config, LocalBundleAdjuster(options, image_id));
+    RecordLocalBundleChanges(ba_config);
 
     // Merge refined tracks with other existing points.
     report.num_merged_observations =
-        triangulator_->MergeTracks(tri_options, variable_point3D_ids);
+        triangulator_->MergeTracks(TriangulatorOptions(tri_options),
+                                   variable_point3D_ids);
     // Complete tracks that may have failed to triangulate before refinement
     // of camera pose and calibration in bundle-adjustment. This may avoid
     // that some points are filtered and it helps for subsequent image
     // registrations.
     report.num_completed_observations =
-        triangulator_->CompleteTracks(tri_options, variable_point3D_ids);
+        triangulator_->CompleteTracks(TriangulatorOptions(tri_options),
+                                      variable_point3D_ids);
     report.num_completed_observations +=
-        triangulator_->CompleteImage(tri_options, image_id);
+        triangulator_->CompleteImage(TriangulatorOptions(tri_options),
+                                     image_id);
   }
 
   // Filter both the modified images and all changed 3D points to make sure
@@ -1308,8 +1652,196 @@ IncrementalMapper::AdjustLocalBundle(
   return report;
 }
 
+IncrementalMapper::LocalBundleAdjustmentReport
+IncrementalMapper::AdjustLocalBundles(
+    const Options& options, const BundleAdjustmentOptions& ba_options,
+    const IncrementalTriangulator::Options& tri_options,
+    const std::vector<image_t>& image_ids,
+    const std::unordered_set<point3D_t>& point3D_ids) {
+  CHECK_NOTNULL(reconstruction_);
+  CHECK(options.Check());
+
+  if (image_ids.size() == 1) {
+    return AdjustLocalBundle(options, ba_options, tri_options, image_ids[0],
+                             point3D_ids);
+  }
+
+  LocalBundleAdjustmentReport report;
+
+  std::vector<std::vector<image_t>> local_bundles(image_ids.size());
+  std::unordered_map<image_t, size_t> bundle_idxs;
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    local_bundles[i] = FindLocalBundle(options, image_ids[i]);
+    bundle_idxs.emplace(image_ids[i], i);
+    for (const image_t local_image_id : local_bundles[i]) {
+      bundle_idxs.emplace(local_image_id, i);
+    }
+  }
+
+  // Every provided 3D point is refined in one of the local bundles that
+  // contain an image of its track, or in the first one if there is none.
+  std::vector<std::unordered_set<point3D_t>> bundle_point3D_ids(
+      image_ids.size());
+  for (const point3D_t point3D_id : point3D_ids) {
+    size_t bundle_idx = 0;
+    for (const TrackElement& track_el :
+         reconstruction_->Point3D(point3D_id).Track().Elements()) {
+      const auto it = bundle_idxs.find(track_el.image_id);
+      if (it != bundle_idxs.end()) {
+        bundle_idx = it->second;
+        break;
+      }
+    }
+    bundle_point3D_ids[bundle_idx].insert(point3D_id);
+  }
+
+  // Partition the local bundles into groups that do not share any parameter,
+  // i.e. the bundles whose images, cameras or 3D points overlap are merged.
+  // This includes the constant images and cameras that observe the refined 3D
+  // points, as they are read while the other groups are solved.
+  std::vector<size_t> parents(image_ids.size());
+  std::iota(parents.begin(), parents.end(), 0);
+  const std::function<size_t(size_t)> FindRoot = [&](const size_t idx) {
+    return parents[idx] == idx ? idx : parents[idx] = FindRoot(parents[idx]);
+  };
+
+  std::unordered_map<image_t, size_t> image_owners;
+  std::unordered_map<camera_t, size_t> camera_owners;
+  std::unordered_map<point3D_t, size_t> point3D_owners;
+  const auto Claim = [&](const size_t bundle_idx, const image_t image_id) {
+    const Image& image = reconstruction_->Image(image_id);
+    const size_t root = FindRoot(bundle_idx);
+    const auto image_owner = image_owners.emplace(image_id, root);
+    parents[FindRoot(image_owner.first->second)] = root;
+    const auto camera_owner = camera_owners.emplace(image.CameraId(), root);
+    parents[FindRoot(camera_owner.first->second)] = root;
+    for (const Point2D& point2D : image.Points2D()) {
+      if (point2D.HasPoint3D()) {
+        const auto point3D_owner =
+            point3D_owners.emplace(point2D.Point3DId(), root);
+        parents[FindRoot(point3D_owner.first->second)] = root;
+      }
+    }
+  };
+
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    if (local_bundles[i].empty()) {
+      continue;
+    }
+    Claim(i, image_ids[i]);
+    for (const image_t local_image_id : local_bundles[i]) {
+      Claim(i, local_image_id);
+    }
+    for (const point3D_t point3D_id : bundle_point3D_ids[i]) {
+      for (const TrackElement& track_el :
+           reconstruction_->Point3D(point3D_id).Track().Elements()) {
+        Claim(i, track_el.image_id);
+      }
+    }
+  }
+
+  // Set up the merged configuration of every group.
+  std::vector<BundleAdjustmentConfig> ba_configs;
+  std::vector<IncrementalBundleAdjuster*> bundle_adjusters;
+  std::unordered_map<size_t, size_t> group_idxs;
+  std::unordered_set<point3D_t> variable_point3D_ids;
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    if (local_bundles[i].empty()) {
+      continue;
+    }
+    const auto group_idx = group_idxs.emplace(FindRoot(i), ba_configs.size());
+    if (group_idx.second) {
+      ba_configs.emplace_back();
+      bundle_adjusters.push_back(LocalBundleAdjuster(options, image_ids[i]));
+    }
+    SetUpLocalBundle(image_ids[i], local_bundles[i], bundle_point3D_ids[i],
+                     &ba_configs[group_idx.first->second],
+                     &variable_point3D_ids);
+  }
+  for (auto& ba_config : ba_configs) {
+    SetUpRigidMotions(&ba_config);
+  }
+
+  // The groups are solved concurrently on the worker pool and share the thread
+  // budget of the bundle adjustment.
+  const int num_eff_threads =
+      GetEffectiveNumThreads(ba_options.solver_options.num_threads);
+  BundleAdjustmentOptions group_ba_options = ba_options;
+  if (ba_configs.size() > 1) {
+    group_ba_options.solver_options.num_threads = std::max(
+        1, num_eff_threads / static_cast<int>(ba_configs.size()));
+    group_ba_options.solver_options.num_linear_solver_threads =
+        group_ba_options.solver_options.num_threads;
+  }
+
+  std::vector<size_t> num_adjusted_observations(ba_configs.size(), 0);
+  const auto AdjustGroup = [&](const size_t group_idx) {
+    num_adjusted_observations[group_idx] =
+        SolveLocalBundle(group_ba_options, ba_configs[group_idx],
+                         bundle_adjusters[group_idx]);
+  };
+
+  if (ba_configs.size() > 1 && num_eff_threads > 1) {
+    ThreadPool* thread_pool = WorkerPool(options.num_threads);
+    std::vector<std::future<void>> futures;
+    futures.reserve(ba_configs.size());
+    for (size_t group_idx = 0; group_idx < ba_configs.size(); ++group_idx) {
+      futures.push_back(thread_pool->AddTask(AdjustGroup, group_idx));
+    }
+    for (auto& future : futures) {
+      future.get();
+    }
+  } else {
+    for (size_t group_idx = 0; group_idx < ba_configs.size(); ++group_idx) {
+      AdjustGroup(group_idx);
+    }
+  }
+
+  for (const size_t num_group_observations : num_adjusted_observations) {
+    report.num_adjusted_observations += num_group_observations;
+  }
+
+  for (const auto& ba_config : ba_configs) {
+    RecordLocalBundleChanges(ba_config);
+  }
+
+  // The track merging, completion and filtering change the reconstruction
+  // outside of the groups, so they run once after all groups are solved.
+  if (!ba_configs.empty()) {
+    report.num_merged_observations = triangulator_->MergeTracks(
+        TriangulatorOptions(tri_options), variable_point3D_ids);
+    report.num_completed_observations = triangulator_->CompleteTracks(
+        TriangulatorOptions(tri_options), variable_point3D_ids);
+    for (size_t i = 0; i < image_ids.size(); ++i) {
+      if (!local_bundles[i].empty()) {
+        report.num_completed_observations += triangulator_->CompleteImage(
+            TriangulatorOptions(tri_options), image_ids[i]);
+      }
+    }
+  }
+
+  std::unordered_set<image_t> filter_image_ids;
+  for (size_t i = 0; i < image_ids.size(); ++i) {
+    filter_image_ids.insert(image_ids[i]);
+    filter_image_ids.insert(local_bundles[i].begin(), local_bundles[i].end());
+  }
+  report.num_filtered_observations = reconstruction_->FilterPoints3DInImages(
+      options.filter_max_reproj_error, options.filter_min_tri_angle,
+      filter_image_ids);
+  report.num_filtered_observations += reconstruction_->FilterPoints3D(
+      options.filter_max_reproj_error, options.filter_min_tri_angle,
+      point3D_ids);
+
+  return report;
+}
+
+void IncrementalMapper::ResetLocalBundleAdjusters() {
+  local_bundle_adjusters_.clear();
+}
+
 bool IncrementalMapper::AdjustGlobalBundle(
     const BundleAdjustmentOptions& ba_options) {
+  TRACE_SCOPE("IncrementalMapper::AdjustGlobalBundle");
   CHECK_NOTNULL(reconstruction_);
 
   const std::vector<image_t>& reg_image_ids = reconstruction_->RegImageIds();
@@ -1318,6 +1850,8 @@ bool IncrementalMapper::AdjustGlobalBundle(
                                        "registered for global "
                                        "bundle-adjustment";
 
+  RecordGlobalBundleParameters();
+
   // Avoid degeneracies in bundle adjustment.
   reconstruction_->FilterObservationsWithNegativeDepth();
 
@@ -1328,6 +1862,7 @@ bool IncrementalMapper::AdjustGlobalBundle(
   }
   ba_config.SetConstantPose(reg_image_ids[0]);
   ba_config.SetConstantTvec(reg_image_ids[1], {0});
+  SetUpRigidMotions(&ba_config);
 
   // Run bundle adjustment.
   BundleAdjuster bundle_adjuster(ba_options, ba_config);
@@ -1335,6 +1870,125 @@ bool IncrementalMapper::AdjustGlobalBundle(
     return false;
   }
 
+  ComputeGlobalBundleChanges();
+
+  // Normalize scene for numerical stability and
+  // to avoid large scale changes in viewer.
+  reconstruction_->Normalize();
+
+  return true;
+}
+
+bool IncrementalMapper::AdjustIncrementalGlobalBundle(
+    const BundleAdjustmentOptions& ba_options) {
+  TRACE_SCOPE("IncrementalMapper::AdjustIncrementalGlobalBundle");
+  CHECK_NOTNULL(reconstruction_);
+
+  // The rigid motions of the phantom images are only supported from scratch.
+  if (!rigid_motions_.empty()) {
+    return AdjustGlobalBundle(ba_options);
+  }
+
+  const std::vector<image_t>& reg_image_ids = reconstruction_->RegImageIds();
+
+  CHECK_GE(reg_image_ids.size(), 2) << "At least two images must be "
+                                       "registered for global "
+                                       "bundle-adjustment";
+
+  RecordGlobalBundleParameters();
+
+  // Avoid degeneracies in bundle adjustment.
+  reconstruction_->FilterObservationsWithNegativeDepth();
+
+  // Configure bundle adjustment.
+  BundleAdjustmentConfig ba_config;
+  for (const image_t image_id : reg_image_ids) {
+    ba_config.AddImage(image_id);
+  }
+  ba_config.SetConstantPose(reg_image_ids[0]);
+  ba_config.SetConstantTvec(reg_image_ids[1], {0});
+
+  // Run bundle adjustment.
+  if (!global_bundle_adjuster_) {
+    global_bundle_adjuster_.reset(new IncrementalBundleAdjuster());
+  }
+  if (!global_bundle_adjuster_->Solve(ba_options, ba_config,
+                                      reconstruction_)) {
+    return false;
+  }
+
+  ComputeGlobalBundleChanges();
+
+  // Normalize scene for numerical stability and
+  // to avoid large scale changes in viewer.
+  reconstruction_->Normalize();
+
+  return true;
+}
+
+void IncrementalMapper::ResetIncrementalGlobalBundle() {
+  global_bundle_adjuster_.reset();
+}
+
+bool IncrementalMapper::AdjustSubsampledGlobalBundle(
+    const BundleAdjustmentOptions& ba_options, const int grid_size) {
+  TRACE_SCOPE("IncrementalMapper::AdjustSubsampledGlobalBundle");
+  CHECK_NOTNULL(reconstruction_);
+  CHECK_GT(grid_size, 0);
+
+  const std::vector<image_t>& reg_image_ids = reconstruction_->RegImageIds();
+
+  CHECK_GE(reg_image_ids.size(), 2) << "At least two images must be "
+                                       "registered for global "
+                                       "bundle-adjustment";
+
+  RecordGlobalBundleParameters();
+
+  // Avoid degeneracies in bundle adjustment.
+  reconstruction_->FilterObservationsWithNegativeDepth();
+
+  const std::unordered_set<point3D_t> subset_point3D_ids =
+      FindGlobalBundlePoints(grid_size);
+
+  // Configure bundle adjustment.
+  BundleAdjustmentConfig ba_config;
+  for (const image_t image_id : reg_image_ids) {
+    ba_config.AddImage(image_id);
+  }
+  ba_config.SetConstantPose(reg_image_ids[0]);
+  ba_config.SetConstantTvec(reg_image_ids[1], {0});
+  ba_config.SetPointSubset(subset_point3D_ids);
+  SetUpRigidMotions(&ba_config);
+
+  // Run bundle adjustment.
+  BundleAdjuster bundle_adjuster(ba_options, ba_config);
+  if (!bundle_adjuster.Solve(reconstruction_)) {
+    return false;
+  }
+
+  // Refine the other points with the adjusted images.
+  std::vector<point3D_t> other_point3D_ids;
+  other_point3D_ids.reserve(reconstruction_->NumPoints3D() -
+                            subset_point3D_ids.size());
+  for (const auto& point3D : reconstruction_->Points3D()) {
+    if (subset_point3D_ids.count(point3D.first) == 0) {
+      other_point3D_ids.push_back(point3D.first);
+    }
+  }
+
+  const int num_threads = ba_options.solver_options.num_threads;
+  RefinePoints3D(ba_options, other_point3D_ids, reconstruction_,
+                 GetEffectiveNumThreads(num_threads) > 1
+                     ? WorkerPool(num_threads)
+                     : nullptr);
+
+  std::cout << StringPrintf("  => Adjusted points: %d / %d",
+                            subset_point3D_ids.size(),
+                            reconstruction_->NumPoints3D())
+            << std::endl;
+
+  ComputeGlobalBundleChanges();
+
   // Normalize scene for numerical stability and
   // to avoid large scale changes in viewer.
   reconstruction_->Normalize();
@@ -1345,13 +1999,21 @@ bool IncrementalMapper::AdjustGlobalBundle(
 bool IncrementalMapper::AdjustParallelGlobalBundle(
     const BundleAdjustmentOptions& ba_options,
     const ParallelBundleAdjuster::Options& parallel_ba_options) {
+  TRACE_SCOPE("IncrementalMapper::AdjustParallelGlobalBundle");
   CHECK_NOTNULL(reconstruction_);
 
+  // The rigid motions of the phantom images are only supported from scratch.
+  if (!rigid_motions_.empty()) {
+    return AdjustGlobalBundle(ba_options);
+  }
+
   const std::vector<image_t>& reg_image_ids = reconstruction_->RegImageIds();
 
   CHECK_GE(reg_image_ids.size(), 2)
       << "At least two images must be registered for global bundle-adjustment";
 
+  RecordGlobalBundleParameters();
+
   // Avoid degeneracies in bundle adjustment.
   reconstruction_->FilterObservationsWithNegativeDepth();
 
@@ -1368,6 +2030,8 @@ bool IncrementalMapper::AdjustParallelGlobalBundle(
     return false;
   }
 
+  ComputeGlobalBundleChanges();
+
   // Normalize scene for numerical stability and
   // to avoid large scale changes in viewer.
   reconstruction_->Normalize();
@@ -1376,6 +2040,7 @@ bool IncrementalMapper::AdjustParallelGlobalBundle(
 }
 
 size_t IncrementalMapper::FilterImages(const Options& options) {
+  TRACE_SCOPE("IncrementalMapper::FilterImages");
   CHECK_NOTNULL(reconstruction_);
   CHECK(options.Check());
 
@@ -1400,12 +2065,71 @@ size_t IncrementalMapper::FilterImages(const Options& options) {
 }
 
 size_t IncrementalMapper::FilterPoints(const Options& options) {
+  TRACE_SCOPE("IncrementalMapper::FilterPoints");
   CHECK_NOTNULL(reconstruction_);
   CHECK(options.Check());
+  global_bundle_changes_.valid = false;
   return reconstruction_->FilterAllPoints3D(options.filter_max_reproj_error,
                                             options.filter_min_tri_angle);
 }
 
+size_t IncrementalMapper::FilterChangedPoints(const Options& options) {
+  TRACE_SCOPE("IncrementalMapper::FilterChangedPoints");
+  CHECK_NOTNULL(reconstruction_);
+  CHECK(options.Check());
+
+  GlobalBundleChanges& changes = global_bundle_changes_;
+  if (!changes.valid || options.filter_min_change == 0) {
+    return FilterPoints(options);
+  }
+
+  changes.valid = false;
+
+  std::unordered_set<image_t> changed_image_ids;
+  for (const auto& image_change : changes.image_changes) {
+    if (image_change.second >= options.filter_min_change) {
+      changed_image_ids.insert(image_change.first);
+    }
+  }
+
+  // The tracks are only read, while the points are selected in parallel.
+  std::vector<char> changed_points(changes.point3D_ids.size(), 0);
+  ParallelFor(0, static_cast<int>(changes.point3D_ids.size()),
+              [&](const int i) {
+                const point3D_t point3D_id = changes.point3D_ids[i];
+                if (!reconstruction_->ExistsPoint3D(point3D_id)) {
+                  return;
+                }
+                if (changes.point_changes[i] >= options.filter_min_change) {
+                  changed_points[i] = 1;
+                  return;
+                }
+                for (const auto& track_el :
+                     reconstruction_->Point3D(point3D_id).Track().Elements()) {
+                  if (changed_image_ids.count(track_el.image_id) > 0) {
+                    changed_points[i] = 1;
+                    return;
+                  }
+                }
+              });
+
+  // The points, whose tracks were completed or merged, are filtered as well.
+  std::unordered_set<point3D_t> point3D_ids = GetModifiedPoints3D();
+  for (size_t i = 0; i < changed_points.size(); ++i) {
+    if (changed_points[i]) {
+      point3D_ids.insert(changes.point3D_ids[i]);
+    }
+  }
+
+  std::cout << StringPrintf("  => Changed points: %d / %d", point3D_ids.size(),
+                            reconstruction_->NumPoints3D())
+            << std::endl;
+
+  return reconstruction_->FilterPoints3D(options.filter_max_reproj_error,
+                                         options.filter_min_tri_angle,
+                                         point3D_ids);
+}
+
 const Reconstruction& IncrementalMapper::GetReconstruction() const {
   CHECK_NOTNULL(reconstruction_);
   return *reconstruction_;
@@ -1507,7 +2231,7 @@ std::vector<image_t> IncrementalMapper::FindSecondInitialImage(
   std::unordered_map<image_t, point2D_t> num_correspondences;
   for (point2D_t point2D_idx = 0; point2D_idx < image1.NumPoints2D();
        ++point2D_idx) {
-    const std::vector<SceneGraph::Correspondence>& corrs =
+    const CsrRow<SceneGraph::Correspondence> corrs =
         scene_graph.FindCorrespondences(image_id1, point2D_idx);
     for (const SceneGraph::Correspondence& corr : corrs) {
       if (num_registrations_.count(corr.image_id) == 0 ||
@@ -1568,6 +2292,271 @@ std::vector<image_t> IncrementalMapper::FindSecondInitialImage(
   return image_ids;
 }
 
+std::unordered_set<point3D_t> IncrementalMapper::FindGlobalBundlePoints(
+    const int grid_size) const {
+  CHECK_GT(grid_size, 0);
+
+  // Whether the first 3D point is better conditioned than the second.
+  const auto IsBetter = [this](const point3D_t point3D_id1,
+                               const point3D_t point3D_id2) {
+    const Point3D& point3D1 = reconstruction_->Point3D(point3D_id1);
+    const Point3D& point3D2 = reconstruction_->Point3D(point3D_id2);
+    if (point3D1.Track().Length() != point3D2.Track().Length()) {
+      return point3D1.Track().Length() > point3D2.Track().Length();
+    }
+    return point3D1.Error() < point3D2.Error();
+  };
+
+  std::unordered_set<point3D_t> point3D_ids;
+  std::vector<point3D_t> cell_point3D_ids(grid_size * grid_size);
+  for (const image_t image_id : reconstruction_->RegImageIds()) {
+    const Image& image = reconstruction_->Image(image_id);
+    const Camera& camera = reconstruction_->Camera(image.CameraId());
+
+    std::fill(cell_point3D_ids.begin(), cell_point3D_ids.end(),
+              kInvalidPoint3DId);
+    for (const Point2D& point2D : image.Points2D()) {
+      if (!point2D.HasPoint3D()) {
+        continue;
+      }
+      const int x = std::min(
+          std::max(static_cast<int>(grid_size * point2D.X() / camera.Width()),
+                   0),
+          grid_size - 1);
+      const int y = std::min(
+          std::max(static_cast<int>(grid_size * point2D.Y() / camera.Height()),
+                   0),
+          grid_size - 1);
+      point3D_t& cell_point3D_id = cell_point3D_ids[y * grid_size + x];
+      if (cell_point3D_id == kInvalidPoint3DId ||
+          IsBetter(point2D.Point3DId(), cell_point3D_id)) {
+        cell_point3D_id = point2D.Point3DId();
+      }
+    }
+
+    for (const point3D_t point3D_id : cell_point3D_ids) {
+      if (point3D_id != kInvalidPoint3DId) {
+        point3D_ids.insert(point3D_id);
+      }
+    }
+  }
+
+  return point3D_ids;
+}
+
+void IncrementalMapper::SetUpLocalBundle(
+    const image_t image_id, const std::vector<image_t>& local_bundle,
+    const std::unordered_set<point3D_t>& point3D_ids,
+    BundleAdjustmentConfig* ba_config,
+    std::unordered_set<point3D_t>* variable_point3D_ids) const {
+  ba_config->AddImage(image_id);
+  for (const image_t local_image_id : local_bundle) {
+    ba_config->AddImage(local_image_id);
+  }
+
+  // Fix 7 DOF to avoid scale/rotation/translation drift in bundle adjustment.
+  // The configuration may already hold other local bundles, whose gauge is
+  // kept if they share images with this one.
+  const auto SetConstantPose = [ba_config](const image_t id) {
+    ba_config->RemoveConstantTvec(id);
+    ba_config->SetConstantPose(id);
+  };
+  const auto SetConstantTvec = [ba_config](const image_t id) {
+    if (!ba_config->HasConstantPose(id) && !ba_config->HasConstantTvec(id)) {
+      ba_config->SetConstantTvec(id, {0});
+    }
+  };
+  if (local_bundle.size() == 1) {
+    SetConstantPose(local_bundle[0]);
+    SetConstantTvec(image_id);
+  } else if (local_bundle.size() > 1) {
+    SetConstantPose(local_bundle[local_bundle.size() - 1]);
+    SetConstantTvec(local_bundle[local_bundle.size() - 2]);
+  }
+
+  // Make sure, we refine all new and short-track 3D points, no matter if
+  // they are fully contained in the local image set or not. Do not include
+  // long track 3D points as they are usually already very stable and adding
+  // to them to bundle adjustment and track merging/completion would slow
+  // down the local bundle adjustment significantly.
+  for (const point3D_t point3D_id : point3D_ids) {
+    const Point3D& point3D = reconstruction_->Point3D(point3D_id);
+    const size_t kMaxTrackLength = 15;
+    if (!point3D.HasError() || point3D.Track().Length() <= kMaxTrackLength) {
+      ba_config->AddVariablePoint(point3D_id);
+      variable_point3D_ids->insert(point3D_id);
+    }
+  }
+}
+
+void IncrementalMapper::RecordGlobalBundleParameters() {
+  GlobalBundleChanges& changes = global_bundle_changes_;
+  changes.valid = false;
+
+  const std::vector<image_t>& reg_image_ids = reconstruction_->RegImageIds();
+  changes.image_ids = reg_image_ids;
+  changes.qvecs.resize(reg_image_ids.size());
+  changes.proj_centers.resize(reg_image_ids.size());
+  changes.camera_params.clear();
+  for (size_t i = 0; i < reg_image_ids.size(); ++i) {
+    const Image& image = reconstruction_->Image(reg_image_ids[i]);
+    changes.qvecs[i] = image.Qvec();
+    changes.proj_centers[i] = image.ProjectionCenter();
+    if (changes.camera_params.count(image.CameraId()) == 0) {
+      changes.camera_params.emplace(
+          image.CameraId(),
+          reconstruction_->Camera(image.CameraId()).Params());
+    }
+  }
+
+  changes.point3D_ids.clear();
+  changes.xyzs.clear();
+  changes.track_lengths.clear();
+  changes.point3D_ids.reserve(reconstruction_->NumPoints3D());
+  changes.xyzs.reserve(reconstruction_->NumPoints3D());
+  changes.track_lengths.reserve(reconstruction_->NumPoints3D());
+  for (const auto& point3D : reconstruction_->Points3D()) {
+    changes.point3D_ids.push_back(point3D.first);
+    changes.xyzs.push_back(point3D.second.XYZ());
+    changes.track_lengths.push_back(point3D.second.Track().Length());
+  }
+}
+
+void IncrementalMapper::ComputeGlobalBundleChanges() {
+  GlobalBundleChanges& changes = global_bundle_changes_;
+
+  // The positions are compared relative to the root mean square distance of
+  // the projection centers from their centroid before the adjustment, which
+  // is invariant to the scale of the scene.
+  Eigen::Vector3d centroid = Eigen::Vector3d::Zero();
+  for (const auto& proj_center : changes.proj_centers) {
+    centroid += proj_center;
+  }
+  centroid /= std::max<size_t>(changes.proj_centers.size(), 1);
+  double scale = 0;
+  for (const auto& proj_center : changes.proj_centers) {
+    scale += (proj_center - centroid).squaredNorm();
+  }
+  scale = std::sqrt(scale / std::max<size_t>(changes.proj_centers.size(), 1));
+  const double inv_scale =
+      scale > 0 ? 1 / scale : std::numeric_limits<double>::infinity();
+
+  std::unordered_map<camera_t, double> camera_changes;
+  for (const auto& camera_params : changes.camera_params) {
+    const std::vector<double>& params =
+        reconstruction_->Camera(camera_params.first).Params();
+    double camera_change = 0;
+    for (size_t i = 0; i < params.size(); ++i) {
+      camera_change = std::max(
+          camera_change, std::abs(params[i] - camera_params.second[i]) /
+                             std::max(std::abs(camera_params.second[i]), 1.0));
+    }
+    camera_changes.emplace(camera_params.first, camera_change);
+  }
+
+  changes.image_changes.clear();
+  for (size_t i = 0; i < changes.image_ids.size(); ++i) {
+    if (!reconstruction_->IsImageRegistered(changes.image_ids[i])) {
+      continue;
+    }
+    const Image& image = reconstruction_->Image(changes.image_ids[i]);
+    const double rotation_change =
+        2 * std::acos(std::min(
+                std::abs(image.Qvec().normalized().dot(
+                    changes.qvecs[i].normalized())),
+                1.0));
+    const double position_change =
+        (image.ProjectionCenter() - changes.proj_centers[i]).norm() *
+        inv_scale;
+    changes.image_changes.emplace(
+        changes.image_ids[i],
+        std::max({rotation_change, position_change,
+                  camera_changes.at(image.CameraId())}));
+  }
+
+  // Points that lost observations in the adjustment are always filtered.
+  changes.point_changes.resize(changes.point3D_ids.size());
+  ParallelFor(0, static_cast<int>(changes.point3D_ids.size()),
+              [&](const int i) {
+                const point3D_t point3D_id = changes.point3D_ids[i];
+                if (!reconstruction_->ExistsPoint3D(point3D_id)) {
+                  changes.point_changes[i] = 0;
+                  return;
+                }
+                const Point3D& point3D = reconstruction_->Point3D(point3D_id);
+                if (point3D.Track().Length() != changes.track_lengths[i]) {
+                  changes.point_changes[i] =
+                      std::numeric_limits<double>::infinity();
+                } else {
+                  changes.point_changes[i] =
+                      (point3D.XYZ() - changes.xyzs[i]).norm() * inv_scale;
+                }
+              });
+
+  changes.valid = true;
+}
+
+void IncrementalMapper::SetUpRigidMotions(
+    BundleAdjustmentConfig* ba_config) const {
+  for (const auto& rigid_motion : rigid_motions_) {
+    const image_t image_id = rigid_motion.first;
+    const image_t original = rigid_motion.second.first;
+    if (ba_config->HasImage(image_id) && ba_config->HasImage(original) &&
+        !ba_config->HasConstantPose(image_id) &&
+        !ba_config->HasConstantTvec(image_id)) {
+      ba_config->SetRigidMotion(image_id, original, rigid_motion.second.second);
+    }
+  }
+}
+
+IncrementalBundleAdjuster* IncrementalMapper::LocalBundleAdjuster(
+    const Options& options, const image_t image_id) {
+  if (!options.local_ba_reuse_problem) {
+    return nullptr;
+  }
+  auto& bundle_adjuster = local_bundle_adjusters_[image_id];
+  if (!bundle_adjuster) {
+    bundle_adjuster.reset(new IncrementalBundleAdjuster());
+  }
+  return bundle_adjuster.get();
+}
+
+size_t IncrementalMapper::SolveLocalBundle(
+    const BundleAdjustmentOptions& ba_options,
+    const BundleAdjustmentConfig& ba_config,
+    IncrementalBundleAdjuster* bundle_adjuster) {
+  TRACE_SCOPE("IncrementalMapper::SolveLocalBundle");
+  // The persistent problems do not support rigid motions.
+  if (bundle_adjuster != nullptr && ba_config.NumRigidMotions() == 0) {
+    if (!bundle_adjuster->Solve(ba_options, ba_config, reconstruction_)) {
+      return 0;
+    }
+    return bundle_adjuster->Summary().num_residuals / 2;
+  }
+
+  BundleAdjuster scratch_bundle_adjuster(ba_options, ba_config);
+  scratch_bundle_adjuster.Solve(reconstruction_);
+  return scratch_bundle_adjuster.Summary().num_residuals / 2;
+}
+
+void IncrementalMapper::RecordLocalBundleChanges(
+    const BundleAdjustmentConfig& ba_config) {
+  if (!reconstruction_->IsRecordingChanges()) {
+    return;
+  }
+  for (const image_t image_id : ba_config.Images()) {
+    reconstruction_->RecordImageChange(image_id);
+    for (const Point2D& point2D : reconstruction_->Image(image_id).Points2D()) {
+      if (point2D.HasPoint3D()) {
+        reconstruction_->RecordPoint3DChange(point2D.Point3DId());
+      }
+    }
+  }
+  for (const point3D_t point3D_id : ba_config.VariablePoints()) {
+    reconstruction_->RecordPoint3DChange(point3D_id);
+  }
+}
+
 std::vector<image_t> IncrementalMapper::FindLocalBundle(
     const Options& options, const image_t image_id) const {
   CHECK(options.Check());
@@ -1617,6 +2606,99 @@ std::vector<image_t> IncrementalMapper::FindLocalBundle(
   return image_ids;
 }
 
+void IncrementalMapper::UpdateNextImageRanking(const Options& options) {
+  std::function<float(const Image&)> rank_image_func;
+  switch (options.image_selection_method) {
+    case Options::ImageSelectionMethod::MAX_VISIBLE_POINTS_NUM:
+      rank_image_func = RankNextImageMaxVisiblePointsNum;
+      break;
+    case Options::ImageSelectionMethod::MAX_VISIBLE_POINTS_RATIO:
+      rank_image_func = RankNextImageMaxVisiblePointsRatio;
+      break;
+    case Options::ImageSelectionMethod::MIN_UNCERTAINTY:
+      rank_image_func = RankNextImageMinUncertainty;
+      break;
+  }
+
+  const auto UpdateRank = [this, &rank_image_func](const image_t image_id) {
+    const float rank = rank_image_func(reconstruction_->Image(image_id));
+    const auto it = next_image_ranks_.find(image_id);
+    if (it == next_image_ranks_.end()) {
+      next_image_ranks_.emplace(image_id, rank);
+    } else if (it->second != rank) {
+      next_image_ranking_.erase(std::make_pair(it->second, image_id));
+      it->second = rank;
+    } else {
+      return;
+    }
+    next_image_ranking_.emplace(rank, image_id);
+  };
+
+  if (options.image_selection_method != next_image_selection_method_) {
+    next_image_selection_method_ = options.image_selection_method;
+    next_image_ranks_.clear();
+    next_image_ranking_.clear();
+  }
+
+  // Images may be added to the reconstruction after it was set up.
+  if (next_image_ranks_.size() != reconstruction_->NumImages()) {
+    for (const auto& image : reconstruction_->Images()) {
+      if (next_image_ranks_.count(image.first) == 0) {
+        UpdateRank(image.first);
+      }
+    }
+  }
+
+  for (const image_t image_id : reconstruction_->VisibilityChangedImageIds()) {
+    UpdateRank(image_id);
+  }
+  reconstruction_->ClearVisibilityChangedImageIds();
+}
+
+std::vector<image_t> IncrementalMapper::RankNextImages(
+    const Options& options, const std::function<bool(const Image&)>& filter) {
+  UpdateNextImageRanking(options);
+
+  std::vector<image_t> ranked_images_ids;
+  std::vector<image_t> other_ranked_images_ids;
+
+  // The ranking is already sorted, so that images only need to be split into
+  // images that have not failed to register before and the other images.
+  for (const auto& ranked_image : next_image_ranking_) {
+    const image_t image_id = ranked_image.second;
+    const Image& image = reconstruction_->Image(image_id);
+
+    // Skip images that are already registered.
+    if (image.IsRegistered()) {
+      continue;
+    }
+
+    if (!filter(image)) {
+      continue;
+    }
+
+    // Only try registration for a certain maximum number of times.
+    const size_t num_reg_trials = num_reg_trials_[image_id];
+    if (num_reg_trials >= static_cast<size_t>(options.max_reg_trials)) {
+      continue;
+    }
+
+    // If image has been filtered or failed to register, place it in the
+    // second bucket and prefer images that have not been tried before.
+    if (filtered_images_.count(image_id) == 0 && num_reg_trials == 0) {
+      ranked_images_ids.push_back(image_id);
+    } else {
+      other_ranked_images_ids.push_back(image_id);
+    }
+  }
+
+  ranked_images_ids.insert(ranked_images_ids.end(),
+                           other_ranked_images_ids.begin(),
+                           other_ranked_images_ids.end());
+
+  return ranked_images_ids;
+}
+
 void IncrementalMapper::RegisterImageEvent(const image_t image_id) {
   size_t& num_regs_for_image = num_registrations_[image_id];
   num_regs_for_image += 1;
@@ -1646,6 +2728,20 @@ bool IncrementalMapper::EstimateInitialTwoViewGeometry(
     return true;
   }
 
+  TwoViewGeometry two_view_geometry;
+  if (EstimateInitialTwoViewGeometry(options, image_id1, image_id2,
+                                     &two_view_geometry)) {
+    prev_init_image_pair_id_ = image_pair_id;
+    prev_init_two_view_geometry_ = two_view_geometry;
+    return true;
+  }
+
+  return false;
+}
+
+bool IncrementalMapper::EstimateInitialTwoViewGeometry(
+    const Options& options, const image_t image_id1, const image_t image_id2,
+    TwoViewGeometry* two_view_geometry) const {
   const Image& image1 = database_cache_->Image(image_id1);
   const Camera& camera1 = database_cache_->Camera(image1.CameraId());
 
@@ -1656,40 +2752,138 @@ bool IncrementalMapper::EstimateInitialTwoViewGeometry(
   const std::vector<std::pair<point2D_t, point2D_t>>& corrs =
       scene_graph.FindCorrespondencesBetweenImages(image_id1, image_id2);
 
-  std::vector<Eigen::Vector2d> points1;
-  points1.reserve(image1.NumPoints2D());
-  for (const auto& point : image1.Points2D()) {
-    points1.push_back(point.XY());
+  const image_pair_t pair_id =
+      Database::ImagePairToPairId(image_id1, image_id2);
+
+  // Reuse the relative pose of a previous estimation, which only holds the
+  // pose and the statistics but no inlier matches.
+  InitialPairCache::Entry cache_entry;
+  size_t num_inliers;
+  if (init_pair_cache_ != nullptr &&
+      init_pair_cache_->Find(pair_id, options.init_max_error, corrs.size(),
+                             &cache_entry)) {
+    *two_view_geometry = TwoViewGeometry();
+    two_view_geometry->qvec = cache_entry.qvec;
+    two_view_geometry->tvec = cache_entry.tvec;
+    two_view_geometry->tri_angle = cache_entry.tri_angle;
+    num_inliers = cache_entry.num_inliers;
+  } else {
+    // The points are read from the out-of-core store if they were spilled.
+    std::vector<Eigen::Vector2d> points1;
+    points1.reserve(image1.NumPoints2D());
+    for (const auto& point : database_cache_->Points2D(image_id1)) {
+      points1.push_back(point.XY());
+    }
+
+    std::vector<Eigen::Vector2d> points2;
+    points2.reserve(image2.NumPoints2D());
+    for (const auto& point : database_cache_->Points2D(image_id2)) {
+      points2.push_back(point.XY());
+    }
+
+    FeatureMatches matches(corrs.size());
+    for (size_t i = 0; i < corrs.size(); ++i) {
+      matches[i].point2D_idx1 = corrs[i].first;
+      matches[i].point2D_idx2 = corrs[i].second;
+    }
+
+    TwoViewGeometry::Options two_view_geometry_options;
+    two_view_geometry_options.ransac_options.max_error =
+        options.init_max_error;
+    two_view_geometry_options.ransac_options.num_threads =
+        options.ransac_num_threads;
+    two_view_geometry->EstimateWithRelativePose(
+        camera1, points1, camera2, points2, matches, two_view_geometry_options);
+    num_inliers = two_view_geometry->inlier_matches.size();
+
+    if (init_pair_cache_ != nullptr) {
+      cache_entry.qvec = two_view_geometry->qvec;
+      cache_entry.tvec = two_view_geometry->tvec;
+      cache_entry.num_inliers = num_inliers;
+      cache_entry.tri_angle = two_view_geometry->tri_angle;
+      cache_entry.max_error = options.init_max_error;
+      cache_entry.num_correspondences = corrs.size();
+      init_pair_cache_->Insert(pair_id, cache_entry);
+    }
   }
 
-  std::vector<Eigen::Vector2d> points2;
-  points2.reserve(image2.NumPoints2D());
-  for (const auto& point : image2.Points2D()) {
-    points2.push_back(point.XY());
+  return static_cast<int>(num_inliers) >= options.init_min_num_inliers &&
+         std::abs(two_view_geometry->tvec.z()) <
+             options.init_max_forward_motion &&
+         two_view_geometry->tri_angle > DegToRad(options.init_min_tri_angle);
+}
+
+size_t IncrementalMapper::EstimateInitialTwoViewGeometries(
+    const Options& options,
+    const std::vector<std::pair<image_t, image_t>>& image_pairs) {
+  const size_t num_image_pairs = image_pairs.size();
+  std::vector<TwoViewGeometry> two_view_geometries(num_image_pairs);
+
+  // Index of the first passing candidate so far. The candidates after it
+  // cannot win anymore and are skipped.
+  std::atomic<size_t> winner(num_image_pairs);
+  const auto EstimateCandidate = [&](const size_t idx) {
+    if (idx > winner) {
+      return;
+    }
+    if (EstimateInitialTwoViewGeometry(options, image_pairs[idx].first,
+                                       image_pairs[idx].second,
+                                       &two_view_geometries[idx])) {
+      size_t prev_winner = winner;
+      while (idx < prev_winner &&
+             !winner.compare_exchange_weak(prev_winner, idx)) {
+      }
+    }
+  };
+
+  if (num_image_pairs > 1 && GetEffectiveNumThreads(options.num_threads) > 1) {
+    ThreadPool* thread_pool = WorkerPool(options.num_threads);
+    std::vector<std::future<void>> futures;
+    futures.reserve(num_image_pairs);
+    for (size_t idx = 0; idx < num_image_pairs; ++idx) {
+      futures.push_back(thread_pool->AddTask(EstimateCandidate, idx));
+    }
+    for (auto& future : futures) {
+      future.get();
+    }
+  } else {
+    for (size_t idx = 0; idx < num_image_pairs && winner == num_image_pairs;
+         ++idx) {
+      EstimateCandidate(idx);
+    }
   }
 
-  FeatureMatches matches(corrs.size());
-  for (size_t i = 0; i < corrs.size(); ++i) {
-    matches[i].point2D_idx1 = corrs[i].first;
-    matches[i].point2D_idx2 = corrs[i].second;
+  const size_t num_tried = std::min(winner.load() + 1, num_image_pairs);
+  for (size_t idx = 0; idx < num_tried; ++idx) {
+    init_image_pairs_.insert(Database::ImagePairToPairId(
+        image_pairs[idx].first, image_pairs[idx].second));
   }
 
-  TwoViewGeometry two_view_geometry;
-  TwoViewGeometry::Options two_view_geometry_options;
-  two_view_geometry_options.ransac_options.max_error = options.init_max_error;
-  two_view_geometry.EstimateWithRelativePose(
-      camera1, points1, camera2, points2, matches, two_view_geometry_options);
-
-  if (static_cast<int>(two_view_geometry.inlier_matches.size()) >=
-          options.init_min_num_inliers &&
-      std::abs(two_view_geometry.tvec.z()) < options.init_max_forward_motion &&
-      two_view_geometry.tri_angle > DegToRad(options.init_min_tri_angle)) {
-    prev_init_image_pair_id_ = image_pair_id;
-    prev_init_two_view_geometry_ = two_view_geometry;
-    return true;
+  if (winner < num_image_pairs) {
+    prev_init_image_pair_id_ = Database::ImagePairToPairId(
+        image_pairs[winner].first, image_pairs[winner].second);
+    prev_init_two_view_geometry_ = two_view_geometries[winner];
   }
 
-  return false;
+  return winner;
+}
+
+ThreadPool* IncrementalMapper::WorkerPool(const int num_threads) {
+  const int num_eff_threads = GetEffectiveNumThreads(num_threads);
+  if (!thread_pool_ ||
+      static_cast<int>(thread_pool_->NumThreads()) != num_eff_threads) {
+    thread_pool_.reset(new ThreadPool(num_eff_threads));
+  }
+  return thread_pool_.get();
+}
+
+IncrementalTriangulator::Options IncrementalMapper::TriangulatorOptions(
+    const IncrementalTriangulator::Options& tri_options) {
+  IncrementalTriangulator::Options options = tri_options;
+  if (GetEffectiveNumThreads(options.num_threads) > 1) {
+    options.thread_pool = WorkerPool(options.num_threads);
+  }
+  return options;
 }
 
 std::vector<cam_s> load_cams()
@@ -1764,7 +2958,7 @@ std::vector<cam_s> load_cams()
 
 }
 
-int count_takes(std::vector<cam_s> C)
+int count_takes(const std::vector<cam_s>& C)
 {
 	int ret = 0;
 	for(unsigned int i=0;i<C.size();i++)
@@ -1775,223 +2969,268 @@ int count_takes(std::vector<cam_s> C)
 	return ret;
 }
 
-std::vector<basis_t> find_bases(std::vector<cam_s> C)
+std::vector<basis_t> find_bases(const std::vector<cam_s>& C, int max_num_threads)
 {
 	std::cout << "Finding Bases\n";
-	std::vector<basis_t> ret;
+	//indices of the cameras of every image, in increasing order
+	std::unordered_map<int, std::vector<int>> by_id;
 	for(unsigned int i=0;i<C.size();i++)
-	{
-		//check if the cam is from anchor take
-		cam_s c1 = C[i];
-		if(c1.anchor != c1.second)
-			continue;
-		Eigen::Matrix3d R1 = c1.R;
-		//Eigen::Vector3d C1 = (-R1.transpose()) * c1.t;
-		//cout << c1.t << "\n";
-		for(unsigned int j=0;j<C.size();j++)
-		{
-			cam_s c2 = C[j];
-			if(c1.id != c2.id || c1.anchor == c2.anchor)
+		by_id[C[i].id].push_back(i);
+
+	//the bases of every anchor camera are collected separately and
+	//concatenated in camera order, so the result does not depend on the
+	//number of threads
+	std::vector<std::vector<basis_t>> found(C.size());
+	auto bases_of = [&C, &by_id, &found](const int first, const int step) {
+		for(unsigned int i=first;i<C.size();i+=step)
+		{
+			//check if the cam is from anchor take
+			const cam_s& c1 = C[i];
+			if(c1.anchor != c1.second)
 				continue;
-			Eigen::Matrix3d R2 = c2.R;
-			//Eigen::Vector3d C2 = (-R2.transpose()) * c2.t;
-			Eigen::Matrix3d A = R2.transpose() * R1;
-			//cout << c1.anchor << " " << c2.anchor << "\n";
-			//cout << A << "\n\n";
-			//cout << R2 << "\n\n" << R2.transpose() << "\n\n\n";
-			basis_t nb;
-			nb.init = c1.anchor;
-			nb.final = c2.anchor;
-			nb.cam_id = c1.id;
-			
-			if(c1.anchor < c2.anchor)
-			{
-				nb.c1 = i;
-				nb.c2 = j;
-				nb.A = A;
-			}
-			else
+			for(const int j : by_id.at(c1.id))
 			{
-				nb.c1 = j;
-				nb.c2 = i;
-				nb.A = A.transpose();
+				const cam_s& c2 = C[j];
+				if(c1.anchor == c2.anchor)
+					continue;
+				const Eigen::Matrix3d A = c2.R.transpose() * c1.R;
+				basis_t nb;
+				nb.init = c1.anchor;
+				nb.final = c2.anchor;
+				nb.cam_id = c1.id;
+				
+				if(c1.anchor < c2.anchor)
+				{
+					nb.c1 = i;
+					nb.c2 = j;
+					nb.A = A;
+				}
+				else
+				{
+					nb.c1 = j;
+					nb.c2 = i;
+					nb.A = A.transpose();
+				}
+				found[i].push_back(nb);
 			}
-			ret.push_back(nb);
 		}
+	};
+
+	//small logs are not worth starting the threads
+	const int kMinNumCamsPerThread = 1024;
+	const int num_threads = std::min(GetEffectiveNumThreads(max_num_threads), std::max(1, static_cast<int>(C.size()) / kMinNumCamsPerThread));
+	if(num_threads == 1)
+		bases_of(0, 1);
+	else
+	{
+		ParallelFor(0, num_threads, [&](const int t) { bases_of(t, num_threads); });
 	}
-	
+
+	std::vector<basis_t> ret;
+	for(unsigned int i=0;i<found.size();i++)
+		ret.insert(ret.end(), found[i].begin(), found[i].end());
 	return ret;
 }
 
+//the acos of the old conversion lost all precision near the identity and
+//returned zero at 180 degrees
 Eigen::Vector3d r2a(Eigen::Matrix3d R)
 {
-	Eigen::Vector3d ret;
+	return RotationMatrixToAngleAxis(R);
+}
+
+Eigen::Matrix3d a2r(Eigen::Vector3d a)
+{
+	return AngleAxisToRotationMatrix(a);
+}
+
+namespace {
 
-	double phi = acos(0.5 * (R.trace() - 1));
-	Eigen::Vector3d r;
-	r(0) = R(2,1) - R(1,2);
-	r(1) = R(0,2) - R(2,0);
-	r(2) = R(1,0) - R(0,1);
-	//cout << r << "\n\n";
-	//cout << sin(phi) << "\n";
-	if(sin(phi) == 0)
+//hypothesis of the exhaustive consensus searches, given by the indices of its
+//minimal sample and the size of its support
+struct hypothesis_t
+{
+	int count = 0;
+	int i = -1;
+	int j = -1;
+};
+
+//runs search(i, &best) for the hypotheses i=0..n-1, interleaved over the
+//threads, where search updates best with the hypotheses of sample i that have
+//a strictly larger support. Ties are resolved towards the first sample, so
+//the result is the same as the one of a serial search.
+template <typename Search>
+hypothesis_t exhaustive_search(const int n, const Search& search, const int max_num_threads)
+{
+	//small groups are not worth starting the threads
+	const int kMinNumSamplesPerThread = 16;
+	const int num_threads = std::min(GetEffectiveNumThreads(max_num_threads), std::max(1, n / kMinNumSamplesPerThread));
+	vector<hypothesis_t> best(num_threads);
+	auto samples = [n, num_threads, &search, &best](const int t) {
+		for(int i=t;i<n;i+=num_threads)
+			search(i, &best[t]);
+	};
+	if(num_threads == 1)
+		samples(0);
+	else
 	{
-		ret(0) = 0;
-		ret(1) = 0;
-		ret(2) = 0;
+		ParallelFor(0, num_threads, [&](const int t) { samples(t); });
 	}
-	else
+
+	hypothesis_t ret;
+	for(const hypothesis_t& h : best)
 	{
-		ret = r/sin(phi);
-		//cout << "RET " << ret << "\n\n";
+		if(h.count > ret.count || (h.count == ret.count && h.count > 0 && std::make_pair(h.i, h.j) < std::make_pair(ret.i, ret.j)))
+			ret = h;
 	}
-	ret = 0.5 * phi * ret;
-	//cout << "RET2 " << ret <<  "\n\n";
 	return ret;
 }
 
-Eigen::Matrix3d a2r(Eigen::Vector3d a)
+//groups the bases or motions by their unordered pair of takes, the groups are
+//in the order of their first elements
+template <typename T>
+std::vector<std::vector<T>> group_by_takes(const std::vector<T>& B)
 {
-	Eigen::Matrix3d ret;
-	if( a(0) == 0 && a(1) == 0 && a(2) == 0 )
+	std::vector<std::vector<T>> ret;
+	std::map<std::pair<int, int>, int> groups;
+	for(const T& b : B)
 	{
-		ret.setIdentity();
-		return ret;
+		const std::pair<int, int> takes(std::min(b.init, b.final), std::max(b.init, b.final));
+		const auto it = groups.emplace(takes, ret.size()).first;
+		if(it->second == (int)ret.size())
+			ret.emplace_back();
+		ret[it->second].push_back(b);
 	}
-	double phi = a.norm();
-	double v1 = a(0)/phi;
-	double v2 = a(1)/phi;
-	double v3 = a(2)/phi;
-
-	Eigen::Matrix3d R1;
-	R1 << v1*v1, v1*v2, v1*v3, v2*v1, v2*v2, v2*v3, v3*v1, v3*v2, v3*v3;
-	R1 = (1-cos(phi)) * R1;
-	Eigen::Matrix3d R2;
-	R2.setIdentity();
-	R2 = cos(phi) * R2;
-	Eigen::Matrix3d R3;
-	R3 << 0, -v3, v2, v3, 0, -v1, -v2, v1, 0;
-	R3 = sin(phi) * R3;
-	ret = R1 + R2 + R3;
 	return ret;
 }
 
-vector<vector<basis_t>> ransac_bases(std::vector<basis_t> G, std::vector<cam_s> C, double sigma)
+//clusters every group with cluster(group), the groups are independent of each
+//other and run as parallel tasks, which split their own searches further.
+//The clusters are stored in the order of the groups
+template <typename T, typename Cluster>
+std::vector<std::vector<std::vector<T>>> cluster_groups(const std::vector<std::vector<T>>& G, const Cluster& cluster, const int max_num_threads)
+{
+	std::vector<std::vector<std::vector<T>>> ret(G.size());
+	auto cluster_group = [&G, &cluster, &ret](const int n) {
+		VLOG(4) << "Motion " << n+1;
+		VLOG(4) << G[n].size();
+		ret[n] = cluster(G[n]);
+	};
+	if(GetEffectiveNumThreads(max_num_threads) == 1)
+	{
+		for(unsigned int n=0;n<G.size();n++)
+			cluster_group(n);
+	}
+	else
+		ParallelFor(0, G.size(), cluster_group);
+	return ret;
+}
+
+}  // namespace
+
+vector<vector<basis_t>> ransac_bases(const std::vector<basis_t>& G, const std::vector<cam_s>& C, double sigma, int max_num_threads)
 {
 	vector<vector<basis_t>> ret;
 	vector<bool> grouped = vector<bool>(G.size(), 0);
 	int cl = 0;
+	//the condition here does not have to bee too strong, as passing it would lead only to longer evaluation but not to errors
+	const double max_angle = sigma * 5 * 0.0247;
+
+	//the camera centers and relative rotations of the bases do not depend on
+	//the hypothesis
+	vector<Eigen::Vector3d> c3s(G.size());
+	vector<Eigen::Vector3d> c4s(G.size());
+	vector<Eigen::Matrix3d> R34s(G.size());
+	for(unsigned int k=0;k<G.size();k++)
+	{
+		const cam_s& cam3 = C[G[k].c1];
+		const cam_s& cam4 = C[G[k].c2];
+		c3s[k] = -cam3.R.transpose() * cam3.t;
+		c4s[k] = -cam4.R.transpose() * cam4.t;
+		R34s[k] = cam4.R.transpose() * cam3.R;
+	}
+
+	//translation hypothesis of the bases i and j, false if their rotations
+	//are not consistent
+	auto hypothesis = [&G, &C, max_angle](const int i, const int j, Eigen::Vector4d* x) {
+		const Eigen::Matrix3d R = G[j].A * G[i].A.transpose();
+		if(r2a(R).norm() > max_angle)
+			return false;
+
+		Eigen::MatrixXd A(6, 4);
+		A << C[G[i].c2].R, -C[G[i].c1].t, C[G[j].c2].R, -C[G[j].c1].t;
+		Eigen::MatrixXd b(6, 1);
+		b << -C[G[i].c2].t, -C[G[j].c2].t;
+		*x = A.colPivHouseholderQr().solve(b);
+		return true;
+	};
+
+	//number of ungrouped bases consistent with the hypothesis x of basis i,
+	//which are flagged in inliers if given
+	auto support = [&G, &C, &grouped, &c3s, &c4s, &R34s, sigma](const int i, const Eigen::Vector4d& x, vector<bool>* inliers) {
+		const Eigen::Matrix3d& R1 = G[i].A;
+		int count = 0;
+		for(unsigned int k=0;k<G.size();k++)
+		{
+			if(grouped[k]) continue;
+			//rotational consistency
+			const Eigen::Matrix3d R134 = R1 * R34s[k].transpose();
+			if(r2a(R134).norm() > 5*sigma*0.0247)
+				continue;
+
+			//translational consistency
+			const Eigen::Vector3d c3_trans = x(3) * R1 * c3s[k] + x.head<3>();
+			const Eigen::Vector3d& point = C[G[k].c2].center;
+			const Eigen::Vector3d v1 = c3_trans - point;
+			const Eigen::Vector3d v2 = c4s[k] - point;
+			const double angle = (v1.dot(v2))/(v1.norm() * v2.norm());
+
+			if(angle >= 0.99)
+			{
+				if(inliers)
+					(*inliers)[k] = 1;
+				count++;
+			}
+		}
+		return count;
+	};
 
 	while(1)
 	{
 		cl++;
-		cout << "CLUSTER " << cl << "\n";
-		vector<bool> best = vector<bool>(G.size(), 0);
-		int best_count = 0;
-		for(unsigned int i=0;i<G.size();i++)
-		{
-			if(grouped[i]) continue;
-			Eigen::Matrix3d R1 = G[i].A;
-			//variables necessary to compute translation
-			Eigen::Vector3d ts1 = C[G[i].c1].t;
-			Eigen::Matrix3d Rt1 = C[G[i].c2].R;
-			Eigen::Vector3d tt1 = C[G[i].c2].t;
-			Eigen::MatrixXd A1(3, 4);
-			A1 << Rt1, -ts1;
-			//cout << A1 << "\n\n";
-
+		VLOG(4) << "CLUSTER " << cl;
+		const hypothesis_t best = exhaustive_search(G.size(), [&G, &grouped, &hypothesis, &support](const int i, hypothesis_t* best) {
+			if(grouped[i]) return;
 			for(unsigned int j=i+1;j<G.size();j++)
 			{
 				if(grouped[j]) continue;
-				Eigen::Matrix3d R2 = G[j].A;
-				//variables necessary to compute translation
-				Eigen::Vector3d ts2 = C[G[j].c1].t;
-				Eigen::Matrix3d Rt2 = C[G[j].c2].R;
-				Eigen::Vector3d tt2 = C[G[j].c2].t;
-				Eigen::MatrixXd A2(3, 4);
-				A2 << Rt2, -ts2;
-
-				Eigen::Matrix3d R = R2 * R1.transpose();
-				Eigen::Vector3d k3 = r2a(R);
-				double n = k3.norm();
-
-				//cout << R << "\n\n";
-				//cout << k3 << "\n\n";
-				//cout << n << "\n\n";
-
-				//the condition here does not have to bee too strong, as passing it would lead only to longer evaluation but not to errors
-				if(n > sigma * 5 * 0.0247)
-				{
+				Eigen::Vector4d x;
+				if(!hypothesis(i, j, &x))
 					continue;
-				}
-
-				//compute the translation hypothesis
-				Eigen::MatrixXd A(6, 4);
-				A << A1, A2;
-				Eigen::MatrixXd b(6, 1);
-				b << -tt1, -tt2;
-				Eigen::Vector4d x = A.colPivHouseholderQr().solve(b);
-
-				//cout << x << "\n\n";
-
-				//check the inliers
-				vector<bool> inliers = vector<bool>(G.size(), 0);
-				int count = 0;
-				for(unsigned int k=0;k<G.size();k++)
+				const int count = support(i, x, nullptr);
+				if(count > best->count)
 				{
-					if(grouped[k]) continue;
-					Eigen::Matrix3d R3 = C[G[k].c1].R;
-					Eigen::Vector3d t3 = C[G[k].c1].t;
-					Eigen::Vector3d c3 = -R3.transpose() * t3;
-
-					Eigen::Vector3d c3t;
-					c3t(0) = x(0);
-					c3t(1) = x(1);
-					c3t(2) = x(2);
-					Eigen::Vector3d c3_trans = x(3) * R1 * c3 + c3t;
-
-					Eigen::Matrix3d R4 = C[G[k].c2].R;
-					Eigen::Vector3d t4 = C[G[k].c2].t;
-					Eigen::Vector3d c4 = -R4.transpose() * t4;
-
-					//rotational consistency
-					Eigen::Matrix3d R34 = R4.transpose() * R3;
-					Eigen::Matrix3d R134 = R1 * R34.transpose();
-					Eigen::Vector3d a34 = r2a(R134);
-					//cout << "R" << a34.norm() << "\n";
-					if(a34.norm() > 5*sigma*0.0247)
-						continue;
-
-					//translational consistency
-					Eigen::Vector3d point = C[G[k].c2].center;
-					Eigen::Vector3d v1 = c3_trans - point;
-					Eigen::Vector3d v2 = c4 - point;
-					double angle = (v1.dot(v2))/(v1.norm() * v2.norm());
-
-					if(angle >= 0.99)
-					{
-						inliers[k] = 1;
-						count++;
-					}
-				
+					best->count = count;
+					best->i = i;
+					best->j = j;
 				}
-				if(count > best_count)
-				{
-					best = inliers;
-					best_count = count;
-				}			
 			}
-		}
+		}, max_num_threads);
 
-		cout << "size " << best_count << "\n";
-		if(best_count == 0)
+		VLOG(4) << "size " << best.count;
+		if(best.count == 0)
 			break;
 
-		vector<basis_t> ND = vector<basis_t>(best_count);
+		vector<bool> inliers = vector<bool>(G.size(), 0);
+		Eigen::Vector4d x;
+		hypothesis(best.i, best.j, &x);
+		support(best.i, x, &inliers);
+
+		vector<basis_t> ND = vector<basis_t>(best.count);
 		int j=0;
 		for(unsigned int i=0;i<G.size();i++)
 		{
-			if(best[i])
+			if(inliers[i])
 			{
 				ND[j] = G[i];
 				j++;
@@ -1999,503 +3238,437 @@ vector<vector<basis_t>> ransac_bases(std::vector<basis_t> G, std::vector<cam_s>
 			}
 		}
 		ret.push_back(ND);
-		if(G.size() == (unsigned int)best_count) break;
+		if(G.size() == (unsigned int)best.count) break;
 	}
 
 	return ret;
 }
 
-std::vector<std::vector<std::vector<basis_t>>> divide_bases(std::vector<basis_t> B, std::vector<cam_s> C, double sigma)
+std::vector<std::vector<std::vector<basis_t>>> divide_bases(const std::vector<basis_t>& B, const std::vector<cam_s>& C, double sigma, int max_num_threads)
 {
-	std::vector<std::vector<std::vector<basis_t>>> ret;
 	cout << "Clustering bases\n";
-	int n=0;
-	vector<bool> grouped = vector<bool>(B.size(), 0);
-	while(1)
+	//cluster the camera pairs of every pair of takes
+	return cluster_groups(group_by_takes(B), [&C, sigma, max_num_threads](const vector<basis_t>& GR) {
+		return ransac_bases(GR, C, sigma, max_num_threads);
+	}, max_num_threads);
+}
+
+//the coordinate-wise median, the upper one of an even number of elements,
+//selected in place in one buffer for all coordinates
+template <typename vector_t, typename scalar_t>
+vector_t coordinate_median(const std::vector<vector_t>& CL)
+{
+	vector_t ret;
+	std::vector<scalar_t> v(CL.size());
+	for(int i=0;i<3;i++)
 	{
-		n++;
-		cout << "Motion " << n << "\n";
-		vector<basis_t> GR;
-		int init = -1;
-		int final = -1;
-		//find the group corresponding to the new motion
-		for(unsigned int i=0;i<B.size();i++)
+		for(unsigned int j=0;j<CL.size();j++)
 		{
-			if(GR.size() == 0 && !grouped[i])
-			{
-				init = B[i].init;
-				final = B[i].final;
-				grouped[i] = 1;
-				basis_t nb = B[i];
-				GR.push_back(nb);
-			}
-			else if(!grouped[i] && ( (B[i].init == init && B[i].final == final ) || (B[i].init == final && B[i].final == init) ))
-			{
-				grouped[i] = 1;
-				basis_t nb = B[i];
-				GR.push_back(nb);
-			}
+			v[j] = CL[j](i);
 		}
-		if(GR.size() == 0)
-			break;
-		cout << GR.size() << "\n";
-
-		//cluster the camera pairs in the group
-		vector<vector<basis_t>> CL = ransac_bases(GR, C, sigma);
-		ret.push_back(CL);
+		ret(i) = NthElement(&v, CL.size()/2);
 	}
-	
 	return ret;
 }
 
-double med(std::vector<double> v, int first, int last, int desired)
+Eigen::Vector3d median(const std::vector<Eigen::Vector3d>& CL)
 {
-	if(first == last)
-		return v[first];
-	double pivot = v[first];
-	int low = first+1;
-	int high = last;
-	while(1)
-	{
-		while(v[low] <= pivot && low <= last) low++;
-		while(v[high] >= pivot && high >= first) high--;
-		if(low >= high) break;
-		double bz = v[low];
-		v[low] = v[high];
-		v[high] = bz;
-	}
-	if(desired >= first && desired < high)
-		return med(v, first+1, high, desired+1);
-	if(desired >= low && desired <= last)
-		return med(v, low, last, desired);
-	return pivot;
+	return coordinate_median<Eigen::Vector3d, double>(CL);
 }
 
-int med(std::vector<int> v, int first, int last, int desired)
+Eigen::Vector3ub median(const std::vector<Eigen::Vector3ub>& CL)
 {
-	if(first == last)
-		return v[first];
-	int pivot = v[first];
-	int low = first+1;
-	int high = last;
-	while(1)
-	{
-		while(v[low] <= pivot && low <= last) low++;
-		while(v[high] >= pivot && high >= first) high--;
-		if(low >= high) break;
-		int bz = v[low];
-		v[low] = v[high];
-		v[high] = bz;
-	}
-	if(desired >= first && desired < high)
-		return med(v, first+1, high, desired+1);
-	if(desired >= low && desired <= last)
-		return med(v, low, last, desired);
-	return pivot;
+	return coordinate_median<Eigen::Vector3ub, int>(CL);
 }
 
-Eigen::Vector3d median(std::vector<Eigen::Vector3d> CL)
+Eigen::Vector3i median(const std::vector<Eigen::Vector3i>& CL)
 {
-	Eigen::Vector3d ret;
-	//double * v = malloc(sizeof(double) * CL.size());
-	std::vector<double> v = vector<double>(CL.size());
-	for(int i=0;i<3;i++)
-	{
-		for(unsigned int j=0;j<CL.size();j++)
-		{
-			v[j] = CL[j](i);
-		}
-		double m = med(v, 0, CL.size()-1, CL.size()/2);
-		ret(i) = m;
-	}
-	return ret;
+	return coordinate_median<Eigen::Vector3i, int>(CL);
 }
 
-Eigen::Vector3i median(std::vector<Eigen::Vector3i> CL)
+//median of the angle-axis rotations of a cluster, the geometric median is
+//robust to outliers in any direction instead of in every axis
+Eigen::Vector3d rotation_median(const std::vector<Eigen::Vector3d>& R, bool geometric)
 {
-	Eigen::Vector3i ret;
-	//double * v = malloc(sizeof(double) * CL.size());
-	std::vector<int> v = vector<int>(CL.size());
-	for(int i=0;i<3;i++)
-	{
-		for(unsigned int j=0;j<CL.size();j++)
-		{
-			v[j] = CL[j](i);
-		}
-		double m = med(v, 0, CL.size()-1, CL.size()/2);
-		ret(i) = m;
-	}
-	return ret;
+	const Eigen::Vector3d ret = median(R);
+	if(!geometric)
+		return ret;
+	return GeometricMedian(R, ret);
 }
 
-std::vector<std::vector<clust_b>> meanclust(std::vector<std::vector<std::vector<basis_t>>> C, std::vector<cam_s> cams)
+std::vector<std::vector<clust_b>> meanclust(const std::vector<std::vector<std::vector<basis_t>>>& C, const std::vector<cam_s>& cams, bool geometric_rotations, int max_num_threads)
 {
 	cout << "Meanclust\n";
-	std::vector<std::vector<clust_b>> ret;
+	std::vector<std::vector<clust_b>> ret(C.size());
+	std::vector<std::pair<int, int>> clusters;
 	for(unsigned int i=0;i<C.size();i++)
 	{
-		std::vector<clust_b> r;
+		ret[i].resize(C[i].size());
 		for(unsigned int j=0;j<C[i].size();j++)
-		{
-			vector<basis_t> cl = C[i][j];
-			vector<Eigen::Vector3d> R = vector<Eigen::Vector3d>(cl.size());
-			Eigen::MatrixXd A;
-			Eigen::MatrixXd b;
-			Eigen::MatrixXd E;
-			Eigen::MatrixXd f;
-			
-			for(unsigned int k=0;k<cl.size();k++)
-			{
-				R[k] = r2a(cl[k].A);
-				//cout << r2a(cl[k].A) << "\n\n";
-				Eigen::Vector3d ts1 = cams[cl[k].c1].t;
-				Eigen::Matrix3d Rt1 = cams[cl[k].c2].R;
-				Eigen::Vector3d tt1 = cams[cl[k].c2].t;
-
-				Eigen::MatrixXd A1(3, 4);
-				A1 << Rt1, -ts1;
-				Eigen::Vector3d b1 = -tt1;
-
-				Eigen::Vector3d ts2 = cams[cl[k].c2].t;
-				Eigen::Matrix3d Rt2 = cams[cl[k].c1].R;
-				Eigen::Vector3d tt2 = cams[cl[k].c1].t;
-
-				Eigen::MatrixXd A2(3, 4);
-				A2 << Rt2, -ts2;
-				Eigen::Vector3d b2 = -tt2;
-
-				if(k==0)
-				{
-					A = A1;
-					b = b1;
-					E = A2;
-					f = b2;
-				}
-				else
-				{
-					Eigen::MatrixXd nA = Eigen::MatrixXd(3*(k+1), 4);
-					nA << A, A1;
-					A = nA;
-					Eigen::MatrixXd nb = Eigen::MatrixXd(3*(k+1), 1);
-					nb << b, b1;
-					b = nb;
-					Eigen::MatrixXd nE = Eigen::MatrixXd(3*(k+1), 4);
-					nE << E, A2;
-					E = nE;
-					Eigen::MatrixXd nf = Eigen::MatrixXd(3*(k+1), 1);
-					nf << f, b2;
-					f = nf;
-				}
-			}
-			Eigen::Vector3d MR = median(R);
-			Eigen::Vector4d x = A.colPivHouseholderQr().solve(b);
-			Eigen::Vector4d x2 = E.colPivHouseholderQr().solve(f);
-			//cout << "MEDIAN " << MR << "\n\n\n\n";
-			//cout << x << "\n\n";
-			clust_b nc;
-			nc.size = cl.size();
-			if(cl[0].init < cl[0].final)
-			{
-				nc.init = cl[0].init;
-				nc.final = cl[0].final;
-			}
-			else
-			{
-				nc.final = cl[0].init;
-				nc.init = cl[0].final;
-			}
-			nc.R = a2r(MR);
-			
-			Eigen::Vector3d mt;
-			mt(0) = x(0);
-			mt(1) = x(1);
-			mt(2) = x(2);
-			nc.t1 = mt;
-			nc.sigma1 = x(3);
+			clusters.emplace_back(i, j);
+	}
+
+	//the clusters are independent of each other
+	auto mean_cluster = [&](const int c)
+	{
+		const vector<basis_t>& cl = C[clusters[c].first][clusters[c].second];
+		vector<Eigen::Vector3d> R = vector<Eigen::Vector3d>(cl.size());
+		Eigen::MatrixXd A(3*cl.size(), 4);
+		Eigen::MatrixXd b(3*cl.size(), 1);
+		Eigen::MatrixXd E(3*cl.size(), 4);
+		Eigen::MatrixXd f(3*cl.size(), 1);
+		
+		for(unsigned int k=0;k<cl.size();k++)
+		{
+			R[k] = r2a(cl[k].A);
+			Eigen::Vector3d ts1 = cams[cl[k].c1].t;
+			Eigen::Matrix3d Rt1 = cams[cl[k].c2].R;
+			Eigen::Vector3d tt1 = cams[cl[k].c2].t;
+
+			A.block<3, 3>(3*k, 0) = Rt1;
+			A.block<3, 1>(3*k, 3) = -ts1;
+			b.block<3, 1>(3*k, 0) = -tt1;
 
-			Eigen::Vector3d mt2;
-			mt2(0) = x2(0);
-			mt2(1) = x2(1);
-			mt2(2) = x2(2);
-			nc.t2 = mt2;
-			nc.sigma2 = x2(3);
+			Eigen::Vector3d ts2 = cams[cl[k].c2].t;
+			Eigen::Matrix3d Rt2 = cams[cl[k].c1].R;
+			Eigen::Vector3d tt2 = cams[cl[k].c1].t;
 
-			r.push_back(nc);
+			E.block<3, 3>(3*k, 0) = Rt2;
+			E.block<3, 1>(3*k, 3) = -ts2;
+			f.block<3, 1>(3*k, 0) = -tt2;
+		}
+		Eigen::Vector3d MR = rotation_median(R, geometric_rotations);
+		Eigen::Vector4d x = A.colPivHouseholderQr().solve(b);
+		Eigen::Vector4d x2 = E.colPivHouseholderQr().solve(f);
+		clust_b& nc = ret[clusters[c].first][clusters[c].second];
+		nc.size = cl.size();
+		if(cl[0].init < cl[0].final)
+		{
+			nc.init = cl[0].init;
+			nc.final = cl[0].final;
 		}
-		ret.push_back(r);
+		else
+		{
+			nc.final = cl[0].init;
+			nc.init = cl[0].final;
+		}
+		nc.R = a2r(MR);
+		nc.t1 = x.head<3>();
+		nc.sigma1 = x(3);
+		nc.t2 = x2.head<3>();
+		nc.sigma2 = x2(3);
+	};
+
+	if(GetEffectiveNumThreads(max_num_threads) == 1)
+	{
+		for(unsigned int c=0;c<clusters.size();c++)
+			mean_cluster(c);
 	}
+	else
+		ParallelFor(0, clusters.size(), mean_cluster);
 
 	return ret;
 }
 
-std::vector<cycle_3> find3cycles(std::vector<std::vector<clust_b>> M)
+namespace {
+
+//enumerates the 3-cycles of motion clusters i: a->b, j: b->c, k: a->c and
+//passes every one to score. The cycles with a negative score are dropped, the
+//others are appended to cycles and their scores to scores. The pairs of takes
+//are indexed by their first take and by both takes, so only the clusters which
+//close a cycle are visited. The first clusters are interleaved over the
+//threads with one output slot each, so the cycles are in the order of the
+//nested loops over all pairs of takes.
+template <typename Score>
+void enumerate3cycles(const std::vector<std::vector<clust_b>>& M, const Score& score, std::vector<cycle_3> * cycles, std::vector<double> * scores, const int max_num_threads)
 {
-	std::vector<cycle_3> ret;
+	std::unordered_map<int, std::vector<int>> from;
+	std::map<std::pair<int, int>, std::vector<int>> between;
 	for(unsigned int i=0;i<M.size();i++)
 	{
 		if(!M[i].size()) continue;
-		for(unsigned int j=0;j<M.size();j++)
+		from[M[i][0].init].push_back(i);
+		between[std::make_pair(M[i][0].init, M[i][0].final)].push_back(i);
+	}
+
+	std::vector<std::vector<cycle_3>> found(M.size());
+	std::vector<std::vector<double>> found_scores(M.size());
+	auto cycles_of = [&M, &score, &from, &between, &found, &found_scores](const int t, const int num_threads) {
+		for(unsigned int i=t;i<M.size();i+=num_threads)
 		{
-			if(!M[j].size()) continue;
-			if(M[i][0].final != M[j][0].init) continue;
-			for(unsigned int k=0;k<M.size();k++)
+			if(!M[i].size()) continue;
+			const auto next = from.find(M[i][0].final);
+			if(next == from.end()) continue;
+			for(const int j : next->second)
 			{
-				if(!M[k].size()) continue;
-				if(M[i][0].init != M[k][0].init || M[j][0].final != M[k][0].final) continue;
-				//cout << M[i][0].init << " " << M[i][0].final << " " << M[j][0].final << "\n";
-				for(unsigned int a=0;a<M[i].size();a++)
+				const auto close = between.find(std::make_pair(M[i][0].init, M[j][0].final));
+				if(close == between.end()) continue;
+				for(const int k : close->second)
 				{
-					Eigen::Matrix3d R12 = M[i][a].R;
-					Eigen::Vector3d o12 = M[i][a].t1;
-					double s12 = M[i][a].sigma1;
-					for(unsigned int b=0;b<M[j].size();b++)
+					for(unsigned int a=0;a<M[i].size();a++)
 					{
-						Eigen::Matrix3d R23 = M[j][b].R;
-						Eigen::Vector3d o23 = M[j][b].t1;
-						double s23 = M[j][b].sigma1;
-						for(unsigned int c=0;c<M[k].size();c++)
+						const Eigen::Matrix3d& R12 = M[i][a].R;
+						const Eigen::Vector3d& o12 = M[i][a].t1;
+						double s12 = M[i][a].sigma1;
+						for(unsigned int b=0;b<M[j].size();b++)
 						{
-							Eigen::Matrix3d R31 = M[k][c].R.transpose();
-							Eigen::Vector3d o31 = M[k][c].t2;
-							double s31 = M[i][a].sigma2;
-
-							Eigen::Vector3d ev = r2a(R31 * R23 * R12);
-							double i1 = ev.norm();
-
-							double i2 = s12 * s23 * s31;
-
-							Eigen::Vector3d i3 = s31*s23*R31*R23*o12 + s31*R31*o23 + o31;
-							//cout << R31 * R23 * R12 << "\n\n";
-							//cout << ev.norm() << "\n\n";
-							
-							cycle_3 ncl;
-							ncl.t1 = i;
-							ncl.cl1 = a;
-							ncl.t2 = j;
-							ncl.cl2 = b;
-							ncl.t3 = k;
-							ncl.cl3 = c;
-
-							ncl.i1 = i1;
-							ncl.i2 = i2;
-							ncl.i3 = i3;
-
-							ret.push_back(ncl);
+							const Eigen::Matrix3d& R23 = M[j][b].R;
+							const Eigen::Vector3d& o23 = M[j][b].t1;
+							double s23 = M[j][b].sigma1;
+							const Eigen::Matrix3d R23_12 = R23 * R12;
+							for(unsigned int c=0;c<M[k].size();c++)
+							{
+								Eigen::Matrix3d R31 = M[k][c].R.transpose();
+								const Eigen::Vector3d& o31 = M[k][c].t2;
+								double s31 = M[i][a].sigma2;
+
+								cycle_3 ncl;
+								ncl.t1 = i;
+								ncl.cl1 = a;
+								ncl.t2 = j;
+								ncl.cl2 = b;
+								ncl.t3 = k;
+								ncl.cl3 = c;
+
+								ncl.i1 = r2a(R31 * R23_12).norm();
+								ncl.i2 = s12 * s23 * s31;
+								ncl.i3 = s31*s23*R31*R23*o12 + s31*R31*o23 + o31;
+
+								const double s = score(ncl);
+								if(s < 0) continue;
+								found[i].push_back(ncl);
+								found_scores[i].push_back(s);
+							}
 						}
 					}
 				}
 			}
 		}
+	};
+
+	//small graphs are not worth starting the threads
+	const int kMinNumClustersPerThread = 16;
+	const int num_threads = std::min(GetEffectiveNumThreads(max_num_threads), std::max(1, static_cast<int>(M.size()) / kMinNumClustersPerThread));
+	if(num_threads == 1)
+		cycles_of(0, 1);
+	else
+	{
+		ParallelFor(0, num_threads, [&](const int t) { cycles_of(t, num_threads); });
+	}
+
+	cycles->clear();
+	scores->clear();
+	for(unsigned int i=0;i<M.size();i++)
+	{
+		cycles->insert(cycles->end(), found[i].begin(), found[i].end());
+		scores->insert(scores->end(), found_scores[i].begin(), found_scores[i].end());
 	}
+}
+
+//the smallest cosine of the angle between the rays from the cameras of the
+//bases of the third cluster to their centers and to the centers moved by the
+//translation of the cycle
+double cycle_bz(const cycle_3& cy, const std::vector<cam_s>& cams, const std::vector<std::vector<std::vector<basis_t>>>& CL)
+{
+	const vector<basis_t>& cc = CL[cy.t3][cy.cl3];
+	double bz = 1;
+	for(unsigned int j=0;j<cc.size();j++)
+	{
+		const Eigen::Matrix3d& R = cams[cc[j].c1].R;
+		Eigen::Vector3d center = -R.transpose() * cams[cc[j].c1].t;
+		const Eigen::Vector3d& point = cams[cc[j].c1].center;
+		Eigen::Vector3d point2 = point + cy.i3;
+		Eigen::Vector3d line1 = point-center;
+		Eigen::Vector3d line2 = point2-center;
+		double angle = line1.dot(line2)/(line1.norm() * line2.norm() );
+		if(angle < bz)
+			bz = angle;
+	}
+	return bz;
+}
+
+//the cycle has to close in rotation and keep the direction of the translation
+// ? 0.99 probably better than 0.98 ?
+bool consistent_cycle(const cycle_3& cy, double bz, double thr)
+{
+	return cy.i1 <= thr && bz >= 0.98;
+}
+
+}  // namespace
+
+std::vector<cycle_3> find3cycles(const std::vector<std::vector<clust_b>>& M, int max_num_threads)
+{
+	std::vector<cycle_3> ret;
+	std::vector<double> scores;
+	enumerate3cycles(M, [](const cycle_3&) { return 0.0; }, &ret, &scores, max_num_threads);
+	return ret;
+}
 
+std::vector<cycle_3> find3cycles(const std::vector<std::vector<clust_b>>& M, double thr, const std::vector<cam_s>& cams, const std::vector<std::vector<std::vector<basis_t>>>& CL, std::vector<double> * bzs, int max_num_threads)
+{
+	std::vector<cycle_3> ret;
+	auto score = [thr, &cams, &CL](const cycle_3& cy) {
+		if(cy.i1 > thr)
+			return -1.0;
+		const double bz = cycle_bz(cy, cams, CL);
+		return consistent_cycle(cy, bz, thr) ? bz : -1.0;
+	};
+	enumerate3cycles(M, score, &ret, bzs, max_num_threads);
 	return ret;
 }
 
-std::vector<int> cluster_cycles(std::vector<cycle_3> C, double thr, std::vector<cam_s> cams, std::vector<std::vector<std::vector<basis_t>>> CL, std::vector<double> * bzs)
+std::vector<int> cluster_cycles(const std::vector<cycle_3>& C)
 {
-	vector<int> ret(C.size());
-	vector<int> pos(C.size());
-	vector<cycle_3> NC;
-	cout << "Clustering cycles\n";
+	//the cycles which share a cluster are connected, so every cluster is
+	//joined with the first cycle through it
+	std::vector<int> parent(C.size());
 	for(unsigned int i=0;i<C.size();i++)
-	{
-		if(C[i].i1 <= thr)
+		parent[i] = i;
+	auto root = [&parent](int i) {
+		while(parent[i] != i)
 		{
-			vector<basis_t> cc = CL[C[i].t3][C[i].cl3];
-			double bz = 1;
-			for(unsigned int j=0;j<cc.size();j++)
-			{
-				Eigen::Matrix3d R = cams[cc[j].c1].R;
-				Eigen::Vector3d center = -R.transpose() * cams[cc[j].c1].t;
-				Eigen::Vector3d point = cams[cc[j].c1].center;
-				Eigen::Vector3d point2 = point + C[i].i3;
-				Eigen::Vector3d line1 = point-center;
-				Eigen::Vector3d line2 = point2-center;
-				double angle = line1.dot(line2)/(line1.norm() * line2.norm() );
-				if(angle < bz)
-					bz = angle;
-			}
-			//cout << C[i].i3 << "\n\n";
-			//cout << bz << "\n\n";
-			//cout << C[i].i2 << "\n\n";
-			// ? 0.99 probably better than 0.98 ?
-			if(bz >= 0.98)
-			{
-				NC.push_back(C[i]);
-				ret[i] = 0;
-				pos[i] = NC.size()-1;
-				(*bzs)[i] = bz;
-			}
-			else { ret[i] = -1; pos[i] = -1; (*bzs)[i] = 0;}
+			parent[i] = parent[parent[i]];
+			i = parent[i];
 		}
-		else { ret[i] = -1; pos[i] = -1; (*bzs)[i] = 0;}
-		//cout << C[i].i1 << " " << ret[i] << "\n";
-	}
-
-	//find connected components
-	Eigen::MatrixXd D = Eigen::MatrixXd(NC.size(), NC.size());
-	D.setZero();
-	Eigen::MatrixXi B = Eigen::MatrixXi(NC.size(), NC.size());
-	B.setZero();
-	for(unsigned int i=0;i<NC.size();i++)
+		return i;
+	};
+	std::map<std::pair<int, int>, int> first;
+	for(unsigned int i=0;i<C.size();i++)
 	{
-		double sum = 0;
-		for(unsigned int j=0;j<NC.size();j++)
+		const std::pair<int, int> clusters[3] = {std::make_pair(C[i].t1, C[i].cl1), std::make_pair(C[i].t2, C[i].cl2), std::make_pair(C[i].t3, C[i].cl3)};
+		for(const std::pair<int, int>& cluster : clusters)
 		{
-			if(i==j) continue;
-
-			//find if the cycles share a cluster
-			bool ended = 0;
-			if(NC[i].t1 == NC[j].t1 && NC[i].cl1 == NC[j].cl1)
-				ended = 1;
-			else if(NC[i].t1 == NC[j].t2 && NC[i].cl1 == NC[j].cl2)
-				ended = 1;
-			else if(NC[i].t1 == NC[j].t3 && NC[i].cl1 == NC[j].cl3)
-				ended = 1;
-			else if(NC[i].t2 == NC[j].t1 && NC[i].cl2 == NC[j].cl1)
-				ended = 1;
-			else if(NC[i].t2 == NC[j].t2 && NC[i].cl2 == NC[j].cl2)
-				ended = 1;
-			else if(NC[i].t2 == NC[j].t3 && NC[i].cl2 == NC[j].cl3)
-				ended = 1;
-			else if(NC[i].t3 == NC[j].t1 && NC[i].cl3 == NC[j].cl1)
-				ended = 1;
-			else if(NC[i].t3 == NC[j].t2 && NC[i].cl3 == NC[j].cl2)
-				ended = 1;
-			else if(NC[i].t3 == NC[j].t3 && NC[i].cl3 == NC[j].cl3)
-				ended = 1;
-
-			if(ended)
-			{
-				D(i,j) = -exp(NC[i].i1)-exp(NC[j].i1);
-				B(i,j) = 1;
-				sum = sum + D(i,j);
-			}
+			auto it = first.emplace(cluster, i).first;
+			const int r1 = root(it->second);
+			const int r2 = root(i);
+			if(r1 != r2)
+				parent[std::max(r1, r2)] = std::min(r1, r2);
 		}
-		D(i,i) = -sum;
 	}
 
-	//find the connected components
+	//the components are numbered from 1 in the order of their first cycle
+	std::vector<int> ret(C.size());
+	std::vector<int> group(C.size(), 0);
 	int gr = 1;
-	while(1)
+	for(unsigned int i=0;i<C.size();i++)
 	{
-		vector<int> q;
-		for(unsigned int i=0;i<ret.size();i++)
-		{
-			if(ret[i] == 0)
-			{
-				ret[i] = gr;
-				q.push_back(i);
-				break;
-			}
-		}
-		if(q.size() == 0) break;
-		while(q.size())
-		{
-			int cur = q[q.size()-1];
-			q.pop_back();
-			for(unsigned int i=0;i<C.size();i++)
-			{
-				if(B(pos[cur], pos[i]) && !ret[i])
-				{
-					ret[i] = gr;
-					q.push_back(i);
-				}
-			}
-		}
-		gr++;
+		const int r = root(i);
+		if(!group[r])
+			group[r] = gr++;
+		ret[i] = group[r];
 	}
 
-	
 	return ret;
 }
 
-std::pair<std::pair<Eigen::MatrixXi, Eigen::MatrixXi>, Eigen::MatrixXd> select_bases(std::vector<std::vector<clust_b>> M, std::vector<cycle_3> CY, std::vector<int> CL2, int takes, std::vector<double> bzs, double thr1, double thr2)
+std::vector<int> cluster_cycles(const std::vector<cycle_3>& C, double thr, const std::vector<cam_s>& cams, const std::vector<std::vector<std::vector<basis_t>>>& CL, std::vector<double> * bzs)
 {
-	double best_sum = 5;
-	int best_count = 0;
-	Eigen::MatrixXi best_if2cl;
-	Eigen::MatrixXi best_sm;
-	Eigen::MatrixXd best_cons;
-	for(int cl=1;;cl++)
+	cout << "Clustering cycles\n";
+	vector<int> ret(C.size(), -1);
+	vector<int> pos;
+	vector<cycle_3> NC;
+	for(unsigned int i=0;i<C.size();i++)
+	{
+		(*bzs)[i] = 0;
+		if(C[i].i1 > thr) continue;
+		double bz = cycle_bz(C[i], cams, CL);
+		if(!consistent_cycle(C[i], bz, thr)) continue;
+		NC.push_back(C[i]);
+		pos.push_back(i);
+		(*bzs)[i] = bz;
+	}
+
+	const vector<int> groups = cluster_cycles(NC);
+	for(unsigned int i=0;i<NC.size();i++)
+		ret[pos[i]] = groups[i];
+	return ret;
+}
+
+std::pair<std::pair<Eigen::MatrixXi, Eigen::MatrixXi>, Eigen::MatrixXd> select_bases(const std::vector<std::vector<clust_b>>& M, const std::vector<cycle_3>& CY, const std::vector<int>& CL2, int takes, const std::vector<double>& bzs, double thr1, double thr2, int max_num_threads)
+{
+	//shows which motion clusters are between the takes
+	Eigen::MatrixXi if2cl = Eigen::MatrixXi::Ones(takes, takes);
+	if2cl = -1*if2cl;
+	//the motion clusters of every take
+	vector<vector<int>> take2m(takes);
+	for(unsigned int i=0;i<M.size();i++)
+	{
+		if(!M[i].size()) continue;
+		int init = M[i][0].init;
+		int final = M[i][0].final;
+		if2cl(init-1, final-1) = i;
+		if2cl(final-1, init-1) = i;
+		take2m[init-1].push_back(i);
+		take2m[final-1].push_back(i);
+	}
+
+	//find the components, which are numbered from 1
+	vector<vector<int>> components;
+	for(unsigned int i=0;i<CL2.size();i++)
+	{
+		if(CL2[i] < 1) continue;
+		if((int)components.size() < CL2[i])
+			components.resize(CL2[i]);
+		components[CL2[i]-1].push_back(i);
+	}
+	for(unsigned int cl=0;cl<components.size();cl++)
 	{
-		//find the component
-		std::vector<cycle_3> NBC;
-		vector<double> nbz;
-		for(unsigned int i=0;i<CL2.size();i++)
+		if(components[cl].empty())
 		{
-			if(CL2[i] == cl)
-			{
-				NBC.push_back(CY[i]);
-				nbz.push_back(bzs[i]);
-				//cout << "BZ " << bzs[i] << "\n";
-			}
+			components.resize(cl);
+			break;
 		}
-		if(!NBC.size()) break;
+	}
+
+	//the spanning tree of every component, the components are independent of each other
+	typedef struct
+	{
+		int count;
+		double sum;
+		Eigen::MatrixXi sm;
+		Eigen::MatrixXd consistency;
+	} tree_s;
+	vector<tree_s> trees(components.size());
+	auto span_component = [&](const int cl)
+	{
+		tree_s& tree = trees[cl];
+		tree.count = 0;
+		tree.sum = INFINITY;
 
-		//initialize the structures
-		//shows which motion clusters are between the takes
-		//somewhere here is a problem
-		Eigen::MatrixXi if2cl = Eigen::MatrixXi::Ones(takes, takes);
-		if2cl = -1*if2cl;
 		//shows which motion between the takes has been selected
-		Eigen::MatrixXi sm = Eigen::MatrixXi::Ones(takes, takes);
-		sm = -1*sm;
-		Eigen::MatrixXd consistency = Eigen::MatrixXd::Ones(takes, takes);
-		consistency = -1*consistency;
-		for(unsigned int i=0;i<M.size();i++)
-		{
-			if(!M[i].size()) continue;
-			int init = M[i][0].init;
-			int final = M[i][0].final;
-			if2cl(init-1, final-1) = i;
-			if2cl(final-1, init-1) = i;
-		}
-		vector<bool> comp(takes);
-		for(int i=0;i<takes;i++)
-			comp[i] = 0;
+		tree.sm = Eigen::MatrixXi::Ones(takes, takes);
+		tree.sm = -1*tree.sm;
+		tree.consistency = Eigen::MatrixXd::Ones(takes, takes);
+		tree.consistency = -1*tree.consistency;
+		vector<bool> comp(takes, 0);
 
-		//for each motion cluster find its consistency as the 
+		//for each motion cluster find its consistency as the best of its cycles
 		//save to a vector of vectors with a structure similar to the M
 		vector<vector<double>> rc(M.size());
 		vector<vector<double>> tc(M.size());
 		for(unsigned int i=0;i<M.size();i++)
 		{
-			rc[i] = vector<double>(M[i].size());
-			tc[i] = vector<double>(M[i].size());
-			for(unsigned int j=0;j<M[i].size();j++)
+			rc[i] = vector<double>(M[i].size(), 1);
+			tc[i] = vector<double>(M[i].size(), 0);
+		}
+		for(const int cy : components[cl])
+		{
+			const cycle_3& C = CY[cy];
+			double rc_cur = C.i1;
+			double tc_cur = bzs[cy];
+			for(const std::pair<int, int> tcl : {std::make_pair(C.t1, C.cl1), std::make_pair(C.t2, C.cl2), std::make_pair(C.t3, C.cl3)})
 			{
-				rc[i][j] = 1;
-				tc[i][j] = 0;
+				if(rc_cur < rc[tcl.first][tcl.second])
+					rc[tcl.first][tcl.second] = rc_cur;
+				if(tc_cur > tc[tcl.first][tcl.second])
+					tc[tcl.first][tcl.second] = tc_cur;
 			}
 		}
-		for(unsigned int i=0;i<NBC.size();i++)
+		auto score = [&](const int i, const int j)
 		{
-			double rc_cur = NBC[i].i1;
-			double tc_cur = nbz[i];
-			
-			int t=NBC[i].t1;
-			int c=NBC[i].cl1;
-			if(rc_cur < rc[t][c])
-				rc[t][c] = rc_cur;
-			if(tc_cur > tc[t][c])
-				tc[t][c] = tc_cur;
-
-			t=NBC[i].t2;
-			c=NBC[i].cl2;
-			if(rc_cur < rc[t][c])
-				rc[t][c] = rc_cur;
-			if(tc_cur > tc[t][c])
-				tc[t][c] = tc_cur;
-
-			t=NBC[i].t3;
-			c=NBC[i].cl3;
-			if(rc_cur < rc[t][c])
-				rc[t][c] = rc_cur;
-			if(tc_cur > tc[t][c])
-				tc[t][c] = tc_cur;
-		}
-		
+			return rc[i][j]/thr1 + (1-tc[i][j])/thr2 + 1/((double)M[i][j].size);
+		};
+
 		//select the first motion cluster (and pair of takes)
 		//take into account only the consistency and the number of the cameras
 		double best_score = 3;
@@ -2508,94 +3681,93 @@ std::pair<std::pair<Eigen::MatrixXi, Eigen::MatrixXi>, Eigen::MatrixXd> select_b
 				if(rc[i][j] > thr1 || tc[i][j] < thr2 || M[i][j].size < 1)
 					continue;
 
-				double score = rc[i][j]/thr1 + (1-tc[i][j])/thr2 + 1/((double)M[i][j].size);
-				//cout << rc[i][j] << " " << 1-tc[i][j] << " " << 1/((double)M[i][j].size + 1) << "\n";
-				if(score < best_score)
+				double cur = score(i, j);
+				if(cur < best_score)
 				{
-					best_score = score;
+					best_score = cur;
 					best_t = i;
 					best_c = j;
 				}
 			}
 		}
+		if(best_t < 0) return;
 
-		//add other motion clusters, apart from the previous take into account the number of common observed points (maybe in a form of classes, take the best from the highest class, or add it to the score (somehow))
-		int i1 = M[best_t][best_c].init;
-		int i2 = M[best_t][best_c].final;
-		comp[i1 - 1] = 1;
-		comp[i2 - 1] = 1;
-		sm(i1-1, i2-1) = best_c;
-		sm(i2-1, i1-1) = best_c;
-		consistency(i1-1, i2-1) = best_score;
-		consistency(i2-1, i1-1) = best_score;
-		int count = 2;
-		double sum = best_score;
+		//add other motion clusters with one take in the component and one outside of it, the best one first and the
+		//first one on ties. the clusters of a take are queued when the take joins the component
 		//TODO
 		//find the list of tracks observed by the clusters in the spanning tree
 		//use the list to add the best next cluster
-		while(1)
-		{
-			double best_score = 4;
-			bool found = false;
-			int best_t = -1;
-			int best_c = -1;
-			for(unsigned int i=0;i<M.size();i++)
-			{
-				//only those clusters which have one take in the component and one outside of it
-				//cout << M[i].size() << "\n";
-				if(!M[i].size()) continue;
-				bool comp1 = comp[(M[i][0].init)-1];
-				bool comp2 = comp[(M[i][0].final)-1];
-				if((comp1 && comp2) || ((!comp1) && (!comp2))) continue;
-				for(unsigned int j=0;j<M[i].size();j++)
+		std::priority_queue<std::pair<double, std::pair<int, int>>, vector<std::pair<double, std::pair<int, int>>>, std::greater<std::pair<double, std::pair<int, int>>>> Q;
+		auto add_cluster = [&](const int t, const int c, const double cur)
+		{
+			int i1 = M[t][c].init;
+			int i2 = M[t][c].final;
+			tree.sm(i1-1, i2-1) = c;
+			tree.sm(i2-1, i1-1) = c;
+			tree.consistency(i1-1, i2-1) = cur;
+			tree.consistency(i2-1, i1-1) = cur;
+			for(const int take : {i1-1, i2-1})
+			{
+				if(comp[take]) continue;
+				comp[take] = 1;
+				for(const int i : take2m[take])
 				{
-					if(rc[i][j] > thr1 || tc[i][j] < thr2 || M[i][j].size < 1);
-					//	continue;
-
-					double score = rc[i][j]/thr1 + (1-tc[i][j])/thr2 + 1/((double)M[i][j].size);
-					//cout << rc[i][j] << " " << 1-tc[i][j] << " " << 1/((double)M[i][j].size + 1) << "\n";
-					if(score < best_score)
+					for(unsigned int j=0;j<M[i].size();j++)
 					{
-						best_score = score;
-						best_t = i;
-						best_c = j;
-						found = 1;
+						double next = score(i, j);
+						if(next < 4)
+							Q.emplace(next, std::make_pair(i, (int)j));
 					}
 				}
 			}
-			if(!found) break;
-
-			int i1 = M[best_t][best_c].init;
-			int i2 = M[best_t][best_c].final;
-			comp[i1 - 1] = 1;
-			comp[i2 - 1] = 1;
-			sm(i1-1, i2-1) = best_c;
-			sm(i2-1, i1-1) = best_c;
-			consistency(i1-1, i2-1) = best_score;
-			consistency(i2-1, i1-1) = best_score;
-			count++;
-			sum+=best_score;
-			
+		};
+		add_cluster(best_t, best_c, best_score);
+		tree.count = 2;
+		tree.sum = best_score;
+		while(!Q.empty())
+		{
+			const double cur = Q.top().first;
+			const int i = Q.top().second.first;
+			const int j = Q.top().second.second;
+			Q.pop();
+			if(comp[(M[i][0].init)-1] && comp[(M[i][0].final)-1]) continue;
+			add_cluster(i, j, cur);
+			tree.count++;
+			tree.sum+=cur;
 		}
-		
-		//evaluate the quality of the whole spanning tree
-		//cout << if2cl << "\n\n\n\n" << sm << "\n";
-		if(count > best_count || (count == best_count && sum < best_sum))
+	};
+
+	if(GetEffectiveNumThreads(max_num_threads) == 1)
+	{
+		for(unsigned int cl=0;cl<components.size();cl++)
+			span_component(cl);
+	}
+	else
+		ParallelFor(0, components.size(), span_component);
+
+	//evaluate the quality of the whole spanning trees
+	double best_sum = 5;
+	int best_count = 0;
+	Eigen::MatrixXi best_if2cl;
+	Eigen::MatrixXi best_sm;
+	Eigen::MatrixXd best_cons;
+	for(const tree_s& tree : trees)
+	{
+		if(tree.count > best_count || (tree.count == best_count && tree.sum < best_sum))
 		{
-			best_count = count;
-			best_sum = sum;
-			best_sm = sm;
+			best_count = tree.count;
+			best_sum = tree.sum;
+			best_sm = tree.sm;
 			best_if2cl = if2cl;
-			best_cons = consistency;
+			best_cons = tree.consistency;
 		}
 	}
-	//cout << best_sm << "\n";
 	std::pair<Eigen::MatrixXi, Eigen::MatrixXi> ret (best_if2cl, best_sm);
 	std::pair<std::pair<Eigen::MatrixXi, Eigen::MatrixXi>, Eigen::MatrixXd> ret2(ret, best_cons);
 	return ret2;
 }
 
-int find_reference(Eigen::MatrixXd st, int takes)
+int find_reference(const Eigen::MatrixXd& st, int takes)
 {
 	int reference = 0;
 	int best_deg = 0;
@@ -2622,7 +3794,7 @@ int find_reference(Eigen::MatrixXd st, int takes)
 	return reference;
 }
 
-std::vector<std::vector<trans_s>> find_transformations(std::pair<Eigen::MatrixXi, Eigen::MatrixXi> st, int reference, std::vector<std::vector<clust_b>> M, int takes)
+std::vector<std::vector<trans_s>> find_transformations(const std::pair<Eigen::MatrixXi, Eigen::MatrixXi>& st, int reference, const std::vector<std::vector<clust_b>>& M, int takes)
 {
 	std::vector<std::vector<trans_s>> ret(takes);
 	vector<bool> found(takes);
@@ -2659,7 +3831,7 @@ std::vector<std::vector<trans_s>> find_transformations(std::pair<Eigen::MatrixXi
 			{
 				int mov = st.first(t,Q[i].second);
 				int cl = st.second(t,Q[i].second);
-				cout << mov << " " << cl << "\n";
+				VLOG(4) << mov << " " << cl;
 				if(Q[i].second > t)
 				{
 					trans_s nt;
@@ -2688,7 +3860,7 @@ std::vector<std::vector<trans_s>> find_transformations(std::pair<Eigen::MatrixXi
 	return ret;
 }
 
-std::vector<motion_t> find_motion(std::vector<cam_s> C)
+std::vector<motion_t> find_motion(const std::vector<cam_s>& C)
 {
 	std::vector<motion_t> ret;
 
@@ -2736,7 +3908,7 @@ std::vector<motion_t> find_motion(std::vector<cam_s> C)
 	return ret;
 }
 
-std::vector<motion_t> transform_motion(std::vector<motion_t> C, std::vector<std::vector<trans_s>> transform)
+std::vector<motion_t> transform_motion(const std::vector<motion_t>& C, const std::vector<std::vector<trans_s>>& transform)
 {
 	std::vector<motion_t> D;
 	for(unsigned int i=0;i<C.size();i++)
@@ -2767,54 +3939,125 @@ std::vector<motion_t> transform_motion(std::vector<motion_t> C, std::vector<std:
 	return D;
 }
 
-Eigen::MatrixXd distance3d(vector<motion_t> C)
+namespace {
+
+//fills D with the distances of all pairs of motions. Both distances are
+//symmetric, so only the pairs i<j are computed and mirrored. row_dist(i, d)
+//fills d with the distances of motion i to the motions i+1, ..., n-1. The rows
+//are interleaved over the threads to balance the triangular workload and D is
+//only reallocated if the number of motions changes.
+template <typename T, typename RowDist>
+void symmetric_distance(const int n, const RowDist& row_dist, Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>* D, const int max_num_threads)
 {
-	Eigen::MatrixXd D = Eigen::MatrixXd::Zero(C.size(), C.size()); 
-	for(unsigned int i=0;i<C.size();i++)
-	{
-		for(unsigned int j=0;j<C.size();j++)
+	D->resize(n, n);
+	auto columns = [&row_dist, D, n](const int first, const int step) {
+		Eigen::VectorXd d;
+		for(int i=first;i<n;i+=step)
 		{
-			if(i==j) continue;
-			Eigen::Matrix3d R = C[i].A.transpose() * C[j].A;
-			Eigen::Vector3d r = r2a(R);
-			D(i,j) = r.norm();
+			(*D)(i,i) = 0;
+			row_dist(i, &d);
+			for(int j=i+1;j<n;j++)
+			{
+				(*D)(j,i) = static_cast<T>(d(j-i-1));
+				(*D)(i,j) = static_cast<T>(d(j-i-1));
+			}
 		}
-	}
-	Eigen::MatrixXd ret = Eigen::MatrixXd::Zero(C.size(), C.size());
-	for(unsigned int i=0;i<C.size();i++)
+	};
+
+	//small problems are not worth starting the threads
+	const int kMinNumMotionsPerThread = 128;
+	const int num_threads = std::min(GetEffectiveNumThreads(max_num_threads), std::max(1, n / kMinNumMotionsPerThread));
+	if(num_threads == 1)
 	{
-		for(unsigned int j=0;j<C.size();j++)
-		{
-			ret(i,j) = 0.5*(D(i,j) + D(j,i));
-		}
+		columns(0, 1);
+		return;
 	}
-	return ret;
+	ParallelFor(0, num_threads, [&](const int t) { columns(t, num_threads); });
 }
 
-Eigen::MatrixXd distance3d_trans(vector<motion_t> C)
+//rotation angles of Ri^T Rj for all j>i. The relative rotations of one row
+//are composed column by column from the stacked rotations R, such that both
+//the products and the angles run over contiguous arrays.
+void rotation_row_distance(const RotationMatrixArray& R, const int i, Eigen::VectorXd* d)
 {
-	Eigen::MatrixXd D = Eigen::MatrixXd::Zero(C.size(), C.size()); 
-	for(unsigned int i=0;i<C.size();i++)
-	{
-		for(unsigned int j=0;j<C.size();j++)
-		{
-			if(i==j) continue;
-			Eigen::Vector3d t = C[i].t - C[j].t;
-			D(i,j) = t.norm();
-		}
-	}
-	Eigen::MatrixXd ret = Eigen::MatrixXd::Zero(C.size(), C.size());
+	const int m = R.rows() - i - 1;
+	RotationMatrixArray P(m, 9);
+	for(int r=0;r<3;r++)
+		for(int c=0;c<3;c++)
+			P.col(3*r+c) = R(i,r) * R.col(c).tail(m) + R(i,3+r) * R.col(3+c).tail(m) + R(i,6+r) * R.col(6+c).tail(m);
+	RotationMatrixAngles(P, d);
+}
+
+template <typename T>
+void rotation_distance(const vector<motion_t>& C, Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>* D, const int max_num_threads)
+{
+	RotationMatrixArray R(C.size(), 9);
 	for(unsigned int i=0;i<C.size();i++)
+		for(int j=0;j<9;j++)
+			R(i,j) = C[i].A(j/3, j%3);
+	symmetric_distance(C.size(), [&R](const int i, Eigen::VectorXd* d) { rotation_row_distance(R, i, d); }, D, max_num_threads);
+}
+
+template <typename T>
+void translation_distance(const vector<motion_t>& C, Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>* D, const int max_num_threads)
+{
+	symmetric_distance(C.size(), [&C](const int i, Eigen::VectorXd* d) {
+		d->resize(C.size()-i-1);
+		for(unsigned int j=i+1;j<C.size();j++)
+			(*d)(j-i-1) = (C[i].t - C[j].t).norm();
+	}, D, max_num_threads);
+}
+
+//evaluates f for the candidate cluster counts first, ..., last on the thread
+//pool, or serially without one. The sweeps evaluate one batch of candidates
+//per thread and then check them in order, so they stop at the same count as
+//a serial loop and only waste the rest of the last batch.
+template <typename T>
+std::vector<T> evaluate_candidates(int first, int last, const std::function<T(int)>& f, ThreadPool* thread_pool)
+{
+	std::vector<T> ret(last-first+1);
+	if(!thread_pool)
 	{
-		for(unsigned int j=0;j<C.size();j++)
-		{
-			ret(i,j) = 0.5*(D(i,j) + D(j,i));
-		}
+		for(int i=first;i<=last;i++)
+			ret[i-first] = f(i);
+		return ret;
 	}
+	std::vector<std::future<void>> futures;
+	for(int i=first;i<=last;i++)
+		futures.push_back(thread_pool->AddTask([&f, &ret, first, i]() { ret[i-first] = f(i); }));
+	for(unsigned int i=0;i<futures.size();i++)
+		futures[i].get();
 	return ret;
 }
 
-Eigen::MatrixXd dist2laplace(Eigen::MatrixXd D, int size)
+int candidate_batch_size(ThreadPool* thread_pool)
+{
+	return thread_pool ? thread_pool->NumThreads() : 1;
+}
+
+}  // namespace
+
+void distance3d(const vector<motion_t>& C, Eigen::MatrixXd* D, int max_num_threads)
+{
+	rotation_distance(C, D, max_num_threads);
+}
+
+void distance3d(const vector<motion_t>& C, Eigen::MatrixXf* D, int max_num_threads)
+{
+	rotation_distance(C, D, max_num_threads);
+}
+
+void distance3d_trans(const vector<motion_t>& C, Eigen::MatrixXd* D, int max_num_threads)
+{
+	translation_distance(C, D, max_num_threads);
+}
+
+void distance3d_trans(const vector<motion_t>& C, Eigen::MatrixXf* D, int max_num_threads)
+{
+	translation_distance(C, D, max_num_threads);
+}
+
+Eigen::MatrixXd dist2laplace(const Eigen::MatrixXd& D, int size)
 {
 	Eigen::MatrixXd L = Eigen::MatrixXd::Zero(size, size);
 	for(int i=0;i<size;i++)
@@ -2848,218 +4091,107 @@ Eigen::MatrixXd dist2laplace(Eigen::MatrixXd D, int size)
 	return L_;
 }
 
-std::vector<int> kmeans(std::vector<Eigen::VectorXd> A, int k, int dim)
+//clusters the rows of A, the seed is fixed so that repeated runs of the
+//postprocessor give the same clusters. The callers sweep over k in parallel,
+//so every clustering runs on a single thread
+std::vector<int> kmeans(const KMeansPointsd& A, int k)
 {
-	std::vector<int> ret(A.size());
-	for(unsigned int i=0;i<A.size();i++)
-		ret[i] = -1;
-	srand(time(NULL));
-	int first = rand() % A.size();
-	vector<Eigen::VectorXd> means;
-	means.push_back(A[first]);
-	for(int i=1;i<k;i++)
-	{
-		//select the center which is the furthest from the nearest point
-		double max_dist = 0;
-		int next = 0;
-		for(unsigned int j=0;j<A.size();j++)
-		{
-			double min_dist = (A[j] - means[0]).norm();
-			for(int l=1;l<i;l++)
-			{
-				double dist = (A[j] - means[l]).norm();
-				if(dist < min_dist) min_dist = dist;
-			}
-			if(min_dist > max_dist)
-			{
-				max_dist = min_dist;
-				next = j;
-			}
-		}
-		means.push_back(A[next]);
-	}
-
-	/*for(int i=0;i<k;i++)
-	{
-		cout << "M" << means[i] << "\n\n";
-	}
-	cout << "\n\n";*/
-
-	bool i1 = 1;
-	double q = 0;
-	while(1)
-	{
-		//assign mean to each point
-		std::vector<int> n_ret(A.size());
-		double nq = 0;
-		for(unsigned int i=0;i<A.size();i++)
-		{
-			double min_dist = (A[i] - means[0]).norm();
-			int sm = 0;
-			for(int j=1;j<k;j++)
-			{
-				double dist = (A[i] - means[j]).norm();
-				if(dist < min_dist)
-				{
-					sm = j;
-					min_dist = dist;
-				}
-			}
-			nq += min_dist;
-			n_ret[i] = sm;
-		}
-
-		//detect if something has changed
-		if(!i1)
-		{
-			bool ch = 0;
-			for(unsigned int i=0;i<A.size();i++)
-			{
-				if(ret[i] == n_ret[i])
-				{
-					ch=1;
-					break;
-				}
-			}
-			if(!ch) break;
-			ret = n_ret;
-		}
-		else
-		{
-			ret = n_ret;
-		}
-
-		if(i1 || nq < q)
-			q = nq;
-		else
-			break;
-
-		//recompute the means, find out if reinitialisation is necessary
-		for(int i=0;i<k;i++)
-		{
-			Eigen::VectorXd mean = Eigen::VectorXd::Zero(dim);
-			int count = 0;
-			for(unsigned int j=0;j<A.size();j++)
-			{
-				if(ret[j] == i)
-				{
-					count++;
-					mean = mean + A[j];
-				}
-			}
-			if(!count)
-			{
-				//reinitialise the mean
-				int np = rand() % A.size();
-				means[i] = A[np];
-			}
-			else
-			{
-				mean = mean / count;
-				means[i] = mean;
-			}
-		}
-
-		i1 = 0;
-	}
-	/*for(int i=1;i<k;i++)
-	{
-		//cout << means[i] << "\n\n";
-	}*/
-
-	return ret;
+	KMeansOptions options;
+	options.num_clusters = k;
+	options.num_threads = 1;
+	return KMeans(options, A);
 }
 
-std::vector<motion_t> remove_id(std::vector<motion_t> C, double pd, double thr1, double thr2)
+std::vector<motion_t> remove_id(const std::vector<motion_t>& C, double pd, double thr1, double thr2, int max_num_threads)
 {
 	std::vector<motion_t> ret;
-	cout << "Removing zero motions\n";
-	int n=0;
-	vector<bool> grouped = vector<bool>(C.size(), 0);
-	while(1)
-	{
-		n++;
-		cout << "Motion " << n << "\n";
-		vector<motion_t> B;
-		int init = -1;
-		int final = -1;
-		//find the group corresponding to the new motion
-		for(unsigned int i=0;i<C.size();i++)
-		{
-			if(B.size() == 0 && !grouped[i])
-			{
-				init = C[i].init;
-				final = C[i].final;
-				grouped[i] = 1;
-				motion_t nb = C[i];
-				B.push_back(nb);
-			}
-			else if(!grouped[i] && ( (C[i].init == init && C[i].final == final ) || (C[i].init == final && C[i].final == init) ))
-			{
-				grouped[i] = 1;
-				motion_t nb = C[i];
-				B.push_back(nb);
-			}
+	cout << "Removing zero motions\n";
+	//distance matrices, reused for all motions
+	Eigen::MatrixXd D1;
+	Eigen::MatrixXd D2;
+	//evaluates the candidate cluster counts
+	ThreadPool thread_pool(max_num_threads);
+	//a cluster is the identity if its median rotation and translation are below
+	//these thresholds. The motions far below or far above them end up in such
+	//clusters anyway, so they are decided right away and only the others are
+	//clustered
+	const double rot_thr = 0.0247 * thr1;
+	const double trans_thr = thr2 * 0.007 * pd;
+	const double kClearMargin = 2;
+	const std::vector<std::vector<motion_t>> groups = group_by_takes(C);
+	for(unsigned int n=0;n<groups.size();n++)
+	{
+		VLOG(4) << "Motion " << n+1;
+		vector<motion_t> B;
+		int num_identity = 0;
+		for(const motion_t& motion : groups[n])
+		{
+			const double rot = r2a(motion.A).norm();
+			const double trans = motion.t.norm();
+			if(rot * kClearMargin < rot_thr && trans * kClearMargin < trans_thr)
+				num_identity++;
+			else if(rot > kClearMargin * rot_thr || trans > kClearMargin * trans_thr)
+				ret.push_back(motion);
+			else
+				B.push_back(motion);
 		}
+		VLOG(4) << groups[n].size() << " " << num_identity << " " << B.size();
 		if(B.size() == 0)
-			break;
-		cout << B.size() << "\n";
+			continue;
 
 		//find distance between rotations and translations
-		Eigen::MatrixXd D1 = distance3d(B);
-		Eigen::MatrixXd D2 = distance3d_trans(B);
+		distance3d(B, &D1, max_num_threads);
+		distance3d_trans(B, &D2, max_num_threads);
 		//compute the graph laplacian
 		Eigen::MatrixXd L1 = dist2laplace(D1, B.size());
 		Eigen::MatrixXd L2 = dist2laplace(D2, B.size());
 		Eigen::MatrixXd L = L1+L2;
 
-		//perform the spectral clustering
-		Eigen::EigenSolver<Eigen::MatrixXd> es(L);
-		Eigen::MatrixXcd lambda = es.eigenvalues();
-		Eigen::MatrixXcd V = es.eigenvectors();
+		//perform the spectral clustering, the laplacian is symmetric and only the
+		//eigenvectors with eigenvalues below 1.2 are used, so compute the
+		//smallest ones until the threshold is passed
+		Eigen::VectorXd lambda;
+		Eigen::MatrixXd V;
+		int num_ev = std::min((int)B.size(), 16);
+		while(1)
+		{
+			SmallestSymmetricEigenvectors(L, num_ev, &lambda, &V);
+			if(lambda(num_ev-1) >= 1.2 || num_ev == (int)B.size())
+				break;
+			num_ev = std::min((int)B.size(), 2*num_ev);
+		}
 		//cout << lambda << "\n\n";
 		int max_i = 1;
-		for(unsigned int i=1;i<B.size();i++)
+		for(int i=1;i<num_ev;i++)
 		{
-			if(lambda(i).real() < 1.2)
+			if(lambda(i) < 1.2)
 			{
 				max_i = i+1;
 				//break;
 			}
-			//cout << lambda(i).real() << "\n";
+			//cout << lambda(i) << "\n";
 		}
 
 		//find the vectors
-		vector<Eigen::VectorXd> a;
-		for(unsigned int j=0;j<B.size();j++)
-		{
-			Eigen::VectorXd nv(max_i);
-			for(int k=0;k<max_i;k++)
-			{
-				nv(k) = V(j,k).real();
-			}
-			a.push_back(nv);
-		}
+		const KMeansPointsd a = V.leftCols(max_i);
 
 		//double chtg = 10 + B.size();
 		double chtg = INFINITY;
 		double best_S = -chtg;
 		//cout << 10 + B.size() << " " << chtg << "\n";
-		vector<int> clust;
-		for(unsigned int i=max_i;i<=B.size();i++)
-		{
-			
+		//clusters with their silhouette for a cluster count
+		std::function<std::pair<vector<int>, double>(int)> evaluate = [&](int i) {
 			//perform the kmeans
-			vector<int> c = kmeans(a, i, max_i);
+			vector<int> c = kmeans(a, i);
 			//cout << c.size() << "\n";
 
 			//compute the silhouette and evaluate the clustering
 			double s = 0;
+			vector<double> d(i);
+			vector<int> n(i);
 			for(unsigned int j=0;j<B.size();j++)
 			{
-				vector<double> d(i);
-				vector<int> n(i);
-				for(unsigned int bz = 0;bz<i;bz++)
+				for(int bz = 0;bz<i;bz++)
 				{
 					d[bz] = 0;
 					n[bz] = 0;
@@ -3076,9 +4208,9 @@ std::vector<motion_t> remove_id(std::vector<motion_t> C, double pd, double thr1,
 				if(n[c[j]] > 1)
 					as = d[c[j]]/(n[c[j]]-1);
 
-				for(unsigned int k=0;k<i;k++)
+				for(int k=0;k<i;k++)
 				{
-					if(k==(unsigned int)c[j]) continue;
+					if(k==c[j]) continue;
 					double bb = d[k]/(n[k]-1);
 					if(bb < bs)
 						bs = bb;
@@ -3096,17 +4228,31 @@ std::vector<motion_t> remove_id(std::vector<motion_t> C, double pd, double thr1,
 				}
 				s = s+S;
 			}
-			//cout << s << "\n";
-			//cout << best_S << "\n";
-			if(s > best_S)
-			{
-				clust = c;
-				best_S = s;
-			}
-			else
-			{
-				if(!clust.size()) clust = c;
-				break;
+			return std::make_pair(c, s);
+		};
+		vector<int> clust;
+		bool done = 0;
+		for(int i=max_i;i<=(int)B.size() && !done;i+=candidate_batch_size(&thread_pool))
+		{
+			const int last = std::min((int)B.size(), i+candidate_batch_size(&thread_pool)-1);
+			std::vector<std::pair<vector<int>, double>> cands = evaluate_candidates(i, last, evaluate, &thread_pool);
+			for(unsigned int j=0;j<cands.size();j++)
+			{
+				vector<int>& c = cands[j].first;
+				double s = cands[j].second;
+				//cout << s << "\n";
+				//cout << best_S << "\n";
+				if(s > best_S)
+				{
+					clust = c;
+					best_S = s;
+				}
+				else
+				{
+					if(!clust.size()) clust = c;
+					done = 1;
+					break;
+				}
 			}
 		}
 
@@ -3138,11 +4284,10 @@ std::vector<motion_t> remove_id(std::vector<motion_t> C, double pd, double thr1,
 			{
 				if(med_trans.norm() < thr2 * 0.007 * pd)
 				{
-					cout << "IDENTITY REMOVED\n";
+					VLOG(4) << "IDENTITY REMOVED";
 				}
 				else
 				{
-					cout << "OK\n";
 					for(unsigned int j=0;j<B.size();j++)
 					{
 						if(clust[j] == i)
@@ -3153,7 +4298,6 @@ std::vector<motion_t> remove_id(std::vector<motion_t> C, double pd, double thr1,
 			}
 			else
 			{
-				cout << "OK\n";
 				for(unsigned int j=0;j<B.size();j++)
 				{
 					if(clust[j] == i)
@@ -3174,7 +4318,7 @@ std::vector<motion_t> remove_id(std::vector<motion_t> C, double pd, double thr1,
 	return ret;
 }
 
-double princ_dist(std::vector<cam_s> C, int take)
+double princ_dist(const std::vector<cam_s>& C, int take)
 {
 	double ret = 0;
 	double cnt = 0;
@@ -3192,7 +4336,7 @@ double princ_dist(std::vector<cam_s> C, int take)
 	return ret/cnt;
 }
 
-std::vector<cam_s> change_basis_cams(std::vector<cam_s> C, std::vector<std::vector<trans_s>> T)
+std::vector<cam_s> change_basis_cams(const std::vector<cam_s>& C, const std::vector<std::vector<trans_s>>& T)
 {
 	std::vector<cam_s> ret;
 	for(unsigned int i=0;i<C.size();i++)
@@ -3233,69 +4377,63 @@ std::vector<cam_s> change_basis_cams(std::vector<cam_s> C, std::vector<std::vect
 	return ret;
 }
 
-std::vector<std::vector<motion_t>> ransac_motions(std::vector<motion_t> G, std::vector<cam_s> C, double sigma, double pd, double thr2)
+std::vector<std::vector<motion_t>> ransac_motions(const std::vector<motion_t>& G, const std::vector<cam_s>& C, double sigma, double pd, double thr2, int max_num_threads)
 {
 	std::vector<std::vector<motion_t>> D;
 
-
-	vector<vector<basis_t>> ret;
 	vector<bool> grouped = vector<bool>(G.size(), 0);
 	int cl = 0;
 
-	while(1)
-	{
-		cl++;
-		cout << "CLUSTER " << cl << "\n";
-		vector<bool> best = vector<bool>(G.size(), 0);
-		int best_count = 0;
-		for(unsigned int i=0;i<G.size();i++)
+	//number of ungrouped motions consistent with motion i, which are flagged
+	//in inliers if given
+	auto support = [&G, &grouped, sigma, pd, thr2](const int i, vector<bool>* inliers) {
+		const Eigen::Matrix3d& R1 = G[i].A;
+		const Eigen::Vector3d& t1 = G[i].t;
+		int count = 0;
+		for(unsigned int j=0;j<G.size();j++)
 		{
-			if(grouped[i]) continue;
-			Eigen::Matrix3d R1 = G[i].A;
-			Eigen::Vector3d t1 = G[i].t;
+			if(grouped[j]) continue;
+			const Eigen::Matrix3d R3 = G[j].A * R1.transpose();
+			if(r2a(R3).norm() > sigma * 0.0247)
+				continue;
 
-			//check the inliers
-			vector<bool> inliers = vector<bool>(G.size(), 0);
-			int count = 0;
-			for(unsigned int j=0;j<G.size();j++)
+			//check translation
+			if((G[j].t - t1).norm() <= 0.015 * pd * thr2)
 			{
-				if(grouped[j]) continue;
-				Eigen::Matrix3d R2 = G[j].A;
-				Eigen::Vector3d t2 = G[j].t;
-
-				Eigen::Matrix3d R3 = R2 * R1.transpose();
-				Eigen::Vector3d k3 = r2a(R3);
-				double n = k3.norm();
-				if(n > sigma * 0.0247)
-					continue;
-
-				//check translation
-				Eigen::Vector3d t3 = t2 - t1;
-				double n3 = t3.norm();
-				//cout << n3 << " " << pd << "\n";
-
-				if(n3 <= 0.015 * pd * thr2)
-				{
-					inliers[j] = 1;
-					count++;
-				}
+				if(inliers)
+					(*inliers)[j] = 1;
+				count++;
 			}
-			if(count > best_count)
+		}
+		return count;
+	};
+
+	while(1)
+	{
+		cl++;
+		VLOG(4) << "CLUSTER " << cl;
+		const hypothesis_t best = exhaustive_search(G.size(), [&grouped, &support](const int i, hypothesis_t* best) {
+			if(grouped[i]) return;
+			const int count = support(i, nullptr);
+			if(count > best->count)
 			{
-				best = inliers;
-				best_count = count;
+				best->count = count;
+				best->i = i;
 			}
-		}
+		}, max_num_threads);
 
-		cout << "size " << best_count << "\n";
-		if(best_count == 0)
+		VLOG(4) << "size " << best.count;
+		if(best.count == 0)
 			break;
 
-		vector<motion_t> ND = vector<motion_t>(best_count);
+		vector<bool> inliers = vector<bool>(G.size(), 0);
+		support(best.i, &inliers);
+
+		vector<motion_t> ND = vector<motion_t>(best.count);
 		int j=0;
 		for(unsigned int i=0;i<G.size();i++)
 		{
-			if(best[i])
+			if(inliers[i])
 			{
 				ND[j] = G[i];
 				j++;
@@ -3303,62 +4441,31 @@ std::vector<std::vector<motion_t>> ransac_motions(std::vector<motion_t> G, std::
 			}
 		}
 		D.push_back(ND);
-		if(G.size() == (unsigned int)best_count) break;
+		if(G.size() == (unsigned int)best.count) break;
 	}
 
 	return D;
 }
 
-std::vector<std::vector<std::vector<motion_t>>> divide_motions(std::vector<motion_t> B, std::vector<cam_s> C, double sigma, double pd, double thr2)
+std::vector<std::vector<std::vector<motion_t>>> divide_motions(const std::vector<motion_t>& B, const std::vector<cam_s>& C, double sigma, double pd, double thr2, int max_num_threads)
 {
-	std::vector<std::vector<std::vector<motion_t>>> ret;
 	cout << "Clustering motions\n";
-	int n=0;
-	vector<bool> grouped = vector<bool>(B.size(), 0);
-	while(1)
-	{
-		n++;
-		cout << "Motion " << n << "\n";
-		vector<motion_t> GR;
-		int init = -1;
-		int final = -1;
-		//find the group corresponding to the new motion
-		for(unsigned int i=0;i<B.size();i++)
-		{
-			if(GR.size() == 0 && !grouped[i])
-			{
-				init = B[i].init;
-				final = B[i].final;
-				grouped[i] = 1;
-				motion_t nb = B[i];
-				GR.push_back(nb);
-			}
-			else if(!grouped[i] && ( (B[i].init == init && B[i].final == final ) || (B[i].init == final && B[i].final == init) ))
-			{
-				grouped[i] = 1;
-				motion_t nb = B[i];
-				GR.push_back(nb);
-			}
-		}
-		if(GR.size() == 0)
-			break;
-		cout << GR.size() << "\n";
-
-		//cluster the camera pairs in the group
-		vector<vector<motion_t>> CL = ransac_motions(GR, C, sigma, pd, thr2);
-		ret.push_back(CL);
-	}
-	
-	return ret;
+	//cluster the camera pairs of every pair of takes
+	return cluster_groups(group_by_takes(B), [&C, sigma, pd, thr2, max_num_threads](const vector<motion_t>& GR) {
+		return ransac_motions(GR, C, sigma, pd, thr2, max_num_threads);
+	}, max_num_threads);
 }
 
-std::vector<std::vector<clust_m>> meanclust_motions(std::vector<std::vector<std::vector<motion_t>>> C)
+std::vector<std::vector<clust_m>> meanclust_motions(const std::vector<std::vector<std::vector<motion_t>>>& C, bool geometric_rotations, int max_num_threads)
 {
-	std::vector<std::vector<clust_m>> D;
+	std::vector<std::vector<clust_m>> D(C.size());
+	std::vector<std::vector<char>> kept(C.size());
+	std::vector<std::pair<int, int>> clusters;
 
 	for(unsigned int i=0;i<C.size();i++)
 	{
-		std::vector<clust_m> ND;
+		D[i].resize(C[i].size());
+		kept[i].resize(C[i].size(), 0);
 		unsigned int max_size = 0;
 		for(unsigned int j=0;j<C[i].size();j++)
 		{
@@ -3373,40 +4480,65 @@ std::vector<std::vector<clust_m>> meanclust_motions(std::vector<std::vector<std:
 			{
 				continue;
 			}
+			kept[i][j] = 1;
+			clusters.emplace_back(i, j);
+		}
+	}
 
-			std::vector<Eigen::Vector3d> R;
-			std::vector<Eigen::Vector3d> t;
-			for(unsigned int k=0;k<C[i][j].size();k++)
-			{
-				R.push_back(r2a(C[i][j][k].A));
-				t.push_back(C[i][j][k].t);
-			}
-			clust_m nm;
-			nm.size = C[i][j].size();
+	//the clusters are independent of each other
+	auto mean_cluster = [&](const int c)
+	{
+		const std::vector<motion_t>& cl = C[clusters[c].first][clusters[c].second];
+		std::vector<Eigen::Vector3d> R;
+		std::vector<Eigen::Vector3d> t;
+		R.reserve(cl.size());
+		t.reserve(cl.size());
+		for(unsigned int k=0;k<cl.size();k++)
+		{
+			R.push_back(r2a(cl[k].A));
+			t.push_back(cl[k].t);
+		}
+		clust_m& nm = D[clusters[c].first][clusters[c].second];
+		nm.size = cl.size();
 
-			if(C[i][j][0].init < C[i][j][0].final)
-			{
-				nm.init = C[i][j][0].init;
-				nm.final = C[i][j][0].final;
-			}
-			else
-			{
-				nm.final = C[i][j][0].init;
-				nm.init = C[i][j][0].final;
-			}
-			nm.R = a2r(median(R));
-			nm.t = median(t);
+		if(cl[0].init < cl[0].final)
+		{
+			nm.init = cl[0].init;
+			nm.final = cl[0].final;
+		}
+		else
+		{
+			nm.final = cl[0].init;
+			nm.init = cl[0].final;
+		}
+		nm.R = a2r(rotation_median(R, geometric_rotations));
+		nm.t = median(t);
+	};
 
-			ND.push_back(nm);
-			
+	if(GetEffectiveNumThreads(max_num_threads) == 1)
+	{
+		for(unsigned int c=0;c<clusters.size();c++)
+			mean_cluster(c);
+	}
+	else
+		ParallelFor(0, clusters.size(), mean_cluster);
+
+	//drop the skipped clusters, keeping the order of the others
+	for(unsigned int i=0;i<C.size();i++)
+	{
+		std::vector<clust_m> ND;
+		for(unsigned int j=0;j<C[i].size();j++)
+		{
+			if(kept[i][j])
+				ND.push_back(D[i][j]);
 		}
-		D.push_back(ND);
+		D[i] = ND;
 	}
 
 	return D;
 }
 
-std::pair<std::vector<std::vector<std::vector<motion_t>>>, std::vector<std::vector<clust_m>>> remove_identity(std::vector<std::vector<clust_m>> C, std::vector<std::vector<std::vector<motion_t>>> CL , double pd, double thr1, double thr2)
+std::pair<std::vector<std::vector<std::vector<motion_t>>>, std::vector<std::vector<clust_m>>> remove_identity(const std::vector<std::vector<clust_m>>& C, const std::vector<std::vector<std::vector<motion_t>>>& CL, double pd, double thr1, double thr2)
 {
 	cout << "REMOVING IDENTITY\n";
 	std::vector<std::vector<std::vector<motion_t>>> NCL;
@@ -3444,457 +4576,344 @@ std::pair<std::vector<std::vector<std::vector<motion_t>>>, std::vector<std::vect
 	return ret;
 }
 
-std::vector<imgs_s> load_imgs(int takes)
+TakeBundle load_take(int take)
 {
-	//HERE_
-	cout << "LOADING IMAGES\n";
-	std::vector<imgs_s> ret;
-	for(int i=1;i<=takes;i++)
-	{
-		imgs_s img;
-		cout << "Take " << i << "\n";
-		bool succ = 0;
-		string line;
-		string p2 = to_string(i) + "/images.txt";
-		ifstream imgs;
-		imgs.open(p2);
+	TakeBundle bundle;
+	string p0 = JoinPaths(to_string(take), kTakeBundleFileName);
+	if(ExistsFile(p0) && ReadTakeBundle(p0, &bundle))
+		return bundle;
 
-		for(int j=0;j<4;j++)
-			getline(imgs,line);
-
-		int pos = 0;
-		while(getline(imgs, line))
-		{
-			int id;
-			istringstream str(line);
-			str >> id;
-			double num;
-			for(int j=0;j<8;j++)
-				str >> num;
-			string name;
-			str >> name;
-			img.id.push_back(id);
-			img.map[id] = pos;
-
-			vector<int> n_obs;
-			vector<int> n_obs2;
-			vector<Eigen::Vector2d> n_feat;
-			getline(imgs,line);
-			istringstream str2(line);
-
-			while(str2 >> num)
-			{
-				double num2;
-				str2 >> num2;
-				Eigen::Vector2d cf;
-				cf(0) = num;
-				cf(1) = num2;
-				n_feat.push_back(cf);
-				int pnt_id;
-				str2 >> pnt_id;
-				n_obs2.push_back(pnt_id);
-				succ = 1;
-				if (pnt_id >= 0)
-				{
-					//cout << pnt_id << "\n";
-					n_obs.push_back(pnt_id);
-				}
-			}
-			//std::sort(n_obs.begin(), n_obs.end());
-			img.obs.push_back(n_obs);
-			img.features.push_back(n_feat);
-			img.obs_all.push_back(n_obs2);
-			pos++;
-		}
-		ret.push_back(img);
-		cout << succ << "\n";
+	//no usable bundle, read the model of the take, which is binary unless the
+	//mapper wrote text
+	bundle = TakeBundle();
+	bundle.anchor = take;
+	const string model_path = to_string(take);
+	bool has_model = false;
+	for(const string ext : {".bin", ".txt"})
+	{
+		has_model = has_model || (ExistsFile(JoinPaths(model_path, "cameras" + ext)) &&
+			ExistsFile(JoinPaths(model_path, "images" + ext)) &&
+			ExistsFile(JoinPaths(model_path, "points3D" + ext)));
 	}
+	if(has_model)
+	{
+		Reconstruction reconstruction;
+		reconstruction.Read(model_path);
+		ExtractTakeBundle(reconstruction, ReadTakeMap("takes.txt"), &bundle);
+	}
+	else
+		std::cout << "WARNING: No model of take " << take << std::endl;
 
-	return ret;
-}
-
-std::vector<pnts_s> load_pnts(int takes)
-{
-	cout << "LOADING POINTS\n";
-	std::vector<pnts_s> ret;
+	//the binary camera log of the mapper, or its text version
+	if(ReadTakeCameraLog(JoinPaths(model_path, kTakeCameraLogFileName), &bundle.cameras))
+		return bundle;
+	bundle.cameras.clear();
 
-	for(int i=1;i<=takes;i++)
+	string p3 = to_string(take) + "/cams.txt";
+	ifstream cams;
+	cams.open(p3);
+	TakeCamera cam;
+	while(cams >> cam.image_id)
 	{
-		cout << "Take " << i << "\n";
-		pnts_s pnt;
-
-		ifstream pnts;
-		string p1 = to_string(i) + "/points3D.txt";
-		pnts.open(p1);
-		string line;
+		cams >> cam.take;
+		cams >> cam.anchor;
+		for(int j=0;j<4;j++)
+			cams >> cam.qvec(j);
 		for(int j=0;j<3;j++)
-			getline(pnts,line);
-
-		while(getline(pnts,line))
-		{
-			//cout << line << "\n";
-			istringstream str(line);
-			int id;
-			str >> id;
-			pnt.ID.push_back(id);
-			double x;
-			double y;
-			double z;
-			int r;
-			int g;
-			int b;
-			str >> x;
-			str >> y;
-			str >> z;
-			str >> r;
-			str >> g;
-			str >> b;
-			Eigen::Vector3d point;
-			point(0) = x;
-			point(1) = y;
-			point(2) = z;
-			pnt.points.push_back(point);
-
-			Eigen::Vector3i color;
-			color(0) = r;
-			color(1) = g;
-			color(2) = b;
-			pnt.color.push_back(color);
-			
-			pnt.ID_map[id] = pnt.ID.size()-1;
-			//if(id < 10)
-			//	cout << id << "\n";
-		}
-		
-		pnts.close();
-		ret.push_back(pnt);
+			cams >> cam.tvec(j);
+		cams >> cam.width;
+		cams >> cam.height;
+		cams >> cam.focal_length;
+		cams >> cam.principal_point_x;
+		cams >> cam.principal_point_y;
+		cams >> cam.num_inliers;
+		cams >> cam.pose_image_id;
+		bundle.cameras.push_back(cam);
 	}
+	cams.close();
 
-	return ret;
+	return bundle;
 }
 
-std::pair<std::vector<std::vector<std::pair<int, int>>>, std::vector<std::unordered_map<int, int>>> load_tracks(std::vector<pnts_s> P, int takes)
+//identifier of an observed 3D point as used by the postprocessor, -1 if the 2D point is not triangulated
+static inline int obs_id(const point3D_t id)
 {
-	cout << "LOADING TRACKS\n";
-	std::vector<std::vector<std::pair<int, int>>> T;
-	std::vector<std::unordered_map<int, int>> P2T(takes);
-	/*for(int i=0;i<takes;i++)
-	{
-		P2T[i] = std::vector<int>(P[i].ID.size());
-	}*/
+	return id == kInvalidPoint3DId ? -1 : static_cast<int>(id);
+}
 
-	ifstream ft;
-	ft.open("tracks.txt");
-	string line;
-	while(getline(ft, line))
-	{
-		std::vector<std::pair<int, int>> track;
-		int t;
-		int p;	
-		istringstream str(line);
-		while(str >> t)
-		{
-			str >> p;
-			std::pair<int, int> np;
-			np.first = t;
-			np.second = p;
-			track.push_back(np);
-			P2T[t-1][P[t-1].ID_map[p]] = T.size();
-		}
-		T.push_back(track);
-	}
-	ft.close();
+std::vector<imgs_s> load_imgs(int takes)
+{
+	return load_imgs(load_takes(takes));
+}
 
-	ifstream fg;
-	fg.open("graph.txt");
-	while(getline(fg, line))
+std::vector<imgs_s> load_imgs(const std::vector<TakeBundle>& B)
+{
+	//HERE_
+	cout << "LOADING IMAGES\n";
+	std::vector<imgs_s> ret;
+	for(unsigned int i=0;i<B.size();i++)
 	{
-		std::vector<std::pair<int, int>> track;
-		int t;
-		int p;	
-		istringstream str(line);
-		while(str >> t)
-		{
-			str >> p;
-			std::pair<int, int> np;
-			np.first = t;
-			np.second = p;
-			track.push_back(np);
-			//P2T[t-1][P[t-1].ID_map[p]] = T.size();
-			//cout << t << " " << p << " " ;
-		}
-		//T.push_back(track);
-		if(!track.size()) continue;
-		//cout << "\n";
-
-		//prepare the laplacian of the graph
-		Eigen::MatrixXd G(track.size(), track.size());
-		for(unsigned int i=0;i<track.size();i++)
-		{
-			for(unsigned int j=0;j<track.size();j++)
-			{
-				double nn;
-				fg >> nn;
-				G(i,j) = nn;
-			}
-		}
-		Eigen::MatrixXd L(track.size(), track.size());
-		L = -1 * G;
-		for(unsigned int i=0;i<track.size();i++)
-		{
-			double sum = 0;
-			for(unsigned int j=0;j<track.size();j++)
-			{
-				if(i==j) continue;
-				sum += G(i,j);
-			}
-			L(i,i) = sum;
-		}
-		Eigen::MatrixXd L1(track.size(), track.size());
-		for(unsigned int i=0;i<track.size();i++)
-		{
-			for(unsigned int j=0;j<track.size();j++)
-			{
-				L1(i,j) = L(i,j)/(sqrt(L(i,i))*sqrt(L(j,j)));
-			}
-		}
-		Eigen::EigenSolver<Eigen::MatrixXd> es(L1);
-		Eigen::MatrixXcd V = es.eigenvectors();
-		//cout << "F" << "\n";
-		int last_cons = 0;
-		//perform the kmeans
-		for(unsigned int i=2;i<track.size();i++)
-		{
-			//cout << i << "\n";
-			int dim = i;
-			if(i>10) dim = 10;
-			
-			vector<Eigen::VectorXd> a;
-			for(unsigned int j=0;j<track.size();j++)
-			{
-				Eigen::VectorXd nv(i);
-				for(unsigned int k=0;k<i;k++)
-				{
-					nv(k) = V(j,k).real();
-				}
-				a.push_back(nv);
-			}
-		
-			std::vector<int> c = kmeans(a, i, dim);
-
-			//check the consistency
-			bool consistent = 1;
-			int cons = 0;
-			int incons = 0;
-			for(unsigned int j=0;j<i;j++)
-			{
-				std::vector<std::pair<int, int>> CC;
-				for(unsigned int k=0;k<track.size();k++)
-				{
-					if((unsigned int)c[k] == j)
-					{
-						CC.push_back(track[k]);
-					}
-				}
-				bool con = 1;
-				for(unsigned int k=0;k<CC.size();k++)
-				{
-					for(unsigned int l=k+1;l<CC.size();l++)
-					{
-						if(CC[k].first == CC[l].first)
-						{
-							consistent = 0;
-							con = 0;
-							break;
-						}
-					}	
-					//if(!consistent) break;
-				}
-				if(con) cons++;
-				else	incons++;
-				//if(!consistent) break;
-			}
-
-			//cout << cons << " " << incons << "\n";
-
-			if(consistent || i==(track.size()-1))
-			{
-				for(unsigned int j=0;j<i;j++)
-				{
-					std::vector<std::pair<int, int>> CCC;
-					for(unsigned int k=0;k<track.size();k++)
-					{
-						if((unsigned int)c[k] == j)
-						{
-							CCC.push_back(track[k]);
-							int t = track[k].first;
-							int p = track[k].second;
-							P2T[t-1][P[t-1].ID_map[p]] = T.size();
-						}
-					}
-					T.push_back(CCC);
-				}
-				break;
-			}
-			else if((last_cons < cons && i >= 10) || i >= 20)
-			{
-				//take the consistent clusters together and the inconsistent ones as single points
-				for(unsigned int j=0;j<i;j++)
-				{
-					std::vector<std::pair<int, int>> CC;
-					for(unsigned int k=0;k<track.size();k++)
-					{
-						if((unsigned int)c[k] == j)
-						{
-							CC.push_back(track[k]);
-						}
-					}
-					bool con = 1;
-					for(unsigned int k=0;k<CC.size();k++)
-					{
-						for(unsigned int l=k+1;l<CC.size();l++)
-						{
-							if(CC[k].first == CC[l].first)
-							{
-								con = 0;
-								break;
-							}
-						}
-					}
-					//TODO
-					//this is only an experimental feature 
-					if(con)
-					{
-						//cout << "C " << CC.size() << "\n";
-						for(unsigned int k=0;k<CC.size();k++)
-						{
-							int t = CC[k].first;
-							int p = CC[k].second;
-							P2T[t-1][P[t-1].ID_map[p]] = T.size();
-						}
-						T.push_back(CC);
-					}
-					else
-					{
-						//cout << "I " << CC.size() << "\n";
-						for(unsigned int k=0;k<CC.size();k++)
-						{
-							std::vector<std::pair<int, int>> CCC;
-							CCC.push_back(CC[k]);
-							int t = CC[k].first;
-							int p = CC[k].second;
-							P2T[t-1][P[t-1].ID_map[p]] = T.size();
-							T.push_back(CCC);
-						}
-					}
-				}
+		imgs_s img;
+		VLOG(4) << "Take " << i+1;
+		bool succ = 0;
+		const TakeBundle& bundle = B[i];
 
-				
-				break;
+		size_t num_features = 0;
+		for(const TakeImage& cur : bundle.images)
+			num_features += cur.points2D.size();
+		img.features.Reserve(bundle.images.size(), num_features);
+		img.obs_all.Reserve(bundle.images.size(), num_features);
+
+		int pos = 0;
+		vector<int> n_obs;
+		for(const TakeImage& cur : bundle.images)
+		{
+			int id = cur.image_id;
+			img.id.push_back(id);
+			img.map[id] = pos;
+
+			n_obs.clear();
+			for(const point3D_t pnt : cur.point3D_ids)
+			{
+				n_obs.push_back(obs_id(pnt));
+				succ = 1;
 			}
+			img.features.AppendRow(cur.points2D);
+			img.obs_all.AppendRow(n_obs);
+			pos++;
 		}
-		//getline(fg, line);
+		ret.push_back(std::move(img));
+		VLOG(4) << succ;
 	}
-	fg.close();
-	cout << "TRACKS LOADED\n";
 
-	std::pair<std::vector<std::vector<std::pair<int, int>>>, std::vector<std::unordered_map<int, int>>> ret;
-	ret.first = T;
-	ret.second = P2T;
 	return ret;
 }
 
-std::vector<std::vector<int>> observed_tracks(std::vector<cam_s> C, std::vector<imgs_s> I, std::vector<pnts_s> P, std::vector<std::unordered_map<int, int>> P2T)
+std::vector<pnts_s> load_pnts(int takes)
 {
-	cout << "FINDING TRACKS OBSERVED BY THE CAMERAS\n";
-	std::vector<std::vector<int>> ret;
-	for(unsigned int i=0;i<C.size();i++)
+	return load_pnts(load_takes(takes));
+}
+
+std::vector<pnts_s> load_pnts(const std::vector<TakeBundle>& B)
+{
+	cout << "LOADING POINTS\n";
+	std::vector<pnts_s> ret;
+
+	for(unsigned int i=0;i<B.size();i++)
 	{
-		std::cout << i << "\n";
-		if(C[i].anchor == C[i].second)
+		VLOG(4) << "Take " << i+1;
+		pnts_s pnt;
+		const TakeBundle& bundle = B[i];
+
+		pnt.ID.reserve(bundle.points3D.size());
+		pnt.points.reserve(bundle.points3D.size());
+		pnt.color.reserve(bundle.points3D.size());
+		for(const TakePoint3D& cur : bundle.points3D)
 		{
-			std::vector<int> tr;
-			ret.push_back(tr);
-			continue;
+			int id = cur.point3D_id;
+			pnt.ID.push_back(id);
+			pnt.points.push_back(cur.xyz);
+			pnt.color.push_back(cur.color);
+			pnt.ID_map[id] = pnt.ID.size()-1;
 		}
-		int rec = C[i].anchor;
-		int cam = C[i].id_2;
-		std::cout << rec << " " << cam << "\n";
-		int pos = I[rec-1].map[cam];
-		//std::cout << "POS " << pos << "\n";
-		//std::cout << I[rec-1].obs.size() << "\n";
-		if(pos >= I[rec-1].obs.size())
+		
+		ret.push_back(pnt);
+	}
+
+	return ret;
+}
+
+namespace {
+
+//the graphs of the inconsistent tracks are stored as edge lists in a binary
+//file, which starts with a magic string and a version
+const char kTrackGraphsMagic[8] = {'T', 'B', 'S', 'F', 'M', 'G', 'R', '\0'};
+const uint32_t kTrackGraphsVersion = 1;
+
+void write_track_graphs(const tracks_s& TR, const std::string& path)
+{
+	std::ofstream file(path, std::ios::trunc | std::ios::binary);
+	CHECK(file.is_open()) << path;
+	file.write(kTrackGraphsMagic, sizeof(kTrackGraphsMagic));
+	WriteBinaryLittleEndian<uint32_t>(&file, kTrackGraphsVersion);
+	WriteBinaryLittleEndian<uint64_t>(&file, TR.graphs.size());
+	for(unsigned int i=0;i<TR.graphs.size();i++)
+	{
+		WriteBinaryLittleEndian<uint64_t>(&file, TR.graph_nodes[i].size());
+		for(const std::pair<int, int>& el : TR.graph_nodes[i])
 		{
-			std::vector<int> tr;
-			ret.push_back(tr);
-			continue;
+			WriteBinaryLittleEndian<int32_t>(&file, el.first);
+			WriteBinaryLittleEndian<int32_t>(&file, el.second);
 		}
-		std::vector<int> obs = I[rec-1].obs[pos];
-		//cout << pos << " " << I[rec-1].obs_all.size() << " " << I[rec-1].obs.size() << "\n";
-		//std::cout << "OBS " << pos << "\n";
-		std::vector<int> tr(obs.size());
-		for(unsigned int j=0;j<obs.size();j++)
+		WriteBinaryLittleEndian<uint64_t>(&file, TR.graphs[i].size());
+		for(const graph_edge_s& edge : TR.graphs[i])
 		{
-			int pnt_p = P[rec-1].ID_map.at(obs[j]);
-			int track = P2T[rec-1].at(pnt_p);
-			tr[j] = track;
+			WriteBinaryLittleEndian<int32_t>(&file, edge.i);
+			WriteBinaryLittleEndian<int32_t>(&file, edge.j);
+			WriteBinaryLittleEndian<double>(&file, edge.strength);
 		}
-		std::sort(tr.begin(), tr.end());
-		ret.push_back(tr);
 	}
-	cout << "FOUND\n";
+}
 
-	return ret;
+void read_track_graphs(const std::string& path, tracks_s * TR)
+{
+	std::ifstream file(path, std::ios::binary);
+	CHECK(file.is_open()) << path;
+	char magic[sizeof(kTrackGraphsMagic)];
+	file.read(magic, sizeof(magic));
+	CHECK(file && std::equal(magic, magic + sizeof(magic), kTrackGraphsMagic)) << path << " is not a track graph file";
+	const uint32_t version = ReadBinaryLittleEndian<uint32_t>(&file);
+	CHECK_EQ(version, kTrackGraphsVersion) << path;
+	const uint64_t num_graphs = ReadBinaryLittleEndian<uint64_t>(&file);
+	TR->graph_nodes.resize(num_graphs);
+	TR->graphs.resize(num_graphs);
+	for(uint64_t i=0;i<num_graphs;i++)
+	{
+		TR->graph_nodes[i].resize(ReadBinaryLittleEndian<uint64_t>(&file));
+		for(std::pair<int, int>& el : TR->graph_nodes[i])
+		{
+			el.first = ReadBinaryLittleEndian<int32_t>(&file);
+			el.second = ReadBinaryLittleEndian<int32_t>(&file);
+		}
+		TR->graphs[i].resize(ReadBinaryLittleEndian<uint64_t>(&file));
+		for(graph_edge_s& edge : TR->graphs[i])
+		{
+			edge.i = ReadBinaryLittleEndian<int32_t>(&file);
+			edge.j = ReadBinaryLittleEndian<int32_t>(&file);
+			edge.strength = ReadBinaryLittleEndian<double>(&file);
+		}
+	}
+	CHECK(file) << path << " is truncated";
 }
 
-std::vector<std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>> observed_tracks_2(std::vector<cam_s> C, std::vector<imgs_s> I, std::vector<pnts_s> P, std::vector<std::unordered_map<int, int>> P2T)
+}  // namespace
+
+std::pair<std::vector<std::vector<std::pair<int, int>>>, std::vector<std::unordered_map<int, int>>> load_tracks(const std::vector<pnts_s>& P, int takes, int max_num_threads)
 {
-	std::vector<std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>> ret;
-	for(unsigned int i=0;i<C.size();i++)
-	{		
-		//cout << "A\n";
-		int rec = C[i].anchor;
-		int cam = C[i].id_2;
-		//cout << rec << " " << cam << "\n";
-		int pos = I[rec-1].map[cam];
-		if(!I[rec-1].obs_all.size())
-		{
-			std::pair<std::vector<int>, std::vector<Eigen::Vector2d>> tr;
-			ret.push_back(tr);
-			continue;
+	cout << "LOADING TRACKS\n";
+	tracks_s TR;
+
+	ifstream ft;
+	ft.open("tracks.txt");
+	string line;
+	while(getline(ft, line))
+	{
+		std::vector<std::pair<int, int>> track;
+		int t;
+		int p;	
+		istringstream str(line);
+		while(str >> t)
+		{
+			str >> p;
+			track.push_back(std::make_pair(t, p));
 		}
-		//cout << pos << " " << I[rec-1].obs_all.size() << " " << I[rec-1].obs.size() << "\n";
-		std::vector<int> obs = I[rec-1].obs_all[pos];
-		//cout << "T1\n";
-		std::vector<Eigen::Vector2d> feat = I[rec-1].features[pos];
-		//cout << "T1\n";
-		std::vector<int> tr(obs.size());
-		//cout << "B\n";
-		for(unsigned int j=0;j<obs.size();j++)
+		TR.tracks.push_back(track);
+	}
+	ft.close();
+
+	read_track_graphs("graph.bin", &TR);
+
+	return load_tracks(P, takes, TR, max_num_threads);
+}
+
+std::pair<std::vector<std::vector<std::pair<int, int>>>, std::vector<std::unordered_map<int, int>>> load_tracks(const std::vector<pnts_s>& P, int takes, const tracks_s& TR, int max_num_threads)
+{
+	std::vector<std::vector<std::pair<int, int>>> T;
+	std::vector<std::unordered_map<int, int>> P2T(takes);
+
+	for(const std::vector<std::pair<int, int>>& track : TR.tracks)
+	{
+		for(const std::pair<int, int>& np : track)
 		{
-			if(obs[j] >= 0)
+			P2T[np.first-1][P[np.first-1].ID_map.at(np.second)] = T.size();
+		}
+		T.push_back(track);
+	}
+
+	//split the inconsistent tracks by their graphs, every track is an independent task
+	TrackSplitterOptions options;
+	options.num_threads = max_num_threads;
+	const std::vector<std::vector<std::vector<std::pair<int, int>>>> splits = SplitTracks(options, TR.graph_nodes, TR.graphs);
+	for(const std::vector<std::vector<std::pair<int, int>>>& split : splits)
+	{
+		for(const std::vector<std::pair<int, int>>& track : split)
+		{
+			for(const std::pair<int, int>& np : track)
 			{
-				int pnt_p = P[rec-1].ID_map.at(obs[j]);
-				int track = P2T[rec-1].at(pnt_p);
-				tr[j] = track;
+				P2T[np.first-1][P[np.first-1].ID_map.at(np.second)] = T.size();
 			}
-			else
+			T.push_back(track);
+		}
+	}
+	cout << "TRACKS LOADED\n";
+
+	std::pair<std::vector<std::vector<std::pair<int, int>>>, std::vector<std::unordered_map<int, int>>> ret;
+	ret.first = T;
+	ret.second = P2T;
+	return ret;
+}
+
+observed_s observed_tracks(const std::vector<cam_s>& C, const std::vector<imgs_s>& I, const std::vector<pnts_s>& P, const std::vector<std::unordered_map<int, int>>& P2T, int max_num_threads)
+{
+	TRACE_SCOPE("observed_tracks");
+	cout << "FINDING TRACKS OBSERVED BY THE CAMERAS\n";
+	observed_s ret;
+	ret.tracks.resize(C.size());
+	ret.features.resize(C.size());
+	//every camera writes only its own slots of ret
+	auto observed_by = [&C, &I, &P, &P2T, &ret](const int t, const int num_threads) {
+		for(unsigned int i=t;i<C.size();i+=num_threads)
+		{
+			int rec = C[i].anchor;
+			int cam = C[i].id_2;
+			int pos = I[rec-1].map.Find(cam);
+			if(pos < 0 || (size_t)pos >= I[rec-1].obs_all.NumRows())
+				continue;
+			//the track of every feature, or -1
+			const CsrRow<int> obs = I[rec-1].obs_all.Row(pos);
+			const CsrRow<Eigen::Vector2d> feat = I[rec-1].features.Row(pos);
+			std::vector<int>& tr = ret.features[i].first;
+			tr.resize(obs.size());
+			for(unsigned int j=0;j<obs.size();j++)
+			{
+				if(obs[j] >= 0)
+				{
+					int pnt_p = P[rec-1].ID_map.at(obs[j]);
+					tr[j] = P2T[rec-1].at(pnt_p);
+				}
+				else
+					tr[j] = -1;
+			}
+			ret.features[i].second.assign(feat.begin(), feat.end());
+
+			//the sorted tracks of the observed points, none for the anchor cameras
+			if(C[i].anchor == C[i].second) continue;
+			std::vector<int>& ot = ret.tracks[i];
+			ot.reserve(tr.size());
+			for(unsigned int j=0;j<tr.size();j++)
 			{
-				tr[j] = -1;
+				if(tr[j] >= 0)
+					ot.push_back(tr[j]);
 			}
+			std::sort(ot.begin(), ot.end());
 		}
-		//cout << "C\n";
-		std::pair<std::vector<int>, std::vector<Eigen::Vector2d>> nr;
-		nr.first = tr;
-		nr.second = feat;
-		ret.push_back(nr);
-		//cout << "D\n";
+	};
+
+	//small logs are not worth starting the threads
+	const int kMinNumCamsPerThread = 64;
+	const int num_threads = std::min(GetEffectiveNumThreads(max_num_threads), std::max(1, static_cast<int>(C.size()) / kMinNumCamsPerThread));
+	if(num_threads == 1)
+		observed_by(0, 1);
+	else
+	{
+		ParallelFor(0, num_threads, [&](const int t) { observed_by(t, num_threads); });
 	}
+	VLOG(3) << "FOUND";
 
 	return ret;
 }
 
-std::vector<std::vector<pair_t>> group_ot(std::vector<std::vector<int>> O, std::vector<cam_s> C, int takes)
+std::vector<std::vector<pair_t>> group_ot(const std::vector<std::vector<int>>& O, const std::vector<cam_s>& C, int takes)
 {
 	cout << "CREATING PAIRS OF CAMERAS\n";
 	
@@ -3939,10 +4958,10 @@ std::vector<std::vector<pair_t>> group_ot(std::vector<std::vector<int>> O, std::
 }
 
 //std::vector<std::vector<pair_t>> filter_groups(std::vector<std::vector<pair_t>> G, std::vector<std::vector<std::pair<int, int>>> T)
-std::vector<std::vector<pair_t>> filter_groups(std::vector<std::vector<pair_t>> G, std::vector<std::vector<std::pair<int, int>>> T, std::vector<pnts_s> P)
+std::vector<std::vector<pair_t>> filter_groups(const std::vector<std::vector<pair_t>>& G, const std::vector<std::vector<std::pair<int, int>>>& T, const std::vector<pnts_s>& P)
 {
 	std::cout << "FILTER GROUPS\n";
-	std::cout << G.size() << "\n";
+	VLOG(3) << G.size();
 	std::vector<std::vector<pair_t>> ret(G.size());
 	for(int i=0;i<G.size();i++)
 	{
@@ -3967,7 +4986,7 @@ std::vector<std::vector<pair_t>> filter_groups(std::vector<std::vector<pair_t>>
 					if(T[track_ix][a].first == i+1)
 					{
 						int pos = T[track_ix][a].second;
-						int pos2 = P[i].ID_map[pos];
+						int pos2 = P[i].ID_map.at(pos);
 						Eigen::Vector3d pnt = P[i].points[pos2];
 
 						//try all other points in the division and find the Euclidean distances from the current point
@@ -3981,7 +5000,7 @@ std::vector<std::vector<pair_t>> filter_groups(std::vector<std::vector<pair_t>>
 								if(T[track_ix2][b].first == i+1)
 								{
 									int pos_ = T[track_ix2][b].second;
-									int pos2_ = P[i].ID_map[pos_];
+									int pos2_ = P[i].ID_map.at(pos_);
 									Eigen::Vector3d pnt_ = P[i].points[pos2_];
 
 									//find the Euclidean distance
@@ -4001,7 +5020,7 @@ std::vector<std::vector<pair_t>> filter_groups(std::vector<std::vector<pair_t>>
 								if(T[track_ix2][b].first == i+1)
 								{
 									int pos_ = T[track_ix2][b].second;
-									int pos2_ = P[i].ID_map[pos_];
+									int pos2_ = P[i].ID_map.at(pos_);
 									Eigen::Vector3d pnt_ = P[i].points[pos2_];
 
 									//find the Euclidean distance
@@ -4032,7 +5051,7 @@ std::vector<std::vector<pair_t>> filter_groups(std::vector<std::vector<pair_t>>
 					if(T[track_ix][a].first == i+1)
 					{
 						int pos = T[track_ix][a].second;
-						int pos2 = P[i].ID_map[pos];
+						int pos2 = P[i].ID_map.at(pos);
 						Eigen::Vector3d pnt = P[i].points[pos2];
 
 						//try all other points in the division and find the Euclidean distances from the current point
@@ -4046,7 +5065,7 @@ std::vector<std::vector<pair_t>> filter_groups(std::vector<std::vector<pair_t>>
 								if(T[track_ix2][b].first == i+1)
 								{
 									int pos_ = T[track_ix2][b].second;
-									int pos2_ = P[i].ID_map[pos_];
+									int pos2_ = P[i].ID_map.at(pos_);
 									Eigen::Vector3d pnt_ = P[i].points[pos2_];
 
 									//find the Euclidean distance
@@ -4066,7 +5085,7 @@ std::vector<std::vector<pair_t>> filter_groups(std::vector<std::vector<pair_t>>
 								if(T[track_ix2][b].first == i+1)
 								{
 									int pos_ = T[track_ix2][b].second;
-									int pos2_ = P[i].ID_map[pos_];
+									int pos2_ = P[i].ID_map.at(pos_);
 									Eigen::Vector3d pnt_ = P[i].points[pos2_];
 
 									//find the Euclidean distance
@@ -4092,387 +5111,229 @@ std::vector<std::vector<pair_t>> filter_groups(std::vector<std::vector<pair_t>>
 			div.second = div2;
 			np.div = div;
 			nv[j] = np;
-			std::cout << i << " " << div1.size() << " " << div2.size() << "\n";
+			VLOG(4) << i << " " << div1.size() << " " << div2.size();
 		}
 		ret[i] = nv;
 	}
 	return ret;
 }
 
-int intersect_size(std::vector<int> O1, std::vector<int> O2)
+//union of two sorted lists that stops at the end of the shorter one, the clusters of linkage are joined with it
+std::vector<int> join(const std::vector<int>& O1, const std::vector<int>& O2)
 {
-	int sz = 0;
-	int pos1 = 0;
-	int pos2 = 0;
+	std::vector<int> ret;
+	ret.reserve(O1.size() + O2.size());
+	size_t pos1 = 0;
+	size_t pos2 = 0;
 	while(pos1 < O1.size() && pos2 < O2.size())
 	{
-		if(O1[pos1] == O2[pos2])
-		{
-			++pos1;
-			++pos2;
-			++sz;
-		}
-		else if(O1[pos1] < O2[pos2])
-		{
-			++pos1;
-		}
-		else
-		{
-			++pos2;
-		}
+		const int id1 = O1[pos1];
+		const int id2 = O2[pos2];
+		ret.push_back(id1 <= id2 ? id1 : id2);
+		pos1 += id1 <= id2;
+		pos2 += id2 <= id1;
 	}
-	return sz;
+	return ret;
 }
 
-std::vector<int> join(std::vector<int> O1, std::vector<int> O2)
+namespace {
+
+//a candidate join of the clusters a < b of linkage, it is stale if one of the clusters changed since it was scored
+struct linkage_join_s
 {
-	int sz = 0;
-	int pos1 = 0;
-	int pos2 = 0;
-	std::vector<int> ret;
-	while(pos1 < O1.size() && pos2 < O2.size())
-	{
-		if(O1[pos1] == O2[pos2])
-		{
-			ret.push_back(O1[pos1]);
-			++pos1;
-			++pos2;
-			++sz;
-		}
-		else if(O1[pos1] < O2[pos2])
-		{
-			ret.push_back(O1[pos1]);
-			++pos1;
-		}
-		else
-		{
-			ret.push_back(O2[pos2]);
-			++pos2;
-		}
-	}
-	return ret;
+	int score;
+	int a;
+	int b;
+	int version_a;
+	int version_b;
+	bool swapped;
+};
+
+//the join with the highest score is the first one, ties go to the lowest clusters as in a scan over all pairs
+bool operator<(const linkage_join_s& j1, const linkage_join_s& j2)
+{
+	if(j1.score != j2.score)
+		return j1.score < j2.score;
+	if(j1.a != j2.a)
+		return j1.a > j2.a;
+	return j1.b > j2.b;
 }
 
-std::vector<std::vector<pair_t>> linkage(std::vector<std::vector<pair_t>> G)
+//score of joining the clusters a and b, the smaller intersection of their corresponding divisions, while the
+//intersections of the other divisions must be small. swapped is set if the first division of a corresponds to
+//the second division of b. the score is zero if the clusters can not be joined
+int linkage_score(const pair_t& a, const pair_t& b, bool * swapped)
 {
-	cout << "GROUPING THE PAIRS OF CAMERAS\n";
-	std::vector<std::vector<pair_t>> NG(G.size());
 	const double block = 0.02;
+	const int s11 = SortedIdIntersectionSize(a.div.first, b.div.first);
+	const int s12 = SortedIdIntersectionSize(a.div.first, b.div.second);
+	const int s21 = SortedIdIntersectionSize(a.div.second, b.div.first);
+	const int s22 = SortedIdIntersectionSize(a.div.second, b.div.second);
+
+	int score = 0;
+	*swapped = 0;
+	//TODO change the threshold for the sim2 to join all relevant pairs
+	if(s11 > 0 && s22 > 0 && ( (s12 <= 2 && s21 <= 2) || (s12 <= block*a.div.first.size() && s12 <= block*b.div.second.size() && s21 <= block*a.div.second.size() && s21 <= block*b.div.first.size()) ))
+		score = std::min(s11, s22);
+	if(s12 > score && s21 > score && ( (s11 <= 2 && s22 <= 2) || (s11 <= block*a.div.first.size() && s11 <= block*b.div.first.size() && s22 <= block*a.div.second.size() && s22 <= block*b.div.second.size()) ))
+	{
+		score = std::min(s12, s21);
+		*swapped = 1;
+	}
+	return score;
+}
 
-	for(int i=0;i<G.size();i++)
-	{
-		cout << i << "\n";
-		std::vector<pair_t> CG = G[i];
+//joins the clusters of CG greedily, always the pair with the highest score. the candidate joins are kept in a heap,
+//after a join only the scores of the joined cluster are recomputed and the stale candidates are dropped when popped
+void link_group(std::vector<pair_t> * CG)
+{
+	std::vector<pair_t>& G = *CG;
+	std::vector<int> version(G.size(), 0);
+	std::vector<linkage_join_s> joins;
+	auto push_join = [&](const int a, const int b)
+	{
+		linkage_join_s candidate;
+		candidate.score = linkage_score(G[a], G[b], &candidate.swapped);
+		if(!candidate.score) return;
+		candidate.a = a;
+		candidate.b = b;
+		candidate.version_a = version[a];
+		candidate.version_b = version[b];
+		joins.push_back(candidate);
+		std::push_heap(joins.begin(), joins.end());
+	};
+
+	//find the initial similarity
+	for(int a=0;a<G.size();a++)
+	{
+		if(!G[a].size) continue;
+		for(int b=(a+1);b<G.size();b++)
+			if(G[b].size)
+				push_join(a, b);
+	}
+
+	//perform the linkage
+	while(!joins.empty())
+	{
+		std::pop_heap(joins.begin(), joins.end());
+		const linkage_join_s best = joins.back();
+		joins.pop_back();
+		if(!G[best.a].size || !G[best.b].size || best.version_a != version[best.a] || best.version_b != version[best.b])
+			continue;
 
-		//initialize the similarity matrices
-		std::vector<std::vector<int>> sim11(CG.size());
-		std::vector<std::vector<int>> sim12(CG.size());
-		std::vector<std::vector<int>> sim21(CG.size());
-		std::vector<std::vector<int>> sim22(CG.size());
-		for(int j=0;j<CG.size();j++)
+		//join the pair
+		pair_t& A = G[best.a];
+		pair_t& B = G[best.b];
+		if(!best.swapped)
 		{
-			std::vector<int> csim11(CG.size());
-			sim11[j] = csim11;
-
-			std::vector<int> csim12(CG.size());
-			sim12[j] = csim12;
-
-			std::vector<int> csim21(CG.size());
-			sim21[j] = csim21;
-
-			std::vector<int> csim22(CG.size());
-			sim22[j] = csim22;
-			
-			for(int k=0;k<CG.size();k++)
-			{
-				sim11[j][k] = 0;
-				sim12[j][k] = 0;
-				sim21[j][k] = 0;
-				sim22[j][k] = 0;
-			}
+			A.div.first = join(A.div.first, B.div.first);
+			A.div.second = join(A.div.second, B.div.second);
+			for(int a=0;a<B.label.size();a++)
+				A.label.push_back(B.label[a]);
 		}
-
-		//cout << "A\n";
-
-		//find the initial similarity
-		for(int a=0;a<CG.size();a++)
+		else
 		{
-			for(int b=(a+1);b<CG.size();b++)
+			A.div.first = join(A.div.first, B.div.second);
+			A.div.second = join(A.div.second, B.div.first);
+			for(int a=0;a<B.label.size();a++)
 			{
-				//find the intersection of the observations of pairs a and b
-				int c11 = intersect_size(CG[a].div.first, CG[b].div.first);
-				int c12 = intersect_size(CG[a].div.first, CG[b].div.second);
-				int c21 = intersect_size(CG[a].div.second, CG[b].div.first);
-				int c22 = intersect_size(CG[a].div.second, CG[b].div.second);
-
-				sim11[a][b] = c11;
-				sim12[a][b] = c12;
-				sim21[a][b] = c21;
-				sim22[a][b] = c22;
+				if(a%2)
+					A.label.push_back(B.label[a-1]);
+				else
+					A.label.push_back(B.label[a+1]);
 			}
 		}
+		B.div.first.clear();
+		B.div.second.clear();
+		A.size = A.size + B.size;
+		B.size = 0;
+		version[best.a]++;
+		version[best.b]++;
 
-		//cout << "B\n";
-
-		//perform the linkage
-		while(1)
+		//change the scores of the joined cluster
+		for(int a=0;a<G.size();a++)
 		{
-			//find the best pair to be joined
-			int max = 0;
-			int best_a = 0;
-			int best_b = 0;
-			bool swapped = 0;
-			for(int a=0;a<CG.size();a++)
-			{
-				if(!CG[a].size) continue;
-				int sz1 = CG[a].div.first.size() + CG[a].div.second.size();
-				for(int b=(a+1);b<CG.size();b++)
-				{
-					if(!CG[b].size) continue;
-					int sz2 = CG[b].div.first.size() + CG[b].div.second.size();
-					//TODO change the threshold for the sim2 to join all relevant pairs
-					if(sim11[a][b] > max && sim22[a][b] > max && ( (sim12[a][b] <= 2 && sim21[a][b] <= 2) || (sim12[a][b] <= block*CG[a].div.first.size() && sim12[a][b] <= block*CG[b].div.second.size() && sim21[a][b] <= block*CG[a].div.second.size() && sim21[a][b] <= block*CG[b].div.first.size()) ))
-					{
-						if(sim11[a][b] < sim22[a][b])
-							max = sim11[a][b];
-						else
-							max = sim22[a][b];
-						swapped = 0;
-						best_a = a;
-						best_b = b;
-					}
-					else if( sim12[a][b] > max && sim21[a][b] > max && ( (sim11[a][b] <= 2 && sim22[a][b] <= 2 ) || (sim11[a][b] <= block*CG[a].div.first.size() && sim11[a][b] <= block*CG[b].div.first.size() && sim22[a][b] <= block*CG[a].div.second.size() && sim22[a][b] <= block*CG[b].div.second.size()) ) )
-					{
-						if(sim12[a][b] < sim21[a][b])
-							max = sim12[a][b];
-						else
-							max = sim21[a][b];
-						swapped = 1;
-						best_a = a;
-						best_b = b;
-					}
-				}
-			}
-
-			//cout << "C\n";
-
-			if(!max) break;
-
-			//join the pair
-			if(!swapped)
-			{
-				vector<int> div1 = join(CG[best_a].div.first, CG[best_b].div.first);
-				vector<int> div2 = join(CG[best_a].div.second, CG[best_b].div.second);
-				CG[best_a].div.first = div1;
-				CG[best_a].div.second = div2;
-				vector<int> empty1;
-				vector<int> empty2;
-				CG[best_b].div.first = empty1;
-				CG[best_b].div.second = empty2;
-				CG[best_a].size = CG[best_a].size + CG[best_b].size;
-				CG[best_b].size = 0;
-
-				for(int a=0;a<CG[best_b].label.size();a++)
-					CG[best_a].label.push_back(CG[best_b].label[a]);
-			}
+			if(a == best.a || !G[a].size) continue;
+			if(a < best.a)
+				push_join(a, best.a);
 			else
-			{
-				vector<int> div1 = join(CG[best_a].div.first, CG[best_b].div.second);
-				vector<int> div2 = join(CG[best_a].div.second, CG[best_b].div.first);
-				CG[best_a].div.first = div1;
-				CG[best_a].div.second = div2;
-				vector<int> empty1;
-				vector<int> empty2;
-				CG[best_b].div.first = empty1;
-				CG[best_b].div.second = empty2;
-
-				for(int a=0;a<CG[best_b].label.size();a++)
-				{
-					if(a%2)
-						CG[best_a].label.push_back(CG[best_b].label[a-1]);
-					else
-						CG[best_a].label.push_back(CG[best_b].label[a+1]);
-				}
-			}
-
-			//cout << "D\n";
-
-			//change the values in the similarity matrices
-			for(int a=0;a<CG.size();a++)
-			{
-				if(a==best_a) continue;
-				int c11 = intersect_size(CG[a].div.first, CG[best_a].div.first);
-				int c12 = intersect_size(CG[a].div.first, CG[best_a].div.second);
-				int c21 = intersect_size(CG[a].div.second, CG[best_a].div.first);
-				int c22 = intersect_size(CG[a].div.second, CG[best_a].div.second);
-
-				if(a<best_a)
-				{
-					sim11[a][best_a] = c11;
-					sim12[a][best_a] = c12;
-					sim21[a][best_a] = c21;
-					sim22[a][best_a] = c22;
-				}
-				else
-				{
-					sim11[best_a][a] = c11;
-					sim12[best_a][a] = c12;
-					sim21[best_a][a] = c21;
-					sim22[best_a][a] = c22;
-				}
-			}
-			for(int a=0;a<CG.size();a++)
-			{
-				if(a<best_b)
-				{
-					sim11[a][best_b] = 0;
-					sim12[a][best_b] = 0;
-					sim21[a][best_b] = 0;
-					sim22[a][best_b] = 0;
-				}
-				else
-				{
-					sim11[best_b][a] = 0;
-					sim12[best_b][a] = 0;
-					sim21[best_b][a] = 0;
-					sim22[best_b][a] = 0;
-				}
-			}
-
-			//cout << "E\n";
+				push_join(best.a, a);
 		}
-		NG[i] = CG;
 	}
-
-	return NG;
 }
 
-std::vector<int> merge(std::vector<int> O1, std::vector<int> O2)
-{
-	std::vector<int> O;
-	unsigned int p1 = 0;
-	unsigned int p2 = 0;
-	while(1)
-	{
-		if(p1 >= O1.size() && p2 >= O2.size())
-		{
-			break;
-		}
-		else if(p1 >= O1.size())
-		{
-			for(;p2<O2.size();p2++)
-			{
-				O.push_back(O2[p2]);
-			}
-			break;
-		}
-		else if(p2 >= O2.size())
-		{
-			for(;p1<O1.size();p1++)
-			{
-				O.push_back(O1[p1]);
-			}
-			break;
-		}
-
-		if(O1[p1] < O2[p2])
-		{
-			O.push_back(O1[p1]);
-			p1++;
-		}
-		else if(O1[p1] > O2[p2])
-		{
-			O.push_back(O2[p2]);
-			p2++;
-		}
-		else
-		{
-			O.push_back(O1[p1]);
-			p1++;
-			p2++;
-		}
-	}
-	return O;
-}
+}  // namespace
 
-int common(std::vector<int> O1, std::vector<int> O2)
+std::vector<std::vector<pair_t>> linkage(const std::vector<std::vector<pair_t>>& G, int max_num_threads)
 {
-	int ret = 0;
-	unsigned int p1 = 0;
-	unsigned int p2 = 0;
-	while(1)
+	cout << "GROUPING THE PAIRS OF CAMERAS\n";
+	std::vector<std::vector<pair_t>> NG = G;
+
+	//the groups are independent of each other
+	auto link = [&](const int i)
 	{
-		if(p1 >= O1.size() || p2 >= O2.size())
-		{
-			break;
-		}
+		VLOG(4) << i;
+		link_group(&NG[i]);
+	};
 
-		if(O1[p1] < O2[p2])
-		{
-			p1++;
-		}
-		else if(O1[p1] > O2[p2])
-		{
-			p2++;
-		}
-		else
-		{
-			ret++;
-			p1++;
-			p2++;
-		}
+	if(GetEffectiveNumThreads(max_num_threads) == 1)
+	{
+		for(unsigned int i=0;i<NG.size();i++)
+			link(i);
 	}
-	return ret;
+	else
+		ParallelFor(0, NG.size(), link);
+
+	return NG;
 }
 
-std::vector<std::vector<std::pair<std::vector<int>, std::vector<int>>>> observed_by_cluster(std::vector<std::vector<std::vector<motion_t>>> CL, std::vector<std::vector<int>> O)
+std::vector<std::vector<std::pair<IdBitmap, IdBitmap>>> observed_by_cluster(const std::vector<std::vector<std::vector<motion_t>>>& CL, const std::vector<std::vector<int>>& O)
 {
-	std::vector<std::vector<std::pair<std::vector<int>, std::vector<int>>>> ret(CL.size());
+	TRACE_SCOPE("observed_by_cluster");
+	std::vector<std::vector<std::pair<IdBitmap, IdBitmap>>> ret(CL.size());
+	//compressed observations of the cameras, shared by all clusters
+	std::vector<IdBitmap> B(O.size());
+	for(unsigned int i=0;i<O.size();i++)
+		B[i] = IdBitmap(O[i]);
 	for(unsigned int i=0;i<CL.size();i++)
 	{
-		std::vector<std::vector<motion_t>> CL2 = CL[i];
-		std::vector<std::pair<std::vector<int>, std::vector<int>>> D2(CL2.size());
+		const std::vector<std::vector<motion_t>>& CL2 = CL[i];
+		std::vector<std::pair<IdBitmap, IdBitmap>>& D2 = ret[i];
+		D2.resize(CL2.size());
 		for(unsigned int j=0;j<CL2.size();j++)
 		{
-			std::vector<motion_t> CL3 = CL2[j];
-			std::pair<std::vector<int>, std::vector<int>> obs;
-			vector<int> obs1;
-			vector<int> obs2;
+			const std::vector<motion_t>& CL3 = CL2[j];
+			IdBitmap& obs1 = D2[j].first;
+			IdBitmap& obs2 = D2[j].second;
 			//cout << "NC\n";
 			for(unsigned int k=0;k<CL3.size();k++)
 			{
-				int cam1 = CL3[k].c1;
-				std::vector<int> o1 = O[cam1];
-				int cam2 = CL3[k].c2;
-				std::vector<int> o2 = O[cam2];
-				//cout << o1.size() << " " << o2.size() << " " << common(o1, o2) << "\n";
+				const IdBitmap& o1 = B[CL3[k].c1];
+				const IdBitmap& o2 = B[CL3[k].c2];
 				if(CL3[k].init < CL3[k].final)
 				{
-					obs1 = merge(obs1, o1);
-					obs2 = merge(obs2, o2);
+					obs1.UnionWith(o1);
+					obs2.UnionWith(o2);
 				}
 				else
 				{
-					obs1 = merge(obs1, o2);
-					obs2 = merge(obs2, o1);
+					obs1.UnionWith(o2);
+					obs2.UnionWith(o1);
 				}
 			}
-			obs.first = obs1;
-			obs.second = obs2;
-			D2[j] = obs;
 		}
-		ret[i] = D2;
 	}
 	return ret;
 }
 
-std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<std::vector<clust_m>> CL, std::vector<std::vector<std::pair<std::vector<int>, std::vector<int>>>> O, double thr1, double thr2, double pd )
+std::vector<std::vector<std::pair<int, int>>> chordal_completion( const std::vector<std::vector<clust_m>>& CL, const std::vector<std::vector<std::pair<IdBitmap, IdBitmap>>>& O, double thr1, double thr2, double pd, int max_num_threads )
 {
+	TRACE_SCOPE("chordal_completion");
 	std::vector<std::pair<int, int>> num2cl;
 	std::vector<clust_m> C;
 	for(unsigned int i=0;i<CL.size();i++)
 	{
-		std::vector<clust_m> T = CL[i];
+		const std::vector<clust_m>& T = CL[i];
 		for(unsigned int j=0;j<T.size();j++)
 		{
 			C.push_back(T[j]);
@@ -4481,62 +5342,104 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 			np.second = j;
 			num2cl.push_back(np);
 		}
-	}
-
-	//create the structure of the edges
-	vector<edge_s> E;
-	Eigen::MatrixXi C2E = Eigen::MatrixXi::Ones(C.size(), C.size());
-	C2E = -C2E;
+	}
+
+	//create the structure of the edges, the clusters which share a take are connected from the start,
+	//the other pairs of clusters get an edge only when it is added as a chord or a cycle is checked
+	vector<edge_s> E;
+	std::unordered_map<uint64_t, int> C2E;
+	auto edge_key = [](const int i, const int j)
+	{
+		return (static_cast<uint64_t>(std::min(i, j)) << 32) | static_cast<uint64_t>(std::max(i, j));
+	};
+	auto add_edge = [&](const int i, const int j, const int grade)
+	{
+		edge_s ne;
+		ne.cl1 = std::min(i, j);
+		ne.cl2 = std::max(i, j);
+		ne.pred = -1;
+		ne.grade = grade;
+		ne.rc = 0;
+		ne.tc = 0;
+		C2E[edge_key(i, j)] = E.size();
+		E.push_back(ne);
+	};
+	auto grade_edge = [&](edge_s * ne)
+	{
+		const IdBitmap& o11 = O[num2cl[ne->cl1].first][num2cl[ne->cl1].second].first;
+		const IdBitmap& o21 = O[num2cl[ne->cl2].first][num2cl[ne->cl2].second].first;
+
+		const IdBitmap& o12 = O[num2cl[ne->cl1].first][num2cl[ne->cl1].second].second;
+		const IdBitmap& o22 = O[num2cl[ne->cl2].first][num2cl[ne->cl2].second].second;
+		int com1 = IdBitmapIntersectionSize(o11, o21);
+		int com2 = IdBitmapIntersectionSize(o12, o22);
+		int com3 = IdBitmapIntersectionSize(o11, o22);
+		int com4 = IdBitmapIntersectionSize(o12, o21);
+		ne->common = com1+com2-com3-com4;
+		if(com3+com4==0)
+			ne->ratio = INFINITY;
+		else
+			ne->ratio = (double)(com1+com2)/(double)(com3+com4);
+	};
+	//index of the edge of the clusters i and j, -1 if there is none yet
+	auto find_edge = [&](const int i, const int j)
+	{
+		const auto el = C2E.find(edge_key(i, j));
+		return el == C2E.end() ? -1 : el->second;
+	};
+	//the missing edges have the grade -1
+	auto edge_grade = [&](const int i, const int j)
+	{
+		const int e = find_edge(i, j);
+		return e == -1 ? -1 : E[e].grade;
+	};
+	auto get_edge = [&](const int i, const int j)
+	{
+		int e = find_edge(i, j);
+		if(e == -1)
+		{
+			e = E.size();
+			add_edge(i, j, -1);
+			grade_edge(&E[e]);
+		}
+		return e;
+	};
 
+	std::unordered_map<int, vector<int>> take2cl;
 	for(unsigned int i=0;i<C.size();i++)
 	{
-		for(unsigned int j=i+1;j<C.size();j++)
+		take2cl[C[i].init].push_back(i);
+		if(C[i].final != C[i].init)
+			take2cl[C[i].final].push_back(i);
+	}
+	vector<int> neighbours;
+	for(unsigned int i=0;i<C.size();i++)
+	{
+		neighbours.clear();
+		for(const int take : {C[i].init, C[i].final})
 		{
-			if(C[i].init == C[j].init && C[i].final == C[j].final)
-				continue;
-			C2E(i,j) = E.size();
-			C2E(j,i) = E.size();
-			edge_s ne;
-			if( (C[i].init == C[j].init) || (C[i].init == C[j].final) || (C[i].final == C[j].init) || (C[i].final == C[j].final) )
-			{
-				
-				ne.cl1 = i;
-				ne.cl2 = j;
-				ne.pred = -1;
-				ne.grade = 0;
-				ne.rc = 0;
-				ne.tc = 0;
-				
-			}
-			else
+			for(const int j : take2cl.at(take))
 			{
-				//cout << "NF\n";
-				ne.cl1 = i;
-				ne.cl2 = j;
-				ne.pred = -1;
-				ne.grade = -1;
-				ne.rc = 0;
-				ne.tc = 0;
+				if(j <= static_cast<int>(i)) continue;
+				if(C[i].init == C[j].init && C[i].final == C[j].final) continue;
+				neighbours.push_back(j);
 			}
-			std::vector<int> o11 = O[num2cl[i].first][num2cl[i].second].first;
-			std::vector<int> o21 = O[num2cl[j].first][num2cl[j].second].first;
-
-			std::vector<int> o12 = O[num2cl[i].first][num2cl[i].second].second;
-			std::vector<int> o22 = O[num2cl[j].first][num2cl[j].second].second;
-			int com1 = common(o11, o21);
-			int com2 = common(o12, o22);
-			int com3 = common(o11, o22);
-			int com4 = common(o12, o21);
-			//cout << i << " " << j << " " << " " << common << "\n";
-			ne.common = com1+com2-com3-com4;
-			if(com3+com4==0)
-				ne.ratio = INFINITY;
-			else
-				ne.ratio = (double)(com1+com2)/(double)(com3+com4);
-			//cout << num2cl[i].first << " " << num2cl[i].second << " " << num2cl[j].first << " " << num2cl[j].second << " " << ne.common << " " << ne.ratio << "\n";
-			E.push_back(ne);
 		}
+		std::sort(neighbours.begin(), neighbours.end());
+		neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+		for(const int j : neighbours)
+			add_edge(i, j, 0);
+	}
+
+	//the edges are graded independently of each other
+	const int kMinNumEdgesPerTask = 64;
+	if(GetEffectiveNumThreads(max_num_threads) == 1)
+	{
+		for(unsigned int e=0;e<E.size();e++)
+			grade_edge(&E[e]);
 	}
+	else
+		ParallelFor(0, E.size(), [&](const int e) { grade_edge(&E[e]); }, kMinNumEdgesPerTask);
 
 	//create the structure of the cycles
 	vector<pair<Eigen::Vector3i, int>> CY;
@@ -4572,15 +5475,16 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 	//perform the chordal completion
 	vector<int> verified_edges;
 	vector<int> verified_edges_2;
+	vector<int> edges_buffer;
 	while(Q.size())
 	{
 		vector<pair<Eigen::Vector3i, int>> NQ;
 		for(unsigned int i=0;i<Q.size();i++)
 		{
 			pair<Eigen::Vector3i, int> cur = Q[i];
-			int e1 = E[C2E(cur.first(0), cur.first(1))].grade;
-			int e2 = E[C2E(cur.first(0), cur.first(2))].grade;
-			int e3 = E[C2E(cur.first(1), cur.first(2))].grade;
+			int e1 = edge_grade(cur.first(0), cur.first(1));
+			int e2 = edge_grade(cur.first(0), cur.first(2));
+			int e3 = edge_grade(cur.first(1), cur.first(2));
 			//if(e1==-1 || e2 == -1 || e3 == -1)
 			//	cout << e1 << " " << e2 << " " << e3 << "\n";
 			if((e1==-1 && e2==-1) || (e1==-1 && e3==-1) || (e2==-1 && e3==-1))
@@ -4596,10 +5500,9 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 					grade = e2+1;
 				else
 					grade = e3+1;
-				edge_s ce = E[C2E(cur.first(0), cur.first(1))];
+				edge_s& ce = E[get_edge(cur.first(0), cur.first(1))];
 				ce.grade = grade;
 				ce.pred = cur.second;
-				E[C2E(cur.first(0), cur.first(1))] = ce;
 			}
 			else if(e2 == -1)
 			{
@@ -4609,10 +5512,9 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 					grade = e1+1;
 				else
 					grade = e3+1;
-				edge_s ce = E[C2E(cur.first(0), cur.first(2))];
+				edge_s& ce = E[get_edge(cur.first(0), cur.first(2))];
 				ce.grade = grade;
 				ce.pred = cur.second;
-				E[C2E(cur.first(0), cur.first(2))] = ce;
 			}
 			else if(e3 == -1)
 			{
@@ -4622,10 +5524,9 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 					grade = e1+1;
 				else
 					grade = e2+1;
-				edge_s ce = E[C2E(cur.first(1), cur.first(2))];
+				edge_s& ce = E[get_edge(cur.first(1), cur.first(2))];
 				ce.grade = grade;
 				ce.pred = cur.second;
-				E[C2E(cur.first(1), cur.first(2))] = ce;
 			}
 			else
 			{
@@ -4644,9 +5545,9 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 					vector<int> cycles;
 					cycles.push_back(cur.second);
 					stack<int> st;
-					st.push(C2E(cur.first(0), cur.first(2)));
-					st.push(C2E(cur.first(1), cur.first(2)));
-					st.push(C2E(cur.first(0), cur.first(1)));
+					st.push(find_edge(cur.first(0), cur.first(2)));
+					st.push(find_edge(cur.first(1), cur.first(2)));
+					st.push(find_edge(cur.first(0), cur.first(1)));
 					while(st.size())
 					{
 						int cur_c = st.top();
@@ -4660,9 +5561,9 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 							int pred = E[cur_c].pred;
 							cycles.push_back(pred);
 							pair<Eigen::Vector3i, int> cycle = CY[pred];
-							int ne1 = C2E(cycle.first(0), cycle.first(1));
-							int ne2 = C2E(cycle.first(0), cycle.first(2));
-							int ne3 = C2E(cycle.first(1), cycle.first(2));
+							int ne1 = find_edge(cycle.first(0), cycle.first(1));
+							int ne2 = find_edge(cycle.first(0), cycle.first(2));
+							int ne3 = find_edge(cycle.first(1), cycle.first(2));
 							if(ne3 != cur_c)
 								st.push(ne3);
 							if(ne2 != cur_c)
@@ -4835,7 +5736,7 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 												for(unsigned int k=j+1;k<cycle.size();k++)
 												{
 													if(cycle[j] == cycle[k]) continue;
-													edge_s ce = E[C2E(cycle[j],cycle[k])];
+													const edge_s ce = E[get_edge(cycle[j],cycle[k])];
 													//cout << "COMMON " << ce.common << " " << ce.ratio << "\n";
 													if(ce.ratio < worst)
 														worst = ce.ratio;
@@ -4847,7 +5748,7 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 											{
 												//cout << "K\n";
 												//no contradictory cluster
-												verified_edges = merge(verified_edges, se);
+												SortedIdUnionInPlace(se, &verified_edges, &edges_buffer);
 												for(unsigned int j=0;j<se.size();j++)
 												{
 													if(E[se[j]].rc < 1/rc)
@@ -4862,9 +5763,8 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 											}
 											else if(worst >= 0.5 || w2 >= -20)
 											{
-												cout << "?\n";
 												//no hard contradictory cluster
-												verified_edges_2 = merge(verified_edges_2, se);
+												SortedIdUnionInPlace(se, &verified_edges_2, &edges_buffer);
 												for(unsigned int j=0;j<se.size();j++)
 												{
 													if(E[se[j]].rc < 1/(2*rc))
@@ -4948,7 +5848,7 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 				CC.push_back(i);
 		}
 		bool consistent = 1;
-		cout << "GROUP " << cl << " size " << CC.size() << "\n";
+		VLOG(4) << "GROUP " << cl << " size " << CC.size();
 		int ic = 0;
 		for(unsigned int i=0;i<CC.size();i++)
 		{
@@ -4971,8 +5871,9 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 				}
 				else
 				{
-					int common = E[C2E(CC[i], CC[j])].common;
-					double ratio = E[C2E(CC[i], CC[j])].ratio;
+					const edge_s& ce = E[get_edge(CC[i], CC[j])];
+					int common = ce.common;
+					double ratio = ce.ratio;
 					if(ratio < 0.5 && common < -20)
 					{
 						consistent = 0;
@@ -4984,7 +5885,7 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 				}
 			}
 		}
-		cout << consistent << "\n";
+		VLOG(4) << consistent;
 		if(consistent)
 		{
 			CCCC.push_back(CC);
@@ -5006,7 +5907,7 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 			{
 				for(int j=i+1;j<CC.size();j++)
 				{
-					int edge = C2E(CC[i], CC[j]);
+					int edge = find_edge(CC[i], CC[j]);
 					if(edge != -1)
 					{
 						r_dist(i,j) = E[edge].rc;
@@ -5070,25 +5971,17 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 			L_3 = (1/w3)*L_3;
 			Eigen::MatrixXd L = L_1+L_2+L_3;
 			//Eigen::MatrixXd L = L3;
-			Eigen::EigenSolver<Eigen::MatrixXd> es(L);
-			Eigen::MatrixXcd lambda = es.eigenvalues();
-			Eigen::MatrixXcd V = es.eigenvectors();
+			//at most 10 eigenvectors of the symmetric laplacian are used
+			Eigen::VectorXd lambda;
+			Eigen::MatrixXd V;
+			SmallestSymmetricEigenvectors(L, std::min((int)CC.size(), 10), &lambda, &V);
 			for(int i=2;i<CC.size();i++)
 			{
 				cout << "CONSISTENCY SPLITTING\n";
 				int dim = i;
 				if(i>10) dim=10;
-				vector<Eigen::VectorXd> a;
-				for(unsigned int j=0;j<CC.size();j++)
-				{
-					Eigen::VectorXd nv(dim);
-					for(int k=0;k<dim;k++)
-					{
-						nv(k) = V(j,k).real();
-					}
-					a.push_back(nv);
-				}
-				vector<int> c = kmeans(a, i, dim);
+				const KMeansPointsd a = V.leftCols(dim);
+				vector<int> c = kmeans(a, i);
 				//for(int j=0;j<c.size();j++) cout << c[j] << "\n";
 				//cout << "G\n";
 
@@ -5123,8 +6016,9 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 							}
 							else
 							{
-								int common = E[C2E(CCC[k], CCC[j])].common;
-								double ratio = E[C2E(CCC[k], CCC[j])].ratio;
+								const edge_s& ce = E[get_edge(CCC[k], CCC[j])];
+								int common = ce.common;
+								double ratio = ce.ratio;
 								if(ratio < 0.5 && common < -20)
 								{
 									ccons = 0;
@@ -5167,8 +6061,9 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 			{
 				for(unsigned int b=0;b<CCCC[j].size();b++)
 				{
-					int common = E[C2E(CCCC[i][a], CCCC[j][b])].common;
-					double ratio = E[C2E(CCCC[i][a], CCCC[j][b])].ratio;
+					const edge_s& ce = E[get_edge(CCCC[i][a], CCCC[j][b])];
+					int common = ce.common;
+					double ratio = ce.ratio;
 					cout << "AA " << common << " " << ratio << "\n";
 				}
 			}
@@ -5190,7 +6085,7 @@ std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<st
 	return ret;
 }
 
-std::vector<std::vector<std::pair<int, int>>> split_cams(std::vector<std::vector<std::pair<std::vector<int>, std::vector<int>>>> O)
+std::vector<std::vector<std::pair<int, int>>> split_cams(const std::vector<std::vector<std::pair<IdBitmap, IdBitmap>>>& O)
 {
 	std::vector<std::pair<int, int>> num2cl;
 	for(unsigned int i=0;i<O.size();i++)
@@ -5198,9 +6093,9 @@ std::vector<std::vector<std::pair<int, int>>> split_cams(std::vector<std::vector
 		for(unsigned int j=0;j<O[i].size();j++)
 		{
 			//check whether the cluster is contradictory
-			int com = common(O[i][j].first, O[i][j].second);
-			//cout << "COMMON " << com << " " << O[i][j].first.size() + O[i][j].second.size() << "\n";
-			if((unsigned int)(20*com) <= O[i][j].first.size() + O[i][j].second.size())
+			int com = IdBitmapIntersectionSize(O[i][j].first, O[i][j].second);
+			//cout << "COMMON " << com << " " << O[i][j].first.Size() + O[i][j].second.Size() << "\n";
+			if((unsigned int)(20*com) <= O[i][j].first.Size() + O[i][j].second.Size())
 			{
 				pair<int, int> np;
 				np.first = i;
@@ -5216,16 +6111,16 @@ std::vector<std::vector<std::pair<int, int>>> split_cams(std::vector<std::vector
 	{
 		for(unsigned int j=0;j<num2cl.size();j++)
 		{
-			std::vector<int> o11 = O[num2cl[i].first][num2cl[i].second].first;
-			std::vector<int> o21 = O[num2cl[j].first][num2cl[j].second].first;
+			const IdBitmap& o11 = O[num2cl[i].first][num2cl[i].second].first;
+			const IdBitmap& o21 = O[num2cl[j].first][num2cl[j].second].first;
 
-			std::vector<int> o12 = O[num2cl[i].first][num2cl[i].second].second;
-			std::vector<int> o22 = O[num2cl[j].first][num2cl[j].second].second;
+			const IdBitmap& o12 = O[num2cl[i].first][num2cl[i].second].second;
+			const IdBitmap& o22 = O[num2cl[j].first][num2cl[j].second].second;
 			
-			int com1 = common(o11, o21);
-			int com2 = common(o12, o22);
-			int com3 = common(o11, o22);
-			int com4 = common(o12, o21);
+			int com1 = IdBitmapIntersectionSize(o11, o21);
+			int com2 = IdBitmapIntersectionSize(o12, o22);
+			int com3 = IdBitmapIntersectionSize(o11, o22);
+			int com4 = IdBitmapIntersectionSize(o12, o21);
 
 			if(com1 > 0 && com2 > 0 && com3 <= 0 && com4 <= 0)
 				b_mat(i,j) = 1;
@@ -5300,18 +6195,21 @@ std::vector<std::vector<std::pair<int, int>>> split_cams(std::vector<std::vector
 			d_mat(j,j) = d;
 		}
 		//cout << c_mat << "\n\n";
-		Eigen::MatrixXd ZA = d_mat.inverse() * c_mat;
-		Eigen::EigenSolver<Eigen::MatrixXd> es(ZA);
-		Eigen::MatrixXcd lambda = es.eigenvalues();
-		Eigen::MatrixXcd V = es.eigenvectors();
+		//D^-1 C has the eigenvalues of the symmetric D^-1/2 C D^-1/2 and its
+		//eigenvectors are scaled by D^-1/2
+		Eigen::VectorXd d_inv_sqrt = d_mat.diagonal().cwiseSqrt().cwiseInverse();
+		Eigen::MatrixXd ZA = d_inv_sqrt.asDiagonal() * c_mat * d_inv_sqrt.asDiagonal();
+		Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(ZA);
+		const Eigen::VectorXd& lambda = es.eigenvalues();
+		Eigen::MatrixXd V = d_inv_sqrt.asDiagonal() * es.eigenvectors();
 		
 		//cout << lambda << "\n\n";
 		int best = -1;
 		double best_d = INFINITY;
 		for(unsigned int j=0;j<comp.size();j++)
 		{
-			double dist = fabs(lambda(j).real() - 1);
-			//cout << dist << " " << lambda(j).real() << "\n";
+			double dist = fabs(lambda(j) - 1);
+			//cout << dist << " " << lambda(j) << "\n";
 			if(dist < best_d)
 			{
 				best_d = dist;
@@ -5325,8 +6223,8 @@ std::vector<std::vector<std::pair<int, int>>> split_cams(std::vector<std::vector
 			Eigen::VectorXd nv(comp.size());
 			for(unsigned int k=0;k<comp.size();k++)
 			{
-				//nv(k) = V(best,k).real();
-				nv(k) = V(k,best).real();
+				//nv(k) = V(best,k);
+				nv(k) = V(k,best);
 			}
 			/*cout << "EV " << lambda(best) << "\n\n";
 			cout << nv << "\n\n";*/
@@ -5362,7 +6260,7 @@ std::vector<std::vector<std::pair<int, int>>> split_cams(std::vector<std::vector
 	return ret;
 }
 
-int select_group(std::vector<std::vector<std::pair<int, int>>> CLCL, std::vector<std::vector<clust_m>> CL)
+int select_group(const std::vector<std::vector<std::pair<int, int>>>& CLCL, const std::vector<std::vector<clust_m>>& CL)
 {
 	int ret = 0;
 	int count = 0;
@@ -5383,7 +6281,7 @@ int select_group(std::vector<std::vector<std::pair<int, int>>> CLCL, std::vector
 	return ret;
 }
 
-int select_group_o(std::vector<std::vector<std::pair<int, int>>> CLCL, std::vector<std::vector<std::pair<std::vector<int>, std::vector<int>>>> O)
+int select_group_o(const std::vector<std::vector<std::pair<int, int>>>& CLCL, const std::vector<std::vector<std::pair<IdBitmap, IdBitmap>>>& O)
 {
 	int ret = 0;
 	int count = 0;
@@ -5394,8 +6292,8 @@ int select_group_o(std::vector<std::vector<std::pair<int, int>>> CLCL, std::vect
 		for(unsigned int j=0;j<CLCL[i].size();j++)
 		{
 			pair<int, int> cur = CLCL[i][j];
-			cur_bg += O[cur.first][cur.second].first.size();
-			cur_fg += O[cur.first][cur.second].second.size();
+			cur_bg += O[cur.first][cur.second].first.Size();
+			cur_fg += O[cur.first][cur.second].second.Size();
 		}
 		int cur_c = cur_fg;
 		if(cur_bg < cur_fg)
@@ -5409,7 +6307,7 @@ int select_group_o(std::vector<std::vector<std::pair<int, int>>> CLCL, std::vect
 	return ret;
 }
 
-std::pair<std::vector<int>, std::vector<int>> group_cams(std::vector<std::pair<int, int>> CL, std::vector<std::vector<std::vector<motion_t>>> MM)
+std::pair<std::vector<int>, std::vector<int>> group_cams(const std::vector<std::pair<int, int>>& CL, const std::vector<std::vector<std::vector<motion_t>>>& MM)
 {
 	vector<int> OB;
 	vector<int> OO;
@@ -5464,15 +6362,16 @@ std::pair<std::vector<int>, std::vector<int>> group_cams(std::vector<std::pair<i
 	return ret;
 }
 
-std::pair<std::pair<std::vector<int>, std::vector<int>>, std::vector<int>> split_tracks(std::pair<std::vector<int>, std::vector<int>> Q, std::vector<std::vector<int>> O, int size)
+std::pair<std::pair<std::vector<int>, std::vector<int>>, std::vector<int>> split_tracks(const std::pair<std::vector<int>, std::vector<int>>& Q, const std::vector<std::vector<int>>& O, int size)
 {
+	TRACE_SCOPE("split_tracks");
 	vector<int> score(size);
 	for(int i=0;i<size;i++)
 		score[i] = 0;
-	vector<int> bck = Q.first;
+	const vector<int>& bck = Q.first;
 	for(unsigned int i=0;i<bck.size();i++)
 	{
-		vector<int> obs = O[bck[i]];
+		const vector<int>& obs = O[bck[i]];
 		for(unsigned int j=0;j<obs.size();j++)
 		{
 			score[obs[j]]++;
@@ -5487,10 +6386,10 @@ std::pair<std::pair<std::vector<int>, std::vector<int>>, std::vector<int>> split
 		}
 	}*/
 	int col = 0;
-	vector<int> obj = Q.second;
+	const vector<int>& obj = Q.second;
 	for(unsigned int i=0;i<obj.size();i++)
 	{
-		vector<int> obs = O[obj[i]];
+		const vector<int>& obs = O[obj[i]];
 		for(unsigned int j=0;j<obs.size();j++)
 		{
 			if(score[obs[j]] > 0)
@@ -5498,7 +6397,7 @@ std::pair<std::pair<std::vector<int>, std::vector<int>>, std::vector<int>> split
 			score[obs[j]]--;
 		}
 	}
-	cout << "COLISIONS " << col << "\n";
+	VLOG(3) << "COLISIONS " << col;
 
 	vector<int> bt;
 	vector<int> ot;
@@ -5522,64 +6421,101 @@ std::pair<std::pair<std::vector<int>, std::vector<int>>, std::vector<int>> split
 	return ret2;
 }
 
-std::vector<int> order_fold(std::vector<std::vector<std::pair<int, int>>> T, std::pair<std::vector<int>, std::vector<int>> OT, int takes)
+namespace {
+
+//the number of tracks that every pair of takes has in common, the smaller one
+//of the background and the object tracks. The points of a track are counted
+//per take, so that every track is visited once
+Eigen::MatrixXd take_overlaps(const std::vector<std::vector<std::pair<int, int>>>& T, const std::pair<std::vector<int>, std::vector<int>>& OT, int takes)
 {
-	vector<int> b = OT.first;
-	vector<int> o = OT.second;
 	Eigen::MatrixXd b_mat = Eigen::MatrixXd::Zero(takes, takes);
 	Eigen::MatrixXd o_mat = Eigen::MatrixXd::Zero(takes, takes);
-	//common points for background
-	for(unsigned int i=0;i<b.size();i++)
+	vector<int> counts(takes, 0);
+	vector<int> track_takes;
+	for(const pair<const vector<int>*, Eigen::MatrixXd*> part : {std::make_pair(&OT.first, &b_mat), std::make_pair(&OT.second, &o_mat)})
 	{
-		vector<pair<int, int>> tr = T[b[i]];
-		if(tr.size() > 1)
+		for(const int t : *part.first)
 		{
-			for(unsigned int q=0;q<tr.size();q++)
+			track_takes.clear();
+			for(const pair<int, int>& el : T[t])
 			{
-				for(unsigned int r=q+1;r<tr.size();r++)
-				{
-					if(tr[q].first != tr[r].first)
-					{
-						b_mat(tr[q].first-1, tr[r].first-1) = b_mat(tr[q].first-1, tr[r].first-1) + 1;
-						b_mat(tr[r].first-1, tr[q].first-1) = b_mat(tr[q].first-1, tr[r].first-1) + 1;
-					}
-				}
+				if(!counts[el.first-1]++)
+					track_takes.push_back(el.first-1);
 			}
-		}
-	}
-	//common points for object
-	for(unsigned int i=0;i<o.size();i++)
-	{
-		vector<pair<int, int>> tr = T[o[i]];
-		if(tr.size() > 1)
-		{
-			for(unsigned int q=0;q<tr.size();q++)
+			for(unsigned int q=0;q<track_takes.size();q++)
 			{
-				for(unsigned int r=q+1;r<tr.size();r++)
+				for(unsigned int r=q+1;r<track_takes.size();r++)
 				{
-					if(tr[q].first != tr[r].first)
-					{
-						o_mat(tr[q].first-1, tr[r].first-1) = o_mat(tr[q].first-1, tr[r].first-1) + 1;
-						o_mat(tr[r].first-1, tr[q].first-1) = o_mat(tr[q].first-1, tr[r].first-1) + 1;
-					}
+					const int common = counts[track_takes[q]] * counts[track_takes[r]];
+					(*part.second)(track_takes[q], track_takes[r]) += common;
+					(*part.second)(track_takes[r], track_takes[q]) += common;
 				}
 			}
+			for(const int take : track_takes)
+				counts[take] = 0;
 		}
 	}
-	Eigen::MatrixXd min_mat = o_mat;
-	for(int i=0;i<takes;i++)
+	return b_mat.cwiseMin(o_mat);
+}
+
+//groups the takes of the merging order by their depth in the maximum spanning
+//tree of their overlaps, whose root is the reference take at the front of the
+//order. A take is only aligned to the takes of the previous groups, so that
+//the takes of a group are aligned independently
+std::vector<std::vector<int>> spanning_tree_levels(const Eigen::MatrixXd& overlaps, const std::vector<int>& order)
+{
+	const int takes = overlaps.rows();
+	vector<int> depth(takes, -1);
+	vector<int> parent(takes, -1);
+	vector<double> best(takes, -1);
+	vector<int> candidates;
+	for(unsigned int rr=1;rr<order.size();rr++)
 	{
-		for(int j=0;j<takes;j++)
+		if(order[rr] >= 0 && order[rr] != order[0] && std::find(candidates.begin(), candidates.end(), order[rr]) == candidates.end())
+			candidates.push_back(order[rr]);
+	}
+
+	std::vector<std::vector<int>> levels;
+	int added = order[0];
+	depth[added] = 0;
+	while(1)
+	{
+		//update the strongest connections to the tree and add the take with
+		//the strongest one, the first one in the order on ties
+		int next = -1;
+		for(const int r : candidates)
 		{
-			if(b_mat(i,j) < o_mat(i,j))
-				min_mat(i,j) = b_mat(i,j);
+			if(depth[r] >= 0) continue;
+			if(overlaps(r, added) > best[r])
+			{
+				best[r] = overlaps(r, added);
+				parent[r] = added;
+			}
+			if(next < 0 || best[r] > best[next])
+				next = r;
 		}
+		if(next < 0) break;
+		depth[next] = depth[parent[next]] + 1;
+		if((int)levels.size() < depth[next])
+			levels.resize(depth[next]);
+		levels[depth[next]-1].push_back(next);
+		added = next;
 	}
+	return levels;
+}
+
+}  // namespace
+
+std::vector<int> order_fold(const std::vector<std::vector<std::pair<int, int>>>& T, const std::pair<std::vector<int>, std::vector<int>>& OT, int takes)
+{
+	TRACE_SCOPE("order_fold");
+	const Eigen::MatrixXd min_mat = take_overlaps(T, OT, takes);
+
 	//find the ordering and the central take
 	vector<int> ret;
 	double strongest = 0;
 	int best_i = 0;
-	int best_j = 0;
+	int best_j = std::min(1, takes-1);
 	for(int i=0;i<takes;i++)
 	{
 		for(int j=i+1;j<takes;j++)
@@ -5592,331 +6528,285 @@ std::vector<int> order_fold(std::vector<std::vector<std::pair<int, int>>> T, std
 			}
 		}
 	}
-	ret.push_back(best_i);
-	ret.push_back(best_j);
 
-	while(ret.size() < (unsigned int)takes)
+	//the overlaps of the remaining takes with the ordered ones only grow, so the heap gets a new entry for every
+	//change and the outdated ones are skipped, the lowest take goes first on ties
+	vector<double> strength(takes, 0);
+	vector<bool> ordered(takes, 0);
+	std::priority_queue<std::pair<double, int>> heap;
+	auto add_take = [&](const int k)
 	{
+		ret.push_back(k);
+		ordered[k] = 1;
 		for(int i=0;i<takes;i++)
 		{
-			min_mat(i,ret[0]) = min_mat(i,ret[0])+min_mat(i,ret[ret.size()-1]);
-			min_mat(ret[0], i) = min_mat(i, ret[0]);
-			min_mat(i, ret[ret.size()-1]) = 0;
-			min_mat(ret[ret.size()-1], i) = 0;
+			if(ordered[i] || min_mat(i,k) <= 0) continue;
+			strength[i] += min_mat(i,k);
+			heap.emplace(strength[i], -i);
 		}
-		min_mat(ret[0], ret[0]) = 0;
-		strongest = 0;
-		best_i = 0;
-		for(int i=0;i<takes;i++)
+	};
+	add_take(best_i);
+	add_take(best_j);
+
+	while(ret.size() < (unsigned int)takes)
+	{
+		while(!heap.empty() && (ordered[-heap.top().second] || heap.top().first != strength[-heap.top().second]))
+			heap.pop();
+		if(heap.empty())
 		{
-			if(min_mat(i, ret[0]) > strongest)
-			{
-				strongest = min_mat(i, ret[0]);
-				best_i = i;
-			}
+			//no remaining take overlaps the ordered ones
+			add_take(std::find(ordered.begin(), ordered.end(), false) - ordered.begin());
+			continue;
 		}
-		ret.push_back(best_i);
+		add_take(-heap.top().second);
 	}
 
 	return ret;
 }
 
-trans_s transform_points_N(vector<Eigen::Vector3d> points1, vector<Eigen::Vector3d> points2)
-{
-	Eigen::Vector3d P1_centroid = points1[0];
-	Eigen::Vector3d P2_centroid = points2[0];
-	for(unsigned int i=1;i<points1.size();i++)
-	{
-		P1_centroid = P1_centroid + points1[i];
-		P2_centroid = P2_centroid + points2[i];
-	}
-	P1_centroid(0) = P1_centroid(0) / points1.size();
-	P1_centroid(1) = P1_centroid(1) / points1.size();
-	P1_centroid(2) = P1_centroid(2) / points1.size();
-	P2_centroid(0) = P2_centroid(0) / points1.size();
-	P2_centroid(1) = P2_centroid(1) / points1.size();
-	P2_centroid(2) = P2_centroid(2) / points1.size();
+namespace {
 
-	vector<Eigen::Vector3d> P1c;
-	vector<Eigen::Vector3d> P2c;
-	for(unsigned int i=0;i<points2.size();i++)
-	{
-		P1c.push_back(points1[i] - P1_centroid);
-		P2c.push_back(points2[i] - P2_centroid);
-	}
+//corresponding points of two takes, stored by coordinate in one buffer, such
+//that the kernels below process all pairs with vector instructions
+typedef struct
+{
+	Eigen::Matrix<double, Eigen::Dynamic, 3> src;
+	Eigen::Matrix<double, Eigen::Dynamic, 3> dst;
+} point_pairs_s;
 
-	//estimate scale
-	vector<double> sc;
-	for(unsigned int i=0;i<P1c.size();i++)
+point_pairs_s make_point_pairs(const vector<Eigen::Vector3d>& points1, const vector<Eigen::Vector3d>& points2)
+{
+	CHECK_EQ(points1.size(), points2.size());
+	point_pairs_s ret;
+	ret.src.resize(points1.size(), 3);
+	ret.dst.resize(points2.size(), 3);
+	for(unsigned int i=0;i<points1.size();i++)
 	{
-		sc.push_back(P2c[i].norm() / P2c[i].norm());
+		ret.src.row(i) = points1[i].transpose();
+		ret.dst.row(i) = points2[i].transpose();
 	}
-	double s = med(sc, 0, sc.size()-1, sc.size()/2);
+	return ret;
+}
 
-	vector<Eigen::Vector3d> P1s;
-	for(unsigned int i=0;i<P1c.size();i++)
+//copies the pairs with the given indices to the front of X, whose buffer is
+//only reallocated when it is too small
+void gather_point_pairs(const point_pairs_s& P, const std::vector<size_t>& idx, point_pairs_s* X)
+{
+	X->src.resize(idx.size(), 3);
+	X->dst.resize(idx.size(), 3);
+	for(unsigned int i=0;i<idx.size();i++)
 	{
-		P1s.push_back(P1c[i] * s);
+		X->src.row(i) = P.src.row(idx[i]);
+		X->dst.row(i) = P.dst.row(idx[i]);
 	}
-	//cout << P1s[0].transpose() << "\n";
+}
 
-	//estimate rotation
-	Eigen::Matrix3d H;
-	H.setZero();
-	for(unsigned int i=0;i<P1s.size();i++)
+//aligns the source points to the destination points with the given scale. The
+//rotation is the orthogonal Procrustes solution of the centred points and the
+//translation the median of the offsets of the rotated points, which is robust
+//to outliers. Without pairs, the transformation only scales. offsets is a
+//scratch buffer
+trans_s align_point_pairs(const point_pairs_s& P, double s, Eigen::Matrix<double, Eigen::Dynamic, 3>* offsets)
+{
+	if(P.src.rows() == 0)
 	{
-		H = H + P1s[i] * P2c[i].transpose();
+		trans_s ret;
+		ret.R = Eigen::Matrix3d::Identity();
+		ret.o = Eigen::Vector3d::Zero();
+		ret.s = s;
+		return ret;
 	}
-	Eigen::JacobiSVD<Eigen::Matrix3d> svd(H, Eigen::ComputeThinU | Eigen::ComputeThinV);
-	Eigen::Matrix3d R = svd.matrixV() * svd.matrixU().transpose();
+	const Eigen::RowVector3d c1 = P.src.colwise().mean();
+	const Eigen::RowVector3d c2 = P.dst.colwise().mean();
+	const Eigen::Matrix3d H = s * (P.src.rowwise() - c1).transpose() * (P.dst.rowwise() - c2);
+	Eigen::JacobiSVD<Eigen::Matrix3d> svd(H, Eigen::ComputeFullU | Eigen::ComputeFullV);
 
-	//estimate translation;
-	vector<Eigen::Vector3d> P1rs;
-	for(unsigned int i=0;i<points1.size();i++)
-	{
-		P1rs.push_back(s * R * points1[i]);
-	}
-	vector<Eigen::Vector3d> diff;
-	for(unsigned int i=0;i<P1rs.size();i++)
-	{
-		diff.push_back(points2[i] - P1rs[i]);
-	}
-	Eigen::Vector3d t = median(diff);
-	
 	trans_s ret;
-	ret.R = R;
-	ret.o = t;
+	ret.R = svd.matrixV() * svd.matrixU().transpose();
 	ret.s = s;
+	offsets->noalias() = P.dst - s * P.src * ret.R.transpose();
+	for(int k=0;k<3;k++)
+	{
+		double* col = offsets->col(k).data();
+		std::nth_element(col, col + P.src.rows()/2, col + P.src.rows());
+		ret.o(k) = col[P.src.rows()/2];
+	}
 	return ret;
 }
 
-trans_s transform_points_R_N(vector<Eigen::Vector3d> pnts1, vector<Eigen::Vector3d> pnts2, int ssample, int trials)
+//distances of the transformed source points to their destinations. The
+//points are transformed with the vectorized kernel of the reconstructions
+void alignment_residuals(const point_pairs_s& P, const trans_s& T, Eigen::VectorXd* residuals)
 {
-	srand(time(NULL));
-	//int best_c = 0;
-	double best_v = 100;
-	trans_s best;
-	for(int i=0;i<trials;i++)
-	{
-		//build the sample
-		vector<Eigen::Vector3d> points1;
-		vector<Eigen::Vector3d> points2;
-		vector<int> prev_s;
-		for(int j=0;j<ssample;j++)
-		{
-			while(1)
-			{
-				int ns = rand() % pnts1.size();
-				bool ok = true;
-				for(unsigned int k=0;k<prev_s.size();k++)
-				{
-					if(ns == prev_s[k])
-					{
-						ok = 0;
-						break;
-					}
-				}
-				if(ok)
-				{
-					points1.push_back(pnts1[ns]);
-					points2.push_back(pnts2[ns]);
-					prev_s.push_back(ns);
-					break;
-				}
-			}
-		}
-
-		//find the hypothesis
-		Eigen::Vector3d P1_centroid = points1[0];
-		Eigen::Vector3d P2_centroid = points2[0];
-		for(unsigned int i=1;i<points1.size();i++)
-		{
-			P1_centroid = P1_centroid + points1[i];
-			P2_centroid = P2_centroid + points2[i];
-		}
-		P1_centroid(0) = P1_centroid(0) / points1.size();
-		P1_centroid(1) = P1_centroid(1) / points1.size();
-		P1_centroid(2) = P1_centroid(2) / points1.size();
-		P2_centroid(0) = P2_centroid(0) / points1.size();
-		P2_centroid(1) = P2_centroid(1) / points1.size();
-		P2_centroid(2) = P2_centroid(2) / points1.size();
-
-		vector<Eigen::Vector3d> P1c;
-		vector<Eigen::Vector3d> P2c;
-		for(unsigned int i=0;i<points2.size();i++)
-		{
-			P1c.push_back(points1[i] - P1_centroid);
-			P2c.push_back(points2[i] - P2_centroid);
-		}
+	Eigen::Matrix3x4d matrix;
+	matrix << T.s * T.R, T.o;
+	Eigen::Matrix<double, Eigen::Dynamic, 3> xyzs = P.src;
+	SimilarityTransform3(matrix).TransformPoints(xyzs);
+	*residuals = (P.dst - xyzs).rowwise().norm();
+}
 
-		//estimate scale
-		vector<double> sc;
-		for(unsigned int i=0;i<P1c.size();i++)
-		{
-			sc.push_back(P2c[i].norm() / P2c[i].norm());
-		}
-		double s = med(sc, 0, sc.size()-1, sc.size()/2);
+//median of the values, which are reordered
+double median_inplace(Eigen::VectorXd* values)
+{
+	double* first = values->data();
+	std::nth_element(first, first + values->size()/2, first + values->size());
+	return first[values->size()/2];
+}
 
-		vector<Eigen::Vector3d> P1s;
-		for(unsigned int i=0;i<P1c.size();i++)
-		{
-			P1s.push_back(P1c[i] * s);
-		}
-		//cout << P1s[0].transpose() << "\n";
+}  // namespace
 
-		//estimate rotation
-		Eigen::Matrix3d H;
-		H.setZero();
-		for(unsigned int i=0;i<P1s.size();i++)
-		{
-			H = H + P1s[i] * P2c[i].transpose();
-		}
-		Eigen::JacobiSVD<Eigen::Matrix3d> svd(H, Eigen::ComputeThinU | Eigen::ComputeThinV);
-		Eigen::Matrix3d R = svd.matrixV() * svd.matrixU().transpose();
+//the takes are registered in the frame of the anchor take, so their points
+//are aligned with the unit scale
+trans_s transform_points_N(const vector<Eigen::Vector3d>& points1, const vector<Eigen::Vector3d>& points2)
+{
+	Eigen::Matrix<double, Eigen::Dynamic, 3> offsets;
+	return align_point_pairs(make_point_pairs(points1, points2), 1, &offsets);
+}
 
-		//estimate translation;
-		vector<Eigen::Vector3d> P1rs;
-		for(unsigned int i=0;i<points1.size();i++)
-		{
-			P1rs.push_back(s * R * points1[i]);
+trans_s transform_points_R_N(const vector<Eigen::Vector3d>& pnts1, const vector<Eigen::Vector3d>& pnts2, int ssample, int trials)
+{
+	//least median of squares over random minimal samples. The trials run in
+	//batches of tasks on the threads and stop once the inlier ratio of the
+	//best hypothesis makes the remaining trials unnecessary with the
+	//confidence below. Every new best hypothesis of a task is refined on the
+	//half of the pairs that it fits best. The tasks draw from the random
+	//streams of their indices and the batches have a fixed size, so that the
+	//result only depends on the PRNG of the calling thread and not on the
+	//number of threads
+	const double kConfidence = 0.999;
+	const int kNumTrialsPerTask = 50;
+	const int kNumTasksPerBatch = 16;
+	const uint64_t seed = RandomSeed();
+	const int num_threads = std::min({GetEffectiveNumThreads(-1), kNumTasksPerBatch, std::max(1, trials / kNumTrialsPerTask)});
+	const point_pairs_s P = make_point_pairs(pnts1, pnts2);
+
+	struct trial_t
+	{
+		double v = 100;
+		trans_s T;
+	};
+	auto run_trials = [&P, ssample, seed](const int task_idx, const int num_trials, trial_t* best) {
+		ScopedPRNG task_prng(seed, task_idx);
+		RandomSampler sampler(ssample);
+		sampler.Initialize(P.src.rows());
+		point_pairs_s X;
+		Eigen::Matrix<double, Eigen::Dynamic, 3> offsets;
+		Eigen::VectorXd residuals;
+		std::vector<size_t> inliers;
+		for(int i=0;i<num_trials;i++)
+		{
+			//find the hypothesis of the sample and its median residual
+			gather_point_pairs(P, sampler.Sample(), &X);
+			const trans_s T = align_point_pairs(X, 1, &offsets);
+			alignment_residuals(P, T, &residuals);
+			const double er = median_inplace(&residuals);
+			if(er >= best->v)
+				continue;
+			best->v = er;
+			best->T = T;
+
+			//local optimization on the pairs within the median residual
+			alignment_residuals(P, T, &residuals);
+			inliers.clear();
+			for(int k=0;k<residuals.size();k++)
+			{
+				if(residuals(k) <= er)
+					inliers.push_back(k);
+			}
+			gather_point_pairs(P, inliers, &X);
+			const trans_s TL = align_point_pairs(X, 1, &offsets);
+			alignment_residuals(P, TL, &residuals);
+			const double erl = median_inplace(&residuals);
+			if(erl < best->v)
+			{
+				best->v = erl;
+				best->T = TL;
+			}
+		}
+	};
+
+	std::unique_ptr<ThreadPool> thread_pool;
+	if(num_threads > 1)
+		thread_pool.reset(new ThreadPool(num_threads));
+	trial_t best;
+	int done = 0;
+	int max_trials = trials;
+	Eigen::VectorXd residuals;
+	for(int batch=0;done<max_trials;batch++)
+	{
+		const int batch_trials = std::min(max_trials - done, kNumTasksPerBatch * kNumTrialsPerTask);
+		const int num_tasks = (batch_trials + kNumTrialsPerTask - 1) / kNumTrialsPerTask;
+		vector<trial_t> results(num_tasks);
+		for(int t=0;t<num_tasks;t++)
+		{
+			const int num_trials = std::min(kNumTrialsPerTask, batch_trials - t * kNumTrialsPerTask);
+			const int task_idx = batch * kNumTasksPerBatch + t;
+			if(thread_pool)
+				thread_pool->AddTask(run_trials, task_idx, num_trials, &results[t]);
+			else
+				run_trials(task_idx, num_trials, &results[t]);
 		}
-		vector<Eigen::Vector3d> diff;
-		for(unsigned int i=0;i<P1rs.size();i++)
+		if(thread_pool)
+			thread_pool->Wait();
+		done += batch_trials;
+		for(const trial_t& r : results)
 		{
-			diff.push_back(points2[i] - P1rs[i]);
+			if(r.v < best.v)
+				best = r;
 		}
-		Eigen::Vector3d t = median(diff);
 
-		//find the support
-		//int count = 0;
-		std::vector<double> err;
-		for(unsigned int k=0;k<pnts1.size();k++)
-		{
-			Eigen::Vector3d diff = pnts2[k] - (s * R * pnts1[k] + t);
-			err.push_back(diff.norm());
-			//cout << diff.norm() << " ";
-		}
-		double er = med(err, 0, err.size()-1, err.size()/2);
-		if(er < best_v)
-		{
-			best_v = er;
-			best.R = R;
-			best.o = t;
-			best.s = s;
-		}
-		//cout << er << "\n";
-		
+		//the inliers are the points within 2.5 robust standard deviations,
+		//which are estimated from the median residual
+		if(best.v >= 100 || pnts1.size() <= (unsigned int)ssample)
+			continue;
+		const double thr = 2.5 * 1.4826 * (1 + 5.0 / (pnts1.size() - ssample)) * best.v;
+		alignment_residuals(P, best.T, &residuals);
+		const int num_inliers = (residuals.array() <= thr).count();
+		const double denom = 1 - std::pow(num_inliers / static_cast<double>(pnts1.size()), ssample);
+		if(denom <= 0)
+			break;
+		max_trials = static_cast<int>(std::min<double>(trials, std::ceil(std::log(1 - kConfidence) / std::log(denom))));
 	}
-	cout << best_v << "\n";
-	vector<Eigen::Vector3d> points1;
-	vector<Eigen::Vector3d> points2;
-	for(unsigned int k=0;k<pnts1.size();k++)
+	const double best_v = best.v;
+
+	VLOG(3) << best_v;
+	alignment_residuals(P, best.T, &residuals);
+	std::vector<size_t> inliers;
+	for(int k=0;k<residuals.size();k++)
 	{
-		Eigen::Vector3d diff = pnts2[k] - (best.s * best.R * pnts1[k] + best.o);
-		if(diff.norm() <= best_v)
-		{
-			points1.push_back(pnts1[k]);
-			points2.push_back(pnts2[k]);
-		}
+		if(residuals(k) <= best_v)
+			inliers.push_back(k);
 	}
-	
-	
-	
-	trans_s ret;
-	ret = transform_points_N(points1, points2);
-	/*ret.R = R;
-	ret.o = t;
-	ret.s = s;*/
-	return ret;
+	point_pairs_s X;
+	gather_point_pairs(P, inliers, &X);
+	Eigen::Matrix<double, Eigen::Dynamic, 3> offsets;
+	return align_point_pairs(X, 1, &offsets);
 }
 
-trans_s transform_points_2(vector<Eigen::Vector3d> points1, vector<Eigen::Vector3d> points2, double s)
+trans_s transform_points_2(const vector<Eigen::Vector3d>& points1, const vector<Eigen::Vector3d>& points2, double s)
 {
-	Eigen::Vector3d P1_centroid = points1[0];
-	Eigen::Vector3d P2_centroid = points2[0];
-	for(unsigned int i=1;i<points1.size();i++)
-	{
-		P1_centroid = P1_centroid + points1[i];
-		P2_centroid = P2_centroid + points2[i];
-	}
-	P1_centroid(0) = P1_centroid(0) / points1.size();
-	P1_centroid(1) = P1_centroid(1) / points1.size();
-	P1_centroid(2) = P1_centroid(2) / points1.size();
-	P2_centroid(0) = P2_centroid(0) / points1.size();
-	P2_centroid(1) = P2_centroid(1) / points1.size();
-	P2_centroid(2) = P2_centroid(2) / points1.size();
-
-	vector<Eigen::Vector3d> P1c;
-	vector<Eigen::Vector3d> P2c;
-	for(unsigned int i=0;i<points2.size();i++)
-	{
-		P1c.push_back(points1[i] - P1_centroid);
-		P2c.push_back(points2[i] - P2_centroid);
-	}
-
-	//estimate scale
-	/*vector<double> sc;
-	for(int i=0;i<P1c.size();i++)
-	{
-		sc.push_back(P2c[i].norm() / P2c[i].norm());
-	}
-	double s = med(sc, 0, sc.size()-1, sc.size()/2);*/
-
-	vector<Eigen::Vector3d> P1s;
-	for(unsigned int i=0;i<P1c.size();i++)
-	{
-		P1s.push_back(P1c[i] * s);
-	}
-	//cout << P1s[0].transpose() << "\n";
-
-	//estimate rotation
-	Eigen::Matrix3d H;
-	H.setZero();
-	for(unsigned int i=0;i<P1s.size();i++)
-	{
-		H = H + P1s[i] * P2c[i].transpose();
-	}
-	Eigen::JacobiSVD<Eigen::Matrix3d> svd(H, Eigen::ComputeThinU | Eigen::ComputeThinV);
-	Eigen::Matrix3d R = svd.matrixV() * svd.matrixU().transpose();
-
-	//estimate translation;
-	vector<Eigen::Vector3d> P1rs;
-	for(unsigned int i=0;i<points1.size();i++)
-	{
-		P1rs.push_back(s * R * points1[i]);
-	}
-	vector<Eigen::Vector3d> diff;
-	for(unsigned int i=0;i<P1rs.size();i++)
-	{
-		diff.push_back(points2[i] - P1rs[i]);
-	}
-	Eigen::Vector3d t = median(diff);
-	
-	trans_s ret;
-	ret.R = R;
-	ret.o = t;
-	ret.s = s;
-	return ret;
+	Eigen::Matrix<double, Eigen::Dynamic, 3> offsets;
+	return align_point_pairs(make_point_pairs(points1, points2), s, &offsets);
 }
 
-std::vector<int> merge_obs(std::vector<std::vector<int>> obs)
+std::vector<int> merge_obs(const std::vector<const std::vector<int>*>& obs)
 {
 	std::vector<int> ret;
 	if(!obs.size()) return ret;
-	for(unsigned int i=0;i<obs[0].size();i++)
+	for(unsigned int i=0;i<obs[0]->size();i++)
 	{
 		int val = -1;
 		int count = 0;
 		for(unsigned int j=0;j<obs.size();j++)
 		{
-			if(!obs[j].size()) continue;
+			if(!obs[j]->size()) continue;
 			int cur_count = 0;
-			int cur_val = obs[j][i];
+			int cur_val = (*obs[j])[i];
 			if(cur_val == -1) continue;
 			for(unsigned int k=0;k<obs.size();k++)
 			{
-				if(!obs[k].size()) continue;
-				if(cur_val == obs[k][i])
+				if(!obs[k]->size()) continue;
+				if(cur_val == (*obs[k])[i])
 				{
 					cur_count++;
 				}
@@ -5932,145 +6822,127 @@ std::vector<int> merge_obs(std::vector<std::vector<int>> obs)
 	return ret;
 }
 
-std::pair<std::pair<pnts_s, pnts_s>, std::vector<std::pair<trans_s,trans_s>>> merge_reconstructions(std::vector<pnts_s> P, std::vector<std::vector<std::pair<int, int>>> T, std::pair<std::vector<int>, std::vector<int>> D, std::vector<int> order)
+std::pair<std::pair<pnts_s, pnts_s>, std::vector<std::pair<trans_s,trans_s>>> merge_reconstructions(const std::vector<pnts_s>& P, const std::vector<std::vector<std::pair<int, int>>>& T, const std::pair<std::vector<int>, std::vector<int>>& D, const std::vector<int>& order, bool tree, int max_num_threads)
 //std::pair< std::pair<std::vector<Eigen::Vector3d>, std::vector<Eigen::Vector3i>> , std::vector<std::pair<trans_s,trans_s>> >  merge_reconstructions(std::vector<pnts_s> P, std::vector<std::vector<std::pair<int, int>>> T, std::pair<std::vector<int>, std::vector<int>> D, std::vector<int> order)
 {
+	TRACE_SCOPE("merge_reconstructions");
 	int ref = order[0];
 	//the structure into which the final points are saved (according to the tracks)
 	vector<vector<Eigen::Vector3d>> points;
-	vector<vector<Eigen::Vector3i>> colors;
+	vector<vector<Eigen::Vector3ub>> colors;
 	for(unsigned int i=0;i<T.size();i++)
 	{
 		vector<Eigen::Vector3d> np;
 		points.push_back(np);
-		vector<Eigen::Vector3i> nc;
+		vector<Eigen::Vector3ub> nc;
 		colors.push_back(nc);
 	}
 	vector<pair<trans_s, trans_s>> motions(P.size());
-	vector<bool> take_exists(P.size());
-	for(unsigned int i=0;i<P.size();i++)
-	{
-		if(i==(unsigned int)ref)
-			take_exists.push_back(1);
-		else
-			take_exists.push_back(0);
-	}
-	//copy points from the reference take to the structure
+	//the points of every take on the background and the object tracks, as the
+	//track and the index of the point, so that a take does not scan all tracks
+	vector<vector<pair<int, int>>> take_b(P.size());
+	vector<vector<pair<int, int>>> take_o(P.size());
 	for(unsigned int i=0;i<D.first.size();i++)
 	{
-		vector<pair<int,int>> track = T[D.first[i]];
-		for(unsigned int j=0;j<track.size();j++)
-		{
-			if(track[j].first == ref+1)
-			{
-				points[D.first[i]].push_back(P[ref].points[P[ref].ID_map[track[j].second]]);
-				cout << P[ref].points[P[ref].ID_map[track[j].second]].transpose() << "\n";
-				colors[D.first[i]].push_back(P[ref].color[P[ref].ID_map[track[j].second]]);
-				break;
-			}
-		}
+		for(const pair<int, int>& el : T[D.first[i]])
+			take_b[el.first-1].emplace_back(D.first[i], P[el.first-1].ID_map.at(el.second));
 	}
-	cout << "\n\n";
 	for(unsigned int i=0;i<D.second.size();i++)
 	{
-		vector<pair<int,int>> track = T[D.second[i]];
-		for(unsigned int j=0;j<track.size();j++)
-		{
-			if(track[j].first == ref+1)
-			{
-				points[D.second[i]].push_back(P[ref].points[P[ref].ID_map[track[j].second]]);
-				cout << P[ref].points[P[ref].ID_map[track[j].second]].transpose() << "\n";
-				colors[D.second[i]].push_back(P[ref].color[P[ref].ID_map[track[j].second]]);
-				break;
-			}
-		}
+		for(const pair<int, int>& el : T[D.second[i]])
+			take_o[el.first-1].emplace_back(D.second[i], P[el.first-1].ID_map.at(el.second));
 	}
 
-	//iterate through the rest of the reconstructions in the given order and add the points to the final reconstruction
-	for(unsigned int rr=1;rr<order.size();rr++)
+	//copy points from the reference take to the structure
+	for(const vector<pair<int, int>>* take_points : {&take_b[ref], &take_o[ref]})
 	{
-		if(order[rr] < 0) continue;
-		int r = order[rr];
-		take_exists[r] = 1;
+		for(const pair<int, int>& tp : *take_points)
+		{
+			if(points[tp.first].size()) continue;
+			points[tp.first].push_back(P[ref].points[tp.second]);
+			VLOG(4) << P[ref].points[tp.second].transpose();
+			colors[tp.first].push_back(P[ref].color[tp.second]);
+		}
+	}
 
+	//aligns a take to the points of the structure, which is only read, returns
+	//false if the take has no background points in the structure
+	auto align_take = [&](int r, pair<trans_s, trans_s>* motion) {
 		//collect points from the background which contain both the points from the merged reconstruction and from the current take
 		vector<Eigen::Vector3d> group1;
 		vector<Eigen::Vector3d> group2;
-		for(unsigned int i=0;i<D.first.size();i++)
+		for(const pair<int, int>& tp : take_b[r])
 		{
-			if(!points[D.first[i]].size()) continue;
-			vector<pair<int, int>> track = T[D.first[i]];
-			for(unsigned int j=0;j<track.size();j++)
-			{
-				if(track[j].first == r+1)
-				{
-					group1.push_back(P[r].points[P[r].ID_map[track[j].second]]);
-					group2.push_back(median(points[D.first[i]]));
-				}
-			}
+			if(!points[tp.first].size()) continue;
+			group1.push_back(P[r].points[tp.second]);
+			group2.push_back(median(points[tp.first]));
 		}
 		//TODO
 		//also try RANSAC to find the transformation
 		//test both versions
-		if(!group1.size() || !group2.size()) continue;
-		trans_s tb = transform_points_N(group1, group2);
-		//trans_s tb = transform_points_R_N(group1, group2, 3, 2000);
-
-		//find the points from the background, transform them and add to the points
-		for(unsigned int i=0;i<D.first.size();i++)
-		{
-			vector<pair<int, int>> track = T[D.first[i]];
-			for(unsigned int j=0;j<track.size();j++)
-			{
-				if(track[j].first == r+1)
-				{
-					Eigen::Vector3d p = P[r].points[P[r].ID_map[track[j].second]];
-					Eigen::Vector3d new_p = tb.s * tb.R * p + tb.o;
-					points[D.first[i]].push_back(new_p);
-					colors[D.first[i]].push_back(P[r].color[P[r].ID_map[track[j].second]]);
-					
-				}
-			}
-		}
+		if(!group1.size() || !group2.size()) return false;
+		motion->first = transform_points_N(group1, group2);
+		//motion->first = transform_points_R_N(group1, group2, 3, 2000);
 
 		//do the same with the object
-		trans_s to;
 		vector<Eigen::Vector3d> gr1;
 		vector<Eigen::Vector3d> gr2;
-		for(unsigned int i=0;i<D.second.size();i++)
+		for(const pair<int, int>& tp : take_o[r])
 		{
-			if(!points[D.second[i]].size()) continue;
-			vector<pair<int, int>> track = T[D.second[i]];
-			for(unsigned int j=0;j<track.size();j++)
-			{
-				if(track[j].first == r+1)
-				{
-					gr1.push_back(P[r].points[P[r].ID_map[track[j].second]]);
-					gr2.push_back(median(points[D.second[i]]));
-				}
-			}
+			if(!points[tp.first].size()) continue;
+			gr1.push_back(P[r].points[tp.second]);
+			gr2.push_back(median(points[tp.first]));
+		}
+		VLOG(4) << gr1.size() << " " << gr2.size();
+		motion->second = transform_points_2(gr1, gr2, motion->first.s);
+		return true;
+	};
+	//transforms the points of an aligned take and adds them to the structure
+	auto add_take = [&](int r, const pair<trans_s, trans_s>& motion) {
+		for(const pair<int, int>& tp : take_b[r])
+		{
+			const trans_s& tb = motion.first;
+			points[tp.first].push_back(tb.s * tb.R * P[r].points[tp.second] + tb.o);
+			colors[tp.first].push_back(P[r].color[tp.second]);
 		}
-		cout << gr1.size() << " " << gr2.size() << "\n";
-		to = transform_points_2(gr1, gr2, tb.s);
+		for(const pair<int, int>& tp : take_o[r])
+		{
+			const trans_s& to = motion.second;
+			points[tp.first].push_back(to.s * to.R * P[r].points[tp.second] + to.o);
+			colors[tp.first].push_back(P[r].color[tp.second]);
+		}
+		motions[r] = motion;
+	};
 
-		for(unsigned int i=0;i<D.second.size();i++)
+	if(!tree)
+	{
+		//iterate through the rest of the reconstructions in the given order and add the points to the final reconstruction
+		for(unsigned int rr=1;rr<order.size();rr++)
 		{
-			vector<pair<int, int>> track = T[D.second[i]];
-			for(unsigned int j=0;j<track.size();j++)
+			if(order[rr] < 0) continue;
+			pair<trans_s, trans_s> motion;
+			if(align_take(order[rr], &motion))
+				add_take(order[rr], motion);
+		}
+	}
+	else
+	{
+		//align the takes of every level of the spanning tree in parallel to the
+		//structure of the previous levels and add them in the order of the level
+		const std::vector<std::vector<int>> levels = spanning_tree_levels(take_overlaps(T, D, P.size()), order);
+		ThreadPool thread_pool(std::min<int>(GetEffectiveNumThreads(max_num_threads), P.size()));
+		for(const std::vector<int>& level : levels)
+		{
+			vector<pair<trans_s, trans_s>> level_motions(level.size());
+			vector<std::future<bool>> aligned;
+			for(unsigned int i=0;i<level.size();i++)
+				aligned.push_back(thread_pool.AddTask(align_take, level[i], &level_motions[i]));
+			for(unsigned int i=0;i<level.size();i++)
 			{
-				if(track[j].first == r+1)
-				{
-					Eigen::Vector3d p = P[r].points[P[r].ID_map[track[j].second]];
-					Eigen::Vector3d new_p = to.s * to.R * p + to.o;
-					points[D.second[i]].push_back(new_p);
-					colors[D.second[i]].push_back(P[r].color[P[r].ID_map[track[j].second]]);
-				}
+				if(aligned[i].get())
+					add_take(level[i], level_motions[i]);
 			}
 		}
-		pair<trans_s, trans_s> nm;
-		nm.first = tb;
-		nm.second = to;
-		motions[r]=nm;
 	}
 
 	//extract the points
@@ -6107,13 +6979,13 @@ std::pair<std::pair<pnts_s, pnts_s>, std::vector<std::pair<trans_s,trans_s>>> me
 	return ret2;*/
 	//HERE_
 	vector<Eigen::Vector3d> pb;
-	vector<Eigen::Vector3i> cb;
+	vector<Eigen::Vector3ub> cb;
 	std::vector<int> IDb;
-	std::unordered_map<int, int> IDb_map;
+	IdIndexMap IDb_map;
 	vector<Eigen::Vector3d> po;
-	vector<Eigen::Vector3i> co;
+	vector<Eigen::Vector3ub> co;
 	std::vector<int> IDo;
-	std::unordered_map<int, int> IDo_map;
+	IdIndexMap IDo_map;
 	for(unsigned int i=0;i<D.first.size();i++)
 	{
 		if(points[D.first[i]].size())
@@ -6122,7 +6994,7 @@ std::pair<std::pair<pnts_s, pnts_s>, std::vector<std::pair<trans_s,trans_s>>> me
 			IDb_map[D.first[i]] = pb.size();
 			Eigen::Vector3d np = median(points[D.first[i]]);
 			pb.push_back(np);
-			Eigen::Vector3i nc = median(colors[D.first[i]]);
+			Eigen::Vector3ub nc = median(colors[D.first[i]]);
 			cb.push_back(nc);
 		}
 	}
@@ -6134,7 +7006,7 @@ std::pair<std::pair<pnts_s, pnts_s>, std::vector<std::pair<trans_s,trans_s>>> me
 			IDo_map[D.second[i]] = po.size();
 			Eigen::Vector3d np = median(points[D.second[i]]);
 			po.push_back(np);
-			Eigen::Vector3i nc = median(colors[D.second[i]]);
+			Eigen::Vector3ub nc = median(colors[D.second[i]]);
 			co.push_back(nc);
 		}
 	}
@@ -6159,24 +7031,31 @@ std::pair<std::pair<pnts_s, pnts_s>, std::vector<std::pair<trans_s,trans_s>>> me
 	return ret;
 }
 
-void save_model_ply(std::pair<pnts_s, pnts_s> M, int mode)
+void save_model_ply(const std::pair<pnts_s, pnts_s>& M, int mode)
 {
-	ofstream ply;
-	ply.open("model.txt");
+	//background points in red, object points in green
+	vector<PlyPoint> ply(M.first.points.size() + M.second.points.size());
 	for(unsigned int i=0;i<M.first.points.size();i++)
 	{
 		Eigen::Vector3d cp = M.first.points[i];
-		ply << cp(0) << " " << cp(1) << " " << cp(2) << " 255 0 0\n";
+		ply[i].x = cp(0);
+		ply[i].y = cp(1);
+		ply[i].z = cp(2);
+		ply[i].r = 255;
 	}
 	for(unsigned int i=0;i<M.second.points.size();i++)
 	{
 		Eigen::Vector3d cp = M.second.points[i];
-		ply << cp(0) << " " << cp(1) << " " << cp(2) << " 0 255 0\n";
+		PlyPoint& p = ply[M.first.points.size() + i];
+		p.x = cp(0);
+		p.y = cp(1);
+		p.z = cp(2);
+		p.g = 255;
 	}
-	ply.close();
+	WriteBinaryPly("model.ply", ply, false, true);
 }
 
-void save_points(std::pair<pnts_s, pnts_s> P)
+void save_points(const std::pair<pnts_s, pnts_s>& P)
 {
 	ofstream pnts;
 	pnts.open("model1.txt");
@@ -6194,8 +7073,9 @@ void save_points(std::pair<pnts_s, pnts_s> P)
 	pnts.close();
 }
 
-std::pair<std::vector<img_s>, std::vector<trans_s>> merge_cameras(std::vector<cam_s> C, std::vector<std::pair<trans_s,trans_s>> motions, int ref, std::vector<std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>> O, std::pair<std::vector<int>, std::vector<int>> Q, std::pair<std::vector<int>, std::vector<int>> D)
+std::pair<std::vector<img_s>, std::vector<trans_s>> merge_cameras(const std::vector<cam_s>& C, const std::vector<std::pair<trans_s,trans_s>>& motions, int ref, const std::vector<std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>>& O, const std::pair<std::vector<int>, std::vector<int>>& Q, const std::pair<std::vector<int>, std::vector<int>>& D, int max_num_threads)
 {
+	TRACE_SCOPE("merge_cameras");
 	cout << "MERGING CAMERAS\n";
 	//classify the cameras
 	vector<int> SC(C.size());
@@ -6433,44 +7313,44 @@ std::pair<std::vector<img_s>, std::vector<trans_s>> merge_cameras(std::vector<ca
 	vector<int> motion_leader(motions.size());
 
 
-	//create hash sets of the tracks in the object and in the background
-	//HERE_
-	unordered_set<int> T1m;
-	for(unsigned int i=0;i<D.first.size();i++)
-	{
-		T1m.insert(D.first[i]);
-	}
-	
-	unordered_set<int> T2m;
-	for(unsigned int i=0;i<D.second.size();i++)
+	//the body of every track, 1 for the background and 2 for the object, the
+	//background wins for the tracks that are in both
+	int num_tracks = 0;
+	for(const std::vector<int>* tracks : {&D.first, &D.second})
 	{
-		T2m.insert(D.second[i]);
+		for(int id : *tracks)
+			num_tracks = std::max(num_tracks, id+1);
 	}
+	vector<char> body(num_tracks, 0);
+	for(int id : D.second)
+		body[id] = 2;
+	for(int id : D.first)
+		body[id] = 1;
 
-	/*for(unsigned int i=0;i<D.second.size();i++)
-	{
-		cout << T2m.count(D.second[i]);
-	}*/
-
-	
-
-	//group the cameras and merge their observations
-	vector<img_s> cams;
+	//bucket the moved cameras by their id, in the order of moved_cams
 	int cam_size = 0;
 	for(unsigned int i=0;i<moved_cams.size();i++)
 	{
 		if(moved_cams[i].id > cam_size)
 			cam_size = moved_cams[i].id;
 	}
-	for(int i=1;i<=cam_size;i++)
+	vector<vector<int>> cam_members(cam_size+1);
+	for(unsigned int j=0;j<moved_cams.size();j++)
 	{
-		img_s cam;
+		if(moved_cams[j].id > 0)
+			cam_members[moved_cams[j].id].push_back(j);
+	}
+
+	//group the cameras and merge their observations, every camera is
+	//independent of the others
+	vector<img_s> merged(cam_size+1);
+	vector<char> valid(cam_size+1, 0);
+	auto merge_camera = [&](int i)
+	{
+		img_s& cam = merged[i];
 		int take = 0;
-		vector<int> background_obs;
-		vector<int> object_obs;
-		vector<int> unknown_obs;
-		vector<vector<int>> obs;
-		vector<Eigen::Vector2d> features;
+		vector<const vector<int>*> obs;
+		const vector<Eigen::Vector2d>* features = nullptr;
 		double size_x;
 		double size_y;
 		double f = 0;
@@ -6479,9 +7359,8 @@ std::pair<std::vector<img_s>, std::vector<trans_s>> merge_cameras(std::vector<ca
 		double py;
 		vector<Eigen::Vector3d> Rs;
 		vector<Eigen::Vector3d> ts;
-		for(unsigned int j=0;j<moved_cams.size();j++)
+		for(int j : cam_members[i])
 		{
-			if(moved_cams[j].id != i) continue;
 			if(!take)
 			{
 				take = moved_cams[j].second;
@@ -6491,63 +7370,68 @@ std::pair<std::vector<img_s>, std::vector<trans_s>> merge_cameras(std::vector<ca
 				py = moved_cams[j].py;
 				//f2 = motions[moved_cams[j].anchor].second.s * moved_cams[j].f;
 				f2 = moved_cams[j].f;
-				features = O[mc_ids[j]].second;
+				features = &O[mc_ids[j]].second;
 			}
 			if(moved_cams[j].anchor == moved_cams[j].second)
 				f = moved_cams[j].f;
-			obs.push_back(O[mc_ids[j]].first);
+			obs.push_back(&O[mc_ids[j]].first);
 			Rs.push_back(r2a(moved_cams[j].R));
 			ts.push_back(moved_cams[j].t);
 		}
-		cout << obs.size() << "\n";
+		if(!Rs.size()) return;
 		vector<int> m_obs = merge_obs(obs);
 
-		//divide the observations between the object and the background
+		//divide the observations between the object and the background in
+		//one pass
+		cam.b_obs.assign(m_obs.size(), -1);
+		cam.o_obs.assign(m_obs.size(), -1);
+		cam.u_obs.assign(m_obs.size(), -1);
 		for(unsigned int j=0;j<m_obs.size();j++)
 		{
-			if(T1m.count(m_obs[j]))
-			{
-				background_obs.push_back(m_obs[j]);
-				object_obs.push_back(-1);
-				unknown_obs.push_back(-1);
-			}
-			else if(T2m.count(m_obs[j]))
-			{
-				background_obs.push_back(-1);
-				object_obs.push_back(m_obs[j]);
-				unknown_obs.push_back(-1);
-			}
+			const int id = m_obs[j];
+			const char b = (id >= 0 && id < num_tracks) ? body[id] : 0;
+			if(b == 1)
+				cam.b_obs[j] = id;
+			else if(b == 2)
+				cam.o_obs[j] = id;
 			else
-			{
-				background_obs.push_back(-1);
-				object_obs.push_back(-1);
-				unknown_obs.push_back(m_obs[j]);
-			}
+				cam.u_obs[j] = id;
 		}
 
-		if(!Rs.size()) continue;
-		Eigen::Matrix3d R = a2r(median(Rs));
-		Eigen::Vector3d t = median(ts);
 		cam.take = take;
-		cam.R = R;
-		cam.c = t;
+		cam.R = a2r(median(Rs));
+		cam.c = median(ts);
 		cam.size_x = size_x;
 		cam.size_y = size_y;
 		cam.px = px;
 		cam.py = py;
-		cam.features = features;
+		if(features)
+			cam.features = *features;
 		if(f > 0)
 			cam.f = f;
 		else
 			cam.f = f2;
-		cam.b_obs = background_obs;
-		cam.o_obs = object_obs;
-		cam.u_obs = unknown_obs;
+		valid[i] = 1;
+	};
+
+	//small logs are not worth starting the threads
+	const int kMinNumCamsPerTask = 16;
+	if(GetEffectiveNumThreads(max_num_threads) == 1)
+	{
+		for(int i=1;i<=cam_size;i++)
+			merge_camera(i);
+	}
+	else
+		ParallelFor(1, cam_size+1, merge_camera, kMinNumCamsPerTask);
 
-		cams.push_back(cam);
+	vector<img_s> cams;
+	for(int i=1;i<=cam_size;i++)
+	{
+		if(valid[i])
+			cams.push_back(std::move(merged[i]));
 	}
 
-	cout << "FINISHED\n";
+	VLOG(3) << "FINISHED";
 	
 	std::pair<std::vector<img_s>, std::vector<trans_s>> ret;
 	ret.first = cams;
@@ -6555,465 +7439,401 @@ std::pair<std::vector<img_s>, std::vector<trans_s>> merge_cameras(std::vector<ca
 	return ret;
 }
 
-void save_model(std::pair<pnts_s, pnts_s> P, std::vector<img_s> C, std::vector<trans_s> motion, int mode, int ref)
-{
-	/*for(int i=0;i<P.first.ID.size();i++)
+namespace
+{
+	//the buffers of the writers are flushed to the files beyond this size
+	const std::streamoff kModelWriterBufferSize = 1 << 22;
+
+	//radial distortion of the written SIMPLE_RADIAL cameras, perform_BA refines
+	//only the focal length of a pinhole camera, so it is fixed for all cameras
+	const double kModelCameraRadial = -0.03;
+
+	//buffered writer of one file of the models, which streams the same content
+	//to all models that share it, so that every line is formatted only once
+	struct model_writer_t
+	{
+		std::vector<std::unique_ptr<std::ofstream>> files;
+		std::ostringstream buffer;
+
+		model_writer_t(const std::string& root, const std::vector<int>& modes, const std::string& name, bool binary)
+		{
+			for(int mode : modes)
+			{
+				string path = JoinPaths(root, "model" + to_string(mode), name);
+				files.emplace_back(new std::ofstream(path, binary ? std::ios::trunc | std::ios::binary : std::ios::trunc));
+				CHECK(files.back()->is_open()) << path;
+			}
+		}
+
+		~model_writer_t()
+		{
+			flush();
+		}
+
+		void flush()
+		{
+			const string data = buffer.str();
+			for(auto& file : files)
+				file->write(data.data(), data.size());
+			buffer.str("");
+		}
+
+		//called after every record, such that the buffer stays bounded
+		void flush_if_full()
+		{
+			if(buffer.tellp() > kModelWriterBufferSize)
+				flush();
+		}
+	};
+
+	//the images of a model in the order of their ids, the cameras of the reference take
+	//have one image of both bodies, the others one image of the background and one of the object
+	typedef struct
 	{
-		cout << i << " " << P.first.ID[i] << " " << P.first.ID_map.at(P.first.ID[i]) << " " << P.first.points[i].transpose() << "\n";
-	}*/
-	/*for(int i=0;i<motion.size();i++)
+		int cam;
+		//0 for both bodies, 1 for the background and 2 for the object
+		int body;
+	} model_image_t;
+
+	//the images of the models with one layout and the track of every point as (image id, index
+	//of the feature), the models 0 and 1 share the layout, as they differ only in the colors
+	typedef struct
 	{
-		cout << motion[i].R << "\n\n" << motion[i].o << "\n\n";
-	}*/
-	cout << "Saving cameras\n";
+		bool background;
+		bool object;
+		std::vector<int> modes;
+		std::vector<model_image_t> images;
+		std::unordered_map<int, std::vector<std::pair<int, int>>> tracks;
+	} model_layout_t;
 
-	int img_count = 0;
-	ofstream cams;
-	string p1 = "model" + to_string(mode) + "/cameras.txt";
-	cams.open(p1);
-	cams << "# Camera list with one line of data per camera:\n";
-	cams << "#   CAMERA_ID, MODEL, WIDTH, HEIGHT, PARAMS[]\n";
-	cams << "# Number of cameras: " << C.size() << "\n";
-	for(unsigned int i=0;i<C.size();i++)
+	//id of the point observed by the feature in an image, or -1
+	int model_observation(const img_s& cam, int body, int j)
 	{
-		if(C[i].take == ref+1 || (mode%4) == 2 || (mode%4) == 3)
-			img_count++;
-		else
-			img_count += 2;
-		cams << i+1 << " SIMPLE_RADIAL " << C[i].size_x << " " << C[i].size_y << " " << C[i].f << " " << C[i].px << " " << C[i].py << " -0.03\n";
+		if(body != 2 && cam.b_obs[j] != -1)
+			return cam.b_obs[j];
+		if(body != 1 && cam.o_obs[j] != -1)
+			return cam.o_obs[j];
+		return -1;
 	}
-	cams.close();
-	cout << "Saving images\n";
-
-	//also save the observations of each track which will be saved to the points3d.txt
-	//use a map
-	unordered_map<int, vector<pair<int, int>>> p2tr;
-	ofstream imgs;
-	string p2 = "model" + to_string(mode) + "/images.txt";
-	imgs.open(p2);
-	imgs << "# Image list with two lines of data per image:\n";
-	imgs << "#   IMAGE_ID, QW, QX, QY, QZ, TX, TY, TZ, CAMERA_ID, NAME\n";
-	imgs << "#   POINTS2D[] as (X, Y, POINT3D_ID)\n";
-	imgs << "# Number of images: " << img_count << ", mean observations per image: 683.904\n";
-	int pos = 1;
-	EPNPEstimator residualCheck;
-	ofstream c2m;
-	string p3 = "model" + to_string(mode) + "/cam2mot.txt";
-	c2m.open(p3);
-	for(unsigned int i=0;i<C.size();i++)
+
+	void build_model_layout(const std::vector<img_s>& C, int ref, model_layout_t* layout)
 	{
-		Eigen::Vector4d q = RotationMatrixToQuaternion(C[i].R);
-		Eigen::Vector3d t = -1 * C[i].R * C[i].c;
-		if(C[i].take == ref+1)
+		for(unsigned int i=0;i<C.size();i++)
 		{
-			imgs << pos << " " << q(0) << " " << q(1) << " " << q(2) << " " << q(3) << " " << t(0) << " " << t(1) << " " << t(2) << " " << i+1 << " " << i+1 << ".JPG\n";
-			for(unsigned int j=0;j<C[i].features.size();j++)
+			if(C[i].take == ref+1)
+				layout->images.push_back({(int)i, 0});
+			else
 			{
-				imgs << C[i].features[j](0) << " " << C[i].features[j](1) << " ";
-				if(C[i].b_obs[j] != -1)
-				{
-					imgs << C[i].b_obs[j]+1 << " ";
-					vector<pair<int, int>> tr;
-					pair<int, int> n_ob;
-					n_ob.first = pos;
-					n_ob.second = j+1;
-					if(p2tr.count(C[i].b_obs[j]))
-					{
-						tr = p2tr[C[i].b_obs[j]];
-					}
-					tr.push_back(n_ob);
-					p2tr[C[i].b_obs[j]] = tr;
-				}
-				else if(C[i].o_obs[j] != -1)
-				{
-					imgs << C[i].o_obs[j]+1 << " ";
-					vector<pair<int, int>> tr;
-					pair<int, int> n_ob;
-					n_ob.first = pos;
-					n_ob.second = j+1;
-					if(p2tr.count(C[i].o_obs[j]))
-					{
-						tr = p2tr[C[i].o_obs[j]];
-					}
-					tr.push_back(n_ob);
-					p2tr[C[i].o_obs[j]] = tr;
-				}
-				else
-					imgs << -1 << " ";
+				if(layout->background)
+					layout->images.push_back({(int)i, 1});
+				if(layout->object)
+					layout->images.push_back({(int)i, 2});
 			}
-			imgs << "\n";
-			c2m << "-1\n";
-			pos++;
 		}
-		else
+		for(unsigned int k=0;k<layout->images.size();k++)
 		{
-			if((mode%4) != 3)
+			const img_s& cam = C[layout->images[k].cam];
+			for(unsigned int j=0;j<cam.features.size();j++)
 			{
-				std::vector<Eigen::Vector2d> points2D0;
-				std::vector<Eigen::Vector3d> points3D0;
-				Eigen::Matrix3x4d p2;
-				p2.leftCols<3>() = C[i].R;
-				p2.rightCols<1>() = t;
-				Eigen::Matrix3d K;
-				K.setZero();
-				K(0,0) = C[i].f;
-				K(1,1) = C[i].f;
-				K(2,2) = 1;
-				K(0,2) = C[i].px;
-				K(1,2) = C[i].py;
-				p2 = K*p2;
-				std::vector<double> residuals_2;
-			
-				imgs << pos << " " << q(0) << " " << q(1) << " " << q(2) << " " << q(3) << " " << t(0) << " " << t(1) << " " << t(2) << " " << i+1 << " " << i+1 << ".JPG\n";
-				for(unsigned int j=0;j<C[i].features.size();j++)
-				{
-					imgs << C[i].features[j](0) << " " << C[i].features[j](1) << " ";
-					if(C[i].b_obs[j] != -1)
-					{
-						imgs << C[i].b_obs[j]+1 << " ";
-						vector<pair<int, int>> tr;
-						pair<int, int> n_ob;
-						n_ob.first = pos;
-						n_ob.second = j+1;
-						if(p2tr.count(C[i].b_obs[j]))
-						{
-							tr = p2tr[C[i].b_obs[j]];
-						}
-						tr.push_back(n_ob);
-						p2tr[C[i].b_obs[j]] = tr;
-						points2D0.push_back(C[i].features[j]);
-						points3D0.push_back(P.first.points[ P.first.ID_map.at( C[i].b_obs[j] ) ]);
-					}
-					else
-						imgs << -1 << " ";
-				}
-
-				//residualCheck.Residuals(points2D0, points3D0, p2, &residuals_2);
-				/*for(int i=0;i<residuals_2.size();i++)
-					cout << residuals_2[i] << " ";*/
-				
-				imgs << "\n";
-				c2m << "-1\n";
-				pos++;
-			}
-			if((mode%4) != 2)
-			{
-				trans_s M = motion[(C[i].take)-1];
-				Eigen::Matrix3d R = C[i].R * M.R;//.transpose();
-				Eigen::Vector3d c = M.R.transpose() * (C[i].c - M.o);//M.R * C[i].c + M.o;
-				Eigen::Vector4d q2 = RotationMatrixToQuaternion(R);
-				Eigen::Vector3d t2 = -R * c;
-
-				std::vector<Eigen::Vector2d> points2D0;
-				std::vector<Eigen::Vector3d> points3D0;
-				Eigen::Matrix3x4d p2;
-				p2.leftCols<3>() = R;
-				p2.rightCols<1>() = t2;
-				Eigen::Matrix3d K;
-				//cout << K << "\n";
-				K.setZero();
-				K(0,0) = C[i].f;
-				K(1,1) = C[i].f;
-				K(2,2) = 1;
-				K(0,2) = C[i].px;
-				K(1,2) = C[i].py;
-				p2 = K*p2;
-				std::vector<double> residuals_2;
-				
-				//cout << M.o.transpose() << "\n";
-				imgs << pos << " " << q2(0) << " " << q2(1) << " " << q2(2) << " " << q2(3) << " " << t2(0) << " " << t2(1) << " " << t2(2) << " " << i+1 << " " << i+1 << ".JPG\n";
-				for(unsigned int j=0;j<C[i].features.size();j++)
-				{
-					imgs << C[i].features[j](0) << " " << C[i].features[j](1) << " ";
-					if(C[i].o_obs[j] != -1)
-					{
-						imgs << C[i].o_obs[j]+1 << " ";
-						vector<pair<int, int>> tr;
-						pair<int, int> n_ob;
-						n_ob.first = pos;
-						n_ob.second = j+1;
-						if(p2tr.count(C[i].o_obs[j]))
-						{
-							tr = p2tr[C[i].o_obs[j]];
-						}
-						tr.push_back(n_ob);
-						p2tr[C[i].o_obs[j]] = tr;
-						points2D0.push_back(C[i].features[j]);
-						points3D0.push_back(P.second.points[ P.second.ID_map.at( C[i].o_obs[j] ) ]);
-					}
-					else
-						imgs << -1 << " ";
-				}
-				//residualCheck.Residuals(points2D0, points3D0, p2, &residuals_2);
-				//for(int i=0;i<residuals_2.size();i++) cout << residuals_2[i] << " ";
-				//cout << "\n";
-				pos++;
-				imgs << "\n";
-				if(C[i].take < ref+1)
-					c2m << C[i].take << "\n";
-				else
-					c2m << C[i].take-1 << "\n";
+				int id = model_observation(cam, layout->images[k].body, j);
+				if(id != -1)
+					layout->tracks[id].emplace_back(k+1, j);
 			}
 		}
 	}
 
-	imgs.close();
-	c2m.close();
-
-	cout << "Saving motions\n";
+	//pose of an image, the object images are in the frame of the object of its take
+	void model_image_pose(const img_s& cam, int body, const std::vector<trans_s>& motion, Eigen::Vector4d* q, Eigen::Vector3d* t)
+	{
+		Eigen::Matrix3d R = cam.R;
+		Eigen::Vector3d c = cam.c;
+		if(body == 2)
+		{
+			const trans_s& M = motion[cam.take-1];
+			R = cam.R * M.R;
+			c = M.R.transpose() * (cam.c - M.o);
+		}
+		*q = RotationMatrixToQuaternion(R);
+		*t = -R * c;
+	}
 
-	ofstream mot;
-	string p4 = "model" + to_string(mode) + "/motions.txt";
-	mot.open(p4);
-	for(unsigned int i=0;i<motion.size();i++)
+	void write_model_cameras(const std::vector<img_s>& C, const std::vector<int>& modes, bool binary, const std::string& root)
 	{
-		if(i!=(unsigned int)ref)
-			mot << r2a(motion[i].R).transpose() << " " << motion[i].o.transpose() << "\n";
+		model_writer_t cams(root, modes, binary ? "cameras.bin" : "cameras.txt", binary);
+		if(binary)
+			WriteBinaryLittleEndian<uint64_t>(&cams.buffer, C.size());
+		else
+		{
+			cams.buffer << "# Camera list with one line of data per camera:\n";
+			cams.buffer << "#   CAMERA_ID, MODEL, WIDTH, HEIGHT, PARAMS[]\n";
+			cams.buffer << "# Number of cameras: " << C.size() << "\n";
+		}
+		for(unsigned int i=0;i<C.size();i++)
+		{
+			if(binary)
+			{
+				WriteBinaryLittleEndian<camera_t>(&cams.buffer, i+1);
+				WriteBinaryLittleEndian<int>(&cams.buffer, SimpleRadialCameraModel::model_id);
+				WriteBinaryLittleEndian<uint64_t>(&cams.buffer, static_cast<uint64_t>(C[i].size_x));
+				WriteBinaryLittleEndian<uint64_t>(&cams.buffer, static_cast<uint64_t>(C[i].size_y));
+				for(double param : {C[i].f, C[i].px, C[i].py, kModelCameraRadial})
+					WriteBinaryLittleEndian<double>(&cams.buffer, param);
+			}
+			else
+				cams.buffer << i+1 << " SIMPLE_RADIAL " << C[i].size_x << " " << C[i].size_y << " " << C[i].f << " " << C[i].px << " " << C[i].py << " " << kModelCameraRadial << "\n";
+			cams.flush_if_full();
+		}
 	}
-	mot.close();
 
-	cout << "Saving points\n";
-	/*int bo = 0;
-	int vbo = 0;*/
+	//the motions are written as text in both formats, as colmap has no binary counterpart
+	void write_model_motions(const std::vector<trans_s>& motion, int ref, const std::vector<int>& modes, const std::string& root)
+	{
+		model_writer_t mot(root, modes, "motions.txt", false);
+		for(unsigned int i=0;i<motion.size();i++)
+		{
+			if(i!=(unsigned int)ref)
+				mot.buffer << r2a(motion[i].R).transpose() << " " << motion[i].o.transpose() << "\n";
+		}
+	}
 
-	ofstream pnts;
-	string p5 = "model" + to_string(mode) + "/points3d.txt";
-	pnts.open(p5);
-	pnts << "# 3D point list with one line of data per point:\n";
-	pnts << "#   POINT3D_ID, X, Y, Z, R, G, B, ERROR, TRACK[] as (IMAGE_ID, POINT2D_IDX)\n";
-	pnts << "# Number of points: " << P.first.points.size() + P.second.points.size() <<", mean track length: 11.69\n";
-	if((mode%4) != 3)
-	{
-		for(unsigned int i=0;i<P.first.points.size();i++)
-		{
-			int r = 255;
-			int g = 0;
-			int b = 0;
-			if((mode%4))
-			{
-				r = P.first.color[i](0);
-				g = P.first.color[i](1);
-				b = P.first.color[i](2);
+	void write_model_images(const std::vector<img_s>& C, const std::vector<trans_s>& motion, int ref, const model_layout_t& layout, bool binary, const std::string& root)
+	{
+		model_writer_t imgs(root, layout.modes, binary ? "images.bin" : "images.txt", binary);
+		model_writer_t c2m(root, layout.modes, "cam2mot.txt", false);
+		if(binary)
+			WriteBinaryLittleEndian<uint64_t>(&imgs.buffer, layout.images.size());
+		else
+		{
+			imgs.buffer << "# Image list with two lines of data per image:\n";
+			imgs.buffer << "#   IMAGE_ID, QW, QX, QY, QZ, TX, TY, TZ, CAMERA_ID, NAME\n";
+			imgs.buffer << "#   POINTS2D[] as (X, Y, POINT3D_ID)\n";
+			imgs.buffer << "# Number of images: " << layout.images.size() << ", mean observations per image: 683.904\n";
+		}
+		for(unsigned int k=0;k<layout.images.size();k++)
+		{
+			const int i = layout.images[k].cam;
+			const int body = layout.images[k].body;
+			Eigen::Vector4d q;
+			Eigen::Vector3d t;
+			model_image_pose(C[i], body, motion, &q, &t);
+			if(binary)
+			{
+				WriteBinaryLittleEndian<image_t>(&imgs.buffer, k+1);
+				for(int l=0;l<4;l++)
+					WriteBinaryLittleEndian<double>(&imgs.buffer, q(l));
+				for(int l=0;l<3;l++)
+					WriteBinaryLittleEndian<double>(&imgs.buffer, t(l));
+				WriteBinaryLittleEndian<camera_t>(&imgs.buffer, i+1);
+				const string name = to_string(i+1) + ".JPG";
+				imgs.buffer.write(name.c_str(), name.size()+1);
+				WriteBinaryLittleEndian<uint64_t>(&imgs.buffer, C[i].features.size());
 			}
-			pnts << P.first.ID[i]+1 << " " << P.first.points[i](0) << " " << P.first.points[i](1) << " " << P.first.points[i](2) << " " << r << " " << g << " " << b << " 0 ";
-			if(p2tr.count(P.first.ID[i]))
+			else
+				imgs.buffer << k+1 << " " << q(0) << " " << q(1) << " " << q(2) << " " << q(3) << " " << t(0) << " " << t(1) << " " << t(2) << " " << i+1 << " " << i+1 << ".JPG\n";
+			for(unsigned int j=0;j<C[i].features.size();j++)
 			{
-				vector<pair<int, int>> tr = p2tr[P.first.ID[i]];
-				for(unsigned int j=0;j<tr.size();j++)
+				int id = model_observation(C[i], body, j);
+				if(binary)
 				{
-					pnts << tr[j].first << " " << tr[j].second << " ";
+					//the points of the body missing from the model are not referenced
+					bool missing = (id == C[i].b_obs[j]) ? !layout.background : !layout.object;
+					WriteBinaryLittleEndian<double>(&imgs.buffer, C[i].features[j](0));
+					WriteBinaryLittleEndian<double>(&imgs.buffer, C[i].features[j](1));
+					WriteBinaryLittleEndian<point3D_t>(&imgs.buffer, (id == -1 || missing) ? kInvalidPoint3DId : id+1);
 				}
-				//TODO
-				//experimental
-				//pnts << "1 1 2 2 3 3 ";
-			}
-			//experimental
-			//pnts << "1 1 2 2 ";
-			pnts << "\n";
+				else
+					imgs.buffer << C[i].features[j](0) << " " << C[i].features[j](1) << " " << (id == -1 ? -1 : id+1) << " ";
+			}
+			if(!binary)
+				imgs.buffer << "\n";
+			if(body != 2)
+				c2m.buffer << "-1\n";
+			else if(C[i].take < ref+1)
+				c2m.buffer << C[i].take << "\n";
+			else
+				c2m.buffer << C[i].take-1 << "\n";
+			imgs.flush_if_full();
+			c2m.flush_if_full();
 		}
 	}
-	if((mode%4) != 2)
+
+	//the points of one body, in red or green in the mode 0,
+	//the error stores the body and the object tracks end with an experimental observation
+	void write_model_body_points(const pnts_s& P, int body, int mode, const model_layout_t& layout, bool binary, model_writer_t* pnts)
 	{
-		for(unsigned int i=0;i<P.second.points.size();i++)
+		const std::vector<std::pair<int, int>> no_track;
+		for(unsigned int i=0;i<P.points.size();i++)
 		{
-			int r = 0;
-			int g = 255;
-			int b = 0;
-			if((mode%4))
-			{
-				r = P.second.color[i](0);
-				g = P.second.color[i](1);
-				b = P.second.color[i](2);
-			}
-			/*if(!p2tr.count(P.second.ID[i]) || p2tr[P.second.ID[i]].size() <= 2)
+			Eigen::Vector3ub color = P.color[i];
+			if(!(mode%4))
+				color = body ? Eigen::Vector3ub(0, 255, 0) : Eigen::Vector3ub(255, 0, 0);
+			auto it = layout.tracks.find(P.ID[i]);
+			const std::vector<std::pair<int, int>>& tr = (it == layout.tracks.end()) ? no_track : it->second;
+			if(binary)
 			{
-				r = 0;
-				g = 0;
-				b = 255;
-				bo++;
-				if(!p2tr.count(P.second.ID[i]) || p2tr[P.second.ID[i]].size() <= 1)
+				WriteBinaryLittleEndian<point3D_t>(&pnts->buffer, P.ID[i]+1);
+				for(int l=0;l<3;l++)
+					WriteBinaryLittleEndian<double>(&pnts->buffer, P.points[i](l));
+				for(int l=0;l<3;l++)
+					WriteBinaryLittleEndian<uint8_t>(&pnts->buffer, color(l));
+				WriteBinaryLittleEndian<double>(&pnts->buffer, body);
+				WriteBinaryLittleEndian<uint64_t>(&pnts->buffer, tr.size());
+				for(unsigned int j=0;j<tr.size();j++)
 				{
-					vbo++;
-					r = 255;
-					g = 0;
-					b = 255;
+					WriteBinaryLittleEndian<image_t>(&pnts->buffer, tr[j].first);
+					WriteBinaryLittleEndian<point2D_t>(&pnts->buffer, tr[j].second);
 				}
-			}*/
-			pnts << P.second.ID[i]+1 << " " << P.second.points[i](0) << " " << P.second.points[i](1) << " " << P.second.points[i](2) << " " << r << " " << g << " " << b << " 1 ";
-			if(p2tr.count(P.second.ID[i]))
+			}
+			else
 			{
-				vector<pair<int, int>> tr = p2tr[P.second.ID[i]];
+				pnts->buffer << P.ID[i]+1 << " " << P.points[i](0) << " " << P.points[i](1) << " " << P.points[i](2) << " " << (int)color(0) << " " << (int)color(1) << " " << (int)color(2) << " " << body << " ";
 				for(unsigned int j=0;j<tr.size();j++)
-				{
-					pnts << tr[j].first << " " << tr[j].second << " ";
-				}
-				//TODO
+					pnts->buffer << tr[j].first << " " << tr[j].second+1 << " ";
 				//experimental
-				//pnts << "1 1 2 2 3 3 ";
+				if(body)
+					pnts->buffer << "1 1 ";
+				pnts->buffer << "\n";
 			}
-			//HERE_
-			//experimental
-			pnts << "1 1 ";
-			pnts << "\n";
+			pnts->flush_if_full();
 		}
 	}
-	//cout << "BLUE POINTS " << bo << "\n";
-	//cout << "VERY BLUE POINTS " << vbo << "\n";
-	
-	pnts.close();
 
-	//for(int i=0;i<P)
+	void write_model_points(const std::pair<pnts_s, pnts_s>& P, int mode, const model_layout_t& layout, bool binary, const std::string& root)
+	{
+		model_writer_t pnts(root, {mode}, binary ? "points3D.bin" : "points3d.txt", binary);
+		if(binary)
+			WriteBinaryLittleEndian<uint64_t>(&pnts.buffer, (layout.background ? P.first.points.size() : 0) + (layout.object ? P.second.points.size() : 0));
+		else
+		{
+			pnts.buffer << "# 3D point list with one line of data per point:\n";
+			pnts.buffer << "#   POINT3D_ID, X, Y, Z, R, G, B, ERROR, TRACK[] as (IMAGE_ID, POINT2D_IDX)\n";
+			pnts.buffer << "# Number of points: " << P.first.points.size() + P.second.points.size() <<", mean track length: 11.69\n";
+		}
+		if(layout.background)
+			write_model_body_points(P.first, 0, mode, layout, binary, &pnts);
+		if(layout.object)
+			write_model_body_points(P.second, 1, mode, layout, binary, &pnts);
+	}
 }
 
-void step1()
+void save_models(const std::pair<pnts_s, pnts_s>& P, const std::vector<img_s>& C, const std::vector<trans_s>& motion, const std::vector<int>& modes, int ref, bool binary, const std::string& path, int max_num_threads)
 {
-	//this will be added to the colmap
-	ifstream pivot;
-	pivot.open("pivot.txt");
-	int takes = 0;
-	pivot >> takes;
-	pivot.close();
-	cout << takes << "\n";
-
-	//create files cams and center
-	ofstream cams;
-	cams.open("cams.txt");
-	ofstream center;
-	center.open("center.txt");
+	TRACE_SCOPE("save_models");
+	cout << "Saving models\n";
 
-	if(takes == 0)
-		takes = 1;
-	for(int i=1;i<=takes;i++)
+	//the layouts of the models with both bodies, the background and the object
+	std::vector<model_layout_t> layouts(3);
+	for(unsigned int l=0;l<layouts.size();l++)
+	{
+		layouts[l].background = (l != 2);
+		layouts[l].object = (l != 1);
+	}
+	for(int mode : modes)
 	{
-		cout << i << "\n";
-		//work with the i-th folder (and reconstruction)
+		if((mode%4) == 2)
+			layouts[1].modes.push_back(mode);
+		else if((mode%4) == 3)
+			layouts[2].modes.push_back(mode);
+		else
+			layouts[0].modes.push_back(mode);
+	}
+	layouts.erase(std::remove_if(layouts.begin(), layouts.end(), [](const model_layout_t& L){ return L.modes.empty(); }), layouts.end());
 
-		//load points3D
-		unordered_map<int,Eigen::Vector3d> points;
-		ifstream pnts;
-		string p1 = to_string(i) + "/points3D.txt";
-		//cout << p1 << "\n";
-		pnts.open(p1);
+	ThreadPool thread_pool(std::min(GetEffectiveNumThreads(max_num_threads), (int)modes.size()+2));
 
-		string line;
-		while(getline(pnts,line))
+	//the cameras and the motions are the same in all models, the images in all models of a layout
+	thread_pool.AddTask(write_model_cameras, std::cref(C), std::cref(modes), binary, std::cref(path));
+	thread_pool.AddTask(write_model_motions, std::cref(motion), ref, std::cref(modes), std::cref(path));
+	for(model_layout_t& layout : layouts)
+	{
+		thread_pool.AddTask([&C, &motion, ref, binary, &path, &layout]()
 		{
-			//cout << line << "\n";
-			istringstream str(line);
-			int id;
-			str >> id;
-			
-			Eigen::Vector3d p;
-			str >> p(0);
-			str >> p(1);
-			str >> p(2);
-			//cout << p.x << " " << p.y << " " << p.z << "\n";
-			points[id] = p;
-		}
+			build_model_layout(C, ref, &layout);
+			write_model_images(C, motion, ref, layout, binary, path);
+		});
+	}
+	thread_pool.Wait();
 
-		pnts.close();
+	for(const model_layout_t& layout : layouts)
+	{
+		for(int mode : layout.modes)
+			thread_pool.AddTask(write_model_points, std::cref(P), mode, std::cref(layout), binary, std::cref(path));
+	}
+	thread_pool.Wait();
+}
 
-		//load images
-		unordered_map<int,Eigen::Vector3d> centerpoints;
-		string p2 = to_string(i) + "/images.txt";
-		ifstream imgs;
-		imgs.open(p2);
+void save_model(const std::pair<pnts_s, pnts_s>& P, const std::vector<img_s>& C, const std::vector<trans_s>& motion, int mode, int ref)
+{
+	save_models(P, C, motion, {mode}, ref, false);
+}
 
-		for(int j=0;j<4;j++)
-			getline(imgs,line);
-
-		while(getline(imgs,line))
-		{
-			int id;
-			istringstream str(line);
-			str >> id;
-			//cout << id << "\n";
-			getline(imgs,line);
-			istringstream str2(line);
-			double num;
-			double x_sum = 0;
-			double y_sum = 0;
-			double z_sum = 0;
-			double count = 0;
-			while(str2 >> num)
-			{
-				str2 >> num;
-				int pnt_id;
-				str2 >> pnt_id;
-				if(pnt_id == -1)
-					continue;
-				//cout << pnt_id << "\n";
-				count++;
-				Eigen::Vector3d pnt = points[pnt_id];
-				x_sum += pnt(0);
-				y_sum += pnt(1);
-				z_sum += pnt(2);
-				//cout << x_sum << "\n";
-			}
-			//cout << "\n";
-			//cout << x_sum << "\n";
-			//cout << "\n\n";
-			//cout << count << "\n";
-			Eigen::Vector3d centerpoint;
-			centerpoint(0) = (x_sum/count);
-			centerpoint(1) = (y_sum/count);
-			centerpoint(2) = (z_sum/count);
-			centerpoints[id] = centerpoint;
-			//cout << centerpoint.x << "\n\n\n";
-		}
-		imgs.close();
+std::vector<TakeBundle> load_takes(int takes)
+{
+	std::vector<TakeBundle> ret;
+	for(int i=1;i<=takes;i++)
+	{
+		ret.push_back(load_take(i));
+	}
+	return ret;
+}
 
-		//copy the cams file and add centerpoints to file center.txt
-		ifstream c;
-		string p3 = to_string(i) + "/cams.txt";
-		c.open(p3);
-		while(getline(c,line))
-		{
-			cams << line << "\n";
-			istringstream str(line);
-			double num;
-			for(int j=0;j<16;j++)
-			{
-				str >> num;
-			}
-			int id;
-			str >> id;
-			//cout << id << "\n";
-			Eigen::Vector3d cp = centerpoints[id];
-			//cout << cp.x << "\n";
-			center << cp(0) << " " << cp(1) << " " << cp(2) << "\n";
+std::unordered_map<int, Eigen::Vector3d> take_centers(const TakeBundle& bundle)
+{
+	//the center of an image is the mean of the 3D points it observes, which
+	//the bundle stores since it was extracted from the reconstruction
+	unordered_map<int,Eigen::Vector3d> centerpoints;
+	centerpoints.reserve(bundle.images.size());
+	for(const TakeImage& img : bundle.images)
+		centerpoints[img.image_id] = img.center;
+	return centerpoints;
+}
+
+std::vector<cam_s> load_cams(const std::vector<TakeBundle>& B)
+{
+	cout << "Loading Cams\n";
+
+	std::vector<cam_s> ret;
+	for(const TakeBundle& bundle : B)
+	{
+		unordered_map<int,Eigen::Vector3d> centerpoints = take_centers(bundle);
+		for(const TakeCamera& c : bundle.cameras)
+		{
+			cam_s ncam;
+			ncam.id = c.image_id;
+			ncam.second = c.take;
+			ncam.anchor = c.anchor;
+			ncam.R = QuaternionToRotationMatrix(c.qvec);
+			ncam.t = c.tvec;
+			ncam.size_x = c.width;
+			ncam.size_y = c.height;
+			ncam.f = c.focal_length;
+			ncam.px = c.principal_point_x;
+			ncam.py = c.principal_point_y;
+			ncam.inl = c.num_inliers;
+			ncam.id_2 = c.pose_image_id;
+			ncam.center = centerpoints[c.pose_image_id];
+			ret.push_back(ncam);
 		}
-		c.close();
-		
 	}
-	cams.close();
-	center.close();
+
+	return ret;
+}
+
+tracks_s find_tracks(const std::vector<TakeBundle>& bundles)
+{
+	const int takes = bundles.size();
 
 	//CREATE TRACKS OF 3D POINTS
 	//for each 3D point find neighbouring points, which share an observation with the 3D point
 	vector<node_s> nodes;
 	vector<unordered_map<int,int>> id2pos;
 
-	//load 3D points from a file
 	for(int i=1;i<=takes;i++)
 	{
-		ifstream pnts;
-		string p1 = to_string(i) + "/points3D.txt";
-		pnts.open(p1);
 		unordered_map<int,int> cur_id2pos;
-
-		string line;
-		for(int j=0;j<3;j++)
-			getline(pnts,line);
-		while(getline(pnts,line))
+		for(const TakePoint3D& pnt : bundles[i-1].points3D)
 		{
-			//cout << line << "\n";
-			istringstream str(line);
-			int id;
-			str >> id;
-			
-			//cout << i << " " << id << "\n";
-			//cout << nodes.size();
+			int id = pnt.point3D_id;
 			point_id nid;
 			nid.take = i;
 			nid.id = id;
@@ -7025,8 +7845,6 @@ void step1()
 			cur_id2pos[id] = nodes.size();
 			nodes.push_back(nnd);
 		}
-		
-		pnts.close();
 		id2pos.push_back(cur_id2pos);
 	}
 
@@ -7036,28 +7854,10 @@ void step1()
 	vector<int> obs_size;
 	for(int i=1;i<=takes;i++)
 	{
-		cout << i << "\n";
-		string line;
-		string p2 = to_string(i) + "/images.txt";
-		ifstream imgs;
-		imgs.open(p2);
-
-		for(int j=0;j<4;j++)
-			getline(imgs,line);
-
-		while(getline(imgs,line))
+		VLOG(4) << i;
+		for(const TakeImage& img : bundles[i-1].images)
 		{
-			int id;
-			/*if(id%20)
-				cout << id << "\n";*/
-			istringstream str(line);
-			str >> id;
-			double num;
-			for(int j=0;j<8;j++)
-				str >> num;
-			string name;
-			str >> name;
-
+			const string& name = img.name;
 			if(!img_id2pos.count(name))
 			{
 				vector<vector<int>> ni;
@@ -7074,51 +7874,34 @@ void step1()
 				images.at(pos).push_back(obs);
 			}
 
-			
-			getline(imgs,line);
-			istringstream str2(line);
-
-			//cout << images.at(pos).size() << " " << i << "\n";
-			
 			if(images.at(pos).at(i-1).size())
 			{
-				int position = 0;
-				while(str2 >> num)
+				//phantom image of an already loaded image, add its observations
+				for(size_t position=0;position<img.point3D_ids.size();position++)
 				{
-					str2 >> num;
-					int pnt_id;
-					str2 >> pnt_id;
+					int pnt_id = obs_id(img.point3D_ids[position]);
 					if (pnt_id >= 0)
 						images.at(pos).at(i-1).at(position) = pnt_id;
-					position++;
 				}
 			}
 			else
 			{
-				int position = 0;
-				//vector<int> obs;
-				while(str2 >> num)
+				for(const point3D_t pnt : img.point3D_ids)
 				{
-					str2 >> num;
-					int pnt_id;
-					str2 >> pnt_id;
-					images.at(pos).at(i-1).push_back(pnt_id);
-					//obs.push_back(pnt_id);
-					position++;
+					images.at(pos).at(i-1).push_back(obs_id(pnt));
 				}
-				obs_size.at(pos) = position;
+				obs_size.at(pos) = img.point3D_ids.size();
 			}
 		}
-		imgs.close();
 	}
 
-	//for each point find its neighbours
+	//for each point find its neighbours, the position of every neighbour in
+	//the neighbours of a point is hashed by the positions of both points
+	unordered_map<uint64_t, int> neighbour_pos;
 	for(unsigned int i=0;i<images.size();i++)
 	{
 		if(!(i%10))
-			cout << i << "\n";
-		/*cout << images.at(i).at(0).size() << "\n";
-		cout << obs_size.at(i) << "\n";*/
+			VLOG(4) << i;
 		for(int j=0;j<obs_size.at(i);j++)
 		{
 			
@@ -7130,6 +7913,8 @@ void step1()
 					continue;
 				if(images.at(i).at(t).at(j) == -1)
 					continue;
+				const int position = id2pos.at(t)[images.at(i).at(t).at(j)];
+				vector<point_id>& neighbours = nodes.at(position).neighbours;
 				for(int u=0;u<takes;u++)
 				{
 					if(images.at(i).size() <= (unsigned int)u)
@@ -7140,44 +7925,31 @@ void step1()
 						continue;
 					if(images.at(i).at(u).at(j) == -1)
 						continue;
-					//cout << t << " " << images.at(i).at(t).at(j) << " " << u << " " << images.at(i).at(u).at(j) << "\n";
 					point_id npt;
 					npt.id = images.at(i).at(u).at(j);
 					npt.take = u+1;
 					npt.position = id2pos.at(u)[npt.id];
 					npt.strength = 1;
-					const int sz = nodes.at(id2pos.at(t)[images.at(i).at(t).at(j)]).neighbours.size();
-					bool found = 0;
-					for(int k=0;k<sz;k++)
-					{
-						if(nodes.at(id2pos.at(t)[images.at(i).at(t).at(j)]).neighbours.at(k).position == npt.position)
-						{
-							nodes.at(id2pos.at(t)[images.at(i).at(t).at(j)]).neighbours.at(k).strength = nodes.at(id2pos.at(t)[images.at(i).at(t).at(j)]).neighbours.at(k).strength+1;
-							found = 1;
-							break;
-						}
-					}
-					if(!found)
-						nodes.at(id2pos.at(t)[images.at(i).at(t).at(j)]).neighbours.push_back(npt);
+					const uint64_t key = (static_cast<uint64_t>(position) << 32) | static_cast<uint32_t>(npt.position);
+					const auto found = neighbour_pos.emplace(key, neighbours.size());
+					if(found.second)
+						neighbours.push_back(npt);
+					else
+						neighbours.at(found.first->second).strength++;
 				}
-				/*cout << t << "\n";
-				cout << images.at(i).at(t).at(j) << "\n";*/
 			}
 		}
 	}
 
 	//merge the neighbouring 3D points into tracks
-	ofstream trac;
-	trac.open("tracks.txt");
-	ofstream grap;
-	grap.open("graph.txt");
+	tracks_s ret;
 	int track_id = 1;
 	//int neg_track_id = -1;
 	for(unsigned int i=0;i<nodes.size();i++)
 	{
 		vector<int> cur_track;
 		if(!(track_id % 1000))
-			cout << track_id << "\n";
+			VLOG(4) << track_id;
 		if(nodes.at(i).track)
 		{
 			continue;
@@ -7221,56 +7993,114 @@ void step1()
 		}
 		if(consistent)
 		{
+			std::vector<std::pair<int, int>> track;
 			for(unsigned int j=0;j<cur_track.size();j++)
 			{
-				trac << nodes.at(cur_track.at(j)).id.take << " " << nodes.at(cur_track.at(j)).id.id << " ";
+				track.push_back(std::make_pair(nodes.at(cur_track.at(j)).id.take, nodes.at(cur_track.at(j)).id.id));
 			}
-			trac << "\n";
+			ret.tracks.push_back(track);
 		}
 		else
 		{
+			std::vector<std::pair<int, int>> track;
+			for(unsigned int j=0;j<cur_track.size();j++)
+			{
+				track.push_back(std::make_pair(nodes.at(cur_track.at(j)).id.take, nodes.at(cur_track.at(j)).id.id));
+			}
+			//the neighbours of the points are all in the track
+			unordered_map<int, int> track_pos;
 			for(unsigned int j=0;j<cur_track.size();j++)
 			{
-				grap << nodes.at(cur_track.at(j)).id.take << " " << nodes.at(cur_track.at(j)).id.id << " ";
+				track_pos[cur_track.at(j)] = j;
 			}
-			grap << "\n";
+			std::vector<graph_edge_s> G;
 			for(unsigned int j=0;j<cur_track.size();j++)
 			{
-				int tj = cur_track.at(j);
-				for(unsigned int k=0;k<cur_track.size();k++)
+				for(const point_id& neighbour : nodes.at(cur_track.at(j)).neighbours)
 				{
-					int tk = cur_track.at(k);
-					if(tj==tk)
-						grap << "0 ";
-					else
-					{
-						bool found = 0;
-						for(unsigned int a=0;a<nodes.at(tj).neighbours.size();a++)
-						{
-							if(nodes.at(tj).neighbours.at(a).position == nodes.at(tk).id.position)
-							{
-								grap << nodes.at(tj).neighbours.at(a).strength << " ";
-								found = 1;
-								break;
-							}
-						}
-						if(!found)
-							grap << "0 ";
-					}
+					graph_edge_s edge;
+					edge.i = j;
+					edge.j = track_pos.at(neighbour.position);
+					edge.strength = neighbour.strength;
+					G.push_back(edge);
 				}
-				grap << "\n";
 			}
-			grap << "\n";
+			ret.graph_nodes.push_back(track);
+			ret.graphs.push_back(G);
 		}
 		
 		track_id++;
 	}
 
+	return ret;
+}
+
+void step1(const std::vector<TakeBundle>& bundles)
+{
+	//create files cams and center
+	ofstream cams;
+	cams.open("cams.txt");
+	ofstream center;
+	center.open("center.txt");
+
+	for(unsigned int i=0;i<bundles.size();i++)
+	{
+		VLOG(4) << i+1;
+		//copy the cams file and add centerpoints to file center.txt
+		unordered_map<int,Eigen::Vector3d> centerpoints = take_centers(bundles[i]);
+		for(const TakeCamera& c : bundles[i].cameras)
+		{
+			cams << c.image_id << " " << c.take << " " << c.anchor << " " << c.qvec(0) << " " << c.qvec(1) << " " << c.qvec(2) << " " << c.qvec(3) << " "
+				<< c.tvec(0) << " " << c.tvec(1) << " " << c.tvec(2) << " " << c.width << " " << c.height << " " << c.focal_length << " "
+				<< c.principal_point_x << " " << c.principal_point_y << " " << c.num_inliers << " " << c.pose_image_id << "\n";
+			Eigen::Vector3d cp = centerpoints[c.pose_image_id];
+			center << cp(0) << " " << cp(1) << " " << cp(2) << "\n";
+		}
+	}
+	cams.close();
+	center.close();
+
+	tracks_s TR = find_tracks(bundles);
+
+	ofstream trac;
+	trac.open("tracks.txt");
+	for(const std::vector<std::pair<int, int>>& track : TR.tracks)
+	{
+		for(const std::pair<int, int>& el : track)
+		{
+			trac << el.first << " " << el.second << " ";
+		}
+		trac << "\n";
+	}
 	trac.close();
-	grap.close();
+
+	write_track_graphs(TR, "graph.bin");
+}
+
+void step1()
+{
+	//the number of takes is the highest take id in the take list
+	ifstream fset;
+	fset.open("takes.txt");
+	int takes = 0;
+	string name;
+	int cur_id;
+	while(fset >> name >> cur_id)
+	{
+		if(cur_id > takes)
+			takes = cur_id;
+	}
+	fset.close();
+	VLOG(3) << takes;
+
+	if(takes == 0)
+		takes = 1;
+
+	//load every take only once, from its binary bundle if there is one
+	step1(load_takes(takes));
 }
 
-void check(std::vector<imgs_s> I, std::vector<pnts_s> P, std::vector<cam_s> C, std::pair<std::vector<std::vector<std::pair<int, int>>>, std::vector<std::unordered_map<int, int>>> T, std::vector<std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>> O)
+void check(const std::vector<imgs_s>& I, const std::vector<pnts_s>& P, const std::vector<cam_s>& C, const std::pair<std::vector<std::vector<std::pair<int, int>>>, std::vector<std::unordered_map<int, int>>>& T, const std::vector<std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>>& O)
 {
 	for(unsigned int i=0;i<C.size();i++)
 	{
@@ -7368,53 +8198,6 @@ void check(std::vector<imgs_s> I, std::vector<pnts_s> P, std::vector<cam_s> C, s
 	}*/
 }
 
-struct CostFunctor
-{
-	CostFunctor(double obs_x, double obs_y) : obs_x(obs_x), obs_y(obs_y) {}
-	template <typename T>
-	bool operator()(const T* const camera, const T* const point, T* residuals) const
-	{
-		T p[3];
-		ceres::AngleAxisRotatePoint(camera, point, p);
-		p[0] += camera[3]; p[1] += camera[4]; p[2] += camera[5];
-		T xp = p[0] / p[2];
-	    T yp = p[1] / p[2];
-	    const T& focal = camera[6];
-		T predicted_x = focal * xp;
-		T predicted_y = focal * yp;
-		residuals[0] = predicted_x - T(obs_x);
-	    residuals[1] = predicted_y - T(obs_y);
-	    return true;
-	}
-	double obs_x;
-	double obs_y;
-};
-
-struct CostFunctor2
-{
-	CostFunctor2(double obs_x, double obs_y) : obs_x(obs_x), obs_y(obs_y) {}
-	template <typename T>
-	bool operator()(const T* const camera, const T* const point, const T* const motion, T* residuals) const
-	{
-		T p0[3];
-		ceres::AngleAxisRotatePoint(motion, point, p0);
-		p0[0] += motion[3]; p0[1] += motion[4]; p0[2] += motion[5];
-		T p[3];
-		ceres::AngleAxisRotatePoint(camera, p0, p);
-		p[0] += camera[3]; p[1] += camera[4]; p[2] += camera[5];
-		T xp = p[0] / p[2];
-	    T yp = p[1] / p[2];
-	    const T& focal = camera[6];
-		T predicted_x = focal * xp;
-		T predicted_y = focal * yp;
-		residuals[0] = predicted_x - T(obs_x);
-	    residuals[1] = predicted_y - T(obs_y);
-	    return true;
-	}
-	double obs_x;
-	double obs_y;
-};
-
 double test1(const double* const camera, const double* const point, double obs_x, double obs_y)
 {
 	double p[3];
@@ -7445,135 +8228,115 @@ double test2(const double* const camera, const double* const point, const double
 	return (predicted_x - obs_x)*(predicted_x - obs_x) + (predicted_y - obs_y)*(predicted_y - obs_y);
 }
 
-void perform_BA(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::vector<trans_s> &motion, int mode, int ref)
+namespace {
+
+//chooses the linear solver by the number of cameras and motions in the
+//reduced camera system, with the same thresholds as BundleAdjuster::Solve. The
+//dense Schur complement does not fit into memory for thousands of images.
+void set_schur_solver(const int num_images, const int num_threads, ceres::Solver::Options* options)
 {
-	//2 cfs will be necessary, one for the normal cams and the other one for the object cams (with parameters of the camera + the motions)
-	
-	//create a list (array, probably a classic one) with parameters
-	//fill it with the parameters
-	//cameras, points
-	vector<double> cams;
-	vector<double> motions;
-	vector<double> points1;
-	vector<double> points2;
-	for(unsigned int i=0;i<C.size();i++)
+	const int kMaxNumImagesDirectDenseSolver = 50;
+	const int kMaxNumImagesDirectSparseSolver = 1000;
+	if(num_images <= kMaxNumImagesDirectDenseSolver)
+		options->linear_solver_type = ceres::DENSE_SCHUR;
+	else if(num_images <= kMaxNumImagesDirectSparseSolver)
+		options->linear_solver_type = ceres::SPARSE_SCHUR;
+	else
+	{
+		options->linear_solver_type = ceres::ITERATIVE_SCHUR;
+		options->preconditioner_type = ceres::SCHUR_JACOBI;
+	}
+	options->num_threads = GetEffectiveNumThreads(num_threads);
+	options->num_linear_solver_threads = GetEffectiveNumThreads(num_threads);
+}
+
+}  // namespace
+
+void perform_BA(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::vector<trans_s> &motion, int mode, int ref, int num_threads, bool use_pba, int pba_gpu_index, bool mixed_precision)
+{
+	TRACE_SCOPE("perform_BA");
+	//the camera of every image is a pinhole camera with a fixed principal point,
+	//so the residuals use the fixed-size analytic TwoBodyCostFunction and
+	//TwoBodyObjectCostFunction instead of a dispatch over the camera models
+	//the images are identified by their indices, the background points by
+	//their positions and the object points follow the background points
+	TwoBodyScene scene;
+	BundleAdjustmentConfig config;
+	const point3D_t num_points1 = P.first.points.size();
+	for(unsigned int i=0;i<P.first.points.size();i++)
+		scene.points3D.emplace(i, P.first.points[i]);
+	for(unsigned int i=0;i<P.second.points.size();i++)
 	{
-		//aa(3), t(3), f(1), /*px(1), py(1)*/ - fix at least the px, py, nothing to change there, maybe also the focal length
-		Eigen::Vector3d aa = r2a(C[i].R);
-		cams.push_back(aa(0));
-		cams.push_back(aa(1));
-		cams.push_back(aa(2));
-		Eigen::Vector3d t = -1 * C[i].R * C[i].c;
-		cams.push_back(t(0));
-		cams.push_back(t(1));
-		cams.push_back(t(2));
-		cams.push_back(C[i].f);
-		//cams.push_back(C[i].px);
-		//cams.push_back(C[i].py);
+		scene.points3D.emplace(num_points1 + i, P.second.points[i]);
+		scene.object_point3D_ids.insert(num_points1 + i);
 	}
 	for(unsigned int i=0;i<motion.size();i++)
 	{
 		//aa(3), t(3)
 		Eigen::Vector3d aa = r2a(motion[i].R.transpose());
-		motions.push_back(aa(0));
-		motions.push_back(aa(1));
-		motions.push_back(aa(2));
 		Eigen::Vector3d t = -1 * motion[i].R.transpose() * motion[i].o;
-		motions.push_back(t(0));
-		motions.push_back(t(1));
-		motions.push_back(t(2));
-	}
-	for(unsigned int i=0;i<P.first.points.size();i++)
-	{
-		//point(3)
-		Eigen::Vector3d p = P.first.points[i];
-		points1.push_back(p(0));
-		points1.push_back(p(1));
-		points1.push_back(p(2));
-	}
-	for(unsigned int i=0;i<P.second.points.size();i++)
-	{
-		//point(3)
-		Eigen::Vector3d p = P.second.points[i];
-		points2.push_back(p(0));
-		points2.push_back(p(1));
-		points2.push_back(p(2));
+		scene.motions.push_back({{aa(0), aa(1), aa(2), t(0), t(1), t(2)}});
 	}
-	double * cams_ = cams.data();
-	double * motions_ = motions.data();
-	double * points1_ = points1.data();
-	double * points2_ = points2.data();
-
-	ceres::Problem problem;
-	//for each observation (camera, feature, point) add a residual block
-	//a cost function is necessary
-	//subtract px, py from the observations
 	for(unsigned int i=0;i<C.size();i++)
 	{
-		//background observations (use the simple reprojection error)
-		vector<Eigen::Vector2d> feat = C[i].features;
-		vector<int> obs = C[i].b_obs;
-		double * camera = cams_ + 7*i;
-		for(unsigned int j=0;j<obs.size();j++)
-		{
-			if(obs[j] == -1) continue;
-			if(!P.first.ID_map.count(obs[j])) {cout << "NK\n"; continue;}
-			int pos = P.first.ID_map[obs[j]];
-			double * point = points1_ + 3*pos;
-			ceres::CostFunction* cost_function = new ceres::AutoDiffCostFunction<CostFunctor, 2, 7, 3>(new CostFunctor(feat[j](0)-C[i].px, feat[j](1)-C[i].py));
-			ceres::LossFunction* loss_function = new ceres::HuberLoss(30.0);
-			problem.AddResidualBlock(cost_function, loss_function, camera, point);
-			//cout << test1(camera, point, feat[j](0)-C[i].px, feat[j](1)-C[i].py) << "\n";
-		}
-
-		//object observations (if the take is not reference, use the complex reprojection error)
-		obs = C[i].o_obs;
-		if(C[i].take == ref+1)
-		{
-			for(unsigned int j=0;j<obs.size();j++)
-			{
-				if(obs[j] == -1) continue;
-				if(!P.second.ID_map.count(obs[j])) {cout << "NK\n"; continue;}
-				int pos = P.second.ID_map[obs[j]];
-				double * point = points2_ + 3*pos;
-				ceres::CostFunction* cost_function = new ceres::AutoDiffCostFunction<CostFunctor, 2, 7, 3>(new CostFunctor(feat[j](0)-C[i].px, feat[j](1)-C[i].py));
-				ceres::LossFunction* loss_function = new ceres::HuberLoss(30.0);
-				problem.AddResidualBlock(cost_function, loss_function, camera, point);
-				//test1(camera, point, feat[j](0)-C[i].px, feat[j](1)-C[i].py);
-			}
-		}
-		else
-		{
-			double * mot = motions_ + 6 * (C[i].take-1);
-			for(unsigned int j=0;j<obs.size();j++)
-			{
-				if(obs[j] == -1) continue;
-				if(!P.second.ID_map.count(obs[j])) {cout << "NK\n"; continue;}
-				int pos = P.second.ID_map[obs[j]];
-				double * point = points2_ + 3*pos;
-				ceres::CostFunction* cost_function = new ceres::AutoDiffCostFunction<CostFunctor2, 2, 7, 3, 6>(new CostFunctor2(feat[j](0)-C[i].px, feat[j](1)-C[i].py));
-				ceres::LossFunction* loss_function = new ceres::HuberLoss(30.0);
-				problem.AddResidualBlock(cost_function, loss_function, camera, point, mot);
-				//test2(camera, point, mot, feat[j](0)-C[i].px, feat[j](1)-C[i].py);
-			}
-		}
-		
-	}
-	//ceres::CostFunction* cost_function = new ceres::AutoDiffCostFunction<CostFunctor, 1, 1>(new CostFunctor(11,11));
-	//problem.AddResidualBlock(cost_function, NULL, &x);
-
-	//solve the problem (use a sparse solver)
-	ceres::Solver::Options options;
-	options.linear_solver_type = ceres::DENSE_SCHUR;
-	options.minimizer_progress_to_stdout = true;
-	//options.max_num_iterations = 1;
-	ceres::Solver::Summary summary;
-	Solve(options, &problem, &summary);
+		//aa(3), t(3), f(1) - the principal point is fixed and subtracted from the observations
+		TwoBodyScene::Image& image = scene.images[i];
+		Eigen::Vector3d aa = r2a(C[i].R);
+		Eigen::Vector3d t = -1 * C[i].R * C[i].c;
+		image.camera = {{aa(0), aa(1), aa(2), t(0), t(1), t(2), C[i].f}};
+		//the object observations of the reference take do not use a motion
+		if(C[i].take != ref+1)
+			image.motion_idx = C[i].take-1;
+
+		const Eigen::Vector2d pp(C[i].px, C[i].py);
+		const vector<Eigen::Vector2d>& feat = C[i].features;
+		const vector<int>& b_obs = C[i].b_obs;
+		for(unsigned int j=0;j<b_obs.size();j++)
+		{
+			if(b_obs[j] == -1) continue;
+			if(!P.first.ID_map.count(b_obs[j])) continue;
+			image.points2D.push_back(feat[j] - pp);
+			image.point3D_ids.push_back(P.first.ID_map[b_obs[j]]);
+		}
+		const vector<int>& o_obs = C[i].o_obs;
+		for(unsigned int j=0;j<o_obs.size();j++)
+		{
+			if(o_obs[j] == -1) continue;
+			if(!P.second.ID_map.count(o_obs[j])) continue;
+			image.points2D.push_back(feat[j] - pp);
+			image.point3D_ids.push_back(num_points1 + P.second.ID_map[o_obs[j]]);
+		}
+		config.AddImage(i);
+	}
+
+	//the Ceres defaults with a Huber loss
+	BundleAdjustmentOptions ba_options;
+	ba_options.loss_function_type = BundleAdjustmentOptions::LossFunctionType::HUBER;
+	ba_options.loss_function_scale = 30.0;
+	ba_options.print_summary = false;
+	ba_options.solver_options = ceres::Solver::Options();
+	ba_options.solver_options.minimizer_progress_to_stdout = true;
+	ba_options.solver_options.num_threads = GetEffectiveNumThreads(num_threads);
+	ba_options.solver_options.num_linear_solver_threads = GetEffectiveNumThreads(num_threads);
+	ba_options.use_mixed_precision_solver = mixed_precision;
+	//PBA brings the cameras and points close to the optimum without the
+	//motions, the joint Ceres adjustment then refines all of them
+	if(use_pba)
+	{
+		ParallelBundleAdjuster::Options pba_options;
+		pba_options.print_summary = false;
+		pba_options.gpu_index = pba_gpu_index;
+		pba_options.num_threads = num_threads;
+		ParallelTwoBodyBundleAdjuster pba_bundle_adjuster(pba_options, ba_options, config);
+		pba_bundle_adjuster.Solve(&scene);
+	}
+	TwoBodyBundleAdjuster bundle_adjuster(ba_options, TwoBodyBundleAdjuster::Options(), config);
+	bundle_adjuster.Solve(&scene);
 
 	//save the points back
 	for(unsigned int i=0;i<C.size();i++)
 	{
-		double * camera = cams_ + 7*i;
+		const double * camera = scene.images.at(i).camera.data();
 		Eigen::Vector3d aa;
 		aa(0) = camera[0];
 		aa(1) = camera[1];
@@ -7590,7 +8353,7 @@ void perform_BA(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::vector
 	}
 	for(unsigned int i=0;i<motion.size();i++)
 	{
-		double * mot = motions_ + 6 * i;
+		const double * mot = scene.motions[i].data();
 		Eigen::Vector3d aa;
 		aa(0) = mot[0];
 		aa(1) = mot[1];
@@ -7603,26 +8366,12 @@ void perform_BA(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::vector
 		motion[i].o = t;
 	}
 	for(unsigned int i=0;i<P.first.points.size();i++)
-	{
-		double * point = points1_ + 3*i;
-		Eigen::Vector3d pnt;
-		pnt(0) = point[0];
-		pnt(1) = point[1];
-		pnt(2) = point[2];
-		P.first.points[i] = pnt;
-	}
+		P.first.points[i] = scene.points3D.at(i);
 	for(unsigned int i=0;i<P.second.points.size();i++)
-	{
-		double * point = points2_ + 3*i;
-		Eigen::Vector3d pnt;
-		pnt(0) = point[0];
-		pnt(1) = point[1];
-		pnt(2) = point[2];
-		P.second.points[i] = pnt;
-	}
+		P.second.points[i] = scene.points3D.at(num_points1 + i);
 }
 
-void perform_BA_alter(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::vector<trans_s> &motion, int mode, int ref)
+void perform_BA_alter(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::vector<trans_s> &motion, int mode, int ref, int num_threads)
 {
 	//2 cfs will be necessary, one for the normal cams and the other one for the object cams (with parameters of the camera + the motions)
 	
@@ -7680,156 +8429,119 @@ void perform_BA_alter(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::
 	double * motions_ = motions.data();
 	double * points1_ = points1.data();
 	double * points2_ = points2.data();
-	vector<bool> pf1(points1.size());
-	
-	ceres::Problem problem;
-	//problem.AddParameterBlock(cams_, /*cams.size()**/7);
-	//problem.AddParameterBlock(motions_, /*motions.size()**/6);
-	//problem.AddParameterBlock(points1_, /*points1.size()**/3);
-	//problem.AddParameterBlock(points2_, /*points2.size()**/3);
-	//for each observation (camera, feature, point) add a residual block
-	//a cost function is necessary
-	//subtract px, py from the observations
-	//fix the points
-	/*int c1 = 0;
-	int c2 = 0;
-	int c3 = 0;*/
+	//every observation is added to two problems, which are kept over all
+	//iterations: the problem of the take of its image, in which the points are
+	//constant, and the problem of the chunk of its point, in which the cameras
+	//and the motions are constant. The problems of one step of the alternation
+	//have disjoint variables, as the cameras of a take only share the motion of
+	//the take, and are solved concurrently
+	const int num_eff_threads = GetEffectiveNumThreads(num_threads);
+	const size_t num_point_chunks = num_eff_threads;
+	const size_t num_points1 = P.first.points.size();
+	std::vector<std::unique_ptr<ceres::Problem>> take_problems(motion.size());
+	std::vector<int> take_num_images(motion.size(), 0);
+	std::vector<std::unique_ptr<ceres::Problem>> point_problems(num_point_chunks);
+	for(auto& problem : take_problems)
+		problem.reset(new ceres::Problem());
+	for(auto& problem : point_problems)
+		problem.reset(new ceres::Problem());
+
+	const auto AddObservation = [](ceres::Problem* problem, const Eigen::Vector2d& point2D, double* camera, double* point, double* mot)
+	{
+		ceres::LossFunction* loss_function = new ceres::HuberLoss(30.0);
+		if(mot == nullptr)
+			problem->AddResidualBlock(TwoBodyCostFunction::Create(point2D), loss_function, camera, point);
+		else
+			problem->AddResidualBlock(TwoBodyObjectCostFunction::Create(point2D), loss_function, camera, point, mot);
+	};
+	//add the observation to both problems, subtract px, py from the observation
+	const auto AddObservations = [&](ceres::Problem* take_problem, const Eigen::Vector2d& point2D, double* camera, double* point, size_t point_idx, double* mot)
+	{
+		AddObservation(take_problem, point2D, camera, point, mot);
+		take_problem->SetParameterBlockConstant(point);
+		ceres::Problem* point_problem = point_problems[point_idx % num_point_chunks].get();
+		AddObservation(point_problem, point2D, camera, point, mot);
+		point_problem->SetParameterBlockConstant(camera);
+		if(mot != nullptr)
+			point_problem->SetParameterBlockConstant(mot);
+	};
+
 	for(unsigned int i=0;i<C.size();i++)
 	{
-		//background observations (use the simple reprojection error)
-		vector<Eigen::Vector2d> feat = C[i].features;
-		vector<int> obs = C[i].b_obs;
+		ceres::Problem* take_problem = take_problems.at(C[i].take-1).get();
+		take_num_images[C[i].take-1] += 1;
+		const vector<Eigen::Vector2d>& feat = C[i].features;
+		const Eigen::Vector2d pp(C[i].px, C[i].py);
 		double * camera = cams_ + 7*i;
-		//problem2.AddParameterBlock(camera, 7);
-		//problem2.SetParameterBlockConstant(camera);
-		for(unsigned int j=0;j<obs.size();j++)
+
+		//background observations (use the simple reprojection error)
+		const vector<int>& b_obs = C[i].b_obs;
+		for(unsigned int j=0;j<b_obs.size();j++)
 		{
-			if(obs[j] == -1) continue;
-			if(!P.first.ID_map.count(obs[j])) {cout << "NK\n"; continue;}
-			int pos = P.first.ID_map[obs[j]];
-			double * point = points1_ + 3*pos;
-			pf1[pos] = 1;
-			ceres::CostFunction* cost_function = new ceres::AutoDiffCostFunction<CostFunctor, 2, 7, 3>(new CostFunctor(feat[j](0)-C[i].px, feat[j](1)-C[i].py));
-			ceres::LossFunction* loss_function = new ceres::HuberLoss(30.0);
-			//problem.AddParameterBlock(camera,7);
-			//double cerr = test1(camera, point, feat[j](0)-C[i].px, feat[j](1)-C[i].py);
-			//if(cerr < 10000) 
-				problem.AddResidualBlock(cost_function, loss_function, camera, point);
+			if(b_obs[j] == -1) continue;
+			if(!P.first.ID_map.count(b_obs[j])) continue;
+			int pos = P.first.ID_map[b_obs[j]];
+			AddObservations(take_problem, feat[j] - pp, camera, points1_ + 3*pos, pos, nullptr);
 		}
 
 		//object observations (if the take is not reference, use the complex reprojection error)
-		obs = C[i].o_obs;
-		if(C[i].take == ref+1)
+		double * mot = (C[i].take == ref+1) ? nullptr : motions_ + 6 * (C[i].take-1);
+		const vector<int>& o_obs = C[i].o_obs;
+		for(unsigned int j=0;j<o_obs.size();j++)
 		{
-			for(unsigned int j=0;j<obs.size();j++)
-			{
-				if(obs[j] == -1) continue;
-				if(!P.second.ID_map.count(obs[j])) {cout << "NK\n"; continue;}
-				int pos = P.second.ID_map[obs[j]];
-				double * point = points2_ + 3*pos;
-				ceres::CostFunction* cost_function = new ceres::AutoDiffCostFunction<CostFunctor, 2, 7, 3>(new CostFunctor(feat[j](0)-C[i].px, feat[j](1)-C[i].py));
-				ceres::LossFunction* loss_function = new ceres::HuberLoss(30.0);
-				//double cerr = test1(camera, point, feat[j](0)-C[i].px, feat[j](1)-C[i].py);
-				//if(cerr < 10000)
-					problem.AddResidualBlock(cost_function, loss_function, camera, point);
-			}
-		}
-		else
-		{
-			double * mot = motions_ + 6 * (C[i].take-1);
-			for(unsigned int j=0;j<obs.size();j++)
-			{
-				if(obs[j] == -1) continue;
-				if(!P.second.ID_map.count(obs[j])) {cout << "NK\n"; continue;}
-				int pos = P.second.ID_map[obs[j]];
-				double * point = points2_ + 3*pos;
-				ceres::CostFunction* cost_function = new ceres::AutoDiffCostFunction<CostFunctor2, 2, 7, 3, 6>(new CostFunctor2(feat[j](0)-C[i].px, feat[j](1)-C[i].py));
-				ceres::LossFunction* loss_function = new ceres::HuberLoss(30.0);
-				//double cerr = test2(camera, point, mot, feat[j](0)-C[i].px, feat[j](1)-C[i].py);
-				//if(cerr < 10000) 
-					problem.AddResidualBlock(cost_function, loss_function, camera, point, mot);
-			}
+			if(o_obs[j] == -1) continue;
+			if(!P.second.ID_map.count(o_obs[j])) continue;
+			int pos = P.second.ID_map[o_obs[j]];
+			AddObservations(take_problem, feat[j] - pp, camera, points2_ + 3*pos, num_points1 + pos, mot);
 		}
-		
 	}
 
-	for(unsigned int i=0;i<P.first.points.size();i++)
+	//the solver options of the problems of a step, the threads are divided
+	//between the takes, every chunk of points is solved on one thread
+	size_t num_take_problems = 0;
+	for(const auto& problem : take_problems)
+		num_take_problems += (problem->NumResiduals() > 0);
+	const int num_take_threads = std::max(1, num_eff_threads / std::max(1, (int)num_take_problems));
+	std::vector<ceres::Solver::Options> take_options(take_problems.size());
+	for(unsigned int t=0;t<take_problems.size();t++)
 	{
-		double * point = points1_ + 3*i;
-		problem.AddParameterBlock(point, 3);
+		set_schur_solver(take_num_images[t] + 1, num_take_threads, &take_options[t]);
+		take_options[t].max_num_iterations = 1;
 	}
-	for(unsigned int i=0;i<P.second.points.size();i++)
+	std::vector<ceres::Solver::Options> point_options(point_problems.size());
+	for(auto& options : point_options)
 	{
-		double * point = points2_ + 3*i;
-		problem.AddParameterBlock(point, 3);
+		set_schur_solver(1, 1, &options);
+		options.max_num_iterations = 1;
 	}
 
-	ceres::Solver::Options options;
-	options.linear_solver_type = ceres::DENSE_SCHUR;
-	options.minimizer_progress_to_stdout = true;
-	options.max_num_iterations = 1;
-	ceres::Solver::Summary summary;
-
-	for(int k=0;k<20;k++)
+	ThreadPool thread_pool(num_eff_threads);
+	const auto SolveProblems = [&thread_pool](const std::vector<std::unique_ptr<ceres::Problem>>& problems, const std::vector<ceres::Solver::Options>& options)
 	{
-		cout << "iteration " << k << "\n";
-		for(unsigned int i=0;i<C.size();i++)
-		{
-			double * camera = cams_ + 7*i;
-			problem.SetParameterBlockVariable(camera);
-			
-		}
-		for(unsigned int i=0;i<motion.size();i++)
-		{
-			if(i==(unsigned int)ref) continue;
-			double * mot = motions_ + 6*i;
-			problem.SetParameterBlockVariable(mot);
-			
-		}
-		for(unsigned int i=0;i<P.first.points.size();i++)
+		std::vector<std::future<void>> futures;
+		for(size_t p=0;p<problems.size();p++)
 		{
-			double * point = points1_ + 3*i;
-			problem.SetParameterBlockConstant(point);
-		}
-		for(unsigned int i=0;i<P.second.points.size();i++)
-		{
-			double * point = points2_ + 3*i;
-			problem.SetParameterBlockConstant(point);
-		}
-		Solve(options, &problem, &summary);
-		
-		for(unsigned int i=0;i<C.size();i++)
-		{
-			double * camera = cams_ + 7*i;
-			problem.SetParameterBlockConstant(camera);
-			
-		}
-		for(unsigned int i=0;i<motion.size();i++)
-		{
-			if(i==(unsigned int)ref) continue;
-			double * mot = motions_ + 6*i;
-			problem.SetParameterBlockConstant(mot);
-		}
-		for(unsigned int i=0;i<P.first.points.size();i++)
-		{
-			double * point = points1_ + 3*i;
-			problem.SetParameterBlockVariable(point);
-		}
-		for(unsigned int i=0;i<P.second.points.size();i++)
-		{
-			double * point = points2_ + 3*i;
-			problem.SetParameterBlockVariable(point);
+			if(problems[p]->NumResiduals() == 0)
+				continue;
+			futures.push_back(thread_pool.AddTask([&problems, &options, p]()
+			{
+				ceres::Solver::Summary summary;
+				ceres::Solve(options[p], problems[p].get(), &summary);
+			}));
 		}
-		//ceres::CostFunction* cost_function = new ceres::AutoDiffCostFunction<CostFunctor, 1, 1>(new CostFunctor(11,11));
-		//problem.AddResidualBlock(cost_function, NULL, &x);
+		for(auto& future : futures)
+			future.get();
+	};
 
-		//solve the problem (use a sparse solver)
-		
-		Solve(options, &problem, &summary);
+	for(int k=0;k<20;k++)
+	{
+		VLOG(4) << "iteration " << k;
+		//the cameras and the motions of every take with constant points
+		SolveProblems(take_problems, take_options);
+		//the points with constant cameras and motions
+		SolveProblems(point_problems, point_options);
 	}
 
-	cout << "K\n";
-
 	//save the points back
 	for(unsigned int i=0;i<C.size();i++)
 	{
@@ -7848,7 +8560,6 @@ void perform_BA_alter(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::
 		C[i].f = camera[6];
 		
 	}
-	cout << "K\n";
 	for(unsigned int i=0;i<motion.size();i++)
 	{
 		double * mot = motions_ + 6 * i;
@@ -7863,7 +8574,6 @@ void perform_BA_alter(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::
 		t(2) = mot[5];
 		motion[i].o = t;
 	}
-	cout << "K\n";
 	for(unsigned int i=0;i<P.first.points.size();i++)
 	{
 		double * point = points1_ + 3*i;
@@ -7873,7 +8583,6 @@ void perform_BA_alter(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::
 		pnt(2) = point[2];
 		P.first.points[i] = pnt;
 	}
-	cout << "K\n";
 	for(unsigned int i=0;i<P.second.points.size();i++)
 	{
 		double * point = points2_ + 3*i;
@@ -7883,10 +8592,9 @@ void perform_BA_alter(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::
 		pnt(2) = point[2];
 		P.second.points[i] = pnt;
 	}
-	cout << "F\n";
 }
 
-std::vector<Eigen::Vector3d> ransac_points(std::vector<Eigen::Vector3d> P, double pd, std::vector<int> tk)
+std::vector<Eigen::Vector3d> ransac_points(const std::vector<Eigen::Vector3d>& P, double pd, const std::vector<int>& tk)
 {
 	//TODO
 	//utilize multi body RANSAC (however it seems the single body will be enough here, the difference is negligible)
@@ -7920,9 +8628,9 @@ std::vector<Eigen::Vector3d> ransac_points(std::vector<Eigen::Vector3d> P, doubl
 	return ret;
 }
 
-void new_points(std::vector<std::vector<std::pair<int, int>>> T, std::vector<pnts_s> P, std::vector<int> D, std::vector<std::pair<trans_s,trans_s>> M, int r, double pd)
+void new_points(const std::vector<std::vector<std::pair<int, int>>>& T, const std::vector<pnts_s>& P, const std::vector<int>& D, const std::vector<std::pair<trans_s,trans_s>>& M, int r, double pd)
 {
-	cout << "UNKNOWN " << D.size() << "\n";
+	VLOG(3) << "UNKNOWN " << D.size();
 	int count = 0;
 	for(unsigned int i=0;i<D.size();i++)
 	{
@@ -7936,7 +8644,7 @@ void new_points(std::vector<std::vector<std::pair<int, int>>> T, std::vector<pnt
 			for(unsigned int j=0;j<T[D[i]].size();j++)
 			{
 				std::pair<int, int> pos = T[D[i]][j];
-				Eigen::Vector3d OP = P[pos.first-1].points[P[pos.first-1].ID_map[pos.second]];
+				Eigen::Vector3d OP = P[pos.first-1].points[P[pos.first-1].ID_map.at(pos.second)];
 				Eigen::Vector3d NPB;
 				Eigen::Vector3d NPF;
 				trans_s M1 = M[pos.first-1].first;
@@ -7966,10 +8674,10 @@ void new_points(std::vector<std::vector<std::pair<int, int>>> T, std::vector<pnt
 			if(NF.size()) count++;
 		}
 	}
-	cout << "UNKNOWN " << count << "\n";
+	VLOG(3) << "UNKNOWN " << count;
 }
 
-std::vector<std::vector<std::pair<int, int>>> load_2tracks(std::vector<img_s> &C, std::pair<pnts_s, pnts_s> &R, std::vector<trans_s> motion)
+std::vector<std::vector<std::pair<int, int>>> load_2tracks(std::vector<img_s> &C, std::pair<pnts_s, pnts_s> &R, const std::vector<trans_s>& motion)
 {
 	vector<vector<pair<int, int>>> ret;
 	vector<vector<pair<int, int>>> tracks;
@@ -8053,7 +8761,7 @@ std::vector<std::vector<std::pair<int, int>>> load_2tracks(std::vector<img_s> &C
 			cnt++;
 		}
 	}
-	cout << "TRACKS " << cnt << "\n";
+	VLOG(3) << "TRACKS " << cnt;
 	tf.close();
 	cnt = 0;
 
@@ -8298,7 +9006,7 @@ std::vector<std::vector<std::pair<int, int>>> load_2tracks(std::vector<img_s> &C
 				R.first.ID.push_back(max);
 				R.first.ID_map[max] = R.first.color.size();
 				
-				Eigen::Vector3i color;
+				Eigen::Vector3ub color;
 				color(0) = 255;
 				color(1) = 0;
 				color(2) = 0;
@@ -8317,7 +9025,7 @@ std::vector<std::vector<std::pair<int, int>>> load_2tracks(std::vector<img_s> &C
 				R.second.ID.push_back(max);
 				R.second.ID_map[max] = R.first.color.size();
 				
-				Eigen::Vector3i color;
+				Eigen::Vector3ub color;
 				color(0) = 0;
 				color(1) = 255;
 				color(2) = 0;
@@ -8335,7 +9043,7 @@ std::vector<std::vector<std::pair<int, int>>> load_2tracks(std::vector<img_s> &C
 		}
 		//cout << "\n";
 	}
-	cout << "TRACKS " << cnt << "\n";
+	VLOG(3) << "TRACKS " << cnt;
 	return ret;
 }
 
@@ -8452,265 +9160,201 @@ std::pair<std::vector<int>, std::vector<int>> split_tracks2(std::vector<img_s> &
 
 }
 
-std::pair<std::vector<int>, std::vector<int>> filter_points2(std::pair<std::vector<int>, std::vector<int>> D2, std::pair<std::vector<int>, std::vector<int>> D, std::vector<img_s> &C, std::vector<pnts_s> P, int k, std::vector<std::vector<std::pair<int, int>>> T)
+namespace
 {
-	cout << "Filtering points\n";
-	//find the points from the background and the foreground
-	vector<vector<Eigen::Vector3d>> b_pnts(P.size());
-	vector<vector<Eigen::Vector3d>> o_pnts(P.size());
-	for(unsigned int i=0;i<D.first.size();i++)
-	{
-		vector<pair<int, int>> track = T[D.first[i]];
-		for(unsigned int j=0;j<track.size();j++)
-		{
-			pair<int, int> e = track[j];
-			Eigen::Vector3d OP = P[e.first-1].points[P[e.first-1].ID_map[e.second]];
-			b_pnts[e.first-1].push_back(OP);
-		}
-	}
-	for(unsigned int i=0;i<D.second.size();i++)
+	//add the points of newly labelled tracks of one take and update the distances to the nearest neighbours,
+	//which are searched in a KD-tree over all points of the take instead of comparing every new point to all points
+	void add_body_points(body_pnts_s* B, int t, const std::vector<Eigen::Vector3d>& added)
 	{
-		vector<pair<int, int>> track = T[D.second[i]];
-		for(unsigned int j=0;j<track.size();j++)
-		{
-			pair<int, int> e = track[j];
-			Eigen::Vector3d OP = P[e.first-1].points[P[e.first-1].ID_map[e.second]];
-			o_pnts[e.first-1].push_back(OP);
-		}
+		if(added.empty())
+			return;
+		vector<Eigen::Vector3d>& points = B->points[t];
+		points.insert(points.end(), added.begin(), added.end());
+		B->nearest[t] = PointIndex(points).NearestNeighborDistances();
 	}
 
-	//find the typical distance between the points
-	vector<double> d_b(P.size());
-	vector<double> d_o(P.size());
-	for(unsigned int i=0;i<P.size();i++)
-	{
-		//cout << i << "\n";
-		d_b[i] = 0;
-		for(unsigned int j=0;j<b_pnts[i].size();j++)
-		{
-			Eigen::Vector3d pnt1 = b_pnts[i][j];
-			double dist = INFINITY;
-			for(unsigned int k=0;k<b_pnts[i].size();k++)
-			{
-				if(j==k) continue;
-				Eigen::Vector3d pnt2 = b_pnts[i][k];
-				double cur_dist = (pnt1-pnt2).norm();
-				if(cur_dist < dist)
-					dist = cur_dist;
-			}
-			d_b[i] = d_b[i] + dist;
-		}
-		if(b_pnts[i].size())
-			d_b[i] = d_b[i] / (double)(b_pnts[i].size());
-	}
-	for(unsigned int i=0;i<P.size();i++)
+	//the tracks with at least k close points of a body, where for every element of a track the k nearest points
+	//of the body in its take count as close if their distance is at most 10 times the typical distance of the take,
+	//the elements are searched in one batch per take
+	std::vector<int> filter_body_tracks(const std::vector<int>& tracks, const body_pnts_s& B, const std::vector<double>& d, const std::vector<pnts_s>& P, int k, const std::vector<std::vector<std::pair<int, int>>>& T, int num_threads)
 	{
-		//cout << i << "\n";
-		d_o[i] = 0;
-		for(unsigned int j=0;j<o_pnts[i].size();j++)
+		vector<vector<Eigen::Vector3d>> queries(P.size());
+		vector<vector<int>> query_tracks(P.size());
+		for(unsigned int i=0;i<tracks.size();i++)
 		{
-			Eigen::Vector3d pnt1 = o_pnts[i][j];
-			double dist = INFINITY;
-			for(unsigned int k=0;k<o_pnts[i].size();k++)
+			for(const pair<int, int>& e : T[tracks[i]])
 			{
-				if(j==k) continue;
-				Eigen::Vector3d pnt2 = o_pnts[i][k];
-				double cur_dist = (pnt1-pnt2).norm();
-				if(cur_dist < dist)
-					dist = cur_dist;
+				queries[e.first-1].push_back(P[e.first-1].points[P[e.first-1].ID_map.at(e.second)]);
+				query_tracks[e.first-1].push_back(i);
 			}
-			d_o[i] = d_o[i] + dist;
 		}
-		if(b_pnts[i].size())
-			d_o[i] = d_o[i] / (double)(o_pnts[i].size());
-	}
 
-	//for each newly classified point find the k nearest points from the same object
-	std::vector<int> b_ret;
-	for(unsigned int i=0;i<D2.first.size();i++)
-	{
-		vector<pair<int, int>> track = T[D2.first[i]];
-		vector<double> values;
-		for(unsigned int j=0;j<track.size();j++)
+		vector<int> cnt(tracks.size(), 0);
+		vector<vector<int>> indices;
+		vector<vector<double>> distances;
+		for(unsigned int t=0;t<P.size();t++)
 		{
-			pair<int, int> e = track[j];
-			Eigen::Vector3d OP = P[e.first-1].points[P[e.first-1].ID_map[e.second]];
-
-			vector<int> ids;
-			for(int a=0;a<k;a++)
+			if(queries[t].empty())
+				continue;
+			PointIndex(B.points[t]).KnnSearch(queries[t], k, &indices, &distances, num_threads);
+			for(size_t q=0;q<queries[t].size();q++)
 			{
-				double dist = INFINITY;
-				int best = -1;
-				for(unsigned int b=0;b<b_pnts[e.first-1].size();b++)
+				for(double dist : distances[q])
 				{
-					Eigen::Vector3d P = b_pnts[e.first-1][b];
-					double c_dist = (OP - P).norm();
-					if(c_dist < dist)
-					{
-						bool ok = 1;
-						for(unsigned int c=0;c<ids.size();c++)
-						{
-							if(ids[c] == (int)b)
-							{
-								ok = 0;
-								break;
-							}
-						}
-						if(ok)
-						{
-							dist = c_dist;
-							best = b;
-						}
-					}
+					if(dist / d[t] <= 10)
+						cnt[query_tracks[t][q]]++;
 				}
-				ids.push_back(best);
-				values.push_back(dist / d_b[e.first-1]);
 			}
 		}
-		int cnt = 0;
-		for(unsigned int j=0;j<values.size();j++)
+
+		vector<int> ret;
+		for(unsigned int i=0;i<tracks.size();i++)
 		{
-			if(values[j] <= 10) cnt++;
-			//cout << values[j] << " ";
+			if(cnt[i] >= k)
+				ret.push_back(tracks[i]);
 		}
-		if(cnt >= k)
-			b_ret.push_back(D2.first[i]);
-		//cout << "\n";
+		return ret;
 	}
 
-	//for each newly classified point find the k nearest points from the same object
-	std::vector<int> o_ret;
-	for(unsigned int i=0;i<D2.second.size();i++)
+	//the typical distance between the points of a body in a take, i.e. the mean distance to the nearest neighbour
+	double mean_nearest(const body_pnts_s& B, int t)
 	{
-		vector<pair<int, int>> track = T[D2.second[i]];
-		vector<double> values;
-		for(unsigned int j=0;j<track.size();j++)
-		{
-			pair<int, int> e = track[j];
-			Eigen::Vector3d OP = P[e.first-1].points[P[e.first-1].ID_map[e.second]];
+		const vector<double>& nearest = B.nearest[t];
+		if(!nearest.size())
+			return 0;
+		double sum = 0;
+		for(double dist : nearest)
+			sum += dist;
+		return sum / (double)(nearest.size());
+	}
+}
 
-			vector<int> ids;
-			for(int a=0;a<k;a++)
-			{
-				double dist = INFINITY;
-				int best = -1;
-				for(unsigned int b=0;b<o_pnts[e.first-1].size();b++)
-				{
-					Eigen::Vector3d P = o_pnts[e.first-1][b];
-					double c_dist = (OP - P).norm();
-					if(c_dist < dist)
-					{
-						bool ok = 1;
-						for(unsigned int c=0;c<ids.size();c++)
-						{
-							if((unsigned  int)ids[c] == b)
-							{
-								ok = 0;
-								break;
-							}
-						}
-						if(ok)
-						{
-							dist = c_dist;
-							best = (int)b;
-						}
-					}
-				}
-				ids.push_back(best);
-				values.push_back(dist / d_o[e.first-1]);
-			}
-		}
-		int cnt = 0;
-		for(unsigned int j=0;j<values.size();j++)
+point_rounds_s init_point_rounds(const std::pair<std::vector<int>, std::vector<int>>& D, const std::vector<std::vector<std::pair<int, int>>>& T, const std::vector<pnts_s>& P, const std::vector<std::unordered_map<int, int>>& P2T)
+{
+	TRACE_SCOPE("init_point_rounds");
+	point_rounds_s S;
+	S.label.assign(T.size(), 0);
+	S.point_tracks.resize(P.size());
+	for(unsigned int t=0;t<P.size();t++)
+	{
+		S.point_tracks[t].assign(P[t].points.size(), -1);
+		for(const auto& pt : P2T[t])
+			S.point_tracks[t][pt.first] = pt.second;
+	}
+	S.background.points.resize(P.size());
+	S.background.nearest.resize(P.size());
+	S.object.points.resize(P.size());
+	S.object.nearest.resize(P.size());
+	update_point_rounds(&S, D, T, P);
+	return S;
+}
+
+void update_point_rounds(point_rounds_s* S, const std::pair<std::vector<int>, std::vector<int>>& D, const std::vector<std::vector<std::pair<int, int>>>& T, const std::vector<pnts_s>& P)
+{
+	for(int body=0;body<2;body++)
+	{
+		const vector<int>& tracks = body ? D.second : D.first;
+		vector<vector<Eigen::Vector3d>> added(P.size());
+		for(unsigned int i=0;i<tracks.size();i++)
 		{
-			if(values[j] <= 10) cnt++;
-			//cout << values[j] << " ";
+			S->label[tracks[i]] = body+1;
+			for(const pair<int, int>& e : T[tracks[i]])
+				added[e.first-1].push_back(P[e.first-1].points[P[e.first-1].ID_map.at(e.second)]);
 		}
-		if(cnt >= k)
-			o_ret.push_back(D2.second[i]);
-		//cout << "\n";
+		for(unsigned int t=0;t<P.size();t++)
+			add_body_points(body ? &S->object : &S->background, t, added[t]);
+	}
+}
+
+std::pair<std::vector<int>, std::vector<int>> filter_points2(const std::pair<std::vector<int>, std::vector<int>>& D2, const point_rounds_s& S, std::vector<img_s> &C, const std::vector<pnts_s>& P, int k, const std::vector<std::vector<std::pair<int, int>>>& T, int num_threads)
+{
+	TRACE_SCOPE("filter_points2");
+	cout << "Filtering points\n";
+	//find the typical distance between the points
+	vector<double> d_b(P.size());
+	vector<double> d_o(P.size());
+	for(unsigned int i=0;i<P.size();i++)
+	{
+		d_b[i] = mean_nearest(S.background, i);
+		d_o[i] = mean_nearest(S.object, i);
 	}
+
+	//for each newly classified point find the k nearest points from the same object
 	std::pair<std::vector<int>, std::vector<int>> ret;
-	ret.first = b_ret;
-	ret.second = o_ret;
+	ret.first = filter_body_tracks(D2.first, S.background, d_b, P, k, T, num_threads);
+	ret.second = filter_body_tracks(D2.second, S.object, d_o, P, k, T, num_threads);
 
-	cout << "F\n";
 
 	//add the observations of the newly separated tracks to the lists of the observations
-	unordered_set<int> is_bg;
-	unordered_set<int> is_fg;
+	//the tracks are labelled in a dense array, 1 for the background and 2 for the object
+	vector<char> is_new(T.size(), 0);
 	for(unsigned int i=0;i<ret.first.size();i++)
 	{
-		is_bg.insert(ret.first[i]);
+		is_new[ret.first[i]] = 1;
 	}
 	for(unsigned int i=0;i<ret.second.size();i++)
 	{
-		is_fg.insert(ret.second[i]);
+		if(!is_new[ret.second[i]])
+			is_new[ret.second[i]] = 2;
 	}
 
 	for(unsigned int i=0;i<C.size();i++)
 	{
 		for(unsigned int j=0;j<C[i].u_obs.size();j++)
 		{
-			if(is_bg.count(C[i].u_obs[j]))
+			int u = C[i].u_obs[j];
+			if(u < 0 || (unsigned int)u >= is_new.size()) continue;
+			if(is_new[u] == 1)
 			{
-				C[i].b_obs[j] = C[i].u_obs[j];
+				C[i].b_obs[j] = u;
 			}
-			else if(is_fg.count(C[i].u_obs[j]))
+			else if(is_new[u] == 2)
 			{
-				C[i].o_obs[j] = C[i].u_obs[j];
+				C[i].o_obs[j] = u;
 			}
 		}
 	}
 
-	cout << "K\n";
-	
+
 	return ret;
 }
 
-void add_points2(std::pair<std::vector<int>, std::vector<int>> D, std::vector<std::vector<std::pair<int, int>>> T, std::vector<pnts_s> P, std::pair<pnts_s, pnts_s> &R, std::vector<std::pair<trans_s,trans_s>> M, int ref)
+void add_points2(const std::pair<std::vector<int>, std::vector<int>>& D, const std::vector<std::vector<std::pair<int, int>>>& T, const std::vector<pnts_s>& P, std::pair<pnts_s, pnts_s> &R, const std::vector<std::pair<trans_s,trans_s>>& M, int ref)
 {
-	vector<int> b_obs = D.first;
-	vector<int> f_obs = D.second;
-	
+	TRACE_SCOPE("add_points2");
+	const vector<int>& b_obs = D.first;
+	const vector<int>& f_obs = D.second;
+
 	//find the points of the background and the foreground
 	//2 strategies -> nearest from one take, nearest among all takes
-	
+
 	//iterate through the new observations
 	for(unsigned int i=0;i<b_obs.size();i++)
 	{
 		//find the track
-		vector<pair<int, int>> track = T[b_obs[i]];
+		const vector<pair<int, int>>& track = T[b_obs[i]];
 
 		//transform the points in the track
 		vector<Eigen::Vector3d> npnt;
-		vector<Eigen::Vector3i> ncol;
-		//bool near = 0;
-		//std::vector
+		vector<Eigen::Vector3ub> ncol;
 		for(unsigned int j=0;j<track.size();j++)
 		{
 			pair<int, int> e = track[j];
-			Eigen::Vector3d OP = P[e.first-1].points[P[e.first-1].ID_map[e.second]];
-			Eigen::Vector3i NC = P[e.first-1].color[P[e.first-1].ID_map[e.second]];
-			//cout << OP.transpose() << " ";
-			trans_s mot = M[e.first-1].first;
+			const int pos = P[e.first-1].ID_map.at(e.second);
+			const Eigen::Vector3d& OP = P[e.first-1].points[pos];
+			const Eigen::Vector3ub& NC = P[e.first-1].color[pos];
+			const trans_s& mot = M[e.first-1].first;
 			Eigen::Vector3d NP = mot.s * mot.R * OP + mot.o;
 			if(ref == (e.first-1))
 				NP = OP;
-			//cout << NP.transpose() << " " << mot.s << " " << e.first << "\n";
 			npnt.push_back(NP);
 			ncol.push_back(NC);
-
-			//check whether a point exists which is near enough to the 
-			//and remember the found points, so we can enforce the minimum count of the found points
-			
 		}
 
 		//find the median point
 		Eigen::Vector3d pnt = median(npnt);
-		//cout << "P " << pnt.transpose() << "\n";
-		Eigen::Vector3i col = median(ncol);
-		
+		Eigen::Vector3ub col = median(ncol);
+
 		//add the point to the reconstruction (together with everything)
 		R.first.ID.push_back(b_obs[i]);
 		R.first.points.push_back(pnt);
@@ -8722,28 +9366,28 @@ void add_points2(std::pair<std::vector<int>, std::vector<int>> D, std::vector<st
 	for(unsigned int i=0;i<f_obs.size();i++)
 	{
 		//find the track
-		vector<pair<int, int>> track = T[f_obs[i]];
+		const vector<pair<int, int>>& track = T[f_obs[i]];
 
 		//transform the points in the track
 		vector<Eigen::Vector3d> npnt;
-		vector<Eigen::Vector3i> ncol;
+		vector<Eigen::Vector3ub> ncol;
 		for(unsigned int j=0;j<track.size();j++)
 		{
 			pair<int, int> e = track[j];
-			Eigen::Vector3d OP = P[e.first-1].points[P[e.first-1].ID_map[e.second]];
-			trans_s mot = M[e.first-1].second;
+			const int pos = P[e.first-1].ID_map.at(e.second);
+			const Eigen::Vector3d& OP = P[e.first-1].points[pos];
+			const trans_s& mot = M[e.first-1].second;
 			Eigen::Vector3d NP = mot.s * mot.R * OP + mot.o;
 			if(ref == (e.first-1))
 				NP = OP;
 			npnt.push_back(NP);
-			Eigen::Vector3i NC = P[e.first-1].color[P[e.first-1].ID_map[e.second]];
-			ncol.push_back(NC);
+			ncol.push_back(P[e.first-1].color[pos]);
 		}
 
 		//find the median point
 		Eigen::Vector3d pnt = median(npnt);
-		Eigen::Vector3i col = median(ncol);
-		
+		Eigen::Vector3ub col = median(ncol);
+
 		//add the point to the reconstruction (together with everything)
 		R.second.ID.push_back(f_obs[i]);
 		R.second.points.push_back(pnt);
@@ -8752,22 +9396,12 @@ void add_points2(std::pair<std::vector<int>, std::vector<int>> D, std::vector<st
 	}
 }
 
-std::pair<std::vector<int>, std::vector<int>> split_tracks3(std::pair<std::vector<int>, std::vector<int>> D, int k, int ts, std::vector<pnts_s> P, std::vector<std::unordered_map<int, int>> P2T)
+std::pair<std::vector<int>, std::vector<int>> split_tracks3(const point_rounds_s& S, int k, const std::vector<pnts_s>& P)
 {
+	TRACE_SCOPE("split_tracks3");
+	const int ts = S.label.size();
 	vector<int> score(ts);
 	for(int i=0;i<ts;i++) score[i] = 0;
-	vector<int> f_cam;
-	vector<vector<int>> O;
-	unordered_set<int> b_ids;
-	unordered_set<int> f_ids;
-	for(unsigned int i=0;i<D.first.size();i++)
-	{
-		b_ids.insert(D.first[i]);
-	}
-	for(unsigned int i=0;i<D.second.size();i++)
-	{
-		f_ids.insert(D.second[i]);
-	}
 	for(unsigned int t=0;t<P.size();t++)
 	{
 		vector<Eigen::Vector3d> train;
@@ -8776,14 +9410,15 @@ std::pair<std::vector<int>, std::vector<int>> split_tracks3(std::pair<std::vecto
 		vector<bool> label;
 		for(unsigned int i=0;i<P[t].points.size();i++)
 		{
-
-			//sort the points between B, F, U
-			if(b_ids.count(P2T[t][i]))
+			//sort the points between B, F, U, the points outside of the tracks are skipped
+			int track = S.point_tracks[t][i];
+			if(track < 0) continue;
+			if(S.label[track] == 1)
 			{
 				train.push_back(P[t].points[i]);
 				label.push_back(0);
 			}
-			else if(f_ids.count(P2T[t][i]))
+			else if(S.label[track] == 2)
 			{
 				train.push_back(P[t].points[i]);
 				label.push_back(1);
@@ -8791,7 +9426,7 @@ std::pair<std::vector<int>, std::vector<int>> split_tracks3(std::pair<std::vecto
 			else
 			{
 				test.push_back(P[t].points[i]);
-				test_id.push_back(P2T[t][ i ]);
+				test_id.push_back(track);
 			}
 		}
 
@@ -8847,18 +9482,15 @@ std::pair<std::vector<int>, std::vector<int>> split_tracks3(std::pair<std::vecto
 			}
 		}
 	}
-	
+
 	std::pair<std::vector<int>, std::vector<int>> Q;
 	for(int i=0;i<ts;i++)
 	{
 		if(score[i] > 0) Q.first.push_back(i);
 		else if(score[i] < 0) Q.second.push_back(i);
 	}
-	 
-	std::pair<std::vector<int>, std::vector<int>> ret = Q;
-	
-	return ret;
 
+	return Q;
 }
 
 }  // namespace colmap
@@ -17,12 +17,26 @@
 #ifndef COLMAP_SRC_SFM_INCREMENTAL_MAPPER_H_
 #define COLMAP_SRC_SFM_INCREMENTAL_MAPPER_H_
 
+#include "base/camera_rig.h"
 #include "base/database.h"
 #include "base/database_cache.h"
 #include "base/reconstruction.h"
+#include "base/take_bundle.h"
+#include "estimators/pose.h"
 #include "optim/bundle_adjustment.h"
 #include "sfm/incremental_triangulator.h"
+#include "sfm/init_pair_cache.h"
+#include "sfm/track_splitter.h"
 #include "util/alignment.h"
+#include "util/cache.h"
+#include "util/csr_array.h"
+#include "util/id_bitmap.h"
+#include "util/id_index.h"
+#include "util/memory_governor.h"
+#include "util/scratch.h"
+#include "util/threading.h"
+#include <functional>
+#include <set>
 #include <utility>
 #include <unordered_map>
 #include "estimators/absolute_pose.h"
@@ -68,6 +82,13 @@ class IncrementalMapper {
     // Maximum number of trials to use an image for initialization.
     int init_max_reg_trials = 2;
 
+    // Number of candidate initial image pairs whose two-view geometry is
+    // estimated concurrently by `FindInitFirstSet`. The first candidate in
+    // the serial order that passes the initialization thresholds is chosen and
+    // the candidates after it are cancelled, so the chosen pair is the same as
+    // with a single candidate, up to the random sampling of RANSAC.
+    int init_num_parallel_pairs = 1;
+
     // Maximum reprojection error in absolute pose estimation.
     double abs_pose_max_error = 12.0;
 
@@ -77,6 +98,14 @@ class IncrementalMapper {
     // Minimum inlier ratio in absolute pose estimation.
     double abs_pose_min_inlier_ratio = 0.25;
 
+    // Whether to reject bad hypotheses early with the sequential probability
+    // ratio test in absolute pose estimation.
+    bool abs_pose_use_sprt = false;
+
+    // Whether to estimate the unknown focal lengths with the pose in a single
+    // RANSAC instead of one RANSAC per focal length sample.
+    bool abs_pose_joint_focal_length = false;
+
     // Whether to estimate the focal length in absolute pose estimation.
     bool abs_pose_refine_focal_length = true;
 
@@ -86,6 +115,11 @@ class IncrementalMapper {
     // Number of images to optimize in local bundle adjustment.
     int local_ba_num_images = 6;
 
+    // Whether to keep the problem of every local bundle adjustment until
+    // `ResetLocalBundleAdjusters`, e.g. between the iterations of a local
+    // refinement, and only update the residuals of the changed observations.
+    bool local_ba_reuse_problem = false;
+
     // Thresholds for bogus camera parameters. Images with bogus camera
     // parameters are filtered and ignored in triangulation.
     double min_focal_length_ratio = 0.1;  // Opening angle of ~130deg
@@ -98,12 +132,42 @@ class IncrementalMapper {
     // Minimum triangulation angle in degrees for stable 3D points.
     double filter_min_tri_angle = 1.5;
 
+    // Minimum change of a 3D point or of an image in a global bundle
+    // adjustment, for which `FilterChangedPoints` filters the point or the
+    // points of the image again. Positions are compared relative to the
+    // spread of the projection centers, rotations in radians and camera
+    // parameters relative to their magnitude. With 0, all points are filtered.
+    double filter_min_change = 1e-4;
+
     // Maximum number of trials to register an image.
     int max_reg_trials = 3;
 
     // Number of threads.
     int num_threads = -1;
 
+    // Number of threads that draw and score the hypotheses of a single RANSAC
+    // estimation of an absolute pose or of the initial two-view geometry, see
+    // `RANSACOptions::num_threads`. Mostly pays off at low inlier ratios,
+    // where a single estimation runs many trials.
+    int ransac_num_threads = 1;
+
+    // Whether `SeqRegisterImage` predicts the body poses of an image from its
+    // registered neighbors in the order of the image names, i.e. from their
+    // poses and by constant-velocity extrapolation. The predictions seed a
+    // short RANSAC and the full RANSAC only runs if fewer than two poses are
+    // found in it.
+    bool seq_pose_prediction = false;
+
+    // Maximum number of trials of the short RANSAC that is seeded with the
+    // predicted poses.
+    int seq_pose_prediction_num_trials = 100;
+
+    // Maximum memory in gigabytes of the image points of the unregistered
+    // images that are paged in, if the database cache spilled the image points
+    // to an out-of-core store. The least recently used images are released
+    // first, the registered images always keep their points.
+    double out_of_core_cache_size = 1.0;
+
     // Method to find and select next best image to register.
     enum class ImageSelectionMethod {
       MAX_VISIBLE_POINTS_NUM,
@@ -125,7 +189,12 @@ class IncrementalMapper {
 
   // Create incremental mapper. The database cache must live for the entire
   // life-time of the incremental mapper.
-  explicit IncrementalMapper(/*const*/ DatabaseCache* database_cache);
+  explicit IncrementalMapper(const DatabaseCache* database_cache);
+
+  // Reuse and record the two-view geometries of the candidate initial image
+  // pairs in the given cache, which must outlive the mapper. The cache can be
+  // shared by several mappers, e.g. of all takes and initialization rounds.
+  void SetInitialPairCache(InitialPairCache* init_pair_cache);
 
   // Prepare the mapper for a new reconstruction, which might have existing
   // registered images (in which case `RegisterNextImage` must be called) or
@@ -150,9 +219,9 @@ class IncrementalMapper {
   // ignores images that failed to registered for `max_reg_trials`.
   std::vector<image_t> FindNextImages(const Options& options);
 
-  std::vector<image_t> FindNextImagesFirstSet(const Options& options, std::unordered_set<image_t> first_set);
+  std::vector<image_t> FindNextImagesFirstSet(const Options& options, const std::unordered_set<image_t>& first_set);
 
-  std::vector<image_t> FindNextImagesSecondSet(const Options& options, std::unordered_set<image_t> first_set);
+  std::vector<image_t> FindNextImagesSecondSet(const Options& options, const std::unordered_set<image_t>& first_set);
 
   // Attempt to seed the reconstruction from an image pair.
   bool RegisterInitialImagePair(const Options& options, const image_t image_id1,
@@ -162,8 +231,27 @@ class IncrementalMapper {
   // a previous call to `RegisterInitialImagePair` was successful.
   bool RegisterNextImage(const Options& options, const image_t image_id);
 
+  // Find the tentative poses of the object and the background in an image of
+  // the second set. Returns the number of found poses.
   int SeqRegisterImage(const Options& options, const image_t image_id);
 
+  // Sequentially register multiple images at once. The poses of the images
+  // are estimated in parallel and committed in the given order. Returns the
+  // number of found poses for each image.
+  std::vector<int> SeqRegisterImages(const Options& options,
+                                     const std::vector<image_t>& image_ids);
+
+  // Find the tentative poses of the object and the background for a frame of
+  // a camera rig, i.e. for images of the second set that were captured at the
+  // same time by different cameras of the rig, in one generalized absolute
+  // pose estimation. The poses of the images follow from the poses of the rig
+  // and the relative poses of its cameras, which are kept fixed. Returns the
+  // number of found poses, which is 0 without registering any image if one of
+  // the cameras is not calibrated yet, in which case the images can still be
+  // registered one by one.
+  int SeqRegisterRigFrame(const Options& options, const CameraRig& camera_rig,
+                          const std::vector<image_t>& image_ids);
+
   int SeqRegisterImage2(const Options& options, const image_t image_id, const camera_t cam);
 
   bool FinishRegistration(const Options& options, const image_t image_id, const std::vector<std::pair<point2D_t, point3D_t>> tri_corrs);
@@ -172,6 +260,11 @@ class IncrementalMapper {
   size_t TriangulateImage(const IncrementalTriangulator::Options& tri_options,
                           const image_t image_id);
 
+  // Triangulate observations of the given images, whose estimations run
+  // concurrently with multiple triangulation threads.
+  size_t TriangulateImages(const IncrementalTriangulator::Options& tri_options,
+                           const std::vector<image_t>& image_ids);
+
   // Retriangulate image pairs that should have common observations according to
   // the scene graph but don't due to drift, etc. To handle drift, the employed
   // reprojection error thresholds should be relatively large. If the thresholds
@@ -200,8 +293,38 @@ class IncrementalMapper {
       const IncrementalTriangulator::Options& tri_options,
       const image_t image_id, const std::unordered_set<point3D_t>& point3D_ids);
 
+  // Adjust the local bundles of several reference images, e.g. the images of
+  // a registration batch. The local bundles that share images, cameras or 3D
+  // points are merged and the resulting independent groups are concurrently
+  // solved on the worker pool, with the solver threads split between them.
+  // With a single image, this is the same as `AdjustLocalBundle`.
+  LocalBundleAdjustmentReport AdjustLocalBundles(
+      const Options& options, const BundleAdjustmentOptions& ba_options,
+      const IncrementalTriangulator::Options& tri_options,
+      const std::vector<image_t>& image_ids,
+      const std::unordered_set<point3D_t>& point3D_ids);
+
+  // Drop the problems kept by the local bundle adjustment.
+  void ResetLocalBundleAdjusters();
+
   // Global bundle adjustment using Ceres Solver or PBA.
   bool AdjustGlobalBundle(const BundleAdjustmentOptions& ba_options);
+
+  // Global bundle adjustment using Ceres Solver, which keeps the problem of
+  // the previous call for the current reconstruction and only inserts and
+  // removes the residuals of the changed observations. Falls back to
+  // `AdjustGlobalBundle` if phantom images have rigid motions, as does
+  // `AdjustParallelGlobalBundle`.
+  bool AdjustIncrementalGlobalBundle(const BundleAdjustmentOptions& ba_options);
+
+  // Drop the problem kept by the incremental global bundle adjustment.
+  void ResetIncrementalGlobalBundle();
+
+  // Global bundle adjustment using Ceres Solver on a spatially uniform subset
+  // of the 3D points, see `FindGlobalBundlePoints`, after which the other 3D
+  // points are independently refined in parallel with the adjusted images.
+  bool AdjustSubsampledGlobalBundle(const BundleAdjustmentOptions& ba_options,
+                                    const int grid_size);
   bool AdjustParallelGlobalBundle(
       const BundleAdjustmentOptions& ba_options,
       const ParallelBundleAdjuster::Options& parallel_ba_options);
@@ -210,6 +333,13 @@ class IncrementalMapper {
   size_t FilterImages(const Options& options);
   size_t FilterPoints(const Options& options);
 
+  // Filter the observations of the 3D points that the last global bundle
+  // adjustment changed by at least `filter_min_change`, directly or through
+  // the images that observe them, and of the modified 3D points. Assumes that
+  // the points were filtered before that bundle adjustment and filters all
+  // points if no global bundle adjustment happened since the last filtering.
+  size_t FilterChangedPoints(const Options& options);
+
   const Reconstruction& GetReconstruction() const;
 
   // Number of images that are registered in at least on reconstruction.
@@ -225,11 +355,104 @@ class IncrementalMapper {
   // Clear the collection of changed 3D points.
   void ClearModifiedPoints3D();
 
-  void InitImage(const image_t image_id, const image_t original, std::vector<image_pair_t> old_pairs, std::vector<image_pair_t> new_pairs);
+  // Add the phantom image of a second pose of `original` to the scene graph.
+  void InitImage(const image_t image_id, const image_t original);
+
+  // Tie the pose of a phantom image to the pose of its original image in
+  // bundle adjustment, through the rigid object motion `motion_idx` that is
+  // shared by all phantom images of the same body and capture instant. Only
+  // the motions are refined instead of independent phantom poses, whenever
+  // both images are adjusted together.
+  void SetRigidMotion(const image_t image_id, const image_t original,
+                      const int motion_idx);
 
-  
+  // Page in the points of an unregistered image, if the database cache spilled
+  // them to its out-of-core store, before they are accessed. The registration
+  // methods page in their images, other callers must do so themselves.
+  void PageInImage(const Options& options, const image_t image_id);
 
  private:
+  // Paged-in points of an unregistered image, which are released when they
+  // are evicted, unless the image was registered in the meantime.
+  class ResidentPoints2D {
+   public:
+    ResidentPoints2D(Image* image, const Camera* camera);
+    ResidentPoints2D(ResidentPoints2D&& other);
+    ~ResidentPoints2D();
+
+    size_t NumBytes() const;
+
+   private:
+    Image* image_;
+    const Camera* camera_;
+    size_t num_bytes_;
+  };
+
+  // Candidate of the sequential registration with its 2D-3D correspondences
+  // and the found poses. The estimation refines a copy of the camera, which is
+  // only written back to the reconstruction when the poses are committed.
+  struct SeqRegistration {
+    image_t image_id = kInvalidImageId;
+    Camera camera;
+    AbsolutePoseEstimationOptions abs_pose_options;
+    AbsolutePoseRefinementOptions abs_pose_refinement_options;
+    ScratchVector<std::pair<point2D_t, point3D_t>> tri_corrs;
+    ScratchVector<Eigen::Vector2d> tri_points2D;
+    ScratchVector<Eigen::Vector3d> tri_points3D;
+    std::vector<Eigen::Vector4d> qvecs;
+    std::vector<Eigen::Vector3d> tvecs;
+    std::vector<size_t> num_inliers;
+    std::vector<std::vector<std::pair<point2D_t, point3D_t>>> inlier_corrs;
+  };
+
+  // Update the cached ranks of the images for next image selection. Only the
+  // images whose visible 3D points changed since the last update are ranked.
+  void UpdateNextImageRanking(const Options& options);
+
+  // Return the unregistered images that pass the filter in the order of their
+  // rank, where images that failed to register before are placed last.
+  std::vector<image_t> RankNextImages(
+      const Options& options, const std::function<bool(const Image&)>& filter);
+
+  // Result of the last 2D-3D correspondence search of an image.
+  struct CorrespondenceCache {
+    // Per image point, the value of `Image::CorrespondencePoint3DVersion` at
+    // the time of the search and the distinct 3D points that were found.
+    std::vector<uint32_t> versions;
+    std::vector<std::vector<point3D_t>> point3D_ids;
+    // Whether the cameras of the corresponding images had bogus parameters.
+    std::unordered_map<camera_t, bool> bogus_cameras;
+  };
+
+  // Search the 2D-3D correspondences of an image through the scene graph.
+  // Only the image points whose correspondences gained or lost a 3D point
+  // since the last search of the same image are searched again.
+  void FindCorrespondences2D3D(
+      const Options& options, const image_t image_id,
+      std::vector<std::pair<point2D_t, point3D_t>>* tri_corrs,
+      std::vector<Eigen::Vector2d>* tri_points2D,
+      std::vector<Eigen::Vector3d>* tri_points3D);
+
+  // Order the 2D-3D correspondences by decreasing quality for progressive
+  // sampling, i.e. by decreasing track length of the 3D points and then by
+  // increasing mean reprojection error of the 3D points.
+  void SortCorrespondences2D3D(
+      std::vector<std::pair<point2D_t, point3D_t>>* tri_corrs,
+      std::vector<Eigen::Vector2d>* tri_points2D,
+      std::vector<Eigen::Vector3d>* tri_points3D) const;
+
+  // Predict the body poses of an image as projection matrices from the pose
+  // hypotheses of its neighbors in the order of the image names.
+  std::vector<Eigen::Matrix3x4d> PredictSeqPoses(const image_t image_id);
+
+  // Steps of `SeqRegisterImage`. Only `EstimateSeqPoses` may run concurrently
+  // for different images.
+  bool PrepareSeqRegistration(const Options& options, const image_t image_id,
+                              SeqRegistration* registration);
+  void EstimateSeqPoses(const Options& options,
+                        SeqRegistration* registration) const;
+  int CommitSeqRegistration(SeqRegistration* registration);
+
   // Find seed images for incremental reconstruction. Suitable seed images have
   // a large number of correspondences and have camera calibration priors. The
   // returned list is ordered such that most suitable images are in the front.
@@ -248,6 +471,48 @@ class IncrementalMapper {
   std::vector<image_t> FindLocalBundle(const Options& options,
                                        const image_t image_id) const;
 
+  // Find a spatially uniform subset of well-conditioned 3D points. The image
+  // points of every registered image are binned into a regular grid with the
+  // given number of cells per dimension and in every cell, the 3D point with
+  // the longest track and then the smallest error is selected.
+  std::unordered_set<point3D_t> FindGlobalBundlePoints(
+      const int grid_size) const;
+
+  // Add the local bundle of an image to the configuration, with its images,
+  // its gauge and the short-track 3D points among the given ones, which are
+  // also added to `variable_point3D_ids`.
+  void SetUpLocalBundle(const image_t image_id,
+                        const std::vector<image_t>& local_bundle,
+                        const std::unordered_set<point3D_t>& point3D_ids,
+                        BundleAdjustmentConfig* ba_config,
+                        std::unordered_set<point3D_t>* variable_point3D_ids)
+      const;
+
+  // Add the rigid motions of the phantom images to the configuration, for
+  // which the original image is configured as well and the phantom image is
+  // not part of the gauge.
+  void SetUpRigidMotions(BundleAdjustmentConfig* ba_config) const;
+
+  // Record the parameters before a global bundle adjustment and compute their
+  // changes after it, before the scene is normalized.
+  void RecordGlobalBundleParameters();
+  void ComputeGlobalBundleChanges();
+
+  // Get the persistent local bundle adjuster of a reference image, or null if
+  // the problems are not kept. Not thread-safe.
+  IncrementalBundleAdjuster* LocalBundleAdjuster(const Options& options,
+                                                 const image_t image_id);
+
+  // Solve the local bundle adjustment with the given persistent adjuster or,
+  // if null, from scratch, and return the number of adjusted observations.
+  size_t SolveLocalBundle(const BundleAdjustmentOptions& ba_options,
+                          const BundleAdjustmentConfig& ba_config,
+                          IncrementalBundleAdjuster* bundle_adjuster);
+
+  // Record the images and 3D points refined by a local bundle adjustment as
+  // changed in the reconstruction, see `Reconstruction::TakeChanges`.
+  void RecordLocalBundleChanges(const BundleAdjustmentConfig& ba_config);
+
   // Register / De-register image in current reconstruction and update
   // the number of shared images between all reconstructions.
   void RegisterImageEvent(const image_t image_id);
@@ -257,18 +522,89 @@ class IncrementalMapper {
                                       const image_t image_id1,
                                       const image_t image_id2);
 
+  // Estimate the two-view geometry of a candidate initial image pair and
+  // return whether it passes the initialization thresholds. It only reads the
+  // database cache, so that several candidates can be estimated concurrently.
+  bool EstimateInitialTwoViewGeometry(const Options& options,
+                                      const image_t image_id1,
+                                      const image_t image_id2,
+                                      TwoViewGeometry* two_view_geometry) const;
+
+  // Estimate the two-view geometries of the candidate initial image pairs in
+  // the given order, concurrently on the worker pool if there are several,
+  // and return the index of the first candidate that passes or the number of
+  // candidates if none passes. The candidates after a passing one are
+  // cancelled, and only the candidates up to it are marked as tried.
+  size_t EstimateInitialTwoViewGeometries(
+      const Options& options,
+      const std::vector<std::pair<image_t, image_t>>& image_pairs);
+
+  // The worker pool of the mapper with the given number of threads, which is
+  // started on first use and kept across calls, so that the pose estimation
+  // of every registration does not start its own threads.
+  ThreadPool* WorkerPool(const int num_threads);
+
+  // The triangulation options, whose parallel triangulation runs on the
+  // worker pool of the mapper.
+  IncrementalTriangulator::Options TriangulatorOptions(
+      const IncrementalTriangulator::Options& tri_options);
+
   // Class that holds all necessary data from database in memory.
-  /*const*/ DatabaseCache* database_cache_;
+  const DatabaseCache* database_cache_;
 
   // Class that holds data of the reconstruction.
   Reconstruction* reconstruction_;
 
-  // the scene graph
-  SceneGraph * sg;
+  // Overlay on the scene graph of the database cache, which holds the phantom
+  // images of the current reconstruction. The database cache itself stays
+  // read-only, so that it can be shared by the mappers of all takes.
+  std::unique_ptr<SceneGraph> scene_graph_;
 
   // Class that is responsible for incremental triangulation.
   std::unique_ptr<IncrementalTriangulator> triangulator_;
 
+  // Worker pool of the pose estimation, the parallel registration and the
+  // parallel triangulation.
+  std::unique_ptr<ThreadPool> thread_pool_;
+
+  // Persistent problem of the incremental global bundle adjustment of the
+  // current reconstruction.
+  std::unique_ptr<IncrementalBundleAdjuster> global_bundle_adjuster_;
+
+  // The parameters before the last global bundle adjustment and, once it
+  // finished, their changes, from which `FilterChangedPoints` selects the 3D
+  // points to filter. The changes are relative, see `filter_min_change`.
+  struct GlobalBundleChanges {
+    // Whether the changes are complete and not yet used for filtering.
+    bool valid = false;
+    std::vector<image_t> image_ids;
+    std::vector<Eigen::Vector4d> qvecs;
+    std::vector<Eigen::Vector3d> proj_centers;
+    std::unordered_map<camera_t, std::vector<double>> camera_params;
+    std::vector<point3D_t> point3D_ids;
+    std::vector<Eigen::Vector3d> xyzs;
+    std::vector<size_t> track_lengths;
+    std::unordered_map<image_t, double> image_changes;
+    std::vector<double> point_changes;
+  };
+  GlobalBundleChanges global_bundle_changes_;
+
+  // Persistent problems of the local bundle adjustment, by the reference
+  // image of the local bundle or the first one of a merged group.
+  std::unordered_map<image_t, std::unique_ptr<IncrementalBundleAdjuster>>
+      local_bundle_adjusters_;
+
+  // The original image and the rigid motion of every phantom image, whose
+  // pose is tied to the original in bundle adjustment.
+  std::unordered_map<image_t, std::pair<image_t, int>> rigid_motions_;
+
+  // Unregistered images of the current reconstruction whose points are paged
+  // in from the out-of-core store of the database cache. The cache is shrunk
+  // by the memory governor when the process exceeds its memory budget.
+  std::unique_ptr<MemoryConsumer> resident_images_memory_consumer_;
+  std::unique_ptr<MemoryConstrainedLRUCache<image_t, ResidentPoints2D>>
+      resident_images_;
+
   // Number of images that are registered in at least on reconstruction.
   size_t num_total_reg_images_;
 
@@ -281,6 +617,9 @@ class IncrementalMapper {
   image_pair_t prev_init_image_pair_id_;
   TwoViewGeometry prev_init_two_view_geometry_;
 
+  // Optional cache of the two-view geometries of candidate initial pairs.
+  InitialPairCache* init_pair_cache_;
+
   // Images and image pairs that have been used for initialization. Each image
   // and image pair is only tried once for initialization.
   std::unordered_map<image_t, size_t> init_num_reg_trials_;
@@ -300,6 +639,23 @@ class IncrementalMapper {
   // Number of trials to register image in current reconstruction. Used to set
   // an upper bound to the number of trials to register an image.
   std::unordered_map<image_t, size_t> num_reg_trials_;
+
+  // Cached 2D-3D correspondence searches of the unregistered images, which
+  // avoid repeating the full search when registration is retried.
+  std::unordered_map<image_t, CorrespondenceCache> correspondence_caches_;
+
+  // The images of the reconstruction ordered by name, i.e. in the capture
+  // order of a take, and the position of each image in this order. Built on
+  // first use for the pose prediction of the sequential registration.
+  std::vector<image_t> image_ids_by_name_;
+  std::unordered_map<image_t, size_t> image_name_idxs_;
+
+  // Ranks of the images for next image selection, both per image and ordered
+  // by decreasing rank, for the selection method they were computed with.
+  Options::ImageSelectionMethod next_image_selection_method_;
+  std::unordered_map<image_t, float> next_image_ranks_;
+  std::set<std::pair<float, image_t>, std::greater<std::pair<float, image_t>>>
+      next_image_ranking_;
 };
 
 typedef struct
@@ -393,23 +749,34 @@ typedef struct
 	double s;
 } trans_s;
 
+//the images of a take, the features and their observed points (or -1) of all images
+//are stored back to back in one array each, the rows are in the order of the ids
 typedef struct
 {
 	std::vector<int> id;
-	std::vector<std::vector<int>> obs;
-	std::unordered_map<int,int> map;
-	std::vector<std::vector<Eigen::Vector2d>> features;
-	std::vector<std::vector<int>> obs_all;
+	IdIndexMap map;
+	CsrArray<Eigen::Vector2d> features;
+	CsrArray<int> obs_all;
 } imgs_s;
 
 typedef struct
 {
 	std::vector<int> ID;
-	std::unordered_map<int, int> ID_map;
+	IdIndexMap ID_map;
 	std::vector<Eigen::Vector3d> points;
-	std::vector<Eigen::Vector3i> color;
+	std::vector<Eigen::Vector3ub> color;
 } pnts_s;
 
+//tracks of 3D points across takes, the consistent ones and the connected
+//components, which contain more points of a take, with their observation graphs
+//as edge lists, which hold every edge in both directions
+typedef struct
+{
+	std::vector<std::vector<std::pair<int, int>>> tracks;
+	std::vector<std::vector<std::pair<int, int>>> graph_nodes;
+	std::vector<std::vector<graph_edge_s>> graphs;
+} tracks_s;
+
 typedef struct
 {
 	int cl1;
@@ -446,6 +813,34 @@ typedef struct
 	int strength;
 } point_id;
 
+//the points of the labelled tracks of one body in every take
+//with the distance of every point to its nearest neighbour among them
+typedef struct
+{
+	std::vector<std::vector<Eigen::Vector3d>> points;
+	std::vector<std::vector<double>> nearest;
+} body_pnts_s;
+
+//state of the rounds which add the remaining points to the merged reconstruction
+typedef struct
+{
+	//label of every track, 0 if unlabelled, 1 for the background and 2 for the object
+	std::vector<char> label;
+	//the track of every point of every take, or -1
+	std::vector<std::vector<int>> point_tracks;
+	body_pnts_s background;
+	body_pnts_s object;
+} point_rounds_s;
+
+//tracks observed by every camera
+typedef struct
+{
+	//the sorted tracks of the observed points, empty for the anchor cameras
+	std::vector<std::vector<int>> tracks;
+	//the track of every feature, or -1, with the feature coordinates
+	std::vector<std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>> features;
+} observed_s;
+
 typedef struct
 {
 	point_id id;
@@ -454,107 +849,158 @@ typedef struct
 } node_s;
 
 
-std::vector<basis_t> find_bases(std::vector<cam_s> C);
+//the parallel stages run on at most max_num_threads threads, all cores for -1
+std::vector<basis_t> find_bases(const std::vector<cam_s>& C, int max_num_threads = -1);
 
 std::vector<cam_s> load_cams();
 
-int count_takes(std::vector<cam_s> C);
+int count_takes(const std::vector<cam_s>& C);
+
+std::vector<std::vector<std::vector<basis_t>>> divide_bases(const std::vector<basis_t>& B, const std::vector<cam_s>& C, double sigma, int max_num_threads = -1);
+
+//the median rotation and the least squares translations of every cluster of
+//bases, with geometric_rotations the rotation is the geometric median
+std::vector<std::vector<clust_b>> meanclust(const std::vector<std::vector<std::vector<basis_t>>>& C, const std::vector<cam_s>& cams, bool geometric_rotations = false, int max_num_threads = -1);
+
+std::vector<cycle_3> find3cycles(const std::vector<std::vector<clust_b>>& M, int max_num_threads = -1);
+
+//only the consistent cycles, which are scored while they are enumerated, with
+//the translation consistency of every one in bzs
+std::vector<cycle_3> find3cycles(const std::vector<std::vector<clust_b>>& M, double thr, const std::vector<cam_s>& cams, const std::vector<std::vector<std::vector<basis_t>>>& CL, std::vector<double> * bzs, int max_num_threads = -1);
 
-std::vector<std::vector<std::vector<basis_t>>> divide_bases(std::vector<basis_t> B, std::vector<cam_s> C, double sigma);
+//connected components of the cycles which share a cluster, numbered from 1
+std::vector<int> cluster_cycles(const std::vector<cycle_3>& C);
 
-std::vector<std::vector<clust_b>> meanclust(std::vector<std::vector<std::vector<basis_t>>> C, std::vector<cam_s> cams);
+//the components of the consistent cycles of C, -1 for the others
+std::vector<int> cluster_cycles(const std::vector<cycle_3>& C, double thr, const std::vector<cam_s>& cams, const std::vector<std::vector<std::vector<basis_t>>>& CL, std::vector<double> * bzs);
 
-std::vector<cycle_3> find3cycles(std::vector<std::vector<clust_b>> M);
+//the spanning tree of motion clusters between the takes of the best component of the cycles, which are evaluated in parallel
+std::pair<std::pair<Eigen::MatrixXi, Eigen::MatrixXi>, Eigen::MatrixXd> select_bases(const std::vector<std::vector<clust_b>>& M, const std::vector<cycle_3>& CY, const std::vector<int>& CL2, int takes, const std::vector<double>& bzs, double thr1, double thr2, int max_num_threads = -1);
 
-std::vector<int> cluster_cycles(std::vector<cycle_3> C, double thr, std::vector<cam_s> cams, std::vector<std::vector<std::vector<basis_t>>> CL, std::vector<double> * bzs);
+int find_reference(const Eigen::MatrixXd& st, int takes);
 
-std::pair<std::pair<Eigen::MatrixXi, Eigen::MatrixXi>, Eigen::MatrixXd> select_bases(std::vector<std::vector<clust_b>> M, std::vector<cycle_3> CY, std::vector<int> CL2, int takes, std::vector<double> bzs, double thr1, double thr2);
+std::vector<std::vector<trans_s>> find_transformations(const std::pair<Eigen::MatrixXi, Eigen::MatrixXi>& st, int reference, const std::vector<std::vector<clust_b>>& M, int takes);
 
-int find_reference(Eigen::MatrixXd st, int takes);
+std::vector<motion_t> find_motion(const std::vector<cam_s>& C);
 
-std::vector<std::vector<trans_s>> find_transformations(std::pair<Eigen::MatrixXi, Eigen::MatrixXi> st, int reference, std::vector<std::vector<clust_b>> M, int takes	);
+std::vector<motion_t> transform_motion(const std::vector<motion_t>& C, const std::vector<std::vector<trans_s>>& transform);
 
-std::vector<motion_t> find_motion(std::vector<cam_s> C);
+//symmetric distances of all pairs of motion rotations and translations. D
+//is reused if it already has the right size, the float version halves the
+//memory of the matrix
+void distance3d(const std::vector<motion_t>& C, Eigen::MatrixXd* D, int max_num_threads = -1);
+void distance3d(const std::vector<motion_t>& C, Eigen::MatrixXf* D, int max_num_threads = -1);
+void distance3d_trans(const std::vector<motion_t>& C, Eigen::MatrixXd* D, int max_num_threads = -1);
+void distance3d_trans(const std::vector<motion_t>& C, Eigen::MatrixXf* D, int max_num_threads = -1);
 
-std::vector<motion_t> transform_motion(std::vector<motion_t> C, std::vector<std::vector<trans_s>> transform);
+//normalized laplacian of the graph whose edge weights are the inverse distances
+Eigen::MatrixXd dist2laplace(const Eigen::MatrixXd& D, int size);
 
-std::vector<motion_t> remove_id(std::vector<motion_t>, double pd, double thr1, double thr2);
+std::vector<motion_t> remove_id(const std::vector<motion_t>& C, double pd, double thr1, double thr2, int max_num_threads = -1);
 
-double princ_dist(std::vector<cam_s> C, int take);
+double princ_dist(const std::vector<cam_s>& C, int take);
 
-std::vector<cam_s> change_basis_cams(std::vector<cam_s> C, std::vector<std::vector<trans_s>> T);
+std::vector<cam_s> change_basis_cams(const std::vector<cam_s>& C, const std::vector<std::vector<trans_s>>& T);
 
-std::vector<std::vector<std::vector<motion_t>>> divide_motions(std::vector<motion_t> B, std::vector<cam_s> C, double sigma, double pd, double thr2);
+std::vector<std::vector<std::vector<motion_t>>> divide_motions(const std::vector<motion_t>& B, const std::vector<cam_s>& C, double sigma, double pd, double thr2, int max_num_threads = -1);
 
-std::vector<std::vector<clust_m>> meanclust_motions(std::vector<std::vector<std::vector<motion_t>>> C);
+std::vector<std::vector<clust_m>> meanclust_motions(const std::vector<std::vector<std::vector<motion_t>>>& C, bool geometric_rotations = false, int max_num_threads = -1);
 
-std::pair<std::vector<std::vector<std::vector<motion_t>>>, std::vector<std::vector<clust_m>>> remove_identity(std::vector<std::vector<clust_m>> C, std::vector<std::vector<std::vector<motion_t>>> CL , double pd, double thr1, double thr2);
+std::pair<std::vector<std::vector<std::vector<motion_t>>>, std::vector<std::vector<clust_m>>> remove_identity(const std::vector<std::vector<clust_m>>& C, const std::vector<std::vector<std::vector<motion_t>>>& CL, double pd, double thr1, double thr2);
+
+//load the reconstruction of a take from its binary bundle or from the text files
+TakeBundle load_take(int take);
+
+std::vector<TakeBundle> load_takes(int takes);
+
+//the in-memory variants take the reconstructions of all takes ordered by take
+std::vector<cam_s> load_cams(const std::vector<TakeBundle>& B);
 
 std::vector<imgs_s> load_imgs(int takes);
+std::vector<imgs_s> load_imgs(const std::vector<TakeBundle>& B);
 
 std::vector<pnts_s> load_pnts(int takes);
+std::vector<pnts_s> load_pnts(const std::vector<TakeBundle>& B);
 
-std::pair<std::vector<std::vector<std::pair<int, int>>>, std::vector<std::unordered_map<int, int>>> load_tracks(std::vector<pnts_s> P, int takes);
+std::pair<std::vector<std::vector<std::pair<int, int>>>, std::vector<std::unordered_map<int, int>>> load_tracks(const std::vector<pnts_s>& P, int takes, int max_num_threads = -1);
+std::pair<std::vector<std::vector<std::pair<int, int>>>, std::vector<std::unordered_map<int, int>>> load_tracks(const std::vector<pnts_s>& P, int takes, const tracks_s& TR, int max_num_threads = -1);
 
-std::vector<std::vector<int>> observed_tracks(std::vector<cam_s> C, std::vector<imgs_s> I, std::vector<pnts_s> P, std::vector<std::unordered_map<int, int>> P2T);
+//find tracks of 3D points across the takes, step1 writes them to tracks.txt and graph.bin
+tracks_s find_tracks(const std::vector<TakeBundle>& B);
 
-std::vector<std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>> observed_tracks_2(std::vector<cam_s> C, std::vector<imgs_s> I, std::vector<pnts_s> P, std::vector<std::unordered_map<int, int>> P2T);
+//tracks observed by every camera, walking the observations of each camera once
+observed_s observed_tracks(const std::vector<cam_s>& C, const std::vector<imgs_s>& I, const std::vector<pnts_s>& P, const std::vector<std::unordered_map<int, int>>& P2T, int max_num_threads = -1);
 
-std::vector<std::vector<pair_t>> group_ot(std::vector<std::vector<int>> O, std::vector<cam_s> C, int takes);
+std::vector<std::vector<pair_t>> group_ot(const std::vector<std::vector<int>>& O, const std::vector<cam_s>& C, int takes);
 
 //std::vector<std::vector<pair_t>> filter_groups(std::vector<std::vector<pair_t>> G, std::vector<std::vector<std::pair<int, int>>> T);
-std::vector<std::vector<pair_t>> filter_groups(std::vector<std::vector<pair_t>> G, std::vector<std::vector<std::pair<int, int>>> T, std::vector<pnts_s> P);
-
-int intersect_size(std::vector<int> O1, std::vector<int> O2);
+std::vector<std::vector<pair_t>> filter_groups(const std::vector<std::vector<pair_t>>& G, const std::vector<std::vector<std::pair<int, int>>>& T, const std::vector<pnts_s>& P);
 
-std::vector<std::vector<pair_t>> linkage(std::vector<std::vector<pair_t>> G);
+//joins the pairs of cameras of every group agglomeratively, the groups are processed in parallel
+std::vector<std::vector<pair_t>> linkage(const std::vector<std::vector<pair_t>>& G, int max_num_threads = -1);
 
-std::vector<std::vector<std::pair<std::vector<int>, std::vector<int>>>> observed_by_cluster(std::vector<std::vector<std::vector<motion_t>>> CL, std::vector<std::vector<int>> O);
+std::vector<std::vector<std::pair<IdBitmap, IdBitmap>>> observed_by_cluster(const std::vector<std::vector<std::vector<motion_t>>>& CL, const std::vector<std::vector<int>>& O);
 
-std::vector<std::vector<std::pair<int, int>>> chordal_completion( std::vector<std::vector<clust_m>> CL, std::vector<std::vector<std::pair<std::vector<int>, std::vector<int>>>> O, double thr1, double thr2, double pd );
+std::vector<std::vector<std::pair<int, int>>> chordal_completion( const std::vector<std::vector<clust_m>>& CL, const std::vector<std::vector<std::pair<IdBitmap, IdBitmap>>>& O, double thr1, double thr2, double pd, int max_num_threads = -1 );
 
-int select_group(std::vector<std::vector<std::pair<int, int>>> CLCL, std::vector<std::vector<clust_m>> CL);
+int select_group(const std::vector<std::vector<std::pair<int, int>>>& CLCL, const std::vector<std::vector<clust_m>>& CL);
 
-int select_group_o(std::vector<std::vector<std::pair<int, int>>> CLCL, std::vector<std::vector<std::pair<std::vector<int>, std::vector<int>>>> O);
+int select_group_o(const std::vector<std::vector<std::pair<int, int>>>& CLCL, const std::vector<std::vector<std::pair<IdBitmap, IdBitmap>>>& O);
 
-std::pair<std::vector<int>, std::vector<int>> group_cams(std::vector<std::pair<int, int>> CL, std::vector<std::vector<std::vector<motion_t>>> MM);
+std::pair<std::vector<int>, std::vector<int>> group_cams(const std::vector<std::pair<int, int>>& CL, const std::vector<std::vector<std::vector<motion_t>>>& MM);
 
-std::pair<std::pair<std::vector<int>, std::vector<int>>, std::vector<int>> split_tracks(std::pair<std::vector<int>, std::vector<int>> Q, std::vector<std::vector<int>> O, int size);
+std::pair<std::pair<std::vector<int>, std::vector<int>>, std::vector<int>> split_tracks(const std::pair<std::vector<int>, std::vector<int>>& Q, const std::vector<std::vector<int>>& O, int size);
 
-std::vector<int> order_fold(std::vector<std::vector<std::pair<int, int>>> T, std::pair<std::vector<int>, std::vector<int>> OT, int takes);
+std::vector<int> order_fold(const std::vector<std::vector<std::pair<int, int>>>& T, const std::pair<std::vector<int>, std::vector<int>>& OT, int takes);
 
-std::pair<std::pair<pnts_s, pnts_s>, std::vector<std::pair<trans_s,trans_s>>> merge_reconstructions(std::vector<pnts_s> P, std::vector<std::vector<std::pair<int, int>>> T, std::pair<std::vector<int>, std::vector<int>> D, std::vector<int> order);
+//merges the takes into the reference take at the front of the order, one take
+//after the other in the order, or with tree, by the levels of the maximum
+//spanning tree of the take overlaps, whose takes are aligned in parallel
+std::pair<std::pair<pnts_s, pnts_s>, std::vector<std::pair<trans_s,trans_s>>> merge_reconstructions(const std::vector<pnts_s>& P, const std::vector<std::vector<std::pair<int, int>>>& T, const std::pair<std::vector<int>, std::vector<int>>& D, const std::vector<int>& order, bool tree = false, int max_num_threads = -1);
 //std::pair< std::pair<std::vector<Eigen::Vector3d>, std::vector<Eigen::Vector3i>> , std::vector<std::pair<trans_s,trans_s>> > merge_reconstructions(std::vector<pnts_s> P, std::vector<std::vector<std::pair<int, int>>> T, std::pair<std::vector<int>, std::vector<int>> D, std::vector<int> order);
 
-void save_model_ply(std::pair<pnts_s, pnts_s> M, int mode);
+void save_model_ply(const std::pair<pnts_s, pnts_s>& M, int mode);
 
-std::pair<std::vector<img_s>, std::vector<trans_s>> merge_cameras(std::vector<cam_s> C, std::vector<std::pair<trans_s,trans_s>> motions, int ref, std::vector<std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>> O, std::pair<std::vector<int>, std::vector<int>> Q, std::pair<std::vector<int>, std::vector<int>> D);
+std::pair<std::vector<img_s>, std::vector<trans_s>> merge_cameras(const std::vector<cam_s>& C, const std::vector<std::pair<trans_s,trans_s>>& motions, int ref, const std::vector<std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>>& O, const std::pair<std::vector<int>, std::vector<int>>& Q, const std::pair<std::vector<int>, std::vector<int>>& D, int max_num_threads = -1);
 
-void save_points(std::pair<pnts_s, pnts_s> P);
+void save_points(const std::pair<pnts_s, pnts_s>& P);
 
-void save_model(std::pair<pnts_s, pnts_s> P, std::vector<img_s> C, std::vector<trans_s> motion, int mode, int ref);
+void save_model(const std::pair<pnts_s, pnts_s>& P, const std::vector<img_s>& C, const std::vector<trans_s>& motion, int mode, int ref);
 
-void perform_BA(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::vector<trans_s> &motion, int mode, int ref);
+//write the models of the given modes in one pass to the existing folders
+//path/model<mode>, in the colmap text or binary format
+void save_models(const std::pair<pnts_s, pnts_s>& P, const std::vector<img_s>& C, const std::vector<trans_s>& motion, const std::vector<int>& modes, int ref, bool binary, const std::string& path = ".", int max_num_threads = -1);
 
-void perform_BA_alter(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::vector<trans_s> &motion, int mode, int ref);
+void perform_BA(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::vector<trans_s> &motion, int mode, int ref, int num_threads = -1, bool use_pba = false, int pba_gpu_index = -1, bool mixed_precision = false);
+
+void perform_BA_alter(std::pair<pnts_s, pnts_s> &P, std::vector<img_s> &C, std::vector<trans_s> &motion, int mode, int ref, int num_threads = -1);
 
 void step1();
+void step1(const std::vector<TakeBundle>& B);
 
-void check(std::vector<imgs_s> I, std::vector<pnts_s> P, std::vector<cam_s> C, std::pair<std::vector<std::vector<std::pair<int, int>>>, std::vector<std::unordered_map<int, int>>> T, std::vector<std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>> O);
+void check(const std::vector<imgs_s>& I, const std::vector<pnts_s>& P, const std::vector<cam_s>& C, const std::pair<std::vector<std::vector<std::pair<int, int>>>, std::vector<std::unordered_map<int, int>>>& T, const std::vector<std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>>& O);
 
-void new_points(std::vector<std::vector<std::pair<int, int>>> T, std::vector<pnts_s> P, std::vector<int> D, std::vector<std::pair<trans_s,trans_s>> M, int r, double pd);
+void new_points(const std::vector<std::vector<std::pair<int, int>>>& T, const std::vector<pnts_s>& P, const std::vector<int>& D, const std::vector<std::pair<trans_s,trans_s>>& M, int r, double pd);
 
 std::pair<std::vector<int>, std::vector<int>> split_tracks2(std::vector<img_s> &C, int k, int ts);
 
-void add_points2(std::pair<std::vector<int>, std::vector<int>> D, std::vector<std::vector<std::pair<int, int>>> T, std::vector<pnts_s> P, std::pair<pnts_s, pnts_s> &R, std::vector<std::pair<trans_s,trans_s>> M, int ref);
+void add_points2(const std::pair<std::vector<int>, std::vector<int>>& D, const std::vector<std::vector<std::pair<int, int>>>& T, const std::vector<pnts_s>& P, std::pair<pnts_s, pnts_s> &R, const std::vector<std::pair<trans_s,trans_s>>& M, int ref);
+
+std::vector<std::vector<std::pair<int, int>>> load_2tracks(std::vector<img_s> &C, std::pair<pnts_s, pnts_s> &R, const std::vector<trans_s>& motion);
+
+//state of the rounds which add the remaining points, it is updated with the tracks
+//labelled in every round instead of being rebuilt from all labelled tracks
+point_rounds_s init_point_rounds(const std::pair<std::vector<int>, std::vector<int>>& D, const std::vector<std::vector<std::pair<int, int>>>& T, const std::vector<pnts_s>& P, const std::vector<std::unordered_map<int, int>>& P2T);
 
-std::vector<std::vector<std::pair<int, int>>> load_2tracks(std::vector<img_s> &C, std::pair<pnts_s, pnts_s> &R, std::vector<trans_s> motion);
+void update_point_rounds(point_rounds_s* S, const std::pair<std::vector<int>, std::vector<int>>& D, const std::vector<std::vector<std::pair<int, int>>>& T, const std::vector<pnts_s>& P);
 
-std::pair<std::vector<int>, std::vector<int>> filter_points2(std::pair<std::vector<int>, std::vector<int>> D2, std::pair<std::vector<int>, std::vector<int>> D, std::vector<img_s> &C, std::vector<pnts_s> P, int k, std::vector<std::vector<std::pair<int, int>>> T);
+//the newly labelled tracks whose points are close to the points of their body, the k nearest
+//points of every track element are searched in a KD-tree, with the given number of threads
+std::pair<std::vector<int>, std::vector<int>> filter_points2(const std::pair<std::vector<int>, std::vector<int>>& D2, const point_rounds_s& S, std::vector<img_s> &C, const std::vector<pnts_s>& P, int k, const std::vector<std::vector<std::pair<int, int>>>& T, int num_threads = 1);
 
-std::pair<std::vector<int>, std::vector<int>> split_tracks3(std::pair<std::vector<int>, std::vector<int>> D, int k, int ts, std::vector<pnts_s> P, std::vector<std::unordered_map<int, int>> P2T);
+std::pair<std::vector<int>, std::vector<int>> split_tracks3(const point_rounds_s& S, int k, const std::vector<pnts_s>& P);
 
-std::vector<std::vector<std::pair<int, int>>> split_cams(std::vector<std::vector<std::pair<std::vector<int>, std::vector<int>>>> O);
+std::vector<std::vector<std::pair<int, int>>> split_cams(const std::vector<std::vector<std::pair<IdBitmap, IdBitmap>>>& O);
 
 }  // namespace colmap
 
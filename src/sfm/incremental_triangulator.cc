@@ -16,11 +16,67 @@
 
 #include "sfm/incremental_triangulator.h"
 
+#include <numeric>
+
 #include "base/projection.h"
 #include "estimators/triangulation.h"
 #include "util/misc.h"
 
 namespace colmap {
+namespace {
+
+// Number of observations or 3D points whose estimations run concurrently
+// before their results are committed.
+const size_t kParallelChunkSize = 1024;
+
+// Minimum number of remaining correspondences to create another 3D point.
+const size_t kMinRecursiveTrackLength = 3;
+
+// Run func(i) for all i < num_elements in blocks on the thread pool and wait
+// for them on the calling thread.
+template <typename Func>
+void ParallelFor(ThreadPool* thread_pool, const size_t num_elements,
+                 const Func& func) {
+  const size_t num_blocks =
+      std::min(num_elements, 4 * thread_pool->NumThreads());
+  std::vector<std::future<void>> futures;
+  futures.reserve(num_blocks);
+  for (size_t i = 0; i < num_blocks; ++i) {
+    const size_t begin = i * num_elements / num_blocks;
+    const size_t end = (i + 1) * num_elements / num_blocks;
+    futures.push_back(thread_pool->AddTask([&func, begin, end]() {
+      for (size_t j = begin; j < end; ++j) {
+        func(j);
+      }
+    }));
+  }
+  for (auto& future : futures) {
+    future.get();
+  }
+}
+
+}  // namespace
+
+// Defined here, after the aligned vector specialization of `CorrData`.
+struct IncrementalTriangulator::PendingTriangulation {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  // The reference observation, which is continued if it is not yet
+  // triangulated, and its correspondences. New points are created from the
+  // correspondences and the reference observation, as in the serial
+  // triangulation.
+  CorrData ref_corr_data;
+  std::vector<CorrData> corrs_data;
+
+  // The 3D points of the correspondences and, last, of the reference
+  // observation, on which the estimation is based.
+  std::vector<point3D_t> point3D_ids;
+
+  // The estimated continuation, as index into the correspondences, and
+  // the estimated new points.
+  size_t continue_idx = std::numeric_limits<size_t>::max();
+  std::vector<Eigen::Vector3d> xyzs;
+  std::vector<Track> tracks;
+};
 
 bool IncrementalTriangulator::Options::Check() const {
   CHECK_OPTION_GE(max_transitivity, 0);
@@ -34,6 +90,7 @@ bool IncrementalTriangulator::Options::Check() const {
   CHECK_OPTION_LE(re_min_ratio, 1);
   CHECK_OPTION_GE(re_max_trials, 0);
   CHECK_OPTION_GT(min_angle, 0);
+  CHECK_OPTION_NE(num_threads, 0);
   return true;
 }
 
@@ -71,6 +128,33 @@ size_t IncrementalTriangulator::TriangulateImage(const Options& options,
   // Container for correspondences from reference observation to other images.
   std::vector<CorrData> corrs_data;
 
+  ThreadPool* thread_pool = WorkerPool(options);
+  if (thread_pool != nullptr) {
+    PendingTriangulations pending;
+    for (point2D_t point2D_idx = 0; point2D_idx < image.NumPoints2D();
+         ++point2D_idx) {
+      Find(options, image_id, point2D_idx,
+           static_cast<size_t>(options.max_transitivity), &corrs_data);
+      if (corrs_data.empty()) {
+        continue;
+      }
+
+      pending.emplace_back();
+      PendingTriangulation& pending_tri = pending.back();
+      pending_tri.ref_corr_data = ref_corr_data;
+      pending_tri.ref_corr_data.point2D_idx = point2D_idx;
+      pending_tri.ref_corr_data.point2D = &image.Point2D(point2D_idx);
+      pending_tri.corrs_data.swap(corrs_data);
+
+      if (pending.size() == kParallelChunkSize) {
+        num_tris += TriangulatePending(options, options, thread_pool, &pending);
+        pending.clear();
+      }
+    }
+    num_tris += TriangulatePending(options, options, thread_pool, &pending);
+    return num_tris;
+  }
+
   // Try to triangulate all image observations.
   for (point2D_t point2D_idx = 0; point2D_idx < image.NumPoints2D();
        ++point2D_idx) {
@@ -100,6 +184,137 @@ size_t IncrementalTriangulator::TriangulateImage(const Options& options,
   return num_tris;
 }
 
+size_t IncrementalTriangulator::TriangulateImages(
+    const Options& options, const std::vector<image_t>& image_ids) {
+  CHECK(options.Check());
+
+  size_t num_tris = 0;
+
+  ThreadPool* thread_pool = WorkerPool(options);
+  if (thread_pool == nullptr) {
+    for (const image_t image_id : image_ids) {
+      num_tris += TriangulateImage(options, image_id);
+    }
+    return num_tris;
+  }
+
+  ClearCaches();
+
+  // Index the observations of all images, which can be correspondences.
+  std::unordered_map<image_t, uint32_t> point2D_offsets;
+  size_t num_points2D = 0;
+  for (const auto& image : reconstruction_->Images()) {
+    point2D_offsets.emplace(image.first, static_cast<uint32_t>(num_points2D));
+    num_points2D += image.second.NumPoints2D();
+  }
+  CHECK_LE(num_points2D, std::numeric_limits<uint32_t>::max());
+
+  // Union-find over the observations, which are joined with their direct
+  // correspondences. The transitive correspondences of `Find` are then in the
+  // same component for any transitivity.
+  std::vector<uint32_t> parents(num_points2D);
+  std::iota(parents.begin(), parents.end(), 0);
+  const auto FindRoot = [&parents](uint32_t idx) {
+    while (parents[idx] != idx) {
+      parents[idx] = parents[parents[idx]];
+      idx = parents[idx];
+    }
+    return idx;
+  };
+
+  for (const auto& image : reconstruction_->Images()) {
+    if (!scene_graph_->ExistsImage(image.first)) {
+      continue;
+    }
+    const uint32_t offset = point2D_offsets.at(image.first);
+    for (point2D_t point2D_idx = 0; point2D_idx < image.second.NumPoints2D();
+         ++point2D_idx) {
+      for (const SceneGraph::Correspondence& corr :
+           scene_graph_->FindCorrespondences(image.first, point2D_idx)) {
+        const auto corr_offset = point2D_offsets.find(corr.image_id);
+        if (corr_offset == point2D_offsets.end()) {
+          continue;
+        }
+        const uint32_t root1 = FindRoot(offset + point2D_idx);
+        const uint32_t root2 = FindRoot(corr_offset->second + corr.point2D_idx);
+        if (root1 != root2) {
+          parents[std::max(root1, root2)] = std::min(root1, root2);
+        }
+      }
+    }
+  }
+
+  // The reference observations in the serial order, where the round of an
+  // observation is the number of earlier observations of its component.
+  struct RefObservation {
+    image_t image_id;
+    point2D_t point2D_idx;
+    uint32_t round;
+  };
+  std::vector<RefObservation> ref_observations;
+  {
+    std::vector<uint32_t> num_component_observations(num_points2D, 0);
+    for (const image_t image_id : image_ids) {
+      const Image& image = reconstruction_->Image(image_id);
+      if (!image.IsRegistered() ||
+          HasCameraBogusParams(options,
+                               reconstruction_->Camera(image.CameraId()))) {
+        continue;
+      }
+      const uint32_t offset = point2D_offsets.at(image_id);
+      for (point2D_t point2D_idx = 0; point2D_idx < image.NumPoints2D();
+           ++point2D_idx) {
+        if (!scene_graph_->HasCorrespondences(image_id, point2D_idx)) {
+          continue;
+        }
+        const uint32_t root = FindRoot(offset + point2D_idx);
+        ref_observations.push_back(
+            {image_id, point2D_idx, num_component_observations[root]++});
+      }
+    }
+  }
+
+  std::stable_sort(ref_observations.begin(), ref_observations.end(),
+                   [](const RefObservation& ref1, const RefObservation& ref2) {
+                     return ref1.round < ref2.round;
+                   });
+
+  // The rounds are estimated in chunks. A chunk never spans two rounds, so
+  // that its estimations are independent of each other.
+  std::vector<CorrData> corrs_data;
+  PendingTriangulations pending;
+  for (size_t i = 0; i < ref_observations.size(); ++i) {
+    const RefObservation& ref_observation = ref_observations[i];
+    Find(options, ref_observation.image_id, ref_observation.point2D_idx,
+         static_cast<size_t>(options.max_transitivity), &corrs_data);
+    if (!corrs_data.empty()) {
+      const Image& image = reconstruction_->Image(ref_observation.image_id);
+      pending.emplace_back();
+      PendingTriangulation& pending_tri = pending.back();
+      pending_tri.ref_corr_data.image_id = ref_observation.image_id;
+      pending_tri.ref_corr_data.point2D_idx = ref_observation.point2D_idx;
+      pending_tri.ref_corr_data.image = &image;
+      pending_tri.ref_corr_data.camera =
+          &reconstruction_->Camera(image.CameraId());
+      pending_tri.ref_corr_data.point2D =
+          &image.Point2D(ref_observation.point2D_idx);
+      pending_tri.ref_corr_data.proj_matrix = image.ProjectionMatrix();
+      pending_tri.corrs_data.swap(corrs_data);
+    }
+
+    const bool end_of_round = i + 1 == ref_observations.size() ||
+                              ref_observations[i + 1].round !=
+                                  ref_observation.round;
+    if (pending.size() == kParallelChunkSize ||
+        (end_of_round && !pending.empty())) {
+      num_tris += TriangulatePending(options, options, thread_pool, &pending);
+      pending.clear();
+    }
+  }
+
+  return num_tris;
+}
+
 size_t IncrementalTriangulator::CompleteImage(const Options& options,
                                               const image_t image_id) {
   CHECK(options.Check());
@@ -221,6 +436,13 @@ size_t IncrementalTriangulator::CompleteTracks(
 
   ClearCaches();
 
+  ThreadPool* thread_pool = WorkerPool(options);
+  if (thread_pool != nullptr) {
+    return CompleteTracksParallel(
+        options, thread_pool,
+        std::vector<point3D_t>(point3D_ids.begin(), point3D_ids.end()));
+  }
+
   for (const point3D_t point3D_id : point3D_ids) {
     num_completed += Complete(options, point3D_id);
   }
@@ -235,7 +457,17 @@ size_t IncrementalTriangulator::CompleteAllTracks(const Options& options) {
 
   ClearCaches();
 
-  for (const point3D_t point3D_id : reconstruction_->Point3DIds()) {
+  const std::unordered_set<point3D_t> point3D_ids =
+      reconstruction_->Point3DIds();
+
+  ThreadPool* thread_pool = WorkerPool(options);
+  if (thread_pool != nullptr) {
+    return CompleteTracksParallel(
+        options, thread_pool,
+        std::vector<point3D_t>(point3D_ids.begin(), point3D_ids.end()));
+  }
+
+  for (const point3D_t point3D_id : point3D_ids) {
     num_completed += Complete(options, point3D_id);
   }
 
@@ -250,6 +482,13 @@ size_t IncrementalTriangulator::MergeTracks(
 
   ClearCaches();
 
+  ThreadPool* thread_pool = WorkerPool(options);
+  if (thread_pool != nullptr) {
+    return MergeTracksParallel(
+        options, thread_pool,
+        std::vector<point3D_t>(point3D_ids.begin(), point3D_ids.end()));
+  }
+
   for (const point3D_t point3D_id : point3D_ids) {
     num_merged += Merge(options, point3D_id);
   }
@@ -264,7 +503,16 @@ size_t IncrementalTriangulator::MergeAllTracks(const Options& options) {
 
   ClearCaches();
 
-  for (const point3D_t point3D_id : reconstruction_->Point3DIds()) {
+  // The other 3D points cannot be merged.
+  const std::vector<point3D_t> point3D_ids =
+      reconstruction_->MergeCandidatePoint3DIds();
+
+  ThreadPool* thread_pool = WorkerPool(options);
+  if (thread_pool != nullptr) {
+    return MergeTracksParallel(options, thread_pool, point3D_ids);
+  }
+
+  for (const point3D_t point3D_id : point3D_ids) {
     num_merged += Merge(options, point3D_id);
   }
 
@@ -281,6 +529,11 @@ size_t IncrementalTriangulator::Retriangulate(const Options& options) {
   Options re_options = options;
   re_options.continue_max_angle_error = options.re_max_angle_error;
 
+  // The parallel retriangulation processes the correspondences of every image
+  // pair in chunks, before the ratio of the next pair is checked.
+  ThreadPool* thread_pool = WorkerPool(options);
+  PendingTriangulations pending;
+
   for (const auto& image_pair : reconstruction_->ImagePairs()) {
     // Only perform retriangulation for under-reconstructed image pairs.
     const double tri_ratio =
@@ -358,6 +611,27 @@ size_t IncrementalTriangulator::Retriangulate(const Options& options) {
       corr_data2.point2D = &point2D2;
       corr_data2.proj_matrix = proj_matrix2;
 
+      if (thread_pool != nullptr) {
+        // Continue the observation without a 3D point or, if both have none,
+        // create a new point from both, as in the serial cases below.
+        pending.emplace_back();
+        PendingTriangulation& pending_tri = pending.back();
+        if (point2D2.HasPoint3D()) {
+          pending_tri.ref_corr_data = corr_data1;
+          pending_tri.corrs_data.push_back(corr_data2);
+        } else {
+          pending_tri.ref_corr_data = corr_data2;
+          pending_tri.corrs_data.push_back(corr_data1);
+        }
+
+        if (pending.size() == kParallelChunkSize) {
+          num_tris +=
+              TriangulatePending(re_options, options, thread_pool, &pending);
+          pending.clear();
+        }
+        continue;
+      }
+
       if (point2D1.HasPoint3D() && !point2D2.HasPoint3D()) {
         const std::vector<CorrData> corrs_data1 = {corr_data1};
         num_tris += Continue(re_options, corr_data2, corrs_data1);
@@ -373,6 +647,11 @@ size_t IncrementalTriangulator::Retriangulate(const Options& options) {
       // Else both points have a 3D point, but we do not want to
       // merge points in retriangulation.
     }
+
+    if (thread_pool != nullptr) {
+      num_tris += TriangulatePending(re_options, options, thread_pool, &pending);
+      pending.clear();
+    }
   }
 
   return num_tris;
@@ -399,6 +678,7 @@ void IncrementalTriangulator::ClearModifiedPoints3D() {
 void IncrementalTriangulator::ClearCaches() {
   camera_has_bogus_params_.clear();
   merge_trials_.clear();
+  merge_checks_.clear();
 }
 
 size_t IncrementalTriangulator::Find(const Options& options,
@@ -406,9 +686,9 @@ size_t IncrementalTriangulator::Find(const Options& options,
                                      const point2D_t point2D_idx,
                                      const size_t transitivity,
                                      std::vector<CorrData>* corrs_data) {
-  const std::vector<SceneGraph::Correspondence>& corrs =
-      scene_graph_->FindTransitiveCorrespondences(image_id, point2D_idx,
-                                                  transitivity);
+  std::vector<SceneGraph::Correspondence>& corrs = found_corrs_;
+  scene_graph_->FindTransitiveCorrespondences(
+      image_id, point2D_idx, transitivity, &transitive_scratch_, &corrs);
   //std::cout << "TRANSITIVITY: " << transitivity << "\n";
   //transitivity je 1, moc nam to neujednodusujou
   //funkce hleda pocet zrekonstruovanych 3D bodu, pres nez je mozne nalepit danou funkci
@@ -460,14 +740,45 @@ size_t IncrementalTriangulator::Create(
     }
   }
 
+  // Estimate triangulation.
+  Eigen::Vector3d xyz;
+  std::vector<char> inlier_mask;
+  if (!EstimateCreate(options, create_corrs_data, &xyz, &inlier_mask)) {
+    return 0;
+  }
+
+  // Add inliers to estimated track.
+  Track track;
+  track.Reserve(create_corrs_data.size());
+  for (size_t i = 0; i < inlier_mask.size(); ++i) {
+    if (inlier_mask[i]) {
+      const CorrData& corr_data = create_corrs_data[i];
+      track.AddElement(corr_data.image_id, corr_data.point2D_idx);
+    }
+  }
+
+  // Add estimated point to reconstruction.
+  const point3D_t point3D_id = reconstruction_->AddPoint3D(xyz, track);
+  modified_point3D_ids_.insert(point3D_id);
+
+  if (create_corrs_data.size() - track.Length() >= kMinRecursiveTrackLength) {
+    return track.Length() + Create(options, create_corrs_data);
+  }
+
+  return track.Length();
+}
+
+bool IncrementalTriangulator::EstimateCreate(
+    const Options& options, const std::vector<CorrData>& create_corrs_data,
+    Eigen::Vector3d* xyz, std::vector<char>* inlier_mask) const {
   if (create_corrs_data.size() < 2) {
     // Need at least two observations for triangulation.
-    return 0;
+    return false;
   } else if (options.ignore_two_view_tracks && create_corrs_data.size() == 2) {
     const CorrData& corr_data1 = create_corrs_data[0];
     if (scene_graph_->IsTwoViewObservation(corr_data1.image_id,
                                            corr_data1.point2D_idx)) {
-      return 0;
+      return false;
     }
   }
 
@@ -503,34 +814,8 @@ size_t IncrementalTriangulator::Create(
     tri_options.ransac_options.min_num_trials = NChooseK(point_data.size(), 2);
   }
 
-  // Estimate triangulation.
-  Eigen::Vector3d xyz;
-  std::vector<char> inlier_mask;
-  if (!EstimateTriangulation(tri_options, point_data, pose_data, &inlier_mask,
-                             &xyz)) {
-    return 0;
-  }
-
-  // Add inliers to estimated track.
-  Track track;
-  track.Reserve(create_corrs_data.size());
-  for (size_t i = 0; i < inlier_mask.size(); ++i) {
-    if (inlier_mask[i]) {
-      const CorrData& corr_data = create_corrs_data[i];
-      track.AddElement(corr_data.image_id, corr_data.point2D_idx);
-    }
-  }
-
-  // Add estimated point to reconstruction.
-  const point3D_t point3D_id = reconstruction_->AddPoint3D(xyz, track);
-  modified_point3D_ids_.insert(point3D_id);
-
-  const size_t kMinRecursiveTrackLength = 3;
-  if (create_corrs_data.size() - track.Length() >= kMinRecursiveTrackLength) {
-    return track.Length() + Create(options, create_corrs_data);
-  }
-
-  return track.Length();
+  return EstimateTriangulation(tri_options, point_data, pose_data, inlier_mask,
+                               xyz);
 }
 
 size_t IncrementalTriangulator::Continue(
@@ -541,6 +826,22 @@ size_t IncrementalTriangulator::Continue(
     return 0;
   }
 
+  const size_t best_idx = EstimateContinue(options, ref_corr_data, corrs_data);
+  if (best_idx != std::numeric_limits<size_t>::max()) {
+    const CorrData& corr_data = corrs_data[best_idx];
+    const TrackElement track_el(ref_corr_data.image_id,
+                                ref_corr_data.point2D_idx);
+    reconstruction_->AddObservation(corr_data.point2D->Point3DId(), track_el);
+    modified_point3D_ids_.insert(corr_data.point2D->Point3DId());
+    return 1;
+  }
+
+  return 0;
+}
+
+size_t IncrementalTriangulator::EstimateContinue(
+    const Options& options, const CorrData& ref_corr_data,
+    const std::vector<CorrData>& corrs_data) const {
   double best_angle_error = std::numeric_limits<double>::max();
   size_t best_idx = std::numeric_limits<size_t>::max();
 
@@ -567,105 +868,278 @@ size_t IncrementalTriangulator::Continue(
   }
 
   const double max_angle_error = DegToRad(options.continue_max_angle_error);
-  if (best_angle_error <= max_angle_error &&
-      best_idx != std::numeric_limits<size_t>::max()) {
-    const CorrData& corr_data = corrs_data[best_idx];
-    const TrackElement track_el(ref_corr_data.image_id,
-                                ref_corr_data.point2D_idx);
-    reconstruction_->AddObservation(corr_data.point2D->Point3DId(), track_el);
-    modified_point3D_ids_.insert(corr_data.point2D->Point3DId());
-    return 1;
+  if (best_angle_error <= max_angle_error) {
+    return best_idx;
   }
 
-  return 0;
+  return std::numeric_limits<size_t>::max();
 }
 
-size_t IncrementalTriangulator::Merge(const Options& options,
-                                      const point3D_t point3D_id) {
-  if (!reconstruction_->ExistsPoint3D(point3D_id)) {
-    return 0;
+size_t IncrementalTriangulator::TriangulatePending(
+    const Options& continue_options, const Options& create_options,
+    ThreadPool* thread_pool, PendingTriangulations* pending) {
+  // Record the 3D points of the observations, on which the estimations are
+  // based.
+  for (PendingTriangulation& pending_tri : *pending) {
+    pending_tri.point3D_ids.clear();
+    pending_tri.point3D_ids.reserve(pending_tri.corrs_data.size() + 1);
+    for (const CorrData& corr_data : pending_tri.corrs_data) {
+      pending_tri.point3D_ids.push_back(corr_data.point2D->Point3DId());
+    }
+    pending_tri.point3D_ids.push_back(
+        pending_tri.ref_corr_data.point2D->Point3DId());
   }
 
-  const auto& point3D = reconstruction_->Point3D(point3D_id);
+  // Estimate the continuations and the new points, as in the serial
+  // `Continue` and the recursive `Create`, without modifying the
+  // reconstruction.
+  ParallelFor(thread_pool, pending->size(), [&](const size_t i) {
+    PendingTriangulation& pending_tri = (*pending)[i];
 
-  for (const auto& track_el : point3D.Track().Elements()) {
-    const std::vector<SceneGraph::Correspondence>& corrs =
-        scene_graph_->FindCorrespondences(track_el.image_id,
-                                          track_el.point2D_idx);
+    const CorrData& ref_corr_data = pending_tri.ref_corr_data;
+    if (!ref_corr_data.point2D->HasPoint3D()) {
+      pending_tri.continue_idx = EstimateContinue(
+          continue_options, ref_corr_data, pending_tri.corrs_data);
+    }
 
-    for (const auto corr : corrs) {
-      const auto& image = reconstruction_->Image(corr.image_id);
-      if (!image.IsRegistered()) {
-        continue;
+    std::vector<CorrData> create_corrs_data;
+    create_corrs_data.reserve(pending_tri.corrs_data.size() + 1);
+    for (const CorrData& corr_data : pending_tri.corrs_data) {
+      if (!corr_data.point2D->HasPoint3D()) {
+        create_corrs_data.push_back(corr_data);
       }
+    }
+    if (!ref_corr_data.point2D->HasPoint3D() &&
+        pending_tri.continue_idx == std::numeric_limits<size_t>::max()) {
+      create_corrs_data.push_back(ref_corr_data);
+    }
 
-      const Point2D& corr_point2D = image.Point2D(corr.point2D_idx);
-      if (!corr_point2D.HasPoint3D() ||
-          corr_point2D.Point3DId() == point3D_id ||
-          merge_trials_[point3D_id].count(corr_point2D.Point3DId()) > 0) {
-        continue;
+    Eigen::Vector3d xyz;
+    std::vector<char> inlier_mask;
+    std::vector<CorrData> outlier_corrs_data;
+    while (EstimateCreate(create_options, create_corrs_data, &xyz,
+                          &inlier_mask)) {
+      Track track;
+      track.Reserve(create_corrs_data.size());
+      outlier_corrs_data.clear();
+      for (size_t j = 0; j < inlier_mask.size(); ++j) {
+        const CorrData& corr_data = create_corrs_data[j];
+        if (inlier_mask[j]) {
+          track.AddElement(corr_data.image_id, corr_data.point2D_idx);
+        } else {
+          outlier_corrs_data.push_back(corr_data);
+        }
       }
 
-      // Try to merge the two 3D points.
-
-      const Point3D& corr_point3D =
-          reconstruction_->Point3D(corr_point2D.Point3DId());
-
-      merge_trials_[point3D_id].insert(corr_point2D.Point3DId());
-      merge_trials_[corr_point2D.Point3DId()].insert(point3D_id);
-
-      // Weighted average of point locations, depending on track length.
-      const Eigen::Vector3d merged_xyz =
-          (point3D.Track().Length() * point3D.XYZ() +
-           corr_point3D.Track().Length() * corr_point3D.XYZ()) /
-          (point3D.Track().Length() + corr_point3D.Track().Length());
-
-      // Count number of inlier track elements of the merged track.
-      bool merge_success = true;
-      for (const Track* track : {&point3D.Track(), &corr_point3D.Track()}) {
-        for (const auto test_track_el : track->Elements()) {
-          const Image& test_image =
-              reconstruction_->Image(test_track_el.image_id);
-          const Camera& test_camera =
-              reconstruction_->Camera(test_image.CameraId());
-          const Point2D& test_point2D =
-              test_image.Point2D(test_track_el.point2D_idx);
-
-          const Eigen::Matrix3x4d test_proj_matrix =
-              test_image.ProjectionMatrix();
-
-          if (!HasPointPositiveDepth(test_proj_matrix, merged_xyz) ||
-              CalculateReprojectionError(test_point2D.XY(), merged_xyz,
-                                         test_proj_matrix, test_camera) >
-                  options.merge_max_reproj_error) {
-            merge_success = false;
-            break;
-          }
-        }
-        if (!merge_success) {
+      pending_tri.xyzs.push_back(xyz);
+      pending_tri.tracks.push_back(std::move(track));
+
+      if (outlier_corrs_data.size() < kMinRecursiveTrackLength) {
+        break;
+      }
+      create_corrs_data.swap(outlier_corrs_data);
+    }
+  });
+
+  // Commit the estimations in their order. If an earlier commit changed one
+  // of the observations after it was recorded, the observation is
+  // triangulated serially on the current reconstruction instead.
+  size_t num_tris = 0;
+  for (PendingTriangulation& pending_tri : *pending) {
+    const CorrData& ref_corr_data = pending_tri.ref_corr_data;
+    std::vector<CorrData>& corrs_data = pending_tri.corrs_data;
+
+    bool changed =
+        ref_corr_data.point2D->Point3DId() != pending_tri.point3D_ids.back();
+    for (size_t i = 0; i < corrs_data.size() && !changed; ++i) {
+      changed = corrs_data[i].point2D->Point3DId() != pending_tri.point3D_ids[i];
+    }
+
+    if (changed) {
+      num_tris += Continue(continue_options, ref_corr_data, corrs_data);
+      corrs_data.push_back(ref_corr_data);
+      num_tris += Create(create_options, corrs_data);
+      continue;
+    }
+
+    if (pending_tri.continue_idx != std::numeric_limits<size_t>::max()) {
+      const point3D_t point3D_id =
+          corrs_data[pending_tri.continue_idx].point2D->Point3DId();
+      const TrackElement track_el(ref_corr_data.image_id,
+                                  ref_corr_data.point2D_idx);
+      reconstruction_->AddObservation(point3D_id, track_el);
+      modified_point3D_ids_.insert(point3D_id);
+      num_tris += 1;
+    }
+
+    for (size_t i = 0; i < pending_tri.xyzs.size(); ++i) {
+      const point3D_t point3D_id =
+          reconstruction_->AddPoint3D(pending_tri.xyzs[i], pending_tri.tracks[i]);
+      modified_point3D_ids_.insert(point3D_id);
+      num_tris += pending_tri.tracks[i].Length();
+    }
+  }
+
+  return num_tris;
+}
+
+size_t IncrementalTriangulator::CompleteTracksParallel(
+    const Options& options, ThreadPool* thread_pool,
+    const std::vector<point3D_t>& point3D_ids) {
+  size_t num_completed = 0;
+
+  // The completions only read the cache of bogus camera parameters. The
+  // scene graph of the reconstruction is finalized, so its queries do not
+  // modify it either.
+  CacheCameraBogusParams(options);
+
+  std::vector<std::vector<TrackElement>> track_els;
+  for (size_t begin = 0; begin < point3D_ids.size();
+       begin += kParallelChunkSize) {
+    const size_t end = std::min(begin + kParallelChunkSize, point3D_ids.size());
+
+    track_els.clear();
+    track_els.resize(end - begin);
+    ParallelFor(thread_pool, end - begin, [&](const size_t i) {
+      EstimateComplete(options, point3D_ids[begin + i], &track_els[i]);
+    });
+
+    // A completion only depends on the other 3D points through the
+    // observations it adds, so it is still valid if none of them was added to
+    // an earlier 3D point of the chunk.
+    for (size_t i = 0; i < track_els.size(); ++i) {
+      const point3D_t point3D_id = point3D_ids[begin + i];
+
+      bool changed = false;
+      for (const TrackElement& track_el : track_els[i]) {
+        if (reconstruction_->Image(track_el.image_id)
+                .Point2D(track_el.point2D_idx)
+                .HasPoint3D()) {
+          changed = true;
           break;
         }
       }
 
-      // Only accept merge if all track elements are inliers.
-      if (merge_success) {
-        const size_t num_merged =
-            point3D.Track().Length() + corr_point3D.Track().Length();
+      if (changed) {
+        num_completed += Complete(options, point3D_id);
+        continue;
+      }
 
-        const point3D_t merged_point3D_id = reconstruction_->MergePoints3D(
-            point3D_id, corr_point2D.Point3DId());
+      for (const TrackElement& track_el : track_els[i]) {
+        reconstruction_->AddObservation(point3D_id, track_el);
+      }
+      if (!track_els[i].empty()) {
+        modified_point3D_ids_.insert(point3D_id);
+      }
+      num_completed += track_els[i].size();
+    }
+  }
 
-        modified_point3D_ids_.erase(point3D_id);
-        modified_point3D_ids_.erase(corr_point2D.Point3DId());
-        modified_point3D_ids_.insert(merged_point3D_id);
+  return num_completed;
+}
 
-        // Merge merged 3D point and return, as the original points are deleted.
-        const size_t num_merged_recursive = Merge(options, merged_point3D_id);
-        if (num_merged_recursive > 0) {
-          return num_merged_recursive;
-        } else {
-          return num_merged;
+size_t IncrementalTriangulator::MergeTracksParallel(
+    const Options& options, ThreadPool* thread_pool,
+    const std::vector<point3D_t>& point3D_ids) {
+  size_t num_merged = 0;
+
+  typedef std::pair<std::pair<point3D_t, point3D_t>, bool> MergeCheck;
+  std::vector<std::vector<MergeCheck>> merge_checks;
+  for (size_t begin = 0; begin < point3D_ids.size();
+       begin += kParallelChunkSize) {
+    const size_t end = std::min(begin + kParallelChunkSize, point3D_ids.size());
+
+    // Check the merges of the 3D points with all their corresponding 3D
+    // points concurrently, while `Merge` then tries them in its order.
+    merge_checks.clear();
+    merge_checks.resize(end - begin);
+    ParallelFor(thread_pool, end - begin, [&](const size_t i) {
+      const point3D_t point3D_id = point3D_ids[begin + i];
+      if (!reconstruction_->ExistsPoint3D(point3D_id)) {
+        return;
+      }
+
+      const Point3D& point3D = reconstruction_->Point3D(point3D_id);
+      for (const auto& merge_candidate :
+           reconstruction_->MergeCandidates(point3D_id)) {
+        const point3D_t corr_point3D_id = merge_candidate.first;
+        const std::pair<point3D_t, point3D_t> key =
+            std::minmax(point3D_id, corr_point3D_id);
+        if (!reconstruction_->ExistsPoint3D(corr_point3D_id) ||
+            merge_checks_.count(key) > 0) {
+          continue;
         }
+
+        const Point3D& corr_point3D = reconstruction_->Point3D(corr_point3D_id);
+        merge_checks[i].emplace_back(
+            key, EstimateMerge(options, point3D, corr_point3D));
+      }
+    });
+
+    for (const auto& point_merge_checks : merge_checks) {
+      merge_checks_.insert(point_merge_checks.begin(),
+                           point_merge_checks.end());
+    }
+
+    for (size_t i = begin; i < end; ++i) {
+      num_merged += Merge(options, point3D_ids[i]);
+    }
+  }
+
+  return num_merged;
+}
+
+size_t IncrementalTriangulator::Merge(const Options& options,
+                                      const point3D_t point3D_id) {
+  if (!reconstruction_->ExistsPoint3D(point3D_id)) {
+    return 0;
+  }
+
+  const auto& point3D = reconstruction_->Point3D(point3D_id);
+
+  // Only the 3D points with corresponding observations can be merged. The
+  // candidates are copied, as they change with every merge.
+  const std::vector<std::pair<point3D_t, size_t>> merge_candidates =
+      reconstruction_->MergeCandidates(point3D_id);
+
+  for (const auto& merge_candidate : merge_candidates) {
+    const point3D_t corr_point3D_id = merge_candidate.first;
+    if (!reconstruction_->ExistsPoint3D(corr_point3D_id) ||
+        merge_trials_[point3D_id].count(corr_point3D_id) > 0) {
+      continue;
+    }
+
+    // Try to merge the two 3D points.
+
+    const Point3D& corr_point3D = reconstruction_->Point3D(corr_point3D_id);
+
+    merge_trials_[point3D_id].insert(corr_point3D_id);
+    merge_trials_[corr_point3D_id].insert(point3D_id);
+
+    // Only accept merge if all track elements are inliers.
+    const auto merge_check =
+        merge_checks_.find(std::minmax(point3D_id, corr_point3D_id));
+    const bool merge_success =
+        merge_check != merge_checks_.end()
+            ? merge_check->second
+            : EstimateMerge(options, point3D, corr_point3D);
+    if (merge_success) {
+      const size_t num_merged =
+          point3D.Track().Length() + corr_point3D.Track().Length();
+
+      const point3D_t merged_point3D_id =
+          reconstruction_->MergePoints3D(point3D_id, corr_point3D_id);
+
+      modified_point3D_ids_.erase(point3D_id);
+      modified_point3D_ids_.erase(corr_point3D_id);
+      modified_point3D_ids_.insert(merged_point3D_id);
+
+      // Merge merged 3D point and return, as the original points are deleted.
+      const size_t num_merged_recursive = Merge(options, merged_point3D_id);
+      if (num_merged_recursive > 0) {
+        return num_merged_recursive;
+      } else {
+        return num_merged;
       }
     }
   }
@@ -673,18 +1147,71 @@ size_t IncrementalTriangulator::Merge(const Options& options,
   return 0;
 }
 
+bool IncrementalTriangulator::EstimateMerge(const Options& options,
+                                            const Point3D& point3D,
+                                            const Point3D& corr_point3D) const {
+  // Weighted average of point locations, depending on track length.
+  const Eigen::Vector3d merged_xyz =
+      (point3D.Track().Length() * point3D.XYZ() +
+       corr_point3D.Track().Length() * corr_point3D.XYZ()) /
+      (point3D.Track().Length() + corr_point3D.Track().Length());
+
+  // Count number of inlier track elements of the merged track.
+  for (const Track* track : {&point3D.Track(), &corr_point3D.Track()}) {
+    for (const auto test_track_el : track->Elements()) {
+      const Image& test_image = reconstruction_->Image(test_track_el.image_id);
+      const Camera& test_camera =
+          reconstruction_->Camera(test_image.CameraId());
+      const Point2D& test_point2D =
+          test_image.Point2D(test_track_el.point2D_idx);
+
+      const Eigen::Matrix3x4d test_proj_matrix = test_image.ProjectionMatrix();
+
+      if (!HasPointPositiveDepth(test_proj_matrix, merged_xyz) ||
+          CalculateReprojectionError(test_point2D.XY(), merged_xyz,
+                                     test_proj_matrix, test_camera) >
+              options.merge_max_reproj_error) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
 size_t IncrementalTriangulator::Complete(const Options& options,
                                          const point3D_t point3D_id) {
-  size_t num_completed = 0;
+  std::vector<TrackElement> track_els;
+  EstimateComplete(options, point3D_id, &track_els);
+
+  // Success, add observations to point track.
+  for (const TrackElement& track_el : track_els) {
+    reconstruction_->AddObservation(point3D_id, track_el);
+  }
+  if (!track_els.empty()) {
+    modified_point3D_ids_.insert(point3D_id);
+  }
+
+  return track_els.size();
+}
+
+void IncrementalTriangulator::EstimateComplete(
+    const Options& options, const point3D_t point3D_id,
+    std::vector<TrackElement>* track_els) {
+  track_els->clear();
 
   if (!reconstruction_->ExistsPoint3D(point3D_id)) {
-    return num_completed;
+    return;
   }
 
   const Point3D& point3D = reconstruction_->Point3D(point3D_id);
 
   std::vector<TrackElement> queue = point3D.Track().Elements();
 
+  // The observations that are added to the track, which are triangulated
+  // for the rest of the search.
+  std::unordered_set<uint64_t> completed_point2D_ids;
+
   const int max_transitivity = options.complete_max_transitivity;
   for (int transitivity = 0; transitivity < max_transitivity; ++transitivity) {
     if (queue.empty()) {
@@ -695,7 +1222,7 @@ size_t IncrementalTriangulator::Complete(const Options& options,
     queue.clear();
 
     for (const TrackElement queue_elem : prev_queue) {
-      const std::vector<SceneGraph::Correspondence>& corrs =
+      const CsrRow<SceneGraph::Correspondence> corrs =
           scene_graph_->FindCorrespondences(queue_elem.image_id,
                                             queue_elem.point2D_idx);
 
@@ -706,7 +1233,9 @@ size_t IncrementalTriangulator::Complete(const Options& options,
         }
 
         const Point2D& point2D = image.Point2D(corr.point2D_idx);
-        if (point2D.HasPoint3D()) {
+        const uint64_t point2D_id =
+            (static_cast<uint64_t>(corr.image_id) << 32) | corr.point2D_idx;
+        if (point2D.HasPoint3D() || completed_point2D_ids.count(point2D_id)) {
           continue;
         }
 
@@ -726,22 +1255,16 @@ size_t IncrementalTriangulator::Complete(const Options& options,
           continue;
         }
 
-        // Success, add observation to point track.
-        const TrackElement track_el(corr.image_id, corr.point2D_idx);
-        reconstruction_->AddObservation(point3D_id, track_el);
-        modified_point3D_ids_.insert(point3D_id);
+        track_els->emplace_back(corr.image_id, corr.point2D_idx);
+        completed_point2D_ids.insert(point2D_id);
 
         // Recursively complete track for this new correspondence.
         if (transitivity < max_transitivity - 1) {
           queue.emplace_back(corr.image_id, corr.point2D_idx);
         }
-
-        num_completed += 1;
       }
     }
   }
-
-  return num_completed;
 }
 
 bool IncrementalTriangulator::HasCameraBogusParams(const Options& options,
@@ -758,4 +1281,24 @@ bool IncrementalTriangulator::HasCameraBogusParams(const Options& options,
   }
 }
 
+void IncrementalTriangulator::CacheCameraBogusParams(const Options& options) {
+  for (const auto& camera : reconstruction_->Cameras()) {
+    HasCameraBogusParams(options, camera.second);
+  }
+}
+
+ThreadPool* IncrementalTriangulator::WorkerPool(const Options& options) {
+  const int num_eff_threads = GetEffectiveNumThreads(options.num_threads);
+  if (num_eff_threads == 1) {
+    return nullptr;
+  } else if (options.thread_pool != nullptr) {
+    return options.thread_pool;
+  }
+  if (!thread_pool_ ||
+      static_cast<int>(thread_pool_->NumThreads()) != num_eff_threads) {
+    thread_pool_.reset(new ThreadPool(num_eff_threads));
+  }
+  return thread_pool_.get();
+}
+
 }  // namespace colmap
@@ -17,9 +17,13 @@
 #ifndef COLMAP_SRC_SFM_INCREMENTAL_TRIANGULATOR_H_
 #define COLMAP_SRC_SFM_INCREMENTAL_TRIANGULATOR_H_
 
+#include <map>
+#include <memory>
+
 #include "base/database_cache.h"
 #include "base/reconstruction.h"
 #include "util/alignment.h"
+#include "util/threading.h"
 
 namespace colmap {
 
@@ -69,6 +73,20 @@ class IncrementalTriangulator {
     double max_focal_length_ratio = 10.0;
     double max_extra_param = 1.0;
 
+    // Number of threads for the triangulation, all cores for -1. With one
+    // thread, the observations are processed one after the other. Otherwise,
+    // they are processed in chunks: the estimations of a chunk run
+    // concurrently on the state of the reconstruction before the chunk and
+    // their results are committed in the serial order. A result is
+    // re-estimated serially if an earlier commit of its chunk changed one of
+    // its observations, so that the reconstruction is the same as with one
+    // thread.
+    int num_threads = 1;
+
+    // If set, the parallel triangulation runs on this pool instead of a pool
+    // owned by the triangulator. Only the calling thread waits for its tasks.
+    ThreadPool* thread_pool = nullptr;
+
     bool Check() const;
   };
 
@@ -86,6 +104,17 @@ class IncrementalTriangulator {
   // in the associated reconstruction.
   size_t TriangulateImage(const Options& options, const image_t image_id);
 
+  // Triangulate observations of the given images, as `TriangulateImage` for
+  // each image in the given order, e.g. to re-triangulate a model with fixed
+  // poses. With multiple threads, the observations are grouped by the
+  // connected components of their correspondences. Observations of different
+  // components neither read nor change the same observations, so that the
+  // estimations run concurrently in rounds, which contain the next
+  // observation of every component. The result is the same as with one
+  // thread up to the ids of the new 3D points.
+  size_t TriangulateImages(const Options& options,
+                           const std::vector<image_t>& image_ids);
+
   // Complete triangulations for image. Tries to create new tracks for not
   // yet triangulated observations and tries to complete existing tracks.
   // Returns the number of completed observations.
@@ -140,6 +169,14 @@ class IncrementalTriangulator {
   };
 
  private:
+  // Observation whose triangulation is estimated concurrently with the other
+  // observations of its chunk and committed afterwards.
+  struct PendingTriangulation;
+
+  typedef std::vector<PendingTriangulation,
+                      Eigen::aligned_allocator<PendingTriangulation>>
+      PendingTriangulations;
+
   // Clear cache of bogus camera parameters and merge trials.
   void ClearCaches();
 
@@ -152,19 +189,66 @@ class IncrementalTriangulator {
   size_t Create(const Options& options,
                 const std::vector<CorrData>& corrs_data);
 
+  // Estimate a new 3D point from the given not yet triangulated
+  // correspondences without modifying the reconstruction.
+  bool EstimateCreate(const Options& options,
+                      const std::vector<CorrData>& create_corrs_data,
+                      Eigen::Vector3d* xyz,
+                      std::vector<char>* inlier_mask) const;
+
   // Try to continue the 3D point with the given correspondences.
   size_t Continue(const Options& options, const CorrData& ref_corr_data,
                   const std::vector<CorrData>& corrs_data);
 
+  // Find the correspondence whose 3D point continues best with the reference
+  // observation, or the maximum index if there is none.
+  size_t EstimateContinue(const Options& options,
+                          const CorrData& ref_corr_data,
+                          const std::vector<CorrData>& corrs_data) const;
+
+  // Estimate the pending triangulations concurrently and commit them in
+  // their order. The existing 3D points are continued with `continue_options`
+  // and new ones are created with `create_options`.
+  size_t TriangulatePending(const Options& continue_options,
+                            const Options& create_options,
+                            ThreadPool* thread_pool,
+                            PendingTriangulations* pending);
+
+  // Complete and merge the tracks of the given 3D points in chunks, whose
+  // estimations run concurrently, in the order of the 3D points.
+  size_t CompleteTracksParallel(const Options& options,
+                                ThreadPool* thread_pool,
+                                const std::vector<point3D_t>& point3D_ids);
+  size_t MergeTracksParallel(const Options& options, ThreadPool* thread_pool,
+                             const std::vector<point3D_t>& point3D_ids);
+
   // Try to merge 3D point with any of its corresponding 3D points.
   size_t Merge(const Options& options, const point3D_t point3D_id);
 
+  // Check whether the merged 3D point would be consistent with all the
+  // observations of both 3D points.
+  bool EstimateMerge(const Options& options, const Point3D& point3D,
+                     const Point3D& corr_point3D) const;
+
   // Try to transitively complete the track of a 3D point.
   size_t Complete(const Options& options, const point3D_t point3D_id);
 
+  // Find the observations that transitively complete the track of a 3D point
+  // without modifying the reconstruction. This is thread-safe if the bogus
+  // parameters of all cameras are cached.
+  void EstimateComplete(const Options& options, const point3D_t point3D_id,
+                        std::vector<TrackElement>* track_els);
+
   // Check if camera has bogus parameters and cache the result.
   bool HasCameraBogusParams(const Options& options, const Camera& camera);
 
+  // Cache the bogus parameters of all cameras, so that the cache is only read
+  // by the concurrent estimations.
+  void CacheCameraBogusParams(const Options& options);
+
+  // The pool for the parallel triangulation, or null for the serial one.
+  ThreadPool* WorkerPool(const Options& options);
+
   // Database cache for the reconstruction. Used to retrieve correspondence
   // information for triangulation.
   const SceneGraph* scene_graph_;
@@ -178,12 +262,24 @@ class IncrementalTriangulator {
   // Cache for tried track merges to avoid duplicate merge trials.
   std::unordered_map<point3D_t, std::unordered_set<point3D_t>> merge_trials_;
 
+  // Merge checks of pairs of 3D points, which are estimated concurrently by
+  // the parallel track merging. Merging only adds and deletes 3D points and
+  // does not modify the existing ones, so the checks stay valid in a call.
+  std::map<std::pair<point3D_t, point3D_t>, bool> merge_checks_;
+
   // Number of trials to retriangulate image pair.
   std::unordered_map<image_pair_t, int> re_num_trials_;
 
   // Changed 3D points, i.e. if a 3D point is modified (created, continued,
   // deleted, merged, etc.). Cleared once `ModifiedPoints3D` is called.
   std::unordered_set<point3D_t> modified_point3D_ids_;
+
+  // Reused by `Find` for the correspondence search of every image point.
+  SceneGraph::TransitiveScratch transitive_scratch_;
+  std::vector<SceneGraph::Correspondence> found_corrs_;
+
+  // The pool of the parallel triangulation, if no pool is given.
+  std::unique_ptr<ThreadPool> thread_pool_;
 };
 
 }  // namespace colmap
@@ -0,0 +1,159 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sfm/init_pair_cache.h"
+
+#include <cstring>
+#include <fstream>
+#include <random>
+
+#include <boost/filesystem.hpp>
+
+#include "util/endian.h"
+#include "util/logging.h"
+#include "util/string.h"
+
+namespace colmap {
+namespace {
+
+const char kInitialPairCacheMagic[8] = {'I', 'N', 'I', 'T', 'P', 'A', 'I', 'R'};
+
+const uint32_t kInitialPairCacheVersion = 1;
+
+}  // namespace
+
+size_t InitialPairCache::Size() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+bool InitialPairCache::Find(const image_pair_t pair_id, const double max_error,
+                            const size_t num_correspondences,
+                            Entry* entry) const {
+  CHECK_NOTNULL(entry);
+  std::unique_lock<std::mutex> lock(mutex_);
+  const auto it = entries_.find(pair_id);
+  if (it == entries_.end() || it->second.max_error != max_error ||
+      it->second.num_correspondences != num_correspondences) {
+    return false;
+  }
+  *entry = it->second;
+  return true;
+}
+
+void InitialPairCache::Insert(const image_pair_t pair_id, const Entry& entry) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  entries_[pair_id] = entry;
+}
+
+void InitialPairCache::Clear() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  entries_.clear();
+}
+
+bool InitialPairCache::Read(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  char magic[sizeof(kInitialPairCacheMagic)];
+  file.read(magic, sizeof(magic));
+  if (!file ||
+      std::memcmp(magic, kInitialPairCacheMagic, sizeof(magic)) != 0) {
+    std::cout << "WARNING: " << path << " is not an initial pair cache."
+              << std::endl;
+    return false;
+  }
+
+  const uint32_t version = ReadBinaryLittleEndian<uint32_t>(&file);
+  if (version != kInitialPairCacheVersion) {
+    std::cout << StringPrintf("WARNING: Initial pair cache %s has version %d, "
+                              "expected %d.",
+                              path.c_str(), version, kInitialPairCacheVersion)
+              << std::endl;
+    return false;
+  }
+
+  EIGEN_STL_UMAP(image_pair_t, Entry) entries;
+  const uint64_t num_entries = ReadBinaryLittleEndian<uint64_t>(&file);
+  for (uint64_t i = 0; i < num_entries && file; ++i) {
+    const image_pair_t pair_id = ReadBinaryLittleEndian<image_pair_t>(&file);
+    Entry entry;
+    for (int j = 0; j < 4; ++j) {
+      entry.qvec(j) = ReadBinaryLittleEndian<double>(&file);
+    }
+    for (int j = 0; j < 3; ++j) {
+      entry.tvec(j) = ReadBinaryLittleEndian<double>(&file);
+    }
+    entry.num_inliers = ReadBinaryLittleEndian<uint64_t>(&file);
+    entry.tri_angle = ReadBinaryLittleEndian<double>(&file);
+    entry.max_error = ReadBinaryLittleEndian<double>(&file);
+    entry.num_correspondences = ReadBinaryLittleEndian<uint64_t>(&file);
+    entries.emplace(pair_id, entry);
+  }
+
+  if (!file) {
+    std::cout << "WARNING: Initial pair cache " << path << " is truncated."
+              << std::endl;
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (const auto& entry : entries) {
+    entries_[entry.first] = entry.second;
+  }
+
+  return true;
+}
+
+void InitialPairCache::Write(const std::string& path) const {
+  // The file is replaced at once, so that concurrent readers of other
+  // processes never see a partially written cache.
+  const std::string temp_path =
+      path + ".tmp" + std::to_string(std::random_device()());
+
+  {
+    std::ofstream file(temp_path, std::ios::trunc | std::ios::binary);
+    CHECK(file.is_open()) << temp_path;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    file.write(kInitialPairCacheMagic, sizeof(kInitialPairCacheMagic));
+    WriteBinaryLittleEndian<uint32_t>(&file, kInitialPairCacheVersion);
+    WriteBinaryLittleEndian<uint64_t>(&file, entries_.size());
+    for (const auto& entry : entries_) {
+      WriteBinaryLittleEndian<image_pair_t>(&file, entry.first);
+      for (int j = 0; j < 4; ++j) {
+        WriteBinaryLittleEndian<double>(&file, entry.second.qvec(j));
+      }
+      for (int j = 0; j < 3; ++j) {
+        WriteBinaryLittleEndian<double>(&file, entry.second.tvec(j));
+      }
+      WriteBinaryLittleEndian<uint64_t>(&file, entry.second.num_inliers);
+      WriteBinaryLittleEndian<double>(&file, entry.second.tri_angle);
+      WriteBinaryLittleEndian<double>(&file, entry.second.max_error);
+      WriteBinaryLittleEndian<uint64_t>(&file,
+                                        entry.second.num_correspondences);
+    }
+
+    CHECK(file.good()) << temp_path;
+  }
+
+  boost::filesystem::rename(temp_path, path);
+}
+
+}  // namespace colmap
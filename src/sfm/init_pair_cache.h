@@ -0,0 +1,81 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_SFM_INIT_PAIR_CACHE_H_
+#define COLMAP_SRC_SFM_INIT_PAIR_CACHE_H_
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <Eigen/Core>
+
+#include "util/alignment.h"
+#include "util/types.h"
+
+namespace colmap {
+
+// Cache of the two-view geometries of the candidate initial image pairs of the
+// incremental mapper, so that the relative pose of a pair is only estimated
+// once, although every initialization round and every take starts a new
+// mapper. The cache can be shared by concurrent mappers and persisted to a
+// binary file for later runs on the same database. An entry is only used for
+// the same RANSAC threshold and number of correspondences as it was estimated
+// with, so that entries of a changed database are estimated again.
+class InitialPairCache {
+ public:
+  struct Entry {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // Relative pose of the second image.
+    Eigen::Vector4d qvec = Eigen::Vector4d(1, 0, 0, 0);
+    Eigen::Vector3d tvec = Eigen::Vector3d::Zero();
+
+    // Number of inlier matches and median triangulation angle in radians.
+    size_t num_inliers = 0;
+    double tri_angle = 0;
+
+    // Inputs of the estimation that invalidate the entry if they change.
+    double max_error = 0;
+    size_t num_correspondences = 0;
+  };
+
+  size_t Size() const;
+
+  // Find the entry of an image pair, if it was estimated with the given
+  // RANSAC threshold and number of correspondences.
+  bool Find(const image_pair_t pair_id, const double max_error,
+            const size_t num_correspondences, Entry* entry) const;
+
+  // Insert or replace the entry of an image pair.
+  void Insert(const image_pair_t pair_id, const Entry& entry);
+
+  void Clear();
+
+  // Read the entries of a file into the cache, replacing existing entries of
+  // the same pairs. Returns false if the file does not exist or has a
+  // different version, and then leaves the cache unchanged.
+  bool Read(const std::string& path);
+  void Write(const std::string& path) const;
+
+ private:
+  mutable std::mutex mutex_;
+  EIGEN_STL_UMAP(image_pair_t, Entry) entries_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_SFM_INIT_PAIR_CACHE_H_
@@ -0,0 +1,109 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "sfm/init_pair_cache"
+#include "util/testing.h"
+
+#include <boost/filesystem.hpp>
+
+#include "sfm/init_pair_cache.h"
+
+using namespace colmap;
+
+namespace {
+
+InitialPairCache::Entry CreateEntry(const size_t seed) {
+  InitialPairCache::Entry entry;
+  entry.qvec = Eigen::Vector4d(1, 0.1 * seed, 0.2, 0.3).normalized();
+  entry.tvec = Eigen::Vector3d(seed, 2, 3);
+  entry.num_inliers = 100 + seed;
+  entry.tri_angle = 0.01 * seed;
+  entry.max_error = 4;
+  entry.num_correspondences = 200 + seed;
+  return entry;
+}
+
+void CheckEqualEntries(const InitialPairCache::Entry& entry1,
+                       const InitialPairCache::Entry& entry2) {
+  BOOST_CHECK_EQUAL(entry1.qvec, entry2.qvec);
+  BOOST_CHECK_EQUAL(entry1.tvec, entry2.tvec);
+  BOOST_CHECK_EQUAL(entry1.num_inliers, entry2.num_inliers);
+  BOOST_CHECK_EQUAL(entry1.tri_angle, entry2.tri_angle);
+  BOOST_CHECK_EQUAL(entry1.max_error, entry2.max_error);
+  BOOST_CHECK_EQUAL(entry1.num_correspondences, entry2.num_correspondences);
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestFind) {
+  InitialPairCache cache;
+  BOOST_CHECK_EQUAL(cache.Size(), 0);
+
+  const InitialPairCache::Entry entry = CreateEntry(1);
+  cache.Insert(10, entry);
+  BOOST_CHECK_EQUAL(cache.Size(), 1);
+
+  InitialPairCache::Entry found_entry;
+  BOOST_CHECK(cache.Find(10, entry.max_error, entry.num_correspondences,
+                         &found_entry));
+  CheckEqualEntries(entry, found_entry);
+
+  // The entry is only valid for the same estimation inputs.
+  BOOST_CHECK(!cache.Find(11, entry.max_error, entry.num_correspondences,
+                          &found_entry));
+  BOOST_CHECK(!cache.Find(10, 2 * entry.max_error, entry.num_correspondences,
+                          &found_entry));
+  BOOST_CHECK(!cache.Find(10, entry.max_error, entry.num_correspondences + 1,
+                          &found_entry));
+
+  cache.Clear();
+  BOOST_CHECK_EQUAL(cache.Size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadWrite) {
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("init_pair_cache_test_%%%%%%%%.bin"))
+          .string();
+
+  InitialPairCache cache;
+  BOOST_CHECK(!cache.Read(path));
+
+  for (size_t i = 0; i < 5; ++i) {
+    cache.Insert(i, CreateEntry(i));
+  }
+  cache.Write(path);
+
+  InitialPairCache read_cache;
+  read_cache.Insert(5, CreateEntry(5));
+  BOOST_CHECK(read_cache.Read(path));
+  BOOST_CHECK_EQUAL(read_cache.Size(), 6);
+  for (size_t i = 0; i < 6; ++i) {
+    const InitialPairCache::Entry entry = CreateEntry(i);
+    InitialPairCache::Entry read_entry;
+    BOOST_CHECK(read_cache.Find(i, entry.max_error, entry.num_correspondences,
+                                &read_entry));
+    CheckEqualEntries(entry, read_entry);
+  }
+
+  // A truncated file leaves the cache unchanged.
+  boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 1);
+  InitialPairCache truncated_cache;
+  BOOST_CHECK(!truncated_cache.Read(path));
+  BOOST_CHECK_EQUAL(truncated_cache.Size(), 0);
+
+  boost::filesystem::remove(path);
+}
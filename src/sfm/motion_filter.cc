@@ -0,0 +1,153 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "sfm/motion_filter.h"
+
+#include "base/pose.h"
+#include "util/logging.h"
+#include "util/math.h"
+
+namespace colmap {
+namespace {
+
+// The angle of a rotation matrix in radians.
+double RotationAngle(const Eigen::Matrix3d& R) {
+  return RotationMatrixToAngleAxis(R).norm();
+}
+
+}  // namespace
+
+ObjectMotion ComputeObjectMotion(const Eigen::Vector4d& qvec1,
+                                 const Eigen::Vector3d& tvec1,
+                                 const Eigen::Vector4d& qvec2,
+                                 const Eigen::Vector3d& tvec2) {
+  // As the motions of the camera log in `find_motion`.
+  const Eigen::Matrix3d R1 = QuaternionToRotationMatrix(qvec1);
+  const Eigen::Matrix3d R2 = QuaternionToRotationMatrix(qvec2);
+  ObjectMotion motion;
+  motion.R = R1.transpose() * R2;
+  motion.t = ProjectionCenterFromParameters(qvec1, tvec1) -
+             motion.R * ProjectionCenterFromParameters(qvec2, tvec2);
+  return motion;
+}
+
+double ComputeSceneScale(const Reconstruction& reconstruction) {
+  double sum_dists = 0;
+  size_t num_dists = 0;
+  for (const image_t image_id : reconstruction.RegImageIds()) {
+    const Image& image = reconstruction.Image(image_id);
+    Eigen::Vector3d center_sum = Eigen::Vector3d::Zero();
+    size_t num_observed = 0;
+    for (const Point2D& point2D : image.Points2D()) {
+      if (point2D.HasPoint3D()) {
+        center_sum += reconstruction.Point3D(point2D.Point3DId()).XYZ();
+        num_observed += 1;
+      }
+    }
+    if (num_observed > 0) {
+      sum_dists +=
+          (image.ProjectionCenter() - center_sum / num_observed).norm();
+      num_dists += 1;
+    }
+  }
+  return num_dists > 0 ? sum_dists / num_dists : 0;
+}
+
+bool TentativeMotionFilter::Options::Check() const {
+  CHECK_OPTION_GT(identity_thr1, 0);
+  CHECK_OPTION_GT(identity_thr2, 0);
+  CHECK_OPTION_GE(num_estimates, 0);
+  CHECK_OPTION_GT(max_rotation_error, 0);
+  CHECK_OPTION_GT(max_translation_error, 0);
+  return true;
+}
+
+TentativeMotionFilter::TentativeMotionFilter(const Options& options,
+                                             const double scene_scale)
+    : options_(options),
+      scene_scale_(scene_scale),
+      num_accepted_(0),
+      num_rejected_identity_(0),
+      num_rejected_inconsistent_(0) {
+  CHECK(options_.Check());
+  CHECK_GE(scene_scale_, 0);
+}
+
+bool TentativeMotionFilter::Filter(const int take,
+                                   const ObjectMotion& motion) {
+  if (IsIdentity(motion)) {
+    num_rejected_identity_ += 1;
+    return false;
+  }
+
+  TakeMotions& motions = take_motions_[take];
+
+  bool is_accepted =
+      motions.accepted.size() < static_cast<size_t>(options_.num_estimates);
+  for (size_t i = 0; i < motions.accepted.size() && !is_accepted; ++i) {
+    is_accepted = IsConsistent(motion, motions.accepted[i]);
+  }
+
+  // A motion that confirms a rejected one is accepted together with it, so
+  // that a body which only appears after the first estimates is still found.
+  for (size_t i = 0; i < motions.rejected.size() && !is_accepted; ++i) {
+    if (IsConsistent(motion, motions.rejected[i])) {
+      motions.accepted.push_back(motions.rejected[i]);
+      motions.rejected.erase(motions.rejected.begin() + i);
+      is_accepted = true;
+    }
+  }
+
+  if (is_accepted) {
+    motions.accepted.push_back(motion);
+    num_accepted_ += 1;
+  } else {
+    motions.rejected.push_back(motion);
+    num_rejected_inconsistent_ += 1;
+  }
+
+  return is_accepted;
+}
+
+size_t TentativeMotionFilter::NumAccepted() const { return num_accepted_; }
+
+size_t TentativeMotionFilter::NumRejectedIdentity() const {
+  return num_rejected_identity_;
+}
+
+size_t TentativeMotionFilter::NumRejectedInconsistent() const {
+  return num_rejected_inconsistent_;
+}
+
+bool TentativeMotionFilter::IsIdentity(const ObjectMotion& motion) const {
+  // The clear identity motions of `remove_id`.
+  const double kClearMargin = 2;
+  const double rot_thr = 0.0247 * options_.identity_thr1;
+  const double trans_thr = 0.007 * options_.identity_thr2 * scene_scale_;
+  return RotationAngle(motion.R) * kClearMargin < rot_thr &&
+         motion.t.norm() * kClearMargin < trans_thr;
+}
+
+bool TentativeMotionFilter::IsConsistent(const ObjectMotion& motion1,
+                                         const ObjectMotion& motion2) const {
+  return RotationAngle(motion1.R.transpose() * motion2.R) <=
+             DegToRad(options_.max_rotation_error) &&
+         (motion1.t - motion2.t).norm() <=
+             options_.max_translation_error * scene_scale_;
+}
+
+}  // namespace colmap
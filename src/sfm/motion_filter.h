@@ -0,0 +1,108 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef COLMAP_SRC_SFM_MOTION_FILTER_H_
+#define COLMAP_SRC_SFM_MOTION_FILTER_H_
+
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "base/reconstruction.h"
+
+namespace colmap {
+
+// The rigid object motion between the background pose and another pose
+// hypothesis of the same image, which maps the points of the moved body into
+// the frame of the background. All images of a take that see the same body
+// have the same motion, whatever their own poses.
+struct ObjectMotion {
+  Eigen::Matrix3d R = Eigen::Matrix3d::Identity();
+  Eigen::Vector3d t = Eigen::Vector3d::Zero();
+};
+
+ObjectMotion ComputeObjectMotion(const Eigen::Vector4d& qvec1,
+                                 const Eigen::Vector3d& tvec1,
+                                 const Eigen::Vector4d& qvec2,
+                                 const Eigen::Vector3d& tvec2);
+
+// The mean distance between the projection centers of the registered images
+// and the mean of their observed 3D points, which is the scale of the
+// translations of the postprocessor's identity test.
+double ComputeSceneScale(const Reconstruction& reconstruction);
+
+// Online estimate-then-confirm filter of the object motions of the additional
+// pose hypotheses of the sequentially registered images, so that the mapper
+// only creates phantom images for plausible motions:
+//
+//  - A motion that the postprocessor's identity test would certainly remove
+//    is rejected. The thresholds are those of `remove_id` without its
+//    clustering of the ambiguous motions.
+//  - The first motions of a take are accepted as estimates. From then on, a
+//    motion is only accepted if it is consistent with an accepted motion or
+//    confirms a previously rejected one, which is accepted as well.
+class TentativeMotionFilter {
+ public:
+  struct Options {
+    // The identity thresholds, as `id_thr1` and `id_thr2` of the
+    // postprocessor.
+    double identity_thr1 = 2.5;
+    double identity_thr2 = 3;
+
+    // The number of accepted motions of a take from which on the motions must
+    // be confirmed.
+    int num_estimates = 5;
+
+    // The maximum rotation difference in degrees and the maximum translation
+    // difference relative to the scene scale of consistent motions.
+    double max_rotation_error = 5;
+    double max_translation_error = 0.1;
+
+    bool Check() const;
+  };
+
+  TentativeMotionFilter(const Options& options, const double scene_scale);
+
+  // Whether to accept the motion of a pose hypothesis in the given take.
+  bool Filter(const int take, const ObjectMotion& motion);
+
+  size_t NumAccepted() const;
+  size_t NumRejectedIdentity() const;
+  size_t NumRejectedInconsistent() const;
+
+ private:
+  struct TakeMotions {
+    std::vector<ObjectMotion> accepted;
+    std::vector<ObjectMotion> rejected;
+  };
+
+  bool IsIdentity(const ObjectMotion& motion) const;
+  bool IsConsistent(const ObjectMotion& motion1,
+                    const ObjectMotion& motion2) const;
+
+  const Options options_;
+  const double scene_scale_;
+  std::unordered_map<int, TakeMotions> take_motions_;
+  size_t num_accepted_;
+  size_t num_rejected_identity_;
+  size_t num_rejected_inconsistent_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_SFM_MOTION_FILTER_H_
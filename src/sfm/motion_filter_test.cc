@@ -0,0 +1,109 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#define TEST_NAME "sfm/motion_filter"
+#include "util/testing.h"
+
+#include "base/pose.h"
+#include "sfm/motion_filter.h"
+#include "util/math.h"
+
+using namespace colmap;
+
+namespace {
+
+ObjectMotion CreateMotion(const double angle, const double x) {
+  ObjectMotion motion;
+  motion.R =
+      AngleAxisToRotationMatrix(Eigen::Vector3d(0, 0, DegToRad(angle)));
+  motion.t = Eigen::Vector3d(x, 0, 0);
+  return motion;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestComputeObjectMotion) {
+  const Eigen::Vector4d qvec1 =
+      NormalizeQuaternion(Eigen::Vector4d(1, 0.1, -0.2, 0.3));
+  const Eigen::Vector3d tvec1(1, 2, 3);
+  const ObjectMotion motion = CreateMotion(30, 0.5);
+
+  // The pose of the moved body is the background pose composed with the
+  // motion, for any background pose.
+  for (int i = 0; i < 3; ++i) {
+    const Eigen::Vector4d qvec = ConcatenateQuaternions(
+        qvec1, RotationMatrixToQuaternion(AngleAxisToRotationMatrix(
+                   Eigen::Vector3d(0.1 * i, 0, 0))));
+    const Eigen::Vector3d tvec = tvec1 + Eigen::Vector3d(0, i, 0);
+    const Eigen::Matrix3d R = QuaternionToRotationMatrix(qvec);
+    const Eigen::Vector4d qvec2 = RotationMatrixToQuaternion(R * motion.R);
+    const Eigen::Vector3d tvec2 = R * motion.t + tvec;
+    const ObjectMotion estimated =
+        ComputeObjectMotion(qvec, tvec, qvec2, tvec2);
+    BOOST_CHECK_LT((estimated.R - motion.R).norm(), 1e-9);
+    BOOST_CHECK_LT((estimated.t - motion.t).norm(), 1e-9);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestOptions) {
+  TentativeMotionFilter::Options options;
+  BOOST_CHECK(options.Check());
+  options.num_estimates = -1;
+  BOOST_CHECK(!options.Check());
+  options.num_estimates = 0;
+  options.max_translation_error = 0;
+  BOOST_CHECK(!options.Check());
+}
+
+BOOST_AUTO_TEST_CASE(TestIdentity) {
+  TentativeMotionFilter::Options options;
+  TentativeMotionFilter filter(options, 10);
+  BOOST_CHECK(!filter.Filter(1, CreateMotion(0, 0)));
+  BOOST_CHECK(!filter.Filter(1, CreateMotion(0.5, 0.01)));
+  BOOST_CHECK(filter.Filter(1, CreateMotion(10, 0)));
+  BOOST_CHECK(filter.Filter(1, CreateMotion(0, 1)));
+  BOOST_CHECK_EQUAL(filter.NumAccepted(), 2);
+  BOOST_CHECK_EQUAL(filter.NumRejectedIdentity(), 2);
+  BOOST_CHECK_EQUAL(filter.NumRejectedInconsistent(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestConsistency) {
+  TentativeMotionFilter::Options options;
+  options.num_estimates = 2;
+  TentativeMotionFilter filter(options, 10);
+
+  // The estimates of the take.
+  BOOST_CHECK(filter.Filter(1, CreateMotion(30, 2)));
+  BOOST_CHECK(filter.Filter(1, CreateMotion(31, 2.1)));
+
+  // Consistent with the estimates.
+  BOOST_CHECK(filter.Filter(1, CreateMotion(32, 2.5)));
+  BOOST_CHECK(!filter.Filter(1, CreateMotion(40, 2)));
+  BOOST_CHECK(!filter.Filter(1, CreateMotion(30, 5)));
+
+  // The other takes have their own estimates.
+  BOOST_CHECK(filter.Filter(2, CreateMotion(-60, 0)));
+
+  // Confirms a rejected motion.
+  BOOST_CHECK(filter.Filter(1, CreateMotion(41, 2.2)));
+  BOOST_CHECK(filter.Filter(1, CreateMotion(42, 2.4)));
+  BOOST_CHECK(!filter.Filter(1, CreateMotion(90, 0)));
+
+  BOOST_CHECK_EQUAL(filter.NumAccepted(), 6);
+  BOOST_CHECK_EQUAL(filter.NumRejectedIdentity(), 0);
+  BOOST_CHECK_EQUAL(filter.NumRejectedInconsistent(), 3);
+}
@@ -0,0 +1,464 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sfm/synthetic_scene.h"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <unordered_map>
+
+#include <Eigen/Geometry>
+
+#include "base/essential_matrix.h"
+#include "feature/utils.h"
+#include "util/logging.h"
+#include "util/math.h"
+#include "util/string.h"
+
+namespace colmap {
+namespace {
+
+// Standard deviation of the noise of the descriptors of the observations.
+const float kDescriptorStddev = 0.02f;
+
+// Rotation from the world to the frame of a camera at `center`, which looks at
+// the origin with the y-axis pointing down.
+Eigen::Matrix3d LookAtOrigin(const Eigen::Vector3d& center) {
+  const Eigen::Vector3d z = -center.normalized();
+  const Eigen::Vector3d x = z.cross(Eigen::Vector3d::UnitZ()).normalized();
+  const Eigen::Vector3d y = z.cross(x);
+  Eigen::Matrix3d R;
+  R.row(0) = x;
+  R.row(1) = y;
+  R.row(2) = z;
+  return R;
+}
+
+Eigen::Matrix3d RandomRotation(const double max_angle, std::mt19937* rng) {
+  std::uniform_real_distribution<double> angle_distribution(-max_angle,
+                                                            max_angle);
+  std::normal_distribution<double> axis_distribution;
+  Eigen::Vector3d axis(axis_distribution(*rng), axis_distribution(*rng),
+                       axis_distribution(*rng));
+  return Eigen::AngleAxisd(angle_distribution(*rng), axis.normalized())
+      .toRotationMatrix();
+}
+
+Eigen::Vector3d RandomPoint(const Eigen::Vector3d& center, const double radius,
+                            std::mt19937* rng) {
+  std::uniform_real_distribution<double> distribution(-radius, radius);
+  return center + Eigen::Vector3d(distribution(*rng), distribution(*rng),
+                                  distribution(*rng));
+}
+
+Eigen::Vector3d RandomNormal(std::mt19937* rng) {
+  std::uniform_real_distribution<double> angle_distribution(-M_PI, M_PI);
+  const double angle = angle_distribution(*rng);
+  return Eigen::Vector3d(std::cos(angle), std::sin(angle), 0);
+}
+
+// Project the point into the image and return whether it is visible, i.e. in
+// front of the camera, within the image and within the viewing angle of its
+// normal.
+bool ProjectPoint(const img_s& image, const Eigen::Vector3d& point3D,
+                  const Eigen::Vector3d& normal,
+                  const double min_cos_viewing_angle,
+                  Eigen::Vector2d* point2D) {
+  const Eigen::Vector3d point_camera = image.R * (point3D - image.c);
+  if (point_camera.z() <= 0) {
+    return false;
+  }
+  if (normal.dot((image.c - point3D).normalized()) < min_cos_viewing_angle) {
+    return false;
+  }
+  *point2D = image.f * point_camera.hnormalized() +
+             Eigen::Vector2d(image.px, image.py);
+  return point2D->x() >= 0 && point2D->y() >= 0 &&
+         point2D->x() < image.size_x && point2D->y() < image.size_y;
+}
+
+pnts_s CreatePoints(const std::vector<Eigen::Vector3d>& points) {
+  pnts_s pnts;
+  pnts.points = points;
+  pnts.color.resize(points.size(), Eigen::Vector3ub::Zero());
+  pnts.ID.resize(points.size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    pnts.ID[i] = static_cast<int>(i);
+  }
+  pnts.ID_map = IdIndexMap(pnts.ID);
+  return pnts;
+}
+
+Eigen::Matrix3d CalibrationMatrix(const img_s& image) {
+  Eigen::Matrix3d K = Eigen::Matrix3d::Identity();
+  K(0, 0) = image.f;
+  K(1, 1) = image.f;
+  K(0, 2) = image.px;
+  K(1, 2) = image.py;
+  return K;
+}
+
+// Calibrated geometry of the background between two images without matches.
+TwoViewGeometry SyntheticTwoViewGeometry(const img_s& image1,
+                                         const img_s& image2) {
+  TwoViewGeometry two_view_geometry;
+  two_view_geometry.config = image1.take == image2.take
+                                 ? TwoViewGeometry::CALIBRATED
+                                 : TwoViewGeometry::MULTIPLE;
+  const Eigen::Matrix3d R = image2.R * image1.R.transpose();
+  const Eigen::Vector3d t = image2.R * (image1.c - image2.c);
+  two_view_geometry.E = EssentialMatrixFromPose(R, t);
+  two_view_geometry.F = CalibrationMatrix(image2).inverse().transpose() *
+                        two_view_geometry.E *
+                        CalibrationMatrix(image1).inverse();
+  return two_view_geometry;
+}
+
+}  // namespace
+
+bool SyntheticSceneOptions::Check() const {
+  CHECK_OPTION_GT(num_takes, 0);
+  CHECK_OPTION_GT(num_images_per_take, 0);
+  CHECK_OPTION_GE(num_background_points, 0);
+  CHECK_OPTION_GE(num_object_points, 0);
+  CHECK_OPTION_GT(max_viewing_angle, 0);
+  CHECK_OPTION_GE(point2D_stddev, 0);
+  CHECK_OPTION_GE(feature_outlier_ratio, 0);
+  CHECK_OPTION_GE(match_outlier_ratio, 0);
+  CHECK_OPTION_GE(num_overlapping_images, 0);
+  CHECK_OPTION_GT(width, 0);
+  CHECK_OPTION_GT(height, 0);
+  CHECK_OPTION_GT(focal_length, 0);
+  return true;
+}
+
+SyntheticSceneOptions ScaledSyntheticSceneOptions(
+    const int num_images_per_take) {
+  SyntheticSceneOptions options;
+  options.num_images_per_take = num_images_per_take;
+  options.num_background_points = 100 * num_images_per_take;
+  options.num_object_points = 50 * num_images_per_take;
+  return options;
+}
+
+SyntheticScene GenerateSyntheticScene(const SyntheticSceneOptions& options) {
+  CHECK(options.Check());
+
+  std::mt19937 rng(options.seed);
+
+  SyntheticScene scene;
+  scene.options = options;
+
+  // The background surrounds the object, which lies close to the center.
+  std::vector<Eigen::Vector3d> background_normals;
+  scene.background_points.reserve(options.num_background_points);
+  background_normals.reserve(options.num_background_points);
+  for (int i = 0; i < options.num_background_points; ++i) {
+    scene.background_points.push_back(
+        RandomPoint(Eigen::Vector3d::Zero(), 2.5, &rng));
+    background_normals.push_back(RandomNormal(&rng));
+  }
+  std::vector<Eigen::Vector3d> object_normals;
+  scene.object_points.reserve(options.num_object_points);
+  object_normals.reserve(options.num_object_points);
+  for (int i = 0; i < options.num_object_points; ++i) {
+    scene.object_points.push_back(
+        RandomPoint(Eigen::Vector3d(0.5, 0, 0), 0.75, &rng));
+    object_normals.push_back(RandomNormal(&rng));
+  }
+
+  const double min_cos_viewing_angle =
+      std::cos(DegToRad(std::min(options.max_viewing_angle, 180.0)));
+
+  std::uniform_real_distribution<double> translation_distribution(-0.5, 0.5);
+  std::uniform_real_distribution<double> height_distribution(-1, 1);
+  std::uniform_real_distribution<double> x_distribution(0, options.width);
+  std::uniform_real_distribution<double> y_distribution(0, options.height);
+  std::normal_distribution<double> noise_distribution(0,
+                                                      options.point2D_stddev);
+
+  scene.images.reserve(options.num_takes * options.num_images_per_take);
+  for (int take = 0; take < options.num_takes; ++take) {
+    trans_s motion;
+    motion.s = 1;
+    if (take == 0) {
+      motion.R = Eigen::Matrix3d::Identity();
+      motion.o = Eigen::Vector3d::Zero();
+    } else {
+      motion.R = RandomRotation(DegToRad(20.0), &rng);
+      motion.o = Eigen::Vector3d(translation_distribution(rng),
+                                 translation_distribution(rng),
+                                 translation_distribution(rng));
+    }
+    scene.motions.push_back(motion);
+
+    std::vector<Eigen::Vector3d> moved_object_points;
+    std::vector<Eigen::Vector3d> moved_object_normals;
+    moved_object_points.reserve(scene.object_points.size());
+    moved_object_normals.reserve(scene.object_points.size());
+    for (size_t i = 0; i < scene.object_points.size(); ++i) {
+      moved_object_points.push_back(motion.R.transpose() *
+                                    (scene.object_points[i] - motion.o));
+      moved_object_normals.push_back(motion.R.transpose() * object_normals[i]);
+    }
+
+    // The cameras of a take span a quarter circle, which starts at a different
+    // angle in every take.
+    for (int i = 0; i < options.num_images_per_take; ++i) {
+      const double angle =
+          DegToRad(30.0 * take +
+                   90.0 * i / std::max(1, options.num_images_per_take - 1));
+      img_s image;
+      image.c = Eigen::Vector3d(8 * std::cos(angle), 8 * std::sin(angle),
+                                height_distribution(rng));
+      image.R = LookAtOrigin(image.c);
+      image.take = take + 1;
+      image.f = options.focal_length;
+      image.px = options.width / 2.0;
+      image.py = options.height / 2.0;
+      image.size_x = options.width;
+      image.size_y = options.height;
+
+      Eigen::Vector2d point2D;
+      for (size_t j = 0; j < scene.background_points.size(); ++j) {
+        if (ProjectPoint(image, scene.background_points[j],
+                         background_normals[j], min_cos_viewing_angle,
+                         &point2D)) {
+          image.features.emplace_back(point2D.x() + noise_distribution(rng),
+                                      point2D.y() + noise_distribution(rng));
+          image.b_obs.push_back(static_cast<int>(j));
+          image.o_obs.push_back(-1);
+        }
+      }
+      for (size_t j = 0; j < moved_object_points.size(); ++j) {
+        if (ProjectPoint(image, moved_object_points[j],
+                         moved_object_normals[j], min_cos_viewing_angle,
+                         &point2D)) {
+          image.features.emplace_back(point2D.x() + noise_distribution(rng),
+                                      point2D.y() + noise_distribution(rng));
+          image.b_obs.push_back(-1);
+          image.o_obs.push_back(static_cast<int>(j));
+        }
+      }
+
+      const size_t num_outliers = static_cast<size_t>(
+          options.feature_outlier_ratio * image.features.size());
+      for (size_t j = 0; j < num_outliers; ++j) {
+        image.features.emplace_back(x_distribution(rng), y_distribution(rng));
+        image.b_obs.push_back(-1);
+        image.o_obs.push_back(-1);
+      }
+      image.u_obs.resize(image.features.size(), -1);
+
+      scene.images.push_back(image);
+    }
+  }
+
+  return scene;
+}
+
+std::string SyntheticImageName(const SyntheticScene& scene,
+                               const size_t image_idx) {
+  return StringPrintf("%d/image%06d.jpg", scene.images.at(image_idx).take,
+                      static_cast<int>(image_idx));
+}
+
+void WriteSyntheticDatabase(const SyntheticScene& scene, Database* database) {
+  const int num_background_points =
+      static_cast<int>(scene.background_points.size());
+  const int num_points =
+      num_background_points + static_cast<int>(scene.object_points.size());
+
+  std::mt19937 rng(scene.options.seed);
+  std::uniform_real_distribution<float> descriptor_distribution(0, 1);
+  std::normal_distribution<float> descriptor_noise_distribution(
+      0, kDescriptorStddev);
+
+  // Descriptors of the points, where the object points follow the background
+  // points, of which the descriptors of the observations are noisy copies.
+  Eigen::MatrixXf point_descriptors(num_points, 128);
+  for (Eigen::MatrixXf::Index i = 0; i < point_descriptors.size(); ++i) {
+    point_descriptors(i) = descriptor_distribution(rng);
+  }
+
+  DatabaseTransaction database_transaction(database);
+
+  // The point of every feature, or -1 for outliers, and the feature of every
+  // point of every image.
+  std::vector<std::vector<int>> feature_points(scene.images.size());
+  std::vector<std::unordered_map<int, point2D_t>> point_features(
+      scene.images.size());
+
+  for (size_t i = 0; i < scene.images.size(); ++i) {
+    const img_s& image = scene.images[i];
+
+    Camera camera;
+    camera.InitializeWithName("SIMPLE_RADIAL", image.f, image.size_x,
+                              image.size_y);
+    camera.SetPriorFocalLength(true);
+    const camera_t camera_id = database->WriteCamera(camera);
+
+    Image db_image;
+    db_image.SetName(SyntheticImageName(scene, i));
+    db_image.SetCameraId(camera_id);
+    const image_t image_id = database->WriteImage(db_image);
+    CHECK_EQ(image_id, i + 1);
+
+    FeatureKeypoints keypoints;
+    keypoints.reserve(image.features.size());
+    Eigen::MatrixXf descriptors(image.features.size(), 128);
+    feature_points[i].reserve(image.features.size());
+    for (size_t j = 0; j < image.features.size(); ++j) {
+      keypoints.emplace_back(image.features[j].x(), image.features[j].y());
+      int point_id = -1;
+      if (image.b_obs[j] >= 0) {
+        point_id = image.b_obs[j];
+      } else if (image.o_obs[j] >= 0) {
+        point_id = num_background_points + image.o_obs[j];
+      }
+      feature_points[i].push_back(point_id);
+      if (point_id >= 0) {
+        point_features[i].emplace(point_id, static_cast<point2D_t>(j));
+        for (int k = 0; k < 128; ++k) {
+          const float noise = descriptor_noise_distribution(rng);
+          descriptors(j, k) =
+              std::max(0.0f, point_descriptors(point_id, k) + noise);
+        }
+      } else {
+        for (int k = 0; k < 128; ++k) {
+          descriptors(j, k) = descriptor_distribution(rng);
+        }
+      }
+    }
+    database->WriteKeypoints(image_id, keypoints);
+    database->WriteDescriptors(
+        image_id, FeatureDescriptorsToUnsignedByte(
+                      L2NormalizeFeatureDescriptors(descriptors)));
+  }
+
+  for (size_t i = 0; i < scene.images.size(); ++i) {
+    const size_t end = std::min(
+        scene.images.size(),
+        i + 1 + static_cast<size_t>(scene.options.num_overlapping_images));
+    for (size_t k = i + 1; k < end; ++k) {
+      TwoViewGeometry two_view_geometry =
+          SyntheticTwoViewGeometry(scene.images[i], scene.images[k]);
+      for (size_t j = 0; j < feature_points[i].size(); ++j) {
+        if (feature_points[i][j] < 0) {
+          continue;
+        }
+        const auto feature = point_features[k].find(feature_points[i][j]);
+        if (feature != point_features[k].end()) {
+          FeatureMatch match;
+          match.point2D_idx1 = static_cast<point2D_t>(j);
+          match.point2D_idx2 = feature->second;
+          two_view_geometry.inlier_matches.push_back(match);
+        }
+      }
+
+      if (two_view_geometry.inlier_matches.empty()) {
+        continue;
+      }
+
+      FeatureMatches matches = two_view_geometry.inlier_matches;
+      const size_t num_outliers =
+          static_cast<size_t>(scene.options.match_outlier_ratio *
+                              two_view_geometry.inlier_matches.size());
+      std::uniform_int_distribution<point2D_t> feature_distribution1(
+          0, static_cast<point2D_t>(feature_points[i].size() - 1));
+      std::uniform_int_distribution<point2D_t> feature_distribution2(
+          0, static_cast<point2D_t>(feature_points[k].size() - 1));
+      for (size_t j = 0; j < num_outliers; ++j) {
+        FeatureMatch match;
+        match.point2D_idx1 = feature_distribution1(rng);
+        match.point2D_idx2 = feature_distribution2(rng);
+        const int point_id = feature_points[i][match.point2D_idx1];
+        if (point_id < 0 || point_id != feature_points[k][match.point2D_idx2]) {
+          matches.push_back(match);
+        }
+      }
+
+      database->WriteMatches(i + 1, k + 1, matches);
+      database->WriteInlierMatches(i + 1, k + 1, two_view_geometry);
+    }
+  }
+}
+
+void WriteSyntheticTakeMap(const SyntheticScene& scene, const std::string& path) {
+  std::ofstream file(path, std::ios::trunc);
+  CHECK(file.is_open()) << path;
+  for (size_t i = 0; i < scene.images.size(); ++i) {
+    file << SyntheticImageName(scene, i) << " " << scene.images[i].take
+         << "\n";
+  }
+}
+
+std::pair<pnts_s, pnts_s> SyntheticScenePoints(const SyntheticScene& scene) {
+  return std::make_pair(CreatePoints(scene.background_points),
+                        CreatePoints(scene.object_points));
+}
+
+SyntheticTakes GenerateSyntheticTakes(const SyntheticScene& scene,
+                                      const unsigned int seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> scale_distribution(0.5, 2);
+  std::uniform_real_distribution<double> translation_distribution(-5, 5);
+
+  const int num_background_points =
+      static_cast<int>(scene.background_points.size());
+  const int num_points =
+      num_background_points + static_cast<int>(scene.object_points.size());
+
+  SyntheticTakes takes;
+  for (size_t take = 0; take < scene.motions.size(); ++take) {
+    const double scale = scale_distribution(rng);
+    const Eigen::Matrix3d R = RandomRotation(M_PI, &rng);
+    const Eigen::Vector3d t(translation_distribution(rng),
+                            translation_distribution(rng),
+                            translation_distribution(rng));
+    const trans_s& motion = scene.motions[take];
+
+    std::vector<Eigen::Vector3d> points;
+    points.reserve(num_points);
+    for (const auto& point : scene.background_points) {
+      points.push_back(scale * R * point + t);
+    }
+    for (const auto& point : scene.object_points) {
+      points.push_back(scale * R * (motion.R.transpose() * (point - motion.o)) +
+                       t);
+    }
+    takes.points.push_back(CreatePoints(points));
+    takes.order.push_back(static_cast<int>(take));
+  }
+
+  // Every point is reconstructed in every take with its track as identifier.
+  takes.tracks.resize(num_points);
+  for (int i = 0; i < num_points; ++i) {
+    for (size_t take = 0; take < scene.motions.size(); ++take) {
+      takes.tracks[i].emplace_back(static_cast<int>(take) + 1, i);
+    }
+    if (i < num_background_points) {
+      takes.body_tracks.first.push_back(i);
+    } else {
+      takes.body_tracks.second.push_back(i);
+    }
+  }
+
+  return takes;
+}
+
+}  // namespace colmap
@@ -0,0 +1,127 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_SFM_SYNTHETIC_SCENE_H_
+#define COLMAP_SRC_SFM_SYNTHETIC_SCENE_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "base/database.h"
+#include "sfm/incremental_mapper.h"
+
+namespace colmap {
+
+// Deterministic synthetic two-body scenes for benchmarks and scale tests. The
+// same options produce the same scene in every run with the same standard
+// library.
+
+struct SyntheticSceneOptions {
+  // The object is static within a take and moves rigidly between takes.
+  int num_takes = 2;
+  int num_images_per_take = 10;
+
+  int num_background_points = 1000;
+  int num_object_points = 500;
+
+  // Every point has a random horizontal normal and is only seen by cameras
+  // within this angle of its normal in degrees, so that the number of
+  // observations does not grow with the product of images and points.
+  double max_viewing_angle = 180.0;
+
+  // Standard deviation of the Gaussian noise of the image points in pixels.
+  double point2D_stddev = 0.5;
+
+  // Number of random features of every image that observe no point, relative
+  // to the number of its observations.
+  double feature_outlier_ratio = 0.0;
+
+  // Number of wrong matches of every image pair, relative to the number of its
+  // correct matches. The wrong matches are not part of the inlier matches.
+  double match_outlier_ratio = 0.0;
+
+  // Every image is matched with this number of its successors.
+  int num_overlapping_images = 10;
+
+  int width = 1024;
+  int height = 768;
+  double focal_length = 1000;
+
+  unsigned int seed = 0;
+
+  bool Check() const;
+};
+
+// A two-body scene of a static background and an object, whose points are
+// given in the frame of the first take. The cameras of every take lie on an
+// arc around the scene and look at its center. The images use the layout of
+// the postprocessor, i.e. the point of every feature is stored in `b_obs` or
+// `o_obs`, both are -1 for outlier features, and the takes start at 1.
+struct SyntheticScene {
+  SyntheticSceneOptions options;
+  std::vector<Eigen::Vector3d> background_points;
+  std::vector<Eigen::Vector3d> object_points;
+  // The motion of the object in every take, which maps a point X of the first
+  // take to R^T (X - o). The motion of the first take is the identity.
+  std::vector<trans_s> motions;
+  std::vector<img_s> images;
+};
+
+// Options of a scene with the given number of images per take, whose number
+// of points grows with the number of images.
+SyntheticSceneOptions ScaledSyntheticSceneOptions(
+    const int num_images_per_take);
+
+SyntheticScene GenerateSyntheticScene(const SyntheticSceneOptions& options);
+
+// Name of an image in the layout of the preprocessor, i.e. TAKE/imageN.jpg.
+std::string SyntheticImageName(const SyntheticScene& scene,
+                               const size_t image_idx);
+
+// Write the cameras, images, keypoints, descriptors, matches and two-view
+// geometries of the scene into the database. The descriptors of the
+// observations of a point are noisy copies of the same random descriptor. The
+// image identifiers are the indices of the images plus one.
+void WriteSyntheticDatabase(const SyntheticScene& scene, Database* database);
+
+// Write the take of every image in the format of takes.txt.
+void WriteSyntheticTakeMap(const SyntheticScene& scene, const std::string& path);
+
+// Points of the scene in the format of the postprocessor, where the identifier
+// of every point is its index.
+std::pair<pnts_s, pnts_s> SyntheticScenePoints(const SyntheticScene& scene);
+
+// Independent reconstructions of every take of the scene as input to
+// `merge_reconstructions`, each in its own random similarity frame.
+struct SyntheticTakes {
+  std::vector<pnts_s> points;
+  // The tracks of the points across the takes as pairs of take and point
+  // identifier, where the takes start at 1.
+  std::vector<std::vector<std::pair<int, int>>> tracks;
+  // The tracks of the background and of the object.
+  std::pair<std::vector<int>, std::vector<int>> body_tracks;
+  std::vector<int> order;
+};
+
+SyntheticTakes GenerateSyntheticTakes(const SyntheticScene& scene,
+                                      const unsigned int seed);
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_SFM_SYNTHETIC_SCENE_H_
@@ -0,0 +1,250 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "sfm/track_builder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <limits>
+#include <memory>
+
+#include "util/endian.h"
+#include "util/logging.h"
+#include "util/threading.h"
+
+namespace colmap {
+namespace {
+
+// Binary tracks files start with a magic string and a version.
+const char kTracksMagic[8] = {'T', 'B', 'S', 'F', 'M', 'T', 'R', '\0'};
+const uint32_t kTracksVersion = 1;
+
+// The number of images whose points are merged by one task.
+const int kNumImagesPerTask = 4;
+
+const uint32_t kInvalidIdx = std::numeric_limits<uint32_t>::max();
+
+// Union-find over the points, which can be merged concurrently. A set is
+// always linked below the root with the smaller index, such that the root of
+// a set is its smallest point regardless of the order of the merges.
+class ConcurrentUnionFind {
+ public:
+  explicit ConcurrentUnionFind(const uint32_t num_elems)
+      : parents_(new std::atomic<uint32_t>[num_elems]) {
+    for (uint32_t i = 0; i < num_elems; ++i) {
+      parents_[i].store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Find the root with path halving. Concurrent merges only link roots, so
+  // that the parent of a non-root can only be shortcut to one of its
+  // ancestors.
+  uint32_t Find(uint32_t elem) {
+    uint32_t parent = parents_[elem].load(std::memory_order_relaxed);
+    while (parent != elem) {
+      const uint32_t grandparent =
+          parents_[parent].load(std::memory_order_relaxed);
+      if (grandparent != parent) {
+        parents_[elem].store(grandparent, std::memory_order_relaxed);
+      }
+      elem = parent;
+      parent = grandparent;
+    }
+    return elem;
+  }
+
+  void Union(uint32_t elem1, uint32_t elem2) {
+    while (true) {
+      elem1 = Find(elem1);
+      elem2 = Find(elem2);
+      if (elem1 == elem2) {
+        return;
+      }
+      if (elem1 < elem2) {
+        std::swap(elem1, elem2);
+      }
+      // Link the larger root, unless it was linked by another thread.
+      uint32_t expected = elem1;
+      if (parents_[elem1].compare_exchange_weak(expected, elem2,
+                                                std::memory_order_relaxed)) {
+        return;
+      }
+    }
+  }
+
+ private:
+  std::unique_ptr<std::atomic<uint32_t>[]> parents_;
+};
+
+// Call func(i) for the images i in [0, num_images), in parallel unless a
+// single thread is requested.
+template <typename func_t>
+void ForEachImage(const int num_images, const func_t& func,
+                  const int num_threads) {
+  if (GetEffectiveNumThreads(num_threads) == 1) {
+    for (int i = 0; i < num_images; ++i) {
+      func(i);
+    }
+  } else {
+    ParallelFor(0, num_images, func, kNumImagesPerTask);
+  }
+}
+
+}  // namespace
+
+std::vector<Track> BuildTracks(const SceneGraph& scene_graph,
+                               const std::vector<image_t>& image_ids,
+                               const int num_threads) {
+  // Number the points of all images in a flat array. Querying the images
+  // also compacts pending correspondences before the concurrent queries.
+  std::vector<image_t> sorted_image_ids;
+  for (const image_t image_id : image_ids) {
+    if (scene_graph.ExistsImage(image_id)) {
+      sorted_image_ids.push_back(image_id);
+    }
+  }
+  std::sort(sorted_image_ids.begin(), sorted_image_ids.end());
+  sorted_image_ids.erase(
+      std::unique(sorted_image_ids.begin(), sorted_image_ids.end()),
+      sorted_image_ids.end());
+
+  const int num_images = static_cast<int>(sorted_image_ids.size());
+  std::vector<uint32_t> image_offsets(num_images + 1, 0);
+  for (int i = 0; i < num_images; ++i) {
+    const uint64_t offset =
+        static_cast<uint64_t>(image_offsets[i]) +
+        scene_graph.NumPoints2DForImage(sorted_image_ids[i]);
+    CHECK_LT(offset, kInvalidIdx) << "Too many image points";
+    image_offsets[i + 1] = static_cast<uint32_t>(offset);
+  }
+  const uint32_t num_points = image_offsets.back();
+
+  // The offsets of the images by identifier, for the correspondences.
+  const image_t max_image_id =
+      sorted_image_ids.empty() ? 0 : sorted_image_ids.back();
+  std::vector<uint32_t> image_id_offsets(max_image_id + 1, kInvalidIdx);
+  for (int i = 0; i < num_images; ++i) {
+    image_id_offsets[sorted_image_ids[i]] = image_offsets[i];
+  }
+
+  // Merge the corresponding points, every correspondence from the point with
+  // the smaller index.
+  ConcurrentUnionFind sets(num_points);
+  ForEachImage(
+      num_images,
+      [&](const int i) {
+        const image_t image_id = sorted_image_ids[i];
+        for (uint32_t point_idx = image_offsets[i];
+             point_idx < image_offsets[i + 1]; ++point_idx) {
+          const point2D_t point2D_idx = point_idx - image_offsets[i];
+          for (const SceneGraph::Correspondence& corr :
+               scene_graph.FindCorrespondences(image_id, point2D_idx)) {
+            if (corr.image_id > max_image_id ||
+                image_id_offsets[corr.image_id] == kInvalidIdx) {
+              continue;
+            }
+            const uint32_t corr_point_idx =
+                image_id_offsets[corr.image_id] + corr.point2D_idx;
+            if (corr_point_idx > point_idx) {
+              sets.Union(point_idx, corr_point_idx);
+            }
+          }
+        }
+      },
+      num_threads);
+
+  // Find the roots of all points, which are final after the merges.
+  std::vector<uint32_t> roots(num_points);
+  ForEachImage(num_images,
+               [&](const int i) {
+                 for (uint32_t point_idx = image_offsets[i];
+                      point_idx < image_offsets[i + 1]; ++point_idx) {
+                   roots[point_idx] = sets.Find(point_idx);
+                 }
+               },
+               num_threads);
+
+  // Number the sets of at least two points in the order of their roots, which
+  // are their first points.
+  std::vector<uint32_t> track_idxs(num_points, 0);
+  for (uint32_t point_idx = 0; point_idx < num_points; ++point_idx) {
+    ++track_idxs[roots[point_idx]];
+  }
+  std::vector<Track> tracks;
+  for (uint32_t point_idx = 0; point_idx < num_points; ++point_idx) {
+    if (track_idxs[point_idx] > 1) {
+      tracks.emplace_back();
+      tracks.back().Reserve(track_idxs[point_idx]);
+      track_idxs[point_idx] = static_cast<uint32_t>(tracks.size() - 1);
+    } else {
+      track_idxs[point_idx] = kInvalidIdx;
+    }
+  }
+
+  for (int i = 0; i < num_images; ++i) {
+    for (uint32_t point_idx = image_offsets[i];
+         point_idx < image_offsets[i + 1]; ++point_idx) {
+      const uint32_t track_idx = track_idxs[roots[point_idx]];
+      if (track_idx != kInvalidIdx) {
+        tracks[track_idx].AddElement(sorted_image_ids[i],
+                                     point_idx - image_offsets[i]);
+      }
+    }
+  }
+
+  return tracks;
+}
+
+void WriteTracksBinary(const std::string& path,
+                       const std::vector<Track>& tracks) {
+  std::ofstream file(path, std::ios::trunc | std::ios::binary);
+  CHECK(file.is_open()) << path;
+  file.write(kTracksMagic, sizeof(kTracksMagic));
+  WriteBinaryLittleEndian<uint32_t>(&file, kTracksVersion);
+  WriteBinaryLittleEndian<uint64_t>(&file, tracks.size());
+  for (const Track& track : tracks) {
+    WriteBinaryLittleEndian<uint32_t>(&file, track.Length());
+    for (const TrackElement& element : track.Elements()) {
+      WriteBinaryLittleEndian<image_t>(&file, element.image_id);
+      WriteBinaryLittleEndian<point2D_t>(&file, element.point2D_idx);
+    }
+  }
+  CHECK(file) << path;
+}
+
+std::vector<Track> ReadTracksBinary(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  CHECK(file.is_open()) << path;
+  char magic[sizeof(kTracksMagic)];
+  file.read(magic, sizeof(magic));
+  CHECK(file && std::equal(magic, magic + sizeof(magic), kTracksMagic))
+      << path << " is not a tracks file";
+  CHECK_EQ(ReadBinaryLittleEndian<uint32_t>(&file), kTracksVersion) << path;
+  std::vector<Track> tracks(ReadBinaryLittleEndian<uint64_t>(&file));
+  for (Track& track : tracks) {
+    const uint32_t length = ReadBinaryLittleEndian<uint32_t>(&file);
+    track.Reserve(length);
+    for (uint32_t i = 0; i < length; ++i) {
+      const image_t image_id = ReadBinaryLittleEndian<image_t>(&file);
+      const point2D_t point2D_idx = ReadBinaryLittleEndian<point2D_t>(&file);
+      track.AddElement(image_id, point2D_idx);
+    }
+  }
+  CHECK(file) << path << " is truncated";
+  return tracks;
+}
+
+}  // namespace colmap
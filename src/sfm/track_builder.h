@@ -0,0 +1,49 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef COLMAP_SRC_SFM_TRACK_BUILDER_H_
+#define COLMAP_SRC_SFM_TRACK_BUILDER_H_
+
+#include <string>
+#include <vector>
+
+#include "base/scene_graph.h"
+#include "base/track.h"
+#include "util/types.h"
+
+namespace colmap {
+
+// The name of the tracks file in the folder of the anchor take.
+const std::string kTracksFileName = "tracks.bin";
+
+// Find the feature tracks of the given images, i.e. the sets of at least two
+// image points that are transitively connected by the correspondences between
+// the images. The points are merged by a concurrent union-find over a flat
+// array of all image points, in parallel over ranges of the images. The tracks
+// are ordered by their first point and their points by image identifier and
+// point index, which does not depend on the number of threads. Images that are
+// not in the scene graph are ignored.
+std::vector<Track> BuildTracks(const SceneGraph& scene_graph,
+                               const std::vector<image_t>& image_ids,
+                               const int num_threads = -1);
+
+// Write and read the tracks in a binary file.
+void WriteTracksBinary(const std::string& path,
+                       const std::vector<Track>& tracks);
+std::vector<Track> ReadTracksBinary(const std::string& path);
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_SFM_TRACK_BUILDER_H_
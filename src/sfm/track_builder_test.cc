@@ -0,0 +1,164 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#define TEST_NAME "sfm/track_builder"
+#include "util/testing.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include <boost/filesystem.hpp>
+
+#include "sfm/track_builder.h"
+#include "util/random.h"
+
+using namespace colmap;
+
+namespace {
+
+typedef std::vector<std::pair<image_t, point2D_t>> TrackPointsType;
+
+TrackPointsType TrackPoints(const Track& track) {
+  TrackPointsType points;
+  for (const TrackElement& element : track.Elements()) {
+    points.emplace_back(element.image_id, element.point2D_idx);
+  }
+  return points;
+}
+
+TrackPointsType TrackPoints(const TrackPointsType& points) { return points; }
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestEmpty) {
+  SceneGraph scene_graph;
+  BOOST_CHECK_EQUAL(BuildTracks(scene_graph, {}).size(), 0);
+  BOOST_CHECK_EQUAL(BuildTracks(scene_graph, {1, 2}).size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestTransitive) {
+  SceneGraph scene_graph;
+  scene_graph.AddImage(1, 4);
+  scene_graph.AddImage(2, 4);
+  scene_graph.AddImage(3, 4);
+  FeatureMatches matches12(2);
+  matches12[0].point2D_idx1 = 0;
+  matches12[0].point2D_idx2 = 1;
+  matches12[1].point2D_idx1 = 2;
+  matches12[1].point2D_idx2 = 3;
+  scene_graph.AddCorrespondences(1, 2, matches12);
+  FeatureMatches matches23(2);
+  matches23[0].point2D_idx1 = 1;
+  matches23[0].point2D_idx2 = 2;
+  matches23[1].point2D_idx1 = 0;
+  matches23[1].point2D_idx2 = 0;
+  scene_graph.AddCorrespondences(2, 3, matches23);
+  scene_graph.Finalize();
+
+  const std::vector<Track> tracks = BuildTracks(scene_graph, {3, 2, 1});
+  BOOST_CHECK_EQUAL(tracks.size(), 3);
+  BOOST_CHECK(TrackPoints(tracks[0]) == TrackPoints({{1, 0}, {2, 1}, {3, 2}}));
+  BOOST_CHECK(TrackPoints(tracks[1]) == TrackPoints({{1, 2}, {2, 3}}));
+  BOOST_CHECK(TrackPoints(tracks[2]) == TrackPoints({{2, 0}, {3, 0}}));
+
+  // The correspondences to other images are ignored.
+  const std::vector<Track> tracks13 = BuildTracks(scene_graph, {1, 3});
+  BOOST_CHECK_EQUAL(tracks13.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestRandom) {
+  SetPRNGSeed(0);
+  const int kNumImages = 20;
+  const int kNumPoints2D = 200;
+  SceneGraph scene_graph;
+  for (int i = 1; i <= kNumImages; ++i) {
+    scene_graph.AddImage(i, kNumPoints2D);
+  }
+  for (int i = 1; i <= kNumImages; ++i) {
+    for (int j = i + 1; j <= std::min(i + 3, kNumImages); ++j) {
+      std::vector<point2D_t> points2D1(kNumPoints2D);
+      std::iota(points2D1.begin(), points2D1.end(), 0);
+      std::vector<point2D_t> points2D2 = points2D1;
+      Shuffle(kNumPoints2D, &points2D1);
+      Shuffle(kNumPoints2D, &points2D2);
+      FeatureMatches matches(kNumPoints2D / 10);
+      for (size_t k = 0; k < matches.size(); ++k) {
+        matches[k].point2D_idx1 = points2D1[k];
+        matches[k].point2D_idx2 = points2D2[k];
+      }
+      scene_graph.AddCorrespondences(i, j, matches);
+    }
+  }
+  scene_graph.Finalize();
+
+  std::vector<image_t> image_ids;
+  for (int i = 1; i <= kNumImages; ++i) {
+    image_ids.push_back(i);
+  }
+  const std::vector<Track> tracks = BuildTracks(scene_graph, image_ids, 1);
+  const std::vector<Track> parallel_tracks =
+      BuildTracks(scene_graph, image_ids, 4);
+  BOOST_CHECK_EQUAL(parallel_tracks.size(), tracks.size());
+  for (size_t i = 0; i < std::min(tracks.size(), parallel_tracks.size());
+       ++i) {
+    BOOST_CHECK(TrackPoints(parallel_tracks[i]) == TrackPoints(tracks[i]));
+  }
+
+  // Every track is the transitive closure of its first point.
+  size_t num_points = 0;
+  for (const Track& track : tracks) {
+    BOOST_CHECK_GE(track.Length(), 2);
+    num_points += track.Length();
+    const TrackElement& element = track.Element(0);
+    std::vector<SceneGraph::Correspondence> corrs =
+        scene_graph.FindTransitiveCorrespondences(
+            element.image_id, element.point2D_idx,
+            kNumImages * kNumPoints2D);
+    TrackPointsType corr_points = {{element.image_id, element.point2D_idx}};
+    for (const SceneGraph::Correspondence& corr : corrs) {
+      corr_points.emplace_back(corr.image_id, corr.point2D_idx);
+    }
+    std::sort(corr_points.begin(), corr_points.end());
+    BOOST_CHECK(corr_points == TrackPoints(track));
+  }
+
+  size_t num_observations = 0;
+  for (int i = 1; i <= kNumImages; ++i) {
+    num_observations += scene_graph.NumObservationsForImage(i);
+  }
+  BOOST_CHECK_EQUAL(num_points, num_observations);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadWriteBinary) {
+  std::vector<Track> tracks(2);
+  tracks[0].AddElement(1, 2);
+  tracks[0].AddElement(3, 4);
+  tracks[1].AddElement(5, 6);
+  tracks[1].AddElement(7, 8);
+  tracks[1].AddElement(9, 10);
+
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("track_builder_test_%%%%%%%%.bin"))
+          .string();
+  WriteTracksBinary(path, tracks);
+  const std::vector<Track> read_tracks = ReadTracksBinary(path);
+  boost::filesystem::remove(path);
+
+  BOOST_CHECK_EQUAL(read_tracks.size(), tracks.size());
+  for (size_t i = 0; i < std::min(tracks.size(), read_tracks.size()); ++i) {
+    BOOST_CHECK(TrackPoints(read_tracks[i]) == TrackPoints(tracks[i]));
+  }
+}
@@ -0,0 +1,328 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "sfm/track_splitter.h"
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <numeric>
+
+#include <Eigen/Core>
+
+#include "util/kmeans.h"
+#include "util/logging.h"
+#include "util/symmetric_eigen.h"
+#include "util/threading.h"
+
+namespace colmap {
+namespace {
+
+typedef std::vector<std::pair<int, int>> Track;
+
+// The number of tracks that are split by one task. Most tracks are small, so
+// that a task per track would mostly schedule.
+const int kNumTracksPerTask = 16;
+
+class UnionFind {
+ public:
+  explicit UnionFind(const int num_elems) : parents_(num_elems) {
+    std::iota(parents_.begin(), parents_.end(), 0);
+  }
+
+  int Find(int elem) {
+    while (parents_[elem] != elem) {
+      parents_[elem] = parents_[parents_[elem]];
+      elem = parents_[elem];
+    }
+    return elem;
+  }
+
+  // Merge the sets with the given roots, the first one becomes the root.
+  void Union(const int root1, const int root2) { parents_[root2] = root1; }
+
+ private:
+  std::vector<int> parents_;
+};
+
+bool IsConsistent(const Track& track) {
+  std::vector<int> takes(track.size());
+  for (size_t i = 0; i < track.size(); ++i) {
+    takes[i] = track[i].first;
+  }
+  std::sort(takes.begin(), takes.end());
+  return std::adjacent_find(takes.begin(), takes.end()) == takes.end();
+}
+
+bool HaveCommonTake(const std::vector<int>& takes1,
+                    const std::vector<int>& takes2) {
+  auto it1 = takes1.begin();
+  auto it2 = takes2.begin();
+  while (it1 != takes1.end() && it2 != takes2.end()) {
+    if (*it1 < *it2) {
+      ++it1;
+    } else if (*it2 < *it1) {
+      ++it2;
+    } else {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Group the points by their labels in the order of the first point of every
+// group. The labels must be in [0, num_labels).
+std::vector<Track> GroupPoints(const Track& points,
+                               const std::vector<int>& labels,
+                               const int num_labels) {
+  std::vector<int> group_idxs(num_labels, -1);
+  std::vector<Track> groups;
+  for (size_t i = 0; i < points.size(); ++i) {
+    int& group_idx = group_idxs[labels[i]];
+    if (group_idx == -1) {
+      group_idx = static_cast<int>(groups.size());
+      groups.emplace_back();
+    }
+    groups[group_idx].push_back(points[i]);
+  }
+  return groups;
+}
+
+// Append the consistent tracks whole and the points of the inconsistent ones
+// as single points.
+void AppendConsistentTracks(const std::vector<Track>& tracks,
+                            std::vector<Track>* consistent_tracks) {
+  for (const Track& track : tracks) {
+    if (IsConsistent(track)) {
+      consistent_tracks->push_back(track);
+    } else {
+      for (const std::pair<int, int>& point : track) {
+        consistent_tracks->push_back(Track(1, point));
+      }
+    }
+  }
+}
+
+// Merge the points along the strongest edges first, unless the merged points
+// would contain a take twice. Returns false if a rejected edge is at least as
+// strong as a merged edge, such that the split is not a cut of the weak edges.
+bool SplitByStrongestEdges(const Track& points,
+                           const std::vector<graph_edge_s>& edges,
+                           std::vector<Track>* tracks) {
+  std::vector<int> edge_idxs(edges.size());
+  std::iota(edge_idxs.begin(), edge_idxs.end(), 0);
+  std::stable_sort(edge_idxs.begin(), edge_idxs.end(),
+                   [&edges](const int idx1, const int idx2) {
+                     return edges[idx1].strength > edges[idx2].strength;
+                   });
+
+  const int num_points = static_cast<int>(points.size());
+  UnionFind sets(num_points);
+  std::vector<std::vector<int>> takes(num_points);
+  for (int i = 0; i < num_points; ++i) {
+    takes[i].push_back(points[i].first);
+  }
+
+  // The edges are visited by decreasing strength, so that the split is a cut
+  // if no edge is merged after an edge was rejected and no rejected edge is as
+  // strong as the last merged one.
+  double min_merged_strength = std::numeric_limits<double>::infinity();
+  bool rejected = false;
+  for (const int edge_idx : edge_idxs) {
+    const graph_edge_s& edge = edges[edge_idx];
+    int root1 = sets.Find(edge.i);
+    int root2 = sets.Find(edge.j);
+    if (root1 == root2) {
+      continue;
+    }
+    if (HaveCommonTake(takes[root1], takes[root2])) {
+      if (edge.strength >= min_merged_strength) {
+        return false;
+      }
+      rejected = true;
+      continue;
+    }
+    if (rejected) {
+      return false;
+    }
+    if (takes[root1].size() < takes[root2].size()) {
+      std::swap(root1, root2);
+    }
+    std::vector<int> merged_takes;
+    merged_takes.reserve(takes[root1].size() + takes[root2].size());
+    std::merge(takes[root1].begin(), takes[root1].end(), takes[root2].begin(),
+               takes[root2].end(), std::back_inserter(merged_takes));
+    takes[root1].swap(merged_takes);
+    takes[root2].clear();
+    takes[root2].shrink_to_fit();
+    sets.Union(root1, root2);
+    min_merged_strength = std::min(min_merged_strength, edge.strength);
+  }
+
+  std::vector<int> labels(num_points);
+  for (int i = 0; i < num_points; ++i) {
+    labels[i] = sets.Find(i);
+  }
+  *tracks = GroupPoints(points, labels, num_points);
+  return true;
+}
+
+// Split the points by k-means clustering of the smallest eigenvectors of the
+// normalized Laplacian of their connected graph.
+std::vector<Track> SplitBySpectralClustering(
+    const TrackSplitterOptions& options, const Track& points,
+    const std::vector<graph_edge_s>& edges) {
+  const int num_points = static_cast<int>(points.size());
+  const int max_num_clusters =
+      std::min(num_points - 1, options.max_num_clusters);
+  std::vector<Track> tracks;
+  if (max_num_clusters < 2) {
+    AppendConsistentTracks({points}, &tracks);
+    return tracks;
+  }
+
+  Eigen::MatrixXd laplacian = Eigen::MatrixXd::Zero(num_points, num_points);
+  for (const graph_edge_s& edge : edges) {
+    laplacian(edge.i, edge.j) = -edge.strength;
+    laplacian(edge.i, edge.i) += edge.strength;
+  }
+  const Eigen::VectorXd inv_sqrt_degrees =
+      laplacian.diagonal().cwiseSqrt().cwiseInverse();
+  laplacian = inv_sqrt_degrees.asDiagonal() * laplacian *
+              inv_sqrt_degrees.asDiagonal();
+
+  Eigen::VectorXd eigenvalues;
+  Eigen::MatrixXd eigenvectors;
+  SmallestSymmetricEigenvectors(
+      laplacian, std::min(num_points, options.max_num_eigenvectors),
+      &eigenvalues, &eigenvectors);
+
+  for (int num_clusters = 2;; ++num_clusters) {
+    KMeansOptions kmeans_options;
+    kmeans_options.num_clusters = num_clusters;
+    kmeans_options.num_threads = 1;
+    const KMeansPointsd embedding = eigenvectors.leftCols(
+        std::min(num_clusters, static_cast<int>(eigenvectors.cols())));
+    const std::vector<Track> clusters = GroupPoints(
+        points, KMeans(kmeans_options, embedding), num_clusters);
+
+    int num_consistent = 0;
+    for (const Track& cluster : clusters) {
+      num_consistent += IsConsistent(cluster);
+    }
+    if (num_consistent == static_cast<int>(clusters.size()) ||
+        (num_consistent > 0 && num_clusters >= options.min_num_clusters) ||
+        num_clusters == max_num_clusters) {
+      AppendConsistentTracks(clusters, &tracks);
+      return tracks;
+    }
+  }
+}
+
+}  // namespace
+
+bool TrackSplitterOptions::Check() const {
+  CHECK_OPTION_GT(max_num_eigenvectors, 0);
+  CHECK_OPTION_GE(min_num_clusters, 2);
+  CHECK_OPTION_GE(max_num_clusters, min_num_clusters);
+  return true;
+}
+
+std::vector<std::vector<std::pair<int, int>>> SplitTrack(
+    const TrackSplitterOptions& options,
+    const std::vector<std::pair<int, int>>& points,
+    const std::vector<graph_edge_s>& edges) {
+  CHECK(options.Check());
+
+  // Find the connected components of the graph.
+  const int num_points = static_cast<int>(points.size());
+  UnionFind components(num_points);
+  for (const graph_edge_s& edge : edges) {
+    CHECK_GE(edge.i, 0);
+    CHECK_LT(edge.i, num_points);
+    CHECK_GE(edge.j, 0);
+    CHECK_LT(edge.j, num_points);
+    const int root1 = components.Find(edge.i);
+    const int root2 = components.Find(edge.j);
+    if (root1 != root2) {
+      components.Union(root1, root2);
+    }
+  }
+
+  // Number the points and edges within their components.
+  std::vector<int> component_idxs(num_points, -1);
+  std::vector<int> local_idxs(num_points);
+  std::vector<Track> component_points;
+  for (int i = 0; i < num_points; ++i) {
+    int& component_idx = component_idxs[components.Find(i)];
+    if (component_idx == -1) {
+      component_idx = static_cast<int>(component_points.size());
+      component_points.emplace_back();
+    }
+    local_idxs[i] = static_cast<int>(component_points[component_idx].size());
+    component_points[component_idx].push_back(points[i]);
+  }
+  std::vector<std::vector<graph_edge_s>> component_edges(
+      component_points.size());
+  for (const graph_edge_s& edge : edges) {
+    graph_edge_s local_edge = edge;
+    local_edge.i = local_idxs[edge.i];
+    local_edge.j = local_idxs[edge.j];
+    component_edges[component_idxs[components.Find(edge.i)]].push_back(
+        local_edge);
+  }
+
+  std::vector<Track> tracks;
+  for (size_t i = 0; i < component_points.size(); ++i) {
+    if (IsConsistent(component_points[i])) {
+      tracks.push_back(component_points[i]);
+      continue;
+    }
+    std::vector<Track> split_tracks;
+    if (!SplitByStrongestEdges(component_points[i], component_edges[i],
+                               &split_tracks)) {
+      split_tracks = SplitBySpectralClustering(options, component_points[i],
+                                               component_edges[i]);
+    }
+    tracks.insert(tracks.end(), split_tracks.begin(), split_tracks.end());
+  }
+
+  return tracks;
+}
+
+std::vector<std::vector<std::vector<std::pair<int, int>>>> SplitTracks(
+    const TrackSplitterOptions& options,
+    const std::vector<std::vector<std::pair<int, int>>>& points,
+    const std::vector<std::vector<graph_edge_s>>& edges) {
+  CHECK_EQ(points.size(), edges.size());
+
+  std::vector<std::vector<Track>> tracks(points.size());
+  const auto split = [&](const int i) {
+    tracks[i] = SplitTrack(options, points[i], edges[i]);
+  };
+
+  const int num_tracks = static_cast<int>(points.size());
+  if (GetEffectiveNumThreads(options.num_threads) == 1) {
+    for (int i = 0; i < num_tracks; ++i) {
+      split(i);
+    }
+  } else {
+    ParallelFor(0, num_tracks, split, kNumTracksPerTask);
+  }
+
+  return tracks;
+}
+
+}  // namespace colmap
@@ -0,0 +1,78 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef COLMAP_SRC_SFM_TRACK_SPLITTER_H_
+#define COLMAP_SRC_SFM_TRACK_SPLITTER_H_
+
+#include <utility>
+#include <vector>
+
+namespace colmap {
+
+//an edge of the observation graph of a track from its node i to its node j,
+//weighted by the number of images that observe both points
+typedef struct
+{
+	int i;
+	int j;
+	double strength;
+} graph_edge_s;
+
+struct TrackSplitterOptions {
+  // The maximum number of eigenvectors of the normalized graph Laplacian that
+  // embed the points for the spectral clustering.
+  int max_num_eigenvectors = 10;
+
+  // The spectral clustering stops at the first cluster count from this one on
+  // for which some clusters are consistent.
+  int min_num_clusters = 10;
+
+  // The maximum cluster count of the spectral clustering.
+  int max_num_clusters = 20;
+
+  // The number of threads for splitting multiple tracks.
+  int num_threads = -1;
+
+  bool Check() const;
+};
+
+// Split the track with the given points, as pairs of take and point id, and
+// observation graph, whose edges hold both directions, into tracks with at
+// most one point per take. The connected components of the graph are split
+// independently and the consistent ones are kept whole.
+//
+// An inconsistent component is first split by merging its points along the
+// strongest edges first, unless the merged points would contain a take twice.
+// If all rejected edges are weaker than all merged ones, the split is a cut of
+// the weak edges and it is kept. Otherwise, the component is split by k-means
+// clustering of the smallest eigenvectors of its normalized Laplacian with the
+// increasing cluster counts, until the clusters are consistent, some clusters
+// are consistent from the minimum count on, or the maximum count is reached.
+// The inconsistent clusters of the last count are split into single points.
+std::vector<std::vector<std::pair<int, int>>> SplitTrack(
+    const TrackSplitterOptions& options,
+    const std::vector<std::pair<int, int>>& points,
+    const std::vector<graph_edge_s>& edges);
+
+// Split the tracks in parallel. The split tracks are returned in the order of
+// the input tracks, which do not depend on the number of threads.
+std::vector<std::vector<std::vector<std::pair<int, int>>>> SplitTracks(
+    const TrackSplitterOptions& options,
+    const std::vector<std::vector<std::pair<int, int>>>& points,
+    const std::vector<std::vector<graph_edge_s>>& edges);
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_SFM_TRACK_SPLITTER_H_
@@ -0,0 +1,169 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#define TEST_NAME "sfm/track_splitter"
+#include "util/testing.h"
+
+#include <algorithm>
+
+#include "sfm/track_splitter.h"
+#include "util/random.h"
+
+using namespace colmap;
+
+namespace {
+
+typedef std::vector<std::pair<int, int>> Track;
+
+void AddEdge(const int i, const int j, const double strength,
+             std::vector<graph_edge_s>* edges) {
+  edges->push_back({i, j, strength});
+  edges->push_back({j, i, strength});
+}
+
+// Check that the split tracks contain every point once and no take twice.
+void CheckSplit(const Track& points, const std::vector<Track>& tracks) {
+  Track split_points;
+  for (const Track& track : tracks) {
+    BOOST_CHECK(!track.empty());
+    for (size_t i = 0; i < track.size(); ++i) {
+      for (size_t j = i + 1; j < track.size(); ++j) {
+        BOOST_CHECK_NE(track[i].first, track[j].first);
+      }
+    }
+    split_points.insert(split_points.end(), track.begin(), track.end());
+  }
+  Track sorted_points = points;
+  std::sort(sorted_points.begin(), sorted_points.end());
+  std::sort(split_points.begin(), split_points.end());
+  BOOST_CHECK(split_points == sorted_points);
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestOptions) {
+  TrackSplitterOptions options;
+  BOOST_CHECK(options.Check());
+  options.max_num_clusters = options.min_num_clusters - 1;
+  BOOST_CHECK(!options.Check());
+}
+
+BOOST_AUTO_TEST_CASE(TestConsistent) {
+  const Track points = {{1, 10}, {2, 20}, {3, 30}};
+  std::vector<graph_edge_s> edges;
+  AddEdge(0, 1, 1, &edges);
+  AddEdge(1, 2, 1, &edges);
+  const std::vector<Track> tracks =
+      SplitTrack(TrackSplitterOptions(), points, edges);
+  BOOST_CHECK_EQUAL(tracks.size(), 1);
+  BOOST_CHECK(tracks[0] == points);
+}
+
+BOOST_AUTO_TEST_CASE(TestComponents) {
+  const Track points = {{1, 10}, {1, 11}, {2, 20}, {2, 21}, {3, 30}};
+  std::vector<graph_edge_s> edges;
+  AddEdge(0, 2, 1, &edges);
+  AddEdge(1, 3, 1, &edges);
+  const std::vector<Track> tracks =
+      SplitTrack(TrackSplitterOptions(), points, edges);
+  BOOST_CHECK_EQUAL(tracks.size(), 3);
+  BOOST_CHECK(tracks[0] == Track({{1, 10}, {2, 20}}));
+  BOOST_CHECK(tracks[1] == Track({{1, 11}, {2, 21}}));
+  BOOST_CHECK(tracks[2] == Track({{3, 30}}));
+}
+
+BOOST_AUTO_TEST_CASE(TestSingleTake) {
+  const Track points = {{1, 10}, {1, 11}};
+  std::vector<graph_edge_s> edges;
+  AddEdge(0, 1, 3, &edges);
+  const std::vector<Track> tracks =
+      SplitTrack(TrackSplitterOptions(), points, edges);
+  BOOST_CHECK_EQUAL(tracks.size(), 2);
+  BOOST_CHECK(tracks[0] == Track({{1, 10}}));
+  BOOST_CHECK(tracks[1] == Track({{1, 11}}));
+}
+
+BOOST_AUTO_TEST_CASE(TestWeakBridge) {
+  // Two triangles of points in the same takes, joined by a weak edge.
+  const Track points = {{1, 10}, {2, 20}, {3, 30}, {1, 11}, {2, 21}, {3, 31}};
+  std::vector<graph_edge_s> edges;
+  for (int i = 0; i < 3; ++i) {
+    for (int j = i + 1; j < 3; ++j) {
+      AddEdge(i, j, 5, &edges);
+      AddEdge(i + 3, j + 3, 4, &edges);
+    }
+  }
+  AddEdge(0, 4, 1, &edges);
+  const std::vector<Track> tracks =
+      SplitTrack(TrackSplitterOptions(), points, edges);
+  BOOST_CHECK_EQUAL(tracks.size(), 2);
+  BOOST_CHECK(tracks[0] == Track({{1, 10}, {2, 20}, {3, 30}}));
+  BOOST_CHECK(tracks[1] == Track({{1, 11}, {2, 21}, {3, 31}}));
+}
+
+BOOST_AUTO_TEST_CASE(TestSpectralClustering) {
+  // Two chains of points in the same takes, joined by edges as strong as the
+  // edges of the chains, so that the strongest edges do not cut the graph.
+  const int kChainLength = 8;
+  Track points;
+  std::vector<graph_edge_s> edges;
+  for (int chain = 0; chain < 2; ++chain) {
+    for (int i = 0; i < kChainLength; ++i) {
+      points.emplace_back(i + 1, 100 * chain + i);
+      if (i > 0) {
+        AddEdge(chain * kChainLength + i - 1, chain * kChainLength + i, 2,
+                &edges);
+      }
+    }
+  }
+  AddEdge(0, kChainLength + 1, 2, &edges);
+  AddEdge(kChainLength - 1, 2 * kChainLength - 2, 2, &edges);
+  const std::vector<Track> tracks =
+      SplitTrack(TrackSplitterOptions(), points, edges);
+  BOOST_CHECK_GE(tracks.size(), 2);
+  CheckSplit(points, tracks);
+}
+
+BOOST_AUTO_TEST_CASE(TestSplitTracks) {
+  SetPRNGSeed(0);
+  std::vector<Track> points(100);
+  std::vector<std::vector<graph_edge_s>> edges(points.size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    const int num_points = RandomInteger(1, 30);
+    for (int j = 0; j < num_points; ++j) {
+      points[i].emplace_back(RandomInteger(1, 10), j);
+    }
+    for (int j = 0; j < 2 * num_points; ++j) {
+      const int point_idx1 = RandomInteger(0, num_points - 1);
+      const int point_idx2 = RandomInteger(0, num_points - 1);
+      if (point_idx1 != point_idx2) {
+        AddEdge(point_idx1, point_idx2, RandomInteger(1, 3), &edges[i]);
+      }
+    }
+  }
+
+  TrackSplitterOptions options;
+  options.num_threads = 1;
+  const std::vector<std::vector<Track>> tracks =
+      SplitTracks(options, points, edges);
+  options.num_threads = 4;
+  const std::vector<std::vector<Track>> parallel_tracks =
+      SplitTracks(options, points, edges);
+  BOOST_CHECK_EQUAL(tracks.size(), points.size());
+  BOOST_CHECK(parallel_tracks == tracks);
+  for (size_t i = 0; i < points.size(); ++i) {
+    CheckSplit(points[i], tracks[i]);
+  }
+}
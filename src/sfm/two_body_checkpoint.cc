@@ -0,0 +1,528 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sfm/two_body_checkpoint.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <streambuf>
+
+#include "util/endian.h"
+#include "util/mapped_file.h"
+#include "util/misc.h"
+
+namespace colmap {
+namespace {
+
+const char kTwoBodyCheckpointMagic[8] = {'T', 'B', 'S', 'F',
+                                         'M', 'C', 'K', '\0'};
+
+// Stream buffer, which computes the 64-bit FNV-1a hash of all written bytes
+// instead of storing them. The inputs are hashed through the same functions
+// that write the checkpoints.
+class HashStreamBuf : public std::streambuf {
+ public:
+  uint64_t Hash() const { return hash_; }
+
+ protected:
+  int_type overflow(int_type ch) override {
+    if (ch != traits_type::eof()) {
+      const char byte = traits_type::to_char_type(ch);
+      Update(&byte, 1);
+    }
+    return traits_type::not_eof(ch);
+  }
+
+  std::streamsize xsputn(const char* data, std::streamsize size) override {
+    Update(data, static_cast<size_t>(size));
+    return size;
+  }
+
+ private:
+  void Update(const char* data, const size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      hash_ ^= static_cast<unsigned char>(data[i]);
+      hash_ *= 1099511628211ull;
+    }
+  }
+
+  uint64_t hash_ = 14695981039346656037ull;
+};
+
+// Serialization of the postprocessor types. Containers are written as their
+// 64-bit size followed by their elements.
+
+void Write(std::ostream* stream, const uint8_t value);
+void Write(std::ostream* stream, const int value);
+void Write(std::ostream* stream, const double value);
+template <int Rows, int Cols, typename T>
+void Write(std::ostream* stream, const Eigen::Matrix<T, Rows, Cols>& matrix);
+template <typename T>
+void Write(std::ostream* stream, const std::vector<T>& values);
+template <typename T1, typename T2>
+void Write(std::ostream* stream, const std::pair<T1, T2>& value);
+template <typename T>
+void Write(std::ostream* stream, const CsrArray<T>& array);
+void Write(std::ostream* stream, const std::unordered_map<int, int>& map);
+void Write(std::ostream* stream, const IdIndexMap& map);
+void Write(std::ostream* stream, const motion_t& motion);
+void Write(std::ostream* stream, const clust_m& cluster);
+void Write(std::ostream* stream, const trans_s& transformation);
+void Write(std::ostream* stream, const pnts_s& points);
+void Write(std::ostream* stream, const img_s& image);
+void Write(std::ostream* stream, const cam_s& camera);
+void Write(std::ostream* stream, const imgs_s& images);
+void Write(std::ostream* stream, const ClusteringCheckpoint& checkpoint);
+void Write(std::ostream* stream, const MergingCheckpoint& checkpoint);
+
+void Read(MappedFileReader* reader, uint8_t* value);
+void Read(MappedFileReader* reader, int* value);
+void Read(MappedFileReader* reader, double* value);
+template <int Rows, int Cols, typename T>
+void Read(MappedFileReader* reader, Eigen::Matrix<T, Rows, Cols>* matrix);
+template <typename T>
+void Read(MappedFileReader* reader, std::vector<T>* values);
+template <typename T1, typename T2>
+void Read(MappedFileReader* reader, std::pair<T1, T2>* value);
+void Read(MappedFileReader* reader, std::unordered_map<int, int>* map);
+void Read(MappedFileReader* reader, IdIndexMap* map);
+void Read(MappedFileReader* reader, motion_t* motion);
+void Read(MappedFileReader* reader, clust_m* cluster);
+void Read(MappedFileReader* reader, trans_s* transformation);
+void Read(MappedFileReader* reader, pnts_s* points);
+void Read(MappedFileReader* reader, img_s* image);
+void Read(MappedFileReader* reader, ClusteringCheckpoint* checkpoint);
+void Read(MappedFileReader* reader, MergingCheckpoint* checkpoint);
+
+void Write(std::ostream* stream, const uint8_t value) {
+  WriteBinaryLittleEndian<uint8_t>(stream, value);
+}
+
+void Write(std::ostream* stream, const int value) {
+  WriteBinaryLittleEndian<int32_t>(stream, value);
+}
+
+void Write(std::ostream* stream, const double value) {
+  WriteBinaryLittleEndian<double>(stream, value);
+}
+
+template <int Rows, int Cols, typename T>
+void Write(std::ostream* stream, const Eigen::Matrix<T, Rows, Cols>& matrix) {
+  for (int i = 0; i < matrix.size(); ++i) {
+    Write(stream, matrix(i));
+  }
+}
+
+template <typename T>
+void Write(std::ostream* stream, const std::vector<T>& values) {
+  WriteBinaryLittleEndian<uint64_t>(stream, values.size());
+  for (const auto& value : values) {
+    Write(stream, value);
+  }
+}
+
+template <typename T1, typename T2>
+void Write(std::ostream* stream, const std::pair<T1, T2>& value) {
+  Write(stream, value.first);
+  Write(stream, value.second);
+}
+
+template <typename T>
+void Write(std::ostream* stream, const CsrArray<T>& array) {
+  // In the layout of nested vectors.
+  WriteBinaryLittleEndian<uint64_t>(stream, array.NumRows());
+  for (size_t row = 0; row < array.NumRows(); ++row) {
+    const CsrRow<T> values = array.Row(row);
+    WriteBinaryLittleEndian<uint64_t>(stream, values.size());
+    for (const auto& value : values) {
+      Write(stream, value);
+    }
+  }
+}
+
+void Write(std::ostream* stream, const std::unordered_map<int, int>& map) {
+  // Sorted, such that equal maps are written and hashed identically.
+  std::vector<std::pair<int, int>> entries(map.begin(), map.end());
+  std::sort(entries.begin(), entries.end());
+  Write(stream, entries);
+}
+
+void Write(std::ostream* stream, const IdIndexMap& map) {
+  // In the layout of std::unordered_map, which the map replaces.
+  std::vector<std::pair<int, int>> entries;
+  entries.reserve(map.size());
+  map.ForEach([&entries](const int id, const int index) {
+    entries.emplace_back(id, index);
+  });
+  std::sort(entries.begin(), entries.end());
+  Write(stream, entries);
+}
+
+void Write(std::ostream* stream, const motion_t& motion) {
+  Write(stream, motion.init);
+  Write(stream, motion.final);
+  Write(stream, motion.cam_id);
+  Write(stream, motion.c1);
+  Write(stream, motion.c2);
+  Write(stream, motion.A);
+  Write(stream, motion.t);
+}
+
+void Write(std::ostream* stream, const clust_m& cluster) {
+  Write(stream, cluster.size);
+  Write(stream, cluster.init);
+  Write(stream, cluster.final);
+  Write(stream, cluster.R);
+  Write(stream, cluster.t);
+}
+
+void Write(std::ostream* stream, const trans_s& transformation) {
+  Write(stream, transformation.R);
+  Write(stream, transformation.o);
+  Write(stream, transformation.s);
+}
+
+void Write(std::ostream* stream, const pnts_s& points) {
+  Write(stream, points.ID);
+  Write(stream, points.ID_map);
+  Write(stream, points.points);
+  Write(stream, points.color);
+}
+
+void Write(std::ostream* stream, const img_s& image) {
+  Write(stream, image.R);
+  Write(stream, image.c);
+  Write(stream, image.take);
+  Write(stream, image.b_obs);
+  Write(stream, image.o_obs);
+  Write(stream, image.u_obs);
+  Write(stream, image.features);
+  Write(stream, image.size_x);
+  Write(stream, image.size_y);
+  Write(stream, image.f);
+  Write(stream, image.px);
+  Write(stream, image.py);
+}
+
+void Write(std::ostream* stream, const cam_s& camera) {
+  Write(stream, camera.id);
+  Write(stream, camera.second);
+  Write(stream, camera.anchor);
+  Write(stream, camera.R);
+  Write(stream, camera.t);
+  Write(stream, camera.size_x);
+  Write(stream, camera.size_y);
+  Write(stream, camera.f);
+  Write(stream, camera.px);
+  Write(stream, camera.py);
+  Write(stream, camera.inl);
+  Write(stream, camera.id_2);
+  Write(stream, camera.center);
+}
+
+void Write(std::ostream* stream, const imgs_s& images) {
+  Write(stream, images.id);
+  Write(stream, images.map);
+  Write(stream, images.features);
+  Write(stream, images.obs_all);
+}
+
+void Read(MappedFileReader* reader, uint8_t* value) {
+  *value = reader->Read<uint8_t>();
+}
+
+void Read(MappedFileReader* reader, int* value) {
+  *value = reader->Read<int32_t>();
+}
+
+void Read(MappedFileReader* reader, double* value) {
+  *value = reader->Read<double>();
+}
+
+template <int Rows, int Cols, typename T>
+void Read(MappedFileReader* reader, Eigen::Matrix<T, Rows, Cols>* matrix) {
+  for (int i = 0; i < matrix->size(); ++i) {
+    Read(reader, &(*matrix)(i));
+  }
+}
+
+template <typename T>
+void Read(MappedFileReader* reader, std::vector<T>* values) {
+  values->clear();
+  values->resize(reader->ReadCount(sizeof(int32_t)));
+  for (auto& value : *values) {
+    Read(reader, &value);
+    if (!reader->Good()) {
+      break;
+    }
+  }
+}
+
+template <typename T1, typename T2>
+void Read(MappedFileReader* reader, std::pair<T1, T2>* value) {
+  Read(reader, &value->first);
+  Read(reader, &value->second);
+}
+
+void Read(MappedFileReader* reader, std::unordered_map<int, int>* map) {
+  std::vector<std::pair<int, int>> entries;
+  Read(reader, &entries);
+  map->clear();
+  map->insert(entries.begin(), entries.end());
+}
+
+void Read(MappedFileReader* reader, IdIndexMap* map) {
+  std::vector<std::pair<int, int>> entries;
+  Read(reader, &entries);
+  map->clear();
+  for (const auto& entry : entries) {
+    (*map)[entry.first] = entry.second;
+  }
+}
+
+void Read(MappedFileReader* reader, motion_t* motion) {
+  Read(reader, &motion->init);
+  Read(reader, &motion->final);
+  Read(reader, &motion->cam_id);
+  Read(reader, &motion->c1);
+  Read(reader, &motion->c2);
+  Read(reader, &motion->A);
+  Read(reader, &motion->t);
+}
+
+void Read(MappedFileReader* reader, clust_m* cluster) {
+  Read(reader, &cluster->size);
+  Read(reader, &cluster->init);
+  Read(reader, &cluster->final);
+  Read(reader, &cluster->R);
+  Read(reader, &cluster->t);
+}
+
+void Read(MappedFileReader* reader, trans_s* transformation) {
+  Read(reader, &transformation->R);
+  Read(reader, &transformation->o);
+  Read(reader, &transformation->s);
+}
+
+void Read(MappedFileReader* reader, pnts_s* points) {
+  Read(reader, &points->ID);
+  Read(reader, &points->ID_map);
+  Read(reader, &points->points);
+  Read(reader, &points->color);
+}
+
+void Read(MappedFileReader* reader, img_s* image) {
+  Read(reader, &image->R);
+  Read(reader, &image->c);
+  Read(reader, &image->take);
+  Read(reader, &image->b_obs);
+  Read(reader, &image->o_obs);
+  Read(reader, &image->u_obs);
+  Read(reader, &image->features);
+  Read(reader, &image->size_x);
+  Read(reader, &image->size_y);
+  Read(reader, &image->f);
+  Read(reader, &image->px);
+  Read(reader, &image->py);
+}
+
+void WriteHeader(std::ostream* stream, const PostprocessorStage stage,
+                 const uint64_t key) {
+  stream->write(kTwoBodyCheckpointMagic, sizeof(kTwoBodyCheckpointMagic));
+  WriteBinaryLittleEndian<uint32_t>(stream, kTwoBodyCheckpointVersion);
+  WriteBinaryLittleEndian<int32_t>(stream, static_cast<int32_t>(stage));
+  WriteBinaryLittleEndian<uint64_t>(stream, key);
+}
+
+bool ReadHeader(const std::string& path, const PostprocessorStage stage,
+                const uint64_t key, MappedFileReader* reader) {
+  std::vector<char> magic;
+  reader->Read(&magic, sizeof(kTwoBodyCheckpointMagic));
+  if (!reader->Good() || !std::equal(magic.begin(), magic.end(),
+                                     kTwoBodyCheckpointMagic)) {
+    std::cout << "WARNING: " << path << " is not a checkpoint." << std::endl;
+    return false;
+  }
+
+  const uint32_t version = reader->Read<uint32_t>();
+  const int32_t file_stage = reader->Read<int32_t>();
+  const uint64_t file_key = reader->Read<uint64_t>();
+  if (!reader->Good() || version != kTwoBodyCheckpointVersion ||
+      file_stage != static_cast<int32_t>(stage)) {
+    std::cout << "WARNING: " << path << " has a different version or stage."
+              << std::endl;
+    return false;
+  }
+
+  if (file_key != key) {
+    std::cout << "WARNING: " << path
+              << " was computed from other inputs or parameters."
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+template <typename Checkpoint>
+void WriteCheckpointImpl(const std::string& path,
+                         const PostprocessorStage stage, const uint64_t key,
+                         const Checkpoint& checkpoint) {
+  // Written to a temporary file first, such that a crash during the write
+  // does not leave a truncated checkpoint behind.
+  const std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::trunc | std::ios::binary);
+    CHECK(file.is_open()) << tmp_path;
+    WriteHeader(&file, stage, key);
+    Write(&file, checkpoint);
+    CHECK(file.good()) << tmp_path;
+  }
+  CHECK_EQ(std::rename(tmp_path.c_str(), path.c_str()), 0) << path;
+}
+
+template <typename Checkpoint>
+bool ReadCheckpointImpl(const std::string& path,
+                        const PostprocessorStage stage, const uint64_t key,
+                        Checkpoint* checkpoint) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    return false;
+  }
+
+  MappedFileReader reader(file);
+  if (!ReadHeader(path, stage, key, &reader)) {
+    return false;
+  }
+
+  Read(&reader, checkpoint);
+
+  if (!reader.Good() || reader.Remaining() != 0) {
+    std::cout << "WARNING: Checkpoint " << path << " is truncated."
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+void Write(std::ostream* stream, const ClusteringCheckpoint& checkpoint) {
+  Write(stream, checkpoint.motion_clusters);
+  Write(stream, checkpoint.cluster_groups);
+}
+
+void Write(std::ostream* stream, const MergingCheckpoint& checkpoint) {
+  Write(stream, checkpoint.tracks);
+  Write(stream, checkpoint.order);
+  Write(stream, checkpoint.points);
+  Write(stream, checkpoint.cameras);
+}
+
+void Read(MappedFileReader* reader, ClusteringCheckpoint* checkpoint) {
+  Read(reader, &checkpoint->motion_clusters);
+  Read(reader, &checkpoint->cluster_groups);
+}
+
+void Read(MappedFileReader* reader, MergingCheckpoint* checkpoint) {
+  Read(reader, &checkpoint->tracks);
+  Read(reader, &checkpoint->order);
+  Read(reader, &checkpoint->points);
+  Read(reader, &checkpoint->cameras);
+}
+
+}  // namespace
+
+std::string PostprocessorStageName(const PostprocessorStage stage) {
+  switch (stage) {
+    case PostprocessorStage::INPUT:
+      return "input";
+    case PostprocessorStage::CLUSTERING:
+      return "clustering";
+    case PostprocessorStage::MERGING:
+      return "merging";
+    case PostprocessorStage::POINTS:
+      return "points";
+  }
+  return "";
+}
+
+bool ParsePostprocessorStage(const std::string& name,
+                             PostprocessorStage* stage) {
+  for (const PostprocessorStage candidate :
+       {PostprocessorStage::INPUT, PostprocessorStage::CLUSTERING,
+        PostprocessorStage::MERGING, PostprocessorStage::POINTS}) {
+    if (name == PostprocessorStageName(candidate)) {
+      *stage = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string PostprocessorCheckpointPath(const std::string& checkpoint_path,
+                                        const PostprocessorStage stage) {
+  return JoinPaths(checkpoint_path, PostprocessorStageName(stage) + ".bin");
+}
+
+uint64_t HashPostprocessorInput(
+    const std::vector<cam_s>& C, const std::vector<imgs_s>& I,
+    const std::vector<pnts_s>& P,
+    const std::pair<std::vector<std::vector<std::pair<int, int>>>,
+                    std::vector<std::unordered_map<int, int>>>& T) {
+  HashStreamBuf buffer;
+  std::ostream stream(&buffer);
+  Write(&stream, C);
+  Write(&stream, I);
+  Write(&stream, P);
+  Write(&stream, T.first);
+  Write(&stream, T.second);
+  return buffer.Hash();
+}
+
+uint64_t HashPostprocessorStage(const uint64_t prev_key,
+                                const PostprocessorStage stage,
+                                const std::vector<double>& parameters) {
+  HashStreamBuf buffer;
+  std::ostream stream(&buffer);
+  WriteBinaryLittleEndian<uint64_t>(&stream, prev_key);
+  WriteBinaryLittleEndian<int32_t>(&stream, static_cast<int32_t>(stage));
+  Write(&stream, parameters);
+  return buffer.Hash();
+}
+
+void WriteCheckpoint(const std::string& path, const PostprocessorStage stage,
+                     const uint64_t key,
+                     const ClusteringCheckpoint& checkpoint) {
+  WriteCheckpointImpl(path, stage, key, checkpoint);
+}
+
+void WriteCheckpoint(const std::string& path, const PostprocessorStage stage,
+                     const uint64_t key, const MergingCheckpoint& checkpoint) {
+  WriteCheckpointImpl(path, stage, key, checkpoint);
+}
+
+bool ReadCheckpoint(const std::string& path, const PostprocessorStage stage,
+                    const uint64_t key, ClusteringCheckpoint* checkpoint) {
+  return ReadCheckpointImpl(path, stage, key, checkpoint);
+}
+
+bool ReadCheckpoint(const std::string& path, const PostprocessorStage stage,
+                    const uint64_t key, MergingCheckpoint* checkpoint) {
+  return ReadCheckpointImpl(path, stage, key, checkpoint);
+}
+
+}  // namespace colmap
@@ -0,0 +1,111 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_SFM_TWO_BODY_CHECKPOINT_H_
+#define COLMAP_SRC_SFM_TWO_BODY_CHECKPOINT_H_
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "sfm/incremental_mapper.h"
+
+namespace colmap {
+
+// Version of the binary checkpoint layout. Checkpoints with a different
+// version are rejected, so that the postprocessor recomputes the stage.
+const uint32_t kTwoBodyCheckpointVersion = 2;
+
+// Stages of the two-body postprocessor, after each of which a checkpoint can
+// be written. A run that resumes from a stage skips all stages up to and
+// including it.
+enum class PostprocessorStage {
+  // No stage is skipped.
+  INPUT = 0,
+  // Clustering of the take bases and the motions and the chordal completion.
+  CLUSTERING = 1,
+  // Selection of the cluster group and merging of the take reconstructions.
+  MERGING = 2,
+  // Rounds of adding the remaining points to the merged reconstruction.
+  POINTS = 3,
+};
+
+// Output of the clustering stage.
+struct ClusteringCheckpoint {
+  // The motions of every cluster and their mean motions.
+  std::pair<std::vector<std::vector<std::vector<motion_t>>>,
+            std::vector<std::vector<clust_m>>>
+      motion_clusters;
+  // The cluster groups found by the chordal completion.
+  std::vector<std::vector<std::pair<int, int>>> cluster_groups;
+};
+
+// Output of the merging and of the points stage.
+struct MergingCheckpoint {
+  // The background and object tracks and the remaining tracks.
+  std::pair<std::pair<std::vector<int>, std::vector<int>>, std::vector<int>>
+      tracks;
+  // The order in which the takes are merged, starting with the reference.
+  std::vector<int> order;
+  // The merged background and object points and the take transformations.
+  std::pair<std::pair<pnts_s, pnts_s>, std::vector<std::pair<trans_s, trans_s>>>
+      points;
+  // The merged cameras and the motions of the takes.
+  std::pair<std::vector<img_s>, std::vector<trans_s>> cameras;
+};
+
+// Name of the stage as used on the command-line and in the checkpoint file
+// names, and its inverse, which returns false for unknown names.
+std::string PostprocessorStageName(const PostprocessorStage stage);
+bool ParsePostprocessorStage(const std::string& name,
+                             PostprocessorStage* stage);
+
+// Path of the checkpoint of the given stage in the checkpoint folder.
+std::string PostprocessorCheckpointPath(const std::string& checkpoint_path,
+                                        const PostprocessorStage stage);
+
+// Key of the postprocessor inputs, i.e. a 64-bit hash of the camera log, the
+// images, the points and the tracks of all takes.
+uint64_t HashPostprocessorInput(
+    const std::vector<cam_s>& C, const std::vector<imgs_s>& I,
+    const std::vector<pnts_s>& P,
+    const std::pair<std::vector<std::vector<std::pair<int, int>>>,
+                    std::vector<std::unordered_map<int, int>>>& T);
+
+// Key of a stage, which combines the key of the previous stage with the
+// parameters of this stage. A change of the inputs or of the parameters of
+// any earlier stage thus invalidates the checkpoints of all later stages.
+uint64_t HashPostprocessorStage(const uint64_t prev_key,
+                                const PostprocessorStage stage,
+                                const std::vector<double>& parameters);
+
+// Write the checkpoint of a stage in the versioned little-endian layout.
+void WriteCheckpoint(const std::string& path, const PostprocessorStage stage,
+                     const uint64_t key, const ClusteringCheckpoint& checkpoint);
+void WriteCheckpoint(const std::string& path, const PostprocessorStage stage,
+                     const uint64_t key, const MergingCheckpoint& checkpoint);
+
+// Read the checkpoint of a stage. Returns false if the file does not exist,
+// has a different version, stage or key, or is truncated.
+bool ReadCheckpoint(const std::string& path, const PostprocessorStage stage,
+                    const uint64_t key, ClusteringCheckpoint* checkpoint);
+bool ReadCheckpoint(const std::string& path, const PostprocessorStage stage,
+                    const uint64_t key, MergingCheckpoint* checkpoint);
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_SFM_TWO_BODY_CHECKPOINT_H_
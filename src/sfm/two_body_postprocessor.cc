@@ -0,0 +1,358 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sfm/two_body_postprocessor.h"
+
+#include <algorithm>
+#include <future>
+#include <iostream>
+
+#include "util/bitmap.h"
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/timer.h"
+#include "util/trace.h"
+
+namespace colmap {
+namespace {
+
+// The clustering of the bases and the motions up to the removal of the
+// identity motions, which only needs the camera log.
+struct MotionClustering {
+  std::pair<std::vector<std::vector<std::vector<motion_t>>>,
+            std::vector<std::vector<clust_m>>>
+      motion_clusters;
+  double pd = 0;
+};
+
+MotionClustering ClusterMotions(const TwoBodyPostprocessorOptions& options,
+                                const std::vector<cam_s>& C) {
+  TRACE_SCOPE("TwoBodyPostprocessor::ClusterMotions");
+  const int takes = count_takes(C);
+  MotionClustering clustering;
+  const std::vector<basis_t> B = find_bases(C, options.num_threads);
+  VLOG(3) << B.size();
+  const std::vector<std::vector<std::vector<basis_t>>> CL =
+      divide_bases(B, C, options.basis_sigma, options.num_threads);
+  const std::vector<std::vector<clust_b>> M = meanclust(
+      CL, C, options.geometric_median_rotations, options.num_threads);
+  std::vector<double> bzs;
+  const std::vector<cycle_3> CY =
+      find3cycles(M, options.cycle_thr, C, CL, &bzs, options.num_threads);
+  std::cout << "Clustering cycles\n";
+  const std::vector<int> CL2 = cluster_cycles(CY);
+  const std::pair<std::pair<Eigen::MatrixXi, Eigen::MatrixXi>, Eigen::MatrixXd>
+      st = select_bases(M, CY, CL2, takes, bzs, options.cycle_thr,
+                        options.basis_thr, options.num_threads);
+  const int reference = find_reference(st.second, takes);
+  clustering.pd = princ_dist(C, reference + 1);
+  VLOG(3) << reference;
+  const std::vector<std::vector<trans_s>> transform =
+      find_transformations(st.first, reference, M, takes);
+  const std::vector<motion_t> U = find_motion(C);
+  const std::vector<motion_t> U2 = transform_motion(U, transform);
+  const std::vector<motion_t> U3 = remove_id(
+      U2, clustering.pd, options.id_thr1, options.id_thr2, options.num_threads);
+  VLOG(3) << clustering.pd;
+  const std::vector<cam_s> C2 = change_basis_cams(C, transform);
+  const std::vector<std::vector<std::vector<motion_t>>> CL_mot =
+      divide_motions(U3, C2, options.motion_sigma, clustering.pd,
+                     options.motion_thr, options.num_threads);
+  const std::vector<std::vector<clust_m>> MM = meanclust_motions(
+      CL_mot, options.geometric_median_rotations, options.num_threads);
+  clustering.motion_clusters =
+      remove_identity(MM, CL_mot, clustering.pd, options.identity_thr1,
+                      options.identity_thr2);
+  return clustering;
+}
+
+// Keys of the checkpoints of all stages, indexed by the stage.
+std::vector<uint64_t> CheckpointKeys(const TwoBodyPostprocessorOptions& options,
+                                     const uint64_t input_key) {
+  const int kClustering = static_cast<int>(PostprocessorStage::CLUSTERING);
+  const int kMerging = static_cast<int>(PostprocessorStage::MERGING);
+  const int kPoints = static_cast<int>(PostprocessorStage::POINTS);
+  std::vector<uint64_t> keys(4);
+  keys[static_cast<int>(PostprocessorStage::INPUT)] = input_key;
+  keys[kClustering] = HashPostprocessorStage(
+      input_key, PostprocessorStage::CLUSTERING,
+      {options.basis_sigma, options.cycle_thr, options.basis_thr,
+       options.id_thr1, options.id_thr2, options.motion_sigma,
+       options.motion_thr, options.identity_thr1, options.identity_thr2,
+       options.completion_thr1, options.completion_thr2,
+       static_cast<double>(options.geometric_median_rotations)});
+  keys[kMerging] = HashPostprocessorStage(
+      keys[kClustering], PostprocessorStage::MERGING,
+      {static_cast<double>(options.tree_merging)});
+  keys[kPoints] = HashPostprocessorStage(
+      keys[kMerging], PostprocessorStage::POINTS,
+      {static_cast<double>(options.point_rounds),
+       static_cast<double>(options.point_track_thr),
+       static_cast<double>(options.point_filter_thr)});
+  return keys;
+}
+
+// Write the checkpoint of a stage, unless there is no checkpoint folder.
+template <typename Checkpoint>
+void WriteStageCheckpoint(const std::string& checkpoint_path,
+                          const PostprocessorStage stage,
+                          const std::vector<uint64_t>& keys,
+                          const Checkpoint& checkpoint) {
+  if (!checkpoint_path.empty()) {
+    WriteCheckpoint(PostprocessorCheckpointPath(checkpoint_path, stage), stage,
+                    keys[static_cast<int>(stage)], checkpoint);
+  }
+}
+
+}  // namespace
+
+PostprocessorLoaders TakeBundleLoaders(
+    const std::shared_ptr<const std::vector<TakeBundle>>& bundles,
+    const int num_threads) {
+  const int takes = static_cast<int>(bundles->size());
+  PostprocessorLoaders loaders;
+  loaders.images = [bundles]() { return load_imgs(*bundles); };
+  loaders.points = [bundles]() { return load_pnts(*bundles); };
+  loaders.tracks = [bundles, takes, num_threads](const std::vector<pnts_s>& P) {
+    return load_tracks(P, takes, find_tracks(*bundles), num_threads);
+  };
+  return loaders;
+}
+
+bool TwoBodyPostprocessorOptions::Check() const {
+  CHECK_OPTION_GT(basis_sigma, 0);
+  CHECK_OPTION_GT(cycle_thr, 0);
+  CHECK_OPTION_GT(basis_thr, 0);
+  CHECK_OPTION_GT(motion_sigma, 0);
+  CHECK_OPTION_GE(point_rounds, 0);
+  CHECK_OPTION_GE(point_track_thr, 0);
+  CHECK_OPTION_GE(point_filter_thr, 0);
+  CHECK_OPTION_GE(ba_pba_gpu_index, -1);
+  CHECK_OPTION_GE(num_threads, -1);
+  CHECK_OPTION_NE(num_threads, 0);
+  return true;
+}
+
+TwoBodyPostprocessor::TwoBodyPostprocessor(
+    const TwoBodyPostprocessorOptions& options)
+    : options_(options),
+      thread_pool_(options.num_threads == -1
+                       ? std::max(4, GetEffectiveNumThreads(-1))
+                       : options.num_threads) {
+  CHECK(options_.Check());
+  callbacks_.emplace(STAGE_STARTED_CALLBACK, std::list<StageCallback>());
+  callbacks_.emplace(STAGE_FINISHED_CALLBACK, std::list<StageCallback>());
+}
+
+void TwoBodyPostprocessor::AddCallback(const int id,
+                                       const StageCallback& func) {
+  CHECK(func);
+  CHECK_GT(callbacks_.count(id), 0) << "Callback not registered";
+  callbacks_.at(id).push_back(func);
+}
+
+void TwoBodyPostprocessor::Callback(const int id, const std::string& stage,
+                                    const double elapsed_seconds) const {
+  CHECK_GT(callbacks_.count(id), 0) << "Callback not registered";
+  for (const auto& callback : callbacks_.at(id)) {
+    callback(stage, elapsed_seconds);
+  }
+}
+
+const TwoBodyPostprocessorOptions& TwoBodyPostprocessor::Options() const {
+  return options_;
+}
+
+TwoBodyModels TwoBodyPostprocessor::Run(const std::vector<cam_s>& C,
+                                        PostprocessorLoaders loaders) {
+  TRACE_SCOPE("TwoBodyPostprocessor::Run");
+  Timer timer;
+  auto start_stage = [this, &timer](const std::string& name) {
+    timer.Restart();
+    Callback(STAGE_STARTED_CALLBACK, name, 0);
+  };
+  auto finish_stage = [this, &timer](const std::string& name) {
+    Callback(STAGE_FINISHED_CALLBACK, name, timer.ElapsedSeconds());
+  };
+
+  const int takes = count_takes(C);
+  VLOG(3) << C.size();
+  VLOG(3) << takes;
+
+  start_stage(PostprocessorStageName(PostprocessorStage::INPUT));
+  std::future<std::vector<imgs_s>> images_task =
+      thread_pool_.AddTask(loaders.images);
+  std::future<std::vector<pnts_s>> points_task =
+      thread_pool_.AddTask(loaders.points);
+  // Without a checkpoint to resume from, the clustering is needed in any case
+  // and starts right away.
+  const bool resuming = !options_.checkpoint_path.empty() &&
+                        options_.resume_from != PostprocessorStage::INPUT;
+  std::future<MotionClustering> motions_task;
+  if (!resuming) {
+    motions_task =
+        thread_pool_.AddTask(ClusterMotions, std::cref(options_), std::cref(C));
+  }
+
+  const std::vector<pnts_s> P = points_task.get();
+  const take_tracks_t T =
+      thread_pool_.AddTask(loaders.tracks, std::cref(P)).get();
+  const std::vector<imgs_s> I = images_task.get();
+  // Release the loaders and the data they hold.
+  loaders = PostprocessorLoaders();
+
+  const std::vector<uint64_t> keys =
+      CheckpointKeys(options_, HashPostprocessorInput(C, I, P, T));
+  auto checkpoint_file = [this](const PostprocessorStage stage) {
+    return PostprocessorCheckpointPath(options_.checkpoint_path, stage);
+  };
+
+  // Resume from the latest stage up to resume_from with a valid checkpoint.
+  ClusteringCheckpoint clustering;
+  MergingCheckpoint merging;
+  PostprocessorStage stage =
+      resuming ? options_.resume_from : PostprocessorStage::INPUT;
+  while (stage != PostprocessorStage::INPUT) {
+    const uint64_t key = keys[static_cast<int>(stage)];
+    const bool loaded =
+        stage == PostprocessorStage::CLUSTERING
+            ? ReadCheckpoint(checkpoint_file(stage), stage, key, &clustering)
+            : ReadCheckpoint(checkpoint_file(stage), stage, key, &merging);
+    if (loaded) {
+      std::cout << "Resuming after stage " << PostprocessorStageName(stage)
+                << "\n";
+      break;
+    }
+    std::cout << "No checkpoint of stage " << PostprocessorStageName(stage)
+              << "\n";
+    stage = static_cast<PostprocessorStage>(static_cast<int>(stage) - 1);
+  }
+  finish_stage(PostprocessorStageName(PostprocessorStage::INPUT));
+
+  std::future<observed_s> observed_task;
+  if (stage < PostprocessorStage::MERGING) {
+    observed_task = thread_pool_.AddTask(
+        observed_tracks, std::cref(C), std::cref(I), std::cref(P),
+        std::cref(T.second), options_.num_threads);
+  }
+
+  observed_s O;
+  if (stage < PostprocessorStage::CLUSTERING) {
+    TRACE_SCOPE("TwoBodyPostprocessor::Clustering");
+    start_stage(PostprocessorStageName(PostprocessorStage::CLUSTERING));
+    if (!motions_task.valid()) {
+      motions_task = thread_pool_.AddTask(ClusterMotions, std::cref(options_),
+                                          std::cref(C));
+    }
+    MotionClustering motions = motions_task.get();
+    clustering.motion_clusters = std::move(motions.motion_clusters);
+
+    O = observed_task.get();
+    const std::vector<std::vector<std::pair<IdBitmap, IdBitmap>>> CLO =
+        observed_by_cluster(clustering.motion_clusters.first, O.tracks);
+    clustering.cluster_groups = chordal_completion(
+        clustering.motion_clusters.second, CLO, options_.completion_thr1,
+        options_.completion_thr2, motions.pd, options_.num_threads);
+    WriteStageCheckpoint(options_.checkpoint_path,
+                         PostprocessorStage::CLUSTERING, keys, clustering);
+    finish_stage(PostprocessorStageName(PostprocessorStage::CLUSTERING));
+  } else if (motions_task.valid()) {
+    motions_task.wait();
+  }
+
+  if (stage < PostprocessorStage::MERGING) {
+    TRACE_SCOPE("TwoBodyPostprocessor::Merging");
+    start_stage(PostprocessorStageName(PostprocessorStage::MERGING));
+    const auto& MM2 = clustering.motion_clusters;
+    const std::vector<std::vector<std::pair<int, int>>>& CLCL =
+        clustering.cluster_groups;
+    const int group = select_group(CLCL, MM2.second);
+    const std::pair<std::vector<int>, std::vector<int>> Q =
+        group_cams(CLCL[group], MM2.first);
+    if (observed_task.valid()) {
+      O = observed_task.get();
+    }
+    merging.tracks = split_tracks(Q, O.tracks, T.first.size());
+    merging.order = order_fold(T.first, merging.tracks.first, takes);
+    merging.points =
+        merge_reconstructions(P, T.first, merging.tracks.first, merging.order,
+                              options_.tree_merging, options_.num_threads);
+    merging.cameras =
+        merge_cameras(C, merging.points.second, merging.order[0], O.features,
+                      Q, merging.tracks.first, options_.num_threads);
+    WriteStageCheckpoint(options_.checkpoint_path,
+                         PostprocessorStage::MERGING, keys, merging);
+    finish_stage(PostprocessorStageName(PostprocessorStage::MERGING));
+  }
+
+  auto& D = merging.tracks;
+  const int reference = merging.order[0];
+  auto& R = merging.points;
+  auto& MC = merging.cameras;
+  if (stage < PostprocessorStage::POINTS) {
+    TRACE_SCOPE("TwoBodyPostprocessor::Points");
+    start_stage(PostprocessorStageName(PostprocessorStage::POINTS));
+    point_rounds_s rounds = init_point_rounds(D.first, T.first, P, T.second);
+    for (int i = 0; i < options_.point_rounds; ++i) {
+      const std::pair<std::vector<int>, std::vector<int>> D2 =
+          split_tracks3(rounds, options_.point_track_thr, P);
+      const std::pair<std::vector<int>, std::vector<int>> D3 = filter_points2(
+          D2, rounds, MC.first, P, options_.point_filter_thr, T.first,
+          options_.num_threads);
+      add_points2(D3, T.first, P, R.first, R.second, reference);
+      update_point_rounds(&rounds, D3, T.first, P);
+      std::cout << "ADDED: " << D3.first.size() << " " << D3.second.size()
+                << "\n";
+      D.first.first.insert(D.first.first.end(), D3.first.begin(),
+                           D3.first.end());
+      D.first.second.insert(D.first.second.end(), D3.second.begin(),
+                            D3.second.end());
+    }
+    WriteStageCheckpoint(options_.checkpoint_path,
+                         PostprocessorStage::POINTS, keys, merging);
+    finish_stage(PostprocessorStageName(PostprocessorStage::POINTS));
+  }
+
+  {
+    TRACE_SCOPE("TwoBodyPostprocessor::BundleAdjustment");
+    start_stage("bundle_adjustment");
+    perform_BA(R.first, MC.first, MC.second, 1, reference,
+               options_.num_threads, options_.ba_use_pba,
+               options_.ba_pba_gpu_index, options_.ba_mixed_precision);
+    finish_stage("bundle_adjustment");
+  }
+
+  TwoBodyModels models;
+  models.points = std::move(R.first);
+  models.images = std::move(MC.first);
+  models.motions = std::move(MC.second);
+  models.reference = reference;
+  return models;
+}
+
+void TwoBodyPostprocessor::WriteModels(const TwoBodyModels& models,
+                                       const std::string& path,
+                                       const bool binary) const {
+  TRACE_SCOPE("TwoBodyPostprocessor::WriteModels");
+  const std::vector<int> modes = {0, 1, 2, 3};
+  for (const int mode : modes) {
+    CreateDirIfNotExists(JoinPaths(path, "model" + std::to_string(mode)));
+  }
+  save_models(models.points, models.images, models.motions, modes,
+              models.reference, binary, path, options_.num_threads);
+}
+
+}  // namespace colmap
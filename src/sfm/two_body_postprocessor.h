@@ -0,0 +1,176 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_SFM_TWO_BODY_POSTPROCESSOR_H_
+#define COLMAP_SRC_SFM_TWO_BODY_POSTPROCESSOR_H_
+
+#include <climits>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "sfm/incremental_mapper.h"
+#include "sfm/two_body_checkpoint.h"
+#include "util/threading.h"
+
+namespace colmap {
+
+// The tracks of all takes and, for every take, the track of every point.
+typedef std::pair<std::vector<std::vector<std::pair<int, int>>>,
+                  std::vector<std::unordered_map<int, int>>>
+    take_tracks_t;
+
+// Loaders of the postprocessor inputs besides the camera log. They run on the
+// worker pool of the postprocessor, concurrently with the clustering of the
+// camera log, and the tracks are loaded as soon as the points are.
+struct PostprocessorLoaders {
+  std::function<std::vector<imgs_s>()> images;
+  std::function<std::vector<pnts_s>()> points;
+  std::function<take_tracks_t(const std::vector<pnts_s>&)> tracks;
+};
+
+// Loaders of take bundles in memory, e.g. as returned by the mapper. The
+// tracks are found from the bundles, which are released with the loaders.
+PostprocessorLoaders TakeBundleLoaders(
+    const std::shared_ptr<const std::vector<TakeBundle>>& bundles,
+    const int num_threads = -1);
+
+struct TwoBodyPostprocessorOptions {
+  // Parameters of the clustering stage.
+  double basis_sigma = 1;
+  double cycle_thr = 0.03;
+  double basis_thr = 0.98;
+  double id_thr1 = 2.5;
+  double id_thr2 = 3;
+  double motion_sigma = 1;
+  double motion_thr = 1;
+  double identity_thr1 = 1;
+  double identity_thr2 = 1;
+  double completion_thr1 = 1;
+  double completion_thr2 = 1;
+  // Whether the rotation of a cluster of bases or motions is the geometric
+  // median of its angle-axis rotations instead of their coordinate-wise median.
+  bool geometric_median_rotations = false;
+
+  // Whether to merge the takes by the levels of the maximum spanning tree of
+  // their overlaps, where the takes of a level are aligned in parallel to the
+  // takes of the previous levels, instead of one after the other.
+  bool tree_merging = false;
+
+  // Parameters of the points stage.
+  int point_rounds = 3;
+  int point_track_thr = 5;
+  int point_filter_thr = 3;
+
+  // Whether to run the final bundle adjustment on PBA before refining the
+  // object motions with Ceres, and the index of the GPU used by PBA. With -1,
+  // the default CUDA device is used.
+  bool ba_use_pba = false;
+  int ba_pba_gpu_index = -1;
+
+  // Whether to solve the final bundle adjustment with the mixed-precision
+  // Schur solver instead of Ceres-Solver.
+  bool ba_mixed_precision = false;
+
+  // The thread budget of the job. Every parallel stage runs on at most this
+  // many threads and so does the worker pool, on which the loading of the
+  // inputs overlaps with the clustering. With -1, all cores are used and the
+  // worker pool has at least 4 threads.
+  int num_threads = -1;
+
+  // If not empty, the output of every stage is written to a checkpoint in
+  // this existing folder and the stages up to `resume_from` are loaded from
+  // their checkpoints instead of recomputed, as long as these were computed
+  // from the same inputs and parameters.
+  std::string checkpoint_path = "";
+  PostprocessorStage resume_from = PostprocessorStage::INPUT;
+
+  bool Check() const;
+};
+
+// The merged two-body reconstruction.
+struct TwoBodyModels {
+  // The merged background and object points.
+  std::pair<pnts_s, pnts_s> points;
+  // The merged cameras and the motions of the takes.
+  std::vector<img_s> images;
+  std::vector<trans_s> motions;
+  // The reference take, in which the models are expressed.
+  int reference = -1;
+};
+
+// Parts 3.3 to 3.7 of the paper as a library, which takes its inputs through
+// the camera log and the loaders and returns the final models instead of
+// reading and writing fixed paths in the working directory.
+//
+// The worker pool is created once and shared by all runs, so that a resident
+// process does not start new threads for every job. The stages form a task
+// graph on the pool: the loading of the inputs overlaps with the clustering of
+// the bases and the motions, which only needs the camera log, and the track
+// observation tables are built concurrently. Only the calling thread waits for
+// tasks, so the pool cannot deadlock on its own dependencies, also not when
+// several runs share it.
+class TwoBodyPostprocessor {
+ public:
+  // Callbacks, which are invoked on the thread that calls Run when a stage
+  // starts and when it has finished, with the name of the stage and the
+  // seconds since it started, which is zero for the started callbacks. The
+  // stages are the ones of PostprocessorStageName, where "input" covers the
+  // loading of the inputs and the checkpoints, and "bundle_adjustment". The
+  // stages which are loaded from a checkpoint are not reported and the time
+  // of the work that overlaps with an earlier stage counts for that one.
+  enum {
+    STAGE_STARTED_CALLBACK = INT_MIN,
+    STAGE_FINISHED_CALLBACK,
+  };
+
+  typedef std::function<void(const std::string& stage,
+                             const double elapsed_seconds)>
+      StageCallback;
+
+  explicit TwoBodyPostprocessor(const TwoBodyPostprocessorOptions& options);
+
+  void AddCallback(const int id, const StageCallback& func);
+
+  // Postprocess the takes of the camera log C, whose images, points and
+  // tracks are obtained from the loaders.
+  TwoBodyModels Run(const std::vector<cam_s>& C,
+                    PostprocessorLoaders loaders);
+
+  // Write the four models to path/model0 to path/model3, which are created
+  // if they do not exist, in the COLMAP binary format if `binary` and in text
+  // otherwise.
+  void WriteModels(const TwoBodyModels& models, const std::string& path,
+                   const bool binary) const;
+
+  const TwoBodyPostprocessorOptions& Options() const;
+
+ private:
+  void Callback(const int id, const std::string& stage,
+                const double elapsed_seconds) const;
+
+  const TwoBodyPostprocessorOptions options_;
+  ThreadPool thread_pool_;
+  std::unordered_map<int, std::list<StageCallback>> callbacks_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_SFM_TWO_BODY_POSTPROCESSOR_H_
@@ -0,0 +1,103 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <iostream>
+
+#include "base/database.h"
+#include "sfm/synthetic_scene.h"
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/option_manager.h"
+#include "util/timer.h"
+
+using namespace colmap;
+
+// Generate a synthetic two-body scene of the given size and write its database
+// and takes.txt, as input to the mapper and the postprocessor at scales beyond
+// the captured datasets.
+int main(int argc, char** argv) {
+  InitializeGlog(argv);
+
+  std::string takes_path = "takes.txt";
+
+  SyntheticSceneOptions scene_options;
+  scene_options.max_viewing_angle = 60.0;
+  scene_options.feature_outlier_ratio = 0.2;
+  scene_options.match_outlier_ratio = 0.1;
+
+  OptionManager options;
+  options.AddDatabaseOptions();
+  options.AddDefaultOption("takes_path", &takes_path);
+  options.AddDefaultOption("num_takes", &scene_options.num_takes);
+  options.AddDefaultOption("num_images_per_take",
+                           &scene_options.num_images_per_take);
+  options.AddDefaultOption("num_background_points",
+                           &scene_options.num_background_points);
+  options.AddDefaultOption("num_object_points",
+                           &scene_options.num_object_points);
+  options.AddDefaultOption("max_viewing_angle",
+                           &scene_options.max_viewing_angle);
+  options.AddDefaultOption("point2D_stddev", &scene_options.point2D_stddev);
+  options.AddDefaultOption("feature_outlier_ratio",
+                           &scene_options.feature_outlier_ratio);
+  options.AddDefaultOption("match_outlier_ratio",
+                           &scene_options.match_outlier_ratio);
+  options.AddDefaultOption("num_overlapping_images",
+                           &scene_options.num_overlapping_images);
+  options.AddDefaultOption("width", &scene_options.width);
+  options.AddDefaultOption("height", &scene_options.height);
+  options.AddDefaultOption("focal_length", &scene_options.focal_length);
+  options.AddDefaultOption("seed", &scene_options.seed);
+  options.Parse(argc, argv);
+
+  if (!scene_options.Check()) {
+    return EXIT_FAILURE;
+  }
+
+  if (ExistsFile(*options.database_path)) {
+    std::cerr << "ERROR: `database_path` already exists." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Timer timer;
+  timer.Start();
+
+  PrintHeading1("Generating scene");
+
+  const SyntheticScene scene = GenerateSyntheticScene(scene_options);
+
+  size_t num_features = 0;
+  for (const auto& image : scene.images) {
+    num_features += image.features.size();
+  }
+  std::cout << " => Images: " << scene.images.size() << std::endl;
+  std::cout << " => Features: " << num_features << std::endl;
+
+  PrintHeading1("Writing database");
+
+  Database database(*options.database_path);
+  WriteSyntheticDatabase(scene, &database);
+  std::cout << " => Image pairs: " << database.NumVerifiedImagePairs()
+            << std::endl;
+  std::cout << " => Inlier matches: " << database.NumInlierMatches()
+            << std::endl;
+
+  WriteSyntheticTakeMap(scene, takes_path);
+
+  timer.PrintMinutes();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,295 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "base/projection.h"
+#include "base/reconstruction.h"
+#include "base/take_bundle.h"
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/option_manager.h"
+#include "util/string.h"
+#include "util/timer.h"
+
+using namespace colmap;
+
+namespace {
+
+// The wall time and peak resident set size of a command, as measured by the
+// driver from the outside.
+struct CommandRun {
+  int exit_code = -1;
+  double wall_seconds = 0;
+  int64_t peak_rss_bytes = 0;
+};
+
+// The size and accuracy of the models of a command.
+struct ModelQuality {
+  size_t num_reg_images = 0;
+  size_t num_points3D = 0;
+  size_t num_observations = 0;
+  double sum_reproj_errors = 0;
+
+  double MeanReprojectionError() const {
+    return num_observations > 0 ? sum_reproj_errors / num_observations : 0;
+  }
+};
+
+// Run a command in the given folder and wait for it to finish.
+CommandRun RunCommand(const std::vector<std::string>& args,
+                      const std::string& working_path) {
+  std::cout << "Running";
+  for (const auto& arg : args) {
+    std::cout << " " << arg;
+  }
+  std::cout << std::endl;
+
+  std::vector<char*> argv;
+  for (const auto& arg : args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  CommandRun run;
+  Timer timer;
+  timer.Start();
+  const pid_t pid = fork();
+  if (pid == 0) {
+    if (chdir(working_path.c_str()) == 0) {
+      execvp(argv[0], argv.data());
+    }
+    _exit(127);
+  }
+  CHECK_GE(pid, 0) << "Could not start " << args[0];
+
+  int status = 0;
+  struct rusage usage;
+  CHECK_EQ(wait4(pid, &status, 0, &usage), pid);
+  run.wall_seconds = timer.ElapsedSeconds();
+  // The maximum resident set size is given in kilobytes.
+  run.peak_rss_bytes = static_cast<int64_t>(usage.ru_maxrss) * 1024;
+  if (WIFEXITED(status)) {
+    run.exit_code = WEXITSTATUS(status);
+  }
+  return run;
+}
+
+// Add a model to the quality. The reprojection errors are recomputed from the
+// observations, since the postprocessor stores the body of a point instead.
+void AddModelQuality(const Reconstruction& reconstruction,
+                     ModelQuality* quality) {
+  quality->num_reg_images += reconstruction.NumRegImages();
+  quality->num_points3D += reconstruction.NumPoints3D();
+  for (const auto& point3D : reconstruction.Points3D()) {
+    for (const auto& track_el : point3D.second.Track().Elements()) {
+      const Image& image = reconstruction.Image(track_el.image_id);
+      const Camera& camera = reconstruction.Camera(image.CameraId());
+      quality->sum_reproj_errors += CalculateReprojectionError(
+          image.Point2D(track_el.point2D_idx).XY(), point3D.second.XYZ(),
+          image.ProjectionMatrix(), camera);
+      quality->num_observations += 1;
+    }
+  }
+}
+
+std::string ModelQualityToJSON(const ModelQuality& quality) {
+  return StringPrintf(
+      "\"num_reg_images\":%d,\"num_points3D\":%d,\"num_observations\":%d,"
+      "\"mean_reprojection_error\":%.6f",
+      static_cast<int>(quality.num_reg_images),
+      static_cast<int>(quality.num_points3D),
+      static_cast<int>(quality.num_observations),
+      quality.MeanReprojectionError());
+}
+
+std::string CommandRunToJSON(const CommandRun& run) {
+  return StringPrintf(
+      "\"exit_code\":%d,\"wall_seconds\":%.6f,\"peak_rss_bytes\":%lld",
+      run.exit_code, run.wall_seconds,
+      static_cast<long long>(run.peak_rss_bytes));
+}
+
+// The resource report that a command wrote to the folder, renamed so that the
+// next command does not overwrite it, or null if there is none.
+std::string MoveResourceReport(const std::string& run_path,
+                               const std::string& command) {
+  const std::string report_path = JoinPaths(run_path, "resources.json");
+  if (!ExistsFile(report_path)) {
+    return "null";
+  }
+  const std::string command_report_path =
+      JoinPaths(run_path, command + "_resources.json");
+  boost::filesystem::rename(report_path, command_report_path);
+  std::ifstream file(command_report_path);
+  std::stringstream report;
+  report << file.rdbuf();
+  std::string json = report.str();
+  StringTrim(&json);
+  return json.empty() ? "null" : json;
+}
+
+}  // namespace
+
+// Reconstruct a two-body dataset, i.e. a folder with the database db.db and
+// the takes.txt, with the mapper and the postprocessor of the given colmap
+// binary and fixed random seeds, and write the wall time and peak resident
+// set size of both commands, their resource reports and the quality of their
+// models to a JSON report. Driven by scripts/python/two_body_regression.py,
+// which compares the reports of a build to stored baselines.
+int main(int argc, char** argv) {
+  InitializeGlog(argv);
+
+  std::string colmap_path = "colmap";
+  std::string dataset_path;
+  std::string image_path;
+  std::string output_path;
+  std::string report_path;
+  int random_seed = 0;
+  int num_threads = -1;
+
+  OptionManager options;
+  options.AddDefaultOption("colmap_path", &colmap_path);
+  options.AddRequiredOption("dataset_path", &dataset_path);
+  options.AddDefaultOption("image_path", &image_path);
+  options.AddRequiredOption("output_path", &output_path);
+  options.AddDefaultOption("report_path", &report_path);
+  options.AddDefaultOption("random_seed", &random_seed);
+  options.AddDefaultOption("num_threads", &num_threads);
+  options.Parse(argc, argv);
+
+  if (!ExistsDir(dataset_path)) {
+    std::cerr << "ERROR: `dataset_path` is not a directory." << std::endl;
+    return EXIT_FAILURE;
+  }
+  dataset_path = boost::filesystem::canonical(dataset_path).string();
+  const std::string database_path = JoinPaths(dataset_path, "db.db");
+  const std::string takes_path = JoinPaths(dataset_path, "takes.txt");
+  if (!ExistsFile(database_path) || !ExistsFile(takes_path)) {
+    std::cerr << "ERROR: `dataset_path` must contain db.db and takes.txt."
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (image_path.empty()) {
+    image_path = JoinPaths(dataset_path, "images");
+    if (!ExistsDir(image_path)) {
+      image_path = dataset_path;
+    }
+  }
+  image_path = boost::filesystem::absolute(image_path).string();
+
+  if (random_seed < 0) {
+    std::cerr << "ERROR: `random_seed` must not be negative." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // The commands read takes.txt from and write their outputs to the working
+  // directory, so every run starts in an empty folder.
+  if (ExistsDir(output_path)) {
+    boost::filesystem::remove_all(output_path);
+  }
+  boost::filesystem::create_directories(output_path);
+  output_path = boost::filesystem::absolute(output_path).string();
+  boost::filesystem::copy_file(takes_path,
+                               JoinPaths(output_path, "takes.txt"));
+  if (report_path.empty()) {
+    report_path = JoinPaths(output_path, "regression.json");
+  }
+
+  const std::string seed_str = std::to_string(random_seed);
+  const std::string num_threads_str = std::to_string(num_threads);
+
+  // The mapper options of the Run procedure of the README.
+  PrintHeading1("Mapper");
+  const CommandRun mapper_run = RunCommand(
+      {colmap_path, "mapper", "--database_path", database_path,
+       "--image_path", image_path, "--export_path", ".",
+       "--Mapper.init_max_reg_trials", "5", "--Mapper.init_num_trials", "400",
+       "--Mapper.abs_pose_min_inlier_ratio", "0.02", "--Mapper.num_threads",
+       num_threads_str, "--random_seed", seed_str},
+      output_path);
+  const std::string mapper_resources =
+      MoveResourceReport(output_path, "mapper");
+
+  CommandRun postprocessor_run;
+  std::string postprocessor_resources = "null";
+  if (mapper_run.exit_code == 0) {
+    PrintHeading1("Postprocessor");
+    postprocessor_run = RunCommand(
+        {colmap_path, "postprocessor", "--output_type", "BIN",
+         "--Postprocessor.num_threads", num_threads_str, "--random_seed",
+         seed_str},
+        output_path);
+    postprocessor_resources = MoveResourceReport(output_path, "postprocessor");
+  }
+
+  // The models of the takes, which the mapper writes to the take folders.
+  PrintHeading1("Evaluating models");
+  int num_takes = 0;
+  for (const auto& take : ReadTakeMap(takes_path)) {
+    num_takes = std::max(num_takes, take.second);
+  }
+  ModelQuality mapper_quality;
+  for (int take = 1; take <= num_takes; ++take) {
+    const std::string take_path = JoinPaths(output_path, std::to_string(take));
+    if (ExistsFile(JoinPaths(take_path, "cameras.bin"))) {
+      Reconstruction reconstruction;
+      reconstruction.Read(take_path);
+      AddModelQuality(reconstruction, &mapper_quality);
+    }
+  }
+
+  // The model of both bodies in real color.
+  ModelQuality postprocessor_quality;
+  const std::string model_path = JoinPaths(output_path, "model1");
+  if (postprocessor_run.exit_code == 0 &&
+      ExistsFile(JoinPaths(model_path, "cameras.bin"))) {
+    Reconstruction reconstruction;
+    reconstruction.Read(model_path);
+    AddModelQuality(reconstruction, &postprocessor_quality);
+  }
+
+  std::ofstream file(report_path, std::ios::trunc);
+  if (!file.is_open()) {
+    std::cerr << "ERROR: Could not write report to `" << report_path << "`."
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  file << StringPrintf("{\"dataset\":\"%s\",\"random_seed\":%d,\n",
+                       StringEscapeJSON(GetPathBaseName(dataset_path)).c_str(),
+                       random_seed);
+  file << "\"mapper\":{" << CommandRunToJSON(mapper_run) << ","
+       << ModelQualityToJSON(mapper_quality)
+       << ",\n\"resources\":" << mapper_resources << "},\n";
+  file << "\"postprocessor\":{" << CommandRunToJSON(postprocessor_run) << ","
+       << ModelQualityToJSON(postprocessor_quality)
+       << ",\n\"resources\":" << postprocessor_resources << "}}\n";
+
+  std::cout << "Wrote " << report_path << std::endl;
+
+  return mapper_run.exit_code == 0 && postprocessor_run.exit_code == 0
+             ? EXIT_SUCCESS
+             : EXIT_FAILURE;
+}
@@ -69,6 +69,7 @@ AutomaticReconstructionWidget::AutomaticReconstructionWidget(
   AddOptionInt(&options_.num_threads, "num_threads", -1);
   AddOptionBool(&options_.use_gpu, "GPU");
   AddOptionText(&options_.gpu_index, "gpu_index");
+  AddOptionBool(&options_.pipelined, "Overlap stages");
 
   AddSpacer();
 
@@ -52,6 +52,10 @@ class StereoOptionsTab : public OptionsWidget {
     AddOptionDouble(&options->dense_stereo->incident_angle_sigma,
                     "incident_angle_sigma");
     AddOptionInt(&options->dense_stereo->num_iterations, "num_iterations");
+    AddOptionInt(&options->dense_stereo->num_pyramid_levels,
+                 "num_pyramid_levels", 1);
+    AddOptionInt(&options->dense_stereo->pyramid_num_iterations,
+                 "pyramid_num_iterations", 1);
     AddOptionBool(&options->dense_stereo->geom_consistency, "geom_consistency");
     AddOptionDouble(&options->dense_stereo->geom_consistency_regularizer,
                     "geom_consistency_regularizer");
@@ -65,11 +69,19 @@ class StereoOptionsTab : public OptionsWidget {
                  "filter_min_num_consistent");
     AddOptionDouble(&options->dense_stereo->filter_geom_consistency_max_cost,
                     "filter_geom_consistency_max_cost");
+    AddOptionBool(&options->dense_stereo->half_precision_maps,
+                  "half_precision_maps");
     AddOptionDouble(&options->dense_stereo->cache_size,
                     "cache_size [gigabytes]", 0,
                     std::numeric_limits<double>::max(), 0.1, 1);
     AddOptionBool(&options->dense_stereo->write_consistency_graph,
                   "write_consistency_graph");
+    AddOptionBool(&options->dense_stereo->write_tiled_maps,
+                  "write_tiled_maps");
+    AddOptionInt(&options->dense_stereo->tiled_maps_tile_size,
+                 "tiled_maps_tile_size", 1, 4096);
+    AddOptionBool(&options->dense_stereo->tiled_maps_half_precision,
+                  "tiled_maps_half_precision");
   }
 };
 
@@ -93,6 +105,8 @@ class FusionOptionsTab : public OptionsWidget {
     AddOptionDouble(&options->dense_fusion->cache_size,
                     "cache_size [gigabytes]", 0,
                     std::numeric_limits<double>::max(), 0.1, 1);
+    AddOptionInt(&options->dense_fusion->num_threads, "num_threads", -1);
+    AddOptionInt(&options->dense_fusion->num_cells, "num_cells", 1);
   }
 };
 
@@ -104,6 +118,8 @@ class MeshingOptionsTab : public OptionsWidget {
     AddOptionInt(&options->dense_meshing->depth, "depth", 1);
     AddOptionDouble(&options->dense_meshing->color, "color", 0);
     AddOptionDouble(&options->dense_meshing->trim, "trim", 0);
+    AddOptionDouble(&options->dense_meshing->samples_per_node,
+                    "samples_per_node", 0);
     AddOptionInt(&options->dense_meshing->num_threads, "num_threads", -1);
   }
 };
@@ -61,6 +61,10 @@ SIFTExtractionWidget::SIFTExtractionWidget(QWidget* parent,
     : ExtractionWidget(parent, options) {
   AddOptionInt(&options->sift_extraction->max_image_size, "max_image_size");
   AddOptionInt(&options->sift_extraction->max_num_features, "max_num_features");
+  AddOptionInt(&options->sift_extraction->tile_size, "tile_size", 0);
+  AddOptionInt(&options->sift_extraction->tile_overlap, "tile_overlap", 0);
+  AddOptionInt(&options->sift_extraction->num_tile_threads, "num_tile_threads",
+               -1);
   AddOptionInt(&options->sift_extraction->first_octave, "first_octave", -5);
   AddOptionInt(&options->sift_extraction->num_octaves, "num_octaves");
   AddOptionInt(&options->sift_extraction->octave_resolution,
@@ -84,6 +88,8 @@ SIFTExtractionWidget::SIFTExtractionWidget(QWidget* parent,
   AddOptionInt(&options->sift_extraction->num_threads, "num_threads", -1);
   AddOptionBool(&options->sift_extraction->use_gpu, "use_gpu");
   AddOptionText(&options->sift_extraction->gpu_index, "gpu_index");
+  AddOptionDirPath(&options->sift_extraction->feature_cache_path,
+                   "feature_cache_path");
 }
 
 void SIFTExtractionWidget::Run() {
@@ -99,9 +99,25 @@ void FeatureMatchingTab::CreateGeneralOptions() {
   AddOptionInt(&options_->sift_matching->max_num_trials, "max_num_trials");
   AddOptionDouble(&options_->sift_matching->min_inlier_ratio,
                   "min_inlier_ratio", 0, 1, 0.001, 3);
+  AddOptionBool(&options_->sift_matching->use_sprt, "use_sprt");
   AddOptionInt(&options_->sift_matching->min_num_inliers, "min_num_inliers");
+  AddOptionBool(&options_->sift_matching->joint_verification,
+                "joint_verification");
+  AddOptionBool(&options_->sift_matching->gpu_verification,
+                "gpu_verification");
+  AddOptionInt(&options_->sift_matching->verification_batch_size,
+               "verification_batch_size", 1);
   AddOptionBool(&options_->sift_matching->multiple_models, "multiple_models");
+  AddOptionInt(&options_->sift_matching->max_num_models, "max_num_models", 1);
   AddOptionBool(&options_->sift_matching->guided_matching, "guided_matching");
+  AddOptionDouble(&options_->sift_matching->descriptor_cache_size,
+                  "descriptor_cache_size [GB]", 0);
+  AddOptionFilePath(&options_->sift_matching->descriptor_store_path,
+                    "descriptor_store_path");
+  AddOptionBool(&options_->sift_matching->use_descriptor_codes,
+                "use_descriptor_codes");
+  AddOptionDirPath(&options_->sift_matching->feature_cache_path,
+                   "feature_cache_path");
 
   AddSpacer();
 
@@ -114,6 +130,11 @@ ExhaustiveMatchingTab::ExhaustiveMatchingTab(QWidget* parent,
                                              OptionManager* options)
     : FeatureMatchingTab(parent, options) {
   AddOptionInt(&options_->exhaustive_matching->block_size, "block_size", 2);
+  AddOptionFilePath(&options_->exhaustive_matching->takes_path, "takes_path");
+  AddOptionInt(&options_->exhaustive_matching->num_cross_take_images,
+               "num_cross_take_images", -1);
+  AddOptionFilePath(&options_->exhaustive_matching->vocab_tree_path,
+                    "vocab_tree_path");
 
   CreateGeneralOptions();
 }
@@ -149,6 +170,9 @@ SequentialMatchingTab::SequentialMatchingTab(QWidget* parent,
                "loop_detection_num_images_after_verification", 0);
   AddOptionInt(&options_->sequential_matching->loop_detection_max_num_features,
                "loop_detection_max_num_features", -1);
+  AddOptionFilePath(&options_->sequential_matching->takes_path, "takes_path");
+  AddOptionInt(&options_->sequential_matching->num_cross_take_images,
+               "num_cross_take_images", -1);
   AddOptionFilePath(&options_->sequential_matching->vocab_tree_path,
                     "vocab_tree_path");
 
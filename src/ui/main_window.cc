@@ -1049,7 +1049,12 @@ void MainWindow::Render() {
 
   render_options_widget_->counter += 1;
 
-  RenderNow();
+  // Only copy the changes of the reconstruction that is being built instead of
+  // reloading it completely after every registered image.
+  reconstruction_manager_widget_->Update();
+  model_viewer_widget_->reconstruction =
+      &reconstruction_manager_.Get(SelectedReconstructionIdx());
+  model_viewer_widget_->UpdateReconstruction();
 }
 
 void MainWindow::RenderNow() {
@@ -141,7 +141,9 @@ ModelViewerWidget::ModelViewerWidget(QWidget* parent, OptionManager* options)
       selected_image_id_(kInvalidImageId),
       selected_point3D_id_(kInvalidPoint3DId),
       coordinate_grid_enabled_(true),
-      near_plane_(kInitNearPlane) {
+      near_plane_(kInitNearPlane),
+      recorded_reconstruction_(nullptr),
+      upload_pending_(false) {
   bg_color_[0] = 1.0f;
   bg_color_[1] = 1.0f;
   bg_color_[2] = 1.0f;
@@ -196,8 +198,14 @@ void ModelViewerWidget::paintGL() {
     coordinate_grid_painter_.Render(pmvc_matrix, width(), height(), 1);
   }
 
-  // Points
-  point_painter_.Render(pmv_matrix, point_size_);
+  // Points, of which the pending ones are uploaded progressively frame by
+  // frame, so that large models do not block the user interface.
+  if (point_painter_.UploadPending(
+          static_cast<size_t>(options_->render->num_points_per_upload))) {
+    update();
+  }
+  point_painter_.Render(pmv_matrix, point_size_,
+                        static_cast<size_t>(options_->render->max_num_points));
   point_connection_painter_.Render(pmv_matrix, width(), height(), 1);
 
   // Images
@@ -220,8 +228,15 @@ void ModelViewerWidget::resizeGL(int width, int height) {
 void ModelViewerWidget::ReloadReconstruction() {
   CHECK_NOTNULL(reconstruction);
 
+  // All changes recorded so far are contained in the full copy.
+  if (reconstruction->IsRecordingChanges()) {
+    reconstruction->TakeChanges();
+  }
+
   cameras = reconstruction->Cameras();
-  points3D = reconstruction->Points3D();
+  points3D.clear();
+  points3D.insert(reconstruction->Points3D().begin(),
+                  reconstruction->Points3D().end());
   reg_image_ids = reconstruction->RegImageIds();
 
   images.clear();
@@ -236,12 +251,63 @@ void ModelViewerWidget::ReloadReconstruction() {
   Upload();
 }
 
+void ModelViewerWidget::UpdateReconstruction() {
+  CHECK_NOTNULL(reconstruction);
+
+  if (reconstruction != recorded_reconstruction_ ||
+      !reconstruction->IsRecordingChanges()) {
+    reconstruction->EnableChangeRecording();
+    recorded_reconstruction_ = reconstruction;
+    ReloadReconstruction();
+    return;
+  }
+
+  const Reconstruction::Changes changes = reconstruction->TakeChanges();
+  if (changes.all) {
+    ReloadReconstruction();
+    return;
+  }
+
+  cameras = reconstruction->Cameras();
+  reg_image_ids = reconstruction->RegImageIds();
+
+  for (const image_t image_id : changes.image_ids) {
+    if (reconstruction->ExistsImage(image_id) &&
+        reconstruction->IsImageRegistered(image_id)) {
+      images[image_id] = reconstruction->Image(image_id);
+    } else {
+      images.erase(image_id);
+    }
+  }
+
+  for (const point3D_t point3D_id : changes.point3D_ids) {
+    if (reconstruction->ExistsPoint3D(point3D_id)) {
+      points3D[point3D_id] = reconstruction->Point3D(point3D_id);
+    } else {
+      points3D.erase(point3D_id);
+    }
+  }
+
+  statusbar_status_label->setText(QString().sprintf(
+      "%d Images - %d Points", static_cast<int>(reg_image_ids.size()),
+      static_cast<int>(points3D.size())));
+
+  if (!upload_pending_) {
+    upload_pending_ = true;
+    QTimer::singleShot(0, this, [this]() {
+      upload_pending_ = false;
+      Upload();
+    });
+  }
+}
+
 void ModelViewerWidget::ClearReconstruction() {
   cameras.clear();
   images.clear();
   points3D.clear();
   reg_image_ids.clear();
   reconstruction = nullptr;
+  recorded_reconstruction_ = nullptr;
   Upload();
 }
 
@@ -412,7 +478,8 @@ void ModelViewerWidget::SelectObject(const int x, const int y) {
   // Render in selection mode, with larger points to improve selection accuracy.
   const QMatrix4x4 pmv_matrix = projection_matrix_ * model_view_matrix_;
   image_triangle_painter_.Render(pmv_matrix);
-  point_painter_.Render(pmv_matrix, 2 * point_size_);
+  point_painter_.Render(pmv_matrix, 2 * point_size_,
+                        static_cast<size_t>(options_->render->max_num_points));
 
   const int scaled_x = devicePixelRatio() * x;
   const int scaled_y = devicePixelRatio() * (height() - y - 1);
@@ -735,7 +802,13 @@ void ModelViewerWidget::UploadPointData(const bool selection_mode) {
     }
   }
 
-  point_painter_.Upload(data);
+  // Objects can only be selected once all points are uploaded.
+  if (selection_mode) {
+    point_painter_.Upload(data);
+  } else {
+    point_painter_.Upload(
+        data, static_cast<size_t>(options_->render->num_points_per_upload));
+  }
 }
 
 void ModelViewerWidget::UploadPointConnectionData() {
@@ -64,6 +64,12 @@ class ModelViewerWidget : public QOpenGLWidget,
   void ReloadReconstruction();
   void ClearReconstruction();
 
+  // Copy only the images and 3D points that changed since the last reload or
+  // update, which requires less time than a full reload of a large
+  // reconstruction that is still being built. The upload to the GPU is
+  // deferred to the event loop, so that the caller is not blocked by it.
+  void UpdateReconstruction();
+
   int GetProjectionType() const;
 
   void SetPointColormap(PointColormapBase* colormap);
@@ -188,6 +194,11 @@ class ModelViewerWidget : public QOpenGLWidget,
   // Near clipping plane.
   float near_plane_;
 
+  // The reconstruction whose changes are recorded for incremental updates.
+  const Reconstruction* recorded_reconstruction_;
+  // Whether a deferred upload of the scene data is queued.
+  bool upload_pending_;
+
   float bg_color_[3];
 };
 
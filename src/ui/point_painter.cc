@@ -16,11 +16,96 @@
 
 #include "ui/point_painter.h"
 
+#include <algorithm>
+#include <random>
+
 #include "util/opengl_utils.h"
 
 namespace colmap {
+namespace {
+
+// Reorder the points by the level of the octree over their bounding box, at
+// which they are the first point of their octree cell, and randomly within
+// every level. Every prefix of the reordered points thus covers the model
+// evenly and only the densest regions are thinned out.
+std::vector<PointPainter::Data> SortPointsByLevelOfDetail(
+    const std::vector<PointPainter::Data>& data) {
+  const int kMaxLevel = 10;
+
+  if (data.size() < 2) {
+    return data;
+  }
+
+  float min_coords[3] = {data[0].x, data[0].y, data[0].z};
+  float max_coords[3] = {data[0].x, data[0].y, data[0].z};
+  for (const auto& point : data) {
+    const float coords[3] = {point.x, point.y, point.z};
+    for (int d = 0; d < 3; ++d) {
+      min_coords[d] = std::min(min_coords[d], coords[d]);
+      max_coords[d] = std::max(max_coords[d], coords[d]);
+    }
+  }
+
+  const double extent = std::max(max_coords[0] - min_coords[0],
+                                 std::max(max_coords[1] - min_coords[1],
+                                          max_coords[2] - min_coords[2]));
+  if (!(extent > 0)) {
+    return data;
+  }
+
+  // Morton codes of the points in the finest octree level.
+  const double scale = ((1 << kMaxLevel) - 1) / extent;
+  std::vector<std::pair<uint32_t, uint32_t>> codes(data.size());
+  for (size_t i = 0; i < data.size(); ++i) {
+    const float coords[3] = {data[i].x, data[i].y, data[i].z};
+    uint32_t code = 0;
+    for (int d = 0; d < 3; ++d) {
+      const uint32_t cell = static_cast<uint32_t>(
+          std::min(std::max(scale * (coords[d] - min_coords[d]), 0.0),
+                   static_cast<double>((1 << kMaxLevel) - 1)));
+      for (int bit = 0; bit < kMaxLevel; ++bit) {
+        code |= ((cell >> bit) & 1) << (3 * bit + d);
+      }
+    }
+    codes[i] = std::make_pair(code, static_cast<uint32_t>(i));
+  }
+
+  std::sort(codes.begin(), codes.end());
+
+  // In Morton order, a point is the first of its cell at all levels, whose
+  // cells are distinguished by the highest bit it differs in from the previous
+  // point. Points in the same finest cell as their predecessor come last.
+  std::vector<std::vector<uint32_t>> levels(kMaxLevel + 2);
+  levels[0].push_back(codes[0].second);
+  for (size_t i = 1; i < codes.size(); ++i) {
+    uint32_t diff = codes[i].first ^ codes[i - 1].first;
+    int level = kMaxLevel + 1;
+    if (diff != 0) {
+      int highest_bit = 0;
+      while (diff >>= 1) {
+        highest_bit += 1;
+      }
+      level = kMaxLevel - highest_bit / 3;
+    }
+    levels[level].push_back(codes[i].second);
+  }
+
+  std::vector<PointPainter::Data> sorted_data;
+  sorted_data.reserve(data.size());
+  std::mt19937 random_engine(0);
+  for (auto& level : levels) {
+    std::shuffle(level.begin(), level.end(), random_engine);
+    for (const uint32_t idx : level) {
+      sorted_data.push_back(data[idx]);
+    }
+  }
+
+  return sorted_data;
+}
 
-PointPainter::PointPainter() : num_geoms_(0) {}
+}  // namespace
+
+PointPainter::PointPainter() : num_uploaded_geoms_(0) {}
 
 PointPainter::~PointPainter() {
   vao_.destroy();
@@ -50,19 +135,23 @@ void PointPainter::Setup() {
 #endif
 }
 
-void PointPainter::Upload(const std::vector<PointPainter::Data>& data) {
-  num_geoms_ = data.size();
-  if (num_geoms_ == 0) {
+void PointPainter::Upload(const std::vector<PointPainter::Data>& data,
+                          const size_t max_num_points_per_upload) {
+  num_uploaded_geoms_ = 0;
+  pending_data_.clear();
+  if (data.empty()) {
     return;
   }
 
+  pending_data_ = SortPointsByLevelOfDetail(data);
+
   vao_.bind();
   vbo_.bind();
 
-  // Upload data array to GPU
+  // Allocate the data array on the GPU, which is filled by `UploadPending`.
   vbo_.setUsagePattern(QOpenGLBuffer::DynamicDraw);
-  vbo_.allocate(data.data(),
-                static_cast<int>(data.size() * sizeof(PointPainter::Data)));
+  vbo_.allocate(
+      static_cast<int>(pending_data_.size() * sizeof(PointPainter::Data)));
 
   // in_position
   shader_program_.enableAttributeArray(0);
@@ -78,14 +167,43 @@ void PointPainter::Upload(const std::vector<PointPainter::Data>& data) {
   vbo_.release();
   vao_.release();
 
+  UploadPending(max_num_points_per_upload);
+}
+
+bool PointPainter::UploadPending(const size_t max_num_points_per_upload) {
+  if (num_uploaded_geoms_ >= pending_data_.size()) {
+    return false;
+  }
+
+  const size_t num_geoms =
+      std::min(max_num_points_per_upload,
+               pending_data_.size() - num_uploaded_geoms_);
+
+  vbo_.bind();
+  vbo_.write(static_cast<int>(num_uploaded_geoms_ * sizeof(PointPainter::Data)),
+             pending_data_.data() + num_uploaded_geoms_,
+             static_cast<int>(num_geoms * sizeof(PointPainter::Data)));
+  vbo_.release();
+
 #if DEBUG
   glDebugLog();
 #endif
+
+  num_uploaded_geoms_ += num_geoms;
+  if (num_uploaded_geoms_ == pending_data_.size()) {
+    pending_data_.clear();
+    pending_data_.shrink_to_fit();
+    return false;
+  }
+
+  return true;
 }
 
 void PointPainter::Render(const QMatrix4x4& pmv_matrix,
-                          const float point_size) {
-  if (num_geoms_ == 0) {
+                          const float point_size,
+                          const size_t max_num_points) {
+  const size_t num_geoms = std::min(num_uploaded_geoms_, max_num_points);
+  if (num_geoms == 0) {
     return;
   }
 
@@ -95,7 +213,7 @@ void PointPainter::Render(const QMatrix4x4& pmv_matrix,
   shader_program_.setUniformValue("u_pmv_matrix", pmv_matrix);
   shader_program_.setUniformValue("u_point_size", point_size);
 
-  glDrawArrays(GL_POINTS, 0, (GLsizei)num_geoms_);
+  glDrawArrays(GL_POINTS, 0, (GLsizei)num_geoms);
 
   // Make sure the VAO is not changed from the outside
   vao_.release();
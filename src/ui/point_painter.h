@@ -17,6 +17,9 @@
 #ifndef COLMAP_SRC_UI_POINT_PAINTER_H_
 #define COLMAP_SRC_UI_POINT_PAINTER_H_
 
+#include <limits>
+#include <vector>
+
 #include <QtCore>
 #include <QtOpenGL>
 
@@ -38,15 +41,30 @@ class PointPainter {
   };
 
   void Setup();
-  void Upload(const std::vector<PointPainter::Data>& data);
-  void Render(const QMatrix4x4& pmv_matrix, const float point_size);
+
+  // Upload the points, which are first reordered by their level of detail,
+  // such that every prefix of the points covers the model evenly. Only the
+  // first `max_num_points_per_upload` points are uploaded immediately, the
+  // remaining points are uploaded by subsequent calls to `UploadPending`.
+  void Upload(const std::vector<PointPainter::Data>& data,
+              const size_t max_num_points_per_upload =
+                  std::numeric_limits<size_t>::max());
+
+  // Upload the next pending points and return whether points remain pending.
+  bool UploadPending(const size_t max_num_points_per_upload);
+
+  // Render at most `max_num_points` of the uploaded points in the order of
+  // their level of detail.
+  void Render(const QMatrix4x4& pmv_matrix, const float point_size,
+              const size_t max_num_points = std::numeric_limits<size_t>::max());
 
  private:
   QOpenGLShaderProgram shader_program_;
   QOpenGLVertexArrayObject vao_;
   QOpenGLBuffer vbo_;
 
-  size_t num_geoms_;
+  size_t num_uploaded_geoms_;
+  std::vector<PointPainter::Data> pending_data_;
 };
 
 }  // namespace colmap
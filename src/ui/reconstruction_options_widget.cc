@@ -34,6 +34,9 @@ MapperGeneralOptionsWidget::MapperGeneralOptionsWidget(QWidget* parent,
   AddOptionDirPath(&options->mapper->snapshot_path, "snapshot_path");
   AddOptionInt(&options->mapper->snapshot_images_freq, "snapshot_images_freq",
                0);
+  AddOptionDirPath(&options->mapper->out_of_core_path, "out_of_core_path");
+  AddOptionDouble(&options->mapper->mapper.out_of_core_cache_size,
+                  "out_of_core_cache_size [GB]");
 }
 
 MapperTriangulationOptionsWidget::MapperTriangulationOptionsWidget(
@@ -70,6 +73,14 @@ MapperRegistrationOptionsWidget::MapperRegistrationOptionsWidget(
                "abs_pose_min_num_inliers");
   AddOptionDouble(&options->mapper->mapper.abs_pose_min_inlier_ratio,
                   "abs_pose_min_inlier_ratio");
+  AddOptionBool(&options->mapper->mapper.abs_pose_use_sprt,
+                "abs_pose_use_sprt");
+  AddOptionBool(&options->mapper->mapper.abs_pose_joint_focal_length,
+                "abs_pose_joint_focal_length");
+  AddOptionBool(&options->mapper->mapper.seq_pose_prediction,
+                "seq_pose_prediction");
+  AddOptionInt(&options->mapper->mapper.seq_pose_prediction_num_trials,
+               "seq_pose_prediction_num_trials", 1);
   AddOptionInt(&options->mapper->mapper.max_reg_trials, "max_reg_trials", 1);
 }
 
@@ -88,6 +99,8 @@ MapperInitializationOptionsWidget::MapperInitializationOptionsWidget(
                   "init_min_tri_angle [deg]");
   AddOptionInt(&options->mapper->mapper.init_max_reg_trials,
                   "init_max_reg_trials", 1);
+  AddOptionInt(&options->mapper->mapper.init_num_parallel_pairs,
+               "init_num_parallel_pairs", 1);
 }
 
 MapperBundleAdjustmentOptionsWidget::MapperBundleAdjustmentOptionsWidget(
@@ -100,6 +113,11 @@ MapperBundleAdjustmentOptionsWidget::MapperBundleAdjustmentOptionsWidget(
                 "refine_principal_point");
   AddOptionBool(&options->mapper->ba_refine_extra_params,
                 "refine_extra_params");
+  AddOptionBool(&options->mapper->ba_mixed_precision, "mixed_precision");
+  AddOptionBool(&options->mapper->ba_rigid_object_motion,
+                "rigid_object_motion");
+  AddOptionBool(&options->mapper->ba_refinement_reuse_problem,
+                "refinement_reuse_problem");
 
   AddSpacer();
 
@@ -107,6 +125,7 @@ MapperBundleAdjustmentOptionsWidget::MapperBundleAdjustmentOptionsWidget(
   AddOptionInt(&options->mapper->ba_local_num_images, "num_images");
   AddOptionInt(&options->mapper->ba_local_max_num_iterations,
                "max_num_iterations");
+  AddOptionBool(&options->mapper->ba_local_batch, "batch");
   AddOptionInt(&options->mapper->ba_local_max_refinements, "max_refinements",
                1);
   AddOptionDouble(&options->mapper->ba_local_max_refinement_change,
@@ -124,6 +143,11 @@ MapperBundleAdjustmentOptionsWidget::MapperBundleAdjustmentOptionsWidget(
   AddOptionInt(&options->mapper->ba_global_max_num_iterations,
                "max_num_iterations");
   AddOptionInt(&options->mapper->ba_global_pba_gpu_index, "pba_gpu_index", -1);
+  AddOptionBool(&options->mapper->ba_global_incremental, "incremental");
+  AddOptionBool(&options->mapper->ba_global_subsample_points,
+                "subsample_points");
+  AddOptionInt(&options->mapper->ba_global_subsample_grid_size,
+               "subsample_grid_size", 1);
   AddOptionInt(&options->mapper->ba_global_max_refinements, "max_refinements",
                1);
   AddOptionDouble(&options->mapper->ba_global_max_refinement_change,
@@ -143,6 +167,8 @@ MapperFilteringOptionsWidget::MapperFilteringOptionsWidget(
                   "filter_max_reproj_error [px]");
   AddOptionDouble(&options->mapper->mapper.filter_min_tri_angle,
                   "filter_min_tri_angle [deg]");
+  AddOptionDouble(&options->mapper->mapper.filter_min_change,
+                  "filter_min_change", 0, 1, 1e-6, 6);
 }
 
 ReconstructionOptionsWidget::ReconstructionOptionsWidget(QWidget* parent,
@@ -23,6 +23,8 @@ namespace colmap {
 bool RenderOptions::Check() const {
   CHECK_OPTION_GE(min_track_len, 0);
   CHECK_OPTION_GE(max_error, 0);
+  CHECK_OPTION_GT(max_num_points, 0);
+  CHECK_OPTION_GT(num_points_per_upload, 0);
   CHECK_OPTION_GT(refresh_rate, 0);
   CHECK_OPTION(projection_type == ProjectionType::PERSPECTIVE ||
                projection_type == ProjectionType::ORTHOGRAPHIC);
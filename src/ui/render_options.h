@@ -33,6 +33,14 @@ struct RenderOptions {
   // Maximum error for a point to be rendered.
   double max_error = 2;
 
+  // Maximum number of rendered points. Larger models are thinned out evenly
+  // in space by the level of detail of the points.
+  int max_num_points = 2000000;
+
+  // Number of points uploaded to the GPU per frame, such that large models
+  // appear progressively without blocking the user interface.
+  int num_points_per_upload = 500000;
+
   // The rate of registered images at which to refresh.
   int refresh_rate = 1;
 
@@ -83,6 +83,9 @@ RenderOptionsWidget::RenderOptionsWidget(QWidget* parent,
 
   AddOptionDouble(&options->render->max_error, "Max. error [px]");
   AddOptionInt(&options->render->min_track_len, "Min. track length", 0);
+  AddOptionInt(&options->render->max_num_points, "Max. rendered points", 1);
+  AddOptionInt(&options->render->num_points_per_upload,
+               "Points uploaded per frame", 1);
 
   AddSpacer();
 
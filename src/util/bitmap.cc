@@ -89,7 +89,7 @@ void Bitmap::Deallocate() {
 }
 
 size_t Bitmap::NumBytes() const {
-  if (data_) {
+  if (data_ && FreeImage_HasPixels(data_.get())) {
     return ScanWidth() * height_;
   } else {
     return 0;
@@ -97,14 +97,18 @@ size_t Bitmap::NumBytes() const {
 }
 
 std::vector<uint8_t> Bitmap::ConvertToRawBits() const {
+  std::vector<uint8_t> raw_bits(ScanWidth() * height_, 0);
+  ConvertToRawBits(raw_bits.data());
+  return raw_bits;
+}
+
+void Bitmap::ConvertToRawBits(uint8_t* raw_bits) const {
   const unsigned int scan_width = ScanWidth();
   const unsigned int bpp = BitsPerPixel();
   const bool kTopDown = true;
-  std::vector<uint8_t> raw_bits(scan_width * height_, 0);
-  FreeImage_ConvertToRawBits(raw_bits.data(), data_.get(), scan_width, bpp,
+  FreeImage_ConvertToRawBits(raw_bits, data_.get(), scan_width, bpp,
                              FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK,
                              FI_RGBA_BLUE_MASK, kTopDown);
-  return raw_bits;
 }
 
 std::vector<uint8_t> Bitmap::ConvertToRowMajorArray() const {
@@ -186,6 +190,12 @@ const uint8_t* Bitmap::GetScanline(const int y) const {
   return FreeImage_GetScanLine(data_.get(), height_ - 1 - y);
 }
 
+uint8_t* Bitmap::GetScanline(const int y) {
+  CHECK_GE(y, 0);
+  CHECK_LT(y, height_);
+  return FreeImage_GetScanLine(data_.get(), height_ - 1 - y);
+}
+
 void Bitmap::Fill(const BitmapColor<uint8_t>& color) {
   for (int y = 0; y < height_; ++y) {
     uint8_t* line = FreeImage_GetScanLine(data_.get(), height_ - 1 - y);
@@ -391,7 +401,8 @@ bool Bitmap::ExifAltitude(double* altitude) {
   return false;
 }
 
-bool Bitmap::Read(const std::string& path, const bool as_rgb) {
+bool Bitmap::Read(const std::string& path, const bool as_rgb,
+                  const int max_image_size) {
   if (!ExistsFile(path)) {
     return false;
   }
@@ -402,7 +413,14 @@ bool Bitmap::Read(const std::string& path, const bool as_rgb) {
     return false;
   }
 
-  FIBITMAP* fi_bitmap = FreeImage_Load(format, path.c_str());
+  // The JPEG plugin of FreeImage takes the requested size in the upper 16 bits
+  // of the flags and then selects the scale of the IDCT.
+  int flags = 0;
+  if (format == FIF_JPEG && max_image_size > 0) {
+    flags = std::min(max_image_size, 0xFFFF) << 16;
+  }
+
+  FIBITMAP* fi_bitmap = FreeImage_Load(format, path.c_str(), flags);
   if (fi_bitmap == nullptr) {
     return false;
   }
@@ -429,6 +447,56 @@ bool Bitmap::Read(const std::string& path, const bool as_rgb) {
   return true;
 }
 
+bool Bitmap::ReadDimensions(const std::string& path, int* width,
+                            int* height) {
+  if (!ExistsFile(path)) {
+    return false;
+  }
+
+  const FREE_IMAGE_FORMAT format = FreeImage_GetFileType(path.c_str(), 0);
+
+  if (format == FIF_UNKNOWN) {
+    return false;
+  }
+
+  FIBITMAP* fi_bitmap =
+      FreeImage_Load(format, path.c_str(), FIF_LOAD_NOPIXELS);
+  if (fi_bitmap == nullptr) {
+    return false;
+  }
+
+  *width = FreeImage_GetWidth(fi_bitmap);
+  *height = FreeImage_GetHeight(fi_bitmap);
+  FreeImage_Unload(fi_bitmap);
+
+  return true;
+}
+
+bool Bitmap::ReadHeader(const std::string& path) {
+  if (!ExistsFile(path)) {
+    return false;
+  }
+
+  const FREE_IMAGE_FORMAT format = FreeImage_GetFileType(path.c_str(), 0);
+
+  if (format == FIF_UNKNOWN) {
+    return false;
+  }
+
+  FIBITMAP* fi_bitmap =
+      FreeImage_Load(format, path.c_str(), FIF_LOAD_NOPIXELS);
+  if (fi_bitmap == nullptr) {
+    return false;
+  }
+
+  data_ = FIBitmapPtr(fi_bitmap, &FreeImage_Unload);
+  width_ = FreeImage_GetWidth(fi_bitmap);
+  height_ = FreeImage_GetHeight(fi_bitmap);
+  channels_ = 0;
+
+  return true;
+}
+
 bool Bitmap::Write(const std::string& path, const FREE_IMAGE_FORMAT format,
                    const int flags) const {
   FREE_IMAGE_FORMAT save_format;
@@ -105,8 +105,10 @@ class Bitmap {
   // Number of bytes required to store image.
   size_t NumBytes() const;
 
-  // Copy raw image data to array.
+  // Copy raw image data to array. The raw bits are stored top-down with
+  // `ScanWidth` bytes per row, i.e. the array holds `NumBytes` bytes.
   std::vector<uint8_t> ConvertToRawBits() const;
+  void ConvertToRawBits(uint8_t* raw_bits) const;
   std::vector<uint8_t> ConvertToRowMajorArray() const;
   std::vector<uint8_t> ConvertToColMajorArray() const;
 
@@ -117,6 +119,7 @@ class Bitmap {
 
   // Get pointer to y-th scanline, where the 0-th scanline is at the top.
   const uint8_t* GetScanline(const int y) const;
+  uint8_t* GetScanline(const int y);
 
   // Fill entire bitmap with uniform color. For grayscale images, the first
   // element of the vector is used.
@@ -135,8 +138,25 @@ class Bitmap {
   bool ExifLongitude(double* longitude);
   bool ExifAltitude(double* altitude);
 
-  // Read bitmap at given path and convert to grey- or colorscale.
-  bool Read(const std::string& path, const bool as_rgb = true);
+  // Read bitmap at given path and convert to grey- or colorscale. If the
+  // maximum image size is positive, JPEG images are decoded directly at 1/2,
+  // 1/4 or 1/8 of their resolution with the scaled IDCT of libjpeg, where the
+  // largest reduction is chosen for which the larger dimension is at least the
+  // maximum image size. The decoded image then still has to be rescaled to
+  // the final size. Other formats are always decoded at full resolution.
+  bool Read(const std::string& path, const bool as_rgb = true,
+            const int max_image_size = 0);
+
+  // Read the dimensions of the bitmap at given path at full resolution, where
+  // only the header is decoded if the format supports it.
+  static bool ReadDimensions(const std::string& path, int* width,
+                             int* height);
+
+  // Read only the header and the metadata of the bitmap at given path, where
+  // the format supports it, such that its full dimensions and EXIF information
+  // are available without decoding the pixels. The bitmap then has no pixels,
+  // i.e. `NumBytes` is zero, and only its dimensions and EXIF may be accessed.
+  bool ReadHeader(const std::string& path);
 
   // Write image to file. Flags can be used to set e.g. the JPEG quality.
   // Consult the FreeImage documentation for all available flags.
@@ -17,6 +17,8 @@
 #define TEST_NAME "util/bitmap"
 #include "util/testing.h"
 
+#include <boost/filesystem.hpp>
+
 #include "util/bitmap.h"
 
 using namespace colmap;
@@ -370,3 +372,47 @@ BOOST_AUTO_TEST_CASE(TestCloneAsGrey) {
   BOOST_CHECK_EQUAL(cloned_bitmap.Channels(), 1);
   BOOST_CHECK_NE(bitmap.Data(), cloned_bitmap.Data());
 }
+
+BOOST_AUTO_TEST_CASE(TestReadScaled) {
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("bitmap_test_%%%%%%%%"))
+          .string();
+  const std::string jpeg_path = path + ".jpg";
+  const std::string png_path = path + ".png";
+
+  Bitmap bitmap;
+  bitmap.Allocate(640, 480, true);
+  bitmap.Fill(BitmapColor<uint8_t>(10, 20, 30));
+  BOOST_REQUIRE(bitmap.Write(jpeg_path));
+  BOOST_REQUIRE(bitmap.Write(png_path));
+
+  int width = 0;
+  int height = 0;
+  BOOST_CHECK(Bitmap::ReadDimensions(jpeg_path, &width, &height));
+  BOOST_CHECK_EQUAL(width, 640);
+  BOOST_CHECK_EQUAL(height, 480);
+
+  Bitmap read_bitmap;
+  BOOST_CHECK(read_bitmap.Read(jpeg_path, true));
+  BOOST_CHECK_EQUAL(read_bitmap.Width(), 640);
+  BOOST_CHECK_EQUAL(read_bitmap.Height(), 480);
+
+  // The JPEG image is decoded at a reduced resolution that is still at least
+  // the maximum image size, the PNG image at full resolution.
+  BOOST_CHECK(read_bitmap.Read(jpeg_path, true, 100));
+  BOOST_CHECK_LT(read_bitmap.Width(), 640);
+  BOOST_CHECK_GE(read_bitmap.Width(), 100);
+  BOOST_CHECK_EQUAL(read_bitmap.Width() * 3, read_bitmap.Height() * 4);
+  BOOST_CHECK_EQUAL(read_bitmap.Channels(), 3);
+  BOOST_CHECK(read_bitmap.Read(jpeg_path, true, 1000));
+  BOOST_CHECK_EQUAL(read_bitmap.Width(), 640);
+  BOOST_CHECK(read_bitmap.Read(png_path, false, 100));
+  BOOST_CHECK_EQUAL(read_bitmap.Width(), 640);
+  BOOST_CHECK_EQUAL(read_bitmap.Channels(), 1);
+
+  BOOST_CHECK(!Bitmap::ReadDimensions(path, &width, &height));
+
+  boost::filesystem::remove(jpeg_path);
+  boost::filesystem::remove(png_path);
+}
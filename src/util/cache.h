@@ -17,21 +17,38 @@
 #ifndef COLMAP_SRC_UTIL_CACHE_H_
 #define COLMAP_SRC_UTIL_CACHE_H_
 
-#include <iostream>
-#include <list>
-#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
 
 #include "util/logging.h"
+#include "util/memory_governor.h"
 
 namespace colmap {
 
 // Least Recently Used cache implementation. Whenever the cache size is
 // exceeded, the least recently used (by Get and GetMutable) is deleted.
+//
+// The elements are stored in slots that are recycled after eviction and that
+// are linked into the least-recently-used order through their indices. The
+// slots are looked up through an open-addressing hash table, so that neither
+// a hit nor, once the cache is full, a miss allocate memory. References to
+// elements stay valid until the element is evicted.
 template <typename key_t, typename value_t>
 class LRUCache {
  public:
   LRUCache(const size_t max_num_elems,
            const std::function<value_t(const key_t&)>& getter_func);
+  virtual ~LRUCache();
+
+  LRUCache(const LRUCache&) = delete;
+  LRUCache& operator=(const LRUCache&) = delete;
 
   // The number of elements in the cache.
   size_t NumElems() const;
@@ -55,20 +72,67 @@ class LRUCache {
   virtual void Clear();
 
  protected:
-  typedef typename std::pair<key_t, value_t> key_value_pair_t;
-  typedef typename std::list<key_value_pair_t>::iterator list_iterator_t;
+  typedef typename std::pair<const key_t, value_t> key_value_pair_t;
+
+  static const size_t kInvalidSlotIdx;
+
+  struct Slot {
+    typename std::aligned_storage<sizeof(key_value_pair_t),
+                                  alignof(key_value_pair_t)>::type elem;
+    size_t hash;
+    // Only maintained by MemoryConstrainedLRUCache.
+    size_t num_bytes;
+    // Neighbors in the least-recently-used list, or the next free slot.
+    size_t prev_idx;
+    size_t next_idx;
+
+    key_value_pair_t& Elem() {
+      return *reinterpret_cast<key_value_pair_t*>(&elem);
+    }
+    const key_value_pair_t& Elem() const {
+      return *reinterpret_cast<const key_value_pair_t*>(&elem);
+    }
+  };
+
+  // Find the slot of the element with the given key or kInvalidSlotIdx.
+  size_t FindSlot(const key_t& key) const;
+
+  // Insert the element as the most recently used element and return its slot.
+  // An existing element with the same key is replaced.
+  size_t InsertSlot(const key_t& key, value_t&& value);
+
+  // Destroy the element in the given slot and recycle the slot.
+  void EraseSlot(const size_t slot_idx);
+
+  // Mark the element in the given slot as the most recently used.
+  void MoveSlotToFront(const size_t slot_idx);
 
   // Maximum number of least-recently-used elements the cache remembers.
   const size_t max_num_elems_;
 
-  // List to keep track of the least-recently-used elements.
-  std::list<key_value_pair_t> elems_list_;
+  size_t num_elems_;
+
+  // The slots never move in memory, since a deque does not relocate its
+  // elements when growing at the end.
+  std::deque<Slot> slots_;
 
-  // Mapping from key to location in the list.
-  std::unordered_map<key_t, list_iterator_t> elems_map_;
+  // The most and least recently used elements and the first free slot.
+  size_t head_slot_idx_;
+  size_t tail_slot_idx_;
+  size_t free_slot_idx_;
+
+  // Hash table with linear probing from hash to slot index.
+  std::vector<size_t> buckets_;
+  int bucket_shift_;
 
   // Function to compute new values if not in the cache.
   const std::function<value_t(const key_t&)> getter_func_;
+
+ private:
+  size_t HomeBucketIdx(const size_t hash) const;
+  void Unlink(const size_t slot_idx);
+  void PushFront(const size_t slot_idx);
+  void Rehash(const size_t num_buckets);
 };
 
 // Least Recently Used cache implementation that is constrained by a maximum
@@ -81,44 +145,116 @@ class MemoryConstrainedLRUCache : public LRUCache<key_t, value_t> {
   MemoryConstrainedLRUCache(
       const size_t max_num_bytes,
       const std::function<value_t(const key_t&)>& getter_func);
+  ~MemoryConstrainedLRUCache();
 
   size_t NumBytes() const;
   size_t MaxNumBytes() const;
   void UpdateNumBytes(const key_t& key);
 
+  // Report the bytes of the cache to a consumer of the memory governor, which
+  // may be shared by several caches, and additionally evict elements whenever
+  // the cache grows while the consumer exceeds its limit.
+  void SetMemoryConsumer(MemoryConsumer* memory_consumer);
+
   void Set(const key_t& key, value_t&& value) override;
   void Pop() override;
   void Clear() override;
 
  private:
-  using typename LRUCache<key_t, value_t>::key_value_pair_t;
-  using typename LRUCache<key_t, value_t>::list_iterator_t;
-  using LRUCache<key_t, value_t>::max_num_elems_;
-  using LRUCache<key_t, value_t>::elems_list_;
-  using LRUCache<key_t, value_t>::elems_map_;
-  using LRUCache<key_t, value_t>::getter_func_;
+  using LRUCache<key_t, value_t>::kInvalidSlotIdx;
+  using LRUCache<key_t, value_t>::num_elems_;
+  using LRUCache<key_t, value_t>::slots_;
+  using LRUCache<key_t, value_t>::tail_slot_idx_;
+
+  void Shrink();
 
   const size_t max_num_bytes_;
   size_t num_bytes_;
-  std::unordered_map<key_t, size_t> elems_num_bytes_;
+  MemoryConsumer* memory_consumer_;
+};
+
+// Thread-safe Least Recently Used cache, which distributes the elements over
+// multiple independently locked caches by the hash of their keys. Concurrent
+// accesses only contend if they fall into the same shard, and a slow getter
+// function only blocks the accesses to its own shard. Since another thread may
+// evict an element at any time, values are returned as copies that are made
+// while the shard is locked.
+template <typename key_t, typename value_t>
+class ShardedLRUCache {
+ public:
+  static const size_t kDefaultNumShards = 8;
+
+  // Create a cache with shards of type `cache_t`, e.g. LRUCache or
+  // MemoryConstrainedLRUCache, between which the maximum size is divided.
+  template <typename cache_t>
+  static ShardedLRUCache* Create(
+      const size_t max_size,
+      const std::function<value_t(const key_t&)>& getter_func,
+      const size_t num_shards = kDefaultNumShards);
+
+  size_t NumShards() const;
+  size_t NumElems() const;
+
+  bool Exists(const key_t& key) const;
+
+  value_t Get(const key_t& key);
+
+  // Compute the value of an element, unless it is already cached, and mark it
+  // as most recently used, without copying it as Get does.
+  void Load(const key_t& key);
+
+  void Set(const key_t& key, value_t&& value);
+
+  void Clear();
+
+  // Set the memory consumer of the shards, which must be memory-constrained.
+  void SetMemoryConsumer(MemoryConsumer* memory_consumer);
+
+ private:
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unique_ptr<LRUCache<key_t, value_t>> cache;
+  };
+
+  explicit ShardedLRUCache(const size_t num_shards);
+
+  Shard& GetShard(const key_t& key) const;
+
+  const size_t num_shards_;
+  std::unique_ptr<Shard[]> shards_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
 
+template <typename key_t, typename value_t>
+const size_t LRUCache<key_t, value_t>::kInvalidSlotIdx =
+    std::numeric_limits<size_t>::max();
+
 template <typename key_t, typename value_t>
 LRUCache<key_t, value_t>::LRUCache(
     const size_t max_num_elems,
     const std::function<value_t(const key_t&)>& getter_func)
-    : max_num_elems_(max_num_elems), getter_func_(getter_func) {
+    : max_num_elems_(max_num_elems),
+      num_elems_(0),
+      head_slot_idx_(kInvalidSlotIdx),
+      tail_slot_idx_(kInvalidSlotIdx),
+      free_slot_idx_(kInvalidSlotIdx),
+      bucket_shift_(64),
+      getter_func_(getter_func) {
   CHECK(getter_func);
   CHECK_GT(max_num_elems, 0);
 }
 
+template <typename key_t, typename value_t>
+LRUCache<key_t, value_t>::~LRUCache() {
+  LRUCache<key_t, value_t>::Clear();
+}
+
 template <typename key_t, typename value_t>
 size_t LRUCache<key_t, value_t>::NumElems() const {
-  return elems_map_.size();
+  return num_elems_;
 }
 
 template <typename key_t, typename value_t>
@@ -128,7 +264,7 @@ size_t LRUCache<key_t, value_t>::MaxNumElems() const {
 
 template <typename key_t, typename value_t>
 bool LRUCache<key_t, value_t>::Exists(const key_t& key) const {
-  return elems_map_.find(key) != elems_map_.end();
+  return FindSlot(key) != kInvalidSlotIdx;
 }
 
 template <typename key_t, typename value_t>
@@ -138,44 +274,203 @@ const value_t& LRUCache<key_t, value_t>::Get(const key_t& key) {
 
 template <typename key_t, typename value_t>
 value_t& LRUCache<key_t, value_t>::GetMutable(const key_t& key) {
-  const auto it = elems_map_.find(key);
-  if (it == elems_map_.end()) {
-    Set(key, std::move(getter_func_(key)));
-    return elems_map_[key]->second;
+  const size_t slot_idx = FindSlot(key);
+  if (slot_idx == kInvalidSlotIdx) {
+    Set(key, getter_func_(key));
+    // The new element is the most recently used and is never evicted by Set.
+    return slots_[head_slot_idx_].Elem().second;
   } else {
-    elems_list_.splice(elems_list_.begin(), elems_list_, it->second);
-    return it->second->second;
+    MoveSlotToFront(slot_idx);
+    return slots_[slot_idx].Elem().second;
   }
 }
 
 template <typename key_t, typename value_t>
 void LRUCache<key_t, value_t>::Set(const key_t& key, value_t&& value) {
-  auto it = elems_map_.find(key);
-  elems_list_.push_front(key_value_pair_t(key, std::move(value)));
-  if (it != elems_map_.end()) {
-    elems_list_.erase(it->second);
-    elems_map_.erase(it);
-  }
-  elems_map_[key] = elems_list_.begin();
-  if (elems_map_.size() > max_num_elems_) {
+  InsertSlot(key, std::move(value));
+  if (num_elems_ > max_num_elems_) {
     Pop();
   }
 }
 
 template <typename key_t, typename value_t>
 void LRUCache<key_t, value_t>::Pop() {
-  if (!elems_list_.empty()) {
-    auto last = elems_list_.end();
-    --last;
-    elems_map_.erase(last->first);
-    elems_list_.pop_back();
+  if (tail_slot_idx_ != kInvalidSlotIdx) {
+    EraseSlot(tail_slot_idx_);
   }
 }
 
 template <typename key_t, typename value_t>
 void LRUCache<key_t, value_t>::Clear() {
-  elems_list_.clear();
-  elems_map_.clear();
+  for (size_t slot_idx = head_slot_idx_; slot_idx != kInvalidSlotIdx;
+       slot_idx = slots_[slot_idx].next_idx) {
+    slots_[slot_idx].Elem().~key_value_pair_t();
+  }
+  num_elems_ = 0;
+  slots_.clear();
+  head_slot_idx_ = kInvalidSlotIdx;
+  tail_slot_idx_ = kInvalidSlotIdx;
+  free_slot_idx_ = kInvalidSlotIdx;
+  std::fill(buckets_.begin(), buckets_.end(), kInvalidSlotIdx);
+}
+
+template <typename key_t, typename value_t>
+size_t LRUCache<key_t, value_t>::FindSlot(const key_t& key) const {
+  if (num_elems_ == 0) {
+    return kInvalidSlotIdx;
+  }
+  const size_t hash = std::hash<key_t>()(key);
+  const size_t bucket_mask = buckets_.size() - 1;
+  for (size_t bucket_idx = HomeBucketIdx(hash);;
+       bucket_idx = (bucket_idx + 1) & bucket_mask) {
+    const size_t slot_idx = buckets_[bucket_idx];
+    if (slot_idx == kInvalidSlotIdx) {
+      return kInvalidSlotIdx;
+    }
+    const Slot& slot = slots_[slot_idx];
+    if (slot.hash == hash && slot.Elem().first == key) {
+      return slot_idx;
+    }
+  }
+}
+
+template <typename key_t, typename value_t>
+size_t LRUCache<key_t, value_t>::InsertSlot(const key_t& key,
+                                            value_t&& value) {
+  const size_t existing_slot_idx = FindSlot(key);
+  if (existing_slot_idx != kInvalidSlotIdx) {
+    EraseSlot(existing_slot_idx);
+  }
+
+  // Keep the load factor of the hash table at most 1/2.
+  if (2 * (num_elems_ + 1) > buckets_.size()) {
+    Rehash(std::max<size_t>(16, 2 * buckets_.size()));
+  }
+
+  size_t slot_idx;
+  if (free_slot_idx_ == kInvalidSlotIdx) {
+    slot_idx = slots_.size();
+    slots_.emplace_back();
+  } else {
+    slot_idx = free_slot_idx_;
+    free_slot_idx_ = slots_[slot_idx].next_idx;
+  }
+
+  Slot& slot = slots_[slot_idx];
+  new (&slot.elem) key_value_pair_t(key, std::move(value));
+  slot.hash = std::hash<key_t>()(key);
+  slot.num_bytes = 0;
+  PushFront(slot_idx);
+
+  const size_t bucket_mask = buckets_.size() - 1;
+  size_t bucket_idx = HomeBucketIdx(slot.hash);
+  while (buckets_[bucket_idx] != kInvalidSlotIdx) {
+    bucket_idx = (bucket_idx + 1) & bucket_mask;
+  }
+  buckets_[bucket_idx] = slot_idx;
+
+  num_elems_ += 1;
+
+  return slot_idx;
+}
+
+template <typename key_t, typename value_t>
+void LRUCache<key_t, value_t>::EraseSlot(const size_t slot_idx) {
+  Slot& slot = slots_[slot_idx];
+
+  // Remove the slot from the hash table by shifting back the following entries
+  // of its probe sequence, so that no tombstones are needed.
+  const size_t bucket_mask = buckets_.size() - 1;
+  size_t bucket_idx = HomeBucketIdx(slot.hash);
+  while (buckets_[bucket_idx] != slot_idx) {
+    bucket_idx = (bucket_idx + 1) & bucket_mask;
+  }
+  size_t next_bucket_idx = bucket_idx;
+  while (true) {
+    next_bucket_idx = (next_bucket_idx + 1) & bucket_mask;
+    const size_t next_slot_idx = buckets_[next_bucket_idx];
+    if (next_slot_idx == kInvalidSlotIdx) {
+      break;
+    }
+    const size_t home_bucket_idx = HomeBucketIdx(slots_[next_slot_idx].hash);
+    // Only move the entry if its home bucket is not cyclically in between the
+    // freed bucket and its current bucket.
+    if (((next_bucket_idx - home_bucket_idx) & bucket_mask) >=
+        ((next_bucket_idx - bucket_idx) & bucket_mask)) {
+      buckets_[bucket_idx] = next_slot_idx;
+      bucket_idx = next_bucket_idx;
+    }
+  }
+  buckets_[bucket_idx] = kInvalidSlotIdx;
+
+  Unlink(slot_idx);
+  slot.Elem().~key_value_pair_t();
+  slot.next_idx = free_slot_idx_;
+  free_slot_idx_ = slot_idx;
+
+  num_elems_ -= 1;
+}
+
+template <typename key_t, typename value_t>
+void LRUCache<key_t, value_t>::MoveSlotToFront(const size_t slot_idx) {
+  if (slot_idx != head_slot_idx_) {
+    Unlink(slot_idx);
+    PushFront(slot_idx);
+  }
+}
+
+template <typename key_t, typename value_t>
+size_t LRUCache<key_t, value_t>::HomeBucketIdx(const size_t hash) const {
+  // Fibonacci hashing, since std::hash is the identity for integer keys.
+  return static_cast<size_t>(
+      (static_cast<uint64_t>(hash) * UINT64_C(11400714819323198485)) >>
+      bucket_shift_);
+}
+
+template <typename key_t, typename value_t>
+void LRUCache<key_t, value_t>::Unlink(const size_t slot_idx) {
+  Slot& slot = slots_[slot_idx];
+  if (slot.prev_idx == kInvalidSlotIdx) {
+    head_slot_idx_ = slot.next_idx;
+  } else {
+    slots_[slot.prev_idx].next_idx = slot.next_idx;
+  }
+  if (slot.next_idx == kInvalidSlotIdx) {
+    tail_slot_idx_ = slot.prev_idx;
+  } else {
+    slots_[slot.next_idx].prev_idx = slot.prev_idx;
+  }
+}
+
+template <typename key_t, typename value_t>
+void LRUCache<key_t, value_t>::PushFront(const size_t slot_idx) {
+  Slot& slot = slots_[slot_idx];
+  slot.prev_idx = kInvalidSlotIdx;
+  slot.next_idx = head_slot_idx_;
+  if (head_slot_idx_ == kInvalidSlotIdx) {
+    tail_slot_idx_ = slot_idx;
+  } else {
+    slots_[head_slot_idx_].prev_idx = slot_idx;
+  }
+  head_slot_idx_ = slot_idx;
+}
+
+template <typename key_t, typename value_t>
+void LRUCache<key_t, value_t>::Rehash(const size_t num_buckets) {
+  buckets_.assign(num_buckets, kInvalidSlotIdx);
+  bucket_shift_ = 64;
+  for (size_t n = num_buckets; n > 1; n >>= 1) {
+    bucket_shift_ -= 1;
+  }
+  const size_t bucket_mask = num_buckets - 1;
+  for (size_t slot_idx = head_slot_idx_; slot_idx != kInvalidSlotIdx;
+       slot_idx = slots_[slot_idx].next_idx) {
+    size_t bucket_idx = HomeBucketIdx(slots_[slot_idx].hash);
+    while (buckets_[bucket_idx] != kInvalidSlotIdx) {
+      bucket_idx = (bucket_idx + 1) & bucket_mask;
+    }
+    buckets_[bucket_idx] = slot_idx;
+  }
 }
 
 template <typename key_t, typename value_t>
@@ -184,10 +479,16 @@ MemoryConstrainedLRUCache<key_t, value_t>::MemoryConstrainedLRUCache(
     const std::function<value_t(const key_t&)>& getter_func)
     : LRUCache<key_t, value_t>(std::numeric_limits<size_t>::max(), getter_func),
       max_num_bytes_(max_num_bytes),
-      num_bytes_(0) {
+      num_bytes_(0),
+      memory_consumer_(nullptr) {
   CHECK_GT(max_num_bytes, 0);
 }
 
+template <typename key_t, typename value_t>
+MemoryConstrainedLRUCache<key_t, value_t>::~MemoryConstrainedLRUCache() {
+  SetMemoryConsumer(nullptr);
+}
+
 template <typename key_t, typename value_t>
 size_t MemoryConstrainedLRUCache<key_t, value_t>::NumBytes() const {
   return num_bytes_;
@@ -198,58 +499,189 @@ size_t MemoryConstrainedLRUCache<key_t, value_t>::MaxNumBytes() const {
   return max_num_bytes_;
 }
 
+template <typename key_t, typename value_t>
+void MemoryConstrainedLRUCache<key_t, value_t>::SetMemoryConsumer(
+    MemoryConsumer* memory_consumer) {
+  if (memory_consumer_ != nullptr) {
+    memory_consumer_->SubtractNumBytes(num_bytes_);
+  }
+  memory_consumer_ = memory_consumer;
+  if (memory_consumer_ != nullptr) {
+    memory_consumer_->AddNumBytes(num_bytes_);
+  }
+}
+
 template <typename key_t, typename value_t>
 void MemoryConstrainedLRUCache<key_t, value_t>::Set(const key_t& key,
                                                     value_t&& value) {
-  auto it = elems_map_.find(key);
-  elems_list_.push_front(key_value_pair_t(key, std::move(value)));
-  if (it != elems_map_.end()) {
-    elems_list_.erase(it->second);
-    elems_map_.erase(it);
+  const size_t existing_slot_idx = this->FindSlot(key);
+  if (existing_slot_idx != kInvalidSlotIdx) {
+    num_bytes_ -= slots_[existing_slot_idx].num_bytes;
+    if (memory_consumer_ != nullptr) {
+      memory_consumer_->SubtractNumBytes(slots_[existing_slot_idx].num_bytes);
+    }
   }
-  elems_map_[key] = elems_list_.begin();
 
   const size_t num_bytes = value.NumBytes();
+  const size_t slot_idx = this->InsertSlot(key, std::move(value));
+  slots_[slot_idx].num_bytes = num_bytes;
   num_bytes_ += num_bytes;
-  elems_num_bytes_.emplace(key, num_bytes);
-
-  while (num_bytes_ > max_num_bytes_ && elems_map_.size() > 1) {
-    Pop();
+  if (memory_consumer_ != nullptr) {
+    memory_consumer_->AddNumBytes(num_bytes);
   }
+
+  Shrink();
 }
 
 template <typename key_t, typename value_t>
 void MemoryConstrainedLRUCache<key_t, value_t>::Pop() {
-  if (!elems_list_.empty()) {
-    auto last = elems_list_.end();
-    --last;
-    num_bytes_ -= elems_num_bytes_.at(last->first);
-    CHECK_GE(num_bytes_, 0);
-    elems_num_bytes_.erase(last->first);
-    elems_map_.erase(last->first);
-    elems_list_.pop_back();
+  if (tail_slot_idx_ != kInvalidSlotIdx) {
+    CHECK_GE(num_bytes_, slots_[tail_slot_idx_].num_bytes);
+    num_bytes_ -= slots_[tail_slot_idx_].num_bytes;
+    if (memory_consumer_ != nullptr) {
+      memory_consumer_->SubtractNumBytes(slots_[tail_slot_idx_].num_bytes);
+    }
+    this->EraseSlot(tail_slot_idx_);
   }
 }
 
 template <typename key_t, typename value_t>
 void MemoryConstrainedLRUCache<key_t, value_t>::UpdateNumBytes(
     const key_t& key) {
-  auto& num_bytes = elems_num_bytes_.at(key);
-  num_bytes_ -= num_bytes;
-  CHECK_GE(num_bytes_, 0);
-  num_bytes = LRUCache<key_t, value_t>::Get(key).NumBytes();
-  num_bytes_ += num_bytes;
-
-  while (num_bytes_ > max_num_bytes_ && elems_map_.size() > 1) {
-    Pop();
+  const size_t slot_idx = this->FindSlot(key);
+  CHECK_NE(slot_idx, kInvalidSlotIdx);
+  this->MoveSlotToFront(slot_idx);
+
+  auto& slot = slots_[slot_idx];
+  CHECK_GE(num_bytes_, slot.num_bytes);
+  num_bytes_ -= slot.num_bytes;
+  if (memory_consumer_ != nullptr) {
+    memory_consumer_->SubtractNumBytes(slot.num_bytes);
   }
+  slot.num_bytes = slot.Elem().second.NumBytes();
+  num_bytes_ += slot.num_bytes;
+  if (memory_consumer_ != nullptr) {
+    memory_consumer_->AddNumBytes(slot.num_bytes);
+  }
+
+  Shrink();
 }
 
 template <typename key_t, typename value_t>
 void MemoryConstrainedLRUCache<key_t, value_t>::Clear() {
   LRUCache<key_t, value_t>::Clear();
+  if (memory_consumer_ != nullptr) {
+    memory_consumer_->SubtractNumBytes(num_bytes_);
+  }
   num_bytes_ = 0;
-  elems_num_bytes_.clear();
+}
+
+template <typename key_t, typename value_t>
+void MemoryConstrainedLRUCache<key_t, value_t>::Shrink() {
+  // The most recently used element is always kept.
+  while (num_bytes_ > max_num_bytes_ && num_elems_ > 1) {
+    Pop();
+  }
+  // A consumer shared by several caches is brought within its limit by the
+  // caches that grow.
+  if (memory_consumer_ != nullptr) {
+    const size_t max_consumer_num_bytes = memory_consumer_->CheckMaxNumBytes();
+    while (memory_consumer_->NumBytes() > max_consumer_num_bytes &&
+           num_elems_ > 1) {
+      Pop();
+    }
+  }
+}
+
+template <typename key_t, typename value_t>
+const size_t ShardedLRUCache<key_t, value_t>::kDefaultNumShards;
+
+template <typename key_t, typename value_t>
+template <typename cache_t>
+ShardedLRUCache<key_t, value_t>* ShardedLRUCache<key_t, value_t>::Create(
+    const size_t max_size,
+    const std::function<value_t(const key_t&)>& getter_func,
+    const size_t num_shards) {
+  CHECK_GT(num_shards, 0);
+  auto cache = new ShardedLRUCache<key_t, value_t>(num_shards);
+  // Round up, so that the shards together hold at least max_size.
+  const size_t max_shard_size = (max_size + num_shards - 1) / num_shards;
+  for (size_t i = 0; i < num_shards; ++i) {
+    cache->shards_[i].cache.reset(new cache_t(max_shard_size, getter_func));
+  }
+  return cache;
+}
+
+template <typename key_t, typename value_t>
+ShardedLRUCache<key_t, value_t>::ShardedLRUCache(const size_t num_shards)
+    : num_shards_(num_shards), shards_(new Shard[num_shards]) {}
+
+template <typename key_t, typename value_t>
+size_t ShardedLRUCache<key_t, value_t>::NumShards() const {
+  return num_shards_;
+}
+
+template <typename key_t, typename value_t>
+size_t ShardedLRUCache<key_t, value_t>::NumElems() const {
+  size_t num_elems = 0;
+  for (size_t i = 0; i < num_shards_; ++i) {
+    std::unique_lock<std::mutex> lock(shards_[i].mutex);
+    num_elems += shards_[i].cache->NumElems();
+  }
+  return num_elems;
+}
+
+template <typename key_t, typename value_t>
+bool ShardedLRUCache<key_t, value_t>::Exists(const key_t& key) const {
+  Shard& shard = GetShard(key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  return shard.cache->Exists(key);
+}
+
+template <typename key_t, typename value_t>
+value_t ShardedLRUCache<key_t, value_t>::Get(const key_t& key) {
+  Shard& shard = GetShard(key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  return shard.cache->Get(key);
+}
+
+template <typename key_t, typename value_t>
+void ShardedLRUCache<key_t, value_t>::Load(const key_t& key) {
+  Shard& shard = GetShard(key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  shard.cache->Get(key);
+}
+
+template <typename key_t, typename value_t>
+void ShardedLRUCache<key_t, value_t>::Set(const key_t& key, value_t&& value) {
+  Shard& shard = GetShard(key);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  shard.cache->Set(key, std::move(value));
+}
+
+template <typename key_t, typename value_t>
+void ShardedLRUCache<key_t, value_t>::Clear() {
+  for (size_t i = 0; i < num_shards_; ++i) {
+    std::unique_lock<std::mutex> lock(shards_[i].mutex);
+    shards_[i].cache->Clear();
+  }
+}
+
+template <typename key_t, typename value_t>
+void ShardedLRUCache<key_t, value_t>::SetMemoryConsumer(
+    MemoryConsumer* memory_consumer) {
+  for (size_t i = 0; i < num_shards_; ++i) {
+    std::unique_lock<std::mutex> lock(shards_[i].mutex);
+    auto cache = dynamic_cast<MemoryConstrainedLRUCache<key_t, value_t>*>(
+        shards_[i].cache.get());
+    CHECK_NOTNULL(cache)->SetMemoryConsumer(memory_consumer);
+  }
+}
+
+template <typename key_t, typename value_t>
+typename ShardedLRUCache<key_t, value_t>::Shard&
+ShardedLRUCache<key_t, value_t>::GetShard(const key_t& key) const {
+  return shards_[std::hash<key_t>()(key) % num_shards_];
 }
 
 }  // namespace colmap
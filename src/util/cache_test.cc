@@ -17,6 +17,12 @@
 #define TEST_NAME "util/cache"
 #include "util/testing.h"
 
+#include <atomic>
+#include <list>
+#include <memory>
+#include <random>
+#include <thread>
+
 #include "util/cache.h"
 
 using namespace colmap;
@@ -152,6 +158,52 @@ BOOST_AUTO_TEST_CASE(TestLRUCacheClear) {
   BOOST_CHECK(cache.Exists(0));
 }
 
+BOOST_AUTO_TEST_CASE(TestLRUCacheRandom) {
+  // Compare against a straightforward list-based implementation, while the
+  // hash table is grown and its entries are repeatedly erased.
+  LRUCache<int, int> cache(100, [](const int key) { return 2 * key; });
+  std::list<int> ref_keys;
+  std::mt19937 prng(0);
+  std::uniform_int_distribution<int> key_distribution(0, 300);
+  for (int i = 0; i < 10000; ++i) {
+    const int key = key_distribution(prng);
+    if (i % 7 == 0) {
+      cache.Set(key, -key);
+    } else {
+      const auto it = std::find(ref_keys.begin(), ref_keys.end(), key);
+      const bool exists = it != ref_keys.end();
+      BOOST_CHECK_EQUAL(cache.Exists(key), exists);
+      const int value = cache.Get(key);
+      BOOST_CHECK(value == 2 * key || (exists && value == -key));
+    }
+    ref_keys.remove(key);
+    ref_keys.push_front(key);
+    if (ref_keys.size() > 100) {
+      ref_keys.pop_back();
+    }
+    if (i % 1000 == 999) {
+      cache.Pop();
+      ref_keys.pop_back();
+    }
+    BOOST_CHECK_EQUAL(cache.NumElems(), ref_keys.size());
+  }
+
+  for (const int key : ref_keys) {
+    BOOST_CHECK(cache.Exists(key));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestLRUCacheReferenceStability) {
+  LRUCache<int, std::unique_ptr<int>> cache(
+      1000, [](const int key) { return std::unique_ptr<int>(new int(key)); });
+  const std::unique_ptr<int>& value = cache.Get(0);
+  for (int i = 1; i < 1000; ++i) {
+    cache.Get(i);
+  }
+  BOOST_CHECK_EQUAL(&cache.Get(0), &value);
+  BOOST_CHECK_EQUAL(*value, 0);
+}
+
 struct SizedElem {
   SizedElem(const size_t num_bytes_) : num_bytes(num_bytes_) {}
   size_t NumBytes() const { return num_bytes; }
@@ -204,6 +256,27 @@ BOOST_AUTO_TEST_CASE(TestMemoryConstrainedLRUCacheGet) {
   BOOST_CHECK(cache.Exists(6));
 }
 
+BOOST_AUTO_TEST_CASE(TestMemoryConstrainedLRUCacheSet) {
+  MemoryConstrainedLRUCache<int, SizedElem> cache(
+      10, [](const int key) { return SizedElem(key); });
+  cache.Set(0, SizedElem(4));
+  cache.Set(1, SizedElem(4));
+  BOOST_CHECK_EQUAL(cache.NumElems(), 2);
+  BOOST_CHECK_EQUAL(cache.NumBytes(), 8);
+
+  // Replacing an element must not count the old element.
+  cache.Set(0, SizedElem(2));
+  BOOST_CHECK_EQUAL(cache.NumElems(), 2);
+  BOOST_CHECK_EQUAL(cache.NumBytes(), 6);
+
+  cache.Set(2, SizedElem(5));
+  BOOST_CHECK_EQUAL(cache.NumElems(), 2);
+  BOOST_CHECK_EQUAL(cache.NumBytes(), 7);
+  BOOST_CHECK(cache.Exists(0));
+  BOOST_CHECK(!cache.Exists(1));
+  BOOST_CHECK(cache.Exists(2));
+}
+
 BOOST_AUTO_TEST_CASE(TestMemoryConstrainedLRUCacheClear) {
   MemoryConstrainedLRUCache<int, SizedElem> cache(
       10, [](const int key) { return SizedElem(key); });
@@ -256,3 +329,137 @@ BOOST_AUTO_TEST_CASE(TestMemoryConstrainedLRUCacheUpdateNumBytes) {
   BOOST_CHECK_EQUAL(cache.Get(2).NumBytes(), 2);
   BOOST_CHECK_EQUAL(cache.NumBytes(), 2);
 }
+
+BOOST_AUTO_TEST_CASE(TestShardedLRUCache) {
+  std::unique_ptr<ShardedLRUCache<int, int>> cache(
+      ShardedLRUCache<int, int>::Create<LRUCache<int, int>>(
+          10, [](const int key) { return key; }, 4));
+  BOOST_CHECK_EQUAL(cache->NumShards(), 4);
+  BOOST_CHECK_EQUAL(cache->NumElems(), 0);
+  for (int i = 0; i < 12; ++i) {
+    BOOST_CHECK_EQUAL(cache->Get(i), i);
+    BOOST_CHECK(cache->Exists(i));
+  }
+  // Each of the shards holds 3 consecutive keys.
+  BOOST_CHECK_EQUAL(cache->NumElems(), 12);
+  BOOST_CHECK_EQUAL(cache->Get(12), 12);
+  BOOST_CHECK_EQUAL(cache->NumElems(), 12);
+  BOOST_CHECK(!cache->Exists(0));
+  BOOST_CHECK(cache->Exists(1));
+
+  cache->Set(2, 22);
+  BOOST_CHECK_EQUAL(cache->Get(2), 22);
+
+  cache->Clear();
+  BOOST_CHECK_EQUAL(cache->NumElems(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestShardedLRUCacheLoad) {
+  int num_computed = 0;
+  std::unique_ptr<ShardedLRUCache<int, int>> cache(
+      ShardedLRUCache<int, int>::Create<LRUCache<int, int>>(
+          4, [&num_computed](const int key) {
+            num_computed += 1;
+            return key;
+          },
+          1));
+  for (int i = 0; i < 4; ++i) {
+    cache->Load(i);
+    BOOST_CHECK(cache->Exists(i));
+  }
+  BOOST_CHECK_EQUAL(num_computed, 4);
+  // Loading an existing element only marks it as most recently used.
+  cache->Load(0);
+  BOOST_CHECK_EQUAL(num_computed, 4);
+  cache->Load(4);
+  BOOST_CHECK_EQUAL(num_computed, 5);
+  BOOST_CHECK(cache->Exists(0));
+  BOOST_CHECK(!cache->Exists(1));
+  BOOST_CHECK_EQUAL(cache->Get(4), 4);
+  BOOST_CHECK_EQUAL(num_computed, 5);
+}
+
+BOOST_AUTO_TEST_CASE(TestShardedMemoryConstrainedLRUCache) {
+  std::unique_ptr<ShardedLRUCache<int, SizedElem>> cache(
+      ShardedLRUCache<int, SizedElem>::Create<
+          MemoryConstrainedLRUCache<int, SizedElem>>(
+          20, [](const int key) { return SizedElem(5); }, 2));
+  for (int i = 0; i < 10; ++i) {
+    BOOST_CHECK_EQUAL(cache->Get(i).NumBytes(), 5);
+  }
+  BOOST_CHECK_EQUAL(cache->NumElems(), 4);
+}
+
+BOOST_AUTO_TEST_CASE(TestShardedLRUCacheConcurrent) {
+  std::unique_ptr<ShardedLRUCache<int, int>> cache(
+      ShardedLRUCache<int, int>::Create<LRUCache<int, int>>(
+          64, [](const int key) { return 3 * key; }));
+  // Boost.Test assertions are not thread-safe.
+  std::atomic<int> num_errors(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&cache, &num_errors, t]() {
+      std::mt19937 prng(t);
+      std::uniform_int_distribution<int> key_distribution(0, 100);
+      for (int i = 0; i < 10000; ++i) {
+        const int key = key_distribution(prng);
+        if (cache->Get(key) != 3 * key) {
+          num_errors += 1;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  BOOST_CHECK_EQUAL(num_errors, 0);
+  BOOST_CHECK_LE(cache->NumElems(), 64);
+}
+
+BOOST_AUTO_TEST_CASE(TestMemoryConstrainedLRUCacheMemoryConsumer) {
+  MemoryConsumer consumer("test", 0, 10);
+  {
+    MemoryConstrainedLRUCache<int, SizedElem> cache(
+        100, [](const int key) { return SizedElem(5); });
+    cache.Get(0);
+    cache.SetMemoryConsumer(&consumer);
+    BOOST_CHECK_EQUAL(consumer.NumBytes(), 5);
+    for (int i = 1; i < 10; ++i) {
+      cache.Get(i);
+    }
+    BOOST_CHECK_EQUAL(cache.NumElems(), 10);
+    BOOST_CHECK_EQUAL(consumer.NumBytes(), 50);
+
+#if defined(__linux__) || defined(__APPLE__)
+    // Any process exceeds a budget of one byte, so that the consumer is
+    // shrunk to its minimum, once the cache grows.
+    SetMemoryBudget(1);
+    cache.Get(10);
+    BOOST_CHECK_EQUAL(cache.NumElems(), 2);
+    BOOST_CHECK_EQUAL(cache.NumBytes(), 10);
+    BOOST_CHECK_EQUAL(consumer.NumBytes(), 10);
+    SetMemoryBudget(0);
+#endif
+
+    cache.Pop();
+    BOOST_CHECK_EQUAL(consumer.NumBytes(), cache.NumBytes());
+    cache.Get(20);
+    BOOST_CHECK_EQUAL(consumer.NumBytes(), cache.NumBytes());
+  }
+  BOOST_CHECK_EQUAL(consumer.NumBytes(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestShardedLRUCacheMemoryConsumer) {
+  MemoryConsumer consumer("test", 0);
+  std::unique_ptr<ShardedLRUCache<int, SizedElem>> cache(
+      ShardedLRUCache<int, SizedElem>::Create<
+          MemoryConstrainedLRUCache<int, SizedElem>>(
+          100, [](const int key) { return SizedElem(5); }, 2));
+  cache->SetMemoryConsumer(&consumer);
+  for (int i = 0; i < 6; ++i) {
+    cache->Get(i);
+  }
+  BOOST_CHECK_EQUAL(consumer.NumBytes(), 30);
+  cache->Clear();
+  BOOST_CHECK_EQUAL(consumer.NumBytes(), 0);
+}
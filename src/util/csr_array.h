@@ -0,0 +1,159 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_CSR_ARRAY_H_
+#define COLMAP_SRC_UTIL_CSR_ARRAY_H_
+
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "util/alignment.h"
+#include "util/logging.h"
+
+namespace colmap {
+
+// Non-owning view of one row of a CsrArray.
+template <typename T>
+class CsrRow {
+ public:
+  CsrRow() : data_(nullptr), size_(0) {}
+  CsrRow(const T* data, const size_t size) : data_(data), size_(size) {}
+
+  inline const T* begin() const { return data_; }
+  inline const T* end() const { return data_ + size_; }
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+  inline const T& operator[](const size_t idx) const { return data_[idx]; }
+  inline const T& at(const size_t idx) const {
+    if (idx >= size_) {
+      throw std::out_of_range("CsrRow::at");
+    }
+    return data_[idx];
+  }
+
+ private:
+  const T* data_;
+  size_t size_;
+};
+
+// Rows of different lengths in compressed sparse row layout, i.e. the values
+// of all rows are stored back to back in one array and the start of every
+// row in a second array. Compared to nested vectors, there are two heap
+// allocations instead of one per row and consecutive rows are contiguous.
+// Rows can only be appended.
+template <typename T>
+class CsrArray {
+ public:
+  CsrArray();
+
+  // Take over the values and the offsets of all rows, laid out as returned by
+  // Values() and Offsets().
+  CsrArray(std::vector<T> values, std::vector<size_t> offsets);
+
+  inline size_t NumRows() const;
+  inline size_t NumValues() const;
+
+  inline CsrRow<T> Row(const size_t row) const;
+
+  // Append a row with the values of the given range.
+  template <typename Iterator>
+  void AppendRow(const Iterator begin, const Iterator end);
+  void AppendRow(const std::vector<T>& values);
+
+  void Reserve(const size_t num_rows, const size_t num_values);
+  void Clear();
+
+  // The values of all rows and the offsets of the rows, where row i spans the
+  // values from offsets[i] to offsets[i + 1].
+  inline const std::vector<T>& Values() const;
+  inline const std::vector<size_t>& Offsets() const;
+
+ private:
+  std::vector<T> values_;
+  std::vector<size_t> offsets_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+CsrArray<T>::CsrArray() : offsets_(1, 0) {}
+
+template <typename T>
+CsrArray<T>::CsrArray(std::vector<T> values, std::vector<size_t> offsets)
+    : values_(std::move(values)), offsets_(std::move(offsets)) {
+  CHECK(!offsets_.empty());
+  CHECK_EQ(offsets_.front(), 0);
+  CHECK_EQ(offsets_.back(), values_.size());
+}
+
+template <typename T>
+size_t CsrArray<T>::NumRows() const {
+  return offsets_.size() - 1;
+}
+
+template <typename T>
+size_t CsrArray<T>::NumValues() const {
+  return values_.size();
+}
+
+template <typename T>
+CsrRow<T> CsrArray<T>::Row(const size_t row) const {
+  CHECK_LT(row, NumRows());
+  return CsrRow<T>(values_.data() + offsets_[row],
+                   offsets_[row + 1] - offsets_[row]);
+}
+
+template <typename T>
+template <typename Iterator>
+void CsrArray<T>::AppendRow(const Iterator begin, const Iterator end) {
+  values_.insert(values_.end(), begin, end);
+  offsets_.push_back(values_.size());
+}
+
+template <typename T>
+void CsrArray<T>::AppendRow(const std::vector<T>& values) {
+  AppendRow(values.begin(), values.end());
+}
+
+template <typename T>
+void CsrArray<T>::Reserve(const size_t num_rows, const size_t num_values) {
+  offsets_.reserve(num_rows + 1);
+  values_.reserve(num_values);
+}
+
+template <typename T>
+void CsrArray<T>::Clear() {
+  values_.clear();
+  offsets_.assign(1, 0);
+}
+
+template <typename T>
+const std::vector<T>& CsrArray<T>::Values() const {
+  return values_;
+}
+
+template <typename T>
+const std::vector<size_t>& CsrArray<T>::Offsets() const {
+  return offsets_;
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_CSR_ARRAY_H_
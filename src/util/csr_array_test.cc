@@ -0,0 +1,75 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/csr_array"
+#include "util/testing.h"
+
+#include "util/csr_array.h"
+
+using namespace colmap;
+
+BOOST_AUTO_TEST_CASE(TestEmpty) {
+  CsrArray<int> array;
+  BOOST_CHECK_EQUAL(array.NumRows(), 0);
+  BOOST_CHECK_EQUAL(array.NumValues(), 0);
+  BOOST_CHECK(array.Offsets() == std::vector<size_t>({0}));
+  BOOST_CHECK(CsrRow<int>().empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestAppendRow) {
+  CsrArray<int> array;
+  array.Reserve(3, 5);
+  array.AppendRow(std::vector<int>{1, 2, 3});
+  array.AppendRow(std::vector<int>());
+  const int values[] = {4, 5};
+  array.AppendRow(values, values + 2);
+  BOOST_CHECK_EQUAL(array.NumRows(), 3);
+  BOOST_CHECK_EQUAL(array.NumValues(), 5);
+  BOOST_CHECK(array.Values() == std::vector<int>({1, 2, 3, 4, 5}));
+  BOOST_CHECK(array.Offsets() == std::vector<size_t>({0, 3, 3, 5}));
+
+  BOOST_CHECK_EQUAL(array.Row(0).size(), 3);
+  BOOST_CHECK_EQUAL(array.Row(0)[2], 3);
+  BOOST_CHECK(array.Row(1).empty());
+  const CsrRow<int> row = array.Row(2);
+  BOOST_CHECK(std::vector<int>(row.begin(), row.end()) ==
+              std::vector<int>({4, 5}));
+
+  array.Clear();
+  BOOST_CHECK_EQUAL(array.NumRows(), 0);
+  BOOST_CHECK_EQUAL(array.NumValues(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestEigen) {
+  CsrArray<Eigen::Vector2d> array;
+  std::vector<Eigen::Vector2d> row(2);
+  row[0] = Eigen::Vector2d(1, 2);
+  row[1] = Eigen::Vector2d(3, 4);
+  array.AppendRow(row);
+  array.AppendRow(row.begin() + 1, row.end());
+  BOOST_CHECK_EQUAL(array.NumRows(), 2);
+  BOOST_CHECK_EQUAL(array.Row(0)[1], Eigen::Vector2d(3, 4));
+  BOOST_CHECK_EQUAL(array.Row(1)[0], Eigen::Vector2d(3, 4));
+}
+
+BOOST_AUTO_TEST_CASE(TestFromOffsets) {
+  const CsrArray<int> array({1, 2, 3}, {0, 0, 2, 3});
+  BOOST_CHECK_EQUAL(array.NumRows(), 3);
+  BOOST_CHECK(array.Row(0).empty());
+  BOOST_CHECK_EQUAL(array.Row(1).at(1), 2);
+  BOOST_CHECK_EQUAL(array.Row(2).at(0), 3);
+  BOOST_CHECK_THROW(array.Row(2).at(1), std::out_of_range);
+}
@@ -69,4 +69,15 @@ void SetBestCudaDevice(const int gpu_index) {
   CUDA_SAFE_CALL(cudaSetDevice(selected_gpu_index));
 }
 
+void* AllocatePinnedHostMemory(const size_t num_bytes) {
+  void* ptr = nullptr;
+  if (cudaHostAlloc(&ptr, num_bytes, cudaHostAllocPortable) != cudaSuccess) {
+    cudaGetLastError();
+    return nullptr;
+  }
+  return ptr;
+}
+
+void FreePinnedHostMemory(void* ptr) { CUDA_SAFE_CALL(cudaFreeHost(ptr)); }
+
 }  // namespace colmap
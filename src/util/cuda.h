@@ -17,12 +17,21 @@
 #ifndef COLMAP_SRC_UTIL_CUDA_H_
 #define COLMAP_SRC_UTIL_CUDA_H_
 
+#include <cstddef>
+
 namespace colmap {
 
 int GetNumCudaDevices();
 
 void SetBestCudaDevice(const int gpu_index);
 
+// Allocate page-locked host memory, which is accessible by all devices and
+// copied to them at the full bandwidth of the bus, or return nullptr if the
+// allocation fails. Allocating page-locked memory is expensive, such that the
+// buffers should be reused.
+void* AllocatePinnedHostMemory(const size_t num_bytes);
+void FreePinnedHostMemory(void* ptr);
+
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_UTIL_CUDA_H_
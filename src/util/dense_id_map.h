@@ -0,0 +1,368 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_DENSE_ID_MAP_H_
+#define COLMAP_SRC_UTIL_DENSE_ID_MAP_H_
+
+#include <bitset>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "util/alignment.h"
+
+namespace colmap {
+
+// Map from integer identifiers to values, which are stored in place in pages
+// of `kPageSize` consecutive identifiers. It is a replacement for an
+// unordered map if the identifiers are mostly consecutive, as the ones of the
+// images and the 3D points: a lookup is an index into the page table instead
+// of a hash and a chain and the iteration is in the order of the identifiers
+// over contiguous memory. Pages are allocated on the first insertion and
+// freed on the last erasure of one of their identifiers, so that the memory
+// overhead of pruned identifiers is bounded.
+//
+// The subset of the std::unordered_map interface used for the images and the
+// 3D points is implemented. Values are never moved, so references and
+// iterators stay valid until their value is erased, also on insertions.
+template <typename Key, typename Value, size_t kPageSize = 1024>
+class DenseIdMap {
+  static_assert(std::is_integral<Key>::value, "Key must be an integer");
+
+ public:
+  typedef Key key_type;
+  typedef Value mapped_type;
+  typedef std::pair<const Key, Value> value_type;
+  typedef size_t size_type;
+
+  template <bool kConst>
+  class Iterator;
+  typedef Iterator<false> iterator;
+  typedef Iterator<true> const_iterator;
+
+  DenseIdMap() : size_(0) {}
+  DenseIdMap(const DenseIdMap& other) : size_(0) { *this = other; }
+  DenseIdMap(DenseIdMap&& other) : size_(0) { swap(other); }
+  ~DenseIdMap() { clear(); }
+
+  DenseIdMap& operator=(const DenseIdMap& other);
+  DenseIdMap& operator=(DenseIdMap&& other);
+
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+
+  inline iterator begin() { return iterator(this, FirstIdx(0)); }
+  inline iterator end() { return iterator(this, EndIdx()); }
+  inline const_iterator begin() const {
+    return const_iterator(this, FirstIdx(0));
+  }
+  inline const_iterator end() const { return const_iterator(this, EndIdx()); }
+
+  inline iterator find(const Key key);
+  inline const_iterator find(const Key key) const;
+  inline size_t count(const Key key) const { return Slot(key) ? 1 : 0; }
+
+  // Access an existing value, throws std::out_of_range otherwise.
+  inline Value& at(const Key key);
+  inline const Value& at(const Key key) const;
+
+  // Access a value, which is default constructed if it does not exist.
+  inline Value& operator[](const Key key) { return emplace(key).first->second; }
+
+  // Construct the value of the key from the arguments, if it does not exist.
+  template <typename... Args>
+  std::pair<iterator, bool> emplace(const Key key, Args&&... args);
+
+  size_t erase(const Key key);
+  iterator erase(const_iterator pos);
+
+  void clear();
+
+  // Reserve the page table for the identifiers below `num_keys`.
+  void reserve(const size_t num_keys);
+
+  void swap(DenseIdMap& other);
+
+ private:
+  struct Page {
+    typename std::aligned_storage<sizeof(value_type),
+                                  alignof(value_type)>::type values[kPageSize];
+    std::bitset<kPageSize> occupied;
+    size_t size = 0;
+
+    // The values may be fixed-size Eigen types with alignment requirements.
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  typedef std::unique_ptr<Page> PagePtr;
+
+  // The identifiers are used as indices, for which the keys are converted to
+  // their unsigned type so that negative keys are out of range.
+  typedef typename std::make_unsigned<Key>::type Index;
+
+  inline size_t EndIdx() const { return pages_.size() * kPageSize; }
+  inline size_t FirstIdx(size_t idx) const;
+
+  inline value_type* Slot(const Key key) const;
+  inline value_type* SlotAt(const size_t idx) const;
+
+  std::vector<PagePtr> pages_;
+  size_t size_;
+};
+
+// Forward iterator over the values in the order of their keys.
+template <typename Key, typename Value, size_t kPageSize>
+template <bool kConst>
+class DenseIdMap<Key, Value, kPageSize>::Iterator {
+ public:
+  typedef std::forward_iterator_tag iterator_category;
+  typedef typename DenseIdMap::value_type value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef typename std::conditional<kConst, const value_type*,
+                                    value_type*>::type pointer;
+  typedef typename std::conditional<kConst, const value_type&,
+                                    value_type&>::type reference;
+
+  Iterator() : map_(nullptr), idx_(0) {}
+
+  // Mutable iterators are convertible to constant ones.
+  template <bool kOtherConst,
+            typename = typename std::enable_if<kConst || !kOtherConst>::type>
+  Iterator(const Iterator<kOtherConst>& other)
+      : map_(other.map_), idx_(other.idx_) {}
+
+  inline reference operator*() const { return *map_->SlotAt(idx_); }
+  inline pointer operator->() const { return map_->SlotAt(idx_); }
+
+  inline Iterator& operator++() {
+    idx_ = map_->FirstIdx(idx_ + 1);
+    return *this;
+  }
+
+  inline Iterator operator++(int) {
+    Iterator it = *this;
+    ++(*this);
+    return it;
+  }
+
+  template <bool kOtherConst>
+  inline bool operator==(const Iterator<kOtherConst>& other) const {
+    return idx_ == other.idx_;
+  }
+
+  template <bool kOtherConst>
+  inline bool operator!=(const Iterator<kOtherConst>& other) const {
+    return idx_ != other.idx_;
+  }
+
+ private:
+  friend class DenseIdMap;
+  template <bool>
+  friend class Iterator;
+
+  Iterator(const DenseIdMap* map, const size_t idx) : map_(map), idx_(idx) {}
+
+  const DenseIdMap* map_;
+  size_t idx_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename Key, typename Value, size_t kPageSize>
+DenseIdMap<Key, Value, kPageSize>& DenseIdMap<Key, Value, kPageSize>::
+operator=(const DenseIdMap& other) {
+  if (this == &other) {
+    return *this;
+  }
+  clear();
+  pages_.resize(other.pages_.size());
+  for (const auto& value : other) {
+    emplace(value.first, value.second);
+  }
+  return *this;
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+DenseIdMap<Key, Value, kPageSize>& DenseIdMap<Key, Value, kPageSize>::
+operator=(DenseIdMap&& other) {
+  if (this != &other) {
+    clear();
+    swap(other);
+  }
+  return *this;
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+typename DenseIdMap<Key, Value, kPageSize>::iterator
+DenseIdMap<Key, Value, kPageSize>::find(const Key key) {
+  return Slot(key) ? iterator(this, static_cast<Index>(key)) : end();
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+typename DenseIdMap<Key, Value, kPageSize>::const_iterator
+DenseIdMap<Key, Value, kPageSize>::find(const Key key) const {
+  return Slot(key) ? const_iterator(this, static_cast<Index>(key)) : end();
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+Value& DenseIdMap<Key, Value, kPageSize>::at(const Key key) {
+  value_type* slot = Slot(key);
+  if (slot == nullptr) {
+    throw std::out_of_range("DenseIdMap::at");
+  }
+  return slot->second;
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+const Value& DenseIdMap<Key, Value, kPageSize>::at(const Key key) const {
+  const value_type* slot = Slot(key);
+  if (slot == nullptr) {
+    throw std::out_of_range("DenseIdMap::at");
+  }
+  return slot->second;
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+template <typename... Args>
+std::pair<typename DenseIdMap<Key, Value, kPageSize>::iterator, bool>
+DenseIdMap<Key, Value, kPageSize>::emplace(const Key key, Args&&... args) {
+  const size_t idx = static_cast<Index>(key);
+  const size_t page_idx = idx / kPageSize;
+  const size_t slot_idx = idx % kPageSize;
+
+  if (page_idx >= pages_.size()) {
+    pages_.resize(page_idx + 1);
+  }
+
+  PagePtr& page = pages_[page_idx];
+  if (!page) {
+    page.reset(new Page);
+  } else if (page->occupied.test(slot_idx)) {
+    return std::make_pair(iterator(this, idx), false);
+  }
+
+  new (&page->values[slot_idx]) value_type(
+      std::piecewise_construct, std::forward_as_tuple(key),
+      std::forward_as_tuple(std::forward<Args>(args)...));
+  page->occupied.set(slot_idx);
+  page->size += 1;
+  size_ += 1;
+
+  return std::make_pair(iterator(this, idx), true);
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+size_t DenseIdMap<Key, Value, kPageSize>::erase(const Key key) {
+  const_iterator it = find(key);
+  if (it == end()) {
+    return 0;
+  }
+  erase(it);
+  return 1;
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+typename DenseIdMap<Key, Value, kPageSize>::iterator
+DenseIdMap<Key, Value, kPageSize>::erase(const_iterator pos) {
+  const size_t page_idx = pos.idx_ / kPageSize;
+  const size_t slot_idx = pos.idx_ % kPageSize;
+
+  PagePtr& page = pages_[page_idx];
+  SlotAt(pos.idx_)->~value_type();
+  page->occupied.reset(slot_idx);
+  page->size -= 1;
+  size_ -= 1;
+
+  if (page->size == 0) {
+    page.reset();
+  }
+
+  return iterator(this, FirstIdx(pos.idx_ + 1));
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+void DenseIdMap<Key, Value, kPageSize>::clear() {
+  for (PagePtr& page : pages_) {
+    if (!page) {
+      continue;
+    }
+    for (size_t slot_idx = 0; slot_idx < kPageSize; ++slot_idx) {
+      if (page->occupied.test(slot_idx)) {
+        reinterpret_cast<value_type*>(&page->values[slot_idx])->~value_type();
+      }
+    }
+  }
+  pages_.clear();
+  size_ = 0;
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+void DenseIdMap<Key, Value, kPageSize>::reserve(const size_t num_keys) {
+  pages_.reserve((num_keys + kPageSize - 1) / kPageSize);
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+void DenseIdMap<Key, Value, kPageSize>::swap(DenseIdMap& other) {
+  pages_.swap(other.pages_);
+  std::swap(size_, other.size_);
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+size_t DenseIdMap<Key, Value, kPageSize>::FirstIdx(size_t idx) const {
+  const size_t end_idx = EndIdx();
+  while (idx < end_idx) {
+    const Page* page = pages_[idx / kPageSize].get();
+    if (page == nullptr) {
+      idx = (idx / kPageSize + 1) * kPageSize;
+    } else if (page->occupied.test(idx % kPageSize)) {
+      return idx;
+    } else {
+      idx += 1;
+    }
+  }
+  return end_idx;
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+typename DenseIdMap<Key, Value, kPageSize>::value_type*
+DenseIdMap<Key, Value, kPageSize>::Slot(const Key key) const {
+  const size_t idx = static_cast<Index>(key);
+  const size_t page_idx = idx / kPageSize;
+  if (page_idx >= pages_.size() || !pages_[page_idx] ||
+      !pages_[page_idx]->occupied.test(idx % kPageSize)) {
+    return nullptr;
+  }
+  return SlotAt(idx);
+}
+
+template <typename Key, typename Value, size_t kPageSize>
+typename DenseIdMap<Key, Value, kPageSize>::value_type*
+DenseIdMap<Key, Value, kPageSize>::SlotAt(const size_t idx) const {
+  return reinterpret_cast<value_type*>(
+      &pages_[idx / kPageSize]->values[idx % kPageSize]);
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_DENSE_ID_MAP_H_
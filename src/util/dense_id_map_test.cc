@@ -0,0 +1,123 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/dense_id_map"
+#include "util/testing.h"
+
+#include <limits>
+#include <string>
+
+#include "util/dense_id_map.h"
+
+using namespace colmap;
+
+BOOST_AUTO_TEST_CASE(TestEmpty) {
+  DenseIdMap<int, int> map;
+  BOOST_CHECK_EQUAL(map.size(), 0);
+  BOOST_CHECK(map.empty());
+  BOOST_CHECK(map.begin() == map.end());
+  BOOST_CHECK(map.find(0) == map.end());
+  BOOST_CHECK_EQUAL(map.count(-1), 0);
+  BOOST_CHECK_EQUAL(map.count(std::numeric_limits<int>::max()), 0);
+  BOOST_CHECK_THROW(map.at(0), std::out_of_range);
+  BOOST_CHECK_EQUAL(map.erase(0), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestInsertFindErase) {
+  DenseIdMap<size_t, std::string, 4> map;
+  BOOST_CHECK(map.emplace(5, "5").second);
+  BOOST_CHECK(!map.emplace(5, "6").second);
+  map[1] = "1";
+  map[10] = "10";
+  BOOST_CHECK_EQUAL(map.size(), 3);
+  BOOST_CHECK_EQUAL(map.at(5), "5");
+  BOOST_CHECK_EQUAL(map.find(10)->second, "10");
+  BOOST_CHECK_EQUAL(map.count(1), 1);
+  BOOST_CHECK_EQUAL(map.count(2), 0);
+  BOOST_CHECK(map[2].empty());
+  BOOST_CHECK_EQUAL(map.size(), 4);
+
+  const std::string* value = &map.at(5);
+  for (size_t key = 11; key < 100; ++key) {
+    map.emplace(key, std::to_string(key));
+  }
+  BOOST_CHECK_EQUAL(&map.at(5), value);
+
+  BOOST_CHECK_EQUAL(map.erase(2), 1);
+  BOOST_CHECK_EQUAL(map.erase(2), 0);
+  BOOST_CHECK_EQUAL(map.count(2), 0);
+  BOOST_CHECK_EQUAL(map.size(), 92);
+}
+
+BOOST_AUTO_TEST_CASE(TestIteration) {
+  DenseIdMap<int, int, 4> map;
+  for (const int key : {9, 2, 17, 3, 8}) {
+    map.emplace(key, 10 * key);
+  }
+
+  std::vector<int> keys;
+  for (const auto& value : map) {
+    BOOST_CHECK_EQUAL(value.second, 10 * value.first);
+    keys.push_back(value.first);
+  }
+  BOOST_CHECK(keys == std::vector<int>({2, 3, 8, 9, 17}));
+
+  for (auto it = map.begin(); it != map.end();) {
+    if (it->first % 2 == 1) {
+      it = map.erase(it);
+    } else {
+      it->second += 1;
+      ++it;
+    }
+  }
+
+  keys.clear();
+  for (const auto& value : map) {
+    BOOST_CHECK_EQUAL(value.second, 10 * value.first + 1);
+    keys.push_back(value.first);
+  }
+  BOOST_CHECK(keys == std::vector<int>({2, 8}));
+
+  const DenseIdMap<int, int, 4>& const_map = map;
+  DenseIdMap<int, int, 4>::const_iterator it = map.begin();
+  BOOST_CHECK(it == const_map.begin());
+  BOOST_CHECK(const_map.find(8) != const_map.end());
+  BOOST_CHECK(const_map.find(9) == const_map.end());
+}
+
+BOOST_AUTO_TEST_CASE(TestCopyMove) {
+  DenseIdMap<int, Eigen::Vector4d> map;
+  map.emplace(1, Eigen::Vector4d(1, 2, 3, 4));
+  map.emplace(2000, Eigen::Vector4d(5, 6, 7, 8));
+
+  DenseIdMap<int, Eigen::Vector4d> copy(map);
+  map.at(1)(0) = 0;
+  BOOST_CHECK_EQUAL(copy.size(), 2);
+  BOOST_CHECK_EQUAL(copy.at(1), Eigen::Vector4d(1, 2, 3, 4));
+  BOOST_CHECK_EQUAL(copy.at(2000), Eigen::Vector4d(5, 6, 7, 8));
+
+  DenseIdMap<int, Eigen::Vector4d> moved(std::move(copy));
+  BOOST_CHECK(copy.empty());
+  BOOST_CHECK_EQUAL(moved.size(), 2);
+  BOOST_CHECK_EQUAL(moved.at(1), Eigen::Vector4d(1, 2, 3, 4));
+
+  moved = map;
+  BOOST_CHECK_EQUAL(moved.at(1), Eigen::Vector4d(0, 2, 3, 4));
+
+  moved.clear();
+  BOOST_CHECK(moved.empty());
+  BOOST_CHECK(moved.begin() == moved.end());
+}
@@ -18,6 +18,8 @@
 #define COLMAP_SRC_UTIL_ENDIAN_H_
 
 #include <algorithm>
+#include <iostream>
+#include <vector>
 
 namespace colmap {
 
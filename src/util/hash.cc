@@ -0,0 +1,163 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/hash.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "util/mapped_file.h"
+#include "util/string.h"
+
+namespace colmap {
+namespace {
+
+const uint64_t kC1 = 0x87c37b91114253d5ULL;
+const uint64_t kC2 = 0x4cf5ad432745937fULL;
+
+inline uint64_t RotateLeft(const uint64_t x, const int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t FinalizationMix(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+// Read a little-endian 64-bit word, independent of the byte order of the host.
+inline uint64_t ReadWord(const uint8_t* data) {
+  uint64_t word = 0;
+  for (int i = 7; i >= 0; --i) {
+    word = (word << 8) | data[i];
+  }
+  return word;
+}
+
+}  // namespace
+
+ContentHasher::ContentHasher()
+    : h1_(0), h2_(0), num_bytes_(0), tail_size_(0) {}
+
+void ContentHasher::Add(const void* data, const size_t num_bytes) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  const uint8_t* end = bytes + num_bytes;
+  num_bytes_ += num_bytes;
+
+  // Complete the block of the previous call.
+  if (tail_size_ > 0) {
+    const size_t num_copy =
+        std::min(sizeof(tail_) - tail_size_, static_cast<size_t>(end - bytes));
+    memcpy(tail_ + tail_size_, bytes, num_copy);
+    tail_size_ += num_copy;
+    bytes += num_copy;
+    if (tail_size_ < sizeof(tail_)) {
+      return;
+    }
+    AddBlock(tail_);
+    tail_size_ = 0;
+  }
+
+  for (; end - bytes >= 16; bytes += 16) {
+    AddBlock(bytes);
+  }
+
+  tail_size_ = end - bytes;
+  memcpy(tail_, bytes, tail_size_);
+}
+
+void ContentHasher::AddString(const std::string& str) {
+  AddValue<uint64_t>(str.size());
+  Add(str.data(), str.size());
+}
+
+std::string ContentHasher::HexDigest() const {
+  uint64_t h1 = h1_;
+  uint64_t h2 = h2_;
+
+  uint64_t k1 = 0;
+  uint64_t k2 = 0;
+  for (size_t i = tail_size_; i > 8; --i) {
+    k2 = (k2 << 8) | tail_[i - 1];
+  }
+  for (size_t i = std::min<size_t>(tail_size_, 8); i > 0; --i) {
+    k1 = (k1 << 8) | tail_[i - 1];
+  }
+
+  if (tail_size_ > 8) {
+    k2 *= kC2;
+    k2 = RotateLeft(k2, 33);
+    k2 *= kC1;
+    h2 ^= k2;
+  }
+
+  if (tail_size_ > 0) {
+    k1 *= kC1;
+    k1 = RotateLeft(k1, 31);
+    k1 *= kC2;
+    h1 ^= k1;
+  }
+
+  h1 ^= num_bytes_;
+  h2 ^= num_bytes_;
+  h1 += h2;
+  h2 += h1;
+  h1 = FinalizationMix(h1);
+  h2 = FinalizationMix(h2);
+  h1 += h2;
+  h2 += h1;
+
+  return StringPrintf("%016llx%016llx", static_cast<unsigned long long>(h1),
+                      static_cast<unsigned long long>(h2));
+}
+
+void ContentHasher::AddBlock(const uint8_t* block) {
+  uint64_t k1 = ReadWord(block);
+  uint64_t k2 = ReadWord(block + 8);
+
+  k1 *= kC1;
+  k1 = RotateLeft(k1, 31);
+  k1 *= kC2;
+  h1_ ^= k1;
+
+  h1_ = RotateLeft(h1_, 27);
+  h1_ += h2_;
+  h1_ = h1_ * 5 + 0x52dce729;
+
+  k2 *= kC2;
+  k2 = RotateLeft(k2, 33);
+  k2 *= kC1;
+  h2_ ^= k2;
+
+  h2_ = RotateLeft(h2_, 31);
+  h2_ += h1_;
+  h2_ = h2_ * 5 + 0x38495ab5;
+}
+
+std::string HashFileContent(const std::string& path) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    return "";
+  }
+  ContentHasher hasher;
+  hasher.Add(file.Data(), file.Size());
+  return hasher.HexDigest();
+}
+
+}  // namespace colmap
@@ -0,0 +1,86 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_HASH_H_
+#define COLMAP_SRC_UTIL_HASH_H_
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace colmap {
+
+// Incremental 128-bit MurmurHash3 (x64 variant) of a stream of bytes, which
+// identifies files and derived data by their content, e.g. for caches that are
+// shared across runs. The hash does not depend on how the bytes are split into
+// calls of `Add`. It is fast but not cryptographic, i.e. it only protects
+// against accidental collisions.
+class ContentHasher {
+ public:
+  ContentHasher();
+
+  void Add(const void* data, const size_t num_bytes);
+
+  // Add the bytes of a trivially copyable value or the elements of a vector.
+  template <typename T>
+  void AddValue(const T& value);
+  template <typename T>
+  void AddVector(const std::vector<T>& values);
+
+  // Add a string prefixed by its length, such that consecutive strings are
+  // delimited.
+  void AddString(const std::string& str);
+
+  // The hash of all bytes added so far as 32 lower-case hexadecimal digits.
+  std::string HexDigest() const;
+
+ private:
+  void AddBlock(const uint8_t* block);
+
+  uint64_t h1_;
+  uint64_t h2_;
+  uint64_t num_bytes_;
+  uint8_t tail_[16];
+  size_t tail_size_;
+};
+
+// The content hash of the file at the given path, which is read through a
+// `MappedFile`. Returns an empty string, if the file cannot be read.
+std::string HashFileContent(const std::string& path);
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+void ContentHasher::AddValue(const T& value) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Only trivially copyable values can be hashed");
+  Add(&value, sizeof(T));
+}
+
+template <typename T>
+void ContentHasher::AddVector(const std::vector<T>& values) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Only trivially copyable values can be hashed");
+  AddValue<uint64_t>(values.size());
+  Add(values.data(), values.size() * sizeof(T));
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_HASH_H_
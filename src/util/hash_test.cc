@@ -0,0 +1,90 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/hash"
+#include "util/testing.h"
+
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+#include "util/hash.h"
+
+using namespace colmap;
+
+BOOST_AUTO_TEST_CASE(TestReferenceValues) {
+  BOOST_CHECK_EQUAL(ContentHasher().HexDigest(),
+                    "00000000000000000000000000000000");
+  const std::string text = "The quick brown fox jumps over the lazy dog";
+  ContentHasher hasher;
+  hasher.Add(text.data(), text.size());
+  BOOST_CHECK_EQUAL(hasher.HexDigest(), "e34bbc7bbc071b6c7a433ca9c49a9347");
+}
+
+BOOST_AUTO_TEST_CASE(TestIncremental) {
+  std::vector<uint8_t> data(1000);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<uint8_t>(i * 31 + 7);
+  }
+
+  ContentHasher hasher;
+  hasher.Add(data.data(), data.size());
+  const std::string digest = hasher.HexDigest();
+
+  for (const size_t chunk_size : {1, 3, 15, 16, 17, 100}) {
+    ContentHasher chunked_hasher;
+    for (size_t i = 0; i < data.size(); i += chunk_size) {
+      chunked_hasher.Add(data.data() + i,
+                         std::min(chunk_size, data.size() - i));
+    }
+    BOOST_CHECK_EQUAL(chunked_hasher.HexDigest(), digest);
+  }
+
+  data[500] += 1;
+  ContentHasher changed_hasher;
+  changed_hasher.Add(data.data(), data.size());
+  BOOST_CHECK_NE(changed_hasher.HexDigest(), digest);
+}
+
+BOOST_AUTO_TEST_CASE(TestStrings) {
+  ContentHasher hasher1;
+  hasher1.AddString("ab");
+  hasher1.AddString("c");
+  ContentHasher hasher2;
+  hasher2.AddString("a");
+  hasher2.AddString("bc");
+  BOOST_CHECK_NE(hasher1.HexDigest(), hasher2.HexDigest());
+}
+
+BOOST_AUTO_TEST_CASE(TestHashFileContent) {
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("hash_test_%%%%%%%%.bin"))
+          .string();
+  BOOST_CHECK_EQUAL(HashFileContent(path), "");
+
+  const std::string text = "The quick brown fox jumps over the lazy dog";
+  {
+    std::ofstream file(path, std::ios::binary);
+    file << text;
+  }
+
+  ContentHasher hasher;
+  hasher.Add(text.data(), text.size());
+  BOOST_CHECK_EQUAL(HashFileContent(path), hasher.HexDigest());
+
+  boost::filesystem::remove(path);
+}
@@ -0,0 +1,289 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/id_bitmap.h"
+
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "util/logging.h"
+
+namespace colmap {
+namespace {
+
+// Number of 64-bit words in the bitset of a dense chunk.
+const size_t kNumChunkWords = (1 << 16) / 64;
+
+// Sparse chunks with more identifiers than this are converted to bitsets,
+// which are then smaller than the arrays.
+const size_t kMaxArraySize = 4096;
+
+inline size_t PopCount(const uint64_t word) {
+#ifdef _MSC_VER
+  return static_cast<size_t>(__popcnt64(word));
+#else
+  return static_cast<size_t>(__builtin_popcountll(word));
+#endif
+}
+
+inline uint16_t ChunkKey(const int id) { return static_cast<uint16_t>(id >> 16); }
+
+inline uint16_t ChunkValue(const int id) {
+  return static_cast<uint16_t>(id & 0xFFFF);
+}
+
+inline bool TestBit(const std::vector<uint64_t>& bits, const uint16_t value) {
+  return (bits[value >> 6] >> (value & 63)) & 1;
+}
+
+}  // namespace
+
+IdBitmap::IdBitmap() : size_(0) {}
+
+IdBitmap::IdBitmap(const SortedIdSpan ids) : size_(0) {
+  CHECK(ids.empty() || ids[0] >= 0);
+  size_t idx = 0;
+  while (idx < ids.size()) {
+    chunks_.emplace_back();
+    Chunk& chunk = chunks_.back();
+    chunk.key = ChunkKey(ids[idx]);
+    while (idx < ids.size() && ChunkKey(ids[idx]) == chunk.key) {
+      const uint16_t value = ChunkValue(ids[idx]);
+      if (chunk.array.empty() || chunk.array.back() != value) {
+        chunk.array.push_back(value);
+      }
+      idx += 1;
+    }
+    chunk.size = chunk.array.size();
+    if (chunk.size > kMaxArraySize) {
+      chunk.MakeDense();
+    }
+    size_ += chunk.size;
+  }
+}
+
+void IdBitmap::Add(const int id) {
+  CHECK_GE(id, 0);
+  const uint16_t key = ChunkKey(id);
+  const uint16_t value = ChunkValue(id);
+
+  auto chunk = std::lower_bound(
+      chunks_.begin(), chunks_.end(), key,
+      [](const Chunk& chunk, const uint16_t key) { return chunk.key < key; });
+  if (chunk == chunks_.end() || chunk->key != key) {
+    chunk = chunks_.emplace(chunk);
+    chunk->key = key;
+  }
+
+  if (chunk->IsDense()) {
+    if (!TestBit(chunk->bits, value)) {
+      chunk->bits[value >> 6] |= uint64_t(1) << (value & 63);
+      chunk->size += 1;
+      size_ += 1;
+    }
+    return;
+  }
+
+  const auto it =
+      std::lower_bound(chunk->array.begin(), chunk->array.end(), value);
+  if (it != chunk->array.end() && *it == value) {
+    return;
+  }
+  chunk->array.insert(it, value);
+  chunk->size += 1;
+  size_ += 1;
+  if (chunk->size > kMaxArraySize) {
+    chunk->MakeDense();
+  }
+}
+
+bool IdBitmap::Contains(const int id) const {
+  if (id < 0) {
+    return false;
+  }
+  const uint16_t key = ChunkKey(id);
+  const auto chunk = std::lower_bound(
+      chunks_.begin(), chunks_.end(), key,
+      [](const Chunk& chunk, const uint16_t key) { return chunk.key < key; });
+  if (chunk == chunks_.end() || chunk->key != key) {
+    return false;
+  }
+  const uint16_t value = ChunkValue(id);
+  if (chunk->IsDense()) {
+    return TestBit(chunk->bits, value);
+  }
+  return std::binary_search(chunk->array.begin(), chunk->array.end(), value);
+}
+
+void IdBitmap::UnionWith(const IdBitmap& other) {
+  if (other.Empty()) {
+    return;
+  }
+
+  std::vector<Chunk> chunks;
+  chunks.reserve(chunks_.size() + other.chunks_.size());
+  size_t idx1 = 0;
+  size_t idx2 = 0;
+  size_ = 0;
+  while (idx1 < chunks_.size() || idx2 < other.chunks_.size()) {
+    if (idx2 == other.chunks_.size() ||
+        (idx1 < chunks_.size() && chunks_[idx1].key < other.chunks_[idx2].key)) {
+      chunks.push_back(std::move(chunks_[idx1]));
+      idx1 += 1;
+    } else if (idx1 == chunks_.size() ||
+               other.chunks_[idx2].key < chunks_[idx1].key) {
+      chunks.push_back(other.chunks_[idx2]);
+      idx2 += 1;
+    } else {
+      chunks.emplace_back();
+      UnionChunks(chunks_[idx1], other.chunks_[idx2], &chunks.back());
+      idx1 += 1;
+      idx2 += 1;
+    }
+    size_ += chunks.back().size;
+  }
+  chunks_.swap(chunks);
+}
+
+std::vector<int> IdBitmap::ToVector() const {
+  std::vector<int> ids;
+  ids.reserve(size_);
+  for (const Chunk& chunk : chunks_) {
+    const int offset = static_cast<int>(chunk.key) << 16;
+    if (chunk.IsDense()) {
+      for (size_t i = 0; i < kNumChunkWords; ++i) {
+        uint64_t word = chunk.bits[i];
+        while (word != 0) {
+          const int bit = static_cast<int>(PopCount((word & -word) - 1));
+          ids.push_back(offset + static_cast<int>(64 * i) + bit);
+          word &= word - 1;
+        }
+      }
+    } else {
+      for (const uint16_t value : chunk.array) {
+        ids.push_back(offset + value);
+      }
+    }
+  }
+  return ids;
+}
+
+void IdBitmap::Chunk::MakeDense() {
+  bits.assign(kNumChunkWords, 0);
+  for (const uint16_t value : array) {
+    bits[value >> 6] |= uint64_t(1) << (value & 63);
+  }
+  array.clear();
+  array.shrink_to_fit();
+}
+
+void IdBitmap::UnionChunks(const Chunk& chunk1, const Chunk& chunk2,
+                           Chunk* chunk) {
+  chunk->key = chunk1.key;
+
+  if (!chunk1.IsDense() && !chunk2.IsDense()) {
+    chunk->array.resize(chunk1.array.size() + chunk2.array.size());
+    const auto end = std::set_union(chunk1.array.begin(), chunk1.array.end(),
+                                    chunk2.array.begin(), chunk2.array.end(),
+                                    chunk->array.begin());
+    chunk->array.resize(end - chunk->array.begin());
+    chunk->size = chunk->array.size();
+    if (chunk->size > kMaxArraySize) {
+      chunk->MakeDense();
+    }
+    return;
+  }
+
+  const Chunk& dense_chunk = chunk1.IsDense() ? chunk1 : chunk2;
+  const Chunk& other_chunk = chunk1.IsDense() ? chunk2 : chunk1;
+  chunk->bits = dense_chunk.bits;
+  if (other_chunk.IsDense()) {
+    for (size_t i = 0; i < kNumChunkWords; ++i) {
+      chunk->bits[i] |= other_chunk.bits[i];
+    }
+  } else {
+    for (const uint16_t value : other_chunk.array) {
+      chunk->bits[value >> 6] |= uint64_t(1) << (value & 63);
+    }
+  }
+
+  chunk->size = 0;
+  for (const uint64_t word : chunk->bits) {
+    chunk->size += PopCount(word);
+  }
+}
+
+size_t IdBitmap::ChunkIntersectionSize(const Chunk& chunk1,
+                                       const Chunk& chunk2) {
+  if (chunk1.IsDense() && chunk2.IsDense()) {
+    size_t size = 0;
+    for (size_t i = 0; i < kNumChunkWords; ++i) {
+      size += PopCount(chunk1.bits[i] & chunk2.bits[i]);
+    }
+    return size;
+  }
+
+  if (chunk1.IsDense() || chunk2.IsDense()) {
+    const Chunk& dense_chunk = chunk1.IsDense() ? chunk1 : chunk2;
+    const Chunk& sparse_chunk = chunk1.IsDense() ? chunk2 : chunk1;
+    size_t size = 0;
+    for (const uint16_t value : sparse_chunk.array) {
+      size += TestBit(dense_chunk.bits, value);
+    }
+    return size;
+  }
+
+  // Branch-free merge of the sorted arrays, as in SortedIdIntersectionSize.
+  const std::vector<uint16_t>& array1 = chunk1.array;
+  const std::vector<uint16_t>& array2 = chunk2.array;
+  size_t size = 0;
+  size_t idx1 = 0;
+  size_t idx2 = 0;
+  while (idx1 < array1.size() && idx2 < array2.size()) {
+    const uint16_t value1 = array1[idx1];
+    const uint16_t value2 = array2[idx2];
+    size += value1 == value2;
+    idx1 += value1 <= value2;
+    idx2 += value2 <= value1;
+  }
+  return size;
+}
+
+size_t IdBitmapIntersectionSize(const IdBitmap& bitmap1,
+                                const IdBitmap& bitmap2) {
+  size_t size = 0;
+  size_t idx1 = 0;
+  size_t idx2 = 0;
+  while (idx1 < bitmap1.chunks_.size() && idx2 < bitmap2.chunks_.size()) {
+    const IdBitmap::Chunk& chunk1 = bitmap1.chunks_[idx1];
+    const IdBitmap::Chunk& chunk2 = bitmap2.chunks_[idx2];
+    if (chunk1.key < chunk2.key) {
+      idx1 += 1;
+    } else if (chunk2.key < chunk1.key) {
+      idx2 += 1;
+    } else {
+      size += IdBitmap::ChunkIntersectionSize(chunk1, chunk2);
+      idx1 += 1;
+      idx2 += 1;
+    }
+  }
+  return size;
+}
+
+}  // namespace colmap
@@ -0,0 +1,93 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_ID_BITMAP_H_
+#define COLMAP_SRC_UTIL_ID_BITMAP_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "util/sorted_ids.h"
+
+namespace colmap {
+
+// Compressed set of non-negative identifiers, e.g. the tracks observed by a
+// group of cameras. The identifier range is split into chunks of 2^16
+// identifiers, where sparse chunks store their identifiers in a sorted array
+// and dense chunks in a bitset, as in roaring bitmaps. Unions and intersection
+// sizes of dense chunks reduce to word-wise bit operations.
+class IdBitmap {
+ public:
+  IdBitmap();
+
+  // Create the set from non-negative identifiers in ascending order.
+  // Identifiers that occur multiple times are only added once.
+  explicit IdBitmap(const SortedIdSpan ids);
+
+  void Add(const int id);
+  bool Contains(const int id) const;
+
+  // Number of identifiers in the set.
+  inline size_t Size() const;
+  inline bool Empty() const;
+
+  // Add all identifiers of the other set to this set.
+  void UnionWith(const IdBitmap& other);
+
+  // All identifiers of the set in ascending order.
+  std::vector<int> ToVector() const;
+
+  friend size_t IdBitmapIntersectionSize(const IdBitmap& bitmap1,
+                                         const IdBitmap& bitmap2);
+
+ private:
+  struct Chunk {
+    // Upper 16 bits of the identifiers in the chunk.
+    uint16_t key = 0;
+    size_t size = 0;
+    // Sorted lower 16 bits of the identifiers, if the chunk is sparse.
+    std::vector<uint16_t> array;
+    // Bitset of the lower 16 bits of the identifiers, if the chunk is dense.
+    std::vector<uint64_t> bits;
+
+    inline bool IsDense() const { return !bits.empty(); }
+    void MakeDense();
+  };
+
+  static void UnionChunks(const Chunk& chunk1, const Chunk& chunk2,
+                          Chunk* chunk);
+  static size_t ChunkIntersectionSize(const Chunk& chunk1, const Chunk& chunk2);
+
+  // Chunks sorted by their key, empty chunks are not stored.
+  std::vector<Chunk> chunks_;
+  size_t size_;
+};
+
+// Number of identifiers that are contained in both sets.
+size_t IdBitmapIntersectionSize(const IdBitmap& bitmap1,
+                                const IdBitmap& bitmap2);
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+size_t IdBitmap::Size() const { return size_; }
+
+bool IdBitmap::Empty() const { return size_ == 0; }
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_ID_BITMAP_H_
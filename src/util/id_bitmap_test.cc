@@ -0,0 +1,113 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/id_bitmap"
+#include "util/testing.h"
+
+#include <algorithm>
+
+#include "util/id_bitmap.h"
+
+using namespace colmap;
+
+BOOST_AUTO_TEST_CASE(TestEmpty) {
+  const IdBitmap bitmap;
+  BOOST_CHECK(bitmap.Empty());
+  BOOST_CHECK_EQUAL(bitmap.Size(), 0);
+  BOOST_CHECK(!bitmap.Contains(0));
+  BOOST_CHECK(!bitmap.Contains(-1));
+  BOOST_CHECK(bitmap.ToVector().empty());
+  BOOST_CHECK(IdBitmap(std::vector<int>()).Empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestFromSortedIds) {
+  const std::vector<int> ids = {0, 3, 3, 70000, 70001, 1 << 30};
+  const IdBitmap bitmap(ids);
+  BOOST_CHECK_EQUAL(bitmap.Size(), 5);
+  BOOST_CHECK(bitmap.Contains(3));
+  BOOST_CHECK(bitmap.Contains(70001));
+  BOOST_CHECK(bitmap.Contains(1 << 30));
+  BOOST_CHECK(!bitmap.Contains(4));
+  BOOST_CHECK(bitmap.ToVector() ==
+              std::vector<int>({0, 3, 70000, 70001, 1 << 30}));
+}
+
+BOOST_AUTO_TEST_CASE(TestAdd) {
+  IdBitmap bitmap;
+  bitmap.Add(100000);
+  bitmap.Add(5);
+  bitmap.Add(5);
+  bitmap.Add(7);
+  BOOST_CHECK_EQUAL(bitmap.Size(), 3);
+  BOOST_CHECK(bitmap.ToVector() == std::vector<int>({5, 7, 100000}));
+
+  // Exceed the array size, such that the chunk is converted to a bitset.
+  for (int i = 0; i < 10000; ++i) {
+    bitmap.Add(2 * i);
+  }
+  BOOST_CHECK_EQUAL(bitmap.Size(), 10003);
+  BOOST_CHECK(bitmap.Contains(7));
+  BOOST_CHECK(bitmap.Contains(19998));
+  BOOST_CHECK(!bitmap.Contains(19999));
+  const std::vector<int> ids = bitmap.ToVector();
+  BOOST_CHECK_EQUAL(ids.size(), 10003);
+  BOOST_CHECK(std::is_sorted(ids.begin(), ids.end()));
+  BOOST_CHECK_EQUAL(ids.back(), 100000);
+}
+
+BOOST_AUTO_TEST_CASE(TestUnion) {
+  IdBitmap bitmap(std::vector<int>{1, 3, 5});
+  bitmap.UnionWith(IdBitmap(std::vector<int>{2, 3, 6, 70000}));
+  BOOST_CHECK_EQUAL(bitmap.Size(), 6);
+  BOOST_CHECK(bitmap.ToVector() == std::vector<int>({1, 2, 3, 5, 6, 70000}));
+  bitmap.UnionWith(IdBitmap());
+  BOOST_CHECK_EQUAL(bitmap.Size(), 6);
+
+  std::vector<int> even_ids;
+  std::vector<int> odd_ids;
+  for (int i = 0; i < 5000; ++i) {
+    even_ids.push_back(2 * i);
+    odd_ids.push_back(2 * i + 1);
+  }
+  IdBitmap dense_bitmap(even_ids);
+  dense_bitmap.UnionWith(IdBitmap(odd_ids));
+  BOOST_CHECK_EQUAL(dense_bitmap.Size(), 10000);
+  dense_bitmap.UnionWith(bitmap);
+  BOOST_CHECK_EQUAL(dense_bitmap.Size(), 10001);
+  BOOST_CHECK(dense_bitmap.Contains(9999));
+  BOOST_CHECK(dense_bitmap.Contains(70000));
+  BOOST_CHECK(!dense_bitmap.Contains(10000));
+}
+
+BOOST_AUTO_TEST_CASE(TestIntersectionSize) {
+  const IdBitmap bitmap1(std::vector<int>{1, 2, 4, 7, 70000});
+  const IdBitmap bitmap2(std::vector<int>{2, 3, 4, 8, 70000});
+  BOOST_CHECK_EQUAL(IdBitmapIntersectionSize(bitmap1, bitmap2), 3);
+  BOOST_CHECK_EQUAL(IdBitmapIntersectionSize(bitmap1, IdBitmap()), 0);
+
+  std::vector<int> dense_ids1;
+  std::vector<int> dense_ids2;
+  for (int i = 0; i < 6000; ++i) {
+    dense_ids1.push_back(2 * i);
+    dense_ids2.push_back(3 * i);
+  }
+  const IdBitmap dense_bitmap1(dense_ids1);
+  const IdBitmap dense_bitmap2(dense_ids2);
+  BOOST_CHECK_EQUAL(IdBitmapIntersectionSize(dense_bitmap1, dense_bitmap2),
+                    SortedIdIntersectionSize(dense_ids1, dense_ids2));
+  BOOST_CHECK_EQUAL(IdBitmapIntersectionSize(dense_bitmap1, bitmap1), 2);
+  BOOST_CHECK_EQUAL(IdBitmapIntersectionSize(bitmap2, dense_bitmap2), 1);
+}
@@ -0,0 +1,154 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/id_index.h"
+
+#include <algorithm>
+
+namespace colmap {
+namespace {
+
+// The dense layout is kept while the largest identifier is below this many
+// times the number of entries plus a minimum size, such that small maps and
+// the point3D_ids of a reconstruction with some deleted points stay dense.
+const size_t kDenseFactor = 4;
+const size_t kMinDenseSize = 1024;
+
+// Minimum capacity of the hash table.
+const size_t kMinHashCapacity = 16;
+
+size_t MaxDenseSize(const size_t num_entries) {
+  return kDenseFactor * num_entries + kMinDenseSize;
+}
+
+size_t HashCapacity(const size_t num_entries) {
+  size_t capacity = kMinHashCapacity;
+  while (capacity < 2 * num_entries) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+}  // namespace
+
+const int IdIndexMap::kInvalidIndex;
+const int IdIndexMap::kEmptyKey;
+
+IdIndexMap::IdIndexMap() : size_(0), dense_(true) {}
+
+IdIndexMap::IdIndexMap(const std::vector<int>& ids) : IdIndexMap() {
+  if (ids.empty()) {
+    return;
+  }
+  const auto min_max = std::minmax_element(ids.begin(), ids.end());
+  if (*min_max.first >= 0 &&
+      static_cast<size_t>(*min_max.second) < MaxDenseSize(ids.size())) {
+    dense_indices_.resize(*min_max.second + 1, kInvalidIndex);
+  } else {
+    dense_ = false;
+    hash_keys_.resize(HashCapacity(ids.size()), kEmptyKey);
+    hash_values_.resize(hash_keys_.size(), kInvalidIndex);
+  }
+  for (size_t i = 0; i < ids.size(); ++i) {
+    (*this)[ids[i]] = static_cast<int>(i);
+  }
+}
+
+bool IdIndexMap::IsDense() const { return dense_; }
+
+void IdIndexMap::clear() {
+  size_ = 0;
+  dense_ = true;
+  dense_indices_.clear();
+  hash_keys_.clear();
+  hash_values_.clear();
+}
+
+int& IdIndexMap::operator[](const int id) {
+  CHECK_NE(id, kEmptyKey);
+  if (dense_ && id >= 0) {
+    const size_t dense_id = static_cast<size_t>(id);
+    if (dense_id >= dense_indices_.size() &&
+        dense_id < MaxDenseSize(size_ + 1)) {
+      const size_t dense_size =
+          std::min(std::max(dense_id + 1, 2 * dense_indices_.size()),
+                   MaxDenseSize(size_ + 1));
+      dense_indices_.resize(dense_size, kInvalidIndex);
+    }
+    if (dense_id < dense_indices_.size()) {
+      int& index = dense_indices_[dense_id];
+      if (index == kInvalidIndex) {
+        index = 0;
+        size_ += 1;
+      }
+      return index;
+    }
+  }
+  if (dense_) {
+    SwitchToHashTable();
+  }
+  return *FindOrInsertHashed(id);
+}
+
+int* IdIndexMap::FindOrInsertHashed(const int id) {
+  if (2 * (size_ + 1) > hash_keys_.size()) {
+    GrowHashTable();
+  }
+  size_t slot = HashSlot(id);
+  while (hash_keys_[slot] != id) {
+    if (hash_keys_[slot] == kEmptyKey) {
+      hash_keys_[slot] = id;
+      hash_values_[slot] = 0;
+      size_ += 1;
+      break;
+    }
+    slot = (slot + 1) & (hash_keys_.size() - 1);
+  }
+  return &hash_values_[slot];
+}
+
+void IdIndexMap::GrowHashTable() {
+  std::vector<int> keys(HashCapacity(size_ + 1), kEmptyKey);
+  std::vector<int> values(keys.size(), kInvalidIndex);
+  keys.swap(hash_keys_);
+  values.swap(hash_values_);
+  for (size_t slot = 0; slot < keys.size(); ++slot) {
+    if (keys[slot] != kEmptyKey) {
+      size_t new_slot = HashSlot(keys[slot]);
+      while (hash_keys_[new_slot] != kEmptyKey) {
+        new_slot = (new_slot + 1) & (hash_keys_.size() - 1);
+      }
+      hash_keys_[new_slot] = keys[slot];
+      hash_values_[new_slot] = values[slot];
+    }
+  }
+}
+
+void IdIndexMap::SwitchToHashTable() {
+  std::vector<int> dense_indices;
+  dense_indices.swap(dense_indices_);
+  dense_ = false;
+  hash_keys_.assign(HashCapacity(size_ + 1), kEmptyKey);
+  size_ = 0;
+  hash_values_.assign(hash_keys_.size(), kInvalidIndex);
+  for (size_t id = 0; id < dense_indices.size(); ++id) {
+    if (dense_indices[id] != kInvalidIndex) {
+      *FindOrInsertHashed(static_cast<int>(id)) = dense_indices[id];
+    }
+  }
+}
+
+}  // namespace colmap
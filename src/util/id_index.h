@@ -0,0 +1,142 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_ID_INDEX_H_
+#define COLMAP_SRC_UTIL_ID_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "util/logging.h"
+
+namespace colmap {
+
+// Map from identifiers to non-negative indices, e.g. from the point3D_id of
+// the points of a take to their position. As long as the identifiers are
+// non-negative and at most a few times more than the number of entries, the
+// indices are stored in a dense array indexed by the identifier. Otherwise,
+// the map switches to a flat open-addressing hash table with linear probing.
+// Both layouts are contiguous, unlike the nodes of std::unordered_map.
+class IdIndexMap {
+ public:
+  static const int kInvalidIndex = -1;
+
+  IdIndexMap();
+
+  // Map every identifier to its position in the vector.
+  explicit IdIndexMap(const std::vector<int>& ids);
+
+  // Index of the identifier or kInvalidIndex if it is not contained.
+  inline int Find(const int id) const;
+
+  // Call `func(id, index)` for every entry in unspecified order.
+  template <typename Func>
+  void ForEach(const Func& func) const;
+
+  bool IsDense() const;
+
+  // Subset of the interface of std::unordered_map<int, int>, such that the
+  // map replaces it without changes of the callers. As for std::unordered_map,
+  // `operator[]` inserts a missing identifier with the index 0. The returned
+  // reference is invalidated by the next insertion.
+  inline size_t size() const;
+  inline bool empty() const;
+  void clear();
+  inline size_t count(const int id) const;
+  inline int at(const int id) const;
+  int& operator[](const int id);
+
+ private:
+  static const int kEmptyKey = std::numeric_limits<int>::min();
+
+  inline size_t HashSlot(const int id) const;
+  int* FindOrInsertHashed(const int id);
+  void GrowHashTable();
+  void SwitchToHashTable();
+
+  size_t size_;
+  bool dense_;
+  // Index of every identifier in the dense layout or kInvalidIndex.
+  std::vector<int> dense_indices_;
+  // Keys and values of the hash table in the sparse layout, whose capacity is
+  // a power of two and at least twice the number of entries.
+  std::vector<int> hash_keys_;
+  std::vector<int> hash_values_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+size_t IdIndexMap::HashSlot(const int id) const {
+  // Fibonacci hashing spreads consecutive identifiers over the table.
+  uint32_t hash = static_cast<uint32_t>(id) * 2654435769u;
+  hash ^= hash >> 16;
+  return hash & (hash_keys_.size() - 1);
+}
+
+int IdIndexMap::Find(const int id) const {
+  if (dense_) {
+    if (id < 0 || static_cast<size_t>(id) >= dense_indices_.size()) {
+      return kInvalidIndex;
+    }
+    return dense_indices_[id];
+  }
+  for (size_t slot = HashSlot(id);; slot = (slot + 1) & (hash_keys_.size() - 1)) {
+    if (hash_keys_[slot] == id) {
+      return hash_values_[slot];
+    } else if (hash_keys_[slot] == kEmptyKey) {
+      return kInvalidIndex;
+    }
+  }
+}
+
+template <typename Func>
+void IdIndexMap::ForEach(const Func& func) const {
+  if (dense_) {
+    for (size_t id = 0; id < dense_indices_.size(); ++id) {
+      if (dense_indices_[id] != kInvalidIndex) {
+        func(static_cast<int>(id), dense_indices_[id]);
+      }
+    }
+  } else {
+    for (size_t slot = 0; slot < hash_keys_.size(); ++slot) {
+      if (hash_keys_[slot] != kEmptyKey) {
+        func(hash_keys_[slot], hash_values_[slot]);
+      }
+    }
+  }
+}
+
+size_t IdIndexMap::size() const { return size_; }
+
+bool IdIndexMap::empty() const { return size_ == 0; }
+
+size_t IdIndexMap::count(const int id) const {
+  return Find(id) != kInvalidIndex ? 1 : 0;
+}
+
+int IdIndexMap::at(const int id) const {
+  const int index = Find(id);
+  CHECK_NE(index, kInvalidIndex) << "Identifier " << id << " does not exist";
+  return index;
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_ID_INDEX_H_
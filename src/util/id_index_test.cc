@@ -0,0 +1,117 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/id_index"
+#include "util/testing.h"
+
+#include <map>
+
+#include "util/id_index.h"
+
+using namespace colmap;
+
+namespace {
+
+// Check that the map contains exactly the entries of the reference.
+void CheckEntries(const IdIndexMap& map, const std::map<int, int>& reference) {
+  BOOST_CHECK_EQUAL(map.size(), reference.size());
+  for (const auto& entry : reference) {
+    BOOST_CHECK_EQUAL(map.Find(entry.first), entry.second);
+    BOOST_CHECK_EQUAL(map.at(entry.first), entry.second);
+    BOOST_CHECK_EQUAL(map.count(entry.first), 1);
+  }
+  std::map<int, int> entries;
+  map.ForEach([&entries](const int id, const int index) {
+    BOOST_CHECK(entries.emplace(id, index).second);
+  });
+  BOOST_CHECK(entries == reference);
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestEmpty) {
+  IdIndexMap map;
+  BOOST_CHECK(map.empty());
+  BOOST_CHECK_EQUAL(map.size(), 0);
+  BOOST_CHECK(map.IsDense());
+  BOOST_CHECK_EQUAL(map.Find(0), IdIndexMap::kInvalidIndex);
+  BOOST_CHECK_EQUAL(map.Find(-5), IdIndexMap::kInvalidIndex);
+  BOOST_CHECK_EQUAL(map.count(3), 0);
+  BOOST_CHECK(IdIndexMap(std::vector<int>()).empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestDense) {
+  const std::vector<int> ids = {4, 0, 7, 2};
+  const IdIndexMap map(ids);
+  BOOST_CHECK(map.IsDense());
+  CheckEntries(map, {{4, 0}, {0, 1}, {7, 2}, {2, 3}});
+  BOOST_CHECK_EQUAL(map.Find(1), IdIndexMap::kInvalidIndex);
+  BOOST_CHECK_EQUAL(map.Find(8), IdIndexMap::kInvalidIndex);
+  BOOST_CHECK_EQUAL(map.Find(-1), IdIndexMap::kInvalidIndex);
+}
+
+BOOST_AUTO_TEST_CASE(TestSparse) {
+  const std::vector<int> ids = {-3, 1000000, 5, 1 << 30};
+  const IdIndexMap map(ids);
+  BOOST_CHECK(!map.IsDense());
+  CheckEntries(map, {{-3, 0}, {1000000, 1}, {5, 2}, {1 << 30, 3}});
+  BOOST_CHECK_EQUAL(map.Find(4), IdIndexMap::kInvalidIndex);
+}
+
+BOOST_AUTO_TEST_CASE(TestInsert) {
+  // Inserting like into std::unordered_map, starting dense and switching to
+  // the hash table once the identifiers become too sparse.
+  IdIndexMap map;
+  std::map<int, int> reference;
+  for (int i = 0; i < 2000; ++i) {
+    map[3 * i] = i;
+    reference[3 * i] = i;
+  }
+  BOOST_CHECK(map.IsDense());
+  CheckEntries(map, reference);
+
+  map[100000000] = 7;
+  reference[100000000] = 7;
+  BOOST_CHECK(!map.IsDense());
+  CheckEntries(map, reference);
+
+  for (int i = 0; i < 5000; ++i) {
+    map[-7 * i - 1] = i;
+    reference[-7 * i - 1] = i;
+  }
+  CheckEntries(map, reference);
+
+  // A missing identifier is inserted with index 0 and existing ones are
+  // overwritten.
+  BOOST_CHECK_EQUAL(map[1], 0);
+  reference[1] = 0;
+  map[3] = 42;
+  reference[3] = 42;
+  CheckEntries(map, reference);
+
+  map.clear();
+  BOOST_CHECK(map.empty());
+  BOOST_CHECK(map.IsDense());
+  BOOST_CHECK_EQUAL(map.Find(3), IdIndexMap::kInvalidIndex);
+}
+
+BOOST_AUTO_TEST_CASE(TestNegativeSwitchesToHashTable) {
+  IdIndexMap map;
+  map[1] = 1;
+  map[-1] = 2;
+  BOOST_CHECK(!map.IsDense());
+  CheckEntries(map, {{1, 1}, {-1, 2}});
+}
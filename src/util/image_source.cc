@@ -0,0 +1,286 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "util/image_source.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <boost/filesystem.hpp>
+
+#include "util/logging.h"
+#include "util/metrics.h"
+#include "util/misc.h"
+#include "util/string.h"
+
+namespace colmap {
+namespace {
+
+// Quote an argument of a shell command.
+std::string ShellQuote(const std::string& arg) {
+  return "'" + StringReplace(arg, "'", "'\\''") + "'";
+}
+
+}  // namespace
+
+bool ImageSourceOptions::Check() const {
+  CHECK_OPTION(StringContains(fetch_command, "{url}"));
+  CHECK_OPTION(StringContains(fetch_command, "{path}"));
+  CHECK_OPTION_GT(cache_size, 0);
+  CHECK_OPTION_GT(num_fetch_threads, 0);
+  CHECK_OPTION_GT(max_num_prefetched_images, 0);
+  return true;
+}
+
+bool IsRemoteImagePath(const std::string& path) {
+  return StringContains(path, "://");
+}
+
+void ImageSource::Prefetch(const std::vector<std::string>& image_names) {}
+
+void ImageSource::Release(const std::string& image_name) {}
+
+LocalImageSource::LocalImageSource(const std::string& image_path)
+    : image_path_(image_path) {}
+
+bool LocalImageSource::Acquire(const std::string& image_name,
+                               std::string* path) {
+  *path = JoinPaths(image_path_, image_name);
+  return ExistsFile(*path);
+}
+
+CachedImageSource::CachedImageSource(const ImageSourceOptions& options)
+    : max_num_bytes_(
+          static_cast<size_t>(1024.0 * 1024.0 * 1024.0 * options.cache_size)),
+      cache_path_(options.cache_path),
+      remove_cache_path_(false),
+      num_bytes_(0) {
+  CHECK(options.Check());
+
+  if (cache_path_.empty()) {
+    cache_path_ = (boost::filesystem::temp_directory_path() /
+                   boost::filesystem::unique_path("colmap_images_%%%%%%%%"))
+                      .string();
+    remove_cache_path_ = true;
+  }
+  boost::filesystem::create_directories(cache_path_);
+
+  fetch_thread_pool_.reset(new ThreadPool(options.num_fetch_threads));
+}
+
+CachedImageSource::~CachedImageSource() {
+  // The fetch threads access the cache, so they must be joined first.
+  fetch_thread_pool_.reset();
+  if (remove_cache_path_) {
+    boost::system::error_code error_code;
+    boost::filesystem::remove_all(cache_path_, error_code);
+  }
+}
+
+void CachedImageSource::Prefetch(const std::vector<std::string>& image_names) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (const auto& image_name : image_names) {
+    if (images_.count(image_name) > 0) {
+      continue;
+    }
+    images_.emplace(image_name, CachedImage());
+    fetch_thread_pool_->AddTask(&CachedImageSource::FetchImage, this,
+                                image_name);
+  }
+}
+
+bool CachedImageSource::Acquire(const std::string& image_name,
+                                std::string* path) {
+  METRIC_COUNTER_ADD("image_source/cache_accesses", 1);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  // Images that were not prefetched, or whose fetch failed before, are
+  // fetched by the calling thread, which would otherwise wait behind the
+  // prefetched images in the queue of the fetch threads.
+  bool fetch = false;
+  auto it = images_.find(image_name);
+  if (it == images_.end()) {
+    it = images_.emplace(image_name, CachedImage()).first;
+    fetch = true;
+  } else if (it->second.state == State::FAILED) {
+    it->second.state = State::FETCHING;
+    fetch = true;
+  }
+
+  CachedImage& image = it->second;
+  image.num_users += 1;
+  MakeUnevictable(&image);
+
+  if (image.state != State::READY) {
+    METRIC_COUNTER_ADD("image_source/cache_misses", 1);
+  }
+
+  if (fetch) {
+    lock.unlock();
+    FetchImage(image_name);
+    lock.lock();
+  }
+
+  fetched_condition_.wait(lock,
+                          [&image]() { return image.state != State::FETCHING; });
+
+  if (image.state == State::FAILED) {
+    image.num_users -= 1;
+    if (image.num_users == 0) {
+      images_.erase(image_name);
+    }
+    return false;
+  }
+
+  *path = CachePath(image_name);
+  return true;
+}
+
+void CachedImageSource::Release(const std::string& image_name) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  CachedImage& image = images_.at(image_name);
+  CHECK_GT(image.num_users, 0);
+  image.num_users -= 1;
+  if (image.num_users == 0) {
+    MakeEvictable(image_name, &image);
+    EvictImages();
+  }
+}
+
+std::string CachedImageSource::CachePath(const std::string& image_name) const {
+  return JoinPaths(cache_path_, image_name);
+}
+
+void CachedImageSource::FetchImage(const std::string& image_name) {
+  const std::string path = CachePath(image_name);
+
+  // The images are fetched to a temporary file, so that the cache never
+  // contains partial images, even if the process is killed.
+  bool success = ExistsFile(path);
+  const bool fetched = !success;
+  if (fetched) {
+    boost::system::error_code error_code;
+    boost::filesystem::create_directories(GetParentDir(path), error_code);
+    const std::string fetch_path =
+        path + boost::filesystem::unique_path(".%%%%%%%%.tmp").string();
+    success = Fetch(image_name, fetch_path) && ExistsFile(fetch_path);
+    if (success) {
+      boost::filesystem::rename(fetch_path, path, error_code);
+      success = !error_code;
+    }
+    if (!success) {
+      boost::filesystem::remove(fetch_path, error_code);
+      std::cerr << StringPrintf("WARNING: Could not fetch image `%s`.",
+                                image_name.c_str())
+                << std::endl;
+    }
+    METRIC_COUNTER_ADD("image_source/num_fetches", 1);
+  }
+
+  const size_t num_bytes = success ? GetFileSize(path) : 0;
+  if (fetched) {
+    METRIC_COUNTER_ADD("image_source/fetched_bytes", num_bytes);
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  CachedImage& image = images_.at(image_name);
+  image.state = success ? State::READY : State::FAILED;
+  image.num_bytes = num_bytes;
+  num_bytes_ += num_bytes;
+  if (success && image.num_users == 0) {
+    MakeEvictable(image_name, &image);
+  }
+  EvictImages();
+  fetched_condition_.notify_all();
+}
+
+void CachedImageSource::MakeEvictable(const std::string& image_name,
+                                      CachedImage* image) {
+  if (image->state != State::READY || image->evictable) {
+    return;
+  }
+  image->lru_it =
+      evictable_images_.insert(evictable_images_.end(), image_name);
+  image->evictable = true;
+}
+
+void CachedImageSource::MakeUnevictable(CachedImage* image) {
+  if (image->evictable) {
+    evictable_images_.erase(image->lru_it);
+    image->evictable = false;
+  }
+}
+
+void CachedImageSource::EvictImages() {
+  while (num_bytes_ > max_num_bytes_ && !evictable_images_.empty()) {
+    const std::string image_name = evictable_images_.front();
+    evictable_images_.pop_front();
+    const auto it = images_.find(image_name);
+    num_bytes_ -= it->second.num_bytes;
+    boost::system::error_code error_code;
+    boost::filesystem::remove(CachePath(image_name), error_code);
+    images_.erase(it);
+  }
+}
+
+CommandImageSource::CommandImageSource(const std::string& url,
+                                       const ImageSourceOptions& options)
+    : CachedImageSource(options),
+      url_(EnsureTrailingSlash(url)),
+      fetch_command_(options.fetch_command) {}
+
+bool CommandImageSource::Fetch(const std::string& image_name,
+                               const std::string& path) {
+  std::string command = fetch_command_;
+  command = StringReplace(command, "{url}", ShellQuote(url_ + image_name));
+  command = StringReplace(command, "{path}", ShellQuote(path));
+  return std::system(command.c_str()) == 0;
+}
+
+std::unique_ptr<ImageSource> CreateImageSource(
+    const std::string& image_path, const ImageSourceOptions& options) {
+  if (IsRemoteImagePath(image_path)) {
+    return std::unique_ptr<ImageSource>(
+        new CommandImageSource(image_path, options));
+  }
+  return std::unique_ptr<ImageSource>(new LocalImageSource(image_path));
+}
+
+ImagePrefetcher::ImagePrefetcher(ImageSource* image_source,
+                                 const std::vector<std::string>& image_names,
+                                 const size_t window_size)
+    : image_source_(CHECK_NOTNULL(image_source)),
+      image_names_(image_names),
+      window_size_(window_size),
+      next_index_(0) {
+  Advance(0);
+}
+
+void ImagePrefetcher::Advance(const size_t index) {
+  const size_t end_index =
+      std::min(image_names_.size(), index + window_size_);
+  if (next_index_ >= end_index) {
+    return;
+  }
+  image_source_->Prefetch(
+      std::vector<std::string>(image_names_.begin() + next_index_,
+                               image_names_.begin() + end_index));
+  next_index_ = end_index;
+}
+
+}  // namespace colmap
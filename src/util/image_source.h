@@ -0,0 +1,196 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef COLMAP_SRC_UTIL_IMAGE_SOURCE_H_
+#define COLMAP_SRC_UTIL_IMAGE_SOURCE_H_
+
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "util/threading.h"
+
+namespace colmap {
+
+struct ImageSourceOptions {
+  // Command that copies a remote image to a local file, for image paths that
+  // are URLs, where "{url}" is replaced by the URL of the image and "{path}"
+  // by the local file, e.g. "aws s3 cp --quiet {url} {path}" or
+  // "gsutil -q cp {url} {path}".
+  std::string fetch_command = "curl -sfL -o {path} {url}";
+
+  // Directory of the local disk cache of the fetched images, which can be
+  // shared by the commands of a job, e.g. by the feature extraction and the
+  // undistortion. A temporary directory that is removed afterwards if empty.
+  std::string cache_path = "";
+
+  // Maximum size of the disk cache in gigabytes. Images in use are never
+  // evicted, so the cache may temporarily exceed the size.
+  double cache_size = 16.0;
+
+  // The number of images that are fetched concurrently, and the number of
+  // images that the readers fetch ahead of their consumption.
+  int num_fetch_threads = 16;
+  int max_num_prefetched_images = 64;
+
+  bool Check() const;
+};
+
+// Whether the path is the URL of a remote image source, e.g.
+// "s3://bucket/images", rather than a local directory.
+bool IsRemoteImagePath(const std::string& path);
+
+// Source of the image files under a root path, which are read from local files.
+// The file of an acquired image is valid until it is released. Thread-safe.
+//
+// Example usage:
+//
+//    auto image_source = CreateImageSource("s3://bucket/images", options);
+//    image_source->Prefetch({"image1.jpg", "image2.jpg"});
+//    std::string path;
+//    if (image_source->Acquire("image1.jpg", &path)) {
+//      bitmap.Read(path);
+//      image_source->Release("image1.jpg");
+//    }
+//
+class ImageSource {
+ public:
+  virtual ~ImageSource() = default;
+
+  // Hint that the images are acquired next, in the given order, so that they
+  // are fetched in the background.
+  virtual void Prefetch(const std::vector<std::string>& image_names);
+
+  // The local path of an image, which waits until the image is fetched.
+  // Returns false if it could not be fetched, in which case the image must
+  // not be released.
+  virtual bool Acquire(const std::string& image_name, std::string* path) = 0;
+
+  virtual void Release(const std::string& image_name);
+};
+
+// The images of a local directory, which are read in place.
+class LocalImageSource : public ImageSource {
+ public:
+  explicit LocalImageSource(const std::string& image_path);
+
+  bool Acquire(const std::string& image_name, std::string* path) override;
+
+ private:
+  const std::string image_path_;
+};
+
+// Images that are fetched into a local disk cache by a pool of threads. When
+// the cache exceeds its size, the least recently used images that are not
+// acquired are evicted. Images left in the cache directory by an earlier
+// command are reused. Subclasses implement the transfer of a single image.
+class CachedImageSource : public ImageSource {
+ public:
+  explicit CachedImageSource(const ImageSourceOptions& options);
+  ~CachedImageSource();
+
+  void Prefetch(const std::vector<std::string>& image_names) override;
+  bool Acquire(const std::string& image_name, std::string* path) override;
+  void Release(const std::string& image_name) override;
+
+ protected:
+  // Fetch the image to the given local file, whose directory exists. Called
+  // concurrently by the fetch threads.
+  virtual bool Fetch(const std::string& image_name,
+                     const std::string& path) = 0;
+
+ private:
+  enum class State { FETCHING, READY, FAILED };
+
+  struct CachedImage {
+    State state = State::FETCHING;
+    size_t num_bytes = 0;
+    int num_users = 0;
+    // The position in the list of evictable images, if not acquired.
+    std::list<std::string>::iterator lru_it;
+    bool evictable = false;
+  };
+
+  std::string CachePath(const std::string& image_name) const;
+
+  // Fetch an image into the cache and update its state, which is done by the
+  // fetch threads or by `Acquire` for images that were not prefetched.
+  void FetchImage(const std::string& image_name);
+
+  // The following functions require the mutex to be locked.
+  void MakeEvictable(const std::string& image_name, CachedImage* image);
+  void MakeUnevictable(CachedImage* image);
+  void EvictImages();
+
+  const size_t max_num_bytes_;
+  std::string cache_path_;
+  bool remove_cache_path_;
+
+  std::mutex mutex_;
+  std::condition_variable fetched_condition_;
+  std::unordered_map<std::string, CachedImage> images_;
+  std::list<std::string> evictable_images_;
+  size_t num_bytes_;
+
+  std::unique_ptr<ThreadPool> fetch_thread_pool_;
+};
+
+// The images under a URL, which are fetched with an external command, e.g.
+// the command line client of the object storage.
+class CommandImageSource : public CachedImageSource {
+ public:
+  CommandImageSource(const std::string& url,
+                     const ImageSourceOptions& options);
+
+ protected:
+  bool Fetch(const std::string& image_name, const std::string& path) override;
+
+ private:
+  const std::string url_;
+  const std::string fetch_command_;
+};
+
+// Create the source of the images under the path, which is remote if the path
+// is a URL and local otherwise.
+std::unique_ptr<ImageSource> CreateImageSource(
+    const std::string& image_path, const ImageSourceOptions& options);
+
+// Prefetches the images of a source in the order in which they are consumed,
+// at most `window_size` images ahead of the consumer.
+class ImagePrefetcher {
+ public:
+  ImagePrefetcher(ImageSource* image_source,
+                  const std::vector<std::string>& image_names,
+                  const size_t window_size);
+
+  // Signal that the consumer has reached the image at the given index.
+  void Advance(const size_t index);
+
+ private:
+  ImageSource* image_source_;
+  const std::vector<std::string> image_names_;
+  const size_t window_size_;
+  size_t next_index_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_IMAGE_SOURCE_H_
@@ -0,0 +1,206 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#define TEST_NAME "util/image_source"
+#include "util/testing.h"
+
+#include <atomic>
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+#include "util/image_source.h"
+#include "util/misc.h"
+
+using namespace colmap;
+
+namespace {
+
+std::string TempPath() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("image_source_test_%%%%%%%%"))
+      .string();
+}
+
+void WriteFile(const std::string& path, const size_t num_bytes) {
+  boost::filesystem::create_directories(GetParentDir(path));
+  std::ofstream file(path, std::ios::binary);
+  file << std::string(num_bytes, 'x');
+}
+
+// Fetches images of 1000 bytes, except for images named "missing".
+class TestImageSource : public CachedImageSource {
+ public:
+  explicit TestImageSource(const ImageSourceOptions& options)
+      : CachedImageSource(options), num_fetches(0) {}
+
+  std::atomic<int> num_fetches;
+
+ protected:
+  bool Fetch(const std::string& image_name, const std::string& path) override {
+    num_fetches += 1;
+    if (image_name == "missing") {
+      return false;
+    }
+    WriteFile(path, 1000);
+    return true;
+  }
+};
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestIsRemoteImagePath) {
+  BOOST_CHECK(IsRemoteImagePath("s3://bucket/images"));
+  BOOST_CHECK(IsRemoteImagePath("https://host/images/"));
+  BOOST_CHECK(!IsRemoteImagePath("/data/images"));
+  BOOST_CHECK(!IsRemoteImagePath("images"));
+}
+
+BOOST_AUTO_TEST_CASE(TestLocalImageSource) {
+  const std::string image_path = TempPath();
+  WriteFile(JoinPaths(image_path, "dir/image.jpg"), 10);
+  auto image_source = CreateImageSource(image_path, ImageSourceOptions());
+  std::string path;
+  BOOST_CHECK(image_source->Acquire("dir/image.jpg", &path));
+  BOOST_CHECK_EQUAL(path, JoinPaths(image_path, "dir/image.jpg"));
+  image_source->Release("dir/image.jpg");
+  BOOST_CHECK(!image_source->Acquire("other.jpg", &path));
+  boost::filesystem::remove_all(image_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestCachedImageSource) {
+  ImageSourceOptions options;
+  options.cache_path = TempPath();
+  TestImageSource image_source(options);
+
+  image_source.Prefetch({"a.jpg", "dir/b.jpg"});
+  std::string path;
+  BOOST_CHECK(image_source.Acquire("a.jpg", &path));
+  BOOST_CHECK_EQUAL(path, JoinPaths(options.cache_path, "a.jpg"));
+  BOOST_CHECK_EQUAL(GetFileSize(path), 1000);
+  BOOST_CHECK(image_source.Acquire("dir/b.jpg", &path));
+  BOOST_CHECK_EQUAL(GetFileSize(path), 1000);
+  BOOST_CHECK(image_source.Acquire("a.jpg", &path));
+  image_source.Release("a.jpg");
+  image_source.Release("a.jpg");
+  image_source.Release("dir/b.jpg");
+  BOOST_CHECK_EQUAL(image_source.num_fetches, 2);
+
+  BOOST_CHECK(!image_source.Acquire("missing", &path));
+  BOOST_CHECK(!image_source.Acquire("missing", &path));
+  BOOST_CHECK_EQUAL(image_source.num_fetches, 4);
+
+  boost::filesystem::remove_all(options.cache_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestCachedImageSourceReuse) {
+  ImageSourceOptions options;
+  options.cache_path = TempPath();
+  WriteFile(JoinPaths(options.cache_path, "a.jpg"), 10);
+  {
+    TestImageSource image_source(options);
+    std::string path;
+    BOOST_CHECK(image_source.Acquire("a.jpg", &path));
+    BOOST_CHECK_EQUAL(GetFileSize(path), 10);
+    image_source.Release("a.jpg");
+    BOOST_CHECK_EQUAL(image_source.num_fetches, 0);
+  }
+  // An explicit cache directory is kept.
+  BOOST_CHECK(ExistsFile(JoinPaths(options.cache_path, "a.jpg")));
+  boost::filesystem::remove_all(options.cache_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestCachedImageSourceEviction) {
+  ImageSourceOptions options;
+  options.cache_path = TempPath();
+  options.cache_size = 2500.0 / (1024.0 * 1024.0 * 1024.0);
+  TestImageSource image_source(options);
+
+  std::string path_a;
+  std::string path_b;
+  std::string path_c;
+  BOOST_CHECK(image_source.Acquire("a.jpg", &path_a));
+  BOOST_CHECK(image_source.Acquire("b.jpg", &path_b));
+  image_source.Release("a.jpg");
+  image_source.Release("b.jpg");
+  BOOST_CHECK(ExistsFile(path_a));
+  BOOST_CHECK(ExistsFile(path_b));
+
+  // The least recently released image is evicted first.
+  BOOST_CHECK(image_source.Acquire("c.jpg", &path_c));
+  BOOST_CHECK(!ExistsFile(path_a));
+  BOOST_CHECK(ExistsFile(path_b));
+  BOOST_CHECK(ExistsFile(path_c));
+
+  // Acquired images are not evicted, even though the cache is too large.
+  BOOST_CHECK(image_source.Acquire("b.jpg", &path_b));
+  BOOST_CHECK(image_source.Acquire("a.jpg", &path_a));
+  BOOST_CHECK(ExistsFile(path_a));
+  BOOST_CHECK(ExistsFile(path_b));
+  BOOST_CHECK(ExistsFile(path_c));
+  BOOST_CHECK_EQUAL(image_source.num_fetches, 4);
+
+  // Released images are evicted while the cache is too large.
+  image_source.Release("b.jpg");
+  BOOST_CHECK(!ExistsFile(path_b));
+  image_source.Release("c.jpg");
+  image_source.Release("a.jpg");
+  BOOST_CHECK(ExistsFile(path_a));
+  BOOST_CHECK(ExistsFile(path_c));
+
+  boost::filesystem::remove_all(options.cache_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestCommandImageSource) {
+  const std::string image_path = TempPath();
+  WriteFile(JoinPaths(image_path, "it's.jpg"), 10);
+
+  ImageSourceOptions options;
+  options.fetch_command = "cp {url} {path}";
+  std::string cache_path;
+  {
+    CommandImageSource image_source(image_path, options);
+    std::string path;
+    BOOST_CHECK(image_source.Acquire("it's.jpg", &path));
+    BOOST_CHECK_EQUAL(GetFileSize(path), 10);
+    cache_path = GetParentDir(path);
+    BOOST_CHECK_NE(cache_path, image_path);
+    image_source.Release("it's.jpg");
+    BOOST_CHECK(!image_source.Acquire("missing.jpg", &path));
+  }
+  // A temporary cache directory is removed.
+  BOOST_CHECK(!ExistsDir(cache_path));
+
+  boost::filesystem::remove_all(image_path);
+}
+
+BOOST_AUTO_TEST_CASE(TestImagePrefetcher) {
+  ImageSourceOptions options;
+  TestImageSource image_source(options);
+  ImagePrefetcher prefetcher(&image_source, {"a", "b", "c", "d", "e"}, 2);
+  std::string path;
+  BOOST_CHECK(image_source.Acquire("a", &path));
+  BOOST_CHECK(image_source.Acquire("b", &path));
+  BOOST_CHECK_EQUAL(image_source.num_fetches, 2);
+  prefetcher.Advance(1);
+  BOOST_CHECK(image_source.Acquire("c", &path));
+  BOOST_CHECK_EQUAL(image_source.num_fetches, 3);
+  prefetcher.Advance(10);
+  BOOST_CHECK(image_source.Acquire("d", &path));
+  BOOST_CHECK(image_source.Acquire("e", &path));
+  BOOST_CHECK_EQUAL(image_source.num_fetches, 5);
+}
@@ -0,0 +1,225 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/job_manifest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/string.h"
+#include "util/timer.h"
+
+namespace colmap {
+namespace {
+
+// Suffix of the file that registers a job. It is created exclusively, so that
+// concurrent calls to `Add` create the pending file of a job only once.
+const char kAddedSuffix[] = "added";
+
+bool IsValidName(const std::string& name) {
+  return !name.empty() && name.find_first_of("./\\") == std::string::npos;
+}
+
+// Create an empty file, failing if it exists.
+bool CreateFileExclusive(const std::string& path) {
+  FILE* file = std::fopen(path.c_str(), "wx");
+  if (file == nullptr) {
+    return false;
+  }
+  std::fclose(file);
+  return true;
+}
+
+void CreateFile(const std::string& path) {
+  FILE* file = std::fopen(path.c_str(), "w");
+  CHECK(file != nullptr) << "Could not create " << path;
+  std::fclose(file);
+}
+
+// Parse the name of a job file into the job, its state and the worker for
+// running jobs. Returns false for other files in the folder.
+bool ParseJobFileName(const std::string& file_name, std::string* job,
+                      JobManifest::State* state, std::string* worker) {
+  const std::vector<std::string> parts = StringSplit(file_name, ".");
+  if (parts.size() == 2) {
+    if (parts[1] == "pending") {
+      *state = JobManifest::State::PENDING;
+    } else if (parts[1] == "done") {
+      *state = JobManifest::State::DONE;
+    } else if (parts[1] == "failed") {
+      *state = JobManifest::State::FAILED;
+    } else {
+      return false;
+    }
+    worker->clear();
+  } else if (parts.size() == 3 && parts[2] == "running") {
+    *state = JobManifest::State::RUNNING;
+    *worker = parts[1];
+  } else {
+    return false;
+  }
+  *job = parts[0];
+  return true;
+}
+
+}  // namespace
+
+JobManifest::JobManifest(const std::string& path) : path_(path) {
+  // Several processes may create the folder at once, which is no error.
+  boost::system::error_code error_code;
+  boost::filesystem::create_directories(path_, error_code);
+  CHECK(ExistsDir(path_)) << "Could not create " << path_;
+}
+
+bool JobManifest::Add(const std::string& job) {
+  CHECK(IsValidName(job)) << "Invalid job name " << job;
+  if (!CreateFileExclusive(JoinPaths(path_, job + "." + kAddedSuffix))) {
+    return false;
+  }
+  CreateFile(JobPath(job, State::PENDING));
+  return true;
+}
+
+bool JobManifest::Claim(const std::string& worker, std::string* job) {
+  CHECK(IsValidName(worker)) << "Invalid worker name " << worker;
+  // Another worker may claim a job between listing and renaming it, in which
+  // case the rename fails and the next pending job is tried.
+  for (const auto& pending_job : Jobs(State::PENDING)) {
+    if (std::rename(JobPath(pending_job, State::PENDING).c_str(),
+                    JobPath(pending_job, State::RUNNING, worker).c_str()) ==
+        0) {
+      *job = pending_job;
+      return true;
+    }
+  }
+  return false;
+}
+
+void JobManifest::Finish(const std::string& worker, const std::string& job,
+                         const bool success) {
+  const std::string running_path = JobPath(job, State::RUNNING, worker);
+  CHECK(ExistsFile(running_path))
+      << "Job " << job << " is not run by " << worker;
+  CHECK_EQ(std::rename(running_path.c_str(),
+                       JobPath(job, success ? State::DONE : State::FAILED)
+                           .c_str()),
+           0);
+}
+
+size_t JobManifest::Requeue(const std::string& worker) {
+  size_t num_jobs = 0;
+  for (const auto& path : GetFileList(path_)) {
+    std::string job;
+    State state;
+    std::string job_worker;
+    if (ParseJobFileName(GetPathBaseName(path), &job, &state, &job_worker) &&
+        state == State::RUNNING && job_worker == worker &&
+        std::rename(path.c_str(), JobPath(job, State::PENDING).c_str()) == 0) {
+      num_jobs += 1;
+    }
+  }
+  return num_jobs;
+}
+
+JobManifest::State JobManifest::GetState(const std::string& job) const {
+  for (const auto& path : GetFileList(path_)) {
+    std::string file_job;
+    State state;
+    std::string worker;
+    if (ParseJobFileName(GetPathBaseName(path), &file_job, &state, &worker) &&
+        file_job == job) {
+      return state;
+    }
+  }
+  return State::MISSING;
+}
+
+std::vector<std::string> JobManifest::Jobs(const State state) const {
+  std::vector<std::string> jobs;
+  for (const auto& path : GetFileList(path_)) {
+    std::string job;
+    State file_state;
+    std::string worker;
+    if (ParseJobFileName(GetPathBaseName(path), &job, &file_state, &worker) &&
+        file_state == state) {
+      jobs.push_back(job);
+    }
+  }
+  return jobs;
+}
+
+bool JobManifest::IsComplete() const {
+  for (const auto& path : GetFileList(path_)) {
+    std::string job;
+    State state;
+    std::string worker;
+    if (ParseJobFileName(GetPathBaseName(path), &job, &state, &worker) &&
+        (state == State::PENDING || state == State::RUNNING)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool JobManifest::Wait(const double poll_seconds,
+                       const double timeout_seconds) const {
+  Timer timer;
+  timer.Start();
+  while (!IsComplete()) {
+    if (timeout_seconds >= 0 && timer.ElapsedSeconds() >= timeout_seconds) {
+      return false;
+    }
+    std::this_thread::sleep_for(
+        std::chrono::duration<double>(std::max(0.0, poll_seconds)));
+  }
+  return true;
+}
+
+std::string JobManifest::UniqueWorkerName() {
+  std::random_device random_device;
+  const uint64_t time = static_cast<uint64_t>(
+      std::chrono::system_clock::now().time_since_epoch().count());
+  const uint64_t random =
+      (static_cast<uint64_t>(random_device()) << 32) | random_device();
+  return StringPrintf("worker%016llx",
+                      static_cast<unsigned long long>(time ^ random));
+}
+
+std::string JobManifest::JobPath(const std::string& job, const State state,
+                                 const std::string& worker) const {
+  switch (state) {
+    case State::PENDING:
+      return JoinPaths(path_, job + ".pending");
+    case State::RUNNING:
+      return JoinPaths(path_, job + "." + worker + ".running");
+    case State::DONE:
+      return JoinPaths(path_, job + ".done");
+    case State::FAILED:
+      return JoinPaths(path_, job + ".failed");
+    default:
+      LOG(FATAL) << "Job files have no missing state";
+      return "";
+  }
+}
+
+}  // namespace colmap
@@ -0,0 +1,96 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_JOB_MANIFEST_H_
+#define COLMAP_SRC_UTIL_JOB_MANIFEST_H_
+
+#include <string>
+#include <vector>
+
+namespace colmap {
+
+// Manifest of independent jobs in a folder on a filesystem that is shared by
+// multiple processes, e.g. by the nodes of a cluster. Every job is an empty
+// file, whose name is the name of the job followed by its state:
+//
+//    <job>.pending
+//    <job>.<worker>.running
+//    <job>.done
+//    <job>.failed
+//
+// Every job also has a `<job>.added` file, which is created once when the job
+// is added. A job is claimed by renaming its pending file, which succeeds for
+// only one of the workers that try at once, so that every job runs exactly
+// once. Job and worker names must not be empty or contain dots or path
+// separators.
+class JobManifest {
+ public:
+  enum class State {
+    MISSING,
+    PENDING,
+    RUNNING,
+    DONE,
+    FAILED,
+  };
+
+  // The folder is created if it does not exist.
+  explicit JobManifest(const std::string& path);
+
+  // Add a pending job, unless the job is already in the manifest in any
+  // state. Returns whether the job was added. Any number of processes can add
+  // the same jobs concurrently.
+  bool Add(const std::string& job);
+
+  // Claim one of the pending jobs for the worker. Returns false if there are
+  // no pending jobs left.
+  bool Claim(const std::string& worker, std::string* job);
+
+  // Mark a job that was claimed by the worker as done or failed.
+  void Finish(const std::string& worker, const std::string& job,
+              const bool success);
+
+  // Return the running jobs of the worker to the pending jobs, e.g. when a
+  // worker restarts after it was interrupted. Returns the number of jobs.
+  size_t Requeue(const std::string& worker);
+
+  State GetState(const std::string& job) const;
+
+  // The jobs in the given state, in no particular order.
+  std::vector<std::string> Jobs(const State state) const;
+
+  // Whether none of the jobs is pending or running.
+  bool IsComplete() const;
+
+  // Block until the manifest is complete, polling the folder at the given
+  // interval. Returns false if the manifest did not complete within the
+  // timeout, where a negative timeout waits forever.
+  bool Wait(const double poll_seconds = 1.0,
+            const double timeout_seconds = -1.0) const;
+
+  // A worker name that is unique with high probability across processes and
+  // nodes.
+  static std::string UniqueWorkerName();
+
+ private:
+  std::string JobPath(const std::string& job, const State state,
+                      const std::string& worker = "") const;
+
+  const std::string path_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_JOB_MANIFEST_H_
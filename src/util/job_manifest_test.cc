@@ -0,0 +1,122 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/job_manifest"
+#include "util/testing.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include <boost/filesystem.hpp>
+
+#include "util/job_manifest.h"
+#include "util/threading.h"
+
+using namespace colmap;
+
+namespace {
+
+std::string TempManifestPath() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("job_manifest_test_%%%%%%%%"))
+      .string();
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestLifecycle) {
+  const std::string path = TempManifestPath();
+  JobManifest manifest(path);
+  BOOST_CHECK(manifest.IsComplete());
+  BOOST_CHECK(manifest.GetState("1") == JobManifest::State::MISSING);
+
+  BOOST_CHECK(manifest.Add("1"));
+  BOOST_CHECK(manifest.Add("2"));
+  BOOST_CHECK(!manifest.Add("1"));
+  BOOST_CHECK(!manifest.IsComplete());
+  BOOST_CHECK_EQUAL(manifest.Jobs(JobManifest::State::PENDING).size(), 2);
+
+  std::string job1;
+  BOOST_CHECK(manifest.Claim("a", &job1));
+  BOOST_CHECK(manifest.GetState(job1) == JobManifest::State::RUNNING);
+  std::string job2;
+  BOOST_CHECK(manifest.Claim("b", &job2));
+  BOOST_CHECK_NE(job1, job2);
+  std::string job3;
+  BOOST_CHECK(!manifest.Claim("a", &job3));
+
+  // A restarted worker returns its jobs to the pending ones.
+  BOOST_CHECK_EQUAL(manifest.Requeue("b"), 1);
+  BOOST_CHECK(manifest.GetState(job2) == JobManifest::State::PENDING);
+  BOOST_CHECK(manifest.Claim("b", &job3));
+  BOOST_CHECK_EQUAL(job2, job3);
+
+  manifest.Finish("a", job1, true);
+  BOOST_CHECK(!manifest.IsComplete());
+  BOOST_CHECK(!manifest.Wait(0.0, 0.0));
+  manifest.Finish("b", job2, false);
+  BOOST_CHECK(manifest.IsComplete());
+  BOOST_CHECK(manifest.Wait(0.0, 0.0));
+  BOOST_CHECK(manifest.GetState(job1) == JobManifest::State::DONE);
+  BOOST_CHECK(manifest.GetState(job2) == JobManifest::State::FAILED);
+
+  // Finished jobs are not added again.
+  BOOST_CHECK(!manifest.Add(job1));
+  BOOST_CHECK(manifest.IsComplete());
+
+  boost::filesystem::remove_all(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestConcurrentClaims) {
+  const std::string path = TempManifestPath();
+  const int kNumJobs = 50;
+  const int kNumWorkers = 4;
+
+  // All workers add all jobs and run the ones they claim, so that every job
+  // must run exactly once.
+  std::mutex mutex;
+  std::vector<std::string> claimed_jobs;
+  ThreadPool thread_pool(kNumWorkers);
+  for (int i = 0; i < kNumWorkers; ++i) {
+    thread_pool.AddTask([&, i]() {
+      JobManifest manifest(path);
+      for (int j = 0; j < kNumJobs; ++j) {
+        manifest.Add(std::to_string(j));
+      }
+      const std::string worker = "worker" + std::to_string(i);
+      std::string job;
+      while (manifest.Claim(worker, &job)) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          claimed_jobs.push_back(job);
+        }
+        manifest.Finish(worker, job, true);
+      }
+    });
+  }
+  thread_pool.Wait();
+
+  std::sort(claimed_jobs.begin(), claimed_jobs.end());
+  BOOST_CHECK_EQUAL(claimed_jobs.size(), kNumJobs);
+  BOOST_CHECK(std::unique(claimed_jobs.begin(), claimed_jobs.end()) ==
+              claimed_jobs.end());
+
+  JobManifest manifest(path);
+  BOOST_CHECK(manifest.IsComplete());
+  BOOST_CHECK_EQUAL(manifest.Jobs(JobManifest::State::DONE).size(), kNumJobs);
+
+  boost::filesystem::remove_all(path);
+}
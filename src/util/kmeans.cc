@@ -0,0 +1,192 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/kmeans.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <random>
+
+#include "util/logging.h"
+#include "util/threading.h"
+#include "util/trace.h"
+
+namespace colmap {
+namespace {
+
+// Number of points that are assigned in one block. The block of distances to
+// all centers stays in the cache and each block is one task for the threads.
+const int kAssignmentBlockSize = 256;
+
+template <typename T>
+using PointMatrix =
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+template <typename T>
+using Vector = Eigen::Matrix<T, Eigen::Dynamic, 1>;
+
+// Assign the points in the given block of rows to their nearest center. The
+// squared distances are expanded as |x|^2 - 2 x^T c + |c|^2, so that the main
+// cost is a matrix product, which Eigen vectorizes.
+template <typename T>
+void AssignBlock(const PointMatrix<T>& points, const Vector<T>& point_norms,
+                 const PointMatrix<T>& centers, const Vector<T>& center_norms,
+                 const int block_start, std::vector<int>* labels,
+                 Vector<T>* distances) {
+  const int block_size = std::min(kAssignmentBlockSize,
+                                  static_cast<int>(points.rows()) - block_start);
+  const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> dots =
+      points.middleRows(block_start, block_size) * centers.transpose();
+  for (int i = 0; i < block_size; ++i) {
+    const int point_idx = block_start + i;
+    int best_label = 0;
+    T best_distance = center_norms(0) - 2 * dots(i, 0);
+    for (int j = 1; j < centers.rows(); ++j) {
+      const T distance = center_norms(j) - 2 * dots(i, j);
+      if (distance < best_distance) {
+        best_distance = distance;
+        best_label = j;
+      }
+    }
+    (*labels)[point_idx] = best_label;
+    (*distances)(point_idx) =
+        std::max(T(0), best_distance + point_norms(point_idx));
+  }
+}
+
+template <typename T>
+std::vector<int> KMeansImpl(const KMeansOptions& options,
+                            const PointMatrix<T>& points) {
+  TRACE_SCOPE("KMeans");
+
+  CHECK(options.Check());
+  CHECK_LE(options.num_clusters, points.rows());
+
+  const int num_points = static_cast<int>(points.rows());
+  const int num_clusters = options.num_clusters;
+  if (num_points == 0) {
+    return std::vector<int>();
+  }
+
+  std::mt19937 generator(options.random_seed);
+
+  // k-means++ initialization, which samples every new center with the
+  // probability proportional to the squared distance to the nearest center.
+  PointMatrix<T> centers(num_clusters, points.cols());
+  std::uniform_int_distribution<int> point_distribution(0, num_points - 1);
+  centers.row(0) = points.row(point_distribution(generator));
+  Vector<T> distances =
+      (points.rowwise() - centers.row(0)).rowwise().squaredNorm();
+  for (int i = 1; i < num_clusters; ++i) {
+    const double sum = distances.template cast<double>().sum();
+    int next = point_distribution(generator);
+    if (sum > 0) {
+      std::uniform_real_distribution<double> distribution(0, sum);
+      double threshold = distribution(generator);
+      for (next = 0; next < num_points - 1; ++next) {
+        threshold -= distances(next);
+        if (threshold <= 0) {
+          break;
+        }
+      }
+    }
+    centers.row(i) = points.row(next);
+    distances = distances.cwiseMin(
+        (points.rowwise() - centers.row(i)).rowwise().squaredNorm());
+  }
+
+  const Vector<T> point_norms = points.rowwise().squaredNorm();
+
+  const int num_blocks =
+      (num_points + kAssignmentBlockSize - 1) / kAssignmentBlockSize;
+  const int num_threads =
+      std::min(GetEffectiveNumThreads(options.num_threads), num_blocks);
+  std::unique_ptr<ThreadPool> thread_pool;
+  if (num_threads > 1) {
+    thread_pool.reset(new ThreadPool(num_threads));
+  }
+
+  std::vector<int> labels(num_points, -1);
+  std::vector<int> prev_labels;
+  std::vector<int> cluster_sizes(num_clusters);
+  for (int iteration = 0; iteration < options.max_num_iterations;
+       ++iteration) {
+    const Vector<T> center_norms = centers.rowwise().squaredNorm();
+    prev_labels = labels;
+    if (thread_pool) {
+      for (int block = 0; block < num_blocks; ++block) {
+        thread_pool->AddTask(AssignBlock<T>, std::cref(points),
+                             std::cref(point_norms), std::cref(centers),
+                             std::cref(center_norms),
+                             block * kAssignmentBlockSize, &labels,
+                             &distances);
+      }
+      thread_pool->Wait();
+    } else {
+      for (int block = 0; block < num_blocks; ++block) {
+        AssignBlock<T>(points, point_norms, centers, center_norms,
+                       block * kAssignmentBlockSize, &labels, &distances);
+      }
+    }
+
+    if (labels == prev_labels) {
+      break;
+    }
+
+    // Move the centers to the means of their points.
+    centers.setZero();
+    std::fill(cluster_sizes.begin(), cluster_sizes.end(), 0);
+    for (int i = 0; i < num_points; ++i) {
+      centers.row(labels[i]) += points.row(i);
+      cluster_sizes[labels[i]] += 1;
+    }
+    for (int j = 0; j < num_clusters; ++j) {
+      if (cluster_sizes[j] > 0) {
+        centers.row(j) /= static_cast<T>(cluster_sizes[j]);
+        continue;
+      }
+      // Re-seed the empty cluster with the worst represented point, whose
+      // distance is cleared so that other empty clusters pick other points.
+      int farthest;
+      distances.maxCoeff(&farthest);
+      centers.row(j) = points.row(farthest);
+      distances(farthest) = 0;
+    }
+  }
+
+  return labels;
+}
+
+}  // namespace
+
+bool KMeansOptions::Check() const {
+  CHECK_OPTION_GT(num_clusters, 0);
+  CHECK_OPTION_GE(max_num_iterations, 1);
+  return true;
+}
+
+std::vector<int> KMeans(const KMeansOptions& options,
+                        const KMeansPointsd& points) {
+  return KMeansImpl(options, points);
+}
+
+std::vector<int> KMeans(const KMeansOptions& options,
+                        const KMeansPointsf& points) {
+  return KMeansImpl(options, points);
+}
+
+}  // namespace colmap
@@ -0,0 +1,60 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_KMEANS_H_
+#define COLMAP_SRC_UTIL_KMEANS_H_
+
+#include <vector>
+
+#include <Eigen/Core>
+
+namespace colmap {
+
+// Points to cluster, one point per row. The rows are contiguous, so that the
+// distance computations vectorize.
+typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    KMeansPointsd;
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    KMeansPointsf;
+
+struct KMeansOptions {
+  // The number of clusters, which must not exceed the number of points.
+  int num_clusters = 2;
+
+  // The maximum number of Lloyd iterations.
+  int max_num_iterations = 100;
+
+  // Seed of the random initialization, such that the clustering of the same
+  // points is reproducible.
+  unsigned int random_seed = 0;
+
+  // The number of threads for the assignment of the points to the centers.
+  int num_threads = -1;
+
+  bool Check() const;
+};
+
+// Cluster the points with Lloyd's algorithm after k-means++ initialization
+// and return the cluster index of every point. Empty clusters are re-seeded
+// with the point that is the farthest from its center.
+std::vector<int> KMeans(const KMeansOptions& options,
+                        const KMeansPointsd& points);
+std::vector<int> KMeans(const KMeansOptions& options,
+                        const KMeansPointsf& points);
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_KMEANS_H_
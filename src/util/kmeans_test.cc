@@ -0,0 +1,104 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/kmeans"
+#include "util/testing.h"
+
+#include "util/kmeans.h"
+
+using namespace colmap;
+
+namespace {
+
+// Points around the corners of a square with the given side length, where
+// point i belongs to corner i % 4.
+KMeansPointsd SquarePoints(const int num_points, const double side_length) {
+  KMeansPointsd points(num_points, 2);
+  for (int i = 0; i < num_points; ++i) {
+    const int corner = i % 4;
+    points(i, 0) = (corner % 2) * side_length + 0.1 * std::sin(i);
+    points(i, 1) = (corner / 2) * side_length + 0.1 * std::cos(i);
+  }
+  return points;
+}
+
+// Check that the points of every corner share one label and that the
+// corners have different labels.
+void CheckSquareLabels(const std::vector<int>& labels) {
+  for (size_t i = 4; i < labels.size(); ++i) {
+    BOOST_CHECK_EQUAL(labels[i], labels[i % 4]);
+  }
+  for (int i = 0; i < 4; ++i) {
+    for (int j = i + 1; j < 4; ++j) {
+      BOOST_CHECK_NE(labels[i], labels[j]);
+    }
+  }
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestOptions) {
+  KMeansOptions options;
+  BOOST_CHECK(options.Check());
+  options.num_clusters = 0;
+  BOOST_CHECK(!options.Check());
+}
+
+BOOST_AUTO_TEST_CASE(TestEmpty) {
+  KMeansOptions options;
+  options.num_clusters = 1;
+  BOOST_CHECK(KMeans(options, KMeansPointsd(0, 3)).empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestSeparatedClusters) {
+  KMeansOptions options;
+  options.num_clusters = 4;
+  const KMeansPointsd points = SquarePoints(40, 10);
+  CheckSquareLabels(KMeans(options, points));
+  CheckSquareLabels(KMeans(options, KMeansPointsf(points.cast<float>())));
+
+  options.num_clusters = 1;
+  const std::vector<int> labels = KMeans(options, points);
+  BOOST_CHECK(labels == std::vector<int>(points.rows(), 0));
+}
+
+BOOST_AUTO_TEST_CASE(TestReproducible) {
+  KMeansOptions options;
+  options.num_clusters = 7;
+  options.num_threads = 1;
+  const KMeansPointsd points = SquarePoints(2000, 1);
+  const std::vector<int> labels = KMeans(options, points);
+  BOOST_CHECK(KMeans(options, points) == labels);
+  options.num_threads = 4;
+  BOOST_CHECK(KMeans(options, points) == labels);
+}
+
+BOOST_AUTO_TEST_CASE(TestAsManyClustersAsPoints) {
+  KMeansOptions options;
+  options.num_clusters = 3;
+  KMeansPointsd points(3, 1);
+  points << 0, 1, 5;
+  std::vector<int> labels = KMeans(options, points);
+  BOOST_CHECK_NE(labels[0], labels[1]);
+  BOOST_CHECK_NE(labels[0], labels[2]);
+  BOOST_CHECK_NE(labels[1], labels[2]);
+
+  // Identical points leave clusters empty, which must not break the
+  // iterations.
+  points.setZero();
+  labels = KMeans(options, points);
+  BOOST_CHECK_EQUAL(labels.size(), 3);
+}
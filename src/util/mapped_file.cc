@@ -0,0 +1,129 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/mapped_file.h"
+
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace colmap {
+
+MappedFile::MappedFile() : data_(nullptr), size_(0), mapped_(false) {}
+
+MappedFile::MappedFile(const std::string& path) : MappedFile() { Open(path); }
+
+MappedFile::~MappedFile() { Close(); }
+
+bool MappedFile::Open(const std::string& path, const bool sequential) {
+  Close();
+
+#ifndef _WIN32
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return false;
+  }
+
+  size_ = static_cast<size_t>(file_stat.st_size);
+  if (size_ == 0) {
+    // Zero-length mappings are not allowed, use the empty buffer instead.
+    close(fd);
+    buffer_.resize(1);
+    data_ = buffer_.data();
+    return true;
+  }
+
+  void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    size_ = 0;
+    return false;
+  }
+
+  madvise(addr, size_, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+
+  data_ = static_cast<const char*>(addr);
+  mapped_ = true;
+  return true;
+#else
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file.is_open()) {
+    return false;
+  }
+  size_ = static_cast<size_t>(file.tellg());
+  file.seekg(0, std::ios::beg);
+  buffer_.resize(size_ + 1);
+  file.read(buffer_.data(), size_);
+  data_ = buffer_.data();
+  return true;
+#endif
+}
+
+void MappedFile::Close() {
+#ifndef _WIN32
+  if (mapped_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+#endif
+  data_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+  buffer_.clear();
+  buffer_.shrink_to_fit();
+}
+
+MappedFileReader::MappedFileReader(const char* data, const size_t size)
+    : data_(data), size_(size), pos_(0), good_(data != nullptr) {}
+
+MappedFileReader::MappedFileReader(const MappedFile& file)
+    : MappedFileReader(file.Data(), file.Size()) {}
+
+std::string MappedFileReader::ReadString() {
+  if (!good_) {
+    return "";
+  }
+  const void* end = std::memchr(data_ + pos_, '\0', Remaining());
+  if (end == nullptr) {
+    good_ = false;
+    return "";
+  }
+  const size_t length = static_cast<const char*>(end) - (data_ + pos_);
+  std::string str(data_ + pos_, length);
+  pos_ += length + 1;
+  return str;
+}
+
+size_t MappedFileReader::ReadCount(const size_t min_elem_size) {
+  const uint64_t count = Read<uint64_t>();
+  if (!good_ || (min_elem_size > 0 && count > Remaining() / min_elem_size)) {
+    good_ = false;
+    return 0;
+  }
+  return static_cast<size_t>(count);
+}
+
+}  // namespace colmap
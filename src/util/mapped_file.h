@@ -0,0 +1,139 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_MAPPED_FILE_H_
+#define COLMAP_SRC_UTIL_MAPPED_FILE_H_
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "util/endian.h"
+#include "util/logging.h"
+
+namespace colmap {
+
+// Read-only view of a whole file in memory. On POSIX systems the file is
+// memory-mapped, otherwise it is read into an internal buffer.
+class MappedFile {
+ public:
+  MappedFile();
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Map the file at the given path. Returns false if it cannot be opened. The
+  // access pattern is a hint to the OS, which reads ahead for sequential
+  // access and only reads the touched pages otherwise.
+  bool Open(const std::string& path, const bool sequential = true);
+  void Close();
+
+  inline bool IsOpen() const;
+  inline const char* Data() const;
+  inline size_t Size() const;
+
+ private:
+  const char* data_;
+  size_t size_;
+  bool mapped_;
+  std::vector<char> buffer_;
+};
+
+// Sequential little-endian reader over a memory region, e.g. a `MappedFile`.
+// Reads past the end of the region are reported through `Good()`, so that
+// truncated files can be rejected without throwing.
+class MappedFileReader {
+ public:
+  MappedFileReader(const char* data, const size_t size);
+  explicit MappedFileReader(const MappedFile& file);
+
+  template <typename T>
+  T Read();
+
+  template <typename T>
+  void Read(std::vector<T>* data, const size_t num_elems);
+
+  // Read a null-terminated string.
+  std::string ReadString();
+
+  // Read a 64-bit element count and reject it, if the remaining data cannot
+  // hold that many elements of at least `min_elem_size` bytes. This guards
+  // against huge allocations when reading corrupt files.
+  size_t ReadCount(const size_t min_elem_size);
+
+  inline bool Good() const;
+  inline size_t Position() const;
+  inline size_t Remaining() const;
+
+ private:
+  const char* data_;
+  size_t size_;
+  size_t pos_;
+  bool good_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+bool MappedFile::IsOpen() const { return data_ != nullptr; }
+
+const char* MappedFile::Data() const { return data_; }
+
+size_t MappedFile::Size() const { return size_; }
+
+template <typename T>
+T MappedFileReader::Read() {
+  T data = T();
+  if (!good_ || Remaining() < sizeof(T)) {
+    good_ = false;
+    return data;
+  }
+  std::memcpy(&data, data_ + pos_, sizeof(T));
+  pos_ += sizeof(T);
+  return LittleEndianToNative(data);
+}
+
+template <typename T>
+void MappedFileReader::Read(std::vector<T>* data, const size_t num_elems) {
+  if (!good_ || Remaining() / sizeof(T) < num_elems) {
+    good_ = false;
+    data->clear();
+    return;
+  }
+  data->resize(num_elems);
+  if (num_elems > 0) {
+    std::memcpy(data->data(), data_ + pos_, num_elems * sizeof(T));
+  }
+  pos_ += num_elems * sizeof(T);
+  if (!IsLittleEndian()) {
+    for (auto& elem : *data) {
+      elem = LittleEndianToNative(elem);
+    }
+  }
+}
+
+bool MappedFileReader::Good() const { return good_; }
+
+size_t MappedFileReader::Position() const { return pos_; }
+
+size_t MappedFileReader::Remaining() const { return size_ - pos_; }
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_MAPPED_FILE_H_
@@ -0,0 +1,87 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/mapped_file"
+#include "util/testing.h"
+
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+#include "util/mapped_file.h"
+
+using namespace colmap;
+
+BOOST_AUTO_TEST_CASE(TestOpenMissing) {
+  MappedFile file;
+  BOOST_CHECK(!file.Open("/nonexistent/mapped_file_test.bin"));
+  BOOST_CHECK(!file.IsOpen());
+  BOOST_CHECK_EQUAL(file.Size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadWrite) {
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("mapped_file_test_%%%%%%%%.bin"))
+          .string();
+
+  {
+    std::ofstream stream(path, std::ios::trunc | std::ios::binary);
+    WriteBinaryLittleEndian<uint32_t>(&stream, 42);
+    WriteBinaryLittleEndian<double>(&stream, 1.5);
+    WriteBinaryLittleEndian<uint64_t>(&stream, 3);
+    WriteBinaryLittleEndian<int32_t>(&stream, {-1, 0, 1});
+    const std::string str = std::string("abc") + '\0';
+    stream.write(str.c_str(), str.size());
+  }
+
+  MappedFile file(path);
+  BOOST_CHECK(file.IsOpen());
+  BOOST_CHECK_EQUAL(file.Size(), 4 + 8 + 8 + 12 + 4);
+
+  MappedFileReader reader(file);
+  BOOST_CHECK_EQUAL(reader.Read<uint32_t>(), 42);
+  BOOST_CHECK_EQUAL(reader.Read<double>(), 1.5);
+  const size_t count = reader.ReadCount(sizeof(int32_t));
+  BOOST_CHECK_EQUAL(count, 3);
+  std::vector<int32_t> values;
+  reader.Read(&values, count);
+  BOOST_CHECK_EQUAL(values.size(), 3);
+  BOOST_CHECK_EQUAL(values[0], -1);
+  BOOST_CHECK_EQUAL(values[1], 0);
+  BOOST_CHECK_EQUAL(values[2], 1);
+  BOOST_CHECK_EQUAL(reader.ReadString(), "abc");
+  BOOST_CHECK(reader.Good());
+  BOOST_CHECK_EQUAL(reader.Remaining(), 0);
+
+  // Reading past the end invalidates the reader.
+  BOOST_CHECK_EQUAL(reader.Read<uint32_t>(), 0);
+  BOOST_CHECK(!reader.Good());
+
+  file.Close();
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadCountOverflow) {
+  std::vector<char> data(sizeof(uint64_t));
+  const uint64_t count = 1000;
+  std::memcpy(data.data(), &count, sizeof(count));
+  MappedFileReader reader(data.data(), data.size());
+  if (IsLittleEndian()) {
+    BOOST_CHECK_EQUAL(reader.ReadCount(1), 0);
+    BOOST_CHECK(!reader.Good());
+  }
+}
@@ -61,6 +61,11 @@ inline double RadToDeg(const double rad);
 template <typename T>
 double Median(const std::vector<T>& elems);
 
+// Select the element, which would be at position `n` if the vector was sorted,
+// in expected linear time. The elements are partially reordered in place.
+template <typename T>
+T NthElement(std::vector<T>* elems, const size_t n);
+
 // Determine mean value in a vector.
 template <typename T>
 double Mean(const std::vector<T>& elems);
@@ -213,6 +218,13 @@ double Median(const std::vector<T>& elems) {
   }
 }
 
+template <typename T>
+T NthElement(std::vector<T>* elems, const size_t n) {
+  CHECK_LT(n, elems->size());
+  std::nth_element(elems->begin(), elems->begin() + n, elems->end());
+  return (*elems)[n];
+}
+
 template <typename T>
 T Percentile(const std::vector<T>& elems, const double p) {
   CHECK(!elems.empty());
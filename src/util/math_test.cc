@@ -79,6 +79,17 @@ BOOST_AUTO_TEST_CASE(TestMedian) {
   BOOST_CHECK_EQUAL(Median<int>({-1, -2, 3, 4}), 1);
 }
 
+BOOST_AUTO_TEST_CASE(TestNthElement) {
+  std::vector<int> elems = {5, -1, 3, 3, 8, 0};
+  BOOST_CHECK_EQUAL(NthElement(&elems, 0), -1);
+  BOOST_CHECK_EQUAL(NthElement(&elems, 2), 3);
+  BOOST_CHECK_EQUAL(NthElement(&elems, 3), 3);
+  BOOST_CHECK_EQUAL(NthElement(&elems, 5), 8);
+  BOOST_CHECK_EQUAL(elems.size(), 6);
+  std::vector<double> single = {1.5};
+  BOOST_CHECK_EQUAL(NthElement(&single, 0), 1.5);
+}
+
 BOOST_AUTO_TEST_CASE(TestPercentile) {
   BOOST_CHECK_EQUAL(Percentile<int>({0}, 0), 0);
   BOOST_CHECK_EQUAL(Percentile<int>({0}, 50), 0);
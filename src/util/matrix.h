@@ -17,6 +17,8 @@
 #ifndef COLMAP_SRC_UTIL_MATRIX_H_
 #define COLMAP_SRC_UTIL_MATRIX_H_
 
+#include <vector>
+
 #include <Eigen/Core>
 #include <Eigen/Dense>
 #include <Eigen/QR>
@@ -37,6 +39,17 @@ inline bool IsInf(const Eigen::MatrixBase<Derived>& x);
 template <typename MatrixType>
 void DecomposeMatrixRQ(const MatrixType& A, MatrixType* R, MatrixType* Q);
 
+// Geometric median of the points, which minimizes the sum of the Euclidean
+// distances to the points, by the Weiszfeld iteration. The iteration starts at
+// `initial`, e.g. the coordinate-wise median, and stops after
+// `max_num_iterations` or when a step is shorter than `tolerance`. Points at
+// the current estimate are left out of its update.
+template <typename VectorType>
+VectorType GeometricMedian(const std::vector<VectorType>& points,
+                           const VectorType& initial,
+                           const int max_num_iterations = 100,
+                           const double tolerance = 1e-10);
+
 ////////////////////////////////////////////////////////////////////////////////
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
@@ -77,6 +90,35 @@ void DecomposeMatrixRQ(const MatrixType& A, MatrixType* R, MatrixType* Q) {
   }
 }
 
+template <typename VectorType>
+VectorType GeometricMedian(const std::vector<VectorType>& points,
+                           const VectorType& initial,
+                           const int max_num_iterations,
+                           const double tolerance) {
+  VectorType median = initial;
+  for (int iteration = 0; iteration < max_num_iterations; ++iteration) {
+    VectorType weighted_sum = VectorType::Zero(initial.size());
+    double sum_weights = 0;
+    for (const auto& point : points) {
+      const double dist = (point - median).norm();
+      if (dist > tolerance) {
+        weighted_sum += point / dist;
+        sum_weights += 1 / dist;
+      }
+    }
+    if (sum_weights == 0) {
+      break;
+    }
+    const VectorType next_median = weighted_sum / sum_weights;
+    const double step = (next_median - median).norm();
+    median = next_median;
+    if (step < tolerance) {
+      break;
+    }
+  }
+  return median;
+}
+
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_UTIL_MATRIX_H_
@@ -52,3 +52,33 @@ BOOST_AUTO_TEST_CASE(TestDecomposeMatrixRQ) {
     BOOST_CHECK(A.isApprox(R * Q, 1e-6));
   }
 }
+
+BOOST_AUTO_TEST_CASE(TestGeometricMedian) {
+  // The geometric median of the corners of a square is its center.
+  std::vector<Eigen::Vector2d> points = {
+      Eigen::Vector2d(0, 0), Eigen::Vector2d(2, 0), Eigen::Vector2d(0, 2),
+      Eigen::Vector2d(2, 2)};
+  BOOST_CHECK_LT((GeometricMedian(points, Eigen::Vector2d(0.3, 1.7)) -
+                  Eigen::Vector2d(1, 1))
+                     .norm(),
+                 1e-6);
+
+  // The outlier only pulls the median slightly off the cluster.
+  std::vector<Eigen::Vector3d> cluster;
+  for (int i = 0; i < 10; ++i) {
+    cluster.emplace_back(1 + 0.01 * (i % 3), 2 - 0.01 * (i % 2), 3);
+  }
+  cluster.emplace_back(100, -100, 50);
+  const Eigen::Vector3d median =
+      GeometricMedian(cluster, Eigen::Vector3d(1, 2, 3));
+  BOOST_CHECK_LT((median - Eigen::Vector3d(1, 2, 3)).norm(), 0.05);
+
+  // Starting at one of collinear points, the median is the middle point.
+  std::vector<Eigen::Vector3d> line = {Eigen::Vector3d(0, 0, 0),
+                                       Eigen::Vector3d(1, 0, 0),
+                                       Eigen::Vector3d(5, 0, 0)};
+  BOOST_CHECK_LT((GeometricMedian(line, Eigen::Vector3d(0, 0, 0)) -
+                  Eigen::Vector3d(1, 0, 0))
+                     .norm(),
+                 1e-6);
+}
@@ -0,0 +1,289 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "util/memory_governor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "util/logging.h"
+#include "util/string.h"
+
+namespace colmap {
+namespace {
+
+const size_t kUnboundedNumBytes = std::numeric_limits<size_t>::max();
+
+std::atomic<size_t> memory_budget(0);
+std::atomic<int64_t> next_memory_check_ms(0);
+
+struct MemoryGovernor {
+  std::mutex mutex;
+  // The consumers in the order of their priority and registration.
+  std::vector<MemoryConsumer*> consumers;
+  // Whether the limits of any consumer are lowered.
+  bool constrained = false;
+  // Whether the consumers could not be shrunk enough since they were
+  // constrained, which is only reported once.
+  bool exhausted = false;
+};
+
+MemoryGovernor& GetMemoryGovernor() {
+  static MemoryGovernor governor;
+  return governor;
+}
+
+int64_t SteadyClockMilliseconds() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+double BytesToGB(const size_t num_bytes) {
+  return num_bytes / (1024.0 * 1024.0 * 1024.0);
+}
+
+}  // namespace
+
+void SetMemoryBudget(const size_t max_num_bytes) {
+  memory_budget.store(max_num_bytes, std::memory_order_relaxed);
+  next_memory_check_ms.store(0, std::memory_order_relaxed);
+  if (max_num_bytes == 0) {
+    UpdateMemoryConsumerLimits(0);
+  }
+}
+
+size_t GetMemoryBudget() {
+  return memory_budget.load(std::memory_order_relaxed);
+}
+
+size_t GetResidentSetSize() {
+#if defined(__linux__)
+  // The second field of /proc/self/statm is the number of resident pages.
+  char buffer[256];
+  const int fd = open("/proc/self/statm", O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  const ssize_t num_bytes = read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
+  if (num_bytes <= 0) {
+    return 0;
+  }
+  buffer[num_bytes] = '\0';
+  char* end = nullptr;
+  std::strtoull(buffer, &end, 10);
+  const unsigned long long num_pages = std::strtoull(end, nullptr, 10);
+  return static_cast<size_t>(num_pages) *
+         static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#elif defined(__APPLE__)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                reinterpret_cast<task_info_t>(&info),
+                &count) != KERN_SUCCESS) {
+    return 0;
+  }
+  return static_cast<size_t>(info.resident_size);
+#else
+  return 0;
+#endif
+}
+
+void CheckMemoryBudget() {
+  if (GetMemoryBudget() == 0) {
+    return;
+  }
+
+#if defined(__GLIBC__)
+  // The allocator keeps the memory freed by the consumers, which would then
+  // still count as resident and make the consumers shrink further.
+  bool constrained;
+  {
+    MemoryGovernor& governor = GetMemoryGovernor();
+    std::unique_lock<std::mutex> lock(governor.mutex);
+    constrained = governor.constrained;
+  }
+  if (constrained) {
+    malloc_trim(0);
+  }
+#endif
+
+  UpdateMemoryConsumerLimits(GetResidentSetSize());
+}
+
+void UpdateMemoryConsumerLimits(const size_t resident_num_bytes) {
+  MemoryGovernor& governor = GetMemoryGovernor();
+  std::unique_lock<std::mutex> lock(governor.mutex);
+
+  const size_t budget = GetMemoryBudget();
+
+  // Release all limits once the process is far enough below the budget that
+  // the caches can grow again without immediately exceeding it.
+  if (budget == 0 || resident_num_bytes <= budget / 2) {
+    for (auto consumer : governor.consumers) {
+      consumer->max_num_bytes_.store(kUnboundedNumBytes);
+    }
+    governor.constrained = false;
+    governor.exhausted = false;
+    return;
+  }
+
+  if (resident_num_bytes > budget) {
+    if (!governor.constrained) {
+      LOG(WARNING) << StringPrintf(
+          "Resident memory of %.2f GB exceeds the memory budget of %.2f GB, "
+          "shrinking the caches",
+          BytesToGB(resident_num_bytes), BytesToGB(budget));
+    }
+
+    size_t excess = resident_num_bytes - budget;
+    for (auto consumer : governor.consumers) {
+      if (excess == 0) {
+        break;
+      }
+      const size_t limit =
+          std::min(consumer->max_num_bytes_.load(), consumer->NumBytes());
+      if (limit <= consumer->min_num_bytes_) {
+        continue;
+      }
+      const size_t num_shrink_bytes =
+          std::min(excess, limit - consumer->min_num_bytes_);
+      consumer->max_num_bytes_.store(limit - num_shrink_bytes);
+      excess -= num_shrink_bytes;
+      governor.constrained = true;
+    }
+
+    if (excess > 0 && !governor.exhausted) {
+      LOG(WARNING) << StringPrintf(
+          "Resident memory exceeds the memory budget by %.2f GB, which the "
+          "caches cannot make up for",
+          BytesToGB(excess));
+      governor.exhausted = true;
+    }
+  } else if (governor.constrained &&
+             resident_num_bytes <= budget - budget / 10) {
+    // Let every consumer grow by the free memory below 90% of the budget. The
+    // consumers may together exceed the budget by this, but the growth is
+    // limited to one check interval before they are shrunk again.
+    const size_t num_free_bytes = budget - budget / 10 - resident_num_bytes;
+    for (auto consumer : governor.consumers) {
+      const size_t limit = consumer->max_num_bytes_.load();
+      if (limit == kUnboundedNumBytes) {
+        continue;
+      }
+      const size_t num_bytes = consumer->NumBytes();
+      if (num_bytes + num_free_bytes > limit) {
+        consumer->max_num_bytes_.store(num_bytes + num_free_bytes);
+      }
+    }
+  }
+}
+
+std::vector<MemoryConsumerUsage> GetMemoryConsumerUsages() {
+  MemoryGovernor& governor = GetMemoryGovernor();
+  std::unique_lock<std::mutex> lock(governor.mutex);
+  std::vector<MemoryConsumerUsage> usages;
+  usages.reserve(governor.consumers.size());
+  for (const auto consumer : governor.consumers) {
+    usages.emplace_back();
+    usages.back().name = consumer->Name();
+    usages.back().num_bytes = consumer->NumBytes();
+    usages.back().max_num_bytes = consumer->MaxNumBytes();
+  }
+  return usages;
+}
+
+MemoryConsumer::MemoryConsumer(const std::string& name, const int priority,
+                               const size_t min_num_bytes)
+    : name_(name),
+      priority_(priority),
+      min_num_bytes_(min_num_bytes),
+      num_bytes_(0),
+      max_num_bytes_(kUnboundedNumBytes) {
+  MemoryGovernor& governor = GetMemoryGovernor();
+  std::unique_lock<std::mutex> lock(governor.mutex);
+  const auto it = std::upper_bound(
+      governor.consumers.begin(), governor.consumers.end(), priority,
+      [](const int priority, const MemoryConsumer* consumer) {
+        return priority < consumer->priority_;
+      });
+  governor.consumers.insert(it, this);
+}
+
+MemoryConsumer::~MemoryConsumer() {
+  MemoryGovernor& governor = GetMemoryGovernor();
+  std::unique_lock<std::mutex> lock(governor.mutex);
+  governor.consumers.erase(std::find(governor.consumers.begin(),
+                                     governor.consumers.end(), this));
+}
+
+const std::string& MemoryConsumer::Name() const { return name_; }
+
+int MemoryConsumer::Priority() const { return priority_; }
+
+size_t MemoryConsumer::MinNumBytes() const { return min_num_bytes_; }
+
+size_t MemoryConsumer::NumBytes() const {
+  return num_bytes_.load(std::memory_order_relaxed);
+}
+
+void MemoryConsumer::AddNumBytes(const size_t num_bytes) {
+  num_bytes_.fetch_add(num_bytes, std::memory_order_relaxed);
+}
+
+void MemoryConsumer::SubtractNumBytes(const size_t num_bytes) {
+  num_bytes_.fetch_sub(num_bytes, std::memory_order_relaxed);
+}
+
+size_t MemoryConsumer::MaxNumBytes() const {
+  return max_num_bytes_.load(std::memory_order_relaxed);
+}
+
+size_t MemoryConsumer::CheckMaxNumBytes() {
+  if (GetMemoryBudget() == 0) {
+    return MaxNumBytes();
+  }
+
+  const int64_t now_ms = SteadyClockMilliseconds();
+  int64_t next_check_ms = next_memory_check_ms.load(std::memory_order_relaxed);
+  // Only one of the threads that find the check due runs it.
+  if (now_ms >= next_check_ms &&
+      next_memory_check_ms.compare_exchange_strong(
+          next_check_ms, now_ms + kMemoryCheckIntervalMs)) {
+    CheckMemoryBudget();
+  }
+
+  return MaxNumBytes();
+}
+
+}  // namespace colmap
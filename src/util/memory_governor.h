@@ -0,0 +1,126 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef COLMAP_SRC_UTIL_MEMORY_GOVERNOR_H_
+#define COLMAP_SRC_UTIL_MEMORY_GOVERNOR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace colmap {
+
+// Process-wide memory budget, which coordinates the caches of the different
+// components. The caches register as memory consumers and report the bytes
+// they hold. While the resident set size of the process exceeds the budget,
+// the governor lowers the limits of the consumers in the order of their
+// priority, lowest priority first, by the excess, and the consumers evict
+// elements until they are within their limits. Once the process is clearly
+// below the budget again, the limits are raised gradually. The memory that is
+// not held by consumers, e.g. the reconstruction itself, cannot be shrunk but
+// counts against the budget, so that the caches make room for it.
+//
+// The governor is cooperative: the limits are only applied by the consumers
+// themselves, whenever they grow, so that no element is evicted while another
+// thread uses it. The resident set size is measured at most every
+// `kMemoryCheckIntervalMs` milliseconds when a consumer asks for its limit.
+//
+// Without a budget, which is the default, the limits are unbounded and asking
+// for them costs a single relaxed atomic load.
+//
+// Example usage:
+//
+//    SetMemoryBudget(16 * 1024 * 1024 * 1024ull);
+//    MemoryConsumer consumer("descriptors", kMatcherCacheMemoryPriority);
+//    cache.SetMemoryConsumer(&consumer);
+//
+const int kMemoryCheckIntervalMs = 100;
+
+// The priorities of the caches of COLMAP. Caches whose elements are cheaper to
+// recompute have lower priorities.
+const int kMatcherCacheMemoryPriority = 10;
+const int kMapperCacheMemoryPriority = 15;
+const int kWorkspaceCacheMemoryPriority = 20;
+
+// Set the budget of the resident set size in bytes, where 0 disables it.
+void SetMemoryBudget(const size_t max_num_bytes);
+size_t GetMemoryBudget();
+
+// The current resident set size of the process in bytes, which is only
+// available on Linux and macOS and 0 otherwise.
+size_t GetResidentSetSize();
+
+// Measure the resident set size and update the limits of the consumers, which
+// is done automatically by `MemoryConsumer::CheckMaxNumBytes`. If the limits
+// were lowered before, the memory freed by the consumers in the meantime is
+// returned to the operating system first, where the allocator supports it.
+void CheckMemoryBudget();
+
+// Update the limits of the consumers for the given resident set size.
+void UpdateMemoryConsumerLimits(const size_t resident_num_bytes);
+
+struct MemoryConsumerUsage {
+  std::string name;
+  size_t num_bytes = 0;
+  size_t max_num_bytes = 0;
+};
+
+// The usage of the registered consumers in the order of their priority.
+std::vector<MemoryConsumerUsage> GetMemoryConsumerUsages();
+
+class MemoryConsumer {
+ public:
+  // The limit of the consumer is never lowered below its minimum number of
+  // bytes, and consumers with the same priority are shrunk in the order of
+  // their registration.
+  MemoryConsumer(const std::string& name, const int priority,
+                 const size_t min_num_bytes = 0);
+  ~MemoryConsumer();
+
+  const std::string& Name() const;
+  int Priority() const;
+  size_t MinNumBytes() const;
+
+  // The bytes held by the consumer, which may be reported by multiple threads.
+  size_t NumBytes() const;
+  void AddNumBytes(const size_t num_bytes);
+  void SubtractNumBytes(const size_t num_bytes);
+
+  // The current limit of the consumer, which is unbounded unless the process
+  // exceeded its memory budget.
+  size_t MaxNumBytes() const;
+
+  // Check the memory budget, if it is due, and return the current limit.
+  size_t CheckMaxNumBytes();
+
+ private:
+  friend void UpdateMemoryConsumerLimits(const size_t resident_num_bytes);
+
+  MemoryConsumer(const MemoryConsumer&) = delete;
+  MemoryConsumer& operator=(const MemoryConsumer&) = delete;
+
+  const std::string name_;
+  const int priority_;
+  const size_t min_num_bytes_;
+  std::atomic<size_t> num_bytes_;
+  std::atomic<size_t> max_num_bytes_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_MEMORY_GOVERNOR_H_
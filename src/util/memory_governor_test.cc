@@ -0,0 +1,142 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#define TEST_NAME "util/memory_governor"
+#include "util/testing.h"
+
+#include <limits>
+#include <vector>
+
+#include "util/memory_governor.h"
+
+using namespace colmap;
+
+namespace {
+
+const size_t kUnbounded = std::numeric_limits<size_t>::max();
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestResidentSetSize) {
+#if defined(__linux__) || defined(__APPLE__)
+  const size_t resident_num_bytes = GetResidentSetSize();
+  BOOST_CHECK_GT(resident_num_bytes, 0);
+  // Touch enough memory that it must show up as resident.
+  std::vector<char> memory(64 * 1024 * 1024, 1);
+  BOOST_CHECK_GT(GetResidentSetSize(), resident_num_bytes + memory.size() / 2);
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(TestNoBudget) {
+  BOOST_CHECK_EQUAL(GetMemoryBudget(), 0);
+  MemoryConsumer consumer("test", 0);
+  BOOST_CHECK_EQUAL(consumer.Name(), "test");
+  BOOST_CHECK_EQUAL(consumer.Priority(), 0);
+  BOOST_CHECK_EQUAL(consumer.MinNumBytes(), 0);
+  consumer.AddNumBytes(100);
+  consumer.AddNumBytes(50);
+  consumer.SubtractNumBytes(30);
+  BOOST_CHECK_EQUAL(consumer.NumBytes(), 120);
+  UpdateMemoryConsumerLimits(1000);
+  BOOST_CHECK_EQUAL(consumer.MaxNumBytes(), kUnbounded);
+  BOOST_CHECK_EQUAL(consumer.CheckMaxNumBytes(), kUnbounded);
+}
+
+BOOST_AUTO_TEST_CASE(TestShrinkByPriority) {
+  SetMemoryBudget(100);
+
+  // Registered out of order of their priorities.
+  MemoryConsumer consumer2("consumer2", 2);
+  MemoryConsumer consumer1("consumer1", 1, 10);
+  MemoryConsumer consumer3("consumer3", 2);
+  consumer1.AddNumBytes(50);
+  consumer2.AddNumBytes(100);
+  consumer3.AddNumBytes(100);
+
+  UpdateMemoryConsumerLimits(100);
+  BOOST_CHECK_EQUAL(consumer1.MaxNumBytes(), kUnbounded);
+  BOOST_CHECK_EQUAL(consumer2.MaxNumBytes(), kUnbounded);
+  BOOST_CHECK_EQUAL(consumer3.MaxNumBytes(), kUnbounded);
+
+  // The lowest priority is shrunk first down to its minimum and then the
+  // consumers of the same priority in the order of their registration.
+  UpdateMemoryConsumerLimits(180);
+  BOOST_CHECK_EQUAL(consumer1.MaxNumBytes(), 10);
+  BOOST_CHECK_EQUAL(consumer2.MaxNumBytes(), 60);
+  BOOST_CHECK_EQUAL(consumer3.MaxNumBytes(), kUnbounded);
+
+  // Before the consumers have shrunk, the limits only go down further.
+  UpdateMemoryConsumerLimits(130);
+  BOOST_CHECK_EQUAL(consumer1.MaxNumBytes(), 10);
+  BOOST_CHECK_EQUAL(consumer2.MaxNumBytes(), 30);
+  BOOST_CHECK_EQUAL(consumer3.MaxNumBytes(), kUnbounded);
+
+  // More than the consumers can make up for.
+  UpdateMemoryConsumerLimits(1000);
+  BOOST_CHECK_EQUAL(consumer1.MaxNumBytes(), 10);
+  BOOST_CHECK_EQUAL(consumer2.MaxNumBytes(), 0);
+  BOOST_CHECK_EQUAL(consumer3.MaxNumBytes(), 0);
+
+  SetMemoryBudget(0);
+  BOOST_CHECK_EQUAL(consumer1.MaxNumBytes(), kUnbounded);
+  BOOST_CHECK_EQUAL(consumer2.MaxNumBytes(), kUnbounded);
+  BOOST_CHECK_EQUAL(consumer3.MaxNumBytes(), kUnbounded);
+}
+
+BOOST_AUTO_TEST_CASE(TestRelax) {
+  SetMemoryBudget(100);
+
+  MemoryConsumer consumer1("consumer1", 1);
+  MemoryConsumer consumer2("consumer2", 2);
+  consumer1.AddNumBytes(50);
+  consumer2.AddNumBytes(50);
+
+  UpdateMemoryConsumerLimits(140);
+  BOOST_CHECK_EQUAL(consumer1.MaxNumBytes(), 10);
+  BOOST_CHECK_EQUAL(consumer2.MaxNumBytes(), kUnbounded);
+  consumer1.SubtractNumBytes(40);
+
+  // Within the budget, but not clearly below it.
+  UpdateMemoryConsumerLimits(95);
+  BOOST_CHECK_EQUAL(consumer1.MaxNumBytes(), 10);
+  BOOST_CHECK_EQUAL(consumer2.MaxNumBytes(), kUnbounded);
+
+  // The consumers may grow by the memory below 90% of the budget.
+  UpdateMemoryConsumerLimits(80);
+  BOOST_CHECK_EQUAL(consumer1.MaxNumBytes(), 20);
+  BOOST_CHECK_EQUAL(consumer2.MaxNumBytes(), kUnbounded);
+
+  // The limits are released below half of the budget.
+  UpdateMemoryConsumerLimits(50);
+  BOOST_CHECK_EQUAL(consumer1.MaxNumBytes(), kUnbounded);
+  BOOST_CHECK_EQUAL(consumer2.MaxNumBytes(), kUnbounded);
+
+  SetMemoryBudget(0);
+}
+
+BOOST_AUTO_TEST_CASE(TestCheckMaxNumBytes) {
+#if defined(__linux__) || defined(__APPLE__)
+  // Any process exceeds a budget of one byte.
+  SetMemoryBudget(1);
+  MemoryConsumer consumer("test", 0, 10);
+  consumer.AddNumBytes(100);
+  BOOST_CHECK_EQUAL(consumer.CheckMaxNumBytes(), 10);
+  BOOST_CHECK_EQUAL(consumer.MaxNumBytes(), 10);
+  SetMemoryBudget(0);
+  BOOST_CHECK_EQUAL(consumer.CheckMaxNumBytes(), kUnbounded);
+#endif
+}
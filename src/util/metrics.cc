@@ -0,0 +1,293 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "util/metrics.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "util/logging.h"
+#include "util/memory_governor.h"
+#include "util/string.h"
+
+namespace colmap {
+namespace internal {
+
+std::atomic<bool> metrics_enabled(false);
+
+}  // namespace internal
+
+namespace {
+
+typedef std::chrono::steady_clock MetricsClock;
+
+double SecondsBetween(const MetricsClock::time_point& begin,
+                      const MetricsClock::time_point& end) {
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+// The metrics are never freed, so that the references of the call sites of
+// the macros always remain valid.
+struct MetricsRegistry {
+  std::mutex mutex;
+  std::map<std::string, std::unique_ptr<MetricCounter>> counters;
+  std::map<std::string, std::unique_ptr<MetricGauge>> gauges;
+  std::string stage;
+  MetricsClock::time_point begin_time = MetricsClock::now();
+  MetricsClock::time_point stage_begin_time = MetricsClock::now();
+  // The counter values at the previous write, to measure the rates.
+  MetricsClock::time_point prev_write_time = MetricsClock::now();
+  std::unordered_map<std::string, int64_t> prev_counter_values;
+};
+
+MetricsRegistry& GetMetricsRegistry() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+struct MetricsWriter {
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::thread thread;
+  bool stop = false;
+};
+
+MetricsWriter& GetMetricsWriter() {
+  static MetricsWriter writer;
+  return writer;
+}
+
+std::string MetricsToJSON() {
+  MetricsRegistry& registry = GetMetricsRegistry();
+  const std::vector<MemoryConsumerUsage> memory_consumer_usages =
+      GetMemoryConsumerUsages();
+
+  std::unique_lock<std::mutex> lock(registry.mutex);
+
+  const auto now = MetricsClock::now();
+  const double interval_seconds = SecondsBetween(registry.prev_write_time, now);
+
+  std::string json = StringPrintf(
+      "{\"time\":%.3f,\"elapsed_seconds\":%.3f,\"stage\":\"%s\","
+      "\"stage_seconds\":%.3f,\n",
+      std::chrono::duration<double>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count(),
+      SecondsBetween(registry.begin_time, now),
+      StringEscapeJSON(registry.stage).c_str(),
+      SecondsBetween(registry.stage_begin_time, now));
+
+  json += StringPrintf(
+      "\"memory\":{\"resident_bytes\":%llu,\"budget_bytes\":%llu,"
+      "\"consumers\":[",
+      static_cast<unsigned long long>(GetResidentSetSize()),
+      static_cast<unsigned long long>(GetMemoryBudget()));
+  for (size_t i = 0; i < memory_consumer_usages.size(); ++i) {
+    const MemoryConsumerUsage& usage = memory_consumer_usages[i];
+    json += StringPrintf("%s{\"name\":\"%s\",\"num_bytes\":%llu,",
+                         i == 0 ? "" : ",",
+                         StringEscapeJSON(usage.name).c_str(),
+                         static_cast<unsigned long long>(usage.num_bytes));
+    if (usage.max_num_bytes == std::numeric_limits<size_t>::max()) {
+      json += "\"max_num_bytes\":null}";
+    } else {
+      json += StringPrintf(
+          "\"max_num_bytes\":%llu}",
+          static_cast<unsigned long long>(usage.max_num_bytes));
+    }
+  }
+  json += "]},\n\"counters\":{";
+
+  bool first = true;
+  for (const auto& counter : registry.counters) {
+    const int64_t value = counter.second->Value();
+    int64_t& prev_value = registry.prev_counter_values[counter.first];
+    const double rate = interval_seconds > 0
+                            ? (value - prev_value) / interval_seconds
+                            : 0.0;
+    prev_value = value;
+    json += StringPrintf("%s\n\"%s\":{\"value\":%lld,\"rate\":%.6g}",
+                         first ? "" : ",",
+                         StringEscapeJSON(counter.first).c_str(),
+                         static_cast<long long>(value), rate);
+    first = false;
+  }
+  json += "},\n\"gauges\":{";
+
+  first = true;
+  for (const auto& gauge : registry.gauges) {
+    json += StringPrintf("%s\n\"%s\":%.9g", first ? "" : ",",
+                         StringEscapeJSON(gauge.first).c_str(),
+                         gauge.second->Value());
+    first = false;
+  }
+  json += "}}\n";
+
+  registry.prev_write_time = now;
+
+  return json;
+}
+
+}  // namespace
+
+void EnableMetrics() {
+  internal::metrics_enabled.store(true, std::memory_order_relaxed);
+}
+
+void DisableMetrics() {
+  internal::metrics_enabled.store(false, std::memory_order_relaxed);
+}
+
+void ClearMetrics() {
+  MetricsRegistry& registry = GetMetricsRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  for (auto& counter : registry.counters) {
+    counter.second->Reset();
+  }
+  for (auto& gauge : registry.gauges) {
+    gauge.second->Reset();
+  }
+  registry.stage.clear();
+  registry.begin_time = MetricsClock::now();
+  registry.stage_begin_time = registry.begin_time;
+  registry.prev_write_time = registry.begin_time;
+  registry.prev_counter_values.clear();
+}
+
+MetricCounter& GetMetricCounter(const std::string& name) {
+  MetricsRegistry& registry = GetMetricsRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  auto& counter = registry.counters[name];
+  if (!counter) {
+    counter.reset(new MetricCounter());
+  }
+  return *counter;
+}
+
+MetricGauge& GetMetricGauge(const std::string& name) {
+  MetricsRegistry& registry = GetMetricsRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  auto& gauge = registry.gauges[name];
+  if (!gauge) {
+    gauge.reset(new MetricGauge());
+  }
+  return *gauge;
+}
+
+void AddMetricCounter(const std::string& name, const int64_t value) {
+  if (IsMetricsEnabled()) {
+    GetMetricCounter(name).Add(value);
+  }
+}
+
+void SetMetricGauge(const std::string& name, const double value) {
+  if (IsMetricsEnabled()) {
+    GetMetricGauge(name).Set(value);
+  }
+}
+
+void SetMetricsStage(const std::string& stage) {
+  if (!IsMetricsEnabled()) {
+    return;
+  }
+  MetricsRegistry& registry = GetMetricsRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  registry.stage = stage;
+  registry.stage_begin_time = MetricsClock::now();
+}
+
+bool WriteMetrics(const std::string& path) {
+  const std::string json = MetricsToJSON();
+
+  // Replace the file atomically, so that readers never see a partial file.
+  const std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::trunc);
+    if (!file.is_open()) {
+      std::cerr << "ERROR: Could not open metrics file " << tmp_path
+                << " for writing." << std::endl;
+      return false;
+    }
+    file << json;
+    if (!file.good()) {
+      return false;
+    }
+  }
+
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    // Renaming onto an existing file fails on Windows.
+    std::remove(path.c_str());
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+      std::cerr << "ERROR: Could not write metrics file " << path << "."
+                << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void StartMetricsWriter(const std::string& path,
+                        const double interval_seconds) {
+  CHECK_GT(interval_seconds, 0);
+  StopMetricsWriter();
+  EnableMetrics();
+
+  MetricsWriter& writer = GetMetricsWriter();
+  writer.stop = false;
+  writer.thread = std::thread([path, interval_seconds]() {
+    MetricsWriter& writer = GetMetricsWriter();
+    const auto interval = std::chrono::duration_cast<MetricsClock::duration>(
+        std::chrono::duration<double>(interval_seconds));
+    std::unique_lock<std::mutex> lock(writer.mutex);
+    while (true) {
+      lock.unlock();
+      WriteMetrics(path);
+      lock.lock();
+      if (writer.stop ||
+          writer.condition.wait_for(lock, interval,
+                                    [&writer]() { return writer.stop; })) {
+        break;
+      }
+    }
+    lock.unlock();
+    WriteMetrics(path);
+  });
+}
+
+void StopMetricsWriter() {
+  MetricsWriter& writer = GetMetricsWriter();
+  {
+    std::unique_lock<std::mutex> lock(writer.mutex);
+    writer.stop = true;
+  }
+  writer.condition.notify_all();
+  if (writer.thread.joinable()) {
+    writer.thread.join();
+  }
+}
+
+}  // namespace colmap
@@ -0,0 +1,137 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef COLMAP_SRC_UTIL_METRICS_H_
+#define COLMAP_SRC_UTIL_METRICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace colmap {
+
+// Live metrics of long running jobs, which a scheduler can poll to detect
+// stalls and to predict the completion of a job. The metrics are named
+// counters, which only grow, e.g. the number of RANSAC trials, and gauges,
+// which hold the last value, e.g. the number of registered images of a take,
+// together with the current stage of the job.
+//
+// A background thread periodically rewrites the metrics as JSON to a file,
+// which is replaced atomically, so that readers never see a partial file.
+// Besides the values, the file holds the rate per second of every counter
+// since the previous write, the resident memory of the process and the bytes
+// of the caches registered with the memory governor.
+//
+// Metrics are disabled until `EnableMetrics` or `StartMetricsWriter` is
+// called, in which case updating a metric through the macros costs a single
+// relaxed atomic load. The name of a metric in a macro must be the same on
+// every call, since the metric is only looked up once per call site.
+//
+// Example usage:
+//
+//    StartMetricsWriter("metrics.json", 10);
+//    SetMetricsStage("mapper");
+//    METRIC_COUNTER_ADD("ransac/num_trials", num_trials);
+//    METRIC_GAUGE_SET("mapper/num_images", num_images);
+//    StopMetricsWriter();
+//
+#define METRIC_COUNTER_ADD(name, value)                        \
+  do {                                                         \
+    if (::colmap::IsMetricsEnabled()) {                        \
+      static ::colmap::MetricCounter& metric_counter_ =        \
+          ::colmap::GetMetricCounter(name);                    \
+      metric_counter_.Add(value);                              \
+    }                                                          \
+  } while (0)
+
+#define METRIC_GAUGE_SET(name, value)                          \
+  do {                                                         \
+    if (::colmap::IsMetricsEnabled()) {                        \
+      static ::colmap::MetricGauge& metric_gauge_ =            \
+          ::colmap::GetMetricGauge(name);                      \
+      metric_gauge_.Set(value);                                \
+    }                                                          \
+  } while (0)
+
+class MetricCounter {
+ public:
+  MetricCounter() : value_(0) {}
+  void Add(const int64_t value) {
+    value_.fetch_add(value, std::memory_order_relaxed);
+  }
+  int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+  void Reset() { value_.store(0, std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_;
+};
+
+class MetricGauge {
+ public:
+  MetricGauge() : value_(0) {}
+  void Set(const double value) {
+    value_.store(value, std::memory_order_relaxed);
+  }
+  double Value() const { return value_.load(std::memory_order_relaxed); }
+  void Reset() { value_.store(0, std::memory_order_relaxed); }
+
+ private:
+  std::atomic<double> value_;
+};
+
+void EnableMetrics();
+void DisableMetrics();
+
+// Reset the stage and all counters and gauges.
+void ClearMetrics();
+
+// The metric with the given name, which is created on first access and lives
+// as long as the process.
+MetricCounter& GetMetricCounter(const std::string& name);
+MetricGauge& GetMetricGauge(const std::string& name);
+
+// Update a metric whose name changes between calls, e.g. per take, which looks
+// up the metric on every call. Does nothing if the metrics are disabled.
+void AddMetricCounter(const std::string& name, const int64_t value);
+void SetMetricGauge(const std::string& name, const double value);
+
+// The stage of the job that was started last.
+void SetMetricsStage(const std::string& stage);
+
+// Write the metrics as JSON, where the rates of the counters are measured
+// since the previous write.
+bool WriteMetrics(const std::string& path);
+
+// Enable the metrics and rewrite them every `interval_seconds` in a background
+// thread until `StopMetricsWriter` is called, which writes them a last time.
+void StartMetricsWriter(const std::string& path,
+                        const double interval_seconds = 10);
+void StopMetricsWriter();
+
+namespace internal {
+
+extern std::atomic<bool> metrics_enabled;
+
+}  // namespace internal
+
+inline bool IsMetricsEnabled() {
+  return internal::metrics_enabled.load(std::memory_order_relaxed);
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_METRICS_H_
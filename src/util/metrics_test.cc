@@ -0,0 +1,142 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#define TEST_NAME "util/metrics"
+#include "util/testing.h"
+
+#include <chrono>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "util/memory_governor.h"
+#include "util/metrics.h"
+
+using namespace colmap;
+
+namespace {
+
+std::string MetricsPath() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("metrics_%%%%%%%%.json"))
+      .string();
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestDisabled) {
+  ClearMetrics();
+  DisableMetrics();
+  BOOST_CHECK(!IsMetricsEnabled());
+  for (int i = 0; i < 3; ++i) {
+    METRIC_COUNTER_ADD("disabled/counter", 1);
+    METRIC_GAUGE_SET("disabled/gauge", 1);
+  }
+  AddMetricCounter("disabled/counter", 1);
+  SetMetricGauge("disabled/gauge", 1);
+  BOOST_CHECK_EQUAL(GetMetricCounter("disabled/counter").Value(), 0);
+  BOOST_CHECK_EQUAL(GetMetricGauge("disabled/gauge").Value(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestCounterAndGauge) {
+  ClearMetrics();
+  EnableMetrics();
+  for (int i = 0; i < 3; ++i) {
+    METRIC_COUNTER_ADD("test/counter", 2);
+    METRIC_GAUGE_SET("test/gauge", i);
+  }
+  AddMetricCounter("test/counter", 1);
+  BOOST_CHECK_EQUAL(GetMetricCounter("test/counter").Value(), 7);
+  BOOST_CHECK_EQUAL(GetMetricGauge("test/gauge").Value(), 2);
+  BOOST_CHECK_EQUAL(&GetMetricCounter("test/counter"),
+                    &GetMetricCounter("test/counter"));
+
+  // The call sites of the macros keep their metrics.
+  ClearMetrics();
+  BOOST_CHECK_EQUAL(GetMetricCounter("test/counter").Value(), 0);
+  METRIC_COUNTER_ADD("test/counter", 3);
+  BOOST_CHECK_EQUAL(GetMetricCounter("test/counter").Value(), 3);
+  DisableMetrics();
+}
+
+BOOST_AUTO_TEST_CASE(TestWriteMetrics) {
+  ClearMetrics();
+  EnableMetrics();
+  MemoryConsumer consumer("test_cache", 0);
+  consumer.AddNumBytes(123);
+  SetMetricsStage("take1/\"registration\"");
+  AddMetricCounter("ransac/num_trials", 100);
+  SetMetricGauge("take1/num_reg_images", 42);
+
+  const std::string path = MetricsPath();
+  BOOST_CHECK(WriteMetrics(path));
+  BOOST_CHECK(!boost::filesystem::exists(path + ".tmp"));
+
+  boost::property_tree::ptree metrics;
+  boost::property_tree::read_json(path, metrics);
+  BOOST_CHECK_GT(metrics.get<double>("time"), 0);
+  BOOST_CHECK_GE(metrics.get<double>("elapsed_seconds"), 0);
+  BOOST_CHECK_EQUAL(metrics.get<std::string>("stage"),
+                    "take1/\"registration\"");
+  BOOST_CHECK_GE(metrics.get<double>("stage_seconds"), 0);
+  BOOST_CHECK_EQUAL(metrics.get<long long>("memory.budget_bytes"), 0);
+  bool found_consumer = false;
+  for (const auto& usage : metrics.get_child("memory.consumers")) {
+    if (usage.second.get<std::string>("name") == "test_cache") {
+      BOOST_CHECK_EQUAL(usage.second.get<long long>("num_bytes"), 123);
+      found_consumer = true;
+    }
+  }
+  BOOST_CHECK(found_consumer);
+  BOOST_CHECK_EQUAL(
+      metrics.get<long long>("counters.ransac/num_trials.value"), 100);
+  BOOST_CHECK_GT(metrics.get<double>("counters.ransac/num_trials.rate"), 0);
+  BOOST_CHECK_EQUAL(metrics.get<double>("gauges.take1/num_reg_images"), 42);
+
+  // Without progress since the last write, the rate drops to zero.
+  BOOST_CHECK(WriteMetrics(path));
+  boost::property_tree::read_json(path, metrics);
+  BOOST_CHECK_EQUAL(
+      metrics.get<long long>("counters.ransac/num_trials.value"), 100);
+  BOOST_CHECK_EQUAL(metrics.get<double>("counters.ransac/num_trials.rate"),
+                    0);
+
+  DisableMetrics();
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestMetricsWriter) {
+  ClearMetrics();
+  const std::string path = MetricsPath();
+  StartMetricsWriter(path, 0.01);
+  BOOST_CHECK(IsMetricsEnabled());
+  SetMetricsStage("first");
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  BOOST_CHECK(boost::filesystem::exists(path));
+  SetMetricsStage("last");
+  StopMetricsWriter();
+
+  // The metrics are written a last time when the writer stops.
+  boost::property_tree::ptree metrics;
+  boost::property_tree::read_json(path, metrics);
+  BOOST_CHECK_EQUAL(metrics.get<std::string>("stage"), "last");
+
+  DisableMetrics();
+  boost::filesystem::remove(path);
+}
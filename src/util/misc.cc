@@ -154,13 +154,14 @@ size_t GetFileSize(const std::string& path) {
 }
 
 void PrintHeading1(const std::string& heading) {
-  std::cout << std::endl << std::string(78, '=') << std::endl;
-  std::cout << heading << std::endl;
-  std::cout << std::string(78, '=') << std::endl << std::endl;
+  // Flushes only once, as the headings are printed in the mapper loops.
+  std::cout << "\n" << std::string(78, '=') << "\n";
+  std::cout << heading << "\n";
+  std::cout << std::string(78, '=') << "\n" << std::endl;
 }
 
 void PrintHeading2(const std::string& heading) {
-  std::cout << std::endl << heading << std::endl;
+  std::cout << "\n" << heading << "\n";
   std::cout << std::string(std::min<int>(heading.size(), 78), '-') << std::endl;
 }
 
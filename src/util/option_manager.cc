@@ -28,7 +28,9 @@
 #include "mvs/meshing.h"
 #include "mvs/patch_match.h"
 #include "optim/bundle_adjustment.h"
+#include "sfm/two_body_postprocessor.h"
 #include "ui/render_options.h"
+#include "util/image_source.h"
 #include "util/misc.h"
 #include "util/version.h"
 
@@ -41,6 +43,7 @@ OptionManager::OptionManager() {
   database_path.reset(new std::string());
   image_path.reset(new std::string());
 
+  image_source.reset(new ImageSourceOptions());
   image_reader.reset(new ImageReaderOptions());
   sift_extraction.reset(new SiftExtractionOptions());
   sift_matching.reset(new SiftMatchingOptions());
@@ -51,6 +54,7 @@ OptionManager::OptionManager() {
   transitive_matching.reset(new TransitiveMatchingOptions());
   bundle_adjustment.reset(new BundleAdjustmentOptions());
   mapper.reset(new IncrementalMapperOptions());
+  postprocessor.reset(new TwoBodyPostprocessorOptions());
   dense_stereo.reset(new mvs::PatchMatchOptions());
   dense_fusion.reset(new mvs::StereoFusionOptions());
   dense_meshing.reset(new mvs::PoissonReconstructionOptions());
@@ -132,6 +136,7 @@ void OptionManager::AddAllOptions() {
   AddLogOptions();
   AddDatabaseOptions();
   AddImageOptions();
+  AddImageSourceOptions();
   AddExtractionOptions();
   AddMatchingOptions();
   AddExhaustiveMatchingOptions();
@@ -141,6 +146,7 @@ void OptionManager::AddAllOptions() {
   AddTransitiveMatchingOptions();
   AddBundleAdjustmentOptions();
   AddMapperOptions();
+  AddPostprocessorOptions();
   AddDenseStereoOptions();
   AddDenseFusionOptions();
   AddDenseMeshingOptions();
@@ -175,6 +181,24 @@ void OptionManager::AddImageOptions() {
   AddAndRegisterRequiredOption("image_path", image_path.get());
 }
 
+void OptionManager::AddImageSourceOptions() {
+  if (added_image_source_options_) {
+    return;
+  }
+  added_image_source_options_ = true;
+
+  AddAndRegisterDefaultOption("ImageSource.fetch_command",
+                              &image_source->fetch_command);
+  AddAndRegisterDefaultOption("ImageSource.cache_path",
+                              &image_source->cache_path);
+  AddAndRegisterDefaultOption("ImageSource.cache_size",
+                              &image_source->cache_size);
+  AddAndRegisterDefaultOption("ImageSource.num_fetch_threads",
+                              &image_source->num_fetch_threads);
+  AddAndRegisterDefaultOption("ImageSource.max_num_prefetched_images",
+                              &image_source->max_num_prefetched_images);
+}
+
 void OptionManager::AddExtractionOptions() {
   if (added_extraction_options_) {
     return;
@@ -189,6 +213,12 @@ void OptionManager::AddExtractionOptions() {
                               &image_reader->camera_params);
   AddAndRegisterDefaultOption("ImageReader.default_focal_length_factor",
                               &image_reader->default_focal_length_factor);
+  AddAndRegisterDefaultOption("ImageReader.num_decode_threads",
+                              &image_reader->num_decode_threads);
+  AddAndRegisterDefaultOption("ImageReader.max_num_prefetched_images",
+                              &image_reader->max_num_prefetched_images);
+  AddAndRegisterDefaultOption("ImageReader.prefetch_cache_size",
+                              &image_reader->prefetch_cache_size);
 
   AddAndRegisterDefaultOption("SiftExtraction.num_threads",
                               &sift_extraction->num_threads);
@@ -200,6 +230,12 @@ void OptionManager::AddExtractionOptions() {
                               &sift_extraction->max_image_size);
   AddAndRegisterDefaultOption("SiftExtraction.max_num_features",
                               &sift_extraction->max_num_features);
+  AddAndRegisterDefaultOption("SiftExtraction.tile_size",
+                              &sift_extraction->tile_size);
+  AddAndRegisterDefaultOption("SiftExtraction.tile_overlap",
+                              &sift_extraction->tile_overlap);
+  AddAndRegisterDefaultOption("SiftExtraction.num_tile_threads",
+                              &sift_extraction->num_tile_threads);
   AddAndRegisterDefaultOption("SiftExtraction.first_octave",
                               &sift_extraction->first_octave);
   AddAndRegisterDefaultOption("SiftExtraction.num_octaves",
@@ -224,6 +260,8 @@ void OptionManager::AddExtractionOptions() {
                               &sift_extraction->dsp_max_scale);
   AddAndRegisterDefaultOption("SiftExtraction.dsp_num_scales",
                               &sift_extraction->dsp_num_scales);
+  AddAndRegisterDefaultOption("SiftExtraction.feature_cache_path",
+                              &sift_extraction->feature_cache_path);
 }
 
 void OptionManager::AddMatchingOptions() {
@@ -253,10 +291,28 @@ void OptionManager::AddMatchingOptions() {
                               &sift_matching->max_num_trials);
   AddAndRegisterDefaultOption("SiftMatching.min_inlier_ratio",
                               &sift_matching->min_inlier_ratio);
+  AddAndRegisterDefaultOption("SiftMatching.use_sprt",
+                              &sift_matching->use_sprt);
   AddAndRegisterDefaultOption("SiftMatching.min_num_inliers",
                               &sift_matching->min_num_inliers);
+  AddAndRegisterDefaultOption("SiftMatching.joint_verification",
+                              &sift_matching->joint_verification);
+  AddAndRegisterDefaultOption("SiftMatching.gpu_verification",
+                              &sift_matching->gpu_verification);
+  AddAndRegisterDefaultOption("SiftMatching.verification_batch_size",
+                              &sift_matching->verification_batch_size);
   AddAndRegisterDefaultOption("SiftMatching.multiple_models",
                               &sift_matching->multiple_models);
+  AddAndRegisterDefaultOption("SiftMatching.max_num_models",
+                              &sift_matching->max_num_models);
+  AddAndRegisterDefaultOption("SiftMatching.descriptor_cache_size",
+                              &sift_matching->descriptor_cache_size);
+  AddAndRegisterDefaultOption("SiftMatching.descriptor_store_path",
+                              &sift_matching->descriptor_store_path);
+  AddAndRegisterDefaultOption("SiftMatching.use_descriptor_codes",
+                              &sift_matching->use_descriptor_codes);
+  AddAndRegisterDefaultOption("SiftMatching.feature_cache_path",
+                              &sift_matching->feature_cache_path);
   AddAndRegisterDefaultOption("SiftMatching.guided_matching",
                               &sift_matching->guided_matching);
   AddAndRegisterDefaultOption("SiftMatching.border", &sift_matching->border);
@@ -272,6 +328,12 @@ void OptionManager::AddExhaustiveMatchingOptions() {
 
   AddAndRegisterDefaultOption("ExhaustiveMatching.block_size",
                               &exhaustive_matching->block_size);
+  AddAndRegisterDefaultOption("ExhaustiveMatching.takes_path",
+                              &exhaustive_matching->takes_path);
+  AddAndRegisterDefaultOption("ExhaustiveMatching.num_cross_take_images",
+                              &exhaustive_matching->num_cross_take_images);
+  AddAndRegisterDefaultOption("ExhaustiveMatching.vocab_tree_path",
+                              &exhaustive_matching->vocab_tree_path);
 }
 
 void OptionManager::AddSequentialMatchingOptions() {
@@ -303,6 +365,10 @@ void OptionManager::AddSequentialMatchingOptions() {
   AddAndRegisterDefaultOption(
       "SequentialMatching.loop_detection_max_num_features",
       &sequential_matching->loop_detection_max_num_features);
+  AddAndRegisterDefaultOption("SequentialMatching.takes_path",
+                              &sequential_matching->takes_path);
+  AddAndRegisterDefaultOption("SequentialMatching.num_cross_take_images",
+                              &sequential_matching->num_cross_take_images);
   AddAndRegisterDefaultOption("SequentialMatching.vocab_tree_path",
                               &sequential_matching->vocab_tree_path);
 }
@@ -427,10 +493,16 @@ void OptionManager::AddMapperOptions() {
                               &mapper->ba_refine_principal_point);
   AddAndRegisterDefaultOption("Mapper.ba_refine_extra_params",
                               &mapper->ba_refine_extra_params);
+  AddAndRegisterDefaultOption("Mapper.ba_mixed_precision",
+                              &mapper->ba_mixed_precision);
+  AddAndRegisterDefaultOption("Mapper.ba_rigid_object_motion",
+                              &mapper->ba_rigid_object_motion);
   AddAndRegisterDefaultOption("Mapper.ba_local_num_images",
                               &mapper->ba_local_num_images);
   AddAndRegisterDefaultOption("Mapper.ba_local_max_num_iterations",
                               &mapper->ba_local_max_num_iterations);
+  AddAndRegisterDefaultOption("Mapper.ba_local_batch",
+                              &mapper->ba_local_batch);
   AddAndRegisterDefaultOption("Mapper.ba_global_use_pba",
                               &mapper->ba_global_use_pba);
   AddAndRegisterDefaultOption("Mapper.ba_global_pba_gpu_index",
@@ -445,6 +517,14 @@ void OptionManager::AddMapperOptions() {
                               &mapper->ba_global_points_freq);
   AddAndRegisterDefaultOption("Mapper.ba_global_max_num_iterations",
                               &mapper->ba_global_max_num_iterations);
+  AddAndRegisterDefaultOption("Mapper.ba_global_incremental",
+                              &mapper->ba_global_incremental);
+  AddAndRegisterDefaultOption("Mapper.ba_global_subsample_points",
+                              &mapper->ba_global_subsample_points);
+  AddAndRegisterDefaultOption("Mapper.ba_global_subsample_grid_size",
+                              &mapper->ba_global_subsample_grid_size);
+  AddAndRegisterDefaultOption("Mapper.ba_refinement_reuse_problem",
+                              &mapper->ba_refinement_reuse_problem);
   AddAndRegisterDefaultOption("Mapper.ba_global_max_refinements",
                               &mapper->ba_global_max_refinements);
   AddAndRegisterDefaultOption("Mapper.ba_global_max_refinement_change",
@@ -456,6 +536,31 @@ void OptionManager::AddMapperOptions() {
   AddAndRegisterDefaultOption("Mapper.snapshot_path", &mapper->snapshot_path);
   AddAndRegisterDefaultOption("Mapper.snapshot_images_freq",
                               &mapper->snapshot_images_freq);
+  AddAndRegisterDefaultOption("Mapper.anchor_take", &mapper->anchor_take);
+  AddAndRegisterDefaultOption("Mapper.write_take_bundle",
+                              &mapper->write_take_bundle);
+  AddAndRegisterDefaultOption("Mapper.write_camera_log_text",
+                              &mapper->write_camera_log_text);
+  AddAndRegisterDefaultOption("Mapper.write_tracks", &mapper->write_tracks);
+  AddAndRegisterDefaultOption("Mapper.write_anchor_model",
+                              &mapper->write_anchor_model);
+  AddAndRegisterDefaultOption("Mapper.init_pair_cache_path",
+                              &mapper->init_pair_cache_path);
+  AddAndRegisterDefaultOption("Mapper.out_of_core_path",
+                              &mapper->out_of_core_path);
+  AddAndRegisterDefaultOption("Mapper.filter_tentative_motions",
+                              &mapper->filter_tentative_motions);
+  AddAndRegisterDefaultOption("Mapper.tentative_motion_identity_thr1",
+                              &mapper->tentative_motion_identity_thr1);
+  AddAndRegisterDefaultOption("Mapper.tentative_motion_identity_thr2",
+                              &mapper->tentative_motion_identity_thr2);
+  AddAndRegisterDefaultOption("Mapper.tentative_motion_num_estimates",
+                              &mapper->tentative_motion_num_estimates);
+  AddAndRegisterDefaultOption("Mapper.tentative_motion_max_rotation_error",
+                              &mapper->tentative_motion_max_rotation_error);
+  AddAndRegisterDefaultOption(
+      "Mapper.tentative_motion_max_translation_error",
+      &mapper->tentative_motion_max_translation_error);
 
   // IncrementalMapper.
   AddAndRegisterDefaultOption("Mapper.init_min_num_inliers",
@@ -468,18 +573,34 @@ void OptionManager::AddMapperOptions() {
                               &mapper->mapper.init_min_tri_angle);
   AddAndRegisterDefaultOption("Mapper.init_max_reg_trials",
                               &mapper->mapper.init_max_reg_trials);
+  AddAndRegisterDefaultOption("Mapper.init_num_parallel_pairs",
+                              &mapper->mapper.init_num_parallel_pairs);
   AddAndRegisterDefaultOption("Mapper.abs_pose_max_error",
                               &mapper->mapper.abs_pose_max_error);
   AddAndRegisterDefaultOption("Mapper.abs_pose_min_num_inliers",
                               &mapper->mapper.abs_pose_min_num_inliers);
   AddAndRegisterDefaultOption("Mapper.abs_pose_min_inlier_ratio",
                               &mapper->mapper.abs_pose_min_inlier_ratio);
+  AddAndRegisterDefaultOption("Mapper.abs_pose_use_sprt",
+                              &mapper->mapper.abs_pose_use_sprt);
+  AddAndRegisterDefaultOption("Mapper.abs_pose_joint_focal_length",
+                              &mapper->mapper.abs_pose_joint_focal_length);
+  AddAndRegisterDefaultOption("Mapper.ransac_num_threads",
+                              &mapper->mapper.ransac_num_threads);
+  AddAndRegisterDefaultOption("Mapper.seq_pose_prediction",
+                              &mapper->mapper.seq_pose_prediction);
+  AddAndRegisterDefaultOption("Mapper.seq_pose_prediction_num_trials",
+                              &mapper->mapper.seq_pose_prediction_num_trials);
   AddAndRegisterDefaultOption("Mapper.filter_max_reproj_error",
                               &mapper->mapper.filter_max_reproj_error);
   AddAndRegisterDefaultOption("Mapper.filter_min_tri_angle",
                               &mapper->mapper.filter_min_tri_angle);
+  AddAndRegisterDefaultOption("Mapper.filter_min_change",
+                              &mapper->mapper.filter_min_change);
   AddAndRegisterDefaultOption("Mapper.max_reg_trials",
                               &mapper->mapper.max_reg_trials);
+  AddAndRegisterDefaultOption("Mapper.out_of_core_cache_size",
+                              &mapper->mapper.out_of_core_cache_size);
 
   // IncrementalTriangulator.
   AddAndRegisterDefaultOption("Mapper.tri_max_transitivity",
@@ -506,6 +627,52 @@ void OptionManager::AddMapperOptions() {
                               &mapper->triangulation.ignore_two_view_tracks);
 }
 
+void OptionManager::AddPostprocessorOptions() {
+  if (added_postprocessor_options_) {
+    return;
+  }
+  added_postprocessor_options_ = true;
+
+  AddAndRegisterDefaultOption("Postprocessor.num_threads",
+                              &postprocessor->num_threads);
+  AddAndRegisterDefaultOption("Postprocessor.basis_sigma",
+                              &postprocessor->basis_sigma);
+  AddAndRegisterDefaultOption("Postprocessor.cycle_thr",
+                              &postprocessor->cycle_thr);
+  AddAndRegisterDefaultOption("Postprocessor.basis_thr",
+                              &postprocessor->basis_thr);
+  AddAndRegisterDefaultOption("Postprocessor.id_thr1", &postprocessor->id_thr1);
+  AddAndRegisterDefaultOption("Postprocessor.id_thr2", &postprocessor->id_thr2);
+  AddAndRegisterDefaultOption("Postprocessor.motion_sigma",
+                              &postprocessor->motion_sigma);
+  AddAndRegisterDefaultOption("Postprocessor.motion_thr",
+                              &postprocessor->motion_thr);
+  AddAndRegisterDefaultOption("Postprocessor.identity_thr1",
+                              &postprocessor->identity_thr1);
+  AddAndRegisterDefaultOption("Postprocessor.identity_thr2",
+                              &postprocessor->identity_thr2);
+  AddAndRegisterDefaultOption("Postprocessor.completion_thr1",
+                              &postprocessor->completion_thr1);
+  AddAndRegisterDefaultOption("Postprocessor.completion_thr2",
+                              &postprocessor->completion_thr2);
+  AddAndRegisterDefaultOption("Postprocessor.geometric_median_rotations",
+                              &postprocessor->geometric_median_rotations);
+  AddAndRegisterDefaultOption("Postprocessor.tree_merging",
+                              &postprocessor->tree_merging);
+  AddAndRegisterDefaultOption("Postprocessor.point_rounds",
+                              &postprocessor->point_rounds);
+  AddAndRegisterDefaultOption("Postprocessor.point_track_thr",
+                              &postprocessor->point_track_thr);
+  AddAndRegisterDefaultOption("Postprocessor.point_filter_thr",
+                              &postprocessor->point_filter_thr);
+  AddAndRegisterDefaultOption("Postprocessor.ba_use_pba",
+                              &postprocessor->ba_use_pba);
+  AddAndRegisterDefaultOption("Postprocessor.ba_pba_gpu_index",
+                              &postprocessor->ba_pba_gpu_index);
+  AddAndRegisterDefaultOption("Postprocessor.ba_mixed_precision",
+                              &postprocessor->ba_mixed_precision);
+}
+
 void OptionManager::AddDenseStereoOptions() {
   if (added_dense_stereo_options_) {
     return;
@@ -538,6 +705,10 @@ void OptionManager::AddDenseStereoOptions() {
                               &dense_stereo->incident_angle_sigma);
   AddAndRegisterDefaultOption("DenseStereo.num_iterations",
                               &dense_stereo->num_iterations);
+  AddAndRegisterDefaultOption("DenseStereo.num_pyramid_levels",
+                              &dense_stereo->num_pyramid_levels);
+  AddAndRegisterDefaultOption("DenseStereo.pyramid_num_iterations",
+                              &dense_stereo->pyramid_num_iterations);
   AddAndRegisterDefaultOption("DenseStereo.geom_consistency",
                               &dense_stereo->geom_consistency);
   AddAndRegisterDefaultOption("DenseStereo.geom_consistency_regularizer",
@@ -553,10 +724,20 @@ void OptionManager::AddDenseStereoOptions() {
                               &dense_stereo->filter_min_num_consistent);
   AddAndRegisterDefaultOption("DenseStereo.filter_geom_consistency_max_cost",
                               &dense_stereo->filter_geom_consistency_max_cost);
+  AddAndRegisterDefaultOption("DenseStereo.half_precision_maps",
+                              &dense_stereo->half_precision_maps);
   AddAndRegisterDefaultOption("DenseStereo.cache_size",
                               &dense_stereo->cache_size);
+  AddAndRegisterDefaultOption("DenseStereo.image_path",
+                              &dense_stereo->image_path);
   AddAndRegisterDefaultOption("DenseStereo.write_consistency_graph",
                               &dense_stereo->write_consistency_graph);
+  AddAndRegisterDefaultOption("DenseStereo.write_tiled_maps",
+                              &dense_stereo->write_tiled_maps);
+  AddAndRegisterDefaultOption("DenseStereo.tiled_maps_tile_size",
+                              &dense_stereo->tiled_maps_tile_size);
+  AddAndRegisterDefaultOption("DenseStereo.tiled_maps_half_precision",
+                              &dense_stereo->tiled_maps_half_precision);
 }
 
 void OptionManager::AddDenseFusionOptions() {
@@ -583,6 +764,15 @@ void OptionManager::AddDenseFusionOptions() {
                               &dense_fusion->check_num_images);
   AddAndRegisterDefaultOption("DenseFusion.cache_size",
                               &dense_fusion->cache_size);
+  AddAndRegisterDefaultOption("DenseFusion.image_path",
+                              &dense_fusion->image_path);
+  AddAndRegisterDefaultOption("DenseFusion.num_threads",
+                              &dense_fusion->num_threads);
+  AddAndRegisterDefaultOption("DenseFusion.num_cells",
+                              &dense_fusion->num_cells);
+  AddAndRegisterDefaultOption("DenseFusion.use_gpu", &dense_fusion->use_gpu);
+  AddAndRegisterDefaultOption("DenseFusion.gpu_index",
+                              &dense_fusion->gpu_index);
 }
 
 void OptionManager::AddDenseMeshingOptions() {
@@ -596,6 +786,8 @@ void OptionManager::AddDenseMeshingOptions() {
   AddAndRegisterDefaultOption("DenseMeshing.depth", &dense_meshing->depth);
   AddAndRegisterDefaultOption("DenseMeshing.color", &dense_meshing->color);
   AddAndRegisterDefaultOption("DenseMeshing.trim", &dense_meshing->trim);
+  AddAndRegisterDefaultOption("DenseMeshing.samples_per_node",
+                              &dense_meshing->samples_per_node);
   AddAndRegisterDefaultOption("DenseMeshing.num_threads",
                               &dense_meshing->num_threads);
 }
@@ -608,6 +800,9 @@ void OptionManager::AddRenderOptions() {
 
   AddAndRegisterDefaultOption("Render.min_track_len", &render->min_track_len);
   AddAndRegisterDefaultOption("Render.max_error", &render->max_error);
+  AddAndRegisterDefaultOption("Render.max_num_points", &render->max_num_points);
+  AddAndRegisterDefaultOption("Render.num_points_per_upload",
+                              &render->num_points_per_upload);
   AddAndRegisterDefaultOption("Render.refresh_rate", &render->refresh_rate);
   AddAndRegisterDefaultOption("Render.adapt_refresh_rate",
                               &render->adapt_refresh_rate);
@@ -634,6 +829,7 @@ void OptionManager::Reset() {
   added_log_options_ = false;
   added_database_options_ = false;
   added_image_options_ = false;
+  added_image_source_options_ = false;
   added_extraction_options_ = false;
   added_match_options_ = false;
   added_exhaustive_match_options_ = false;
@@ -643,6 +839,7 @@ void OptionManager::Reset() {
   added_transitive_match_options_ = false;
   added_ba_options_ = false;
   added_mapper_options_ = false;
+  added_postprocessor_options_ = false;
   added_dense_stereo_options_ = false;
   added_dense_fusion_options_ = false;
   added_dense_meshing_options_ = false;
@@ -655,6 +852,7 @@ void OptionManager::ResetOptions(const bool reset_paths) {
     *database_path = "";
     *image_path = "";
   }
+  *image_source = ImageSourceOptions();
   *image_reader = ImageReaderOptions();
   *sift_extraction = SiftExtractionOptions();
   *sift_matching = SiftMatchingOptions();
@@ -665,6 +863,7 @@ void OptionManager::ResetOptions(const bool reset_paths) {
   *transitive_matching = TransitiveMatchingOptions();
   *bundle_adjustment = BundleAdjustmentOptions();
   *mapper = IncrementalMapperOptions();
+  *postprocessor = TwoBodyPostprocessorOptions();
   *dense_stereo = mvs::PatchMatchOptions();
   *dense_fusion = mvs::StereoFusionOptions();
   *dense_meshing = mvs::PoissonReconstructionOptions();
@@ -681,9 +880,15 @@ bool OptionManager::Check() {
                                 ExistsDir(database_parent_path));
   }
 
+  // Remote images are only supported by the commands with image source
+  // options.
   if (added_image_options_)
-    success = success && CHECK_OPTION_IMPL(ExistsDir(*image_path));
+    success = success && CHECK_OPTION_IMPL(
+                             ExistsDir(*image_path) ||
+                             (added_image_source_options_ &&
+                              IsRemoteImagePath(*image_path)));
 
+  if (image_source) success = success && image_source->Check();
   if (image_reader) success = success && image_reader->Check();
   if (sift_extraction) success = success && sift_extraction->Check();
 
@@ -695,6 +900,7 @@ bool OptionManager::Check() {
 
   if (bundle_adjustment) success = success && bundle_adjustment->Check();
   if (mapper) success = success && mapper->Check();
+  if (postprocessor) success = success && postprocessor->Check();
 
   if (dense_stereo) success = success && dense_stereo->Check();
   if (dense_fusion) success = success && dense_fusion->Check();
@@ -26,6 +26,7 @@
 namespace colmap {
 
 struct ImageReaderOptions;
+struct ImageSourceOptions;
 struct SiftExtractionOptions;
 struct SiftMatchingOptions;
 struct ExhaustiveMatchingOptions;
@@ -35,6 +36,7 @@ struct SpatialMatchingOptions;
 struct TransitiveMatchingOptions;
 struct BundleAdjustmentOptions;
 struct IncrementalMapperOptions;
+struct TwoBodyPostprocessorOptions;
 struct RenderOptions;
 
 namespace mvs {
@@ -66,6 +68,7 @@ class OptionManager {
   void AddLogOptions();
   void AddDatabaseOptions();
   void AddImageOptions();
+  void AddImageSourceOptions();
   void AddExtractionOptions();
   void AddMatchingOptions();
   void AddExhaustiveMatchingOptions();
@@ -75,6 +78,7 @@ class OptionManager {
   void AddTransitiveMatchingOptions();
   void AddBundleAdjustmentOptions();
   void AddMapperOptions();
+  void AddPostprocessorOptions();
   void AddDenseStereoOptions();
   void AddDenseFusionOptions();
   void AddDenseMeshingOptions();
@@ -101,6 +105,7 @@ class OptionManager {
   std::shared_ptr<std::string> database_path;
   std::shared_ptr<std::string> image_path;
 
+  std::shared_ptr<ImageSourceOptions> image_source;
   std::shared_ptr<ImageReaderOptions> image_reader;
   std::shared_ptr<SiftExtractionOptions> sift_extraction;
 
@@ -113,6 +118,7 @@ class OptionManager {
 
   std::shared_ptr<BundleAdjustmentOptions> bundle_adjustment;
   std::shared_ptr<IncrementalMapperOptions> mapper;
+  std::shared_ptr<TwoBodyPostprocessorOptions> postprocessor;
 
   std::shared_ptr<mvs::PatchMatchOptions> dense_stereo;
   std::shared_ptr<mvs::StereoFusionOptions> dense_fusion;
@@ -141,6 +147,7 @@ class OptionManager {
   bool added_log_options_;
   bool added_database_options_;
   bool added_image_options_;
+  bool added_image_source_options_;
   bool added_extraction_options_;
   bool added_match_options_;
   bool added_exhaustive_match_options_;
@@ -150,6 +157,7 @@ class OptionManager {
   bool added_transitive_match_options_;
   bool added_ba_options_;
   bool added_mapper_options_;
+  bool added_postprocessor_options_;
   bool added_dense_stereo_options_;
   bool added_dense_fusion_options_;
   bool added_dense_meshing_options_;
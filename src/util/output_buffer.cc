@@ -0,0 +1,217 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/output_buffer.h"
+
+#include <algorithm>
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "util/logging.h"
+#include "util/threading.h"
+
+namespace colmap {
+namespace {
+
+// The powers of ten, which are exactly representable as doubles.
+const double kExactPowersOf10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+const int kMaxExactPowerOf10 = 22;
+
+const int kNumSignificantDigits = 6;
+
+// Format with `printf`, whose decimal point depends on the C locale of the
+// process, e.g. after a GUI application set it from the environment.
+void AppendDoublePrintf(const double value, std::string* data) {
+  char str[32];
+  const int length = std::snprintf(str, sizeof(str), "%g", value);
+  CHECK_GT(length, 0);
+  const char* decimal_point = std::localeconv()->decimal_point;
+  const size_t decimal_point_length = std::strlen(decimal_point);
+  const char* point = nullptr;
+  if (decimal_point_length > 0 &&
+      !(decimal_point_length == 1 && decimal_point[0] == '.')) {
+    point = std::strstr(str, decimal_point);
+  }
+  if (point == nullptr) {
+    data->append(str, length);
+  } else {
+    data->append(str, point - str);
+    data->push_back('.');
+    data->append(point + decimal_point_length);
+  }
+}
+
+// Compute the decimal digits of `abs_value` rounded to the significant
+// digits and the decimal exponent of the first digit. Returns false if the
+// value is too small or too large or too close to the midpoint between two
+// roundings, for which the scaling below is not guaranteed to be exact.
+bool ComputeDecimalDigits(const double abs_value, uint64_t* digits,
+                          int* exponent) {
+  *exponent = static_cast<int>(std::floor(std::log10(abs_value)));
+
+  // The logarithm can be off by one close to powers of ten.
+  for (int i = 0; i < 3; ++i) {
+    const int shift = kNumSignificantDigits - 1 - *exponent;
+    if (std::abs(shift) > kMaxExactPowerOf10) {
+      return false;
+    }
+
+    // A single rounding error, which is far below the checked margin.
+    const double scaled_value = shift >= 0
+                                    ? abs_value * kExactPowersOf10[shift]
+                                    : abs_value / kExactPowersOf10[-shift];
+    const double fraction = scaled_value - std::floor(scaled_value);
+    if (std::abs(fraction - 0.5) < 1e-6) {
+      return false;
+    }
+
+    *digits = static_cast<uint64_t>(std::floor(scaled_value + 0.5));
+    if (*digits < 100000) {
+      *exponent -= 1;
+    } else if (*digits >= 1000000) {
+      if (scaled_value < 1000000) {
+        // Rounded up to the next power of ten.
+        *digits = 100000;
+        *exponent += 1;
+        return true;
+      }
+      *exponent += 1;
+    } else {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+}  // namespace
+
+void OutputBuffer::AppendInt(const int64_t value) {
+  if (value < 0) {
+    data_.push_back('-');
+    // Negate in unsigned arithmetic, which is defined for the minimum value.
+    AppendUInt(~static_cast<uint64_t>(value) + 1);
+  } else {
+    AppendUInt(static_cast<uint64_t>(value));
+  }
+}
+
+void OutputBuffer::AppendUInt(uint64_t value) {
+  char str[20];
+  int length = 0;
+  do {
+    str[sizeof(str) - 1 - length] = static_cast<char>('0' + value % 10);
+    value /= 10;
+    length += 1;
+  } while (value > 0);
+  data_.append(str + sizeof(str) - length, length);
+}
+
+void OutputBuffer::AppendDouble(const double value) {
+  if (value == 0) {
+    data_.append(std::signbit(value) ? "-0" : "0");
+    return;
+  }
+
+  uint64_t digits;
+  int exponent;
+  if (!std::isfinite(value) ||
+      !ComputeDecimalDigits(std::abs(value), &digits, &exponent)) {
+    AppendDoublePrintf(value, &data_);
+    return;
+  }
+
+  char digit_str[kNumSignificantDigits];
+  for (int i = kNumSignificantDigits - 1; i >= 0; --i) {
+    digit_str[i] = static_cast<char>('0' + digits % 10);
+    digits /= 10;
+  }
+  int num_digits = kNumSignificantDigits;
+  while (num_digits > 1 && digit_str[num_digits - 1] == '0') {
+    num_digits -= 1;
+  }
+
+  if (value < 0) {
+    data_.push_back('-');
+  }
+
+  if (exponent < -4 || exponent >= kNumSignificantDigits) {
+    data_.push_back(digit_str[0]);
+    if (num_digits > 1) {
+      data_.push_back('.');
+      data_.append(digit_str + 1, num_digits - 1);
+    }
+    data_.push_back('e');
+    data_.push_back(exponent < 0 ? '-' : '+');
+    if (std::abs(exponent) < 10) {
+      data_.push_back('0');
+    }
+    AppendUInt(static_cast<uint64_t>(std::abs(exponent)));
+  } else if (exponent < 0) {
+    data_.append("0.");
+    data_.append(-exponent - 1, '0');
+    data_.append(digit_str, num_digits);
+  } else {
+    const int num_integer_digits = exponent + 1;
+    data_.append(digit_str, num_integer_digits);
+    if (num_digits > num_integer_digits) {
+      data_.push_back('.');
+      data_.append(digit_str + num_integer_digits,
+                   num_digits - num_integer_digits);
+    }
+  }
+}
+
+void OutputBuffer::PopBack() {
+  CHECK(!data_.empty());
+  data_.pop_back();
+}
+
+void WriteParallel(
+    const size_t num_items, const size_t chunk_size,
+    const std::function<void(size_t, size_t, OutputBuffer*)>& format,
+    std::ostream* stream) {
+  CHECK_GT(chunk_size, 0);
+
+  const size_t num_chunks = (num_items + chunk_size - 1) / chunk_size;
+  const size_t kMaxNumBufferedChunks =
+      2 * std::max<size_t>(1, TaskScheduler::Global().NumThreads());
+  std::vector<OutputBuffer> buffers(
+      std::min(num_chunks, kMaxNumBufferedChunks));
+
+  for (size_t batch_begin = 0; batch_begin < num_chunks;
+       batch_begin += buffers.size()) {
+    const int num_batch_chunks =
+        static_cast<int>(std::min(num_chunks - batch_begin, buffers.size()));
+    ParallelFor(0, num_batch_chunks, [&](const int i) {
+      const size_t begin = (batch_begin + i) * chunk_size;
+      const size_t end = std::min(num_items, begin + chunk_size);
+      buffers[i].Clear();
+      format(begin, end, &buffers[i]);
+    });
+
+    for (int i = 0; i < num_batch_chunks; ++i) {
+      stream->write(buffers[i].Data().data(), buffers[i].Size());
+    }
+  }
+}
+
+}  // namespace colmap
@@ -0,0 +1,87 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_OUTPUT_BUFFER_H_
+#define COLMAP_SRC_UTIL_OUTPUT_BUFFER_H_
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+
+#include "util/endian.h"
+
+namespace colmap {
+
+// Growable buffer, into which text and little endian binary data is
+// formatted without the overhead of `std::ostream`. Numbers are formatted as
+// `std::ostream` with its default flags in the classic locale formats them,
+// so that files written from the buffer are identical to files written with
+// a stream.
+class OutputBuffer {
+ public:
+  void Reserve(const size_t num_bytes) { data_.reserve(num_bytes); }
+  void Clear() { data_.clear(); }
+
+  size_t Size() const { return data_.size(); }
+  const std::string& Data() const { return data_; }
+
+  void Append(const char c) { data_.push_back(c); }
+  void Append(const std::string& str) { data_.append(str); }
+  void Append(const char* str) { data_.append(str); }
+
+  // Text formatting of numbers.
+  void AppendInt(const int64_t value);
+  void AppendUInt(const uint64_t value);
+
+  // Formatted with 6 significant digits as `%g` in the classic locale.
+  void AppendDouble(const double value);
+
+  // Remove the last character, e.g. the separator after the last value.
+  void PopBack();
+
+  // Append the little endian representation of `value`.
+  template <typename T>
+  void AppendBinary(const T& value);
+
+ private:
+  std::string data_;
+};
+
+// Format the items [0, num_items) into buffers of `chunk_size` items in
+// parallel and write the buffers to the stream in the order of the items. The
+// callback `format(begin, end, buffer)` appends the items [begin, end) to the
+// buffer and is called concurrently for different chunks. Only a few chunks
+// per thread are held in memory at a time and every chunk is written to the
+// stream with a single call.
+void WriteParallel(
+    const size_t num_items, const size_t chunk_size,
+    const std::function<void(size_t, size_t, OutputBuffer*)>& format,
+    std::ostream* stream);
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+void OutputBuffer::AppendBinary(const T& value) {
+  const T value_little_endian = NativeToLittleEndian(value);
+  data_.append(reinterpret_cast<const char*>(&value_little_endian), sizeof(T));
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_OUTPUT_BUFFER_H_
@@ -0,0 +1,135 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/output_buffer"
+#include "util/testing.h"
+
+#include <cmath>
+#include <limits>
+#include <sstream>
+
+#include "util/output_buffer.h"
+#include "util/random.h"
+
+using namespace colmap;
+
+namespace {
+
+std::string StreamFormat(const double value) {
+  std::ostringstream stream;
+  stream << value;
+  return stream.str();
+}
+
+std::string BufferFormat(const double value) {
+  OutputBuffer buffer;
+  buffer.AppendDouble(value);
+  return buffer.Data();
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestAppendInt) {
+  OutputBuffer buffer;
+  buffer.AppendInt(0);
+  buffer.Append(' ');
+  buffer.AppendInt(-1);
+  buffer.Append(' ');
+  buffer.AppendInt(std::numeric_limits<int64_t>::min());
+  buffer.Append(' ');
+  buffer.AppendUInt(std::numeric_limits<uint64_t>::max());
+  buffer.Append(' ');
+  buffer.PopBack();
+  BOOST_CHECK_EQUAL(buffer.Data(),
+                    "0 -1 -9223372036854775808 18446744073709551615");
+}
+
+BOOST_AUTO_TEST_CASE(TestAppendDoubleSpecial) {
+  const double kValues[] = {0.0,
+                            -0.0,
+                            1.0,
+                            -1.0,
+                            0.5,
+                            0.1,
+                            0.0001,
+                            0.00001,
+                            123456,
+                            1234567,
+                            999999.5,
+                            999999.4,
+                            99999.96,
+                            9.999995,
+                            1e100,
+                            -1e-100,
+                            1e300,
+                            4.9e-324,
+                            std::numeric_limits<double>::max(),
+                            std::numeric_limits<double>::infinity(),
+                            -std::numeric_limits<double>::infinity(),
+                            std::numeric_limits<double>::quiet_NaN()};
+  for (const double value : kValues) {
+    BOOST_CHECK_EQUAL(BufferFormat(value), StreamFormat(value));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestAppendDoubleRandom) {
+  SetPRNGSeed(0);
+  for (int i = 0; i < 100000; ++i) {
+    const double value =
+        RandomReal(-1.0, 1.0) * std::pow(10.0, RandomInteger(-30, 30));
+    BOOST_CHECK_EQUAL(BufferFormat(value), StreamFormat(value));
+    // Values with few decimal digits, which are close to ties.
+    const double rounded_value =
+        RandomInteger(-2000000, 2000000) / std::pow(10.0, RandomInteger(0, 8));
+    BOOST_CHECK_EQUAL(BufferFormat(rounded_value), StreamFormat(rounded_value));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestAppendBinary) {
+  OutputBuffer buffer;
+  buffer.AppendBinary<uint32_t>(1);
+  buffer.AppendBinary<double>(0.5);
+  BOOST_REQUIRE_EQUAL(buffer.Size(), 12);
+  BOOST_CHECK_EQUAL(buffer.Data()[0], 1);
+  BOOST_CHECK_EQUAL(buffer.Data()[1], 0);
+  buffer.Clear();
+  BOOST_CHECK_EQUAL(buffer.Size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestWriteParallel) {
+  for (const size_t num_items : {0, 1, 7, 1000}) {
+    for (const size_t chunk_size : {1, 3, 2000}) {
+      std::ostringstream expected_stream;
+      for (size_t i = 0; i < num_items; ++i) {
+        expected_stream << i << " " << i * 0.1 << "\n";
+      }
+
+      std::ostringstream stream;
+      WriteParallel(num_items, chunk_size,
+                    [](const size_t begin, const size_t end,
+                       OutputBuffer* buffer) {
+                      for (size_t i = begin; i < end; ++i) {
+                        buffer->AppendUInt(i);
+                        buffer->Append(' ');
+                        buffer->AppendDouble(i * 0.1);
+                        buffer->Append('\n');
+                      }
+                    },
+                    &stream);
+      BOOST_CHECK_EQUAL(stream.str(), expected_stream.str());
+    }
+  }
+}
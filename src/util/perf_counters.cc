@@ -0,0 +1,337 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/perf_counters.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "util/logging.h"
+#include "util/string.h"
+
+namespace colmap {
+namespace internal {
+
+std::atomic<bool> perf_counters_enabled(false);
+
+}  // namespace internal
+
+namespace {
+
+using internal::kNumPerfCounters;
+
+// The counts of the calls of a scope.
+struct ScopeCounts {
+  ScopeCounts() {
+    for (int i = 0; i < kNumPerfCounters; ++i) {
+      values[i] = 0;
+      available[i] = false;
+    }
+  }
+
+  void Add(const ScopeCounts& other) {
+    num_calls += other.num_calls;
+    for (int i = 0; i < kNumPerfCounters; ++i) {
+      values[i] += other.values[i];
+      available[i] = available[i] || other.available[i];
+    }
+  }
+
+  size_t num_calls = 0;
+  int64_t values[kNumPerfCounters];
+  bool available[kNumPerfCounters];
+};
+
+// The counters and the counts of a thread. The counters are closed and the
+// counts are kept by the registry, once the thread exits.
+class ThreadPerfCounters {
+ public:
+  ThreadPerfCounters();
+  ~ThreadPerfCounters();
+
+  bool Read(int64_t values[kNumPerfCounters]);
+  void Record(const char* name, const int64_t begin_values[kNumPerfCounters],
+              const int64_t end_values[kNumPerfCounters]);
+
+  void CollectCounts(std::map<std::string, ScopeCounts>* counts);
+  void ClearCounts();
+
+ private:
+  void Open();
+
+  bool opened_;
+  // The first opened counter, which leads the group of all counters, such
+  // that they are read at once.
+  int group_fd_;
+  int fds_[kNumPerfCounters];
+  // The index of every counter in the values of the group or -1, if the
+  // counter is not available.
+  int value_idxs_[kNumPerfCounters];
+  int num_values_;
+
+  std::mutex mutex_;
+  // The counts by the names of the scopes, which have static storage.
+  std::unordered_map<const char*, ScopeCounts> counts_;
+};
+
+struct PerfCounterRegistry {
+  std::mutex mutex;
+  std::vector<ThreadPerfCounters*> threads;
+  // The counts of the threads that have exited.
+  std::map<std::string, ScopeCounts> exited_counts;
+};
+
+PerfCounterRegistry& GetPerfCounterRegistry() {
+  static PerfCounterRegistry registry;
+  return registry;
+}
+
+ThreadPerfCounters::ThreadPerfCounters()
+    : opened_(false), group_fd_(-1), num_values_(0) {
+  for (int i = 0; i < kNumPerfCounters; ++i) {
+    fds_[i] = -1;
+    value_idxs_[i] = -1;
+  }
+  PerfCounterRegistry& registry = GetPerfCounterRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  registry.threads.push_back(this);
+}
+
+ThreadPerfCounters::~ThreadPerfCounters() {
+#ifdef __linux__
+  for (int i = 0; i < kNumPerfCounters; ++i) {
+    if (fds_[i] >= 0) {
+      close(fds_[i]);
+    }
+  }
+#endif
+  PerfCounterRegistry& registry = GetPerfCounterRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  CollectCounts(&registry.exited_counts);
+  registry.threads.erase(
+      std::find(registry.threads.begin(), registry.threads.end(), this));
+}
+
+void ThreadPerfCounters::Open() {
+  opened_ = true;
+#ifdef __linux__
+  // The cache misses are the misses of the last-level cache on most CPUs.
+  const uint64_t kConfigs[kNumPerfCounters] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+  for (int i = 0; i < kNumPerfCounters; ++i) {
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = kConfigs[i];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    // Count the calling thread on any CPU.
+    const int fd = static_cast<int>(
+        syscall(__NR_perf_event_open, &attr, 0, -1, group_fd_, 0));
+    if (fd < 0) {
+      continue;
+    }
+    if (group_fd_ < 0) {
+      group_fd_ = fd;
+    }
+    fds_[i] = fd;
+    value_idxs_[i] = num_values_;
+    num_values_ += 1;
+  }
+#endif
+}
+
+bool ThreadPerfCounters::Read(int64_t values[kNumPerfCounters]) {
+  if (!opened_) {
+    Open();
+  }
+  if (group_fd_ < 0) {
+    return false;
+  }
+#ifdef __linux__
+  // The group is read as the number of values followed by the values.
+  uint64_t buffer[1 + kNumPerfCounters];
+  const ssize_t num_bytes = read(group_fd_, buffer, sizeof(buffer));
+  if (num_bytes < static_cast<ssize_t>((1 + num_values_) * sizeof(uint64_t))) {
+    return false;
+  }
+  for (int i = 0; i < kNumPerfCounters; ++i) {
+    values[i] = value_idxs_[i] < 0
+                    ? -1
+                    : static_cast<int64_t>(buffer[1 + value_idxs_[i]]);
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void ThreadPerfCounters::Record(const char* name,
+                                const int64_t begin_values[kNumPerfCounters],
+                                const int64_t end_values[kNumPerfCounters]) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ScopeCounts& counts = counts_[name];
+  counts.num_calls += 1;
+  for (int i = 0; i < kNumPerfCounters; ++i) {
+    if (begin_values[i] >= 0 && end_values[i] >= 0) {
+      counts.values[i] += end_values[i] - begin_values[i];
+      counts.available[i] = true;
+    }
+  }
+}
+
+void ThreadPerfCounters::CollectCounts(
+    std::map<std::string, ScopeCounts>* counts) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (const auto& scope_counts : counts_) {
+    (*counts)[scope_counts.first].Add(scope_counts.second);
+  }
+}
+
+void ThreadPerfCounters::ClearCounts() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  counts_.clear();
+}
+
+ThreadPerfCounters& GetThreadPerfCounters() {
+  static thread_local ThreadPerfCounters thread_perf_counters;
+  return thread_perf_counters;
+}
+
+// The ratio of the counts per the given number of instructions or cycles, or
+// -1 if either count is not available.
+double CountRatio(const int64_t count, const int64_t per_count,
+                  const double scale) {
+  if (count < 0 || per_count <= 0) {
+    return -1;
+  }
+  return scale * count / per_count;
+}
+
+}  // namespace
+
+namespace internal {
+
+bool ReadPerfCounters(int64_t values[kNumPerfCounters]) {
+  return GetThreadPerfCounters().Read(values);
+}
+
+void RecordPerfCounters(const char* name,
+                        const int64_t begin_values[kNumPerfCounters],
+                        const int64_t end_values[kNumPerfCounters]) {
+  GetThreadPerfCounters().Record(name, begin_values, end_values);
+}
+
+}  // namespace internal
+
+double PerfCounterStats::IPC() const {
+  return CountRatio(instructions, cycles, 1);
+}
+
+double PerfCounterStats::LLCMissesPerKiloInstruction() const {
+  return CountRatio(llc_misses, instructions, 1000);
+}
+
+double PerfCounterStats::BranchMissesPerKiloInstruction() const {
+  return CountRatio(branch_misses, instructions, 1000);
+}
+
+bool EnablePerfCounters() {
+  int64_t values[kNumPerfCounters];
+  if (!internal::ReadPerfCounters(values)) {
+    return false;
+  }
+  internal::perf_counters_enabled.store(true);
+  return true;
+}
+
+void DisablePerfCounters() { internal::perf_counters_enabled.store(false); }
+
+void ClearPerfCounters() {
+  PerfCounterRegistry& registry = GetPerfCounterRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  registry.exited_counts.clear();
+  for (auto thread : registry.threads) {
+    thread->ClearCounts();
+  }
+}
+
+std::vector<PerfCounterStats> GetPerfCounterStats() {
+  std::map<std::string, ScopeCounts> counts;
+  {
+    PerfCounterRegistry& registry = GetPerfCounterRegistry();
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    counts = registry.exited_counts;
+    for (auto thread : registry.threads) {
+      thread->CollectCounts(&counts);
+    }
+  }
+
+  std::vector<PerfCounterStats> stats;
+  stats.reserve(counts.size());
+  for (const auto& scope_counts : counts) {
+    stats.emplace_back();
+    PerfCounterStats& scope_stats = stats.back();
+    scope_stats.name = scope_counts.first;
+    scope_stats.num_calls = scope_counts.second.num_calls;
+    int64_t* values[kNumPerfCounters] = {
+        &scope_stats.cycles, &scope_stats.instructions,
+        &scope_stats.llc_misses, &scope_stats.branch_misses};
+    for (int i = 0; i < kNumPerfCounters; ++i) {
+      *values[i] = scope_counts.second.available[i]
+                       ? scope_counts.second.values[i]
+                       : -1;
+    }
+  }
+
+  return stats;
+}
+
+std::string PerfCounterStatsToJSON(const std::vector<PerfCounterStats>& stats) {
+  std::string json = "[";
+  for (size_t i = 0; i < stats.size(); ++i) {
+    json += i == 0 ? "\n" : ",\n";
+    json += StringPrintf(
+        "{\"name\":\"%s\",\"num_calls\":%lld,\"cycles\":%lld,"
+        "\"instructions\":%lld,\"llc_misses\":%lld,\"branch_misses\":%lld,"
+        "\"ipc\":%.4f,\"llc_misses_per_kilo_instruction\":%.4f,"
+        "\"branch_misses_per_kilo_instruction\":%.4f}",
+        StringEscapeJSON(stats[i].name).c_str(),
+        static_cast<long long>(stats[i].num_calls),
+        static_cast<long long>(stats[i].cycles),
+        static_cast<long long>(stats[i].instructions),
+        static_cast<long long>(stats[i].llc_misses),
+        static_cast<long long>(stats[i].branch_misses), stats[i].IPC(),
+        stats[i].LLCMissesPerKiloInstruction(),
+        stats[i].BranchMissesPerKiloInstruction());
+  }
+  json += "\n]";
+  return json;
+}
+
+}  // namespace colmap
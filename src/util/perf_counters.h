@@ -0,0 +1,109 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_PERF_COUNTERS_H_
+#define COLMAP_SRC_UTIL_PERF_COUNTERS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace colmap {
+
+// Hardware performance counters of the trace scopes, e.g. to find out whether
+// a kernel is compute- or memory-bound. While the counters are enabled, every
+// `TRACE_SCOPE` reads the cycles, instructions, last-level cache misses and
+// branch misses of its thread at its begin and end, and the counts are
+// accumulated per scope name. The counts of a scope include the ones of its
+// nested scopes, but not the work that it hands to other threads.
+//
+// The counters are opened per thread with `perf_event_open` on Linux, where
+// the kernel may restrict them, see /proc/sys/kernel/perf_event_paranoid, and
+// they are not available on other platforms. Reading them costs a system call
+// at the begin and end of every scope, so they should only be enabled for
+// profiling. While they are disabled, a scope costs a single relaxed atomic
+// load.
+//
+// Example usage:
+//
+//    if (EnablePerfCounters()) {
+//      {
+//        TRACE_SCOPE("KMeans");
+//        ...
+//      }
+//      for (const auto& stats : GetPerfCounterStats()) {
+//        std::cout << stats.name << ": " << stats.IPC() << std::endl;
+//      }
+//    }
+//
+struct PerfCounterStats {
+  std::string name;
+  size_t num_calls = 0;
+  // The accumulated counts of all calls, which are -1 if the counter was not
+  // available in any of the calls.
+  int64_t cycles = 0;
+  int64_t instructions = 0;
+  int64_t llc_misses = 0;
+  int64_t branch_misses = 0;
+
+  // Instructions per cycle and misses per thousand instructions, which are -1
+  // if their counters are not available.
+  double IPC() const;
+  double LLCMissesPerKiloInstruction() const;
+  double BranchMissesPerKiloInstruction() const;
+};
+
+// Enable the counters, if they can be opened for the calling thread, and
+// return whether they are enabled.
+bool EnablePerfCounters();
+void DisablePerfCounters();
+
+// Discard the accumulated counts.
+void ClearPerfCounters();
+
+// The accumulated counts of all threads, including threads that have already
+// exited, in the order of the scope names.
+std::vector<PerfCounterStats> GetPerfCounterStats();
+
+// Write the accumulated counts as a JSON array.
+std::string PerfCounterStatsToJSON(const std::vector<PerfCounterStats>& stats);
+
+namespace internal {
+
+const int kNumPerfCounters = 4;
+
+extern std::atomic<bool> perf_counters_enabled;
+
+// Read the counters of the calling thread, which are opened on the first call,
+// and return false if none of them is available. Unavailable counters are -1.
+bool ReadPerfCounters(int64_t values[kNumPerfCounters]);
+
+// Accumulate the counts of a call of the named scope, whose name must have
+// static storage duration.
+void RecordPerfCounters(const char* name,
+                        const int64_t begin_values[kNumPerfCounters],
+                        const int64_t end_values[kNumPerfCounters]);
+
+}  // namespace internal
+
+inline bool ArePerfCountersEnabled() {
+  return internal::perf_counters_enabled.load(std::memory_order_relaxed);
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_PERF_COUNTERS_H_
@@ -0,0 +1,130 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/perf_counters"
+#include "util/testing.h"
+
+#include <thread>
+
+#include "util/perf_counters.h"
+#include "util/trace.h"
+
+using namespace colmap;
+
+namespace {
+
+// Some work, whose instructions are counted.
+double Work() {
+  volatile double sum = 0;
+  for (int i = 0; i < 100000; ++i) {
+    sum = sum + i * 0.5;
+  }
+  return sum;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestDisabled) {
+  DisablePerfCounters();
+  ClearPerfCounters();
+  BOOST_CHECK(!ArePerfCountersEnabled());
+  {
+    TraceScope scope("Disabled");
+    Work();
+  }
+  BOOST_CHECK_EQUAL(GetPerfCounterStats().size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestScopes) {
+  ClearPerfCounters();
+  if (!EnablePerfCounters()) {
+    BOOST_TEST_MESSAGE("Performance counters are not available");
+    BOOST_CHECK(!ArePerfCountersEnabled());
+    return;
+  }
+
+  BOOST_CHECK(ArePerfCountersEnabled());
+  for (int i = 0; i < 2; ++i) {
+    TraceScope outer_scope("Outer");
+    Work();
+    {
+      TraceScope inner_scope("Inner");
+      Work();
+    }
+  }
+  std::thread thread([]() {
+    TraceScope scope("Thread");
+    Work();
+  });
+  thread.join();
+  DisablePerfCounters();
+
+  const std::vector<PerfCounterStats> stats = GetPerfCounterStats();
+  BOOST_CHECK_EQUAL(stats.size(), 3);
+  BOOST_CHECK_EQUAL(stats[0].name, "Inner");
+  BOOST_CHECK_EQUAL(stats[1].name, "Outer");
+  BOOST_CHECK_EQUAL(stats[2].name, "Thread");
+  BOOST_CHECK_EQUAL(stats[0].num_calls, 2);
+  BOOST_CHECK_EQUAL(stats[1].num_calls, 2);
+  BOOST_CHECK_EQUAL(stats[2].num_calls, 1);
+  if (stats[0].instructions >= 0) {
+    BOOST_CHECK_GT(stats[0].instructions, 0);
+    // The outer scopes include the inner scopes.
+    BOOST_CHECK_GT(stats[1].instructions, stats[0].instructions);
+    BOOST_CHECK_GT(stats[2].instructions, 0);
+  }
+
+  ClearPerfCounters();
+  BOOST_CHECK_EQUAL(GetPerfCounterStats().size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestRatios) {
+  PerfCounterStats stats;
+  stats.cycles = 2000;
+  stats.instructions = 4000;
+  stats.llc_misses = 8;
+  stats.branch_misses = 20;
+  BOOST_CHECK_EQUAL(stats.IPC(), 2);
+  BOOST_CHECK_EQUAL(stats.LLCMissesPerKiloInstruction(), 2);
+  BOOST_CHECK_EQUAL(stats.BranchMissesPerKiloInstruction(), 5);
+
+  stats.cycles = -1;
+  stats.llc_misses = -1;
+  BOOST_CHECK_EQUAL(stats.IPC(), -1);
+  BOOST_CHECK_EQUAL(stats.LLCMissesPerKiloInstruction(), -1);
+  BOOST_CHECK_EQUAL(stats.BranchMissesPerKiloInstruction(), 5);
+
+  stats.instructions = -1;
+  BOOST_CHECK_EQUAL(stats.BranchMissesPerKiloInstruction(), -1);
+}
+
+BOOST_AUTO_TEST_CASE(TestJSON) {
+  BOOST_CHECK_EQUAL(PerfCounterStatsToJSON({}), "[\n]");
+
+  PerfCounterStats stats;
+  stats.name = "Scope";
+  stats.num_calls = 3;
+  stats.cycles = 100;
+  stats.instructions = 200;
+  stats.llc_misses = -1;
+  stats.branch_misses = 2;
+  BOOST_CHECK_EQUAL(
+      PerfCounterStatsToJSON({stats}),
+      "[\n{\"name\":\"Scope\",\"num_calls\":3,\"cycles\":100,"
+      "\"instructions\":200,\"llc_misses\":-1,\"branch_misses\":2,"
+      "\"ipc\":2.0000,\"llc_misses_per_kilo_instruction\":-1.0000,"
+      "\"branch_misses_per_kilo_instruction\":10.0000}\n]");
+}
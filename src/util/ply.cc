@@ -16,23 +16,24 @@
 
 #include "util/ply.h"
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
 
 #include <Eigen/Core>
 
 #include "util/logging.h"
+#include "util/mapped_file.h"
 #include "util/misc.h"
 
 namespace colmap {
+namespace {
 
-std::vector<PlyPoint> ReadPly(const std::string& path) {
-  std::ifstream file(path, std::ios::binary);
-  CHECK(file.is_open()) << path;
-
-  std::vector<PlyPoint> points;
-
-  std::string line;
+// The number of points that are packed into a buffer before writing it.
+const size_t kNumPointsPerWrite = 1 << 16;
 
+struct PlyHeader {
   // The index of the property for ASCII PLY files.
   int X_index = -1;
   int Y_index = -1;
@@ -55,14 +56,32 @@ std::vector<PlyPoint> ReadPly(const std::string& path) {
   int G_byte_pos = -1;
   int B_byte_pos = -1;
 
-  bool in_vertex_section = false;
   bool is_binary = false;
   bool is_little_endian = false;
   size_t num_bytes_per_line = 0;
   size_t num_vertices = 0;
 
+  // The position in number of bytes of the first vertex.
+  size_t data_pos = 0;
+
+  bool IsNormalMissing() const {
+    return NX_index == -1 || NY_index == -1 || NZ_index == -1;
+  }
+
+  bool IsRGBMissing() const {
+    return R_index == -1 || G_index == -1 || B_index == -1;
+  }
+};
+
+PlyHeader ReadPlyHeader(std::ifstream* file) {
+  PlyHeader header;
+
+  std::string line;
+
+  bool in_vertex_section = false;
+
   int index = 0;
-  while (std::getline(file, line)) {
+  while (std::getline(*file, line)) {
     StringTrim(&line);
 
     if (line.empty()) {
@@ -75,13 +94,13 @@ std::vector<PlyPoint> ReadPly(const std::string& path) {
 
     if (line.size() >= 6 && line.substr(0, 6) == "format") {
       if (line == "format ascii 1.0") {
-        is_binary = false;
+        header.is_binary = false;
       } else if (line == "format binary_little_endian 1.0") {
-        is_binary = true;
-        is_little_endian = true;
+        header.is_binary = true;
+        header.is_little_endian = true;
       } else if (line == "format binary_big_endian 1.0") {
-        is_binary = true;
-        is_little_endian = false;
+        header.is_binary = true;
+        header.is_little_endian = false;
       }
     }
 
@@ -90,7 +109,7 @@ std::vector<PlyPoint> ReadPly(const std::string& path) {
     if (line_elems.size() >= 3 && line_elems[0] == "element") {
       in_vertex_section = false;
       if (line_elems[1] == "vertex") {
-        num_vertices = std::stoll(line_elems[2]);
+        header.num_vertices = std::stoll(line_elems[2]);
         in_vertex_section = true;
       } else if (std::stoll(line_elems[2]) > 0) {
         LOG(FATAL) << "Only vertex elements supported";
@@ -108,164 +127,268 @@ std::vector<PlyPoint> ReadPly(const std::string& path) {
             line_elems[1] == "uchar")
           << "PLY import only supports the float and uchar data types";
 
+      const int byte_pos = static_cast<int>(header.num_bytes_per_line);
       if (line == "property float x" || line == "property float32 x") {
-        X_index = index;
-        X_byte_pos = num_bytes_per_line;
+        header.X_index = index;
+        header.X_byte_pos = byte_pos;
       } else if (line == "property float y" || line == "property float32 y") {
-        Y_index = index;
-        Y_byte_pos = num_bytes_per_line;
+        header.Y_index = index;
+        header.Y_byte_pos = byte_pos;
       } else if (line == "property float z" || line == "property float32 z") {
-        Z_index = index;
-        Z_byte_pos = num_bytes_per_line;
+        header.Z_index = index;
+        header.Z_byte_pos = byte_pos;
       } else if (line == "property float nx" || line == "property float32 nx") {
-        NX_index = index;
-        NX_byte_pos = num_bytes_per_line;
+        header.NX_index = index;
+        header.NX_byte_pos = byte_pos;
       } else if (line == "property float ny" || line == "property float32 ny") {
-        NY_index = index;
-        NY_byte_pos = num_bytes_per_line;
+        header.NY_index = index;
+        header.NY_byte_pos = byte_pos;
       } else if (line == "property float nz" || line == "property float32 nz") {
-        NZ_index = index;
-        NZ_byte_pos = num_bytes_per_line;
+        header.NZ_index = index;
+        header.NZ_byte_pos = byte_pos;
       } else if (line == "property uchar r" || line == "property uchar red" ||
                  line == "property uchar diffuse_red" ||
                  line == "property uchar ambient_red" ||
                  line == "property uchar specular_red") {
-        R_index = index;
-        R_byte_pos = num_bytes_per_line;
+        header.R_index = index;
+        header.R_byte_pos = byte_pos;
       } else if (line == "property uchar g" || line == "property uchar green" ||
                  line == "property uchar diffuse_green" ||
                  line == "property uchar ambient_green" ||
                  line == "property uchar specular_green") {
-        G_index = index;
-        G_byte_pos = num_bytes_per_line;
+        header.G_index = index;
+        header.G_byte_pos = byte_pos;
       } else if (line == "property uchar b" || line == "property uchar blue" ||
                  line == "property uchar diffuse_blue" ||
                  line == "property uchar ambient_blue" ||
                  line == "property uchar specular_blue") {
-        B_index = index;
-        B_byte_pos = num_bytes_per_line;
+        header.B_index = index;
+        header.B_byte_pos = byte_pos;
       }
 
       index += 1;
       if (line_elems[1] == "float" || line_elems[1] == "float32") {
-        num_bytes_per_line += 4;
+        header.num_bytes_per_line += 4;
       } else if (line_elems[1] == "uchar") {
-        num_bytes_per_line += 1;
+        header.num_bytes_per_line += 1;
       } else {
         LOG(FATAL) << "Invalid data type: " << line_elems[1];
       }
     }
   }
 
-  const bool is_normal_missing =
-      (NX_index == -1) || (NY_index == -1) || (NZ_index == -1);
-  const bool is_rgb_missing =
-      (R_index == -1) || (G_index == -1) || (B_index == -1);
-
-  CHECK(X_index != -1 && Y_index != -1 && Z_index)
+  CHECK(header.X_index != -1 && header.Y_index != -1 && header.Z_index != -1)
       << "Invalid PLY file format: x, y, z properties missing";
 
-  points.reserve(num_vertices);
-
-  if (is_binary) {
-    std::vector<char> buffer(num_bytes_per_line);
-    for (size_t i = 0; i < num_vertices; ++i) {
-      file.read(buffer.data(), num_bytes_per_line);
-
-      PlyPoint point;
-
-      if (is_little_endian) {
-        point.x = LittleEndianToNative(
-            *reinterpret_cast<float*>(&buffer[X_byte_pos]));
-        point.y = LittleEndianToNative(
-            *reinterpret_cast<float*>(&buffer[Y_byte_pos]));
-        point.z = LittleEndianToNative(
-            *reinterpret_cast<float*>(&buffer[Z_byte_pos]));
-
-        if (!is_normal_missing) {
-          point.nx = LittleEndianToNative(
-              *reinterpret_cast<float*>(&buffer[NX_byte_pos]));
-          point.ny = LittleEndianToNative(
-              *reinterpret_cast<float*>(&buffer[NY_byte_pos]));
-          point.nz = LittleEndianToNative(
-              *reinterpret_cast<float*>(&buffer[NZ_byte_pos]));
-        }
-
-        if (!is_rgb_missing) {
-          point.r = LittleEndianToNative(
-              *reinterpret_cast<uint8_t*>(&buffer[R_byte_pos]));
-          point.g = LittleEndianToNative(
-              *reinterpret_cast<uint8_t*>(&buffer[G_byte_pos]));
-          point.b = LittleEndianToNative(
-              *reinterpret_cast<uint8_t*>(&buffer[B_byte_pos]));
-        }
-      } else {
-        point.x =
-            BigEndianToNative(*reinterpret_cast<float*>(&buffer[X_byte_pos]));
-        point.y =
-            BigEndianToNative(*reinterpret_cast<float*>(&buffer[Y_byte_pos]));
-        point.z =
-            BigEndianToNative(*reinterpret_cast<float*>(&buffer[Z_byte_pos]));
-
-        if (!is_normal_missing) {
-          point.nx = BigEndianToNative(
-              *reinterpret_cast<float*>(&buffer[NX_byte_pos]));
-          point.ny = BigEndianToNative(
-              *reinterpret_cast<float*>(&buffer[NY_byte_pos]));
-          point.nz = BigEndianToNative(
-              *reinterpret_cast<float*>(&buffer[NZ_byte_pos]));
-        }
-
-        if (!is_rgb_missing) {
-          point.r = BigEndianToNative(
-              *reinterpret_cast<uint8_t*>(&buffer[R_byte_pos]));
-          point.g = BigEndianToNative(
-              *reinterpret_cast<uint8_t*>(&buffer[G_byte_pos]));
-          point.b = BigEndianToNative(
-              *reinterpret_cast<uint8_t*>(&buffer[B_byte_pos]));
-        }
-      }
+  header.data_pos = static_cast<size_t>(file->tellg());
 
-      points.push_back(point);
-    }
-  } else {
-    while (std::getline(file, line)) {
-      StringTrim(&line);
-      std::stringstream line_stream(line);
-
-      std::string item;
-      std::vector<std::string> items;
-      while (!line_stream.eof()) {
-        std::getline(line_stream, item, ' ');
-        StringTrim(&item);
-        items.push_back(item);
+  return header;
+}
+
+// Copy one property of all vertices from the interleaved rows into a column.
+template <typename T>
+void ReadPlyColumn(const char* data, const PlyHeader& header,
+                   const int byte_pos, std::vector<T>* column) {
+  column->resize(header.num_vertices);
+  const char* src = data + byte_pos;
+  for (size_t i = 0; i < header.num_vertices; ++i) {
+    std::memcpy(&(*column)[i], src, sizeof(T));
+    src += header.num_bytes_per_line;
+  }
+
+  if (header.is_little_endian) {
+    if (!IsLittleEndian()) {
+      for (auto& value : *column) {
+        value = LittleEndianToNative(value);
       }
+    }
+  } else if (!IsBigEndian()) {
+    for (auto& value : *column) {
+      value = BigEndianToNative(value);
+    }
+  }
+}
+
+PlyPointBuffers ReadBinaryPlyData(const std::string& path,
+                                  const PlyHeader& header) {
+  CHECK(header.is_binary) << path;
 
-      PlyPoint point;
+  MappedFile file;
+  CHECK(file.Open(path)) << path;
+  CHECK_GE(file.Size(), header.data_pos) << path;
+  CHECK_GE((file.Size() - header.data_pos) /
+               std::max<size_t>(header.num_bytes_per_line, 1),
+           header.num_vertices)
+      << "Truncated PLY file: " << path;
 
-      point.x = std::stold(items.at(X_index));
-      point.y = std::stold(items.at(Y_index));
-      point.z = std::stold(items.at(Z_index));
+  const char* data = file.Data() + header.data_pos;
 
-      if (!is_normal_missing) {
-        point.nx = std::stold(items.at(NX_index));
-        point.ny = std::stold(items.at(NY_index));
-        point.nz = std::stold(items.at(NZ_index));
+  PlyPointBuffers buffers;
+
+  ReadPlyColumn(data, header, header.X_byte_pos, &buffers.x);
+  ReadPlyColumn(data, header, header.Y_byte_pos, &buffers.y);
+  ReadPlyColumn(data, header, header.Z_byte_pos, &buffers.z);
+
+  if (!header.IsNormalMissing()) {
+    ReadPlyColumn(data, header, header.NX_byte_pos, &buffers.nx);
+    ReadPlyColumn(data, header, header.NY_byte_pos, &buffers.ny);
+    ReadPlyColumn(data, header, header.NZ_byte_pos, &buffers.nz);
+  }
+
+  if (!header.IsRGBMissing()) {
+    ReadPlyColumn(data, header, header.R_byte_pos, &buffers.r);
+    ReadPlyColumn(data, header, header.G_byte_pos, &buffers.g);
+    ReadPlyColumn(data, header, header.B_byte_pos, &buffers.b);
+  }
+
+  return buffers;
+}
+
+template <typename T>
+char* PackBinaryLittleEndian(char* dst, const T value) {
+  const T little_endian_value = NativeToLittleEndian(value);
+  std::memcpy(dst, &little_endian_value, sizeof(T));
+  return dst + sizeof(T);
+}
+
+// Pack the rows of the points into one buffer per chunk of points, so that the
+// stream is not written property by property.
+void WriteBinaryPlyPoints(std::ostream* stream,
+                          const std::vector<PlyPoint>& points,
+                          const bool write_normal, const bool write_rgb) {
+  const size_t num_bytes_per_point =
+      3 * sizeof(float) + (write_normal ? 3 * sizeof(float) : 0) +
+      (write_rgb ? 3 * sizeof(uint8_t) : 0);
+
+  std::vector<char> buffer(
+      std::min(points.size(), kNumPointsPerWrite) * num_bytes_per_point);
+
+  for (size_t begin = 0; begin < points.size(); begin += kNumPointsPerWrite) {
+    const size_t end = std::min(begin + kNumPointsPerWrite, points.size());
+
+    char* dst = buffer.data();
+    for (size_t i = begin; i < end; ++i) {
+      const PlyPoint& point = points[i];
+
+      dst = PackBinaryLittleEndian<float>(dst, point.x);
+      dst = PackBinaryLittleEndian<float>(dst, point.y);
+      dst = PackBinaryLittleEndian<float>(dst, point.z);
+
+      if (write_normal) {
+        dst = PackBinaryLittleEndian<float>(dst, point.nx);
+        dst = PackBinaryLittleEndian<float>(dst, point.ny);
+        dst = PackBinaryLittleEndian<float>(dst, point.nz);
       }
 
-      if (!is_rgb_missing) {
-        point.r = std::stoi(items.at(R_index));
-        point.g = std::stoi(items.at(G_index));
-        point.b = std::stoi(items.at(B_index));
+      if (write_rgb) {
+        dst = PackBinaryLittleEndian<uint8_t>(dst, point.r);
+        dst = PackBinaryLittleEndian<uint8_t>(dst, point.g);
+        dst = PackBinaryLittleEndian<uint8_t>(dst, point.b);
       }
+    }
+
+    stream->write(buffer.data(), dst - buffer.data());
+  }
+}
+
+}  // namespace
+
+size_t PlyPointBuffers::Size() const { return x.size(); }
 
-      points.push_back(point);
+std::vector<PlyPoint> PlyPointBuffers::ToPoints() const {
+  const bool has_normal = !nx.empty();
+  const bool has_rgb = !r.empty();
+
+  std::vector<PlyPoint> points(Size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    PlyPoint& point = points[i];
+
+    point.x = x[i];
+    point.y = y[i];
+    point.z = z[i];
+
+    if (has_normal) {
+      point.nx = nx[i];
+      point.ny = ny[i];
+      point.nz = nz[i];
+    }
+
+    if (has_rgb) {
+      point.r = r[i];
+      point.g = g[i];
+      point.b = b[i];
     }
   }
 
   return points;
 }
 
+std::vector<PlyPoint> ReadPly(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  CHECK(file.is_open()) << path;
+
+  const PlyHeader header = ReadPlyHeader(&file);
+
+  if (header.is_binary) {
+    file.close();
+    return ReadBinaryPlyData(path, header).ToPoints();
+  }
+
+  const bool is_normal_missing = header.IsNormalMissing();
+  const bool is_rgb_missing = header.IsRGBMissing();
+
+  std::vector<PlyPoint> points;
+  points.reserve(header.num_vertices);
+
+  std::string line;
+  while (std::getline(file, line)) {
+    StringTrim(&line);
+    std::stringstream line_stream(line);
+
+    std::string item;
+    std::vector<std::string> items;
+    while (!line_stream.eof()) {
+      std::getline(line_stream, item, ' ');
+      StringTrim(&item);
+      items.push_back(item);
+    }
+
+    PlyPoint point;
+
+    point.x = std::stold(items.at(header.X_index));
+    point.y = std::stold(items.at(header.Y_index));
+    point.z = std::stold(items.at(header.Z_index));
+
+    if (!is_normal_missing) {
+      point.nx = std::stold(items.at(header.NX_index));
+      point.ny = std::stold(items.at(header.NY_index));
+      point.nz = std::stold(items.at(header.NZ_index));
+    }
+
+    if (!is_rgb_missing) {
+      point.r = std::stoi(items.at(header.R_index));
+      point.g = std::stoi(items.at(header.G_index));
+      point.b = std::stoi(items.at(header.B_index));
+    }
+
+    points.push_back(point);
+  }
+
+  return points;
+}
+
+PlyPointBuffers ReadBinaryPlyPoints(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  CHECK(file.is_open()) << path;
+
+  const PlyHeader header = ReadPlyHeader(&file);
+  file.close();
+
+  CHECK(header.is_binary) << "Not a binary PLY file: " << path;
+
+  return ReadBinaryPlyData(path, header);
+}
+
 void WriteTextPly(const std::string& path, const std::vector<PlyPoint>& points,
                   const bool write_normal, const bool write_rgb) {
   std::ofstream file(path);
@@ -314,54 +437,114 @@ void WriteTextPly(const std::string& path, const std::vector<PlyPoint>& points,
 void WriteBinaryPly(const std::string& path,
                     const std::vector<PlyPoint>& points,
                     const bool write_normal, const bool write_rgb) {
-  std::fstream text_file(path, std::ios::out);
-  CHECK(text_file.is_open()) << path;
+  std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  CHECK(file.is_open()) << path;
 
-  text_file << "ply" << std::endl;
-  text_file << "format binary_little_endian 1.0" << std::endl;
-  text_file << "element vertex " << points.size() << std::endl;
+  file << "ply" << std::endl;
+  file << "format binary_little_endian 1.0" << std::endl;
+  file << "element vertex " << points.size() << std::endl;
 
-  text_file << "property float x" << std::endl;
-  text_file << "property float y" << std::endl;
-  text_file << "property float z" << std::endl;
+  file << "property float x" << std::endl;
+  file << "property float y" << std::endl;
+  file << "property float z" << std::endl;
 
   if (write_normal) {
-    text_file << "property float nx" << std::endl;
-    text_file << "property float ny" << std::endl;
-    text_file << "property float nz" << std::endl;
+    file << "property float nx" << std::endl;
+    file << "property float ny" << std::endl;
+    file << "property float nz" << std::endl;
   }
 
   if (write_rgb) {
-    text_file << "property uchar red" << std::endl;
-    text_file << "property uchar green" << std::endl;
-    text_file << "property uchar blue" << std::endl;
+    file << "property uchar red" << std::endl;
+    file << "property uchar green" << std::endl;
+    file << "property uchar blue" << std::endl;
   }
 
-  text_file << "end_header" << std::endl;
-  text_file.close();
+  file << "end_header" << std::endl;
 
-  std::fstream binary_file(path,
-                           std::ios::out | std::ios::binary | std::ios::app);
-  CHECK(binary_file.is_open()) << path;
+  WriteBinaryPlyPoints(&file, points, write_normal, write_rgb);
 
-  for (const auto& point : points) {
-    WriteBinaryLittleEndian<float>(&binary_file, point.x);
-    WriteBinaryLittleEndian<float>(&binary_file, point.y);
-    WriteBinaryLittleEndian<float>(&binary_file, point.z);
+  file.close();
+  CHECK(!file.fail()) << "Could not write " << path;
+}
 
-    if (write_normal) {
-      WriteBinaryLittleEndian<float>(&binary_file, point.nx);
-      WriteBinaryLittleEndian<float>(&binary_file, point.ny);
-      WriteBinaryLittleEndian<float>(&binary_file, point.nz);
-    }
+BinaryPlyWriter::BinaryPlyWriter(const std::string& path,
+                                 const bool write_normal,
+                                 const bool write_rgb)
+    : path_(path),
+      write_normal_(write_normal),
+      write_rgb_(write_rgb),
+      file_(path, std::ios::out | std::ios::binary | std::ios::trunc),
+      num_points_(0) {
+  CHECK(file_.is_open()) << path;
+
+  file_ << "ply" << std::endl;
+  file_ << "format binary_little_endian 1.0" << std::endl;
+  file_ << "element vertex ";
+  num_points_pos_ = file_.tellp();
+  // Padded with spaces to the maximum number of digits of the final count.
+  file_ << std::left << std::setw(20) << 0 << std::endl;
+
+  file_ << "property float x" << std::endl;
+  file_ << "property float y" << std::endl;
+  file_ << "property float z" << std::endl;
+
+  if (write_normal_) {
+    file_ << "property float nx" << std::endl;
+    file_ << "property float ny" << std::endl;
+    file_ << "property float nz" << std::endl;
+  }
 
-    if (write_rgb) {
-      WriteBinaryLittleEndian<uint8_t>(&binary_file, point.r);
-      WriteBinaryLittleEndian<uint8_t>(&binary_file, point.g);
-      WriteBinaryLittleEndian<uint8_t>(&binary_file, point.b);
-    }
+  if (write_rgb_) {
+    file_ << "property uchar red" << std::endl;
+    file_ << "property uchar green" << std::endl;
+    file_ << "property uchar blue" << std::endl;
   }
-  binary_file.close();
+
+  file_ << "end_header" << std::endl;
+}
+
+BinaryPlyWriter::~BinaryPlyWriter() { Close(); }
+
+void BinaryPlyWriter::Write(const PlyPoint& point) {
+  CHECK(file_.is_open()) << path_;
+
+  WriteBinaryLittleEndian<float>(&file_, point.x);
+  WriteBinaryLittleEndian<float>(&file_, point.y);
+  WriteBinaryLittleEndian<float>(&file_, point.z);
+
+  if (write_normal_) {
+    WriteBinaryLittleEndian<float>(&file_, point.nx);
+    WriteBinaryLittleEndian<float>(&file_, point.ny);
+    WriteBinaryLittleEndian<float>(&file_, point.nz);
+  }
+
+  if (write_rgb_) {
+    WriteBinaryLittleEndian<uint8_t>(&file_, point.r);
+    WriteBinaryLittleEndian<uint8_t>(&file_, point.g);
+    WriteBinaryLittleEndian<uint8_t>(&file_, point.b);
+  }
+
+  num_points_ += 1;
+}
+
+void BinaryPlyWriter::Write(const std::vector<PlyPoint>& points) {
+  CHECK(file_.is_open()) << path_;
+  WriteBinaryPlyPoints(&file_, points, write_normal_, write_rgb_);
+  num_points_ += points.size();
+}
+
+size_t BinaryPlyWriter::NumPoints() const { return num_points_; }
+
+void BinaryPlyWriter::Close() {
+  if (!file_.is_open()) {
+    return;
+  }
+
+  file_.seekp(num_points_pos_);
+  file_ << std::left << std::setw(20) << num_points_;
+  file_.close();
+  CHECK(!file_.fail()) << "Could not write " << path_;
 }
 
 }  // namespace colmap
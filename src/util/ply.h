@@ -17,6 +17,7 @@
 #ifndef COLMAP_SRC_UTIL_PLY_H_
 #define COLMAP_SRC_UTIL_PLY_H_
 
+#include <fstream>
 #include <string>
 #include <vector>
 
@@ -34,9 +35,29 @@ struct PlyPoint {
   uint8_t b = 0;
 };
 
+// Point cloud with one contiguous buffer per property. The normal and color
+// buffers are empty, if the properties are missing in the file.
+struct PlyPointBuffers {
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+  std::vector<float> nx;
+  std::vector<float> ny;
+  std::vector<float> nz;
+  std::vector<uint8_t> r;
+  std::vector<uint8_t> g;
+  std::vector<uint8_t> b;
+
+  size_t Size() const;
+  std::vector<PlyPoint> ToPoints() const;
+};
+
 // Read PLY point cloud from text or binary file.
 std::vector<PlyPoint> ReadPly(const std::string& path);
 
+// Read binary PLY point cloud from a memory-mapped file.
+PlyPointBuffers ReadBinaryPlyPoints(const std::string& path);
+
 // Write PLY point cloud to text or binary file.
 void WriteTextPly(const std::string& path, const std::vector<PlyPoint>& points,
                   const bool write_normal = true, const bool write_rgb = true);
@@ -45,6 +66,32 @@ void WriteBinaryPly(const std::string& path,
                     const bool write_normal = true,
                     const bool write_rgb = true);
 
+// Write a binary PLY point cloud incrementally, so that the points do not have
+// to be kept in memory. The header reserves space for the number of points,
+// which is only known and written when the writer is closed.
+class BinaryPlyWriter {
+ public:
+  BinaryPlyWriter(const std::string& path, const bool write_normal = true,
+                  const bool write_rgb = true);
+  ~BinaryPlyWriter();
+
+  void Write(const PlyPoint& point);
+  void Write(const std::vector<PlyPoint>& points);
+
+  size_t NumPoints() const;
+
+  // Write the number of points to the header and close the file.
+  void Close();
+
+ private:
+  const std::string path_;
+  const bool write_normal_;
+  const bool write_rgb_;
+  std::ofstream file_;
+  std::streampos num_points_pos_;
+  size_t num_points_;
+};
+
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_UTIL_PLY_H_
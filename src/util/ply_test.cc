@@ -0,0 +1,135 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/ply"
+#include "util/testing.h"
+
+#include <boost/filesystem.hpp>
+
+#include "util/ply.h"
+
+using namespace colmap;
+
+namespace {
+
+std::string TempPlyPath() {
+  return (boost::filesystem::temp_directory_path() /
+          boost::filesystem::unique_path("ply_test_%%%%%%%%.ply"))
+      .string();
+}
+
+std::vector<PlyPoint> CreatePoints(const size_t num_points) {
+  std::vector<PlyPoint> points(num_points);
+  for (size_t i = 0; i < num_points; ++i) {
+    points[i].x = i;
+    points[i].y = -0.5f * i;
+    points[i].z = 2.0f * i;
+    points[i].nx = 1.0f;
+    points[i].r = static_cast<uint8_t>(i);
+    points[i].b = 255;
+  }
+  return points;
+}
+
+void CheckPointsEqual(const std::vector<PlyPoint>& points1,
+                      const std::vector<PlyPoint>& points2) {
+  BOOST_REQUIRE_EQUAL(points1.size(), points2.size());
+  for (size_t i = 0; i < points1.size(); ++i) {
+    BOOST_CHECK_EQUAL(points1[i].x, points2[i].x);
+    BOOST_CHECK_EQUAL(points1[i].y, points2[i].y);
+    BOOST_CHECK_EQUAL(points1[i].z, points2[i].z);
+    BOOST_CHECK_EQUAL(points1[i].nx, points2[i].nx);
+    BOOST_CHECK_EQUAL(points1[i].ny, points2[i].ny);
+    BOOST_CHECK_EQUAL(points1[i].nz, points2[i].nz);
+    BOOST_CHECK_EQUAL(points1[i].r, points2[i].r);
+    BOOST_CHECK_EQUAL(points1[i].g, points2[i].g);
+    BOOST_CHECK_EQUAL(points1[i].b, points2[i].b);
+  }
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestBinaryPlyWriter) {
+  const std::vector<PlyPoint> points = CreatePoints(100);
+  const std::string path = TempPlyPath();
+
+  {
+    BinaryPlyWriter writer(path);
+    writer.Write(points[0]);
+    writer.Write(std::vector<PlyPoint>(points.begin() + 1, points.end()));
+    BOOST_CHECK_EQUAL(writer.NumPoints(), points.size());
+  }
+
+  CheckPointsEqual(ReadPly(path), points);
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestBinaryPlyWriterEmpty) {
+  const std::string path = TempPlyPath();
+
+  BinaryPlyWriter writer(path);
+  writer.Close();
+  BOOST_CHECK_EQUAL(writer.NumPoints(), 0);
+  BOOST_CHECK(ReadPly(path).empty());
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestWriteBinaryPly) {
+  const std::vector<PlyPoint> points = CreatePoints(10);
+  const std::string path = TempPlyPath();
+
+  WriteBinaryPly(path, points);
+  CheckPointsEqual(ReadPly(path), points);
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestReadBinaryPlyPoints) {
+  // More points than are packed into one write buffer.
+  const std::vector<PlyPoint> points = CreatePoints(100000);
+  const std::string path = TempPlyPath();
+
+  WriteBinaryPly(path, points);
+
+  const PlyPointBuffers buffers = ReadBinaryPlyPoints(path);
+  BOOST_CHECK_EQUAL(buffers.Size(), points.size());
+  BOOST_CHECK_EQUAL(buffers.nx.size(), points.size());
+  BOOST_CHECK_EQUAL(buffers.r.size(), points.size());
+  CheckPointsEqual(buffers.ToPoints(), points);
+
+  WriteBinaryPly(path, points, false, false);
+
+  const PlyPointBuffers buffers_xyz = ReadBinaryPlyPoints(path);
+  BOOST_CHECK_EQUAL(buffers_xyz.Size(), points.size());
+  BOOST_CHECK(buffers_xyz.nx.empty());
+  BOOST_CHECK(buffers_xyz.r.empty());
+  BOOST_CHECK_EQUAL(buffers_xyz.x[7], points[7].x);
+  BOOST_CHECK_EQUAL(buffers_xyz.z.back(), points.back().z);
+
+  boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(TestWriteTextPly) {
+  const std::vector<PlyPoint> points = CreatePoints(10);
+  const std::string path = TempPlyPath();
+
+  WriteTextPly(path, points);
+  CheckPointsEqual(ReadPly(path), points);
+
+  boost::filesystem::remove(path);
+}
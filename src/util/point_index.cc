@@ -0,0 +1,166 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/point_index.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "ext/FLANN/flann.hpp"
+#include "util/logging.h"
+#include "util/threading.h"
+
+namespace colmap {
+namespace {
+
+// The number of queries that are searched by one task.
+const int kQueryBlockSize = 1024;
+
+// The maximum number of points in a leaf of the KD-tree.
+const int kLeafMaxSize = 10;
+
+}  // namespace
+
+class PointIndex::Index
+    : public flann::KDTreeSingleIndex<flann::L2<double>> {
+ public:
+  explicit Index(const flann::Matrix<double>& points)
+      : flann::KDTreeSingleIndex<flann::L2<double>>(
+            points, flann::KDTreeSingleIndexParams(kLeafMaxSize)) {}
+};
+
+PointIndex::PointIndex() {}
+
+PointIndex::PointIndex(const std::vector<Eigen::Vector3d>& points) {
+  coordinates_.reserve(3 * points.size());
+  for (const Eigen::Vector3d& point : points) {
+    coordinates_.push_back(point(0));
+    coordinates_.push_back(point(1));
+    coordinates_.push_back(point(2));
+  }
+  if (!points.empty()) {
+    index_.reset(new Index(
+        flann::Matrix<double>(coordinates_.data(), points.size(), 3)));
+    index_->buildIndex();
+  }
+}
+
+PointIndex::PointIndex(PointIndex&& other) = default;
+
+PointIndex& PointIndex::operator=(PointIndex&& other) = default;
+
+PointIndex::~PointIndex() {}
+
+size_t PointIndex::NumPoints() const { return coordinates_.size() / 3; }
+
+void PointIndex::KnnSearch(const std::vector<Eigen::Vector3d>& queries,
+                           const int k, std::vector<std::vector<int>>* indices,
+                           std::vector<std::vector<double>>* distances,
+                           const int num_threads) const {
+  CHECK_GE(k, 0);
+  CHECK_NOTNULL(indices);
+  CHECK_NOTNULL(distances);
+
+  const int num_queries = static_cast<int>(queries.size());
+  indices->assign(num_queries, std::vector<int>(k, -1));
+  distances->assign(
+      num_queries,
+      std::vector<double>(k, std::numeric_limits<double>::infinity()));
+
+  const size_t knn = std::min(static_cast<size_t>(k), NumPoints());
+  if (knn == 0) {
+    return;
+  }
+
+  const auto SearchBlock = [&](const int begin) {
+    const int end = std::min(begin + kQueryBlockSize, num_queries);
+    std::vector<double> query_coordinates;
+    query_coordinates.reserve(3 * (end - begin));
+    for (int i = begin; i < end; ++i) {
+      query_coordinates.push_back(queries[i](0));
+      query_coordinates.push_back(queries[i](1));
+      query_coordinates.push_back(queries[i](2));
+    }
+    const flann::Matrix<double> query_matrix(query_coordinates.data(),
+                                             end - begin, 3);
+    std::vector<size_t> block_indices(knn * (end - begin));
+    flann::Matrix<size_t> indices_matrix(block_indices.data(), end - begin,
+                                         knn);
+    std::vector<double> block_distances(knn * (end - begin));
+    flann::Matrix<double> distances_matrix(block_distances.data(),
+                                           end - begin, knn);
+    index_->knnSearch(query_matrix, indices_matrix, distances_matrix, knn,
+                      flann::SearchParams(flann::FLANN_CHECKS_UNLIMITED));
+
+    // Recompute the distances as in a brute-force search, which may reorder
+    // neighbors whose squared distances are equal up to rounding.
+    std::vector<std::pair<double, int>> neighbors(knn);
+    for (int i = begin; i < end; ++i) {
+      for (size_t j = 0; j < knn; ++j) {
+        const int idx = static_cast<int>(indices_matrix[i - begin][j]);
+        const Eigen::Vector3d point(coordinates_[3 * idx],
+                                    coordinates_[3 * idx + 1],
+                                    coordinates_[3 * idx + 2]);
+        neighbors[j] = std::make_pair((queries[i] - point).norm(), idx);
+      }
+      std::sort(neighbors.begin(), neighbors.end());
+      for (size_t j = 0; j < knn; ++j) {
+        (*distances)[i][j] = neighbors[j].first;
+        (*indices)[i][j] = neighbors[j].second;
+      }
+    }
+  };
+
+  const int num_blocks = (num_queries + kQueryBlockSize - 1) / kQueryBlockSize;
+  const int num_eff_threads =
+      std::min(GetEffectiveNumThreads(num_threads), num_blocks);
+  if (num_eff_threads > 1) {
+    ThreadPool thread_pool(num_eff_threads);
+    for (int block = 0; block < num_blocks; ++block) {
+      thread_pool.AddTask(SearchBlock, block * kQueryBlockSize);
+    }
+    thread_pool.Wait();
+  } else {
+    for (int block = 0; block < num_blocks; ++block) {
+      SearchBlock(block * kQueryBlockSize);
+    }
+  }
+}
+
+std::vector<double> PointIndex::NearestNeighborDistances(
+    const int num_threads) const {
+  std::vector<Eigen::Vector3d> points(NumPoints());
+  for (size_t i = 0; i < points.size(); ++i) {
+    points[i] = Eigen::Vector3d(coordinates_[3 * i], coordinates_[3 * i + 1],
+                                coordinates_[3 * i + 2]);
+  }
+
+  // The nearest point of a point is usually the point itself, unless there
+  // are duplicates of it, in which case their distance is zero anyway.
+  std::vector<std::vector<int>> indices;
+  std::vector<std::vector<double>> distances;
+  KnnSearch(points, 2, &indices, &distances, num_threads);
+
+  std::vector<double> nearest_distances(points.size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    nearest_distances[i] = indices[i][0] == static_cast<int>(i)
+                               ? distances[i][1]
+                               : distances[i][0];
+  }
+  return nearest_distances;
+}
+
+}  // namespace colmap
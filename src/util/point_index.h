@@ -0,0 +1,64 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_POINT_INDEX_H_
+#define COLMAP_SRC_UTIL_POINT_INDEX_H_
+
+#include <memory>
+#include <vector>
+
+#include <Eigen/Core>
+
+namespace colmap {
+
+// Exact nearest neighbor search among a fixed set of 3D points with a FLANN
+// KD-tree, which is built once and then queried in batches. The distances are
+// the Euclidean norms of the differences of the points, i.e. the same values
+// as computed by a brute-force loop, and ties are broken by the point index.
+class PointIndex {
+ public:
+  PointIndex();
+  explicit PointIndex(const std::vector<Eigen::Vector3d>& points);
+  PointIndex(PointIndex&& other);
+  PointIndex& operator=(PointIndex&& other);
+  ~PointIndex();
+
+  size_t NumPoints() const;
+
+  // Find the `k` nearest points of every query point in ascending order of
+  // their distance. If there are fewer than `k` points, the missing neighbors
+  // have the index -1 and an infinite distance. The queries are distributed
+  // over `num_threads` threads.
+  void KnnSearch(const std::vector<Eigen::Vector3d>& queries, const int k,
+                 std::vector<std::vector<int>>* indices,
+                 std::vector<std::vector<double>>* distances,
+                 const int num_threads = 1) const;
+
+  // The distance of every indexed point to its nearest other point, or
+  // infinity if there is only one point.
+  std::vector<double> NearestNeighborDistances(
+      const int num_threads = 1) const;
+
+ private:
+  class Index;
+
+  std::vector<double> coordinates_;
+  std::unique_ptr<Index> index_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_POINT_INDEX_H_
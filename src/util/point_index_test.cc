@@ -0,0 +1,115 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/point_index"
+#include "util/testing.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "util/point_index.h"
+
+using namespace colmap;
+
+namespace {
+
+std::vector<Eigen::Vector3d> GridPoints(const int size) {
+  std::vector<Eigen::Vector3d> points;
+  for (int x = 0; x < size; ++x) {
+    for (int y = 0; y < size; ++y) {
+      for (int z = 0; z < size; ++z) {
+        points.emplace_back(x + 0.01 * std::sin(x * y + z), y, 2.0 * z);
+      }
+    }
+  }
+  return points;
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestKnnSearch) {
+  const std::vector<Eigen::Vector3d> points = GridPoints(12);
+  const PointIndex index(points);
+  BOOST_CHECK_EQUAL(index.NumPoints(), points.size());
+
+  std::vector<Eigen::Vector3d> queries;
+  for (int i = 0; i < 3000; ++i) {
+    queries.emplace_back(11 * std::abs(std::sin(i)),
+                         11 * std::abs(std::cos(3 * i)), 22 * std::sin(i) - 1);
+  }
+
+  const int kNumNeighbors = 5;
+  std::vector<std::vector<int>> indices;
+  std::vector<std::vector<double>> distances;
+  index.KnnSearch(queries, kNumNeighbors, &indices, &distances, 3);
+  BOOST_CHECK_EQUAL(indices.size(), queries.size());
+  BOOST_CHECK_EQUAL(distances.size(), queries.size());
+
+  for (size_t i = 0; i < queries.size(); ++i) {
+    std::vector<double> brute_force_distances;
+    for (const Eigen::Vector3d& point : points) {
+      brute_force_distances.push_back((queries[i] - point).norm());
+    }
+    std::sort(brute_force_distances.begin(), brute_force_distances.end());
+    for (int j = 0; j < kNumNeighbors; ++j) {
+      BOOST_CHECK_EQUAL(distances[i][j], brute_force_distances[j]);
+      BOOST_CHECK_EQUAL((queries[i] - points[indices[i][j]]).norm(),
+                        distances[i][j]);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestKnnSearchFewPoints) {
+  const PointIndex index({Eigen::Vector3d(0, 0, 0), Eigen::Vector3d(0, 0, 2)});
+  std::vector<std::vector<int>> indices;
+  std::vector<std::vector<double>> distances;
+  index.KnnSearch({Eigen::Vector3d(0, 0, 1.5)}, 3, &indices, &distances);
+  BOOST_CHECK_EQUAL(indices[0][0], 1);
+  BOOST_CHECK_EQUAL(indices[0][1], 0);
+  BOOST_CHECK_EQUAL(indices[0][2], -1);
+  BOOST_CHECK_EQUAL(distances[0][0], 0.5);
+  BOOST_CHECK_EQUAL(distances[0][1], 1.5);
+  BOOST_CHECK(std::isinf(distances[0][2]));
+
+  const PointIndex empty_index;
+  BOOST_CHECK_EQUAL(empty_index.NumPoints(), 0);
+  empty_index.KnnSearch({Eigen::Vector3d(0, 0, 0)}, 1, &indices, &distances);
+  BOOST_CHECK_EQUAL(indices[0][0], -1);
+  BOOST_CHECK(std::isinf(distances[0][0]));
+}
+
+BOOST_AUTO_TEST_CASE(TestNearestNeighborDistances) {
+  std::vector<Eigen::Vector3d> points = GridPoints(8);
+  points.push_back(points[5]);
+  const PointIndex index(points);
+  const std::vector<double> nearest_distances =
+      index.NearestNeighborDistances(2);
+  BOOST_CHECK_EQUAL(nearest_distances.size(), points.size());
+  for (size_t i = 0; i < points.size(); ++i) {
+    double nearest_distance = std::numeric_limits<double>::infinity();
+    for (size_t j = 0; j < points.size(); ++j) {
+      if (i != j) {
+        nearest_distance =
+            std::min(nearest_distance, (points[i] - points[j]).norm());
+      }
+    }
+    BOOST_CHECK_EQUAL(nearest_distances[i], nearest_distance);
+  }
+  BOOST_CHECK_EQUAL(nearest_distances[5], 0);
+
+  const PointIndex single_index({Eigen::Vector3d(1, 2, 3)});
+  BOOST_CHECK(std::isinf(single_index.NearestNeighborDistances()[0]));
+}
@@ -16,9 +16,96 @@
 
 #include "util/random.h"
 
+#include <atomic>
+
 namespace colmap {
+namespace {
+
+// The multipliers and key increments of the rounds of Philox4x32.
+const uint32_t kPhiloxM0 = 0xD2511F53;
+const uint32_t kPhiloxM1 = 0xCD9E8D57;
+const uint32_t kPhiloxW0 = 0x9E3779B9;
+const uint32_t kPhiloxW1 = 0xBB67AE85;
+const int kPhiloxNumRounds = 10;
+
+inline void MultiplyHiLo(const uint32_t a, const uint32_t b, uint32_t* hi,
+                         uint32_t* lo) {
+  const uint64_t product = static_cast<uint64_t>(a) * b;
+  *hi = static_cast<uint32_t>(product >> 32);
+  *lo = static_cast<uint32_t>(product);
+}
+
+}  // namespace
+
+thread_local Philox4x32* PRNG = nullptr;
+
+namespace {
+
+std::atomic<unsigned> default_prng_seed(kRandomPRNGSeed);
+
+}  // namespace
+
+Philox4x32::Philox4x32(const uint64_t seed, const uint64_t stream)
+    : stream_(stream), block_counter_(0), block_idx_(4) {
+  key_[0] = static_cast<uint32_t>(seed);
+  key_[1] = static_cast<uint32_t>(seed >> 32);
+}
+
+void Philox4x32::Discard(const uint64_t num) {
+  const uint64_t num_in_block = static_cast<uint64_t>(4 - block_idx_);
+  if (num < num_in_block) {
+    block_idx_ += static_cast<int>(num);
+    return;
+  }
+  const uint64_t remaining = num - num_in_block;
+  block_counter_ += remaining / 4;
+  block_idx_ = 4;
+  if (remaining % 4 != 0) {
+    GenerateBlock();
+    block_idx_ = static_cast<int>(remaining % 4);
+  }
+}
+
+uint64_t Philox4x32::Seed() const {
+  return (static_cast<uint64_t>(key_[1]) << 32) | key_[0];
+}
 
-thread_local std::mt19937* PRNG = nullptr;
+uint64_t Philox4x32::Stream() const { return stream_; }
+
+void Philox4x32::Generate(const uint32_t key[2], const uint32_t counter[4],
+                          uint32_t output[4]) {
+  uint32_t k0 = key[0];
+  uint32_t k1 = key[1];
+  uint32_t c0 = counter[0];
+  uint32_t c1 = counter[1];
+  uint32_t c2 = counter[2];
+  uint32_t c3 = counter[3];
+  for (int round = 0; round < kPhiloxNumRounds; ++round) {
+    uint32_t hi0, lo0, hi1, lo1;
+    MultiplyHiLo(kPhiloxM0, c0, &hi0, &lo0);
+    MultiplyHiLo(kPhiloxM1, c2, &hi1, &lo1);
+    c0 = hi1 ^ c1 ^ k0;
+    c1 = lo1;
+    c2 = hi0 ^ c3 ^ k1;
+    c3 = lo0;
+    k0 += kPhiloxW0;
+    k1 += kPhiloxW1;
+  }
+  output[0] = c0;
+  output[1] = c1;
+  output[2] = c2;
+  output[3] = c3;
+}
+
+void Philox4x32::GenerateBlock() {
+  const uint32_t counter[4] = {static_cast<uint32_t>(block_counter_),
+                               static_cast<uint32_t>(block_counter_ >> 32),
+                               static_cast<uint32_t>(stream_),
+                               static_cast<uint32_t>(stream_ >> 32)};
+  Generate(key_, counter, block_);
+  block_counter_ += 1;
+  block_idx_ = 0;
+}
 
 void SetPRNGSeed(unsigned seed) {
   // Overwrite existing PRNG
@@ -26,12 +113,33 @@ void SetPRNGSeed(unsigned seed) {
     delete PRNG;
   }
 
+  if (seed == kRandomPRNGSeed) {
+    seed = default_prng_seed;
+  }
+
   if (seed == kRandomPRNGSeed) {
     seed = static_cast<unsigned>(
         std::chrono::system_clock::now().time_since_epoch().count());
   }
 
-  PRNG = new std::mt19937(seed);
+  PRNG = new Philox4x32(seed);
+}
+
+void SetDefaultPRNGSeed(const unsigned seed) { default_prng_seed = seed; }
+
+ScopedPRNG::ScopedPRNG(const uint64_t seed, const uint64_t stream)
+    : prng_(seed, stream), prev_prng_(PRNG) {
+  PRNG = &prng_;
+}
+
+ScopedPRNG::~ScopedPRNG() { PRNG = prev_prng_; }
+
+void ScopedPRNG::SetStream(const uint64_t stream) {
+  prng_ = Philox4x32(prng_.Seed(), stream);
+}
+
+uint64_t RandomSeed() {
+  return RandomInteger<uint64_t>(0, std::numeric_limits<uint64_t>::max());
 }
 
 }  // namespace colmap
@@ -18,6 +18,8 @@
 #define COLMAP_SRC_UTIL_RANDOM_H_
 
 #include <chrono>
+#include <cstdint>
+#include <limits>
 #include <random>
 #include <thread>
 
@@ -26,7 +28,47 @@
 
 namespace colmap {
 
-extern thread_local std::mt19937* PRNG;
+// Counter-based pseudo-random number generator Philox4x32-10, see Salmon et
+// al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC 2011. The i-th number
+// of a stream is a bijective function of the seed, the stream index and i, so
+// that any number of independent and reproducible streams can be created in
+// constant time, e.g., one per task of a parallel loop keyed by the index of
+// the task. Satisfies the requirements of a uniform random bit generator.
+class Philox4x32 {
+ public:
+  typedef uint32_t result_type;
+
+  explicit Philox4x32(const uint64_t seed = 0, const uint64_t stream = 0);
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  inline result_type operator()();
+
+  // Skip the next `num` numbers of the stream.
+  void Discard(const uint64_t num);
+
+  uint64_t Seed() const;
+  uint64_t Stream() const;
+
+  // The numbers of the stream, i.e., of the counter, for the given seed.
+  static void Generate(const uint32_t key[2], const uint32_t counter[4],
+                       uint32_t output[4]);
+
+ private:
+  void GenerateBlock();
+
+  uint32_t key_[2];
+  uint64_t stream_;
+  // Index of the next block of four numbers.
+  uint64_t block_counter_;
+  uint32_t block_[4];
+  int block_idx_;
+};
+
+extern thread_local Philox4x32* PRNG;
 
 static const unsigned kRandomPRNGSeed = std::numeric_limits<unsigned>::max();
 
@@ -36,6 +78,37 @@ static const unsigned kRandomPRNGSeed = std::numeric_limits<unsigned>::max();
 //               is used as the seed.
 void SetPRNGSeed(unsigned seed = kRandomPRNGSeed);
 
+// Set the seed that replaces `kRandomPRNGSeed` in `SetPRNGSeed`, i.e. the seed
+// of the PRNG that every thread creates on its first draw, for reproducible
+// runs. With `kRandomPRNGSeed`, the default, the current time is used.
+void SetDefaultPRNGSeed(unsigned seed);
+
+// Draw from the given stream on the calling thread until destruction and
+// restore the previous PRNG of the thread afterwards. Used by parallel tasks,
+// which key their stream by the index of the task instead of the thread that
+// happens to run them, so that their results do not depend on the number of
+// threads. The seed is typically drawn once from the PRNG of the thread that
+// creates the tasks, see `RandomSeed`. `SetPRNGSeed` must not be called on
+// the thread within the scope.
+class ScopedPRNG {
+ public:
+  ScopedPRNG(const uint64_t seed, const uint64_t stream);
+  ~ScopedPRNG();
+
+  // Switch to another stream of the same seed.
+  void SetStream(const uint64_t stream);
+
+ private:
+  ScopedPRNG(const ScopedPRNG&) = delete;
+  ScopedPRNG& operator=(const ScopedPRNG&) = delete;
+
+  Philox4x32 prng_;
+  Philox4x32* prev_prng_;
+};
+
+// Draw a seed for the streams of parallel tasks from the PRNG of the thread.
+uint64_t RandomSeed();
+
 // Generate uniformly distributed random integer number.
 //
 // This implementation is unbiased and thread-safe in contrast to `rand()`.
@@ -57,8 +130,7 @@ T RandomGaussian(const T mean, const T stddev);
 // Fisher-Yates shuffling.
 //
 // Note that the vector may not contain more values than UINT32_MAX. This
-// restriction comes from the fact that the 32-bit version of the
-// Mersenne Twister PRNG is significantly faster.
+// restriction comes from the fact that the PRNG generates 32-bit numbers.
 //
 // @param elems            Vector of elements to shuffle.
 // @param num_to_shuffle   Optional parameter, specifying the number of first
@@ -70,6 +142,13 @@ void Shuffle(const uint32_t num_to_shuffle, std::vector<T>* elems);
 // Implementation
 ////////////////////////////////////////////////////////////////////////////////
 
+Philox4x32::result_type Philox4x32::operator()() {
+  if (block_idx_ == 4) {
+    GenerateBlock();
+  }
+  return block_[block_idx_++];
+}
+
 template <typename T>
 T RandomInteger(const T min, const T max) {
   if (PRNG == nullptr) {
@@ -32,6 +32,98 @@ BOOST_AUTO_TEST_CASE(TestPRNGSeed) {
   BOOST_CHECK(PRNG != nullptr);
 }
 
+BOOST_AUTO_TEST_CASE(TestPhiloxKnownAnswers) {
+  // The known answers of the reference implementation Random123.
+  const uint32_t key1[2] = {0, 0};
+  const uint32_t counter1[4] = {0, 0, 0, 0};
+  uint32_t output1[4];
+  Philox4x32::Generate(key1, counter1, output1);
+  BOOST_CHECK_EQUAL(output1[0], 0x6627e8d5);
+  BOOST_CHECK_EQUAL(output1[1], 0xe169c58d);
+  BOOST_CHECK_EQUAL(output1[2], 0xbc57ac4c);
+  BOOST_CHECK_EQUAL(output1[3], 0x9b00dbd8);
+
+  const uint32_t key2[2] = {0xffffffff, 0xffffffff};
+  const uint32_t counter2[4] = {0xffffffff, 0xffffffff, 0xffffffff,
+                                0xffffffff};
+  uint32_t output2[4];
+  Philox4x32::Generate(key2, counter2, output2);
+  BOOST_CHECK_EQUAL(output2[0], 0x408f276d);
+  BOOST_CHECK_EQUAL(output2[1], 0x41c83b0e);
+  BOOST_CHECK_EQUAL(output2[2], 0xa20bc7c6);
+  BOOST_CHECK_EQUAL(output2[3], 0x6d5451fd);
+
+  const uint32_t key3[2] = {0xa4093822, 0x299f31d0};
+  const uint32_t counter3[4] = {0x243f6a88, 0x85a308d3, 0x13198a2e,
+                                0x03707344};
+  uint32_t output3[4];
+  Philox4x32::Generate(key3, counter3, output3);
+  BOOST_CHECK_EQUAL(output3[0], 0xd16cfe09);
+  BOOST_CHECK_EQUAL(output3[1], 0x94fdcceb);
+  BOOST_CHECK_EQUAL(output3[2], 0x5001e420);
+  BOOST_CHECK_EQUAL(output3[3], 0x24126ea1);
+}
+
+BOOST_AUTO_TEST_CASE(TestPhiloxStreams) {
+  Philox4x32 prng1(42, 0);
+  Philox4x32 prng2(42, 1);
+  Philox4x32 prng3(42, 0);
+  BOOST_CHECK_EQUAL(prng1.Seed(), 42);
+  BOOST_CHECK_EQUAL(prng2.Stream(), 1);
+  std::vector<uint32_t> numbers1;
+  size_t num_equal = 0;
+  for (size_t i = 0; i < 100; ++i) {
+    numbers1.push_back(prng1());
+    const uint32_t number2 = prng2();
+    BOOST_CHECK_EQUAL(prng3(), numbers1.back());
+    if (number2 == numbers1.back()) {
+      num_equal += 1;
+    }
+  }
+  BOOST_CHECK_EQUAL(num_equal, 0);
+
+  // The stream is split into blocks of four numbers.
+  for (const uint64_t num_skip : {0, 1, 3, 4, 5, 8, 13}) {
+    Philox4x32 prng(42, 0);
+    prng.Discard(num_skip);
+    for (size_t i = num_skip; i < numbers1.size(); ++i) {
+      BOOST_CHECK_EQUAL(prng(), numbers1[i]);
+    }
+  }
+  Philox4x32 prng(42, 0);
+  prng();
+  prng.Discard(6);
+  BOOST_CHECK_EQUAL(prng(), numbers1[7]);
+}
+
+BOOST_AUTO_TEST_CASE(TestScopedPRNG) {
+  SetPRNGSeed(0);
+  Philox4x32* thread_prng = PRNG;
+  const uint64_t seed = RandomSeed();
+  std::vector<int> numbers1;
+  {
+    ScopedPRNG scoped_prng(seed, 3);
+    BOOST_CHECK(PRNG != thread_prng);
+    for (size_t i = 0; i < 10; ++i) {
+      numbers1.push_back(RandomInteger(0, 10000));
+    }
+  }
+  BOOST_CHECK_EQUAL(PRNG, thread_prng);
+
+  // The same stream on another thread.
+  std::vector<int> numbers2;
+  std::thread thread([&]() {
+    ScopedPRNG scoped_prng(seed, 2);
+    scoped_prng.SetStream(3);
+    for (size_t i = 0; i < 10; ++i) {
+      numbers2.push_back(RandomInteger(0, 10000));
+    }
+  });
+  thread.join();
+  BOOST_CHECK_EQUAL_COLLECTIONS(numbers1.begin(), numbers1.end(),
+                                numbers2.begin(), numbers2.end());
+}
+
 BOOST_AUTO_TEST_CASE(TestRepeatability) {
   SetPRNGSeed(0);
   std::vector<int> numbers1;
@@ -59,6 +151,36 @@ BOOST_AUTO_TEST_CASE(TestRepeatability) {
   BOOST_CHECK(!all_equal);
 }
 
+BOOST_AUTO_TEST_CASE(TestDefaultPRNGSeed) {
+  SetDefaultPRNGSeed(42);
+  SetPRNGSeed();
+  std::vector<int> numbers1;
+  for (size_t i = 0; i < 100; ++i) {
+    numbers1.push_back(RandomInteger(0, 10000));
+  }
+
+  // The PRNG of a new thread is also seeded by the default seed.
+  std::vector<int> numbers2;
+  std::thread thread([&numbers2]() {
+    for (size_t i = 0; i < 100; ++i) {
+      numbers2.push_back(RandomInteger(0, 10000));
+    }
+  });
+  thread.join();
+  BOOST_CHECK_EQUAL_COLLECTIONS(numbers1.begin(), numbers1.end(),
+                                numbers2.begin(), numbers2.end());
+
+  SetPRNGSeed(42);
+  std::vector<int> numbers3;
+  for (size_t i = 0; i < 100; ++i) {
+    numbers3.push_back(RandomInteger(0, 10000));
+  }
+  BOOST_CHECK_EQUAL_COLLECTIONS(numbers1.begin(), numbers1.end(),
+                                numbers3.begin(), numbers3.end());
+
+  SetDefaultPRNGSeed(kRandomPRNGSeed);
+}
+
 BOOST_AUTO_TEST_CASE(TestRandomInteger) {
   SetPRNGSeed();
   for (size_t i = 0; i < 1000; ++i) {
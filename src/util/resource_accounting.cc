@@ -0,0 +1,347 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/resource_accounting.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "util/logging.h"
+#include "util/perf_counters.h"
+#include "util/string.h"
+#include "util/threading.h"
+
+namespace colmap {
+namespace internal {
+
+std::atomic<bool> resource_accounting_enabled(false);
+
+}  // namespace internal
+
+namespace {
+
+// The allocations are counted on several cache lines, so that the threads do
+// not contend for a single counter.
+const int kNumAllocationCounters = 16;
+
+struct alignas(64) AllocationCounter {
+  std::atomic<int64_t> count;
+};
+
+AllocationCounter allocation_counters[kNumAllocationCounters];
+std::atomic<int> next_allocation_counter_idx(0);
+thread_local int thread_allocation_counter_idx = -1;
+
+void CountAllocation() {
+  if (thread_allocation_counter_idx < 0) {
+    thread_allocation_counter_idx =
+        next_allocation_counter_idx.fetch_add(1, std::memory_order_relaxed) %
+        kNumAllocationCounters;
+  }
+  allocation_counters[thread_allocation_counter_idx].count.fetch_add(
+      1, std::memory_order_relaxed);
+}
+
+int64_t NumAllocations() {
+  int64_t num_allocations = 0;
+  for (int i = 0; i < kNumAllocationCounters; ++i) {
+    num_allocations +=
+        allocation_counters[i].count.load(std::memory_order_relaxed);
+  }
+  return num_allocations;
+}
+
+void* Allocate(const std::size_t size) {
+  CountAllocation();
+  void* ptr;
+  while ((ptr = std::malloc(size == 0 ? 1 : size)) == nullptr) {
+    const std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+  return ptr;
+}
+
+void* AllocateNoThrow(const std::size_t size) noexcept {
+  try {
+    return Allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+#ifdef __linux__
+// Bytes read and written through system calls, including the ones served by
+// the page cache, from /proc/self/io.
+void ReadProcessIO(int64_t* bytes_read, int64_t* bytes_written) {
+  // The file is read without allocations, since they would be counted.
+  char buffer[1024];
+  const int fd = open("/proc/self/io", O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  const ssize_t num_bytes = read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
+  if (num_bytes <= 0) {
+    return;
+  }
+  buffer[num_bytes] = '\0';
+  for (char* line = buffer; line != nullptr && *line != '\0';) {
+    char* next_line = std::strchr(line, '\n');
+    if (next_line != nullptr) {
+      *next_line = '\0';
+      next_line += 1;
+    }
+    if (std::strncmp(line, "rchar:", 6) == 0) {
+      *bytes_read = std::strtoll(line + 6, nullptr, 10);
+    } else if (std::strncmp(line, "wchar:", 6) == 0) {
+      *bytes_written = std::strtoll(line + 6, nullptr, 10);
+    }
+    line = next_line;
+  }
+}
+#endif
+
+struct ResourceRegistry {
+  std::mutex mutex;
+  ResourceUsage enabled_usage;
+  std::vector<ResourceStage> stages;
+  std::unordered_map<std::string, size_t> stage_idxs;
+};
+
+ResourceRegistry& GetResourceRegistry() {
+  static ResourceRegistry registry;
+  return registry;
+}
+
+void RecordResourceStage(const std::string& name, const ResourceUsage& usage) {
+  ResourceRegistry& registry = GetResourceRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  const auto stage_idx =
+      registry.stage_idxs.emplace(name, registry.stages.size());
+  if (stage_idx.second) {
+    registry.stages.emplace_back();
+    registry.stages.back().name = name;
+  }
+  ResourceStage& stage = registry.stages[stage_idx.first->second];
+  stage.num_calls += 1;
+  stage.usage += usage;
+}
+
+// The innermost active scope of the thread.
+thread_local ResourceScope* thread_resource_scope = nullptr;
+
+std::string ResourceUsageToJSON(const ResourceUsage& usage) {
+  return StringPrintf(
+      "\"wall_seconds\":%.6f,\"cpu_seconds\":%.6f,\"peak_rss_bytes\":%lld,"
+      "\"num_allocations\":%lld,\"bytes_read\":%lld,\"bytes_written\":%lld",
+      usage.wall_seconds, usage.cpu_seconds,
+      static_cast<long long>(usage.peak_rss_bytes),
+      static_cast<long long>(usage.num_allocations),
+      static_cast<long long>(usage.bytes_read),
+      static_cast<long long>(usage.bytes_written));
+}
+
+}  // namespace
+
+ResourceUsage& ResourceUsage::operator+=(const ResourceUsage& other) {
+  wall_seconds += other.wall_seconds;
+  cpu_seconds += other.cpu_seconds;
+  peak_rss_bytes += other.peak_rss_bytes;
+  num_allocations += other.num_allocations;
+  bytes_read += other.bytes_read;
+  bytes_written += other.bytes_written;
+  return *this;
+}
+
+ResourceUsage& ResourceUsage::operator-=(const ResourceUsage& other) {
+  wall_seconds -= other.wall_seconds;
+  cpu_seconds -= other.cpu_seconds;
+  peak_rss_bytes -= other.peak_rss_bytes;
+  num_allocations -= other.num_allocations;
+  bytes_read -= other.bytes_read;
+  bytes_written -= other.bytes_written;
+  return *this;
+}
+
+ResourceUsage GetProcessResourceUsage() {
+  ResourceUsage usage;
+  usage.wall_seconds =
+      std::chrono::duration<double>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+  usage.num_allocations = NumAllocations();
+
+#if defined(__linux__) || defined(__APPLE__)
+  struct rusage rusage;
+  if (getrusage(RUSAGE_SELF, &rusage) == 0) {
+    usage.cpu_seconds =
+        rusage.ru_utime.tv_sec + rusage.ru_utime.tv_usec / 1e6 +
+        rusage.ru_stime.tv_sec + rusage.ru_stime.tv_usec / 1e6;
+#ifdef __APPLE__
+    usage.peak_rss_bytes = rusage.ru_maxrss;
+#else
+    usage.peak_rss_bytes = static_cast<int64_t>(rusage.ru_maxrss) * 1024;
+#endif
+  }
+#endif
+
+#ifdef __linux__
+  ReadProcessIO(&usage.bytes_read, &usage.bytes_written);
+#endif
+
+  return usage;
+}
+
+void EnableResourceAccounting() {
+  ResourceRegistry& registry = GetResourceRegistry();
+  {
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    registry.enabled_usage = GetProcessResourceUsage();
+  }
+  internal::resource_accounting_enabled.store(true, std::memory_order_relaxed);
+}
+
+void DisableResourceAccounting() {
+  internal::resource_accounting_enabled.store(false,
+                                              std::memory_order_relaxed);
+}
+
+void ClearResourceAccounting() {
+  ResourceRegistry& registry = GetResourceRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  registry.stages.clear();
+  registry.stage_idxs.clear();
+}
+
+std::vector<ResourceStage> GetResourceStages() {
+  ResourceRegistry& registry = GetResourceRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  return registry.stages;
+}
+
+bool WriteResourceReport(const std::string& path) {
+  ResourceUsage total_usage = GetProcessResourceUsage();
+  {
+    ResourceRegistry& registry = GetResourceRegistry();
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    total_usage -= registry.enabled_usage;
+  }
+
+  std::ofstream file(path, std::ios::trunc);
+  if (!file.is_open()) {
+    std::cerr << "ERROR: Could not open resource report " << path
+              << " for writing." << std::endl;
+    return false;
+  }
+
+  file << "{\"total\":{" << ResourceUsageToJSON(total_usage)
+       << "},\"stages\":[";
+  const std::vector<ResourceStage> stages = GetResourceStages();
+  for (size_t i = 0; i < stages.size(); ++i) {
+    file << (i == 0 ? "\n" : ",\n");
+    file << StringPrintf("{\"name\":\"%s\",\"num_calls\":%d,",
+                         StringEscapeJSON(stages[i].name).c_str(),
+                         static_cast<int>(stages[i].num_calls))
+         << ResourceUsageToJSON(stages[i].usage) << "}";
+  }
+  file << "\n]";
+
+  // The hardware counters of the trace scopes, if they were enabled.
+  const std::vector<PerfCounterStats> perf_counter_stats =
+      GetPerfCounterStats();
+  if (!perf_counter_stats.empty()) {
+    file << ",\"perf_counters\":" << PerfCounterStatsToJSON(perf_counter_stats);
+  }
+
+  file << "}\n";
+
+  return file.good();
+}
+
+ResourceScope::ResourceScope(const std::string& name)
+    : active_(false), parent_(nullptr) {
+  if (!IsResourceAccountingEnabled()) {
+    return;
+  }
+  for (const ResourceScope* scope = thread_resource_scope; scope != nullptr;
+       scope = scope->parent_) {
+    if (scope->name_ == name) {
+      return;
+    }
+  }
+  active_ = true;
+  name_ = name;
+  parent_ = thread_resource_scope;
+  thread_resource_scope = this;
+  begin_usage_ = GetProcessResourceUsage();
+}
+
+ResourceScope::~ResourceScope() {
+  if (!active_) {
+    return;
+  }
+  ResourceUsage usage = GetProcessResourceUsage();
+  usage -= begin_usage_;
+  if (parent_ != nullptr) {
+    parent_->nested_usage_ += usage;
+  }
+  usage -= nested_usage_;
+  thread_resource_scope = parent_;
+  RecordResourceStage(name_, usage);
+}
+
+}  // namespace colmap
+
+// Replacements of the global allocation functions, which count the allocations
+// of the process for the resource accounting.
+
+void* operator new(std::size_t size) { return colmap::Allocate(size); }
+
+void* operator new[](std::size_t size) { return colmap::Allocate(size); }
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return colmap::AllocateNoThrow(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return colmap::AllocateNoThrow(size);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+  std::free(ptr);
+}
@@ -0,0 +1,117 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_RESOURCE_ACCOUNTING_H_
+#define COLMAP_SRC_UTIL_RESOURCE_ACCOUNTING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace colmap {
+
+// Accounting of the resources used by named stages, e.g. to size the jobs of
+// long running reconstructions. A stage is a scope on one thread, whose
+// resources are accumulated over all its calls. The resources of nested
+// stages only count for the innermost stage, a stage nested into a stage of
+// the same name is merged into the outer one.
+//
+// The counters are process-wide, so the stages that run concurrently on
+// different threads share the resources used in the meantime. The CPU time,
+// the peak resident set size and the bytes read and written are only
+// available on Linux and macOS, the file bytes only on Linux. The allocations
+// are the calls of the global operator new.
+//
+// Accounting is disabled until `EnableResourceAccounting` is called, in which
+// case a scope costs a single relaxed atomic load.
+//
+// Example usage:
+//
+//    EnableResourceAccounting();
+//    {
+//      ResourceScope scope("bundle_adjustment");
+//      ...
+//    }
+//    WriteResourceReport("resources.json");
+//
+struct ResourceUsage {
+  double wall_seconds = 0;
+  double cpu_seconds = 0;
+  // Growth of the peak resident set size of the process.
+  int64_t peak_rss_bytes = 0;
+  int64_t num_allocations = 0;
+  int64_t bytes_read = 0;
+  int64_t bytes_written = 0;
+
+  ResourceUsage& operator+=(const ResourceUsage& other);
+  ResourceUsage& operator-=(const ResourceUsage& other);
+};
+
+struct ResourceStage {
+  std::string name;
+  size_t num_calls = 0;
+  ResourceUsage usage;
+};
+
+// Resources used by the process since it started, where the wall time is
+// measured from an arbitrary point in time.
+ResourceUsage GetProcessResourceUsage();
+
+void EnableResourceAccounting();
+void DisableResourceAccounting();
+
+// Discard all accumulated stages.
+void ClearResourceAccounting();
+
+// The accumulated stages in the order of their first completion.
+std::vector<ResourceStage> GetResourceStages();
+
+// Write the stages and the total usage of the process since accounting was
+// enabled as JSON, together with the hardware counters of the trace scopes, if
+// any were counted, see `EnablePerfCounters`.
+bool WriteResourceReport(const std::string& path);
+
+namespace internal {
+
+extern std::atomic<bool> resource_accounting_enabled;
+
+}  // namespace internal
+
+inline bool IsResourceAccountingEnabled() {
+  return internal::resource_accounting_enabled.load(std::memory_order_relaxed);
+}
+
+class ResourceScope {
+ public:
+  explicit ResourceScope(const std::string& name);
+  ~ResourceScope();
+
+ private:
+  ResourceScope(const ResourceScope&) = delete;
+  ResourceScope& operator=(const ResourceScope&) = delete;
+
+  bool active_;
+  std::string name_;
+  ResourceScope* parent_;
+  ResourceUsage begin_usage_;
+  // Usage of the nested stages, which does not count for this stage.
+  ResourceUsage nested_usage_;
+};
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_RESOURCE_ACCOUNTING_H_
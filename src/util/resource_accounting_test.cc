@@ -0,0 +1,126 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/resource_accounting"
+#include "util/testing.h"
+
+#include <fstream>
+#include <memory>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "util/resource_accounting.h"
+
+using namespace colmap;
+
+namespace {
+
+// Allocate and release the given number of objects through operator new.
+void Allocate(const int num_allocations) {
+  for (int i = 0; i < num_allocations; ++i) {
+    std::unique_ptr<int> ptr(new int(i));
+    BOOST_CHECK_EQUAL(*ptr, i);
+  }
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestDisabled) {
+  ClearResourceAccounting();
+  DisableResourceAccounting();
+  BOOST_CHECK(!IsResourceAccountingEnabled());
+  { ResourceScope scope("disabled"); }
+  BOOST_CHECK_EQUAL(GetResourceStages().size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestProcessResourceUsage) {
+  const ResourceUsage begin_usage = GetProcessResourceUsage();
+  Allocate(100);
+  const ResourceUsage end_usage = GetProcessResourceUsage();
+  BOOST_CHECK_GE(end_usage.wall_seconds, begin_usage.wall_seconds);
+  BOOST_CHECK_GE(end_usage.cpu_seconds, begin_usage.cpu_seconds);
+  BOOST_CHECK_GE(end_usage.peak_rss_bytes, begin_usage.peak_rss_bytes);
+  BOOST_CHECK_GE(end_usage.num_allocations - begin_usage.num_allocations, 100);
+}
+
+BOOST_AUTO_TEST_CASE(TestNestedScopes) {
+  ClearResourceAccounting();
+  EnableResourceAccounting();
+  BOOST_CHECK(IsResourceAccountingEnabled());
+  for (int i = 0; i < 2; ++i) {
+    ResourceScope outer_scope("outer");
+    Allocate(10);
+    {
+      ResourceScope inner_scope("inner");
+      Allocate(1000);
+      // Merged into the enclosing scope of the same name.
+      ResourceScope nested_scope("inner");
+      Allocate(1000);
+    }
+  }
+  DisableResourceAccounting();
+
+  const std::vector<ResourceStage> stages = GetResourceStages();
+  BOOST_CHECK_EQUAL(stages.size(), 2);
+  BOOST_CHECK_EQUAL(stages[0].name, "inner");
+  BOOST_CHECK_EQUAL(stages[0].num_calls, 2);
+  BOOST_CHECK_GE(stages[0].usage.num_allocations, 4000);
+  BOOST_CHECK_GE(stages[0].usage.wall_seconds, 0);
+  BOOST_CHECK_EQUAL(stages[1].name, "outer");
+  BOOST_CHECK_EQUAL(stages[1].num_calls, 2);
+  // The allocations of the inner stage do not count for the outer stage.
+  BOOST_CHECK_GE(stages[1].usage.num_allocations, 20);
+  BOOST_CHECK_LT(stages[1].usage.num_allocations, 1000);
+}
+
+BOOST_AUTO_TEST_CASE(TestWriteResourceReport) {
+  ClearResourceAccounting();
+  EnableResourceAccounting();
+  { ResourceScope scope("take1/\"registration\""); }
+  {
+    ResourceScope scope("take1/bundle_adjustment");
+    std::ofstream file(
+        (boost::filesystem::temp_directory_path() /
+         boost::filesystem::unique_path("resource_accounting_%%%%%%%%.bin"))
+            .string());
+  }
+
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("resource_accounting_%%%%%%%%.json"))
+          .string();
+  BOOST_CHECK(WriteResourceReport(path));
+  DisableResourceAccounting();
+
+  boost::property_tree::ptree report;
+  boost::property_tree::read_json(path, report);
+  BOOST_CHECK_GE(report.get<double>("total.wall_seconds"), 0);
+  BOOST_CHECK_GE(report.get<long long>("total.num_allocations"), 0);
+  const auto& stages = report.get_child("stages");
+  BOOST_CHECK_EQUAL(stages.size(), 2);
+  auto stage = stages.begin();
+  BOOST_CHECK_EQUAL(stage->second.get<std::string>("name"),
+                    "take1/\"registration\"");
+  BOOST_CHECK_EQUAL(stage->second.get<int>("num_calls"), 1);
+  ++stage;
+  BOOST_CHECK_EQUAL(stage->second.get<std::string>("name"),
+                    "take1/bundle_adjustment");
+  BOOST_CHECK_GE(stage->second.get<long long>("bytes_read"), 0);
+
+  boost::filesystem::remove(path);
+}
@@ -0,0 +1,64 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/scratch.h"
+
+#include <atomic>
+
+#include "util/threading.h"
+
+namespace colmap {
+namespace internal {
+namespace {
+
+std::atomic<size_t> num_scratch_types(0);
+
+thread_local std::vector<std::unique_ptr<ScratchPoolBase>>*
+    thread_scratch_pools = nullptr;
+
+}  // namespace
+
+size_t NextScratchTypeIndex() { return num_scratch_types.fetch_add(1); }
+
+std::vector<std::unique_ptr<ScratchPoolBase>>& ThreadScratchPools() {
+  if (thread_scratch_pools == nullptr) {
+    thread_scratch_pools =
+        new std::vector<std::unique_ptr<ScratchPoolBase>>();
+  }
+  return *thread_scratch_pools;
+}
+
+}  // namespace internal
+
+void ReleaseThreadScratchVectors() {
+  delete internal::thread_scratch_pools;
+  internal::thread_scratch_pools = nullptr;
+}
+
+size_t NumThreadScratchVectors() {
+  if (internal::thread_scratch_pools == nullptr) {
+    return 0;
+  }
+  size_t num_vectors = 0;
+  for (const auto& pool : *internal::thread_scratch_pools) {
+    if (pool) {
+      num_vectors += pool->NumFreeVectors();
+    }
+  }
+  return num_vectors;
+}
+
+}  // namespace colmap
@@ -0,0 +1,161 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_SCRATCH_H_
+#define COLMAP_SRC_UTIL_SCRATCH_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace colmap {
+
+// Thread-local arena of temporary vectors for hot paths, e.g. RANSAC or the
+// registration of images. Instead of being freed, the vector of a destroyed
+// scratch vector is kept by its thread and handed to the next scratch vector
+// of the same type, so that a hot path stops allocating once the buffers of
+// its thread have grown to the required capacity.
+//
+// The buffers are plain `std::vector`s, so they can be passed to the
+// estimators and samplers as they are. Moving or swapping their contents is
+// allowed, it only changes which buffer is recycled. Every thread keeps at
+// most `kMaxNumScratchVectors` free vectors per type. The threads of `Thread`,
+// `ThreadPool` and `TaskScheduler` release their vectors before they exit,
+// other threads can call `ReleaseThreadScratchVectors`.
+//
+// Example usage:
+//
+//    ScratchVector<double> residuals_buffer(num_samples);
+//    std::vector<double>& residuals = *residuals_buffer;
+//    estimator.Residuals(X, Y, model, &residuals);
+//
+template <typename T, typename Alloc = std::allocator<T>>
+class ScratchVector {
+ public:
+  typedef std::vector<T, Alloc> vector_type;
+
+  // Acquire an empty vector.
+  ScratchVector();
+
+  // Acquire a vector with `size` value-initialized elements.
+  explicit ScratchVector(const size_t size);
+
+  ScratchVector(ScratchVector&& other);
+  ~ScratchVector();
+
+  vector_type& operator*() { return *vector_; }
+  const vector_type& operator*() const { return *vector_; }
+  vector_type* operator->() { return vector_.get(); }
+  const vector_type* operator->() const { return vector_.get(); }
+  vector_type* get() { return vector_.get(); }
+
+ private:
+  ScratchVector(const ScratchVector&) = delete;
+  ScratchVector& operator=(const ScratchVector&) = delete;
+
+  std::unique_ptr<vector_type> vector_;
+};
+
+const size_t kMaxNumScratchVectors = 16;
+
+// Free the recycled vectors of the calling thread.
+void ReleaseThreadScratchVectors();
+
+// Number of recycled vectors kept by the calling thread.
+size_t NumThreadScratchVectors();
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+namespace internal {
+
+class ScratchPoolBase {
+ public:
+  virtual ~ScratchPoolBase() = default;
+  virtual size_t NumFreeVectors() const = 0;
+};
+
+template <typename Vector>
+class ScratchPool : public ScratchPoolBase {
+ public:
+  size_t NumFreeVectors() const override { return free_vectors.size(); }
+
+  std::vector<std::unique_ptr<Vector>> free_vectors;
+};
+
+// Dense index of a vector type, which identifies its pool in every thread.
+size_t NextScratchTypeIndex();
+
+template <typename Vector>
+size_t ScratchTypeIndex() {
+  static const size_t index = NextScratchTypeIndex();
+  return index;
+}
+
+// The pools of the calling thread by type index, created on first use.
+std::vector<std::unique_ptr<ScratchPoolBase>>& ThreadScratchPools();
+
+template <typename Vector>
+ScratchPool<Vector>& ThreadScratchPool() {
+  std::vector<std::unique_ptr<ScratchPoolBase>>& pools = ThreadScratchPools();
+  const size_t index = ScratchTypeIndex<Vector>();
+  if (index >= pools.size()) {
+    pools.resize(index + 1);
+  }
+  if (!pools[index]) {
+    pools[index].reset(new ScratchPool<Vector>());
+  }
+  return static_cast<ScratchPool<Vector>&>(*pools[index]);
+}
+
+}  // namespace internal
+
+template <typename T, typename Alloc>
+ScratchVector<T, Alloc>::ScratchVector() {
+  auto& free_vectors = internal::ThreadScratchPool<vector_type>().free_vectors;
+  if (free_vectors.empty()) {
+    vector_.reset(new vector_type());
+  } else {
+    vector_ = std::move(free_vectors.back());
+    free_vectors.pop_back();
+  }
+}
+
+template <typename T, typename Alloc>
+ScratchVector<T, Alloc>::ScratchVector(const size_t size) : ScratchVector() {
+  vector_->resize(size);
+}
+
+template <typename T, typename Alloc>
+ScratchVector<T, Alloc>::ScratchVector(ScratchVector&& other)
+    : vector_(std::move(other.vector_)) {}
+
+template <typename T, typename Alloc>
+ScratchVector<T, Alloc>::~ScratchVector() {
+  if (!vector_) {
+    return;
+  }
+  auto& free_vectors = internal::ThreadScratchPool<vector_type>().free_vectors;
+  if (free_vectors.size() < kMaxNumScratchVectors) {
+    vector_->clear();
+    free_vectors.push_back(std::move(vector_));
+  }
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_SCRATCH_H_
@@ -0,0 +1,106 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/scratch"
+#include "util/testing.h"
+
+#include <thread>
+
+#include "util/scratch.h"
+
+using namespace colmap;
+
+BOOST_AUTO_TEST_CASE(TestRecycle) {
+  ReleaseThreadScratchVectors();
+  const double* data = nullptr;
+  {
+    ScratchVector<double> buffer(100);
+    BOOST_CHECK_EQUAL(buffer->size(), 100);
+    (*buffer)[0] = 1;
+    data = buffer->data();
+    BOOST_CHECK_EQUAL(NumThreadScratchVectors(), 0);
+  }
+  BOOST_CHECK_EQUAL(NumThreadScratchVectors(), 1);
+  {
+    ScratchVector<double> buffer;
+    BOOST_CHECK_EQUAL(NumThreadScratchVectors(), 0);
+    BOOST_CHECK(buffer->empty());
+    BOOST_CHECK_GE(buffer->capacity(), 100);
+    buffer->resize(50);
+    BOOST_CHECK_EQUAL(buffer->data(), data);
+    BOOST_CHECK_EQUAL((*buffer)[0], 0);
+  }
+  ReleaseThreadScratchVectors();
+  BOOST_CHECK_EQUAL(NumThreadScratchVectors(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestNested) {
+  ReleaseThreadScratchVectors();
+  {
+    ScratchVector<int> buffer1(10);
+    ScratchVector<int> buffer2(20);
+    ScratchVector<char> buffer3(30);
+    BOOST_CHECK_NE(buffer1->data(), buffer2->data());
+  }
+  BOOST_CHECK_EQUAL(NumThreadScratchVectors(), 3);
+  {
+    ScratchVector<int> buffer1;
+    ScratchVector<int> buffer2;
+    BOOST_CHECK_GE(buffer1->capacity(), 10);
+    BOOST_CHECK_GE(buffer2->capacity(), 10);
+    BOOST_CHECK_EQUAL(NumThreadScratchVectors(), 1);
+  }
+  ReleaseThreadScratchVectors();
+}
+
+BOOST_AUTO_TEST_CASE(TestMove) {
+  ReleaseThreadScratchVectors();
+  {
+    ScratchVector<int> buffer1(10);
+    ScratchVector<int> buffer2(std::move(buffer1));
+    BOOST_CHECK_EQUAL(buffer2->size(), 10);
+    std::vector<int> values = std::move(*buffer2);
+    BOOST_CHECK_EQUAL(values.size(), 10);
+  }
+  BOOST_CHECK_EQUAL(NumThreadScratchVectors(), 1);
+  ReleaseThreadScratchVectors();
+}
+
+BOOST_AUTO_TEST_CASE(TestMaxNumVectors) {
+  ReleaseThreadScratchVectors();
+  {
+    std::vector<ScratchVector<int>> buffers;
+    for (size_t i = 0; i < 2 * kMaxNumScratchVectors; ++i) {
+      buffers.emplace_back(1);
+    }
+  }
+  BOOST_CHECK_EQUAL(NumThreadScratchVectors(), kMaxNumScratchVectors);
+  ReleaseThreadScratchVectors();
+}
+
+BOOST_AUTO_TEST_CASE(TestThreads) {
+  ReleaseThreadScratchVectors();
+  { ScratchVector<int> buffer(10); }
+  std::thread thread([]() {
+    BOOST_CHECK_EQUAL(NumThreadScratchVectors(), 0);
+    { ScratchVector<int> buffer(10); }
+    BOOST_CHECK_EQUAL(NumThreadScratchVectors(), 1);
+    ReleaseThreadScratchVectors();
+  });
+  thread.join();
+  BOOST_CHECK_EQUAL(NumThreadScratchVectors(), 1);
+  ReleaseThreadScratchVectors();
+}
@@ -0,0 +1,170 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/simd.h"
+
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define COLMAP_SIMD_X86_64
+#if defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#include "util/logging.h"
+#include "util/string.h"
+
+namespace colmap {
+namespace {
+
+#ifdef COLMAP_SIMD_X86_64
+
+void CPUID(const uint32_t leaf, const uint32_t subleaf, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+  int int_regs[4];
+  __cpuidex(int_regs, static_cast<int>(leaf), static_cast<int>(subleaf));
+  for (int i = 0; i < 4; ++i) {
+    regs[i] = static_cast<uint32_t>(int_regs[i]);
+  }
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// The register state that is saved by the operating system.
+uint64_t XGETBV() {
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  uint32_t eax;
+  uint32_t edx;
+  __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+inline bool IsBitSet(const uint32_t reg, const int bit) {
+  return (reg >> bit) & 1;
+}
+
+#endif
+
+CPUFeatures DetectCPUFeatures() {
+  CPUFeatures features;
+
+#ifdef COLMAP_SIMD_X86_64
+  uint32_t regs[4];
+  CPUID(0, 0, regs);
+  const uint32_t max_leaf = regs[0];
+  if (max_leaf < 1) {
+    return features;
+  }
+
+  CPUID(1, 0, regs);
+  features.sse2 = IsBitSet(regs[3], 26);
+  const bool osxsave = IsBitSet(regs[2], 27);
+
+  // The XMM and YMM registers, and the opmask and ZMM registers.
+  const uint64_t xcr0 = osxsave ? XGETBV() : 0;
+  const bool os_avx = (xcr0 & 0x6) == 0x6;
+  const bool os_avx512 = os_avx && (xcr0 & 0xe0) == 0xe0;
+
+  features.avx = os_avx && IsBitSet(regs[2], 28);
+  features.fma = features.avx && IsBitSet(regs[2], 12);
+
+  if (max_leaf >= 7) {
+    CPUID(7, 0, regs);
+    features.avx2 = features.avx && IsBitSet(regs[1], 5);
+    features.avx512f = os_avx512 && IsBitSet(regs[1], 16);
+    features.avx512dq = features.avx512f && IsBitSet(regs[1], 17);
+    features.avx512bw = features.avx512f && IsBitSet(regs[1], 30);
+    features.avx512vl = features.avx512f && IsBitSet(regs[1], 31);
+    features.avx512vpopcntdq = features.avx512f && IsBitSet(regs[2], 14);
+  }
+#elif defined(__aarch64__)
+  // NEON is mandatory on AArch64 and part of the baseline.
+  features.neon = true;
+#endif
+
+  return features;
+}
+
+SIMDLevel DetermineSIMDLevel() {
+  SIMDLevel level = GetSupportedSIMDLevel(GetCPUFeatures());
+
+  const char* max_level_env = std::getenv("COLMAP_SIMD_LEVEL");
+  if (max_level_env != nullptr) {
+    std::string max_level_str(max_level_env);
+    StringToLower(&max_level_str);
+    SIMDLevel max_level = level;
+    if (max_level_str == "baseline") {
+      max_level = SIMDLevel::BASELINE;
+    } else if (max_level_str == "avx2") {
+      max_level = SIMDLevel::AVX2;
+    } else if (max_level_str == "avx512") {
+      max_level = SIMDLevel::AVX512;
+    } else {
+      LOG(WARNING) << "Ignoring invalid COLMAP_SIMD_LEVEL=" << max_level_env;
+    }
+    if (max_level < level) {
+      level = max_level;
+    }
+  }
+
+  return level;
+}
+
+}  // namespace
+
+const CPUFeatures& GetCPUFeatures() {
+  static const CPUFeatures features = DetectCPUFeatures();
+  return features;
+}
+
+SIMDLevel GetSIMDLevel() {
+  static const SIMDLevel level = DetermineSIMDLevel();
+  return level;
+}
+
+SIMDLevel GetSupportedSIMDLevel(const CPUFeatures& features) {
+  if (!features.avx2 || !features.fma) {
+    return SIMDLevel::BASELINE;
+  }
+  if (!features.avx512f || !features.avx512bw || !features.avx512dq ||
+      !features.avx512vl) {
+    return SIMDLevel::AVX2;
+  }
+  return SIMDLevel::AVX512;
+}
+
+std::string SIMDLevelToString(const SIMDLevel level) {
+  switch (level) {
+    case SIMDLevel::BASELINE:
+      return "baseline";
+    case SIMDLevel::AVX2:
+      return "avx2";
+    case SIMDLevel::AVX512:
+      return "avx512";
+  }
+  return "unknown";
+}
+
+}  // namespace colmap
@@ -0,0 +1,124 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_SIMD_H_
+#define COLMAP_SRC_UTIL_SIMD_H_
+
+#include <string>
+
+namespace colmap {
+
+// Runtime dispatch of SIMD kernels, so that a single binary uses the widest
+// instruction set of every node it is deployed to. A kernel has a baseline
+// implementation, which is compiled with the default flags of the build (SSE2
+// on x86-64, NEON on AArch64), and optional implementations in translation
+// units compiled for a wider instruction set, see COLMAP_SET_SIMD_SOURCE_FLAGS
+// in CMake. The wider implementations only exist if the compiler supports the
+// instruction set, indicated by the definitions SIMD_AVX2_ENABLED and
+// SIMD_AVX512_ENABLED, and they are only selected if the CPU and the operating
+// system support it. A kernel resolves its implementation once into a static
+// function pointer:
+//
+//    void ComputeFoo(const double* x, double* y) {
+//      static const FooFunc func = SelectSIMDFunction<FooFunc>(
+//          &ComputeFooBaseline, COLMAP_SIMD_AVX2_FUNC(&ComputeFooAVX2),
+//          COLMAP_SIMD_AVX512_FUNC(nullptr));
+//      func(x, y);
+//    }
+//
+// The translation units of an instruction set must not share inline functions
+// or template instances with other translation units, since the linker keeps
+// an arbitrary copy, which might contain unsupported instructions. Code that
+// is compiled for several instruction sets belongs into an anonymous
+// namespace and the interfaces of the kernels use plain arrays, not Eigen.
+enum class SIMDLevel {
+  BASELINE = 0,
+  // AVX2 and FMA.
+  AVX2 = 1,
+  // AVX-512 with the F, BW, DQ and VL extensions.
+  AVX512 = 2,
+};
+
+// Instruction set extensions of the CPU that are usable, i.e., the operating
+// system also saves the state of their registers.
+struct CPUFeatures {
+  bool sse2 = false;
+  bool avx = false;
+  bool avx2 = false;
+  bool fma = false;
+  bool avx512f = false;
+  bool avx512bw = false;
+  bool avx512dq = false;
+  bool avx512vl = false;
+  bool avx512vpopcntdq = false;
+  bool neon = false;
+};
+
+// The features of the calling CPU, detected once.
+const CPUFeatures& GetCPUFeatures();
+
+// The highest level supported by the CPU features. It can be lowered with the
+// environment variable COLMAP_SIMD_LEVEL set to "baseline" or "avx2", e.g. to
+// compare the implementations on the same node. Determined once.
+SIMDLevel GetSIMDLevel();
+SIMDLevel GetSupportedSIMDLevel(const CPUFeatures& features);
+
+std::string SIMDLevelToString(const SIMDLevel level);
+
+// Select the implementation of the highest level that is supported and
+// compiled, i.e., not null.
+template <typename Func>
+Func SelectSIMDFunction(const SIMDLevel level, Func baseline, Func avx2,
+                        Func avx512);
+template <typename Func>
+Func SelectSIMDFunction(Func baseline, Func avx2, Func avx512);
+
+#ifdef SIMD_AVX2_ENABLED
+#define COLMAP_SIMD_AVX2_FUNC(func) (func)
+#else
+#define COLMAP_SIMD_AVX2_FUNC(func) nullptr
+#endif
+
+#ifdef SIMD_AVX512_ENABLED
+#define COLMAP_SIMD_AVX512_FUNC(func) (func)
+#else
+#define COLMAP_SIMD_AVX512_FUNC(func) nullptr
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename Func>
+Func SelectSIMDFunction(const SIMDLevel level, Func baseline, Func avx2,
+                        Func avx512) {
+  if (level >= SIMDLevel::AVX512 && avx512 != nullptr) {
+    return avx512;
+  }
+  if (level >= SIMDLevel::AVX2 && avx2 != nullptr) {
+    return avx2;
+  }
+  return baseline;
+}
+
+template <typename Func>
+Func SelectSIMDFunction(Func baseline, Func avx2, Func avx512) {
+  return SelectSIMDFunction(GetSIMDLevel(), baseline, avx2, avx512);
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_SIMD_H_
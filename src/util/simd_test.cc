@@ -0,0 +1,89 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/simd"
+#include "util/testing.h"
+
+#include "util/simd.h"
+
+using namespace colmap;
+
+namespace {
+
+int Baseline() { return 0; }
+int AVX2() { return 1; }
+int AVX512() { return 2; }
+
+typedef int (*Func)();
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestSupportedSIMDLevel) {
+  CPUFeatures features;
+  BOOST_CHECK(GetSupportedSIMDLevel(features) == SIMDLevel::BASELINE);
+  features.avx2 = true;
+  BOOST_CHECK(GetSupportedSIMDLevel(features) == SIMDLevel::BASELINE);
+  features.fma = true;
+  BOOST_CHECK(GetSupportedSIMDLevel(features) == SIMDLevel::AVX2);
+  features.avx512f = true;
+  features.avx512bw = true;
+  features.avx512dq = true;
+  BOOST_CHECK(GetSupportedSIMDLevel(features) == SIMDLevel::AVX2);
+  features.avx512vl = true;
+  BOOST_CHECK(GetSupportedSIMDLevel(features) == SIMDLevel::AVX512);
+}
+
+BOOST_AUTO_TEST_CASE(TestGetSIMDLevel) {
+  const CPUFeatures& features = GetCPUFeatures();
+  BOOST_CHECK(GetSIMDLevel() <= GetSupportedSIMDLevel(features));
+  BOOST_CHECK(GetSIMDLevel() == GetSIMDLevel());
+  BOOST_CHECK_EQUAL(&GetCPUFeatures(), &features);
+  if (features.avx2) {
+    BOOST_CHECK(features.avx);
+  }
+  if (features.avx512bw) {
+    BOOST_CHECK(features.avx512f);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestSelectSIMDFunction) {
+  BOOST_CHECK_EQUAL(SelectSIMDFunction<Func>(SIMDLevel::BASELINE, &Baseline,
+                                             &AVX2, &AVX512)(),
+                    0);
+  BOOST_CHECK_EQUAL(
+      SelectSIMDFunction<Func>(SIMDLevel::AVX2, &Baseline, &AVX2, &AVX512)(),
+      1);
+  BOOST_CHECK_EQUAL(SelectSIMDFunction<Func>(SIMDLevel::AVX512, &Baseline,
+                                             &AVX2, &AVX512)(),
+                    2);
+  BOOST_CHECK_EQUAL(SelectSIMDFunction<Func>(SIMDLevel::AVX512, &Baseline,
+                                             &AVX2, nullptr)(),
+                    1);
+  BOOST_CHECK_EQUAL(SelectSIMDFunction<Func>(SIMDLevel::AVX512, &Baseline,
+                                             nullptr, nullptr)(),
+                    0);
+  BOOST_CHECK_EQUAL(
+      SelectSIMDFunction<Func>(SIMDLevel::AVX2, &Baseline, nullptr, &AVX512)(),
+      0);
+  const int level = SelectSIMDFunction<Func>(&Baseline, &AVX2, &AVX512)();
+  BOOST_CHECK_EQUAL(level, static_cast<int>(GetSIMDLevel()));
+}
+
+BOOST_AUTO_TEST_CASE(TestSIMDLevelToString) {
+  BOOST_CHECK_EQUAL(SIMDLevelToString(SIMDLevel::BASELINE), "baseline");
+  BOOST_CHECK_EQUAL(SIMDLevelToString(SIMDLevel::AVX2), "avx2");
+  BOOST_CHECK_EQUAL(SIMDLevelToString(SIMDLevel::AVX512), "avx512");
+}
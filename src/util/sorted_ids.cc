@@ -0,0 +1,94 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/sorted_ids.h"
+
+#include <algorithm>
+
+namespace colmap {
+namespace {
+
+// Intersect by binary searching the elements of the shorter sequence in the
+// longer one, which is faster when the sizes are very different.
+size_t GallopingIntersectionSize(const SortedIdSpan short_ids,
+                                 const SortedIdSpan long_ids) {
+  size_t size = 0;
+  const int* it = long_ids.begin();
+  for (const int id : short_ids) {
+    it = std::lower_bound(it, long_ids.end(), id);
+    if (it == long_ids.end()) {
+      break;
+    }
+    if (*it == id) {
+      size += 1;
+      ++it;
+    }
+  }
+  return size;
+}
+
+}  // namespace
+
+size_t SortedIdIntersectionSize(const SortedIdSpan ids1,
+                                const SortedIdSpan ids2) {
+  // Ratio of the sequence sizes above which binary search beats merging.
+  const size_t kGallopingRatio = 32;
+  if (ids1.size() * kGallopingRatio < ids2.size()) {
+    return GallopingIntersectionSize(ids1, ids2);
+  } else if (ids2.size() * kGallopingRatio < ids1.size()) {
+    return GallopingIntersectionSize(ids2, ids1);
+  }
+
+  // Branch-free merge, the comparisons are hard to predict for interleaved
+  // sequences and the compiler turns this loop into conditional moves.
+  size_t size = 0;
+  size_t idx1 = 0;
+  size_t idx2 = 0;
+  while (idx1 < ids1.size() && idx2 < ids2.size()) {
+    const int id1 = ids1[idx1];
+    const int id2 = ids2[idx2];
+    size += id1 == id2;
+    idx1 += id1 <= id2;
+    idx2 += id2 <= id1;
+  }
+  return size;
+}
+
+void SortedIdUnion(const SortedIdSpan ids1, const SortedIdSpan ids2,
+                   std::vector<int>* ids) {
+  ids->resize(ids1.size() + ids2.size());
+  int* out = ids->data();
+  size_t idx1 = 0;
+  size_t idx2 = 0;
+  while (idx1 < ids1.size() && idx2 < ids2.size()) {
+    const int id1 = ids1[idx1];
+    const int id2 = ids2[idx2];
+    *out++ = id1 <= id2 ? id1 : id2;
+    idx1 += id1 <= id2;
+    idx2 += id2 <= id1;
+  }
+  out = std::copy(ids1.begin() + idx1, ids1.end(), out);
+  out = std::copy(ids2.begin() + idx2, ids2.end(), out);
+  ids->resize(out - ids->data());
+}
+
+void SortedIdUnionInPlace(const SortedIdSpan ids, std::vector<int>* sorted_ids,
+                          std::vector<int>* buffer) {
+  SortedIdUnion(*sorted_ids, ids, buffer);
+  sorted_ids->swap(*buffer);
+}
+
+}  // namespace colmap
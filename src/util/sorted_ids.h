@@ -0,0 +1,64 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_SORTED_IDS_H_
+#define COLMAP_SRC_UTIL_SORTED_IDS_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace colmap {
+
+// Non-owning view of an ascending sequence of identifiers, e.g. the tracks
+// observed by a camera. Vectors convert implicitly, so that functions taking
+// views can be called with vectors without copying them.
+class SortedIdSpan {
+ public:
+  SortedIdSpan() : data_(nullptr), size_(0) {}
+  SortedIdSpan(const int* data, const size_t size) : data_(data), size_(size) {}
+  SortedIdSpan(const std::vector<int>& ids)
+      : data_(ids.data()), size_(ids.size()) {}
+
+  inline const int* begin() const { return data_; }
+  inline const int* end() const { return data_ + size_; }
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+  inline int operator[](const size_t idx) const { return data_[idx]; }
+
+ private:
+  const int* data_;
+  size_t size_;
+};
+
+// Number of identifiers that are contained in both sequences. Identifiers that
+// occur multiple times are counted as often as they occur in both sequences.
+size_t SortedIdIntersectionSize(const SortedIdSpan ids1,
+                                const SortedIdSpan ids2);
+
+// Compute the union of both sequences, where identifiers contained in both
+// sequences are only added once. The output is overwritten and must not be
+// one of the inputs, so that its memory can be reused across calls.
+void SortedIdUnion(const SortedIdSpan ids1, const SortedIdSpan ids2,
+                   std::vector<int>* ids);
+
+// Add the identifiers of the sequence to the sorted identifiers in place,
+// using `buffer` as scratch memory that can be reused across calls.
+void SortedIdUnionInPlace(const SortedIdSpan ids, std::vector<int>* sorted_ids,
+                          std::vector<int>* buffer);
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_SORTED_IDS_H_
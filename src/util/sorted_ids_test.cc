@@ -0,0 +1,70 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/sorted_ids"
+#include "util/testing.h"
+
+#include "util/sorted_ids.h"
+
+using namespace colmap;
+
+BOOST_AUTO_TEST_CASE(TestSpan) {
+  const std::vector<int> ids = {1, 3, 5};
+  const SortedIdSpan span(ids);
+  BOOST_CHECK_EQUAL(span.size(), 3);
+  BOOST_CHECK(!span.empty());
+  BOOST_CHECK_EQUAL(span[1], 3);
+  BOOST_CHECK_EQUAL(span.begin(), ids.data());
+  BOOST_CHECK(SortedIdSpan().empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestIntersectionSize) {
+  BOOST_CHECK_EQUAL(SortedIdIntersectionSize({}, {}), 0);
+  BOOST_CHECK_EQUAL(SortedIdIntersectionSize(std::vector<int>{1, 2}, {}), 0);
+  BOOST_CHECK_EQUAL(SortedIdIntersectionSize(std::vector<int>{1, 2, 4, 7},
+                                             std::vector<int>{2, 3, 4, 8}),
+                    2);
+  BOOST_CHECK_EQUAL(SortedIdIntersectionSize(std::vector<int>{1, 1, 2},
+                                             std::vector<int>{1, 1, 1}),
+                    2);
+
+  // Very different sizes switch to binary search.
+  std::vector<int> long_ids;
+  for (int i = 0; i < 1000; ++i) {
+    long_ids.push_back(2 * i);
+  }
+  const std::vector<int> short_ids = {-1, 0, 5, 10, 10, 1998, 2000};
+  BOOST_CHECK_EQUAL(SortedIdIntersectionSize(short_ids, long_ids), 3);
+  BOOST_CHECK_EQUAL(SortedIdIntersectionSize(long_ids, short_ids), 3);
+}
+
+BOOST_AUTO_TEST_CASE(TestUnion) {
+  std::vector<int> ids = {42};
+  SortedIdUnion(std::vector<int>{1, 3, 5}, std::vector<int>{2, 3, 6, 7}, &ids);
+  BOOST_CHECK(ids == std::vector<int>({1, 2, 3, 5, 6, 7}));
+  SortedIdUnion({}, std::vector<int>{4}, &ids);
+  BOOST_CHECK(ids == std::vector<int>({4}));
+  SortedIdUnion({}, {}, &ids);
+  BOOST_CHECK(ids.empty());
+}
+
+BOOST_AUTO_TEST_CASE(TestUnionInPlace) {
+  std::vector<int> ids;
+  std::vector<int> buffer;
+  SortedIdUnionInPlace(std::vector<int>{2, 4}, &ids, &buffer);
+  SortedIdUnionInPlace(std::vector<int>{1, 4, 9}, &ids, &buffer);
+  BOOST_CHECK(ids == std::vector<int>({1, 2, 4, 9}));
+}
@@ -175,4 +175,20 @@ bool StringContains(const std::string& str, const std::string& sub_str) {
   return str.find(sub_str) != std::string::npos;
 }
 
+std::string StringEscapeJSON(const std::string& str) {
+  std::string escaped;
+  escaped.reserve(str.size());
+  for (const char c : str) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      escaped += StringPrintf("\\u%04x", static_cast<int>(c));
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
 }  // namespace colmap
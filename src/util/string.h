@@ -50,6 +50,10 @@ void StringToUpper(std::string* str);
 // Check whether the sub-string is contained in the given string.
 bool StringContains(const std::string& str, const std::string& sub_str);
 
+// Escape the quotes, backslashes and control characters of the string, such
+// that it can be embedded in a JSON string literal.
+std::string StringEscapeJSON(const std::string& str);
+
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_UTIL_STRING_H_
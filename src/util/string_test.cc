@@ -197,3 +197,11 @@ BOOST_AUTO_TEST_CASE(TestStringContains) {
   BOOST_CHECK(!StringContains("", "a"));
   BOOST_CHECK(!StringContains("ab", "c"));
 }
+
+BOOST_AUTO_TEST_CASE(TestStringEscapeJSON) {
+  BOOST_CHECK_EQUAL(StringEscapeJSON(""), "");
+  BOOST_CHECK_EQUAL(StringEscapeJSON("take1/registration"),
+                    "take1/registration");
+  BOOST_CHECK_EQUAL(StringEscapeJSON("a\"b\\c"), "a\\\"b\\\\c");
+  BOOST_CHECK_EQUAL(StringEscapeJSON("a\nb"), "a\\u000ab");
+}
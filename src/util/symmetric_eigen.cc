@@ -0,0 +1,156 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/symmetric_eigen.h"
+
+#include <algorithm>
+#include <random>
+
+#include <Eigen/Eigenvalues>
+
+#include "util/logging.h"
+
+namespace colmap {
+namespace {
+
+// Matrices smaller than this are decomposed densely, where the iterations
+// have no advantage.
+const int kMinSizeForLanczos = 256;
+
+// Residual of the Ritz pairs relative to the norm of the matrix, at which
+// the iterations are considered converged.
+const double kResidualTolerance = 1e-8;
+
+void DenseSmallestEigenvectors(const Eigen::MatrixXd& A,
+                               const int num_eigenvalues,
+                               Eigen::VectorXd* eigenvalues,
+                               Eigen::MatrixXd* eigenvectors) {
+  const Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(A);
+  *eigenvalues = solver.eigenvalues().head(num_eigenvalues);
+  *eigenvectors = solver.eigenvectors().leftCols(num_eigenvalues);
+}
+
+}  // namespace
+
+void SmallestSymmetricEigenvectors(const Eigen::MatrixXd& A,
+                                   const int num_eigenvalues,
+                                   Eigen::VectorXd* eigenvalues,
+                                   Eigen::MatrixXd* eigenvectors) {
+  CHECK_EQ(A.rows(), A.cols());
+  CHECK_GE(num_eigenvalues, 0);
+  CHECK_LE(num_eigenvalues, A.rows());
+
+  const int size = static_cast<int>(A.rows());
+  const int block_size = num_eigenvalues;
+  // Beyond this size of the Krylov subspace, the dense decomposition is
+  // cheaper than the projections of the iterations.
+  const int max_basis_size = size / 2;
+  if (num_eigenvalues == 0 || size < kMinSizeForLanczos ||
+      4 * block_size > max_basis_size) {
+    DenseSmallestEigenvectors(A, num_eigenvalues, eigenvalues, eigenvectors);
+    return;
+  }
+
+  // The infinity norm bounds the magnitude of all eigenvalues.
+  const double norm = A.cwiseAbs().rowwise().sum().maxCoeff();
+
+  // Orthonormal basis of the Krylov subspace and its product with A, which
+  // grow by one block per iteration.
+  Eigen::MatrixXd Q(size, 4 * block_size);
+  Eigen::MatrixXd AQ(size, 4 * block_size);
+  int basis_size = 0;
+
+  // Fixed seed, such that the results are reproducible.
+  std::mt19937 generator(0);
+  std::normal_distribution<double> distribution;
+  Eigen::MatrixXd block(size, block_size);
+  for (int i = 0; i < block.size(); ++i) {
+    block.data()[i] = distribution(generator);
+  }
+
+  while (true) {
+    // Orthogonalize the new block against the basis. Two passes of
+    // Gram-Schmidt keep the basis orthogonal to machine precision, which
+    // avoids the spurious copies of converged eigenvalues of basic Lanczos.
+    const int block_start = basis_size;
+    for (int i = 0; i < block.cols(); ++i) {
+      if (basis_size == Q.cols()) {
+        const int capacity = std::min(2 * basis_size, max_basis_size);
+        Q.conservativeResize(Eigen::NoChange, capacity);
+        AQ.conservativeResize(Eigen::NoChange, capacity);
+      }
+      Eigen::VectorXd vec = block.col(i);
+      const double vec_norm = vec.norm();
+      for (int pass = 0; pass < 2; ++pass) {
+        const auto basis = Q.leftCols(basis_size);
+        vec -= basis * (basis.transpose() * vec);
+      }
+      // Linearly dependent vectors do not extend the subspace.
+      const double orth_norm = vec.norm();
+      if (orth_norm <= kResidualTolerance * vec_norm) {
+        continue;
+      }
+      Q.col(basis_size) = vec / orth_norm;
+      basis_size += 1;
+    }
+
+    const int num_added = basis_size - block_start;
+    if (num_added > 0) {
+      AQ.middleCols(block_start, num_added) =
+          A * Q.middleCols(block_start, num_added);
+    }
+
+    if (basis_size >= num_eigenvalues) {
+      // Rayleigh-Ritz projection onto the current subspace.
+      const auto basis = Q.leftCols(basis_size);
+      const auto A_basis = AQ.leftCols(basis_size);
+      Eigen::MatrixXd H = basis.transpose() * A_basis;
+      H = 0.5 * (H + H.transpose()).eval();
+      const Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(H);
+      const Eigen::MatrixXd Y = solver.eigenvectors().leftCols(num_eigenvalues);
+      const Eigen::VectorXd ritz_values =
+          solver.eigenvalues().head(num_eigenvalues);
+      const Eigen::MatrixXd ritz_vectors = basis * Y;
+      const Eigen::MatrixXd residuals =
+          A_basis * Y - ritz_vectors * ritz_values.asDiagonal();
+
+      bool converged = true;
+      for (int i = 0; i < num_eigenvalues; ++i) {
+        if (residuals.col(i).norm() > kResidualTolerance * norm) {
+          converged = false;
+          break;
+        }
+      }
+
+      // An exhausted subspace is invariant, so its Ritz pairs are exact.
+      if (converged || num_added == 0) {
+        *eigenvalues = ritz_values;
+        *eigenvectors = ritz_vectors;
+        return;
+      }
+    }
+
+    if (num_added == 0 || basis_size + block_size > max_basis_size) {
+      break;
+    }
+
+    block = AQ.middleCols(block_start, num_added);
+  }
+
+  DenseSmallestEigenvectors(A, num_eigenvalues, eigenvalues, eigenvectors);
+}
+
+}  // namespace colmap
@@ -0,0 +1,39 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_SYMMETRIC_EIGEN_H_
+#define COLMAP_SRC_UTIL_SYMMETRIC_EIGEN_H_
+
+#include <Eigen/Core>
+
+namespace colmap {
+
+// Compute the `num_eigenvalues` smallest eigenvalues of the symmetric matrix
+// `A` in ascending order and the corresponding eigenvectors as columns.
+//
+// Large matrices are solved with block Lanczos iterations, which only need
+// products with `A` and converge to multiple eigenvalues up to the number of
+// requested eigenvalues, e.g. the Laplacian of a graph with several connected
+// components. Small matrices, or iterations that do not converge before the
+// Krylov subspace gets large, fall back to a full dense decomposition.
+void SmallestSymmetricEigenvectors(const Eigen::MatrixXd& A,
+                                   const int num_eigenvalues,
+                                   Eigen::VectorXd* eigenvalues,
+                                   Eigen::MatrixXd* eigenvectors);
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_SYMMETRIC_EIGEN_H_
@@ -0,0 +1,99 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/symmetric_eigen"
+#include "util/testing.h"
+
+#include <Eigen/Eigenvalues>
+
+#include "util/symmetric_eigen.h"
+
+using namespace colmap;
+
+namespace {
+
+// Laplacian of a graph with the given number of disconnected, complete
+// components with random positive edge weights.
+Eigen::MatrixXd RandomLaplacian(const int size, const int num_components) {
+  Eigen::MatrixXd W = Eigen::MatrixXd::Zero(size, size);
+  for (int i = 0; i < size; ++i) {
+    for (int j = i + 1; j < size; ++j) {
+      if (i % num_components == j % num_components) {
+        W(i, j) = W(j, i) = 1.5 + std::sin(i * 7.0 + j * 3.0);
+      }
+    }
+  }
+  Eigen::MatrixXd L = -W;
+  for (int i = 0; i < size; ++i) {
+    L(i, i) = W.row(i).sum();
+  }
+  return L;
+}
+
+void CheckEigenvectors(const Eigen::MatrixXd& A, const int num_eigenvalues) {
+  Eigen::VectorXd eigenvalues;
+  Eigen::MatrixXd eigenvectors;
+  SmallestSymmetricEigenvectors(A, num_eigenvalues, &eigenvalues,
+                                &eigenvectors);
+  BOOST_CHECK_EQUAL(eigenvalues.size(), num_eigenvalues);
+  BOOST_CHECK_EQUAL(eigenvectors.rows(), A.rows());
+  BOOST_CHECK_EQUAL(eigenvectors.cols(), num_eigenvalues);
+
+  const Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(A);
+  for (int i = 0; i < num_eigenvalues; ++i) {
+    BOOST_CHECK_SMALL(eigenvalues(i) - solver.eigenvalues()(i), 1e-6);
+    BOOST_CHECK_SMALL(
+        (A * eigenvectors.col(i) - eigenvalues(i) * eigenvectors.col(i))
+            .norm(),
+        1e-5);
+  }
+  BOOST_CHECK((eigenvectors.transpose() * eigenvectors).isApprox(
+      Eigen::MatrixXd::Identity(num_eigenvalues, num_eigenvalues), 1e-6));
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(TestEmpty) {
+  Eigen::VectorXd eigenvalues;
+  Eigen::MatrixXd eigenvectors;
+  SmallestSymmetricEigenvectors(RandomLaplacian(10, 1), 0, &eigenvalues,
+                                &eigenvectors);
+  BOOST_CHECK_EQUAL(eigenvalues.size(), 0);
+  BOOST_CHECK_EQUAL(eigenvectors.cols(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestDense) {
+  CheckEigenvectors(RandomLaplacian(20, 1), 3);
+  CheckEigenvectors(RandomLaplacian(20, 2), 20);
+}
+
+BOOST_AUTO_TEST_CASE(TestLanczos) {
+  CheckEigenvectors(RandomLaplacian(600, 1), 5);
+}
+
+BOOST_AUTO_TEST_CASE(TestLanczosMultipleEigenvalues) {
+  // The zero eigenvalue has the multiplicity of the number of components.
+  const Eigen::MatrixXd L = RandomLaplacian(600, 3);
+  CheckEigenvectors(L, 4);
+
+  Eigen::VectorXd eigenvalues;
+  Eigen::MatrixXd eigenvectors;
+  SmallestSymmetricEigenvectors(L, 4, &eigenvalues, &eigenvectors);
+  BOOST_CHECK_SMALL(eigenvalues(0), 1e-6);
+  BOOST_CHECK_SMALL(eigenvalues(1), 1e-6);
+  BOOST_CHECK_SMALL(eigenvalues(2), 1e-6);
+  BOOST_CHECK_GT(eigenvalues(3), 1);
+}
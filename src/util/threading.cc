@@ -17,6 +17,7 @@
 #include "util/threading.h"
 
 #include "util/logging.h"
+#include "util/scratch.h"
 
 namespace colmap {
 
@@ -160,6 +161,7 @@ bool Thread::CheckValidSetup() {
 void Thread::RunFunc() {
   Callback(STARTED_CALLBACK);
   Run();
+  ReleaseThreadScratchVectors();
   {
     std::unique_lock<std::mutex> lock(mutex_);
     finished_ = true;
@@ -224,6 +226,7 @@ void ThreadPool::WorkerFunc(const int index) {
       task_condition_.wait(lock,
                            [this] { return stopped_ || !tasks_.empty(); });
       if (stopped_ && tasks_.empty()) {
+        ReleaseThreadScratchVectors();
         return;
       }
       task = std::move(tasks_.front());
@@ -251,6 +254,163 @@ int ThreadPool::GetThreadIndex() {
   return thread_id_to_index_.at(GetThreadId());
 }
 
+namespace {
+
+// The scheduler and the index of the worker that runs on the current thread.
+thread_local TaskScheduler* current_scheduler = nullptr;
+thread_local int current_worker_index = -1;
+
+}  // namespace
+
+TaskScheduler::TaskScheduler(const int num_threads)
+    : num_pending_tasks_(0), stopped_(false) {
+  const int num_effective_threads = GetEffectiveNumThreads(num_threads);
+  for (int index = 0; index <= num_effective_threads; ++index) {
+    queues_.emplace_back(new TaskQueue());
+  }
+  for (int index = 0; index < num_effective_threads; ++index) {
+    workers_.emplace_back(&TaskScheduler::WorkerFunc, this, index);
+  }
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+
+  task_condition_.notify_all();
+
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+TaskScheduler& TaskScheduler::Global() {
+  static TaskScheduler scheduler;
+  return scheduler;
+}
+
+void TaskScheduler::Schedule(std::function<void()> task) {
+  // The task is counted before it is queued, so that the count never drops
+  // below zero, when the task is popped right after it is queued.
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_pending_tasks_ += 1;
+  }
+
+  // Workers push to their own queue and other threads to the shared queue.
+  const int queue_index =
+      current_scheduler == this ? current_worker_index : NumThreads();
+  {
+    TaskQueue& queue = *queues_[queue_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+  }
+
+  task_condition_.notify_one();
+}
+
+bool TaskScheduler::RunPendingTask() {
+  std::function<void()> task;
+  if (!PopTask(&task)) {
+    return false;
+  }
+  task();
+  return true;
+}
+
+bool TaskScheduler::PopTask(std::function<void()>* task) {
+  if (num_pending_tasks_ == 0) {
+    return false;
+  }
+
+  const int own_index =
+      current_scheduler == this ? current_worker_index : NumThreads();
+
+  // Pop the most recent task of the own queue.
+  {
+    TaskQueue& queue = *queues_[own_index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      *task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      num_pending_tasks_ -= 1;
+      return true;
+    }
+  }
+
+  // Steal the oldest task of the shared queue or of another worker.
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    TaskQueue& queue = *queues_[(own_index + queues_.size() - i) %
+                                queues_.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      *task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      num_pending_tasks_ -= 1;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void TaskScheduler::WorkerFunc(const int index) {
+  current_scheduler = this;
+  current_worker_index = index;
+
+  std::function<void()> task;
+  while (true) {
+    if (PopTask(&task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_condition_.wait(
+        lock, [this]() { return stopped_ || num_pending_tasks_ > 0; });
+    if (stopped_ && num_pending_tasks_ == 0) {
+      break;
+    }
+  }
+
+  ReleaseThreadScratchVectors();
+}
+
+TaskGroup::TaskGroup(TaskScheduler* scheduler)
+    : scheduler_(scheduler), num_pending_tasks_(0) {
+  CHECK_NOTNULL(scheduler_);
+}
+
+TaskGroup::~TaskGroup() { Wait(); }
+
+void TaskGroup::Wait() {
+  while (num_pending_tasks_ > 0) {
+    if (!scheduler_->RunPendingTask()) {
+      // The remaining tasks of the group run on other threads, which might
+      // spawn further tasks, so the waiting is bounded.
+      std::unique_lock<std::mutex> lock(mutex_);
+      finished_condition_.wait_for(
+          lock, std::chrono::milliseconds(1),
+          [this]() { return num_pending_tasks_ == 0; });
+    }
+  }
+
+  // Synchronize with the last finished task, which notifies under the lock,
+  // before the group can be destroyed.
+  std::lock_guard<std::mutex> lock(mutex_);
+}
+
+void TaskGroup::FinishTask() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  num_pending_tasks_ -= 1;
+  if (num_pending_tasks_ == 0) {
+    finished_condition_.notify_all();
+  }
+}
+
 int GetEffectiveNumThreads(const int num_threads) {
   int num_effective_threads = num_threads;
   if (num_threads <= 0) {
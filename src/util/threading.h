@@ -17,14 +17,21 @@
 #ifndef COLMAP_SRC_UTIL_THREADING_
 #define COLMAP_SRC_UTIL_THREADING_
 
+#include <algorithm>
 #include <atomic>
 #include <climits>
+#include <deque>
 #include <functional>
 #include <future>
+#include <iterator>
 #include <list>
+#include <memory>
 #include <queue>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
+#include "util/logging.h"
 #include "util/timer.h"
 
 namespace colmap {
@@ -234,6 +241,97 @@ class ThreadPool {
   std::unordered_map<std::thread::id, int> thread_id_to_index_;
 };
 
+// A work-stealing scheduler of tasks, whose process-wide instance is shared by
+// the parallel regions of all modules. Every worker owns a deque, to which it
+// pushes the tasks that it spawns and from which it pops its most recent task,
+// while idle workers steal the oldest tasks of other workers. Tasks spawned by
+// other threads are pushed to a shared queue. Waiting for a task group runs
+// pending tasks instead of blocking, so that tasks can spawn and wait for
+// nested tasks without oversubscribing the cores or deadlocking:
+//
+//    TaskGroup task_group;
+//    for (int i = 0; i < 10; ++i) {
+//      task_group.Run([i]() {
+//        ParallelFor(0, 100, [i](const int j) { /* Do some work */ });
+//      });
+//    }
+//    task_group.Wait();
+//
+class TaskScheduler {
+ public:
+  static const int kMaxNumThreads = -1;
+
+  explicit TaskScheduler(const int num_threads = kMaxNumThreads);
+  ~TaskScheduler();
+
+  // The process-wide scheduler with a worker per logical CPU core.
+  static TaskScheduler& Global();
+
+  inline size_t NumThreads() const;
+
+  // Schedule a task on the workers. Use a TaskGroup to wait for tasks.
+  void Schedule(std::function<void()> task);
+
+  // Run a pending task on the calling thread. Returns false if there is none.
+  bool RunPendingTask();
+
+ private:
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  bool PopTask(std::function<void()>* task);
+  void WorkerFunc(const int index);
+
+  std::vector<std::thread> workers_;
+
+  // The queues of the workers followed by the queue of the other threads.
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+
+  std::atomic<int> num_pending_tasks_;
+  std::mutex mutex_;
+  std::condition_variable task_condition_;
+  bool stopped_;
+};
+
+// A group of tasks on a scheduler, which can be waited for. The destructor
+// waits for the remaining tasks of the group.
+class TaskGroup {
+ public:
+  explicit TaskGroup(TaskScheduler* scheduler = &TaskScheduler::Global());
+  ~TaskGroup();
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  // Add new task to the group. Note that waiting for the returned future
+  // blocks the worker, as opposed to waiting for the group.
+  template <class func_t, class... args_t>
+  auto Run(func_t&& f, args_t&&... args)
+      -> std::future<typename std::result_of<func_t(args_t...)>::type>;
+
+  // Wait until all tasks of the group are finished, while running pending
+  // tasks of the scheduler on the calling thread.
+  void Wait();
+
+ private:
+  void FinishTask();
+
+  TaskScheduler* scheduler_;
+  std::atomic<int> num_pending_tasks_;
+  std::mutex mutex_;
+  std::condition_variable finished_condition_;
+};
+
+// Call func(i) for all i in [begin, end) on the scheduler, where every task
+// processes grain_size consecutive indices. The calling thread runs tasks as
+// well and the function returns when all indices are processed.
+template <typename func_t>
+void ParallelFor(const int begin, const int end, const func_t& func,
+                 const int grain_size = 1,
+                 TaskScheduler* scheduler = &TaskScheduler::Global());
+
 // A job queue class for the producer-consumer paradigm.
 //
 //    JobQueue<int> job_queue;
@@ -262,6 +360,7 @@ class JobQueue {
    public:
     Job() : valid_(false) {}
     explicit Job(const T& data) : data_(data), valid_(true) {}
+    explicit Job(T&& data) : data_(std::move(data)), valid_(true) {}
 
     // Check whether the data is valid.
     bool IsValid() const { return valid_; }
@@ -307,6 +406,112 @@ class JobQueue {
   std::condition_variable empty_condition_;
 };
 
+// A bounded job queue with the semantics of `JobQueue` for pipelines with many
+// small jobs. The jobs are stored in a lock-free ring buffer for multiple
+// producers and consumers, so that pushing and popping only take a lock if a
+// thread has to wait because the queue is full or empty. Batches of jobs are
+// pushed and popped by claiming consecutive slots at once.
+//
+//    RingJobQueue<int> job_queue(64);
+//
+//    std::thread producer_thread([&job_queue]() {
+//      const std::vector<int> jobs = {1, 2, 3};
+//      job_queue.PushBatch(jobs.begin(), jobs.end());
+//    });
+//
+//    std::thread consumer_thread([&job_queue]() {
+//      std::vector<int> jobs;
+//      while (jobs.size() < 3 && job_queue.PopBatch(3 - jobs.size(), &jobs)) {
+//        /* Do some work */
+//      }
+//    });
+//
+template <typename T>
+class RingJobQueue {
+ public:
+  typedef typename JobQueue<T>::Job Job;
+
+  static const size_t kDefaultMaxNumJobs = 1024;
+
+  RingJobQueue();
+  explicit RingJobQueue(const size_t max_num_jobs);
+  ~RingJobQueue();
+
+  // The number of pushed and not popped jobs in the queue.
+  size_t Size() const;
+
+  // Push a new job to the queue. Waits if the number of jobs is exceeded.
+  bool Push(const T& data);
+  bool Push(T&& data);
+
+  // Push the jobs in [first, last) in order, where as many jobs as fit into
+  // the queue are pushed at once. Waits if the number of jobs is exceeded.
+  template <typename Iterator>
+  bool PushBatch(Iterator first, const Iterator last);
+
+  // Pop a job from the queue. Waits if there is no job in the queue.
+  Job Pop();
+
+  // Append between one and `max_num_jobs` jobs to `jobs`. Waits if there is no
+  // job in the queue and returns false if the queue was stopped.
+  bool PopBatch(const size_t max_num_jobs, std::vector<T>* jobs);
+
+  // Wait for all jobs to be popped.
+  void Wait();
+
+  // Stop the queue and return from all push/pop calls with false.
+  void Stop();
+
+  // Clear all pushed and not popped jobs from the queue.
+  void Clear();
+
+ private:
+  // A slot of the ring buffer. Its sequence number equals the position of the
+  // next push into the slot if it is free and that position plus one if it
+  // holds a job, see "Bounded MPMC queue" by Dmitry Vyukov.
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  // Push or pop as many jobs as possible without waiting and return their
+  // number.
+  template <typename Iterator>
+  size_t TryPush(Iterator* first, const size_t num_jobs);
+  template <typename OutputIterator>
+  size_t TryPop(const size_t max_num_jobs, OutputIterator output);
+
+  // Wake the threads waiting for a pop or push, only takes the lock if there
+  // is any.
+  void NotifyPushed();
+  void NotifyPopped();
+
+  // Block until the predicate holds or the queue is stopped.
+  template <typename Predicate>
+  void WaitFor(std::condition_variable* condition,
+               std::atomic<int>* num_waiting, const Predicate& predicate);
+
+  const size_t max_num_jobs_;
+  // One slot more than jobs, so that free and filled slots are distinct.
+  const size_t num_slots_;
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<bool> stop_;
+
+  // The positions of the next push and pop on separate cache lines.
+  char pad0_[64];
+  std::atomic<size_t> push_pos_;
+  char pad1_[64];
+  std::atomic<size_t> pop_pos_;
+  char pad2_[64];
+
+  std::atomic<int> num_waiting_pushers_;
+  std::atomic<int> num_waiting_poppers_;
+  std::mutex mutex_;
+  std::condition_variable push_condition_;
+  std::condition_variable pop_condition_;
+  std::condition_variable empty_condition_;
+};
+
 // Return the number of logical CPU cores if num_threads <= 0,
 // otherwise return the input value of num_threads.
 int GetEffectiveNumThreads(const int num_threads);
@@ -340,6 +545,51 @@ auto ThreadPool::AddTask(func_t&& f, args_t&&... args)
   return result;
 }
 
+size_t TaskScheduler::NumThreads() const { return workers_.size(); }
+
+template <class func_t, class... args_t>
+auto TaskGroup::Run(func_t&& f, args_t&&... args)
+    -> std::future<typename std::result_of<func_t(args_t...)>::type> {
+  typedef typename std::result_of<func_t(args_t...)>::type return_t;
+
+  auto task = std::make_shared<std::packaged_task<return_t()>>(
+      std::bind(std::forward<func_t>(f), std::forward<args_t>(args)...));
+
+  std::future<return_t> result = task->get_future();
+
+  num_pending_tasks_ += 1;
+  scheduler_->Schedule([this, task]() {
+    (*task)();
+    FinishTask();
+  });
+
+  return result;
+}
+
+template <typename func_t>
+void ParallelFor(const int begin, const int end, const func_t& func,
+                 const int grain_size, TaskScheduler* scheduler) {
+  CHECK_GT(grain_size, 0);
+
+  if (end - begin <= grain_size || scheduler->NumThreads() == 0) {
+    for (int i = begin; i < end; ++i) {
+      func(i);
+    }
+    return;
+  }
+
+  TaskGroup task_group(scheduler);
+  for (int chunk_begin = begin; chunk_begin < end; chunk_begin += grain_size) {
+    const int chunk_end = std::min(end, chunk_begin + grain_size);
+    task_group.Run([&func, chunk_begin, chunk_end]() {
+      for (int i = chunk_begin; i < chunk_end; ++i) {
+        func(i);
+      }
+    });
+  }
+  task_group.Wait();
+}
+
 template <typename T>
 JobQueue<T>::JobQueue() : JobQueue(std::numeric_limits<size_t>::max()) {}
 
@@ -414,6 +664,238 @@ void JobQueue<T>::Clear() {
   std::swap(jobs_, empty_jobs);
 }
 
+template <typename T>
+const size_t RingJobQueue<T>::kDefaultMaxNumJobs;
+
+template <typename T>
+RingJobQueue<T>::RingJobQueue() : RingJobQueue(kDefaultMaxNumJobs) {}
+
+template <typename T>
+RingJobQueue<T>::RingJobQueue(const size_t max_num_jobs)
+    : max_num_jobs_(max_num_jobs),
+      num_slots_(max_num_jobs + 1),
+      slots_(new Slot[max_num_jobs + 1]),
+      stop_(false),
+      push_pos_(0),
+      pop_pos_(0),
+      num_waiting_pushers_(0),
+      num_waiting_poppers_(0) {
+  CHECK_GT(max_num_jobs_, 0);
+  for (size_t i = 0; i < num_slots_; ++i) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+template <typename T>
+RingJobQueue<T>::~RingJobQueue() {
+  Stop();
+}
+
+template <typename T>
+size_t RingJobQueue<T>::Size() const {
+  const size_t pop_pos = pop_pos_.load();
+  const size_t push_pos = push_pos_.load();
+  return push_pos > pop_pos ? push_pos - pop_pos : 0;
+}
+
+template <typename T>
+bool RingJobQueue<T>::Push(const T& data) {
+  const T* first = &data;
+  return PushBatch(first, first + 1);
+}
+
+template <typename T>
+bool RingJobQueue<T>::Push(T&& data) {
+  T* first = &data;
+  return PushBatch(std::make_move_iterator(first),
+                   std::make_move_iterator(first + 1));
+}
+
+template <typename T>
+template <typename Iterator>
+bool RingJobQueue<T>::PushBatch(Iterator first, const Iterator last) {
+  size_t num_jobs = std::distance(first, last);
+  while (num_jobs > 0) {
+    if (stop_) {
+      return false;
+    }
+    const size_t num_pushed = TryPush(&first, num_jobs);
+    if (num_pushed > 0) {
+      num_jobs -= num_pushed;
+      NotifyPushed();
+    } else {
+      WaitFor(&pop_condition_, &num_waiting_pushers_,
+              [this]() { return Size() < max_num_jobs_; });
+    }
+  }
+  return true;
+}
+
+template <typename T>
+typename RingJobQueue<T>::Job RingJobQueue<T>::Pop() {
+  while (!stop_) {
+    T data;
+    if (TryPop(1, &data) > 0) {
+      NotifyPopped();
+      return Job(std::move(data));
+    }
+    WaitFor(&push_condition_, &num_waiting_poppers_,
+            [this]() { return Size() > 0; });
+  }
+  return Job();
+}
+
+template <typename T>
+bool RingJobQueue<T>::PopBatch(const size_t max_num_jobs,
+                               std::vector<T>* jobs) {
+  CHECK_GT(max_num_jobs, 0);
+  while (!stop_) {
+    if (TryPop(max_num_jobs, std::back_inserter(*jobs)) > 0) {
+      NotifyPopped();
+      return true;
+    }
+    WaitFor(&push_condition_, &num_waiting_poppers_,
+            [this]() { return Size() > 0; });
+  }
+  return false;
+}
+
+template <typename T>
+void RingJobQueue<T>::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  num_waiting_pushers_ += 1;
+  empty_condition_.wait(lock, [this]() { return Size() == 0; });
+  num_waiting_pushers_ -= 1;
+}
+
+template <typename T>
+void RingJobQueue<T>::Stop() {
+  stop_ = true;
+  std::unique_lock<std::mutex> lock(mutex_);
+  push_condition_.notify_all();
+  pop_condition_.notify_all();
+  empty_condition_.notify_all();
+}
+
+template <typename T>
+void RingJobQueue<T>::Clear() {
+  T data;
+  while (TryPop(1, &data) > 0) {
+  }
+  NotifyPopped();
+}
+
+template <typename T>
+template <typename Iterator>
+size_t RingJobQueue<T>::TryPush(Iterator* first, const size_t num_jobs) {
+  size_t pos = push_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    const size_t pop_pos = pop_pos_.load();
+    const size_t num_queued = pos > pop_pos ? pos - pop_pos : 0;
+    if (num_queued >= max_num_jobs_) {
+      return 0;
+    }
+
+    // Count the free slots from the current position on.
+    const size_t max_num_free = std::min(num_jobs, max_num_jobs_ - num_queued);
+    size_t num_free = 0;
+    while (num_free < max_num_free) {
+      const Slot& slot = slots_[(pos + num_free) % num_slots_];
+      if (slot.sequence.load(std::memory_order_acquire) != pos + num_free) {
+        break;
+      }
+      num_free += 1;
+    }
+
+    if (num_free == 0) {
+      const size_t sequence =
+          slots_[pos % num_slots_].sequence.load(std::memory_order_acquire);
+      if (static_cast<std::ptrdiff_t>(sequence - pos) < 0) {
+        // The slot still holds the job of the previous round.
+        return 0;
+      }
+      // Another producer has claimed the slot.
+      pos = push_pos_.load(std::memory_order_relaxed);
+    } else if (push_pos_.compare_exchange_weak(pos, pos + num_free)) {
+      for (size_t i = 0; i < num_free; ++i, ++*first) {
+        Slot& slot = slots_[(pos + i) % num_slots_];
+        slot.data = **first;
+        slot.sequence.store(pos + i + 1, std::memory_order_release);
+      }
+      return num_free;
+    }
+  }
+}
+
+template <typename T>
+template <typename OutputIterator>
+size_t RingJobQueue<T>::TryPop(const size_t max_num_jobs,
+                               OutputIterator output) {
+  size_t pos = pop_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    // Count the filled slots from the current position on.
+    size_t num_filled = 0;
+    while (num_filled < max_num_jobs) {
+      const Slot& slot = slots_[(pos + num_filled) % num_slots_];
+      if (slot.sequence.load(std::memory_order_acquire) !=
+          pos + num_filled + 1) {
+        break;
+      }
+      num_filled += 1;
+    }
+
+    if (num_filled == 0) {
+      const size_t sequence =
+          slots_[pos % num_slots_].sequence.load(std::memory_order_acquire);
+      if (static_cast<std::ptrdiff_t>(sequence - (pos + 1)) < 0) {
+        // The slot is empty or its job is still being written.
+        return 0;
+      }
+      // Another consumer has claimed the slot.
+      pos = pop_pos_.load(std::memory_order_relaxed);
+    } else if (pop_pos_.compare_exchange_weak(pos, pos + num_filled)) {
+      for (size_t i = 0; i < num_filled; ++i, ++output) {
+        Slot& slot = slots_[(pos + i) % num_slots_];
+        *output = std::move(slot.data);
+        // Release the resources of the job before the slot is reused.
+        slot.data = T();
+        slot.sequence.store(pos + i + num_slots_, std::memory_order_release);
+      }
+      return num_filled;
+    }
+  }
+}
+
+template <typename T>
+void RingJobQueue<T>::NotifyPushed() {
+  if (num_waiting_poppers_ > 0) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    push_condition_.notify_all();
+  }
+}
+
+template <typename T>
+void RingJobQueue<T>::NotifyPopped() {
+  if (num_waiting_pushers_ > 0) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    pop_condition_.notify_all();
+    empty_condition_.notify_all();
+  }
+}
+
+template <typename T>
+template <typename Predicate>
+void RingJobQueue<T>::WaitFor(std::condition_variable* condition,
+                              std::atomic<int>* num_waiting,
+                              const Predicate& predicate) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // The waiting count is raised before the predicate is checked, so that a
+  // concurrent push or pop either makes the predicate hold or notifies.
+  *num_waiting += 1;
+  condition->wait(lock, [this, &predicate]() { return stop_ || predicate(); });
+  *num_waiting -= 1;
+}
+
 }  // namespace colmap
 
 #endif  // COLMAP_SRC_UTIL_THREADING_
@@ -17,6 +17,9 @@
 #define TEST_NAME "util/threading"
 #include "util/testing.h"
 
+#include <memory>
+#include <numeric>
+
 #include "util/logging.h"
 #include "util/threading.h"
 
@@ -855,6 +858,187 @@ BOOST_AUTO_TEST_CASE(TestJobQueueClear) {
   BOOST_CHECK_EQUAL(job_queue.Size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(TestRingJobQueueSingleProducerSingleConsumer) {
+  RingJobQueue<int> job_queue(2);
+
+  std::thread producer_thread([&job_queue]() {
+    for (int i = 0; i < 10; ++i) {
+      CHECK(job_queue.Push(i));
+    }
+  });
+
+  std::thread consumer_thread([&job_queue]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK_EQ(job_queue.Size(), 2);
+    for (int i = 0; i < 10; ++i) {
+      const auto job = job_queue.Pop();
+      CHECK(job.IsValid());
+      CHECK_EQ(job.Data(), i);
+    }
+  });
+
+  producer_thread.join();
+  consumer_thread.join();
+}
+
+BOOST_AUTO_TEST_CASE(TestRingJobQueueMultipleProducerMultipleConsumer) {
+  RingJobQueue<int> job_queue(3);
+
+  const int kNumThreads = 4;
+  const int kNumJobs = 10000;
+
+  std::vector<std::thread> producer_threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    producer_threads.emplace_back([&job_queue]() {
+      for (int i = 1; i <= kNumJobs; ++i) {
+        CHECK(job_queue.Push(i));
+      }
+    });
+  }
+
+  std::atomic<int64_t> sum(0);
+  std::vector<std::thread> consumer_threads;
+  for (int t = 0; t < kNumThreads; ++t) {
+    consumer_threads.emplace_back([&job_queue, &sum]() {
+      for (int i = 0; i < kNumJobs; ++i) {
+        const auto job = job_queue.Pop();
+        CHECK(job.IsValid());
+        CHECK_LE(job.Data(), kNumJobs);
+        sum += job.Data();
+      }
+    });
+  }
+
+  for (auto& thread : producer_threads) {
+    thread.join();
+  }
+  for (auto& thread : consumer_threads) {
+    thread.join();
+  }
+
+  BOOST_CHECK_EQUAL(sum, int64_t(kNumThreads) * kNumJobs * (kNumJobs + 1) / 2);
+  BOOST_CHECK_EQUAL(job_queue.Size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestRingJobQueueBatch) {
+  RingJobQueue<int> job_queue(4);
+
+  std::thread producer_thread([&job_queue]() {
+    std::vector<int> jobs(10);
+    std::iota(jobs.begin(), jobs.end(), 0);
+    CHECK(job_queue.PushBatch(jobs.begin(), jobs.end()));
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  BOOST_CHECK_EQUAL(job_queue.Size(), 4);
+
+  std::vector<int> jobs;
+  BOOST_CHECK(job_queue.PopBatch(3, &jobs));
+  BOOST_CHECK_EQUAL(jobs.size(), 3);
+  while (jobs.size() < 10) {
+    BOOST_CHECK(job_queue.PopBatch(10 - jobs.size(), &jobs));
+  }
+  for (int i = 0; i < 10; ++i) {
+    BOOST_CHECK_EQUAL(jobs[i], i);
+  }
+
+  producer_thread.join();
+}
+
+BOOST_AUTO_TEST_CASE(TestRingJobQueueMove) {
+  RingJobQueue<std::unique_ptr<int>> job_queue(1);
+  BOOST_CHECK(job_queue.Push(std::unique_ptr<int>(new int(1))));
+  auto job = job_queue.Pop();
+  BOOST_CHECK(job.IsValid());
+  BOOST_CHECK_EQUAL(*job.Data(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(TestRingJobQueueWait) {
+  RingJobQueue<int> job_queue;
+
+  std::thread producer_thread([&job_queue]() {
+    for (int i = 0; i < 10; ++i) {
+      CHECK(job_queue.Push(i));
+    }
+  });
+
+  std::thread consumer_thread([&job_queue]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK_EQ(job_queue.Size(), 10);
+    for (int i = 0; i < 10; ++i) {
+      const auto job = job_queue.Pop();
+      CHECK(job.IsValid());
+      CHECK_EQ(job.Data(), i);
+    }
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  job_queue.Wait();
+
+  BOOST_CHECK_EQUAL(job_queue.Size(), 0);
+  BOOST_CHECK(job_queue.Push(0));
+  BOOST_CHECK(job_queue.Pop().IsValid());
+
+  producer_thread.join();
+  consumer_thread.join();
+}
+
+BOOST_AUTO_TEST_CASE(TestRingJobQueueStopProducer) {
+  RingJobQueue<int> job_queue(1);
+
+  std::thread producer_thread([&job_queue]() {
+    CHECK(job_queue.Push(0));
+    CHECK(!job_queue.Push(0));
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  BOOST_CHECK_EQUAL(job_queue.Size(), 1);
+
+  job_queue.Stop();
+  producer_thread.join();
+
+  BOOST_CHECK(!job_queue.Push(0));
+  BOOST_CHECK(!job_queue.Pop().IsValid());
+}
+
+BOOST_AUTO_TEST_CASE(TestRingJobQueueStopConsumer) {
+  RingJobQueue<int> job_queue(1);
+
+  BOOST_CHECK(job_queue.Push(0));
+
+  std::thread consumer_thread([&job_queue]() {
+    const auto job = job_queue.Pop();
+    CHECK(job.IsValid());
+    CHECK_EQ(job.Data(), 0);
+    CHECK(!job_queue.Pop().IsValid());
+    std::vector<int> jobs;
+    CHECK(!job_queue.PopBatch(1, &jobs));
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  BOOST_CHECK_EQUAL(job_queue.Size(), 0);
+
+  job_queue.Stop();
+  consumer_thread.join();
+
+  BOOST_CHECK(!job_queue.Push(0));
+  BOOST_CHECK(!job_queue.Pop().IsValid());
+}
+
+BOOST_AUTO_TEST_CASE(TestRingJobQueueClear) {
+  RingJobQueue<int> job_queue(2);
+
+  BOOST_CHECK(job_queue.Push(0));
+  BOOST_CHECK(job_queue.Push(1));
+  BOOST_CHECK_EQUAL(job_queue.Size(), 2);
+
+  job_queue.Clear();
+  BOOST_CHECK_EQUAL(job_queue.Size(), 0);
+  BOOST_CHECK(job_queue.Push(2));
+  BOOST_CHECK_EQUAL(job_queue.Pop().Data(), 2);
+}
+
 BOOST_AUTO_TEST_CASE(TestGetEffectiveNumThreads) {
   BOOST_CHECK_GT(GetEffectiveNumThreads(-2), 0);
   BOOST_CHECK_GT(GetEffectiveNumThreads(-1), 0);
@@ -863,3 +1047,86 @@ BOOST_AUTO_TEST_CASE(TestGetEffectiveNumThreads) {
   BOOST_CHECK_EQUAL(GetEffectiveNumThreads(2), 2);
   BOOST_CHECK_EQUAL(GetEffectiveNumThreads(3), 3);
 }
+
+BOOST_AUTO_TEST_CASE(TestTaskGroup) {
+  TaskScheduler scheduler(4);
+  BOOST_CHECK_EQUAL(scheduler.NumThreads(), 4);
+
+  std::atomic<int> num_tasks(0);
+  TaskGroup task_group(&scheduler);
+  std::vector<std::future<int>> futures;
+  for (int i = 0; i < 100; ++i) {
+    futures.push_back(task_group.Run([&num_tasks](const int i) {
+      num_tasks += 1;
+      return i;
+    }, i));
+  }
+  task_group.Wait();
+
+  BOOST_CHECK_EQUAL(num_tasks, 100);
+  for (int i = 0; i < 100; ++i) {
+    BOOST_CHECK_EQUAL(futures[i].get(), i);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestTaskGroupNested) {
+  // Every task waits for nested tasks, which would deadlock a thread pool
+  // with fewer workers than waiting tasks.
+  TaskScheduler scheduler(2);
+
+  std::atomic<int> num_tasks(0);
+  TaskGroup task_group(&scheduler);
+  for (int i = 0; i < 10; ++i) {
+    task_group.Run([&scheduler, &num_tasks]() {
+      TaskGroup nested_task_group(&scheduler);
+      for (int j = 0; j < 10; ++j) {
+        nested_task_group.Run([&num_tasks]() { num_tasks += 1; });
+      }
+      nested_task_group.Wait();
+    });
+  }
+  task_group.Wait();
+
+  BOOST_CHECK_EQUAL(num_tasks, 100);
+}
+
+BOOST_AUTO_TEST_CASE(TestParallelFor) {
+  TaskScheduler scheduler(4);
+
+  for (const int grain_size : {1, 3, 7, 1000}) {
+    std::vector<int> values(100, 0);
+    ParallelFor(0, 100, [&values](const int i) { values[i] += i; },
+                grain_size, &scheduler);
+    for (int i = 0; i < 100; ++i) {
+      BOOST_CHECK_EQUAL(values[i], i);
+    }
+  }
+
+  std::vector<std::atomic<int>> counts(20);
+  for (auto& count : counts) {
+    count = 0;
+  }
+  ParallelFor(0, 20, [&counts, &scheduler](const int i) {
+    ParallelFor(0, 20, [&counts, i](const int j) { counts[i] += j; }, 2,
+                &scheduler);
+  }, 1, &scheduler);
+  for (const auto& count : counts) {
+    BOOST_CHECK_EQUAL(count, 190);
+  }
+
+  // The process-wide scheduler.
+  std::atomic<int> sum(0);
+  ParallelFor(0, 10, [&sum](const int i) { sum += i; });
+  BOOST_CHECK_EQUAL(sum, 45);
+}
+
+BOOST_AUTO_TEST_CASE(TestTaskSchedulerDestructor) {
+  std::atomic<int> num_tasks(0);
+  {
+    TaskScheduler scheduler(2);
+    for (int i = 0; i < 100; ++i) {
+      scheduler.Schedule([&num_tasks]() { num_tasks += 1; });
+    }
+  }
+  BOOST_CHECK_EQUAL(num_tasks, 100);
+}
@@ -0,0 +1,206 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "util/trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+#include "util/logging.h"
+#include "util/misc.h"
+#include "util/string.h"
+#include "util/threading.h"
+
+namespace colmap {
+namespace internal {
+
+std::atomic<bool> tracing_enabled(false);
+
+}  // namespace internal
+
+namespace {
+
+typedef std::chrono::steady_clock TraceClock;
+
+struct TraceBuffer {
+  TraceBuffer(const int thread_idx, const size_t max_num_events)
+      : thread_idx(thread_idx), events(max_num_events), num_events(0) {}
+
+  const int thread_idx;
+  std::vector<TraceEvent> events;
+  // Total number of recorded events, which can exceed the buffer size.
+  std::atomic<size_t> num_events;
+};
+
+// The buffers are never freed, so that events of exited threads survive and
+// the thread-local pointers to the buffers always remain valid.
+struct TraceRegistry {
+  std::mutex mutex;
+  size_t max_num_events = 1 << 16;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+};
+
+TraceRegistry& GetTraceRegistry() {
+  static TraceRegistry registry;
+  return registry;
+}
+
+thread_local TraceBuffer* thread_trace_buffer = nullptr;
+
+TraceBuffer* GetThreadTraceBuffer() {
+  if (thread_trace_buffer == nullptr) {
+    TraceRegistry& registry = GetTraceRegistry();
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    registry.buffers.emplace_back(new TraceBuffer(
+        static_cast<int>(registry.buffers.size()), registry.max_num_events));
+    thread_trace_buffer = registry.buffers.back().get();
+  }
+  return thread_trace_buffer;
+}
+
+}  // namespace
+
+namespace internal {
+
+uint64_t TraceNowNs() {
+  static const TraceClock::time_point epoch = TraceClock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             TraceClock::now() - epoch)
+      .count();
+}
+
+void RecordTraceEvent(const char* name, const uint64_t begin_ns,
+                      const uint64_t end_ns) {
+  TraceBuffer* buffer = GetThreadTraceBuffer();
+  const size_t event_idx = buffer->num_events.load(std::memory_order_relaxed);
+  TraceEvent& event = buffer->events[event_idx % buffer->events.size()];
+  event.name = name;
+  event.begin_ns = begin_ns;
+  event.end_ns = end_ns;
+  buffer->num_events.store(event_idx + 1, std::memory_order_release);
+}
+
+}  // namespace internal
+
+void EnableTracing(const size_t max_num_events) {
+  CHECK_GT(max_num_events, 0);
+  TraceRegistry& registry = GetTraceRegistry();
+  {
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    // Only affects the buffers of threads without any recorded events yet.
+    registry.max_num_events = max_num_events;
+  }
+  internal::TraceNowNs();
+  internal::tracing_enabled.store(true);
+}
+
+void DisableTracing() { internal::tracing_enabled.store(false); }
+
+void ClearTrace() {
+  TraceRegistry& registry = GetTraceRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  for (auto& buffer : registry.buffers) {
+    buffer->num_events.store(0);
+  }
+}
+
+std::vector<TraceThreadEvents> GetTraceEvents() {
+  TraceRegistry& registry = GetTraceRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+
+  std::vector<TraceThreadEvents> thread_events;
+  thread_events.reserve(registry.buffers.size());
+  for (const auto& buffer : registry.buffers) {
+    const size_t num_events =
+        buffer->num_events.load(std::memory_order_acquire);
+    if (num_events == 0) {
+      continue;
+    }
+
+    thread_events.emplace_back();
+    TraceThreadEvents& events = thread_events.back();
+    events.thread_idx = buffer->thread_idx;
+
+    const size_t buffer_size = buffer->events.size();
+    if (num_events <= buffer_size) {
+      events.events.assign(buffer->events.begin(),
+                           buffer->events.begin() + num_events);
+    } else {
+      // The oldest event in the ring buffer follows the newest event.
+      const size_t oldest_idx = num_events % buffer_size;
+      events.events.reserve(buffer_size);
+      events.events.insert(events.events.end(),
+                           buffer->events.begin() + oldest_idx,
+                           buffer->events.end());
+      events.events.insert(events.events.end(), buffer->events.begin(),
+                           buffer->events.begin() + oldest_idx);
+      events.num_dropped_events = num_events - buffer_size;
+    }
+  }
+
+  return thread_events;
+}
+
+bool WriteChromeTrace(const std::string& path) {
+  std::ofstream file(path, std::ios::trunc);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  file << "{\"traceEvents\":[";
+
+  bool first_event = true;
+  const auto WriteSeparator = [&]() {
+    if (!first_event) {
+      file << ",";
+    }
+    file << "\n";
+    first_event = false;
+  };
+
+  for (const auto& thread_events : GetTraceEvents()) {
+    WriteSeparator();
+    file << StringPrintf(
+        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+        "\"args\":{\"name\":\"Thread %d\"}}",
+        thread_events.thread_idx, thread_events.thread_idx);
+
+    if (thread_events.num_dropped_events > 0) {
+      std::cout << StringPrintf(
+                       "WARNING: Dropped %d oldest trace events of thread %d",
+                       static_cast<int>(thread_events.num_dropped_events),
+                       thread_events.thread_idx)
+                << std::endl;
+    }
+
+    for (const auto& event : thread_events.events) {
+      WriteSeparator();
+      file << StringPrintf(
+          "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+          "\"pid\":0,\"tid\":%d}",
+          StringEscapeJSON(event.name).c_str(), event.begin_ns / 1e3,
+          (event.end_ns - event.begin_ns) / 1e3, thread_events.thread_idx);
+    }
+  }
+
+  file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+  return file.good();
+}
+
+}  // namespace colmap
@@ -0,0 +1,156 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLMAP_SRC_UTIL_TRACE_H_
+#define COLMAP_SRC_UTIL_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "util/perf_counters.h"
+
+namespace colmap {
+
+// Low-overhead tracing of hierarchical scopes, e.g. for hot paths of long
+// running reconstructions. Every thread records its completed scopes into its
+// own fixed-size ring buffer without any locking. Once a buffer is full, the
+// oldest events of that thread are overwritten. Nested scopes of a thread are
+// reconstructed from their time intervals by the trace viewer.
+//
+// Tracing is disabled at runtime until `EnableTracing` is called, in which case
+// a scope costs a single relaxed atomic load. If `TRACING_ENABLED` is not
+// defined at compile time, `TRACE_SCOPE` expands to nothing. The scopes also
+// count the hardware performance counters of their thread, while these are
+// enabled, see `EnablePerfCounters`.
+//
+// Example usage:
+//
+//    EnableTracing();
+//    {
+//      TRACE_SCOPE("BundleAdjustment");
+//      ...
+//    }
+//    WriteChromeTrace("trace.json");
+//
+#ifdef TRACING_ENABLED
+#define TRACE_SCOPE(name) \
+  ::colmap::TraceScope TRACE_SCOPE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
+
+#define TRACE_SCOPE_CONCAT_(a, b) a##b
+#define TRACE_SCOPE_CONCAT(a, b) TRACE_SCOPE_CONCAT_(a, b)
+
+struct TraceEvent {
+  // Name of the scope, which must have static storage duration.
+  const char* name = nullptr;
+  // Begin and end of the scope in nanoseconds since tracing was enabled.
+  uint64_t begin_ns = 0;
+  uint64_t end_ns = 0;
+};
+
+struct TraceThreadEvents {
+  // Sequential identifier of the thread in the order of its first event.
+  int thread_idx = -1;
+  // Recorded events in the order of their completion.
+  std::vector<TraceEvent> events;
+  // Number of events that were overwritten in the ring buffer.
+  size_t num_dropped_events = 0;
+};
+
+// Enable the recording of trace events. The ring buffer of every thread holds
+// up to `max_num_events` events, where each event occupies 24 bytes.
+void EnableTracing(const size_t max_num_events = 1 << 16);
+void DisableTracing();
+
+// Discard all recorded events.
+void ClearTrace();
+
+// Collect the recorded events of all threads, including threads that have
+// already exited. Scopes that are still open are not included. The events are
+// only consistent, if no thread records events concurrently.
+std::vector<TraceThreadEvents> GetTraceEvents();
+
+// Write the recorded events in the Chrome trace event JSON format, which can be
+// loaded in chrome://tracing or https://ui.perfetto.dev.
+bool WriteChromeTrace(const std::string& path);
+
+namespace internal {
+
+extern std::atomic<bool> tracing_enabled;
+
+uint64_t TraceNowNs();
+void RecordTraceEvent(const char* name, const uint64_t begin_ns,
+                      const uint64_t end_ns);
+
+}  // namespace internal
+
+inline bool IsTracingEnabled() {
+  return internal::tracing_enabled.load(std::memory_order_relaxed);
+}
+
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name);
+  ~TraceScope();
+
+ private:
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+  const char* name_;
+  bool record_event_;
+  bool count_perf_;
+  uint64_t begin_ns_;
+  int64_t begin_perf_counters_[internal::kNumPerfCounters];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Implementation
+////////////////////////////////////////////////////////////////////////////////
+
+inline TraceScope::TraceScope(const char* name)
+    : name_(name), record_event_(false), count_perf_(false), begin_ns_(0) {
+  if (IsTracingEnabled()) {
+    record_event_ = true;
+    begin_ns_ = internal::TraceNowNs();
+  }
+  // The counters are read last and first, so that they do not count the
+  // recording of the event.
+  if (ArePerfCountersEnabled()) {
+    count_perf_ = internal::ReadPerfCounters(begin_perf_counters_);
+  }
+}
+
+inline TraceScope::~TraceScope() {
+  if (count_perf_) {
+    int64_t end_perf_counters[internal::kNumPerfCounters];
+    if (internal::ReadPerfCounters(end_perf_counters)) {
+      internal::RecordPerfCounters(name_, begin_perf_counters_,
+                                   end_perf_counters);
+    }
+  }
+  if (record_event_) {
+    internal::RecordTraceEvent(name_, begin_ns_, internal::TraceNowNs());
+  }
+}
+
+}  // namespace colmap
+
+#endif  // COLMAP_SRC_UTIL_TRACE_H_
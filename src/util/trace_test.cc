@@ -0,0 +1,131 @@
+// COLMAP - Structure-from-Motion and Multi-View Stereo.
+// Copyright (C) 2017  Johannes L. Schoenberger <jsch at inf.ethz.ch>
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define TEST_NAME "util/trace"
+#include "util/testing.h"
+
+#include <thread>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "util/trace.h"
+
+using namespace colmap;
+
+BOOST_AUTO_TEST_CASE(TestDisabled) {
+  ClearTrace();
+  DisableTracing();
+  BOOST_CHECK(!IsTracingEnabled());
+  { TraceScope scope("Disabled"); }
+  BOOST_CHECK_EQUAL(GetTraceEvents().size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(TestNestedScopes) {
+  ClearTrace();
+  EnableTracing();
+  BOOST_CHECK(IsTracingEnabled());
+  {
+    TraceScope outer_scope("Outer");
+    { TraceScope inner_scope("Inner"); }
+  }
+  DisableTracing();
+
+  const auto thread_events = GetTraceEvents();
+  BOOST_CHECK_EQUAL(thread_events.size(), 1);
+  BOOST_CHECK_EQUAL(thread_events[0].num_dropped_events, 0);
+  const auto& events = thread_events[0].events;
+  BOOST_CHECK_EQUAL(events.size(), 2);
+  BOOST_CHECK_EQUAL(std::string(events[0].name), "Inner");
+  BOOST_CHECK_EQUAL(std::string(events[1].name), "Outer");
+  BOOST_CHECK_LE(events[1].begin_ns, events[0].begin_ns);
+  BOOST_CHECK_LE(events[0].begin_ns, events[0].end_ns);
+  BOOST_CHECK_LE(events[0].end_ns, events[1].end_ns);
+}
+
+BOOST_AUTO_TEST_CASE(TestMultipleThreads) {
+  ClearTrace();
+  EnableTracing();
+  std::thread thread1([]() { TraceScope scope("Thread1"); });
+  std::thread thread2([]() { TraceScope scope("Thread2"); });
+  thread1.join();
+  thread2.join();
+  DisableTracing();
+
+  // The events of exited threads are retained.
+  const auto thread_events = GetTraceEvents();
+  BOOST_CHECK_EQUAL(thread_events.size(), 2);
+  BOOST_CHECK_NE(thread_events[0].thread_idx, thread_events[1].thread_idx);
+  for (const auto& events : thread_events) {
+    BOOST_CHECK_EQUAL(events.events.size(), 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestRingBuffer) {
+  ClearTrace();
+  EnableTracing(4);
+  std::thread thread([]() {
+    const char* kNames[] = {"0", "1", "2", "3", "4", "5"};
+    for (const char* name : kNames) {
+      TraceScope scope(name);
+    }
+  });
+  thread.join();
+  DisableTracing();
+  EnableTracing();
+  DisableTracing();
+
+  const auto thread_events = GetTraceEvents();
+  BOOST_CHECK_EQUAL(thread_events.size(), 1);
+  BOOST_CHECK_EQUAL(thread_events[0].num_dropped_events, 2);
+  const auto& events = thread_events[0].events;
+  BOOST_CHECK_EQUAL(events.size(), 4);
+  for (size_t i = 0; i < events.size(); ++i) {
+    BOOST_CHECK_EQUAL(std::string(events[i].name), std::to_string(i + 2));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TestWriteChromeTrace) {
+  ClearTrace();
+  EnableTracing();
+  {
+    TraceScope outer_scope("Outer");
+    { TraceScope inner_scope("Inner \"quoted\""); }
+  }
+  DisableTracing();
+
+  const std::string path =
+      (boost::filesystem::temp_directory_path() /
+       boost::filesystem::unique_path("trace_test_%%%%%%%%.json"))
+          .string();
+  BOOST_CHECK(WriteChromeTrace(path));
+
+  boost::property_tree::ptree tree;
+  boost::property_tree::read_json(path, tree);
+  std::vector<std::string> names;
+  for (const auto& event : tree.get_child("traceEvents")) {
+    if (event.second.get<std::string>("ph") == "X") {
+      names.push_back(event.second.get<std::string>("name"));
+      BOOST_CHECK_GE(event.second.get<double>("dur"), 0);
+    }
+  }
+  BOOST_CHECK_EQUAL(names.size(), 2);
+  BOOST_CHECK_EQUAL(names[0], "Inner \"quoted\"");
+  BOOST_CHECK_EQUAL(names[1], "Outer");
+
+  boost::filesystem::remove(path);
+}